@@ -21,6 +21,21 @@
 
 #include <kph.h>
 
+#define KPH_CAPTURED_INPUT_SIZE (16 * sizeof(ULONG_PTR))
+
+NTSTATUS KphpDispatchDeviceControlCall(
+    __in ULONG IoControlCode,
+    __in PVOID CapturedInput,
+    __in ULONG InputLength,
+    __in KPROCESSOR_MODE AccessMode
+    );
+
+NTSTATUS KphpDispatchBatch(
+    __in PKPH_BATCH_OPERATION Operations,
+    __in ULONG NumberOfOperations,
+    __in KPROCESSOR_MODE AccessMode
+    );
+
 NTSTATUS KphDispatchDeviceControl(
     __in PDEVICE_OBJECT DeviceObject,
     __in PIRP Irp
@@ -32,20 +47,7 @@ NTSTATUS KphDispatchDeviceControl(
     ULONG inputLength;
     ULONG ioControlCode;
     KPROCESSOR_MODE accessMode;
-    UCHAR capturedInput[16 * sizeof(ULONG_PTR)];
-    PVOID capturedInputPointer;
-
-#define VERIFY_INPUT_LENGTH \
-    do { \
-        /* Ensure at compile time that our local buffer fits this particular call. */ \
-        C_ASSERT(sizeof(*input) <= sizeof(capturedInput)); \
-        \
-        if (inputLength != sizeof(*input)) \
-        { \
-            status = STATUS_INFO_LENGTH_MISMATCH; \
-            goto ControlEnd; \
-        } \
-    } while (0)
+    UCHAR capturedInput[KPH_CAPTURED_INPUT_SIZE];
 
     stackLocation = IoGetCurrentIrpStackLocation(Irp);
     originalInput = stackLocation->Parameters.DeviceIoControl.Type3InputBuffer;
@@ -90,9 +92,167 @@ NTSTATUS KphDispatchDeviceControl(
         memcpy(capturedInput, originalInput, inputLength);
     }
 
-    capturedInputPointer = capturedInput; // avoid casting below
+    if (ioControlCode == KPH_BATCH)
+    {
+        struct
+        {
+            PKPH_BATCH_OPERATION Operations;
+            ULONG NumberOfOperations;
+        } *input = (PVOID)capturedInput;
+
+        if (inputLength != sizeof(*input))
+        {
+            status = STATUS_INFO_LENGTH_MISMATCH;
+            goto ControlEnd;
+        }
+
+        status = KphpDispatchBatch(
+            input->Operations,
+            input->NumberOfOperations,
+            accessMode
+            );
+    }
+    else
+    {
+        status = KphpDispatchDeviceControlCall(
+            ioControlCode,
+            capturedInput,
+            inputLength,
+            accessMode
+            );
+    }
+
+ControlEnd:
+    Irp->IoStatus.Status = status;
+    Irp->IoStatus.Information = 0;
+    IoCompleteRequest(Irp, IO_NO_INCREMENT);
+
+    return status;
+}
+
+/**
+ * Executes a batch of control requests.
+ *
+ * \param Operations An array of operations. The status of each operation
+ * is written back to its descriptor.
+ * \param NumberOfOperations The number of operations.
+ * \param AccessMode The mode in which to perform access checks.
+ *
+ * \return STATUS_SUCCESS if every descriptor was processed, even if some
+ * of the operations failed.
+ */
+NTSTATUS KphpDispatchBatch(
+    __in PKPH_BATCH_OPERATION Operations,
+    __in ULONG NumberOfOperations,
+    __in KPROCESSOR_MODE AccessMode
+    )
+{
+    NTSTATUS status;
+    KPH_BATCH_OPERATION operation;
+    UCHAR capturedInput[KPH_CAPTURED_INPUT_SIZE];
+    ULONG i;
+
+    if (NumberOfOperations > KPH_BATCH_MAXIMUM_OPERATIONS)
+        return STATUS_INVALID_PARAMETER_2;
+
+    if (AccessMode != KernelMode)
+    {
+        __try
+        {
+            ProbeForWrite(Operations, NumberOfOperations * sizeof(KPH_BATCH_OPERATION), sizeof(ULONG));
+        }
+        __except (EXCEPTION_EXECUTE_HANDLER)
+        {
+            return GetExceptionCode();
+        }
+    }
+
+    for (i = 0; i < NumberOfOperations; i++)
+    {
+        // Capture the descriptor and its input. The caller can change either of them
+        // at any time, so everything is read exactly once.
+        __try
+        {
+            operation = Operations[i];
+
+            if (operation.InputLength == 0)
+            {
+                status = STATUS_SUCCESS;
+            }
+            else if (operation.InputLength > sizeof(capturedInput) || !operation.Input)
+            {
+                status = STATUS_INVALID_BUFFER_SIZE;
+            }
+            else
+            {
+                if (AccessMode != KernelMode)
+                    ProbeForRead(operation.Input, operation.InputLength, sizeof(UCHAR));
+
+                memcpy(capturedInput, operation.Input, operation.InputLength);
+                status = STATUS_SUCCESS;
+            }
+        }
+        __except (EXCEPTION_EXECUTE_HANDLER)
+        {
+            return GetExceptionCode();
+        }
+
+        if (NT_SUCCESS(status))
+        {
+            // Batches cannot be nested.
+            if (operation.ControlCode == KPH_BATCH)
+            {
+                status = STATUS_INVALID_DEVICE_REQUEST;
+            }
+            else
+            {
+                status = KphpDispatchDeviceControlCall(
+                    operation.ControlCode,
+                    capturedInput,
+                    operation.InputLength,
+                    AccessMode
+                    );
+            }
+        }
 
-    switch (ioControlCode)
+        __try
+        {
+            Operations[i].Status = status;
+        }
+        __except (EXCEPTION_EXECUTE_HANDLER)
+        {
+            return GetExceptionCode();
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS KphpDispatchDeviceControlCall(
+    __in ULONG IoControlCode,
+    __in PVOID CapturedInput,
+    __in ULONG InputLength,
+    __in KPROCESSOR_MODE AccessMode
+    )
+{
+    NTSTATUS status;
+    PVOID capturedInputPointer = CapturedInput; // avoid casting below
+    ULONG inputLength = InputLength;
+    KPROCESSOR_MODE accessMode = AccessMode;
+
+#define VERIFY_INPUT_LENGTH \
+    do { \
+        /* Ensure at compile time that our local buffer fits this particular call. */ \
+        C_ASSERT(sizeof(*input) <= KPH_CAPTURED_INPUT_SIZE); \
+        \
+        if (inputLength != sizeof(*input)) \
+        { \
+            status = STATUS_INFO_LENGTH_MISMATCH; \
+            goto ControlEnd; \
+        } \
+    } while (0)
+
+    switch (IoControlCode)
     {
     case KPH_GETFEATURES:
         {
@@ -282,6 +442,29 @@ NTSTATUS KphDispatchDeviceControl(
                 );
         }
         break;
+    case KPH_READVIRTUALMEMORYSCATTER:
+        {
+            struct
+            {
+                HANDLE ProcessHandle;
+                PKPH_VM_READ_RANGE Ranges;
+                ULONG NumberOfRanges;
+                PVOID Buffer;
+                SIZE_T BufferSize;
+            } *input = capturedInputPointer;
+
+            VERIFY_INPUT_LENGTH;
+
+            status = KpiReadVirtualMemoryScatter(
+                input->ProcessHandle,
+                input->Ranges,
+                input->NumberOfRanges,
+                input->Buffer,
+                input->BufferSize,
+                accessMode
+                );
+        }
+        break;
     case KPH_QUERYINFORMATIONPROCESS:
         {
             struct
@@ -457,6 +640,50 @@ NTSTATUS KphDispatchDeviceControl(
                 );
         }
         break;
+    case KPH_ENUMERATEPROCESSES:
+        {
+            struct
+            {
+                PVOID Buffer;
+                ULONG BufferLength;
+                PULONG ReturnLength;
+            } *input = capturedInputPointer;
+
+            VERIFY_INPUT_LENGTH;
+
+            status = KpiEnumerateProcesses(
+                input->Buffer,
+                input->BufferLength,
+                input->ReturnLength,
+                accessMode
+                );
+        }
+        break;
+    case KPH_CAPTURESTACKBACKTRACEPROCESS:
+        {
+            struct
+            {
+                HANDLE ProcessHandle;
+                ULONG FramesToSkip;
+                ULONG FramesToCapture;
+                PVOID Buffer;
+                ULONG BufferLength;
+                PULONG ReturnLength;
+            } *input = capturedInputPointer;
+
+            VERIFY_INPUT_LENGTH;
+
+            status = KpiCaptureStackBackTraceProcess(
+                input->ProcessHandle,
+                input->FramesToSkip,
+                input->FramesToCapture,
+                input->Buffer,
+                input->BufferLength,
+                input->ReturnLength,
+                accessMode
+                );
+        }
+        break;
     case KPH_QUERYINFORMATIONTHREAD:
         {
             struct
@@ -522,6 +749,29 @@ NTSTATUS KphDispatchDeviceControl(
                 );
         }
         break;
+    case KPH_ENUMERATEPROCESSHANDLESEX:
+        {
+            struct
+            {
+                HANDLE ProcessHandle;
+                PKPH_HANDLE_FILTER Filter;
+                PVOID Buffer;
+                ULONG BufferLength;
+                PULONG ReturnLength;
+            } *input = capturedInputPointer;
+
+            VERIFY_INPUT_LENGTH;
+
+            status = KpiEnumerateProcessHandlesEx(
+                input->ProcessHandle,
+                input->Filter,
+                input->Buffer,
+                input->BufferLength,
+                input->ReturnLength,
+                accessMode
+                );
+        }
+        break;
     case KPH_QUERYINFORMATIONOBJECT:
         {
             struct
@@ -547,6 +797,31 @@ NTSTATUS KphDispatchDeviceControl(
                 );
         }
         break;
+    case KPH_QUERYINFORMATIONOBJECTS:
+        {
+            struct
+            {
+                HANDLE ProcessHandle;
+                PHANDLE Handles;
+                ULONG NumberOfHandles;
+                PVOID Buffer;
+                ULONG BufferLength;
+                PULONG ReturnLength;
+            } *input = capturedInputPointer;
+
+            VERIFY_INPUT_LENGTH;
+
+            status = KpiQueryInformationObjects(
+                input->ProcessHandle,
+                input->Handles,
+                input->NumberOfHandles,
+                input->Buffer,
+                input->BufferLength,
+                input->ReturnLength,
+                accessMode
+                );
+        }
+        break;
     case KPH_SETINFORMATIONOBJECT:
         {
             struct
@@ -637,15 +912,26 @@ NTSTATUS KphDispatchDeviceControl(
                 );
         }
         break;
+    case KPH_MAPEVENTRING:
+        {
+            struct
+            {
+                PVOID *BaseAddress;
+            } *input = capturedInputPointer;
+
+            VERIFY_INPUT_LENGTH;
+
+            status = KpiMapEventRing(
+                input->BaseAddress,
+                accessMode
+                );
+        }
+        break;
     default:
         status = STATUS_INVALID_DEVICE_REQUEST;
         break;
     }
 
 ControlEnd:
-    Irp->IoStatus.Status = status;
-    Irp->IoStatus.Information = 0;
-    IoCompleteRequest(Irp, IO_NO_INCREMENT);
-
     return status;
 }
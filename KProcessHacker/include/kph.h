@@ -67,6 +67,21 @@ PVOID KphGetSystemRoutineAddress(
     __in PWSTR SystemRoutineName
     );
 
+// notify
+
+VOID KphEventRingInitialization(
+    VOID
+    );
+
+VOID KphEventRingUninitialization(
+    VOID
+    );
+
+NTSTATUS KpiMapEventRing(
+    __out PVOID *BaseAddress,
+    __in KPROCESSOR_MODE AccessMode
+    );
+
 // object
 
 POBJECT_TYPE KphGetObjectType(
@@ -94,6 +109,15 @@ NTSTATUS KpiEnumerateProcessHandles(
     __in KPROCESSOR_MODE AccessMode
     );
 
+NTSTATUS KpiEnumerateProcessHandlesEx(
+    __in HANDLE ProcessHandle,
+    __in_opt PKPH_HANDLE_FILTER Filter,
+    __out_bcount(BufferLength) PVOID Buffer,
+    __in_opt ULONG BufferLength,
+    __out_opt PULONG ReturnLength,
+    __in KPROCESSOR_MODE AccessMode
+    );
+
 NTSTATUS KphQueryNameObject(
     __in PVOID Object,
     __out_bcount(BufferLength) POBJECT_NAME_INFORMATION Buffer,
@@ -118,6 +142,16 @@ NTSTATUS KpiQueryInformationObject(
     __in KPROCESSOR_MODE AccessMode
     );
 
+NTSTATUS KpiQueryInformationObjects(
+    __in HANDLE ProcessHandle,
+    __in_ecount(NumberOfHandles) PHANDLE Handles,
+    __in ULONG NumberOfHandles,
+    __out_bcount(BufferLength) PVOID Buffer,
+    __in ULONG BufferLength,
+    __out_opt PULONG ReturnLength,
+    __in KPROCESSOR_MODE AccessMode
+    );
+
 NTSTATUS KpiSetInformationObject(
     __in HANDLE ProcessHandle,
     __in HANDLE Handle,
@@ -218,6 +252,13 @@ NTSTATUS KpiSetInformationProcess(
     __in KPROCESSOR_MODE AccessMode
     );
 
+NTSTATUS KpiEnumerateProcesses(
+    __out_bcount(BufferLength) PVOID Buffer,
+    __in ULONG BufferLength,
+    __out_opt PULONG ReturnLength,
+    __in KPROCESSOR_MODE AccessMode
+    );
+
 BOOLEAN KphAcquireProcessRundownProtection(
     __in PEPROCESS Process
     );
@@ -316,6 +357,16 @@ NTSTATUS KpiCaptureStackBackTraceThread(
     __in KPROCESSOR_MODE AccessMode
     );
 
+NTSTATUS KpiCaptureStackBackTraceProcess(
+    __in HANDLE ProcessHandle,
+    __in ULONG FramesToSkip,
+    __in ULONG FramesToCapture,
+    __out_bcount(BufferLength) PVOID Buffer,
+    __in ULONG BufferLength,
+    __out_opt PULONG ReturnLength,
+    __in KPROCESSOR_MODE AccessMode
+    );
+
 NTSTATUS KpiQueryInformationThread(
     __in HANDLE ThreadHandle,
     __in KPH_THREAD_INFORMATION_CLASS ThreadInformationClass,
@@ -372,6 +423,15 @@ NTSTATUS KpiReadVirtualMemoryUnsafe(
     __in KPROCESSOR_MODE AccessMode
     );
 
+NTSTATUS KpiReadVirtualMemoryScatter(
+    __in HANDLE ProcessHandle,
+    __inout_ecount(NumberOfRanges) PKPH_VM_READ_RANGE Ranges,
+    __in ULONG NumberOfRanges,
+    __out_bcount(BufferSize) PVOID Buffer,
+    __in SIZE_T BufferSize,
+    __in KPROCESSOR_MODE AccessMode
+    );
+
 // Inline support functions
 
 FORCEINLINE VOID KphFreeCapturedUnicodeString(
@@ -290,6 +290,20 @@ ZwQueryInformationThread(
     __out_opt PULONG ReturnLength
     );
 
+NTKERNELAPI
+PUCHAR
+NTAPI
+PsGetProcessImageFileName(
+    __in PEPROCESS Process
+    );
+
+NTKERNELAPI
+NTSTATUS
+NTAPI
+PsGetProcessExitStatus(
+    __in PEPROCESS Process
+    );
+
 NTKERNELAPI
 NTSTATUS
 NTAPI
@@ -335,6 +349,12 @@ PsGetProcessJob(
     __in PEPROCESS Process
     );
 
+// MM
+
+#ifndef SEC_NO_CHANGE
+#define SEC_NO_CHANGE 0x400000
+#endif
+
 // RTL
 
 // Sensible limit that may or may not correspond to the actual Windows value.
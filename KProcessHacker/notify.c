@@ -0,0 +1,375 @@
+/*
+ * KProcessHacker
+ *
+ * Copyright (C) 2016 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The event ring is a section shared by the driver and its clients. The process, thread
+ * and image notify routines write events into it, and clients map a read-only view and
+ * read events at their own pace. Writers reserve a position by incrementing Head, write the
+ * event, and then publish it by setting its Sequence to the position plus one. While an
+ * event is being written its Sequence holds the position itself, so a reader never mistakes
+ * a partially written event for a complete one.
+ *
+ * The ring and the notify routines are only set up once the first client asks for the ring,
+ * and they stay until the driver is unloaded.
+ */
+
+#include <kph.h>
+
+VOID KphpCreateProcessNotifyRoutine(
+    __in HANDLE ParentId,
+    __in HANDLE ProcessId,
+    __in BOOLEAN Create
+    );
+
+VOID KphpCreateThreadNotifyRoutine(
+    __in HANDLE ProcessId,
+    __in HANDLE ThreadId,
+    __in BOOLEAN Create
+    );
+
+VOID KphpLoadImageNotifyRoutine(
+    __in_opt PUNICODE_STRING FullImageName,
+    __in HANDLE ProcessId,
+    __in PIMAGE_INFO ImageInfo
+    );
+
+NTSTATUS KphpStartEventRing(
+    VOID
+    );
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text(PAGE, KphEventRingInitialization)
+#pragma alloc_text(PAGE, KphEventRingUninitialization)
+#pragma alloc_text(PAGE, KphpStartEventRing)
+#pragma alloc_text(PAGE, KpiMapEventRing)
+#pragma alloc_text(PAGE, KphpCreateProcessNotifyRoutine)
+#pragma alloc_text(PAGE, KphpCreateThreadNotifyRoutine)
+#pragma alloc_text(PAGE, KphpLoadImageNotifyRoutine)
+#endif
+
+static FAST_MUTEX KphpEventRingMutex;
+static HANDLE KphpEventRingSectionHandle;
+static PVOID KphpEventRingSection;
+static PKPH_EVENT_RING KphpEventRing;
+static BOOLEAN KphpProcessNotifyRegistered;
+static BOOLEAN KphpThreadNotifyRegistered;
+static BOOLEAN KphpImageNotifyRegistered;
+
+VOID KphEventRingInitialization(
+    VOID
+    )
+{
+    PAGED_CODE();
+
+    ExInitializeFastMutex(&KphpEventRingMutex);
+}
+
+VOID KphEventRingUninitialization(
+    VOID
+    )
+{
+    PAGED_CODE();
+
+    // The removal routines wait for callbacks that are currently running.
+
+    if (KphpImageNotifyRegistered)
+        PsRemoveLoadImageNotifyRoutine(KphpLoadImageNotifyRoutine);
+    if (KphpThreadNotifyRegistered)
+        PsRemoveCreateThreadNotifyRoutine(KphpCreateThreadNotifyRoutine);
+    if (KphpProcessNotifyRegistered)
+        PsSetCreateProcessNotifyRoutine(KphpCreateProcessNotifyRoutine, TRUE);
+
+    if (KphpEventRing)
+        MmUnmapViewInSystemSpace(KphpEventRing);
+    if (KphpEventRingSection)
+        ObDereferenceObject(KphpEventRingSection);
+    if (KphpEventRingSectionHandle)
+        ZwClose(KphpEventRingSectionHandle);
+}
+
+FORCEINLINE PKPH_EVENT KphpBeginWriteEvent(
+    __out PULONG Position
+    )
+{
+    PKPH_EVENT_RING ring = KphpEventRing;
+    ULONG position;
+    PKPH_EVENT event;
+
+    position = (ULONG)InterlockedIncrement((PLONG)&ring->Head) - 1;
+    event = &ring->Entries[position & (KPH_EVENT_RING_NUMBER_OF_ENTRIES - 1)];
+
+    // Invalidate the entry before overwriting it.
+    InterlockedExchange((PLONG)&event->Sequence, (LONG)position);
+
+    KeQuerySystemTime(&event->Time);
+    event->ParentProcessId = NULL;
+    event->ThreadId = NULL;
+    event->ImageBase = NULL;
+    event->ImageSize = 0;
+    event->ImageFileName[0] = 0;
+
+    *Position = position;
+
+    return event;
+}
+
+FORCEINLINE VOID KphpEndWriteEvent(
+    __inout PKPH_EVENT Event,
+    __in ULONG Position
+    )
+{
+    // The exchange is a full barrier, so the event is complete before it is published.
+    InterlockedExchange((PLONG)&Event->Sequence, (LONG)(Position + 1));
+}
+
+VOID KphpCreateProcessNotifyRoutine(
+    __in HANDLE ParentId,
+    __in HANDLE ProcessId,
+    __in BOOLEAN Create
+    )
+{
+    PKPH_EVENT event;
+    ULONG position;
+
+    PAGED_CODE();
+
+    event = KphpBeginWriteEvent(&position);
+    event->Type = Create ? KphEventProcessCreate : KphEventProcessExit;
+    event->ProcessId = ProcessId;
+    event->ParentProcessId = ParentId;
+
+    if (Create)
+    {
+        PEPROCESS process;
+
+        if (NT_SUCCESS(PsLookupProcessByProcessId(ProcessId, &process)))
+        {
+            PUCHAR imageFileName;
+
+            if (imageFileName = PsGetProcessImageFileName(process))
+            {
+                strncpy(event->ImageFileName, (PCHAR)imageFileName, sizeof(event->ImageFileName) - 1);
+                event->ImageFileName[sizeof(event->ImageFileName) - 1] = 0;
+            }
+
+            ObDereferenceObject(process);
+        }
+    }
+
+    KphpEndWriteEvent(event, position);
+}
+
+VOID KphpCreateThreadNotifyRoutine(
+    __in HANDLE ProcessId,
+    __in HANDLE ThreadId,
+    __in BOOLEAN Create
+    )
+{
+    PKPH_EVENT event;
+    ULONG position;
+
+    PAGED_CODE();
+
+    event = KphpBeginWriteEvent(&position);
+    event->Type = Create ? KphEventThreadCreate : KphEventThreadExit;
+    event->ProcessId = ProcessId;
+    event->ThreadId = ThreadId;
+    KphpEndWriteEvent(event, position);
+}
+
+VOID KphpLoadImageNotifyRoutine(
+    __in_opt PUNICODE_STRING FullImageName,
+    __in HANDLE ProcessId,
+    __in PIMAGE_INFO ImageInfo
+    )
+{
+    PKPH_EVENT event;
+    ULONG position;
+
+    PAGED_CODE();
+
+    event = KphpBeginWriteEvent(&position);
+    event->Type = KphEventImageLoad;
+    event->ProcessId = ProcessId;
+    event->ImageBase = ImageInfo->ImageBase;
+    event->ImageSize = ImageInfo->ImageSize;
+    KphpEndWriteEvent(event, position);
+}
+
+NTSTATUS KphpStartEventRing(
+    VOID
+    )
+{
+    NTSTATUS status;
+    OBJECT_ATTRIBUTES objectAttributes;
+    LARGE_INTEGER maximumSize;
+    SIZE_T viewSize;
+    PVOID section;
+    HANDLE sectionHandle;
+    PVOID baseAddress = NULL;
+
+    PAGED_CODE();
+
+    InitializeObjectAttributes(&objectAttributes, NULL, OBJ_KERNEL_HANDLE, NULL, NULL);
+    maximumSize.QuadPart = sizeof(KPH_EVENT_RING);
+
+    status = ZwCreateSection(
+        &sectionHandle,
+        SECTION_ALL_ACCESS,
+        &objectAttributes,
+        &maximumSize,
+        PAGE_READWRITE,
+        SEC_COMMIT,
+        NULL
+        );
+
+    if (!NT_SUCCESS(status))
+        return status;
+
+    status = ObReferenceObjectByHandle(
+        sectionHandle,
+        SECTION_ALL_ACCESS,
+        NULL,
+        KernelMode,
+        &section,
+        NULL
+        );
+
+    if (!NT_SUCCESS(status))
+    {
+        ZwClose(sectionHandle);
+        return status;
+    }
+
+    viewSize = sizeof(KPH_EVENT_RING);
+    status = MmMapViewInSystemSpace(section, &baseAddress, &viewSize);
+
+    if (!NT_SUCCESS(status))
+    {
+        ObDereferenceObject(section);
+        ZwClose(sectionHandle);
+        return status;
+    }
+
+    KphpEventRingSectionHandle = sectionHandle;
+    KphpEventRingSection = section;
+    KphpEventRing = baseAddress;
+    KphpEventRing->NumberOfEntries = KPH_EVENT_RING_NUMBER_OF_ENTRIES;
+
+    // Keep whatever notify routines we could register; a client still gets the events
+    // that are available.
+
+    if (NT_SUCCESS(PsSetCreateProcessNotifyRoutine(KphpCreateProcessNotifyRoutine, FALSE)))
+        KphpProcessNotifyRegistered = TRUE;
+    if (NT_SUCCESS(PsSetCreateThreadNotifyRoutine(KphpCreateThreadNotifyRoutine)))
+        KphpThreadNotifyRegistered = TRUE;
+    if (NT_SUCCESS(PsSetLoadImageNotifyRoutine(KphpLoadImageNotifyRoutine)))
+        KphpImageNotifyRegistered = TRUE;
+
+    if (!KphpProcessNotifyRegistered)
+    {
+        dprintf("Unable to register the process notify routine\n");
+        return STATUS_UNSUCCESSFUL;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * Maps a read-only view of the event ring into the current process.
+ *
+ * \param BaseAddress A variable which receives the base address of the view.
+ * The view remains valid until the client unmaps it or exits.
+ * \param AccessMode The mode in which to perform access checks.
+ */
+NTSTATUS KpiMapEventRing(
+    __out PVOID *BaseAddress,
+    __in KPROCESSOR_MODE AccessMode
+    )
+{
+    NTSTATUS status;
+    PVOID baseAddress = NULL;
+    SIZE_T viewSize = 0;
+
+    PAGED_CODE();
+
+    if (AccessMode != KernelMode)
+    {
+        __try
+        {
+            ProbeForWrite(BaseAddress, sizeof(PVOID), sizeof(PVOID));
+        }
+        __except (EXCEPTION_EXECUTE_HANDLER)
+        {
+            return GetExceptionCode();
+        }
+    }
+
+    ExAcquireFastMutex(&KphpEventRingMutex);
+
+    if (!KphpEventRing)
+        status = KphpStartEventRing();
+    else if (!KphpProcessNotifyRegistered)
+        status = STATUS_UNSUCCESSFUL;
+    else
+        status = STATUS_SUCCESS;
+
+    ExReleaseFastMutex(&KphpEventRingMutex);
+
+    if (!NT_SUCCESS(status))
+        return status;
+
+    // SEC_NO_CHANGE stops the client from making its view writable.
+    status = ZwMapViewOfSection(
+        KphpEventRingSectionHandle,
+        ZwCurrentProcess(),
+        &baseAddress,
+        0,
+        0,
+        NULL,
+        &viewSize,
+        ViewUnmap,
+        SEC_NO_CHANGE,
+        PAGE_READONLY
+        );
+
+    if (!NT_SUCCESS(status))
+        return status;
+
+    if (AccessMode != KernelMode)
+    {
+        __try
+        {
+            *BaseAddress = baseAddress;
+        }
+        __except (EXCEPTION_EXECUTE_HANDLER)
+        {
+            ZwUnmapViewOfSection(ZwCurrentProcess(), baseAddress);
+            return GetExceptionCode();
+        }
+    }
+    else
+    {
+        *BaseAddress = baseAddress;
+    }
+
+    return STATUS_SUCCESS;
+}
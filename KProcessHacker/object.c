@@ -38,6 +38,7 @@ typedef struct _KPHP_ENUMERATE_PROCESS_HANDLES_CONTEXT
     PVOID CurrentEntry;
     ULONG Count;
     NTSTATUS Status;
+    PKPH_HANDLE_FILTER Filter;
 } KPHP_ENUMERATE_PROCESS_HANDLES_CONTEXT, *PKPHP_ENUMERATE_PROCESS_HANDLES_CONTEXT;
 
 BOOLEAN KphpEnumerateProcessHandlesEnumCallback61(
@@ -53,17 +54,34 @@ BOOLEAN KphpEnumerateProcessHandlesEnumCallback(
     __in PVOID Context
     );
 
+USHORT KphpGetObjectTypeIndex(
+    __in PVOID Object
+    );
+
+NTSTATUS KphpEnumerateProcessHandles(
+    __in HANDLE ProcessHandle,
+    __in_opt PKPH_HANDLE_FILTER Filter,
+    __out_bcount(BufferLength) PVOID Buffer,
+    __in_opt ULONG BufferLength,
+    __out_opt PULONG ReturnLength,
+    __in KPROCESSOR_MODE AccessMode
+    );
+
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text(PAGE, KphGetObjectType)
+#pragma alloc_text(PAGE, KphpGetObjectTypeIndex)
 #pragma alloc_text(PAGE, KphReferenceProcessHandleTable)
 #pragma alloc_text(PAGE, KphDereferenceProcessHandleTable)
 #pragma alloc_text(PAGE, KphUnlockHandleTableEntry)
 #pragma alloc_text(PAGE, KphpEnumerateProcessHandlesEnumCallback61)
 #pragma alloc_text(PAGE, KphpEnumerateProcessHandlesEnumCallback)
+#pragma alloc_text(PAGE, KphpEnumerateProcessHandles)
 #pragma alloc_text(PAGE, KpiEnumerateProcessHandles)
+#pragma alloc_text(PAGE, KpiEnumerateProcessHandlesEx)
 #pragma alloc_text(PAGE, KphQueryNameObject)
 #pragma alloc_text(PAGE, KphQueryNameFileObject)
 #pragma alloc_text(PAGE, KpiQueryInformationObject)
+#pragma alloc_text(PAGE, KpiQueryInformationObjects)
 #pragma alloc_text(PAGE, KpiSetInformationObject)
 #pragma alloc_text(PAGE, KphDuplicateObject)
 #pragma alloc_text(PAGE, KpiDuplicateObject)
@@ -110,6 +128,35 @@ POBJECT_TYPE KphGetObjectType(
     }
 }
 
+/**
+ * Gets the index of an object's type.
+ *
+ * \param Object A pointer to an object.
+ *
+ * \return The object type index, or -1 if it could not be
+ * determined.
+ */
+USHORT KphpGetObjectTypeIndex(
+    __in PVOID Object
+    )
+{
+    POBJECT_TYPE objectType;
+
+    PAGED_CODE();
+
+    objectType = KphGetObjectType(Object);
+
+    if (objectType && KphDynOtIndex != -1)
+    {
+        if (KphDynNtVersion >= PHNT_WIN7)
+            return (USHORT)*(PUCHAR)((ULONG_PTR)objectType + KphDynOtIndex);
+        else
+            return (USHORT)*(PULONG)((ULONG_PTR)objectType + KphDynOtIndex);
+    }
+
+    return (USHORT)-1;
+}
+
 /**
  * Gets a pointer to the handle table of a process.
  *
@@ -192,8 +239,8 @@ BOOLEAN KphpEnumerateProcessHandlesEnumCallback61(
     PKPHP_ENUMERATE_PROCESS_HANDLES_CONTEXT context = Context;
     KPH_PROCESS_HANDLE handleInfo;
     POBJECT_HEADER objectHeader;
-    POBJECT_TYPE objectType;
-    PKPH_PROCESS_HANDLE entryInBuffer;
+    PVOID entryInBuffer;
+    ULONG entrySize;
 
     PAGED_CODE();
 
@@ -207,22 +254,40 @@ BOOLEAN KphpEnumerateProcessHandlesEnumCallback61(
     handleInfo.Reserved2 = 0;
 
     if (handleInfo.Object)
+        handleInfo.ObjectTypeIndex = KphpGetObjectTypeIndex(handleInfo.Object);
+
+    // Apply the caller's filter. Handles which don't match aren't counted, so they take up no
+    // space in the buffer.
+    if (context->Filter)
     {
-        objectType = KphGetObjectType(handleInfo.Object);
+        if (context->Filter->Flags & KPH_HANDLE_FILTER_OBJECT_TYPE)
+        {
+            if (handleInfo.ObjectTypeIndex >= KPH_HANDLE_FILTER_MAX_TYPE_INDEX ||
+                !KPH_HANDLE_FILTER_TEST_TYPE(context->Filter, handleInfo.ObjectTypeIndex))
+            {
+                return FALSE;
+            }
+        }
 
-        if (objectType && KphDynOtIndex != -1)
+        if (context->Filter->Flags & KPH_HANDLE_FILTER_HANDLE_RANGE)
         {
-            if (KphDynNtVersion >= PHNT_WIN7)
-                handleInfo.ObjectTypeIndex = (USHORT)*(PUCHAR)((ULONG_PTR)objectType + KphDynOtIndex);
-            else
-                handleInfo.ObjectTypeIndex = (USHORT)*(PULONG)((ULONG_PTR)objectType + KphDynOtIndex);
+            if ((ULONG_PTR)Handle < (ULONG_PTR)context->Filter->MinimumHandle ||
+                (ULONG_PTR)Handle > (ULONG_PTR)context->Filter->MaximumHandle)
+            {
+                return FALSE;
+            }
         }
     }
 
+    if (context->Filter && (context->Filter->Flags & KPH_HANDLE_FILTER_COMPACT))
+        entrySize = sizeof(KPH_PROCESS_HANDLE_COMPACT);
+    else
+        entrySize = sizeof(KPH_PROCESS_HANDLE);
+
     // Advance the current entry pointer regardless of whether the information will be written;
     // this will allow the parent function to report the correct return length.
     entryInBuffer = context->CurrentEntry;
-    context->CurrentEntry = (PVOID)((ULONG_PTR)context->CurrentEntry + sizeof(KPH_PROCESS_HANDLE));
+    context->CurrentEntry = (PVOID)((ULONG_PTR)context->CurrentEntry + entrySize);
     context->Count++;
 
     // Only write if we have not exceeded the buffer length.
@@ -230,12 +295,24 @@ BOOLEAN KphpEnumerateProcessHandlesEnumCallback61(
     // handles, the buffer pointer may wrap).
     if (
         (ULONG_PTR)entryInBuffer >= (ULONG_PTR)context->Buffer &&
-        (ULONG_PTR)entryInBuffer + sizeof(KPH_PROCESS_HANDLE) <= (ULONG_PTR)context->BufferLimit
+        (ULONG_PTR)entryInBuffer + entrySize <= (ULONG_PTR)context->BufferLimit
         )
     {
         __try
         {
-            *entryInBuffer = handleInfo;
+            if (entrySize == sizeof(KPH_PROCESS_HANDLE_COMPACT))
+            {
+                PKPH_PROCESS_HANDLE_COMPACT compactEntry = entryInBuffer;
+
+                compactEntry->Handle = (ULONG)(ULONG_PTR)handleInfo.Handle;
+                compactEntry->GrantedAccess = handleInfo.GrantedAccess;
+                compactEntry->ObjectTypeIndex = handleInfo.ObjectTypeIndex;
+                compactEntry->HandleAttributes = (USHORT)handleInfo.HandleAttributes;
+            }
+            else
+            {
+                *(PKPH_PROCESS_HANDLE)entryInBuffer = handleInfo;
+            }
         }
         __except (EXCEPTION_EXECUTE_HANDLER)
         {
@@ -275,6 +352,7 @@ BOOLEAN KphpEnumerateProcessHandlesEnumCallback(
  * Enumerates the handles of a process.
  *
  * \param ProcessHandle A handle to a process.
+ * \param Filter A captured filter, or NULL to return all handles.
  * \param Buffer The buffer in which the handle information will
  * be stored.
  * \param BufferLength The number of bytes available in \a Buffer.
@@ -282,8 +360,9 @@ BOOLEAN KphpEnumerateProcessHandlesEnumCallback(
  * required to be available in \a Buffer.
  * \param AccessMode The mode in which to perform access checks.
  */
-NTSTATUS KpiEnumerateProcessHandles(
+NTSTATUS KphpEnumerateProcessHandles(
     __in HANDLE ProcessHandle,
+    __in_opt PKPH_HANDLE_FILTER Filter,
     __out_bcount(BufferLength) PVOID Buffer,
     __in_opt ULONG BufferLength,
     __out_opt PULONG ReturnLength,
@@ -295,6 +374,7 @@ NTSTATUS KpiEnumerateProcessHandles(
     PEPROCESS process;
     PHANDLE_TABLE handleTable;
     KPHP_ENUMERATE_PROCESS_HANDLES_CONTEXT context;
+    ULONG headerSize;
 
     PAGED_CODE();
 
@@ -341,12 +421,18 @@ NTSTATUS KpiEnumerateProcessHandles(
         return STATUS_UNSUCCESSFUL;
     }
 
+    if (Filter && (Filter->Flags & KPH_HANDLE_FILTER_COMPACT))
+        headerSize = FIELD_OFFSET(KPH_PROCESS_HANDLE_COMPACT_INFORMATION, Handles);
+    else
+        headerSize = FIELD_OFFSET(KPH_PROCESS_HANDLE_INFORMATION, Handles);
+
     // Initialize the enumeration context.
     context.Buffer = Buffer;
     context.BufferLimit = (PVOID)((ULONG_PTR)Buffer + BufferLength);
-    context.CurrentEntry = ((PKPH_PROCESS_HANDLE_INFORMATION)Buffer)->Handles;
+    context.CurrentEntry = (PVOID)((ULONG_PTR)Buffer + headerSize);
     context.Count = 0;
     context.Status = STATUS_SUCCESS;
+    context.Filter = Filter;
 
     // Enumerate the handles.
 
@@ -373,7 +459,7 @@ NTSTATUS KpiEnumerateProcessHandles(
     ObDereferenceObject(process);
 
     // Write the number of handles if we can.
-    if (BufferLength >= FIELD_OFFSET(KPH_PROCESS_HANDLE_INFORMATION, Handles))
+    if (BufferLength >= headerSize)
     {
         if (AccessMode != KernelMode)
         {
@@ -421,6 +507,109 @@ NTSTATUS KpiEnumerateProcessHandles(
     return context.Status;
 }
 
+/**
+ * Enumerates the handles of a process.
+ *
+ * \param ProcessHandle A handle to a process.
+ * \param Buffer The buffer in which the handle information will
+ * be stored.
+ * \param BufferLength The number of bytes available in \a Buffer.
+ * \param ReturnLength A variable which receives the number of bytes
+ * required to be available in \a Buffer.
+ * \param AccessMode The mode in which to perform access checks.
+ */
+NTSTATUS KpiEnumerateProcessHandles(
+    __in HANDLE ProcessHandle,
+    __out_bcount(BufferLength) PVOID Buffer,
+    __in_opt ULONG BufferLength,
+    __out_opt PULONG ReturnLength,
+    __in KPROCESSOR_MODE AccessMode
+    )
+{
+    PAGED_CODE();
+
+    return KphpEnumerateProcessHandles(
+        ProcessHandle,
+        NULL,
+        Buffer,
+        BufferLength,
+        ReturnLength,
+        AccessMode
+        );
+}
+
+/**
+ * Enumerates the handles of a process that match a filter.
+ *
+ * \param ProcessHandle A handle to a process.
+ * \param Filter A filter which selects the handles to return and the
+ * format of the returned information. If NULL, all handles are returned
+ * as in KpiEnumerateProcessHandles().
+ * \param Buffer The buffer in which the handle information will
+ * be stored. This is a KPH_PROCESS_HANDLE_COMPACT_INFORMATION structure
+ * if KPH_HANDLE_FILTER_COMPACT is specified, otherwise it is a
+ * KPH_PROCESS_HANDLE_INFORMATION structure.
+ * \param BufferLength The number of bytes available in \a Buffer.
+ * \param ReturnLength A variable which receives the number of bytes
+ * required to be available in \a Buffer.
+ * \param AccessMode The mode in which to perform access checks.
+ */
+NTSTATUS KpiEnumerateProcessHandlesEx(
+    __in HANDLE ProcessHandle,
+    __in_opt PKPH_HANDLE_FILTER Filter,
+    __out_bcount(BufferLength) PVOID Buffer,
+    __in_opt ULONG BufferLength,
+    __out_opt PULONG ReturnLength,
+    __in KPROCESSOR_MODE AccessMode
+    )
+{
+    KPH_HANDLE_FILTER filter;
+
+    PAGED_CODE();
+
+    if (!Filter)
+    {
+        return KphpEnumerateProcessHandles(
+            ProcessHandle,
+            NULL,
+            Buffer,
+            BufferLength,
+            ReturnLength,
+            AccessMode
+            );
+    }
+
+    // Capture the filter so the caller can't change it during the enumeration.
+    if (AccessMode != KernelMode)
+    {
+        __try
+        {
+            ProbeForRead(Filter, sizeof(KPH_HANDLE_FILTER), sizeof(ULONG));
+            filter = *Filter;
+        }
+        __except (EXCEPTION_EXECUTE_HANDLER)
+        {
+            return GetExceptionCode();
+        }
+    }
+    else
+    {
+        filter = *Filter;
+    }
+
+    if (filter.Flags & ~KPH_HANDLE_FILTER_VALID_FLAGS)
+        return STATUS_INVALID_PARAMETER;
+
+    return KphpEnumerateProcessHandles(
+        ProcessHandle,
+        &filter,
+        Buffer,
+        BufferLength,
+        ReturnLength,
+        AccessMode
+        );
+}
+
 /**
  * Queries the name of an object.
  *
@@ -1203,6 +1392,285 @@ NTSTATUS KpiQueryInformationObject(
     return status;
 }
 
+/**
+ * Queries basic information, the type index and the name of multiple
+ * objects referenced by handles in a process.
+ *
+ * \param ProcessHandle A handle to a process.
+ * \param Handles An array of handles in the process.
+ * \param NumberOfHandles The number of elements in \a Handles. This
+ * must not be greater than KPH_OBJECT_BATCH_LIMIT.
+ * \param Buffer The buffer in which the information will be stored,
+ * as a KPH_OBJECT_BATCH_INFORMATION structure. The names are packed
+ * after the array of entries.
+ * \param BufferLength The number of bytes available in \a Buffer.
+ * \param ReturnLength A variable which receives the number of bytes
+ * required to be available in \a Buffer.
+ * \param AccessMode The mode in which to perform access checks.
+ *
+ * \remarks Names are queried with KphQueryNameObject(), so file
+ * objects which are busy are handled without hanging.
+ */
+NTSTATUS KpiQueryInformationObjects(
+    __in HANDLE ProcessHandle,
+    __in_ecount(NumberOfHandles) PHANDLE Handles,
+    __in ULONG NumberOfHandles,
+    __out_bcount(BufferLength) PVOID Buffer,
+    __in ULONG BufferLength,
+    __out_opt PULONG ReturnLength,
+    __in KPROCESSOR_MODE AccessMode
+    )
+{
+    NTSTATUS status;
+    PEPROCESS process;
+    KPROCESSOR_MODE referenceMode;
+    KAPC_STATE apcState;
+    PHANDLE handles;
+    PVOID *objects;
+    PKPH_OBJECT_BATCH_ENTRY entries;
+    POBJECT_NAME_INFORMATION nameInfo;
+    ULONG nameInfoLength;
+    ULONG headerLength;
+    ULONG returnLength;
+    ULONG i;
+
+    PAGED_CODE();
+
+    if (NumberOfHandles == 0 || NumberOfHandles > KPH_OBJECT_BATCH_LIMIT)
+        return STATUS_INVALID_PARAMETER_3;
+
+    headerLength = FIELD_OFFSET(KPH_OBJECT_BATCH_INFORMATION, Entries) + NumberOfHandles * sizeof(KPH_OBJECT_BATCH_ENTRY);
+
+    // Capture the handle array.
+    handles = ExAllocatePoolWithTag(PagedPool, NumberOfHandles * sizeof(HANDLE), 'QhpK');
+
+    if (!handles)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    if (AccessMode != KernelMode)
+    {
+        __try
+        {
+            ProbeForRead(Handles, NumberOfHandles * sizeof(HANDLE), sizeof(HANDLE));
+            memcpy(handles, Handles, NumberOfHandles * sizeof(HANDLE));
+            ProbeForWrite(Buffer, BufferLength, sizeof(ULONG));
+
+            if (ReturnLength)
+                ProbeForWrite(ReturnLength, sizeof(ULONG), sizeof(ULONG));
+        }
+        __except (EXCEPTION_EXECUTE_HANDLER)
+        {
+            ExFreePoolWithTag(handles, 'QhpK');
+            return GetExceptionCode();
+        }
+    }
+    else
+    {
+        memcpy(handles, Handles, NumberOfHandles * sizeof(HANDLE));
+    }
+
+    status = ObReferenceObjectByHandle(
+        ProcessHandle,
+        0,
+        *PsProcessType,
+        AccessMode,
+        &process,
+        NULL
+        );
+
+    if (!NT_SUCCESS(status))
+    {
+        ExFreePoolWithTag(handles, 'QhpK');
+        return status;
+    }
+
+    referenceMode = process == PsInitialSystemProcess ? KernelMode : AccessMode;
+
+    objects = ExAllocatePoolWithTag(PagedPool, NumberOfHandles * sizeof(PVOID), 'QhpK');
+    entries = ExAllocatePoolWithTag(PagedPool, NumberOfHandles * sizeof(KPH_OBJECT_BATCH_ENTRY), 'QhpK');
+    nameInfoLength = 0x200;
+    nameInfo = ExAllocatePoolWithTag(PagedPool, nameInfoLength, 'QhpK');
+
+    if (!objects || !entries || !nameInfo)
+    {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CleanupExit;
+    }
+
+    memset(objects, 0, NumberOfHandles * sizeof(PVOID));
+    memset(entries, 0, NumberOfHandles * sizeof(KPH_OBJECT_BATCH_ENTRY));
+
+    // Reference all of the objects and query their basic information while we are attached
+    // to the process, so we only have to attach once.
+
+    KeStackAttachProcess(process, &apcState);
+
+    for (i = 0; i < NumberOfHandles; i++)
+    {
+        HANDLE handle = handles[i];
+
+        entries[i].Handle = handle;
+        entries[i].ObjectTypeIndex = -1;
+        entries[i].NameStatus = STATUS_UNSUCCESSFUL;
+
+        // See KpiQueryInformationObject for the handle checks.
+        if (process == PsInitialSystemProcess)
+        {
+            handle = MakeKernelHandle(handle);
+        }
+        else if (IsKernelHandle(handle))
+        {
+            entries[i].Status = STATUS_INVALID_HANDLE;
+            continue;
+        }
+
+        entries[i].Status = ObReferenceObjectByHandle(
+            handle,
+            0,
+            NULL,
+            referenceMode,
+            &objects[i],
+            NULL
+            );
+
+        if (!NT_SUCCESS(entries[i].Status))
+        {
+            objects[i] = NULL;
+            continue;
+        }
+
+        entries[i].Status = ZwQueryObject(
+            handle,
+            ObjectBasicInformation,
+            &entries[i].BasicInformation,
+            sizeof(OBJECT_BASIC_INFORMATION),
+            NULL
+            );
+    }
+
+    KeUnstackDetachProcess(&apcState);
+
+    // Query the type indices and names, and copy everything to the caller's buffer. The names
+    // are placed after the entries. We keep going when the buffer is too small so that we can
+    // report the correct return length.
+
+    returnLength = headerLength;
+
+    for (i = 0; i < NumberOfHandles; i++)
+    {
+        ULONG nameReturnLength;
+
+        if (!objects[i])
+            continue;
+
+        entries[i].ObjectTypeIndex = KphpGetObjectTypeIndex(objects[i]);
+
+        memset(nameInfo, 0, nameInfoLength);
+        entries[i].NameStatus = KphQueryNameObject(objects[i], nameInfo, nameInfoLength, &nameReturnLength);
+
+        if (entries[i].NameStatus == STATUS_BUFFER_TOO_SMALL &&
+            nameReturnLength > nameInfoLength &&
+            nameReturnLength <= sizeof(OBJECT_NAME_INFORMATION) + MAXUSHORT)
+        {
+            POBJECT_NAME_INFORMATION newNameInfo;
+
+            if (newNameInfo = ExAllocatePoolWithTag(PagedPool, nameReturnLength, 'QhpK'))
+            {
+                ExFreePoolWithTag(nameInfo, 'QhpK');
+                nameInfo = newNameInfo;
+                nameInfoLength = nameReturnLength;
+
+                memset(nameInfo, 0, nameInfoLength);
+                entries[i].NameStatus = KphQueryNameObject(objects[i], nameInfo, nameInfoLength, &nameReturnLength);
+            }
+        }
+
+        if (NT_SUCCESS(entries[i].NameStatus) && nameInfo->Name.Length != 0)
+        {
+            ULONG nameOffset;
+
+            nameOffset = ALIGN_UP(returnLength, WCHAR);
+            entries[i].NameLength = nameInfo->Name.Length;
+            entries[i].NameOffset = nameOffset;
+            returnLength = nameOffset + nameInfo->Name.Length;
+
+            if (returnLength <= BufferLength)
+            {
+                __try
+                {
+                    memcpy((PCHAR)Buffer + nameOffset, nameInfo->Name.Buffer, nameInfo->Name.Length);
+                }
+                __except (EXCEPTION_EXECUTE_HANDLER)
+                {
+                    status = GetExceptionCode();
+                    goto CleanupExit;
+                }
+            }
+        }
+    }
+
+    if (returnLength <= BufferLength)
+    {
+        __try
+        {
+            ((PKPH_OBJECT_BATCH_INFORMATION)Buffer)->NumberOfEntries = NumberOfHandles;
+            memcpy(((PKPH_OBJECT_BATCH_INFORMATION)Buffer)->Entries, entries, NumberOfHandles * sizeof(KPH_OBJECT_BATCH_ENTRY));
+        }
+        __except (EXCEPTION_EXECUTE_HANDLER)
+        {
+            status = GetExceptionCode();
+            goto CleanupExit;
+        }
+
+        status = STATUS_SUCCESS;
+    }
+    else
+    {
+        status = STATUS_BUFFER_TOO_SMALL;
+    }
+
+    if (ReturnLength)
+    {
+        if (AccessMode != KernelMode)
+        {
+            __try
+            {
+                *ReturnLength = returnLength;
+            }
+            __except (EXCEPTION_EXECUTE_HANDLER)
+            {
+                status = GetExceptionCode();
+            }
+        }
+        else
+        {
+            *ReturnLength = returnLength;
+        }
+    }
+
+CleanupExit:
+    if (objects)
+    {
+        for (i = 0; i < NumberOfHandles; i++)
+        {
+            if (objects[i])
+                ObDereferenceObject(objects[i]);
+        }
+
+        ExFreePoolWithTag(objects, 'QhpK');
+    }
+
+    if (entries)
+        ExFreePoolWithTag(entries, 'QhpK');
+    if (nameInfo)
+        ExFreePoolWithTag(nameInfo, 'QhpK');
+
+    ExFreePoolWithTag(handles, 'QhpK');
+    ObDereferenceObject(process);
+
+    return status;
+}
+
 /**
  * Sets object information.
  *
@@ -32,6 +32,7 @@
 #pragma alloc_text(PAGE, KpiTerminateProcess)
 #pragma alloc_text(PAGE, KpiQueryInformationProcess)
 #pragma alloc_text(PAGE, KpiSetInformationProcess)
+#pragma alloc_text(PAGE, KpiEnumerateProcesses)
 #endif
 
 /**
@@ -939,3 +940,140 @@ VOID KphReleaseProcessRundownProtection(
 
     ExReleaseRundownProtection((PEX_RUNDOWN_REF)((ULONG_PTR)Process + KphDynEpRundownProtect));
 }
+
+/**
+ * Enumerates processes by looking up every possible process ID
+ * in the client ID table.
+ *
+ * \param Buffer A buffer which receives a KPH_PROCESS_LIST structure.
+ * \param BufferLength The number of bytes available in \a Buffer.
+ * \param ReturnLength A variable which receives the number of bytes
+ * required to be available in \a Buffer.
+ * \param AccessMode The mode in which to perform access checks.
+ *
+ * \remarks Processes which have been unlinked from the active
+ * process list are still found, because PsLookupProcessByProcessId
+ * does not use the list.
+ */
+NTSTATUS KpiEnumerateProcesses(
+    __out_bcount(BufferLength) PVOID Buffer,
+    __in ULONG BufferLength,
+    __out_opt PULONG ReturnLength,
+    __in KPROCESSOR_MODE AccessMode
+    )
+{
+    NTSTATUS status;
+    PKPH_PROCESS_ENTRY entries;
+    ULONG allocatedEntries;
+    ULONG numberOfEntries;
+    ULONG_PTR processId;
+    ULONG returnLength;
+
+    PAGED_CODE();
+
+    if (AccessMode != KernelMode)
+    {
+        __try
+        {
+            ProbeForWrite(Buffer, BufferLength, sizeof(ULONG_PTR));
+
+            if (ReturnLength)
+                ProbeForWrite(ReturnLength, sizeof(ULONG), sizeof(ULONG));
+        }
+        __except (EXCEPTION_EXECUTE_HANDLER)
+        {
+            return GetExceptionCode();
+        }
+    }
+
+    allocatedEntries = 256;
+    entries = ExAllocatePoolWithTag(PagedPool, allocatedEntries * sizeof(KPH_PROCESS_ENTRY), 'ThpK');
+
+    if (!entries)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    numberOfEntries = 0;
+    status = STATUS_SUCCESS;
+
+    for (processId = 4; processId < KPH_PROCESS_ID_LIMIT; processId += 4)
+    {
+        PEPROCESS process;
+        PKPH_PROCESS_ENTRY entry;
+
+        if (!NT_SUCCESS(PsLookupProcessByProcessId((HANDLE)processId, &process)))
+            continue;
+
+        if (numberOfEntries == allocatedEntries)
+        {
+            PKPH_PROCESS_ENTRY newEntries;
+
+            newEntries = ExAllocatePoolWithTag(PagedPool, allocatedEntries * 2 * sizeof(KPH_PROCESS_ENTRY), 'ThpK');
+
+            if (!newEntries)
+            {
+                ObDereferenceObject(process);
+                status = STATUS_INSUFFICIENT_RESOURCES;
+                break;
+            }
+
+            memcpy(newEntries, entries, numberOfEntries * sizeof(KPH_PROCESS_ENTRY));
+            ExFreePoolWithTag(entries, 'ThpK');
+            entries = newEntries;
+            allocatedEntries *= 2;
+        }
+
+        entry = &entries[numberOfEntries++];
+        entry->ProcessId = (HANDLE)processId;
+        entry->Object = process;
+        entry->CreateTime.QuadPart = PsGetProcessCreateTimeQuadPart(process);
+        entry->Flags = 0;
+
+        if (PsGetProcessExitStatus(process) != STATUS_PENDING)
+            entry->Flags |= KPH_PROCESS_ENTRY_EXITED;
+
+        strncpy(entry->ImageFileName, (PCHAR)PsGetProcessImageFileName(process), sizeof(entry->ImageFileName) - 1);
+        entry->ImageFileName[sizeof(entry->ImageFileName) - 1] = 0;
+
+        ObDereferenceObject(process);
+    }
+
+    if (NT_SUCCESS(status))
+    {
+        returnLength = FIELD_OFFSET(KPH_PROCESS_LIST, Processes) + numberOfEntries * sizeof(KPH_PROCESS_ENTRY);
+
+        if (BufferLength >= returnLength)
+        {
+            __try
+            {
+                PKPH_PROCESS_LIST list = Buffer;
+
+                list->NumberOfProcesses = numberOfEntries;
+                memcpy(list->Processes, entries, numberOfEntries * sizeof(KPH_PROCESS_ENTRY));
+            }
+            __except (EXCEPTION_EXECUTE_HANDLER)
+            {
+                status = GetExceptionCode();
+            }
+        }
+        else
+        {
+            status = STATUS_BUFFER_TOO_SMALL;
+        }
+
+        if (ReturnLength)
+        {
+            __try
+            {
+                *ReturnLength = returnLength;
+            }
+            __except (EXCEPTION_EXECUTE_HANDLER)
+            {
+                NOTHING;
+            }
+        }
+    }
+
+    ExFreePoolWithTag(entries, 'ThpK');
+
+    return status;
+}
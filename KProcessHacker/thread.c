@@ -41,7 +41,23 @@ typedef struct _CAPTURE_BACKTRACE_THREAD_CONTEXT
     ULONG BackTraceHash;
 } CAPTURE_BACKTRACE_THREAD_CONTEXT, *PCAPTURE_BACKTRACE_THREAD_CONTEXT;
 
+typedef struct _CAPTURE_BACKTRACE_PROCESS_CONTEXT
+{
+    BOOLEAN Local;
+    KAPC Apc;
+    KEVENT CompletedEvent;
+    PETHREAD Thread;
+    HANDLE ThreadId;
+    NTSTATUS Status;
+    ULONG FramesToSkip;
+    ULONG FramesToCapture;
+    ULONG NumberOfKernelFrames;
+    ULONG NumberOfUserFrames;
+    PVOID Frames[1]; // FramesToCapture kernel-mode frames, then FramesToCapture user-mode frames
+} CAPTURE_BACKTRACE_PROCESS_CONTEXT, *PCAPTURE_BACKTRACE_PROCESS_CONTEXT;
+
 KKERNEL_ROUTINE KphpCaptureStackBackTraceThreadSpecialApc;
+KKERNEL_ROUTINE KphpCaptureStackBackTraceProcessSpecialApc;
 KKERNEL_ROUTINE KphpExitThreadSpecialApc;
 
 VOID KphpCaptureStackBackTraceThreadSpecialApc(
@@ -52,6 +68,14 @@ VOID KphpCaptureStackBackTraceThreadSpecialApc(
     __inout PVOID *SystemArgument2
     );
 
+VOID KphpCaptureStackBackTraceProcessSpecialApc(
+    __in PRKAPC Apc,
+    __inout PKNORMAL_ROUTINE *NormalRoutine,
+    __inout PVOID *NormalContext,
+    __inout PVOID *SystemArgument1,
+    __inout PVOID *SystemArgument2
+    );
+
 VOID KphpExitThreadSpecialApc(
     __in PRKAPC Apc,
     __inout PKNORMAL_ROUTINE *NormalRoutine,
@@ -60,6 +84,12 @@ VOID KphpExitThreadSpecialApc(
     __inout PVOID *SystemArgument2
     );
 
+NTSTATUS KphpGetProcessThreadIds(
+    __in HANDLE ProcessId,
+    __out PHANDLE *ThreadIds,
+    __out PULONG NumberOfThreads
+    );
+
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text(PAGE, KpiOpenThread)
 #pragma alloc_text(PAGE, KpiOpenThreadProcess)
@@ -72,6 +102,9 @@ VOID KphpExitThreadSpecialApc(
 #pragma alloc_text(PAGE, KphCaptureStackBackTraceThread)
 #pragma alloc_text(PAGE, KphpCaptureStackBackTraceThreadSpecialApc)
 #pragma alloc_text(PAGE, KpiCaptureStackBackTraceThread)
+#pragma alloc_text(PAGE, KphpGetProcessThreadIds)
+#pragma alloc_text(PAGE, KphpCaptureStackBackTraceProcessSpecialApc)
+#pragma alloc_text(PAGE, KpiCaptureStackBackTraceProcess)
 #pragma alloc_text(PAGE, KpiQueryInformationThread)
 #pragma alloc_text(PAGE, KpiSetInformationThread)
 #endif
@@ -904,6 +937,417 @@ NTSTATUS KpiCaptureStackBackTraceThread(
     return status;
 }
 
+NTSTATUS KphpGetProcessThreadIds(
+    __in HANDLE ProcessId,
+    __out PHANDLE *ThreadIds,
+    __out PULONG NumberOfThreads
+    )
+{
+    NTSTATUS status;
+    PVOID buffer;
+    ULONG bufferSize;
+    ULONG attempts;
+    PSYSTEM_PROCESS_INFORMATION process;
+    PHANDLE threadIds;
+    ULONG i;
+
+    PAGED_CODE();
+
+    bufferSize = 0x10000;
+    attempts = 8;
+
+    do
+    {
+        buffer = ExAllocatePoolWithTag(PagedPool, bufferSize, 'bhpK');
+
+        if (!buffer)
+            return STATUS_INSUFFICIENT_RESOURCES;
+
+        status = ZwQuerySystemInformation(
+            SystemProcessInformation,
+            buffer,
+            bufferSize,
+            &bufferSize
+            );
+
+        if (NT_SUCCESS(status))
+            break;
+
+        ExFreePoolWithTag(buffer, 'bhpK');
+
+        if (status != STATUS_INFO_LENGTH_MISMATCH)
+            return status;
+    } while (--attempts);
+
+    if (!NT_SUCCESS(status))
+        return status;
+
+    process = buffer;
+
+    while (TRUE)
+    {
+        if (process->UniqueProcessId == ProcessId)
+            break;
+
+        if (process->NextEntryOffset == 0)
+        {
+            ExFreePoolWithTag(buffer, 'bhpK');
+            return STATUS_NOT_FOUND;
+        }
+
+        process = (PSYSTEM_PROCESS_INFORMATION)((PCHAR)process + process->NextEntryOffset);
+    }
+
+    threadIds = ExAllocatePoolWithTag(PagedPool, max(process->NumberOfThreads, 1) * sizeof(HANDLE), 'bhpK');
+
+    if (!threadIds)
+    {
+        ExFreePoolWithTag(buffer, 'bhpK');
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    for (i = 0; i < process->NumberOfThreads; i++)
+        threadIds[i] = process->Threads[i].ClientId.UniqueThread;
+
+    *ThreadIds = threadIds;
+    *NumberOfThreads = process->NumberOfThreads;
+
+    ExFreePoolWithTag(buffer, 'bhpK');
+
+    return STATUS_SUCCESS;
+}
+
+VOID KphpCaptureStackBackTraceProcessSpecialApc(
+    __in PRKAPC Apc,
+    __inout PKNORMAL_ROUTINE *NormalRoutine,
+    __inout PVOID *NormalContext,
+    __inout PVOID *SystemArgument1,
+    __inout PVOID *SystemArgument2
+    )
+{
+    PCAPTURE_BACKTRACE_PROCESS_CONTEXT context = *SystemArgument1;
+
+    PAGED_CODE();
+
+    context->NumberOfKernelFrames = KphCaptureStackBackTrace(
+        context->FramesToSkip,
+        context->FramesToCapture,
+        0,
+        context->Frames,
+        NULL
+        );
+
+    if (!PsIsSystemThread((PETHREAD)KeGetCurrentThread()))
+    {
+        context->NumberOfUserFrames = KphCaptureStackBackTrace(
+            0,
+            context->FramesToCapture,
+            RTL_WALK_USER_MODE_STACK,
+            context->Frames + context->FramesToCapture,
+            NULL
+            );
+    }
+    else
+    {
+        context->NumberOfUserFrames = 0;
+    }
+
+    if (!context->Local)
+    {
+        // Notify the originating thread that we have completed.
+        KeSetEvent(&context->CompletedEvent, 0, FALSE);
+    }
+}
+
+/**
+ * Captures the stack traces of all threads in a process.
+ *
+ * \param ProcessHandle A handle to a process.
+ * \param FramesToSkip The number of frames to skip from the
+ * bottom of each kernel-mode stack.
+ * \param FramesToCapture The maximum number of kernel-mode frames
+ * and the maximum number of user-mode frames to capture for each
+ * thread.
+ * \param Buffer A buffer which receives a list of KPH_THREAD_BACKTRACE
+ * structures linked by NextEntryOffset.
+ * \param BufferLength The number of bytes available in \a Buffer.
+ * \param ReturnLength A variable which receives the number of bytes
+ * written to \a Buffer, or the number of bytes required if
+ * \a Buffer is too small.
+ * \param AccessMode The mode in which to perform access checks.
+ *
+ * \remarks An APC is queued to every thread before waiting for any
+ * of them, so the stacks are captured in parallel. Kernel-mode
+ * frames are stored before user-mode frames.
+ */
+NTSTATUS KpiCaptureStackBackTraceProcess(
+    __in HANDLE ProcessHandle,
+    __in ULONG FramesToSkip,
+    __in ULONG FramesToCapture,
+    __out_bcount(BufferLength) PVOID Buffer,
+    __in ULONG BufferLength,
+    __out_opt PULONG ReturnLength,
+    __in KPROCESSOR_MODE AccessMode
+    )
+{
+    NTSTATUS status;
+    PEPROCESS process;
+    PHANDLE threadIds;
+    ULONG numberOfThreads;
+    PCAPTURE_BACKTRACE_PROCESS_CONTEXT *contexts;
+    ULONG contextSize;
+    ULONG entrySize;
+    ULONG requiredLength;
+    ULONG returnLength;
+    ULONG i;
+
+    PAGED_CODE();
+
+    if (FramesToCapture > MAX_STACK_DEPTH)
+        return STATUS_INVALID_PARAMETER_3;
+
+    if (AccessMode != KernelMode)
+    {
+        __try
+        {
+            ProbeForWrite(Buffer, BufferLength, sizeof(PVOID));
+
+            if (ReturnLength)
+                ProbeForWrite(ReturnLength, sizeof(ULONG), sizeof(ULONG));
+        }
+        __except (EXCEPTION_EXECUTE_HANDLER)
+        {
+            return GetExceptionCode();
+        }
+    }
+
+    status = ObReferenceObjectByHandle(
+        ProcessHandle,
+        0,
+        *PsProcessType,
+        AccessMode,
+        &process,
+        NULL
+        );
+
+    if (!NT_SUCCESS(status))
+        return status;
+
+    status = KphpGetProcessThreadIds(PsGetProcessId(process), &threadIds, &numberOfThreads);
+
+    if (!NT_SUCCESS(status))
+    {
+        ObDereferenceObject(process);
+        return status;
+    }
+
+    // Make sure the caller's buffer can hold the worst case before we
+    // touch any threads.
+    entrySize = FIELD_OFFSET(KPH_THREAD_BACKTRACE, Frames) + FramesToCapture * 2 * sizeof(PVOID);
+    requiredLength = numberOfThreads * entrySize;
+
+    if (BufferLength < requiredLength)
+    {
+        status = STATUS_BUFFER_TOO_SMALL;
+        returnLength = requiredLength;
+        contexts = NULL;
+        goto WriteReturnLength;
+    }
+
+    contexts = ExAllocatePoolWithTag(PagedPool, max(numberOfThreads, 1) * sizeof(PVOID), 'bhpK');
+
+    if (!contexts)
+    {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CleanupExit;
+    }
+
+    memset(contexts, 0, max(numberOfThreads, 1) * sizeof(PVOID));
+    contextSize = FIELD_OFFSET(CAPTURE_BACKTRACE_PROCESS_CONTEXT, Frames) + FramesToCapture * 2 * sizeof(PVOID);
+
+    // Queue the APCs.
+    for (i = 0; i < numberOfThreads; i++)
+    {
+        PCAPTURE_BACKTRACE_PROCESS_CONTEXT context;
+        PETHREAD thread;
+
+        if (!NT_SUCCESS(PsLookupThreadByThreadId(threadIds[i], &thread)))
+            continue;
+
+        // The thread ID may have been reused by a thread in another process.
+        if (IoThreadToProcess(thread) != process)
+        {
+            ObDereferenceObject(thread);
+            continue;
+        }
+
+        context = ExAllocatePoolWithTag(NonPagedPool, contextSize, 'bhpK');
+
+        if (!context)
+        {
+            ObDereferenceObject(thread);
+            continue;
+        }
+
+        context->Thread = thread;
+        context->ThreadId = threadIds[i];
+        context->Status = STATUS_SUCCESS;
+        context->FramesToSkip = FramesToSkip;
+        context->FramesToCapture = FramesToCapture;
+        context->NumberOfKernelFrames = 0;
+        context->NumberOfUserFrames = 0;
+        contexts[i] = context;
+
+        if (thread == PsGetCurrentThread())
+        {
+            PCAPTURE_BACKTRACE_PROCESS_CONTEXT contextPtr = context;
+            PVOID dummy = NULL;
+            KIRQL oldIrql;
+
+            context->Local = TRUE;
+            KeRaiseIrql(APC_LEVEL, &oldIrql);
+            KphpCaptureStackBackTraceProcessSpecialApc(
+                &context->Apc,
+                NULL,
+                NULL,
+                &contextPtr,
+                &dummy
+                );
+            KeLowerIrql(oldIrql);
+        }
+        else
+        {
+            context->Local = FALSE;
+            KeInitializeEvent(&context->CompletedEvent, NotificationEvent, FALSE);
+            KeInitializeApc(
+                &context->Apc,
+                (PKTHREAD)thread,
+                OriginalApcEnvironment,
+                KphpCaptureStackBackTraceProcessSpecialApc,
+                NULL,
+                NULL,
+                KernelMode,
+                NULL
+                );
+
+            if (!KeInsertQueueApc(&context->Apc, context, NULL, 2))
+            {
+                // The thread is probably terminating.
+                context->Local = TRUE;
+                context->Status = STATUS_UNSUCCESSFUL;
+            }
+        }
+    }
+
+    // Wait for the APCs to complete.
+    for (i = 0; i < numberOfThreads; i++)
+    {
+        if (contexts[i] && !contexts[i]->Local)
+        {
+            contexts[i]->Status = KeWaitForSingleObject(
+                &contexts[i]->CompletedEvent,
+                Executive,
+                KernelMode,
+                FALSE,
+                NULL
+                );
+        }
+    }
+
+    // Copy the stack traces to the caller's buffer.
+
+    returnLength = 0;
+
+    __try
+    {
+        PKPH_THREAD_BACKTRACE entry = NULL;
+        PKPH_THREAD_BACKTRACE previousEntry = NULL;
+
+        for (i = 0; i < numberOfThreads; i++)
+        {
+            PCAPTURE_BACKTRACE_PROCESS_CONTEXT context = contexts[i];
+
+            if (!context)
+                continue;
+
+            entry = (PKPH_THREAD_BACKTRACE)((PCHAR)Buffer + returnLength);
+            entry->NextEntryOffset = 0;
+            entry->Status = context->Status;
+            entry->ThreadId = context->ThreadId;
+
+            if (NT_SUCCESS(context->Status))
+            {
+                entry->NumberOfKernelFrames = context->NumberOfKernelFrames;
+                entry->NumberOfUserFrames = context->NumberOfUserFrames;
+                memcpy(entry->Frames, context->Frames, context->NumberOfKernelFrames * sizeof(PVOID));
+                memcpy(
+                    entry->Frames + context->NumberOfKernelFrames,
+                    context->Frames + context->FramesToCapture,
+                    context->NumberOfUserFrames * sizeof(PVOID)
+                    );
+            }
+            else
+            {
+                entry->NumberOfKernelFrames = 0;
+                entry->NumberOfUserFrames = 0;
+            }
+
+            if (previousEntry)
+                previousEntry->NextEntryOffset = (ULONG)((PCHAR)entry - (PCHAR)previousEntry);
+
+            previousEntry = entry;
+            returnLength += entrySize;
+        }
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER)
+    {
+        status = GetExceptionCode();
+    }
+
+CleanupExit:
+    if (contexts)
+    {
+        for (i = 0; i < numberOfThreads; i++)
+        {
+            if (contexts[i])
+            {
+                ObDereferenceObject(contexts[i]->Thread);
+                ExFreePoolWithTag(contexts[i], 'bhpK');
+            }
+        }
+
+        ExFreePoolWithTag(contexts, 'bhpK');
+    }
+
+    if (!NT_SUCCESS(status))
+        returnLength = 0;
+
+WriteReturnLength:
+    if (ReturnLength)
+    {
+        if (AccessMode != KernelMode)
+        {
+            __try
+            {
+                *ReturnLength = returnLength;
+            }
+            __except (EXCEPTION_EXECUTE_HANDLER)
+            {
+                NOTHING;
+            }
+        }
+        else
+        {
+            *ReturnLength = returnLength;
+        }
+    }
+
+    ExFreePoolWithTag(threadIds, 'bhpK');
+    ObDereferenceObject(process);
+
+    return status;
+}
+
 /**
  * Queries thread information.
  *
@@ -27,17 +27,41 @@ ULONG KphpGetCopyExceptionInfo(
     __out PULONG_PTR BadAddress
     );
 
+NTSTATUS KphpCopyVirtualMemoryBuffered(
+    __in PEPROCESS FromProcess,
+    __in PVOID FromAddress,
+    __in PEPROCESS ToProcess,
+    __in PVOID ToAddress,
+    __in SIZE_T BufferLength,
+    __in KPROCESSOR_MODE AccessMode,
+    __out PSIZE_T ReturnLength
+    );
+
+NTSTATUS KphpCopyVirtualMemoryLarge(
+    __in PEPROCESS FromProcess,
+    __in PVOID FromAddress,
+    __in PVOID ToAddress,
+    __in SIZE_T BufferLength,
+    __in KPROCESSOR_MODE AccessMode,
+    __out PSIZE_T ReturnLength
+    );
+
 #ifdef ALLOC_PRAGMA
+#pragma alloc_text(PAGE, KphpCopyVirtualMemoryBuffered)
+#pragma alloc_text(PAGE, KphpCopyVirtualMemoryLarge)
 #pragma alloc_text(PAGE, KphCopyVirtualMemory)
 #pragma alloc_text(PAGE, KpiReadVirtualMemory)
 #pragma alloc_text(PAGE, KpiWriteVirtualMemory)
 #pragma alloc_text(PAGE, KpiReadVirtualMemoryUnsafe)
+#pragma alloc_text(PAGE, KpiReadVirtualMemoryScatter)
 #endif
 
 #define KPH_STACK_COPY_BYTES 0x200
 #define KPH_POOL_COPY_BYTES 0x10000
 #define KPH_MAPPED_COPY_PAGES 14
 #define KPH_POOL_COPY_THRESHOLD 0x3ff
+#define KPH_LARGE_COPY_THRESHOLD 0x40000
+#define KPH_LARGE_COPY_BYTES 0x100000
 
 ULONG KphpGetCopyExceptionInfo(
     __in PEXCEPTION_POINTERS ExceptionInfo,
@@ -66,7 +90,8 @@ ULONG KphpGetCopyExceptionInfo(
 }
 
 /**
- * Copies memory from one process to another.
+ * Copies memory from one process to another through intermediate
+ * buffers.
  *
  * \param FromProcess The source process.
  * \param FromAddress The source address.
@@ -77,7 +102,7 @@ ULONG KphpGetCopyExceptionInfo(
  * \param ReturnLength A variable which receives the number of
  * bytes copied.
  */
-NTSTATUS KphCopyVirtualMemory(
+NTSTATUS KphpCopyVirtualMemoryBuffered(
     __in PEPROCESS FromProcess,
     __in PVOID FromAddress,
     __in PEPROCESS ToProcess,
@@ -301,6 +326,243 @@ NTSTATUS KphCopyVirtualMemory(
     return STATUS_SUCCESS;
 }
 
+/**
+ * Copies a large block of memory from another process into the
+ * current process.
+ *
+ * \param FromProcess The source process.
+ * \param FromAddress The source address.
+ * \param ToAddress The target address in the current process.
+ * \param BufferLength The number of bytes to copy.
+ * \param AccessMode The mode in which to perform access checks.
+ * \param ReturnLength A variable which receives the number of
+ * bytes copied.
+ *
+ * \remarks The target pages are locked and mapped into system space,
+ * so the data is copied straight from the source process into the
+ * caller's buffer without an intermediate buffer, and the source
+ * process is attached only once per block. If STATUS_INSUFFICIENT_RESOURCES
+ * is returned, \a ReturnLength bytes were copied and the caller may
+ * copy the rest in some other way.
+ */
+NTSTATUS KphpCopyVirtualMemoryLarge(
+    __in PEPROCESS FromProcess,
+    __in PVOID FromAddress,
+    __in PVOID ToAddress,
+    __in SIZE_T BufferLength,
+    __in KPROCESSOR_MODE AccessMode,
+    __out PSIZE_T ReturnLength
+    )
+{
+    NTSTATUS status;
+    PMDL mdl;
+    PVOID mappedAddress;
+    SIZE_T blockSize;
+    SIZE_T stillToCopy;
+    KAPC_STATE apcState;
+    PVOID sourceAddress;
+    PVOID targetAddress;
+    BOOLEAN haveBadAddress;
+    ULONG_PTR badAddress;
+
+    PAGED_CODE();
+
+    // Allocate one MDL that is large enough for any block, including
+    // one which doesn't start on a page boundary.
+    mdl = ExAllocatePoolWithTag(
+        NonPagedPool,
+        MmSizeOfMdl((PVOID)(PAGE_SIZE - 1), KPH_LARGE_COPY_BYTES),
+        'ChpK'
+        );
+
+    if (!mdl)
+    {
+        *ReturnLength = 0;
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    sourceAddress = FromAddress;
+    targetAddress = ToAddress;
+    stillToCopy = BufferLength;
+    status = STATUS_SUCCESS;
+
+    if (AccessMode != KernelMode)
+    {
+        KeStackAttachProcess(FromProcess, &apcState);
+
+        __try
+        {
+            ProbeForRead(sourceAddress, BufferLength, sizeof(UCHAR));
+        }
+        __except (EXCEPTION_EXECUTE_HANDLER)
+        {
+            status = GetExceptionCode();
+        }
+
+        KeUnstackDetachProcess(&apcState);
+
+        if (!NT_SUCCESS(status))
+        {
+            ExFreePoolWithTag(mdl, 'ChpK');
+            *ReturnLength = 0;
+            return status;
+        }
+    }
+
+    while (stillToCopy)
+    {
+        blockSize = stillToCopy;
+
+        if (blockSize > KPH_LARGE_COPY_BYTES)
+            blockSize = KPH_LARGE_COPY_BYTES;
+
+        // Lock the part of the target buffer we are about to fill. We are
+        // still in the context of the current process.
+        MmInitializeMdl(mdl, targetAddress, blockSize);
+
+        __try
+        {
+            MmProbeAndLockPages(mdl, AccessMode, IoWriteAccess);
+        }
+        __except (EXCEPTION_EXECUTE_HANDLER)
+        {
+            status = GetExceptionCode();
+            break;
+        }
+
+        mappedAddress = MmMapLockedPagesSpecifyCache(
+            mdl,
+            KernelMode,
+            MmCached,
+            NULL,
+            FALSE,
+            HighPagePriority
+            );
+
+        if (!mappedAddress)
+        {
+            MmUnlockPages(mdl);
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            break;
+        }
+
+        KeStackAttachProcess(FromProcess, &apcState);
+
+        __try
+        {
+            memcpy(mappedAddress, sourceAddress, blockSize);
+        }
+        __except (KphpGetCopyExceptionInfo(
+            GetExceptionInformation(),
+            &haveBadAddress,
+            &badAddress
+            ))
+        {
+            // Only the source can fault; the target is locked.
+            if (
+                haveBadAddress &&
+                badAddress >= (ULONG_PTR)sourceAddress &&
+                badAddress < (ULONG_PTR)sourceAddress + blockSize
+                )
+            {
+                stillToCopy -= badAddress - (ULONG_PTR)sourceAddress;
+            }
+
+            status = STATUS_PARTIAL_COPY;
+        }
+
+        KeUnstackDetachProcess(&apcState);
+
+        MmUnmapLockedPages(mappedAddress, mdl);
+        MmUnlockPages(mdl);
+
+        if (!NT_SUCCESS(status))
+            break;
+
+        stillToCopy -= blockSize;
+        sourceAddress = (PVOID)((ULONG_PTR)sourceAddress + blockSize);
+        targetAddress = (PVOID)((ULONG_PTR)targetAddress + blockSize);
+    }
+
+    ExFreePoolWithTag(mdl, 'ChpK');
+
+    *ReturnLength = BufferLength - stillToCopy;
+
+    return status;
+}
+
+/**
+ * Copies memory from one process to another.
+ *
+ * \param FromProcess The source process.
+ * \param FromAddress The source address.
+ * \param ToProcess The target process.
+ * \param ToAddress The target address.
+ * \param BufferLength The number of bytes to copy.
+ * \param AccessMode The mode in which to perform access checks.
+ * \param ReturnLength A variable which receives the number of
+ * bytes copied.
+ */
+NTSTATUS KphCopyVirtualMemory(
+    __in PEPROCESS FromProcess,
+    __in PVOID FromAddress,
+    __in PEPROCESS ToProcess,
+    __in PVOID ToAddress,
+    __in SIZE_T BufferLength,
+    __in KPROCESSOR_MODE AccessMode,
+    __out PSIZE_T ReturnLength
+    )
+{
+    NTSTATUS status;
+    SIZE_T numberOfBytesCopied;
+
+    PAGED_CODE();
+
+    if (BufferLength >= KPH_LARGE_COPY_THRESHOLD && ToProcess == PsGetCurrentProcess())
+    {
+        status = KphpCopyVirtualMemoryLarge(
+            FromProcess,
+            FromAddress,
+            ToAddress,
+            BufferLength,
+            AccessMode,
+            &numberOfBytesCopied
+            );
+
+        if (status != STATUS_INSUFFICIENT_RESOURCES)
+        {
+            *ReturnLength = numberOfBytesCopied;
+            return status;
+        }
+
+        // We couldn't get an MDL or a mapping. Copy the rest through the
+        // intermediate buffers instead.
+
+        status = KphpCopyVirtualMemoryBuffered(
+            FromProcess,
+            (PVOID)((ULONG_PTR)FromAddress + numberOfBytesCopied),
+            ToProcess,
+            (PVOID)((ULONG_PTR)ToAddress + numberOfBytesCopied),
+            BufferLength - numberOfBytesCopied,
+            AccessMode,
+            ReturnLength
+            );
+        *ReturnLength += numberOfBytesCopied;
+
+        return status;
+    }
+
+    return KphpCopyVirtualMemoryBuffered(
+        FromProcess,
+        FromAddress,
+        ToProcess,
+        ToAddress,
+        BufferLength,
+        AccessMode,
+        ReturnLength
+        );
+}
+
 /**
  * Copies memory from another process into the current process.
  *
@@ -653,3 +915,176 @@ NTSTATUS KpiReadVirtualMemoryUnsafe(
 
     return status;
 }
+
+/**
+ * Copies several ranges of memory from another process into the
+ * current process.
+ *
+ * \param ProcessHandle A handle to a process. The handle must
+ * have PROCESS_VM_READ access.
+ * \param Ranges An array of ranges to copy. On return, the Status
+ * and NumberOfBytesRead members of each range are updated.
+ * \param NumberOfRanges The number of elements in \a Ranges.
+ * \param Buffer A buffer which receives the copied memory. The
+ * ranges are stored one after another in the order given.
+ * \param BufferSize The size of \a Buffer, in bytes. This must be
+ * at least the sum of the lengths of the ranges.
+ * \param AccessMode The mode in which to perform access checks.
+ *
+ * \return STATUS_SUCCESS if every range was copied, or
+ * STATUS_PARTIAL_COPY if at least one range failed. The status of
+ * each range is stored in the range.
+ */
+NTSTATUS KpiReadVirtualMemoryScatter(
+    __in HANDLE ProcessHandle,
+    __inout_ecount(NumberOfRanges) PKPH_VM_READ_RANGE Ranges,
+    __in ULONG NumberOfRanges,
+    __out_bcount(BufferSize) PVOID Buffer,
+    __in SIZE_T BufferSize,
+    __in KPROCESSOR_MODE AccessMode
+    )
+{
+    NTSTATUS status;
+    PKPH_VM_READ_RANGE ranges;
+    SIZE_T rangesLength;
+    SIZE_T totalLength;
+    PEPROCESS process;
+    ULONG i;
+    PUCHAR buffer;
+    BOOLEAN allSucceeded;
+
+    PAGED_CODE();
+
+    if (NumberOfRanges == 0)
+        return STATUS_SUCCESS;
+    if (NumberOfRanges > KPH_VM_READ_MAXIMUM_RANGES)
+        return STATUS_INVALID_PARAMETER_3;
+
+    rangesLength = NumberOfRanges * sizeof(KPH_VM_READ_RANGE);
+
+    if (AccessMode != KernelMode)
+    {
+        if (
+            (ULONG_PTR)Buffer + BufferSize < (ULONG_PTR)Buffer ||
+            (ULONG_PTR)Buffer + BufferSize > (ULONG_PTR)MmHighestUserAddress
+            )
+        {
+            return STATUS_ACCESS_VIOLATION;
+        }
+    }
+
+    ranges = ExAllocatePoolWithTag(PagedPool, rangesLength, 'ThpK');
+
+    if (!ranges)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    // Capture the ranges so that the caller can't change them while
+    // we validate and use them.
+    __try
+    {
+        if (AccessMode != KernelMode)
+            ProbeForWrite(Ranges, rangesLength, sizeof(ULONG_PTR));
+
+        memcpy(ranges, Ranges, rangesLength);
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER)
+    {
+        ExFreePoolWithTag(ranges, 'ThpK');
+        return GetExceptionCode();
+    }
+
+    totalLength = 0;
+
+    for (i = 0; i < NumberOfRanges; i++)
+    {
+        if (
+            (ULONG_PTR)ranges[i].BaseAddress + ranges[i].Length < (ULONG_PTR)ranges[i].BaseAddress ||
+            totalLength + ranges[i].Length < totalLength
+            )
+        {
+            ExFreePoolWithTag(ranges, 'ThpK');
+            return STATUS_ACCESS_VIOLATION;
+        }
+
+        totalLength += ranges[i].Length;
+    }
+
+    if (totalLength > BufferSize)
+    {
+        ExFreePoolWithTag(ranges, 'ThpK');
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    status = ObReferenceObjectByHandle(
+        ProcessHandle,
+        0,
+        *PsProcessType,
+        AccessMode,
+        &process,
+        NULL
+        );
+
+    if (!NT_SUCCESS(status))
+    {
+        ExFreePoolWithTag(ranges, 'ThpK');
+        return status;
+    }
+
+    buffer = Buffer;
+    allSucceeded = TRUE;
+
+    for (i = 0; i < NumberOfRanges; i++)
+    {
+        ranges[i].NumberOfBytesRead = 0;
+
+        if (ranges[i].Length == 0)
+        {
+            ranges[i].Status = STATUS_SUCCESS;
+            continue;
+        }
+
+        if (AccessMode != KernelMode &&
+            (ULONG_PTR)ranges[i].BaseAddress + ranges[i].Length > (ULONG_PTR)MmHighestUserAddress)
+        {
+            ranges[i].Status = STATUS_ACCESS_VIOLATION;
+        }
+        else
+        {
+            ranges[i].Status = KphCopyVirtualMemory(
+                process,
+                ranges[i].BaseAddress,
+                PsGetCurrentProcess(),
+                buffer,
+                ranges[i].Length,
+                AccessMode,
+                &ranges[i].NumberOfBytesRead
+                );
+        }
+
+        if (!NT_SUCCESS(ranges[i].Status))
+            allSucceeded = FALSE;
+
+        buffer += ranges[i].Length;
+    }
+
+    ObDereferenceObject(process);
+
+    __try
+    {
+        for (i = 0; i < NumberOfRanges; i++)
+        {
+            Ranges[i].Status = ranges[i].Status;
+            Ranges[i].NumberOfBytesRead = ranges[i].NumberOfBytesRead;
+        }
+
+        status = allSucceeded ? STATUS_SUCCESS : STATUS_PARTIAL_COPY;
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER)
+    {
+        status = GetExceptionCode();
+    }
+
+    ExFreePoolWithTag(ranges, 'ThpK');
+
+    return status;
+}
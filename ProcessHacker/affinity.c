@@ -35,6 +35,10 @@ typedef struct _AFFINITY_DIALOG_CONTEXT
     PPH_THREAD_ITEM ThreadItem;
     ULONG_PTR AffinityMask;
     ULONG_PTR NewAffinityMask;
+
+    // Threads on systems with more than one processor group
+    BOOLEAN UseGroupAffinity;
+    USHORT Group;
 } AFFINITY_DIALOG_CONTEXT, *PAFFINITY_DIALOG_CONTEXT;
 
 INT_PTR CALLBACK PhpProcessAffinityDlgProc(
@@ -56,6 +60,7 @@ VOID PhShowProcessAffinityDialog(
 
     context.ProcessItem = ProcessItem;
     context.ThreadItem = ThreadItem;
+    context.UseGroupAffinity = FALSE;
 
     DialogBoxParam(
         PhInstanceHandle,
@@ -77,6 +82,7 @@ BOOLEAN PhShowProcessAffinityDialog2(
     context.ProcessItem = NULL;
     context.ThreadItem = NULL;
     context.AffinityMask = AffinityMask;
+    context.UseGroupAffinity = FALSE;
 
     if (DialogBoxParam(
         PhInstanceHandle,
@@ -153,7 +159,28 @@ static INT_PTR CALLBACK PhpProcessAffinityDlgProc(
                 {
                     status = PhGetThreadBasicInformation(threadHandle, &basicInfo);
 
-                    if (NT_SUCCESS(status))
+                    if (NT_SUCCESS(status) && PhNumberOfCpuGroups > 1)
+                    {
+                        GROUP_AFFINITY groupAffinity;
+
+                        // The thread may be running in any group, so show the mask for its
+                        // group. The process affinity mask only applies to the primary group.
+                        if (NT_SUCCESS(status = PhGetThreadGroupAffinity(threadHandle, &groupAffinity)))
+                        {
+                            affinityMask = groupAffinity.Mask;
+                            context->UseGroupAffinity = TRUE;
+                            context->Group = groupAffinity.Group;
+
+                            for (i = 0; i < PhNumberOfCpuGroups; i++)
+                            {
+                                if (PhCpuGroups[i].Group == groupAffinity.Group)
+                                    systemAffinityMask = PhCpuGroups[i].ActiveMask;
+                            }
+
+                            SetWindowText(hwndDlg, PhaFormatString(L"Affinity (group %u)", groupAffinity.Group)->Buffer);
+                        }
+                    }
+                    else if (NT_SUCCESS(status))
                     {
                         affinityMask = basicInfo.AffinityMask;
 
@@ -270,11 +297,24 @@ static INT_PTR CALLBACK PhpProcessAffinityDlgProc(
 
                         if (NT_SUCCESS(status = PhOpenThread(
                             &threadHandle,
-                            ThreadSetAccess,
+                            context->UseGroupAffinity ? THREAD_SET_INFORMATION : ThreadSetAccess,
                             context->ThreadItem->ThreadId
                             )))
                         {
-                            status = PhSetThreadAffinityMask(threadHandle, affinityMask);
+                            if (context->UseGroupAffinity)
+                            {
+                                GROUP_AFFINITY groupAffinity;
+
+                                memset(&groupAffinity, 0, sizeof(GROUP_AFFINITY));
+                                groupAffinity.Mask = affinityMask;
+                                groupAffinity.Group = context->Group;
+                                status = PhSetThreadGroupAffinity(threadHandle, groupAffinity);
+                            }
+                            else
+                            {
+                                status = PhSetThreadAffinityMask(threadHandle, affinityMask);
+                            }
+
                             NtClose(threadHandle);
                         }
                     }
@@ -37,6 +37,7 @@
 #pragma warning(pop)
 
 #include <appmodel.h>
+#include <shlobj.h>
 
 typedef LONG (WINAPI *_GetPackageFullName)(
     _In_ HANDLE hProcess,
@@ -984,8 +985,41 @@ VOID PhLoadSymbolProviderOptions(
     _Inout_ PPH_SYMBOL_PROVIDER SymbolProvider
     )
 {
+    static PH_INITONCE initOnce = PH_INITONCE_INIT;
     PPH_STRING searchPath;
 
+    if (PhBeginInitOnce(&initOnce))
+    {
+        // Keep saved symbol indexes next to the settings file.
+        if (PhGetIntegerSetting(L"DbgHelpIndexCache") && PhSettingsFileName)
+        {
+            PPH_STRING fullPath;
+            ULONG indexOfFileName;
+            PPH_STRING directoryName;
+
+            fullPath = PhGetFullPath(PhSettingsFileName->Buffer, &indexOfFileName);
+
+            if (fullPath)
+            {
+                if (indexOfFileName != -1)
+                {
+                    PPH_STRING cacheDirectory;
+
+                    directoryName = PhSubstring(fullPath, 0, indexOfFileName);
+                    cacheDirectory = PhConcatStrings2(directoryName->Buffer, L"symindex");
+                    SHCreateDirectoryEx(NULL, cacheDirectory->Buffer, NULL);
+                    PhSetSymbolIndexCacheDirectory(cacheDirectory->Buffer);
+                    PhDereferenceObject(cacheDirectory);
+                    PhDereferenceObject(directoryName);
+                }
+
+                PhDereferenceObject(fullPath);
+            }
+        }
+
+        PhEndInitOnce(&initOnce);
+    }
+
     PhSetOptionsSymbolProvider(
         SYMOPT_UNDNAME,
         PhGetIntegerSetting(L"DbgHelpUndecorate") ? SYMOPT_UNDNAME : 0
@@ -1870,6 +1904,71 @@ VOID PhApplyTreeNewFilters(
     TreeNew_NodesStructured(Support->TreeNewHandle);
 }
 
+#define PH_CACHED_FORMAT_SIZE 0x10000
+#define PH_CACHED_FORMAT_UINT64 0x20000
+#define PH_CACHED_FORMAT_UINT64_GROUP_DIGITS 0x30000
+
+/**
+ * Formats a size using a cache.
+ *
+ * \param Cache The cache for the cell.
+ * \param Size The size.
+ *
+ * \return The formatted size. The string is owned by \a Cache and is valid until the cache is
+ * used again or deleted with PhDeleteCachedFormat().
+ *
+ * \remarks The string is only recreated if the size or the maximum size unit has changed since
+ * the last call.
+ */
+PPH_STRING PhFormatSizeCached(
+    _Inout_ PPH_CACHED_FORMAT Cache,
+    _In_ ULONG64 Size
+    )
+{
+    ULONG format;
+
+    format = PH_CACHED_FORMAT_SIZE | (PhMaxSizeUnit & 0xffff);
+
+    if (!Cache->Text || Cache->Value != Size || Cache->Format != format)
+    {
+        PhMoveReference(&Cache->Text, PhFormatSize(Size, -1));
+        Cache->Value = Size;
+        Cache->Format = format;
+    }
+
+    return Cache->Text;
+}
+
+/**
+ * Formats a 64-bit unsigned integer using a cache.
+ *
+ * \param Cache The cache for the cell.
+ * \param Value The integer.
+ * \param GroupDigits TRUE to group digits, otherwise FALSE.
+ *
+ * \return The formatted integer. The string is owned by \a Cache and is valid until the cache
+ * is used again or deleted with PhDeleteCachedFormat().
+ */
+PPH_STRING PhFormatUInt64Cached(
+    _Inout_ PPH_CACHED_FORMAT Cache,
+    _In_ ULONG64 Value,
+    _In_ BOOLEAN GroupDigits
+    )
+{
+    ULONG format;
+
+    format = GroupDigits ? PH_CACHED_FORMAT_UINT64_GROUP_DIGITS : PH_CACHED_FORMAT_UINT64;
+
+    if (!Cache->Text || Cache->Value != Value || Cache->Format != format)
+    {
+        PhMoveReference(&Cache->Text, PhFormatUInt64(Value, GroupDigits));
+        Cache->Value = Value;
+        Cache->Format = format;
+    }
+
+    return Cache->Text;
+}
+
 VOID NTAPI PhpCopyCellEMenuItemDeleteFunction(
     _In_ struct _PH_EMENU_ITEM *Item
     )
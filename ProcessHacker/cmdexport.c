@@ -0,0 +1,532 @@
+/*
+ * Process Hacker -
+ *   command line snapshot export
+ *
+ * Copyright (C) 2016 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The export command runs the providers on the current thread without creating any windows
+ * or tree nodes, and writes their items as rows:
+ *
+ * ProcessHacker.exe -c -ctype export -caction csv|jsonl [-cobject file] [-cvalue samples]
+ *   [-interval milliseconds] [-tables process,thread,network,service]
+ *
+ * Rows go to standard output if no file is specified. Every row starts with the table name,
+ * the sample number and the sample time in milliseconds since 1970.
+ */
+
+#include <phapp.h>
+
+#define PH_EXPORT_TABLE_PROCESS 0x1
+#define PH_EXPORT_TABLE_THREAD 0x2
+#define PH_EXPORT_TABLE_NETWORK 0x4
+#define PH_EXPORT_TABLE_SERVICE 0x8
+#define PH_EXPORT_TABLE_ALL 0xf
+
+#define PH_EXPORT_TABLE_COUNT 4
+
+#define PH_EXPORT_OPTION_INTERVAL 1
+#define PH_EXPORT_OPTION_TABLES 2
+
+typedef enum _PH_EXPORT_FORMAT
+{
+    ExportFormatCsv,
+    ExportFormatJsonLines
+} PH_EXPORT_FORMAT;
+
+typedef struct _PH_EXPORT_CONTEXT
+{
+    PPH_FILE_STREAM FileStream;
+    PH_EXPORT_FORMAT Format;
+    ULONG Tables;
+    ULONG Interval;
+
+    ULONG Sample;
+    ULONG64 Time;
+
+    ULONG TableIndex;
+    BOOLEAN HeaderWritten[PH_EXPORT_TABLE_COUNT];
+    BOOLEAN NeedsHeader;
+    PH_STRING_BUILDER Header;
+    PH_STRING_BUILDER Row;
+} PH_EXPORT_CONTEXT, *PPH_EXPORT_CONTEXT;
+
+static PWSTR PhpExportTableNames[PH_EXPORT_TABLE_COUNT] = { L"process", L"thread", L"network", L"service" };
+
+static BOOLEAN NTAPI PhpExportOptionCallback(
+    _In_opt_ PPH_COMMAND_LINE_OPTION Option,
+    _In_opt_ PPH_STRING Value,
+    _In_opt_ PVOID Context
+    )
+{
+    PPH_EXPORT_CONTEXT context = Context;
+    ULONG64 integer;
+
+    if (Option)
+    {
+        switch (Option->Id)
+        {
+        case PH_EXPORT_OPTION_INTERVAL:
+            if (PhStringToInteger64(&Value->sr, 10, &integer))
+                context->Interval = (ULONG)integer;
+            break;
+        case PH_EXPORT_OPTION_TABLES:
+            {
+                PH_STRINGREF remaining;
+                PH_STRINGREF part;
+                ULONG i;
+
+                context->Tables = 0;
+                remaining = Value->sr;
+
+                while (remaining.Length != 0)
+                {
+                    PhSplitStringRefAtChar(&remaining, ',', &part, &remaining);
+
+                    for (i = 0; i < PH_EXPORT_TABLE_COUNT; i++)
+                    {
+                        if (PhEqualStringRef2(&part, PhpExportTableNames[i], TRUE))
+                            context->Tables |= 1 << i;
+                    }
+                }
+            }
+            break;
+        }
+    }
+
+    return TRUE;
+}
+
+static VOID PhpExportAppendEscaped(
+    _In_ PPH_EXPORT_CONTEXT Context,
+    _Inout_ PPH_STRING_BUILDER StringBuilder,
+    _In_ PPH_STRINGREF String
+    )
+{
+    SIZE_T count;
+    SIZE_T i;
+    WCHAR c;
+
+    count = String->Length / sizeof(WCHAR);
+    PhAppendCharStringBuilder(StringBuilder, '"');
+
+    for (i = 0; i < count; i++)
+    {
+        c = String->Buffer[i];
+
+        if (Context->Format == ExportFormatCsv)
+        {
+            if (c == '"')
+                PhAppendCharStringBuilder(StringBuilder, '"');
+
+            PhAppendCharStringBuilder(StringBuilder, c);
+        }
+        else
+        {
+            if (c == '"' || c == '\\')
+            {
+                PhAppendCharStringBuilder(StringBuilder, '\\');
+                PhAppendCharStringBuilder(StringBuilder, c);
+            }
+            else if (c < ' ')
+            {
+                PhAppendFormatStringBuilder(StringBuilder, L"\\u%04x", c);
+            }
+            else
+            {
+                PhAppendCharStringBuilder(StringBuilder, c);
+            }
+        }
+    }
+
+    PhAppendCharStringBuilder(StringBuilder, '"');
+}
+
+static VOID PhpExportBeginField(
+    _In_ PPH_EXPORT_CONTEXT Context,
+    _In_ PWSTR Name
+    )
+{
+    if (Context->Format == ExportFormatCsv)
+    {
+        PhAppendCharStringBuilder(&Context->Row, ',');
+
+        if (Context->NeedsHeader)
+        {
+            PhAppendCharStringBuilder(&Context->Header, ',');
+            PhAppendStringBuilder2(&Context->Header, Name);
+        }
+    }
+    else
+    {
+        PhAppendFormatStringBuilder(&Context->Row, L",\"%s\":", Name);
+    }
+}
+
+static VOID PhpExportString(
+    _In_ PPH_EXPORT_CONTEXT Context,
+    _In_ PWSTR Name,
+    _In_opt_ PPH_STRINGREF Value
+    )
+{
+    static PH_STRINGREF emptyString = PH_STRINGREF_INIT(L"");
+
+    PhpExportBeginField(Context, Name);
+    PhpExportAppendEscaped(Context, &Context->Row, Value ? Value : &emptyString);
+}
+
+static VOID PhpExportString2(
+    _In_ PPH_EXPORT_CONTEXT Context,
+    _In_ PWSTR Name,
+    _In_opt_ PWSTR Value
+    )
+{
+    PH_STRINGREF value;
+
+    if (Value)
+        PhInitializeStringRefLongHint(&value, Value);
+    else
+        PhInitializeEmptyStringRef(&value);
+
+    PhpExportString(Context, Name, &value);
+}
+
+static VOID PhpExportInteger(
+    _In_ PPH_EXPORT_CONTEXT Context,
+    _In_ PWSTR Name,
+    _In_ ULONG64 Value
+    )
+{
+    PhpExportBeginField(Context, Name);
+    PhAppendFormatStringBuilder(&Context->Row, L"%I64u", Value);
+}
+
+static VOID PhpExportFloat(
+    _In_ PPH_EXPORT_CONTEXT Context,
+    _In_ PWSTR Name,
+    _In_ FLOAT Value
+    )
+{
+    PhpExportBeginField(Context, Name);
+    PhAppendFormatStringBuilder(&Context->Row, L"%.2f", Value);
+}
+
+static ULONG64 PhpExportUnixTime(
+    _In_ PLARGE_INTEGER Time
+    )
+{
+    // 100ns intervals between 1601 and 1970.
+    if (Time->QuadPart < 116444736000000000)
+        return 0;
+
+    return (ULONG64)(Time->QuadPart - 116444736000000000) / PH_TICKS_PER_MS;
+}
+
+static VOID PhpExportBeginRow(
+    _In_ PPH_EXPORT_CONTEXT Context,
+    _In_ ULONG TableIndex
+    )
+{
+    Context->TableIndex = TableIndex;
+    Context->NeedsHeader = Context->Format == ExportFormatCsv && !Context->HeaderWritten[TableIndex];
+
+    if (Context->NeedsHeader)
+        PhAppendStringBuilder2(&Context->Header, L"table,sample,time");
+
+    if (Context->Format == ExportFormatCsv)
+    {
+        PhAppendFormatStringBuilder(&Context->Row, L"%s,%u,%I64u",
+            PhpExportTableNames[TableIndex], Context->Sample, Context->Time);
+    }
+    else
+    {
+        PhAppendFormatStringBuilder(&Context->Row, L"{\"table\":\"%s\",\"sample\":%u,\"time\":%I64u",
+            PhpExportTableNames[TableIndex], Context->Sample, Context->Time);
+    }
+}
+
+static VOID PhpExportEndRow(
+    _In_ PPH_EXPORT_CONTEXT Context
+    )
+{
+    if (Context->Format == ExportFormatJsonLines)
+        PhAppendCharStringBuilder(&Context->Row, '}');
+
+    PhAppendStringBuilder2(&Context->Row, L"\r\n");
+
+    if (Context->NeedsHeader)
+    {
+        PhAppendStringBuilder2(&Context->Header, L"\r\n");
+        PhWriteStringAsUtf8FileStreamEx(Context->FileStream, Context->Header.String->Buffer, Context->Header.String->Length);
+        PhRemoveEndStringBuilder(&Context->Header, Context->Header.String->Length / sizeof(WCHAR));
+
+        Context->HeaderWritten[Context->TableIndex] = TRUE;
+        Context->NeedsHeader = FALSE;
+    }
+
+    PhWriteStringAsUtf8FileStreamEx(Context->FileStream, Context->Row.String->Buffer, Context->Row.String->Length);
+
+    // Keep the buffer for the next row.
+    PhRemoveEndStringBuilder(&Context->Row, Context->Row.String->Length / sizeof(WCHAR));
+}
+
+static VOID PhpExportProcesses(
+    _In_ PPH_EXPORT_CONTEXT Context
+    )
+{
+    PPH_PROCESS_ITEM *processItems;
+    ULONG numberOfProcessItems;
+    ULONG i;
+
+    PhEnumProcessItems(&processItems, &numberOfProcessItems);
+
+    for (i = 0; i < numberOfProcessItems; i++)
+    {
+        PPH_PROCESS_ITEM processItem = processItems[i];
+
+        PhpExportBeginRow(Context, 0);
+        PhpExportInteger(Context, L"pid", HandleToUlong(processItem->ProcessId));
+        PhpExportInteger(Context, L"ppid", HandleToUlong(processItem->ParentProcessId));
+        PhpExportString(Context, L"name", &processItem->ProcessName->sr);
+        PhpExportString(Context, L"user", processItem->UserName ? &processItem->UserName->sr : NULL);
+        PhpExportInteger(Context, L"session", processItem->SessionId);
+        PhpExportInteger(Context, L"create_time", PhpExportUnixTime(&processItem->CreateTime));
+        PhpExportFloat(Context, L"cpu", processItem->CpuUsage * 100);
+        PhpExportInteger(Context, L"private_bytes", processItem->VmCounters.PagefileUsage);
+        PhpExportInteger(Context, L"working_set", processItem->VmCounters.WorkingSetSize);
+        PhpExportInteger(Context, L"io_read_bytes", processItem->IoCounters.ReadTransferCount);
+        PhpExportInteger(Context, L"io_write_bytes", processItem->IoCounters.WriteTransferCount);
+        PhpExportInteger(Context, L"io_other_bytes", processItem->IoCounters.OtherTransferCount);
+        PhpExportInteger(Context, L"threads", processItem->NumberOfThreads);
+        PhpExportInteger(Context, L"handles", processItem->NumberOfHandles);
+        PhpExportInteger(Context, L"priority", processItem->BasePriority);
+        PhpExportEndRow(Context);
+    }
+
+    PhDereferenceObjects(processItems, numberOfProcessItems);
+    PhFree(processItems);
+}
+
+static VOID PhpExportThreads(
+    _In_ PPH_EXPORT_CONTEXT Context
+    )
+{
+    PSYSTEM_PROCESS_INFORMATION process;
+    ULONG i;
+
+    // The process provider runs on this thread, so its snapshot is safe to use.
+    if (!PhProcessInformation)
+        return;
+
+    process = PH_FIRST_PROCESS(PhProcessInformation);
+
+    do
+    {
+        for (i = 0; i < process->NumberOfThreads; i++)
+        {
+            PSYSTEM_THREAD_INFORMATION thread = &process->Threads[i];
+
+            PhpExportBeginRow(Context, 1);
+            PhpExportInteger(Context, L"pid", HandleToUlong(process->UniqueProcessId));
+            PhpExportInteger(Context, L"tid", HandleToUlong(thread->ClientId.UniqueThread));
+            PhpExportInteger(Context, L"start_address", (ULONG_PTR)thread->StartAddress);
+            PhpExportInteger(Context, L"priority", thread->Priority);
+            PhpExportInteger(Context, L"base_priority", thread->BasePriority);
+            PhpExportInteger(Context, L"state", thread->ThreadState);
+            PhpExportInteger(Context, L"wait_reason", thread->WaitReason);
+            PhpExportInteger(Context, L"kernel_time", thread->KernelTime.QuadPart);
+            PhpExportInteger(Context, L"user_time", thread->UserTime.QuadPart);
+            PhpExportInteger(Context, L"context_switches", thread->ContextSwitches);
+            PhpExportEndRow(Context);
+        }
+    } while (process = PH_NEXT_PROCESS(process));
+}
+
+static VOID PhpExportNetwork(
+    _In_ PPH_EXPORT_CONTEXT Context
+    )
+{
+    PPH_NETWORK_ITEM *networkItems;
+    ULONG numberOfNetworkItems;
+    ULONG i;
+
+    PhEnumNetworkItems(&networkItems, &numberOfNetworkItems);
+
+    for (i = 0; i < numberOfNetworkItems; i++)
+    {
+        PPH_NETWORK_ITEM networkItem = networkItems[i];
+
+        PhpExportBeginRow(Context, 2);
+        PhpExportInteger(Context, L"pid", HandleToUlong(networkItem->ProcessId));
+        PhpExportString(Context, L"process", networkItem->ProcessName ? &networkItem->ProcessName->sr : NULL);
+        PhpExportString2(Context, L"protocol", PhGetProtocolTypeName(networkItem->ProtocolType));
+        PhpExportString2(Context, L"local_address", networkItem->LocalAddressString);
+        PhpExportInteger(Context, L"local_port", networkItem->LocalEndpoint.Port);
+        PhpExportString2(Context, L"remote_address", networkItem->RemoteAddressString);
+        PhpExportInteger(Context, L"remote_port", networkItem->RemoteEndpoint.Port);
+        PhpExportString2(Context, L"state", (networkItem->ProtocolType & PH_TCP_PROTOCOL_TYPE) ? PhGetTcpStateName(networkItem->State) : NULL);
+        PhpExportEndRow(Context);
+    }
+
+    PhDereferenceObjects(networkItems, numberOfNetworkItems);
+    PhFree(networkItems);
+}
+
+static VOID PhpExportServices(
+    _In_ PPH_EXPORT_CONTEXT Context
+    )
+{
+    PPH_SERVICE_ITEM *serviceItems;
+    ULONG numberOfServiceItems;
+    ULONG i;
+
+    PhEnumServiceItems(&serviceItems, &numberOfServiceItems);
+
+    for (i = 0; i < numberOfServiceItems; i++)
+    {
+        PPH_SERVICE_ITEM serviceItem = serviceItems[i];
+
+        PhpExportBeginRow(Context, 3);
+        PhpExportString(Context, L"name", &serviceItem->Name->sr);
+        PhpExportString(Context, L"display_name", &serviceItem->DisplayName->sr);
+        PhpExportString2(Context, L"type", PhGetServiceTypeString(serviceItem->Type));
+        PhpExportString2(Context, L"state", PhGetServiceStateString(serviceItem->State));
+        PhpExportString2(Context, L"start_type", PhGetServiceStartTypeString(serviceItem->StartType));
+        PhpExportInteger(Context, L"pid", HandleToUlong(serviceItem->ProcessId));
+        PhpExportEndRow(Context);
+    }
+
+    PhDereferenceObjects(serviceItems, numberOfServiceItems);
+    PhFree(serviceItems);
+}
+
+NTSTATUS PhCommandModeExport(
+    VOID
+    )
+{
+    static PH_COMMAND_LINE_OPTION options[] =
+    {
+        { PH_EXPORT_OPTION_INTERVAL, L"interval", MandatoryArgumentType },
+        { PH_EXPORT_OPTION_TABLES, L"tables", MandatoryArgumentType }
+    };
+    NTSTATUS status;
+    PH_EXPORT_CONTEXT context;
+    PH_STRINGREF commandLine;
+    ULONG64 samples;
+    LARGE_INTEGER time;
+    LARGE_INTEGER interval;
+
+    memset(&context, 0, sizeof(PH_EXPORT_CONTEXT));
+
+    if (PhEqualString2(PhStartupParameters.CommandAction, L"csv", TRUE))
+        context.Format = ExportFormatCsv;
+    else if (PhEqualString2(PhStartupParameters.CommandAction, L"jsonl", TRUE))
+        context.Format = ExportFormatJsonLines;
+    else
+        return STATUS_INVALID_PARAMETER;
+
+    samples = 1;
+
+    if (PhStartupParameters.CommandValue)
+    {
+        if (!PhStringToInteger64(&PhStartupParameters.CommandValue->sr, 10, &samples) || samples == 0)
+            return STATUS_INVALID_PARAMETER;
+    }
+
+    context.Tables = PH_EXPORT_TABLE_ALL;
+    context.Interval = PhGetIntegerSetting(L"UpdateInterval");
+
+    PhUnicodeStringToStringRef(&NtCurrentPeb()->ProcessParameters->CommandLine, &commandLine);
+    PhParseCommandLine(
+        &commandLine,
+        options,
+        sizeof(options) / sizeof(PH_COMMAND_LINE_OPTION),
+        PH_COMMAND_LINE_IGNORE_UNKNOWN_OPTIONS,
+        PhpExportOptionCallback,
+        &context
+        );
+
+    if (PhStartupParameters.CommandObject)
+    {
+        status = PhCreateFileStream(
+            &context.FileStream,
+            PhStartupParameters.CommandObject->Buffer,
+            FILE_GENERIC_WRITE,
+            FILE_SHARE_READ,
+            FILE_OVERWRITE_IF,
+            0
+            );
+    }
+    else
+    {
+        HANDLE outputHandle = NtCurrentPeb()->ProcessParameters->StandardOutput;
+
+        if (!outputHandle || outputHandle == INVALID_HANDLE_VALUE)
+            return STATUS_INVALID_HANDLE;
+
+        status = PhCreateFileStream2(&context.FileStream, outputHandle, PH_FILE_STREAM_HANDLE_UNOWNED, 0x1000);
+    }
+
+    if (!NT_SUCCESS(status))
+        return status;
+
+    // Host names are not needed and would cost a lookup for every remote address.
+    PhEnableNetworkProviderResolve = FALSE;
+
+    PhInitializeStringBuilder(&context.Header, 0x100);
+    PhInitializeStringBuilder(&context.Row, 0x200);
+
+    for (context.Sample = 0; context.Sample < samples; context.Sample++)
+    {
+        if (context.Sample != 0)
+        {
+            interval.QuadPart = -(LONGLONG)context.Interval * PH_TIMEOUT_MS;
+            NtDelayExecution(FALSE, &interval);
+        }
+
+        if (context.Tables & (PH_EXPORT_TABLE_PROCESS | PH_EXPORT_TABLE_THREAD))
+            PhProcessProviderUpdate(NULL);
+        if (context.Tables & PH_EXPORT_TABLE_NETWORK)
+            PhNetworkProviderUpdate(NULL);
+        if (context.Tables & PH_EXPORT_TABLE_SERVICE)
+            PhServiceProviderUpdate(NULL);
+
+        PhQuerySystemTime(&time);
+        context.Time = PhpExportUnixTime(&time);
+
+        if (context.Tables & PH_EXPORT_TABLE_PROCESS)
+            PhpExportProcesses(&context);
+        if (context.Tables & PH_EXPORT_TABLE_THREAD)
+            PhpExportThreads(&context);
+        if (context.Tables & PH_EXPORT_TABLE_NETWORK)
+            PhpExportNetwork(&context);
+        if (context.Tables & PH_EXPORT_TABLE_SERVICE)
+            PhpExportServices(&context);
+
+        // Write each sample out as soon as it is complete so that readers can stream the output.
+        if (!NT_SUCCESS(status = PhFlushFileStream(context.FileStream, FALSE)))
+            break;
+    }
+
+    PhDeleteStringBuilder(&context.Row);
+    PhDeleteStringBuilder(&context.Header);
+    PhDereferenceObject(context.FileStream);
+
+    return status;
+}
@@ -390,6 +390,26 @@ NTSTATUS PhCommandModeStart(
             }
         }
     }
+    else if (PhEqualString2(PhStartupParameters.CommandType, L"export", TRUE))
+    {
+        status = PhCommandModeExport();
+    }
+    else if (PhEqualString2(PhStartupParameters.CommandType, L"recording", TRUE))
+    {
+        status = PhCommandModeDumpRecording();
+    }
+    else if (PhEqualString2(PhStartupParameters.CommandType, L"replay", TRUE))
+    {
+        status = PhCommandModeReplay();
+    }
+    else if (PhEqualString2(PhStartupParameters.CommandType, L"remote", TRUE))
+    {
+        status = PhCommandModeRemote();
+    }
+    else if (PhEqualString2(PhStartupParameters.CommandType, L"minidump", TRUE))
+    {
+        status = PhCommandModeExpandMiniDump();
+    }
 
     return status;
 }
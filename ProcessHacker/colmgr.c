@@ -47,6 +47,7 @@ VOID PhCmInitializeManager(
     Manager->PostSortFunction = PostSortFunction;
     InitializeListHead(&Manager->ColumnListHead);
     Manager->NotifyList = NULL;
+    Manager->ColumnList = NULL;
 }
 
 VOID PhCmDeleteManager(
@@ -68,6 +69,8 @@ VOID PhCmDeleteManager(
 
     if (Manager->NotifyList)
         PhDereferenceObject(Manager->NotifyList);
+    if (Manager->ColumnList)
+        PhDereferenceObject(Manager->ColumnList);
 }
 
 PPH_CM_COLUMN PhCmCreateColumn(
@@ -91,6 +94,11 @@ PPH_CM_COLUMN PhCmCreateColumn(
     column->SortFunction = SortFunction;
     InsertTailList(&Manager->ColumnListHead, &column->ListEntry);
 
+    if (!Manager->ColumnList)
+        Manager->ColumnList = PhCreateList(8);
+
+    PhAddItemList(Manager->ColumnList, column);
+
     memset(&tnColumn, 0, sizeof(PH_TREENEW_COLUMN));
     tnColumn.Id = column->Id;
     tnColumn.Context = column;
@@ -168,16 +176,17 @@ BOOLEAN PhCmForwardMessage(
     case TreeNewGetCellText:
         {
             PPH_TREENEW_GET_CELL_TEXT getCellText = Parameter1;
-            PH_TREENEW_COLUMN tnColumn;
             PPH_CM_COLUMN column;
 
             if (getCellText->Id < Manager->MinId)
                 return FALSE;
 
-            if (!TreeNew_GetColumn(hwnd, getCellText->Id, &tnColumn))
+            // This is called for every visible cell, so we look up the column directly instead of
+            // asking the tree.
+            if (!Manager->ColumnList || getCellText->Id - Manager->MinId >= Manager->ColumnList->Count)
                 return FALSE;
 
-            column = tnColumn.Context;
+            column = Manager->ColumnList->Items[getCellText->Id - Manager->MinId];
             pluginMessage.SubId = column->SubId;
             pluginMessage.Context = column->Context;
             plugin = column->Plugin;
@@ -290,7 +299,7 @@ BOOLEAN PhCmForwardSort(
     sortContext.Context = column->Context;
     sortContext.PostSortFunction = Manager->PostSortFunction;
     sortContext.SortOrder = SortOrder;
-    qsort_s(Nodes, NumberOfNodes, sizeof(PVOID), PhCmpSortFunction, &sortContext);
+    PhSortItemsIncrementalEx(Nodes, NumberOfNodes, PhCmpSortFunction, &sortContext);
 
     return TRUE;
 }
@@ -276,6 +276,9 @@ static VOID PhpPrintHashtableStatistics(
     wprintf(L"Next free entry: %d\n", Hashtable->FreeEntry);
     wprintf(L"Next usable entry: %d\n", Hashtable->NextEntry);
 
+    if (Hashtable->OldBuckets)
+        wprintf(L"Resizing: %u of %u old buckets moved (entries in the old buckets are not shown)\n", Hashtable->MigrateIndex, Hashtable->OldAllocatedBuckets);
+
     wprintf(L"Hash function: %s\n", PhpGetSymbolForAddress(Hashtable->HashFunction));
     wprintf(L"Compare function: %s\n", PhpGetSymbolForAddress(Hashtable->CompareFunction));
 
@@ -443,6 +446,84 @@ static NTSTATUS PhpLeakEnumerationRoutine(
     return 0;
 }
 
+#define DIAGNOSTICS_SUMMARY_SAMPLES 60
+
+static BOOLEAN NTAPI PhpPrintDiagnosticsSeriesCallback(
+    _In_ PPH_DIAGNOSTICS_SERIES Series,
+    _In_opt_ PVOID Context
+    )
+{
+    PPH_STRINGREF filter = Context;
+    ULONG count;
+
+    if (filter && PhFindStringInStringRef(&Series->Name, filter, TRUE) == -1)
+        return TRUE;
+
+    count = min(Series->History.Count, DIAGNOSTICS_SUMMARY_SAMPLES);
+
+    if (count == 0)
+        return TRUE;
+
+    wprintf(
+        L"%-56.*s %12I64u %12I64u %12I64u\n",
+        (ULONG)(Series->Name.Length / sizeof(WCHAR)),
+        Series->Name.Buffer,
+        Series->Value,
+        PhSumCircularBuffer_ULONG64(&Series->History, 0, count) / count,
+        PhMaximumCircularBuffer_ULONG64(&Series->History, 0, count)
+        );
+
+    return TRUE;
+}
+
+static BOOLEAN NTAPI PhpPrintObjectTypeCallback(
+    _In_ PPH_OBJECT_TYPE_INFORMATION Information,
+    _In_opt_ PVOID Context
+    )
+{
+    PPH_STRINGREF filter = Context;
+    PH_STRINGREF name;
+
+    PhInitializeStringRef(&name, Information->Name);
+
+    if (filter && PhFindStringInStringRef(&name, filter, TRUE) == -1)
+        return TRUE;
+
+    wprintf(
+        L"%-24s %10u %14Iu %14Iu %12u\n",
+        Information->Name,
+        Information->NumberOfObjects,
+        Information->NumberOfBytes,
+        Information->PeakNumberOfBytes,
+        Information->NumberOfAllocations
+        );
+
+    return TRUE;
+}
+
+#define OBJECT_SITES_TO_PRINT 20
+
+static BOOLEAN NTAPI PhpCollectObjectAllocationSiteCallback(
+    _In_ PPH_OBJECT_ALLOCATION_SITE_INFORMATION Information,
+    _In_opt_ PVOID Context
+    )
+{
+    PhAddItemList(Context, PhAllocateCopy(Information, sizeof(PH_OBJECT_ALLOCATION_SITE_INFORMATION)));
+
+    return TRUE;
+}
+
+static int __cdecl PhpObjectAllocationSiteCompare(
+    _In_ const void *elem1,
+    _In_ const void *elem2
+    )
+{
+    PPH_OBJECT_ALLOCATION_SITE_INFORMATION site1 = *(PPH_OBJECT_ALLOCATION_SITE_INFORMATION *)elem1;
+    PPH_OBJECT_ALLOCATION_SITE_INFORMATION site2 = *(PPH_OBJECT_ALLOCATION_SITE_INFORMATION *)elem2;
+
+    return -uint64cmp(site1->NumberOfBytes, site2->NumberOfBytes);
+}
+
 typedef struct _STOPWATCH
 {
     LARGE_INTEGER StartCounter;
@@ -729,6 +810,8 @@ NTSTATUS PhpDebugConsoleThreadStart(
                 L"testlocks\n"
                 L"stats\n"
                 L"objects [type-name-filter]\n"
+                L"objtypes [type-name-filter]\n"
+                L"objsites [on [interval]|off|reset|type-name-filter]\n"
                 L"objtrace object-address\n"
                 L"objmksnap\n"
                 L"objcmpsnap\n"
@@ -740,12 +823,16 @@ NTSTATUS PhpDebugConsoleThreadStart(
                 L"threads\n"
                 L"provthreads\n"
                 L"workqueues\n"
+                L"procquery\n"
                 L"procrecords\n"
                 L"procitem\n"
                 L"uniquestr\n"
                 L"enableleakdetect\n"
                 L"leakdetect\n"
                 L"mem\n"
+                L"slabs\n"
+                L"lockstats [on|off|reset]\n"
+                L"diag [start [interval-ms]|stop|save file-name|filter]\n"
                 );
         }
         else if (PhEqualStringZ(command, L"exit", TRUE))
@@ -832,6 +919,28 @@ NTSTATUS PhpDebugConsoleThreadStart(
             PhStopStopwatch(&stopwatch);
 
             wprintf(L"Queued lock: %ums\n", PhGetMillisecondsStopwatch(&stopwatch));
+
+            // String hashing
+
+            testString = PhCreateString(L"\\Device\\HarddiskVolume1\\Windows\\System32\\kernel32.dll");
+            PhStartStopwatch(&stopwatch);
+
+            for (i = 0; i < 10000000; i++)
+                PhHashStringRef(&testString->sr, FALSE);
+
+            PhStopStopwatch(&stopwatch);
+
+            wprintf(L"Hash string: %ums\n", PhGetMillisecondsStopwatch(&stopwatch));
+
+            PhStartStopwatch(&stopwatch);
+
+            for (i = 0; i < 10000000; i++)
+                PhHashStringRef(&testString->sr, TRUE);
+
+            PhStopStopwatch(&stopwatch);
+            PhDereferenceObject(testString);
+
+            wprintf(L"Hash string (ignore case): %ums\n", PhGetMillisecondsStopwatch(&stopwatch));
         }
         else if (PhEqualStringZ(command, L"testlocks", TRUE))
         {
@@ -885,6 +994,8 @@ NTSTATUS PhpDebugConsoleThreadStart(
             wprintf(L"Statistics:\n");
 #define PRINT_STATISTIC(Name) wprintf(L#Name L": %u\n", PhLibStatisticsBlock.Name);
 
+            PRINT_STATISTIC(BaseAllocations);
+            PRINT_STATISTIC(BaseReAllocations);
             PRINT_STATISTIC(BaseThreadsCreated);
             PRINT_STATISTIC(BaseThreadsCreateFailed);
             PRINT_STATISTIC(BaseStringBuildersCreated);
@@ -897,18 +1008,30 @@ NTSTATUS PhpDebugConsoleThreadStart(
             PRINT_STATISTIC(RefObjectsFreedToSmallFreeList);
             PRINT_STATISTIC(RefObjectsAllocatedFromTypeFreeList);
             PRINT_STATISTIC(RefObjectsFreedToTypeFreeList);
+            PRINT_STATISTIC(RefObjectsAllocatedFromArena);
             PRINT_STATISTIC(RefObjectsDeleteDeferred);
             PRINT_STATISTIC(RefAutoPoolsCreated);
             PRINT_STATISTIC(RefAutoPoolsDestroyed);
             PRINT_STATISTIC(RefAutoPoolsDynamicAllocated);
             PRINT_STATISTIC(RefAutoPoolsDynamicResized);
+            PRINT_STATISTIC(RefAutoPoolArenasAllocated);
+            PRINT_STATISTIC(RefAutoPoolArenasEscaped);
             PRINT_STATISTIC(QlBlockSpins);
             PRINT_STATISTIC(QlBlockWaits);
             PRINT_STATISTIC(QlAcquireExclusiveBlocks);
             PRINT_STATISTIC(QlAcquireSharedBlocks);
+            PRINT_STATISTIC(QlOptimizations);
+            PRINT_STATISTIC(QlWakes);
+            PRINT_STATISTIC(QlWakesDeferred);
+            PRINT_STATISTIC(QlWaitersWoken);
+            PRINT_STATISTIC(QlKeyedEventReleases);
             PRINT_STATISTIC(WqWorkQueueThreadsCreated);
             PRINT_STATISTIC(WqWorkQueueThreadsCreateFailed);
             PRINT_STATISTIC(WqWorkItemsQueued);
+            PRINT_STATISTIC(WqWorkItemsStolen);
+            PRINT_STATISTIC(WqWorkItemsDropped);
+            PRINT_STATISTIC(EpEpochsAdvanced);
+            PRINT_STATISTIC(EpEntriesReclaimed);
 
 #else
             wprintf(commandDebugOnly);
@@ -978,6 +1101,109 @@ NTSTATUS PhpDebugConsoleThreadStart(
             wprintf(commandDebugOnly);
 #endif
         }
+        else if (PhEqualStringZ(command, L"objtypes", TRUE))
+        {
+            PWSTR typeFilter = wcstok_s(NULL, delims, &context);
+            PH_STRINGREF filter;
+
+            if (typeFilter)
+                PhInitializeStringRef(&filter, typeFilter);
+
+            wprintf(L"%-24s %10s %14s %14s %12s\n", L"Type", L"Objects", L"Bytes", L"Peak bytes", L"Allocations");
+            PhEnumObjectTypeInformation(PhpPrintObjectTypeCallback, typeFilter ? &filter : NULL);
+#ifndef _WIN64
+            wprintf(L"Bytes are only recorded on 64-bit systems.\n");
+#endif
+        }
+        else if (PhEqualStringZ(command, L"objsites", TRUE))
+        {
+            PWSTR options;
+            PWSTR argument;
+            PH_STRINGREF filter;
+            PPH_LIST sites;
+            ULONG interval;
+            ULONG numberOfPrinted;
+            ULONG i;
+            ULONG j;
+
+            options = wcstok_s(NULL, delims, &context);
+            argument = options ? wcstok_s(NULL, delims, &context) : NULL;
+
+            if (options && PhEqualStringZ(options, L"on", TRUE))
+            {
+                ULONG64 interval64 = 64;
+
+                if (argument)
+                {
+                    PH_STRINGREF intervalString;
+
+                    PhInitializeStringRef(&intervalString, argument);
+
+                    if (!PhStringToInteger64(&intervalString, 10, &interval64) || interval64 == 0 || interval64 > MAXULONG)
+                    {
+                        wprintf(L"Invalid interval.\n");
+                        goto EndCommand;
+                    }
+                }
+
+                PhSetObjectAllocationSampling((ULONG)interval64);
+                wprintf(L"Sampling every %I64u allocations.\n", interval64);
+                goto EndCommand;
+            }
+            else if (options && PhEqualStringZ(options, L"off", TRUE))
+            {
+                PhSetObjectAllocationSampling(0);
+                goto EndCommand;
+            }
+            else if (options && PhEqualStringZ(options, L"reset", TRUE))
+            {
+                PhResetObjectAllocationSites();
+                goto EndCommand;
+            }
+
+            if (options)
+                PhInitializeStringRef(&filter, options);
+
+            interval = PhGetObjectAllocationSampling();
+            sites = PhCreateList(64);
+            PhEnumObjectAllocationSites(PhpCollectObjectAllocationSiteCallback, sites);
+            qsort(sites->Items, sites->Count, sizeof(PVOID), PhpObjectAllocationSiteCompare);
+            numberOfPrinted = 0;
+
+            for (i = 0; i < sites->Count; i++)
+            {
+                PPH_OBJECT_ALLOCATION_SITE_INFORMATION site = sites->Items[i];
+                PH_STRINGREF typeName;
+
+                PhInitializeStringRef(&typeName, site->TypeName);
+
+                if (options && PhFindStringInStringRef(&typeName, &filter, TRUE) == -1)
+                    continue;
+
+                if (numberOfPrinted < OBJECT_SITES_TO_PRINT)
+                {
+                    wprintf(L"%s: %u samples, %I64u bytes sampled\n", site->TypeName, site->NumberOfSamples, site->NumberOfBytes);
+
+                    for (j = 0; j < site->NumberOfFrames; j++)
+                        wprintf(L"\t%s\n", PhpGetSymbolForAddress(site->Frames[j]));
+                }
+
+                numberOfPrinted++;
+            }
+
+            if (numberOfPrinted > OBJECT_SITES_TO_PRINT)
+                wprintf(L"(%u more sites not shown)\n", numberOfPrinted - OBJECT_SITES_TO_PRINT);
+
+            if (interval != 0)
+                wprintf(L"Sampling every %u allocations; multiply by %u to estimate totals.\n", interval, interval);
+            else
+                wprintf(L"Sampling is off (use \"objsites on [interval]\").\n");
+
+            for (i = 0; i < sites->Count; i++)
+                PhFree(sites->Items[i]);
+
+            PhDereferenceObject(sites);
+        }
         else if (PhEqualStringZ(command, L"objtrace", TRUE))
         {
 #ifdef DEBUG
@@ -1321,6 +1547,7 @@ NTSTATUS PhpDebugConsoleThreadStart(
                 {
                     PPH_WORK_QUEUE workQueue = PhDbgWorkQueueList->Items[i];
                     PLIST_ENTRY workQueueItemEntry;
+                    ULONG priority;
 
                     wprintf(L"Work queue at %s\n", PhpGetSymbolForAddress(workQueue));
                     wprintf(L"Maximum threads: %u\n", workQueue->MaximumThreads);
@@ -1330,22 +1557,35 @@ NTSTATUS PhpDebugConsoleThreadStart(
                     wprintf(L"Current threads: %u\n", workQueue->CurrentThreads);
                     wprintf(L"Busy count: %u\n", workQueue->BusyCount);
 
-                    PhAcquireQueuedLockExclusive(&workQueue->QueueLock);
+                    if (workQueue->Flags & PH_WORK_QUEUE_WORK_STEALING)
+                    {
+                        // Items are spread over the worker deques and can't be listed safely.
+                        wprintf(L"Work stealing, queued count: %u\n", workQueue->QueuedCount);
+                        wprintf(L"Idle count: %u\n", workQueue->IdleCount);
+                        wprintf(L"\n");
+                        continue;
+                    }
 
-                    // List the items backwards.
-                    workQueueItemEntry = workQueue->QueueListHead.Blink;
+                    PhAcquireQueuedLockExclusive(&workQueue->QueueLock);
 
-                    while (workQueueItemEntry != &workQueue->QueueListHead)
+                    for (priority = 0; priority < PH_WORK_QUEUE_PRIORITY_COUNT; priority++)
                     {
-                        PPH_WORK_QUEUE_ITEM workQueueItem;
+                        // List the items backwards.
+                        workQueueItemEntry = workQueue->QueueListHeads[priority].Blink;
 
-                        workQueueItem = CONTAINING_RECORD(workQueueItemEntry, PH_WORK_QUEUE_ITEM, ListEntry);
+                        while (workQueueItemEntry != &workQueue->QueueListHeads[priority])
+                        {
+                            PPH_WORK_QUEUE_ITEM workQueueItem;
 
-                        wprintf(L"\tWork queue item at %Ix\n", (ULONG_PTR)workQueueItem);
-                        wprintf(L"\t\tFunction: %s\n", PhpGetSymbolForAddress(workQueueItem->Function));
-                        wprintf(L"\t\tContext: %Ix\n", (ULONG_PTR)workQueueItem->Context);
+                            workQueueItem = CONTAINING_RECORD(workQueueItemEntry, PH_WORK_QUEUE_ITEM, ListEntry);
 
-                        workQueueItemEntry = workQueueItemEntry->Blink;
+                            wprintf(L"\tWork queue item at %Ix\n", (ULONG_PTR)workQueueItem);
+                            wprintf(L"\t\tFunction: %s\n", PhpGetSymbolForAddress(workQueueItem->Function));
+                            wprintf(L"\t\tContext: %Ix\n", (ULONG_PTR)workQueueItem->Context);
+                            wprintf(L"\t\tPriority: %u\n", priority);
+
+                            workQueueItemEntry = workQueueItemEntry->Blink;
+                        }
                     }
 
                     PhReleaseQueuedLockExclusive(&workQueue->QueueLock);
@@ -1359,6 +1599,18 @@ NTSTATUS PhpDebugConsoleThreadStart(
             wprintf(commandDebugOnly);
 #endif
         }
+        else if (PhEqualStringZ(command, L"procquery", TRUE))
+        {
+            PH_PROCESS_QUERY_STATISTICS statistics;
+
+            PhGetProcessQueryStatistics(&statistics);
+
+            wprintf(L"Queued: %u (%u priority)\n", statistics.QueuedCount, statistics.PriorityQueuedCount);
+            wprintf(L"Running: %u\n", statistics.RunningCount);
+            wprintf(L"Peak queued: %u\n", statistics.PeakQueuedCount);
+            wprintf(L"Total queued: %I64u\n", statistics.TotalQueued);
+            wprintf(L"Total completed: %I64u\n", statistics.TotalCompleted);
+        }
         else if (PhEqualStringZ(command, L"procrecords", TRUE))
         {
             PPH_PROCESS_RECORD record;
@@ -1671,6 +1923,142 @@ PrintMemUsage:
             wprintf(L"Usage: mem address [numberOfBytes]\n");
             wprintf(L"Example: mem 12345678 16\n");
         }
+        else if (PhEqualStringZ(command, L"slabs", TRUE))
+        {
+            PH_SLAB_STATISTICS statistics;
+            ULONG i;
+
+            PhGetSlabStatistics(&statistics);
+
+            if (!statistics.Enabled)
+            {
+                wprintf(L"The slab allocator is not enabled.\n");
+                goto EndCommand;
+            }
+
+            wprintf(L"Reserved: %Iu bytes, committed: %Iu bytes, thread caches: %u\n",
+                statistics.ReservedSize, statistics.CommittedSize, statistics.NumberOfThreadCaches);
+
+            for (i = 0; i < PH_SLAB_NUMBER_OF_CLASSES; i++)
+            {
+                wprintf(L"%4u bytes: %u slabs, %I64u allocations, %I64u frees\n",
+                    statistics.Classes[i].BlockSize,
+                    statistics.Classes[i].NumberOfSlabs,
+                    statistics.Classes[i].Allocations,
+                    statistics.Classes[i].Frees
+                    );
+            }
+        }
+        else if (PhEqualStringZ(command, L"lockstats", TRUE))
+        {
+            PH_LOCK_STATISTICS_INFORMATION information;
+            PWSTR options;
+            ULONG i;
+
+            options = wcstok_s(NULL, delims, &context);
+
+            if (options)
+            {
+                if (PhEqualStringZ(options, L"on", TRUE))
+                    PhSetLockStatisticsEnabled(TRUE);
+                else if (PhEqualStringZ(options, L"off", TRUE))
+                    PhSetLockStatisticsEnabled(FALSE);
+                else if (PhEqualStringZ(options, L"reset", TRUE))
+                    PhResetLockStatistics();
+                else
+                    wprintf(L"Usage: lockstats [on|off|reset]\n");
+
+                goto EndCommand;
+            }
+
+            PhGetLockStatistics(&information);
+
+            if (!information.Available)
+            {
+                wprintf(L"Lock statistics are not available in this build.\n");
+                goto EndCommand;
+            }
+
+            wprintf(L"Recording: %s\n", information.Enabled ? L"on" : L"off");
+
+            for (i = 0; i < information.NumberOfEntries; i++)
+            {
+                PPH_LOCK_STATISTICS statistics = &information.Entries[i];
+
+                wprintf(L"%s (%u locks)\n", statistics->Name, statistics->NumberOfLocks);
+                wprintf(L"\tAcquires: %I64u exclusive, %I64u shared\n",
+                    statistics->ExclusiveAcquireCount, statistics->SharedAcquireCount);
+                wprintf(L"\tContended: %I64u, total wait: %I64u us\n",
+                    statistics->ContendedCount, statistics->TotalWaitTime);
+                wprintf(L"\tMaximum exclusive hold: %I64u us\n", statistics->MaximumHoldTime);
+            }
+        }
+        else if (PhEqualStringZ(command, L"diag", TRUE))
+        {
+            PWSTR options;
+            PWSTR argument;
+            PH_STRINGREF filter;
+            ULONG numberOfSamples;
+
+            options = wcstok_s(NULL, delims, &context);
+            argument = options ? wcstok_s(NULL, delims, &context) : NULL;
+
+            if (options && PhEqualStringZ(options, L"start", TRUE))
+            {
+                ULONG64 interval = 1000;
+
+                if (argument)
+                {
+                    PH_STRINGREF intervalString;
+
+                    PhInitializeStringRef(&intervalString, argument);
+
+                    if (!PhStringToInteger64(&intervalString, 10, &interval) || interval < 100)
+                    {
+                        wprintf(L"The interval must be at least 100 ms.\n");
+                        goto EndCommand;
+                    }
+                }
+
+                PhStartDiagnostics((ULONG)interval);
+                wprintf(L"Sampling every %I64u ms.\n", interval);
+            }
+            else if (options && PhEqualStringZ(options, L"stop", TRUE))
+            {
+                PhStopDiagnostics();
+            }
+            else if (options && PhEqualStringZ(options, L"save", TRUE))
+            {
+                NTSTATUS status;
+
+                if (!argument)
+                {
+                    wprintf(L"Usage: diag save file-name\n");
+                    goto EndCommand;
+                }
+
+                status = PhSaveDiagnosticsHistory(argument);
+
+                if (NT_SUCCESS(status))
+                    wprintf(L"Saved.\n");
+                else
+                    wprintf(L"Error: 0x%x\n", status);
+            }
+            else
+            {
+                if (options)
+                    PhInitializeStringRef(&filter, options);
+
+                wprintf(L"%-56s %12s %12s %12s\n", L"Series", L"Current", L"Average", L"Maximum");
+                numberOfSamples = PhEnumDiagnosticsSeries(PhpPrintDiagnosticsSeriesCallback, options ? &filter : NULL);
+                wprintf(
+                    L"%u samples, averages and maximums over the last %u. Sampler is %s.\n",
+                    numberOfSamples,
+                    DIAGNOSTICS_SUMMARY_SAMPLES,
+                    PhIsDiagnosticsRunning() ? L"running" : L"stopped (use \"diag start\")"
+                    );
+            }
+        }
         else
         {
             wprintf(L"Unrecognized command.\n");
@@ -0,0 +1,858 @@
+/*
+ * Process Hacker -
+ *   diagnostics sampler
+ *
+ * Copyright (C) 2016 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The diagnostics sampler records our own performance counters at a fixed interval, on its own
+ * provider thread, so that they can be watched live from the debug console and saved as CSV for
+ * graphing. Each counter is a named series with a history of PH_DIAGNOSTICS_HISTORY_SIZE values:
+ *
+ * provider.<function>.run_us, .lag_ms, .interval_ms - the last run time, start lag and effective
+ *     interval of each provider. Registrations of the same function are added together, except
+ *     for the lag and interval, where the maximum is used.
+ * workqueue.<address>.threads, .active, .depth - the worker threads, executing items and queued
+ *     items of each work queue.
+ * objects.<type>.count, .bytes, .peak_bytes - the live objects of each object type. Bytes are
+ *     only recorded on 64-bit systems.
+ * objects.<type>.allocations - per second, the number of objects of each type created.
+ * memory.private_bytes, .working_set, .heap_allocated, .heap_committed, .slab_committed
+ * callback.<module>.calls, .time_us - per second, the number of callback functions invoked and
+ *     the time spent in them, attributed to the image containing each function.
+ * lock.<name>.contended, .wait_us - per second, when lock statistics are being recorded.
+ *
+ * Plugins add their own series through GeneralCallbackDiagnosticsSampling.
+ *
+ * Nothing is collected until the sampler is started, and callback timing is only enabled while
+ * it is running. Everything else is read from counters that are maintained anyway, so a sample
+ * costs little more than walking the provider, work queue and object type lists.
+ */
+
+#include <phapp.h>
+#include <phintrnl.h>
+#include <lockstat.h>
+#include <phplug.h>
+#include <providers.h>
+
+#define PH_DIAGNOSTICS_HISTORY_SIZE 1024
+#define PH_DIAGNOSTICS_MAXIMUM_MODULES 64
+
+#define PH_DIAGNOSTICS_VALUE_SET 0
+#define PH_DIAGNOSTICS_VALUE_ADD 1
+#define PH_DIAGNOSTICS_VALUE_MAXIMUM 2
+
+typedef struct _PH_DIAGNOSTICS_MODULE
+{
+    ULONG_PTR BaseAddress;
+    ULONG_PTR EndAddress;
+    PH_STRINGREF Name;
+    volatile LONG64 Calls;
+    volatile LONG64 Time; // in performance counter ticks
+} PH_DIAGNOSTICS_MODULE, *PPH_DIAGNOSTICS_MODULE;
+
+typedef struct _PH_HEAP_SUMMARY
+{
+    ULONG cb;
+    SIZE_T cbAllocated;
+    SIZE_T cbCommitted;
+    SIZE_T cbReserved;
+    SIZE_T cbMaxReserve;
+} PH_HEAP_SUMMARY, *PPH_HEAP_SUMMARY;
+
+typedef BOOL (WINAPI *_HeapSummary)(
+    _In_ HANDLE hHeap,
+    _In_ ULONG dwFlags,
+    _Out_ PPH_HEAP_SUMMARY lpSummary
+    );
+
+VOID NTAPI PhpDiagnosticsProviderUpdate(
+    _In_ PVOID Object
+    );
+
+VOID NTAPI PhpDiagnosticsCallbackTiming(
+    _In_ PPH_CALLBACK_FUNCTION Function,
+    _In_ ULONG64 Time
+    );
+
+static PH_PROVIDER_THREAD PhpDiagnosticsProviderThread;
+static PH_PROVIDER_REGISTRATION PhpDiagnosticsProviderRegistration;
+static BOOLEAN PhpDiagnosticsRunning = FALSE;
+static PH_QUEUED_LOCK PhpDiagnosticsStartLock = PH_QUEUED_LOCK_INIT;
+
+static PH_QUEUED_LOCK PhpDiagnosticsLock = PH_QUEUED_LOCK_INIT;
+static PPH_HASHTABLE PhpDiagnosticsSeriesHashtable;
+static PPH_LIST PhpDiagnosticsSeriesList;
+static PH_CIRCULAR_BUFFER_ULONG64 PhpDiagnosticsTimeHistory;
+static ULONG PhpDiagnosticsSampleCount = 0;
+static ULONG64 PhpDiagnosticsLastTickCount = 0;
+static LARGE_INTEGER PhpDiagnosticsFrequency;
+
+// The module table is only built once and never freed, because the timing function may still be
+// running on other threads after the sampler has been stopped.
+static PH_DIAGNOSTICS_MODULE PhpDiagnosticsModules[PH_DIAGNOSTICS_MAXIMUM_MODULES];
+static ULONG PhpDiagnosticsNumberOfModules = 0;
+static PH_DIAGNOSTICS_MODULE PhpDiagnosticsOtherModule;
+
+static _HeapSummary HeapSummary_I = NULL;
+
+static BOOLEAN PhpDiagnosticsSeriesEqualFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    )
+{
+    PPH_DIAGNOSTICS_SERIES series1 = *(PPH_DIAGNOSTICS_SERIES *)Entry1;
+    PPH_DIAGNOSTICS_SERIES series2 = *(PPH_DIAGNOSTICS_SERIES *)Entry2;
+
+    return PhEqualStringRef(&series1->Name, &series2->Name, FALSE);
+}
+
+static ULONG PhpDiagnosticsSeriesHashFunction(
+    _In_ PVOID Entry
+    )
+{
+    PPH_DIAGNOSTICS_SERIES series = *(PPH_DIAGNOSTICS_SERIES *)Entry;
+
+    return PhHashStringRef(&series->Name, FALSE);
+}
+
+static VOID PhpAddDiagnosticsModule(
+    _In_ PVOID DllBase,
+    _In_ PPH_STRINGREF Name
+    )
+{
+    PIMAGE_DOS_HEADER dosHeader;
+    PIMAGE_NT_HEADERS ntHeaders;
+    PPH_DIAGNOSTICS_MODULE module;
+
+    if (PhpDiagnosticsNumberOfModules == PH_DIAGNOSTICS_MAXIMUM_MODULES)
+        return;
+
+    dosHeader = DllBase;
+    ntHeaders = PTR_ADD_OFFSET(DllBase, dosHeader->e_lfanew);
+
+    module = &PhpDiagnosticsModules[PhpDiagnosticsNumberOfModules];
+    module->BaseAddress = (ULONG_PTR)DllBase;
+    module->EndAddress = (ULONG_PTR)DllBase + ntHeaders->OptionalHeader.SizeOfImage;
+    module->Name = *Name;
+    module->Calls = 0;
+    module->Time = 0;
+
+    PhpDiagnosticsNumberOfModules++;
+}
+
+static VOID PhpInitializeDiagnostics(
+    VOID
+    )
+{
+    static PH_STRINGREF mainModuleName = PH_STRINGREF_INIT(L"ProcessHacker");
+    static PH_STRINGREF otherModuleName = PH_STRINGREF_INIT(L"Other");
+    PPH_AVL_LINKS links;
+
+    PhpDiagnosticsSeriesHashtable = PhCreateHashtable(
+        sizeof(PPH_DIAGNOSTICS_SERIES),
+        PhpDiagnosticsSeriesEqualFunction,
+        PhpDiagnosticsSeriesHashFunction,
+        256
+        );
+    PhpDiagnosticsSeriesList = PhCreateList(256);
+    PhInitializeCircularBuffer_ULONG64(&PhpDiagnosticsTimeHistory, PH_DIAGNOSTICS_HISTORY_SIZE);
+    NtQueryPerformanceCounter(&PhpDiagnosticsFrequency, &PhpDiagnosticsFrequency);
+
+    PhpAddDiagnosticsModule(PhInstanceHandle, &mainModuleName);
+
+    // Plugins loaded after this point are counted as "Other".
+    for (links = PhMinimumElementAvlTree(&PhPluginsByName); links; links = PhSuccessorElementAvlTree(links))
+    {
+        PPH_PLUGIN plugin = CONTAINING_RECORD(links, PH_PLUGIN, Links);
+
+        if (plugin->DllBase)
+            PhpAddDiagnosticsModule(plugin->DllBase, &plugin->Name);
+    }
+
+    PhpDiagnosticsOtherModule.Name = otherModuleName;
+
+    HeapSummary_I = PhGetModuleProcAddress(L"kernel32.dll", "HeapSummary");
+}
+
+/**
+ * Starts the diagnostics sampler.
+ *
+ * \param Interval The interval between samples, in milliseconds.
+ */
+VOID PhStartDiagnostics(
+    _In_ ULONG Interval
+    )
+{
+    static PH_INITONCE initOnce = PH_INITONCE_INIT;
+
+    if (PhBeginInitOnce(&initOnce))
+    {
+        PhpInitializeDiagnostics();
+        PhEndInitOnce(&initOnce);
+    }
+
+    PhAcquireQueuedLockExclusive(&PhpDiagnosticsStartLock);
+
+    if (!PhpDiagnosticsRunning)
+    {
+        PhpDiagnosticsLastTickCount = 0;
+
+        PhInitializeProviderThread(&PhpDiagnosticsProviderThread, Interval);
+        PhRegisterProvider(&PhpDiagnosticsProviderThread, PhpDiagnosticsProviderUpdate, NULL, &PhpDiagnosticsProviderRegistration);
+        PhSetEnabledProvider(&PhpDiagnosticsProviderRegistration, TRUE);
+        PhSetCallbackTimingFunction(PhpDiagnosticsCallbackTiming);
+        PhStartProviderThread(&PhpDiagnosticsProviderThread);
+
+        PhpDiagnosticsRunning = TRUE;
+    }
+    else
+    {
+        PhSetIntervalProviderThread(&PhpDiagnosticsProviderThread, Interval);
+    }
+
+    PhReleaseQueuedLockExclusive(&PhpDiagnosticsStartLock);
+}
+
+/**
+ * Stops the diagnostics sampler. The recorded history is kept.
+ */
+VOID PhStopDiagnostics(
+    VOID
+    )
+{
+    PhAcquireQueuedLockExclusive(&PhpDiagnosticsStartLock);
+
+    if (PhpDiagnosticsRunning)
+    {
+        PhSetCallbackTimingFunction(NULL);
+        PhStopProviderThread(&PhpDiagnosticsProviderThread);
+        PhUnregisterProvider(&PhpDiagnosticsProviderRegistration);
+        PhDeleteProviderThread(&PhpDiagnosticsProviderThread);
+
+        PhpDiagnosticsRunning = FALSE;
+    }
+
+    PhReleaseQueuedLockExclusive(&PhpDiagnosticsStartLock);
+}
+
+BOOLEAN PhIsDiagnosticsRunning(
+    VOID
+    )
+{
+    return PhpDiagnosticsRunning;
+}
+
+VOID NTAPI PhpDiagnosticsCallbackTiming(
+    _In_ PPH_CALLBACK_FUNCTION Function,
+    _In_ ULONG64 Time
+    )
+{
+    PPH_DIAGNOSTICS_MODULE module = &PhpDiagnosticsOtherModule;
+    ULONG i;
+
+    for (i = 0; i < PhpDiagnosticsNumberOfModules; i++)
+    {
+        if (
+            (ULONG_PTR)Function >= PhpDiagnosticsModules[i].BaseAddress &&
+            (ULONG_PTR)Function < PhpDiagnosticsModules[i].EndAddress
+            )
+        {
+            module = &PhpDiagnosticsModules[i];
+            break;
+        }
+    }
+
+    InterlockedIncrement64(&module->Calls);
+    InterlockedExchangeAdd64(&module->Time, Time);
+}
+
+/**
+ * Records a value for the current sample. The diagnostics lock must be held in exclusive mode.
+ *
+ * \param Name The name of the series.
+ * \param Value The value.
+ * \param Mode How the value is combined with other values recorded for the same series in this
+ * sample: PH_DIAGNOSTICS_VALUE_SET, PH_DIAGNOSTICS_VALUE_ADD or PH_DIAGNOSTICS_VALUE_MAXIMUM.
+ * \param Flags A combination of flags.
+ * \li \c PH_DIAGNOSTICS_SERIES_RATE The value is a cumulative counter, and the series records
+ * its rate of change per second.
+ */
+static VOID PhpRecordDiagnosticsValue(
+    _In_ PPH_STRINGREF Name,
+    _In_ ULONG64 Value,
+    _In_ ULONG Mode,
+    _In_ ULONG Flags
+    )
+{
+    PH_DIAGNOSTICS_SERIES lookupSeries;
+    PPH_DIAGNOSTICS_SERIES lookupSeriesPtr = &lookupSeries;
+    PPH_DIAGNOSTICS_SERIES *seriesPtr;
+    PPH_DIAGNOSTICS_SERIES series;
+
+    lookupSeries.Name = *Name;
+    seriesPtr = PhFindEntryHashtable(PhpDiagnosticsSeriesHashtable, &lookupSeriesPtr);
+
+    if (seriesPtr)
+    {
+        series = *seriesPtr;
+    }
+    else
+    {
+        series = PhAllocate(sizeof(PH_DIAGNOSTICS_SERIES));
+        memset(series, 0, sizeof(PH_DIAGNOSTICS_SERIES));
+        series->NameString = PhCreateString2(Name);
+        series->Name = series->NameString->sr;
+        series->Flags = Flags;
+        PhInitializeCircularBuffer_ULONG64(&series->History, PH_DIAGNOSTICS_HISTORY_SIZE);
+
+        PhAddEntryHashtable(PhpDiagnosticsSeriesHashtable, &series);
+        PhAddItemList(PhpDiagnosticsSeriesList, series);
+    }
+
+    if (series->UpdatedSampleCount != PhpDiagnosticsSampleCount)
+    {
+        series->UpdatedSampleCount = PhpDiagnosticsSampleCount;
+        series->PendingValue = Value;
+    }
+    else if (Mode == PH_DIAGNOSTICS_VALUE_ADD)
+    {
+        series->PendingValue += Value;
+    }
+    else if (Mode == PH_DIAGNOSTICS_VALUE_MAXIMUM)
+    {
+        if (series->PendingValue < Value)
+            series->PendingValue = Value;
+    }
+    else
+    {
+        series->PendingValue = Value;
+    }
+}
+
+static VOID PhpRecordDiagnosticsValueZ(
+    _In_ PWSTR Name,
+    _In_ ULONG64 Value,
+    _In_ ULONG Mode,
+    _In_ ULONG Flags
+    )
+{
+    PH_STRINGREF name;
+
+    PhInitializeStringRef(&name, Name);
+    PhpRecordDiagnosticsValue(&name, Value, Mode, Flags);
+}
+
+static VOID PhpRecordDiagnosticsValueFormat(
+    _Inout_ PPH_STRING_BUILDER StringBuilder,
+    _In_ PWSTR Suffix,
+    _In_ ULONG64 Value,
+    _In_ ULONG Mode,
+    _In_ ULONG Flags
+    )
+{
+    SIZE_T length;
+
+    length = StringBuilder->String->Length / sizeof(WCHAR);
+    PhAppendStringBuilder2(StringBuilder, Suffix);
+    PhpRecordDiagnosticsValue(&StringBuilder->String->sr, Value, Mode, Flags);
+    PhRemoveEndStringBuilder(StringBuilder, StringBuilder->String->Length / sizeof(WCHAR) - length);
+}
+
+static VOID PhpAppendDiagnosticsAddress(
+    _Inout_ PPH_STRING_BUILDER StringBuilder,
+    _In_ PVOID Address
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < PhpDiagnosticsNumberOfModules; i++)
+    {
+        if ((ULONG_PTR)Address >= PhpDiagnosticsModules[i].BaseAddress && (ULONG_PTR)Address < PhpDiagnosticsModules[i].EndAddress)
+        {
+            PhAppendStringBuilder(StringBuilder, &PhpDiagnosticsModules[i].Name);
+            PhAppendFormatStringBuilder(StringBuilder, L"+0x%Ix", (ULONG_PTR)Address - PhpDiagnosticsModules[i].BaseAddress);
+            return;
+        }
+    }
+
+    PhAppendFormatStringBuilder(StringBuilder, L"0x%Ix", (ULONG_PTR)Address);
+}
+
+static VOID PhpSampleProviders(
+    _Inout_ PPH_STRING_BUILDER StringBuilder
+    )
+{
+    static struct
+    {
+        PPH_PROVIDER_FUNCTION Function;
+        PWSTR Name;
+    } knownProviders[] =
+    {
+        { PhProcessProviderUpdate, L"process" },
+        { PhServiceProviderUpdate, L"service" },
+        { PhNetworkProviderUpdate, L"network" },
+        { PhModuleProviderUpdate, L"module" },
+        { PhHandleProviderUpdate, L"handle" }
+    };
+    ULONG i;
+    ULONG j;
+
+    if (!PhDbgProviderList)
+        return;
+
+    PhAcquireQueuedLockShared(&PhDbgProviderListLock);
+
+    for (i = 0; i < PhDbgProviderList->Count; i++)
+    {
+        PPH_PROVIDER_THREAD providerThread = PhDbgProviderList->Items[i];
+        PLIST_ENTRY listEntry;
+
+        // Providers that are running, or that have already run in the current pass of their
+        // thread, are on a temporary list and are missed. Their series keep the previous value.
+
+        PhAcquireQueuedLockExclusive(&providerThread->Lock);
+
+        for (listEntry = providerThread->ListHead.Flink; listEntry != &providerThread->ListHead; listEntry = listEntry->Flink)
+        {
+            PPH_PROVIDER_REGISTRATION registration = CONTAINING_RECORD(listEntry, PH_PROVIDER_REGISTRATION, ListEntry);
+            ULONG interval;
+
+            if (!registration->Enabled || registration->Unregistering)
+                continue;
+
+            PhAppendStringBuilder2(StringBuilder, L"provider.");
+
+            for (j = 0; j < ARRAYSIZE(knownProviders); j++)
+            {
+                if (registration->Function == knownProviders[j].Function)
+                {
+                    PhAppendStringBuilder2(StringBuilder, knownProviders[j].Name);
+                    break;
+                }
+            }
+
+            if (j == ARRAYSIZE(knownProviders))
+                PhpAppendDiagnosticsAddress(StringBuilder, registration->Function);
+
+            interval = registration->EffectiveInterval != 0 ? registration->EffectiveInterval : registration->Interval;
+
+            if (interval < providerThread->Interval)
+                interval = providerThread->Interval;
+
+            PhpRecordDiagnosticsValueFormat(StringBuilder, L".run_us", registration->LastRunTime, PH_DIAGNOSTICS_VALUE_ADD, 0);
+            PhpRecordDiagnosticsValueFormat(StringBuilder, L".lag_ms", registration->Lag, PH_DIAGNOSTICS_VALUE_MAXIMUM, 0);
+            PhpRecordDiagnosticsValueFormat(StringBuilder, L".interval_ms", interval, PH_DIAGNOSTICS_VALUE_MAXIMUM, 0);
+
+            PhRemoveEndStringBuilder(StringBuilder, StringBuilder->String->Length / sizeof(WCHAR));
+        }
+
+        PhReleaseQueuedLockExclusive(&providerThread->Lock);
+    }
+
+    PhReleaseQueuedLockShared(&PhDbgProviderListLock);
+}
+
+static VOID PhpSampleWorkQueues(
+    _Inout_ PPH_STRING_BUILDER StringBuilder
+    )
+{
+    ULONG i;
+
+    if (!PhDbgWorkQueueList)
+        return;
+
+    PhAcquireQueuedLockShared(&PhDbgWorkQueueListLock);
+
+    for (i = 0; i < PhDbgWorkQueueList->Count; i++)
+    {
+        PPH_WORK_QUEUE workQueue = PhDbgWorkQueueList->Items[i];
+        ULONG busyCount;
+        ULONG executingCount;
+
+        busyCount = workQueue->BusyCount;
+        executingCount = workQueue->ExecutingCount;
+
+        PhAppendStringBuilder2(StringBuilder, L"workqueue.");
+        PhpAppendDiagnosticsAddress(StringBuilder, workQueue);
+
+        PhpRecordDiagnosticsValueFormat(StringBuilder, L".threads", workQueue->CurrentThreads, PH_DIAGNOSTICS_VALUE_SET, 0);
+        PhpRecordDiagnosticsValueFormat(StringBuilder, L".active", executingCount, PH_DIAGNOSTICS_VALUE_SET, 0);
+        PhpRecordDiagnosticsValueFormat(StringBuilder, L".depth", busyCount > executingCount ? busyCount - executingCount : 0, PH_DIAGNOSTICS_VALUE_SET, 0);
+
+        PhRemoveEndStringBuilder(StringBuilder, StringBuilder->String->Length / sizeof(WCHAR));
+    }
+
+    PhReleaseQueuedLockShared(&PhDbgWorkQueueListLock);
+}
+
+static BOOLEAN NTAPI PhpSampleObjectTypeCallback(
+    _In_ PPH_OBJECT_TYPE_INFORMATION Information,
+    _In_opt_ PVOID Context
+    )
+{
+    PPH_STRING_BUILDER stringBuilder = Context;
+
+    PhAppendStringBuilder2(stringBuilder, L"objects.");
+    PhAppendStringBuilder2(stringBuilder, Information->Name);
+
+    PhpRecordDiagnosticsValueFormat(stringBuilder, L".count", Information->NumberOfObjects, PH_DIAGNOSTICS_VALUE_SET, 0);
+    PhpRecordDiagnosticsValueFormat(stringBuilder, L".allocations", Information->NumberOfAllocations, PH_DIAGNOSTICS_VALUE_SET, PH_DIAGNOSTICS_SERIES_RATE);
+#ifdef _WIN64
+    PhpRecordDiagnosticsValueFormat(stringBuilder, L".bytes", Information->NumberOfBytes, PH_DIAGNOSTICS_VALUE_SET, 0);
+    PhpRecordDiagnosticsValueFormat(stringBuilder, L".peak_bytes", Information->PeakNumberOfBytes, PH_DIAGNOSTICS_VALUE_SET, 0);
+#endif
+
+    PhRemoveEndStringBuilder(stringBuilder, stringBuilder->String->Length / sizeof(WCHAR));
+
+    return TRUE;
+}
+
+static VOID PhpSampleMemory(
+    VOID
+    )
+{
+    VM_COUNTERS_EX vmCounters;
+    PH_HEAP_SUMMARY heapSummary;
+    PH_SLAB_STATISTICS slabStatistics;
+
+    if (NT_SUCCESS(NtQueryInformationProcess(
+        NtCurrentProcess(),
+        ProcessVmCounters,
+        &vmCounters,
+        sizeof(VM_COUNTERS_EX),
+        NULL
+        )))
+    {
+        PhpRecordDiagnosticsValueZ(L"memory.private_bytes", vmCounters.PrivateUsage, PH_DIAGNOSTICS_VALUE_SET, 0);
+        PhpRecordDiagnosticsValueZ(L"memory.working_set", vmCounters.WorkingSetSize, PH_DIAGNOSTICS_VALUE_SET, 0);
+    }
+
+    if (HeapSummary_I)
+    {
+        heapSummary.cb = sizeof(PH_HEAP_SUMMARY);
+
+        if (HeapSummary_I(PhHeapHandle, 0, &heapSummary))
+        {
+            PhpRecordDiagnosticsValueZ(L"memory.heap_allocated", heapSummary.cbAllocated, PH_DIAGNOSTICS_VALUE_SET, 0);
+            PhpRecordDiagnosticsValueZ(L"memory.heap_committed", heapSummary.cbCommitted, PH_DIAGNOSTICS_VALUE_SET, 0);
+        }
+    }
+
+    PhGetSlabStatistics(&slabStatistics);
+
+    if (slabStatistics.Enabled)
+        PhpRecordDiagnosticsValueZ(L"memory.slab_committed", slabStatistics.CommittedSize, PH_DIAGNOSTICS_VALUE_SET, 0);
+
+#ifdef DEBUG
+    PhpRecordDiagnosticsValueZ(L"memory.allocations", PhLibStatisticsBlock.BaseAllocations, PH_DIAGNOSTICS_VALUE_SET, PH_DIAGNOSTICS_SERIES_RATE);
+#endif
+}
+
+FORCEINLINE ULONG64 PhpReadDiagnosticsCounter(
+    _In_ volatile LONG64 *Counter
+    )
+{
+#ifdef _WIN64
+    return *Counter;
+#else
+    // Avoid reading a torn value.
+    return InterlockedCompareExchange64(Counter, 0, 0);
+#endif
+}
+
+static VOID PhpSampleCallbacks(
+    _Inout_ PPH_STRING_BUILDER StringBuilder
+    )
+{
+    ULONG i;
+    PPH_DIAGNOSTICS_MODULE module;
+
+    for (i = 0; i <= PhpDiagnosticsNumberOfModules; i++)
+    {
+        module = i < PhpDiagnosticsNumberOfModules ? &PhpDiagnosticsModules[i] : &PhpDiagnosticsOtherModule;
+
+        PhAppendStringBuilder2(StringBuilder, L"callback.");
+        PhAppendStringBuilder(StringBuilder, &module->Name);
+
+        PhpRecordDiagnosticsValueFormat(StringBuilder, L".calls", PhpReadDiagnosticsCounter(&module->Calls), PH_DIAGNOSTICS_VALUE_SET, PH_DIAGNOSTICS_SERIES_RATE);
+        PhpRecordDiagnosticsValueFormat(
+            StringBuilder,
+            L".time_us",
+            PhpReadDiagnosticsCounter(&module->Time) * 1000000 / PhpDiagnosticsFrequency.QuadPart,
+            PH_DIAGNOSTICS_VALUE_SET,
+            PH_DIAGNOSTICS_SERIES_RATE
+            );
+
+        PhRemoveEndStringBuilder(StringBuilder, StringBuilder->String->Length / sizeof(WCHAR));
+    }
+}
+
+static VOID PhpSampleLocks(
+    _Inout_ PPH_STRING_BUILDER StringBuilder
+    )
+{
+    PPH_LOCK_STATISTICS_INFORMATION information;
+    ULONG i;
+
+    information = PhAllocate(sizeof(PH_LOCK_STATISTICS_INFORMATION));
+    PhGetLockStatistics(information);
+
+    if (information->Available && information->Enabled)
+    {
+        for (i = 0; i < information->NumberOfEntries; i++)
+        {
+            PPH_LOCK_STATISTICS statistics = &information->Entries[i];
+
+            PhAppendStringBuilder2(StringBuilder, L"lock.");
+            PhAppendStringBuilder2(StringBuilder, statistics->Name);
+
+            PhpRecordDiagnosticsValueFormat(StringBuilder, L".contended", statistics->ContendedCount, PH_DIAGNOSTICS_VALUE_SET, PH_DIAGNOSTICS_SERIES_RATE);
+            PhpRecordDiagnosticsValueFormat(StringBuilder, L".wait_us", statistics->TotalWaitTime, PH_DIAGNOSTICS_VALUE_SET, PH_DIAGNOSTICS_SERIES_RATE);
+
+            PhRemoveEndStringBuilder(StringBuilder, StringBuilder->String->Length / sizeof(WCHAR));
+        }
+    }
+
+    PhFree(information);
+}
+
+static VOID NTAPI PhpAddPluginDiagnosticsCounter(
+    _In_ PWSTR Name,
+    _In_ ULONG64 Value,
+    _In_ BOOLEAN Cumulative
+    )
+{
+    PhpRecordDiagnosticsValueZ(Name, Value, PH_DIAGNOSTICS_VALUE_ADD, Cumulative ? PH_DIAGNOSTICS_SERIES_RATE : 0);
+}
+
+/**
+ * Adds the values recorded in the current sample to the histories. The diagnostics lock must be
+ * held in exclusive mode.
+ */
+static VOID PhpCommitDiagnosticsSample(
+    _In_ ULONG64 TickCount,
+    _In_ ULONG64 ElapsedTime
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < PhpDiagnosticsSeriesList->Count; i++)
+    {
+        PPH_DIAGNOSTICS_SERIES series = PhpDiagnosticsSeriesList->Items[i];
+
+        if (series->UpdatedSampleCount == PhpDiagnosticsSampleCount)
+        {
+            if (series->Flags & PH_DIAGNOSTICS_SERIES_RATE)
+            {
+                // There is no rate until we have two values.
+                if (series->RawValueValid && ElapsedTime != 0 && series->PendingValue >= series->RawValue)
+                    series->Value = (series->PendingValue - series->RawValue) * 1000 / ElapsedTime;
+                else
+                    series->Value = 0;
+
+                series->RawValue = series->PendingValue;
+                series->RawValueValid = TRUE;
+            }
+            else
+            {
+                series->Value = series->PendingValue;
+            }
+        }
+
+        PhAddItemCircularBuffer_ULONG64(&series->History, series->Value);
+    }
+
+    PhAddItemCircularBuffer_ULONG64(&PhpDiagnosticsTimeHistory, TickCount);
+}
+
+VOID NTAPI PhpDiagnosticsProviderUpdate(
+    _In_ PVOID Object
+    )
+{
+    PH_STRING_BUILDER stringBuilder;
+    PH_PLUGIN_DIAGNOSTICS_SAMPLE pluginSample;
+    LARGE_INTEGER startCounter;
+    LARGE_INTEGER endCounter;
+    ULONG64 tickCount;
+    ULONG64 elapsedTime;
+
+    NtQueryPerformanceCounter(&startCounter, NULL);
+
+    tickCount = NtGetTickCount64();
+    elapsedTime = PhpDiagnosticsLastTickCount != 0 ? tickCount - PhpDiagnosticsLastTickCount : 0;
+    PhpDiagnosticsLastTickCount = tickCount;
+
+    PhInitializeStringBuilder(&stringBuilder, 100);
+
+    PhAcquireQueuedLockExclusive(&PhpDiagnosticsLock);
+
+    PhpDiagnosticsSampleCount++;
+
+    PhpSampleProviders(&stringBuilder);
+    PhpSampleWorkQueues(&stringBuilder);
+    PhEnumObjectTypeInformation(PhpSampleObjectTypeCallback, &stringBuilder);
+    PhpSampleMemory();
+    PhpSampleCallbacks(&stringBuilder);
+    PhpSampleLocks(&stringBuilder);
+
+    if (PhPluginsEnabled)
+    {
+        pluginSample.AddCounter = PhpAddPluginDiagnosticsCounter;
+        PhInvokeCallback(PhGetGeneralCallback(GeneralCallbackDiagnosticsSampling), &pluginSample);
+    }
+
+    NtQueryPerformanceCounter(&endCounter, NULL);
+    PhpRecordDiagnosticsValueZ(
+        L"diagnostics.sample_us",
+        (endCounter.QuadPart - startCounter.QuadPart) * 1000000 / PhpDiagnosticsFrequency.QuadPart,
+        PH_DIAGNOSTICS_VALUE_SET,
+        0
+        );
+
+    PhpCommitDiagnosticsSample(tickCount, elapsedTime);
+
+    PhReleaseQueuedLockExclusive(&PhpDiagnosticsLock);
+
+    PhDeleteStringBuilder(&stringBuilder);
+}
+
+/**
+ * Enumerates the series recorded by the diagnostics sampler.
+ *
+ * \param Callback A function which receives each series. The series must not be modified or
+ * used after the callback returns.
+ * \param Context A user-defined value to pass to the callback function.
+ *
+ * \return The number of samples that have been recorded.
+ */
+ULONG PhEnumDiagnosticsSeries(
+    _In_ PPH_ENUM_DIAGNOSTICS_SERIES_CALLBACK Callback,
+    _In_opt_ PVOID Context
+    )
+{
+    ULONG count;
+    ULONG i;
+
+    if (!PhpDiagnosticsSeriesList)
+        return 0;
+
+    PhAcquireQueuedLockShared(&PhpDiagnosticsLock);
+
+    count = PhpDiagnosticsSampleCount;
+
+    for (i = 0; i < PhpDiagnosticsSeriesList->Count; i++)
+    {
+        if (!Callback(PhpDiagnosticsSeriesList->Items[i], Context))
+            break;
+    }
+
+    PhReleaseQueuedLockShared(&PhpDiagnosticsLock);
+
+    return count;
+}
+
+/**
+ * Saves the recorded history as CSV.
+ *
+ * \param FileName The name of the output file.
+ *
+ * \remarks The first column is the tick count of each sample in milliseconds, followed by one
+ * column for each series. A series that did not exist yet at the time of a sample has an empty
+ * value.
+ */
+NTSTATUS PhSaveDiagnosticsHistory(
+    _In_ PWSTR FileName
+    )
+{
+    NTSTATUS status;
+    PPH_FILE_STREAM fileStream;
+    PH_STRING_BUILDER stringBuilder;
+    ULONG numberOfSamples;
+    ULONG i;
+    ULONG j;
+
+    if (!PhpDiagnosticsSeriesList)
+        return STATUS_NO_MORE_ENTRIES;
+
+    if (!NT_SUCCESS(status = PhCreateFileStream(
+        &fileStream,
+        FileName,
+        FILE_GENERIC_WRITE,
+        FILE_SHARE_READ,
+        FILE_OVERWRITE_IF,
+        0
+        )))
+        return status;
+
+    PhInitializeStringBuilder(&stringBuilder, 0x1000);
+
+    PhAcquireQueuedLockShared(&PhpDiagnosticsLock);
+
+    PhAppendStringBuilder2(&stringBuilder, L"time");
+
+    for (j = 0; j < PhpDiagnosticsSeriesList->Count; j++)
+    {
+        PPH_DIAGNOSTICS_SERIES series = PhpDiagnosticsSeriesList->Items[j];
+
+        PhAppendCharStringBuilder(&stringBuilder, ',');
+        PhAppendStringBuilder(&stringBuilder, &series->Name);
+    }
+
+    PhAppendStringBuilder2(&stringBuilder, L"\r\n");
+
+    numberOfSamples = PhpDiagnosticsTimeHistory.Count;
+
+    // Write the oldest sample first. Index 0 of a circular buffer is the newest item.
+    for (i = numberOfSamples; i != 0; i--)
+    {
+        PhAppendFormatStringBuilder(&stringBuilder, L"%I64u", PhGetItemCircularBuffer_ULONG64(&PhpDiagnosticsTimeHistory, i - 1));
+
+        for (j = 0; j < PhpDiagnosticsSeriesList->Count; j++)
+        {
+            PPH_DIAGNOSTICS_SERIES series = PhpDiagnosticsSeriesList->Items[j];
+
+            PhAppendCharStringBuilder(&stringBuilder, ',');
+
+            if (i - 1 < series->History.Count)
+                PhAppendFormatStringBuilder(&stringBuilder, L"%I64u", PhGetItemCircularBuffer_ULONG64(&series->History, i - 1));
+        }
+
+        PhAppendStringBuilder2(&stringBuilder, L"\r\n");
+
+        if (stringBuilder.String->Length >= 0x10000)
+        {
+            status = PhWriteStringAsUtf8FileStreamEx(fileStream, stringBuilder.String->Buffer, stringBuilder.String->Length);
+            PhRemoveEndStringBuilder(&stringBuilder, stringBuilder.String->Length / sizeof(WCHAR));
+
+            if (!NT_SUCCESS(status))
+                break;
+        }
+    }
+
+    PhReleaseQueuedLockShared(&PhpDiagnosticsLock);
+
+    if (NT_SUCCESS(status))
+        status = PhWriteStringAsUtf8FileStreamEx(fileStream, stringBuilder.String->Buffer, stringBuilder.String->Length);
+
+    PhDeleteStringBuilder(&stringBuilder);
+    PhDereferenceObject(fileStream);
+
+    return status;
+}
@@ -53,6 +53,15 @@ typedef struct _PHP_OBJECT_SEARCH_RESULT
     SYSTEM_HANDLE_TABLE_ENTRY_INFO_EX Info;
 } PHP_OBJECT_SEARCH_RESULT, *PPHP_OBJECT_SEARCH_RESULT;
 
+typedef struct _SEARCH_NAME_CACHE_ENTRY
+{
+    PVOID Object;
+    ULONG ObjectTypeIndex;
+    ULONG LastSearchCount;
+    PPH_STRING TypeName;
+    PPH_STRING BestObjectName;
+} SEARCH_NAME_CACHE_ENTRY, *PSEARCH_NAME_CACHE_ENTRY;
+
 INT_PTR CALLBACK PhpFindObjectsDlgProc(
     _In_ HWND hwndDlg,
     _In_ UINT uMsg,
@@ -77,6 +86,13 @@ static pcre2_match_data *SearchRegexMatchData;
 static PPH_LIST SearchResults = NULL;
 static ULONG SearchResultsAddIndex;
 static PH_QUEUED_LOCK SearchResultsLock = PH_QUEUED_LOCK_INIT;
+static volatile LONG SearchUpdatePending = FALSE;
+
+static PPH_HASHTABLE SearchNameCacheHashtable;
+static PH_QUEUED_LOCK SearchNameCacheLock = PH_QUEUED_LOCK_INIT;
+static ULONG SearchCount = 0;
+static BOOLEAN SearchUseNameQueries;
+static ULONG SearchFileObjectTypeIndex = -1;
 
 static ULONG64 SearchPointer;
 static BOOLEAN UseSearchPointer;
@@ -629,6 +645,9 @@ static INT_PTR CALLBACK PhpFindObjectsDlgProc(
 
             lvHandle = GetDlgItem(hwndDlg, IDC_RESULTS);
 
+            // Results added from now on need another update.
+            _InterlockedExchange(&SearchUpdatePending, FALSE);
+
             ExtendedListView_SetRedraw(lvHandle, FALSE);
 
             PhAcquireQueuedLockExclusive(&SearchResultsLock);
@@ -734,71 +753,287 @@ static BOOLEAN MatchSearchString(
     }
 }
 
-typedef struct _SEARCH_HANDLE_CONTEXT
+static VOID AddSearchResult(
+    _In_ PPHP_OBJECT_SEARCH_RESULT SearchResult
+    )
 {
-    BOOLEAN NeedToFree;
-    PSYSTEM_HANDLE_TABLE_ENTRY_INFO_EX HandleInfo;
-    HANDLE ProcessHandle;
-} SEARCH_HANDLE_CONTEXT, *PSEARCH_HANDLE_CONTEXT;
+    PhAcquireQueuedLockExclusive(&SearchResultsLock);
+    PhAddItemList(SearchResults, SearchResult);
+    PhReleaseQueuedLockExclusive(&SearchResultsLock);
+
+    // Only post an update if the window hasn't picked up the previous results yet, so
+    // results appear as they are found without flooding the message queue.
+    if (!_InterlockedExchange(&SearchUpdatePending, TRUE))
+        PostMessage(PhFindObjectsWindowHandle, WM_PH_SEARCH_UPDATE, 0, 0);
+}
 
-static NTSTATUS NTAPI SearchHandleFunction(
-    _In_ PVOID Parameter
+static BOOLEAN NTAPI SearchNameCacheEqualFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    )
+{
+    PSEARCH_NAME_CACHE_ENTRY entry1 = Entry1;
+    PSEARCH_NAME_CACHE_ENTRY entry2 = Entry2;
+
+    return entry1->Object == entry2->Object && entry1->ObjectTypeIndex == entry2->ObjectTypeIndex;
+}
+
+static ULONG NTAPI SearchNameCacheHashFunction(
+    _In_ PVOID Entry
+    )
+{
+    PSEARCH_NAME_CACHE_ENTRY entry = Entry;
+
+    return PhHashIntPtr((ULONG_PTR)entry->Object) ^ entry->ObjectTypeIndex;
+}
+
+static BOOLEAN LookupSearchNameCache(
+    _In_ PSYSTEM_HANDLE_TABLE_ENTRY_INFO_EX HandleInfo,
+    _Out_ PPH_STRING *TypeName,
+    _Out_ PPH_STRING *BestObjectName
+    )
+{
+    SEARCH_NAME_CACHE_ENTRY lookupEntry;
+    PSEARCH_NAME_CACHE_ENTRY entry;
+
+    // Objects that were seen by the previous search keep their names. As with the
+    // handle provider, this relies on object addresses not being reused for a while.
+
+    lookupEntry.Object = HandleInfo->Object;
+    lookupEntry.ObjectTypeIndex = HandleInfo->ObjectTypeIndex;
+
+    PhAcquireQueuedLockExclusive(&SearchNameCacheLock);
+
+    if (entry = PhFindEntryHashtable(SearchNameCacheHashtable, &lookupEntry))
+    {
+        PhSetReference(TypeName, entry->TypeName);
+        PhSetReference(BestObjectName, entry->BestObjectName);
+        entry->LastSearchCount = SearchCount;
+    }
+
+    PhReleaseQueuedLockExclusive(&SearchNameCacheLock);
+
+    return !!entry;
+}
+
+static VOID UpdateSearchNameCache(
+    _In_ PSYSTEM_HANDLE_TABLE_ENTRY_INFO_EX HandleInfo,
+    _In_ PPH_STRING TypeName,
+    _In_ PPH_STRING BestObjectName
+    )
+{
+    SEARCH_NAME_CACHE_ENTRY lookupEntry;
+    PSEARCH_NAME_CACHE_ENTRY entry;
+    BOOLEAN added;
+
+    lookupEntry.Object = HandleInfo->Object;
+    lookupEntry.ObjectTypeIndex = HandleInfo->ObjectTypeIndex;
+
+    PhAcquireQueuedLockExclusive(&SearchNameCacheLock);
+
+    entry = PhAddEntryHashtableEx(SearchNameCacheHashtable, &lookupEntry, &added);
+
+    if (added)
+    {
+        PhSetReference(&entry->TypeName, TypeName);
+        PhSetReference(&entry->BestObjectName, BestObjectName);
+    }
+
+    entry->LastSearchCount = SearchCount;
+
+    PhReleaseQueuedLockExclusive(&SearchNameCacheLock);
+}
+
+static VOID PruneSearchNameCache(
+    VOID
     )
 {
-    PSEARCH_HANDLE_CONTEXT context = Parameter;
-    PPH_STRING typeName;
-    PPH_STRING bestObjectName;
-
-    if (!SearchStop && NT_SUCCESS(PhGetHandleInformation(
-        context->ProcessHandle,
-        (HANDLE)context->HandleInfo->HandleValue,
-        context->HandleInfo->ObjectTypeIndex,
-        NULL,
-        &typeName,
-        NULL,
-        &bestObjectName
-        )))
+    PH_HASHTABLE_ENUM_CONTEXT enumContext;
+    PSEARCH_NAME_CACHE_ENTRY entry;
+    PPH_LIST entriesToRemove = NULL;
+    ULONG i;
+
+    // Only keep the objects that were seen by this search.
+
+    PhAcquireQueuedLockExclusive(&SearchNameCacheLock);
+
+    PhBeginEnumHashtable(SearchNameCacheHashtable, &enumContext);
+
+    while (entry = PhNextEnumHashtable(&enumContext))
     {
-        PPH_STRING upperBestObjectName;
+        if (entry->LastSearchCount != SearchCount)
+        {
+            if (!entriesToRemove)
+                entriesToRemove = PhCreateList(32);
 
-        upperBestObjectName = PhDuplicateString(bestObjectName);
-        PhUpperString(upperBestObjectName);
+            PhAddItemList(entriesToRemove, entry);
+        }
+    }
 
-        if (MatchSearchString(&upperBestObjectName->sr) ||
-            (UseSearchPointer && context->HandleInfo->Object == (PVOID)SearchPointer))
+    if (entriesToRemove)
+    {
+        for (i = 0; i < entriesToRemove->Count; i++)
         {
-            PPHP_OBJECT_SEARCH_RESULT searchResult;
+            entry = entriesToRemove->Items[i];
 
-            searchResult = PhAllocate(sizeof(PHP_OBJECT_SEARCH_RESULT));
-            searchResult->ProcessId = (HANDLE)context->HandleInfo->UniqueProcessId;
-            searchResult->ResultType = HandleSearchResult;
-            searchResult->Handle = (HANDLE)context->HandleInfo->HandleValue;
-            searchResult->TypeName = typeName;
-            searchResult->Name = bestObjectName;
-            PhPrintPointer(searchResult->HandleString, (PVOID)searchResult->Handle);
-            searchResult->Info = *context->HandleInfo;
+            PhDereferenceObject(entry->TypeName);
+            PhDereferenceObject(entry->BestObjectName);
+            PhRemoveEntryHashtable(SearchNameCacheHashtable, entry);
+        }
 
-            PhAcquireQueuedLockExclusive(&SearchResultsLock);
+        PhDereferenceObject(entriesToRemove);
+    }
+
+    PhReleaseQueuedLockExclusive(&SearchNameCacheLock);
+}
 
-            PhAddItemList(SearchResults, searchResult);
+static VOID SearchHandle(
+    _In_ PSYSTEM_HANDLE_TABLE_ENTRY_INFO_EX HandleInfo,
+    _In_ _Assume_refs_(1) PPH_STRING TypeName,
+    _In_ _Assume_refs_(1) PPH_STRING BestObjectName
+    )
+{
+    PPH_STRING upperBestObjectName;
 
-            // Update the search results in batches of 40.
-            if (SearchResults->Count % 40 == 0)
-                PostMessage(PhFindObjectsWindowHandle, WM_PH_SEARCH_UPDATE, 0, 0);
+    upperBestObjectName = PhDuplicateString(BestObjectName);
+    PhUpperString(upperBestObjectName);
 
-            PhReleaseQueuedLockExclusive(&SearchResultsLock);
+    if (MatchSearchString(&upperBestObjectName->sr) ||
+        (UseSearchPointer && HandleInfo->Object == (PVOID)SearchPointer))
+    {
+        PPHP_OBJECT_SEARCH_RESULT searchResult;
+
+        searchResult = PhAllocate(sizeof(PHP_OBJECT_SEARCH_RESULT));
+        searchResult->ProcessId = (HANDLE)HandleInfo->UniqueProcessId;
+        searchResult->ResultType = HandleSearchResult;
+        searchResult->Handle = (HANDLE)HandleInfo->HandleValue;
+        searchResult->TypeName = TypeName;
+        searchResult->Name = BestObjectName;
+        PhPrintPointer(searchResult->HandleString, (PVOID)searchResult->Handle);
+        searchResult->Info = *HandleInfo;
+
+        AddSearchResult(searchResult);
+    }
+    else
+    {
+        PhDereferenceObject(TypeName);
+        PhDereferenceObject(BestObjectName);
+    }
+
+    PhDereferenceObject(upperBestObjectName);
+}
+
+static VOID NTAPI SearchHandleNameQueryCallback(
+    _Inout_ PPH_HANDLE_NAME_QUERY Query,
+    _In_opt_ PVOID Context
+    )
+{
+    PSYSTEM_HANDLE_TABLE_ENTRY_INFO_EX handleInfo = Query->Context;
+
+    if (Query->ObjectName)
+        PhDereferenceObject(Query->ObjectName);
+
+    if (!Query->TypeName)
+    {
+        PhClearReference(&Query->BestObjectName);
+        return;
+    }
+
+    if (!Query->BestObjectName)
+        Query->BestObjectName = PhReferenceEmptyString();
+
+    UpdateSearchNameCache(handleInfo, Query->TypeName, Query->BestObjectName);
+    SearchHandle(handleInfo, Query->TypeName, Query->BestObjectName);
+}
+
+typedef struct _SEARCH_PROCESS_CONTEXT
+{
+    HANDLE ProcessId;
+    PSYSTEM_HANDLE_TABLE_ENTRY_INFO_EX Handles;
+    ULONG NumberOfHandles;
+} SEARCH_PROCESS_CONTEXT, *PSEARCH_PROCESS_CONTEXT;
+
+static NTSTATUS NTAPI SearchProcessHandlesFunction(
+    _In_ PVOID Parameter
+    )
+{
+    PSEARCH_PROCESS_CONTEXT context = Parameter;
+    HANDLE processHandle;
+    PPH_HANDLE_NAME_QUERY nameQueries = NULL;
+    ULONG numberOfNameQueries = 0;
+    ULONG i;
+
+    if (SearchStop)
+        goto CleanupExit;
+
+    if (!NT_SUCCESS(PhOpenProcess(&processHandle, PROCESS_DUP_HANDLE, context->ProcessId)))
+        goto CleanupExit;
+
+    for (i = 0; i < context->NumberOfHandles; i++)
+    {
+        PSYSTEM_HANDLE_TABLE_ENTRY_INFO_EX handleInfo = &context->Handles[i];
+        PPH_STRING typeName;
+        PPH_STRING bestObjectName;
+
+        if (SearchStop)
+            break;
+
+        if (LookupSearchNameCache(handleInfo, &typeName, &bestObjectName))
+        {
+            SearchHandle(handleInfo, typeName, bestObjectName);
+            continue;
         }
-        else
+
+        // File names can hang when we don't have KPH, so they are queried together
+        // with a timeout once the rest of the process has been searched.
+        if (SearchUseNameQueries && handleInfo->ObjectTypeIndex == (USHORT)SearchFileObjectTypeIndex)
         {
-            PhDereferenceObject(typeName);
-            PhDereferenceObject(bestObjectName);
+            if (!nameQueries)
+                nameQueries = PhAllocate(sizeof(PH_HANDLE_NAME_QUERY) * context->NumberOfHandles);
+
+            nameQueries[numberOfNameQueries].Handle = (HANDLE)handleInfo->HandleValue;
+            nameQueries[numberOfNameQueries].ObjectTypeNumber = handleInfo->ObjectTypeIndex;
+            nameQueries[numberOfNameQueries].Context = handleInfo;
+            numberOfNameQueries++;
+            continue;
         }
 
-        PhDereferenceObject(upperBestObjectName);
+        if (NT_SUCCESS(PhGetHandleInformation(
+            processHandle,
+            (HANDLE)handleInfo->HandleValue,
+            handleInfo->ObjectTypeIndex,
+            NULL,
+            &typeName,
+            NULL,
+            &bestObjectName
+            )))
+        {
+            UpdateSearchNameCache(handleInfo, typeName, bestObjectName);
+            SearchHandle(handleInfo, typeName, bestObjectName);
+        }
     }
 
-    if (context->NeedToFree)
-        PhFree(context);
+    if (nameQueries)
+    {
+        if (!SearchStop)
+        {
+            PhQueryHandleNamesWithTimeout(
+                processHandle,
+                nameQueries,
+                numberOfNameQueries,
+                1000,
+                SearchHandleNameQueryCallback,
+                NULL
+                );
+        }
+
+        PhFree(nameQueries);
+    }
+
+    NtClose(processHandle);
+
+CleanupExit:
+    PhFree(context);
 
     return STATUS_SUCCESS;
 }
@@ -841,15 +1076,7 @@ static BOOLEAN NTAPI EnumModulesCallback(
         PhPrintPointer(searchResult->HandleString, Module->BaseAddress);
         memset(&searchResult->Info, 0, sizeof(SYSTEM_HANDLE_TABLE_ENTRY_INFO_EX));
 
-        PhAcquireQueuedLockExclusive(&SearchResultsLock);
-
-        PhAddItemList(SearchResults, searchResult);
-
-        // Update the search results in batches of 40.
-        if (SearchResults->Count % 40 == 0)
-            PostMessage(PhFindObjectsWindowHandle, WM_PH_SEARCH_UPDATE, 0, 0);
-
-        PhReleaseQueuedLockExclusive(&SearchResultsLock);
+        AddSearchResult(searchResult);
     }
 
     PhDereferenceObject(upperFileName);
@@ -857,16 +1084,35 @@ static BOOLEAN NTAPI EnumModulesCallback(
     return TRUE;
 }
 
+static NTSTATUS NTAPI SearchProcessModulesFunction(
+    _In_ PVOID Parameter
+    )
+{
+    if (!SearchStop)
+    {
+        PhEnumGenericModules(
+            (HANDLE)Parameter,
+            NULL,
+            PH_ENUM_GENERIC_MAPPED_FILES | PH_ENUM_GENERIC_MAPPED_IMAGES,
+            EnumModulesCallback,
+            Parameter
+            );
+    }
+
+    return STATUS_SUCCESS;
+}
+
 static NTSTATUS PhpFindObjectsThreadStart(
     _In_ PVOID Parameter
     )
 {
+    static PH_INITONCE initOnce = PH_INITONCE_INIT;
+
     NTSTATUS status = STATUS_SUCCESS;
-    PSYSTEM_HANDLE_INFORMATION_EX handles;
-    PPH_HASHTABLE processHandleHashtable;
+    PH_WORK_QUEUE workQueue;
+    PPH_HANDLE_SNAPSHOT snapshot = NULL;
     PVOID processes;
     PSYSTEM_PROCESS_INFORMATION process;
-    ULONG i;
 
     // Refuse to search with no filter.
     if (SearchString->Length == 0)
@@ -877,108 +1123,52 @@ static NTSTATUS PhpFindObjectsThreadStart(
 
     PhUpperString(SearchString);
 
-    if (NT_SUCCESS(status = PhEnumHandlesEx(&handles)))
+    if (PhBeginInitOnce(&initOnce))
     {
-        static PH_INITONCE initOnce = PH_INITONCE_INIT;
-        static ULONG fileObjectTypeIndex = -1;
+        UNICODE_STRING fileTypeName;
 
-        BOOLEAN useWorkQueue = FALSE;
-        PH_WORK_QUEUE workQueue;
-        processHandleHashtable = PhCreateSimpleHashtable(8);
+        RtlInitUnicodeString(&fileTypeName, L"File");
+        SearchFileObjectTypeIndex = PhGetObjectTypeNumber(&fileTypeName);
 
-        if (!KphIsConnected() && WindowsVersion >= WINDOWS_VISTA)
-        {
-            useWorkQueue = TRUE;
-            PhInitializeWorkQueue(&workQueue, 1, 20, 1000);
-
-            if (PhBeginInitOnce(&initOnce))
-            {
-                UNICODE_STRING fileTypeName;
-
-                RtlInitUnicodeString(&fileTypeName, L"File");
-                fileObjectTypeIndex = PhGetObjectTypeNumber(&fileTypeName);
-                PhEndInitOnce(&initOnce);
-            }
-        }
-
-        for (i = 0; i < handles->NumberOfHandles; i++)
-        {
-            PSYSTEM_HANDLE_TABLE_ENTRY_INFO_EX handleInfo = &handles->Handles[i];
-            PVOID *processHandlePtr;
-            HANDLE processHandle;
-
-            if (SearchStop)
-                break;
-
-            // Open a handle to the process if we don't already have one.
-
-            processHandlePtr = PhFindItemSimpleHashtable(
-                processHandleHashtable,
-                (PVOID)handleInfo->UniqueProcessId
-                );
+        SearchNameCacheHashtable = PhCreateHashtable(
+            sizeof(SEARCH_NAME_CACHE_ENTRY),
+            SearchNameCacheEqualFunction,
+            SearchNameCacheHashFunction,
+            1024
+            );
 
-            if (processHandlePtr)
-            {
-                processHandle = (HANDLE)*processHandlePtr;
-            }
-            else
-            {
-                if (NT_SUCCESS(PhOpenProcess(
-                    &processHandle,
-                    PROCESS_DUP_HANDLE,
-                    (HANDLE)handleInfo->UniqueProcessId
-                    )))
-                {
-                    PhAddItemSimpleHashtable(
-                        processHandleHashtable,
-                        (PVOID)handleInfo->UniqueProcessId,
-                        processHandle
-                        );
-                }
-                else
-                {
-                    continue;
-                }
-            }
+        PhEndInitOnce(&initOnce);
+    }
 
-            if (useWorkQueue && handleInfo->ObjectTypeIndex == (USHORT)fileObjectTypeIndex)
-            {
-                PSEARCH_HANDLE_CONTEXT searchHandleContext;
+    SearchUseNameQueries = !KphIsConnected() && WindowsVersion >= WINDOWS_VISTA;
+    SearchCount++;
 
-                searchHandleContext = PhAllocate(sizeof(SEARCH_HANDLE_CONTEXT));
-                searchHandleContext->NeedToFree = TRUE;
-                searchHandleContext->HandleInfo = handleInfo;
-                searchHandleContext->ProcessHandle = processHandle;
-                PhQueueItemWorkQueue(&workQueue, SearchHandleFunction, searchHandleContext);
-            }
-            else
-            {
-                SEARCH_HANDLE_CONTEXT searchHandleContext;
+    // Each process is searched by a single work item, so one process with many handles
+    // doesn't hold up the rest of the search.
+    PhInitializeWorkQueue(
+        &workQueue,
+        0,
+        min(max((ULONG)PhSystemBasicInformation.NumberOfProcessors, 2), 16),
+        1000
+        );
 
-                searchHandleContext.NeedToFree = FALSE;
-                searchHandleContext.HandleInfo = handleInfo;
-                searchHandleContext.ProcessHandle = processHandle;
-                SearchHandleFunction(&searchHandleContext);
-            }
-        }
+    if (NT_SUCCESS(status = PhReferenceHandleSnapshot(&snapshot)))
+    {
+        PH_HASHTABLE_ENUM_CONTEXT enumContext;
+        PPH_HANDLE_SNAPSHOT_PROCESS snapshotProcess;
 
-        if (useWorkQueue)
-        {
-            PhWaitForWorkQueue(&workQueue);
-            PhDeleteWorkQueue(&workQueue);
-        }
+        PhBeginEnumHashtable(snapshot->ProcessTable, &enumContext);
 
+        while (snapshotProcess = PhNextEnumHashtable(&enumContext))
         {
-            PPH_KEY_VALUE_PAIR entry;
+            PSEARCH_PROCESS_CONTEXT context;
 
-            i = 0;
-
-            while (PhEnumHashtable(processHandleHashtable, &entry, &i))
-                NtClose((HANDLE)entry->Value);
+            context = PhAllocate(sizeof(SEARCH_PROCESS_CONTEXT));
+            context->ProcessId = snapshotProcess->ProcessId;
+            context->Handles = &snapshot->Information->Handles[snapshotProcess->Start];
+            context->NumberOfHandles = snapshotProcess->Count;
+            PhQueueItemWorkQueue(&workQueue, SearchProcessHandlesFunction, context);
         }
-
-        PhDereferenceObject(processHandleHashtable);
-        PhFree(handles);
     }
 
     if (NT_SUCCESS(PhEnumProcesses(&processes)))
@@ -987,20 +1177,26 @@ static NTSTATUS PhpFindObjectsThreadStart(
 
         do
         {
-            PhEnumGenericModules(
-                process->UniqueProcessId,
-                NULL,
-                PH_ENUM_GENERIC_MAPPED_FILES | PH_ENUM_GENERIC_MAPPED_IMAGES,
-                EnumModulesCallback,
-                (PVOID)process->UniqueProcessId
-                );
+            PhQueueItemWorkQueue(&workQueue, SearchProcessModulesFunction, process->UniqueProcessId);
         } while (process = PH_NEXT_PROCESS(process));
 
         PhFree(processes);
     }
 
+    // The work queue only waits until the last item has been taken, but deleting it
+    // waits for the worker threads to exit, so no items are running after this.
+    PhWaitForWorkQueue(&workQueue);
+    PhDeleteWorkQueue(&workQueue);
+
+    if (snapshot)
+        PhDereferenceObject(snapshot);
+
+    // A cancelled search didn't see every object, so keep the names for next time.
+    if (!SearchStop)
+        PruneSearchNameCache();
+
 Exit:
     PostMessage(PhFindObjectsWindowHandle, WM_PH_SEARCH_FINISHED, status, 0);
 
     return STATUS_SUCCESS;
-}
+}
\ No newline at end of file
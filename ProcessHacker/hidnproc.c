@@ -27,7 +27,10 @@
  * in order to find processes which have been unlinked from the active process
  * list (EPROCESS.ActiveProcessLinks). This method is not effective when
  * either NtOpenProcess is hooked or PsLookupProcessByProcessId is hooked
- * (KProcessHacker cannot bypass this).
+ * (KProcessHacker cannot bypass this). When KProcessHacker is available, the
+ * process IDs are looked up by the driver instead of being opened one by one.
+ * Otherwise the ID space is split into chunks which are scanned by several
+ * threads, and the upper bound is raised whenever an ID is found in use.
  *
  * CSR Handles. This enumerates handles in all running CSR processes, and works
  * even when a process has been unlinked from the active process list and
@@ -45,6 +48,14 @@
 #include <hidnproc.h>
 #include <windowsx.h>
 
+#define WM_PH_SCAN_FINISHED (WM_APP + 801)
+
+#define PH_HIDDEN_PROCESS_SCAN_CHUNK 1024 // process IDs claimed by a worker at a time
+#define PH_HIDDEN_PROCESS_SCAN_MARGIN (16384 * 4) // how far past an ID in use we keep scanning
+#define PH_HIDDEN_PROCESS_SCAN_MINIMUM_LIMIT 65536
+#define PH_HIDDEN_PROCESS_MAXIMUM_ID (0x1000000 * 4)
+#define PH_HIDDEN_PROCESS_SCAN_MAXIMUM_THREADS 8
+
 INT_PTR CALLBACK PhpHiddenProcessesDlgProc(
     _In_ HWND hwndDlg,
     _In_ UINT uMsg,
@@ -67,6 +78,10 @@ PPH_PROCESS_ITEM PhpCreateProcessItemForHiddenProcess(
     _In_ PPH_HIDDEN_PROCESS_ENTRY Entry
     );
 
+NTSTATUS PhpHiddenProcessesScanThreadStart(
+    _In_ PVOID Parameter
+    );
+
 HWND PhHiddenProcessesWindowHandle = NULL;
 HWND PhHiddenProcessesListViewHandle = NULL;
 static PH_LAYOUT_MANAGER WindowLayoutManager;
@@ -76,6 +91,12 @@ static PH_HIDDEN_PROCESS_METHOD ProcessesMethod;
 static PPH_LIST ProcessesList = NULL;
 static ULONG NumberOfHiddenProcesses;
 static ULONG NumberOfTerminatedProcesses;
+static HANDLE ScanThreadHandle = NULL;
+static PH_HIDDEN_PROCESS_SCAN ScanInfo;
+
+// Shared by the scan methods and the CSR helpers so that repeated scans reuse the same buffers.
+static PH_PROCESS_SNAPSHOT ProcessesSnapshot = { SystemProcessInformation };
+static PH_QUEUED_LOCK ProcessesSnapshotLock = PH_QUEUED_LOCK_INIT;
 
 VOID PhShowHiddenProcessesDialog(
     VOID
@@ -170,6 +191,14 @@ static INT_PTR CALLBACK PhpHiddenProcessesDlgProc(
         break;
     case WM_DESTROY:
         {
+            if (ScanThreadHandle)
+            {
+                ScanInfo.Cancelled = TRUE;
+                NtWaitForSingleObject(ScanThreadHandle, FALSE, NULL);
+                NtClose(ScanThreadHandle);
+                ScanThreadHandle = NULL;
+            }
+
             PhSaveWindowPlacementToSetting(L"HiddenProcessesWindowPosition", L"HiddenProcessesWindowSize", hwndDlg);
             PhSaveListViewColumnsToSetting(L"HiddenProcessesListViewColumns", PhHiddenProcessesListViewHandle);
         }
@@ -193,9 +222,16 @@ static INT_PTR CALLBACK PhpHiddenProcessesDlgProc(
                 break;
             case IDC_SCAN:
                 {
-                    NTSTATUS status;
                     PPH_STRING method;
 
+                    if (ScanThreadHandle)
+                    {
+                        // The thread will post WM_PH_SCAN_FINISHED with the results found so far.
+                        ScanInfo.Cancelled = TRUE;
+                        EnableWindow(GetDlgItem(hwndDlg, IDC_SCAN), FALSE);
+                        break;
+                    }
+
                     method = PhGetWindowText(GetDlgItem(hwndDlg, IDC_METHOD));
                     PhAutoDereferenceObject(method);
 
@@ -226,28 +262,18 @@ static INT_PTR CALLBACK PhpHiddenProcessesDlgProc(
                         CsrHandlesScanMethod;
                     NumberOfHiddenProcesses = 0;
                     NumberOfTerminatedProcesses = 0;
-
-                    ExtendedListView_SetRedraw(PhHiddenProcessesListViewHandle, FALSE);
-                    status = PhEnumHiddenProcesses(
-                        ProcessesMethod,
-                        PhpHiddenProcessesCallback,
-                        NULL
-                        );
-                    ExtendedListView_SortItems(PhHiddenProcessesListViewHandle);
-                    ExtendedListView_SetRedraw(PhHiddenProcessesListViewHandle, TRUE);
-
-                    if (NT_SUCCESS(status))
-                    {
-                        SetDlgItemText(hwndDlg, IDC_DESCRIPTION,
-                            PhaFormatString(L"%u hidden process(es), %u terminated process(es).",
-                            NumberOfHiddenProcesses, NumberOfTerminatedProcesses)->Buffer
-                            );
-                        InvalidateRect(GetDlgItem(hwndDlg, IDC_DESCRIPTION), NULL, TRUE);
-                    }
-                    else
-                    {
-                        PhShowStatus(hwndDlg, L"Unable to perform the scan", status, 0);
-                    }
+                    memset(&ScanInfo, 0, sizeof(PH_HIDDEN_PROCESS_SCAN));
+
+                    if (!(ScanThreadHandle = PhCreateThread(0, PhpHiddenProcessesScanThreadStart, NULL)))
+                        break;
+
+                    SetDlgItemText(hwndDlg, IDC_SCAN, L"Cancel");
+                    EnableWindow(GetDlgItem(hwndDlg, IDC_METHOD), FALSE);
+                    EnableWindow(GetDlgItem(hwndDlg, IDC_SAVE), FALSE);
+                    EnableWindow(GetDlgItem(hwndDlg, IDC_TERMINATE), FALSE);
+                    SetDlgItemText(hwndDlg, IDC_DESCRIPTION, L"Scanning...");
+                    InvalidateRect(GetDlgItem(hwndDlg, IDC_DESCRIPTION), NULL, TRUE);
+                    SetTimer(hwndDlg, 1, 250, NULL);
                 }
                 break;
             case IDC_TERMINATE:
@@ -453,6 +479,83 @@ static INT_PTR CALLBACK PhpHiddenProcessesDlgProc(
             }
         }
         break;
+    case WM_TIMER:
+        {
+            ULONG scannedCount;
+            ULONG totalCount;
+
+            if (!ScanThreadHandle || ProcessesMethod != BruteForceScanMethod || KphIsConnected())
+                break;
+
+            scannedCount = ScanInfo.ScannedCount;
+            totalCount = ScanInfo.TotalCount;
+
+            if (totalCount != 0)
+            {
+                SetDlgItemText(hwndDlg, IDC_DESCRIPTION,
+                    PhaFormatString(L"Scanning... %u%% (%u of %u process IDs)",
+                    min(scannedCount, totalCount) * 100 / totalCount,
+                    min(scannedCount, totalCount), totalCount)->Buffer
+                    );
+                InvalidateRect(GetDlgItem(hwndDlg, IDC_DESCRIPTION), NULL, TRUE);
+            }
+        }
+        break;
+    case WM_PH_SCAN_FINISHED:
+        {
+            NTSTATUS status = (NTSTATUS)wParam;
+            ULONG i;
+
+            KillTimer(hwndDlg, 1);
+
+            NtWaitForSingleObject(ScanThreadHandle, FALSE, NULL);
+            NtClose(ScanThreadHandle);
+            ScanThreadHandle = NULL;
+
+            ExtendedListView_SetRedraw(PhHiddenProcessesListViewHandle, FALSE);
+
+            for (i = 0; i < ProcessesList->Count; i++)
+            {
+                PPH_HIDDEN_PROCESS_ENTRY entry = ProcessesList->Items[i];
+                INT lvItemIndex;
+                WCHAR pidString[PH_INT32_STR_LEN_1];
+
+                lvItemIndex = PhAddListViewItem(PhHiddenProcessesListViewHandle, MAXINT,
+                    PhGetStringOrDefault(entry->FileName, L"(unknown)"), entry);
+                PhPrintUInt32(pidString, HandleToUlong(entry->ProcessId));
+                PhSetListViewSubItem(PhHiddenProcessesListViewHandle, lvItemIndex, 1, pidString);
+
+                if (entry->Type == HiddenProcess)
+                    NumberOfHiddenProcesses++;
+                else if (entry->Type == TerminatedProcess)
+                    NumberOfTerminatedProcesses++;
+            }
+
+            ExtendedListView_SortItems(PhHiddenProcessesListViewHandle);
+            ExtendedListView_SetRedraw(PhHiddenProcessesListViewHandle, TRUE);
+
+            SetDlgItemText(hwndDlg, IDC_SCAN, L"&Scan");
+            EnableWindow(GetDlgItem(hwndDlg, IDC_SCAN), TRUE);
+            EnableWindow(GetDlgItem(hwndDlg, IDC_METHOD), TRUE);
+            EnableWindow(GetDlgItem(hwndDlg, IDC_SAVE), TRUE);
+
+            if (NT_SUCCESS(status) || status == STATUS_CANCELLED)
+            {
+                SetDlgItemText(hwndDlg, IDC_DESCRIPTION,
+                    PhaFormatString(L"%s%u hidden process(es), %u terminated process(es).",
+                    status == STATUS_CANCELLED ? L"Scan cancelled. " : L"",
+                    NumberOfHiddenProcesses, NumberOfTerminatedProcesses)->Buffer
+                    );
+            }
+            else
+            {
+                SetDlgItemText(hwndDlg, IDC_DESCRIPTION, L"");
+                PhShowStatus(hwndDlg, L"Unable to perform the scan", status, 0);
+            }
+
+            InvalidateRect(GetDlgItem(hwndDlg, IDC_DESCRIPTION), NULL, TRUE);
+        }
+        break;
     case WM_SIZE:
         {
             PhLayoutManagerLayout(&WindowLayoutManager);
@@ -511,8 +614,8 @@ static BOOLEAN NTAPI PhpHiddenProcessesCallback(
     )
 {
     PPH_HIDDEN_PROCESS_ENTRY entry;
-    INT lvItemIndex;
-    WCHAR pidString[PH_INT32_STR_LEN_1];
+
+    // This is called on the scan thread. The list view is filled in once the scan has finished.
 
     entry = PhAllocateCopy(Process, sizeof(PH_HIDDEN_PROCESS_ENTRY));
 
@@ -521,17 +624,24 @@ static BOOLEAN NTAPI PhpHiddenProcessesCallback(
 
     PhAddItemList(ProcessesList, entry);
 
-    lvItemIndex = PhAddListViewItem(PhHiddenProcessesListViewHandle, MAXINT,
-        PhGetStringOrDefault(entry->FileName, L"(unknown)"), entry);
-    PhPrintUInt32(pidString, HandleToUlong(entry->ProcessId));
-    PhSetListViewSubItem(PhHiddenProcessesListViewHandle, lvItemIndex, 1, pidString);
+    return TRUE;
+}
 
-    if (entry->Type == HiddenProcess)
-        NumberOfHiddenProcesses++;
-    else if (entry->Type == TerminatedProcess)
-        NumberOfTerminatedProcesses++;
+static NTSTATUS PhpHiddenProcessesScanThreadStart(
+    _In_ PVOID Parameter
+    )
+{
+    NTSTATUS status;
 
-    return TRUE;
+    status = PhEnumHiddenProcessesEx(
+        ProcessesMethod,
+        PhpHiddenProcessesCallback,
+        NULL,
+        &ScanInfo
+        );
+    PostMessage(PhHiddenProcessesWindowHandle, WM_PH_SCAN_FINISHED, status, 0);
+
+    return STATUS_SUCCESS;
 }
 
 static PPH_PROCESS_ITEM PhpCreateProcessItemForHiddenProcess(
@@ -741,131 +851,418 @@ static PPH_PROCESS_ITEM PhpCreateProcessItemForHiddenProcess(
 
     // TODO: Other stage 1 tasks.
 
+    processItem->Stage1Flags = PH_PROCESS_STAGE1_ALL;
     PhSetEvent(&processItem->Stage1Event);
 
     return processItem;
 }
 
-NTSTATUS PhpEnumHiddenProcessesBruteForce(
-    _In_ PPH_ENUM_HIDDEN_PROCESSES_CALLBACK Callback,
-    _In_opt_ PVOID Context
+/**
+ * Takes a snapshot of the process IDs that are visible through NtQuerySystemInformation.
+ *
+ * \param Bitmap A variable which receives a bitmap with one bit for each possible process ID
+ * (divided by 4) up to the highest one in the snapshot. Free the buffer with PhFree() when it is
+ * no longer needed.
+ */
+static NTSTATUS PhpSnapshotProcessIds(
+    _Out_ PRTL_BITMAP Bitmap
     )
 {
     NTSTATUS status;
     PVOID processes;
     PSYSTEM_PROCESS_INFORMATION process;
-    PPH_LIST pids;
-    ULONG pid;
-    BOOLEAN stop = FALSE;
+    ULONG maximumIndex;
+    ULONG numberOfBits;
+    PULONG buffer;
+
+    PhAcquireQueuedLockExclusive(&ProcessesSnapshotLock);
 
-    if (!NT_SUCCESS(status = PhEnumProcesses(&processes)))
+    if (!NT_SUCCESS(status = PhUpdateProcessSnapshot(&ProcessesSnapshot, &processes)))
+    {
+        PhReleaseQueuedLockExclusive(&ProcessesSnapshotLock);
         return status;
+    }
 
-    pids = PhCreateList(40);
+    maximumIndex = 0;
+    process = PH_FIRST_PROCESS(processes);
+
+    do
+    {
+        maximumIndex = max(maximumIndex, HandleToUlong(process->UniqueProcessId) / 4);
+    } while (process = PH_NEXT_PROCESS(process));
+
+    numberOfBits = ALIGN_UP_BY(maximumIndex + 1, 32);
+    buffer = PhAllocate(numberOfBits / 8);
+    RtlInitializeBitMap(Bitmap, buffer, numberOfBits);
+    RtlClearAllBits(Bitmap);
 
     process = PH_FIRST_PROCESS(processes);
 
     do
     {
-        PhAddItemList(pids, process->UniqueProcessId);
+        RtlSetBits(Bitmap, HandleToUlong(process->UniqueProcessId) / 4, 1);
     } while (process = PH_NEXT_PROCESS(process));
 
-    PhFree(processes);
+    PhReleaseQueuedLockExclusive(&ProcessesSnapshotLock);
+
+    return STATUS_SUCCESS;
+}
+
+FORCEINLINE BOOLEAN PhpIsProcessIdInSnapshot(
+    _In_ PRTL_BITMAP Bitmap,
+    _In_ HANDLE ProcessId
+    )
+{
+    ULONG index;
+
+    index = HandleToUlong(ProcessId) / 4;
 
-    for (pid = 8; pid <= 65536; pid += 4)
+    return index < Bitmap->SizeOfBitMap && RtlCheckBit(Bitmap, index);
+}
+
+NTSTATUS PhpEnumHiddenProcessesKph(
+    _In_ PRTL_BITMAP Pids,
+    _In_ PPH_ENUM_HIDDEN_PROCESSES_CALLBACK Callback,
+    _In_opt_ PVOID Context
+    )
+{
+    NTSTATUS status;
+    PKPH_PROCESS_LIST list;
+    ULONG bufferSize;
+    ULONG attempts;
+    ULONG i;
+
+    bufferSize = FIELD_OFFSET(KPH_PROCESS_LIST, Processes) + 512 * sizeof(KPH_PROCESS_ENTRY);
+    list = PhAllocate(bufferSize);
+    attempts = 8;
+
+    while (TRUE)
     {
-        NTSTATUS status2;
-        HANDLE processHandle;
+        status = KphEnumerateProcesses(list, bufferSize, &bufferSize);
+
+        if (status != STATUS_BUFFER_TOO_SMALL || --attempts == 0)
+            break;
+
+        PhFree(list);
+        bufferSize += 16 * sizeof(KPH_PROCESS_ENTRY); // processes may be created in the meantime
+        list = PhAllocate(bufferSize);
+    }
+
+    if (!NT_SUCCESS(status))
+    {
+        PhFree(list);
+        return status;
+    }
+
+    for (i = 0; i < list->NumberOfProcesses; i++)
+    {
+        PKPH_PROCESS_ENTRY process = &list->Processes[i];
         PH_HIDDEN_PROCESS_ENTRY entry;
-        KERNEL_USER_TIMES times;
         PPH_STRING fileName;
 
-        status2 = PhOpenProcess(
-            &processHandle,
-            ProcessQueryAccess,
-            UlongToHandle(pid)
-            );
+        entry.ProcessId = process->ProcessId;
 
-        if (NT_SUCCESS(status2))
+        if (WindowsVersion >= WINDOWS_VISTA && NT_SUCCESS(PhGetProcessImageFileNameByProcessId(process->ProcessId, &fileName)))
         {
-            entry.ProcessId = UlongToHandle(pid);
+            entry.FileName = PhGetFileName(fileName);
+            PhDereferenceObject(fileName);
+        }
+        else
+        {
+            process->ImageFileName[sizeof(process->ImageFileName) - 1] = 0;
+            entry.FileName = PhConvertMultiByteToUtf16(process->ImageFileName);
+        }
 
-            if (NT_SUCCESS(status2 = PhGetProcessTimes(
-                processHandle,
-                &times
-                )) &&
-                NT_SUCCESS(status2 = PhGetProcessImageFileName(
-                processHandle,
-                &fileName
-                )))
-            {
-                entry.FileName = PhGetFileName(fileName);
-                PhDereferenceObject(fileName);
+        if (process->Flags & KPH_PROCESS_ENTRY_EXITED)
+            entry.Type = TerminatedProcess;
+        else if (PhpIsProcessIdInSnapshot(Pids, process->ProcessId))
+            entry.Type = NormalProcess;
+        else
+            entry.Type = HiddenProcess;
 
-                if (times.ExitTime.QuadPart != 0)
-                    entry.Type = TerminatedProcess;
-                else if (PhFindItemList(pids, UlongToHandle(pid)) != -1)
-                    entry.Type = NormalProcess;
-                else
-                    entry.Type = HiddenProcess;
+        if (!Callback(&entry, Context))
+        {
+            PhDereferenceObject(entry.FileName);
+            break;
+        }
 
-                if (!Callback(&entry, Context))
-                    stop = TRUE;
+        PhDereferenceObject(entry.FileName);
+    }
 
-                PhDereferenceObject(entry.FileName);
-            }
+    PhFree(list);
 
-            NtClose(processHandle);
-        }
+    return STATUS_SUCCESS;
+}
+
+typedef struct _BRUTE_FORCE_CONTEXT
+{
+    PRTL_BITMAP Pids;
+    PPH_HIDDEN_PROCESS_SCAN Scan;
+
+    // The next process ID to be claimed by a worker.
+    volatile LONG NextProcessId;
+    // Workers stop claiming IDs past this value. It is raised whenever an ID is found in use.
+    volatile LONG Limit;
+
+    PH_QUEUED_LOCK ResultsLock;
+    PPH_LIST Results;
+} BRUTE_FORCE_CONTEXT, *PBRUTE_FORCE_CONTEXT;
+
+static VOID PhpAddBruteForceResult(
+    _In_ PBRUTE_FORCE_CONTEXT Context,
+    _In_ PPH_HIDDEN_PROCESS_ENTRY Entry
+    )
+{
+    PPH_HIDDEN_PROCESS_ENTRY entry;
+
+    // The copy takes over the reference to the file name.
+    entry = PhAllocateCopy(Entry, sizeof(PH_HIDDEN_PROCESS_ENTRY));
+
+    PhAcquireQueuedLockExclusive(&Context->ResultsLock);
+    PhAddItemList(Context->Results, entry);
+    PhReleaseQueuedLockExclusive(&Context->ResultsLock);
+}
+
+static VOID PhpRaiseBruteForceLimit(
+    _In_ PBRUTE_FORCE_CONTEXT Context,
+    _In_ ULONG ProcessId
+    )
+{
+    LONG newLimit;
+    LONG limit;
+    LONG oldLimit;
+
+    newLimit = (LONG)min(ProcessId + PH_HIDDEN_PROCESS_SCAN_MARGIN, PH_HIDDEN_PROCESS_MAXIMUM_ID);
+    limit = Context->Limit;
 
-        // Use an alternative method if we don't have sufficient access.
-        if (status2 == STATUS_ACCESS_DENIED && WindowsVersion >= WINDOWS_VISTA)
+    while (newLimit > limit)
+    {
+        oldLimit = _InterlockedCompareExchange(&Context->Limit, newLimit, limit);
+
+        if (oldLimit == limit)
         {
-            if (NT_SUCCESS(status2 = PhGetProcessImageFileNameByProcessId(UlongToHandle(pid), &fileName)))
-            {
-                entry.ProcessId = UlongToHandle(pid);
-                entry.FileName = PhGetFileName(fileName);
-                PhDereferenceObject(fileName);
+            Context->Scan->TotalCount = newLimit / 4;
+            break;
+        }
+
+        limit = oldLimit;
+    }
+}
 
-                if (PhFindItemList(pids, UlongToHandle(pid)) != -1)
-                    entry.Type = NormalProcess;
-                else
-                    entry.Type = HiddenProcess;
+static VOID PhpBruteForceScanProcessId(
+    _In_ PBRUTE_FORCE_CONTEXT Context,
+    _In_ ULONG ProcessId
+    )
+{
+    NTSTATUS status;
+    HANDLE processHandle;
+    PH_HIDDEN_PROCESS_ENTRY entry;
+    KERNEL_USER_TIMES times;
+    PPH_STRING fileName;
 
-                if (!Callback(&entry, Context))
-                    stop = TRUE;
+    entry.ProcessId = UlongToHandle(ProcessId);
 
-                PhDereferenceObject(entry.FileName);
-            }
+    status = PhOpenProcess(
+        &processHandle,
+        ProcessQueryAccess,
+        entry.ProcessId
+        );
+
+    if (status == STATUS_INVALID_CID || status == STATUS_INVALID_PARAMETER)
+        return;
+
+    // Something is using this ID, so keep scanning past it.
+    PhpRaiseBruteForceLimit(Context, ProcessId);
+
+    if (NT_SUCCESS(status))
+    {
+        if (NT_SUCCESS(status = PhGetProcessTimes(
+            processHandle,
+            &times
+            )) &&
+            NT_SUCCESS(status = PhGetProcessImageFileName(
+            processHandle,
+            &fileName
+            )))
+        {
+            entry.FileName = PhGetFileName(fileName);
+            PhDereferenceObject(fileName);
+
+            if (times.ExitTime.QuadPart != 0)
+                entry.Type = TerminatedProcess;
+            else if (PhpIsProcessIdInSnapshot(Context->Pids, entry.ProcessId))
+                entry.Type = NormalProcess;
+            else
+                entry.Type = HiddenProcess;
+
+            PhpAddBruteForceResult(Context, &entry);
         }
 
-        if (status2 == STATUS_INVALID_CID || status2 == STATUS_INVALID_PARAMETER)
-            status2 = STATUS_SUCCESS;
+        NtClose(processHandle);
+    }
 
-        if (!NT_SUCCESS(status2))
+    // Use an alternative method if we don't have sufficient access.
+    if (status == STATUS_ACCESS_DENIED && WindowsVersion >= WINDOWS_VISTA)
+    {
+        if (NT_SUCCESS(status = PhGetProcessImageFileNameByProcessId(entry.ProcessId, &fileName)))
         {
-            entry.ProcessId = UlongToHandle(pid);
-            entry.FileName = NULL;
-            entry.Type = UnknownProcess;
+            entry.FileName = PhGetFileName(fileName);
+            PhDereferenceObject(fileName);
+
+            if (PhpIsProcessIdInSnapshot(Context->Pids, entry.ProcessId))
+                entry.Type = NormalProcess;
+            else
+                entry.Type = HiddenProcess;
 
-            if (!Callback(&entry, Context))
-                stop = TRUE;
+            PhpAddBruteForceResult(Context, &entry);
         }
+    }
 
-        if (stop)
+    if (status == STATUS_INVALID_CID || status == STATUS_INVALID_PARAMETER)
+        status = STATUS_SUCCESS;
+
+    if (!NT_SUCCESS(status))
+    {
+        entry.FileName = NULL;
+        entry.Type = UnknownProcess;
+
+        PhpAddBruteForceResult(Context, &entry);
+    }
+}
+
+static NTSTATUS PhpBruteForceThreadStart(
+    _In_ PVOID Parameter
+    )
+{
+    PBRUTE_FORCE_CONTEXT context = Parameter;
+    ULONG startId;
+    ULONG processId;
+
+    while (!context->Scan->Cancelled)
+    {
+        startId = (ULONG)_InterlockedExchangeAdd(&context->NextProcessId, PH_HIDDEN_PROCESS_SCAN_CHUNK * 4);
+
+        if (startId > (ULONG)context->Limit)
             break;
+
+        for (processId = startId; processId < startId + PH_HIDDEN_PROCESS_SCAN_CHUNK * 4; processId += 4)
+            PhpBruteForceScanProcessId(context, processId);
+
+        _InterlockedExchangeAdd((volatile LONG *)&context->Scan->ScannedCount, PH_HIDDEN_PROCESS_SCAN_CHUNK);
     }
 
-    PhDereferenceObject(pids);
+    return STATUS_SUCCESS;
+}
 
-    return status;
+static int __cdecl PhpHiddenProcessEntryCompare(
+    _In_ const void *elem1,
+    _In_ const void *elem2
+    )
+{
+    PPH_HIDDEN_PROCESS_ENTRY entry1 = *(PPH_HIDDEN_PROCESS_ENTRY *)elem1;
+    PPH_HIDDEN_PROCESS_ENTRY entry2 = *(PPH_HIDDEN_PROCESS_ENTRY *)elem2;
+
+    return uintptrcmp((ULONG_PTR)entry1->ProcessId, (ULONG_PTR)entry2->ProcessId);
+}
+
+NTSTATUS PhpEnumHiddenProcessesBruteForce(
+    _In_ PPH_ENUM_HIDDEN_PROCESSES_CALLBACK Callback,
+    _In_opt_ PVOID Context,
+    _Inout_ PPH_HIDDEN_PROCESS_SCAN Scan
+    )
+{
+    NTSTATUS status;
+    RTL_BITMAP pids;
+    BRUTE_FORCE_CONTEXT context;
+    HANDLE threadHandles[PH_HIDDEN_PROCESS_SCAN_MAXIMUM_THREADS];
+    ULONG numberOfThreads;
+    ULONG i;
+    BOOLEAN stop = FALSE;
+
+    if (!NT_SUCCESS(status = PhpSnapshotProcessIds(&pids)))
+        return status;
+
+    // KProcessHacker can look up every process ID in the kernel, which is much faster
+    // than opening each one from here. Older versions of the driver don't support this.
+    if (KphIsConnected())
+    {
+        status = PhpEnumHiddenProcessesKph(&pids, Callback, Context);
+
+        if (status != STATUS_INVALID_DEVICE_REQUEST)
+        {
+            PhFree(pids.Buffer);
+            return status;
+        }
+    }
+
+    // Split the process ID space into chunks which are claimed by worker threads. Hidden
+    // processes will usually have IDs near the visible ones, so we start with a limit just past
+    // the highest visible ID (or the old fixed maximum) and raise it whenever we find an ID in use.
+
+    context.Pids = &pids;
+    context.Scan = Scan;
+    context.NextProcessId = 8;
+    context.Limit = (LONG)max(PH_HIDDEN_PROCESS_SCAN_MINIMUM_LIMIT, pids.SizeOfBitMap * 4 + PH_HIDDEN_PROCESS_SCAN_MARGIN);
+    PhInitializeQueuedLock(&context.ResultsLock);
+    context.Results = PhCreateList(64);
+
+    Scan->ScannedCount = 0;
+    Scan->TotalCount = context.Limit / 4;
+
+    numberOfThreads = min((ULONG)PhSystemBasicInformation.NumberOfProcessors, PH_HIDDEN_PROCESS_SCAN_MAXIMUM_THREADS);
+
+    // The current thread is one of the workers.
+    for (i = 0; i < numberOfThreads - 1; i++)
+    {
+        if (!(threadHandles[i] = PhCreateThread(0, PhpBruteForceThreadStart, &context)))
+            break;
+    }
+
+    numberOfThreads = i;
+    PhpBruteForceThreadStart(&context);
+
+    if (numberOfThreads != 0)
+    {
+        NtWaitForMultipleObjects(numberOfThreads, threadHandles, WaitAll, FALSE, NULL);
+
+        for (i = 0; i < numberOfThreads; i++)
+            NtClose(threadHandles[i]);
+    }
+
+    Scan->ScannedCount = Scan->TotalCount;
+
+    // Report the results in order of process ID, as the sequential scan did.
+
+    qsort(context.Results->Items, context.Results->Count, sizeof(PVOID), PhpHiddenProcessEntryCompare);
+
+    for (i = 0; i < context.Results->Count; i++)
+    {
+        PPH_HIDDEN_PROCESS_ENTRY entry = context.Results->Items[i];
+
+        if (!stop && !Callback(entry, Context))
+            stop = TRUE;
+
+        if (entry->FileName)
+            PhDereferenceObject(entry->FileName);
+
+        PhFree(entry);
+    }
+
+    PhDereferenceObject(context.Results);
+    PhFree(pids.Buffer);
+
+    if (Scan->Cancelled)
+        return STATUS_CANCELLED;
+
+    return STATUS_SUCCESS;
 }
 
 typedef struct _CSR_HANDLES_CONTEXT
 {
     PPH_ENUM_HIDDEN_PROCESSES_CALLBACK Callback;
     PVOID Context;
-    PPH_LIST Pids;
+    PRTL_BITMAP Pids;
+    PPH_HIDDEN_PROCESS_SCAN Scan;
 } CSR_HANDLES_CONTEXT, *PCSR_HANDLES_CONTEXT;
 
 static BOOLEAN NTAPI PhpCsrProcessHandlesCallback(
@@ -881,6 +1278,9 @@ static BOOLEAN NTAPI PhpCsrProcessHandlesCallback(
     PPH_STRING fileName;
     PH_HIDDEN_PROCESS_ENTRY entry;
 
+    if (context->Scan->Cancelled)
+        return FALSE;
+
     entry.ProcessId = Handle->ProcessId;
 
     if (NT_SUCCESS(status = PhOpenProcessByCsrHandle(
@@ -903,7 +1303,7 @@ static BOOLEAN NTAPI PhpCsrProcessHandlesCallback(
 
             if (times.ExitTime.QuadPart != 0)
                 entry.Type = TerminatedProcess;
-            else if (PhFindItemList(context->Pids, Handle->ProcessId) != -1)
+            else if (PhpIsProcessIdInSnapshot(context->Pids, Handle->ProcessId))
                 entry.Type = NormalProcess;
             else
                 entry.Type = HiddenProcess;
@@ -931,36 +1331,28 @@ static BOOLEAN NTAPI PhpCsrProcessHandlesCallback(
 
 NTSTATUS PhpEnumHiddenProcessesCsrHandles(
     _In_ PPH_ENUM_HIDDEN_PROCESSES_CALLBACK Callback,
-    _In_opt_ PVOID Context
+    _In_opt_ PVOID Context,
+    _Inout_ PPH_HIDDEN_PROCESS_SCAN Scan
     )
 {
     NTSTATUS status;
-    PVOID processes;
-    PSYSTEM_PROCESS_INFORMATION process;
-    PPH_LIST pids;
+    RTL_BITMAP pids;
     CSR_HANDLES_CONTEXT context;
 
-    if (!NT_SUCCESS(status = PhEnumProcesses(&processes)))
+    if (!NT_SUCCESS(status = PhpSnapshotProcessIds(&pids)))
         return status;
 
-    pids = PhCreateList(40);
-
-    process = PH_FIRST_PROCESS(processes);
-
-    do
-    {
-        PhAddItemList(pids, process->UniqueProcessId);
-    } while (process = PH_NEXT_PROCESS(process));
-
-    PhFree(processes);
-
     context.Callback = Callback;
     context.Context = Context;
-    context.Pids = pids;
+    context.Pids = &pids;
+    context.Scan = Scan;
 
     status = PhEnumCsrProcessHandles(PhpCsrProcessHandlesCallback, &context);
 
-    PhDereferenceObject(pids);
+    PhFree(pids.Buffer);
+
+    if (NT_SUCCESS(status) && Scan->Cancelled)
+        status = STATUS_CANCELLED;
 
     return status;
 }
@@ -971,18 +1363,51 @@ NTSTATUS PhEnumHiddenProcesses(
     _In_opt_ PVOID Context
     )
 {
+    return PhEnumHiddenProcessesEx(Method, Callback, Context, NULL);
+}
+
+/**
+ * Enumerates processes, reporting those that are hidden or have terminated.
+ *
+ * \param Method The detection method.
+ * \param Callback A function which receives information about each process. It is called on the
+ * current thread.
+ * \param Context A user-defined value to pass to the callback function.
+ * \param Scan An optional structure which receives progress information, and which can be used
+ * to cancel the scan from another thread by setting Cancelled to TRUE.
+ *
+ * \return STATUS_CANCELLED if the scan was cancelled. The processes found until then have been
+ * reported.
+ */
+NTSTATUS PhEnumHiddenProcessesEx(
+    _In_ PH_HIDDEN_PROCESS_METHOD Method,
+    _In_ PPH_ENUM_HIDDEN_PROCESSES_CALLBACK Callback,
+    _In_opt_ PVOID Context,
+    _Inout_opt_ PPH_HIDDEN_PROCESS_SCAN Scan
+    )
+{
+    PH_HIDDEN_PROCESS_SCAN localScan;
+
+    if (!Scan)
+    {
+        memset(&localScan, 0, sizeof(PH_HIDDEN_PROCESS_SCAN));
+        Scan = &localScan;
+    }
+
     if (Method == BruteForceScanMethod)
     {
         return PhpEnumHiddenProcessesBruteForce(
             Callback,
-            Context
+            Context,
+            Scan
             );
     }
     else
     {
         return PhpEnumHiddenProcessesCsrHandles(
             Callback,
-            Context
+            Context,
+            Scan
             );
     }
 }
@@ -997,8 +1422,13 @@ NTSTATUS PhpOpenCsrProcesses(
     PSYSTEM_PROCESS_INFORMATION process;
     PPH_LIST processHandleList;
 
-    if (!NT_SUCCESS(status = PhEnumProcesses(&processes)))
+    PhAcquireQueuedLockExclusive(&ProcessesSnapshotLock);
+
+    if (!NT_SUCCESS(status = PhUpdateProcessSnapshot(&ProcessesSnapshot, &processes)))
+    {
+        PhReleaseQueuedLockExclusive(&ProcessesSnapshotLock);
         return status;
+    }
 
     processHandleList = PhCreateList(8);
 
@@ -1030,7 +1460,7 @@ NTSTATUS PhpOpenCsrProcesses(
         }
     } while (process = PH_NEXT_PROCESS(process));
 
-    PhFree(processes);
+    PhReleaseQueuedLockExclusive(&ProcessesSnapshotLock);
 
     *ProcessHandles = PhAllocateCopy(processHandleList->Items, processHandleList->Count * sizeof(HANDLE));
     *NumberOfProcessHandles = processHandleList->Count;
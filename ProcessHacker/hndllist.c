@@ -85,6 +85,7 @@ VOID PhInitializeHandleList(
     PhSetControlTheme(hwnd, L"explorer");
 
     TreeNew_SetCallback(hwnd, PhpHandleTreeNewCallback, Context);
+    TreeNew_SetExtendedFlags(hwnd, TN_FLAG_SEARCH_INDEX, TN_FLAG_SEARCH_INDEX);
 
     TreeNew_SetRedraw(hwnd, FALSE);
 
@@ -494,7 +495,7 @@ BOOLEAN NTAPI PhpHandleTreeNewCallback(
 
                 if (sortFunction)
                 {
-                    qsort_s(context->NodeList->Items, context->NodeList->Count, sizeof(PVOID), sortFunction, context);
+                    PhSortItemsIncrementalEx(context->NodeList->Items, context->NodeList->Count, sortFunction, context);
                 }
 
                 getChildren->Children = (PPH_TREENEW_NODE *)context->NodeList->Items;
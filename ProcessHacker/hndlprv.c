@@ -24,11 +24,29 @@
 #include <kphuser.h>
 #include <extmgri.h>
 
-typedef struct _PHP_CREATE_HANDLE_ITEM_CONTEXT
+// Names are kept for this many updates after the object was last seen.
+#define PH_HANDLE_NAME_CACHE_EXPIRY 60
+#define PH_HANDLE_NAME_CACHE_PRUNE_INTERVAL 8
+
+typedef struct _PHP_HANDLE_NAME_CACHE_ENTRY
 {
-    PPH_HANDLE_PROVIDER Provider;
-    PSYSTEM_HANDLE_TABLE_ENTRY_INFO_EX Handle;
-} PHP_CREATE_HANDLE_ITEM_CONTEXT, *PPHP_CREATE_HANDLE_ITEM_CONTEXT;
+    PVOID Object;
+    ULONG ObjectTypeIndex;
+    ULONG LastRunCount;
+
+    PPH_STRING TypeName;
+    PPH_STRING ObjectName;
+    PPH_STRING BestObjectName;
+} PHP_HANDLE_NAME_CACHE_ENTRY, *PPHP_HANDLE_NAME_CACHE_ENTRY;
+
+BOOLEAN NTAPI PhpHandleNameCacheEqualFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    );
+
+ULONG NTAPI PhpHandleNameCacheHashFunction(
+    _In_ PVOID Entry
+    );
 
 VOID NTAPI PhpHandleProviderDeleteProcedure(
     _In_ PVOID Object,
@@ -40,15 +58,42 @@ VOID NTAPI PhpHandleItemDeleteProcedure(
     _In_ ULONG Flags
     );
 
+VOID NTAPI PhpHandleSnapshotDeleteProcedure(
+    _In_ PVOID Object,
+    _In_ ULONG Flags
+    );
+
+VOID NTAPI PhpHandleStatisticsDeleteProcedure(
+    _In_ PVOID Object,
+    _In_ ULONG Flags
+    );
+
 PPH_OBJECT_TYPE PhHandleProviderType;
 PPH_OBJECT_TYPE PhHandleItemType;
+PPH_OBJECT_TYPE PhHandleSnapshotType;
+PPH_OBJECT_TYPE PhHandleStatisticsType;
+
+static PH_QUEUED_LOCK PhpHandleSnapshotLock = PH_QUEUED_LOCK_INIT;
+static PPH_HANDLE_SNAPSHOT PhpHandleSnapshot = NULL;
+static LONG PhpHandleProviderCount = 0;
+
+static PH_QUEUED_LOCK PhpHandleStatisticsLock = PH_QUEUED_LOCK_INIT;
+static PPH_HANDLE_STATISTICS PhpHandleStatistics = NULL;
+static BOOLEAN PhpHandleStatisticsEnabled = FALSE;
 
 BOOLEAN PhHandleProviderInitialization(
     VOID
     )
 {
+    PH_OBJECT_TYPE_PARAMETERS parameters;
+
     PhHandleProviderType = PhCreateObjectType(L"HandleProvider", 0, PhpHandleProviderDeleteProcedure);
-    PhHandleItemType = PhCreateObjectType(L"HandleItem", 0, PhpHandleItemDeleteProcedure);
+
+    parameters.FreeListSize = 0;
+    parameters.FreeListCount = 1024;
+    PhHandleItemType = PhCreateObjectTypeEx(L"HandleItem", PH_OBJECT_TYPE_USE_FREE_LIST, PhpHandleItemDeleteProcedure, &parameters);
+    PhHandleSnapshotType = PhCreateObjectType(L"HandleSnapshot", 0, PhpHandleSnapshotDeleteProcedure);
+    PhHandleStatisticsType = PhCreateObjectType(L"HandleStatistics", 0, PhpHandleStatisticsDeleteProcedure);
 
     return TRUE;
 }
@@ -68,6 +113,7 @@ PPH_HANDLE_PROVIDER PhCreateHandleProvider(
     handleProvider->HandleHashSet = PhCreateHashSet(handleProvider->HandleHashSetSize);
     handleProvider->HandleHashSetCount = 0;
     PhInitializeQueuedLock(&handleProvider->HandleHashSetLock);
+    PhRegisterLockStatistics(&handleProvider->HandleHashSetLock, L"HandleProvider->HandleHashSetLock");
 
     PhInitializeCallback(&handleProvider->HandleAddedEvent);
     PhInitializeCallback(&handleProvider->HandleModifiedEvent);
@@ -83,7 +129,19 @@ PPH_HANDLE_PROVIDER PhCreateHandleProvider(
         ProcessId
         );
 
-    handleProvider->TempListHashtable = PhCreateSimpleHashtable(20);
+    handleProvider->TempListHashtable = PhCreateSimpleHashtableEx(20, PH_HASHTABLE_INCREMENTAL_RESIZE);
+
+    handleProvider->RunCount = 0;
+    PhInitializeQueuedLock(&handleProvider->NameCacheLock);
+    handleProvider->NameCacheHashtable = PhCreateHashtableEx(
+        sizeof(PHP_HANDLE_NAME_CACHE_ENTRY),
+        PhpHandleNameCacheEqualFunction,
+        PhpHandleNameCacheHashFunction,
+        64,
+        PH_HASHTABLE_INCREMENTAL_RESIZE
+        );
+
+    _InterlockedIncrement(&PhpHandleProviderCount);
 
     PhEmCallObjectOperation(EmHandleProviderType, handleProvider, EmObjectCreate);
 
@@ -96,6 +154,8 @@ VOID PhpHandleProviderDeleteProcedure(
     )
 {
     PPH_HANDLE_PROVIDER handleProvider = (PPH_HANDLE_PROVIDER)Object;
+    PH_HASHTABLE_ENUM_CONTEXT enumContext;
+    PPHP_HANDLE_NAME_CACHE_ENTRY cacheEntry;
 
     PhEmCallObjectOperation(EmHandleProviderType, handleProvider, EmObjectDelete);
 
@@ -104,6 +164,7 @@ VOID PhpHandleProviderDeleteProcedure(
     PhDereferenceAllHandleItems(handleProvider);
 
     PhFree(handleProvider->HandleHashSet);
+    PhUnregisterLockStatistics(&handleProvider->HandleHashSetLock);
     PhDeleteCallback(&handleProvider->HandleAddedEvent);
     PhDeleteCallback(&handleProvider->HandleModifiedEvent);
     PhDeleteCallback(&handleProvider->HandleRemovedEvent);
@@ -111,6 +172,436 @@ VOID PhpHandleProviderDeleteProcedure(
     if (handleProvider->ProcessHandle) NtClose(handleProvider->ProcessHandle);
 
     PhDereferenceObject(handleProvider->TempListHashtable);
+
+    PhBeginEnumHashtable(handleProvider->NameCacheHashtable, &enumContext);
+
+    while (cacheEntry = PhNextEnumHashtable(&enumContext))
+    {
+        if (cacheEntry->TypeName) PhDereferenceObject(cacheEntry->TypeName);
+        if (cacheEntry->ObjectName) PhDereferenceObject(cacheEntry->ObjectName);
+        if (cacheEntry->BestObjectName) PhDereferenceObject(cacheEntry->BestObjectName);
+    }
+
+    PhDereferenceObject(handleProvider->NameCacheHashtable);
+
+    // Don't keep the system handle table in memory once nothing needs it every interval.
+    if (_InterlockedDecrement(&PhpHandleProviderCount) == 0)
+    {
+        PPH_HANDLE_SNAPSHOT snapshot;
+
+        PhAcquireQueuedLockExclusive(&PhpHandleSnapshotLock);
+        snapshot = PhpHandleSnapshot;
+        PhpHandleSnapshot = NULL;
+        PhReleaseQueuedLockExclusive(&PhpHandleSnapshotLock);
+
+        if (snapshot)
+            PhDereferenceObject(snapshot);
+    }
+}
+
+VOID PhpHandleSnapshotDeleteProcedure(
+    _In_ PVOID Object,
+    _In_ ULONG Flags
+    )
+{
+    PPH_HANDLE_SNAPSHOT snapshot = (PPH_HANDLE_SNAPSHOT)Object;
+
+    PhFree(snapshot->Information);
+    PhDereferenceObject(snapshot->ProcessTable);
+}
+
+VOID PhpHandleStatisticsDeleteProcedure(
+    _In_ PVOID Object,
+    _In_ ULONG Flags
+    )
+{
+    PPH_HANDLE_STATISTICS statistics = (PPH_HANDLE_STATISTICS)Object;
+
+    PhFree(statistics->Buffer);
+    PhDereferenceObject(statistics->ProcessTable);
+}
+
+BOOLEAN NTAPI PhpHandleNameCacheEqualFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    )
+{
+    PPHP_HANDLE_NAME_CACHE_ENTRY entry1 = Entry1;
+    PPHP_HANDLE_NAME_CACHE_ENTRY entry2 = Entry2;
+
+    return entry1->Object == entry2->Object && entry1->ObjectTypeIndex == entry2->ObjectTypeIndex;
+}
+
+ULONG NTAPI PhpHandleNameCacheHashFunction(
+    _In_ PVOID Entry
+    )
+{
+    PPHP_HANDLE_NAME_CACHE_ENTRY entry = Entry;
+
+    return PhHashIntPtr((ULONG_PTR)entry->Object) ^ entry->ObjectTypeIndex;
+}
+
+BOOLEAN NTAPI PhpHandleSnapshotProcessEqualFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    )
+{
+    return ((PPH_HANDLE_SNAPSHOT_PROCESS)Entry1)->ProcessId == ((PPH_HANDLE_SNAPSHOT_PROCESS)Entry2)->ProcessId;
+}
+
+ULONG NTAPI PhpHandleSnapshotProcessHashFunction(
+    _In_ PVOID Entry
+    )
+{
+    return PhHashIntPtr((ULONG_PTR)((PPH_HANDLE_SNAPSHOT_PROCESS)Entry)->ProcessId);
+}
+
+NTSTATUS PhpCreateHandleSnapshot(
+    _Out_ PPH_HANDLE_SNAPSHOT *Snapshot
+    )
+{
+    NTSTATUS status;
+    PSYSTEM_HANDLE_INFORMATION_EX handles;
+    PSYSTEM_HANDLE_INFORMATION_EX groupedHandles;
+    PPH_HASHTABLE processTable;
+    PH_HANDLE_SNAPSHOT_PROCESS lookupEntry;
+    PPH_HANDLE_SNAPSHOT_PROCESS entry;
+    PH_HASHTABLE_ENUM_CONTEXT enumContext;
+    PPH_HANDLE_SNAPSHOT snapshot;
+    BOOLEAN added;
+    BOOLEAN grouped;
+    ULONG numberOfHandles;
+    ULONG runStart;
+    ULONG offset;
+    ULONG i;
+
+    if (PhProviderDataSource)
+        status = PhProviderDataSource->QueryHandles(&handles);
+    else
+        status = PhEnumHandlesEx(&handles);
+
+    if (!NT_SUCCESS(status))
+        return status;
+
+    numberOfHandles = (ULONG)handles->NumberOfHandles;
+    processTable = PhCreateHashtable(
+        sizeof(PH_HANDLE_SNAPSHOT_PROCESS),
+        PhpHandleSnapshotProcessEqualFunction,
+        PhpHandleSnapshotProcessHashFunction,
+        256
+        );
+
+    // The kernel walks one handle table at a time, so the handles of each process are
+    // normally already contiguous. Count the runs, and only regroup the handles if a
+    // process appears in more than one run.
+
+    grouped = TRUE;
+    runStart = 0;
+
+    for (i = 1; i <= numberOfHandles; i++)
+    {
+        if (i != numberOfHandles && handles->Handles[i].UniqueProcessId == handles->Handles[runStart].UniqueProcessId)
+            continue;
+
+        lookupEntry.ProcessId = (HANDLE)handles->Handles[runStart].UniqueProcessId;
+        lookupEntry.Start = runStart;
+        lookupEntry.Count = 0;
+        entry = PhAddEntryHashtableEx(processTable, &lookupEntry, &added);
+
+        if (!added)
+            grouped = FALSE;
+
+        entry->Count += i - runStart;
+        runStart = i;
+    }
+
+    if (!grouped)
+    {
+        groupedHandles = PhAllocate(
+            FIELD_OFFSET(SYSTEM_HANDLE_INFORMATION_EX, Handles) +
+            sizeof(SYSTEM_HANDLE_TABLE_ENTRY_INFO_EX) * numberOfHandles
+            );
+        groupedHandles->NumberOfHandles = numberOfHandles;
+        groupedHandles->Reserved = 0;
+
+        // Give each process a range, then use Count as the fill cursor for that range.
+
+        offset = 0;
+        PhBeginEnumHashtable(processTable, &enumContext);
+
+        while (entry = PhNextEnumHashtable(&enumContext))
+        {
+            entry->Start = offset;
+            offset += entry->Count;
+            entry->Count = 0;
+        }
+
+        for (i = 0; i < numberOfHandles; i++)
+        {
+            lookupEntry.ProcessId = (HANDLE)handles->Handles[i].UniqueProcessId;
+            entry = PhFindEntryHashtable(processTable, &lookupEntry);
+            groupedHandles->Handles[entry->Start + entry->Count] = handles->Handles[i];
+            entry->Count++;
+        }
+
+        PhFree(handles);
+        handles = groupedHandles;
+    }
+
+    snapshot = PhCreateObject(sizeof(PH_HANDLE_SNAPSHOT), PhHandleSnapshotType);
+    snapshot->TickCount = NtGetTickCount64();
+    snapshot->Information = handles;
+    snapshot->ProcessTable = processTable;
+
+    *Snapshot = snapshot;
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * Gets a snapshot of the system handle table.
+ *
+ * \param Snapshot A variable which receives a pointer to the snapshot. You must
+ * dereference the snapshot using PhDereferenceObject() when you no longer need it.
+ *
+ * \remarks While a handle provider exists, the most recent snapshot is kept and
+ * returned to all callers for the rest of the update interval, so handle providers
+ * for different processes share a single enumeration of the system handle table.
+ */
+NTSTATUS PhReferenceHandleSnapshot(
+    _Out_ PPH_HANDLE_SNAPSHOT *Snapshot
+    )
+{
+    NTSTATUS status;
+    PPH_HANDLE_SNAPSHOT snapshot;
+    PPH_HANDLE_SNAPSHOT oldSnapshot = NULL;
+
+    PhAcquireQueuedLockExclusive(&PhpHandleSnapshotLock);
+
+    snapshot = PhpHandleSnapshot;
+
+    // Replayed data changes with every query, so the snapshot is never reused.
+    if (snapshot && !PhProviderDataSource && NtGetTickCount64() - snapshot->TickCount < PhCsUpdateInterval / 2)
+    {
+        PhReferenceObject(snapshot);
+        status = STATUS_SUCCESS;
+    }
+    else
+    {
+        // Other callers wait on the lock so that they can use the new snapshot instead
+        // of taking their own.
+        if (NT_SUCCESS(status = PhpCreateHandleSnapshot(&snapshot)))
+        {
+            oldSnapshot = PhpHandleSnapshot;
+
+            if (PhpHandleProviderCount != 0 || PhpHandleStatisticsEnabled)
+            {
+                PhReferenceObject(snapshot);
+                PhpHandleSnapshot = snapshot;
+            }
+            else
+            {
+                PhpHandleSnapshot = NULL;
+            }
+        }
+    }
+
+    PhReleaseQueuedLockExclusive(&PhpHandleSnapshotLock);
+
+    if (oldSnapshot)
+        PhDereferenceObject(oldSnapshot);
+
+    if (NT_SUCCESS(status))
+        *Snapshot = snapshot;
+
+    return status;
+}
+
+/**
+ * Gets the handles of a process from a handle snapshot.
+ *
+ * \param Snapshot A handle snapshot.
+ * \param ProcessId The ID of the process.
+ * \param NumberOfHandles A variable which receives the number of handles.
+ *
+ * \return A pointer to the handles of the process, or NULL if the process has no
+ * handles in the snapshot. The handles are valid until the snapshot is dereferenced.
+ */
+PSYSTEM_HANDLE_TABLE_ENTRY_INFO_EX PhGetProcessHandlesHandleSnapshot(
+    _In_ PPH_HANDLE_SNAPSHOT Snapshot,
+    _In_ HANDLE ProcessId,
+    _Out_ PULONG NumberOfHandles
+    )
+{
+    PH_HANDLE_SNAPSHOT_PROCESS lookupEntry;
+    PPH_HANDLE_SNAPSHOT_PROCESS entry;
+
+    lookupEntry.ProcessId = ProcessId;
+    entry = PhFindEntryHashtable(Snapshot->ProcessTable, &lookupEntry);
+
+    if (!entry)
+    {
+        *NumberOfHandles = 0;
+        return NULL;
+    }
+
+    *NumberOfHandles = entry->Count;
+
+    return &Snapshot->Information->Handles[entry->Start];
+}
+
+static PPH_HANDLE_STATISTICS PhpCreateHandleStatistics(
+    _In_ PPH_HANDLE_SNAPSHOT Snapshot
+    )
+{
+    PPH_HANDLE_STATISTICS statistics;
+    PSYSTEM_HANDLE_INFORMATION_EX handles = Snapshot->Information;
+    ULONG systemCounts[MAX_OBJECT_TYPE_NUMBER];
+    ULONG numberOfTypes;
+    ULONG i;
+    ULONG j;
+    PH_HASHTABLE_ENUM_CONTEXT enumContext;
+    PPH_HANDLE_SNAPSHOT_PROCESS entry;
+    PULONG counts;
+
+    memset(systemCounts, 0, sizeof(systemCounts));
+    numberOfTypes = 0;
+
+    for (i = 0; i < (ULONG)handles->NumberOfHandles; i++)
+    {
+        ULONG typeIndex = handles->Handles[i].ObjectTypeIndex;
+
+        if (typeIndex >= MAX_OBJECT_TYPE_NUMBER)
+            continue;
+
+        systemCounts[typeIndex]++;
+
+        if (numberOfTypes < typeIndex + 1)
+            numberOfTypes = typeIndex + 1;
+    }
+
+    statistics = PhCreateObject(sizeof(PH_HANDLE_STATISTICS), PhHandleStatisticsType);
+    statistics->NumberOfTypes = numberOfTypes;
+    statistics->ProcessTable = PhCreateSimpleHashtable(Snapshot->ProcessTable->Count);
+
+    // The system counts come first, followed by the counts of each process.
+    statistics->Buffer = PhAllocate(sizeof(ULONG) * max(numberOfTypes, 1) * (Snapshot->ProcessTable->Count + 1));
+    statistics->SystemCounts = statistics->Buffer;
+    memcpy(statistics->SystemCounts, systemCounts, sizeof(ULONG) * numberOfTypes);
+
+    counts = statistics->Buffer + numberOfTypes;
+    PhBeginEnumHashtable(Snapshot->ProcessTable, &enumContext);
+
+    // The handles of each process are next to each other in the snapshot, so each process
+    // only needs to look at its own range.
+    while (entry = PhNextEnumHashtable(&enumContext))
+    {
+        memset(counts, 0, sizeof(ULONG) * numberOfTypes);
+
+        for (j = entry->Start; j < entry->Start + entry->Count; j++)
+        {
+            ULONG typeIndex = handles->Handles[j].ObjectTypeIndex;
+
+            if (typeIndex < numberOfTypes)
+                counts[typeIndex]++;
+        }
+
+        PhAddItemSimpleHashtable(statistics->ProcessTable, entry->ProcessId, counts);
+        counts += numberOfTypes;
+    }
+
+    return statistics;
+}
+
+/**
+ * Enables or disables the collection of handle statistics.
+ *
+ * \param Enabled TRUE to collect handle statistics on every process provider update,
+ * FALSE to stop collecting them and free the current statistics.
+ */
+VOID PhSetEnabledHandleStatistics(
+    _In_ BOOLEAN Enabled
+    )
+{
+    PhpHandleStatisticsEnabled = Enabled;
+}
+
+/**
+ * Updates the handle statistics from the shared handle snapshot.
+ *
+ * \remarks This function is called by the process provider. If handle statistics
+ * are not enabled, the current statistics are freed.
+ */
+VOID PhUpdateHandleStatistics(
+    VOID
+    )
+{
+    PPH_HANDLE_SNAPSHOT snapshot;
+    PPH_HANDLE_STATISTICS statistics = NULL;
+    PPH_HANDLE_STATISTICS oldStatistics;
+
+    if (PhpHandleStatisticsEnabled)
+    {
+        if (NT_SUCCESS(PhReferenceHandleSnapshot(&snapshot)))
+        {
+            statistics = PhpCreateHandleStatistics(snapshot);
+            PhDereferenceObject(snapshot);
+        }
+    }
+    else if (!PhpHandleStatistics)
+    {
+        return;
+    }
+
+    PhAcquireQueuedLockExclusive(&PhpHandleStatisticsLock);
+    oldStatistics = PhpHandleStatistics;
+    PhpHandleStatistics = statistics;
+    PhReleaseQueuedLockExclusive(&PhpHandleStatisticsLock);
+
+    if (oldStatistics)
+        PhDereferenceObject(oldStatistics);
+}
+
+/**
+ * Gets the most recent handle statistics.
+ *
+ * \return A pointer to the statistics, or NULL if handle statistics are not enabled or
+ * have not been collected yet. You must dereference the statistics using
+ * PhDereferenceObject() when you no longer need them.
+ */
+PPH_HANDLE_STATISTICS PhReferenceHandleStatistics(
+    VOID
+    )
+{
+    PPH_HANDLE_STATISTICS statistics;
+
+    PhAcquireQueuedLockShared(&PhpHandleStatisticsLock);
+
+    statistics = PhpHandleStatistics;
+
+    if (statistics)
+        PhReferenceObject(statistics);
+
+    PhReleaseQueuedLockShared(&PhpHandleStatisticsLock);
+
+    return statistics;
+}
+
+/**
+ * Gets the handle counts of a process from handle statistics.
+ *
+ * \param Statistics Handle statistics.
+ * \param ProcessId The ID of the process.
+ *
+ * \return An array of \a Statistics->NumberOfTypes handle counts indexed by object
+ * type index, or NULL if the process has no handles.
+ */
+PULONG PhGetProcessCountsHandleStatistics(
+    _In_ PPH_HANDLE_STATISTICS Statistics,
+    _In_ HANDLE ProcessId
+    )
+{
+    return PhFindItemSimpleHashtable2(Statistics->ProcessTable, ProcessId);
 }
 
 PPH_HANDLE_ITEM PhCreateHandleItem(
@@ -134,6 +625,7 @@ PPH_HANDLE_ITEM PhCreateHandleItem(
         handleItem->Attributes = Handle->HandleAttributes;
         handleItem->GrantedAccess = (ACCESS_MASK)Handle->GrantedAccess;
         PhPrintPointer(handleItem->GrantedAccessString, UlongToPtr(handleItem->GrantedAccess));
+        handleItem->ObjectTypeIndex = Handle->ObjectTypeIndex;
     }
 
     PhEmCallObjectOperation(EmHandleItemType, handleItem, EmObjectCreate);
@@ -301,7 +793,7 @@ NTSTATUS PhEnumHandlesGeneric(
     // * Otherwise, NtQuerySystemInformation with SystemHandleInformation
     //   can be used.
 
-    if (KphIsConnected())
+    if (KphIsConnected() && !PhProviderDataSource)
     {
         PKPH_PROCESS_HANDLE_INFORMATION handles;
         PSYSTEM_HANDLE_INFORMATION_EX convertedHandles;
@@ -341,16 +833,33 @@ NTSTATUS PhEnumHandlesGeneric(
 
     if (WindowsVersion >= WINDOWS_XP)
     {
+        PPH_HANDLE_SNAPSHOT snapshot;
+        PSYSTEM_HANDLE_TABLE_ENTRY_INFO_EX processHandles;
         PSYSTEM_HANDLE_INFORMATION_EX handles;
+        ULONG numberOfHandles;
 
-        // Enumerate handles using the new method; no conversion
-        // necessary.
+        // Use the shared snapshot of the system handle table and copy out the
+        // handles of this process.
 
-        if (!NT_SUCCESS(status = PhEnumHandlesEx(&handles)))
+        if (!NT_SUCCESS(status = PhReferenceHandleSnapshot(&snapshot)))
             return status;
 
+        processHandles = PhGetProcessHandlesHandleSnapshot(snapshot, ProcessId, &numberOfHandles);
+
+        handles = PhAllocate(
+            FIELD_OFFSET(SYSTEM_HANDLE_INFORMATION_EX, Handles) +
+            sizeof(SYSTEM_HANDLE_TABLE_ENTRY_INFO_EX) * numberOfHandles
+            );
+        handles->NumberOfHandles = numberOfHandles;
+        handles->Reserved = 0;
+
+        if (numberOfHandles != 0)
+            memcpy(handles->Handles, processHandles, sizeof(SYSTEM_HANDLE_TABLE_ENTRY_INFO_EX) * numberOfHandles);
+
+        PhDereferenceObject(snapshot);
+
         *Handles = handles;
-        *FilterNeeded = TRUE;
+        *FilterNeeded = FALSE;
     }
     else
     {
@@ -411,46 +920,165 @@ NTSTATUS PhEnumHandlesGeneric(
     return STATUS_SUCCESS;
 }
 
-NTSTATUS PhpCreateHandleItemFunction(
-    _In_ PVOID Parameter
+VOID PhpUpdateHandleNameCache(
+    _In_ PPH_HANDLE_PROVIDER HandleProvider,
+    _In_ PPH_HANDLE_ITEM HandleItem
     )
 {
-    PPHP_CREATE_HANDLE_ITEM_CONTEXT context = Parameter;
-    PPH_HANDLE_ITEM handleItem;
+    PHP_HANDLE_NAME_CACHE_ENTRY lookupEntry;
+    PPHP_HANDLE_NAME_CACHE_ENTRY entry;
+    BOOLEAN added;
+
+    if (!HandleItem->Object || !HandleItem->TypeName)
+        return;
+
+    lookupEntry.Object = HandleItem->Object;
+    lookupEntry.ObjectTypeIndex = HandleItem->ObjectTypeIndex;
+
+    PhAcquireQueuedLockExclusive(&HandleProvider->NameCacheLock);
+
+    entry = PhAddEntryHashtableEx(HandleProvider->NameCacheHashtable, &lookupEntry, &added);
+
+    if (added)
+    {
+        PhSetReference(&entry->TypeName, HandleItem->TypeName);
+        PhSetReference(&entry->ObjectName, HandleItem->ObjectName);
+        PhSetReference(&entry->BestObjectName, HandleItem->BestObjectName);
+    }
+
+    entry->LastRunCount = HandleProvider->RunCount;
+
+    PhReleaseQueuedLockExclusive(&HandleProvider->NameCacheLock);
+}
+
+VOID PhpPruneHandleNameCache(
+    _In_ PPH_HANDLE_PROVIDER HandleProvider
+    )
+{
+    PH_HASHTABLE_ENUM_CONTEXT enumContext;
+    PPHP_HANDLE_NAME_CACHE_ENTRY entry;
+    PPH_LIST entriesToRemove = NULL;
+    ULONG i;
 
-    handleItem = PhCreateHandleItem(context->Handle);
+    PhBeginEnumHashtable(HandleProvider->NameCacheHashtable, &enumContext);
+
+    while (entry = PhNextEnumHashtable(&enumContext))
+    {
+        if (HandleProvider->RunCount - entry->LastRunCount > PH_HANDLE_NAME_CACHE_EXPIRY)
+        {
+            if (!entriesToRemove)
+                entriesToRemove = PhCreateList(32);
+
+            PhAddItemList(entriesToRemove, entry);
+        }
+    }
+
+    if (!entriesToRemove)
+        return;
+
+    PhAcquireQueuedLockExclusive(&HandleProvider->NameCacheLock);
+
+    for (i = 0; i < entriesToRemove->Count; i++)
+    {
+        entry = entriesToRemove->Items[i];
+
+        if (entry->TypeName) PhDereferenceObject(entry->TypeName);
+        if (entry->ObjectName) PhDereferenceObject(entry->ObjectName);
+        if (entry->BestObjectName) PhDereferenceObject(entry->BestObjectName);
+        PhRemoveEntryHashtable(HandleProvider->NameCacheHashtable, entry);
+    }
+
+    PhReleaseQueuedLockExclusive(&HandleProvider->NameCacheLock);
+
+    PhDereferenceObject(entriesToRemove);
+}
+
+BOOLEAN PhpLookupHandleNameCache(
+    _In_ PPH_HANDLE_PROVIDER HandleProvider,
+    _Inout_ PPH_HANDLE_ITEM HandleItem
+    )
+{
+    PHP_HANDLE_NAME_CACHE_ENTRY lookupEntry;
+    PPHP_HANDLE_NAME_CACHE_ENTRY entry;
+
+    // A handle that was re-opened to an object we have already seen gets the cached
+    // names, which saves duplicating the handle and querying the object again. As with
+    // the closed handle check, this relies on object addresses not being reused for a
+    // while.
+
+    if (!HandleItem->Object)
+        return FALSE;
+
+    lookupEntry.Object = HandleItem->Object;
+    lookupEntry.ObjectTypeIndex = HandleItem->ObjectTypeIndex;
+
+    PhAcquireQueuedLockExclusive(&HandleProvider->NameCacheLock);
+
+    if (entry = PhFindEntryHashtable(HandleProvider->NameCacheHashtable, &lookupEntry))
+    {
+        PhSetReference(&HandleItem->TypeName, entry->TypeName);
+        PhSetReference(&HandleItem->ObjectName, entry->ObjectName);
+        PhSetReference(&HandleItem->BestObjectName, entry->BestObjectName);
+        entry->LastRunCount = HandleProvider->RunCount;
+    }
+
+    PhReleaseQueuedLockExclusive(&HandleProvider->NameCacheLock);
+
+    return !!entry;
+}
+
+VOID PhpQueryHandleItemNames(
+    _In_ PPH_HANDLE_PROVIDER HandleProvider,
+    _Inout_ PPH_HANDLE_ITEM HandleItem
+    )
+{
+    if (PhpLookupHandleNameCache(HandleProvider, HandleItem))
+        return;
 
     PhGetHandleInformationEx(
-        context->Provider->ProcessHandle,
-        handleItem->Handle,
-        context->Handle->ObjectTypeIndex,
+        HandleProvider->ProcessHandle,
+        HandleItem->Handle,
+        HandleItem->ObjectTypeIndex,
         0,
         NULL,
         NULL,
-        &handleItem->TypeName,
-        &handleItem->ObjectName,
-        &handleItem->BestObjectName,
+        &HandleItem->TypeName,
+        &HandleItem->ObjectName,
+        &HandleItem->BestObjectName,
         NULL
         );
 
+    PhpUpdateHandleNameCache(HandleProvider, HandleItem);
+}
+
+VOID NTAPI PhpHandleNameQueryCallback(
+    _Inout_ PPH_HANDLE_NAME_QUERY Query,
+    _In_opt_ PVOID Context
+    )
+{
+    PPH_HANDLE_PROVIDER handleProvider = Context;
+    PPH_HANDLE_ITEM handleItem = Query->Context;
+
+    handleItem->TypeName = Query->TypeName;
+    handleItem->ObjectName = Query->ObjectName;
+    handleItem->BestObjectName = Query->BestObjectName;
+
     if (handleItem->TypeName)
     {
+        PhpUpdateHandleNameCache(handleProvider, handleItem);
+
         // Add the handle item to the hashtable.
-        PhAcquireQueuedLockExclusive(&context->Provider->HandleHashSetLock);
-        PhpAddHandleItem(context->Provider, handleItem);
-        PhReleaseQueuedLockExclusive(&context->Provider->HandleHashSetLock);
+        PhAcquireQueuedLockExclusive(&handleProvider->HandleHashSetLock);
+        PhpAddHandleItem(handleProvider, handleItem);
+        PhReleaseQueuedLockExclusive(&handleProvider->HandleHashSetLock);
 
         // Raise the handle added event.
-        PhInvokeCallback(&context->Provider->HandleAddedEvent, handleItem);
+        PhInvokeCallback(&handleProvider->HandleAddedEvent, handleItem);
     }
     else
     {
         PhDereferenceObject(handleItem);
     }
-
-    PhFree(context);
-
-    return STATUS_SUCCESS;
 }
 
 VOID PhHandleProviderUpdate(
@@ -468,8 +1096,10 @@ VOID PhHandleProviderUpdate(
     ULONG i;
     PH_HASHTABLE_ENUM_CONTEXT enumContext;
     PPH_KEY_VALUE_PAIR handlePair;
-    BOOLEAN useWorkQueue = FALSE;
-    PH_WORK_QUEUE workQueue;
+    BOOLEAN useNameQueries = FALSE;
+    PPH_HANDLE_NAME_QUERY nameQueries = NULL;
+    ULONG numberOfNameQueries = 0;
+    ULONG allocatedNameQueries = 0;
 
     if (!handleProvider->ProcessHandle)
         goto UpdateExit;
@@ -482,10 +1112,11 @@ VOID PhHandleProviderUpdate(
         )))
         goto UpdateExit;
 
+    handleProvider->RunCount++;
+
     if (!KphIsConnected() && WindowsVersion >= WINDOWS_VISTA)
     {
-        useWorkQueue = TRUE;
-        PhInitializeWorkQueue(&workQueue, 1, 20, 1000);
+        useNameQueries = TRUE;
 
         if (PhBeginInitOnce(&initOnce))
         {
@@ -570,6 +1201,9 @@ VOID PhHandleProviderUpdate(
                     // Raise the handle removed event.
                     PhInvokeCallback(&handleProvider->HandleRemovedEvent, handleItem);
 
+                    // Remember the names in case the object is opened again.
+                    PhpUpdateHandleNameCache(handleProvider, handleItem);
+
                     if (!handlesToRemove)
                         handlesToRemove = PhCreateList(2);
 
@@ -608,33 +1242,32 @@ VOID PhHandleProviderUpdate(
 
         if (!handleItem)
         {
-            // When we don't have KPH, query handle information in parallel to take full advantage of the
-            // PhCallWithTimeout functionality.
-            if (useWorkQueue && handle->ObjectTypeIndex == fileObjectTypeIndex)
+            handleItem = PhCreateHandleItem(handle);
+
+            // When we don't have KPH, file names can hang, so they are queried together
+            // once the other handles have been processed.
+            if (useNameQueries && handle->ObjectTypeIndex == fileObjectTypeIndex &&
+                !PhpLookupHandleNameCache(handleProvider, handleItem))
             {
-                PPHP_CREATE_HANDLE_ITEM_CONTEXT context;
+                if (numberOfNameQueries == allocatedNameQueries)
+                {
+                    allocatedNameQueries = allocatedNameQueries ? allocatedNameQueries * 2 : 16;
+
+                    if (nameQueries)
+                        nameQueries = PhReAllocate(nameQueries, sizeof(PH_HANDLE_NAME_QUERY) * allocatedNameQueries);
+                    else
+                        nameQueries = PhAllocate(sizeof(PH_HANDLE_NAME_QUERY) * allocatedNameQueries);
+                }
 
-                context = PhAllocate(sizeof(PHP_CREATE_HANDLE_ITEM_CONTEXT));
-                context->Provider = handleProvider;
-                context->Handle = handle;
-                PhQueueItemWorkQueue(&workQueue, PhpCreateHandleItemFunction, context);
+                nameQueries[numberOfNameQueries].Handle = handleItem->Handle;
+                nameQueries[numberOfNameQueries].ObjectTypeNumber = handleItem->ObjectTypeIndex;
+                nameQueries[numberOfNameQueries].Context = handleItem;
+                numberOfNameQueries++;
                 continue;
             }
 
-            handleItem = PhCreateHandleItem(handle);
-
-            PhGetHandleInformationEx(
-                handleProvider->ProcessHandle,
-                handleItem->Handle,
-                handle->ObjectTypeIndex,
-                0,
-                NULL,
-                NULL,
-                &handleItem->TypeName,
-                &handleItem->ObjectName,
-                &handleItem->BestObjectName,
-                NULL
-                );
+            if (!handleItem->TypeName)
+                PhpQueryHandleItemNames(handleProvider, handleItem);
 
             // We need at least a type name to continue.
             if (!handleItem->TypeName)
@@ -691,19 +1324,31 @@ VOID PhHandleProviderUpdate(
         }
     }
 
-    if (useWorkQueue)
+    // The names are queried in parallel, and each item is added as soon as its query
+    // completes.
+    if (nameQueries)
     {
-        PhWaitForWorkQueue(&workQueue);
-        PhDeleteWorkQueue(&workQueue);
+        PhQueryHandleNamesWithTimeout(
+            handleProvider->ProcessHandle,
+            nameQueries,
+            numberOfNameQueries,
+            0,
+            PhpHandleNameQueryCallback,
+            handleProvider
+            );
+        PhFree(nameQueries);
     }
 
     PhFree(handleInfo);
 
+    if (handleProvider->RunCount % PH_HANDLE_NAME_CACHE_PRUNE_INTERVAL == 0)
+        PhpPruneHandleNameCache(handleProvider);
+
     // Re-create the temporary hashtable if it got too big.
     if (handleProvider->TempListHashtable->AllocatedEntries > 8192)
     {
         PhDereferenceObject(handleProvider->TempListHashtable);
-        handleProvider->TempListHashtable = PhCreateSimpleHashtable(512);
+        handleProvider->TempListHashtable = PhCreateSimpleHashtableEx(512, PH_HASHTABLE_INCREMENTAL_RESIZE);
     }
     else
     {
@@ -0,0 +1,520 @@
+/*
+ * Process Hacker -
+ *   image metadata cache
+ *
+ * Copyright (C) 2016 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The same images (ntdll, kernel32, svchost, ...) are loaded by most processes, and
+ * the process and module providers would otherwise parse their version resources
+ * once per process. This cache shares the parsed metadata between all providers.
+ *
+ * Entries are keyed by file name and are only reused while the file's ID, last write
+ * time and size (see PhQueryFileCacheKey) are unchanged. The first thread to ask for
+ * a file queries it; other threads asking for the same file at the same time wait for
+ * that result instead of querying the file themselves.
+ *
+ * Icons are cached on the same entries. They are stored in separate reference-counted
+ * objects so that every process running the same image can draw the same HICONs, and
+ * so that trimming an entry doesn't destroy icons that are still in use.
+ *
+ * Besides the fixed entry limit, the cache is registered with the memory budget manager,
+ * which evicts the least recently used entries when the process is over its budget.
+ */
+
+#include <phapp.h>
+
+#define PH_IMAGE_CACHE_MAXIMUM_ENTRIES 1024
+
+typedef struct _PH_IMAGE_CACHE_ENTRY
+{
+    PPH_STRING FileName;
+    PH_FILE_CACHE_KEY Key;
+    PH_EVENT ReadyEvent;
+    ULONG LastUseTime;
+
+    BOOLEAN HaveVersionInfo;
+    PH_IMAGE_VERSION_INFO VersionInfo;
+
+    PPH_IMAGE_ICONS Icons; // protected by PhpImageCacheLock
+} PH_IMAGE_CACHE_ENTRY, *PPH_IMAGE_CACHE_ENTRY;
+
+VOID NTAPI PhpImageCacheEntryDeleteProcedure(
+    _In_ PVOID Object,
+    _In_ ULONG Flags
+    );
+
+BOOLEAN NTAPI PhpImageCacheHashtableCompareFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    );
+
+ULONG NTAPI PhpImageCacheHashtableHashFunction(
+    _In_ PVOID Entry
+    );
+
+VOID NTAPI PhpImageIconsDeleteProcedure(
+    _In_ PVOID Object,
+    _In_ ULONG Flags
+    );
+
+PPH_OBJECT_TYPE PhImageCacheEntryType;
+PPH_OBJECT_TYPE PhImageIconsType;
+
+static PPH_HASHTABLE PhpImageCacheHashtable;
+static PH_QUEUED_LOCK PhpImageCacheLock = PH_QUEUED_LOCK_INIT;
+static PH_MEMORY_BUDGET_CLIENT PhpImageCacheBudgetClient;
+
+static SIZE_T NTAPI PhpImageCacheQuerySize(
+    _In_opt_ PVOID Context
+    );
+
+static SIZE_T NTAPI PhpImageCacheTrim(
+    _In_ SIZE_T BytesToFree,
+    _In_opt_ PVOID Context
+    );
+
+BOOLEAN PhImageCacheInitialization(
+    VOID
+    )
+{
+    PhImageCacheEntryType = PhCreateObjectType(L"ImageCacheEntry", 0, PhpImageCacheEntryDeleteProcedure);
+    PhImageIconsType = PhCreateObjectType(L"ImageIcons", 0, PhpImageIconsDeleteProcedure);
+    PhpImageCacheHashtable = PhCreateHashtable(
+        sizeof(PPH_IMAGE_CACHE_ENTRY),
+        PhpImageCacheHashtableCompareFunction,
+        PhpImageCacheHashtableHashFunction,
+        64
+        );
+    PhRegisterMemoryBudgetClient(
+        &PhpImageCacheBudgetClient,
+        L"Image cache",
+        PhpImageCacheQuerySize,
+        PhpImageCacheTrim,
+        NULL
+        );
+
+    return TRUE;
+}
+
+VOID NTAPI PhpImageCacheEntryDeleteProcedure(
+    _In_ PVOID Object,
+    _In_ ULONG Flags
+    )
+{
+    PPH_IMAGE_CACHE_ENTRY entry = (PPH_IMAGE_CACHE_ENTRY)Object;
+
+    PhDereferenceObject(entry->FileName);
+
+    if (entry->HaveVersionInfo)
+        PhDeleteImageVersionInfo(&entry->VersionInfo);
+
+    if (entry->Icons)
+        PhDereferenceObject(entry->Icons);
+}
+
+VOID NTAPI PhpImageIconsDeleteProcedure(
+    _In_ PVOID Object,
+    _In_ ULONG Flags
+    )
+{
+    PPH_IMAGE_ICONS icons = (PPH_IMAGE_ICONS)Object;
+
+    DestroyIcon(icons->SmallIcon);
+    DestroyIcon(icons->LargeIcon);
+}
+
+BOOLEAN NTAPI PhpImageCacheHashtableCompareFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    )
+{
+    return PhEqualString(
+        (*(PPH_IMAGE_CACHE_ENTRY *)Entry1)->FileName,
+        (*(PPH_IMAGE_CACHE_ENTRY *)Entry2)->FileName,
+        TRUE
+        );
+}
+
+ULONG NTAPI PhpImageCacheHashtableHashFunction(
+    _In_ PVOID Entry
+    )
+{
+    return PhHashStringRef(&(*(PPH_IMAGE_CACHE_ENTRY *)Entry)->FileName->sr, TRUE);
+}
+
+static SIZE_T PhpGetImageCacheEntrySize(
+    _In_ PPH_IMAGE_CACHE_ENTRY Entry
+    )
+{
+    SIZE_T size;
+
+    size = sizeof(PH_IMAGE_CACHE_ENTRY) + Entry->FileName->Length;
+
+    // The version info is only valid once the entry is ready.
+    if (PhTestEvent(&Entry->ReadyEvent) && Entry->HaveVersionInfo)
+    {
+        if (Entry->VersionInfo.CompanyName)
+            size += Entry->VersionInfo.CompanyName->Length;
+        if (Entry->VersionInfo.FileDescription)
+            size += Entry->VersionInfo.FileDescription->Length;
+        if (Entry->VersionInfo.FileVersion)
+            size += Entry->VersionInfo.FileVersion->Length;
+        if (Entry->VersionInfo.ProductName)
+            size += Entry->VersionInfo.ProductName->Length;
+    }
+
+    if (Entry->Icons)
+        size += sizeof(PH_IMAGE_ICONS);
+
+    return size;
+}
+
+/**
+ * Removes the least recently used entry from the image cache.
+ *
+ * \return The approximate number of bytes used by the entry, or 0 if no entry could be
+ * removed.
+ */
+static SIZE_T PhpTrimImageCache(
+    VOID
+    )
+{
+    SIZE_T size;
+    ULONG enumerationKey = 0;
+    PPH_IMAGE_CACHE_ENTRY *entry;
+    PPH_IMAGE_CACHE_ENTRY oldestEntry = NULL;
+    ULONG currentTime = NtGetTickCount();
+
+    // Remove the least recently used entry. Entries still being queried are skipped.
+    while (PhEnumHashtable(PhpImageCacheHashtable, &entry, &enumerationKey))
+    {
+        if (!PhTestEvent(&(*entry)->ReadyEvent))
+            continue;
+
+        if (!oldestEntry || currentTime - (*entry)->LastUseTime > currentTime - oldestEntry->LastUseTime)
+            oldestEntry = *entry;
+    }
+
+    if (!oldestEntry)
+        return 0;
+
+    size = PhpGetImageCacheEntrySize(oldestEntry);
+    PhRemoveEntryHashtable(PhpImageCacheHashtable, &oldestEntry);
+    PhDereferenceObject(oldestEntry);
+
+    return size;
+}
+
+static SIZE_T NTAPI PhpImageCacheQuerySize(
+    _In_opt_ PVOID Context
+    )
+{
+    ULONG enumerationKey = 0;
+    PPH_IMAGE_CACHE_ENTRY *entry;
+    SIZE_T size = 0;
+
+    PhAcquireQueuedLockExclusive(&PhpImageCacheLock);
+
+    while (PhEnumHashtable(PhpImageCacheHashtable, &entry, &enumerationKey))
+        size += PhpGetImageCacheEntrySize(*entry);
+
+    PhReleaseQueuedLockExclusive(&PhpImageCacheLock);
+
+    return size;
+}
+
+static SIZE_T NTAPI PhpImageCacheTrim(
+    _In_ SIZE_T BytesToFree,
+    _In_opt_ PVOID Context
+    )
+{
+    SIZE_T bytesFreed = 0;
+    SIZE_T size;
+
+    PhAcquireQueuedLockExclusive(&PhpImageCacheLock);
+
+    while (bytesFreed < BytesToFree && (size = PhpTrimImageCache()) != 0)
+        bytesFreed += size;
+
+    PhReleaseQueuedLockExclusive(&PhpImageCacheLock);
+
+    return bytesFreed;
+}
+
+static VOID PhpCopyImageVersionInfo(
+    _Out_ PPH_IMAGE_VERSION_INFO Destination,
+    _In_ PPH_IMAGE_VERSION_INFO Source
+    )
+{
+    PhSetReference(&Destination->CompanyName, Source->CompanyName);
+    PhSetReference(&Destination->FileDescription, Source->FileDescription);
+    PhSetReference(&Destination->FileVersion, Source->FileVersion);
+    PhSetReference(&Destination->ProductName, Source->ProductName);
+}
+
+/**
+ * Gets version information for an image, using a cached result if possible.
+ *
+ * \param ImageVersionInfo A variable which receives the version information.
+ * Use PhDeleteImageVersionInfo() to free it when you no longer need it.
+ * \param FileName The Win32 file name of the image.
+ *
+ * \return TRUE if version information was found, otherwise FALSE.
+ */
+BOOLEAN PhInitializeImageVersionInfoCached(
+    _Out_ PPH_IMAGE_VERSION_INFO ImageVersionInfo,
+    _In_ PPH_STRING FileName
+    )
+{
+    PH_FILE_CACHE_KEY key;
+    PH_IMAGE_CACHE_ENTRY lookupEntry;
+    PPH_IMAGE_CACHE_ENTRY lookupEntryPtr = &lookupEntry;
+    PPH_IMAGE_CACHE_ENTRY *entryPtr;
+    PPH_IMAGE_CACHE_ENTRY entry = NULL;
+    BOOLEAN owner = FALSE;
+    BOOLEAN result;
+
+    memset(ImageVersionInfo, 0, sizeof(PH_IMAGE_VERSION_INFO));
+
+    // Without a key we have no way of telling whether a cached result is still
+    // valid.
+    if (!NT_SUCCESS(PhQueryFileCacheKey(FileName, &key)))
+        return PhInitializeImageVersionInfo(ImageVersionInfo, FileName->Buffer);
+
+    lookupEntry.FileName = FileName;
+
+    PhAcquireQueuedLockExclusive(&PhpImageCacheLock);
+
+    entryPtr = PhFindEntryHashtable(PhpImageCacheHashtable, &lookupEntryPtr);
+
+    if (entryPtr)
+    {
+        entry = *entryPtr;
+
+        if (!RtlEqualMemory(&entry->Key, &key, sizeof(PH_FILE_CACHE_KEY)))
+        {
+            if (PhTestEvent(&entry->ReadyEvent))
+            {
+                // The file has changed. Replace the stale entry.
+                PhRemoveEntryHashtable(PhpImageCacheHashtable, &entry);
+                PhDereferenceObject(entry);
+            }
+            else
+            {
+                // The file changed while someone else is still querying it. Don't wait
+                // for a result we can't use.
+                PhReleaseQueuedLockExclusive(&PhpImageCacheLock);
+                return PhInitializeImageVersionInfo(ImageVersionInfo, FileName->Buffer);
+            }
+
+            entry = NULL;
+        }
+    }
+
+    if (!entry)
+    {
+        if (PhpImageCacheHashtable->Count >= PH_IMAGE_CACHE_MAXIMUM_ENTRIES)
+            PhpTrimImageCache();
+
+        entry = PhCreateObject(sizeof(PH_IMAGE_CACHE_ENTRY), PhImageCacheEntryType);
+        entry->FileName = FileName;
+        PhReferenceObject(FileName);
+        entry->Key = key;
+        PhInitializeEvent(&entry->ReadyEvent);
+        entry->HaveVersionInfo = FALSE;
+
+        PhAddEntryHashtable(PhpImageCacheHashtable, &entry);
+        owner = TRUE;
+    }
+
+    PhReferenceObject(entry);
+    entry->LastUseTime = NtGetTickCount();
+
+    PhReleaseQueuedLockExclusive(&PhpImageCacheLock);
+
+    if (owner)
+    {
+        entry->HaveVersionInfo = PhInitializeImageVersionInfo(&entry->VersionInfo, FileName->Buffer);
+        PhSetEvent(&entry->ReadyEvent);
+    }
+    else
+    {
+        PhWaitForEvent(&entry->ReadyEvent, NULL);
+    }
+
+    // The entry is never modified once its event is set.
+    if (result = entry->HaveVersionInfo)
+        PhpCopyImageVersionInfo(ImageVersionInfo, &entry->VersionInfo);
+
+    PhDereferenceObject(entry);
+
+    return result;
+}
+
+static PPH_IMAGE_ICONS PhpCreateImageIcons(
+    _In_ PPH_STRING FileName
+    )
+{
+    HICON smallIcon = NULL;
+    HICON largeIcon = NULL;
+    PPH_IMAGE_ICONS icons;
+
+    if (ExtractIconEx(FileName->Buffer, 0, &largeIcon, &smallIcon, 1) == 0)
+        return NULL;
+
+    // We only deal with images that have both sizes.
+    if (!smallIcon || !largeIcon)
+    {
+        if (smallIcon) DestroyIcon(smallIcon);
+        if (largeIcon) DestroyIcon(largeIcon);
+
+        return NULL;
+    }
+
+    icons = PhCreateObject(sizeof(PH_IMAGE_ICONS), PhImageIconsType);
+    icons->SmallIcon = smallIcon;
+    icons->LargeIcon = largeIcon;
+
+    return icons;
+}
+
+/**
+ * Gets the icons of an image, using a cached result if possible.
+ *
+ * \param FileName The Win32 file name of the image.
+ *
+ * \return The icons of the image, or NULL if the image does not have both a small and a
+ * large icon. You must dereference the object when you no longer need it. The icons
+ * are shared and must not be destroyed.
+ *
+ * \remarks Icons are only cached for images which already have a cache entry (see
+ * PhInitializeImageVersionInfoCached()).
+ */
+PPH_IMAGE_ICONS PhReferenceImageIconsCached(
+    _In_ PPH_STRING FileName
+    )
+{
+    PH_FILE_CACHE_KEY key;
+    PH_IMAGE_CACHE_ENTRY lookupEntry;
+    PPH_IMAGE_CACHE_ENTRY lookupEntryPtr = &lookupEntry;
+    PPH_IMAGE_CACHE_ENTRY *entryPtr;
+    PPH_IMAGE_CACHE_ENTRY entry;
+    PPH_IMAGE_ICONS icons = NULL;
+    PPH_IMAGE_ICONS newIcons;
+
+    if (!NT_SUCCESS(PhQueryFileCacheKey(FileName, &key)))
+        return PhpCreateImageIcons(FileName);
+
+    lookupEntry.FileName = FileName;
+
+    PhAcquireQueuedLockExclusive(&PhpImageCacheLock);
+
+    entryPtr = PhFindEntryHashtable(PhpImageCacheHashtable, &lookupEntryPtr);
+
+    if (entryPtr)
+    {
+        entry = *entryPtr;
+
+        if (entry->Icons && RtlEqualMemory(&entry->Key, &key, sizeof(PH_FILE_CACHE_KEY)))
+        {
+            icons = entry->Icons;
+            PhReferenceObject(icons);
+            entry->LastUseTime = NtGetTickCount();
+        }
+    }
+
+    PhReleaseQueuedLockExclusive(&PhpImageCacheLock);
+
+    if (icons)
+        return icons;
+
+    // Extracting icons is slow, so we don't hold the lock while doing it. If another
+    // thread extracts the same icons in the meantime, we use its copy and discard ours.
+
+    newIcons = PhpCreateImageIcons(FileName);
+
+    if (!newIcons)
+        return NULL;
+
+    PhAcquireQueuedLockExclusive(&PhpImageCacheLock);
+
+    entryPtr = PhFindEntryHashtable(PhpImageCacheHashtable, &lookupEntryPtr);
+
+    if (entryPtr)
+    {
+        entry = *entryPtr;
+
+        if (RtlEqualMemory(&entry->Key, &key, sizeof(PH_FILE_CACHE_KEY)))
+        {
+            if (entry->Icons)
+            {
+                icons = entry->Icons;
+                PhReferenceObject(icons);
+            }
+            else
+            {
+                entry->Icons = newIcons;
+                PhReferenceObject(newIcons);
+            }
+        }
+    }
+
+    PhReleaseQueuedLockExclusive(&PhpImageCacheLock);
+
+    if (icons)
+    {
+        PhDereferenceObject(newIcons);
+        return icons;
+    }
+
+    return newIcons;
+}
+
+/**
+ * Gets the default application icons.
+ *
+ * \return The default application icons. You must dereference the object when you no
+ * longer need it. The icons are shared and must not be destroyed.
+ */
+PPH_IMAGE_ICONS PhReferenceStockImageIcons(
+    VOID
+    )
+{
+    static PH_INITONCE initOnce = PH_INITONCE_INIT;
+    static PPH_IMAGE_ICONS stockIcons;
+
+    if (PhBeginInitOnce(&initOnce))
+    {
+        HICON smallIcon;
+        HICON largeIcon;
+
+        PhGetStockApplicationIcon(&smallIcon, &largeIcon);
+
+        stockIcons = PhCreateObject(sizeof(PH_IMAGE_ICONS), PhImageIconsType);
+        stockIcons->SmallIcon = DuplicateIcon(NULL, smallIcon);
+        stockIcons->LargeIcon = DuplicateIcon(NULL, largeIcon);
+
+        PhEndInitOnce(&initOnce);
+    }
+
+    PhReferenceObject(stockIcons);
+
+    return stockIcons;
+}
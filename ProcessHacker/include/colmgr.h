@@ -20,6 +20,7 @@ typedef struct _PH_CM_MANAGER
     PPH_CM_POST_SORT_FUNCTION PostSortFunction;
     LIST_ENTRY ColumnListHead;
     PPH_LIST NotifyList;
+    PPH_LIST ColumnList; // indexed by Id - MinId
 } PH_CM_MANAGER, *PPH_CM_MANAGER;
 
 typedef struct _PH_CM_COLUMN
@@ -31,6 +31,13 @@ typedef struct _PH_CSR_HANDLE_INFO
     HANDLE ProcessId;
 } PH_CSR_HANDLE_INFO, *PPH_CSR_HANDLE_INFO;
 
+typedef struct _PH_HIDDEN_PROCESS_SCAN
+{
+    volatile BOOLEAN Cancelled; // set by the caller to stop the scan
+    volatile ULONG ScannedCount; // number of process IDs scanned so far (brute force only)
+    volatile ULONG TotalCount; // current estimate of the number of process IDs to scan
+} PH_HIDDEN_PROCESS_SCAN, *PPH_HIDDEN_PROCESS_SCAN;
+
 typedef BOOLEAN (NTAPI *PPH_ENUM_HIDDEN_PROCESSES_CALLBACK)(
     _In_ PPH_HIDDEN_PROCESS_ENTRY Process,
     _In_opt_ PVOID Context
@@ -44,6 +51,15 @@ PhEnumHiddenProcesses(
     _In_opt_ PVOID Context
     );
 
+NTSTATUS
+NTAPI
+PhEnumHiddenProcessesEx(
+    _In_ PH_HIDDEN_PROCESS_METHOD Method,
+    _In_ PPH_ENUM_HIDDEN_PROCESSES_CALLBACK Callback,
+    _In_opt_ PVOID Context,
+    _Inout_opt_ PPH_HIDDEN_PROCESS_SCAN Scan
+    );
+
 typedef BOOLEAN (NTAPI *PPH_ENUM_CSR_PROCESS_HANDLES_CALLBACK)(
     _In_ PPH_CSR_HANDLE_INFO Handle,
     _In_opt_ PVOID Context
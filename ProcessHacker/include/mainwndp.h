@@ -6,6 +6,11 @@
 #define PH_FLUSH_PROCESS_QUERY_DATA_INTERVAL_LONG_TERM 1000
 
 #define TIMER_FLUSH_PROCESS_QUERY_DATA 1
+#define TIMER_APPLY_PROCESS_UPDATES 2
+
+// The maximum time in milliseconds spent adding and removing process nodes before the UI thread
+// goes back to handling input and painting.
+#define PH_APPLY_PROCESS_UPDATES_BUDGET 10
 
 LRESULT CALLBACK PhMwpWndProc(
     _In_ HWND hWnd,
@@ -28,10 +33,18 @@ VOID PhMwpApplyUpdateInterval(
     _In_ ULONG Interval
     );
 
+VOID PhMwpUpdateBackgroundMode(
+    _In_ BOOLEAN Background
+    );
+
 VOID PhMwpInitializeControls(
     VOID
     );
 
+NTSTATUS PhMwpPrefetchSymbolsFunction(
+    _In_ PVOID Parameter
+    );
+
 NTSTATUS PhMwpDelayedLoadFunction(
     _In_ PVOID Parameter
     );
@@ -135,6 +148,16 @@ VOID NTAPI PhMwpProcessesUpdatedHandler(
     _In_opt_ PVOID Context
     );
 
+VOID NTAPI PhMwpShortLivedProcessHandler(
+    _In_opt_ PVOID Parameter,
+    _In_opt_ PVOID Context
+    );
+
+VOID NTAPI PhMwpProcessProviderHintHandler(
+    _In_opt_ PVOID Parameter,
+    _In_opt_ PVOID Context
+    );
+
 VOID NTAPI PhMwpServiceAddedHandler(
     _In_opt_ PVOID Parameter,
     _In_opt_ PVOID Context
@@ -354,6 +377,10 @@ VOID PhMwpOnProcessAdded(
     _In_ ULONG RunId
     );
 
+VOID PhMwpOnInitialProcessesAdded(
+    VOID
+    );
+
 VOID PhMwpOnProcessModified(
     _In_ PPH_PROCESS_ITEM ProcessItem
     );
@@ -366,6 +393,23 @@ VOID PhMwpOnProcessesUpdated(
     VOID
     );
 
+VOID PhMwpQueueProcessAdded(
+    _In_ _Assume_refs_(1) PPH_PROCESS_ITEM ProcessItem,
+    _In_ ULONG RunId
+    );
+
+VOID PhMwpQueueProcessRemoved(
+    _In_ PPH_PROCESS_ITEM ProcessItem
+    );
+
+VOID PhMwpApplyPendingProcessUpdates(
+    VOID
+    );
+
+VOID PhMwpOnShortLivedProcess(
+    _In_ PPH_SHORT_LIVED_PROCESS ShortLivedProcess
+    );
+
 // Services
 
 VOID PhMwpNeedServiceTreeList(
@@ -0,0 +1,44 @@
+#ifndef PH_MEMSNAP_H
+#define PH_MEMSNAP_H
+
+#include <memsrch.h>
+
+// A memory snapshot records the committed regions of a process and a hash of each page
+// in them. Two snapshots can be compared to find the pages that were changed, committed
+// or freed in between.
+
+#define PH_MEMORY_SNAPSHOT_UNREADABLE 0 // the page hash of a page that could not be read
+
+typedef struct _PH_MEMORY_SNAPSHOT_REGION
+{
+    PVOID BaseAddress;
+    SIZE_T RegionSize;
+    ULONG Protect;
+    ULONG Type;
+    PULONG64 PageHashes;
+} PH_MEMORY_SNAPSHOT_REGION, *PPH_MEMORY_SNAPSHOT_REGION;
+
+typedef struct _PH_MEMORY_SNAPSHOT
+{
+    HANDLE ProcessId;
+    ULONG NumberOfRegions;
+    PPH_MEMORY_SNAPSHOT_REGION Regions; // sorted by address
+
+    SIZE_T NumberOfPages;
+    SIZE_T NumberOfPagesRead; // pages whose hashes were not taken from a previous snapshot
+    PULONG64 PageHashes;
+} PH_MEMORY_SNAPSHOT, *PPH_MEMORY_SNAPSHOT;
+
+NTSTATUS PhCreateMemorySnapshot(
+    _In_ HANDLE ProcessId,
+    _In_opt_ PPH_MEMORY_SNAPSHOT PreviousSnapshot,
+    _Out_ PPH_MEMORY_SNAPSHOT *Snapshot
+    );
+
+VOID PhDiffMemorySnapshots(
+    _In_ PPH_MEMORY_SNAPSHOT OldSnapshot,
+    _In_ PPH_MEMORY_SNAPSHOT NewSnapshot,
+    _Inout_ PPH_MEMORY_RESULTS Results
+    );
+
+#endif
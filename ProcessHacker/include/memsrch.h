@@ -1,26 +1,41 @@
 #ifndef PH_MEMSRCH_H
 #define PH_MEMSRCH_H
 
+#define PH_DISPLAY_BUFFER_COUNT (PAGE_SIZE * 2 - 1)
+
+// Results are stored in blocks owned by a PH_MEMORY_RESULTS object, and their display
+// text is packed into large arenas. Nothing is allocated per result, and all of it is
+// freed at once when the object is deleted.
+
 typedef struct _PH_MEMORY_RESULT
 {
-    LONG RefCount;
     PVOID Address;
-    SIZE_T Length;
-    PH_STRINGREF Display;
+    ULONG Length;
+    ULONG DisplayLength : 31; // in characters
+    ULONG WideDisplay : 1; // the display text is UTF-16, otherwise it is ANSI
+    PVOID Display;
 } PH_MEMORY_RESULT, *PPH_MEMORY_RESULT;
 
-typedef VOID (NTAPI *PPH_MEMORY_RESULT_CALLBACK)(
-    _In_ _Assume_refs_(1) PPH_MEMORY_RESULT Result,
-    _In_opt_ PVOID Context
-    );
+#define PH_MEMORY_RESULTS_BLOCK_SHIFT 12
+#define PH_MEMORY_RESULTS_BLOCK_SIZE (1 << PH_MEMORY_RESULTS_BLOCK_SHIFT)
 
-#define PH_DISPLAY_BUFFER_COUNT (PAGE_SIZE * 2 - 1)
+typedef struct _PH_MEMORY_RESULTS
+{
+    ULONG Count;
+    PPH_LIST Blocks;
+
+    PPH_LIST Arenas;
+    PUCHAR ArenaPosition;
+    SIZE_T ArenaRemaining;
+
+    // Results copied from another set keep that set's display text alive.
+    struct _PH_MEMORY_RESULTS *Source;
+} PH_MEMORY_RESULTS, *PPH_MEMORY_RESULTS;
 
 typedef struct _PH_MEMORY_SEARCH_OPTIONS
 {
     BOOLEAN Cancel;
-    PPH_MEMORY_RESULT_CALLBACK Callback;
-    PVOID Context;
+    PPH_MEMORY_RESULTS Results;
 } PH_MEMORY_SEARCH_OPTIONS, *PPH_MEMORY_SEARCH_OPTIONS;
 
 typedef struct _PH_MEMORY_STRING_OPTIONS
@@ -32,30 +47,49 @@ typedef struct _PH_MEMORY_STRING_OPTIONS
     ULONG MemoryTypeMask;
 } PH_MEMORY_STRING_OPTIONS, *PPH_MEMORY_STRING_OPTIONS;
 
-PVOID PhAllocateForMemorySearch(
-    _In_ SIZE_T Size
-    );
+typedef struct _PH_MEMORY_PATTERN_OPTIONS
+{
+    PH_MEMORY_SEARCH_OPTIONS Header;
+
+    PVOID CompiledExpression; // pcre2_code
+    BOOLEAN DetectUnicode;
+    ULONG MemoryTypeMask;
+} PH_MEMORY_PATTERN_OPTIONS, *PPH_MEMORY_PATTERN_OPTIONS;
 
-VOID PhFreeForMemorySearch(
-    _In_ _Post_invalid_ PVOID Memory
+PPH_MEMORY_RESULTS PhCreateMemoryResults(
+    _In_opt_ PPH_MEMORY_RESULTS Source
     );
 
-PVOID PhCreateMemoryResult(
+VOID PhAddMemoryResult(
+    _Inout_ PPH_MEMORY_RESULTS Results,
     _In_ PVOID Address,
-    _In_ SIZE_T Length
+    _In_ ULONG Length,
+    _In_reads_bytes_(DisplayLength * (WideDisplay ? sizeof(WCHAR) : sizeof(CHAR))) PVOID Display,
+    _In_ ULONG DisplayLength,
+    _In_ BOOLEAN WideDisplay
     );
 
-VOID PhReferenceMemoryResult(
+VOID PhCopyMemoryResult(
+    _Inout_ PPH_MEMORY_RESULTS Results,
     _In_ PPH_MEMORY_RESULT Result
     );
 
-VOID PhDereferenceMemoryResult(
-    _In_ PPH_MEMORY_RESULT Result
+VOID PhSortMemoryResults(
+    _Inout_ PPH_MEMORY_RESULTS Results
     );
 
-VOID PhDereferenceMemoryResults(
-    _In_reads_(NumberOfResults) PPH_MEMORY_RESULT *Results,
-    _In_ ULONG NumberOfResults
+ULONG PhGetMemoryResultDisplay(
+    _In_ PPH_MEMORY_RESULT Result,
+    _Out_writes_(PH_DISPLAY_BUFFER_COUNT + 1) PWSTR Buffer
     );
 
+FORCEINLINE PPH_MEMORY_RESULT PhGetMemoryResult(
+    _In_ PPH_MEMORY_RESULTS Results,
+    _In_ ULONG Index
+    )
+{
+    return (PPH_MEMORY_RESULT)Results->Blocks->Items[Index >> PH_MEMORY_RESULTS_BLOCK_SHIFT] +
+        (Index & (PH_MEMORY_RESULTS_BLOCK_SIZE - 1));
+}
+
 #endif
@@ -126,6 +126,7 @@ typedef enum _PH_MINIINFO_LIST_SECTION_MESSAGE
     MiListSectionGetUsageText, // PPH_MINIINFO_LIST_SECTION_GET_USAGE_TEXT Parameter1
     MiListSectionInitializeContextMenu, // PPH_MINIINFO_LIST_SECTION_MENU_INFORMATION Parameter1
     MiListSectionHandleContextMenu, // PPH_MINIINFO_LIST_SECTION_MENU_INFORMATION Parameter1
+    MiListSectionGetProcessCompareFunction, // PPH_MINIINFO_LIST_SECTION_GET_COMPARE_FUNCTION Parameter1
     MaxMiListSectionMessage
 } PH_MINIINFO_LIST_SECTION_MESSAGE;
 
@@ -137,7 +138,9 @@ typedef BOOLEAN (NTAPI *PPH_MINIINFO_LIST_SECTION_CALLBACK)(
     );
 
 // The list section performs the following steps when constructing the list of process groups:
-// 1. MiListSectionSortProcessList is sent in order to sort the process list.
+// 1. MiListSectionGetProcessCompareFunction is sent in order to get a function that orders the processes. Only the
+//    processes needed for the groups are put in order. If the message is not handled, MiListSectionSortProcessList
+//    is sent in order to sort the whole process list instead.
 // 2. A small number of process groups is created from the first few processes in the sorted list (typically high
 //    resource consumers).
 // 3. MiListSectionAssignSortData is sent for each process group so that the user can assign custom sort data to
@@ -158,6 +161,12 @@ typedef struct _PH_MINIINFO_LIST_SECTION_ASSIGN_SORT_DATA
     PPH_MINIINFO_LIST_SECTION_SORT_DATA SortData;
 } PH_MINIINFO_LIST_SECTION_ASSIGN_SORT_DATA, *PPH_MINIINFO_LIST_SECTION_ASSIGN_SORT_DATA;
 
+typedef struct _PH_MINIINFO_LIST_SECTION_GET_COMPARE_FUNCTION
+{
+    // Compares two PPH_PROCESS_NODE * elements, like a qsort comparison function.
+    int (__cdecl *CompareFunction)(_In_ const void *elem1, _In_ const void *elem2);
+} PH_MINIINFO_LIST_SECTION_GET_COMPARE_FUNCTION, *PPH_MINIINFO_LIST_SECTION_GET_COMPARE_FUNCTION;
+
 typedef struct _PH_MINIINFO_LIST_SECTION_SORT_LIST
 {
     // MiListSectionSortProcessList: List of PPH_PROCESS_NODE
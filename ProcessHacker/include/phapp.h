@@ -47,7 +47,8 @@ typedef struct _PH_STARTUP_PARAMETERS
             ULONG UninstallKph : 1;
             ULONG Debug : 1;
             ULONG Help : 1;
-            ULONG Spare : 17;
+            ULONG TraceStartup : 1;
+            ULONG Spare : 16;
         };
         ULONG Flags;
     };
@@ -85,6 +86,16 @@ extern PH_STARTUP_PARAMETERS PhStartupParameters;
 
 extern PH_PROVIDER_THREAD PhPrimaryProviderThread;
 extern PH_PROVIDER_THREAD PhSecondaryProviderThread;
+extern PH_PROVIDER_THREAD PhTertiaryProviderThread;
+
+VOID PhTraceStartup(
+    _In_ PWSTR Phase,
+    _In_opt_ PPH_STRINGREF Detail
+    );
+
+VOID PhFinishStartupTrace(
+    VOID
+    );
 
 // begin_phapppub
 PHAPPAPI
@@ -560,6 +571,17 @@ PhApplyTreeNewFilters(
     );
 // end_phapppub
 
+PPH_STRING PhFormatSizeCached(
+    _Inout_ PPH_CACHED_FORMAT Cache,
+    _In_ ULONG64 Size
+    );
+
+PPH_STRING PhFormatUInt64Cached(
+    _Inout_ PPH_CACHED_FORMAT Cache,
+    _In_ ULONG64 Value,
+    _In_ BOOLEAN GroupDigits
+    );
+
 typedef struct _PH_COPY_CELL_CONTEXT
 {
     HWND TreeNewHandle;
@@ -684,7 +706,8 @@ extern BOOLEAN PhMainWndExiting;
 #define WM_PH_SET_UPDATE_AUTOMATICALLY (WM_APP + 143)
 // end_phapppub
 #define WM_PH_ICON_CLICK (WM_APP + 144)
-#define WM_PH_LAST (WM_APP + 144)
+#define WM_PH_SHORT_LIVED_PROCESS (WM_APP + 145)
+#define WM_PH_LAST (WM_APP + 145)
 
 // begin_phapppub
 #define ProcessHacker_ShowProcessProperties(hWnd, ProcessItem) \
@@ -745,7 +768,7 @@ typedef struct _PH_SHOWMEMORYEDITOR
 typedef struct _PH_SHOWMEMORYRESULTS
 {
     HANDLE ProcessId;
-    PPH_LIST Results;
+    struct _PH_MEMORY_RESULTS *Results;
 } PH_SHOWMEMORYRESULTS, *PPH_SHOWMEMORYRESULTS;
 
 // begin_phapppub
@@ -872,6 +895,10 @@ VOID PhLoadPlugins(
     VOID
     );
 
+VOID PhLoadDeferredPlugins(
+    VOID
+    );
+
 VOID PhUnloadPlugins(
     VOID
     );
@@ -896,6 +923,8 @@ typedef struct _PH_PROCESS_PROPCONTEXT
     HPROPSHEETPAGE *PropSheetPages;
 
     HANDLE SelectThreadId;
+    struct _PH_THREAD_PROVIDER *ThreadProvider; // created in the background so that symbols can be prefetched
+    BOOLEAN ThreadsPageCreated;
 } PH_PROCESS_PROPCONTEXT, *PPH_PROCESS_PROPCONTEXT;
 
 // begin_phapppub
@@ -1066,6 +1095,7 @@ PhShowProcessProperties(
 
 typedef struct _PH_LOG_ENTRY *PPH_LOG_ENTRY; // phapppub
 
+// Strings are stored as IDs of interned strings. Use PhFormatLogEntry to get the text of an entry.
 typedef struct _PH_LOG_ENTRY
 {
     UCHAR Type;
@@ -1077,23 +1107,21 @@ typedef struct _PH_LOG_ENTRY
         struct
         {
             HANDLE ProcessId;
-            PPH_STRING Name;
             HANDLE ParentProcessId;
-            PPH_STRING ParentName;
+            ULONG NameId;
+            ULONG ParentNameId;
             NTSTATUS ExitStatus;
         } Process;
         struct
         {
-            PPH_STRING Name;
-            PPH_STRING DisplayName;
+            ULONG NameId;
+            ULONG DisplayNameId;
         } Service;
-        PPH_STRING Message;
+        ULONG MessageId;
     };
-    UCHAR Buffer[1];
 } PH_LOG_ENTRY, *PPH_LOG_ENTRY;
 
 #ifndef PH_LOG_PRIVATE
-extern PH_CIRCULAR_BUFFER_PVOID PhLogBuffer;
 PHAPPAPI extern PH_CALLBACK PhLoggedCallback; // phapppub
 #endif
 
@@ -1101,10 +1129,23 @@ VOID PhLogInitialization(
     VOID
     );
 
+VOID PhLogUninitialization(
+    VOID
+    );
+
 VOID PhClearLogEntries(
     VOID
     );
 
+ULONG PhGetLogEntryCount(
+    VOID
+    );
+
+BOOLEAN PhGetLogEntry(
+    _In_ ULONG Index,
+    _Out_ PPH_LOG_ENTRY Entry
+    );
+
 VOID PhLogProcessEntry(
     _In_ UCHAR Type,
     _In_ HANDLE ProcessId,
@@ -1143,6 +1184,51 @@ VOID PhShowDebugConsole(
     VOID
     );
 
+// diag
+
+#define PH_DIAGNOSTICS_SERIES_RATE 0x1
+
+typedef struct _PH_DIAGNOSTICS_SERIES
+{
+    PH_STRINGREF Name;
+    PPH_STRING NameString;
+    ULONG Flags;
+
+    ULONG UpdatedSampleCount;
+    BOOLEAN RawValueValid;
+    ULONG64 RawValue; // last value of a cumulative counter
+    ULONG64 PendingValue;
+    ULONG64 Value; // latest value in the history
+
+    PH_CIRCULAR_BUFFER_ULONG64 History;
+} PH_DIAGNOSTICS_SERIES, *PPH_DIAGNOSTICS_SERIES;
+
+typedef BOOLEAN (NTAPI *PPH_ENUM_DIAGNOSTICS_SERIES_CALLBACK)(
+    _In_ PPH_DIAGNOSTICS_SERIES Series,
+    _In_opt_ PVOID Context
+    );
+
+VOID PhStartDiagnostics(
+    _In_ ULONG Interval
+    );
+
+VOID PhStopDiagnostics(
+    VOID
+    );
+
+BOOLEAN PhIsDiagnosticsRunning(
+    VOID
+    );
+
+ULONG PhEnumDiagnosticsSeries(
+    _In_ PPH_ENUM_DIAGNOSTICS_SERIES_CALLBACK Callback,
+    _In_opt_ PVOID Context
+    );
+
+NTSTATUS PhSaveDiagnosticsHistory(
+    _In_ PWSTR FileName
+    );
+
 // actions
 
 typedef enum _PH_ACTION_ELEVATION_LEVEL
@@ -1529,6 +1615,10 @@ PhUiSetAttributesHandle(
 
 // itemtips
 
+ULONG PhGetProcessTooltipKey(
+    _In_ PPH_PROCESS_ITEM Process
+    );
+
 PPH_STRING PhGetProcessTooltipText(
     _In_ PPH_PROCESS_ITEM Process,
     _Out_opt_ PULONG ValidToTickCount
@@ -1544,6 +1634,48 @@ NTSTATUS PhCommandModeStart(
     VOID
     );
 
+// cmdexport
+
+NTSTATUS PhCommandModeExport(
+    VOID
+    );
+
+// recorder
+
+VOID PhRecorderInitialization(
+    VOID
+    );
+
+VOID PhRecorderUninitialization(
+    VOID
+    );
+
+NTSTATUS PhCommandModeDumpRecording(
+    VOID
+    );
+
+// provrply
+
+NTSTATUS PhCommandModeReplay(
+    VOID
+    );
+
+// remote
+
+NTSTATUS PhCommandModeRemote(
+    VOID
+    );
+
+// pubsnap
+
+VOID PhSnapshotPublicationInitialization(
+    VOID
+    );
+
+VOID PhSnapshotPublicationUninitialization(
+    VOID
+    );
+
 // anawait
 
 VOID PhUiAnalyzeWaitThread(
@@ -1560,6 +1692,10 @@ BOOLEAN PhUiCreateDumpFileProcess(
     _In_ PPH_PROCESS_ITEM Process
     );
 
+NTSTATUS PhCommandModeExpandMiniDump(
+    VOID
+    );
+
 // about
 
 VOID PhShowAboutDialog(
@@ -1735,7 +1871,7 @@ VOID PhShowMemoryProtectDialog(
 
 VOID PhShowMemoryResultsDialog(
     _In_ HANDLE ProcessId,
-    _In_ PPH_LIST Results
+    _In_ struct _PH_MEMORY_RESULTS *Results
     );
 
 // memsrch
@@ -1790,6 +1926,12 @@ VOID PhShowOptionsDialog(
     _In_ HWND ParentWindowHandle
     );
 
+// joblist
+
+VOID PhShowJobListDialog(
+    _In_ HWND ParentWindowHandle
+    );
+
 // pagfiles
 
 VOID PhShowPagefilesDialog(
@@ -1921,6 +2063,13 @@ VOID PhShowProcessTerminatorDialog(
     _In_ PPH_PROCESS_ITEM ProcessItem
     );
 
+// thrdprof
+
+VOID PhStartThreadProfiler(
+    _In_ PPH_PROCESS_ITEM ProcessItem,
+    _In_ PPH_STRING FileName
+    );
+
 // thrdstk
 
 VOID PhShowThreadStackDialog(
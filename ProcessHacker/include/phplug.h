@@ -44,6 +44,10 @@ typedef enum _PH_GENERAL_CALLBACK
     GeneralCallbackMemoryItemListControl = 31, // PPH_PLUGIN_MEMORY_ITEM_LIST_CONTROL Data [properties thread]
     GeneralCallbackMiniInformationInitializing = 32, // PPH_PLUGIN_MINIINFO_POINTERS Data [main thread]
     GeneralCallbackMiListSectionMenuInitializing = 33, // PPH_PLUGIN_MENU_INFORMATION Data [main thread]
+    GeneralCallbackProcessProviderUpdated = 34, // PPH_PLUGIN_PROVIDER_UPDATE Data [process provider thread]
+    GeneralCallbackServiceProviderUpdated = 35, // PPH_PLUGIN_PROVIDER_UPDATE Data [service provider thread]
+    GeneralCallbackNetworkProviderUpdated = 36, // PPH_PLUGIN_PROVIDER_UPDATE Data [network provider thread]
+    GeneralCallbackDiagnosticsSampling = 37, // PPH_PLUGIN_DIAGNOSTICS_SAMPLE Data [diagnostics thread]
     GeneralCallbackMaximum
 } PH_GENERAL_CALLBACK, *PPH_GENERAL_CALLBACK;
 
@@ -56,6 +60,7 @@ typedef enum _PH_PLUGIN_CALLBACK
     PluginCallbackTreeNewMessage = 4, // PPH_PLUGIN_TREENEW_MESSAGE Message [main/properties thread]
     PluginCallbackPhSvcRequest = 5, // PPH_PLUGIN_PHSVC_REQUEST Message [phsvc thread]
     PluginCallbackMenuHook = 6, // PH_PLUGIN_MENU_HOOK_INFORMATION MenuHookInfo [menu thread]
+    PluginCallbackLoadDeferred = 7, // [main thread] // after the main window is first populated
     PluginCallbackMaximum
 } PH_PLUGIN_CALLBACK, *PPH_PLUGIN_CALLBACK;
 
@@ -97,6 +102,40 @@ typedef struct _PH_PLUGIN_NOTIFY_EVENT
     PVOID Parameter;
 } PH_PLUGIN_NOTIFY_EVENT, *PPH_PLUGIN_NOTIFY_EVENT;
 
+typedef struct _PH_PLUGIN_PROVIDER_UPDATE
+{
+    // Items are:
+    // PPH_PROCESS_ITEM for GeneralCallbackProcessProviderUpdated
+    // PPH_SERVICE_ITEM for GeneralCallbackServiceProviderUpdated
+    // PPH_NETWORK_ITEM for GeneralCallbackNetworkProviderUpdated
+    //
+    // The items are only valid for the duration of the callback. The arrays contain the
+    // items for which the individual added, modified and removed events were raised during
+    // one provider run, in the same order.
+
+    ULONG NumberOfAddedItems;
+    PVOID *AddedItems;
+    ULONG NumberOfModifiedItems;
+    PVOID *ModifiedItems;
+    ULONG NumberOfRemovedItems;
+    PVOID *RemovedItems;
+} PH_PLUGIN_PROVIDER_UPDATE, *PPH_PLUGIN_PROVIDER_UPDATE;
+
+typedef VOID (NTAPI *PPH_DIAGNOSTICS_ADD_COUNTER)(
+    _In_ PWSTR Name,
+    _In_ ULONG64 Value,
+    _In_ BOOLEAN Cumulative
+    );
+
+typedef struct _PH_PLUGIN_DIAGNOSTICS_SAMPLE
+{
+    // Names have the form "area.counter", e.g. "etw.events_lost". Values added with the same
+    // name in one sample are summed. Cumulative counters only ever increase, and the sampler
+    // records their rate of change per second.
+
+    PPH_DIAGNOSTICS_ADD_COUNTER AddCounter;
+} PH_PLUGIN_DIAGNOSTICS_SAMPLE, *PPH_PLUGIN_DIAGNOSTICS_SAMPLE;
+
 typedef struct _PH_PLUGIN_OBJECT_PROPERTIES
 {
     // Parameter is:
@@ -599,6 +638,33 @@ PhPluginTriggerEMenuItem(
     _In_ PPH_EMENU_ITEM Item
     );
 
+#define PH_PROVIDER_UPDATE_ADDED 0
+#define PH_PROVIDER_UPDATE_MODIFIED 1
+#define PH_PROVIDER_UPDATE_REMOVED 2
+#define PH_PROVIDER_UPDATE_MAXIMUM 3
+
+typedef struct _PH_PROVIDER_UPDATE_BATCH
+{
+    PH_GENERAL_CALLBACK Callback;
+    PPH_LIST Items[PH_PROVIDER_UPDATE_MAXIMUM];
+} PH_PROVIDER_UPDATE_BATCH, *PPH_PROVIDER_UPDATE_BATCH;
+
+#define PH_PROVIDER_UPDATE_BATCH_INIT(Callback) { Callback, { NULL, NULL, NULL } }
+
+VOID
+NTAPI
+PhAddProviderUpdateBatchItem(
+    _Inout_ PPH_PROVIDER_UPDATE_BATCH Batch,
+    _In_ ULONG Type,
+    _In_ PVOID Item
+    );
+
+VOID
+NTAPI
+PhFlushProviderUpdateBatch(
+    _Inout_ PPH_PROVIDER_UPDATE_BATCH Batch
+    );
+
 // begin_phapppub
 PHAPPAPI
 BOOLEAN
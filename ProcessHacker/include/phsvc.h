@@ -235,4 +235,9 @@ NTSTATUS PhSvcApiWriteMiniDumpProcess(
     _Inout_ PPHSVC_API_PAYLOAD Payload
     );
 
+NTSTATUS PhSvcApiBatch(
+    _In_ PPHSVC_CLIENT Client,
+    _Inout_ PPHSVC_API_PAYLOAD Payload
+    );
+
 #endif
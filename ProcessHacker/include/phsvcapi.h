@@ -25,6 +25,7 @@ typedef enum _PHSVC_API_NUMBER
     PhSvcSetServiceSecurityApiNumber = 17,
     PhSvcLoadDbgHelpApiNumber = 18, // WOW64 compatible
     PhSvcWriteMiniDumpProcessApiNumber = 19, // WOW64 compatible
+    PhSvcBatchApiNumber = 20,
     PhSvcMaximumApiNumber
 } PHSVC_API_NUMBER, *PPHSVC_API_NUMBER;
 
@@ -260,6 +261,14 @@ typedef union _PHSVC_API_WRITEMINIDUMPPROCESS
     } i;
 } PHSVC_API_WRITEMINIDUMPPROCESS, *PPHSVC_API_WRITEMINIDUMPPROCESS;
 
+typedef union _PHSVC_API_BATCH
+{
+    struct
+    {
+        PH_RELATIVE_STRINGREF Requests; // array of PHSVC_API_PAYLOAD in the port view
+    } i;
+} PHSVC_API_BATCH, *PPHSVC_API_BATCH;
+
 typedef union _PHSVC_API_PAYLOAD
 {
     PHSVC_API_CONNECTINFO ConnectInfo;
@@ -287,6 +296,7 @@ typedef union _PHSVC_API_PAYLOAD
             PHSVC_API_SETSERVICESECURITY SetServiceSecurity;
             PHSVC_API_LOADDBGHELP LoadDbgHelp;
             PHSVC_API_WRITEMINIDUMPPROCESS WriteMiniDumpProcess;
+            PHSVC_API_BATCH Batch;
         } u;
     };
 } PHSVC_API_PAYLOAD, *PPHSVC_API_PAYLOAD;
@@ -152,4 +152,9 @@ NTSTATUS PhSvcCallWriteMiniDumpProcess(
     _In_ ULONG DumpType
     );
 
+NTSTATUS PhSvcCallBatch(
+    _Inout_updates_(NumberOfRequests) PPHSVC_API_PAYLOAD Requests,
+    _In_ ULONG NumberOfRequests
+    );
+
 #endif
@@ -14,6 +14,12 @@ typedef VOID (NTAPI *PPH_SORT_LIST_FUNCTION)(
     _In_opt_ PVOID Context
     );
 
+// Compares two PPH_PROCESS_NODE * elements, like a qsort comparison function.
+typedef int (__cdecl *PPH_PROCESS_NODE_COMPARE_FUNCTION)(
+    _In_ const void *elem1,
+    _In_ const void *elem2
+    );
+
 #define PH_GROUP_PROCESSES_DONT_GROUP 0x1
 #define PH_GROUP_PROCESSES_FILE_PATH 0x2
 
@@ -24,6 +30,14 @@ PPH_LIST PhCreateProcessGroupList(
     _In_ ULONG Flags
     );
 
+PPH_LIST PhCreateProcessGroupListEx(
+    _In_opt_ PPH_SORT_LIST_FUNCTION SortListFunction, // Sort a list of PPH_PROCESS_NODE
+    _In_opt_ PVOID Context,
+    _In_opt_ PPH_PROCESS_NODE_COMPARE_FUNCTION CompareFunction,
+    _In_ ULONG MaximumGroups,
+    _In_ ULONG Flags
+    );
+
 VOID PhFreeProcessGroupList(
     _In_ PPH_LIST List
     );
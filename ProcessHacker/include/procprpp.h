@@ -265,6 +265,7 @@ typedef struct _PH_MEMORY_CONTEXT
     BOOLEAN MemoryItemListValid;
     NTSTATUS LastRunStatus;
     PPH_STRING ErrorMessage;
+    struct _PH_MEMORY_SNAPSHOT *Snapshot;
 // begin_phapppub
 } PH_MEMORY_CONTEXT, *PPH_MEMORY_CONTEXT;
 // end_phapppub
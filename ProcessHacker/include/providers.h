@@ -13,6 +13,51 @@ PHAPPAPI extern PH_CALLBACK PhProcessModifiedEvent; // phapppub
 PHAPPAPI extern PH_CALLBACK PhProcessRemovedEvent; // phapppub
 PHAPPAPI extern PH_CALLBACK PhProcessesUpdatedEvent; // phapppub
 
+// A process that was created and exited between two updates of the process provider.
+// These are only reported when KProcessHacker is connected or a plugin queues process hints.
+typedef struct _PH_SHORT_LIVED_PROCESS
+{
+    HANDLE ProcessId;
+    HANDLE ParentProcessId;
+    LARGE_INTEGER CreateTime;
+    LARGE_INTEGER ExitTime;
+    PPH_STRING ProcessName;
+} PH_SHORT_LIVED_PROCESS, *PPH_SHORT_LIVED_PROCESS;
+
+extern PH_CALLBACK PhShortLivedProcessEvent;
+extern PH_CALLBACK PhProcessProviderHintEvent;
+
+// begin_phapppub
+typedef enum _PH_PROCESS_PROVIDER_HINT_TYPE
+{
+    ProcessProviderHintProcessCreate, // ProcessId, ParentProcessId, Time, ImageName
+    ProcessProviderHintProcessExit, // ProcessId, Time
+    ProcessProviderHintImageLoad, // ProcessId
+    ProcessProviderHintImageUnload // ProcessId
+} PH_PROCESS_PROVIDER_HINT_TYPE;
+
+// An event from another source (e.g. an ETW session) which tells the providers that something
+// has changed before the next update notices it.
+typedef struct _PH_PROCESS_PROVIDER_HINT
+{
+    PH_PROCESS_PROVIDER_HINT_TYPE Type;
+    HANDLE ProcessId;
+    HANDLE ParentProcessId;
+    LARGE_INTEGER Time;
+    PPH_STRING ImageName;
+} PH_PROCESS_PROVIDER_HINT, *PPH_PROCESS_PROVIDER_HINT;
+// end_phapppub
+
+// A processor group. Processors in all groups are numbered consecutively in the per-CPU
+// statistics arrays.
+typedef struct _PH_CPU_GROUP
+{
+    USHORT Group;
+    ULONG FirstCpu;
+    ULONG NumberOfCpus;
+    KAFFINITY ActiveMask;
+} PH_CPU_GROUP, *PPH_CPU_GROUP;
+
 extern PPH_LIST PhProcessRecordList;
 extern PH_QUEUED_LOCK PhProcessRecordListLock;
 
@@ -20,12 +65,19 @@ extern ULONG PhStatisticsSampleCount;
 extern BOOLEAN PhEnableProcessQueryStage2;
 extern BOOLEAN PhEnablePurgeProcessRecords;
 extern BOOLEAN PhEnableCycleCpuUsage;
+extern BOOLEAN PhEnableCompressedProcessHistory;
 
 extern PVOID PhProcessInformation; // only can be used if running on same thread as process provider
+extern struct _PH_PROCESS_INFORMATION_SNAPSHOT *PhProcessInformationSnapshot; // same as above
 extern ULONG PhProcessInformationSequenceNumber;
 extern SYSTEM_PERFORMANCE_INFORMATION PhPerfInformation;
 extern PSYSTEM_PROCESSOR_PERFORMANCE_INFORMATION PhCpuInformation;
 extern SYSTEM_PROCESSOR_PERFORMANCE_INFORMATION PhCpuTotals;
+extern ULONG PhNumberOfCpus; // in all processor groups
+extern USHORT PhNumberOfCpuGroups;
+extern PPH_CPU_GROUP PhCpuGroups;
+extern PUSHORT PhCpuNumaNodes; // NUMA node of each processor
+extern ULONG PhNumberOfNumaNodes;
 extern ULONG PhTotalProcesses;
 extern ULONG PhTotalThreads;
 extern ULONG PhTotalHandles;
@@ -40,6 +92,8 @@ extern FLOAT PhCpuKernelUsage;
 extern FLOAT PhCpuUserUsage;
 extern PFLOAT PhCpusKernelUsage;
 extern PFLOAT PhCpusUserUsage;
+extern PFLOAT PhNumaNodesKernelUsage;
+extern PFLOAT PhNumaNodesUserUsage;
 
 extern PH_UINT64_DELTA PhCpuKernelDelta;
 extern PH_UINT64_DELTA PhCpuUserDelta;
@@ -57,10 +111,50 @@ extern PH_CIRCULAR_BUFFER_FLOAT PhCpuKernelHistory;
 extern PH_CIRCULAR_BUFFER_FLOAT PhCpuUserHistory;
 //extern PH_CIRCULAR_BUFFER_FLOAT PhCpuOtherHistory;
 
+// These only hold the latest sample. The full history is in PhCpusHistory.
 extern PPH_CIRCULAR_BUFFER_FLOAT PhCpusKernelHistory;
 extern PPH_CIRCULAR_BUFFER_FLOAT PhCpusUserHistory;
 //extern PPH_CIRCULAR_BUFFER_FLOAT PhCpusOtherHistory;
 
+// Per-CPU usage history. Samples are stored time-major: each row holds the kernel usage of
+// every CPU followed by the user usage of every CPU, so recording a sample writes a single
+// contiguous row instead of touching two buffers per CPU.
+typedef struct _PH_CPUS_HISTORY
+{
+    ULONG Size;
+    ULONG SizeMinusOne;
+    ULONG Count;
+    ULONG Index;
+    ULONG NumberOfCpus;
+    ULONG RowLength; // in FLOATs, rounded up to a cache line
+    PFLOAT Data;
+} PH_CPUS_HISTORY, *PPH_CPUS_HISTORY;
+
+extern PH_CPUS_HISTORY PhCpusHistory;
+
+FORCEINLINE PFLOAT PhGetCpusHistoryRow(
+    _In_ ULONG Index
+    )
+{
+    return &PhCpusHistory.Data[((PhCpusHistory.Index + Index) & PhCpusHistory.SizeMinusOne) * PhCpusHistory.RowLength];
+}
+
+FORCEINLINE FLOAT PhGetCpuKernelHistory(
+    _In_ ULONG Cpu,
+    _In_ ULONG Index
+    )
+{
+    return PhGetCpusHistoryRow(Index)[Cpu];
+}
+
+FORCEINLINE FLOAT PhGetCpuUserHistory(
+    _In_ ULONG Cpu,
+    _In_ ULONG Index
+    )
+{
+    return PhGetCpusHistoryRow(Index)[PhCpusHistory.NumberOfCpus + Cpu];
+}
+
 extern PH_CIRCULAR_BUFFER_ULONG64 PhIoReadHistory;
 extern PH_CIRCULAR_BUFFER_ULONG64 PhIoWriteHistory;
 extern PH_CIRCULAR_BUFFER_ULONG64 PhIoOtherHistory;
@@ -89,6 +183,16 @@ extern PH_CIRCULAR_BUFFER_ULONG64 PhMaxIoWriteHistory;
 
 // The process item has been removed.
 #define PH_PROCESS_ITEM_REMOVED 0x1
+
+// Stage 1 parts. Each flag is set in Stage1Flags once the fields it covers are valid.
+#define PH_PROCESS_STAGE1_IMAGE 0x1 // VersionInfo, Icons, SmallIcon, LargeIcon
+#define PH_PROCESS_STAGE1_WOW64 0x2 // IsWow64, IsWow64Valid
+#define PH_PROCESS_STAGE1_COMMAND_LINE 0x4 // CommandLine, IsPosix
+#define PH_PROCESS_STAGE1_DOTNET 0x8 // IsDotNet
+#define PH_PROCESS_STAGE1_TOKEN 0x10 // ElevationType, IsElevated, IntegrityLevel, IntegrityString
+#define PH_PROCESS_STAGE1_JOB 0x20 // JobName, IsInJob, IsInSignificantJob
+#define PH_PROCESS_STAGE1_HOST 0x40 // ConsoleHostProcessId, PackageFullName
+#define PH_PROCESS_STAGE1_ALL 0x7f
 // end_phapppub
 
 #define PH_INTEGRITY_STR_LEN 10
@@ -126,6 +230,7 @@ typedef struct _PH_PROCESS_ITEM
 
     HICON SmallIcon;
     HICON LargeIcon;
+    struct _PH_IMAGE_ICONS *Icons; // shared owner of SmallIcon and LargeIcon, if any
     PH_IMAGE_VERSION_INFO VersionInfo;
 
     // Security
@@ -175,7 +280,8 @@ typedef struct _PH_PROCESS_ITEM
     // Misc.
 
     ULONG JustProcessed;
-    PH_EVENT Stage1Event;
+    PH_EVENT Stage1Event; // set when all stage 1 parts are valid
+    LONG Stage1Flags; // PH_PROCESS_STAGE1_*
 
     PPH_POINTER_LIST ServiceList;
     PH_QUEUED_LOCK ServiceListLock;
@@ -229,7 +335,60 @@ typedef struct _PH_PROCESS_ITEM
     PPH_STRING PackageFullName;
 
     PH_QUEUED_LOCK RemoveLock;
+
+    // If not NULL, the full history is stored here (indexed by PH_PROCESS_HISTORY_TYPE) and
+    // the history buffers above only contain the latest sample. Use PhGetProcessItemHistory*
+    // to access the history.
+    PPH_COMPRESSED_CIRCULAR_BUFFER CompressedHistory;
+
+    // The fields that changed during the update identified by SequenceNumber (see
+    // PH_PROCESS_CHANGE_*).
+    ULONG ChangeMask;
+
+    // Opened on first use by PhGetProcessItemVmReadHandle. Do not access these directly.
+    PH_INITONCE VmReadHandleInitOnce;
+    NTSTATUS VmReadHandleStatus;
+    HANDLE VmReadHandle;
+    ACCESS_MASK VmReadHandleAccess;
 } PH_PROCESS_ITEM, *PPH_PROCESS_ITEM;
+
+// Change mask flags
+
+// BasePriority, PriorityClass
+#define PH_PROCESS_CHANGE_PRIORITY 0x1
+// KernelTime, UserTime
+#define PH_PROCESS_CHANGE_CPUTIME 0x2
+// NumberOfHandles
+#define PH_PROCESS_CHANGE_HANDLES 0x4
+// NumberOfThreads, PeakNumberOfThreads
+#define PH_PROCESS_CHANGE_THREADS 0x8
+// VmCounters (except PageFaultCount), WorkingSetPrivateSize, PrivateBytesDelta
+#define PH_PROCESS_CHANGE_MEMORY 0x10
+// VmCounters.PageFaultCount, HardFaultCount, PageFaultsDelta
+#define PH_PROCESS_CHANGE_PAGEFAULTS 0x20
+// IoCounters and the I/O deltas
+#define PH_PROCESS_CHANGE_IO 0x40
+// CpuUsage, CpuKernelUsage, CpuUserUsage
+#define PH_PROCESS_CHANGE_CPU 0x80
+// CycleTimeDelta
+#define PH_PROCESS_CHANGE_CYCLES 0x100
+// ContextSwitchesDelta
+#define PH_PROCESS_CHANGE_CONTEXTSWITCHES 0x200
+// IsBeingDebugged, IsSuspended, IsPartiallySuspended, IsDotNet, IsImmersive
+#define PH_PROCESS_CHANGE_STATE 0x400
+// The item was just created.
+#define PH_PROCESS_CHANGE_ALL 0xffffffff
+
+typedef enum _PH_PROCESS_HISTORY_TYPE
+{
+    ProcessCpuKernelHistory,
+    ProcessCpuUserHistory,
+    ProcessIoReadHistory,
+    ProcessIoWriteHistory,
+    ProcessIoOtherHistory,
+    ProcessPrivateBytesHistory,
+    MaxProcessHistory
+} PH_PROCESS_HISTORY_TYPE;
 // end_phapppub
 
 // begin_phapppub
@@ -254,6 +413,9 @@ typedef struct _PH_PROCESS_RECORD
     PPH_STRING FileName;
     PPH_STRING CommandLine;
     /*PPH_STRING UserName;*/
+
+    PH_AVL_LINKS IndexLinks;
+    LIST_ENTRY DeadListEntry;
 } PH_PROCESS_RECORD, *PPH_PROCESS_RECORD;
 // end_phapppub
 
@@ -261,6 +423,24 @@ BOOLEAN PhProcessProviderInitialization(
     VOID
     );
 
+typedef struct _PH_PROCESS_QUERY_STATISTICS
+{
+    ULONG QueuedCount;
+    ULONG PriorityQueuedCount;
+    ULONG RunningCount;
+    ULONG PeakQueuedCount;
+    ULONG64 TotalQueued;
+    ULONG64 TotalCompleted;
+} PH_PROCESS_QUERY_STATISTICS, *PPH_PROCESS_QUERY_STATISTICS;
+
+VOID PhPrioritizeProcessQuery(
+    _In_ PPH_PROCESS_ITEM ProcessItem
+    );
+
+VOID PhGetProcessQueryStatistics(
+    _Out_ PPH_PROCESS_QUERY_STATISTICS Statistics
+    );
+
 // begin_phapppub
 PHAPPAPI
 PPH_STRING
@@ -314,6 +494,32 @@ VERIFY_RESULT PhVerifyFileWithAdditionalCatalog(
     _Out_opt_ PPH_STRING *SignerName
     );
 
+// vrfcache
+
+typedef struct _PH_FILE_CACHE_KEY
+{
+    LARGE_INTEGER FileId;
+    LARGE_INTEGER LastWriteTime;
+    LARGE_INTEGER EndOfFile;
+} PH_FILE_CACHE_KEY, *PPH_FILE_CACHE_KEY;
+
+NTSTATUS PhQueryFileCacheKey(
+    _In_ PPH_STRING FileName,
+    _Out_ PPH_FILE_CACHE_KEY Key
+    );
+
+VOID PhVerifyCacheInitialization(
+    VOID
+    );
+
+VOID PhOpenVerifyCacheStore(
+    _In_ PWSTR FileName
+    );
+
+VOID PhCloseVerifyCacheStore(
+    VOID
+    );
+
 VERIFY_RESULT PhVerifyFileCached(
     _In_ PPH_STRING FileName,
     _In_opt_ PWSTR PackageFullName,
@@ -321,6 +527,75 @@ VERIFY_RESULT PhVerifyFileCached(
     _In_ BOOLEAN CachedOnly
     );
 
+// imgcache
+
+BOOLEAN PhImageCacheInitialization(
+    VOID
+    );
+
+BOOLEAN PhInitializeImageVersionInfoCached(
+    _Out_ PPH_IMAGE_VERSION_INFO ImageVersionInfo,
+    _In_ PPH_STRING FileName
+    );
+
+typedef struct _PH_IMAGE_ICONS
+{
+    HICON SmallIcon;
+    HICON LargeIcon;
+} PH_IMAGE_ICONS, *PPH_IMAGE_ICONS;
+
+PPH_IMAGE_ICONS PhReferenceImageIconsCached(
+    _In_ PPH_STRING FileName
+    );
+
+PPH_IMAGE_ICONS PhReferenceStockImageIcons(
+    VOID
+    );
+
+typedef struct _PH_PROCESS_JOB
+{
+    PPH_STRING JobName;
+    BOOLEAN IsSignificant;
+
+    ULONG NumberOfProcesses;
+    PHANDLE ProcessIds;
+
+    // Totals over the members known to the process provider
+    FLOAT CpuUsage;
+    SIZE_T PrivateBytes;
+    SIZE_T WorkingSetSize;
+} PH_PROCESS_JOB, *PPH_PROCESS_JOB;
+
+PPH_PROCESS_JOB PhReferenceProcessJob(
+    _In_ HANDLE ProcessId
+    );
+
+VOID PhEnumProcessJobs(
+    _Out_ PPH_PROCESS_JOB **Jobs,
+    _Out_ PULONG NumberOfJobs
+    );
+
+// begin_phapppub
+typedef enum _PH_SYSTEM_GRAPH_SERIES
+{
+    SystemGraphCpuSeries, // Data1: kernel usage, Data2: user usage
+    SystemGraphPhysicalSeries, // Data1: fraction of physical memory in use
+    SystemGraphCommitSeries, // Data1: fraction of the commit limit in use
+    SystemGraphIoSeries, // Data1: read + other, Data2: write; scaled to the maximum (at least 1 MB)
+    SystemGraphSeriesMaximum
+} PH_SYSTEM_GRAPH_SERIES;
+
+PHAPPAPI
+VOID
+NTAPI
+PhGetSystemGraphSeries(
+    _In_ PH_SYSTEM_GRAPH_SERIES Series,
+    _In_ ULONG Count,
+    _Out_writes_(Count) PFLOAT Data1,
+    _Out_writes_opt_(Count) PFLOAT Data2
+    );
+// end_phapppub
+
 // begin_phapppub
 PHAPPAPI
 BOOLEAN
@@ -338,6 +613,55 @@ PhGetStatisticsTimeString(
     _In_opt_ PPH_PROCESS_ITEM ProcessItem,
     _In_ ULONG Index
     );
+
+NTSTATUS PhQueryCpuInformation(
+    _In_ SYSTEM_INFORMATION_CLASS SystemInformationClass,
+    _Out_writes_bytes_(EntrySize * PhNumberOfCpus) PVOID Buffer,
+    _In_ ULONG EntrySize
+    );
+
+VOID PhCopyCpuHistory(
+    _In_ ULONG Cpu,
+    _Out_writes_(Count) PFLOAT KernelDestination,
+    _Out_writes_(Count) PFLOAT UserDestination,
+    _In_ ULONG Count
+    );
+
+PHAPPAPI
+ULONG
+NTAPI
+PhGetProcessItemHistoryCount(
+    _In_ PPH_PROCESS_ITEM ProcessItem,
+    _In_ PH_PROCESS_HISTORY_TYPE Type
+    );
+
+PHAPPAPI
+ULONG64
+NTAPI
+PhGetProcessItemHistoryInteger(
+    _In_ PPH_PROCESS_ITEM ProcessItem,
+    _In_ PH_PROCESS_HISTORY_TYPE Type,
+    _In_ ULONG Index
+    );
+
+PHAPPAPI
+FLOAT
+NTAPI
+PhGetProcessItemHistoryFloat(
+    _In_ PPH_PROCESS_ITEM ProcessItem,
+    _In_ PH_PROCESS_HISTORY_TYPE Type,
+    _In_ ULONG Index
+    );
+
+PHAPPAPI
+VOID
+NTAPI
+PhCopyProcessItemHistory(
+    _In_ PPH_PROCESS_ITEM ProcessItem,
+    _In_ PH_PROCESS_HISTORY_TYPE Type,
+    _Out_writes_(Count) PFLOAT Destination,
+    _In_ ULONG Count
+    );
 // end_phapppub
 
 VOID PhFlushProcessQueryData(
@@ -406,8 +730,51 @@ NTAPI
 PhReferenceProcessItemForRecord(
     _In_ PPH_PROCESS_RECORD Record
     );
+
+PHAPPAPI
+VOID
+NTAPI
+PhQueueProcessProviderHint(
+    _In_ PPH_PROCESS_PROVIDER_HINT Hint
+    );
+
+PHAPPAPI
+NTSTATUS
+NTAPI
+PhGetProcessItemVmReadHandle(
+    _In_ PPH_PROCESS_ITEM ProcessItem,
+    _In_ ACCESS_MASK DesiredAccess,
+    _Out_ PHANDLE ProcessHandle
+    );
 // end_phapppub
 
+typedef struct _PH_PROCESS_INFORMATION_SNAPSHOT_ENTRY
+{
+    HANDLE ProcessId;
+    PSYSTEM_PROCESS_INFORMATION Process;
+} PH_PROCESS_INFORMATION_SNAPSHOT_ENTRY, *PPH_PROCESS_INFORMATION_SNAPSHOT_ENTRY;
+
+typedef struct _PH_PROCESS_INFORMATION_SNAPSHOT
+{
+    ULONG RunId;
+    /** The process information returned by NtQuerySystemInformation. */
+    PVOID Processes;
+    ULONG NumberOfProcesses;
+    /** One entry for each process, sorted by process ID. */
+    PPH_PROCESS_INFORMATION_SNAPSHOT_ENTRY Entries;
+    /** Whether the snapshot owns Processes, which happens if it outlives the provider's buffer. */
+    BOOLEAN OwnsBuffer;
+} PH_PROCESS_INFORMATION_SNAPSHOT, *PPH_PROCESS_INFORMATION_SNAPSHOT;
+
+PPH_PROCESS_INFORMATION_SNAPSHOT PhReferenceProcessInformationSnapshot(
+    VOID
+    );
+
+PSYSTEM_PROCESS_INFORMATION PhFindProcessInformationSnapshot(
+    _In_ PPH_PROCESS_INFORMATION_SNAPSHOT Snapshot,
+    _In_ HANDLE ProcessId
+    );
+
 // srvprv
 
 extern PPH_OBJECT_TYPE PhServiceItemType;
@@ -479,6 +846,14 @@ NTAPI
 PhReferenceServiceItem(
     _In_ PWSTR Name
     );
+
+PHAPPAPI
+VOID
+NTAPI
+PhEnumServiceItems(
+    _Out_opt_ PPH_SERVICE_ITEM **ServiceItems,
+    _Out_ PULONG NumberOfServiceItems
+    );
 // end_phapppub
 
 VOID PhMarkNeedsConfigUpdateServiceItem(
@@ -512,6 +887,12 @@ PHAPPAPI extern PH_CALLBACK PhNetworkItemsUpdatedEvent; // phapppub
 
 extern BOOLEAN PhEnableNetworkProviderResolve;
 
+#define PH_NETWORK_TABLE_TCP4 0
+#define PH_NETWORK_TABLE_TCP6 1
+#define PH_NETWORK_TABLE_UDP4 2
+#define PH_NETWORK_TABLE_UDP6 3
+#define PH_NETWORK_TABLE_MAXIMUM 4
+
 // begin_phapppub
 #define PH_NETWORK_OWNER_INFO_SIZE 16
 
@@ -560,16 +941,33 @@ PhReferenceNetworkItem(
     _In_ PPH_IP_ENDPOINT RemoteEndpoint,
     _In_ HANDLE ProcessId
     );
+
+PHAPPAPI
+VOID
+NTAPI
+PhEnumNetworkItems(
+    _Out_opt_ PPH_NETWORK_ITEM **NetworkItems,
+    _Out_ PULONG NumberOfNetworkItems
+    );
 // end_phapppub
 
 PPH_STRING PhGetHostNameFromAddress(
     _In_ PPH_IP_ADDRESS Address
     );
 
+VOID PhPrefetchNetworkImports(
+    VOID
+    );
+
 VOID PhNetworkProviderUpdate(
     _In_ PVOID Object
     );
 
+PVOID PhQueryNetworkTable(
+    _In_ ULONG TableIndex,
+    _Out_ PULONG TableSize
+    );
+
 // begin_phapppub
 PHAPPAPI
 PWSTR
@@ -633,6 +1031,15 @@ typedef struct _PH_MODULE_PROVIDER
     PPH_STRING PackageFullName;
     SLIST_HEADER QueryListHead;
     NTSTATUS RunStatus;
+
+    SIZE_T LastVirtualSize;
+    ULONG SkippedUpdates;
+
+    LIST_ENTRY ListEntry;
+    LONG ImageEventPending;
+
+    ULONG LastKernelModuleCount;
+    ULONG LastKernelModulesChecksum;
 } PH_MODULE_PROVIDER, *PPH_MODULE_PROVIDER;
 // end_phapppub
 
@@ -661,6 +1068,10 @@ VOID PhModuleProviderUpdate(
     _In_ PVOID Object
     );
 
+VOID PhHintModuleProviders(
+    _In_ HANDLE ProcessId
+    );
+
 // thrdprv
 
 extern PPH_OBJECT_TYPE PhThreadProviderType;
@@ -724,6 +1135,10 @@ typedef struct _PH_THREAD_PROVIDER
     LONG SymbolsLoading;
     ULONG64 RunId;
     ULONG64 SymbolsLoadedRunId;
+    PPH_WORK_QUEUE_CANCEL_TOKEN CancelToken;
+
+    BOOLEAN Disabled;
+    BOOLEAN RebaseDeltas; // the next update starts new deltas instead of reporting the time spent disabled
 } PH_THREAD_PROVIDER, *PPH_THREAD_PROVIDER;
 // end_phapppub
 
@@ -745,6 +1160,11 @@ VOID PhUnregisterThreadProvider(
     _In_ PPH_CALLBACK_REGISTRATION CallbackRegistration
     );
 
+VOID PhSetEnabledThreadProvider(
+    _Inout_ PPH_THREAD_PROVIDER ThreadProvider,
+    _In_ BOOLEAN Enabled
+    );
+
 VOID PhSetTerminatingThreadProvider(
     _Inout_ PPH_THREAD_PROVIDER ThreadProvider
     );
@@ -753,6 +1173,14 @@ VOID PhLoadSymbolsThreadProvider(
     _In_ PPH_THREAD_PROVIDER ThreadProvider
     );
 
+VOID PhPrefetchSymbolsThreadProvider(
+    _In_ PPH_THREAD_PROVIDER ThreadProvider
+    );
+
+VOID PhPrefetchCommonModuleSymbols(
+    VOID
+    );
+
 PPH_THREAD_ITEM PhCreateThreadItem(
     _In_ HANDLE ThreadId
     );
@@ -807,6 +1235,8 @@ typedef struct _PH_HANDLE_ITEM
     WCHAR HandleString[PH_PTR_STR_LEN_1];
     WCHAR ObjectString[PH_PTR_STR_LEN_1];
     WCHAR GrantedAccessString[PH_PTR_STR_LEN_1];
+
+    ULONG ObjectTypeIndex;
 } PH_HANDLE_ITEM, *PPH_HANDLE_ITEM;
 
 typedef struct _PH_HANDLE_PROVIDER
@@ -826,6 +1256,10 @@ typedef struct _PH_HANDLE_PROVIDER
 
     PPH_HASHTABLE TempListHashtable;
     NTSTATUS RunStatus;
+
+    ULONG RunCount;
+    PH_QUEUED_LOCK NameCacheLock;
+    PPH_HASHTABLE NameCacheHashtable;
 } PH_HANDLE_PROVIDER, *PPH_HANDLE_PROVIDER;
 // end_phapppub
 
@@ -850,6 +1284,60 @@ VOID PhDereferenceAllHandleItems(
     _In_ PPH_HANDLE_PROVIDER HandleProvider
     );
 
+typedef struct _PH_HANDLE_SNAPSHOT_PROCESS
+{
+    HANDLE ProcessId;
+    ULONG Start;
+    ULONG Count;
+} PH_HANDLE_SNAPSHOT_PROCESS, *PPH_HANDLE_SNAPSHOT_PROCESS;
+
+typedef struct _PH_HANDLE_SNAPSHOT
+{
+    ULONG64 TickCount;
+    /** The system handle table, with the handles of each process next to each other. */
+    PSYSTEM_HANDLE_INFORMATION_EX Information;
+    /** A hashtable of PH_HANDLE_SNAPSHOT_PROCESS entries. */
+    PPH_HASHTABLE ProcessTable;
+} PH_HANDLE_SNAPSHOT, *PPH_HANDLE_SNAPSHOT;
+
+NTSTATUS PhReferenceHandleSnapshot(
+    _Out_ PPH_HANDLE_SNAPSHOT *Snapshot
+    );
+
+PSYSTEM_HANDLE_TABLE_ENTRY_INFO_EX PhGetProcessHandlesHandleSnapshot(
+    _In_ PPH_HANDLE_SNAPSHOT Snapshot,
+    _In_ HANDLE ProcessId,
+    _Out_ PULONG NumberOfHandles
+    );
+
+typedef struct _PH_HANDLE_STATISTICS
+{
+    /** The number of object type indices that are counted. */
+    ULONG NumberOfTypes;
+    /** The number of handles of each object type in the system. */
+    PULONG SystemCounts;
+    /** A simple hashtable which maps process IDs to arrays of handle counts, indexed by object type index. */
+    PPH_HASHTABLE ProcessTable;
+    PULONG Buffer;
+} PH_HANDLE_STATISTICS, *PPH_HANDLE_STATISTICS;
+
+VOID PhSetEnabledHandleStatistics(
+    _In_ BOOLEAN Enabled
+    );
+
+VOID PhUpdateHandleStatistics(
+    VOID
+    );
+
+PPH_HANDLE_STATISTICS PhReferenceHandleStatistics(
+    VOID
+    );
+
+PULONG PhGetProcessCountsHandleStatistics(
+    _In_ PPH_HANDLE_STATISTICS Statistics,
+    _In_ HANDLE ProcessId
+    );
+
 NTSTATUS PhEnumHandlesGeneric(
     _In_ HANDLE ProcessId,
     _In_ HANDLE ProcessHandle,
@@ -1007,4 +1495,26 @@ PhQueryMemoryItemList(
     );
 // end_phapppub
 
+// provrply
+
+// Replaces the system queries made by the process, handle and network providers. This is
+// only used to replay recorded data.
+typedef struct _PH_PROVIDER_DATA_SOURCE
+{
+    // Same as PhUpdateProcessSnapshot.
+    NTSTATUS (NTAPI *QueryProcesses)(
+        _Out_ PVOID *Processes
+        );
+    // The caller frees the buffer using PhFree().
+    NTSTATUS (NTAPI *QueryHandles)(
+        _Out_ PSYSTEM_HANDLE_INFORMATION_EX *Handles
+        );
+    // The table is owned by the data source and must not be modified.
+    PVOID (NTAPI *QueryNetworkTable)(
+        _In_ ULONG TableIndex
+        );
+} PH_PROVIDER_DATA_SOURCE, *PPH_PROVIDER_DATA_SOURCE;
+
+extern PPH_PROVIDER_DATA_SOURCE PhProviderDataSource;
+
 #endif
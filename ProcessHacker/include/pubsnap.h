@@ -0,0 +1,61 @@
+#ifndef PH_PUBSNAP_H
+#define PH_PUBSNAP_H
+
+// When the EnableSnapshotPublication setting is on, the process provider copies its per-process
+// statistics into a section named Local\ProcessHackerSnapshot after every update. The layout
+// below only uses Windows types so that other programs can include this header.
+//
+// The header is protected by a sequence lock. The sequence number is odd while the table is
+// being written. To read a consistent snapshot:
+//
+//   do
+//   {
+//       sequence = Snapshot->Sequence;
+//       MemoryBarrier();
+//       ... copy what you need ...
+//       MemoryBarrier();
+//   } while ((sequence & 1) || Snapshot->Sequence != sequence);
+
+#define PH_SNAPSHOT_SECTION_NAME L"Local\\ProcessHackerSnapshot"
+#define PH_SNAPSHOT_VERSION 1
+#define PH_SNAPSHOT_MAXIMUM_PROCESSES 4096
+#define PH_SNAPSHOT_NAME_LENGTH 64
+
+typedef struct _PH_SNAPSHOT_PROCESS
+{
+    ULONG ProcessId;
+    ULONG ParentProcessId;
+    LARGE_INTEGER CreateTime;
+    WCHAR Name[PH_SNAPSHOT_NAME_LENGTH]; // null-terminated, truncated if necessary
+
+    FLOAT CpuUsage; // 0 to 1, cycle-based where available
+    FLOAT CpuKernelUsage;
+    FLOAT CpuUserUsage;
+    ULONG NumberOfThreads;
+    ULONG64 CycleTimeDelta;
+    ULONG64 IoReadDelta; // bytes since the previous update
+    ULONG64 IoWriteDelta;
+    ULONG64 IoOtherDelta;
+    ULONG64 PrivateBytes;
+    ULONG64 WorkingSetSize;
+    ULONG NumberOfHandles;
+    ULONG SessionId;
+} PH_SNAPSHOT_PROCESS, *PPH_SNAPSHOT_PROCESS;
+
+typedef struct _PH_SNAPSHOT_HEADER
+{
+    ULONG Version;
+    ULONG HeaderSize;
+    ULONG EntrySize;
+    ULONG MaximumEntries;
+    volatile LONG Sequence;
+    ULONG NumberOfEntries;
+    LARGE_INTEGER Time; // time of the update, as FILETIME
+    ULONG UpdateInterval; // milliseconds
+    FLOAT CpuKernelUsage;
+    FLOAT CpuUserUsage;
+    ULONG Reserved;
+    PH_SNAPSHOT_PROCESS Entries[PH_SNAPSHOT_MAXIMUM_PROCESSES];
+} PH_SNAPSHOT_HEADER, *PPH_SNAPSHOT_HEADER;
+
+#endif
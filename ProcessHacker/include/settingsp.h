@@ -3,6 +3,31 @@
 
 #include <shlobj.h>
 
+// The settings cache is a binary copy of the settings file. It is only used if the settings file
+// has not been modified since the cache was written.
+
+#define PH_SETTINGS_CACHE_SUFFIX L".cache"
+#define PH_SETTINGS_CACHE_MAGIC ('cShP')
+#define PH_SETTINGS_CACHE_VERSION 1
+
+typedef struct _PH_SETTINGS_CACHE_HEADER
+{
+    ULONG Magic;
+    ULONG Version;
+    LARGE_INTEGER XmlLastWriteTime;
+    LARGE_INTEGER XmlEndOfFile;
+    ULONG NumberOfEntries;
+    ULONG Reserved;
+} PH_SETTINGS_CACHE_HEADER, *PPH_SETTINGS_CACHE_HEADER;
+
+// Each entry is followed by the name and the value, and is padded to a multiple of 4 bytes.
+typedef struct _PH_SETTINGS_CACHE_ENTRY
+{
+    USHORT NameLength; // in bytes
+    USHORT Reserved;
+    ULONG ValueLength; // in bytes
+} PH_SETTINGS_CACHE_ENTRY, *PPH_SETTINGS_CACHE_ENTRY;
+
 BOOLEAN NTAPI PhpSettingsHashtableCompareFunction(
     _In_ PVOID Entry1,
     _In_ PVOID Entry2
@@ -39,4 +64,24 @@ PVOID PhpLookupSetting(
     _In_ PPH_STRINGREF Name
     );
 
+BOOLEAN PhpIsStringSettingEqual(
+    _In_ PPH_SETTING Setting,
+    _In_ PPH_STRINGREF Value
+    );
+
+VOID PhpLoadSetting(
+    _In_ PPH_STRINGREF Name,
+    _In_ PPH_STRING Value
+    );
+
+BOOLEAN PhpLoadSettingsCache(
+    _In_ PWSTR FileName,
+    _In_ PFILE_NETWORK_OPEN_INFORMATION FileInformation
+    );
+
+VOID PhpSaveSettingsCache(
+    _In_ PWSTR FileName,
+    _In_ PFILE_NETWORK_OPEN_INFORMATION FileInformation
+    );
+
 #endif
@@ -12,6 +12,8 @@
 #define PH_SYSINFO_SEPARATOR_WIDTH 2
 
 #define PH_SYSINFO_CPU_PADDING 5
+#define PH_SYSINFO_CPU_HEATMAP_THRESHOLD 32 // use a heatmap instead of one graph per CPU above this
+#define PH_SYSINFO_CPU_HEATMAP_CELL_WIDTH 4
 #define PH_SYSINFO_MEMORY_PADDING 3
 
 #define SI_MSG_SYSINFO_FIRST (WM_APP + 150)
@@ -273,6 +275,27 @@ VOID PhSipNotifyCpuGraph(
     _In_ NMHDR *Header
     );
 
+VOID PhSipInitializeCpuHeatmap(
+    VOID
+    );
+
+VOID PhSipNotifyCpuHeatmap(
+    _In_ NMHDR *Header
+    );
+
+VOID PhSipDrawCpuHeatmap(
+    _In_ HDC hdc,
+    _In_ PRECT Rect,
+    _In_ ULONG NumberOfColumns,
+    _In_ COLORREF BackColor
+    );
+
+COLORREF PhSipBlendColor(
+    _In_ COLORREF Color1,
+    _In_ COLORREF Color2,
+    _In_ FLOAT Fraction
+    );
+
 VOID PhSipUpdateCpuGraphs(
     VOID
     );
@@ -107,6 +107,24 @@ FORCEINLINE VOID PhChangeShStateTn(
         } \
     } while (0)
 
+// Cell text cache support
+
+// The text of a numeric cell along with the value and format it was created from, so that
+// the text is only recreated when the value changes (see PhFormatSizeCached).
+typedef struct _PH_CACHED_FORMAT
+{
+    ULONG64 Value;
+    ULONG Format;
+    PPH_STRING Text;
+} PH_CACHED_FORMAT, *PPH_CACHED_FORMAT;
+
+FORCEINLINE VOID PhDeleteCachedFormat(
+    _Inout_ PPH_CACHED_FORMAT Cache
+    )
+{
+    PhClearReference(&Cache->Text);
+}
+
 // proctree
 
 // Columns
@@ -192,9 +210,20 @@ FORCEINLINE VOID PhChangeShStateTn(
 #define PHPRTLC_APPID 73
 #define PHPRTLC_DPIAWARENESS 74
 #define PHPRTLC_CFGUARD 75
-
-#define PHPRTLC_MAXIMUM 76
+#define PHPRTLC_FILEHANDLES 76
+#define PHPRTLC_KEYHANDLES 77
+#define PHPRTLC_EVENTHANDLES 78
+#define PHPRTLC_SECTIONHANDLES 79
+#define PHPRTLC_THREADHANDLES 80
+#define PHPRTLC_PROCESSHANDLES 81
+
+#define PHPRTLC_MAXIMUM 82
 #define PHPRTLC_IOGROUP_COUNT 9
+#define PHPRTLC_HANDLETYPES_COUNT 6
+
+// Number of plugin columns whose text can be cached by the tree (see PhPluginAddTreeNewColumn).
+#define PHPRTLC_PLUGIN_CACHE_COUNT 32
+#define PHPRTLC_TEXT_CACHE_SIZE (PHPRTLC_MAXIMUM + PHPRTLC_PLUGIN_CACHE_COUNT)
 
 #define PHPN_WSCOUNTERS 0x1
 #define PHPN_GDIUSERHANDLES 0x2
@@ -207,6 +236,29 @@ FORCEINLINE VOID PhChangeShStateTn(
 #define PHPN_IMAGE 0x100
 #define PHPN_APPID 0x200
 #define PHPN_DPIAWARENESS 0x400
+#define PHPN_HANDLETYPES 0x800
+
+// Items that always remain valid.
+#define PHPN_PERMANENT_MASK (PHPN_OSCONTEXT | PHPN_IMAGE | PHPN_DPIAWARENESS)
+// Items that are expensive to query and rarely change. These are only invalidated every
+// PHPN_SLOW_REFRESH_TICKS ticks.
+#define PHPN_SLOW_MASK (PHPN_DEPSTATUS | PHPN_TOKEN | PHPN_QUOTALIMITS | PHPN_APPID)
+#define PHPN_SLOW_REFRESH_TICKS 5
+
+// Sums of the aggregated process item fields over a node and its descendants.
+typedef struct _PH_PROCESS_NODE_AGGREGATES
+{
+    FLOAT CpuUsage;
+    ULONG NumberOfThreads;
+    ULONG NumberOfHandles;
+    SIZE_T PagefileUsage;
+    SIZE_T WorkingSetSize;
+    ULONG64 IoReadDelta;
+    ULONG64 IoWriteDelta;
+    ULONG64 IoOtherDelta;
+    ULONG64 CycleTime;
+    ULONG64 CycleTimeDelta;
+} PH_PROCESS_NODE_AGGREGATES, *PPH_PROCESS_NODE_AGGREGATES;
 
 // begin_phapppub
 typedef struct _PH_PROCESS_NODE
@@ -224,13 +276,20 @@ typedef struct _PH_PROCESS_NODE
     PPH_LIST Children;
 // end_phapppub
 
-    PH_STRINGREF TextCache[PHPRTLC_MAXIMUM];
+    // Positions of the node in the list of all nodes and in its parent's children (or the root
+    // list), so that the node can be removed without searching.
+    ULONG ListIndex;
+    ULONG SiblingIndex;
+
+    PH_STRINGREF TextCache[PHPRTLC_TEXT_CACHE_SIZE];
 
     PH_STRINGREF DescriptionText;
 
     // If the user has selected certain columns we need extra information
     // that isn't retrieved by the process provider.
     ULONG ValidMask;
+    // The process item sequence number at the last tick.
+    ULONG TickSequenceNumber;
 
     // WS counters
     PH_PROCESS_WS_COUNTERS WsCounters;
@@ -266,28 +325,42 @@ typedef struct _PH_PROCESS_NODE
     PH_UINT64_DELTA CyclesDelta;
     // DPI Awareness
     ULONG DpiAwareness;
+    // Handle types
+    ULONG HandleTypeCounts[PHPRTLC_HANDLETYPES_COUNT];
 
     PPH_STRING TooltipText;
     ULONG TooltipTextValidToTickCount;
+    ULONG TooltipKey; // see PhGetProcessTooltipKey
+
+    // Natural sort keys, created when the column is first sorted
+    PPH_BYTES NameSortKey;
+    PPH_BYTES FileNameSortKey;
+
+    // Whether pending queries for this process have been moved to the priority lane.
+    BOOLEAN QueryPrioritized;
+
+    // Recomputed on each tick and adjusted when nodes are linked or unlinked.
+    PH_PROCESS_NODE_AGGREGATES Aggregates;
 
     // Text buffers
     WCHAR CpuUsageText[PH_INT32_STR_LEN_1];
     PPH_STRING IoTotalRateText;
-    PPH_STRING PrivateBytesText;
-    PPH_STRING PeakPrivateBytesText;
-    PPH_STRING WorkingSetText;
-    PPH_STRING PeakWorkingSetText;
-    PPH_STRING PrivateWsText;
-    PPH_STRING SharedWsText;
-    PPH_STRING ShareableWsText;
-    PPH_STRING VirtualSizeText;
-    PPH_STRING PeakVirtualSizeText;
-    PPH_STRING PageFaultsText;
+    PH_CACHED_FORMAT PrivateBytesText;
+    PH_CACHED_FORMAT PeakPrivateBytesText;
+    PH_CACHED_FORMAT WorkingSetText;
+    PH_CACHED_FORMAT PeakWorkingSetText;
+    PH_CACHED_FORMAT PrivateWsText;
+    PH_CACHED_FORMAT SharedWsText;
+    PH_CACHED_FORMAT ShareableWsText;
+    PH_CACHED_FORMAT VirtualSizeText;
+    PH_CACHED_FORMAT PeakVirtualSizeText;
+    PH_CACHED_FORMAT PageFaultsText;
     WCHAR BasePriorityText[PH_INT32_STR_LEN_1];
     WCHAR ThreadsText[PH_INT32_STR_LEN_1 + 3];
     WCHAR HandlesText[PH_INT32_STR_LEN_1 + 3];
     WCHAR GdiHandlesText[PH_INT32_STR_LEN_1 + 3];
     WCHAR UserHandlesText[PH_INT32_STR_LEN_1 + 3];
+    WCHAR HandleTypeCountsText[PHPRTLC_HANDLETYPES_COUNT][PH_INT32_STR_LEN_1 + 3];
     PPH_STRING IoRoRateText;
     PPH_STRING IoWRateText;
     WCHAR PagePriorityText[PH_INT32_STR_LEN_1];
@@ -299,16 +372,16 @@ typedef struct _PH_PROCESS_NODE
     PPH_STRING WindowTitleText;
     PPH_STRING CyclesText;
     PPH_STRING CyclesDeltaText;
-    PPH_STRING ContextSwitchesText;
-    PPH_STRING ContextSwitchesDeltaText;
-    PPH_STRING PageFaultsDeltaText;
-    PPH_STRING IoGroupText[PHPRTLC_IOGROUP_COUNT];
-    PPH_STRING PagedPoolText;
-    PPH_STRING PeakPagedPoolText;
-    PPH_STRING NonPagedPoolText;
-    PPH_STRING PeakNonPagedPoolText;
-    PPH_STRING MinimumWorkingSetText;
-    PPH_STRING MaximumWorkingSetText;
+    PH_CACHED_FORMAT ContextSwitchesText;
+    PH_CACHED_FORMAT ContextSwitchesDeltaText;
+    PH_CACHED_FORMAT PageFaultsDeltaText;
+    PH_CACHED_FORMAT IoGroupText[PHPRTLC_IOGROUP_COUNT];
+    PH_CACHED_FORMAT PagedPoolText;
+    PH_CACHED_FORMAT PeakPagedPoolText;
+    PH_CACHED_FORMAT NonPagedPoolText;
+    PH_CACHED_FORMAT PeakNonPagedPoolText;
+    PH_CACHED_FORMAT MinimumWorkingSetText;
+    PH_CACHED_FORMAT MaximumWorkingSetText;
     PPH_STRING PrivateBytesDeltaText;
 
     // Graph buffers
@@ -353,6 +426,13 @@ PPH_PROCESS_NODE PhAddProcessNode(
     _In_ ULONG RunId
     );
 
+VOID PhAddProcessNodes(
+    _In_reads_(NumberOfProcessItems) PPH_PROCESS_ITEM *ProcessItems,
+    _In_ ULONG NumberOfProcessItems,
+    _In_ ULONG RunId,
+    _Out_writes_(NumberOfProcessItems) PPH_PROCESS_NODE *ProcessNodes
+    );
+
 // begin_phapppub
 PHAPPAPI
 PPH_PROCESS_NODE
@@ -375,6 +455,15 @@ PhUpdateProcessNode(
     );
 // end_phapppub
 
+VOID PhUpdateProcessNodeEx(
+    _In_ PPH_PROCESS_NODE ProcessNode,
+    _In_ BOOLEAN InvalidateTooltip
+    );
+
+VOID PhInvalidateProcessNodeTooltip(
+    _In_ PPH_PROCESS_ITEM ProcessItem
+    );
+
 VOID PhTickProcessNodes(
     VOID
     );
@@ -480,6 +569,8 @@ typedef struct _PH_SERVICE_NODE
     PPH_SERVICE_ITEM ServiceItem;
 // end_phapppub
 
+    ULONG ListIndex; // position in the list of all nodes
+
     PH_STRINGREF TextCache[PHSVTLC_MAXIMUM];
 
     ULONG ValidMask;
@@ -617,6 +708,8 @@ typedef struct _PH_NETWORK_NODE
     PPH_NETWORK_ITEM NetworkItem;
 // end_phapppub
 
+    ULONG ListIndex; // position in the list of all nodes
+
     PH_STRINGREF TextCache[PHNETLC_MAXIMUM];
 
     LONG UniqueId;
@@ -736,7 +829,7 @@ typedef struct _PH_THREAD_NODE
     ULONG ValidMask;
 
     WCHAR CpuUsageText[PH_INT32_STR_LEN_1];
-    PPH_STRING CyclesDeltaText; // used for Context Switches Delta as well
+    PH_CACHED_FORMAT CyclesDeltaText; // used for Context Switches Delta as well
     PPH_STRING StartAddressText;
     PPH_STRING PriorityText;
 // begin_phapppub
@@ -858,7 +951,7 @@ typedef struct _PH_MODULE_NODE
 
     PPH_STRING TooltipText;
 
-    PPH_STRING SizeText;
+    PH_CACHED_FORMAT SizeText;
     WCHAR LoadCountText[PH_INT32_STR_LEN_1];
     PPH_STRING TimeStampText;
     PPH_STRING LoadTimeText;
@@ -37,7 +37,35 @@ VOID PhpFillRunningTasks(
     _Inout_ PPH_STRING_BUILDER Tasks
     );
 
+// Tasks and UMDF drivers take a long time to enumerate, so we build these tooltip sections
+// on a worker thread and show the rest of the tooltip in the meantime. The sections are
+// cached per process and are only accessed on the main thread.
+
+#define PH_TOOLTIP_SECTION_VALID_FOR_MS (10 * 1000) // 10 seconds
+#define PH_TOOLTIP_SECTION_MAXIMUM_ENTRIES 64
+
+typedef struct _PH_TOOLTIP_SECTION
+{
+    HANDLE ProcessId;
+    LARGE_INTEGER CreateTime;
+    PPH_STRING Text; // NULL until the first query completes
+    ULONG ValidToTickCount;
+    BOOLEAN Querying;
+} PH_TOOLTIP_SECTION, *PPH_TOOLTIP_SECTION;
+
+typedef struct _PH_TOOLTIP_SECTION_QUERY
+{
+    PPH_PROCESS_ITEM Process;
+    PH_KNOWN_PROCESS_TYPE KnownProcessType;
+    PPH_STRING Text;
+} PH_TOOLTIP_SECTION_QUERY, *PPH_TOOLTIP_SECTION_QUERY;
+
+VOID PhpTooltipSectionQueryCompleted(
+    _In_ PVOID Parameter
+    );
+
 static PH_STRINGREF StandardIndent = PH_STRINGREF_INIT(L"    ");
+static PPH_HASHTABLE PhpTooltipSectionHashtable = NULL;
 
 VOID PhpAppendStringWithLineBreaks(
     _Inout_ PPH_STRING_BUILDER StringBuilder,
@@ -87,6 +115,213 @@ static int __cdecl ServiceForTooltipCompare(
     return PhCompareString(serviceItem1->Name, serviceItem2->Name, TRUE);
 }
 
+BOOLEAN NTAPI PhpTooltipSectionHashtableCompareFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    )
+{
+    PPH_TOOLTIP_SECTION section1 = Entry1;
+    PPH_TOOLTIP_SECTION section2 = Entry2;
+
+    return section1->ProcessId == section2->ProcessId &&
+        section1->CreateTime.QuadPart == section2->CreateTime.QuadPart;
+}
+
+ULONG NTAPI PhpTooltipSectionHashtableHashFunction(
+    _In_ PVOID Entry
+    )
+{
+    return PhHashIntPtr((ULONG_PTR)((PPH_TOOLTIP_SECTION)Entry)->ProcessId);
+}
+
+NTSTATUS PhpTooltipSectionQueryWorker(
+    _In_ PVOID Parameter
+    )
+{
+    PPH_TOOLTIP_SECTION_QUERY query = Parameter;
+    PH_STRING_BUILDER stringBuilder;
+    BOOLEAN comInitialized;
+
+    comInitialized = SUCCEEDED(CoInitializeEx(NULL, COINIT_MULTITHREADED));
+
+    PhInitializeStringBuilder(&stringBuilder, 100);
+
+    switch (query->KnownProcessType & KnownProcessTypeMask)
+    {
+    case TaskHostProcessType:
+        PhpFillRunningTasks(query->Process, &stringBuilder);
+        break;
+    case UmdfHostProcessType:
+        PhpFillUmdfDrivers(query->Process, &stringBuilder);
+        break;
+    }
+
+    query->Text = PhFinalStringBuilderString(&stringBuilder);
+
+    if (comInitialized)
+        CoUninitialize();
+
+    ProcessHacker_Invoke(PhMainWndHandle, PhpTooltipSectionQueryCompleted, query);
+
+    return STATUS_SUCCESS;
+}
+
+VOID PhpTooltipSectionQueryCompleted(
+    _In_ PVOID Parameter
+    )
+{
+    PPH_TOOLTIP_SECTION_QUERY query = Parameter;
+    PH_TOOLTIP_SECTION lookupSection;
+    PPH_TOOLTIP_SECTION section;
+
+    lookupSection.ProcessId = query->Process->ProcessId;
+    lookupSection.CreateTime = query->Process->CreateTime;
+
+    // The entry may have been trimmed while we were querying.
+    if (section = PhFindEntryHashtable(PhpTooltipSectionHashtable, &lookupSection))
+    {
+        PhMoveReference(&section->Text, query->Text);
+        section->ValidToTickCount = GetTickCount() + PH_TOOLTIP_SECTION_VALID_FOR_MS;
+        section->Querying = FALSE;
+
+        PhInvalidateProcessNodeTooltip(query->Process);
+    }
+    else
+    {
+        PhDereferenceObject(query->Text);
+    }
+
+    PhDereferenceObject(query->Process);
+    PhFree(query);
+}
+
+static VOID PhpTrimTooltipSections(
+    VOID
+    )
+{
+    PPH_LIST staleSections;
+    ULONG enumerationKey = 0;
+    PPH_TOOLTIP_SECTION section;
+    ULONG i;
+
+    // Remove every section that isn't being queried. We can't remove entries while
+    // enumerating the hashtable, so collect them first.
+
+    staleSections = PhCreateList(PhpTooltipSectionHashtable->Count);
+
+    while (PhEnumHashtable(PhpTooltipSectionHashtable, &section, &enumerationKey))
+    {
+        if (!section->Querying)
+            PhAddItemList(staleSections, section);
+    }
+
+    for (i = 0; i < staleSections->Count; i++)
+    {
+        PH_TOOLTIP_SECTION removedSection = *(PPH_TOOLTIP_SECTION)staleSections->Items[i];
+
+        PhRemoveEntryHashtable(PhpTooltipSectionHashtable, &removedSection);
+        PhClearReference(&removedSection.Text);
+    }
+
+    PhDereferenceObject(staleSections);
+}
+
+/**
+ * Gets a tooltip section that is built in the background.
+ *
+ * \param Process The process.
+ * \param KnownProcessType The known type of the process, which selects the section.
+ *
+ * \return The text of the section, or NULL if it is still being built. The text is
+ * owned by the cache and is only valid until the next call.
+ */
+static PPH_STRING PhpGetDeferredTooltipSection(
+    _In_ PPH_PROCESS_ITEM Process,
+    _In_ PH_KNOWN_PROCESS_TYPE KnownProcessType
+    )
+{
+    PH_TOOLTIP_SECTION lookupSection;
+    PPH_TOOLTIP_SECTION section;
+    BOOLEAN added;
+
+    if (!PhpTooltipSectionHashtable)
+    {
+        PhpTooltipSectionHashtable = PhCreateHashtable(
+            sizeof(PH_TOOLTIP_SECTION),
+            PhpTooltipSectionHashtableCompareFunction,
+            PhpTooltipSectionHashtableHashFunction,
+            16
+            );
+    }
+
+    lookupSection.ProcessId = Process->ProcessId;
+    lookupSection.CreateTime = Process->CreateTime;
+    lookupSection.Text = NULL;
+    lookupSection.ValidToTickCount = 0;
+    lookupSection.Querying = FALSE;
+
+    if (!PhFindEntryHashtable(PhpTooltipSectionHashtable, &lookupSection) &&
+        PhpTooltipSectionHashtable->Count >= PH_TOOLTIP_SECTION_MAXIMUM_ENTRIES)
+    {
+        PhpTrimTooltipSections();
+    }
+
+    section = PhAddEntryHashtableEx(PhpTooltipSectionHashtable, &lookupSection, &added);
+
+    // Keep showing the old text while it is being refreshed.
+    if (!section->Querying && (added || (LONG)(section->ValidToTickCount - GetTickCount()) < 0))
+    {
+        PPH_TOOLTIP_SECTION_QUERY query;
+
+        query = PhAllocate(sizeof(PH_TOOLTIP_SECTION_QUERY));
+        query->Process = Process;
+        PhReferenceObject(Process);
+        query->KnownProcessType = KnownProcessType;
+        query->Text = NULL;
+
+        section->Querying = TRUE;
+        PhQueueItemWorkQueue(PhGetGlobalWorkQueue(), PhpTooltipSectionQueryWorker, query);
+    }
+
+    return section->Text;
+}
+
+/**
+ * Computes a value that changes when any of the process item fields used by
+ * PhGetProcessTooltipText() changes.
+ *
+ * \param Process The process.
+ *
+ * \remarks This allows callers to keep a tooltip across updates that only change
+ * statistics.
+ */
+ULONG PhGetProcessTooltipKey(
+    _In_ PPH_PROCESS_ITEM Process
+    )
+{
+    ULONG key;
+
+    key = PhHashIntPtr((ULONG_PTR)Process->CommandLine);
+    key ^= PhHashIntPtr((ULONG_PTR)Process->QueryHandle) * 3;
+    key ^= PhHashIntPtr((ULONG_PTR)Process->ConsoleHostProcessId) * 5;
+    key ^= PhHashIntPtr((ULONG_PTR)Process->PackageFullName) * 7;
+    key ^= PhHashIntPtr((ULONG_PTR)Process->VerifySignerName) * 11;
+    key ^= PhHashInt32(Process->VerifyResult) * 13;
+    key ^= PhHashInt32(Process->ImportFunctions) * 17;
+    key ^= PhHashInt32(Process->ServiceList ? Process->ServiceList->Count : 0) * 19;
+    key ^= PhHashInt32(
+        (Process->IsDotNet << 0) |
+        (Process->IsElevated << 1) |
+        (Process->IsImmersive << 2) |
+        (Process->IsInJob << 3) |
+        (Process->IsPacked << 4) |
+        (Process->IsPosix << 5) |
+        (Process->IsWow64 << 6)
+        ) * 23;
+
+    return key;
+}
+
 PPH_STRING PhGetProcessTooltipText(
     _In_ PPH_PROCESS_ITEM Process,
     _Out_opt_ PULONG ValidToTickCount
@@ -158,9 +393,9 @@ PPH_STRING PhGetProcessTooltipText(
                 {
                     PH_IMAGE_VERSION_INFO versionInfo;
 
-                    if (PhInitializeImageVersionInfo(
+                    if (PhInitializeImageVersionInfoCached(
                         &versionInfo,
-                        knownCommandLine.RunDllAsApp.FileName->Buffer
+                        knownCommandLine.RunDllAsApp.FileName
                         ))
                     {
                         tempString = PhFormatImageVersionInfo(
@@ -206,9 +441,9 @@ PPH_STRING PhGetProcessTooltipText(
                         PhAppendCharStringBuilder(&stringBuilder, '\n');
                     }
 
-                    if (knownCommandLine.ComSurrogate.FileName && PhInitializeImageVersionInfo(
+                    if (knownCommandLine.ComSurrogate.FileName && PhInitializeImageVersionInfoCached(
                         &versionInfo,
-                        knownCommandLine.ComSurrogate.FileName->Buffer
+                        knownCommandLine.ComSurrogate.FileName
                         ))
                     {
                         tempString = PhFormatImageVersionInfo(
@@ -287,39 +522,26 @@ PPH_STRING PhGetProcessTooltipText(
     switch (knownProcessType & KnownProcessTypeMask)
     {
     case TaskHostProcessType:
-        {
-            PH_STRING_BUILDER tasks;
-
-            PhInitializeStringBuilder(&tasks, 40);
-
-            PhpFillRunningTasks(Process, &tasks);
-
-            if (tasks.String->Length != 0)
-            {
-                PhAppendStringBuilder2(&stringBuilder, L"Tasks:\n");
-                PhAppendStringBuilder(&stringBuilder, &tasks.String->sr);
-            }
-
-            PhDeleteStringBuilder(&tasks);
-        }
-        break;
     case UmdfHostProcessType:
         {
-            PH_STRING_BUILDER drivers;
-
-            PhInitializeStringBuilder(&drivers, 40);
+            PPH_STRING sectionText;
 
-            PhpFillUmdfDrivers(Process, &drivers);
+            sectionText = PhpGetDeferredTooltipSection(Process, knownProcessType);
 
-            if (drivers.String->Length != 0)
+            if (!sectionText || sectionText->Length != 0)
             {
-                PhAppendStringBuilder2(&stringBuilder, L"Drivers:\n");
-                PhAppendStringBuilder(&stringBuilder, &drivers.String->sr);
-            }
+                if ((knownProcessType & KnownProcessTypeMask) == TaskHostProcessType)
+                    PhAppendStringBuilder2(&stringBuilder, L"Tasks:\n");
+                else
+                    PhAppendStringBuilder2(&stringBuilder, L"Drivers:\n");
 
-            PhDeleteStringBuilder(&drivers);
+                if (sectionText)
+                    PhAppendStringBuilder(&stringBuilder, &sectionText->sr);
+                else
+                    PhAppendStringBuilder2(&stringBuilder, L"    Loading...\n");
+            }
 
-            validForMs = 10 * 1000; // 10 seconds
+            validForMs = PH_TOOLTIP_SECTION_VALID_FOR_MS;
         }
         break;
     }
@@ -341,8 +563,9 @@ PPH_STRING PhGetProcessTooltipText(
 
     {
         PH_STRING_BUILDER notes;
+        ULONG_PTR notesStorage[64];
 
-        PhInitializeStringBuilder(&notes, 40);
+        PhInitializeStringBuilderInline(&notes, notesStorage, sizeof(notesStorage));
 
         if (Process->FileName)
         {
@@ -0,0 +1,420 @@
+/*
+ * Process Hacker -
+ *   jobs viewer
+ *
+ * Copyright (C) 2016 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <phapp.h>
+
+#define MSG_UPDATE (WM_APP + 1)
+
+#define PHJLTLC_NAME 0
+#define PHJLTLC_PID 1
+#define PHJLTLC_PROCESSES 2
+#define PHJLTLC_CPU 3
+#define PHJLTLC_PRIVATEBYTES 4
+#define PHJLTLC_WORKINGSET 5
+#define PHJLTLC_MAXIMUM 6
+
+// Job nodes have the processes of the job as children. The tree is rebuilt from the job index
+// of the process provider after every update.
+typedef struct _PH_JOB_LIST_NODE
+{
+    PH_TREENEW_NODE Node;
+    PH_STRINGREF TextCache[PHJLTLC_MAXIMUM];
+
+    PPH_LIST Children; // job nodes only
+    HANDLE ProcessId; // process nodes only; for job nodes, the first process in the job
+
+    PPH_STRING Name;
+    ULONG NumberOfProcesses;
+    FLOAT CpuUsage;
+    SIZE_T PrivateBytes;
+    SIZE_T WorkingSetSize;
+
+    WCHAR PidString[PH_INT32_STR_LEN_1];
+    WCHAR ProcessesString[PH_INT32_STR_LEN_1];
+    PPH_STRING CpuText;
+    PPH_STRING PrivateBytesText;
+    PPH_STRING WorkingSetText;
+} PH_JOB_LIST_NODE, *PPH_JOB_LIST_NODE;
+
+typedef struct _PH_JOB_LIST_CONTEXT
+{
+    HWND WindowHandle;
+    HWND TreeNewHandle;
+    PH_CALLBACK_REGISTRATION ProcessesUpdatedRegistration;
+
+    PPH_LIST NodeList;
+    PPH_LIST RootList;
+} PH_JOB_LIST_CONTEXT, *PPH_JOB_LIST_CONTEXT;
+
+INT_PTR CALLBACK PhpJobListDlgProc(
+    _In_ HWND hwndDlg,
+    _In_ UINT uMsg,
+    _In_ WPARAM wParam,
+    _In_ LPARAM lParam
+    );
+
+VOID PhShowJobListDialog(
+    _In_ HWND ParentWindowHandle
+    )
+{
+    DialogBox(
+        PhInstanceHandle,
+        MAKEINTRESOURCE(IDD_JOBS),
+        ParentWindowHandle,
+        PhpJobListDlgProc
+        );
+}
+
+static VOID NTAPI ProcessesUpdatedCallback(
+    _In_opt_ PVOID Parameter,
+    _In_opt_ PVOID Context
+    )
+{
+    PPH_JOB_LIST_CONTEXT context = Context;
+
+    PostMessage(context->WindowHandle, MSG_UPDATE, 0, 0);
+}
+
+static PPH_JOB_LIST_NODE PhpCreateJobListNode(
+    _In_ PPH_JOB_LIST_CONTEXT Context
+    )
+{
+    PPH_JOB_LIST_NODE node;
+
+    node = PhAllocate(sizeof(PH_JOB_LIST_NODE));
+    memset(node, 0, sizeof(PH_JOB_LIST_NODE));
+    PhInitializeTreeNewNode(&node->Node);
+
+    node->Node.TextCache = node->TextCache;
+    node->Node.TextCacheSize = PHJLTLC_MAXIMUM;
+
+    PhAddItemList(Context->NodeList, node);
+
+    return node;
+}
+
+static VOID PhpDestroyJobListNode(
+    _In_ PPH_JOB_LIST_NODE Node
+    )
+{
+    if (Node->Children) PhDereferenceObject(Node->Children);
+    PhClearReference(&Node->Name);
+    PhClearReference(&Node->CpuText);
+    PhClearReference(&Node->PrivateBytesText);
+    PhClearReference(&Node->WorkingSetText);
+
+    PhFree(Node);
+}
+
+static VOID PhpClearJobListNodes(
+    _In_ PPH_JOB_LIST_CONTEXT Context
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < Context->NodeList->Count; i++)
+        PhpDestroyJobListNode(Context->NodeList->Items[i]);
+
+    PhClearList(Context->NodeList);
+    PhClearList(Context->RootList);
+}
+
+static VOID PhpRefreshJobList(
+    _In_ PPH_JOB_LIST_CONTEXT Context
+    )
+{
+    PPH_PROCESS_JOB *jobs;
+    ULONG numberOfJobs;
+    PPH_LIST collapsedList;
+    ULONG i;
+    ULONG j;
+
+    // Jobs are recreated on every update, so we remember collapsed jobs by their first
+    // process.
+    collapsedList = PhCreateList(4);
+
+    for (i = 0; i < Context->RootList->Count; i++)
+    {
+        PPH_JOB_LIST_NODE node = Context->RootList->Items[i];
+
+        if (!node->Node.Expanded)
+            PhAddItemList(collapsedList, node->ProcessId);
+    }
+
+    PhpClearJobListNodes(Context);
+
+    PhEnumProcessJobs(&jobs, &numberOfJobs);
+
+    for (i = 0; i < numberOfJobs; i++)
+    {
+        PPH_PROCESS_JOB job = jobs[i];
+        PPH_JOB_LIST_NODE jobNode;
+
+        jobNode = PhpCreateJobListNode(Context);
+        jobNode->Children = PhCreateList(job->NumberOfProcesses);
+        jobNode->ProcessId = job->NumberOfProcesses != 0 ? job->ProcessIds[0] : NULL;
+        jobNode->NumberOfProcesses = job->NumberOfProcesses;
+        jobNode->CpuUsage = job->CpuUsage;
+        jobNode->PrivateBytes = job->PrivateBytes;
+        jobNode->WorkingSetSize = job->WorkingSetSize;
+
+        if (!PhIsNullOrEmptyString(job->JobName))
+            PhSetReference(&jobNode->Name, job->JobName);
+        else
+            jobNode->Name = PhCreateString(L"(unnamed job)");
+
+        jobNode->Node.Expanded = PhFindItemList(collapsedList, jobNode->ProcessId) == -1;
+
+        for (j = 0; j < job->NumberOfProcesses; j++)
+        {
+            PPH_JOB_LIST_NODE processNode;
+            PPH_PROCESS_ITEM processItem;
+
+            processNode = PhpCreateJobListNode(Context);
+            processNode->ProcessId = job->ProcessIds[j];
+
+            if (processItem = PhReferenceProcessItem(processNode->ProcessId))
+            {
+                PhSetReference(&processNode->Name, processItem->ProcessName);
+                processNode->CpuUsage = processItem->CpuUsage;
+                processNode->PrivateBytes = processItem->VmCounters.PagefileUsage;
+                processNode->WorkingSetSize = processItem->VmCounters.WorkingSetSize;
+                PhDereferenceObject(processItem);
+            }
+            else
+            {
+                processNode->Name = PhCreateString(L"Non-existent process");
+            }
+
+            PhAddItemList(jobNode->Children, processNode);
+        }
+
+        PhAddItemList(Context->RootList, jobNode);
+        PhDereferenceObject(job);
+    }
+
+    PhFree(jobs);
+    PhDereferenceObject(collapsedList);
+
+    TreeNew_NodesStructured(Context->TreeNewHandle);
+}
+
+BOOLEAN NTAPI PhpJobListTreeNewCallback(
+    _In_ HWND hwnd,
+    _In_ PH_TREENEW_MESSAGE Message,
+    _In_opt_ PVOID Parameter1,
+    _In_opt_ PVOID Parameter2,
+    _In_opt_ PVOID Context
+    )
+{
+    PPH_JOB_LIST_CONTEXT context = Context;
+    PPH_JOB_LIST_NODE node;
+
+    switch (Message)
+    {
+    case TreeNewGetChildren:
+        {
+            PPH_TREENEW_GET_CHILDREN getChildren = Parameter1;
+
+            node = (PPH_JOB_LIST_NODE)getChildren->Node;
+
+            if (!node)
+            {
+                getChildren->Children = (PPH_TREENEW_NODE *)context->RootList->Items;
+                getChildren->NumberOfChildren = context->RootList->Count;
+            }
+            else if (node->Children)
+            {
+                getChildren->Children = (PPH_TREENEW_NODE *)node->Children->Items;
+                getChildren->NumberOfChildren = node->Children->Count;
+            }
+        }
+        return TRUE;
+    case TreeNewIsLeaf:
+        {
+            PPH_TREENEW_IS_LEAF isLeaf = Parameter1;
+
+            node = (PPH_JOB_LIST_NODE)isLeaf->Node;
+            isLeaf->IsLeaf = !node->Children || node->Children->Count == 0;
+        }
+        return TRUE;
+    case TreeNewGetCellText:
+        {
+            PPH_TREENEW_GET_CELL_TEXT getCellText = Parameter1;
+
+            node = (PPH_JOB_LIST_NODE)getCellText->Node;
+
+            switch (getCellText->Id)
+            {
+            case PHJLTLC_NAME:
+                getCellText->Text = PhGetStringRef(node->Name);
+                break;
+            case PHJLTLC_PID:
+                if (!node->Children)
+                {
+                    PhPrintUInt32(node->PidString, HandleToUlong(node->ProcessId));
+                    PhInitializeStringRefLongHint(&getCellText->Text, node->PidString);
+                }
+                break;
+            case PHJLTLC_PROCESSES:
+                if (node->Children)
+                {
+                    PhPrintUInt32(node->ProcessesString, node->NumberOfProcesses);
+                    PhInitializeStringRefLongHint(&getCellText->Text, node->ProcessesString);
+                }
+                break;
+            case PHJLTLC_CPU:
+                if (node->CpuUsage >= 0.0001f)
+                {
+                    PhMoveReference(&node->CpuText, PhFormatString(L"%.2f", node->CpuUsage * 100));
+                    getCellText->Text = node->CpuText->sr;
+                }
+                break;
+            case PHJLTLC_PRIVATEBYTES:
+                if (node->PrivateBytes != 0)
+                {
+                    PhMoveReference(&node->PrivateBytesText, PhFormatSize(node->PrivateBytes, -1));
+                    getCellText->Text = node->PrivateBytesText->sr;
+                }
+                break;
+            case PHJLTLC_WORKINGSET:
+                if (node->WorkingSetSize != 0)
+                {
+                    PhMoveReference(&node->WorkingSetText, PhFormatSize(node->WorkingSetSize, -1));
+                    getCellText->Text = node->WorkingSetText->sr;
+                }
+                break;
+            default:
+                return FALSE;
+            }
+
+            getCellText->Flags = TN_CACHE;
+        }
+        return TRUE;
+    case TreeNewLeftDoubleClick:
+        {
+            PPH_TREENEW_MOUSE_EVENT mouseEvent = Parameter1;
+            PPH_PROCESS_NODE processNode;
+
+            node = (PPH_JOB_LIST_NODE)mouseEvent->Node;
+
+            if (node && !node->Children && (processNode = PhFindProcessNode(node->ProcessId)))
+            {
+                ProcessHacker_SelectTabPage(PhMainWndHandle, 0);
+                PhSelectAndEnsureVisibleProcessNode(processNode);
+            }
+        }
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+INT_PTR CALLBACK PhpJobListDlgProc(
+    _In_ HWND hwndDlg,
+    _In_ UINT uMsg,
+    _In_ WPARAM wParam,
+    _In_ LPARAM lParam
+    )
+{
+    PPH_JOB_LIST_CONTEXT context;
+
+    if (uMsg == WM_INITDIALOG)
+    {
+        context = PhAllocate(sizeof(PH_JOB_LIST_CONTEXT));
+        memset(context, 0, sizeof(PH_JOB_LIST_CONTEXT));
+        SetProp(hwndDlg, PhMakeContextAtom(), (HANDLE)context);
+    }
+    else
+    {
+        context = (PPH_JOB_LIST_CONTEXT)GetProp(hwndDlg, PhMakeContextAtom());
+
+        if (uMsg == WM_DESTROY)
+            RemoveProp(hwndDlg, PhMakeContextAtom());
+    }
+
+    if (!context)
+        return FALSE;
+
+    switch (uMsg)
+    {
+    case WM_INITDIALOG:
+        {
+            HWND tnHandle;
+
+            PhCenterWindow(hwndDlg, GetParent(hwndDlg));
+
+            context->WindowHandle = hwndDlg;
+            context->TreeNewHandle = tnHandle = GetDlgItem(hwndDlg, IDC_LIST);
+            context->NodeList = PhCreateList(64);
+            context->RootList = PhCreateList(8);
+
+            PhSetControlTheme(tnHandle, L"explorer");
+            TreeNew_SetCallback(tnHandle, PhpJobListTreeNewCallback, context);
+
+            PhAddTreeNewColumn(tnHandle, PHJLTLC_NAME, TRUE, L"Name", 200, PH_ALIGN_LEFT, -2, 0);
+            PhAddTreeNewColumn(tnHandle, PHJLTLC_PID, TRUE, L"PID", 50, PH_ALIGN_RIGHT, 0, DT_RIGHT);
+            PhAddTreeNewColumn(tnHandle, PHJLTLC_PROCESSES, TRUE, L"Processes", 60, PH_ALIGN_RIGHT, 1, DT_RIGHT);
+            PhAddTreeNewColumn(tnHandle, PHJLTLC_CPU, TRUE, L"CPU", 45, PH_ALIGN_RIGHT, 2, DT_RIGHT);
+            PhAddTreeNewColumn(tnHandle, PHJLTLC_PRIVATEBYTES, TRUE, L"Private bytes", 80, PH_ALIGN_RIGHT, 3, DT_RIGHT);
+            PhAddTreeNewColumn(tnHandle, PHJLTLC_WORKINGSET, TRUE, L"Working set", 80, PH_ALIGN_RIGHT, 4, DT_RIGHT);
+
+            PhpRefreshJobList(context);
+
+            if (!KphIsConnected())
+                SetDlgItemText(hwndDlg, IDC_MESSAGE, L"KProcessHacker is required to list jobs.");
+
+            PhRegisterCallback(&PhProcessesUpdatedEvent, ProcessesUpdatedCallback, context, &context->ProcessesUpdatedRegistration);
+
+            SendMessage(hwndDlg, WM_NEXTDLGCTL, (WPARAM)GetDlgItem(hwndDlg, IDOK), TRUE);
+        }
+        break;
+    case WM_DESTROY:
+        {
+            PhUnregisterCallback(&PhProcessesUpdatedEvent, &context->ProcessesUpdatedRegistration);
+
+            PhpClearJobListNodes(context);
+            PhDereferenceObject(context->NodeList);
+            PhDereferenceObject(context->RootList);
+            PhFree(context);
+        }
+        break;
+    case WM_COMMAND:
+        {
+            switch (LOWORD(wParam))
+            {
+            case IDCANCEL:
+            case IDOK:
+                EndDialog(hwndDlg, IDOK);
+                break;
+            }
+        }
+        break;
+    case MSG_UPDATE:
+        {
+            PhpRefreshJobList(context);
+        }
+        break;
+    }
+
+    return FALSE;
+}
@@ -24,154 +24,349 @@
 #include <phapp.h>
 #include <settings.h>
 
-PH_CIRCULAR_BUFFER_PVOID PhLogBuffer;
+#define PH_LOG_MAXIMUM_ENTRIES 0x100000
+#define PH_LOG_STREAM_FLUSH_INTERVAL 64
+
+typedef struct _PHP_LOG_STRING
+{
+    PPH_STRING String; // NULL if the slot is free
+    ULONG RefCount; // next free slot if the slot is free
+} PHP_LOG_STRING, *PPHP_LOG_STRING;
+
 PHAPPAPI PH_CALLBACK_DECLARE(PhLoggedCallback);
 
+// Entries are stored by value in a ring that is allocated once. Names are interned: each
+// distinct string is stored once in PhpLogStrings and entries refer to it by index. Index 0
+// is never assigned; it means "no string" in an entry and holds the key during lookups.
+static PH_QUEUED_LOCK PhpLogLock = PH_QUEUED_LOCK_INIT;
+static PPH_LOG_ENTRY PhpLogEntries;
+static ULONG PhpLogSize;
+static ULONG PhpLogCount;
+static ULONG PhpLogNext;
+
+static PPHP_LOG_STRING PhpLogStrings;
+static ULONG PhpLogStringsCount;
+static ULONG PhpLogStringsAllocated;
+static ULONG PhpLogStringsFree;
+static PPH_HASHTABLE PhpLogStringHashtable;
+
+static PPH_FILE_STREAM PhpLogFileStream;
+static ULONG PhpLogFileStreamPending;
+
+static BOOLEAN NTAPI PhpLogStringCompareFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    )
+{
+    return PhEqualString(PhpLogStrings[*(PULONG)Entry1].String, PhpLogStrings[*(PULONG)Entry2].String, FALSE);
+}
+
+static ULONG NTAPI PhpLogStringHashFunction(
+    _In_ PVOID Entry
+    )
+{
+    return PhHashStringRef(&PhpLogStrings[*(PULONG)Entry].String->sr, FALSE);
+}
+
 VOID PhLogInitialization(
     VOID
     )
 {
     ULONG entries;
+    PPH_STRING fileName;
 
     entries = PhGetIntegerSetting(L"LogEntries");
-    if (entries > 0x1000) entries = 0x1000;
-    PhInitializeCircularBuffer_PVOID(&PhLogBuffer, entries);
-    memset(PhLogBuffer.Data, 0, sizeof(PVOID) * PhLogBuffer.Size);
+    if (entries > PH_LOG_MAXIMUM_ENTRIES) entries = PH_LOG_MAXIMUM_ENTRIES;
+    if (entries == 0) entries = 1;
+
+    PhpLogSize = entries;
+    PhpLogEntries = PhAllocate(sizeof(PH_LOG_ENTRY) * PhpLogSize);
+    memset(PhpLogEntries, 0, sizeof(PH_LOG_ENTRY) * PhpLogSize);
+
+    PhpLogStringsAllocated = 64;
+    PhpLogStrings = PhAllocate(sizeof(PHP_LOG_STRING) * PhpLogStringsAllocated);
+    memset(PhpLogStrings, 0, sizeof(PHP_LOG_STRING) * PhpLogStringsAllocated);
+    PhpLogStringsCount = 1;
+    PhpLogStringHashtable = PhCreateHashtable(
+        sizeof(ULONG),
+        PhpLogStringCompareFunction,
+        PhpLogStringHashFunction,
+        64
+        );
+
+    fileName = PhGetStringSetting(L"LogFileName");
+
+    if (fileName->Length != 0)
+    {
+        PhCreateFileStream(
+            &PhpLogFileStream,
+            fileName->Buffer,
+            FILE_GENERIC_WRITE,
+            FILE_SHARE_READ,
+            FILE_OPEN_IF,
+            PH_FILE_STREAM_APPEND
+            );
+    }
+
+    PhDereferenceObject(fileName);
 }
 
-PPH_LOG_ENTRY PhpCreateLogEntry(
-    _In_ UCHAR Type
+VOID PhLogUninitialization(
+    VOID
     )
 {
-    PPH_LOG_ENTRY entry;
-
-    entry = PhAllocate(sizeof(PH_LOG_ENTRY));
-    memset(entry, 0, sizeof(PH_LOG_ENTRY));
+    PhAcquireQueuedLockExclusive(&PhpLogLock);
 
-    entry->Type = Type;
-    PhQuerySystemTime(&entry->Time);
+    if (PhpLogFileStream)
+    {
+        PhFlushFileStream(PhpLogFileStream, FALSE);
+        PhClearReference(&PhpLogFileStream);
+    }
 
-    return entry;
+    PhReleaseQueuedLockExclusive(&PhpLogLock);
 }
 
-VOID PhpFreeLogEntry(
-    _Inout_ PPH_LOG_ENTRY Entry
+static ULONG PhpReferenceLogString(
+    _In_opt_ PPH_STRING String
     )
 {
-    if (Entry->Type >= PH_LOG_ENTRY_PROCESS_FIRST && Entry->Type <= PH_LOG_ENTRY_PROCESS_LAST)
+    PULONG existingId;
+    ULONG id;
+
+    if (!String)
+        return 0;
+
+    id = 0;
+    PhpLogStrings[0].String = String;
+    existingId = PhFindEntryHashtable(PhpLogStringHashtable, &id);
+    PhpLogStrings[0].String = NULL;
+
+    if (existingId)
     {
-        PhDereferenceObject(Entry->Process.Name);
-        if (Entry->Process.ParentName) PhDereferenceObject(Entry->Process.ParentName);
+        PhpLogStrings[*existingId].RefCount++;
+        return *existingId;
     }
-    else if (Entry->Type >= PH_LOG_ENTRY_SERVICE_FIRST && Entry->Type <= PH_LOG_ENTRY_SERVICE_LAST)
+
+    if (PhpLogStringsFree != 0)
     {
-        PhDereferenceObject(Entry->Service.Name);
-        PhDereferenceObject(Entry->Service.DisplayName);
+        id = PhpLogStringsFree;
+        PhpLogStringsFree = PhpLogStrings[id].RefCount;
     }
-    else if (Entry->Type == PH_LOG_ENTRY_MESSAGE)
+    else
     {
-        PhDereferenceObject(Entry->Message);
+        if (PhpLogStringsCount == PhpLogStringsAllocated)
+        {
+            PhpLogStringsAllocated *= 2;
+            PhpLogStrings = PhReAllocate(PhpLogStrings, sizeof(PHP_LOG_STRING) * PhpLogStringsAllocated);
+        }
+
+        id = PhpLogStringsCount++;
     }
 
-    PhFree(Entry);
+    PhSetReference(&PhpLogStrings[id].String, String);
+    PhpLogStrings[id].RefCount = 1;
+    PhAddEntryHashtable(PhpLogStringHashtable, &id);
+
+    return id;
 }
 
-PPH_LOG_ENTRY PhpCreateProcessLogEntry(
-    _In_ UCHAR Type,
-    _In_ HANDLE ProcessId,
-    _In_opt_ HANDLE QueryHandle,
-    _In_ PPH_STRING Name,
-    _In_opt_ HANDLE ParentProcessId,
-    _In_opt_ PPH_STRING ParentName
+static VOID PhpDereferenceLogString(
+    _In_ ULONG Id
     )
 {
-    PPH_LOG_ENTRY entry;
+    if (Id == 0)
+        return;
+
+    if (--PhpLogStrings[Id].RefCount == 0)
+    {
+        PhRemoveEntryHashtable(PhpLogStringHashtable, &Id);
+        PhClearReference(&PhpLogStrings[Id].String);
+        PhpLogStrings[Id].RefCount = PhpLogStringsFree;
+        PhpLogStringsFree = Id;
+    }
+}
 
-    entry = PhpCreateLogEntry(Type);
-    entry->Process.ProcessId = ProcessId;
-    PhReferenceObject(Name);
-    entry->Process.Name = Name;
+static PWSTR PhpGetLogString(
+    _In_ ULONG Id,
+    _In_ PWSTR DefaultString
+    )
+{
+    if (Id == 0 || Id >= PhpLogStringsCount || !PhpLogStrings[Id].String)
+        return DefaultString;
 
-    entry->Process.ParentProcessId = ParentProcessId;
+    return PhpLogStrings[Id].String->Buffer;
+}
 
-    if (ParentName)
+static VOID PhpDereferenceLogEntry(
+    _In_ PPH_LOG_ENTRY Entry
+    )
+{
+    if (Entry->Type >= PH_LOG_ENTRY_PROCESS_FIRST && Entry->Type <= PH_LOG_ENTRY_PROCESS_LAST)
     {
-        PhReferenceObject(ParentName);
-        entry->Process.ParentName = ParentName;
+        PhpDereferenceLogString(Entry->Process.NameId);
+        PhpDereferenceLogString(Entry->Process.ParentNameId);
     }
-
-    if (QueryHandle && entry->Type == PH_LOG_ENTRY_PROCESS_DELETE)
+    else if (Entry->Type >= PH_LOG_ENTRY_SERVICE_FIRST && Entry->Type <= PH_LOG_ENTRY_SERVICE_LAST)
     {
-        PROCESS_BASIC_INFORMATION basicInfo;
+        PhpDereferenceLogString(Entry->Service.NameId);
+        PhpDereferenceLogString(Entry->Service.DisplayNameId);
+    }
+    else if (Entry->Type == PH_LOG_ENTRY_MESSAGE)
+    {
+        PhpDereferenceLogString(Entry->MessageId);
+    }
+}
 
-        if (NT_SUCCESS(PhGetProcessBasicInformation(QueryHandle, &basicInfo)))
-        {
-            entry->Process.ExitStatus = basicInfo.ExitStatus;
-        }
+static PPH_STRING PhpFormatLogEntry(
+    _In_ PPH_LOG_ENTRY Entry
+    )
+{
+    switch (Entry->Type)
+    {
+    case PH_LOG_ENTRY_PROCESS_CREATE:
+        return PhFormatString(
+            L"Process created: %s (%u) started by %s (%u)",
+            PhpGetLogString(Entry->Process.NameId, L""),
+            HandleToUlong(Entry->Process.ProcessId),
+            PhpGetLogString(Entry->Process.ParentNameId, L"Unknown Process"),
+            HandleToUlong(Entry->Process.ParentProcessId)
+            );
+    case PH_LOG_ENTRY_PROCESS_DELETE:
+        return PhFormatString(L"Process terminated: %s (%u); exit status 0x%x", PhpGetLogString(Entry->Process.NameId, L""), HandleToUlong(Entry->Process.ProcessId), Entry->Process.ExitStatus);
+    case PH_LOG_ENTRY_SERVICE_CREATE:
+        return PhFormatString(L"Service created: %s (%s)", PhpGetLogString(Entry->Service.NameId, L""), PhpGetLogString(Entry->Service.DisplayNameId, L""));
+    case PH_LOG_ENTRY_SERVICE_DELETE:
+        return PhFormatString(L"Service deleted: %s (%s)", PhpGetLogString(Entry->Service.NameId, L""), PhpGetLogString(Entry->Service.DisplayNameId, L""));
+    case PH_LOG_ENTRY_SERVICE_START:
+        return PhFormatString(L"Service started: %s (%s)", PhpGetLogString(Entry->Service.NameId, L""), PhpGetLogString(Entry->Service.DisplayNameId, L""));
+    case PH_LOG_ENTRY_SERVICE_STOP:
+        return PhFormatString(L"Service stopped: %s (%s)", PhpGetLogString(Entry->Service.NameId, L""), PhpGetLogString(Entry->Service.DisplayNameId, L""));
+    case PH_LOG_ENTRY_SERVICE_CONTINUE:
+        return PhFormatString(L"Service continued: %s (%s)", PhpGetLogString(Entry->Service.NameId, L""), PhpGetLogString(Entry->Service.DisplayNameId, L""));
+    case PH_LOG_ENTRY_SERVICE_PAUSE:
+        return PhFormatString(L"Service paused: %s (%s)", PhpGetLogString(Entry->Service.NameId, L""), PhpGetLogString(Entry->Service.DisplayNameId, L""));
+    case PH_LOG_ENTRY_MESSAGE:
+        return PhCreateString(PhpGetLogString(Entry->MessageId, L""));
+    default:
+        return PhReferenceEmptyString();
     }
+}
 
-    return entry;
+static VOID PhpWriteLogEntryToStream(
+    _In_ PPH_LOG_ENTRY Entry
+    )
+{
+    SYSTEMTIME systemTime;
+    PPH_STRING dateTime;
+    PPH_STRING string;
+
+    PhLargeIntegerToLocalSystemTime(&systemTime, &Entry->Time);
+    dateTime = PhFormatDateTime(&systemTime);
+    string = PhpFormatLogEntry(Entry);
+    PhWriteStringFormatAsUtf8FileStream(PhpLogFileStream, L"%s: %s\r\n", dateTime->Buffer, string->Buffer);
+    PhDereferenceObject(string);
+    PhDereferenceObject(dateTime);
+
+    // The stream is buffered. Flush it now and then so that the file is
+    // reasonably current if we are terminated.
+    if (++PhpLogFileStreamPending == PH_LOG_STREAM_FLUSH_INTERVAL)
+    {
+        PhFlushFileStream(PhpLogFileStream, FALSE);
+        PhpLogFileStreamPending = 0;
+    }
 }
 
-PPH_LOG_ENTRY PhpCreateServiceLogEntry(
-    _In_ UCHAR Type,
-    _In_ PPH_STRING Name,
-    _In_ PPH_STRING DisplayName
+/**
+ * Adds an entry to the log.
+ *
+ * \param Entry The entry. The caller's references to any interned strings
+ * are transferred to the log.
+ */
+static VOID PhpLogEntry(
+    _In_ PPH_LOG_ENTRY Entry
     )
 {
-    PPH_LOG_ENTRY entry;
+    PPH_LOG_ENTRY slot;
+
+    slot = &PhpLogEntries[PhpLogNext];
 
-    entry = PhpCreateLogEntry(Type);
-    PhReferenceObject(Name);
-    entry->Service.Name = Name;
-    PhReferenceObject(DisplayName);
-    entry->Service.DisplayName = DisplayName;
+    if (PhpLogCount == PhpLogSize)
+        PhpDereferenceLogEntry(slot);
+    else
+        PhpLogCount++;
 
-    return entry;
+    *slot = *Entry;
+    PhpLogNext = (PhpLogNext + 1) % PhpLogSize;
+
+    if (PhpLogFileStream)
+        PhpWriteLogEntryToStream(Entry);
 }
 
-PPH_LOG_ENTRY PhpCreateMessageLogEntry(
-    _In_ UCHAR Type,
-    _In_ PPH_STRING Message
+static VOID PhpInitializeLogEntry(
+    _Out_ PPH_LOG_ENTRY Entry,
+    _In_ UCHAR Type
     )
 {
-    PPH_LOG_ENTRY entry;
-
-    entry = PhpCreateLogEntry(Type);
-    PhReferenceObject(Message);
-    entry->Message = Message;
-
-    return entry;
+    memset(Entry, 0, sizeof(PH_LOG_ENTRY));
+    Entry->Type = Type;
+    PhQuerySystemTime(&Entry->Time);
 }
 
-VOID PhpLogEntry(
-    _In_ PPH_LOG_ENTRY Entry
+VOID PhClearLogEntries(
+    VOID
     )
 {
-    PPH_LOG_ENTRY oldEntry;
+    ULONG i;
 
-    oldEntry = PhAddItemCircularBuffer2_PVOID(&PhLogBuffer, Entry);
+    PhAcquireQueuedLockExclusive(&PhpLogLock);
 
-    if (oldEntry)
-        PhpFreeLogEntry(oldEntry);
+    for (i = 0; i < PhpLogCount; i++)
+        PhpDereferenceLogEntry(&PhpLogEntries[i]);
 
-    PhInvokeCallback(&PhLoggedCallback, Entry);
+    memset(PhpLogEntries, 0, sizeof(PH_LOG_ENTRY) * PhpLogSize);
+    PhpLogCount = 0;
+    PhpLogNext = 0;
+
+    PhReleaseQueuedLockExclusive(&PhpLogLock);
 }
 
-VOID PhClearLogEntries(
+/**
+ * Gets the number of entries in the log.
+ */
+ULONG PhGetLogEntryCount(
     VOID
     )
 {
-    ULONG i;
+    return PhpLogCount;
+}
 
-    for (i = 0; i < PhLogBuffer.Size; i++)
+/**
+ * Gets a copy of an entry in the log.
+ *
+ * \param Index The index of the entry, where 0 is the most recent entry.
+ * \param Entry A variable which receives the entry. Use PhFormatLogEntry
+ * to get its text.
+ *
+ * \return TRUE if the entry exists, otherwise FALSE.
+ */
+BOOLEAN PhGetLogEntry(
+    _In_ ULONG Index,
+    _Out_ PPH_LOG_ENTRY Entry
+    )
+{
+    BOOLEAN result = FALSE;
+
+    PhAcquireQueuedLockShared(&PhpLogLock);
+
+    if (Index < PhpLogCount)
     {
-        if (PhLogBuffer.Data[i])
-            PhpFreeLogEntry(PhLogBuffer.Data[i]);
+        *Entry = PhpLogEntries[(PhpLogNext + PhpLogSize - 1 - Index) % PhpLogSize];
+        result = TRUE;
     }
 
-    PhClearCircularBuffer_PVOID(&PhLogBuffer);
-    memset(PhLogBuffer.Data, 0, sizeof(PVOID) * PhLogBuffer.Size);
+    PhReleaseQueuedLockShared(&PhpLogLock);
+
+    return result;
 }
 
 VOID PhLogProcessEntry(
@@ -183,7 +378,29 @@ VOID PhLogProcessEntry(
     _In_opt_ PPH_STRING ParentName
     )
 {
-    PhpLogEntry(PhpCreateProcessLogEntry(Type, ProcessId, QueryHandle, Name, ParentProcessId, ParentName));
+    PH_LOG_ENTRY entry;
+
+    PhpInitializeLogEntry(&entry, Type);
+    entry.Process.ProcessId = ProcessId;
+    entry.Process.ParentProcessId = ParentProcessId;
+
+    if (QueryHandle && Type == PH_LOG_ENTRY_PROCESS_DELETE)
+    {
+        PROCESS_BASIC_INFORMATION basicInfo;
+
+        if (NT_SUCCESS(PhGetProcessBasicInformation(QueryHandle, &basicInfo)))
+        {
+            entry.Process.ExitStatus = basicInfo.ExitStatus;
+        }
+    }
+
+    PhAcquireQueuedLockExclusive(&PhpLogLock);
+    entry.Process.NameId = PhpReferenceLogString(Name);
+    entry.Process.ParentNameId = PhpReferenceLogString(ParentName);
+    PhpLogEntry(&entry);
+    PhReleaseQueuedLockExclusive(&PhpLogLock);
+
+    PhInvokeCallback(&PhLoggedCallback, &entry);
 }
 
 VOID PhLogServiceEntry(
@@ -192,7 +409,17 @@ VOID PhLogServiceEntry(
     _In_ PPH_STRING DisplayName
     )
 {
-    PhpLogEntry(PhpCreateServiceLogEntry(Type, Name, DisplayName));
+    PH_LOG_ENTRY entry;
+
+    PhpInitializeLogEntry(&entry, Type);
+
+    PhAcquireQueuedLockExclusive(&PhpLogLock);
+    entry.Service.NameId = PhpReferenceLogString(Name);
+    entry.Service.DisplayNameId = PhpReferenceLogString(DisplayName);
+    PhpLogEntry(&entry);
+    PhReleaseQueuedLockExclusive(&PhpLogLock);
+
+    PhInvokeCallback(&PhLoggedCallback, &entry);
 }
 
 VOID PhLogMessageEntry(
@@ -200,41 +427,33 @@ VOID PhLogMessageEntry(
     _In_ PPH_STRING Message
     )
 {
-    PhpLogEntry(PhpCreateMessageLogEntry(Type, Message));
+    PH_LOG_ENTRY entry;
+
+    PhpInitializeLogEntry(&entry, Type);
+
+    PhAcquireQueuedLockExclusive(&PhpLogLock);
+    entry.MessageId = PhpReferenceLogString(Message);
+    PhpLogEntry(&entry);
+    PhReleaseQueuedLockExclusive(&PhpLogLock);
+
+    PhInvokeCallback(&PhLoggedCallback, &entry);
 }
 
+/**
+ * Formats the text of a log entry.
+ *
+ * \param Entry The entry, as passed to PhLoggedCallback or returned by
+ * PhGetLogEntry.
+ */
 PPH_STRING PhFormatLogEntry(
     _In_ PPH_LOG_ENTRY Entry
     )
 {
-    switch (Entry->Type)
-    {
-    case PH_LOG_ENTRY_PROCESS_CREATE:
-        return PhFormatString(
-            L"Process created: %s (%u) started by %s (%u)",
-            Entry->Process.Name->Buffer,
-            HandleToUlong(Entry->Process.ProcessId),
-            PhGetStringOrDefault(Entry->Process.ParentName, L"Unknown Process"),
-            HandleToUlong(Entry->Process.ParentProcessId)
-            );
-    case PH_LOG_ENTRY_PROCESS_DELETE:
-        return PhFormatString(L"Process terminated: %s (%u); exit status 0x%x", Entry->Process.Name->Buffer, HandleToUlong(Entry->Process.ProcessId), Entry->Process.ExitStatus);
-    case PH_LOG_ENTRY_SERVICE_CREATE:
-        return PhFormatString(L"Service created: %s (%s)", Entry->Service.Name->Buffer, Entry->Service.DisplayName->Buffer);
-    case PH_LOG_ENTRY_SERVICE_DELETE:
-        return PhFormatString(L"Service deleted: %s (%s)", Entry->Service.Name->Buffer, Entry->Service.DisplayName->Buffer);
-    case PH_LOG_ENTRY_SERVICE_START:
-        return PhFormatString(L"Service started: %s (%s)", Entry->Service.Name->Buffer, Entry->Service.DisplayName->Buffer);
-    case PH_LOG_ENTRY_SERVICE_STOP:
-        return PhFormatString(L"Service stopped: %s (%s)", Entry->Service.Name->Buffer, Entry->Service.DisplayName->Buffer);
-    case PH_LOG_ENTRY_SERVICE_CONTINUE:
-        return PhFormatString(L"Service continued: %s (%s)", Entry->Service.Name->Buffer, Entry->Service.DisplayName->Buffer);
-    case PH_LOG_ENTRY_SERVICE_PAUSE:
-        return PhFormatString(L"Service paused: %s (%s)", Entry->Service.Name->Buffer, Entry->Service.DisplayName->Buffer);
-    case PH_LOG_ENTRY_MESSAGE:
-        PhReferenceObject(Entry->Message);
-        return Entry->Message;
-    default:
-        return PhReferenceEmptyString();
-    }
+    PPH_STRING string;
+
+    PhAcquireQueuedLockShared(&PhpLogLock);
+    string = PhpFormatLogEntry(Entry);
+    PhReleaseQueuedLockShared(&PhpLogLock);
+
+    return string;
 }
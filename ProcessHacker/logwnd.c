@@ -73,7 +73,7 @@ static VOID PhpUpdateLogList(
     VOID
     )
 {
-    ListViewCount = PhLogBuffer.Count;
+    ListViewCount = PhGetLogEntryCount();
     ListView_SetItemCountEx(ListViewHandle, ListViewCount, LVSICF_NOSCROLL);
 
     if (ListViewCount >= 2 && Button_GetCheck(GetDlgItem(PhLogWindowHandle, IDC_AUTOSCROLL)) == BST_CHECKED)
@@ -101,7 +101,7 @@ static PPH_STRING PhpGetStringForSelectedLogEntries(
 
     while (TRUE)
     {
-        PPH_LOG_ENTRY entry;
+        PH_LOG_ENTRY entry;
         SYSTEMTIME systemTime;
         PPH_STRING temp;
 
@@ -114,18 +114,16 @@ static PPH_STRING PhpGetStringForSelectedLogEntries(
             }
         }
 
-        entry = PhGetItemCircularBuffer_PVOID(&PhLogBuffer, i);
-
-        if (!entry)
+        if (!PhGetLogEntry(i, &entry))
             goto ContinueLoop;
 
-        PhLargeIntegerToLocalSystemTime(&systemTime, &entry->Time);
+        PhLargeIntegerToLocalSystemTime(&systemTime, &entry.Time);
         temp = PhFormatDateTime(&systemTime);
         PhAppendStringBuilder(&stringBuilder, &temp->sr);
         PhDereferenceObject(temp);
         PhAppendStringBuilder2(&stringBuilder, L": ");
 
-        temp = PhFormatLogEntry(entry);
+        temp = PhFormatLogEntry(&entry);
         PhAppendStringBuilder(&stringBuilder, &temp->sr);
         PhDereferenceObject(temp);
         PhAppendStringBuilder2(&stringBuilder, L"\r\n");
@@ -300,9 +298,11 @@ INT_PTR CALLBACK PhpLogDlgProc(
             case LVN_GETDISPINFO:
                 {
                     NMLVDISPINFO *dispInfo = (NMLVDISPINFO *)header;
-                    PPH_LOG_ENTRY entry;
+                    PH_LOG_ENTRY entry;
 
-                    entry = PhGetItemCircularBuffer_PVOID(&PhLogBuffer, ListViewCount - dispInfo->item.iItem - 1);
+                    // Entries are only formatted here, for the rows that are actually displayed.
+                    if (!PhGetLogEntry(ListViewCount - dispInfo->item.iItem - 1, &entry))
+                        break;
 
                     if (dispInfo->item.iSubItem == 0)
                     {
@@ -311,7 +311,7 @@ INT_PTR CALLBACK PhpLogDlgProc(
                             SYSTEMTIME systemTime;
                             PPH_STRING dateTime;
 
-                            PhLargeIntegerToLocalSystemTime(&systemTime, &entry->Time);
+                            PhLargeIntegerToLocalSystemTime(&systemTime, &entry.Time);
                             dateTime = PhFormatDateTime(&systemTime);
                             wcsncpy_s(dispInfo->item.pszText, dispInfo->item.cchTextMax, dateTime->Buffer, _TRUNCATE);
                             PhDereferenceObject(dateTime);
@@ -323,7 +323,7 @@ INT_PTR CALLBACK PhpLogDlgProc(
                         {
                             PPH_STRING string;
 
-                            string = PhFormatLogEntry(entry);
+                            string = PhFormatLogEntry(&entry);
                             wcsncpy_s(dispInfo->item.pszText, dispInfo->item.cchTextMax, string->Buffer, _TRUNCATE);
                             PhDereferenceObject(string);
                         }
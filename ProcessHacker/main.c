@@ -61,6 +61,15 @@ VOID PhpEnablePrivileges(
     VOID
     );
 
+typedef struct _PHP_STARTUP_TRACE_ENTRY
+{
+    PWSTR Phase;
+    PPH_STRING Detail;
+    LARGE_INTEGER Counter;
+} PHP_STARTUP_TRACE_ENTRY, *PPHP_STARTUP_TRACE_ENTRY;
+
+#define PHP_STARTUP_TRACE_MAXIMUM 256
+
 PPH_STRING PhApplicationDirectory;
 PPH_STRING PhApplicationFileName;
 PHAPPAPI HFONT PhApplicationFont;
@@ -75,8 +84,14 @@ PH_STARTUP_PARAMETERS PhStartupParameters;
 
 PH_PROVIDER_THREAD PhPrimaryProviderThread;
 PH_PROVIDER_THREAD PhSecondaryProviderThread;
+PH_PROVIDER_THREAD PhTertiaryProviderThread;
 
 static PPH_LIST DialogList = NULL;
+static LARGE_INTEGER StartupTraceStart;
+static LARGE_INTEGER StartupTraceFrequency;
+static PHP_STARTUP_TRACE_ENTRY StartupTraceEntries[PHP_STARTUP_TRACE_MAXIMUM];
+static ULONG StartupTraceCount = 0;
+static BOOLEAN StartupTraceFinished = FALSE;
 static PPH_LIST FilterList = NULL;
 static PH_AUTO_POOL BaseAutoPool;
 
@@ -92,6 +107,9 @@ INT WINAPI wWinMain(
     PHP_BASE_THREAD_DBG dbg;
 #endif
 
+    // This is recorded unconditionally because the command line has not been parsed yet.
+    NtQueryPerformanceCounter(&StartupTraceStart, &StartupTraceFrequency);
+
     CoInitializeEx(NULL, COINIT_APARTMENTTHREADED);
 #ifndef DEBUG
     SetErrorMode(SEM_NOOPENFILEERRORBOX | SEM_FAILCRITICALERRORS | SEM_NOGPFAULTERRORBOX);
@@ -133,6 +151,7 @@ INT WINAPI wWinMain(
         PhApplicationDirectory = PhReferenceEmptyString();
 
     PhpProcessStartupParameters();
+    PhTraceStartup(L"Base initialization", NULL);
     PhSettingsInitialization();
     PhpEnablePrivileges();
 
@@ -142,6 +161,7 @@ INT WINAPI wWinMain(
     }
 
     PhpInitializeSettings();
+    PhTraceStartup(L"Settings", NULL);
 
     // Activate a previous instance if required.
     if (PhGetIntegerSetting(L"AllowOnlyOneInstance") &&
@@ -154,7 +174,10 @@ INT WINAPI wWinMain(
     }
 
     if (PhGetIntegerSetting(L"EnableKph") && !PhStartupParameters.NoKph && !PhIsExecutingInWow64())
+    {
         PhInitializeKph();
+        PhTraceStartup(L"KProcessHacker", NULL);
+    }
 
     if (PhStartupParameters.CommandMode && PhStartupParameters.CommandType && PhStartupParameters.CommandAction)
     {
@@ -178,7 +201,7 @@ INT WINAPI wWinMain(
     TlsSetValue(PhDbgThreadDbgTlsIndex, &dbg);
 #endif
 
-    PhInitializeAutoPool(&BaseAutoPool);
+    PhInitializeAutoPoolEx(&BaseAutoPool, PH_AUTO_POOL_USE_ARENA);
 
     PhEmInitialization();
     PhGuiSupportInitialization();
@@ -186,6 +209,7 @@ INT WINAPI wWinMain(
     PhGraphControlInitialization();
     PhHexEditInitialization();
     PhColorBoxInitialization();
+    PhTraceStartup(L"Controls", NULL);
 
     PhSmallIconSize.X = GetSystemMetrics(SM_CXSMICON);
     PhSmallIconSize.Y = GetSystemMetrics(SM_CYSMICON);
@@ -217,6 +241,7 @@ INT WINAPI wWinMain(
     {
         PhPluginsInitialization();
         PhLoadPlugins();
+        PhTraceStartup(L"Plugins", NULL);
     }
 
     if (PhStartupParameters.PhSvc)
@@ -267,6 +292,7 @@ INT WINAPI wWinMain(
         return 1;
     }
 
+    PhTraceStartup(L"Main window", NULL);
     PhDrainAutoPool(&BaseAutoPool);
 
     result = PhMainMessageLoop();
@@ -341,6 +367,91 @@ LONG PhMainMessageLoop(
     return (LONG)message.wParam;
 }
 
+/**
+ * Records the end of a startup phase when startup tracing is enabled.
+ *
+ * \param Phase The name of the phase. This must be a static string.
+ * \param Detail An optional string identifying the item within the phase,
+ * e.g. the name of a plugin.
+ *
+ * \remarks The time reported for each entry is the time elapsed since
+ * the previous entry.
+ */
+VOID PhTraceStartup(
+    _In_ PWSTR Phase,
+    _In_opt_ PPH_STRINGREF Detail
+    )
+{
+    PPHP_STARTUP_TRACE_ENTRY entry;
+
+    if (!PhStartupParameters.TraceStartup || StartupTraceFinished)
+        return;
+    if (StartupTraceCount == PHP_STARTUP_TRACE_MAXIMUM)
+        return;
+
+    entry = &StartupTraceEntries[StartupTraceCount++];
+    entry->Phase = Phase;
+    entry->Detail = Detail ? PhCreateString2(Detail) : NULL;
+    NtQueryPerformanceCounter(&entry->Counter, NULL);
+}
+
+/**
+ * Writes the startup trace to the log and to the debugger, and stops
+ * recording further entries.
+ */
+VOID PhFinishStartupTrace(
+    VOID
+    )
+{
+    LARGE_INTEGER previousCounter;
+    ULONG i;
+
+    if (StartupTraceFinished)
+        return;
+
+    StartupTraceFinished = TRUE;
+
+    if (!PhStartupParameters.TraceStartup || StartupTraceFrequency.QuadPart == 0)
+        return;
+
+    previousCounter = StartupTraceStart;
+
+    for (i = 0; i < StartupTraceCount; i++)
+    {
+        PPHP_STARTUP_TRACE_ENTRY entry = &StartupTraceEntries[i];
+        PPH_STRING message;
+
+        message = PhFormatString(
+            L"Startup: %s%s%s: %.2f ms",
+            entry->Phase,
+            entry->Detail ? L" - " : L"",
+            entry->Detail ? entry->Detail->Buffer : L"",
+            (DOUBLE)(entry->Counter.QuadPart - previousCounter.QuadPart) * 1000 / StartupTraceFrequency.QuadPart
+            );
+        OutputDebugString(message->Buffer);
+        OutputDebugString(L"\n");
+        PhLogMessageEntry(PH_LOG_ENTRY_MESSAGE, message);
+        PhDereferenceObject(message);
+
+        previousCounter = entry->Counter;
+        PhClearReference(&entry->Detail);
+    }
+
+    if (StartupTraceCount != 0)
+    {
+        PPH_STRING message;
+
+        message = PhFormatString(
+            L"Startup: total: %.2f ms",
+            (DOUBLE)(previousCounter.QuadPart - StartupTraceStart.QuadPart) * 1000 / StartupTraceFrequency.QuadPart
+            );
+        OutputDebugString(message->Buffer);
+        OutputDebugString(L"\n");
+        PhLogMessageEntry(PH_LOG_ENTRY_MESSAGE, message);
+        PhDereferenceObject(message);
+    }
+}
+
 VOID PhRegisterDialog(
     _In_ HWND DialogWindowHandle
     )
@@ -525,6 +636,10 @@ BOOLEAN PhInitializeAppSystem(
 {
     PhApplicationName = L"Process Hacker";
 
+    PhVerifyCacheInitialization();
+
+    if (!PhImageCacheInitialization())
+        return FALSE;
     if (!PhProcessProviderInitialization())
         return FALSE;
     if (!PhServiceProviderInitialization())
@@ -641,6 +756,8 @@ VOID PhpInitializeSettings(
 
     // Apply basic global settings.
     PhMaxSizeUnit = PhGetIntegerSetting(L"MaxSizeUnit");
+    PhSetGraphRenderer(PhGetIntegerSetting(L"GraphRenderer"));
+    PhSetMemoryBudget((SIZE_T)PhGetIntegerSetting(L"MemoryBudget") * 1024 * 1024);
 
     if (PhGetIntegerSetting(L"SampleCountAutomatic"))
     {
@@ -682,6 +799,7 @@ VOID PhpInitializeSettings(
 #define PH_ARG_PRIORITY 25
 #define PH_ARG_PLUGIN 26
 #define PH_ARG_SELECTTAB 27
+#define PH_ARG_TRACESTARTUP 28
 
 BOOLEAN NTAPI PhpCommandLineOptionCallback(
     _In_opt_ PPH_COMMAND_LINE_OPTION Option,
@@ -803,6 +921,9 @@ BOOLEAN NTAPI PhpCommandLineOptionCallback(
         case PH_ARG_SELECTTAB:
             PhSwapReference(&PhStartupParameters.SelectTab, Value);
             break;
+        case PH_ARG_TRACESTARTUP:
+            PhStartupParameters.TraceStartup = TRUE;
+            break;
         }
     }
     else
@@ -857,7 +978,8 @@ VOID PhpProcessStartupParameters(
         { PH_ARG_SELECTPID, L"selectpid", MandatoryArgumentType },
         { PH_ARG_PRIORITY, L"priority", MandatoryArgumentType },
         { PH_ARG_PLUGIN, L"plugin", MandatoryArgumentType },
-        { PH_ARG_SELECTTAB, L"selecttab", MandatoryArgumentType }
+        { PH_ARG_SELECTTAB, L"selecttab", MandatoryArgumentType },
+        { PH_ARG_TRACESTARTUP, L"tracestartup", NoArgumentType }
     };
     PH_STRINGREF commandLine;
 
@@ -897,6 +1019,7 @@ VOID PhpProcessStartupParameters(
             L"-selectpid pid-to-select\n"
             L"-selecttab name-of-tab-to-select\n"
             L"-settings filename\n"
+            L"-tracestartup\n"
             L"-uninstallkph\n"
             L"-v\n"
             );
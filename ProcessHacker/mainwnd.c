@@ -39,6 +39,7 @@
 #include <shlobj.h>
 #include <winsta.h>
 #include <iphlpapi.h>
+#include <dbt.h>
 
 #define RUNAS_MODE_ADMIN 1
 #define RUNAS_MODE_LIMITED 2
@@ -55,6 +56,7 @@ BOOLEAN PhMainWndExiting = FALSE;
 HMENU PhMainWndMenuHandle;
 
 static BOOLEAN NeedsMaximize = FALSE;
+static BOOLEAN BackgroundMode = FALSE;
 static ULONG NeedsSelectPid = 0;
 static BOOLEAN AlwaysOnTop = FALSE;
 
@@ -92,7 +94,15 @@ static PH_CALLBACK_REGISTRATION ProcessAddedRegistration;
 static PH_CALLBACK_REGISTRATION ProcessModifiedRegistration;
 static PH_CALLBACK_REGISTRATION ProcessRemovedRegistration;
 static PH_CALLBACK_REGISTRATION ProcessesUpdatedRegistration;
+static PH_CALLBACK_REGISTRATION ShortLivedProcessRegistration;
+static PH_CALLBACK_REGISTRATION ProcessProviderHintRegistration;
 static BOOLEAN ProcessesNeedsRedraw = FALSE;
+static PPH_LIST InitialProcessAddList = NULL;
+static PPH_LIST PendingProcessAddList = NULL; // items that may have been cancelled
+static ULONG PendingProcessAddIndex = 0;
+static PPH_HASHTABLE PendingProcessAddHashtable = NULL; // item -> run ID, only for items still pending
+static PPH_LIST PendingProcessRemoveList = NULL;
+static BOOLEAN SymbolsPrefetched = FALSE;
 static PPH_PROCESS_NODE ProcessToScrollTo = NULL;
 
 static PH_PROVIDER_REGISTRATION ServiceProviderRegistration;
@@ -221,6 +231,8 @@ BOOLEAN PhMainWndInitialization(
 
     PhMwpLoadSettings();
     PhLogInitialization();
+    PhRecorderInitialization();
+    PhSnapshotPublicationInitialization();
     PhQueueItemGlobalWorkQueue(PhMwpDelayedLoadFunction, NULL);
 
     PhMwpSelectionChangedTabControl(-1);
@@ -230,6 +242,7 @@ BOOLEAN PhMainWndInitialization(
 
     PhStartProviderThread(&PhPrimaryProviderThread);
     PhStartProviderThread(&PhSecondaryProviderThread);
+    PhStartProviderThread(&PhTertiaryProviderThread);
 
     // See PhMwpOnTimer for more details.
     if (PhCsUpdateInterval > PH_FLUSH_PROCESS_QUERY_DATA_INTERVAL_1)
@@ -360,6 +373,20 @@ LRESULT CALLBACK PhMwpWndProc(
             PhMwpOnWtsSessionChange((ULONG)wParam, (ULONG)lParam);
         }
         break;
+    case WM_POWERBROADCAST:
+        {
+            // The background interval depends on whether we are running on battery power.
+            if (wParam == PBT_APMPOWERSTATUSCHANGE && BackgroundMode)
+                PhMwpUpdateBackgroundMode(TRUE);
+        }
+        break;
+    case WM_DEVICECHANGE:
+        {
+            // Drive letters may have been added or removed.
+            if (wParam == DBT_DEVICEARRIVAL || wParam == DBT_DEVICEREMOVECOMPLETE)
+                PhUpdateDosDevicePrefixes();
+        }
+        break;
     }
 
     if (uMsg >= WM_PH_FIRST && uMsg <= WM_PH_LAST)
@@ -412,12 +439,19 @@ VOID PhMwpInitializeProviders(
 
     PhInitializeProviderThread(&PhPrimaryProviderThread, interval);
     PhInitializeProviderThread(&PhSecondaryProviderThread, interval);
+    PhInitializeProviderThread(&PhTertiaryProviderThread, interval);
 
+    // The process and service providers also feed the tray icons, notifications and plugins, so
+    // they keep running while the main window is hidden. The network provider only feeds the
+    // Network tab. It can be slow on systems with many connections, so it gets its own thread to
+    // avoid delaying the process provider.
     PhRegisterProvider(&PhPrimaryProviderThread, PhProcessProviderUpdate, NULL, &ProcessProviderRegistration);
     PhSetEnabledProvider(&ProcessProviderRegistration, TRUE);
+    PhSetBackgroundProvider(&ProcessProviderRegistration, TRUE);
     PhRegisterProvider(&PhPrimaryProviderThread, PhServiceProviderUpdate, NULL, &ServiceProviderRegistration);
     PhSetEnabledProvider(&ServiceProviderRegistration, TRUE);
-    PhRegisterProvider(&PhPrimaryProviderThread, PhNetworkProviderUpdate, NULL, &NetworkProviderRegistration);
+    PhSetBackgroundProvider(&ServiceProviderRegistration, TRUE);
+    PhRegisterProvider(&PhTertiaryProviderThread, PhNetworkProviderUpdate, NULL, &NetworkProviderRegistration);
 }
 
 VOID PhMwpApplyUpdateInterval(
@@ -426,6 +460,7 @@ VOID PhMwpApplyUpdateInterval(
 {
     PhSetIntervalProviderThread(&PhPrimaryProviderThread, Interval);
     PhSetIntervalProviderThread(&PhSecondaryProviderThread, Interval);
+    PhSetIntervalProviderThread(&PhTertiaryProviderThread, Interval);
 
     if (Interval > PH_FLUSH_PROCESS_QUERY_DATA_INTERVAL_LONG_TERM)
         SetTimer(PhMainWndHandle, TIMER_FLUSH_PROCESS_QUERY_DATA, PH_FLUSH_PROCESS_QUERY_DATA_INTERVAL_LONG_TERM, NULL);
@@ -433,6 +468,34 @@ VOID PhMwpApplyUpdateInterval(
         KillTimer(PhMainWndHandle, TIMER_FLUSH_PROCESS_QUERY_DATA); // Might not exist
 }
 
+VOID PhMwpUpdateBackgroundMode(
+    _In_ BOOLEAN Background
+    )
+{
+    ULONG interval;
+
+    BackgroundMode = Background;
+    interval = 0;
+
+    if (Background && PhGetIntegerSetting(L"EnableBackgroundMode"))
+    {
+        SYSTEM_POWER_STATUS powerStatus;
+
+        interval = PhGetIntegerSetting(L"BackgroundUpdateInterval");
+
+        if (interval < PhCsUpdateInterval)
+            interval = PhCsUpdateInterval;
+
+        if (GetSystemPowerStatus(&powerStatus) && powerStatus.ACLineStatus == 0)
+            interval *= 2;
+    }
+
+    // Leaving background mode runs all providers immediately, so the window is up to date as soon
+    // as it is restored.
+    PhSetBackgroundModeProviderThread(&PhPrimaryProviderThread, interval);
+    PhSetBackgroundModeProviderThread(&PhTertiaryProviderThread, interval);
+}
+
 VOID PhMwpInitializeControls(
     VOID
     )
@@ -539,6 +602,18 @@ VOID PhMwpInitializeControls(
         NULL,
         &ProcessesUpdatedRegistration
         );
+    PhRegisterCallback(
+        &PhShortLivedProcessEvent,
+        PhMwpShortLivedProcessHandler,
+        NULL,
+        &ShortLivedProcessRegistration
+        );
+    PhRegisterCallback(
+        &PhProcessProviderHintEvent,
+        PhMwpProcessProviderHintHandler,
+        NULL,
+        &ProcessProviderHintRegistration
+        );
 
     PhRegisterCallback(
         &PhServiceAddedEvent,
@@ -591,6 +666,18 @@ VOID PhMwpInitializeControls(
         );
 }
 
+NTSTATUS PhMwpPrefetchSymbolsFunction(
+    _In_ PVOID Parameter
+    )
+{
+    // Load dbghelp and symsrv, and build symbol indexes for the most common modules
+    // while nothing needs them.
+    PhPrefetchSymbolProvider();
+    PhPrefetchCommonModuleSymbols();
+
+    return STATUS_SUCCESS;
+}
+
 NTSTATUS PhMwpDelayedLoadFunction(
     _In_ PVOID Parameter
     )
@@ -600,6 +687,10 @@ NTSTATUS PhMwpDelayedLoadFunction(
 
     PhNfLoadStage2();
 
+    // The first provider runs need these, so get them out of the way on this thread.
+    PhGetLookupPolicyHandle();
+    PhPrefetchNetworkImports();
+
     // Make sure we get closed late in the shutdown process.
     SetProcessShutdownParameters(0x100, 0);
 
@@ -664,6 +755,10 @@ VOID PhMwpOnDestroy(
         ProcessHacker_SaveAllSettings(PhMainWndHandle);
 
     PhNfUninitialization();
+    PhCloseVerifyCacheStore();
+    PhLogUninitialization();
+    PhRecorderUninitialization();
+    PhSnapshotPublicationUninitialization();
 
     PostQuitMessage(0);
 }
@@ -1124,6 +1219,11 @@ VOID PhMwpOnCommand(
             PhFreeFileDialog(fileDialog);
         }
         break;
+    case ID_TOOLS_JOBS:
+        {
+            PhShowJobListDialog(PhMainWndHandle);
+        }
+        break;
     case ID_TOOLS_PAGEFILES:
         {
             PhShowPagefilesDialog(PhMainWndHandle);
@@ -1810,6 +1910,8 @@ VOID PhMwpOnShowWindow(
     _In_ ULONG State
     )
 {
+    PhMwpUpdateBackgroundMode(!Showing || IsIconic(PhMainWndHandle));
+
     if (NeedsMaximize)
     {
         ShowWindow(PhMainWndHandle, SW_MAXIMIZE);
@@ -1941,6 +2043,8 @@ VOID PhMwpOnSize(
     VOID
     )
 {
+    PhMwpUpdateBackgroundMode(IsIconic(PhMainWndHandle) || !IsWindowVisible(PhMainWndHandle));
+
     if (!IsIconic(PhMainWndHandle))
     {
         HDWP deferHandle;
@@ -1977,7 +2081,24 @@ VOID PhMwpOnTimer(
     _In_ ULONG Id
     )
 {
-    if (Id == TIMER_FLUSH_PROCESS_QUERY_DATA)
+    if (Id == TIMER_APPLY_PROCESS_UPDATES)
+    {
+        PhMwpApplyPendingProcessUpdates();
+
+        // Let the partial result be painted before the next slice.
+        if (ProcessesNeedsRedraw)
+        {
+            TreeNew_SetRedraw(ProcessTreeListHandle, TRUE);
+            ProcessesNeedsRedraw = FALSE;
+        }
+
+        if (ProcessToScrollTo)
+        {
+            TreeNew_EnsureVisible(ProcessTreeListHandle, &ProcessToScrollTo->Node);
+            ProcessToScrollTo = NULL;
+        }
+    }
+    else if (Id == TIMER_FLUSH_PROCESS_QUERY_DATA)
     {
         static ULONG state = 1;
 
@@ -2229,10 +2350,6 @@ ULONG_PTR PhMwpOnUserMessage(
                 showMemoryResults->ProcessId,
                 showMemoryResults->Results
                 );
-            PhDereferenceMemoryResults(
-                (PPH_MEMORY_RESULT *)showMemoryResults->Results->Items,
-                showMemoryResults->Results->Count
-                );
             PhDereferenceObject(showMemoryResults->Results);
             PhFree(showMemoryResults);
         }
@@ -2389,17 +2506,31 @@ ULONG_PTR PhMwpOnUserMessage(
             ULONG runId = (ULONG)WParam;
             PPH_PROCESS_ITEM processItem = (PPH_PROCESS_ITEM)LParam;
 
-            PhMwpOnProcessAdded(processItem, runId);
+            // The initial list is added in one go when the first update completes; the tree
+            // isn't visible yet.
+            if (runId == 1)
+            {
+                if (!InitialProcessAddList)
+                    InitialProcessAddList = PhCreateList(256);
+
+                PhAddItemList(InitialProcessAddList, processItem);
+            }
+            else
+                PhMwpQueueProcessAdded(processItem, runId);
         }
         break;
     case WM_PH_PROCESS_MODIFIED:
         {
-            PhMwpOnProcessModified((PPH_PROCESS_ITEM)LParam);
+            PPH_PROCESS_ITEM processItem = (PPH_PROCESS_ITEM)LParam;
+
+            // If the node hasn't been created yet, it will be up to date when it is.
+            if (!PendingProcessAddHashtable || !PhFindItemSimpleHashtable(PendingProcessAddHashtable, processItem))
+                PhMwpOnProcessModified(processItem);
         }
         break;
     case WM_PH_PROCESS_REMOVED:
         {
-            PhMwpOnProcessRemoved((PPH_PROCESS_ITEM)LParam);
+            PhMwpQueueProcessRemoved((PPH_PROCESS_ITEM)LParam);
         }
         break;
     case WM_PH_PROCESSES_UPDATED:
@@ -2407,6 +2538,11 @@ ULONG_PTR PhMwpOnUserMessage(
             PhMwpOnProcessesUpdated();
         }
         break;
+    case WM_PH_SHORT_LIVED_PROCESS:
+        {
+            PhMwpOnShortLivedProcess((PPH_SHORT_LIVED_PROCESS)LParam);
+        }
+        break;
     case WM_PH_SERVICE_ADDED:
         {
             ULONG runId = (ULONG)WParam;
@@ -2509,6 +2645,38 @@ VOID NTAPI PhMwpProcessesUpdatedHandler(
     PostMessage(PhMainWndHandle, WM_PH_PROCESSES_UPDATED, 0, 0);
 }
 
+VOID NTAPI PhMwpShortLivedProcessHandler(
+    _In_opt_ PVOID Parameter,
+    _In_opt_ PVOID Context
+    )
+{
+    PPH_SHORT_LIVED_PROCESS shortLivedProcess = (PPH_SHORT_LIVED_PROCESS)Parameter;
+    PPH_SHORT_LIVED_PROCESS copy;
+
+    // The provider frees its copy after the callback returns.
+    copy = PhAllocateCopy(shortLivedProcess, sizeof(PH_SHORT_LIVED_PROCESS));
+
+    if (copy->ProcessName)
+        PhReferenceObject(copy->ProcessName);
+
+    if (!PostMessage(PhMainWndHandle, WM_PH_SHORT_LIVED_PROCESS, 0, (LPARAM)copy))
+    {
+        PhClearReference(&copy->ProcessName);
+        PhFree(copy);
+    }
+}
+
+VOID NTAPI PhMwpProcessProviderHintHandler(
+    _In_opt_ PVOID Parameter,
+    _In_opt_ PVOID Context
+    )
+{
+    // Process hints are queued from other threads, so we can't wait for the main window.
+    // Boosting is safe on any thread, and does nothing if automatic updates are paused.
+    if (UpdateAutomatically)
+        PhBoostProvider(&ProcessProviderRegistration, NULL);
+}
+
 VOID NTAPI PhMwpServiceAddedHandler(
     _In_opt_ PVOID Parameter,
     _In_opt_ PVOID Context
@@ -2623,9 +2791,26 @@ VOID PhMwpLoadSettings(
     PhEnableProcessQueryStage2 = !!PhGetIntegerSetting(L"EnableStage2");
     PhEnablePurgeProcessRecords = !PhGetIntegerSetting(L"NoPurgeProcessRecords");
     PhEnableCycleCpuUsage = !!PhGetIntegerSetting(L"EnableCycleCpuUsage");
+    PhEnableCompressedProcessHistory = !!PhGetIntegerSetting(L"EnableCompressedProcessHistory");
     PhEnableServiceNonPoll = !!PhGetIntegerSetting(L"EnableServiceNonPoll");
     PhEnableNetworkProviderResolve = !!PhGetIntegerSetting(L"EnableNetworkResolve");
 
+    if (PhSettingsFileName && PhGetIntegerSetting(L"EnablePersistentVerifyCache"))
+    {
+        static PH_STRINGREF verifyCacheFileName = PH_STRINGREF_INIT(L"\\verifycache.dat");
+        PH_STRINGREF directory;
+        PH_STRINGREF baseName;
+        PPH_STRING fileName;
+
+        // The store lives next to the settings file.
+        if (PhSplitStringRefAtLastChar(&PhSettingsFileName->sr, '\\', &directory, &baseName))
+        {
+            fileName = PhConcatStringRef2(&directory, &verifyCacheFileName);
+            PhOpenVerifyCacheStore(fileName->Buffer);
+            PhDereferenceObject(fileName);
+        }
+    }
+
     PhNfLoadStage1();
 
     NotifyIconNotifyMask = PhGetIntegerSetting(L"IconNotifyMask");
@@ -4603,11 +4788,52 @@ VOID PhMwpOnProcessAdded(
     PhDereferenceObject(ProcessItem);
 }
 
+VOID PhMwpOnInitialProcessesAdded(
+    VOID
+    )
+{
+    PPH_PROCESS_NODE *processNodes;
+    ULONG i;
+
+    if (!InitialProcessAddList || InitialProcessAddList->Count == 0)
+        return;
+
+    if (!ProcessesNeedsRedraw)
+    {
+        TreeNew_SetRedraw(ProcessTreeListHandle, FALSE);
+        ProcessesNeedsRedraw = TRUE;
+    }
+
+    processNodes = PhAllocate(sizeof(PPH_PROCESS_NODE) * InitialProcessAddList->Count);
+    PhAddProcessNodes(
+        (PPH_PROCESS_ITEM *)InitialProcessAddList->Items,
+        InitialProcessAddList->Count,
+        1,
+        processNodes
+        );
+
+    for (i = 0; i < InitialProcessAddList->Count; i++)
+    {
+        if (NeedsSelectPid != 0 && processNodes[i]->ProcessId == UlongToHandle(NeedsSelectPid))
+            ProcessToScrollTo = processNodes[i];
+
+        // PhCreateProcessNode has its own reference.
+        PhDereferenceObject(InitialProcessAddList->Items[i]);
+    }
+
+    PhFree(processNodes);
+
+    // The list isn't needed after startup.
+    PhDereferenceObject(InitialProcessAddList);
+    InitialProcessAddList = NULL;
+}
+
 VOID PhMwpOnProcessModified(
     _In_ PPH_PROCESS_ITEM ProcessItem
     )
 {
-    PhUpdateProcessNode(PhFindProcessNode(ProcessItem->ProcessId));
+    // The tooltip is rebuilt on demand if its fields have changed.
+    PhUpdateProcessNodeEx(PhFindProcessNode(ProcessItem->ProcessId), FALSE);
 
     if (SignedFilterEntry)
         PhApplyTreeNewFilters(PhGetFilterSupportProcessTreeList());
@@ -4650,10 +4876,221 @@ VOID PhMwpOnProcessRemoved(
         ProcessToScrollTo = NULL;
 }
 
+VOID PhMwpQueueProcessAdded(
+    _In_ _Assume_refs_(1) PPH_PROCESS_ITEM ProcessItem,
+    _In_ ULONG RunId
+    )
+{
+    if (!PendingProcessAddList)
+    {
+        PendingProcessAddList = PhCreateList(64);
+        PendingProcessAddHashtable = PhCreateSimpleHashtable(64);
+        PendingProcessRemoveList = PhCreateList(64);
+    }
+
+    PhAddItemList(PendingProcessAddList, ProcessItem);
+    PhAddItemSimpleHashtable(PendingProcessAddHashtable, ProcessItem, UlongToPtr(RunId));
+    SetTimer(PhMainWndHandle, TIMER_APPLY_PROCESS_UPDATES, USER_TIMER_MINIMUM, NULL);
+}
+
+VOID PhMwpQueueProcessRemoved(
+    _In_ PPH_PROCESS_ITEM ProcessItem
+    )
+{
+    if (!PendingProcessAddList)
+    {
+        PendingProcessAddList = PhCreateList(64);
+        PendingProcessAddHashtable = PhCreateSimpleHashtable(64);
+        PendingProcessRemoveList = PhCreateList(64);
+    }
+
+    // If the node hasn't been created yet, don't create it at all. The process is logged the
+    // same way as one that the provider never saw.
+    if (PhRemoveItemSimpleHashtable(PendingProcessAddHashtable, ProcessItem))
+    {
+        PPH_SHORT_LIVED_PROCESS shortLivedProcess;
+
+        shortLivedProcess = PhAllocate(sizeof(PH_SHORT_LIVED_PROCESS));
+        shortLivedProcess->ProcessId = ProcessItem->ProcessId;
+        shortLivedProcess->ParentProcessId = ProcessItem->ParentProcessId;
+        shortLivedProcess->CreateTime = ProcessItem->CreateTime;
+        shortLivedProcess->ExitTime.QuadPart = 0;
+        shortLivedProcess->ProcessName = ProcessItem->ProcessName;
+        PhReferenceObject(shortLivedProcess->ProcessName);
+
+        PhMwpOnShortLivedProcess(shortLivedProcess);
+
+        // The item stays in PendingProcessAddList with its reference until it is skipped.
+        return;
+    }
+
+    PhAddItemList(PendingProcessRemoveList, ProcessItem);
+    SetTimer(PhMainWndHandle, TIMER_APPLY_PROCESS_UPDATES, USER_TIMER_MINIMUM, NULL);
+}
+
+static BOOLEAN PhMwpIsProcessNodeInView(
+    _In_ PPH_PROCESS_NODE ProcessNode,
+    _In_ PPH_TREENEW_VIEW_PARTS ViewParts
+    )
+{
+    LONG numberOfRows;
+
+    if (!ProcessNode || !ProcessNode->Node.Visible || ViewParts->RowHeight == 0)
+        return FALSE;
+
+    // The index is stale if the node isn't in the flat list, for example when its parent is
+    // collapsed.
+    if (TreeNew_GetFlatNode(ProcessTreeListHandle, ProcessNode->Node.Index) != &ProcessNode->Node)
+        return FALSE;
+
+    numberOfRows = (ViewParts->ClientRect.bottom - ViewParts->HeaderHeight) / ViewParts->RowHeight + 1;
+
+    return (LONG)ProcessNode->Node.Index >= ViewParts->VScrollPosition &&
+        (LONG)ProcessNode->Node.Index < ViewParts->VScrollPosition + numberOfRows;
+}
+
+/**
+ * Applies some of the queued process additions and removals to the process tree.
+ *
+ * \remarks At most PH_APPLY_PROCESS_UPDATES_BUDGET milliseconds are spent here. If anything
+ * is left, it is applied on the next timer tick, after pending input and painting. Removals
+ * are applied before additions, so a node is always removed before another process with the
+ * same ID is added, and removals of rows that can be seen are applied first.
+ */
+VOID PhMwpApplyPendingProcessUpdates(
+    VOID
+    )
+{
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER startCounter;
+    LARGE_INTEGER counter;
+    LONG64 budget;
+    ULONG pass;
+    ULONG i;
+    ULONG j;
+
+    if (!PendingProcessAddList)
+        return;
+
+    NtQueryPerformanceCounter(&startCounter, &frequency);
+    budget = frequency.QuadPart * PH_APPLY_PROCESS_UPDATES_BUDGET / 1000;
+
+#define PH_BUDGET_EXCEEDED() \
+    (NtQueryPerformanceCounter(&counter, NULL), counter.QuadPart - startCounter.QuadPart >= budget)
+
+    if (PendingProcessRemoveList->Count != 0)
+    {
+        PH_TREENEW_VIEW_PARTS viewParts;
+
+        TreeNew_GetViewParts(ProcessTreeListHandle, &viewParts);
+
+        // The first pass only takes rows that are in view.
+        for (pass = 0; pass < 2; pass++)
+        {
+            for (i = 0, j = 0; i < PendingProcessRemoveList->Count; i++)
+            {
+                PPH_PROCESS_ITEM processItem = PendingProcessRemoveList->Items[i];
+
+                if ((pass == 0 && !PhMwpIsProcessNodeInView(PhFindProcessNode(processItem->ProcessId), &viewParts)) ||
+                    PH_BUDGET_EXCEEDED())
+                {
+                    PendingProcessRemoveList->Items[j++] = processItem;
+                    continue;
+                }
+
+                PhMwpOnProcessRemoved(processItem);
+            }
+
+            PendingProcessRemoveList->Count = j;
+        }
+    }
+
+    if (PendingProcessRemoveList->Count == 0)
+    {
+        for (; PendingProcessAddIndex < PendingProcessAddList->Count; PendingProcessAddIndex++)
+        {
+            PPH_PROCESS_ITEM processItem = PendingProcessAddList->Items[PendingProcessAddIndex];
+            PVOID *runId;
+
+            // Items without an entry were removed before we got to them.
+            if (!(runId = PhFindItemSimpleHashtable(PendingProcessAddHashtable, processItem)))
+            {
+                PhDereferenceObject(processItem);
+                continue;
+            }
+
+            if (PH_BUDGET_EXCEEDED())
+                break;
+
+            PhMwpOnProcessAdded(processItem, PtrToUlong(*runId));
+            PhRemoveItemSimpleHashtable(PendingProcessAddHashtable, processItem);
+        }
+
+        if (PendingProcessAddIndex == PendingProcessAddList->Count)
+        {
+            PhClearList(PendingProcessAddList);
+            PendingProcessAddIndex = 0;
+        }
+    }
+
+#undef PH_BUDGET_EXCEEDED
+
+    if (PendingProcessRemoveList->Count == 0 && PendingProcessAddList->Count == 0)
+        KillTimer(PhMainWndHandle, TIMER_APPLY_PROCESS_UPDATES);
+}
+
+VOID PhMwpOnShortLivedProcess(
+    _In_ PPH_SHORT_LIVED_PROCESS ShortLivedProcess
+    )
+{
+    PPH_PROCESS_ITEM parentProcess;
+    HANDLE parentProcessId = NULL;
+    PPH_STRING parentName = NULL;
+
+    if (!ShortLivedProcess->ProcessName)
+        ShortLivedProcess->ProcessName = PhReferenceEmptyString();
+
+    if (parentProcess = PhReferenceProcessItemForParent(
+        ShortLivedProcess->ParentProcessId,
+        ShortLivedProcess->ProcessId,
+        &ShortLivedProcess->CreateTime
+        ))
+    {
+        parentProcessId = parentProcess->ProcessId;
+        parentName = parentProcess->ProcessName;
+    }
+
+    PhLogProcessEntry(
+        PH_LOG_ENTRY_PROCESS_CREATE,
+        ShortLivedProcess->ProcessId,
+        NULL,
+        ShortLivedProcess->ProcessName,
+        parentProcessId,
+        parentName
+        );
+    PhLogProcessEntry(
+        PH_LOG_ENTRY_PROCESS_DELETE,
+        ShortLivedProcess->ProcessId,
+        NULL,
+        ShortLivedProcess->ProcessName,
+        NULL,
+        NULL
+        );
+
+    if (parentProcess)
+        PhDereferenceObject(parentProcess);
+
+    PhDereferenceObject(ShortLivedProcess->ProcessName);
+    PhFree(ShortLivedProcess);
+}
+
 VOID PhMwpOnProcessesUpdated(
     VOID
     )
 {
+    PhMwpOnInitialProcessesAdded();
+    PhMwpApplyPendingProcessUpdates();
+
     // The modified notification is only sent for special cases.
     // We have to invalidate the text on each update.
     PhTickProcessNodes();
@@ -4667,6 +5104,19 @@ VOID PhMwpOnProcessesUpdated(
     {
         TreeNew_SetRedraw(ProcessTreeListHandle, TRUE);
         ProcessesNeedsRedraw = FALSE;
+
+        // The first update is the end of startup as far as the user is concerned.
+        PhTraceStartup(L"Process tree populated", NULL);
+        PhFinishStartupTrace();
+
+        if (PhPluginsEnabled)
+            PhLoadDeferredPlugins();
+
+        if (!SymbolsPrefetched)
+        {
+            SymbolsPrefetched = TRUE;
+            PhQueueItemGlobalWorkQueue(PhMwpPrefetchSymbolsFunction, NULL);
+        }
     }
 
     if (NeedsSelectPid != 0)
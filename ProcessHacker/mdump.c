@@ -36,6 +36,52 @@
 #define PH_MINIDUMP_STATUS_UPDATE 1
 #define PH_MINIDUMP_COMPLETED 2
 #define PH_MINIDUMP_ERROR 3
+#define PH_MINIDUMP_PROGRESS 4
+
+#define PH_MINIDUMP_CHUNK_SIZE (1024 * 1024)
+#define PH_MINIDUMP_MAXIMUM_CHUNKS 16
+#define PH_MINIDUMP_FILE_BUFFER_SIZE (4 * 1024 * 1024)
+
+// A compressed dump file consists of a header followed by frames. Each frame holds a range of
+// the uncompressed dump file. dbghelp sometimes goes back and rewrites earlier parts of the
+// file (e.g. the stream directory), so frames may overlap and must be applied in order.
+
+#define PH_COMPRESSED_DUMP_MAGIC ('ZPMD')
+#define PH_COMPRESSED_DUMP_VERSION 1
+
+#define PH_COMPRESSED_DUMP_FRAME_COMPRESSED 0x1
+
+typedef struct _PH_COMPRESSED_DUMP_HEADER
+{
+    ULONG Magic;
+    ULONG Version;
+    ULONG ChunkSize;
+    ULONG Reserved;
+} PH_COMPRESSED_DUMP_HEADER, *PPH_COMPRESSED_DUMP_HEADER;
+
+typedef struct _PH_COMPRESSED_DUMP_FRAME
+{
+    ULONG64 Offset;
+    ULONG UncompressedSize;
+    ULONG StoredSize;
+    ULONG Flags;
+    ULONG Reserved;
+} PH_COMPRESSED_DUMP_FRAME, *PPH_COMPRESSED_DUMP_FRAME;
+
+typedef struct _PH_MINIDUMP_CHUNK
+{
+    PH_EVENT CompletedEvent;
+    BOOLEAN Pending;
+    BOOLEAN Compressed;
+
+    ULONG64 Offset;
+    PUCHAR Buffer;
+    ULONG Length;
+
+    PUCHAR CompressedBuffer;
+    ULONG CompressedLength;
+    PVOID WorkSpace;
+} PH_MINIDUMP_CHUNK, *PPH_MINIDUMP_CHUNK;
 
 typedef struct _PROCESS_MINIDUMP_CONTEXT
 {
@@ -43,6 +89,7 @@ typedef struct _PROCESS_MINIDUMP_CONTEXT
     PWSTR FileName;
     MINIDUMP_TYPE DumpType;
     BOOLEAN IsWow64;
+    BOOLEAN Compress;
 
     HANDLE ProcessHandle;
     HANDLE FileHandle;
@@ -53,6 +100,22 @@ typedef struct _PROCESS_MINIDUMP_CONTEXT
     BOOLEAN Succeeded;
 
     ULONG LastTickCount;
+    BOOLEAN ShowingProgress;
+
+    // Writer
+
+    PPH_FILE_STREAM FileStream;
+    ULONG64 FilePosition;
+    NTSTATUS WriteStatus;
+
+    PH_WORK_QUEUE WorkQueue;
+    PH_MINIDUMP_CHUNK Chunks[PH_MINIDUMP_MAXIMUM_CHUNKS];
+    ULONG NumberOfChunks;
+    ULONG CurrentChunk;
+
+    ULONG64 BytesWritten;
+    ULONG64 EstimatedSize;
+    ULONG LastProgressTickCount;
 } PROCESS_MINIDUMP_CONTEXT, *PPROCESS_MINIDUMP_CONTEXT;
 
 BOOLEAN PhpCreateProcessMiniDumpWithProgress(
@@ -77,6 +140,7 @@ BOOLEAN PhUiCreateDumpFileProcess(
     static PH_FILETYPE_FILTER filters[] =
     {
         { L"Dump files (*.dmp)", L"*.dmp" },
+        { L"Compressed dump files (*.dmpz)", L"*.dmpz" },
         { L"All files (*.*)", L"*.*" }
     };
     PVOID fileDialog;
@@ -117,11 +181,14 @@ BOOLEAN PhpCreateProcessMiniDumpWithProgress(
 {
     NTSTATUS status;
     PROCESS_MINIDUMP_CONTEXT context;
+    PH_STRINGREF fileName;
 
     memset(&context, 0, sizeof(PROCESS_MINIDUMP_CONTEXT));
     context.ProcessId = ProcessId;
     context.FileName = FileName;
     context.DumpType = DumpType;
+    PhInitializeStringRef(&fileName, FileName);
+    context.Compress = PhEndsWithStringRef2(&fileName, L".dmpz", TRUE);
 
     if (!NT_SUCCESS(status = PhOpenProcess(
         &context.ProcessHandle,
@@ -168,6 +235,403 @@ BOOLEAN PhpCreateProcessMiniDumpWithProgress(
     return context.Succeeded;
 }
 
+NTSTATUS NTAPI PhpCompressMiniDumpChunk(
+    _In_ PVOID Parameter
+    )
+{
+    PPH_MINIDUMP_CHUNK chunk = Parameter;
+
+    // If the data doesn't get any smaller, we store it as is.
+    chunk->Compressed = NT_SUCCESS(RtlCompressBuffer(
+        COMPRESSION_FORMAT_LZNT1 | COMPRESSION_ENGINE_STANDARD,
+        chunk->Buffer,
+        chunk->Length,
+        chunk->CompressedBuffer,
+        chunk->Length,
+        4096,
+        &chunk->CompressedLength,
+        chunk->WorkSpace
+        )) && chunk->CompressedLength < chunk->Length;
+
+    PhSetEvent(&chunk->CompletedEvent);
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * Writes a finished chunk to the dump file.
+ */
+NTSTATUS PhpRetireMiniDumpChunk(
+    _Inout_ PPROCESS_MINIDUMP_CONTEXT Context,
+    _Inout_ PPH_MINIDUMP_CHUNK Chunk
+    )
+{
+    NTSTATUS status;
+
+    if (Chunk->Pending)
+    {
+        PhWaitForEvent(&Chunk->CompletedEvent, NULL);
+        PhResetEvent(&Chunk->CompletedEvent);
+        Chunk->Pending = FALSE;
+    }
+
+    if (Chunk->Length == 0)
+        return STATUS_SUCCESS;
+
+    if (Context->Compress)
+    {
+        PH_COMPRESSED_DUMP_FRAME frame;
+
+        frame.Offset = Chunk->Offset;
+        frame.UncompressedSize = Chunk->Length;
+        frame.Flags = Chunk->Compressed ? PH_COMPRESSED_DUMP_FRAME_COMPRESSED : 0;
+        frame.StoredSize = Chunk->Compressed ? Chunk->CompressedLength : Chunk->Length;
+        frame.Reserved = 0;
+
+        if (NT_SUCCESS(status = PhWriteFileStream(Context->FileStream, &frame, sizeof(PH_COMPRESSED_DUMP_FRAME))))
+        {
+            status = PhWriteFileStream(
+                Context->FileStream,
+                Chunk->Compressed ? Chunk->CompressedBuffer : Chunk->Buffer,
+                frame.StoredSize
+                );
+        }
+    }
+    else
+    {
+        status = STATUS_SUCCESS;
+
+        // Seeking flushes the stream buffer, so we only do it when dbghelp goes back to
+        // rewrite an earlier part of the file.
+        if (Context->FilePosition != Chunk->Offset)
+        {
+            LARGE_INTEGER offset;
+
+            offset.QuadPart = Chunk->Offset;
+            status = PhSeekFileStream(Context->FileStream, &offset, SeekStart);
+        }
+
+        if (NT_SUCCESS(status))
+            status = PhWriteFileStream(Context->FileStream, Chunk->Buffer, Chunk->Length);
+
+        Context->FilePosition = Chunk->Offset + Chunk->Length;
+    }
+
+    Context->BytesWritten += Chunk->Length;
+    Chunk->Length = 0;
+
+    return status;
+}
+
+/**
+ * Hands off the current chunk and moves on to the next one.
+ */
+NTSTATUS PhpSubmitMiniDumpChunk(
+    _Inout_ PPROCESS_MINIDUMP_CONTEXT Context
+    )
+{
+    PPH_MINIDUMP_CHUNK chunk;
+
+    chunk = &Context->Chunks[Context->CurrentChunk];
+
+    if (Context->Compress)
+    {
+        chunk->Pending = TRUE;
+        PhQueueItemWorkQueue(&Context->WorkQueue, PhpCompressMiniDumpChunk, chunk);
+    }
+    else
+    {
+        NTSTATUS status;
+
+        if (!NT_SUCCESS(status = PhpRetireMiniDumpChunk(Context, chunk)))
+            return status;
+    }
+
+    // Chunks are retired in the order in which they were submitted, so the next chunk is always
+    // the oldest one.
+    Context->CurrentChunk = (Context->CurrentChunk + 1) % Context->NumberOfChunks;
+
+    return PhpRetireMiniDumpChunk(Context, &Context->Chunks[Context->CurrentChunk]);
+}
+
+NTSTATUS PhpWriteMiniDumpData(
+    _Inout_ PPROCESS_MINIDUMP_CONTEXT Context,
+    _In_ ULONG64 Offset,
+    _In_reads_bytes_(Length) PVOID Buffer,
+    _In_ ULONG Length
+    )
+{
+    PPH_MINIDUMP_CHUNK chunk;
+    ULONG length;
+
+    if (!NT_SUCCESS(Context->WriteStatus))
+        return Context->WriteStatus;
+
+    while (Length != 0)
+    {
+        chunk = &Context->Chunks[Context->CurrentChunk];
+
+        // Start a new chunk if this write isn't contiguous with the current one.
+        if (chunk->Length != 0 && chunk->Offset + chunk->Length != Offset)
+        {
+            if (!NT_SUCCESS(Context->WriteStatus = PhpSubmitMiniDumpChunk(Context)))
+                return Context->WriteStatus;
+
+            chunk = &Context->Chunks[Context->CurrentChunk];
+        }
+
+        if (chunk->Length == 0)
+            chunk->Offset = Offset;
+
+        length = min(Length, PH_MINIDUMP_CHUNK_SIZE - chunk->Length);
+        memcpy(chunk->Buffer + chunk->Length, Buffer, length);
+        chunk->Length += length;
+
+        Offset += length;
+        Buffer = PTR_ADD_OFFSET(Buffer, length);
+        Length -= length;
+
+        if (chunk->Length == PH_MINIDUMP_CHUNK_SIZE)
+        {
+            if (!NT_SUCCESS(Context->WriteStatus = PhpSubmitMiniDumpChunk(Context)))
+                return Context->WriteStatus;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS PhpInitializeMiniDumpWriter(
+    _Inout_ PPROCESS_MINIDUMP_CONTEXT Context
+    )
+{
+    NTSTATUS status;
+    ULONG compressBufferWorkSpaceSize = 0;
+    ULONG compressFragmentWorkSpaceSize;
+    ULONG i;
+
+    if (!NT_SUCCESS(status = PhCreateFileStream2(
+        &Context->FileStream,
+        Context->FileHandle,
+        PH_FILE_STREAM_HANDLE_UNOWNED,
+        PH_MINIDUMP_FILE_BUFFER_SIZE
+        )))
+        return status;
+
+    if (Context->Compress)
+    {
+        PH_COMPRESSED_DUMP_HEADER header;
+
+        if (!NT_SUCCESS(status = RtlGetCompressionWorkSpaceSize(
+            COMPRESSION_FORMAT_LZNT1 | COMPRESSION_ENGINE_STANDARD,
+            &compressBufferWorkSpaceSize,
+            &compressFragmentWorkSpaceSize
+            )))
+            return status;
+
+        header.Magic = PH_COMPRESSED_DUMP_MAGIC;
+        header.Version = PH_COMPRESSED_DUMP_VERSION;
+        header.ChunkSize = PH_MINIDUMP_CHUNK_SIZE;
+        header.Reserved = 0;
+
+        if (!NT_SUCCESS(status = PhWriteFileStream(Context->FileStream, &header, sizeof(PH_COMPRESSED_DUMP_HEADER))))
+            return status;
+
+        // Keep enough chunks in flight to occupy every processor while the oldest chunk is
+        // being written out.
+        Context->NumberOfChunks = min(PhSystemBasicInformation.NumberOfProcessors * 2, PH_MINIDUMP_MAXIMUM_CHUNKS);
+        Context->NumberOfChunks = max(Context->NumberOfChunks, 2);
+        PhInitializeWorkQueue(&Context->WorkQueue, 0, PhSystemBasicInformation.NumberOfProcessors, 1000);
+    }
+    else
+    {
+        Context->NumberOfChunks = 1;
+    }
+
+    for (i = 0; i < Context->NumberOfChunks; i++)
+    {
+        PPH_MINIDUMP_CHUNK chunk = &Context->Chunks[i];
+
+        PhInitializeEvent(&chunk->CompletedEvent);
+        chunk->Buffer = PhAllocatePage(PH_MINIDUMP_CHUNK_SIZE, NULL);
+
+        if (!chunk->Buffer)
+            return STATUS_NO_MEMORY;
+
+        if (Context->Compress)
+        {
+            chunk->CompressedBuffer = PhAllocatePage(PH_MINIDUMP_CHUNK_SIZE, NULL);
+            chunk->WorkSpace = PhAllocate(compressBufferWorkSpaceSize);
+
+            if (!chunk->CompressedBuffer)
+                return STATUS_NO_MEMORY;
+        }
+    }
+
+    Context->FilePosition = 0;
+    Context->BytesWritten = 0;
+    Context->WriteStatus = STATUS_SUCCESS;
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS PhpFinishMiniDumpWriter(
+    _Inout_ PPROCESS_MINIDUMP_CONTEXT Context,
+    _In_ BOOLEAN Flush
+    )
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    ULONG i;
+
+    if (Flush && NT_SUCCESS(Context->WriteStatus) && Context->NumberOfChunks != 0)
+    {
+        if (Context->Chunks[Context->CurrentChunk].Length != 0)
+            status = PhpSubmitMiniDumpChunk(Context);
+
+        // Retire the remaining chunks, oldest first.
+        for (i = 0; i < Context->NumberOfChunks && NT_SUCCESS(status); i++)
+        {
+            status = PhpRetireMiniDumpChunk(
+                Context,
+                &Context->Chunks[(Context->CurrentChunk + i) % Context->NumberOfChunks]
+                );
+        }
+
+        if (NT_SUCCESS(status))
+            status = PhFlushFileStream(Context->FileStream, FALSE);
+    }
+
+    if (Context->Compress && Context->NumberOfChunks != 0)
+    {
+        PhWaitForWorkQueue(&Context->WorkQueue);
+        PhDeleteWorkQueue(&Context->WorkQueue);
+    }
+
+    for (i = 0; i < Context->NumberOfChunks; i++)
+    {
+        PPH_MINIDUMP_CHUNK chunk = &Context->Chunks[i];
+
+        if (chunk->Buffer)
+            PhFreePage(chunk->Buffer);
+        if (chunk->CompressedBuffer)
+            PhFreePage(chunk->CompressedBuffer);
+        if (chunk->WorkSpace)
+            PhFree(chunk->WorkSpace);
+
+        memset(chunk, 0, sizeof(PH_MINIDUMP_CHUNK));
+    }
+
+    Context->NumberOfChunks = 0;
+    Context->CurrentChunk = 0;
+
+    if (Context->FileStream)
+    {
+        PhDereferenceObject(Context->FileStream);
+        Context->FileStream = NULL;
+    }
+
+    return status;
+}
+
+VOID PhpResetMiniDumpFile(
+    _In_ HANDLE FileHandle
+    )
+{
+    FILE_END_OF_FILE_INFORMATION endOfFileInfo;
+    FILE_POSITION_INFORMATION positionInfo;
+    IO_STATUS_BLOCK isb;
+
+    endOfFileInfo.EndOfFile.QuadPart = 0;
+    NtSetInformationFile(FileHandle, &isb, &endOfFileInfo, sizeof(FILE_END_OF_FILE_INFORMATION), FileEndOfFileInformation);
+    positionInfo.CurrentByteOffset.QuadPart = 0;
+    NtSetInformationFile(FileHandle, &isb, &positionInfo, sizeof(FILE_POSITION_INFORMATION), FilePositionInformation);
+}
+
+/**
+ * Estimates the size of a full-memory dump from the committed, readable memory of the process.
+ */
+ULONG64 PhpEstimateMiniDumpSize(
+    _In_ HANDLE ProcessHandle
+    )
+{
+    ULONG64 size = 0;
+    PVOID baseAddress;
+    MEMORY_BASIC_INFORMATION basicInfo;
+
+    baseAddress = (PVOID)0;
+
+    while (NT_SUCCESS(NtQueryVirtualMemory(
+        ProcessHandle,
+        baseAddress,
+        MemoryBasicInformation,
+        &basicInfo,
+        sizeof(MEMORY_BASIC_INFORMATION),
+        NULL
+        )))
+    {
+        if (
+            basicInfo.State == MEM_COMMIT &&
+            basicInfo.Protect != PAGE_NOACCESS &&
+            !(basicInfo.Protect & PAGE_GUARD)
+            )
+        {
+            size += basicInfo.RegionSize;
+        }
+
+        baseAddress = PTR_ADD_OFFSET(baseAddress, basicInfo.RegionSize);
+    }
+
+    return size;
+}
+
+VOID PhpUpdateMiniDumpProgress(
+    _Inout_ PPROCESS_MINIDUMP_CONTEXT Context
+    )
+{
+    ULONG tickCount;
+    ULONG64 bytesWritten;
+    PPH_STRING bytesWrittenString;
+    PPH_STRING message;
+    ULONG percent;
+
+    if (Context->ProcessId == NtCurrentProcessId())
+        return;
+
+    tickCount = GetTickCount();
+
+    if (tickCount - Context->LastProgressTickCount < 250)
+        return;
+
+    Context->LastProgressTickCount = tickCount;
+
+    // Include data that has been buffered but not yet written.
+    bytesWritten = Context->BytesWritten + Context->Chunks[Context->CurrentChunk].Length;
+
+    bytesWrittenString = PhFormatSize(bytesWritten, -1);
+
+    if (Context->EstimatedSize != 0)
+    {
+        PPH_STRING estimatedSizeString;
+
+        percent = (ULONG)(bytesWritten * 100 / Context->EstimatedSize);
+        percent = min(percent, 100);
+
+        estimatedSizeString = PhFormatSize(Context->EstimatedSize, -1);
+        message = PhFormatString(L"Writing memory: %s of about %s...", bytesWrittenString->Buffer, estimatedSizeString->Buffer);
+        PhDereferenceObject(estimatedSizeString);
+
+        SendMessage(Context->WindowHandle, WM_PH_MINIDUMP_STATUS_UPDATE, PH_MINIDUMP_PROGRESS, percent);
+    }
+    else
+    {
+        message = PhFormatString(L"Writing memory: %s...", bytesWrittenString->Buffer);
+    }
+
+    SendMessage(Context->WindowHandle, WM_PH_MINIDUMP_STATUS_UPDATE, PH_MINIDUMP_STATUS_UPDATE, (LPARAM)message->Buffer);
+    PhDereferenceObject(message);
+    PhDereferenceObject(bytesWrittenString);
+}
+
 static BOOL CALLBACK PhpProcessMiniDumpCallback(
     _In_ PVOID CallbackParam,
     _In_ const PMINIDUMP_CALLBACK_INPUT CallbackInput,
@@ -177,6 +641,42 @@ static BOOL CALLBACK PhpProcessMiniDumpCallback(
     PPROCESS_MINIDUMP_CONTEXT context = CallbackParam;
     PPH_STRING message = NULL;
 
+    // We do all I/O ourselves so that we can buffer, compress and report progress.
+    switch (CallbackInput->CallbackType)
+    {
+    case IoStartCallback:
+        CallbackOutput->Status = S_FALSE;
+        return TRUE;
+    case IoWriteAllCallback:
+        {
+            if (context->Stop)
+            {
+                CallbackOutput->Status = E_ABORT;
+                return TRUE;
+            }
+
+            if (NT_SUCCESS(PhpWriteMiniDumpData(
+                context,
+                CallbackInput->Io.Offset,
+                CallbackInput->Io.Buffer,
+                CallbackInput->Io.BufferBytes
+                )))
+            {
+                CallbackOutput->Status = S_OK;
+            }
+            else
+            {
+                CallbackOutput->Status = HRESULT_FROM_NT(context->WriteStatus);
+            }
+
+            PhpUpdateMiniDumpProgress(context);
+        }
+        return TRUE;
+    case IoFinishCallback:
+        CallbackOutput->Status = S_OK;
+        return TRUE;
+    }
+
     // Don't try to send status updates if we're creating a dump of the current process.
     if (context->ProcessId == NtCurrentProcessId())
         return TRUE;
@@ -225,12 +725,16 @@ NTSTATUS PhpProcessMiniDumpThreadStart(
 {
     PPROCESS_MINIDUMP_CONTEXT context = Parameter;
     MINIDUMP_CALLBACK_INFORMATION callbackInfo;
+    NTSTATUS status;
+    ULONG win32Result = 0;
 
     callbackInfo.CallbackRoutine = PhpProcessMiniDumpCallback;
     callbackInfo.CallbackParam = context;
 
 #ifdef _WIN64
-    if (context->IsWow64)
+    // The 32-bit server writes directly to the file and can't compress, so compressed dumps of
+    // 32-bit processes are always written by us.
+    if (context->IsWow64 && !context->Compress)
     {
         if (PhUiConnectToPhSvcEx(NULL, Wow64PhSvcMode, FALSE))
         {
@@ -304,7 +808,14 @@ NTSTATUS PhpProcessMiniDumpThreadStart(
     }
 #endif
 
-    if (PhWriteMiniDumpProcess(
+    if (context->DumpType & MiniDumpWithFullMemory)
+        context->EstimatedSize = PhpEstimateMiniDumpSize(context->ProcessHandle);
+
+    if (!NT_SUCCESS(status = PhpInitializeMiniDumpWriter(context)))
+    {
+        win32Result = PhNtStatusToDosError(status);
+    }
+    else if (PhWriteMiniDumpProcess(
         context->ProcessHandle,
         context->ProcessId,
         context->FileHandle,
@@ -318,29 +829,59 @@ NTSTATUS PhpProcessMiniDumpThreadStart(
     }
     else
     {
+        win32Result = GetLastError();
+
         // We may have an old version of dbghelp - in that case, try using minimal dump flags.
-        if (GetLastError() == HRESULT_FROM_WIN32(ERROR_INVALID_PARAMETER) && PhWriteMiniDumpProcess(
-            context->ProcessHandle,
-            context->ProcessId,
-            context->FileHandle,
-            MiniDumpWithFullMemory | MiniDumpWithHandleData,
-            NULL,
-            NULL,
-            &callbackInfo
-            ))
+        if (win32Result == HRESULT_FROM_WIN32(ERROR_INVALID_PARAMETER) && !context->Stop)
         {
-            context->Succeeded = TRUE;
+            PhpFinishMiniDumpWriter(context, FALSE);
+            PhpResetMiniDumpFile(context->FileHandle);
+
+            if (!NT_SUCCESS(status = PhpInitializeMiniDumpWriter(context)))
+            {
+                win32Result = PhNtStatusToDosError(status);
+            }
+            else if (PhWriteMiniDumpProcess(
+                context->ProcessHandle,
+                context->ProcessId,
+                context->FileHandle,
+                MiniDumpWithFullMemory | MiniDumpWithHandleData,
+                NULL,
+                NULL,
+                &callbackInfo
+                ))
+            {
+                context->Succeeded = TRUE;
+            }
+            else
+            {
+                win32Result = GetLastError();
+            }
         }
-        else
+    }
+
+    if (context->Succeeded)
+    {
+        if (!NT_SUCCESS(status = PhpFinishMiniDumpWriter(context, TRUE)))
         {
-            SendMessage(
-                context->WindowHandle,
-                WM_PH_MINIDUMP_STATUS_UPDATE,
-                PH_MINIDUMP_ERROR,
-                (LPARAM)GetLastError()
-                );
+            context->Succeeded = FALSE;
+            win32Result = PhNtStatusToDosError(status);
         }
     }
+    else
+    {
+        PhpFinishMiniDumpWriter(context, FALSE);
+    }
+
+    if (!context->Succeeded && !context->Stop)
+    {
+        SendMessage(
+            context->WindowHandle,
+            WM_PH_MINIDUMP_STATUS_UPDATE,
+            PH_MINIDUMP_ERROR,
+            (LPARAM)win32Result
+            );
+    }
 
 #ifdef _WIN64
 Completed:
@@ -454,6 +995,21 @@ INT_PTR CALLBACK PhpProcessMiniDumpDlgProc(
             case PH_MINIDUMP_ERROR:
                 PhShowStatus(hwndDlg, L"Unable to create the minidump", 0, (ULONG)lParam);
                 break;
+            case PH_MINIDUMP_PROGRESS:
+                {
+                    HWND progressHandle = GetDlgItem(hwndDlg, IDC_PROGRESS);
+
+                    if (!context->ShowingProgress)
+                    {
+                        SendMessage(progressHandle, PBM_SETMARQUEE, FALSE, 0);
+                        PhSetWindowStyle(progressHandle, PBS_MARQUEE, 0);
+                        SendMessage(progressHandle, PBM_SETRANGE32, 0, 100);
+                        context->ShowingProgress = TRUE;
+                    }
+
+                    SendMessage(progressHandle, PBM_SETPOS, (ULONG)lParam, 0);
+                }
+                break;
             case PH_MINIDUMP_COMPLETED:
                 EndDialog(hwndDlg, IDOK);
                 break;
@@ -464,3 +1020,169 @@ INT_PTR CALLBACK PhpProcessMiniDumpDlgProc(
 
     return FALSE;
 }
+
+/**
+ * Expands a compressed dump file (-ctype minidump -caction expand -cobject input -cvalue output).
+ */
+NTSTATUS PhCommandModeExpandMiniDump(
+    VOID
+    )
+{
+    NTSTATUS status;
+    PPH_FILE_STREAM inputStream;
+    PPH_FILE_STREAM outputStream;
+    PH_COMPRESSED_DUMP_HEADER header;
+    PH_COMPRESSED_DUMP_FRAME frame;
+    PUCHAR storedBuffer;
+    PUCHAR buffer;
+    ULONG readLength;
+    ULONG64 position;
+
+    if (
+        !PhEqualString2(PhStartupParameters.CommandAction, L"expand", TRUE) ||
+        !PhStartupParameters.CommandObject ||
+        !PhStartupParameters.CommandValue
+        )
+        return STATUS_INVALID_PARAMETER;
+
+    if (!NT_SUCCESS(status = PhCreateFileStream(
+        &inputStream,
+        PhStartupParameters.CommandObject->Buffer,
+        FILE_GENERIC_READ,
+        FILE_SHARE_READ,
+        FILE_OPEN,
+        0
+        )))
+        return status;
+
+    if (!NT_SUCCESS(status = PhReadFileStream(inputStream, &header, sizeof(PH_COMPRESSED_DUMP_HEADER), &readLength)) ||
+        readLength != sizeof(PH_COMPRESSED_DUMP_HEADER) ||
+        header.Magic != PH_COMPRESSED_DUMP_MAGIC ||
+        header.Version != PH_COMPRESSED_DUMP_VERSION ||
+        header.ChunkSize == 0 ||
+        header.ChunkSize > 64 * 1024 * 1024)
+    {
+        PhDereferenceObject(inputStream);
+        return NT_SUCCESS(status) ? STATUS_INVALID_IMAGE_FORMAT : status;
+    }
+
+    if (!NT_SUCCESS(status = PhCreateFileStream(
+        &outputStream,
+        PhStartupParameters.CommandValue->Buffer,
+        FILE_GENERIC_WRITE,
+        0,
+        FILE_OVERWRITE_IF,
+        0
+        )))
+    {
+        PhDereferenceObject(inputStream);
+        return status;
+    }
+
+    storedBuffer = PhAllocatePage(header.ChunkSize, NULL);
+    buffer = PhAllocatePage(header.ChunkSize, NULL);
+    position = 0;
+
+    if (!storedBuffer || !buffer)
+    {
+        status = STATUS_NO_MEMORY;
+        goto CleanupExit;
+    }
+
+    while (TRUE)
+    {
+        PUCHAR data;
+        ULONG dataLength;
+
+        status = PhReadFileStream(inputStream, &frame, sizeof(PH_COMPRESSED_DUMP_FRAME), &readLength);
+
+        if (status == STATUS_END_OF_FILE || (NT_SUCCESS(status) && readLength == 0))
+        {
+            status = STATUS_SUCCESS;
+            break;
+        }
+
+        if (!NT_SUCCESS(status))
+            break;
+
+        if (
+            readLength != sizeof(PH_COMPRESSED_DUMP_FRAME) ||
+            frame.UncompressedSize > header.ChunkSize ||
+            frame.StoredSize > header.ChunkSize
+            )
+        {
+            status = STATUS_INVALID_IMAGE_FORMAT;
+            break;
+        }
+
+        if (!NT_SUCCESS(status = PhReadFileStream(inputStream, storedBuffer, frame.StoredSize, &readLength)))
+            break;
+
+        if (readLength != frame.StoredSize)
+        {
+            status = STATUS_INVALID_IMAGE_FORMAT;
+            break;
+        }
+
+        if (frame.Flags & PH_COMPRESSED_DUMP_FRAME_COMPRESSED)
+        {
+            if (!NT_SUCCESS(status = RtlDecompressBuffer(
+                COMPRESSION_FORMAT_LZNT1,
+                buffer,
+                frame.UncompressedSize,
+                storedBuffer,
+                frame.StoredSize,
+                &dataLength
+                )))
+                break;
+
+            if (dataLength != frame.UncompressedSize)
+            {
+                status = STATUS_INVALID_IMAGE_FORMAT;
+                break;
+            }
+
+            data = buffer;
+        }
+        else
+        {
+            if (frame.StoredSize != frame.UncompressedSize)
+            {
+                status = STATUS_INVALID_IMAGE_FORMAT;
+                break;
+            }
+
+            data = storedBuffer;
+            dataLength = frame.StoredSize;
+        }
+
+        if (position != frame.Offset)
+        {
+            LARGE_INTEGER offset;
+
+            offset.QuadPart = frame.Offset;
+
+            if (!NT_SUCCESS(status = PhSeekFileStream(outputStream, &offset, SeekStart)))
+                break;
+        }
+
+        if (!NT_SUCCESS(status = PhWriteFileStream(outputStream, data, dataLength)))
+            break;
+
+        position = frame.Offset + dataLength;
+    }
+
+    if (NT_SUCCESS(status))
+        status = PhFlushFileStream(outputStream, FALSE);
+
+CleanupExit:
+    if (buffer)
+        PhFreePage(buffer);
+    if (storedBuffer)
+        PhFreePage(storedBuffer);
+
+    PhDereferenceObject(outputStream);
+    PhDereferenceObject(inputStream);
+
+    return status;
+}
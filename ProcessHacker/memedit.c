@@ -27,6 +27,8 @@
 
 #define WM_PH_SELECT_OFFSET (WM_APP + 300)
 
+#define MEMORY_EDITOR_SAVE_CHUNK_SIZE (1024 * 1024) // 1 MB
+
 typedef struct _MEMORY_EDITOR_CONTEXT
 {
     PH_AVL_LINKS Links;
@@ -44,7 +46,6 @@ typedef struct _MEMORY_EDITOR_CONTEXT
     HWND WindowHandle;
     PH_LAYOUT_MANAGER LayoutManager;
     HWND HexEditHandle;
-    PUCHAR Buffer;
     ULONG SelectOffset;
     PPH_STRING Title;
     ULONG Flags;
@@ -64,6 +65,42 @@ INT_PTR CALLBACK PhpMemoryEditorDlgProc(
     _In_ LPARAM lParam
     );
 
+static NTSTATUS NTAPI PhpMemoryEditorReadPage(
+    _In_ PVOID Context,
+    _In_ ULONG Offset,
+    _Out_writes_bytes_(Length) PVOID Buffer,
+    _In_ ULONG Length
+    )
+{
+    PMEMORY_EDITOR_CONTEXT context = Context;
+
+    return PhReadVirtualMemory(
+        context->ProcessHandle,
+        PTR_ADD_OFFSET(context->BaseAddress, Offset),
+        Buffer,
+        Length,
+        NULL
+        );
+}
+
+static NTSTATUS NTAPI PhpMemoryEditorWritePage(
+    _In_ PVOID Context,
+    _In_ ULONG Offset,
+    _In_reads_bytes_(Length) PVOID Buffer,
+    _In_ ULONG Length
+    )
+{
+    PMEMORY_EDITOR_CONTEXT context = Context;
+
+    return PhWriteVirtualMemory(
+        context->ProcessHandle,
+        PTR_ADD_OFFSET(context->BaseAddress, Offset),
+        Buffer,
+        Length,
+        NULL
+        );
+}
+
 PH_AVL_TREE PhMemoryEditorSet = PH_AVL_TREE_INIT(PhpMemoryEditorCompareFunction);
 static RECT MinimumSize = { -1, -1, -1, -1 };
 
@@ -177,6 +214,8 @@ INT_PTR CALLBACK PhpMemoryEditorDlgProc(
     case WM_INITDIALOG:
         {
             NTSTATUS status;
+            UCHAR firstPage[PH_HEXEDIT_PAGE_SIZE];
+            PH_HEXEDIT_DATA_SOURCE dataSource;
 
             if (context->Title)
             {
@@ -197,7 +236,9 @@ INT_PTR CALLBACK PhpMemoryEditorDlgProc(
 
             PhInitializeLayoutManager(&context->LayoutManager, hwndDlg);
 
-            if (context->RegionSize > 1024 * 1024 * 1024) // 1 GB
+            // Pages are read on demand, so the only limit is the range of offsets the hex
+            // editor supports.
+            if (context->RegionSize > MAXLONG)
             {
                 PhShowError(NULL, L"Unable to edit the memory region because it is too large.");
                 return TRUE;
@@ -220,19 +261,11 @@ INT_PTR CALLBACK PhpMemoryEditorDlgProc(
                 }
             }
 
-            context->Buffer = PhAllocatePage(context->RegionSize, NULL);
-
-            if (!context->Buffer)
-            {
-                PhShowError(NULL, L"Unable to allocate memory for the buffer.");
-                return TRUE;
-            }
-
             if (!NT_SUCCESS(status = PhReadVirtualMemory(
                 context->ProcessHandle,
                 context->BaseAddress,
-                context->Buffer,
-                context->RegionSize,
+                firstPage,
+                min(context->RegionSize, PH_HEXEDIT_PAGE_SIZE),
                 NULL
                 )))
             {
@@ -268,7 +301,12 @@ INT_PTR CALLBACK PhpMemoryEditorDlgProc(
 
             context->HexEditHandle = GetDlgItem(hwndDlg, IDC_MEMORY);
             PhAddLayoutItem(&context->LayoutManager, context->HexEditHandle, NULL, PH_ANCHOR_ALL);
-            HexEdit_SetBuffer(context->HexEditHandle, context->Buffer, (ULONG)context->RegionSize);
+
+            dataSource.Length = (ULONG)context->RegionSize;
+            dataSource.ReadPage = PhpMemoryEditorReadPage;
+            dataSource.WritePage = PhpMemoryEditorWritePage;
+            dataSource.Context = context;
+            HexEdit_SetDataSource(context->HexEditHandle, &dataSource);
 
             {
                 PH_RECTANGLE windowRectangle;
@@ -325,7 +363,11 @@ INT_PTR CALLBACK PhpMemoryEditorDlgProc(
 
             PhDeleteLayoutManager(&context->LayoutManager);
 
-            if (context->Buffer) PhFreePage(context->Buffer);
+            // Children are destroyed after this window, so detach the hex editor (and wait
+            // for its read-ahead) before the process handle is closed.
+            if (context->HexEditHandle)
+                HexEdit_SetDataSource(context->HexEditHandle, NULL);
+
             if (context->ProcessHandle) NtClose(context->ProcessHandle);
             PhClearReference(&context->Title);
 
@@ -392,7 +434,31 @@ INT_PTR CALLBACK PhpMemoryEditorDlgProc(
                             0
                             )))
                         {
-                            status = PhWriteFileStream(fileStream, context->Buffer, (ULONG)context->RegionSize);
+                            PH_HEXEDIT_READ_DATA readData;
+                            PVOID buffer;
+
+                            // Save what the editor shows, including changes which have not
+                            // been written yet.
+                            if (buffer = PhAllocatePage(MEMORY_EDITOR_SAVE_CHUNK_SIZE, NULL))
+                            {
+                                readData.Buffer = buffer;
+
+                                for (readData.Offset = 0; readData.Offset < (ULONG)context->RegionSize; readData.Offset += readData.Length)
+                                {
+                                    readData.Length = min((ULONG)context->RegionSize - readData.Offset, MEMORY_EDITOR_SAVE_CHUNK_SIZE);
+                                    HexEdit_ReadData(context->HexEditHandle, &readData);
+
+                                    if (!NT_SUCCESS(status = PhWriteFileStream(fileStream, buffer, readData.Length)))
+                                        break;
+                                }
+
+                                PhFreePage(buffer);
+                            }
+                            else
+                            {
+                                status = STATUS_NO_MEMORY;
+                            }
+
                             PhDereferenceObject(fileStream);
                         }
 
@@ -444,13 +510,8 @@ INT_PTR CALLBACK PhpMemoryEditorDlgProc(
                 {
                     NTSTATUS status;
 
-                    if (!NT_SUCCESS(status = PhWriteVirtualMemory(
-                        context->ProcessHandle,
-                        context->BaseAddress,
-                        context->Buffer,
-                        context->RegionSize,
-                        NULL
-                        )))
+                    // Only pages which have been changed are written.
+                    if (!NT_SUCCESS(status = HexEdit_Flush(context->HexEditHandle)))
                     {
                         PhShowStatus(hwndDlg, L"Unable to write memory", status, 0);
                     }
@@ -458,20 +519,8 @@ INT_PTR CALLBACK PhpMemoryEditorDlgProc(
                 break;
             case IDC_REREAD:
                 {
-                    NTSTATUS status;
-
-                    if (!NT_SUCCESS(status = PhReadVirtualMemory(
-                        context->ProcessHandle,
-                        context->BaseAddress,
-                        context->Buffer,
-                        context->RegionSize,
-                        NULL
-                        )))
-                    {
-                        PhShowStatus(hwndDlg, L"Unable to read memory", status, 0);
-                    }
-
-                    InvalidateRect(context->HexEditHandle, NULL, TRUE);
+                    // Cached pages are dropped and read again as they are shown.
+                    HexEdit_Refresh(context->HexEditHandle);
                 }
                 break;
             case IDC_BYTESPERROW:
@@ -68,6 +68,7 @@ VOID PhInitializeMemoryList(
     PhSetControlTheme(hwnd, L"explorer");
 
     TreeNew_SetCallback(hwnd, PhpMemoryTreeNewCallback, Context);
+    TreeNew_SetExtendedFlags(hwnd, TN_FLAG_SEARCH_INDEX, TN_FLAG_SEARCH_INDEX);
 
     TreeNew_SetRedraw(hwnd, FALSE);
 
@@ -26,6 +26,39 @@
 #define MAX_HEAPS 1000
 #define WS_REQUEST_COUNT (PAGE_SIZE / sizeof(MEMORY_WORKING_SET_EX_INFORMATION))
 
+#define PH_MEMORY_REGION_CACHE_LIMIT 8
+
+// The region types found by reading the target process are remembered per process, so that
+// refreshing the memory list does not have to read every TEB and probe every committed
+// region for a heap segment header again. Entries are matched to the new regions by base
+// address, allocation base, size, state and type.
+typedef struct _PH_MEMORY_REGION_CACHE_ENTRY
+{
+    PVOID BaseAddress;
+    PVOID AllocationBase;
+    SIZE_T RegionSize;
+    ULONG State;
+    ULONG Type;
+    PH_MEMORY_REGION_TYPE RegionType; // UnknownRegion if nothing was found
+    union
+    {
+        HANDLE ThreadId; // TEB and stack regions
+        PPH_STRING FileName; // mapped file regions
+        PVOID HeapBaseAddress; // heap segment regions
+    } u;
+} PH_MEMORY_REGION_CACHE_ENTRY, *PPH_MEMORY_REGION_CACHE_ENTRY;
+
+typedef struct _PH_MEMORY_REGION_CACHE
+{
+    HANDLE ProcessId;
+    LARGE_INTEGER CreateTime;
+    ULONG ThreadHash; // the TEB and stack entries are only used if the threads are the same
+    ULONG ImageHash; // the other entries are only used if the same images are mapped
+
+    ULONG NumberOfEntries;
+    PPH_MEMORY_REGION_CACHE_ENTRY Entries; // sorted by base address
+} PH_MEMORY_REGION_CACHE, *PPH_MEMORY_REGION_CACHE;
+
 VOID PhpMemoryItemDeleteProcedure(
     _In_ PVOID Object,
     _In_ ULONG Flags
@@ -33,11 +66,15 @@ VOID PhpMemoryItemDeleteProcedure(
 
 PPH_OBJECT_TYPE PhMemoryItemType;
 
+static PPH_LIST PhpMemoryRegionCacheList; // least recently used first
+static PH_QUEUED_LOCK PhpMemoryRegionCacheLock = PH_QUEUED_LOCK_INIT;
+
 BOOLEAN PhMemoryProviderInitialization(
     VOID
     )
 {
     PhMemoryItemType = PhCreateObjectType(L"MemoryItem", 0, PhpMemoryItemDeleteProcedure);
+    PhpMemoryRegionCacheList = PhCreateList(PH_MEMORY_REGION_CACHE_LIMIT);
 
     return TRUE;
 }
@@ -265,6 +302,224 @@ PPH_MEMORY_ITEM PhpSetMemoryRegionType(
     return memoryItem;
 }
 
+static VOID PhpFreeMemoryRegionCache(
+    _In_ PPH_MEMORY_REGION_CACHE Cache
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < Cache->NumberOfEntries; i++)
+    {
+        if (Cache->Entries[i].RegionType == MappedFileRegion)
+            PhDereferenceObject(Cache->Entries[i].u.FileName);
+    }
+
+    if (Cache->Entries)
+        PhFree(Cache->Entries);
+
+    PhFree(Cache);
+}
+
+/**
+ * Removes the cached region types of a process from the cache.
+ *
+ * \return The cached region types, or NULL if there are none for this instance
+ * of the process. Free the cache using PhpFreeMemoryRegionCache() or give it
+ * back using PhpPutMemoryRegionCache().
+ */
+static PPH_MEMORY_REGION_CACHE PhpTakeMemoryRegionCache(
+    _In_ HANDLE ProcessId,
+    _In_ PLARGE_INTEGER CreateTime
+    )
+{
+    PPH_MEMORY_REGION_CACHE cache = NULL;
+    ULONG i;
+
+    PhAcquireQueuedLockExclusive(&PhpMemoryRegionCacheLock);
+
+    for (i = 0; i < PhpMemoryRegionCacheList->Count; i++)
+    {
+        PPH_MEMORY_REGION_CACHE entry = PhpMemoryRegionCacheList->Items[i];
+
+        if (entry->ProcessId == ProcessId)
+        {
+            PhRemoveItemList(PhpMemoryRegionCacheList, i);
+            cache = entry;
+            break;
+        }
+    }
+
+    PhReleaseQueuedLockExclusive(&PhpMemoryRegionCacheLock);
+
+    if (cache && cache->CreateTime.QuadPart != CreateTime->QuadPart)
+    {
+        // The process ID has been reused.
+        PhpFreeMemoryRegionCache(cache);
+        cache = NULL;
+    }
+
+    return cache;
+}
+
+static VOID PhpPutMemoryRegionCache(
+    _In_ PPH_MEMORY_REGION_CACHE Cache
+    )
+{
+    PPH_MEMORY_REGION_CACHE oldCache = NULL;
+
+    PhAcquireQueuedLockExclusive(&PhpMemoryRegionCacheLock);
+
+    PhAddItemList(PhpMemoryRegionCacheList, Cache);
+
+    if (PhpMemoryRegionCacheList->Count > PH_MEMORY_REGION_CACHE_LIMIT)
+    {
+        oldCache = PhpMemoryRegionCacheList->Items[0];
+        PhRemoveItemList(PhpMemoryRegionCacheList, 0);
+    }
+
+    PhReleaseQueuedLockExclusive(&PhpMemoryRegionCacheLock);
+
+    if (oldCache)
+        PhpFreeMemoryRegionCache(oldCache);
+}
+
+static PPH_MEMORY_REGION_CACHE_ENTRY PhpFindMemoryRegionCacheEntry(
+    _In_ PPH_MEMORY_REGION_CACHE Cache,
+    _In_ PPH_MEMORY_ITEM MemoryItem
+    )
+{
+    LONG low;
+    LONG high;
+    LONG i;
+    PPH_MEMORY_REGION_CACHE_ENTRY entry;
+
+    low = 0;
+    high = (LONG)Cache->NumberOfEntries - 1;
+
+    while (low <= high)
+    {
+        i = (low + high) / 2;
+        entry = &Cache->Entries[i];
+
+        if ((ULONG_PTR)MemoryItem->BaseAddress < (ULONG_PTR)entry->BaseAddress)
+        {
+            high = i - 1;
+        }
+        else if ((ULONG_PTR)MemoryItem->BaseAddress > (ULONG_PTR)entry->BaseAddress)
+        {
+            low = i + 1;
+        }
+        else
+        {
+            if (entry->AllocationBase == MemoryItem->AllocationBase &&
+                entry->RegionSize == MemoryItem->RegionSize &&
+                entry->State == MemoryItem->State &&
+                entry->Type == MemoryItem->Type)
+            {
+                return entry;
+            }
+
+            return NULL;
+        }
+    }
+
+    return NULL;
+}
+
+static BOOLEAN PhpIsCachedMemoryRegionType(
+    _In_ PPH_MEMORY_ITEM MemoryItem
+    )
+{
+    switch (MemoryItem->RegionType)
+    {
+    case TebRegion:
+    case StackRegion:
+    case Stack32Region:
+    case MappedFileRegion:
+    case HeapSegmentRegion:
+    case HeapSegment32Region:
+        return TRUE;
+    case UnknownRegion:
+        // Remember that there was nothing to find in a committed region, so that we don't probe
+        // it again.
+        return !!(MemoryItem->State & MEM_COMMIT);
+    default:
+        return FALSE;
+    }
+}
+
+static PPH_MEMORY_REGION_CACHE PhpCreateMemoryRegionCache(
+    _In_ PPH_MEMORY_ITEM_LIST List,
+    _In_ PLARGE_INTEGER CreateTime,
+    _In_ ULONG ThreadHash,
+    _In_ ULONG ImageHash
+    )
+{
+    PPH_MEMORY_REGION_CACHE cache;
+    PLIST_ENTRY listEntry;
+    PPH_MEMORY_ITEM memoryItem;
+    ULONG count;
+
+    cache = PhAllocate(sizeof(PH_MEMORY_REGION_CACHE));
+    cache->ProcessId = List->ProcessId;
+    cache->CreateTime = *CreateTime;
+    cache->ThreadHash = ThreadHash;
+    cache->ImageHash = ImageHash;
+
+    count = 0;
+
+    for (listEntry = List->ListHead.Flink; listEntry != &List->ListHead; listEntry = listEntry->Flink)
+    {
+        memoryItem = CONTAINING_RECORD(listEntry, PH_MEMORY_ITEM, ListEntry);
+
+        if (PhpIsCachedMemoryRegionType(memoryItem))
+            count++;
+    }
+
+    cache->NumberOfEntries = 0;
+    cache->Entries = count != 0 ? PhAllocate(sizeof(PH_MEMORY_REGION_CACHE_ENTRY) * count) : NULL;
+
+    // The list is in address order, so the entries are too.
+    for (listEntry = List->ListHead.Flink; listEntry != &List->ListHead; listEntry = listEntry->Flink)
+    {
+        PPH_MEMORY_REGION_CACHE_ENTRY entry;
+
+        memoryItem = CONTAINING_RECORD(listEntry, PH_MEMORY_ITEM, ListEntry);
+
+        if (!PhpIsCachedMemoryRegionType(memoryItem))
+            continue;
+
+        entry = &cache->Entries[cache->NumberOfEntries++];
+        entry->BaseAddress = memoryItem->BaseAddress;
+        entry->AllocationBase = memoryItem->AllocationBase;
+        entry->RegionSize = memoryItem->RegionSize;
+        entry->State = memoryItem->State;
+        entry->Type = memoryItem->Type;
+        entry->RegionType = memoryItem->RegionType;
+        entry->u.ThreadId = NULL;
+
+        switch (memoryItem->RegionType)
+        {
+        case TebRegion:
+            entry->u.ThreadId = memoryItem->u.Teb.ThreadId;
+            break;
+        case StackRegion:
+        case Stack32Region:
+            entry->u.ThreadId = memoryItem->u.Stack.ThreadId;
+            break;
+        case MappedFileRegion:
+            PhSetReference(&entry->u.FileName, memoryItem->u.MappedFile.FileName);
+            break;
+        case HeapSegmentRegion:
+        case HeapSegment32Region:
+            entry->u.HeapBaseAddress = memoryItem->u.HeapSegment.HeapItem->BaseAddress;
+            break;
+        }
+    }
+
+    return cache;
+}
+
 NTSTATUS PhpUpdateMemoryRegionTypes(
     _In_ PPH_MEMORY_ITEM_LIST List,
     _In_ HANDLE ProcessHandle
@@ -279,6 +534,11 @@ NTSTATUS PhpUpdateMemoryRegionTypes(
 #endif
     PPH_MEMORY_ITEM memoryItem;
     PLIST_ENTRY listEntry;
+    PPH_MEMORY_REGION_CACHE cache;
+    ULONG threadHash;
+    ULONG imageHash;
+    BOOLEAN threadsCached;
+    BOOLEAN regionsCached;
 
     if (!NT_SUCCESS(status = PhEnumProcessesEx(&processes, SystemExtendedProcessInformation)))
         return status;
@@ -291,6 +551,24 @@ NTSTATUS PhpUpdateMemoryRegionTypes(
         return STATUS_NOT_FOUND;
     }
 
+    threadHash = process->NumberOfThreads;
+    imageHash = 0;
+
+    for (i = 0; i < process->NumberOfThreads; i++)
+        threadHash += PhHashIntPtr((ULONG_PTR)((PSYSTEM_EXTENDED_THREAD_INFORMATION)process->Threads + i)->ThreadInfo.ClientId.UniqueThread);
+
+    for (listEntry = List->ListHead.Flink; listEntry != &List->ListHead; listEntry = listEntry->Flink)
+    {
+        memoryItem = CONTAINING_RECORD(listEntry, PH_MEMORY_ITEM, ListEntry);
+
+        if ((memoryItem->Type & (MEM_MAPPED | MEM_IMAGE)) && memoryItem->AllocationBaseItem == memoryItem)
+            imageHash = imageHash * 31 + PhHashIntPtr((ULONG_PTR)memoryItem->BaseAddress);
+    }
+
+    cache = PhpTakeMemoryRegionCache(List->ProcessId, &process->CreateTime);
+    threadsCached = cache && cache->ThreadHash == threadHash;
+    regionsCached = cache && cache->ImageHash == imageHash;
+
     // USER_SHARED_DATA
     PhpSetMemoryRegionType(List, USER_SHARED_DATA, TRUE, UserSharedDataRegion);
 
@@ -368,63 +646,121 @@ NTSTATUS PhpUpdateMemoryRegionTypes(
     }
 
     // TEB, stack
-    for (i = 0; i < process->NumberOfThreads; i++)
+    if (threadsCached)
     {
-        PSYSTEM_EXTENDED_THREAD_INFORMATION thread = (PSYSTEM_EXTENDED_THREAD_INFORMATION)process->Threads + i;
+        for (i = 0; i < cache->NumberOfEntries; i++)
+        {
+            PPH_MEMORY_REGION_CACHE_ENTRY entry = &cache->Entries[i];
+
+            if (entry->RegionType != TebRegion && entry->RegionType != StackRegion && entry->RegionType != Stack32Region)
+                continue;
+
+            memoryItem = PhLookupMemoryItemList(List, entry->BaseAddress);
+
+            if (!memoryItem || memoryItem->RegionType != UnknownRegion ||
+                PhpFindMemoryRegionCacheEntry(cache, memoryItem) != entry)
+                continue;
+
+            memoryItem->RegionType = entry->RegionType;
+
+            if (entry->RegionType == TebRegion)
+                memoryItem->u.Teb.ThreadId = entry->u.ThreadId;
+            else
+                memoryItem->u.Stack.ThreadId = entry->u.ThreadId;
+        }
+    }
+    else
+    {
+        PPH_VIRTUAL_MEMORY_RANGE ranges;
+        PNT_TIB ntTibs;
+        ULONG numberOfRanges;
+        ULONG j;
+
+        // Collect the TEBs first so that all of the NT_TIBs can be read with a single request.
 
-        if (WindowsVersion < WINDOWS_VISTA)
+        ranges = PhAllocate(max(process->NumberOfThreads, 1) * sizeof(PH_VIRTUAL_MEMORY_RANGE));
+        ntTibs = PhAllocate(max(process->NumberOfThreads, 1) * sizeof(NT_TIB));
+        numberOfRanges = 0;
+
+        for (i = 0; i < process->NumberOfThreads; i++)
         {
-            HANDLE threadHandle;
-            THREAD_BASIC_INFORMATION basicInfo;
+            PSYSTEM_EXTENDED_THREAD_INFORMATION thread = (PSYSTEM_EXTENDED_THREAD_INFORMATION)process->Threads + i;
 
-            if (NT_SUCCESS(PhOpenThread(&threadHandle, ThreadQueryAccess, thread->ThreadInfo.ClientId.UniqueThread)))
+            if (WindowsVersion < WINDOWS_VISTA)
             {
-                if (NT_SUCCESS(PhGetThreadBasicInformation(threadHandle, &basicInfo)))
-                    thread->TebBase = basicInfo.TebBaseAddress;
+                HANDLE threadHandle;
+                THREAD_BASIC_INFORMATION basicInfo;
+
+                if (NT_SUCCESS(PhOpenThread(&threadHandle, ThreadQueryAccess, thread->ThreadInfo.ClientId.UniqueThread)))
+                {
+                    if (NT_SUCCESS(PhGetThreadBasicInformation(threadHandle, &basicInfo)))
+                        thread->TebBase = basicInfo.TebBaseAddress;
 
-                NtClose(threadHandle);
+                    NtClose(threadHandle);
+                }
+            }
+
+            if (thread->TebBase)
+            {
+                if (memoryItem = PhpSetMemoryRegionType(List, thread->TebBase, TRUE, TebRegion))
+                    memoryItem->u.Teb.ThreadId = thread->ThreadInfo.ClientId.UniqueThread;
+
+                ranges[numberOfRanges].BaseAddress = thread->TebBase;
+                ranges[numberOfRanges].Length = sizeof(NT_TIB);
+                numberOfRanges++;
             }
         }
 
-        if (thread->TebBase)
+        if (numberOfRanges != 0)
+            PhReadVirtualMemoryScatter(ProcessHandle, ranges, numberOfRanges, ntTibs, numberOfRanges * sizeof(NT_TIB));
+
+        j = 0;
+
+        for (i = 0; i < process->NumberOfThreads; i++)
         {
-            NT_TIB ntTib;
-            SIZE_T bytesRead;
+            PSYSTEM_EXTENDED_THREAD_INFORMATION thread = (PSYSTEM_EXTENDED_THREAD_INFORMATION)process->Threads + i;
+            PNT_TIB ntTib;
+
+            if (!thread->TebBase)
+                continue;
+
+            ntTib = &ntTibs[j];
+            j++;
 
-            if (memoryItem = PhpSetMemoryRegionType(List, thread->TebBase, TRUE, TebRegion))
-                memoryItem->u.Teb.ThreadId = thread->ThreadInfo.ClientId.UniqueThread;
+            if (!NT_SUCCESS(ranges[j - 1].Status) || ranges[j - 1].NumberOfBytesRead != sizeof(NT_TIB))
+                continue;
 
-            if (NT_SUCCESS(PhReadVirtualMemory(ProcessHandle, thread->TebBase, &ntTib, sizeof(NT_TIB), &bytesRead)) &&
-                bytesRead == sizeof(NT_TIB))
+            if ((ULONG_PTR)ntTib->StackLimit < (ULONG_PTR)ntTib->StackBase)
             {
-                if ((ULONG_PTR)ntTib.StackLimit < (ULONG_PTR)ntTib.StackBase)
-                {
-                    if (memoryItem = PhpSetMemoryRegionType(List, ntTib.StackLimit, TRUE, StackRegion))
-                        memoryItem->u.Stack.ThreadId = thread->ThreadInfo.ClientId.UniqueThread;
-                }
+                if (memoryItem = PhpSetMemoryRegionType(List, ntTib->StackLimit, TRUE, StackRegion))
+                    memoryItem->u.Stack.ThreadId = thread->ThreadInfo.ClientId.UniqueThread;
+            }
 #ifdef _WIN64
 
-                if (isWow64 && ntTib.ExceptionList)
-                {
-                    ULONG teb32 = PtrToUlong(ntTib.ExceptionList);
-                    NT_TIB32 ntTib32;
+            if (isWow64 && ntTib->ExceptionList)
+            {
+                ULONG teb32 = PtrToUlong(ntTib->ExceptionList);
+                NT_TIB32 ntTib32;
+                SIZE_T bytesRead;
 
-                    // 64-bit and 32-bit TEBs usually share the same memory region, so don't do anything for the 32-bit
-                    // TEB.
+                // 64-bit and 32-bit TEBs usually share the same memory region, so don't do anything for the 32-bit
+                // TEB.
 
-                    if (NT_SUCCESS(PhReadVirtualMemory(ProcessHandle, UlongToPtr(teb32), &ntTib32, sizeof(NT_TIB32), &bytesRead)) &&
-                        bytesRead == sizeof(NT_TIB32))
+                if (NT_SUCCESS(PhReadVirtualMemory(ProcessHandle, UlongToPtr(teb32), &ntTib32, sizeof(NT_TIB32), &bytesRead)) &&
+                    bytesRead == sizeof(NT_TIB32))
+                {
+                    if (ntTib32.StackLimit < ntTib32.StackBase)
                     {
-                        if (ntTib32.StackLimit < ntTib32.StackBase)
-                        {
-                            if (memoryItem = PhpSetMemoryRegionType(List, UlongToPtr(ntTib32.StackLimit), TRUE, Stack32Region))
-                                memoryItem->u.Stack.ThreadId = thread->ThreadInfo.ClientId.UniqueThread;
-                        }
+                        if (memoryItem = PhpSetMemoryRegionType(List, UlongToPtr(ntTib32.StackLimit), TRUE, Stack32Region))
+                            memoryItem->u.Stack.ThreadId = thread->ThreadInfo.ClientId.UniqueThread;
                     }
                 }
-#endif
             }
+#endif
         }
+
+        PhFree(ntTibs);
+        PhFree(ranges);
     }
 
     // Mapped file, heap segment, unusable
@@ -435,6 +771,37 @@ NTSTATUS PhpUpdateMemoryRegionTypes(
         if (memoryItem->RegionType != UnknownRegion)
             continue;
 
+        if (regionsCached)
+        {
+            PPH_MEMORY_REGION_CACHE_ENTRY entry;
+            PPH_MEMORY_ITEM heapMemoryItem;
+
+            if (entry = PhpFindMemoryRegionCacheEntry(cache, memoryItem))
+            {
+                switch (entry->RegionType)
+                {
+                case UnknownRegion:
+                    continue;
+                case MappedFileRegion:
+                    memoryItem->RegionType = MappedFileRegion;
+                    PhSetReference(&memoryItem->u.MappedFile.FileName, entry->u.FileName);
+                    continue;
+                case HeapSegmentRegion:
+                case HeapSegment32Region:
+                    heapMemoryItem = PhLookupMemoryItemList(List, entry->u.HeapBaseAddress);
+
+                    if (heapMemoryItem && heapMemoryItem->BaseAddress == entry->u.HeapBaseAddress &&
+                        heapMemoryItem->RegionType == (entry->RegionType == HeapSegmentRegion ? HeapRegion : Heap32Region))
+                    {
+                        memoryItem->RegionType = entry->RegionType;
+                        memoryItem->u.HeapSegment.HeapItem = heapMemoryItem;
+                        continue;
+                    }
+                    break;
+                }
+            }
+        }
+
         if ((memoryItem->Type & (MEM_MAPPED | MEM_IMAGE)) && memoryItem->AllocationBaseItem == memoryItem)
         {
             PPH_STRING fileName;
@@ -512,12 +879,28 @@ NTSTATUS PhpUpdateMemoryRegionTypes(
         }
     }
 
+    if (cache)
+        PhpFreeMemoryRegionCache(cache);
+
+    PhpPutMemoryRegionCache(PhpCreateMemoryRegionCache(List, &process->CreateTime, threadHash, imageHash));
+
     PhFree(processes);
 
     return STATUS_SUCCESS;
 }
 
-NTSTATUS PhpUpdateMemoryWsCounters(
+static int __cdecl PhpWorkingSetBlockCompare(
+    _In_ const void *elem1,
+    _In_ const void *elem2
+    )
+{
+    PMEMORY_WORKING_SET_BLOCK block1 = (PMEMORY_WORKING_SET_BLOCK)elem1;
+    PMEMORY_WORKING_SET_BLOCK block2 = (PMEMORY_WORKING_SET_BLOCK)elem2;
+
+    return uintptrcmp(block1->VirtualPage, block2->VirtualPage);
+}
+
+static NTSTATUS PhpUpdateMemoryWsCountersForRegions(
     _In_ PPH_MEMORY_ITEM_LIST List,
     _In_ HANDLE ProcessHandle
     )
@@ -525,6 +908,9 @@ NTSTATUS PhpUpdateMemoryWsCounters(
     PLIST_ENTRY listEntry;
     PMEMORY_WORKING_SET_EX_INFORMATION info;
 
+    // Every committed page is queried, so this is only used when the working set is too
+    // large to be returned at once.
+
     info = PhAllocatePage(WS_REQUEST_COUNT * sizeof(MEMORY_WORKING_SET_EX_INFORMATION), NULL);
 
     if (!info)
@@ -592,43 +978,118 @@ NTSTATUS PhpUpdateMemoryWsCounters(
     return STATUS_SUCCESS;
 }
 
-NTSTATUS PhpUpdateMemoryWsCountersOld(
+NTSTATUS PhpUpdateMemoryWsCounters(
     _In_ PPH_MEMORY_ITEM_LIST List,
-    _In_ HANDLE ProcessHandle
+    _In_ HANDLE ProcessHandle,
+    _In_ BOOLEAN ExtendedInformation
     )
 {
     NTSTATUS status;
     PMEMORY_WORKING_SET_INFORMATION info;
-    PPH_MEMORY_ITEM memoryItem = NULL;
+    PMEMORY_WORKING_SET_EX_INFORMATION exInfo = NULL;
+    PLIST_ENTRY listEntry;
+    PPH_MEMORY_ITEM memoryItem;
     ULONG_PTR i;
+    ULONG_PTR j;
+    ULONG_PTR requestPages;
+    BOOLEAN exValid;
 
     if (!NT_SUCCESS(status = PhGetProcessWorkingSetInformation(ProcessHandle, &info)))
+    {
+        if (status == STATUS_INSUFFICIENT_RESOURCES && ExtendedInformation)
+            return PhpUpdateMemoryWsCountersForRegions(List, ProcessHandle);
+
         return status;
+    }
+
+    // Only resident pages are returned, in no particular order. Sorting them once lets
+    // them be matched against the region list (which is in address order) in a single
+    // pass, so the cost depends on the size of the working set and not on the size of
+    // the address space.
+    qsort(info->WorkingSetInfo, info->NumberOfEntries, sizeof(MEMORY_WORKING_SET_BLOCK), PhpWorkingSetBlockCompare);
 
-    for (i = 0; i < info->NumberOfEntries; i++)
+    if (ExtendedInformation)
+        exInfo = PhAllocatePage(WS_REQUEST_COUNT * sizeof(MEMORY_WORKING_SET_EX_INFORMATION), NULL);
+
+    listEntry = List->ListHead.Flink;
+
+    for (i = 0; i < info->NumberOfEntries && listEntry != &List->ListHead; i += requestPages)
     {
-        PMEMORY_WORKING_SET_BLOCK block = &info->WorkingSetInfo[i];
-        ULONG_PTR virtualAddress = block->VirtualPage * PAGE_SIZE;
+        requestPages = min(info->NumberOfEntries - i, WS_REQUEST_COUNT);
+        exValid = FALSE;
 
-        if (!memoryItem || virtualAddress < (ULONG_PTR)memoryItem->BaseAddress ||
-            virtualAddress >= (ULONG_PTR)memoryItem->BaseAddress + memoryItem->RegionSize)
+        if (exInfo)
         {
-            memoryItem = PhLookupMemoryItemList(List, (PVOID)virtualAddress);
+            // The extended information includes the locked state of each page.
+            for (j = 0; j < requestPages; j++)
+                exInfo[j].VirtualAddress = (PVOID)(info->WorkingSetInfo[i + j].VirtualPage * PAGE_SIZE);
+
+            exValid = NT_SUCCESS(NtQueryVirtualMemory(
+                ProcessHandle,
+                NULL,
+                MemoryWorkingSetExInformation,
+                exInfo,
+                requestPages * sizeof(MEMORY_WORKING_SET_EX_INFORMATION),
+                NULL
+                ));
         }
 
-        if (memoryItem)
+        for (j = 0; j < requestPages; j++)
         {
-            memoryItem->TotalWorkingSetPages++;
-
-            if (block->ShareCount > 1)
-                memoryItem->SharedWorkingSetPages++;
-            if (block->ShareCount == 0)
-                memoryItem->PrivateWorkingSetPages++;
-            if (block->Shared)
-                memoryItem->ShareableWorkingSetPages++;
+            PMEMORY_WORKING_SET_BLOCK block = &info->WorkingSetInfo[i + j];
+            ULONG_PTR virtualAddress = block->VirtualPage * PAGE_SIZE;
+
+            while (listEntry != &List->ListHead)
+            {
+                memoryItem = CONTAINING_RECORD(listEntry, PH_MEMORY_ITEM, ListEntry);
+
+                if (virtualAddress < (ULONG_PTR)memoryItem->BaseAddress + memoryItem->RegionSize)
+                    break;
+
+                listEntry = listEntry->Flink;
+            }
+
+            if (listEntry == &List->ListHead)
+                break;
+            if (virtualAddress < (ULONG_PTR)memoryItem->BaseAddress)
+                continue;
+
+            if (exValid)
+            {
+                PMEMORY_WORKING_SET_EX_BLOCK exBlock = &exInfo[j].u1.VirtualAttributes;
+
+                // The page may have been removed from the working set in the meantime.
+                if (!exBlock->Valid)
+                    continue;
+
+                memoryItem->TotalWorkingSetPages++;
+
+                if (exBlock->ShareCount > 1)
+                    memoryItem->SharedWorkingSetPages++;
+                if (exBlock->ShareCount == 0)
+                    memoryItem->PrivateWorkingSetPages++;
+                if (exBlock->Shared)
+                    memoryItem->ShareableWorkingSetPages++;
+                if (exBlock->Locked)
+                    memoryItem->LockedWorkingSetPages++;
+            }
+            else
+            {
+                memoryItem->TotalWorkingSetPages++;
+
+                if (block->ShareCount > 1)
+                    memoryItem->SharedWorkingSetPages++;
+                if (block->ShareCount == 0)
+                    memoryItem->PrivateWorkingSetPages++;
+                if (block->Shared)
+                    memoryItem->ShareableWorkingSetPages++;
+            }
         }
     }
 
+    if (exInfo)
+        PhFreePage(exInfo);
+
     PhFree(info);
 
     return STATUS_SUCCESS;
@@ -758,12 +1219,7 @@ ContinueLoop:
         PhpUpdateMemoryRegionTypes(List, processHandle);
 
     if (Flags & PH_QUERY_MEMORY_WS_COUNTERS)
-    {
-        if (WindowsVersion >= WINDOWS_SERVER_2003)
-            PhpUpdateMemoryWsCounters(List, processHandle);
-        else
-            PhpUpdateMemoryWsCountersOld(List, processHandle);
-    }
+        PhpUpdateMemoryWsCounters(List, processHandle, WindowsVersion >= WINDOWS_SERVER_2003);
 
     NtClose(processHandle);
 
@@ -35,7 +35,8 @@
 typedef struct _MEMORY_RESULTS_CONTEXT
 {
     HANDLE ProcessId;
-    PPH_LIST Results;
+    PPH_MEMORY_RESULTS Results;
+    WCHAR DisplayBuffer[PH_DISPLAY_BUFFER_COUNT + 1];
 
     PH_LAYOUT_MANAGER LayoutManager;
 } MEMORY_RESULTS_CONTEXT, *PMEMORY_RESULTS_CONTEXT;
@@ -51,12 +52,11 @@ static RECT MinimumSize = { -1, -1, -1, -1 };
 
 VOID PhShowMemoryResultsDialog(
     _In_ HANDLE ProcessId,
-    _In_ PPH_LIST Results
+    _In_ PPH_MEMORY_RESULTS Results
     )
 {
     HWND windowHandle;
     PMEMORY_RESULTS_CONTEXT context;
-    ULONG i;
 
     context = PhAllocate(sizeof(MEMORY_RESULTS_CONTEXT));
     context->ProcessId = ProcessId;
@@ -64,9 +64,6 @@ VOID PhShowMemoryResultsDialog(
 
     PhReferenceObject(Results);
 
-    for (i = 0; i < Results->Count; i++)
-        PhReferenceMemoryResult(Results->Items[i]);
-
     windowHandle = CreateDialogParam(
         PhInstanceHandle,
         MAKEINTRESOURCE(IDD_MEMRESULTS),
@@ -79,8 +76,9 @@ VOID PhShowMemoryResultsDialog(
 
 static PPH_STRING PhpGetStringForSelectedResults(
     _In_ HWND ListViewHandle,
-    _In_ PPH_LIST Results,
-    _In_ BOOLEAN All
+    _In_ PPH_MEMORY_RESULTS Results,
+    _In_ BOOLEAN All,
+    _Out_writes_(PH_DISPLAY_BUFFER_COUNT + 1) PWSTR DisplayBuffer
     )
 {
     PH_STRING_BUILDER stringBuilder;
@@ -98,10 +96,11 @@ static PPH_STRING PhpGetStringForSelectedResults(
                 continue;
         }
 
-        result = Results->Items[i];
+        result = PhGetMemoryResult(Results, i);
+        PhGetMemoryResultDisplay(result, DisplayBuffer);
 
         PhAppendFormatStringBuilder(&stringBuilder, L"0x%Ix (%u): %s\r\n", result->Address, result->Length,
-            result->Display.Buffer ? result->Display.Buffer : L"");
+            DisplayBuffer);
     }
 
     return PhFinalStringBuilderString(&stringBuilder);
@@ -114,11 +113,14 @@ static VOID FilterResults(
     )
 {
     PPH_STRING selectedChoice = NULL;
-    PPH_LIST results;
+    PPH_MEMORY_RESULTS results;
+    PWSTR displayBuffer;
+    ULONG displayLength;
     pcre2_code *compiledExpression;
     pcre2_match_data *matchData;
 
     results = Context->Results;
+    displayBuffer = Context->DisplayBuffer;
 
     SetCursor(LoadCursor(NULL, IDC_WAIT));
 
@@ -135,24 +137,23 @@ static VOID FilterResults(
         L"MemFilterChoices"
         ))
     {
-        PPH_LIST newResults = NULL;
+        PPH_MEMORY_RESULTS newResults = NULL;
         ULONG i;
 
         if (Type == FILTER_CONTAINS || Type == FILTER_CONTAINS_IGNORECASE)
         {
-            newResults = PhCreateList(1024);
+            newResults = PhCreateMemoryResults(results);
 
             if (Type == FILTER_CONTAINS)
             {
                 for (i = 0; i < results->Count; i++)
                 {
-                    PPH_MEMORY_RESULT result = results->Items[i];
+                    PPH_MEMORY_RESULT result = PhGetMemoryResult(results, i);
 
-                    if (wcsstr(result->Display.Buffer, selectedChoice->Buffer))
-                    {
-                        PhReferenceMemoryResult(result);
-                        PhAddItemList(newResults, result);
-                    }
+                    PhGetMemoryResultDisplay(result, displayBuffer);
+
+                    if (wcsstr(displayBuffer, selectedChoice->Buffer))
+                        PhCopyMemoryResult(newResults, result);
                 }
             }
             else
@@ -163,22 +164,13 @@ static VOID FilterResults(
 
                 for (i = 0; i < results->Count; i++)
                 {
-                    PPH_MEMORY_RESULT result = results->Items[i];
-                    PWSTR upperDisplay;
+                    PPH_MEMORY_RESULT result = PhGetMemoryResult(results, i);
 
-                    upperDisplay = PhAllocateForMemorySearch(result->Display.Length + sizeof(WCHAR));
-                    // Copy the null terminator as well.
-                    memcpy(upperDisplay, result->Display.Buffer, result->Display.Length + sizeof(WCHAR));
+                    PhGetMemoryResultDisplay(result, displayBuffer);
+                    _wcsupr(displayBuffer);
 
-                    _wcsupr(upperDisplay);
-
-                    if (wcsstr(upperDisplay, upperChoice->Buffer))
-                    {
-                        PhReferenceMemoryResult(result);
-                        PhAddItemList(newResults, result);
-                    }
-
-                    PhFreeForMemorySearch(upperDisplay);
+                    if (wcsstr(displayBuffer, upperChoice->Buffer))
+                        PhCopyMemoryResult(newResults, result);
                 }
             }
         }
@@ -207,24 +199,25 @@ static VOID FilterResults(
 
             matchData = pcre2_match_data_create_from_pattern(compiledExpression, NULL);
 
-            newResults = PhCreateList(1024);
+            newResults = PhCreateMemoryResults(results);
 
             for (i = 0; i < results->Count; i++)
             {
-                PPH_MEMORY_RESULT result = results->Items[i];
+                PPH_MEMORY_RESULT result = PhGetMemoryResult(results, i);
+
+                displayLength = PhGetMemoryResultDisplay(result, displayBuffer);
 
                 if (pcre2_match(
                     compiledExpression,
-                    result->Display.Buffer,
-                    result->Display.Length / sizeof(WCHAR),
+                    displayBuffer,
+                    displayLength,
                     0,
                     0,
                     matchData,
                     NULL
                     ) >= 0)
                 {
-                    PhReferenceMemoryResult(result);
-                    PhAddItemList(newResults, result);
+                    PhCopyMemoryResult(newResults, result);
                 }
             }
 
@@ -235,7 +228,6 @@ static VOID FilterResults(
         if (newResults)
         {
             PhShowMemoryResultsDialog(Context->ProcessId, newResults);
-            PhDereferenceMemoryResults((PPH_MEMORY_RESULT *)newResults->Items, newResults->Count);
             PhDereferenceObject(newResults);
             break;
         }
@@ -352,7 +344,6 @@ INT_PTR CALLBACK PhpMemoryResultsDlgProc(
             PhUnregisterDialog(hwndDlg);
             RemoveProp(hwndDlg, PhMakeContextAtom());
 
-            PhDereferenceMemoryResults((PPH_MEMORY_RESULT *)context->Results->Items, context->Results->Count);
             PhDereferenceObject(context->Results);
             PhFree(context);
         }
@@ -377,12 +368,12 @@ INT_PTR CALLBACK PhpMemoryResultsDlgProc(
                     if (selectedCount == 0)
                     {
                         // User didn't select anything, so copy all items.
-                        string = PhpGetStringForSelectedResults(lvHandle, context->Results, TRUE);
+                        string = PhpGetStringForSelectedResults(lvHandle, context->Results, TRUE, context->DisplayBuffer);
                         PhSetStateAllListViewItems(lvHandle, LVIS_SELECTED, LVIS_SELECTED);
                     }
                     else
                     {
-                        string = PhpGetStringForSelectedResults(lvHandle, context->Results, FALSE);
+                        string = PhpGetStringForSelectedResults(lvHandle, context->Results, FALSE, context->DisplayBuffer);
                     }
 
                     PhSetClipboardString(hwndDlg, &string->sr);
@@ -427,7 +418,7 @@ INT_PTR CALLBACK PhpMemoryResultsDlgProc(
                             PhWriteStringAsUtf8FileStream(fileStream, &PhUnicodeByteOrderMark);
                             PhWritePhTextHeader(fileStream);
 
-                            string = PhpGetStringForSelectedResults(GetDlgItem(hwndDlg, IDC_LIST), context->Results, TRUE);
+                            string = PhpGetStringForSelectedResults(GetDlgItem(hwndDlg, IDC_LIST), context->Results, TRUE, context->DisplayBuffer);
                             PhWriteStringAsUtf8FileStreamEx(fileStream, string->Buffer, string->Length);
                             PhDereferenceObject(string);
 
@@ -504,7 +495,7 @@ INT_PTR CALLBACK PhpMemoryResultsDlgProc(
 
                     if (dispInfo->item.mask & LVIF_TEXT)
                     {
-                        PPH_MEMORY_RESULT result = context->Results->Items[dispInfo->item.iItem];
+                        PPH_MEMORY_RESULT result = PhGetMemoryResult(context->Results, dispInfo->item.iItem);
 
                         switch (dispInfo->item.iSubItem)
                         {
@@ -535,10 +526,12 @@ INT_PTR CALLBACK PhpMemoryResultsDlgProc(
                             }
                             break;
                         case 2:
+                            // Display text is only widened when the row is drawn.
+                            PhGetMemoryResultDisplay(result, context->DisplayBuffer);
                             wcsncpy_s(
                                 dispInfo->item.pszText,
                                 dispInfo->item.cchTextMax,
-                                result->Display.Buffer,
+                                context->DisplayBuffer,
                                 _TRUNCATE
                                 );
                             break;
@@ -559,7 +552,7 @@ INT_PTR CALLBACK PhpMemoryResultsDlgProc(
                             )) != -1)
                         {
                             NTSTATUS status;
-                            PPH_MEMORY_RESULT result = context->Results->Items[index];
+                            PPH_MEMORY_RESULT result = PhGetMemoryResult(context->Results, index);
                             HANDLE processHandle;
                             MEMORY_BASIC_INFORMATION basicInfo;
                             PPH_SHOWMEMORYEDITOR showMemoryEditor;
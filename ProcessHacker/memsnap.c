@@ -0,0 +1,472 @@
+/*
+ * Process Hacker -
+ *   memory snapshots
+ *
+ * Copyright (C) 2016 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <phapp.h>
+#include <memsnap.h>
+
+#define PH_MEMORY_SNAPSHOT_READ_SIZE (1024 * 1024) // 1 MB
+#define PH_MEMORY_SNAPSHOT_MAXIMUM_RUN (1024 * 1024 * 1024) // 1 GB
+
+#define PH_MEMORY_SNAPSHOT_WRITABLE \
+    (PAGE_READWRITE | PAGE_WRITECOPY | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY)
+
+typedef enum _PH_MEMORY_SNAPSHOT_CHANGE
+{
+    MemorySnapshotUnchanged,
+    MemorySnapshotChanged,
+    MemorySnapshotProtectionChanged,
+    MemorySnapshotAdded,
+    MemorySnapshotFreed
+} PH_MEMORY_SNAPSHOT_CHANGE;
+
+typedef struct _PH_MEMORY_SNAPSHOT_RUN
+{
+    PH_MEMORY_SNAPSHOT_CHANGE Change;
+    ULONG_PTR Start;
+    SIZE_T Length;
+    PPH_MEMORY_SNAPSHOT_REGION OldRegion;
+    PPH_MEMORY_SNAPSHOT_REGION NewRegion;
+} PH_MEMORY_SNAPSHOT_RUN, *PPH_MEMORY_SNAPSHOT_RUN;
+
+static PPH_OBJECT_TYPE PhMemorySnapshotType;
+
+static VOID NTAPI PhpMemorySnapshotDeleteProcedure(
+    _In_ PVOID Object,
+    _In_ ULONG Flags
+    )
+{
+    PPH_MEMORY_SNAPSHOT snapshot = Object;
+
+    if (snapshot->Regions)
+        PhFree(snapshot->Regions);
+    if (snapshot->PageHashes)
+        PhFreePage(snapshot->PageHashes);
+}
+
+static ULONG64 PhpHashMemoryPage(
+    _In_reads_(PAGE_SIZE / sizeof(ULONG64)) PULONG64 Page
+    )
+{
+    ULONG64 hash;
+    ULONG i;
+
+    // FNV-1a over 64-bit words instead of bytes. Each step is a bijection of the hash,
+    // so a change to any single word always changes the result.
+
+    hash = 0xcbf29ce484222325;
+
+    for (i = 0; i < PAGE_SIZE / sizeof(ULONG64); i++)
+    {
+        hash ^= Page[i];
+        hash *= 0x100000001b3;
+    }
+
+    if (hash == PH_MEMORY_SNAPSHOT_UNREADABLE)
+        hash = 1;
+
+    return hash;
+}
+
+static PPH_MEMORY_SNAPSHOT_REGION PhpFindMemorySnapshotRegion(
+    _In_ PPH_MEMORY_SNAPSHOT Snapshot,
+    _In_ PVOID BaseAddress
+    )
+{
+    LONG low;
+    LONG high;
+    LONG i;
+
+    low = 0;
+    high = (LONG)Snapshot->NumberOfRegions - 1;
+
+    while (low <= high)
+    {
+        i = (low + high) / 2;
+
+        if ((ULONG_PTR)BaseAddress < (ULONG_PTR)Snapshot->Regions[i].BaseAddress)
+            high = i - 1;
+        else if ((ULONG_PTR)BaseAddress > (ULONG_PTR)Snapshot->Regions[i].BaseAddress)
+            low = i + 1;
+        else
+            return &Snapshot->Regions[i];
+    }
+
+    return NULL;
+}
+
+static VOID PhpHashMemorySnapshotRegion(
+    _In_ HANDLE ProcessHandle,
+    _Inout_ PPH_MEMORY_SNAPSHOT_REGION Region,
+    _Out_writes_bytes_(PH_MEMORY_SNAPSHOT_READ_SIZE) PVOID Buffer
+    )
+{
+    SIZE_T offset;
+    SIZE_T readSize;
+    SIZE_T pageOffset;
+    PULONG64 hash;
+
+    hash = Region->PageHashes;
+
+    if (Region->Protect & (PAGE_NOACCESS | PAGE_GUARD))
+    {
+        // Reading a guard page would change it.
+        memset(hash, 0, Region->RegionSize / PAGE_SIZE * sizeof(ULONG64));
+        return;
+    }
+
+    for (offset = 0; offset < Region->RegionSize; offset += readSize)
+    {
+        readSize = min(Region->RegionSize - offset, PH_MEMORY_SNAPSHOT_READ_SIZE);
+
+        if (NT_SUCCESS(NtReadVirtualMemory(
+            ProcessHandle,
+            PTR_ADD_OFFSET(Region->BaseAddress, offset),
+            Buffer,
+            readSize,
+            NULL
+            )))
+        {
+            for (pageOffset = 0; pageOffset < readSize; pageOffset += PAGE_SIZE)
+                *hash++ = PhpHashMemoryPage(PTR_ADD_OFFSET(Buffer, pageOffset));
+        }
+        else
+        {
+            // Part of the range could not be read. Fall back to reading one page at a time.
+            for (pageOffset = 0; pageOffset < readSize; pageOffset += PAGE_SIZE)
+            {
+                if (NT_SUCCESS(NtReadVirtualMemory(
+                    ProcessHandle,
+                    PTR_ADD_OFFSET(Region->BaseAddress, offset + pageOffset),
+                    Buffer,
+                    PAGE_SIZE,
+                    NULL
+                    )))
+                {
+                    *hash++ = PhpHashMemoryPage(Buffer);
+                }
+                else
+                {
+                    *hash++ = PH_MEMORY_SNAPSHOT_UNREADABLE;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Takes a snapshot of the committed memory of a process.
+ *
+ * \param ProcessId The ID of the process.
+ * \param PreviousSnapshot An earlier snapshot of the same process, or NULL.
+ * Regions that are not writable and are unchanged since \a PreviousSnapshot
+ * are not read again.
+ * \param Snapshot A variable which receives the snapshot. You must
+ * dereference the snapshot using PhDereferenceObject() when you no longer
+ * need it.
+ */
+NTSTATUS PhCreateMemorySnapshot(
+    _In_ HANDLE ProcessId,
+    _In_opt_ PPH_MEMORY_SNAPSHOT PreviousSnapshot,
+    _Out_ PPH_MEMORY_SNAPSHOT *Snapshot
+    )
+{
+    static PH_INITONCE initOnce = PH_INITONCE_INIT;
+    NTSTATUS status;
+    HANDLE processHandle;
+    PH_MEMORY_ITEM_LIST memoryItemList;
+    PLIST_ENTRY listEntry;
+    PPH_MEMORY_SNAPSHOT snapshot;
+    PPH_MEMORY_SNAPSHOT_REGION region;
+    PPH_MEMORY_SNAPSHOT_REGION previousRegion;
+    PULONG64 pageHashes;
+    PVOID buffer;
+    ULONG i;
+
+    if (PhBeginInitOnce(&initOnce))
+    {
+        PhMemorySnapshotType = PhCreateObjectType(L"MemorySnapshot", 0, PhpMemorySnapshotDeleteProcedure);
+        PhEndInitOnce(&initOnce);
+    }
+
+    if (!NT_SUCCESS(status = PhOpenProcess(
+        &processHandle,
+        PROCESS_QUERY_INFORMATION | PROCESS_VM_READ,
+        ProcessId
+        )))
+        return status;
+
+    if (!NT_SUCCESS(status = PhQueryMemoryItemList(ProcessId, PH_QUERY_MEMORY_IGNORE_FREE, &memoryItemList)))
+    {
+        NtClose(processHandle);
+        return status;
+    }
+
+    snapshot = PhCreateObject(sizeof(PH_MEMORY_SNAPSHOT), PhMemorySnapshotType);
+    memset(snapshot, 0, sizeof(PH_MEMORY_SNAPSHOT));
+    snapshot->ProcessId = ProcessId;
+
+    for (listEntry = memoryItemList.ListHead.Flink; listEntry != &memoryItemList.ListHead; listEntry = listEntry->Flink)
+    {
+        PPH_MEMORY_ITEM memoryItem = CONTAINING_RECORD(listEntry, PH_MEMORY_ITEM, ListEntry);
+
+        if (memoryItem->State & MEM_COMMIT)
+        {
+            snapshot->NumberOfRegions++;
+            snapshot->NumberOfPages += memoryItem->RegionSize / PAGE_SIZE;
+        }
+    }
+
+    snapshot->Regions = PhAllocate(max(snapshot->NumberOfRegions, 1) * sizeof(PH_MEMORY_SNAPSHOT_REGION));
+
+    if (!(snapshot->PageHashes = PhAllocatePage(max(snapshot->NumberOfPages, 1) * sizeof(ULONG64), NULL)))
+    {
+        PhDeleteMemoryItemList(&memoryItemList);
+        PhDereferenceObject(snapshot);
+        NtClose(processHandle);
+        return STATUS_NO_MEMORY;
+    }
+
+    region = snapshot->Regions;
+    pageHashes = snapshot->PageHashes;
+
+    for (listEntry = memoryItemList.ListHead.Flink; listEntry != &memoryItemList.ListHead; listEntry = listEntry->Flink)
+    {
+        PPH_MEMORY_ITEM memoryItem = CONTAINING_RECORD(listEntry, PH_MEMORY_ITEM, ListEntry);
+
+        if (memoryItem->State & MEM_COMMIT)
+        {
+            region->BaseAddress = memoryItem->BaseAddress;
+            region->RegionSize = memoryItem->RegionSize;
+            region->Protect = memoryItem->Protect;
+            region->Type = memoryItem->Type;
+            region->PageHashes = pageHashes;
+            pageHashes += memoryItem->RegionSize / PAGE_SIZE;
+            region++;
+        }
+    }
+
+    PhDeleteMemoryItemList(&memoryItemList);
+
+    buffer = PhAllocatePage(PH_MEMORY_SNAPSHOT_READ_SIZE, NULL);
+
+    for (i = 0; i < snapshot->NumberOfRegions; i++)
+    {
+        region = &snapshot->Regions[i];
+
+        // Pages that cannot be written can only change if the region is replaced or its
+        // protection changes, so their hashes can be taken from the previous snapshot.
+        if (PreviousSnapshot &&
+            !(region->Protect & PH_MEMORY_SNAPSHOT_WRITABLE) &&
+            (previousRegion = PhpFindMemorySnapshotRegion(PreviousSnapshot, region->BaseAddress)) &&
+            previousRegion->RegionSize == region->RegionSize &&
+            previousRegion->Protect == region->Protect &&
+            previousRegion->Type == region->Type)
+        {
+            memcpy(region->PageHashes, previousRegion->PageHashes, region->RegionSize / PAGE_SIZE * sizeof(ULONG64));
+        }
+        else if (buffer)
+        {
+            PhpHashMemorySnapshotRegion(processHandle, region, buffer);
+            snapshot->NumberOfPagesRead += region->RegionSize / PAGE_SIZE;
+        }
+        else
+        {
+            memset(region->PageHashes, 0, region->RegionSize / PAGE_SIZE * sizeof(ULONG64));
+        }
+    }
+
+    if (buffer)
+        PhFreePage(buffer);
+
+    NtClose(processHandle);
+
+    *Snapshot = snapshot;
+
+    return STATUS_SUCCESS;
+}
+
+static VOID PhpFlushMemorySnapshotRun(
+    _Inout_ PPH_MEMORY_SNAPSHOT_RUN Run,
+    _Inout_ PPH_MEMORY_RESULTS Results
+    )
+{
+    PPH_STRING display;
+    WCHAR oldProtect[17];
+    WCHAR newProtect[17];
+
+    if (Run->Change == MemorySnapshotUnchanged || Run->Length == 0)
+        return;
+
+    if (Run->OldRegion)
+        PhGetMemoryProtectionString(Run->OldRegion->Protect, oldProtect);
+    if (Run->NewRegion)
+        PhGetMemoryProtectionString(Run->NewRegion->Protect, newProtect);
+
+    switch (Run->Change)
+    {
+    case MemorySnapshotChanged:
+        display = PhFormatString(L"Changed: %s, %s", PhGetMemoryTypeString(Run->NewRegion->Type), newProtect);
+        break;
+    case MemorySnapshotProtectionChanged:
+        display = PhFormatString(L"Protection changed: %s -> %s", oldProtect, newProtect);
+        break;
+    case MemorySnapshotAdded:
+        display = PhFormatString(L"Added: %s, %s", PhGetMemoryTypeString(Run->NewRegion->Type), newProtect);
+        break;
+    case MemorySnapshotFreed:
+        display = PhFormatString(L"Freed: %s, %s", PhGetMemoryTypeString(Run->OldRegion->Type), oldProtect);
+        break;
+    default:
+        return;
+    }
+
+    PhAddMemoryResult(Results, (PVOID)Run->Start, (ULONG)Run->Length, display->Buffer, (ULONG)display->Length / sizeof(WCHAR), TRUE);
+    PhDereferenceObject(display);
+}
+
+static VOID PhpAddMemorySnapshotPage(
+    _Inout_ PPH_MEMORY_SNAPSHOT_RUN Run,
+    _Inout_ PPH_MEMORY_RESULTS Results,
+    _In_ PH_MEMORY_SNAPSHOT_CHANGE Change,
+    _In_ ULONG_PTR Address,
+    _In_opt_ PPH_MEMORY_SNAPSHOT_REGION OldRegion,
+    _In_opt_ PPH_MEMORY_SNAPSHOT_REGION NewRegion
+    )
+{
+    // Adjacent pages with the same change in the same regions are reported as one result.
+    if (Run->Change == Change &&
+        Run->OldRegion == OldRegion &&
+        Run->NewRegion == NewRegion &&
+        Run->Start + Run->Length == Address &&
+        Run->Length < PH_MEMORY_SNAPSHOT_MAXIMUM_RUN)
+    {
+        Run->Length += PAGE_SIZE;
+        return;
+    }
+
+    PhpFlushMemorySnapshotRun(Run, Results);
+
+    Run->Change = Change;
+    Run->Start = Address;
+    Run->Length = PAGE_SIZE;
+    Run->OldRegion = OldRegion;
+    Run->NewRegion = NewRegion;
+}
+
+/**
+ * Compares two memory snapshots of a process.
+ *
+ * \param OldSnapshot The earlier snapshot.
+ * \param NewSnapshot The later snapshot.
+ * \param Results The set of results which receives a result for each range
+ * of pages that was changed, committed, freed or had its protection changed.
+ */
+VOID PhDiffMemorySnapshots(
+    _In_ PPH_MEMORY_SNAPSHOT OldSnapshot,
+    _In_ PPH_MEMORY_SNAPSHOT NewSnapshot,
+    _Inout_ PPH_MEMORY_RESULTS Results
+    )
+{
+    PH_MEMORY_SNAPSHOT_RUN run;
+    ULONG oldIndex = 0;
+    ULONG newIndex = 0;
+    ULONG_PTR address = 0;
+
+    memset(&run, 0, sizeof(PH_MEMORY_SNAPSHOT_RUN));
+
+    // Walk both region lists in address order. Each step covers a range of pages that
+    // lies entirely inside or outside the current region of each snapshot.
+
+    while (oldIndex < OldSnapshot->NumberOfRegions || newIndex < NewSnapshot->NumberOfRegions)
+    {
+        PPH_MEMORY_SNAPSHOT_REGION oldRegion = NULL;
+        PPH_MEMORY_SNAPSHOT_REGION newRegion = NULL;
+        ULONG_PTR oldStart = MAXULONG_PTR;
+        ULONG_PTR newStart = MAXULONG_PTR;
+        ULONG_PTR end;
+        BOOLEAN inOld;
+        BOOLEAN inNew;
+
+        if (oldIndex < OldSnapshot->NumberOfRegions)
+        {
+            oldRegion = &OldSnapshot->Regions[oldIndex];
+            oldStart = (ULONG_PTR)oldRegion->BaseAddress;
+
+            if (address >= oldStart + oldRegion->RegionSize)
+            {
+                oldIndex++;
+                continue;
+            }
+        }
+
+        if (newIndex < NewSnapshot->NumberOfRegions)
+        {
+            newRegion = &NewSnapshot->Regions[newIndex];
+            newStart = (ULONG_PTR)newRegion->BaseAddress;
+
+            if (address >= newStart + newRegion->RegionSize)
+            {
+                newIndex++;
+                continue;
+            }
+        }
+
+        inOld = oldRegion && address >= oldStart;
+        inNew = newRegion && address >= newStart;
+
+        if (!inOld && !inNew)
+        {
+            address = min(oldStart, newStart);
+            continue;
+        }
+
+        end = MAXULONG_PTR;
+
+        if (oldRegion)
+            end = min(end, inOld ? oldStart + oldRegion->RegionSize : oldStart);
+        if (newRegion)
+            end = min(end, inNew ? newStart + newRegion->RegionSize : newStart);
+
+        for (; address < end; address += PAGE_SIZE)
+        {
+            PH_MEMORY_SNAPSHOT_CHANGE change;
+
+            if (inOld && inNew)
+            {
+                if (oldRegion->PageHashes[(address - oldStart) / PAGE_SIZE] != newRegion->PageHashes[(address - newStart) / PAGE_SIZE])
+                    change = MemorySnapshotChanged;
+                else if (oldRegion->Protect != newRegion->Protect)
+                    change = MemorySnapshotProtectionChanged;
+                else
+                    change = MemorySnapshotUnchanged;
+            }
+            else
+            {
+                change = inNew ? MemorySnapshotAdded : MemorySnapshotFreed;
+            }
+
+            PhpAddMemorySnapshotPage(&run, Results, change, address, inOld ? oldRegion : NULL, inNew ? newRegion : NULL);
+        }
+    }
+
+    PhpFlushMemorySnapshotRun(&run, Results);
+}
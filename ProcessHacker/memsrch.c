@@ -22,6 +22,7 @@
 
 #include <phapp.h>
 #include <memsrch.h>
+#include "pcre/pcre2.h"
 #include <windowsx.h>
 
 #define WM_PH_MEMORY_STATUS_UPDATE (WM_APP + 301)
@@ -29,6 +30,10 @@
 #define PH_SEARCH_UPDATE 1
 #define PH_SEARCH_COMPLETED 2
 
+#define PH_MEMORY_SEARCH_CHUNK_SIZE (16 * 1024 * 1024) // 16 MB
+#define PH_MEMORY_PATTERN_CHUNK_SIZE (4 * 1024 * 1024) // 4 MB
+#define PH_MEMORY_RESULTS_ARENA_SIZE (1024 * 1024) // 1 MB
+
 typedef struct _MEMORY_STRING_CONTEXT
 {
     HANDLE ProcessId;
@@ -38,11 +43,13 @@ typedef struct _MEMORY_STRING_CONTEXT
     BOOLEAN Private;
     BOOLEAN Image;
     BOOLEAN Mapped;
+    pcre2_code *CompiledExpression; // search for a pattern instead of strings
 
     HWND WindowHandle;
     HANDLE ThreadHandle;
     PH_MEMORY_STRING_OPTIONS Options;
-    PPH_LIST Results;
+    PH_MEMORY_PATTERN_OPTIONS PatternOptions;
+    PPH_MEMORY_RESULTS Results;
 } MEMORY_STRING_CONTEXT, *PMEMORY_STRING_CONTEXT;
 
 INT_PTR CALLBACK PhpMemoryStringDlgProc(
@@ -59,156 +66,291 @@ INT_PTR CALLBACK PhpMemoryStringProgressDlgProc(
     _In_ LPARAM lParam
     );
 
-PVOID PhMemorySearchHeap = NULL;
-LONG PhMemorySearchHeapRefCount = 0;
-PH_QUEUED_LOCK PhMemorySearchHeapLock = PH_QUEUED_LOCK_INIT;
+static PPH_OBJECT_TYPE PhMemoryResultsType;
 
-PVOID PhAllocateForMemorySearch(
-    _In_ SIZE_T Size
+static VOID NTAPI PhpMemoryResultsDeleteProcedure(
+    _In_ PVOID Object,
+    _In_ ULONG Flags
     )
 {
-    PVOID memory;
+    PPH_MEMORY_RESULTS results = Object;
+    ULONG i;
 
-    PhAcquireQueuedLockExclusive(&PhMemorySearchHeapLock);
+    for (i = 0; i < results->Blocks->Count; i++)
+        PhFree(results->Blocks->Items[i]);
 
-    if (!PhMemorySearchHeap)
-    {
-        assert(PhMemorySearchHeapRefCount == 0);
-        PhMemorySearchHeap = RtlCreateHeap(
-            HEAP_GROWABLE | HEAP_CLASS_1,
-            NULL,
-            8192 * 1024, // 8 MB
-            2048 * 1024, // 2 MB
-            NULL,
-            NULL
-            );
-    }
+    for (i = 0; i < results->Arenas->Count; i++)
+        PhFreePage(results->Arenas->Items[i]);
 
-    if (PhMemorySearchHeap)
-    {
-        // Don't use HEAP_NO_SERIALIZE - it's very slow on Vista and above.
-        memory = RtlAllocateHeap(PhMemorySearchHeap, 0, Size);
+    PhDereferenceObject(results->Blocks);
+    PhDereferenceObject(results->Arenas);
 
-        if (memory)
-            PhMemorySearchHeapRefCount++;
-    }
-    else
+    if (results->Source)
+        PhDereferenceObject(results->Source);
+}
+
+/**
+ * Creates an empty set of memory results.
+ *
+ * \param Source A set of results which PhCopyMemoryResult() will copy results
+ * from, or NULL.
+ */
+PPH_MEMORY_RESULTS PhCreateMemoryResults(
+    _In_opt_ PPH_MEMORY_RESULTS Source
+    )
+{
+    static PH_INITONCE initOnce = PH_INITONCE_INIT;
+    PPH_MEMORY_RESULTS results;
+
+    if (PhBeginInitOnce(&initOnce))
     {
-        memory = NULL;
+        PhMemoryResultsType = PhCreateObjectType(L"MemoryResults", 0, PhpMemoryResultsDeleteProcedure);
+        PhEndInitOnce(&initOnce);
     }
 
-    PhReleaseQueuedLockExclusive(&PhMemorySearchHeapLock);
+    results = PhCreateObject(sizeof(PH_MEMORY_RESULTS), PhMemoryResultsType);
+    memset(results, 0, sizeof(PH_MEMORY_RESULTS));
+    results->Blocks = PhCreateList(16);
+    results->Arenas = PhCreateList(16);
+    PhSetReference(&results->Source, Source);
 
-    return memory;
+    return results;
 }
 
-VOID PhFreeForMemorySearch(
-    _In_ _Post_invalid_ PVOID Memory
+static PPH_MEMORY_RESULT PhpAllocateMemoryResult(
+    _Inout_ PPH_MEMORY_RESULTS Results
     )
 {
-    PhAcquireQueuedLockExclusive(&PhMemorySearchHeapLock);
-
-    RtlFreeHeap(PhMemorySearchHeap, 0, Memory);
+    if ((Results->Count & (PH_MEMORY_RESULTS_BLOCK_SIZE - 1)) == 0)
+        PhAddItemList(Results->Blocks, PhAllocate(PH_MEMORY_RESULTS_BLOCK_SIZE * sizeof(PH_MEMORY_RESULT)));
 
-    if (--PhMemorySearchHeapRefCount == 0)
-    {
-        RtlDestroyHeap(PhMemorySearchHeap);
-        PhMemorySearchHeap = NULL;
-    }
-
-    PhReleaseQueuedLockExclusive(&PhMemorySearchHeapLock);
+    return PhGetMemoryResult(Results, Results->Count++);
 }
 
-PVOID PhCreateMemoryResult(
+/**
+ * Adds a result to a set of memory results.
+ *
+ * \param Results The set of results.
+ * \param Address The address of the result.
+ * \param Length The length of the result, in bytes.
+ * \param Display The text to display for the result. It is truncated to
+ * PH_DISPLAY_BUFFER_COUNT characters.
+ * \param DisplayLength The number of characters in \a Display.
+ * \param WideDisplay TRUE if \a Display is UTF-16, FALSE if it is ANSI.
+ *
+ * \remarks This function is not thread-safe.
+ */
+VOID PhAddMemoryResult(
+    _Inout_ PPH_MEMORY_RESULTS Results,
     _In_ PVOID Address,
-    _In_ SIZE_T Length
+    _In_ ULONG Length,
+    _In_reads_bytes_(DisplayLength * (WideDisplay ? sizeof(WCHAR) : sizeof(CHAR))) PVOID Display,
+    _In_ ULONG DisplayLength,
+    _In_ BOOLEAN WideDisplay
     )
 {
     PPH_MEMORY_RESULT result;
+    SIZE_T displaySize;
 
-    result = PhAllocateForMemorySearch(sizeof(PH_MEMORY_RESULT));
+    DisplayLength = min(DisplayLength, PH_DISPLAY_BUFFER_COUNT);
+    displaySize = DisplayLength * (WideDisplay ? sizeof(WCHAR) : sizeof(CHAR));
 
-    if (!result)
-        return NULL;
+    // Keep UTF-16 text aligned.
+    if (WideDisplay && (PtrToUlong(Results->ArenaPosition) & 1) && Results->ArenaRemaining != 0)
+    {
+        Results->ArenaPosition++;
+        Results->ArenaRemaining--;
+    }
 
-    result->RefCount = 1;
+    if (Results->ArenaRemaining < displaySize)
+    {
+        if (!(Results->ArenaPosition = PhAllocatePage(PH_MEMORY_RESULTS_ARENA_SIZE, NULL)))
+        {
+            Results->ArenaRemaining = 0;
+            return;
+        }
+
+        PhAddItemList(Results->Arenas, Results->ArenaPosition);
+        Results->ArenaRemaining = PH_MEMORY_RESULTS_ARENA_SIZE;
+    }
+
+    result = PhpAllocateMemoryResult(Results);
     result->Address = Address;
     result->Length = Length;
-    result->Display.Length = 0;
-    result->Display.Buffer = NULL;
+    result->DisplayLength = DisplayLength;
+    result->WideDisplay = !!WideDisplay;
+    result->Display = Results->ArenaPosition;
+    memcpy(Results->ArenaPosition, Display, displaySize);
 
-    return result;
+    Results->ArenaPosition += displaySize;
+    Results->ArenaRemaining -= displaySize;
 }
 
-VOID PhReferenceMemoryResult(
+/**
+ * Adds a result from another set of memory results, sharing its display text.
+ *
+ * \param Results The set of results, created with the set that contains
+ * \a Result as its source.
+ * \param Result The result to copy.
+ */
+VOID PhCopyMemoryResult(
+    _Inout_ PPH_MEMORY_RESULTS Results,
     _In_ PPH_MEMORY_RESULT Result
     )
 {
-    _InterlockedIncrement(&Result->RefCount);
+    assert(Results->Source);
+    *PhpAllocateMemoryResult(Results) = *Result;
 }
 
-VOID PhDereferenceMemoryResult(
-    _In_ PPH_MEMORY_RESULT Result
+static int __cdecl PhpMemoryResultCompare(
+    _In_ const void *elem1,
+    _In_ const void *elem2
     )
 {
-    if (_InterlockedDecrement(&Result->RefCount) == 0)
+    PPH_MEMORY_RESULT result1 = (PPH_MEMORY_RESULT)elem1;
+    PPH_MEMORY_RESULT result2 = (PPH_MEMORY_RESULT)elem2;
+
+    return uintptrcmp((ULONG_PTR)result1->Address, (ULONG_PTR)result2->Address);
+}
+
+/**
+ * Sorts a set of memory results by address.
+ *
+ * \param Results The set of results.
+ */
+VOID PhSortMemoryResults(
+    _Inout_ PPH_MEMORY_RESULTS Results
+    )
+{
+    PPH_MEMORY_RESULT flat;
+    ULONG i;
+    ULONG count;
+
+    if (Results->Count < 2)
+        return;
+
+    // The blocks are copied into one array for sorting, which is cheaper than sorting
+    // through PhGetMemoryResult.
+    if (!(flat = PhAllocateSafe(Results->Count * sizeof(PH_MEMORY_RESULT))))
+        return;
+
+    for (i = 0; i < Results->Count; i += count)
     {
-        if (Result->Display.Buffer)
-            PhFreeForMemorySearch(Result->Display.Buffer);
+        count = min(Results->Count - i, PH_MEMORY_RESULTS_BLOCK_SIZE);
+        memcpy(flat + i, PhGetMemoryResult(Results, i), count * sizeof(PH_MEMORY_RESULT));
+    }
+
+    qsort(flat, Results->Count, sizeof(PH_MEMORY_RESULT), PhpMemoryResultCompare);
 
-        PhFreeForMemorySearch(Result);
+    for (i = 0; i < Results->Count; i += count)
+    {
+        count = min(Results->Count - i, PH_MEMORY_RESULTS_BLOCK_SIZE);
+        memcpy(PhGetMemoryResult(Results, i), flat + i, count * sizeof(PH_MEMORY_RESULT));
     }
+
+    PhFree(flat);
 }
 
-VOID PhDereferenceMemoryResults(
-    _In_reads_(NumberOfResults) PPH_MEMORY_RESULT *Results,
-    _In_ ULONG NumberOfResults
+/**
+ * Gets the display text of a memory result.
+ *
+ * \param Result The result.
+ * \param Buffer A buffer which receives the null-terminated text.
+ *
+ * \return The number of characters in the text, not including the null
+ * terminator.
+ */
+ULONG PhGetMemoryResultDisplay(
+    _In_ PPH_MEMORY_RESULT Result,
+    _Out_writes_(PH_DISPLAY_BUFFER_COUNT + 1) PWSTR Buffer
     )
 {
     ULONG i;
 
-    for (i = 0; i < NumberOfResults; i++)
-        PhDereferenceMemoryResult(Results[i]);
+    if (Result->WideDisplay)
+    {
+        memcpy(Buffer, Result->Display, Result->DisplayLength * sizeof(WCHAR));
+    }
+    else
+    {
+        for (i = 0; i < Result->DisplayLength; i++)
+            Buffer[i] = ((PUCHAR)Result->Display)[i];
+    }
+
+    Buffer[Result->DisplayLength] = 0;
+
+    return Result->DisplayLength;
 }
 
-VOID PhSearchMemoryString(
-    _In_ HANDLE ProcessHandle,
-    _In_ PPH_MEMORY_STRING_OPTIONS Options
-    )
+typedef VOID (NTAPI *PPH_MEMORY_REGION_SEARCH_FUNCTION)(
+    _In_ PVOID BaseAddress,
+    _In_ SIZE_T Size,
+    _In_ PVOID Context
+    );
+
+typedef struct _PH_MEMORY_REGION_SEARCH_ITEM
 {
-    ULONG minimumLength;
-    BOOLEAN detectUnicode;
-    ULONG memoryTypeMask;
-    PVOID baseAddress;
-    MEMORY_BASIC_INFORMATION basicInfo;
-    PUCHAR buffer;
-    SIZE_T bufferSize;
-    PWSTR displayBuffer;
-    SIZE_T displayBufferCount;
+    PPH_MEMORY_SEARCH_OPTIONS Options;
+    PPH_MEMORY_REGION_SEARCH_FUNCTION Function;
+    PVOID Context;
+    PVOID BaseAddress;
+    SIZE_T Size;
+} PH_MEMORY_REGION_SEARCH_ITEM, *PPH_MEMORY_REGION_SEARCH_ITEM;
+
+typedef struct _PH_MEMORY_STRING_SEARCH
+{
+    HANDLE ProcessHandle;
+    PPH_MEMORY_STRING_OPTIONS Options;
+    PH_QUEUED_LOCK ResultsLock;
+} PH_MEMORY_STRING_SEARCH, *PPH_MEMORY_STRING_SEARCH;
 
-    minimumLength = Options->MinimumLength;
-    detectUnicode = Options->DetectUnicode;
-    memoryTypeMask = Options->MemoryTypeMask;
+typedef struct _PH_MEMORY_PATTERN_SEARCH
+{
+    HANDLE ProcessHandle;
+    PPH_MEMORY_PATTERN_OPTIONS Options;
+    PH_QUEUED_LOCK ResultsLock;
+} PH_MEMORY_PATTERN_SEARCH, *PPH_MEMORY_PATTERN_SEARCH;
 
-    if (minimumLength < 4)
-        return;
+static NTSTATUS NTAPI PhpSearchMemoryRegionWorker(
+    _In_ PVOID Parameter
+    )
+{
+    PPH_MEMORY_REGION_SEARCH_ITEM item = Parameter;
 
-    baseAddress = (PVOID)0;
+    if (!item->Options->Cancel)
+        item->Function(item->BaseAddress, item->Size, item->Context);
 
-    bufferSize = PAGE_SIZE * 64;
-    buffer = PhAllocatePage(bufferSize, NULL);
+    PhFree(item);
 
-    if (!buffer)
-        return;
+    return STATUS_SUCCESS;
+}
+
+/**
+ * Calls a function for each committed, accessible region of a process in parallel.
+ *
+ * \param ProcessHandle A handle to the process.
+ * \param Options The search options. The search stops when Cancel is set.
+ * \param MemoryTypeMask The types of regions to search.
+ * \param MaximumSize Regions larger than this are split into pieces of this size.
+ * \param Function The function to call for each region.
+ * \param Context A user-defined value to pass to \a Function.
+ */
+static VOID PhpSearchMemoryRegions(
+    _In_ HANDLE ProcessHandle,
+    _In_ PPH_MEMORY_SEARCH_OPTIONS Options,
+    _In_ ULONG MemoryTypeMask,
+    _In_ SIZE_T MaximumSize,
+    _In_ PPH_MEMORY_REGION_SEARCH_FUNCTION Function,
+    _In_ PVOID Context
+    )
+{
+    PH_WORK_QUEUE workQueue;
+    PVOID baseAddress;
+    MEMORY_BASIC_INFORMATION basicInfo;
 
-    displayBufferCount = PH_DISPLAY_BUFFER_COUNT;
-    displayBuffer = PhAllocatePage((displayBufferCount + 1) * sizeof(WCHAR), NULL);
+    PhInitializeWorkQueue(&workQueue, 0, PhSystemBasicInformation.NumberOfProcessors, 1000);
 
-    if (!displayBuffer)
-    {
-        PhFreePage(buffer);
-        return;
-    }
+    baseAddress = (PVOID)0;
 
     while (NT_SUCCESS(NtQueryVirtualMemory(
         ProcessHandle,
@@ -220,247 +362,598 @@ VOID PhSearchMemoryString(
         )))
     {
         ULONG_PTR offset;
-        SIZE_T readSize;
+        PPH_MEMORY_REGION_SEARCH_ITEM item;
 
-        if (Options->Header.Cancel)
+        if (Options->Cancel)
             break;
         if (basicInfo.State != MEM_COMMIT)
             goto ContinueLoop;
-        if ((basicInfo.Type & memoryTypeMask) == 0)
+        if ((basicInfo.Type & MemoryTypeMask) == 0)
             goto ContinueLoop;
         if (basicInfo.Protect == PAGE_NOACCESS)
             goto ContinueLoop;
         if (basicInfo.Protect & PAGE_GUARD)
             goto ContinueLoop;
 
-        readSize = basicInfo.RegionSize;
+        for (offset = 0; offset < basicInfo.RegionSize; offset += MaximumSize)
+        {
+            item = PhAllocate(sizeof(PH_MEMORY_REGION_SEARCH_ITEM));
+            item->Options = Options;
+            item->Function = Function;
+            item->Context = Context;
+            item->BaseAddress = PTR_ADD_OFFSET(baseAddress, offset);
+            item->Size = min(basicInfo.RegionSize - offset, MaximumSize);
+            PhQueueItemWorkQueue(&workQueue, PhpSearchMemoryRegionWorker, item);
+        }
 
-        if (basicInfo.RegionSize > bufferSize)
+ContinueLoop:
+        baseAddress = PTR_ADD_OFFSET(baseAddress, basicInfo.RegionSize);
+    }
+
+    PhWaitForWorkQueue(&workQueue);
+    PhDeleteWorkQueue(&workQueue);
+}
+
+/**
+ * Finds the first 16 byte block that contains a printable character.
+ *
+ * \param Buffer The buffer.
+ * \param Index The index to start at.
+ * \param Size The size of the buffer.
+ *
+ * \return The index of the first block containing a printable character, or
+ * the index of the trailing partial block if there is none.
+ */
+static ULONG_PTR PhpSkipNonPrintableBlocks(
+    _In_reads_bytes_(Size) PUCHAR Buffer,
+    _In_ ULONG_PTR Index,
+    _In_ SIZE_T Size
+    )
+{
+    __m128i b;
+    __m128i printable;
+
+    // PhCharIsPrintable contains ' ' to '~', TAB, LF and CR. Bytes above 127 are
+    // negative as signed bytes, so they fall outside the range.
+    while (Index + 16 <= Size)
+    {
+        b = _mm_loadu_si128((__m128i *)(Buffer + Index));
+        printable = _mm_and_si128(
+            _mm_cmpgt_epi8(b, _mm_set1_epi8(' ' - 1)),
+            _mm_cmplt_epi8(b, _mm_set1_epi8(127))
+            );
+        printable = _mm_or_si128(printable, _mm_cmpeq_epi8(b, _mm_set1_epi8('\t')));
+        printable = _mm_or_si128(printable, _mm_cmpeq_epi8(b, _mm_set1_epi8('\n')));
+        printable = _mm_or_si128(printable, _mm_cmpeq_epi8(b, _mm_set1_epi8('\r')));
+
+        if (_mm_movemask_epi8(printable) != 0)
+            break;
+
+        Index += 16;
+    }
+
+    return Index;
+}
+
+static VOID PhpSearchMemoryStringBuffer(
+    _In_ PPH_MEMORY_STRING_SEARCH Search,
+    _In_ PVOID BaseAddress,
+    _In_reads_bytes_(Size) PUCHAR Buffer,
+    _In_ SIZE_T Size,
+    _Out_writes_(PH_DISPLAY_BUFFER_COUNT) PUCHAR DisplayBuffer
+    )
+{
+    BOOLEAN useSse2;
+    ULONG_PTR i;
+    UCHAR byte; // current byte
+    UCHAR byte1; // previous byte
+    UCHAR byte2; // byte before previous byte
+    BOOLEAN printable;
+    BOOLEAN printable1;
+    BOOLEAN printable2;
+    ULONG length;
+
+    useSse2 = USER_SHARED_DATA->ProcessorFeatures[PF_XMMI64_INSTRUCTIONS_AVAILABLE];
+    byte1 = 0;
+    byte2 = 0;
+    printable1 = FALSE;
+    printable2 = FALSE;
+    length = 0;
+
+    for (i = 0; i < Size; i++)
+    {
+        // When the last two bytes weren't printable, nothing happens until the next
+        // printable byte (state 8 below), so whole blocks of binary data can be skipped.
+        if (!printable1 && !printable2 && useSse2)
         {
-            // Don't allocate a huge buffer though.
-            if (basicInfo.RegionSize <= 16 * 1024 * 1024) // 16 MB
+            ULONG_PTR next;
+
+            next = PhpSkipNonPrintableBlocks(Buffer, i, Size);
+
+            if (next != i)
             {
-                PhFreePage(buffer);
-                bufferSize = basicInfo.RegionSize;
-                buffer = PhAllocatePage(bufferSize, NULL);
+                i = next;
 
-                if (!buffer)
+                if (i >= Size)
                     break;
+
+                byte2 = Buffer[i - 2];
+                byte1 = Buffer[i - 1];
+            }
+        }
+
+        byte = Buffer[i];
+        printable = PhCharIsPrintable[byte];
+
+        // To find strings Process Hacker uses a state table.
+        // * byte2 - byte before previous byte
+        // * byte1 - previous byte
+        // * byte - current byte
+        // * length - length of current string run
+        //
+        // The states are described below.
+        //
+        //    [byte2] [byte1] [byte] ...
+        //    [char] means printable, [oth] means non-printable.
+        //
+        // 1. [char] [char] [char] ...
+        //      (we're in a non-wide sequence)
+        //      -> append char.
+        // 2. [char] [char] [oth] ...
+        //      (we reached the end of a non-wide sequence, or we need to start a wide sequence)
+        //      -> if current string is big enough, create result (non-wide).
+        //         otherwise if byte = null, reset to new string with byte1 as first character.
+        //         otherwise if byte != null, reset to new string.
+        // 3. [char] [oth] [char] ...
+        //      (we're in a wide sequence)
+        //      -> (byte1 should = null) append char.
+        // 4. [char] [oth] [oth] ...
+        //      (we reached the end of a wide sequence)
+        //      -> (byte1 should = null) if the current string is big enough, create result (wide).
+        //         otherwise, reset to new string.
+        // 5. [oth] [char] [char] ...
+        //      (we reached the end of a wide sequence, or we need to start a non-wide sequence)
+        //      -> (excluding byte1) if the current string is big enough, create result (wide).
+        //         otherwise, reset to new string with byte1 as first character and byte as
+        //         second character.
+        // 6. [oth] [char] [oth] ...
+        //      (we're in a wide sequence)
+        //      -> (byte2 and byte should = null) do nothing.
+        // 7. [oth] [oth] [char] ...
+        //      (we're starting a sequence, but we don't know if it's a wide or non-wide sequence)
+        //      -> append char.
+        // 8. [oth] [oth] [oth] ...
+        //      (nothing)
+        //      -> do nothing.
+
+        if (printable2 && printable1 && printable)
+        {
+            if (length < PH_DISPLAY_BUFFER_COUNT)
+                DisplayBuffer[length] = byte;
+
+            length++;
+        }
+        else if (printable2 && printable1 && !printable)
+        {
+            if (length >= Search->Options->MinimumLength)
+            {
+                goto CreateResult;
+            }
+            else if (byte == 0)
+            {
+                length = 1;
+                DisplayBuffer[0] = byte1;
             }
             else
             {
-                readSize = bufferSize;
+                length = 0;
             }
         }
+        else if (printable2 && !printable1 && printable)
+        {
+            if (byte1 == 0)
+            {
+                if (length < PH_DISPLAY_BUFFER_COUNT)
+                    DisplayBuffer[length] = byte;
 
-        for (offset = 0; offset < basicInfo.RegionSize; offset += readSize)
+                length++;
+            }
+        }
+        else if (printable2 && !printable1 && !printable)
         {
-            ULONG_PTR i;
-            UCHAR byte; // current byte
-            UCHAR byte1; // previous byte
-            UCHAR byte2; // byte before previous byte
-            BOOLEAN printable;
-            BOOLEAN printable1;
-            BOOLEAN printable2;
-            ULONG length;
+            if (length >= Search->Options->MinimumLength)
+            {
+                goto CreateResult;
+            }
+            else
+            {
+                length = 0;
+            }
+        }
+        else if (!printable2 && printable1 && printable)
+        {
+            if (length >= Search->Options->MinimumLength + 1) // length - 1 >= Search->Options->MinimumLength but avoiding underflow
+            {
+                length--; // exclude byte1
+                goto CreateResult;
+            }
+            else
+            {
+                length = 2;
+                DisplayBuffer[0] = byte1;
+                DisplayBuffer[1] = byte;
+            }
+        }
+        else if (!printable2 && printable1 && !printable)
+        {
+            // Nothing
+        }
+        else if (!printable2 && !printable1 && printable)
+        {
+            if (length < PH_DISPLAY_BUFFER_COUNT)
+                DisplayBuffer[length] = byte;
 
-            if (!NT_SUCCESS(PhReadVirtualMemory(
-                ProcessHandle,
-                PTR_ADD_OFFSET(baseAddress, offset),
-                buffer,
-                readSize,
-                NULL
-                )))
-                continue;
+            length++;
+        }
+        else if (!printable2 && !printable1 && !printable)
+        {
+            // Nothing
+        }
 
-            byte1 = 0;
-            byte2 = 0;
-            printable1 = FALSE;
-            printable2 = FALSE;
-            length = 0;
+        goto AfterCreateResult;
+
+CreateResult:
+        {
+            ULONG lengthInBytes;
+            ULONG bias;
+            BOOLEAN isWide;
+            ULONG displayLength;
+
+            lengthInBytes = length;
+            bias = 0;
+            isWide = FALSE;
 
-            for (i = 0; i < readSize; i++)
+            if (printable1 == printable) // determine if string was wide (refer to state table, 4 and 5)
             {
-                byte = buffer[i];
-                printable = PhCharIsPrintable[byte];
-
-                // To find strings Process Hacker uses a state table.
-                // * byte2 - byte before previous byte
-                // * byte1 - previous byte
-                // * byte - current byte
-                // * length - length of current string run
-                //
-                // The states are described below.
-                //
-                //    [byte2] [byte1] [byte] ...
-                //    [char] means printable, [oth] means non-printable.
-                //
-                // 1. [char] [char] [char] ...
-                //      (we're in a non-wide sequence)
-                //      -> append char.
-                // 2. [char] [char] [oth] ...
-                //      (we reached the end of a non-wide sequence, or we need to start a wide sequence)
-                //      -> if current string is big enough, create result (non-wide).
-                //         otherwise if byte = null, reset to new string with byte1 as first character.
-                //         otherwise if byte != null, reset to new string.
-                // 3. [char] [oth] [char] ...
-                //      (we're in a wide sequence)
-                //      -> (byte1 should = null) append char.
-                // 4. [char] [oth] [oth] ...
-                //      (we reached the end of a wide sequence)
-                //      -> (byte1 should = null) if the current string is big enough, create result (wide).
-                //         otherwise, reset to new string.
-                // 5. [oth] [char] [char] ...
-                //      (we reached the end of a wide sequence, or we need to start a non-wide sequence)
-                //      -> (excluding byte1) if the current string is big enough, create result (wide).
-                //         otherwise, reset to new string with byte1 as first character and byte as
-                //         second character.
-                // 6. [oth] [char] [oth] ...
-                //      (we're in a wide sequence)
-                //      -> (byte2 and byte should = null) do nothing.
-                // 7. [oth] [oth] [char] ...
-                //      (we're starting a sequence, but we don't know if it's a wide or non-wide sequence)
-                //      -> append char.
-                // 8. [oth] [oth] [oth] ...
-                //      (nothing)
-                //      -> do nothing.
-
-                if (printable2 && printable1 && printable)
-                {
-                    if (length < displayBufferCount)
-                        displayBuffer[length] = byte;
+                isWide = TRUE;
+                lengthInBytes *= 2;
+            }
 
-                    length++;
-                }
-                else if (printable2 && printable1 && !printable)
-                {
-                    if (length >= minimumLength)
-                    {
-                        goto CreateResult;
-                    }
-                    else if (byte == 0)
-                    {
-                        length = 1;
-                        displayBuffer[0] = byte1;
-                    }
-                    else
-                    {
-                        length = 0;
-                    }
-                }
-                else if (printable2 && !printable1 && printable)
-                {
-                    if (byte1 == 0)
-                    {
-                        if (length < displayBufferCount)
-                            displayBuffer[length] = byte;
+            if (printable) // byte1 excluded (refer to state table, 5)
+            {
+                bias = 1;
+            }
 
-                        length++;
-                    }
-                }
-                else if (printable2 && !printable1 && !printable)
-                {
-                    if (length >= minimumLength)
-                    {
-                        goto CreateResult;
-                    }
-                    else
-                    {
-                        length = 0;
-                    }
-                }
-                else if (!printable2 && printable1 && printable)
-                {
-                    if (length >= minimumLength + 1) // length - 1 >= minimumLength but avoiding underflow
-                    {
-                        length--; // exclude byte1
-                        goto CreateResult;
-                    }
-                    else
-                    {
-                        length = 2;
-                        displayBuffer[0] = byte1;
-                        displayBuffer[1] = byte;
-                    }
-                }
-                else if (!printable2 && printable1 && !printable)
-                {
-                    // Nothing
-                }
-                else if (!printable2 && !printable1 && printable)
-                {
-                    if (length < displayBufferCount)
-                        displayBuffer[length] = byte;
+            if (!(isWide && !Search->Options->DetectUnicode))
+            {
+                // Only the low bytes of wide strings are kept, so the display text is
+                // always ANSI.
+                displayLength = min(length, PH_DISPLAY_BUFFER_COUNT);
+
+                // Results from all workers are added one at a time.
+                PhAcquireQueuedLockExclusive(&Search->ResultsLock);
+                PhAddMemoryResult(
+                    Search->Options->Header.Results,
+                    PTR_ADD_OFFSET(BaseAddress, i - bias - lengthInBytes),
+                    lengthInBytes,
+                    DisplayBuffer,
+                    displayLength,
+                    FALSE
+                    );
+                PhReleaseQueuedLockExclusive(&Search->ResultsLock);
+            }
 
-                    length++;
-                }
-                else if (!printable2 && !printable1 && !printable)
-                {
-                    // Nothing
-                }
+            length = 0;
+        }
+AfterCreateResult:
 
-                goto AfterCreateResult;
+        byte2 = byte1;
+        byte1 = byte;
+        printable2 = printable1;
+        printable1 = printable;
+    }
+}
 
-CreateResult:
-                {
-                    PPH_MEMORY_RESULT result;
-                    ULONG lengthInBytes;
-                    ULONG bias;
-                    BOOLEAN isWide;
-                    ULONG displayLength;
+static VOID NTAPI PhpSearchMemoryStringRegion(
+    _In_ PVOID BaseAddress,
+    _In_ SIZE_T Size,
+    _In_ PVOID Context
+    )
+{
+    PPH_MEMORY_STRING_SEARCH search = Context;
+    PUCHAR buffer;
+    PUCHAR displayBuffer;
 
-                    lengthInBytes = length;
-                    bias = 0;
-                    isWide = FALSE;
+    // The display buffer lives at the end of the read buffer.
+    if (!(buffer = PhAllocatePage(Size + PH_DISPLAY_BUFFER_COUNT, NULL)))
+        return;
 
-                    if (printable1 == printable) // determine if string was wide (refer to state table, 4 and 5)
-                    {
-                        isWide = TRUE;
-                        lengthInBytes *= 2;
-                    }
+    displayBuffer = buffer + Size;
 
-                    if (printable) // byte1 excluded (refer to state table, 5)
-                    {
-                        bias = 1;
-                    }
+    if (NT_SUCCESS(PhReadVirtualMemory(
+        search->ProcessHandle,
+        BaseAddress,
+        buffer,
+        Size,
+        NULL
+        )))
+    {
+        PhpSearchMemoryStringBuffer(search, BaseAddress, buffer, Size, displayBuffer);
+    }
 
-                    if (!(isWide && !detectUnicode) && (result = PhCreateMemoryResult(
-                        PTR_ADD_OFFSET(baseAddress, i - bias - lengthInBytes),
-                        lengthInBytes
-                        )))
-                    {
-                        displayLength = (ULONG)(min(length, displayBufferCount) * sizeof(WCHAR));
+    PhFreePage(buffer);
+}
 
-                        if (result->Display.Buffer = PhAllocateForMemorySearch(displayLength + sizeof(WCHAR)))
-                        {
-                            memcpy(result->Display.Buffer, displayBuffer, displayLength);
-                            result->Display.Buffer[displayLength / sizeof(WCHAR)] = 0;
-                            result->Display.Length = displayLength;
-                        }
+VOID PhSearchMemoryString(
+    _In_ HANDLE ProcessHandle,
+    _In_ PPH_MEMORY_STRING_OPTIONS Options
+    )
+{
+    PH_MEMORY_STRING_SEARCH search;
 
-                        Options->Header.Callback(
-                            result,
-                            Options->Header.Context
-                            );
-                    }
+    if (Options->MinimumLength < 4)
+        return;
 
-                    length = 0;
-                }
-AfterCreateResult:
+    search.ProcessHandle = ProcessHandle;
+    search.Options = Options;
+    PhInitializeQueuedLock(&search.ResultsLock);
 
-                byte2 = byte1;
-                byte1 = byte;
-                printable2 = printable1;
-                printable1 = printable;
-            }
+    // Each region is read as a whole, except that huge regions are split into chunks
+    // so that memory usage stays bounded.
+    PhpSearchMemoryRegions(
+        ProcessHandle,
+        &Options->Header,
+        Options->MemoryTypeMask,
+        PH_MEMORY_SEARCH_CHUNK_SIZE,
+        PhpSearchMemoryStringRegion,
+        &search
+        );
+}
+
+static VOID PhpAddMemoryPatternResult(
+    _In_ PPH_MEMORY_PATTERN_SEARCH Search,
+    _In_ PVOID Address,
+    _In_ SIZE_T Length,
+    _In_reads_(DisplayLength) PWCHAR Display,
+    _In_ SIZE_T DisplayLength,
+    _In_ BOOLEAN WideDisplay,
+    _Out_writes_bytes_(PH_DISPLAY_BUFFER_COUNT * sizeof(WCHAR)) PVOID DisplayBuffer
+    )
+{
+    SIZE_T i;
+    WCHAR c;
+
+    DisplayLength = min(DisplayLength, PH_DISPLAY_BUFFER_COUNT);
+
+    // Matches can contain anything, so replace characters that can't be displayed. Byte
+    // matches only contain code units below 0x100 and are kept as ANSI.
+    for (i = 0; i < DisplayLength; i++)
+    {
+        c = Display[i];
+
+        if (c < 0x100 && !PhCharIsPrintable[c])
+            c = '.';
+
+        if (WideDisplay)
+            ((PWCHAR)DisplayBuffer)[i] = c;
+        else
+            ((PUCHAR)DisplayBuffer)[i] = (UCHAR)c;
+    }
+
+    PhAcquireQueuedLockExclusive(&Search->ResultsLock);
+    PhAddMemoryResult(
+        Search->Options->Header.Results,
+        Address,
+        (ULONG)Length,
+        DisplayBuffer,
+        (ULONG)DisplayLength,
+        WideDisplay
+        );
+    PhReleaseQueuedLockExclusive(&Search->ResultsLock);
+}
+
+/**
+ * Matches the pattern against one chunk of a region.
+ *
+ * \param Search The search.
+ * \param BaseAddress The address of the first byte of the chunk.
+ * \param Subject The chunk, as code units.
+ * \param SubjectLength The number of code units in the chunk.
+ * \param UnitSize The number of bytes in the process represented by each code unit.
+ * \param Final TRUE if the chunk ends the region, otherwise FALSE.
+ * \param MatchData Match data for the pattern.
+ * \param DisplayBuffer A buffer for the display text of results.
+ *
+ * \return The number of code units that have been completely searched. If a
+ * match may continue past the end of the chunk, the next chunk should begin
+ * where that match begins.
+ */
+static SIZE_T PhpSearchMemoryPatternChunk(
+    _In_ PPH_MEMORY_PATTERN_SEARCH Search,
+    _In_ PVOID BaseAddress,
+    _In_reads_(SubjectLength) PCWSTR Subject,
+    _In_ SIZE_T SubjectLength,
+    _In_ ULONG UnitSize,
+    _In_ BOOLEAN Final,
+    _In_ pcre2_match_data *MatchData,
+    _Out_writes_bytes_(PH_DISPLAY_BUFFER_COUNT * sizeof(WCHAR)) PVOID DisplayBuffer
+    )
+{
+    pcre2_code *compiledExpression = Search->Options->CompiledExpression;
+    PCRE2_SIZE *ovector;
+    PCRE2_SIZE startOffset;
+    int rc;
+
+    ovector = pcre2_get_ovector_pointer(MatchData);
+    startOffset = 0;
+
+    while (startOffset < SubjectLength)
+    {
+        rc = pcre2_match(
+            compiledExpression,
+            Subject,
+            SubjectLength,
+            startOffset,
+            Final ? 0 : PCRE2_PARTIAL_HARD,
+            MatchData,
+            NULL
+            );
+
+        if (rc == PCRE2_ERROR_PARTIAL)
+        {
+            // The match reached the end of the chunk. Continue from where it begins,
+            // unless it already begins at the start of the chunk (the match would need
+            // more than a whole chunk).
+            if (ovector[0] != 0)
+                return ovector[0];
+
+            break;
         }
 
-ContinueLoop:
-        baseAddress = PTR_ADD_OFFSET(baseAddress, basicInfo.RegionSize);
+        if (rc < 0)
+            break;
+
+        if (ovector[1] > ovector[0])
+        {
+            PhpAddMemoryPatternResult(
+                Search,
+                PTR_ADD_OFFSET(BaseAddress, ovector[0] * UnitSize),
+                (ovector[1] - ovector[0]) * UnitSize,
+                (PWCHAR)Subject + ovector[0],
+                ovector[1] - ovector[0],
+                UnitSize == sizeof(WCHAR),
+                DisplayBuffer
+                );
+            startOffset = ovector[1];
+        }
+        else
+        {
+            // Skip empty matches.
+            startOffset = ovector[0] + 1;
+        }
+
+        if (Search->Options->Header.Cancel)
+            break;
     }
 
-    if (buffer)
+    return SubjectLength;
+}
+
+static VOID NTAPI PhpSearchMemoryPatternRegion(
+    _In_ PVOID BaseAddress,
+    _In_ SIZE_T Size,
+    _In_ PVOID Context
+    )
+{
+    PPH_MEMORY_PATTERN_SEARCH search = Context;
+    PUCHAR buffer;
+    PWSTR wideBuffer;
+    PWSTR displayBuffer;
+    SIZE_T chunkSize;
+    pcre2_match_data *matchData;
+    ULONG unitSize;
+
+    chunkSize = min(Size, PH_MEMORY_PATTERN_CHUNK_SIZE);
+
+    // The wide buffer holds the bytes of a chunk widened to code units, so that byte
+    // patterns can be matched with the 16-bit library.
+    if (!(buffer = PhAllocatePage(chunkSize + chunkSize * sizeof(WCHAR) + PH_DISPLAY_BUFFER_COUNT * sizeof(WCHAR), NULL)))
+        return;
+
+    wideBuffer = (PWSTR)(buffer + chunkSize);
+    displayBuffer = wideBuffer + chunkSize;
+    if (!(matchData = pcre2_match_data_create_from_pattern(search->Options->CompiledExpression, NULL)))
+    {
         PhFreePage(buffer);
+        return;
+    }
+
+    for (unitSize = sizeof(UCHAR); unitSize <= sizeof(WCHAR); unitSize++)
+    {
+        SIZE_T offset;
+
+        if (unitSize == sizeof(WCHAR) && !search->Options->DetectUnicode)
+            break;
+
+        offset = 0;
+
+        while (offset < Size && !search->Options->Header.Cancel)
+        {
+            SIZE_T readSize;
+            SIZE_T numberOfUnits;
+            SIZE_T searched;
+            SIZE_T i;
+
+            readSize = min(Size - offset, chunkSize);
+
+            if (!NT_SUCCESS(PhReadVirtualMemory(
+                search->ProcessHandle,
+                PTR_ADD_OFFSET(BaseAddress, offset),
+                buffer,
+                readSize,
+                NULL
+                )))
+            {
+                offset += readSize;
+                continue;
+            }
+
+            if (unitSize == sizeof(UCHAR))
+            {
+                for (i = 0; i < readSize; i++)
+                    wideBuffer[i] = buffer[i];
+
+                numberOfUnits = readSize;
+            }
+            else
+            {
+                memcpy(wideBuffer, buffer, readSize);
+                numberOfUnits = readSize / sizeof(WCHAR);
+            }
+
+            searched = PhpSearchMemoryPatternChunk(
+                search,
+                PTR_ADD_OFFSET(BaseAddress, offset),
+                wideBuffer,
+                numberOfUnits,
+                unitSize,
+                offset + readSize >= Size,
+                matchData,
+                displayBuffer
+                );
+
+            offset += searched != numberOfUnits ? searched * unitSize : readSize;
+        }
+    }
+
+    pcre2_match_data_free(matchData);
+    PhFreePage(buffer);
+}
+
+VOID PhSearchMemoryPattern(
+    _In_ HANDLE ProcessHandle,
+    _In_ PPH_MEMORY_PATTERN_OPTIONS Options
+    )
+{
+    PH_MEMORY_PATTERN_SEARCH search;
+
+    search.ProcessHandle = ProcessHandle;
+    search.Options = Options;
+    PhInitializeQueuedLock(&search.ResultsLock);
+
+    // The JIT is used when it is available; otherwise the interpreter is.
+    pcre2_jit_compile(Options->CompiledExpression, PCRE2_JIT_COMPLETE | PCRE2_JIT_PARTIAL_HARD);
+
+    // Regions are searched sequentially in chunks so that matches can span chunk
+    // boundaries.
+    PhpSearchMemoryRegions(
+        ProcessHandle,
+        &Options->Header,
+        Options->MemoryTypeMask,
+        MAXSIZE_T,
+        PhpSearchMemoryPatternRegion,
+        &search
+        );
 }
 
 VOID PhShowMemoryStringDialog(
@@ -495,11 +988,14 @@ VOID PhShowMemoryStringDialog(
         (LPARAM)&context
         ) != IDOK)
     {
+        if (context.CompiledExpression)
+            pcre2_code_free(context.CompiledExpression);
+
         NtClose(processHandle);
         return;
     }
 
-    context.Results = PhCreateList(1024);
+    context.Results = PhCreateMemoryResults(NULL);
 
     if (DialogBoxParam(
         PhInstanceHandle,
@@ -521,6 +1017,10 @@ VOID PhShowMemoryStringDialog(
     }
 
     PhDereferenceObject(context.Results);
+
+    if (context.CompiledExpression)
+        pcre2_code_free(context.CompiledExpression);
+
     NtClose(processHandle);
 }
 
@@ -557,6 +1057,7 @@ INT_PTR CALLBACK PhpMemoryStringDlgProc(
                 {
                     PMEMORY_STRING_CONTEXT context = (PMEMORY_STRING_CONTEXT)GetProp(hwndDlg, PhMakeContextAtom());
                     ULONG64 minimumLength = 10;
+                    PPH_STRING pattern;
 
                     PhStringToInteger64(&PhaGetDlgItemText(hwndDlg, IDC_MINIMUMLENGTH)->sr, 0, &minimumLength);
 
@@ -566,6 +1067,32 @@ INT_PTR CALLBACK PhpMemoryStringDlgProc(
                         break;
                     }
 
+                    pattern = PhaGetDlgItemText(hwndDlg, IDC_PATTERN);
+
+                    if (pattern->Length != 0)
+                    {
+                        int errorCode;
+                        PCRE2_SIZE errorOffset;
+
+                        context->CompiledExpression = pcre2_compile(
+                            pattern->Buffer,
+                            pattern->Length / sizeof(WCHAR),
+                            PCRE2_DOTALL,
+                            &errorCode,
+                            &errorOffset,
+                            NULL
+                            );
+
+                        if (!context->CompiledExpression)
+                        {
+                            PhShowError(hwndDlg, L"Unable to compile the regular expression: \"%s\" at position %zu.",
+                                PhGetStringOrDefault(PhAutoDereferenceObject(PhPcre2GetErrorMessage(errorCode)), L"Unknown error"),
+                                errorOffset
+                                );
+                            break;
+                        }
+                    }
+
                     context->MinimumLength = (ULONG)minimumLength;
                     context->DetectUnicode = Button_GetCheck(GetDlgItem(hwndDlg, IDC_DETECTUNICODE)) == BST_CHECKED;
                     context->Private = Button_GetCheck(GetDlgItem(hwndDlg, IDC_PRIVATE)) == BST_CHECKED;
@@ -583,37 +1110,41 @@ INT_PTR CALLBACK PhpMemoryStringDlgProc(
     return FALSE;
 }
 
-static BOOL NTAPI PhpMemoryStringResultCallback(
-    _In_ _Assume_refs_(1) PPH_MEMORY_RESULT Result,
-    _In_opt_ PVOID Context
-    )
-{
-    PMEMORY_STRING_CONTEXT context = Context;
-
-    PhAddItemList(context->Results, Result);
-
-    return TRUE;
-}
-
 NTSTATUS PhpMemoryStringThreadStart(
     _In_ PVOID Parameter
     )
 {
     PMEMORY_STRING_CONTEXT context = Parameter;
-
-    context->Options.Header.Callback = PhpMemoryStringResultCallback;
-    context->Options.Header.Context = context;
-    context->Options.MinimumLength = context->MinimumLength;
-    context->Options.DetectUnicode = context->DetectUnicode;
+    ULONG memoryTypeMask = 0;
 
     if (context->Private)
-        context->Options.MemoryTypeMask |= MEM_PRIVATE;
+        memoryTypeMask |= MEM_PRIVATE;
     if (context->Image)
-        context->Options.MemoryTypeMask |= MEM_IMAGE;
+        memoryTypeMask |= MEM_IMAGE;
     if (context->Mapped)
-        context->Options.MemoryTypeMask |= MEM_MAPPED;
+        memoryTypeMask |= MEM_MAPPED;
+
+    if (context->CompiledExpression)
+    {
+        context->PatternOptions.Header.Results = context->Results;
+        context->PatternOptions.CompiledExpression = context->CompiledExpression;
+        context->PatternOptions.DetectUnicode = context->DetectUnicode;
+        context->PatternOptions.MemoryTypeMask = memoryTypeMask;
+
+        PhSearchMemoryPattern(context->ProcessHandle, &context->PatternOptions);
+    }
+    else
+    {
+        context->Options.Header.Results = context->Results;
+        context->Options.MinimumLength = context->MinimumLength;
+        context->Options.DetectUnicode = context->DetectUnicode;
+        context->Options.MemoryTypeMask = memoryTypeMask;
+
+        PhSearchMemoryString(context->ProcessHandle, &context->Options);
+    }
 
-    PhSearchMemoryString(context->ProcessHandle, &context->Options);
+    // Regions are searched in parallel, so results arrive out of order.
+    PhSortMemoryResults(context->Results);
 
     SendMessage(
         context->WindowHandle,
@@ -682,6 +1213,7 @@ INT_PTR CALLBACK PhpMemoryStringProgressDlgProc(
 
                     EnableWindow(GetDlgItem(hwndDlg, IDCANCEL), FALSE);
                     context->Options.Header.Cancel = TRUE;
+                    context->PatternOptions.Header.Cancel = TRUE;
                 }
                 break;
             }
@@ -1323,12 +1323,21 @@ VOID PhMipTickListSection(
     ULONG i;
     PPH_MIP_GROUP_NODE node;
     PH_MINIINFO_LIST_SECTION_ASSIGN_SORT_DATA assignSortData;
+    PH_MINIINFO_LIST_SECTION_GET_COMPARE_FUNCTION getCompareFunction;
 
     PhMipClearListSection(ListSection);
 
-    ListSection->ProcessGroupList = PhCreateProcessGroupList(
+    // Only the first few groups are shown, so we would rather select the top processes than
+    // sort all of them.
+    getCompareFunction.CompareFunction = NULL;
+
+    if (!ListSection->Callback(ListSection, MiListSectionGetProcessCompareFunction, &getCompareFunction, NULL))
+        getCompareFunction.CompareFunction = NULL;
+
+    ListSection->ProcessGroupList = PhCreateProcessGroupListEx(
         PhMipListSectionSortFunction,
         ListSection,
+        getCompareFunction.CompareFunction,
         MIP_MAX_PROCESS_GROUPS,
         0
         );
@@ -1859,12 +1868,11 @@ BOOLEAN PhMipCpuListSectionCallback(
         ListSection->Section->Parameters->SetSectionText(ListSection->Section,
             PhaFormatString(L"CPU    %.2f%%", (PhCpuUserUsage + PhCpuKernelUsage) * 100));
         break;
-    case MiListSectionSortProcessList:
+    case MiListSectionGetProcessCompareFunction:
         {
-            PPH_MINIINFO_LIST_SECTION_SORT_LIST sortList = Parameter1;
+            PPH_MINIINFO_LIST_SECTION_GET_COMPARE_FUNCTION getCompareFunction = Parameter1;
 
-            qsort(sortList->List->Items, sortList->List->Count,
-                sizeof(PPH_PROCESS_NODE), PhMipCpuListSectionProcessCompareFunction);
+            getCompareFunction->CompareFunction = PhMipCpuListSectionProcessCompareFunction;
         }
         return TRUE;
     case MiListSectionAssignSortData:
@@ -1961,12 +1969,11 @@ BOOLEAN PhMipCommitListSectionCallback(
                 PhAutoDereferenceObject(PhFormat(format, 5, 96)));
         }
         break;
-    case MiListSectionSortProcessList:
+    case MiListSectionGetProcessCompareFunction:
         {
-            PPH_MINIINFO_LIST_SECTION_SORT_LIST sortList = Parameter1;
+            PPH_MINIINFO_LIST_SECTION_GET_COMPARE_FUNCTION getCompareFunction = Parameter1;
 
-            qsort(sortList->List->Items, sortList->List->Count,
-                sizeof(PPH_PROCESS_NODE), PhMipCommitListSectionProcessCompareFunction);
+            getCompareFunction->CompareFunction = PhMipCommitListSectionProcessCompareFunction;
         }
         return TRUE;
     case MiListSectionAssignSortData:
@@ -2052,12 +2059,11 @@ BOOLEAN PhMipPhysicalListSectionCallback(
                 PhAutoDereferenceObject(PhFormat(format, 5, 96)));
         }
         break;
-    case MiListSectionSortProcessList:
+    case MiListSectionGetProcessCompareFunction:
         {
-            PPH_MINIINFO_LIST_SECTION_SORT_LIST sortList = Parameter1;
+            PPH_MINIINFO_LIST_SECTION_GET_COMPARE_FUNCTION getCompareFunction = Parameter1;
 
-            qsort(sortList->List->Items, sortList->List->Count,
-                sizeof(PPH_PROCESS_NODE), PhMipPhysicalListSectionProcessCompareFunction);
+            getCompareFunction->CompareFunction = PhMipPhysicalListSectionProcessCompareFunction;
         }
         return TRUE;
     case MiListSectionAssignSortData:
@@ -2148,12 +2154,11 @@ BOOLEAN PhMipIoListSectionCallback(
                 PhAutoDereferenceObject(PhFormat(format, 6, 80)));
         }
         break;
-    case MiListSectionSortProcessList:
+    case MiListSectionGetProcessCompareFunction:
         {
-            PPH_MINIINFO_LIST_SECTION_SORT_LIST sortList = Parameter1;
+            PPH_MINIINFO_LIST_SECTION_GET_COMPARE_FUNCTION getCompareFunction = Parameter1;
 
-            qsort(sortList->List->Items, sortList->List->Count,
-                sizeof(PPH_PROCESS_NODE), PhMipIoListSectionProcessCompareFunction);
+            getCompareFunction->CompareFunction = PhMipIoListSectionProcessCompareFunction;
         }
         return TRUE;
     case MiListSectionAssignSortData:
@@ -276,7 +276,7 @@ VOID PhpDestroyModuleNode(
 
     if (ModuleNode->TooltipText) PhDereferenceObject(ModuleNode->TooltipText);
 
-    if (ModuleNode->SizeText) PhDereferenceObject(ModuleNode->SizeText);
+    PhDeleteCachedFormat(&ModuleNode->SizeText);
     if (ModuleNode->TimeStampText) PhDereferenceObject(ModuleNode->TimeStampText);
     if (ModuleNode->LoadTimeText) PhDereferenceObject(ModuleNode->LoadTimeText);
 
@@ -583,9 +583,7 @@ BOOLEAN NTAPI PhpModuleTreeNewCallback(
                 PhInitializeStringRefLongHint(&getCellText->Text, moduleItem->BaseAddressString);
                 break;
             case PHMOTLC_SIZE:
-                if (!node->SizeText)
-                    node->SizeText = PhFormatSize(moduleItem->Size, -1);
-                getCellText->Text = PhGetStringRef(node->SizeText);
+                getCellText->Text = PhFormatSizeCached(&node->SizeText, moduleItem->Size)->sr;
                 break;
             case PHMOTLC_DESCRIPTION:
                 getCellText->Text = PhGetStringRef(moduleItem->VersionInfo.FileDescription);
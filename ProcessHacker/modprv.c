@@ -24,6 +24,8 @@
 #include <verify.h>
 #include <extmgri.h>
 
+#define PH_MODULE_PROVIDER_MAXIMUM_SKIPPED_UPDATES 10
+
 typedef struct _PH_MODULE_QUERY_DATA
 {
     SLIST_ENTRY ListEntry;
@@ -56,12 +58,23 @@ ULONG NTAPI PhpModuleHashtableHashFunction(
 PPH_OBJECT_TYPE PhModuleProviderType;
 PPH_OBJECT_TYPE PhModuleItemType;
 
+// Live module providers, so that image load hints can be delivered to them.
+static LIST_ENTRY PhpModuleProviderListHead;
+static PH_QUEUED_LOCK PhpModuleProviderListLock = PH_QUEUED_LOCK_INIT;
+
 BOOLEAN PhModuleProviderInitialization(
     VOID
     )
 {
+    PH_OBJECT_TYPE_PARAMETERS parameters;
+
     PhModuleProviderType = PhCreateObjectType(L"ModuleProvider", 0, PhpModuleProviderDeleteProcedure);
-    PhModuleItemType = PhCreateObjectType(L"ModuleItem", 0, PhpModuleItemDeleteProcedure);
+
+    parameters.FreeListSize = 0;
+    parameters.FreeListCount = 256;
+    PhModuleItemType = PhCreateObjectTypeEx(L"ModuleItem", PH_OBJECT_TYPE_USE_FREE_LIST, PhpModuleItemDeleteProcedure, &parameters);
+
+    InitializeListHead(&PhpModuleProviderListHead);
 
     return TRUE;
 }
@@ -85,6 +98,7 @@ PPH_MODULE_PROVIDER PhCreateModuleProvider(
         20
         );
     PhInitializeFastLock(&moduleProvider->ModuleHashtableLock);
+    PhRegisterLockStatistics(&moduleProvider->ModuleHashtableLock, L"ModuleProvider->ModuleHashtableLock");
 
     PhInitializeCallback(&moduleProvider->ModuleAddedEvent);
     PhInitializeCallback(&moduleProvider->ModuleModifiedEvent);
@@ -122,6 +136,15 @@ PPH_MODULE_PROVIDER PhCreateModuleProvider(
         moduleProvider->PackageFullName = PhGetProcessPackageFullName(moduleProvider->ProcessHandle);
 
     RtlInitializeSListHead(&moduleProvider->QueryListHead);
+    moduleProvider->LastVirtualSize = 0;
+    moduleProvider->SkippedUpdates = 0;
+    moduleProvider->ImageEventPending = FALSE;
+    moduleProvider->LastKernelModuleCount = 0;
+    moduleProvider->LastKernelModulesChecksum = 0;
+
+    PhAcquireQueuedLockExclusive(&PhpModuleProviderListLock);
+    InsertTailList(&PhpModuleProviderListHead, &moduleProvider->ListEntry);
+    PhReleaseQueuedLockExclusive(&PhpModuleProviderListLock);
 
     PhEmCallObjectOperation(EmModuleProviderType, moduleProvider, EmObjectCreate);
 
@@ -135,6 +158,10 @@ VOID PhpModuleProviderDeleteProcedure(
 {
     PPH_MODULE_PROVIDER moduleProvider = (PPH_MODULE_PROVIDER)Object;
 
+    PhAcquireQueuedLockExclusive(&PhpModuleProviderListLock);
+    RemoveEntryList(&moduleProvider->ListEntry);
+    PhReleaseQueuedLockExclusive(&PhpModuleProviderListLock);
+
     PhEmCallObjectOperation(EmModuleProviderType, moduleProvider, EmObjectDelete);
 
     // Dereference all module items (we referenced them
@@ -142,6 +169,7 @@ VOID PhpModuleProviderDeleteProcedure(
     PhDereferenceAllModuleItems(moduleProvider);
 
     PhDereferenceObject(moduleProvider->ModuleHashtable);
+    PhUnregisterLockStatistics(&moduleProvider->ModuleHashtableLock);
     PhDeleteFastLock(&moduleProvider->ModuleHashtableLock);
     PhDeleteCallback(&moduleProvider->ModuleAddedEvent);
     PhDeleteCallback(&moduleProvider->ModuleModifiedEvent);
@@ -336,6 +364,123 @@ static BOOLEAN NTAPI EnumModulesCallback(
     return TRUE;
 }
 
+static BOOLEAN PhpModuleProviderNeedsUpdate(
+    _In_ PPH_MODULE_PROVIDER ModuleProvider
+    )
+{
+    VM_COUNTERS vmCounters;
+
+    if (ModuleProvider->ProcessId == SYSTEM_PROCESS_ID)
+    {
+        ULONG numberOfModules;
+        ULONG checksum;
+
+        // The System process's modules are the kernel modules, which don't show up in its
+        // address space. Check the kernel module list itself, which is a lot cheaper than
+        // converting and comparing all of its entries.
+        if (!NT_SUCCESS(PhGetKernelModulesChecksum(&numberOfModules, &checksum)))
+            return TRUE;
+
+        if (!_InterlockedExchange(&ModuleProvider->ImageEventPending, FALSE) &&
+            numberOfModules == ModuleProvider->LastKernelModuleCount &&
+            checksum == ModuleProvider->LastKernelModulesChecksum &&
+            ModuleProvider->SkippedUpdates < PH_MODULE_PROVIDER_MAXIMUM_SKIPPED_UPDATES &&
+            NT_SUCCESS(ModuleProvider->RunStatus))
+        {
+            ModuleProvider->SkippedUpdates++;
+            return FALSE;
+        }
+
+        ModuleProvider->LastKernelModuleCount = numberOfModules;
+        ModuleProvider->LastKernelModulesChecksum = checksum;
+        ModuleProvider->SkippedUpdates = 0;
+
+        return TRUE;
+    }
+
+    if (!ModuleProvider->ProcessHandle)
+        return TRUE;
+
+    if (!NT_SUCCESS(NtQueryInformationProcess(
+        ModuleProvider->ProcessHandle,
+        ProcessVmCounters,
+        &vmCounters,
+        sizeof(VM_COUNTERS),
+        NULL
+        )))
+        return TRUE;
+
+    // Loading or unloading a module (or mapping and unmapping a file) always changes the
+    // size of the address space. Some other change with exactly the same size could hide
+    // one, so do a full enumeration every so often anyway. An image load hint tells us
+    // about such a change directly.
+    if (!_InterlockedExchange(&ModuleProvider->ImageEventPending, FALSE) &&
+        vmCounters.VirtualSize == ModuleProvider->LastVirtualSize &&
+        ModuleProvider->SkippedUpdates < PH_MODULE_PROVIDER_MAXIMUM_SKIPPED_UPDATES &&
+        NT_SUCCESS(ModuleProvider->RunStatus))
+    {
+        ModuleProvider->SkippedUpdates++;
+        return FALSE;
+    }
+
+    ModuleProvider->LastVirtualSize = vmCounters.VirtualSize;
+    ModuleProvider->SkippedUpdates = 0;
+
+    return TRUE;
+}
+
+/**
+ * Makes the module providers of a process enumerate modules on their next update.
+ *
+ * \param ProcessId The ID of the process in which an image was loaded or unloaded.
+ */
+VOID PhHintModuleProviders(
+    _In_ HANDLE ProcessId
+    )
+{
+    PLIST_ENTRY listEntry;
+    PPH_MODULE_PROVIDER moduleProvider;
+
+    // Drivers are reported as being loaded into process 0.
+    if (ProcessId == SYSTEM_IDLE_PROCESS_ID)
+        ProcessId = SYSTEM_PROCESS_ID;
+
+    PhAcquireQueuedLockShared(&PhpModuleProviderListLock);
+
+    for (listEntry = PhpModuleProviderListHead.Flink; listEntry != &PhpModuleProviderListHead; listEntry = listEntry->Flink)
+    {
+        moduleProvider = CONTAINING_RECORD(listEntry, PH_MODULE_PROVIDER, ListEntry);
+
+        if (moduleProvider->ProcessId == ProcessId)
+            _InterlockedExchange(&moduleProvider->ImageEventPending, TRUE);
+    }
+
+    PhReleaseQueuedLockShared(&PhpModuleProviderListLock);
+}
+
+static VOID PhpProcessModuleQueryData(
+    _In_ PPH_MODULE_PROVIDER ModuleProvider
+    )
+{
+    PSLIST_ENTRY entry;
+    PPH_MODULE_QUERY_DATA data;
+
+    entry = RtlInterlockedFlushSList(&ModuleProvider->QueryListHead);
+
+    while (entry)
+    {
+        data = CONTAINING_RECORD(entry, PH_MODULE_QUERY_DATA, ListEntry);
+        entry = entry->Next;
+
+        data->ModuleItem->VerifyResult = data->VerifyResult;
+        data->ModuleItem->VerifySignerName = data->VerifySignerName;
+        data->ModuleItem->JustProcessed = TRUE;
+
+        PhDereferenceObject(data->ModuleItem);
+        PhFree(data);
+    }
+}
+
 VOID PhModuleProviderUpdate(
     _In_ PVOID Object
     )
@@ -350,6 +495,26 @@ VOID PhModuleProviderUpdate(
     if (!moduleProvider->ProcessHandle && moduleProvider->ProcessId != SYSTEM_PROCESS_ID)
         goto UpdateExit;
 
+    if (!PhpModuleProviderNeedsUpdate(moduleProvider))
+    {
+        ULONG enumerationKey = 0;
+        PPH_MODULE_ITEM *moduleItem;
+
+        // The module list hasn't changed, but verification results may have arrived.
+        PhpProcessModuleQueryData(moduleProvider);
+
+        while (PhEnumHashtable(moduleProvider->ModuleHashtable, (PVOID *)&moduleItem, &enumerationKey))
+        {
+            if ((*moduleItem)->JustProcessed)
+            {
+                (*moduleItem)->JustProcessed = FALSE;
+                PhInvokeCallback(&moduleProvider->ModuleModifiedEvent, *moduleItem);
+            }
+        }
+
+        goto UpdateExit;
+    }
+
     modules = PhCreateList(20);
 
     moduleProvider->RunStatus = PhEnumGenericModules(
@@ -363,26 +528,29 @@ VOID PhModuleProviderUpdate(
     // Look for removed modules.
     {
         PPH_LIST modulesToRemove = NULL;
+        PPH_HASHTABLE moduleHashtable;
         ULONG enumerationKey = 0;
         PPH_MODULE_ITEM *moduleItem;
 
+        // Index the modules by base address so that processes with thousands of modules
+        // don't need a quadratic comparison.
+        moduleHashtable = PhCreateSimpleHashtable(modules->Count);
+
+        for (i = 0; i < modules->Count; i++)
+        {
+            PPH_MODULE_INFO module = modules->Items[i];
+
+            PhAddItemSimpleHashtable(moduleHashtable, module->BaseAddress, module);
+        }
+
         while (PhEnumHashtable(moduleProvider->ModuleHashtable, (PVOID *)&moduleItem, &enumerationKey))
         {
-            BOOLEAN found = FALSE;
+            PPH_MODULE_INFO module;
 
             // Check if the module still exists.
-            for (i = 0; i < modules->Count; i++)
-            {
-                PPH_MODULE_INFO module = modules->Items[i];
+            module = PhFindItemSimpleHashtable2(moduleHashtable, (*moduleItem)->BaseAddress);
 
-                if ((*moduleItem)->BaseAddress == module->BaseAddress && PhEqualString((*moduleItem)->FileName, module->FileName, TRUE))
-                {
-                    found = TRUE;
-                    break;
-                }
-            }
-
-            if (!found)
+            if (!module || !PhEqualString((*moduleItem)->FileName, module->FileName, TRUE))
             {
                 // Raise the module removed event.
                 PhInvokeCallback(&moduleProvider->ModuleRemovedEvent, *moduleItem);
@@ -394,6 +562,8 @@ VOID PhModuleProviderUpdate(
             }
         }
 
+        PhDereferenceObject(moduleHashtable);
+
         if (modulesToRemove)
         {
             PhAcquireFastLockExclusive(&moduleProvider->ModuleHashtableLock);
@@ -412,25 +582,7 @@ VOID PhModuleProviderUpdate(
     }
 
     // Go through the queued thread query data.
-    {
-        PSLIST_ENTRY entry;
-        PPH_MODULE_QUERY_DATA data;
-
-        entry = RtlInterlockedFlushSList(&moduleProvider->QueryListHead);
-
-        while (entry)
-        {
-            data = CONTAINING_RECORD(entry, PH_MODULE_QUERY_DATA, ListEntry);
-            entry = entry->Next;
-
-            data->ModuleItem->VerifyResult = data->VerifyResult;
-            data->ModuleItem->VerifySignerName = data->VerifySignerName;
-            data->ModuleItem->JustProcessed = TRUE;
-
-            PhDereferenceObject(data->ModuleItem);
-            PhFree(data);
-        }
-    }
+    PhpProcessModuleQueryData(moduleProvider);
 
     // Look for new modules.
     for (i = 0; i < modules->Count; i++)
@@ -453,15 +605,17 @@ VOID PhModuleProviderUpdate(
             moduleItem->LoadCount = module->LoadCount;
             moduleItem->LoadTime = module->LoadTime;
 
-            moduleItem->Name = module->Name;
-            PhReferenceObject(moduleItem->Name);
-            moduleItem->FileName = module->FileName;
-            PhReferenceObject(moduleItem->FileName);
+            // The same modules are loaded by most processes.
+            moduleItem->Name = PhInternString(module->Name);
+            moduleItem->FileName = PhInternString(module->FileName);
 
-            PhInitializeImageVersionInfo(
-                &moduleItem->VersionInfo,
-                PhGetString(moduleItem->FileName)
-                );
+            if (moduleItem->FileName)
+            {
+                PhInitializeImageVersionInfoCached(
+                    &moduleItem->VersionInfo,
+                    moduleItem->FileName
+                    );
+            }
 
             moduleItem->IsFirst = i == 0;
 
@@ -219,6 +219,7 @@ PPH_NETWORK_NODE PhAddNetworkNode(
     PhpUpdateNetworkNodeAddressStrings(networkNode);
 
     PhAddEntryHashtable(NetworkNodeHashtable, &networkNode);
+    networkNode->ListIndex = NetworkNodeList->Count;
     PhAddItemList(NetworkNodeList, networkNode);
 
     if (FilterSupport.NodeList)
@@ -280,14 +281,17 @@ VOID PhpRemoveNetworkNode(
     _In_ PPH_NETWORK_NODE NetworkNode
     )
 {
-    ULONG index;
+    PPH_NETWORK_NODE lastNode;
 
     PhEmCallObjectOperation(EmNetworkNodeType, NetworkNode, EmObjectDelete);
 
-    // Remove from list and cleanup.
+    // Remove from list and cleanup. The list is sorted again before it is used, so the last node
+    // takes this node's place.
 
-    if ((index = PhFindItemList(NetworkNodeList, NetworkNode)) != -1)
-        PhRemoveItemList(NetworkNodeList, index);
+    lastNode = NetworkNodeList->Items[NetworkNodeList->Count - 1];
+    NetworkNodeList->Items[NetworkNode->ListIndex] = lastNode;
+    lastNode->ListIndex = NetworkNode->ListIndex;
+    NetworkNodeList->Count--;
 
     if (NetworkNode->ProcessNameText) PhDereferenceObject(NetworkNode->ProcessNameText);
     if (NetworkNode->TimeStampText) PhDereferenceObject(NetworkNode->TimeStampText);
@@ -447,6 +451,7 @@ BOOLEAN NTAPI PhpNetworkTreeNewCallback(
                     SORT_FUNCTION(TimeStamp)
                 };
                 int (__cdecl *sortFunction)(const void *, const void *);
+                ULONG i;
 
                 if (!PhCmForwardSort(
                     (PPH_TREENEW_NODE *)NetworkNodeList->Items,
@@ -463,10 +468,13 @@ BOOLEAN NTAPI PhpNetworkTreeNewCallback(
 
                     if (sortFunction)
                     {
-                        qsort(NetworkNodeList->Items, NetworkNodeList->Count, sizeof(PVOID), sortFunction);
+                        PhSortItemsIncremental(NetworkNodeList->Items, NetworkNodeList->Count, sortFunction);
                     }
                 }
 
+                for (i = 0; i < NetworkNodeList->Count; i++)
+                    ((PPH_NETWORK_NODE)NetworkNodeList->Items[i])->ListIndex = i;
+
                 getChildren->Children = (PPH_TREENEW_NODE *)NetworkNodeList->Items;
                 getChildren->NumberOfChildren = NetworkNodeList->Count;
             }
@@ -774,20 +782,5 @@ VOID PhWriteNetworkList(
     _In_ ULONG Mode
     )
 {
-    PPH_LIST lines;
-    ULONG i;
-
-    lines = PhGetGenericTreeNewLines(NetworkTreeListHandle, Mode);
-
-    for (i = 0; i < lines->Count; i++)
-    {
-        PPH_STRING line;
-
-        line = lines->Items[i];
-        PhWriteStringAsUtf8FileStream(FileStream, &line->sr);
-        PhDereferenceObject(line);
-        PhWriteStringAsUtf8FileStream2(FileStream, L"\r\n");
-    }
-
-    PhDereferenceObject(lines);
+    PhWriteGenericTreeNew(FileStream, NetworkTreeListHandle, Mode);
 }
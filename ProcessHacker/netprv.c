@@ -26,6 +26,20 @@
 #include <ws2ipdef.h>
 #include <iphlpapi.h>
 #include <extmgri.h>
+#include <phplug.h>
+
+// Connections are usually gone by the time a lookup has waited this long.
+#define PH_NETWORK_QUERY_TIMEOUT (30 * 1000)
+// The maximum number of resolver threads.
+#define PH_NETWORK_RESOLVE_MAXIMUM_WORKERS 3
+// The number of addresses a resolver takes from the queue at once.
+#define PH_NETWORK_RESOLVE_BATCH_SIZE 16
+// How long host names are cached for, in 100ns units.
+#define PH_NETWORK_RESOLVE_TTL (60 * 60 * PH_TICKS_PER_SEC)
+// How long failed lookups are cached for, in 100ns units.
+#define PH_NETWORK_RESOLVE_NEGATIVE_TTL (5 * 60 * PH_TICKS_PER_SEC)
+// The maximum number of entries in the resolve cache.
+#define PH_NETWORK_RESOLVE_CACHE_MAXIMUM 4096
 
 typedef struct _PH_NETWORK_CONNECTION
 {
@@ -34,13 +48,16 @@ typedef struct _PH_NETWORK_CONNECTION
     PH_IP_ENDPOINT RemoteEndpoint;
     ULONG State;
     HANDLE ProcessId;
-    LARGE_INTEGER CreateTime;
-    ULONGLONG OwnerInfo[PH_NETWORK_OWNER_INFO_SIZE];
+    // The table row for the connection. This is only valid until the tables are queried again.
+    PVOID Row;
+    // The network item for the connection. This is not referenced; the hashtable owns the item.
+    PPH_NETWORK_ITEM NetworkItem;
 } PH_NETWORK_CONNECTION, *PPH_NETWORK_CONNECTION;
 
 typedef struct _PH_NETWORK_ITEM_QUERY_DATA
 {
     SLIST_ENTRY ListEntry;
+    struct _PH_NETWORK_ITEM_QUERY_DATA *NextWaiter;
     PPH_NETWORK_ITEM NetworkItem;
 
     PH_IP_ADDRESS Address;
@@ -51,9 +68,27 @@ typedef struct _PH_NETWORK_ITEM_QUERY_DATA
 typedef struct _PHP_RESOLVE_CACHE_ITEM
 {
     PH_IP_ADDRESS Address;
-    PPH_STRING HostString;
+    PPH_STRING HostString; // NULL if the address could not be resolved
+    LARGE_INTEGER ExpiryTime;
+    LIST_ENTRY ListEntry; // in PhpResolveCacheListHead, oldest first
 } PHP_RESOLVE_CACHE_ITEM, *PPHP_RESOLVE_CACHE_ITEM;
 
+typedef struct _PHP_RESOLVE_REQUEST
+{
+    PH_IP_ADDRESS Address;
+    LIST_ENTRY ListEntry; // in PhpResolveRequestListHead while the request is waiting for a resolver
+    LARGE_INTEGER QueueTime;
+    PPH_NETWORK_ITEM_QUERY_DATA Waiters;
+} PHP_RESOLVE_REQUEST, *PPHP_RESOLVE_REQUEST;
+
+typedef struct _PHP_OWNER_CACHE_ENTRY
+{
+    HANDLE ProcessId;
+    ULONG ServiceTag;
+    LARGE_INTEGER CreateTime;
+    PPH_STRING ServiceName; // NULL if the tag could not be resolved
+} PHP_OWNER_CACHE_ENTRY, *PPHP_OWNER_CACHE_ENTRY;
+
 typedef DWORD (WINAPI *_GetExtendedTcpTable)(
     _Out_writes_bytes_opt_(*pdwSize) PVOID pTcpTable,
     _Inout_ PDWORD pdwSize,
@@ -118,20 +153,72 @@ ULONG NTAPI PhpResolveCacheHashtableHashFunction(
     _In_ PVOID Entry
     );
 
+BOOLEAN PhpResolveRequestHashtableCompareFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    );
+
+ULONG NTAPI PhpResolveRequestHashtableHashFunction(
+    _In_ PVOID Entry
+    );
+
+BOOLEAN PhpOwnerCacheHashtableCompareFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    );
+
+ULONG NTAPI PhpOwnerCacheHashtableHashFunction(
+    _In_ PVOID Entry
+    );
+
+VOID NTAPI PhpNetworkProcessRemovedHandler(
+    _In_opt_ PVOID Parameter,
+    _In_opt_ PVOID Context
+    );
+
 BOOLEAN PhGetNetworkConnections(
     _Out_ PPH_NETWORK_CONNECTION *Connections,
     _Out_ PULONG NumberOfConnections
     );
 
+int __cdecl PhpNetworkConnectionCompare(
+    _In_ const void *elem1,
+    _In_ const void *elem2
+    );
+
+VOID PhpGetNetworkConnectionOwner(
+    _In_ PPH_NETWORK_CONNECTION Connection,
+    _Out_ PLARGE_INTEGER CreateTime,
+    _Out_writes_(PH_NETWORK_OWNER_INFO_SIZE) PULONGLONG OwnerInfo
+    );
+
+typedef struct _PH_NETWORK_ITEM_SNAPSHOT
+{
+    ULONG Count;
+    PPH_NETWORK_ITEM Items[1];
+} PH_NETWORK_ITEM_SNAPSHOT, *PPH_NETWORK_ITEM_SNAPSHOT;
+
 PPH_OBJECT_TYPE PhNetworkItemType;
 
-PPH_HASHTABLE PhNetworkHashtable;
+PPH_FLAT_HASHTABLE PhNetworkHashtable;
 PH_QUEUED_LOCK PhNetworkHashtableLock = PH_QUEUED_LOCK_INIT;
+static PPH_NETWORK_ITEM_SNAPSHOT PhpNetworkItemSnapshot = NULL;
+
+// The table buffers are kept between updates and only grow.
+static PVOID PhpNetworkTables[PH_NETWORK_TABLE_MAXIMUM];
+static ULONG PhpNetworkTableSizes[PH_NETWORK_TABLE_MAXIMUM];
+// The sorted connections from the previous update, and a spare array for the next update.
+static PPH_NETWORK_CONNECTION PhpNetworkConnections = NULL;
+static ULONG PhpNumberOfNetworkConnections = 0;
+static ULONG PhpAllocatedNetworkConnections = 0;
+static PPH_NETWORK_CONNECTION PhpSpareNetworkConnections = NULL;
+static ULONG PhpAllocatedSpareNetworkConnections = 0;
 
 PHAPPAPI PH_CALLBACK_DECLARE(PhNetworkItemAddedEvent);
 PHAPPAPI PH_CALLBACK_DECLARE(PhNetworkItemModifiedEvent);
 PHAPPAPI PH_CALLBACK_DECLARE(PhNetworkItemRemovedEvent);
 PHAPPAPI PH_CALLBACK_DECLARE(PhNetworkItemsUpdatedEvent);
+static PH_PROVIDER_UPDATE_BATCH PhpNetworkUpdateBatch = PH_PROVIDER_UPDATE_BATCH_INIT(GeneralCallbackNetworkProviderUpdated);
 
 BOOLEAN PhEnableNetworkProviderResolve = TRUE;
 
@@ -140,9 +227,24 @@ PH_WORK_QUEUE PhNetworkProviderWorkQueue;
 SLIST_HEADER PhNetworkItemQueryListHead;
 
 static PPH_HASHTABLE PhpResolveCacheHashtable;
+static LIST_ENTRY PhpResolveCacheListHead;
 static PH_QUEUED_LOCK PhpResolveCacheHashtableLock = PH_QUEUED_LOCK_INIT;
 
-static BOOLEAN NetworkImportDone = FALSE;
+// Service names of connection owners by process and service tag. Servers create many
+// connections with the same few owners, and resolving a tag is a query to the service
+// control manager. Entries are removed when their process exits.
+static PPH_HASHTABLE PhpOwnerCacheHashtable;
+static PH_QUEUED_LOCK PhpOwnerCacheLock = PH_QUEUED_LOCK_INIT;
+static PH_CALLBACK_REGISTRATION PhpProcessRemovedRegistration;
+
+// Addresses that are waiting to be resolved. Each address is only resolved once, no matter
+// how many network items are waiting for it.
+static PPH_HASHTABLE PhpResolveRequestHashtable;
+static LIST_ENTRY PhpResolveRequestListHead;
+static ULONG PhpResolveWorkerCount = 0;
+static PH_QUEUED_LOCK PhpResolveRequestLock = PH_QUEUED_LOCK_INIT;
+
+static PH_INITONCE NetworkImportInitOnce = PH_INITONCE_INIT;
 static _GetExtendedTcpTable GetExtendedTcpTable_I;
 static _GetExtendedUdpTable GetExtendedUdpTable_I;
 static _WSAStartup WSAStartup_I;
@@ -154,22 +256,50 @@ BOOLEAN PhNetworkProviderInitialization(
     VOID
     )
 {
-    PhNetworkItemType = PhCreateObjectType(L"NetworkItem", 0, PhpNetworkItemDeleteProcedure);
-    PhNetworkHashtable = PhCreateHashtable(
+    PH_OBJECT_TYPE_PARAMETERS parameters;
+
+    parameters.FreeListSize = 0;
+    parameters.FreeListCount = 128;
+    PhNetworkItemType = PhCreateObjectTypeEx(L"NetworkItem", PH_OBJECT_TYPE_USE_FREE_LIST, PhpNetworkItemDeleteProcedure, &parameters);
+    PhNetworkHashtable = PhCreateFlatHashtable(
         sizeof(PPH_NETWORK_ITEM),
+        0,
         PhpNetworkHashtableCompareFunction,
         PhpNetworkHashtableHashFunction,
         40
         );
+    PhRegisterLockStatistics(&PhNetworkHashtableLock, L"PhNetworkHashtableLock");
 
     RtlInitializeSListHead(&PhNetworkItemQueryListHead);
 
     PhpResolveCacheHashtable = PhCreateHashtable(
-        sizeof(PHP_RESOLVE_CACHE_ITEM),
+        sizeof(PPHP_RESOLVE_CACHE_ITEM),
         PhpResolveCacheHashtableCompareFunction,
         PhpResolveCacheHashtableHashFunction,
         20
         );
+    InitializeListHead(&PhpResolveCacheListHead);
+
+    PhpResolveRequestHashtable = PhCreateHashtable(
+        sizeof(PPHP_RESOLVE_REQUEST),
+        PhpResolveRequestHashtableCompareFunction,
+        PhpResolveRequestHashtableHashFunction,
+        20
+        );
+    InitializeListHead(&PhpResolveRequestListHead);
+
+    PhpOwnerCacheHashtable = PhCreateHashtable(
+        sizeof(PHP_OWNER_CACHE_ENTRY),
+        PhpOwnerCacheHashtableCompareFunction,
+        PhpOwnerCacheHashtableHashFunction,
+        20
+        );
+    PhRegisterCallback(
+        &PhProcessRemovedEvent,
+        PhpNetworkProcessRemovedHandler,
+        NULL,
+        &PhpProcessRemovedRegistration
+        );
 
     return TRUE;
 }
@@ -256,7 +386,7 @@ PPH_NETWORK_ITEM PhReferenceNetworkItem(
 
     PhAcquireQueuedLockShared(&PhNetworkHashtableLock);
 
-    networkItemPtr = (PPH_NETWORK_ITEM *)PhFindEntryHashtable(
+    networkItemPtr = (PPH_NETWORK_ITEM *)PhFindEntryFlatHashtable(
         PhNetworkHashtable,
         &lookupNetworkItemPtr
         );
@@ -276,12 +406,85 @@ PPH_NETWORK_ITEM PhReferenceNetworkItem(
     return networkItem;
 }
 
+/**
+ * Enumerates the network items.
+ *
+ * \param NetworkItems A variable which receives an array of pointers to network items. You
+ * must free the buffer with PhFree() when you no longer need it.
+ * \param NumberOfNetworkItems A variable which receives the number of network items returned
+ * in \a NetworkItems.
+ *
+ * \remarks The network items are referenced; dereference them with PhDereferenceObject() when
+ * you no longer need them. The items are those present at the end of the last update.
+ */
+VOID PhEnumNetworkItems(
+    _Out_opt_ PPH_NETWORK_ITEM **NetworkItems,
+    _Out_ PULONG NumberOfNetworkItems
+    )
+{
+    PPH_NETWORK_ITEM *networkItems;
+    PH_EPOCH_GUARD guard;
+    PPH_NETWORK_ITEM_SNAPSHOT snapshot;
+    ULONG count;
+    ULONG i;
+
+    PhEnterEpoch(&guard);
+
+    snapshot = *(PPH_NETWORK_ITEM_SNAPSHOT volatile *)&PhpNetworkItemSnapshot;
+    count = snapshot ? snapshot->Count : 0;
+
+    if (!NetworkItems)
+    {
+        PhLeaveEpoch(&guard);
+        *NumberOfNetworkItems = count;
+        return;
+    }
+
+    networkItems = PhAllocate(sizeof(PPH_NETWORK_ITEM) * count);
+
+    for (i = 0; i < count; i++)
+    {
+        PhReferenceObject(snapshot->Items[i]);
+        networkItems[i] = snapshot->Items[i];
+    }
+
+    PhLeaveEpoch(&guard);
+
+    *NetworkItems = networkItems;
+    *NumberOfNetworkItems = count;
+}
+
+static VOID PhpPublishNetworkItemSnapshot(
+    VOID
+    )
+{
+    PPH_NETWORK_ITEM_SNAPSHOT snapshot;
+    PPH_NETWORK_ITEM_SNAPSHOT oldSnapshot;
+    ULONG enumerationKey = 0;
+    PPH_NETWORK_ITEM *networkItem;
+    ULONG count = 0;
+
+    // Only the provider thread modifies the hashtable, so we don't need the lock to read it.
+    snapshot = PhAllocate(FIELD_OFFSET(PH_NETWORK_ITEM_SNAPSHOT, Items) + sizeof(PPH_NETWORK_ITEM) * PhNetworkHashtable->Count);
+
+    while (PhEnumFlatHashtable(PhNetworkHashtable, &networkItem, &enumerationKey))
+        snapshot->Items[count++] = *networkItem;
+
+    snapshot->Count = count;
+
+    oldSnapshot = _InterlockedExchangePointer(&PhpNetworkItemSnapshot, snapshot);
+
+    if (oldSnapshot)
+        PhFreeAfterEpoch(oldSnapshot);
+}
+
 VOID PhpRemoveNetworkItem(
     _In_ PPH_NETWORK_ITEM NetworkItem
     )
 {
-    PhRemoveEntryHashtable(PhNetworkHashtable, &NetworkItem);
-    PhDereferenceObject(NetworkItem);
+    PhRemoveEntryFlatHashtable(PhNetworkHashtable, &NetworkItem);
+    // The item may still be in the published snapshot.
+    PhDereferenceObjectAfterEpoch(NetworkItem);
 }
 
 BOOLEAN PhpResolveCacheHashtableCompareFunction(
@@ -304,6 +507,80 @@ ULONG NTAPI PhpResolveCacheHashtableHashFunction(
     return PhHashIpAddress(&cacheItem->Address);
 }
 
+BOOLEAN PhpResolveRequestHashtableCompareFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    )
+{
+    PPHP_RESOLVE_REQUEST request1 = *(PPHP_RESOLVE_REQUEST *)Entry1;
+    PPHP_RESOLVE_REQUEST request2 = *(PPHP_RESOLVE_REQUEST *)Entry2;
+
+    return PhEqualIpAddress(&request1->Address, &request2->Address);
+}
+
+ULONG NTAPI PhpResolveRequestHashtableHashFunction(
+    _In_ PVOID Entry
+    )
+{
+    PPHP_RESOLVE_REQUEST request = *(PPHP_RESOLVE_REQUEST *)Entry;
+
+    return PhHashIpAddress(&request->Address);
+}
+
+BOOLEAN PhpOwnerCacheHashtableCompareFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    )
+{
+    PPHP_OWNER_CACHE_ENTRY entry1 = Entry1;
+    PPHP_OWNER_CACHE_ENTRY entry2 = Entry2;
+
+    return entry1->ProcessId == entry2->ProcessId && entry1->ServiceTag == entry2->ServiceTag;
+}
+
+ULONG NTAPI PhpOwnerCacheHashtableHashFunction(
+    _In_ PVOID Entry
+    )
+{
+    PPHP_OWNER_CACHE_ENTRY entry = Entry;
+
+    return (HandleToUlong(entry->ProcessId) / 4) ^ PhHashInt32(entry->ServiceTag);
+}
+
+VOID NTAPI PhpNetworkProcessRemovedHandler(
+    _In_opt_ PVOID Parameter,
+    _In_opt_ PVOID Context
+    )
+{
+    PPH_PROCESS_ITEM processItem = Parameter;
+    PH_HASHTABLE_ENUM_CONTEXT enumContext;
+    PPHP_OWNER_CACHE_ENTRY entry;
+
+    PhAcquireQueuedLockExclusive(&PhpOwnerCacheLock);
+
+    if (PhpOwnerCacheHashtable->Count != 0)
+    {
+        // Removing entries doesn't move the others, so we can keep enumerating.
+        PhBeginEnumHashtable(PhpOwnerCacheHashtable, &enumContext);
+
+        while (entry = PhNextEnumHashtable(&enumContext))
+        {
+            PHP_OWNER_CACHE_ENTRY removedEntry;
+
+            if (entry->ProcessId != processItem->ProcessId)
+                continue;
+
+            removedEntry = *entry;
+            PhRemoveEntryHashtable(PhpOwnerCacheHashtable, &removedEntry);
+
+            if (removedEntry.ServiceName)
+                PhDereferenceObject(removedEntry.ServiceName);
+        }
+    }
+
+    PhReleaseQueuedLockExclusive(&PhpOwnerCacheLock);
+}
+
 PPHP_RESOLVE_CACHE_ITEM PhpLookupResolveCacheItem(
     _In_ PPH_IP_ADDRESS Address
     )
@@ -326,6 +603,150 @@ PPHP_RESOLVE_CACHE_ITEM PhpLookupResolveCacheItem(
         return NULL;
 }
 
+/**
+ * Looks up an address in the resolve cache.
+ *
+ * \param Address The address to look up.
+ * \param HostString A variable which receives a reference to the cached host name. This is
+ * NULL if the address is cached but could not be resolved.
+ *
+ * \return TRUE if the address has an entry that has not expired, otherwise FALSE.
+ */
+BOOLEAN PhpGetCachedHostName(
+    _In_ PPH_IP_ADDRESS Address,
+    _Out_ PPH_STRING *HostString
+    )
+{
+    PPHP_RESOLVE_CACHE_ITEM cacheItem;
+    LARGE_INTEGER currentTime;
+    BOOLEAN found = FALSE;
+
+    PhQuerySystemTime(&currentTime);
+
+    PhAcquireQueuedLockShared(&PhpResolveCacheHashtableLock);
+
+    cacheItem = PhpLookupResolveCacheItem(Address);
+
+    if (cacheItem && currentTime.QuadPart < cacheItem->ExpiryTime.QuadPart)
+    {
+        if (cacheItem->HostString)
+            PhReferenceObject(cacheItem->HostString);
+
+        *HostString = cacheItem->HostString;
+        found = TRUE;
+    }
+
+    PhReleaseQueuedLockShared(&PhpResolveCacheHashtableLock);
+
+    if (!found)
+        *HostString = NULL;
+
+    return found;
+}
+
+static VOID PhpRemoveResolveCacheItem(
+    _In_ PPHP_RESOLVE_CACHE_ITEM CacheItem
+    )
+{
+    PhRemoveEntryHashtable(PhpResolveCacheHashtable, &CacheItem);
+    RemoveEntryList(&CacheItem->ListEntry);
+
+    if (CacheItem->HostString)
+        PhDereferenceObject(CacheItem->HostString);
+
+    PhFree(CacheItem);
+}
+
+static VOID PhpTrimResolveCache(
+    _In_ PLARGE_INTEGER CurrentTime
+    )
+{
+    PLIST_ENTRY listEntry;
+    PPHP_RESOLVE_CACHE_ITEM cacheItem;
+    ULONG count;
+
+    // Remove the expired entries first.
+
+    listEntry = PhpResolveCacheListHead.Flink;
+
+    while (listEntry != &PhpResolveCacheListHead)
+    {
+        cacheItem = CONTAINING_RECORD(listEntry, PHP_RESOLVE_CACHE_ITEM, ListEntry);
+        listEntry = listEntry->Flink;
+
+        if (CurrentTime->QuadPart >= cacheItem->ExpiryTime.QuadPart)
+            PhpRemoveResolveCacheItem(cacheItem);
+    }
+
+    // If the cache is still too large, remove the oldest entries. We remove more than we need
+    // to so that we don't have to walk the cache again for every new entry.
+
+    if (PhpResolveCacheHashtable->Count >= PH_NETWORK_RESOLVE_CACHE_MAXIMUM)
+    {
+        count = PH_NETWORK_RESOLVE_CACHE_MAXIMUM / 8;
+
+        while (count-- != 0 && !IsListEmpty(&PhpResolveCacheListHead))
+        {
+            cacheItem = CONTAINING_RECORD(PhpResolveCacheListHead.Flink, PHP_RESOLVE_CACHE_ITEM, ListEntry);
+            PhpRemoveResolveCacheItem(cacheItem);
+        }
+    }
+}
+
+/**
+ * Adds an address to the resolve cache, replacing any existing entry.
+ *
+ * \param Address The address.
+ * \param HostString The host name, or NULL if the address could not be resolved.
+ */
+VOID PhpAddResolveCacheItem(
+    _In_ PPH_IP_ADDRESS Address,
+    _In_opt_ PPH_STRING HostString
+    )
+{
+    PPHP_RESOLVE_CACHE_ITEM cacheItem;
+    LARGE_INTEGER currentTime;
+
+    PhQuerySystemTime(&currentTime);
+
+    PhAcquireQueuedLockExclusive(&PhpResolveCacheHashtableLock);
+
+    cacheItem = PhpLookupResolveCacheItem(Address);
+
+    if (cacheItem)
+    {
+        RemoveEntryList(&cacheItem->ListEntry);
+
+        if (cacheItem->HostString)
+            PhDereferenceObject(cacheItem->HostString);
+    }
+    else
+    {
+        if (PhpResolveCacheHashtable->Count >= PH_NETWORK_RESOLVE_CACHE_MAXIMUM)
+            PhpTrimResolveCache(&currentTime);
+
+        cacheItem = PhAllocate(sizeof(PHP_RESOLVE_CACHE_ITEM));
+        cacheItem->Address = *Address;
+        PhAddEntryHashtable(PhpResolveCacheHashtable, &cacheItem);
+    }
+
+    cacheItem->HostString = HostString;
+
+    if (HostString)
+    {
+        PhReferenceObject(HostString);
+        cacheItem->ExpiryTime.QuadPart = currentTime.QuadPart + PH_NETWORK_RESOLVE_TTL;
+    }
+    else
+    {
+        cacheItem->ExpiryTime.QuadPart = currentTime.QuadPart + PH_NETWORK_RESOLVE_NEGATIVE_TTL;
+    }
+
+    InsertTailList(&PhpResolveCacheListHead, &cacheItem->ListEntry);
+
+    PhReleaseQueuedLockExclusive(&PhpResolveCacheHashtableLock);
+}
+
 PPH_STRING PhGetHostNameFromAddress(
     _In_ PPH_IP_ADDRESS Address
     )
@@ -336,6 +757,8 @@ PPH_STRING PhGetHostNameFromAddress(
     socklen_t length;
     PPH_STRING hostName;
 
+    PhPrefetchNetworkImports();
+
     if (!GetNameInfoW_I)
         return NULL;
 
@@ -399,58 +822,104 @@ PPH_STRING PhGetHostNameFromAddress(
     return hostName;
 }
 
+static VOID PhpCompleteResolveRequest(
+    _In_ PPHP_RESOLVE_REQUEST Request,
+    _In_ BOOLEAN Cancelled,
+    _In_opt_ PPH_STRING HostString
+    )
+{
+    PPH_NETWORK_ITEM_QUERY_DATA data;
+    PPH_NETWORK_ITEM_QUERY_DATA nextData;
+
+    // New waiters can't be added once the request has been removed from the hashtable.
+    PhAcquireQueuedLockExclusive(&PhpResolveRequestLock);
+    PhRemoveEntryHashtable(PhpResolveRequestHashtable, &Request);
+    data = Request->Waiters;
+    PhReleaseQueuedLockExclusive(&PhpResolveRequestLock);
+
+    while (data)
+    {
+        nextData = data->NextWaiter;
+
+        if (Cancelled)
+        {
+            PhDereferenceObject(data->NetworkItem);
+            PhFree(data);
+        }
+        else
+        {
+            if (HostString)
+                PhReferenceObject(HostString);
+
+            data->HostString = HostString;
+            RtlInterlockedPushEntrySList(&PhNetworkItemQueryListHead, &data->ListEntry);
+        }
+
+        data = nextData;
+    }
+
+    PhFree(Request);
+}
+
 NTSTATUS PhpNetworkItemQueryWorker(
     _In_ PVOID Parameter
     )
 {
-    PPH_NETWORK_ITEM_QUERY_DATA data = (PPH_NETWORK_ITEM_QUERY_DATA)Parameter;
+    PPHP_RESOLVE_REQUEST requests[PH_NETWORK_RESOLVE_BATCH_SIZE];
+    ULONG numberOfRequests;
+    LARGE_INTEGER currentTime;
     PPH_STRING hostString;
-    PPHP_RESOLVE_CACHE_ITEM cacheItem;
+    ULONG i;
 
-    // Last minute check of the cache.
+    while (TRUE)
+    {
+        // Take a batch of addresses from the queue. The worker exits once the queue is empty.
 
-    PhAcquireQueuedLockShared(&PhpResolveCacheHashtableLock);
-    cacheItem = PhpLookupResolveCacheItem(&data->Address);
-    PhReleaseQueuedLockShared(&PhpResolveCacheHashtableLock);
+        numberOfRequests = 0;
 
-    if (!cacheItem)
-    {
-        hostString = PhGetHostNameFromAddress(&data->Address);
+        PhAcquireQueuedLockExclusive(&PhpResolveRequestLock);
 
-        if (hostString)
+        while (numberOfRequests < PH_NETWORK_RESOLVE_BATCH_SIZE && !IsListEmpty(&PhpResolveRequestListHead))
         {
-            data->HostString = hostString;
+            requests[numberOfRequests] = CONTAINING_RECORD(RemoveHeadList(&PhpResolveRequestListHead), PHP_RESOLVE_REQUEST, ListEntry);
+            numberOfRequests++;
+        }
+
+        if (numberOfRequests == 0)
+            PhpResolveWorkerCount--;
 
-            // Update the cache.
+        PhReleaseQueuedLockExclusive(&PhpResolveRequestLock);
 
-            PhAcquireQueuedLockExclusive(&PhpResolveCacheHashtableLock);
+        if (numberOfRequests == 0)
+            break;
 
-            cacheItem = PhpLookupResolveCacheItem(&data->Address);
+        for (i = 0; i < numberOfRequests; i++)
+        {
+            PhQuerySystemTime(&currentTime);
 
-            if (!cacheItem)
+            if (currentTime.QuadPart - requests[i]->QueueTime.QuadPart >= PH_NETWORK_QUERY_TIMEOUT * PH_TICKS_PER_MS)
             {
-                cacheItem = PhAllocate(sizeof(PHP_RESOLVE_CACHE_ITEM));
-                cacheItem->Address = data->Address;
-                cacheItem->HostString = hostString;
-                PhReferenceObject(hostString);
+                PhpCompleteResolveRequest(requests[i], TRUE, NULL);
+                continue;
+            }
 
-                PhAddEntryHashtable(PhpResolveCacheHashtable, &cacheItem);
+            // Last minute check of the cache.
+            if (!PhpGetCachedHostName(&requests[i]->Address, &hostString))
+            {
+                hostString = PhGetHostNameFromAddress(&requests[i]->Address);
+
+                if (!hostString)
+                    dprintf("resolve failed, error %u\n", WSAGetLastError_I());
+
+                PhpAddResolveCacheItem(&requests[i]->Address, hostString);
             }
 
-            PhReleaseQueuedLockExclusive(&PhpResolveCacheHashtableLock);
-        }
-        else
-        {
-            dprintf("resolve failed, error %u\n", WSAGetLastError_I());
+            PhpCompleteResolveRequest(requests[i], FALSE, hostString);
+
+            if (hostString)
+                PhDereferenceObject(hostString);
         }
     }
-    else
-    {
-        PhReferenceObject(cacheItem->HostString);
-        data->HostString = cacheItem->HostString;
-    }
-
-    RtlInterlockedPushEntrySList(&PhNetworkItemQueryListHead, &data->ListEntry);
 
     return STATUS_SUCCESS;
 }
@@ -461,6 +930,11 @@ VOID PhpQueueNetworkItemQuery(
     )
 {
     PPH_NETWORK_ITEM_QUERY_DATA data;
+    PHP_RESOLVE_REQUEST lookupRequest;
+    PPHP_RESOLVE_REQUEST lookupRequestPtr = &lookupRequest;
+    PPHP_RESOLVE_REQUEST *requestPtr;
+    PPHP_RESOLVE_REQUEST request;
+    BOOLEAN startWorker = FALSE;
 
     if (!PhEnableNetworkProviderResolve)
         return;
@@ -477,13 +951,48 @@ VOID PhpQueueNetworkItemQuery(
 
     PhReferenceObject(NetworkItem);
 
-    if (PhBeginInitOnce(&PhNetworkProviderWorkQueueInitOnce))
+    lookupRequest.Address = data->Address;
+
+    PhAcquireQueuedLockExclusive(&PhpResolveRequestLock);
+
+    requestPtr = PhFindEntryHashtable(PhpResolveRequestHashtable, &lookupRequestPtr);
+
+    if (requestPtr)
     {
-        PhInitializeWorkQueue(&PhNetworkProviderWorkQueue, 0, 3, 500);
-        PhEndInitOnce(&PhNetworkProviderWorkQueueInitOnce);
+        // The address is already being resolved.
+        request = *requestPtr;
+    }
+    else
+    {
+        request = PhAllocate(sizeof(PHP_RESOLVE_REQUEST));
+        request->Address = data->Address;
+        PhQuerySystemTime(&request->QueueTime);
+        request->Waiters = NULL;
+        PhAddEntryHashtable(PhpResolveRequestHashtable, &request);
+        InsertTailList(&PhpResolveRequestListHead, &request->ListEntry);
+
+        if (PhpResolveWorkerCount < PH_NETWORK_RESOLVE_MAXIMUM_WORKERS)
+        {
+            PhpResolveWorkerCount++;
+            startWorker = TRUE;
+        }
     }
 
-    PhQueueItemWorkQueue(&PhNetworkProviderWorkQueue, PhpNetworkItemQueryWorker, data);
+    data->NextWaiter = request->Waiters;
+    request->Waiters = data;
+
+    PhReleaseQueuedLockExclusive(&PhpResolveRequestLock);
+
+    if (startWorker)
+    {
+        if (PhBeginInitOnce(&PhNetworkProviderWorkQueueInitOnce))
+        {
+            PhInitializeWorkQueue(&PhNetworkProviderWorkQueue, 0, PH_NETWORK_RESOLVE_MAXIMUM_WORKERS, 500);
+            PhEndInitOnce(&PhNetworkProviderWorkQueueInitOnce);
+        }
+
+        PhQueueItemWorkQueue(&PhNetworkProviderWorkQueue, PhpNetworkItemQueryWorker, NULL);
+    }
 }
 
 VOID PhpUpdateNetworkItemOwner(
@@ -493,27 +1002,71 @@ VOID PhpUpdateNetworkItemOwner(
 {
     if (*(PULONG64)NetworkItem->OwnerInfo)
     {
-        PVOID serviceTag;
-        PPH_STRING serviceName;
+        PHP_OWNER_CACHE_ENTRY lookupEntry;
+        PPHP_OWNER_CACHE_ENTRY entry;
+        PPH_STRING serviceName = NULL;
+        BOOLEAN found = FALSE;
 
+        lookupEntry.ProcessId = NetworkItem->ProcessId;
         // May change in the future...
-        serviceTag = UlongToPtr(*(PULONG)NetworkItem->OwnerInfo);
-        serviceName = PhGetServiceNameFromTag(NetworkItem->ProcessId, serviceTag);
+        lookupEntry.ServiceTag = *(PULONG)NetworkItem->OwnerInfo;
+
+        PhAcquireQueuedLockShared(&PhpOwnerCacheLock);
+
+        entry = PhFindEntryHashtable(PhpOwnerCacheHashtable, &lookupEntry);
+
+        if (entry && entry->CreateTime.QuadPart == ProcessItem->CreateTime.QuadPart)
+        {
+            PhSetReference(&serviceName, entry->ServiceName);
+            found = TRUE;
+        }
+
+        PhReleaseQueuedLockShared(&PhpOwnerCacheLock);
+
+        if (!found)
+        {
+            BOOLEAN added;
+
+            serviceName = PhGetServiceNameFromTag(NetworkItem->ProcessId, UlongToPtr(lookupEntry.ServiceTag));
+
+            lookupEntry.CreateTime = ProcessItem->CreateTime;
+            lookupEntry.ServiceName = serviceName;
+
+            PhAcquireQueuedLockExclusive(&PhpOwnerCacheLock);
+
+            entry = PhAddEntryHashtableEx(PhpOwnerCacheHashtable, &lookupEntry, &added);
+
+            if (!added)
+            {
+                // The entry belongs to an earlier process with the same ID.
+                entry->CreateTime = lookupEntry.CreateTime;
+                PhMoveReference(&entry->ServiceName, serviceName);
+            }
+
+            if (serviceName)
+                PhReferenceObject(serviceName);
+
+            PhReleaseQueuedLockExclusive(&PhpOwnerCacheLock);
+        }
 
         if (serviceName)
             PhMoveReference(&NetworkItem->OwnerName, serviceName);
     }
 }
 
-VOID PhNetworkProviderUpdate(
-    _In_ PVOID Object
+/**
+ * Loads iphlpapi.dll and ws2_32.dll and initializes Winsock if this has
+ * not been done yet.
+ *
+ * \remarks This happens on the first network provider run at the latest.
+ * Calling it earlier from a background thread keeps that run from paying
+ * for it.
+ */
+VOID PhPrefetchNetworkImports(
+    VOID
     )
 {
-    PPH_NETWORK_CONNECTION connections;
-    ULONG numberOfConnections;
-    ULONG i;
-
-    if (!NetworkImportDone)
+    if (PhBeginInitOnce(&NetworkImportInitOnce))
     {
         WSADATA wsaData;
         HMODULE iphlpapi;
@@ -534,45 +1087,63 @@ VOID PhNetworkProviderUpdate(
             WSAStartup_I(MAKEWORD(2, 2), &wsaData);
         }
 
-        NetworkImportDone = TRUE;
+        PhEndInitOnce(&NetworkImportInitOnce);
     }
+}
+
+VOID PhNetworkProviderUpdate(
+    _In_ PVOID Object
+    )
+{
+    PPH_NETWORK_CONNECTION connections;
+    ULONG numberOfConnections;
+    ULONG i;
+    BOOLEAN itemsChanged = FALSE;
+
+    PhPrefetchNetworkImports();
 
     if (!PhGetNetworkConnections(&connections, &numberOfConnections))
         return;
 
+    // Both the previous and the new connections are sorted, so a single merge finds the
+    // connections that were removed and matches the remaining connections to their items.
     {
         PPH_LIST connectionsToRemove = NULL;
-        PH_HASHTABLE_ENUM_CONTEXT enumContext;
-        PPH_NETWORK_ITEM *networkItem;
+        ULONG j = 0;
+        INT result;
 
-        PhBeginEnumHashtable(PhNetworkHashtable, &enumContext);
+        i = 0;
 
-        while (networkItem = PhNextEnumHashtable(&enumContext))
+        while (i < PhpNumberOfNetworkConnections || j < numberOfConnections)
         {
-            BOOLEAN found = FALSE;
+            if (i < PhpNumberOfNetworkConnections && j < numberOfConnections)
+                result = PhpNetworkConnectionCompare(&PhpNetworkConnections[i], &connections[j]);
+            else
+                result = i < PhpNumberOfNetworkConnections ? -1 : 1;
 
-            for (i = 0; i < numberOfConnections; i++)
+            if (result < 0)
             {
-                if (
-                    (*networkItem)->ProtocolType == connections[i].ProtocolType &&
-                    PhEqualIpEndpoint(&(*networkItem)->LocalEndpoint, &connections[i].LocalEndpoint) &&
-                    PhEqualIpEndpoint(&(*networkItem)->RemoteEndpoint, &connections[i].RemoteEndpoint) &&
-                    (*networkItem)->ProcessId == connections[i].ProcessId
-                    )
-                {
-                    found = TRUE;
-                    break;
-                }
-            }
+                PPH_NETWORK_ITEM networkItem = PhpNetworkConnections[i].NetworkItem;
 
-            if (!found)
-            {
-                PhInvokeCallback(&PhNetworkItemRemovedEvent, *networkItem);
+                PhInvokeCallback(&PhNetworkItemRemovedEvent, networkItem);
+                PhAddProviderUpdateBatchItem(&PhpNetworkUpdateBatch, PH_PROVIDER_UPDATE_REMOVED, networkItem);
 
                 if (!connectionsToRemove)
                     connectionsToRemove = PhCreateList(2);
 
-                PhAddItemList(connectionsToRemove, *networkItem);
+                PhAddItemList(connectionsToRemove, networkItem);
+                i++;
+            }
+            else if (result > 0)
+            {
+                connections[j].NetworkItem = NULL;
+                j++;
+            }
+            else
+            {
+                connections[j].NetworkItem = PhpNetworkConnections[i].NetworkItem;
+                i++;
+                j++;
             }
         }
 
@@ -587,6 +1158,7 @@ VOID PhNetworkProviderUpdate(
 
             PhReleaseQueuedLockExclusive(&PhNetworkHashtableLock);
             PhDereferenceObject(connectionsToRemove);
+            itemsChanged = TRUE;
         }
     }
 
@@ -618,17 +1190,10 @@ VOID PhNetworkProviderUpdate(
     {
         PPH_NETWORK_ITEM networkItem;
 
-        // Try to find the connection in our hashtable.
-        networkItem = PhReferenceNetworkItem(
-            connections[i].ProtocolType,
-            &connections[i].LocalEndpoint,
-            &connections[i].RemoteEndpoint,
-            connections[i].ProcessId
-            );
+        networkItem = connections[i].NetworkItem;
 
         if (!networkItem)
         {
-            PPHP_RESOLVE_CACHE_ITEM cacheItem;
             PPH_PROCESS_ITEM processItem;
 
             // Network item not found, create it.
@@ -641,8 +1206,7 @@ VOID PhNetworkProviderUpdate(
             networkItem->RemoteEndpoint = connections[i].RemoteEndpoint;
             networkItem->State = connections[i].State;
             networkItem->ProcessId = connections[i].ProcessId;
-            networkItem->CreateTime = connections[i].CreateTime;
-            memcpy(networkItem->OwnerInfo, connections[i].OwnerInfo, sizeof(ULONGLONG) * PH_NETWORK_OWNER_INFO_SIZE);
+            PhpGetNetworkConnectionOwner(&connections[i], &networkItem->CreateTime, networkItem->OwnerInfo);
 
             // Format various strings.
 
@@ -674,38 +1238,16 @@ VOID PhNetworkProviderUpdate(
             // Get host names.
 
             // Local
+            if (!PhpGetCachedHostName(&networkItem->LocalEndpoint.Address, &networkItem->LocalHostString))
             {
-                PhAcquireQueuedLockShared(&PhpResolveCacheHashtableLock);
-                cacheItem = PhpLookupResolveCacheItem(&networkItem->LocalEndpoint.Address);
-                PhReleaseQueuedLockShared(&PhpResolveCacheHashtableLock);
-
-                if (cacheItem)
-                {
-                    PhReferenceObject(cacheItem->HostString);
-                    networkItem->LocalHostString = cacheItem->HostString;
-                }
-                else
-                {
-                    PhpQueueNetworkItemQuery(networkItem, FALSE);
-                }
+                PhpQueueNetworkItemQuery(networkItem, FALSE);
             }
 
             // Remote
             if (!PhIsNullIpAddress(&networkItem->RemoteEndpoint.Address))
             {
-                PhAcquireQueuedLockShared(&PhpResolveCacheHashtableLock);
-                cacheItem = PhpLookupResolveCacheItem(&networkItem->RemoteEndpoint.Address);
-                PhReleaseQueuedLockShared(&PhpResolveCacheHashtableLock);
-
-                if (cacheItem)
-                {
-                    PhReferenceObject(cacheItem->HostString);
-                    networkItem->RemoteHostString = cacheItem->HostString;
-                }
-                else
-                {
+                if (!PhpGetCachedHostName(&networkItem->RemoteEndpoint.Address, &networkItem->RemoteHostString))
                     PhpQueueNetworkItemQuery(networkItem, TRUE);
-                }
             }
 
             // Get process information.
@@ -715,7 +1257,7 @@ VOID PhNetworkProviderUpdate(
                 PhReferenceObject(processItem->ProcessName);
                 PhpUpdateNetworkItemOwner(networkItem, processItem);
 
-                if (PhTestEvent(&processItem->Stage1Event))
+                if (processItem->Stage1Flags & PH_PROCESS_STAGE1_IMAGE)
                 {
                     networkItem->ProcessIcon = processItem->SmallIcon;
                     networkItem->ProcessIconValid = TRUE;
@@ -726,11 +1268,14 @@ VOID PhNetworkProviderUpdate(
 
             // Add the network item to the hashtable.
             PhAcquireQueuedLockExclusive(&PhNetworkHashtableLock);
-            PhAddEntryHashtable(PhNetworkHashtable, &networkItem);
+            PhAddEntryFlatHashtable(PhNetworkHashtable, &networkItem);
             PhReleaseQueuedLockExclusive(&PhNetworkHashtableLock);
+            connections[i].NetworkItem = networkItem;
+            itemsChanged = TRUE;
 
             // Raise the network item added event.
             PhInvokeCallback(&PhNetworkItemAddedEvent, networkItem);
+            PhAddProviderUpdateBatchItem(&PhpNetworkUpdateBatch, PH_PROVIDER_UPDATE_ADDED, networkItem);
         }
         else
         {
@@ -758,7 +1303,7 @@ VOID PhNetworkProviderUpdate(
                         modified = TRUE;
                     }
 
-                    if (!networkItem->ProcessIconValid && PhTestEvent(&processItem->Stage1Event))
+                    if (!networkItem->ProcessIconValid && (processItem->Stage1Flags & PH_PROCESS_STAGE1_IMAGE))
                     {
                         networkItem->ProcessIcon = processItem->SmallIcon;
                         networkItem->ProcessIconValid = TRUE;
@@ -775,14 +1320,29 @@ VOID PhNetworkProviderUpdate(
             {
                 // Raise the network item modified event.
                 PhInvokeCallback(&PhNetworkItemModifiedEvent, networkItem);
+                PhAddProviderUpdateBatchItem(&PhpNetworkUpdateBatch, PH_PROVIDER_UPDATE_MODIFIED, networkItem);
             }
-
-            PhDereferenceObject(networkItem);
         }
     }
 
-    PhFree(connections);
+    // The new connections become the previous connections for the next update.
+    {
+        PPH_NETWORK_CONNECTION oldConnections = PhpNetworkConnections;
+        ULONG oldAllocated = PhpAllocatedNetworkConnections;
+
+        PhpNetworkConnections = PhpSpareNetworkConnections;
+        PhpNumberOfNetworkConnections = numberOfConnections;
+        PhpAllocatedNetworkConnections = PhpAllocatedSpareNetworkConnections;
+        PhpSpareNetworkConnections = oldConnections;
+        PhpAllocatedSpareNetworkConnections = oldAllocated;
+    }
 
+    if (itemsChanged || !PhpNetworkItemSnapshot)
+        PhpPublishNetworkItemSnapshot();
+
+    PhReclaimEpoch();
+
+    PhFlushProviderUpdateBatch(&PhpNetworkUpdateBatch);
     PhInvokeCallback(&PhNetworkItemsUpdatedEvent, NULL);
 }
 
@@ -840,46 +1400,21 @@ PWSTR PhGetTcpStateName(
     }
 }
 
-BOOLEAN PhGetNetworkConnections(
-    _Out_ PPH_NETWORK_CONNECTION *Connections,
-    _Out_ PULONG NumberOfConnections
+static PVOID PhpQueryNetworkTable(
+    _In_ ULONG TableIndex
     )
 {
-    PVOID table;
+    BOOLEAN tcp;
+    ULONG addressFamily;
     DWORD tableSize;
-    PMIB_TCPTABLE_OWNER_MODULE tcp4Table;
-    PMIB_UDPTABLE_OWNER_MODULE udp4Table;
-    PMIB_TCP6TABLE_OWNER_MODULE tcp6Table;
-    PMIB_UDP6TABLE_OWNER_MODULE udp6Table;
-    ULONG count = 0;
-    ULONG i;
-    ULONG index = 0;
-    PPH_NETWORK_CONNECTION connections;
-
-    if (!GetExtendedTcpTable_I || !GetExtendedUdpTable_I)
-        return FALSE;
-
-    // TCP IPv4
-
-    tableSize = 0;
-    GetExtendedTcpTable_I(NULL, &tableSize, FALSE, AF_INET, TCP_TABLE_OWNER_MODULE_ALL, 0);
-    table = PhAllocate(tableSize);
-
-    if (GetExtendedTcpTable_I(table, &tableSize, FALSE, AF_INET, TCP_TABLE_OWNER_MODULE_ALL, 0) == 0)
-    {
-        tcp4Table = table;
-        count += tcp4Table->dwNumEntries;
-    }
-    else
-    {
-        PhFree(table);
-        tcp4Table = NULL;
-    }
+    DWORD result;
+    ULONG attempts;
 
-    // TCP IPv6
+    if (PhProviderDataSource)
+        return PhProviderDataSource->QueryNetworkTable(TableIndex);
 
-    tableSize = 0;
-    GetExtendedTcpTable_I(NULL, &tableSize, FALSE, AF_INET6, TCP_TABLE_OWNER_MODULE_ALL, 0);
+    tcp = TableIndex == PH_NETWORK_TABLE_TCP4 || TableIndex == PH_NETWORK_TABLE_TCP6;
+    addressFamily = (TableIndex == PH_NETWORK_TABLE_TCP4 || TableIndex == PH_NETWORK_TABLE_UDP4) ? AF_INET : AF_INET6;
 
     // Note: On Windows XP, GetExtendedTcpTable had a bug where it calculated the required buffer size
     // for IPv6 TCP_TABLE_OWNER_MODULE_ALL requests incorrectly, causing it to return the wrong size
@@ -887,61 +1422,236 @@ BOOLEAN PhGetNetworkConnections(
     // = FIELD_OFFSET(MIB_TCP6TABLE_OWNER_MODULE, table) + sizeof(MIB_TCP6ROW_OWNER_MODULE) * (number of entries)
     // However, the function calculated it as:
     // = FIELD_OFFSET(MIB_TCP6TABLE_OWNER_MODULE, table) + sizeof(MIB_TCP6ROW_OWNER_PID) * (number of entries)
-    // A workaround is implemented below.
-    if (WindowsVersion <= WINDOWS_XP && tableSize >= (ULONG)FIELD_OFFSET(MIB_TCP6TABLE_OWNER_MODULE, table)) // make sure we don't wrap around
+    // Since the function can't be trusted to check the size of our buffer, we always query the size
+    // and make sure the buffer is large enough before passing it in.
+    if (TableIndex == PH_NETWORK_TABLE_TCP6 && WindowsVersion <= WINDOWS_XP)
     {
+        tableSize = 0;
+        GetExtendedTcpTable_I(NULL, &tableSize, FALSE, AF_INET6, TCP_TABLE_OWNER_MODULE_ALL, 0);
+
+        if (tableSize < (ULONG)FIELD_OFFSET(MIB_TCP6TABLE_OWNER_MODULE, table)) // make sure we don't wrap around
+            return NULL;
+
         tableSize = FIELD_OFFSET(MIB_TCP6TABLE_OWNER_MODULE, table) +
             (tableSize - FIELD_OFFSET(MIB_TCP6TABLE_OWNER_MODULE, table)) / sizeof(MIB_TCP6ROW_OWNER_PID) * sizeof(MIB_TCP6ROW_OWNER_MODULE);
-    }
 
-    table = PhAllocate(tableSize);
+        if (tableSize > PhpNetworkTableSizes[TableIndex])
+        {
+            if (PhpNetworkTables[TableIndex])
+                PhFree(PhpNetworkTables[TableIndex]);
 
-    if (GetExtendedTcpTable_I(table, &tableSize, FALSE, AF_INET6, TCP_TABLE_OWNER_MODULE_ALL, 0) == 0)
-    {
-        tcp6Table = table;
-        count += tcp6Table->dwNumEntries;
+            PhpNetworkTables[TableIndex] = PhAllocate(tableSize);
+            PhpNetworkTableSizes[TableIndex] = tableSize;
+        }
+
+        tableSize = PhpNetworkTableSizes[TableIndex];
+
+        if (GetExtendedTcpTable_I(PhpNetworkTables[TableIndex], &tableSize, FALSE, AF_INET6, TCP_TABLE_OWNER_MODULE_ALL, 0) == 0)
+            return PhpNetworkTables[TableIndex];
+        else
+            return NULL;
     }
-    else
+
+    // Reuse the buffer from the previous update, and only grow it when the table no longer fits.
+    for (attempts = 0; attempts < 4; attempts++)
     {
-        PhFree(table);
-        tcp6Table = NULL;
+        tableSize = PhpNetworkTableSizes[TableIndex];
+
+        if (tcp)
+            result = GetExtendedTcpTable_I(PhpNetworkTables[TableIndex], &tableSize, FALSE, addressFamily, TCP_TABLE_OWNER_MODULE_ALL, 0);
+        else
+            result = GetExtendedUdpTable_I(PhpNetworkTables[TableIndex], &tableSize, FALSE, addressFamily, UDP_TABLE_OWNER_MODULE, 0);
+
+        if (result == 0)
+            return PhpNetworkTables[TableIndex];
+        if (result != ERROR_INSUFFICIENT_BUFFER || tableSize <= PhpNetworkTableSizes[TableIndex])
+            return NULL;
+
+        // Leave some room for new connections so that we don't have to grow the buffer again
+        // on the next update.
+        tableSize += tableSize / 8;
+
+        if (PhpNetworkTables[TableIndex])
+            PhFree(PhpNetworkTables[TableIndex]);
+
+        PhpNetworkTables[TableIndex] = PhAllocate(tableSize);
+        PhpNetworkTableSizes[TableIndex] = tableSize;
     }
 
-    // UDP IPv4
+    return NULL;
+}
+
+/**
+ * Queries a connection table.
+ *
+ * \param TableIndex The table to query, one of the PH_NETWORK_TABLE_* values.
+ * \param TableSize A variable which receives the size of the table, in bytes.
+ *
+ * \return The table, or NULL if the query failed. The table is owned by the network
+ * provider and is only valid until the next update.
+ */
+PVOID PhQueryNetworkTable(
+    _In_ ULONG TableIndex,
+    _Out_ PULONG TableSize
+    )
+{
+    PVOID table;
+    ULONG numberOfEntries;
+
+    PhPrefetchNetworkImports();
+
+    *TableSize = 0;
 
-    tableSize = 0;
-    GetExtendedUdpTable_I(NULL, &tableSize, FALSE, AF_INET, UDP_TABLE_OWNER_MODULE, 0);
-    table = PhAllocate(tableSize);
+    if (!GetExtendedTcpTable_I || !GetExtendedUdpTable_I)
+        return NULL;
+    if (!(table = PhpQueryNetworkTable(TableIndex)))
+        return NULL;
+
+    // The tables all start with the number of entries.
+    numberOfEntries = *(PULONG)table;
 
-    if (GetExtendedUdpTable_I(table, &tableSize, FALSE, AF_INET, UDP_TABLE_OWNER_MODULE, 0) == 0)
+    switch (TableIndex)
     {
-        udp4Table = table;
-        count += udp4Table->dwNumEntries;
+    case PH_NETWORK_TABLE_TCP4:
+        *TableSize = FIELD_OFFSET(MIB_TCPTABLE_OWNER_MODULE, table) + sizeof(MIB_TCPROW_OWNER_MODULE) * numberOfEntries;
+        break;
+    case PH_NETWORK_TABLE_TCP6:
+        *TableSize = FIELD_OFFSET(MIB_TCP6TABLE_OWNER_MODULE, table) + sizeof(MIB_TCP6ROW_OWNER_MODULE) * numberOfEntries;
+        break;
+    case PH_NETWORK_TABLE_UDP4:
+        *TableSize = FIELD_OFFSET(MIB_UDPTABLE_OWNER_MODULE, table) + sizeof(MIB_UDPROW_OWNER_MODULE) * numberOfEntries;
+        break;
+    case PH_NETWORK_TABLE_UDP6:
+        *TableSize = FIELD_OFFSET(MIB_UDP6TABLE_OWNER_MODULE, table) + sizeof(MIB_UDP6ROW_OWNER_MODULE) * numberOfEntries;
+        break;
     }
-    else
+
+    return table;
+}
+
+FORCEINLINE INT PhpCompareIpEndpoint(
+    _In_ PPH_IP_ENDPOINT Endpoint1,
+    _In_ PPH_IP_ENDPOINT Endpoint2
+    )
+{
+    INT result;
+
+    result = uintcmp(Endpoint1->Address.Type, Endpoint2->Address.Type);
+
+    if (result == 0)
     {
-        PhFree(table);
-        udp4Table = NULL;
+        if (Endpoint1->Address.Type == PH_IPV4_NETWORK_TYPE)
+            result = uintcmp(Endpoint1->Address.Ipv4, Endpoint2->Address.Ipv4);
+        else if (Endpoint1->Address.Type == PH_IPV6_NETWORK_TYPE)
+            result = memcmp(Endpoint1->Address.Ipv6, Endpoint2->Address.Ipv6, 16);
     }
 
-    // UDP IPv6
+    if (result == 0)
+        result = uintcmp(Endpoint1->Port, Endpoint2->Port);
+
+    return result;
+}
+
+int __cdecl PhpNetworkConnectionCompare(
+    _In_ const void *elem1,
+    _In_ const void *elem2
+    )
+{
+    PPH_NETWORK_CONNECTION connection1 = (PPH_NETWORK_CONNECTION)elem1;
+    PPH_NETWORK_CONNECTION connection2 = (PPH_NETWORK_CONNECTION)elem2;
+    INT result;
+
+    result = uintcmp(connection1->ProtocolType, connection2->ProtocolType);
+
+    if (result == 0)
+        result = PhpCompareIpEndpoint(&connection1->LocalEndpoint, &connection2->LocalEndpoint);
+    if (result == 0)
+        result = PhpCompareIpEndpoint(&connection1->RemoteEndpoint, &connection2->RemoteEndpoint);
+    if (result == 0)
+        result = uintptrcmp((ULONG_PTR)connection1->ProcessId, (ULONG_PTR)connection2->ProcessId);
 
-    tableSize = 0;
-    GetExtendedUdpTable_I(NULL, &tableSize, FALSE, AF_INET6, UDP_TABLE_OWNER_MODULE, 0);
-    table = PhAllocate(tableSize);
+    return result;
+}
+
+VOID PhpGetNetworkConnectionOwner(
+    _In_ PPH_NETWORK_CONNECTION Connection,
+    _Out_ PLARGE_INTEGER CreateTime,
+    _Out_writes_(PH_NETWORK_OWNER_INFO_SIZE) PULONGLONG OwnerInfo
+    )
+{
+    PULONGLONG owningModuleInfo;
 
-    if (GetExtendedUdpTable_I(table, &tableSize, FALSE, AF_INET6, UDP_TABLE_OWNER_MODULE, 0) == 0)
+    memset(OwnerInfo, 0, sizeof(ULONGLONG) * PH_NETWORK_OWNER_INFO_SIZE);
+
+    switch (Connection->ProtocolType)
     {
-        udp6Table = table;
-        count += udp6Table->dwNumEntries;
+    case PH_TCP4_NETWORK_PROTOCOL:
+        *CreateTime = ((PMIB_TCPROW_OWNER_MODULE)Connection->Row)->liCreateTimestamp;
+        owningModuleInfo = ((PMIB_TCPROW_OWNER_MODULE)Connection->Row)->OwningModuleInfo;
+        break;
+    case PH_TCP6_NETWORK_PROTOCOL:
+        *CreateTime = ((PMIB_TCP6ROW_OWNER_MODULE)Connection->Row)->liCreateTimestamp;
+        owningModuleInfo = ((PMIB_TCP6ROW_OWNER_MODULE)Connection->Row)->OwningModuleInfo;
+        break;
+    case PH_UDP4_NETWORK_PROTOCOL:
+        *CreateTime = ((PMIB_UDPROW_OWNER_MODULE)Connection->Row)->liCreateTimestamp;
+        owningModuleInfo = ((PMIB_UDPROW_OWNER_MODULE)Connection->Row)->OwningModuleInfo;
+        break;
+    case PH_UDP6_NETWORK_PROTOCOL:
+        *CreateTime = ((PMIB_UDP6ROW_OWNER_MODULE)Connection->Row)->liCreateTimestamp;
+        owningModuleInfo = ((PMIB_UDP6ROW_OWNER_MODULE)Connection->Row)->OwningModuleInfo;
+        break;
+    default:
+        CreateTime->QuadPart = 0;
+        return;
     }
-    else
+
+    memcpy(OwnerInfo, owningModuleInfo, sizeof(ULONGLONG) * min(PH_NETWORK_OWNER_INFO_SIZE, TCPIP_OWNING_MODULE_SIZE));
+}
+
+/**
+ * Gets the current connections, sorted by protocol, endpoints and process ID.
+ *
+ * \param Connections A variable which receives the connections. The array is owned
+ * by the network provider and is only valid until the next update.
+ * \param NumberOfConnections A variable which receives the number of connections.
+ */
+BOOLEAN PhGetNetworkConnections(
+    _Out_ PPH_NETWORK_CONNECTION *Connections,
+    _Out_ PULONG NumberOfConnections
+    )
+{
+    PMIB_TCPTABLE_OWNER_MODULE tcp4Table;
+    PMIB_UDPTABLE_OWNER_MODULE udp4Table;
+    PMIB_TCP6TABLE_OWNER_MODULE tcp6Table;
+    PMIB_UDP6TABLE_OWNER_MODULE udp6Table;
+    ULONG count = 0;
+    ULONG i;
+    ULONG index = 0;
+    PPH_NETWORK_CONNECTION connections;
+
+    if (!GetExtendedTcpTable_I || !GetExtendedUdpTable_I)
+        return FALSE;
+
+    if (tcp4Table = PhpQueryNetworkTable(PH_NETWORK_TABLE_TCP4))
+        count += tcp4Table->dwNumEntries;
+    if (tcp6Table = PhpQueryNetworkTable(PH_NETWORK_TABLE_TCP6))
+        count += tcp6Table->dwNumEntries;
+    if (udp4Table = PhpQueryNetworkTable(PH_NETWORK_TABLE_UDP4))
+        count += udp4Table->dwNumEntries;
+    if (udp6Table = PhpQueryNetworkTable(PH_NETWORK_TABLE_UDP6))
+        count += udp6Table->dwNumEntries;
+
+    if (PhpAllocatedSpareNetworkConnections < count)
     {
-        PhFree(table);
-        udp6Table = NULL;
+        if (PhpSpareNetworkConnections)
+            PhFree(PhpSpareNetworkConnections);
+
+        PhpAllocatedSpareNetworkConnections = count + count / 8;
+        PhpSpareNetworkConnections = PhAllocate(sizeof(PH_NETWORK_CONNECTION) * PhpAllocatedSpareNetworkConnections);
     }
 
-    connections = PhAllocate(sizeof(PH_NETWORK_CONNECTION) * count);
+    connections = PhpSpareNetworkConnections;
     memset(connections, 0, sizeof(PH_NETWORK_CONNECTION) * count);
 
     if (tcp4Table)
@@ -960,17 +1670,10 @@ BOOLEAN PhGetNetworkConnections(
 
             connections[index].State = tcp4Table->table[i].dwState;
             connections[index].ProcessId = UlongToHandle(tcp4Table->table[i].dwOwningPid);
-            connections[index].CreateTime = tcp4Table->table[i].liCreateTimestamp;
-            memcpy(
-                connections[index].OwnerInfo,
-                tcp4Table->table[i].OwningModuleInfo,
-                sizeof(ULONGLONG) * min(PH_NETWORK_OWNER_INFO_SIZE, TCPIP_OWNING_MODULE_SIZE)
-                );
+            connections[index].Row = &tcp4Table->table[i];
 
             index++;
         }
-
-        PhFree(tcp4Table);
     }
 
     if (tcp6Table)
@@ -989,17 +1692,10 @@ BOOLEAN PhGetNetworkConnections(
 
             connections[index].State = tcp6Table->table[i].dwState;
             connections[index].ProcessId = UlongToHandle(tcp6Table->table[i].dwOwningPid);
-            connections[index].CreateTime = tcp6Table->table[i].liCreateTimestamp;
-            memcpy(
-                connections[index].OwnerInfo,
-                tcp6Table->table[i].OwningModuleInfo,
-                sizeof(ULONGLONG) * min(PH_NETWORK_OWNER_INFO_SIZE, TCPIP_OWNING_MODULE_SIZE)
-                );
+            connections[index].Row = &tcp6Table->table[i];
 
             index++;
         }
-
-        PhFree(tcp6Table);
     }
 
     if (udp4Table)
@@ -1016,17 +1712,10 @@ BOOLEAN PhGetNetworkConnections(
 
             connections[index].State = 0;
             connections[index].ProcessId = UlongToHandle(udp4Table->table[i].dwOwningPid);
-            connections[index].CreateTime = udp4Table->table[i].liCreateTimestamp;
-            memcpy(
-                connections[index].OwnerInfo,
-                udp4Table->table[i].OwningModuleInfo,
-                sizeof(ULONGLONG) * min(PH_NETWORK_OWNER_INFO_SIZE, TCPIP_OWNING_MODULE_SIZE)
-                );
+            connections[index].Row = &udp4Table->table[i];
 
             index++;
         }
-
-        PhFree(udp4Table);
     }
 
     if (udp6Table)
@@ -1043,17 +1732,31 @@ BOOLEAN PhGetNetworkConnections(
 
             connections[index].State = 0;
             connections[index].ProcessId = UlongToHandle(udp6Table->table[i].dwOwningPid);
-            connections[index].CreateTime = udp6Table->table[i].liCreateTimestamp;
-            memcpy(
-                connections[index].OwnerInfo,
-                udp6Table->table[i].OwningModuleInfo,
-                sizeof(ULONGLONG) * min(PH_NETWORK_OWNER_INFO_SIZE, TCPIP_OWNING_MODULE_SIZE)
-                );
+            connections[index].Row = &udp6Table->table[i];
 
             index++;
         }
+    }
+
+    qsort(connections, count, sizeof(PH_NETWORK_CONNECTION), PhpNetworkConnectionCompare);
+
+    // Remove duplicates so that each connection maps to exactly one network item.
+    if (count != 0)
+    {
+        index = 1;
+
+        for (i = 1; i < count; i++)
+        {
+            if (PhpNetworkConnectionCompare(&connections[index - 1], &connections[i]) != 0)
+            {
+                if (index != i)
+                    connections[index] = connections[i];
+
+                index++;
+            }
+        }
 
-        PhFree(udp6Table);
+        count = index;
     }
 
     *NumberOfConnections = count;
@@ -37,6 +37,14 @@ typedef struct _PH_NF_BITMAP
     PVOID Bits;
 } PH_NF_BITMAP, *PPH_NF_BITMAP;
 
+// The last bitmap sent to explorer for a default icon.
+typedef struct _PH_NF_ICON_CACHE
+{
+    BOOLEAN Valid;
+    ULONG BitsSize;
+    PVOID Bits;
+} PH_NF_ICON_CACHE, *PPH_NF_ICON_CACHE;
+
 HICON PhNfpGetBlackIcon(
     VOID
     );
@@ -84,6 +92,15 @@ VOID PhNfpBeginBitmap2(
     _Out_ HBITMAP *OldBitmap
     );
 
+VOID PhNfpUpdateDefaultIcon(
+    _In_ ULONG Id,
+    _In_ PPH_STRING Text,
+    _In_ HBITMAP Bitmap,
+    _In_opt_ PVOID Bits,
+    _In_ ULONG Width,
+    _In_ ULONG Height
+    );
+
 VOID PhNfpUpdateIconCpuHistory(
     VOID
     );
@@ -110,6 +127,7 @@ ULONG PhNfIconNotifyMask;
 ULONG PhNfMaximumIconId = PH_ICON_DEFAULT_MAXIMUM;
 PPH_NF_ICON PhNfRegisteredIcons[32] = { 0 };
 PPH_STRING PhNfIconTextCache[32] = { 0 };
+PH_NF_ICON_CACHE PhNfpIconCache[32] = { 0 };
 BOOLEAN PhNfMiniInfoEnabled;
 BOOLEAN PhNfMiniInfoPinned;
 
@@ -120,6 +138,13 @@ PH_NF_BITMAP PhNfpBlackBitmapContext = { 0 };
 HBITMAP PhNfpBlackBitmap = NULL;
 HICON PhNfpBlackIcon = NULL;
 
+// The scale of the I/O history icon. It is only valid while the icon is updated after
+// every new sample.
+PH_SLIDING_MAXIMUM PhNfpIoMaximum;
+ULONG PhNfpIoMaximumWindowSize = 0;
+LONG PhNfpIoMaximumHistoryIndex;
+BOOLEAN PhNfpIoMaximumValid = FALSE;
+
 VOID PhNfLoadStage1(
     VOID
     )
@@ -596,6 +621,9 @@ BOOLEAN PhNfpAddNotifyIcon(
     if (!_BitScanForward(&Id, Id))
         return FALSE;
 
+    // The new icon is black, so the next update must send the bitmap again.
+    PhNfpIconCache[Id].Valid = FALSE;
+
     notifyIcon.hWnd = PhMainWndHandle;
     notifyIcon.uID = Id;
     notifyIcon.uFlags = NIF_ICON | NIF_MESSAGE | NIF_TIP;
@@ -705,6 +733,8 @@ VOID PhNfpProcessesUpdatedHandler(
         PhNfpUpdateIconCpuHistory();
     if (PhNfIconMask & PH_ICON_IO_HISTORY)
         PhNfpUpdateIconIoHistory();
+    else
+        PhNfpIoMaximumValid = FALSE;
     if (PhNfIconMask & PH_ICON_COMMIT_HISTORY)
         PhNfpUpdateIconCommitHistory();
     if (PhNfIconMask & PH_ICON_PHYSICAL_HISTORY)
@@ -785,6 +815,74 @@ VOID PhNfpUpdateRegisteredIcon(
         PhDereferenceObject(newText);
 }
 
+/**
+ * Updates a default icon. Explorer is only called for the parts (bitmap, text) that differ from
+ * what it already shows, because Shell_NotifyIcon is by far the most expensive part of an update.
+ *
+ * \param Id The ID of the icon.
+ * \param Text The new tooltip text.
+ * \param Bitmap The new bitmap. It must not be selected into a DC.
+ * \param Bits The bits of \a Bitmap.
+ * \param Width The width of \a Bitmap.
+ * \param Height The height of \a Bitmap.
+ */
+VOID PhNfpUpdateDefaultIcon(
+    _In_ ULONG Id,
+    _In_ PPH_STRING Text,
+    _In_ HBITMAP Bitmap,
+    _In_opt_ PVOID Bits,
+    _In_ ULONG Width,
+    _In_ ULONG Height
+    )
+{
+    PPH_NF_ICON_CACHE cache;
+    ULONG index;
+    ULONG bitsSize;
+    ULONG flags;
+    HICON icon;
+
+    if (!_BitScanForward(&index, Id))
+        return;
+
+    cache = &PhNfpIconCache[index];
+    bitsSize = Width * Height * sizeof(ULONG);
+    flags = 0;
+    icon = NULL;
+
+    if (Bits)
+        GdiFlush();
+
+    if (!Bits || !cache->Valid || cache->BitsSize != bitsSize || memcmp(cache->Bits, Bits, bitsSize) != 0)
+    {
+        if (Bits)
+        {
+            if (cache->BitsSize != bitsSize)
+            {
+                if (cache->Bits)
+                    PhFree(cache->Bits);
+
+                cache->Bits = PhAllocate(bitsSize);
+                cache->BitsSize = bitsSize;
+            }
+
+            memcpy(cache->Bits, Bits, bitsSize);
+            cache->Valid = TRUE;
+        }
+
+        icon = PhNfBitmapToIcon(Bitmap);
+        flags |= NIF_ICON;
+    }
+
+    if (!PhNfIconTextCache[index] || !PhEqualString(PhNfIconTextCache[index], Text, FALSE))
+        flags |= NIF_TIP;
+
+    if (flags != 0)
+        PhNfpModifyNotifyIcon(Id, flags, Text, icon);
+
+    if (icon)
+        DestroyIcon(icon);
+}
+
 VOID PhNfpBeginBitmap(
     _Out_ PULONG Width,
     _Out_ PULONG Height,
@@ -863,7 +961,6 @@ VOID PhNfpUpdateIconCpuHistory(
     PVOID bits;
     HDC hdc;
     HBITMAP oldBitmap;
-    HICON icon;
     HANDLE maxCpuProcessId;
     PPH_PROCESS_ITEM maxCpuProcessItem;
     PH_FORMAT format[8];
@@ -892,7 +989,6 @@ VOID PhNfpUpdateIconCpuHistory(
         PhDrawGraphDirect(hdc, bits, &drawInfo);
 
     SelectObject(hdc, oldBitmap);
-    icon = PhNfBitmapToIcon(bitmap);
 
     // Text
 
@@ -922,9 +1018,8 @@ VOID PhNfpUpdateIconCpuHistory(
     text = PhFormat(format, maxCpuProcessItem ? 8 : 3, 128);
     if (maxCpuProcessItem) PhDereferenceObject(maxCpuProcessItem);
 
-    PhNfpModifyNotifyIcon(PH_ICON_CPU_HISTORY, NIF_TIP | NIF_ICON, text, icon);
+    PhNfpUpdateDefaultIcon(PH_ICON_CPU_HISTORY, text, bitmap, bits, drawInfo.Width, drawInfo.Height);
 
-    DestroyIcon(icon);
     PhDereferenceObject(text);
 }
 
@@ -958,7 +1053,6 @@ VOID PhNfpUpdateIconIoHistory(
     PVOID bits;
     HDC hdc;
     HBITMAP oldBitmap;
-    HICON icon;
     HANDLE maxIoProcessId;
     PPH_PROCESS_ITEM maxIoProcessItem;
     PH_FORMAT format[8];
@@ -972,7 +1066,6 @@ VOID PhNfpUpdateIconIoHistory(
     lineData2 = _alloca(maxDataCount * sizeof(FLOAT));
 
     lineDataCount = min(maxDataCount, PhIoReadHistory.Count);
-    max = 1024 * 1024; // minimum scaling of 1 MB.
 
     for (i = 0; i < lineDataCount; i++)
     {
@@ -981,11 +1074,43 @@ VOID PhNfpUpdateIconIoHistory(
             (FLOAT)PhGetItemCircularBuffer_ULONG64(&PhIoOtherHistory, i);
         lineData2[i] =
             (FLOAT)PhGetItemCircularBuffer_ULONG64(&PhIoWriteHistory, i);
+    }
+
+    // Keep the largest total of the visible samples up to date one sample at a time. The
+    // window has to be rebuilt if the icon size changed or if samples were missed.
+    if (!PhNfpIoMaximumValid || PhNfpIoMaximumWindowSize != maxDataCount)
+    {
+        if (PhNfpIoMaximumWindowSize != 0)
+            PhDeleteSlidingMaximum(&PhNfpIoMaximum);
+
+        PhInitializeSlidingMaximum(&PhNfpIoMaximum, maxDataCount);
+        PhNfpIoMaximumWindowSize = maxDataCount;
 
-        if (max < lineData1[i] + lineData2[i])
-            max = lineData1[i] + lineData2[i];
+        for (i = lineDataCount; i != 0; i--)
+        {
+            PhAddItemSlidingMaximum(&PhNfpIoMaximum,
+                PhGetItemCircularBuffer_ULONG64(&PhIoReadHistory, i - 1) +
+                PhGetItemCircularBuffer_ULONG64(&PhIoOtherHistory, i - 1) +
+                PhGetItemCircularBuffer_ULONG64(&PhIoWriteHistory, i - 1));
+        }
+
+        PhNfpIoMaximumValid = TRUE;
+    }
+    else if (PhIoReadHistory.Index != PhNfpIoMaximumHistoryIndex && lineDataCount != 0)
+    {
+        PhAddItemSlidingMaximum(&PhNfpIoMaximum,
+            PhGetItemCircularBuffer_ULONG64(&PhIoReadHistory, 0) +
+            PhGetItemCircularBuffer_ULONG64(&PhIoOtherHistory, 0) +
+            PhGetItemCircularBuffer_ULONG64(&PhIoWriteHistory, 0));
     }
 
+    PhNfpIoMaximumHistoryIndex = PhIoReadHistory.Index;
+
+    max = (FLOAT)PhGetSlidingMaximum(&PhNfpIoMaximum);
+
+    if (max < 1024 * 1024)
+        max = 1024 * 1024; // minimum scaling of 1 MB.
+
     PhDivideSinglesBySingle(lineData1, max, lineDataCount);
     PhDivideSinglesBySingle(lineData2, max, lineDataCount);
 
@@ -1001,7 +1126,6 @@ VOID PhNfpUpdateIconIoHistory(
         PhDrawGraphDirect(hdc, bits, &drawInfo);
 
     SelectObject(hdc, oldBitmap);
-    icon = PhNfBitmapToIcon(bitmap);
 
     // Text
 
@@ -1031,9 +1155,8 @@ VOID PhNfpUpdateIconIoHistory(
     text = PhFormat(format, maxIoProcessItem ? 8 : 6, 128);
     if (maxIoProcessItem) PhDereferenceObject(maxIoProcessItem);
 
-    PhNfpModifyNotifyIcon(PH_ICON_IO_HISTORY, NIF_TIP | NIF_ICON, text, icon);
+    PhNfpUpdateDefaultIcon(PH_ICON_IO_HISTORY, text, bitmap, bits, drawInfo.Width, drawInfo.Height);
 
-    DestroyIcon(icon);
     PhDereferenceObject(text);
 }
 
@@ -1065,7 +1188,6 @@ VOID PhNfpUpdateIconCommitHistory(
     PVOID bits;
     HDC hdc;
     HBITMAP oldBitmap;
-    HICON icon;
     DOUBLE commitFraction;
     PH_FORMAT format[5];
     PPH_STRING text;
@@ -1092,7 +1214,6 @@ VOID PhNfpUpdateIconCommitHistory(
         PhDrawGraphDirect(hdc, bits, &drawInfo);
 
     SelectObject(hdc, oldBitmap);
-    icon = PhNfBitmapToIcon(bitmap);
 
     // Text
 
@@ -1106,9 +1227,8 @@ VOID PhNfpUpdateIconCommitHistory(
 
     text = PhFormat(format, 5, 96);
 
-    PhNfpModifyNotifyIcon(PH_ICON_COMMIT_HISTORY, NIF_TIP | NIF_ICON, text, icon);
+    PhNfpUpdateDefaultIcon(PH_ICON_COMMIT_HISTORY, text, bitmap, bits, drawInfo.Width, drawInfo.Height);
 
-    DestroyIcon(icon);
     PhDereferenceObject(text);
 }
 
@@ -1140,7 +1260,6 @@ VOID PhNfpUpdateIconPhysicalHistory(
     PVOID bits;
     HDC hdc;
     HBITMAP oldBitmap;
-    HICON icon;
     ULONG physicalUsage;
     FLOAT physicalFraction;
     PH_FORMAT format[5];
@@ -1168,7 +1287,6 @@ VOID PhNfpUpdateIconPhysicalHistory(
         PhDrawGraphDirect(hdc, bits, &drawInfo);
 
     SelectObject(hdc, oldBitmap);
-    icon = PhNfBitmapToIcon(bitmap);
 
     // Text
 
@@ -1183,9 +1301,8 @@ VOID PhNfpUpdateIconPhysicalHistory(
 
     text = PhFormat(format, 5, 96);
 
-    PhNfpModifyNotifyIcon(PH_ICON_PHYSICAL_HISTORY, NIF_TIP | NIF_ICON, text, icon);
+    PhNfpUpdateDefaultIcon(PH_ICON_PHYSICAL_HISTORY, text, bitmap, bits, drawInfo.Width, drawInfo.Height);
 
-    DestroyIcon(icon);
     PhDereferenceObject(text);
 }
 
@@ -1198,15 +1315,15 @@ VOID PhNfpUpdateIconCpuUsage(
     HBITMAP bitmap;
     HDC hdc;
     HBITMAP oldBitmap;
-    HICON icon;
     HANDLE maxCpuProcessId;
     PPH_PROCESS_ITEM maxCpuProcessItem;
     PPH_STRING maxCpuText = NULL;
     PPH_STRING text;
+    PVOID bits;
 
     // Icon
 
-    PhNfpBeginBitmap(&width, &height, &bitmap, NULL, &hdc, &oldBitmap);
+    PhNfpBeginBitmap(&width, &height, &bitmap, &bits, &hdc, &oldBitmap);
 
     // This stuff is copied from CpuUsageIcon.cs (PH 1.x).
     {
@@ -1283,7 +1400,6 @@ VOID PhNfpUpdateIconCpuUsage(
     }
 
     SelectObject(hdc, oldBitmap);
-    icon = PhNfBitmapToIcon(bitmap);
 
     // Text
 
@@ -1308,8 +1424,7 @@ VOID PhNfpUpdateIconCpuUsage(
     text = PhFormatString(L"CPU Usage: %.2f%%%s", (PhCpuKernelUsage + PhCpuUserUsage) * 100, PhGetStringOrEmpty(maxCpuText));
     if (maxCpuText) PhDereferenceObject(maxCpuText);
 
-    PhNfpModifyNotifyIcon(PH_ICON_CPU_USAGE, NIF_TIP | NIF_ICON, text, icon);
+    PhNfpUpdateDefaultIcon(PH_ICON_CPU_USAGE, text, bitmap, bits, width, height);
 
-    DestroyIcon(icon);
     PhDereferenceObject(text);
 }
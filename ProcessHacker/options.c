@@ -183,6 +183,7 @@ VOID PhShowOptionsDialog(
         if (!PhStartupParameters.ShowOptions)
         {
             PhUpdateCachedSettings();
+            PhSetGraphRenderer(PhGetIntegerSetting(L"GraphRenderer"));
             ProcessHacker_SaveAllSettings(PhMainWndHandle);
             PhInvalidateAllProcessNodes();
             PhReloadSettingsProcessTreeList();
@@ -1215,3 +1215,43 @@ CleanupExit:
 
     return status;
 }
+
+NTSTATUS PhSvcCallBatch(
+    _Inout_updates_(NumberOfRequests) PPHSVC_API_PAYLOAD Requests,
+    _In_ ULONG NumberOfRequests
+    )
+{
+    NTSTATUS status;
+    PHSVC_API_MSG m;
+    PPHSVC_API_PAYLOAD requests;
+    SIZE_T requestsLength;
+    ULONG i;
+
+    if (!PhSvcClPortHandle)
+        return STATUS_PORT_DISCONNECTED;
+    if (NumberOfRequests == 0)
+        return STATUS_SUCCESS;
+
+    requestsLength = (SIZE_T)NumberOfRequests * sizeof(PHSVC_API_PAYLOAD);
+
+    m.p.ApiNumber = PhSvcBatchApiNumber;
+
+    // The requests are passed through the port view, so the size of a batch is only limited by
+    // the size of the port section and not by the maximum message length.
+    requests = PhSvcpCreateString(Requests, requestsLength, &m.p.u.Batch.i.Requests);
+
+    if (!requests)
+        return STATUS_NO_MEMORY;
+
+    for (i = 0; i < NumberOfRequests; i++)
+        requests[i].ReturnStatus = STATUS_PENDING;
+
+    status = PhSvcpCallServer(&m);
+
+    for (i = 0; i < NumberOfRequests; i++)
+        Requests[i].ReturnStatus = NT_SUCCESS(status) ? requests[i].ReturnStatus : status;
+
+    PhSvcpFreeHeap(requests);
+
+    return status;
+}
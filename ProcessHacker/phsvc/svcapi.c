@@ -59,7 +59,8 @@ PPHSVC_API_PROCEDURE PhSvcApiCallTable[] =
     PhSvcApiCreateProcessIgnoreIfeoDebugger,
     PhSvcApiSetServiceSecurity,
     PhSvcApiLoadDbgHelp,
-    PhSvcApiWriteMiniDumpProcess
+    PhSvcApiWriteMiniDumpProcess,
+    PhSvcApiBatch
 };
 C_ASSERT(sizeof(PhSvcApiCallTable) / sizeof(PPHSVC_API_PROCEDURE) == PhSvcMaximumApiNumber - 1);
 
@@ -1424,3 +1425,49 @@ NTSTATUS PhSvcApiWriteMiniDumpProcess(
             return STATUS_UNSUCCESSFUL;
     }
 }
+
+NTSTATUS PhSvcApiBatch(
+    _In_ PPHSVC_CLIENT Client,
+    _Inout_ PPHSVC_API_PAYLOAD Payload
+    )
+{
+    NTSTATUS status;
+    PPHSVC_API_PAYLOAD requests;
+    ULONG numberOfRequests;
+    ULONG i;
+
+    if (PhIsExecutingInWow64())
+        return STATUS_NOT_SUPPORTED; // the payload layout differs for 32-bit clients
+
+    if (Payload->u.Batch.i.Requests.Length % sizeof(PHSVC_API_PAYLOAD) != 0)
+        return STATUS_INVALID_PARAMETER;
+
+    if (!NT_SUCCESS(status = PhSvcProbeBuffer(&Payload->u.Batch.i.Requests, __alignof(PHSVC_API_PAYLOAD), FALSE, &requests)))
+        return status;
+
+    numberOfRequests = Payload->u.Batch.i.Requests.Length / sizeof(PHSVC_API_PAYLOAD);
+
+    for (i = 0; i < numberOfRequests; i++)
+    {
+        PHSVC_API_PAYLOAD request;
+
+        // The requests live in memory shared with the client, so we capture each one before
+        // dispatching it. Only the return status is written back.
+        request = requests[i];
+
+        if (
+            request.ApiNumber == 0 ||
+            (ULONG)request.ApiNumber >= (ULONG)PhSvcMaximumApiNumber ||
+            request.ApiNumber == PhSvcBatchApiNumber ||
+            !PhSvcApiCallTable[request.ApiNumber - 1]
+            )
+        {
+            requests[i].ReturnStatus = STATUS_INVALID_SYSTEM_SERVICE;
+            continue;
+        }
+
+        requests[i].ReturnStatus = PhSvcApiCallTable[request.ApiNumber - 1](Client, &request);
+    }
+
+    return STATUS_SUCCESS;
+}
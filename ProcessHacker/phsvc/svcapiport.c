@@ -47,6 +47,7 @@ NTSTATUS PhSvcApiPortInitialization(
     UCHAR administratorsSidBuffer[FIELD_OFFSET(SID, SubAuthority) + sizeof(ULONG) * 2];
     PSID administratorsSid;
     PACL dacl;
+    ULONG numberOfThreads;
     ULONG i;
     HANDLE threadHandle;
 
@@ -97,7 +98,16 @@ NTSTATUS PhSvcApiPortInitialization(
 
     PhSvcApiThreadContextTlsIndex = TlsAlloc();
 
-    for (i = 0; i < 2; i++)
+    // Requests from different clients (and batched requests from a single client) can block on
+    // slow operations, so we scale the number of request threads with the processor count.
+    numberOfThreads = PhSystemBasicInformation.NumberOfProcessors;
+
+    if (numberOfThreads < 2)
+        numberOfThreads = 2;
+    if (numberOfThreads > 8)
+        numberOfThreads = 8;
+
+    for (i = 0; i < numberOfThreads; i++)
     {
         threadHandle = PhCreateThread(0, PhSvcApiRequestThreadStart, NULL);
 
@@ -202,6 +202,7 @@ static BOOLEAN EnumPluginsDirectoryCallback(
     _In_opt_ PVOID Context
     )
 {
+    PPH_LIST fileNames = Context;
     PH_STRINGREF baseName;
     PPH_STRING fileName;
 
@@ -216,15 +217,44 @@ static BOOLEAN EnumPluginsDirectoryCallback(
             memcpy(fileName->Buffer, PluginsDirectory->Buffer, PluginsDirectory->Length);
             memcpy(&fileName->Buffer[PluginsDirectory->Length / 2], Information->FileName, Information->FileNameLength);
 
-            PhLoadPlugin(fileName);
-
-            PhDereferenceObject(fileName);
+            PhAddItemList(fileNames, fileName);
         }
     }
 
     return TRUE;
 }
 
+static NTSTATUS PhpPrefetchPluginWorker(
+    _In_ PVOID Parameter
+    )
+{
+    PPH_STRING fileName = Parameter;
+    PVOID viewBase;
+    SIZE_T size;
+    SIZE_T offset;
+
+    // Touch every page of the file so that the main thread's LoadLibrary
+    // finds the image in the file cache instead of waiting for the disk.
+    if (NT_SUCCESS(PhMapViewOfEntireFile(fileName->Buffer, NULL, TRUE, &viewBase, &size)))
+    {
+        __try
+        {
+            for (offset = 0; offset < size; offset += PhSystemBasicInformation.PageSize)
+                *((volatile UCHAR *)viewBase + offset);
+        }
+        __except (EXCEPTION_EXECUTE_HANDLER)
+        {
+            NOTHING;
+        }
+
+        NtUnmapViewOfSection(NtCurrentProcess(), viewBase);
+    }
+
+    PhDereferenceObject(fileName);
+
+    return STATUS_SUCCESS;
+}
+
 /**
  * Loads plugins from the default plugins directory.
  */
@@ -234,6 +264,8 @@ VOID PhLoadPlugins(
 {
     HANDLE pluginsDirectoryHandle;
     PPH_STRING pluginsDirectory;
+    PPH_LIST fileNames;
+    ULONG i;
 
     pluginsDirectory = PhGetStringSetting(L"PluginsDirectory");
 
@@ -248,6 +280,8 @@ VOID PhLoadPlugins(
         PluginsDirectory = pluginsDirectory;
     }
 
+    fileNames = PhCreateList(10);
+
     if (NT_SUCCESS(PhCreateFileWin32(
         &pluginsDirectoryHandle,
         PluginsDirectory->Buffer,
@@ -260,10 +294,28 @@ VOID PhLoadPlugins(
     {
         UNICODE_STRING pattern = RTL_CONSTANT_STRING(L"*.dll");
 
-        PhEnumDirectoryFile(pluginsDirectoryHandle, &pattern, EnumPluginsDirectoryCallback, NULL);
+        PhEnumDirectoryFile(pluginsDirectoryHandle, &pattern, EnumPluginsDirectoryCallback, fileNames);
         NtClose(pluginsDirectoryHandle);
     }
 
+    // Plugins must be loaded one at a time on this thread: DllMain runs under the loader lock
+    // and PhRegisterPlugin is not thread-safe. Reading the images from disk is the part that
+    // can overlap, so we prefetch every plugin except the first in the background while the
+    // earlier plugins are being loaded.
+    for (i = 1; i < fileNames->Count; i++)
+    {
+        PhReferenceObject(fileNames->Items[i]);
+        PhQueueItemGlobalWorkQueue(PhpPrefetchPluginWorker, fileNames->Items[i]);
+    }
+
+    for (i = 0; i < fileNames->Count; i++)
+    {
+        PhLoadPlugin(fileNames->Items[i]);
+        PhDereferenceObject(fileNames->Items[i]);
+    }
+
+    PhDereferenceObject(fileNames);
+
     // Handle load errors.
     // In certain startup modes we want to ignore all plugin load errors.
     if (LoadErrors && LoadErrors->Count != 0 && !PhStartupParameters.PhSvc)
@@ -317,6 +369,24 @@ VOID PhLoadPlugins(
     PhpExecuteCallbackForAllPlugins(PluginCallbackLoad, TRUE);
 }
 
+/**
+ * Notifies all plugins that the main window has been shown and populated
+ * for the first time, so that initialization which is not needed to
+ * display the main window can be performed.
+ */
+VOID PhLoadDeferredPlugins(
+    VOID
+    )
+{
+    static BOOLEAN deferredLoaded = FALSE;
+
+    if (deferredLoaded)
+        return;
+
+    deferredLoaded = TRUE;
+    PhpExecuteCallbackForAllPlugins(PluginCallbackLoadDeferred, FALSE);
+}
+
 /**
  * Notifies all plugins that the program is shutting down.
  */
@@ -352,6 +422,10 @@ BOOLEAN PhLoadPlugin(
         success = FALSE;
         errorMessage = PhGetWin32Message(GetLastError());
     }
+    else
+    {
+        PhTraceStartup(L"Plugin loaded", &fileName->sr);
+    }
 
     if (!success)
     {
@@ -412,6 +486,9 @@ VOID PhpExecuteCallbackForAllPlugins(
 
         PhInvokeCallback(PhGetPluginCallback(plugin, Callback), parameters);
 
+        if (Callback == PluginCallbackLoad)
+            PhTraceStartup(L"Plugin initialized", &plugin->Name);
+
         if (parameters)
         {
             PhDereferenceObjects(parameters->Items, parameters->Count);
@@ -882,6 +959,81 @@ BOOLEAN PhPluginTriggerEMenuItem(
     return TRUE;
 }
 
+/**
+ * Records an item for the next provider updated callback.
+ *
+ * \param Batch The batch for the provider.
+ * \param Type The event raised for the item:
+ * \li \c PH_PROVIDER_UPDATE_ADDED
+ * \li \c PH_PROVIDER_UPDATE_MODIFIED
+ * \li \c PH_PROVIDER_UPDATE_REMOVED
+ * \param Item The item. A reference is held until the batch is flushed.
+ */
+VOID NTAPI PhAddProviderUpdateBatchItem(
+    _Inout_ PPH_PROVIDER_UPDATE_BATCH Batch,
+    _In_ ULONG Type,
+    _In_ PVOID Item
+    )
+{
+    if (!PhPluginsEnabled)
+        return;
+
+    if (!Batch->Items[Type])
+        Batch->Items[Type] = PhCreateList(64);
+
+    PhReferenceObject(Item);
+    PhAddItemList(Batch->Items[Type], Item);
+}
+
+/**
+ * Invokes the provider updated callback for a batch and
+ * clears the batch.
+ *
+ * \param Batch The batch for the provider.
+ *
+ * \remarks The callback is not invoked if no items were
+ * recorded during the provider run.
+ */
+VOID NTAPI PhFlushProviderUpdateBatch(
+    _Inout_ PPH_PROVIDER_UPDATE_BATCH Batch
+    )
+{
+    PH_PLUGIN_PROVIDER_UPDATE update;
+    PPH_LIST lists[PH_PROVIDER_UPDATE_MAXIMUM];
+    ULONG count[PH_PROVIDER_UPDATE_MAXIMUM];
+    ULONG i;
+    ULONG j;
+
+    for (i = 0; i < PH_PROVIDER_UPDATE_MAXIMUM; i++)
+    {
+        lists[i] = Batch->Items[i];
+        count[i] = lists[i] ? lists[i]->Count : 0;
+    }
+
+    if (count[PH_PROVIDER_UPDATE_ADDED] == 0 && count[PH_PROVIDER_UPDATE_MODIFIED] == 0 && count[PH_PROVIDER_UPDATE_REMOVED] == 0)
+        return;
+
+    update.NumberOfAddedItems = count[PH_PROVIDER_UPDATE_ADDED];
+    update.AddedItems = lists[PH_PROVIDER_UPDATE_ADDED] ? lists[PH_PROVIDER_UPDATE_ADDED]->Items : NULL;
+    update.NumberOfModifiedItems = count[PH_PROVIDER_UPDATE_MODIFIED];
+    update.ModifiedItems = lists[PH_PROVIDER_UPDATE_MODIFIED] ? lists[PH_PROVIDER_UPDATE_MODIFIED]->Items : NULL;
+    update.NumberOfRemovedItems = count[PH_PROVIDER_UPDATE_REMOVED];
+    update.RemovedItems = lists[PH_PROVIDER_UPDATE_REMOVED] ? lists[PH_PROVIDER_UPDATE_REMOVED]->Items : NULL;
+
+    PhInvokeCallback(PhGetGeneralCallback(Batch->Callback), &update);
+
+    for (i = 0; i < PH_PROVIDER_UPDATE_MAXIMUM; i++)
+    {
+        if (!lists[i])
+            continue;
+
+        for (j = 0; j < lists[i]->Count; j++)
+            PhDereferenceObject(lists[i]->Items[j]);
+
+        PhClearList(lists[i]);
+    }
+}
+
 /**
  * Adds a column to a tree new control.
  *
@@ -893,6 +1045,11 @@ BOOLEAN PhPluginTriggerEMenuItem(
  * plugin.
  * \param Context A user-defined value.
  * \param SortFunction The sort function for the column.
+ *
+ * \remarks In the process tree, a plugin can set TN_CACHE in the Flags of
+ * \ref PH_TREENEW_GET_CELL_TEXT to have the text of a cell cached until the next
+ * update, instead of being asked for it on every repaint. The text must then
+ * remain valid until the plugin is asked for the text of that cell again.
  */
 BOOLEAN PhPluginAddTreeNewColumn(
     _In_ PPH_PLUGIN Plugin,
@@ -28,6 +28,7 @@ typedef struct _PHP_PROCESS_DATA
     PPH_PROCESS_NODE Process;
     LIST_ENTRY ListEntry;
     BOOLEAN HasWindow;
+    BOOLEAN Grouped;
 } PHP_PROCESS_DATA, *PPHP_PROCESS_DATA;
 
 PPH_LIST PhpCreateProcessDataList(
@@ -217,6 +218,73 @@ VOID PhpAddGroupMember(
     PhReferenceObject(ProcessData->Process->ProcessItem);
     PhAddItemList(List, ProcessData->Process->ProcessItem);
     RemoveEntryList(&ProcessData->ListEntry);
+    ProcessData->Grouped = TRUE;
+}
+
+static BOOLEAN PhpProcessDataComesBefore(
+    _In_ PPHP_PROCESS_DATA ProcessData1,
+    _In_ PPHP_PROCESS_DATA ProcessData2,
+    _In_ PPH_PROCESS_NODE_COMPARE_FUNCTION CompareFunction
+    )
+{
+    return CompareFunction(&ProcessData1->Process, &ProcessData2->Process) < 0;
+}
+
+static VOID PhpSiftDownProcessDataHeap(
+    _Inout_updates_(Count) PPHP_PROCESS_DATA *Heap,
+    _In_ ULONG Count,
+    _In_ ULONG Index,
+    _In_ PPH_PROCESS_NODE_COMPARE_FUNCTION CompareFunction
+    )
+{
+    ULONG child;
+    PPHP_PROCESS_DATA temp;
+
+    while ((child = Index * 2 + 1) < Count)
+    {
+        if (child + 1 < Count && PhpProcessDataComesBefore(Heap[child + 1], Heap[child], CompareFunction))
+            child++;
+
+        if (!PhpProcessDataComesBefore(Heap[child], Heap[Index], CompareFunction))
+            break;
+
+        temp = Heap[Index];
+        Heap[Index] = Heap[child];
+        Heap[child] = temp;
+        Index = child;
+    }
+}
+
+/**
+ * Removes the first process that hasn't been grouped yet from a heap.
+ *
+ * \param Heap The heap.
+ * \param Count A variable which contains the number of elements in the heap. This is
+ * updated to the new number of elements.
+ * \param CompareFunction The function that orders the heap.
+ *
+ * \return The process, or NULL if every process has been grouped.
+ */
+static PPHP_PROCESS_DATA PhpPopProcessDataHeap(
+    _Inout_ PPHP_PROCESS_DATA *Heap,
+    _Inout_ PULONG Count,
+    _In_ PPH_PROCESS_NODE_COMPARE_FUNCTION CompareFunction
+    )
+{
+    PPHP_PROCESS_DATA processData;
+
+    while (*Count != 0)
+    {
+        processData = Heap[0];
+        Heap[0] = Heap[--(*Count)];
+        PhpSiftDownProcessDataHeap(Heap, *Count, 0, CompareFunction);
+
+        // Group members are taken from anywhere in the heap, so skip them.
+        if (!processData->Grouped)
+            return processData;
+    }
+
+    return NULL;
 }
 
 VOID PhpAddGroupMembersFromRoot(
@@ -255,9 +323,37 @@ PPH_LIST PhCreateProcessGroupList(
     _In_ ULONG MaximumGroups,
     _In_ ULONG Flags
     )
+{
+    return PhCreateProcessGroupListEx(SortListFunction, Context, NULL, MaximumGroups, Flags);
+}
+
+/**
+ * Groups processes.
+ *
+ * \param SortListFunction A function that sorts the list of processes, with the processes
+ * that should be grouped first at the start.
+ * \param Context A user-defined value to pass to \a SortListFunction.
+ * \param CompareFunction A function that orders the processes, used instead of
+ * \a SortListFunction. Only the processes needed for \a MaximumGroups groups are put in
+ * order, which is much cheaper than sorting every process when only a few groups are
+ * needed.
+ * \param MaximumGroups The maximum number of groups to create.
+ * \param Flags A combination of PH_GROUP_PROCESSES_* flags.
+ *
+ * \return A list of PPH_PROCESS_GROUP. Use PhFreeProcessGroupList() to free the list.
+ */
+PPH_LIST PhCreateProcessGroupListEx(
+    _In_opt_ PPH_SORT_LIST_FUNCTION SortListFunction,
+    _In_opt_ PVOID Context,
+    _In_opt_ PPH_PROCESS_NODE_COMPARE_FUNCTION CompareFunction,
+    _In_ ULONG MaximumGroups,
+    _In_ ULONG Flags
+    )
 {
     PPH_LIST processList;
     PPH_LIST processDataList;
+    PPHP_PROCESS_DATA *heap = NULL; // Processes that haven't been considered yet, if CompareFunction is used
+    ULONG heapCount = 0;
     LIST_ENTRY processDataListHead; // We will be removing things from this list as we group processes together
     PPH_HASHTABLE processDataHashtable; // Process ID to process data hashtable
     QUERY_WINDOWS_CONTEXT queryWindowsContext;
@@ -270,7 +366,7 @@ PPH_LIST PhCreateProcessGroupList(
 
     processList = PhDuplicateProcessNodeList();
 
-    if (SortListFunction)
+    if (SortListFunction && !CompareFunction)
         SortListFunction(processList, Context);
 
     processDataList = PhpCreateProcessDataList(processList);
@@ -281,15 +377,36 @@ PPH_LIST PhCreateProcessGroupList(
     queryWindowsContext.ProcessDataHashtable = processDataHashtable;
     PhEnumChildWindows(NULL, 0x800, PhpQueryWindowsEnumWindowsProc, (LPARAM)&queryWindowsContext);
 
+    if (CompareFunction && processDataList->Count != 0)
+    {
+        ULONG i;
+
+        heapCount = processDataList->Count;
+        heap = PhAllocateCopy(processDataList->Items, sizeof(PPHP_PROCESS_DATA) * heapCount);
+
+        for (i = heapCount / 2; i != 0; i--)
+            PhpSiftDownProcessDataHeap(heap, heapCount, i - 1, CompareFunction);
+    }
+
     processGroupList = PhCreateList(10);
 
     while (processDataListHead.Flink != &processDataListHead && processGroupList->Count < MaximumGroups)
     {
-        PPHP_PROCESS_DATA processData = CONTAINING_RECORD(processDataListHead.Flink, PHP_PROCESS_DATA, ListEntry);
+        PPHP_PROCESS_DATA processData;
         PPH_PROCESS_GROUP processGroup;
         PPH_STRING fileName;
         PPH_STRING userName;
 
+        if (heap)
+        {
+            if (!(processData = PhpPopProcessDataHeap(heap, &heapCount, CompareFunction)))
+                break;
+        }
+        else
+        {
+            processData = CONTAINING_RECORD(processDataListHead.Flink, PHP_PROCESS_DATA, ListEntry);
+        }
+
         processGroup = PhAllocate(sizeof(PH_PROCESS_GROUP));
         processGroup->Processes = PhCreateList(4);
         fileName = PhpGetRelevantFileName(processData->Process->ProcessItem, Flags);
@@ -310,6 +427,9 @@ PPH_LIST PhCreateProcessGroupList(
         PhAddItemList(processGroupList, processGroup);
     }
 
+    if (heap)
+        PhFree(heap);
+
     PhDereferenceObject(processDataHashtable);
     PhpDestroyProcessDataList(processDataList);
 
@@ -30,6 +30,7 @@
 #include <extmgri.h>
 #include <verify.h>
 #include <procprpp.h>
+#include <memsnap.h>
 #include <windowsx.h>
 
 #define SET_BUTTON_BITMAP(Id, Bitmap) \
@@ -112,6 +113,25 @@ PPH_PROCESS_PROPCONTEXT PhCreateProcessPropContext(
     return propContext;
 }
 
+/**
+ * Starts loading symbols for the Threads page before the page is opened, so that it can
+ * show start addresses as soon as it opens.
+ *
+ * \param PropContext The property context.
+ */
+VOID PhpPrewarmProcessPropContext(
+    _Inout_ PPH_PROCESS_PROPCONTEXT PropContext
+    )
+{
+    if (PropContext->ThreadProvider || PropContext->ThreadsPageCreated)
+        return;
+    if (PH_IS_FAKE_PROCESS_ID(PropContext->ProcessItem->ProcessId))
+        return;
+
+    PropContext->ThreadProvider = PhCreateThreadProvider(PropContext->ProcessItem->ProcessId);
+    PhPrefetchSymbolsThreadProvider(PropContext->ThreadProvider);
+}
+
 VOID NTAPI PhpProcessPropContextDeleteProcedure(
     _In_ PVOID Object,
     _In_ ULONG Flags
@@ -119,6 +139,13 @@ VOID NTAPI PhpProcessPropContextDeleteProcedure(
 {
     PPH_PROCESS_PROPCONTEXT propContext = (PPH_PROCESS_PROPCONTEXT)Object;
 
+    if (propContext->ThreadProvider)
+    {
+        // The Threads page was never opened.
+        PhSetTerminatingThreadProvider(propContext->ThreadProvider);
+        PhDereferenceObject(propContext->ThreadProvider);
+    }
+
     PhFree(propContext->PropSheetPages);
     PhDereferenceObject(propContext->Title);
     PhDereferenceObject(propContext->ProcessItem);
@@ -1034,13 +1061,28 @@ INT_PTR CALLBACK PhpProcessGeneralDlgProc(
             ShowWindow(GetDlgItem(hwndDlg, IDC_PROCESSTYPELABEL), SW_SHOW);
             ShowWindow(GetDlgItem(hwndDlg, IDC_PROCESSTYPETEXT), SW_SHOW);
 #endif
+
+            // WM_TIMER is only generated when there are no other messages (including WM_PAINT)
+            // in the queue, so the other pages are prewarmed after this one has been painted.
+            if (PhGetIntegerSetting(L"ProcPropPrewarm"))
+                SetTimer(hwndDlg, 1, USER_TIMER_MINIMUM, NULL);
         }
         break;
     case WM_DESTROY:
         {
+            KillTimer(hwndDlg, 1);
             PhpPropPageDlgProcDestroy(hwndDlg);
         }
         break;
+    case WM_TIMER:
+        {
+            if (wParam == 1)
+            {
+                KillTimer(hwndDlg, 1);
+                PhpPrewarmProcessPropContext(propPageContext->PropContext);
+            }
+        }
+        break;
     case WM_SHOWWINDOW:
         {
             if (!propPageContext->LayoutInitialized)
@@ -1316,7 +1358,8 @@ VOID PhpUpdateProcessStatistics(
             gdiHandles = PhaFormatUInt64(GetGuiResources(ProcessItem->QueryHandle, GR_GDIOBJECTS), TRUE); // GDI handles
             userHandles = PhaFormatUInt64(GetGuiResources(ProcessItem->QueryHandle, GR_USEROBJECTS), TRUE); // USER handles
 
-            if (WINDOWS_HAS_CYCLE_TIME &&
+            // On Windows 7 and above the cycle time comes from the process snapshot (see below).
+            if (WINDOWS_HAS_CYCLE_TIME && WindowsVersion < WINDOWS_7 &&
                 NT_SUCCESS(PhGetProcessCycleTime(ProcessItem->QueryHandle, &cycleTime)))
             {
                 cycles = PhaFormatUInt64(cycleTime, TRUE);
@@ -1657,14 +1700,14 @@ INT_PTR CALLBACK PhpProcessPerformanceDlgProc(
                         PhGraphStateGetDrawInfo(
                             &performanceContext->CpuGraphState,
                             getDrawInfo,
-                            processItem->CpuKernelHistory.Count
+                            PhGetProcessItemHistoryCount(processItem, ProcessCpuKernelHistory)
                             );
 
                         if (!performanceContext->CpuGraphState.Valid)
                         {
-                            PhCopyCircularBuffer_FLOAT(&processItem->CpuKernelHistory,
+                            PhCopyProcessItemHistory(processItem, ProcessCpuKernelHistory,
                                 performanceContext->CpuGraphState.Data1, drawInfo->LineDataCount);
-                            PhCopyCircularBuffer_FLOAT(&processItem->CpuUserHistory,
+                            PhCopyProcessItemHistory(processItem, ProcessCpuUserHistory,
                                 performanceContext->CpuGraphState.Data2, drawInfo->LineDataCount);
                             performanceContext->CpuGraphState.Valid = TRUE;
                         }
@@ -1697,18 +1740,13 @@ INT_PTR CALLBACK PhpProcessPerformanceDlgProc(
                         PhGraphStateGetDrawInfo(
                             &performanceContext->PrivateGraphState,
                             getDrawInfo,
-                            processItem->PrivateBytesHistory.Count
+                            PhGetProcessItemHistoryCount(processItem, ProcessPrivateBytesHistory)
                             );
 
                         if (!performanceContext->PrivateGraphState.Valid)
                         {
-                            ULONG i;
-
-                            for (i = 0; i < drawInfo->LineDataCount; i++)
-                            {
-                                performanceContext->PrivateGraphState.Data1[i] =
-                                    (FLOAT)PhGetItemCircularBuffer_SIZE_T(&processItem->PrivateBytesHistory, i);
-                            }
+                            PhCopyProcessItemHistory(processItem, ProcessPrivateBytesHistory,
+                                performanceContext->PrivateGraphState.Data1, drawInfo->LineDataCount);
 
                             if (processItem->VmCounters.PeakPagefileUsage != 0)
                             {
@@ -1752,7 +1790,7 @@ INT_PTR CALLBACK PhpProcessPerformanceDlgProc(
                         PhGraphStateGetDrawInfo(
                             &performanceContext->IoGraphState,
                             getDrawInfo,
-                            processItem->IoReadHistory.Count
+                            PhGetProcessItemHistoryCount(processItem, ProcessIoReadHistory)
                             );
 
                         if (!performanceContext->IoGraphState.Valid)
@@ -1766,10 +1804,10 @@ INT_PTR CALLBACK PhpProcessPerformanceDlgProc(
                                 FLOAT data2;
 
                                 performanceContext->IoGraphState.Data1[i] = data1 =
-                                    (FLOAT)PhGetItemCircularBuffer_ULONG64(&processItem->IoReadHistory, i) +
-                                    (FLOAT)PhGetItemCircularBuffer_ULONG64(&processItem->IoOtherHistory, i);
+                                    PhGetProcessItemHistoryFloat(processItem, ProcessIoReadHistory, i) +
+                                    PhGetProcessItemHistoryFloat(processItem, ProcessIoOtherHistory, i);
                                 performanceContext->IoGraphState.Data2[i] = data2 =
-                                    (FLOAT)PhGetItemCircularBuffer_ULONG64(&processItem->IoWriteHistory, i);
+                                    PhGetProcessItemHistoryFloat(processItem, ProcessIoWriteHistory, i);
 
                                 if (max < data1 + data2)
                                     max = data1 + data2;
@@ -1810,8 +1848,8 @@ INT_PTR CALLBACK PhpProcessPerformanceDlgProc(
                             FLOAT cpuKernel;
                             FLOAT cpuUser;
 
-                            cpuKernel = PhGetItemCircularBuffer_FLOAT(&processItem->CpuKernelHistory, getTooltipText->Index);
-                            cpuUser = PhGetItemCircularBuffer_FLOAT(&processItem->CpuUserHistory, getTooltipText->Index);
+                            cpuKernel = PhGetProcessItemHistoryFloat(processItem, ProcessCpuKernelHistory, getTooltipText->Index);
+                            cpuUser = PhGetProcessItemHistoryFloat(processItem, ProcessCpuUserHistory, getTooltipText->Index);
 
                             PhMoveReference(&performanceContext->CpuGraphState.TooltipText, PhFormatString(
                                 L"%.2f%%\n%s",
@@ -1831,7 +1869,7 @@ INT_PTR CALLBACK PhpProcessPerformanceDlgProc(
                         {
                             SIZE_T privateBytes;
 
-                            privateBytes = PhGetItemCircularBuffer_SIZE_T(&processItem->PrivateBytesHistory, getTooltipText->Index);
+                            privateBytes = (SIZE_T)PhGetProcessItemHistoryInteger(processItem, ProcessPrivateBytesHistory, getTooltipText->Index);
 
                             PhMoveReference(&performanceContext->PrivateGraphState.TooltipText, PhFormatString(
                                 L"Private Bytes: %s\n%s",
@@ -1853,9 +1891,9 @@ INT_PTR CALLBACK PhpProcessPerformanceDlgProc(
                             ULONG64 ioWrite;
                             ULONG64 ioOther;
 
-                            ioRead = PhGetItemCircularBuffer_ULONG64(&processItem->IoReadHistory, getTooltipText->Index);
-                            ioWrite = PhGetItemCircularBuffer_ULONG64(&processItem->IoWriteHistory, getTooltipText->Index);
-                            ioOther = PhGetItemCircularBuffer_ULONG64(&processItem->IoOtherHistory, getTooltipText->Index);
+                            ioRead = PhGetProcessItemHistoryInteger(processItem, ProcessIoReadHistory, getTooltipText->Index);
+                            ioWrite = PhGetProcessItemHistoryInteger(processItem, ProcessIoWriteHistory, getTooltipText->Index);
+                            ioOther = PhGetProcessItemHistoryInteger(processItem, ProcessIoOtherHistory, getTooltipText->Index);
 
                             PhMoveReference(&performanceContext->IoGraphState.TooltipText, PhFormatString(
                                 L"R: %s\nW: %s\nO: %s\n%s",
@@ -2506,11 +2544,21 @@ INT_PTR CALLBACK PhpProcessThreadsDlgProc(
         {
             threadsContext = propPageContext->Context =
                 PhAllocate(PhEmGetObjectSize(EmThreadsContextType, sizeof(PH_THREADS_CONTEXT)));
+            propPageContext->PropContext->ThreadsPageCreated = TRUE;
 
             // The thread provider has a special registration mechanism.
-            threadsContext->Provider = PhCreateThreadProvider(
-                processItem->ProcessId
-                );
+            if (propPageContext->PropContext->ThreadProvider)
+            {
+                // Take the provider that has been prefetching symbols.
+                threadsContext->Provider = propPageContext->PropContext->ThreadProvider;
+                propPageContext->PropContext->ThreadProvider = NULL;
+            }
+            else
+            {
+                threadsContext->Provider = PhCreateThreadProvider(
+                    processItem->ProcessId
+                    );
+            }
             PhRegisterCallback(
                 &threadsContext->Provider->ThreadAddedEvent,
                 ThreadAddedHandler,
@@ -2882,6 +2930,31 @@ INT_PTR CALLBACK PhpProcessThreadsDlgProc(
                     }
                 }
                 break;
+            case ID_ANALYZE_CPUPROFILE:
+                {
+                    static PH_FILETYPE_FILTER filters[] =
+                    {
+                        { L"Folded stack files (*.folded)", L"*.folded" },
+                        { L"All files (*.*)", L"*.*" }
+                    };
+                    PVOID fileDialog;
+
+                    fileDialog = PhCreateSaveFileDialog();
+                    PhSetFileDialogFilter(fileDialog, filters, sizeof(filters) / sizeof(PH_FILETYPE_FILTER));
+                    PhSetFileDialogFileName(fileDialog, PhaConcatStrings2(processItem->ProcessName->Buffer, L".folded")->Buffer);
+
+                    if (PhShowFileDialog(hwndDlg, fileDialog))
+                    {
+                        PPH_STRING fileName;
+
+                        fileName = PhGetFileDialogFileName(fileDialog);
+                        PhStartThreadProfiler(processItem, fileName);
+                        PhDereferenceObject(fileName);
+                    }
+
+                    PhFreeFileDialog(fileDialog);
+                }
+                break;
             case ID_PRIORITY_TIMECRITICAL:
             case ID_PRIORITY_HIGHEST:
             case ID_PRIORITY_ABOVENORMAL:
@@ -3026,9 +3099,11 @@ INT_PTR CALLBACK PhpProcessThreadsDlgProc(
             switch (header->code)
             {
             case PSN_SETACTIVE:
+                PhSetEnabledThreadProvider(threadsContext->Provider, TRUE);
                 break;
             case PSN_KILLACTIVE:
-                // Can't disable, it screws up the deltas.
+                // The provider reports zero deltas on the first update after it is resumed.
+                PhSetEnabledThreadProvider(threadsContext->Provider, FALSE);
                 break;
             }
         }
@@ -3934,6 +4009,7 @@ INT_PTR CALLBACK PhpProcessMemoryDlgProc(
                 PhDeleteMemoryItemList(&memoryContext->MemoryItemList);
 
             PhClearReference(&memoryContext->ErrorMessage);
+            PhClearReference(&memoryContext->Snapshot);
             PhFree(memoryContext);
 
             PhpPropPageDlgProcDestroy(hwndDlg);
@@ -3947,6 +4023,8 @@ INT_PTR CALLBACK PhpProcessMemoryDlgProc(
 
                 dialogItem = PhAddPropPageLayoutItem(hwndDlg, hwndDlg,
                     PH_PROP_PAGE_TAB_CONTROL_PARENT, PH_ANCHOR_ALL);
+                PhAddPropPageLayoutItem(hwndDlg, GetDlgItem(hwndDlg, IDC_SNAPSHOT),
+                    dialogItem, PH_ANCHOR_TOP | PH_ANCHOR_RIGHT);
                 PhAddPropPageLayoutItem(hwndDlg, GetDlgItem(hwndDlg, IDC_STRINGS),
                     dialogItem, PH_ANCHOR_TOP | PH_ANCHOR_RIGHT);
                 PhAddPropPageLayoutItem(hwndDlg, GetDlgItem(hwndDlg, IDC_REFRESH),
@@ -4201,6 +4279,81 @@ INT_PTR CALLBACK PhpProcessMemoryDlgProc(
                     PhSetOptionsMemoryList(&memoryContext->ListContext, hide);
                 }
                 break;
+            case IDC_SNAPSHOT:
+                {
+                    PPH_EMENU menu;
+                    PPH_EMENU_ITEM compareItem;
+                    PPH_EMENU_ITEM selectedItem;
+                    RECT buttonRect;
+
+                    menu = PhCreateEMenu();
+                    PhInsertEMenuItem(menu, PhCreateEMenuItem(0, ID_MEMORY_TAKESNAPSHOT, L"Take snapshot", NULL, NULL), -1);
+                    PhInsertEMenuItem(menu, compareItem = PhCreateEMenuItem(0, ID_MEMORY_COMPARESNAPSHOT, L"Compare with snapshot", NULL, NULL), -1);
+
+                    if (!memoryContext->Snapshot)
+                        compareItem->Flags |= PH_EMENU_DISABLED;
+
+                    GetWindowRect(GetDlgItem(hwndDlg, IDC_SNAPSHOT), &buttonRect);
+
+                    selectedItem = PhShowEMenu(
+                        menu,
+                        hwndDlg,
+                        PH_EMENU_SHOW_LEFTRIGHT,
+                        PH_ALIGN_LEFT | PH_ALIGN_TOP,
+                        buttonRect.left,
+                        buttonRect.bottom
+                        );
+
+                    if (selectedItem)
+                        SendMessage(hwndDlg, WM_COMMAND, selectedItem->Id, 0);
+
+                    PhDestroyEMenu(menu);
+                }
+                break;
+            case ID_MEMORY_TAKESNAPSHOT:
+            case ID_MEMORY_COMPARESNAPSHOT:
+                {
+                    NTSTATUS status;
+                    PPH_MEMORY_SNAPSHOT previousSnapshot;
+                    PPH_MEMORY_SNAPSHOT snapshot;
+                    PPH_MEMORY_RESULTS results;
+
+                    previousSnapshot = memoryContext->Snapshot;
+
+                    if (LOWORD(wParam) == ID_MEMORY_COMPARESNAPSHOT && !previousSnapshot)
+                        break;
+
+                    SetCursor(LoadCursor(NULL, IDC_WAIT));
+
+                    // The previous snapshot is always passed in so that regions which
+                    // cannot have changed are not read again.
+                    status = PhCreateMemorySnapshot(processItem->ProcessId, previousSnapshot, &snapshot);
+
+                    SetCursor(LoadCursor(NULL, IDC_ARROW));
+
+                    if (!NT_SUCCESS(status))
+                    {
+                        PhShowStatus(hwndDlg, L"Unable to take a snapshot of the process memory", status, 0);
+                        break;
+                    }
+
+                    if (LOWORD(wParam) == ID_MEMORY_COMPARESNAPSHOT)
+                    {
+                        results = PhCreateMemoryResults(NULL);
+                        PhDiffMemorySnapshots(previousSnapshot, snapshot, results);
+
+                        if (results->Count != 0)
+                            PhShowMemoryResultsDialog(processItem->ProcessId, results);
+                        else
+                            PhShowInformation(hwndDlg, L"The process memory has not changed since the snapshot was taken.");
+
+                        PhDereferenceObject(results);
+                    }
+
+                    // The next comparison is made against the newest snapshot.
+                    PhMoveReference(&memoryContext->Snapshot, snapshot);
+                }
+                break;
             case IDC_STRINGS:
                 PhShowMemoryStringDialog(hwndDlg, processItem);
                 break;
@@ -5426,7 +5579,7 @@ NTSTATUS PhpProcessPropertiesThreadStart(
     BOOL result;
     MSG message;
 
-    PhInitializeAutoPool(&autoPool);
+    PhInitializeAutoPoolEx(&autoPool, PH_AUTO_POOL_USE_ARENA);
 
     // Wait for stage 1 to be processed.
     PhWaitForEvent(&PropContext->ProcessItem->Stage1Event, NULL);
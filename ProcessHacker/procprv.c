@@ -56,30 +56,170 @@
  */
 
 #include <phapp.h>
+#include <apiimport.h>
 #include <kphuser.h>
 #include <extmgri.h>
 #include <phplug.h>
 #include <verify.h>
 #include <winsta.h>
 
-#define PROCESS_ID_BUCKETS 64
-#define PROCESS_ID_TO_BUCKET_INDEX(ProcessId) ((HandleToUlong(ProcessId) / 4) & (PROCESS_ID_BUCKETS - 1))
+#define PH_PROCESS_ID_INDEX_MINIMUM_SIZE 256
+#define PROCESS_ID_TO_INDEX_HASH(ProcessId) (HandleToUlong(ProcessId) / 4)
+
+#define PH_PROCESS_ID_INDEX_TOMBSTONE ((PVOID)1)
+
+// An open-addressing (linear probing) map from process IDs to pointers. The key is stored
+// next to the value so that probing does not need to touch the items themselves.
+//
+// Shared indexes can be read without locking from inside an epoch. Only one thread may
+// modify an index at a time. Entries are never moved: a slot goes from empty to used to
+// removed (a tombstone) and is only reused after the table has been rebuilt, and old
+// tables are freed through the epoch. The table is never more than half full, counting
+// tombstones, so lookups always terminate.
+typedef struct _PH_PROCESS_ID_INDEX_ENTRY
+{
+    HANDLE ProcessId;
+    PVOID Value; // NULL for empty slots, PH_PROCESS_ID_INDEX_TOMBSTONE for removed entries
+} PH_PROCESS_ID_INDEX_ENTRY, *PPH_PROCESS_ID_INDEX_ENTRY;
+
+typedef struct _PH_PROCESS_ID_INDEX_TABLE
+{
+    ULONG AllocatedCount; // always a power of two
+    PH_PROCESS_ID_INDEX_ENTRY Entries[1];
+} PH_PROCESS_ID_INDEX_TABLE, *PPH_PROCESS_ID_INDEX_TABLE;
+
+typedef struct _PH_PROCESS_ID_INDEX
+{
+    PPH_PROCESS_ID_INDEX_TABLE Table;
+    ULONG Count;
+    ULONG TombstoneCount;
+    BOOLEAN Shared;
+} PH_PROCESS_ID_INDEX, *PPH_PROCESS_ID_INDEX;
+
+// The counters of existing processes are copied into one array per counter before the main
+// update pass, indexed by a dense slot in the order that pass visits the processes. The
+// deltas, CPU usages and maximums are then computed in simple loops over the arrays instead
+// of being scattered across the process items.
+typedef enum _PH_PROCESS_METRIC
+{
+    PhProcessMetricKernelTime,
+    PhProcessMetricUserTime,
+    PhProcessMetricCycleTime,
+    PhProcessMetricIoRead,
+    PhProcessMetricIoWrite,
+    PhProcessMetricIoOther,
+    PhProcessMetricIoReadCount,
+    PhProcessMetricIoWriteCount,
+    PhProcessMetricIoOtherCount,
+    PhProcessMetricPrivateBytes,
+    PhMaxProcessMetric
+} PH_PROCESS_METRIC;
+
+typedef struct _PH_PROCESS_METRICS_TABLE
+{
+    ULONG Count;
+    ULONG AllocatedCount;
+    PVOID Buffer;
+
+    PPH_PROCESS_ITEM *Items;
+    PULONG64 Values[PhMaxProcessMetric];
+    PULONG64 Deltas[PhMaxProcessMetric]; // the previous values until the deltas are computed
+    PFLOAT CpuUsage;
+    PFLOAT CpuKernelUsage;
+    PFLOAT CpuUserUsage;
+
+    ULONG IdleIndex; // excluded from the maximums
+    ULONG MaxCpuIndex;
+    ULONG MaxIoIndex;
+} PH_PROCESS_METRICS_TABLE, *PPH_PROCESS_METRICS_TABLE;
+
+// On systems with many processes the table is split into contiguous ranges of slots that are
+// computed in parallel. Each range also appends to the history buffers of its own process
+// items. Everything that raises events stays on the provider thread.
+#define PH_PROCESS_METRICS_PARTITION_SIZE 1024
+#define PH_PROCESS_METRICS_MAXIMUM_PARTITIONS 8
+
+typedef struct _PH_PROCESS_METRICS_PARTITION
+{
+    PPH_PROCESS_METRICS_TABLE Table;
+    ULONG StartIndex;
+    ULONG EndIndex;
+    BOOLEAN IsCycleCpuUsageEnabled;
+    ULONG64 SysTotalTime;
+    ULONG64 SysTotalCycleTime;
+
+    FLOAT MaxCpuValue;
+    ULONG MaxCpuIndex;
+    ULONG64 MaxIoValue;
+    ULONG MaxIoIndex;
+
+    volatile LONG *RemainingCount;
+    PPH_EVENT CompletedEvent;
+} PH_PROCESS_METRICS_PARTITION, *PPH_PROCESS_METRICS_PARTITION;
+
+#define PH_PROCESS_QUERY_MAXIMUM_THREADS 4
+
+// The maximum number of dead process records examined by each call to PhPurgeProcessRecords.
+#define PH_PROCESS_RECORD_PURGE_LIMIT 1024
+
+// The maximum number of process hints waiting for the process provider.
+#define PH_PROCESS_HINT_LIMIT 4096
+// The minimum time between two process provider updates requested by process hints, in
+// milliseconds.
+#define PH_PROCESS_HINT_EVENT_INTERVAL 250
+
+#define PH_CLIENT_ID_NAME_CACHE_SIZE 256 // must be a power of two
+
+typedef struct _PH_CLIENT_ID_NAME_CACHE_ENTRY
+{
+    HANDLE ProcessId;
+    HANDLE ThreadId;
+    // The creation time of the process item that the name was built from, or 0 if the
+    // process did not exist. This tells apart processes that reuse an ID.
+    LARGE_INTEGER CreateTime;
+    PPH_STRING Name;
+} PH_CLIENT_ID_NAME_CACHE_ENTRY, *PPH_CLIENT_ID_NAME_CACHE_ENTRY;
 
 typedef struct _PH_PROCESS_QUERY_DATA
 {
     SLIST_ENTRY ListEntry;
     ULONG Stage;
     PPH_PROCESS_ITEM ProcessItem;
+    BOOLEAN Priority;
 } PH_PROCESS_QUERY_DATA, *PPH_PROCESS_QUERY_DATA;
 
+// Stage 1 is split into sub-queries (parts) which run concurrently. This is shared by the
+// sub-queries of a process item.
+typedef struct _PH_PROCESS_QUERY_S1_STATE
+{
+    LONG RefCount;
+    LONG QueuedParts;
+    LONG CompletedParts;
+
+    // Results that other parts depend on. These are valid once their part has completed.
+    BOOLEAN IsWow64;
+    BOOLEAN IsWow64Valid;
+} PH_PROCESS_QUERY_S1_STATE, *PPH_PROCESS_QUERY_S1_STATE;
+
+typedef struct _PH_PROCESS_QUERY_REQUEST
+{
+    LIST_ENTRY ListEntry;
+    ULONG Stage;
+    BOOLEAN Priority;
+    PPH_PROCESS_ITEM ProcessItem;
+    ULONG Part; // stage 1 only
+    PPH_PROCESS_QUERY_S1_STATE State; // stage 1 only
+} PH_PROCESS_QUERY_REQUEST, *PPH_PROCESS_QUERY_REQUEST;
+
 typedef struct _PH_PROCESS_QUERY_S1_DATA
 {
     PH_PROCESS_QUERY_DATA Header;
+    ULONG Parts; // the parts that were queried
+
 
     PPH_STRING CommandLine;
 
-    HICON SmallIcon;
-    HICON LargeIcon;
+    PPH_IMAGE_ICONS Icons;
     PH_IMAGE_VERSION_INFO VersionInfo;
 
     TOKEN_ELEVATION_TYPE ElevationType;
@@ -100,6 +240,18 @@ typedef struct _PH_PROCESS_QUERY_S1_DATA
     BOOLEAN IsWow64Valid;
 } PH_PROCESS_QUERY_S1_DATA, *PPH_PROCESS_QUERY_S1_DATA;
 
+typedef VOID (NTAPI *PPH_PROCESS_QUERY_S1_ROUTINE)(
+    _Inout_ PPH_PROCESS_QUERY_S1_DATA Data,
+    _Inout_ PPH_PROCESS_QUERY_S1_STATE State
+    );
+
+typedef struct _PH_PROCESS_QUERY_S1_TASK
+{
+    ULONG Part;
+    ULONG Dependencies; // parts which must complete before this part is queued
+    PPH_PROCESS_QUERY_S1_ROUTINE Routine;
+} PH_PROCESS_QUERY_S1_TASK, *PPH_PROCESS_QUERY_S1_TASK;
+
 typedef struct _PH_PROCESS_QUERY_S2_DATA
 {
     PH_PROCESS_QUERY_DATA Header;
@@ -112,23 +264,19 @@ typedef struct _PH_PROCESS_QUERY_S2_DATA
     ULONG ImportModules;
 } PH_PROCESS_QUERY_S2_DATA, *PPH_PROCESS_QUERY_S2_DATA;
 
-typedef struct _PH_VERIFY_CACHE_ENTRY
-{
-    PH_AVL_LINKS Links;
-
-    PPH_STRING FileName;
-    VERIFY_RESULT VerifyResult;
-    PPH_STRING VerifySignerName;
-} PH_VERIFY_CACHE_ENTRY, *PPH_VERIFY_CACHE_ENTRY;
-
 VOID NTAPI PhpProcessItemDeleteProcedure(
     _In_ PVOID Object,
     _In_ ULONG Flags
     );
 
-INT NTAPI PhpVerifyCacheCompareFunction(
-    _In_ PPH_AVL_LINKS Links1,
-    _In_ PPH_AVL_LINKS Links2
+VOID NTAPI PhpProcessInformationSnapshotDeleteProcedure(
+    _In_ PVOID Object,
+    _In_ ULONG Flags
+    );
+
+VOID NTAPI PhpProcessJobDeleteProcedure(
+    _In_ PVOID Object,
+    _In_ ULONG Flags
     );
 
 VOID PhpQueueProcessQueryStage1(
@@ -136,7 +284,16 @@ VOID PhpQueueProcessQueryStage1(
     );
 
 VOID PhpQueueProcessQueryStage2(
-    _In_ PPH_PROCESS_ITEM ProcessItem
+    _In_ PPH_PROCESS_ITEM ProcessItem,
+    _In_ BOOLEAN Priority
+    );
+
+VOID PhpQueueProcessQueryRequest(
+    _In_ PPH_PROCESS_ITEM ProcessItem,
+    _In_ ULONG Stage,
+    _In_ ULONG Part,
+    _In_opt_ PPH_PROCESS_QUERY_S1_STATE State,
+    _In_ BOOLEAN Priority
     );
 
 PPH_PROCESS_RECORD PhpCreateProcessRecord(
@@ -151,31 +308,84 @@ VOID PhpRemoveProcessRecord(
     _Inout_ PPH_PROCESS_RECORD ProcessRecord
     );
 
+VOID PhpMarkProcessRecordDead(
+    _Inout_ PPH_PROCESS_RECORD ProcessRecord,
+    _In_ PLARGE_INTEGER ExitTime
+    );
+
+LONG NTAPI PhpProcessRecordIndexCompareFunction(
+    _In_ PPH_AVL_LINKS Links1,
+    _In_ PPH_AVL_LINKS Links2
+    );
+
+PPH_PROCESS_ITEM PhpLookupProcessItem(
+    _In_ HANDLE ProcessId
+    );
+
+VOID PhpInvalidateClientIdNames(
+    _In_ HANDLE ProcessId
+    );
+
 PPH_OBJECT_TYPE PhProcessItemType;
 
-PPH_HASH_ENTRY PhProcessHashSet[256] = PH_HASH_SET_INIT;
-ULONG PhProcessHashSetCount = 0;
-PH_QUEUED_LOCK PhProcessHashSetLock = PH_QUEUED_LOCK_INIT;
+// Only modified by the provider thread. Other threads read it from inside an epoch.
+static PH_PROCESS_ID_INDEX PhpProcessItemIndex;
 
 SLIST_HEADER PhProcessQueryDataListHead;
 
+// Stage 1 and 2 queries run on their own work queue so that process creation storms cannot
+// starve other users of the global work queue. Requests for processes that are visible in the
+// UI go into the priority lane and are always dequeued first.
+static PH_WORK_QUEUE PhpProcessQueryWorkQueue;
+static LIST_ENTRY PhpProcessQueryPriorityListHead;
+static LIST_ENTRY PhpProcessQueryNormalListHead;
+static PH_QUEUED_LOCK PhpProcessQueryListLock = PH_QUEUED_LOCK_INIT;
+static PH_PROCESS_QUERY_STATISTICS PhpProcessQueryStatistics;
+
+// Direct-mapped cache of client ID names. Entries are replaced with interlocked operations and
+// freed after the current epoch, so readers only need to be inside an epoch.
+static PPH_CLIENT_ID_NAME_CACHE_ENTRY volatile PhpClientIdNameCache[PH_CLIENT_ID_NAME_CACHE_SIZE];
+
 PHAPPAPI PH_CALLBACK_DECLARE(PhProcessAddedEvent);
 PHAPPAPI PH_CALLBACK_DECLARE(PhProcessModifiedEvent);
 PHAPPAPI PH_CALLBACK_DECLARE(PhProcessRemovedEvent);
 PHAPPAPI PH_CALLBACK_DECLARE(PhProcessesUpdatedEvent);
+PH_CALLBACK_DECLARE(PhShortLivedProcessEvent);
+PH_CALLBACK_DECLARE(PhProcessProviderHintEvent);
+static PH_PROVIDER_UPDATE_BATCH PhpProcessUpdateBatch = PH_PROVIDER_UPDATE_BATCH_INIT(GeneralCallbackProcessProviderUpdated);
 
 PPH_LIST PhProcessRecordList;
 PH_QUEUED_LOCK PhProcessRecordListLock = PH_QUEUED_LOCK_INIT;
+// Records ordered by process ID and then by creation time, for PID+time lookups.
+static PH_AVL_TREE PhpProcessRecordIndex = PH_AVL_TREE_INIT(PhpProcessRecordIndexCompareFunction);
+// Dead records in the order their processes exited, for purging.
+static LIST_ENTRY PhpDeadProcessRecordListHead;
 
 ULONG PhStatisticsSampleCount = 512;
 BOOLEAN PhEnableProcessQueryStage2 = FALSE;
 BOOLEAN PhEnablePurgeProcessRecords = TRUE;
 BOOLEAN PhEnableCycleCpuUsage = TRUE;
+BOOLEAN PhEnableCompressedProcessHistory = FALSE;
 
 PVOID PhProcessInformation; // only can be used if running on same thread as process provider
+PPH_PROCESS_INFORMATION_SNAPSHOT PhProcessInformationSnapshot; // same as above
+static PH_PROCESS_SNAPSHOT PhpProcessSnapshot;
+static PH_ARENA PhpProcessProviderArena; // histories and snapshot buffers
+static PPH_OBJECT_TYPE PhpProcessInformationSnapshotType;
+static PH_QUEUED_LOCK PhpProcessInformationSnapshotLock = PH_QUEUED_LOCK_INIT;
+static PPH_PROCESS_INFORMATION_SNAPSHOT PhpPreviousProcessInformationSnapshot;
+static PPH_OBJECT_TYPE PhpProcessJobType;
+static PH_QUEUED_LOCK PhpProcessJobIndexLock = PH_QUEUED_LOCK_INIT;
+static PH_PROCESS_ID_INDEX PhpProcessJobIndex; // process ID to PPH_PROCESS_JOB
+static PPH_LIST PhpProcessJobList;
 SYSTEM_PERFORMANCE_INFORMATION PhPerfInformation;
 PSYSTEM_PROCESSOR_PERFORMANCE_INFORMATION PhCpuInformation;
 SYSTEM_PROCESSOR_PERFORMANCE_INFORMATION PhCpuTotals;
+ULONG PhNumberOfCpus; // in all processor groups
+USHORT PhNumberOfCpuGroups;
+PPH_CPU_GROUP PhCpuGroups;
+PUSHORT PhCpuNumaNodes; // NUMA node of each processor
+ULONG PhNumberOfNumaNodes;
 ULONG PhTotalProcesses;
 ULONG PhTotalThreads;
 ULONG PhTotalHandles;
@@ -194,6 +404,9 @@ FLOAT PhCpuKernelUsage;
 FLOAT PhCpuUserUsage;
 PFLOAT PhCpusKernelUsage;
 PFLOAT PhCpusUserUsage;
+PFLOAT PhNumaNodesKernelUsage;
+PFLOAT PhNumaNodesUserUsage;
+static PULONG64 PhpNumaNodesTotals; // kernel, user and total time delta of each NUMA node
 
 PH_UINT64_DELTA PhCpuKernelDelta;
 PH_UINT64_DELTA PhCpuUserDelta;
@@ -217,6 +430,7 @@ PH_CIRCULAR_BUFFER_FLOAT PhCpuUserHistory;
 
 PPH_CIRCULAR_BUFFER_FLOAT PhCpusKernelHistory;
 PPH_CIRCULAR_BUFFER_FLOAT PhCpusUserHistory;
+PH_CPUS_HISTORY PhCpusHistory;
 //PPH_CIRCULAR_BUFFER_FLOAT PhCpusOtherHistory;
 
 PH_CIRCULAR_BUFFER_ULONG64 PhIoReadHistory;
@@ -234,13 +448,203 @@ PH_CIRCULAR_BUFFER_ULONG64 PhMaxIoReadOtherHistory;
 PH_CIRCULAR_BUFFER_ULONG64 PhMaxIoWriteHistory;
 #endif
 
+static PKPH_EVENT_RING PhpKphEventRing = NULL;
+static KPH_EVENT_READER PhpKphEventReader;
+static BOOLEAN PhpKphEventRingAttempted = FALSE;
+static PPH_HASHTABLE PhpPendingProcessHashtable = NULL; // process ID to PPH_SHORT_LIVED_PROCESS
+static PH_QUEUED_LOCK PhpProcessHintListLock = PH_QUEUED_LOCK_INIT;
+static PPH_LIST PhpProcessHintList = NULL; // PPH_PROCESS_PROVIDER_HINT, queued from any thread
+static ULONG64 PhpLastProcessHintEventTime = 0;
+
 static PTS_ALL_PROCESSES_INFO PhpTsProcesses = NULL;
 static ULONG PhpTsNumberOfProcesses;
 
-#ifdef PH_ENABLE_VERIFY_CACHE
-static PH_AVL_TREE PhpVerifyCacheSet = PH_AVL_TREE_INIT(PhpVerifyCacheCompareFunction);
-static PH_QUEUED_LOCK PhpVerifyCacheLock = PH_QUEUED_LOCK_INIT;
-#endif
+static NTSTATUS PhpQueryLogicalProcessorInformation(
+    _In_ LOGICAL_PROCESSOR_RELATIONSHIP Relationship,
+    _Out_ PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX *Buffer,
+    _Out_ PULONG BufferLength
+    )
+{
+    NTSTATUS status;
+    _NtQuerySystemInformationEx ntQuerySystemInformationEx;
+    PVOID buffer;
+    ULONG bufferSize;
+
+    if (!(ntQuerySystemInformationEx = NtQuerySystemInformationEx_Import()))
+        return STATUS_NOT_SUPPORTED;
+
+    bufferSize = 0x400;
+    buffer = PhAllocate(bufferSize);
+
+    status = ntQuerySystemInformationEx(
+        SystemLogicalProcessorAndGroupInformation,
+        &Relationship,
+        sizeof(LOGICAL_PROCESSOR_RELATIONSHIP),
+        buffer,
+        bufferSize,
+        &bufferSize
+        );
+
+    if (status == STATUS_INFO_LENGTH_MISMATCH)
+    {
+        PhFree(buffer);
+        buffer = PhAllocate(bufferSize);
+
+        status = ntQuerySystemInformationEx(
+            SystemLogicalProcessorAndGroupInformation,
+            &Relationship,
+            sizeof(LOGICAL_PROCESSOR_RELATIONSHIP),
+            buffer,
+            bufferSize,
+            &bufferSize
+            );
+    }
+
+    if (!NT_SUCCESS(status))
+    {
+        PhFree(buffer);
+        return status;
+    }
+
+    *Buffer = buffer;
+    *BufferLength = bufferSize;
+
+    return status;
+}
+
+static VOID PhpInitializeCpuTopology(
+    VOID
+    )
+{
+    PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX buffer;
+    PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX entry;
+    ULONG bufferLength;
+    ULONG offset;
+    ULONG i;
+    ULONG j;
+
+    // Without processor group support (before Windows 7) we only see a single group.
+    PhNumberOfCpuGroups = 1;
+    PhCpuGroups = PhAllocate(sizeof(PH_CPU_GROUP));
+    PhCpuGroups[0].Group = 0;
+    PhCpuGroups[0].FirstCpu = 0;
+    PhCpuGroups[0].NumberOfCpus = (ULONG)PhSystemBasicInformation.NumberOfProcessors;
+    PhCpuGroups[0].ActiveMask = PhSystemBasicInformation.ActiveProcessorsAffinityMask;
+    PhNumberOfCpus = PhCpuGroups[0].NumberOfCpus;
+
+    if (NT_SUCCESS(PhpQueryLogicalProcessorInformation(RelationGroup, &buffer, &bufferLength)))
+    {
+        PGROUP_RELATIONSHIP groupInfo = &buffer->Group;
+
+        if (buffer->Relationship == RelationGroup && groupInfo->ActiveGroupCount > 1)
+        {
+            PhFree(PhCpuGroups);
+            PhCpuGroups = PhAllocate(sizeof(PH_CPU_GROUP) * groupInfo->ActiveGroupCount);
+            PhNumberOfCpus = 0;
+
+            // Processors are numbered group by group, which matches the numbering used for the
+            // idle threads of the System Idle Process.
+            for (i = 0; i < groupInfo->ActiveGroupCount; i++)
+            {
+                PhCpuGroups[i].Group = (USHORT)i;
+                PhCpuGroups[i].FirstCpu = PhNumberOfCpus;
+                PhCpuGroups[i].NumberOfCpus = groupInfo->GroupInfo[i].ActiveProcessorCount;
+                PhCpuGroups[i].ActiveMask = groupInfo->GroupInfo[i].ActiveProcessorMask;
+                PhNumberOfCpus += PhCpuGroups[i].NumberOfCpus;
+            }
+
+            PhNumberOfCpuGroups = groupInfo->ActiveGroupCount;
+        }
+
+        PhFree(buffer);
+    }
+
+    PhCpuNumaNodes = PhAllocate(sizeof(USHORT) * PhNumberOfCpus);
+    memset(PhCpuNumaNodes, 0, sizeof(USHORT) * PhNumberOfCpus);
+    PhNumberOfNumaNodes = 1;
+
+    if (NT_SUCCESS(PhpQueryLogicalProcessorInformation(RelationNumaNode, &buffer, &bufferLength)))
+    {
+        for (offset = 0; offset < bufferLength; offset += entry->Size)
+        {
+            entry = (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)PTR_ADD_OFFSET(buffer, offset);
+
+            if (entry->Size == 0)
+                break;
+            if (entry->Relationship != RelationNumaNode)
+                continue;
+
+            for (i = 0; i < PhNumberOfCpuGroups; i++)
+            {
+                if (PhCpuGroups[i].Group != entry->NumaNode.GroupMask.Group)
+                    continue;
+
+                for (j = 0; j < PhCpuGroups[i].NumberOfCpus; j++)
+                {
+                    if (entry->NumaNode.GroupMask.Mask & ((KAFFINITY)1 << j))
+                        PhCpuNumaNodes[PhCpuGroups[i].FirstCpu + j] = (USHORT)entry->NumaNode.NodeNumber;
+                }
+            }
+
+            if (PhNumberOfNumaNodes < entry->NumaNode.NodeNumber + 1)
+                PhNumberOfNumaNodes = entry->NumaNode.NodeNumber + 1;
+        }
+
+        PhFree(buffer);
+    }
+}
+
+/**
+ * Queries per-processor system information for the processors in all
+ * processor groups.
+ *
+ * \param SystemInformationClass The information class. It must return an
+ * array of \a EntrySize bytes for each processor.
+ * \param Buffer A buffer which receives \ref PhNumberOfCpus entries,
+ * ordered in the same way as the per-CPU statistics arrays.
+ * \param EntrySize The size of each entry.
+ */
+NTSTATUS PhQueryCpuInformation(
+    _In_ SYSTEM_INFORMATION_CLASS SystemInformationClass,
+    _Out_writes_bytes_(EntrySize * PhNumberOfCpus) PVOID Buffer,
+    _In_ ULONG EntrySize
+    )
+{
+    NTSTATUS status;
+    _NtQuerySystemInformationEx ntQuerySystemInformationEx;
+    ULONG i;
+
+    if (PhNumberOfCpuGroups == 1)
+    {
+        return NtQuerySystemInformation(
+            SystemInformationClass,
+            Buffer,
+            EntrySize * PhNumberOfCpus,
+            NULL
+            );
+    }
+
+    ntQuerySystemInformationEx = NtQuerySystemInformationEx_Import();
+
+    for (i = 0; i < PhNumberOfCpuGroups; i++)
+    {
+        USHORT group = PhCpuGroups[i].Group;
+
+        status = ntQuerySystemInformationEx(
+            SystemInformationClass,
+            &group,
+            sizeof(USHORT),
+            PTR_ADD_OFFSET(Buffer, EntrySize * PhCpuGroups[i].FirstCpu),
+            EntrySize * PhCpuGroups[i].NumberOfCpus,
+            NULL
+            );
+
+        if (!NT_SUCCESS(status))
+            return status;
+    }
+
+    return STATUS_SUCCESS;
+}
 
 BOOLEAN PhProcessProviderInitialization(
     VOID
@@ -249,12 +653,32 @@ BOOLEAN PhProcessProviderInitialization(
     PFLOAT usageBuffer;
     PPH_UINT64_DELTA deltaBuffer;
     PPH_CIRCULAR_BUFFER_FLOAT historyBuffer;
+    PH_OBJECT_TYPE_PARAMETERS parameters;
 
-    PhProcessItemType = PhCreateObjectType(L"ProcessItem", 0, PhpProcessItemDeleteProcedure);
+    parameters.FreeListSize = 0;
+    parameters.FreeListCount = 64;
+    PhProcessItemType = PhCreateObjectTypeEx(L"ProcessItem", PH_OBJECT_TYPE_USE_FREE_LIST, PhpProcessItemDeleteProcedure, &parameters);
+    PhpProcessInformationSnapshotType = PhCreateObjectType(L"ProcessInformationSnapshot", 0, PhpProcessInformationSnapshotDeleteProcedure);
+    PhpProcessJobType = PhCreateObjectType(L"ProcessJob", 0, PhpProcessJobDeleteProcedure);
+
+    PhRegisterLockStatistics(&PhProcessRecordListLock, L"PhProcessRecordListLock");
 
     RtlInitializeSListHead(&PhProcessQueryDataListHead);
+    InitializeListHead(&PhpProcessQueryPriorityListHead);
+    InitializeListHead(&PhpProcessQueryNormalListHead);
+    PhInitializeWorkQueueEx(
+        &PhpProcessQueryWorkQueue,
+        0,
+        min((ULONG)PhSystemBasicInformation.NumberOfProcessors, PH_PROCESS_QUERY_MAXIMUM_THREADS),
+        1000,
+        PH_WORK_QUEUE_WORK_STEALING
+        );
 
     PhProcessRecordList = PhCreateList(40);
+    InitializeListHead(&PhpDeadProcessRecordListHead);
+    PhInitializeArena(&PhpProcessProviderArena, PH_ARENA_LARGE_PAGES);
+    PhInitializeProcessSnapshotEx(&PhpProcessSnapshot, SystemProcessInformation, &PhpProcessProviderArena);
+    PhpInitializeProcessIdIndex(&PhpProcessItemIndex, PH_PROCESS_ID_INDEX_MINIMUM_SIZE, TRUE);
 
     RtlInitUnicodeString(
         &PhDpcsProcessInformation.ImageName,
@@ -270,74 +694,152 @@ BOOLEAN PhProcessProviderInitialization(
     PhInterruptsProcessInformation.UniqueProcessId = INTERRUPTS_PROCESS_ID;
     PhInterruptsProcessInformation.InheritedFromUniqueProcessId = SYSTEM_IDLE_PROCESS_ID;
 
+    PhpInitializeCpuTopology();
+
     PhCpuInformation = PhAllocate(
         sizeof(SYSTEM_PROCESSOR_PERFORMANCE_INFORMATION) *
-        (ULONG)PhSystemBasicInformation.NumberOfProcessors
+        PhNumberOfCpus
         );
 
     PhCpuIdleCycleTime = PhAllocate(
         sizeof(LARGE_INTEGER) *
-        (ULONG)PhSystemBasicInformation.NumberOfProcessors
+        PhNumberOfCpus
         );
     PhCpuSystemCycleTime = PhAllocate(
         sizeof(LARGE_INTEGER) *
-        (ULONG)PhSystemBasicInformation.NumberOfProcessors
+        PhNumberOfCpus
         );
 
     usageBuffer = PhAllocate(
         sizeof(FLOAT) *
-        (ULONG)PhSystemBasicInformation.NumberOfProcessors *
+        PhNumberOfCpus *
         2
         );
     deltaBuffer = PhAllocate(
         sizeof(PH_UINT64_DELTA) *
-        (ULONG)PhSystemBasicInformation.NumberOfProcessors *
+        PhNumberOfCpus *
         3 // 4 for PhCpusIdleCycleDelta
         );
     historyBuffer = PhAllocate(
         sizeof(PH_CIRCULAR_BUFFER_FLOAT) *
-        (ULONG)PhSystemBasicInformation.NumberOfProcessors *
+        PhNumberOfCpus *
         2
         );
 
     PhCpusKernelUsage = usageBuffer;
-    PhCpusUserUsage = PhCpusKernelUsage + (ULONG)PhSystemBasicInformation.NumberOfProcessors;
+    PhCpusUserUsage = PhCpusKernelUsage + PhNumberOfCpus;
 
     PhCpusKernelDelta = deltaBuffer;
-    PhCpusUserDelta = PhCpusKernelDelta + (ULONG)PhSystemBasicInformation.NumberOfProcessors;
-    PhCpusIdleDelta = PhCpusUserDelta + (ULONG)PhSystemBasicInformation.NumberOfProcessors;
-    //PhCpusIdleCycleDelta = PhCpusIdleDelta + (ULONG)PhSystemBasicInformation.NumberOfProcessors;
+    PhCpusUserDelta = PhCpusKernelDelta + PhNumberOfCpus;
+    PhCpusIdleDelta = PhCpusUserDelta + PhNumberOfCpus;
+    //PhCpusIdleCycleDelta = PhCpusIdleDelta + PhNumberOfCpus;
 
     PhCpusKernelHistory = historyBuffer;
-    PhCpusUserHistory = PhCpusKernelHistory + (ULONG)PhSystemBasicInformation.NumberOfProcessors;
+    PhCpusUserHistory = PhCpusKernelHistory + PhNumberOfCpus;
+
+    memset(deltaBuffer, 0, sizeof(PH_UINT64_DELTA) * PhNumberOfCpus * 3);
 
-    memset(deltaBuffer, 0, sizeof(PH_UINT64_DELTA) * (ULONG)PhSystemBasicInformation.NumberOfProcessors);
+    PhNumaNodesKernelUsage = PhAllocate(sizeof(FLOAT) * PhNumberOfNumaNodes * 2);
+    PhNumaNodesUserUsage = PhNumaNodesKernelUsage + PhNumberOfNumaNodes;
+    memset(PhNumaNodesKernelUsage, 0, sizeof(FLOAT) * PhNumberOfNumaNodes * 2);
+    PhpNumaNodesTotals = PhAllocate(sizeof(ULONG64) * PhNumberOfNumaNodes * 3);
 
     return TRUE;
 }
 
+static VOID PhpFreeClientIdNameCacheEntry(
+    _In_ PPH_CLIENT_ID_NAME_CACHE_ENTRY Entry
+    )
+{
+    // Readers may still be looking at the entry.
+    PhDereferenceObjectAfterEpoch(Entry->Name);
+    PhFreeAfterEpoch(Entry);
+}
+
+/**
+ * Gets a string describing a process or thread, e.g. "explorer.exe (1234): 5678".
+ *
+ * \param ClientId The ID of the process, and optionally the ID of a thread in the process.
+ *
+ * \return A string which may be shared with other callers. You must not modify it.
+ *
+ * \remarks Names are cached, so this function is cheap to call for the same client ID
+ * repeatedly.
+ */
 PPH_STRING PhGetClientIdName(
     _In_ PCLIENT_ID ClientId
     )
 {
     PPH_STRING name;
     PPH_PROCESS_ITEM processItem;
+    LARGE_INTEGER createTime;
+    ULONG index;
+    PPH_CLIENT_ID_NAME_CACHE_ENTRY entry;
+    PH_EPOCH_GUARD guard;
 
-    processItem = PhReferenceProcessItem(ClientId->UniqueProcess);
+    index = (HandleToUlong(ClientId->UniqueProcess) / 4 * 31 + HandleToUlong(ClientId->UniqueThread) / 4) &
+        (PH_CLIENT_ID_NAME_CACHE_SIZE - 1);
 
-    if (processItem)
-    {
-        name = PhGetClientIdNameEx(ClientId, processItem->ProcessName);
-        PhDereferenceObject(processItem);
-    }
-    else
+    PhEnterEpoch(&guard);
+
+    processItem = PhpLookupProcessItem(ClientId->UniqueProcess);
+    createTime.QuadPart = processItem ? processItem->CreateTime.QuadPart : 0;
+
+    entry = PhpClientIdNameCache[index];
+
+    if (
+        entry &&
+        entry->ProcessId == ClientId->UniqueProcess &&
+        entry->ThreadId == ClientId->UniqueThread &&
+        entry->CreateTime.QuadPart == createTime.QuadPart
+        )
     {
-        name = PhGetClientIdNameEx(ClientId, NULL);
+        PhReferenceObject(entry->Name);
+        PhLeaveEpoch(&guard);
+
+        return entry->Name;
     }
 
+    name = PhGetClientIdNameEx(ClientId, processItem ? processItem->ProcessName : NULL);
+
+    entry = PhAllocate(sizeof(PH_CLIENT_ID_NAME_CACHE_ENTRY));
+    entry->ProcessId = ClientId->UniqueProcess;
+    entry->ThreadId = ClientId->UniqueThread;
+    entry->CreateTime = createTime;
+    PhSetReference(&entry->Name, name);
+
+    if (entry = _InterlockedExchangePointer((PVOID volatile *)&PhpClientIdNameCache[index], entry))
+        PhpFreeClientIdNameCacheEntry(entry);
+
+    PhLeaveEpoch(&guard);
+
     return name;
 }
 
+/**
+ * Removes the cached client ID names of a process.
+ *
+ * \param ProcessId The ID of the process.
+ */
+VOID PhpInvalidateClientIdNames(
+    _In_ HANDLE ProcessId
+    )
+{
+    PPH_CLIENT_ID_NAME_CACHE_ENTRY entry;
+    ULONG i;
+
+    for (i = 0; i < PH_CLIENT_ID_NAME_CACHE_SIZE; i++)
+    {
+        entry = PhpClientIdNameCache[i];
+
+        if (entry && entry->ProcessId == ProcessId)
+        {
+            if (_InterlockedCompareExchangePointer((PVOID volatile *)&PhpClientIdNameCache[i], NULL, entry) == entry)
+                PhpFreeClientIdNameCacheEntry(entry);
+        }
+    }
+}
+
 PPH_STRING PhGetClientIdNameEx(
     _In_ PCLIENT_ID ClientId,
     _In_opt_ PPH_STRING ProcessName
@@ -423,6 +925,7 @@ PPH_PROCESS_ITEM PhCreateProcessItem(
     )
 {
     PPH_PROCESS_ITEM processItem;
+    ULONG historySize;
 
     processItem = PhCreateObject(
         PhEmGetObjectSize(EmProcessItemType, sizeof(PH_PROCESS_ITEM)),
@@ -431,6 +934,7 @@ PPH_PROCESS_ITEM PhCreateProcessItem(
     memset(processItem, 0, sizeof(PH_PROCESS_ITEM));
     PhInitializeEvent(&processItem->Stage1Event);
     PhInitializeQueuedLock(&processItem->ServiceListLock);
+    PhInitializeInitOnce(&processItem->VmReadHandleInitOnce);
 
     processItem->ProcessId = ProcessId;
 
@@ -438,13 +942,37 @@ PPH_PROCESS_ITEM PhCreateProcessItem(
         PhPrintUInt32(processItem->ProcessIdString, HandleToUlong(ProcessId));
 
     // Create the statistics buffers.
-    PhInitializeCircularBuffer_FLOAT(&processItem->CpuKernelHistory, PhStatisticsSampleCount);
-    PhInitializeCircularBuffer_FLOAT(&processItem->CpuUserHistory, PhStatisticsSampleCount);
-    PhInitializeCircularBuffer_ULONG64(&processItem->IoReadHistory, PhStatisticsSampleCount);
-    PhInitializeCircularBuffer_ULONG64(&processItem->IoWriteHistory, PhStatisticsSampleCount);
-    PhInitializeCircularBuffer_ULONG64(&processItem->IoOtherHistory, PhStatisticsSampleCount);
-    PhInitializeCircularBuffer_SIZE_T(&processItem->PrivateBytesHistory, PhStatisticsSampleCount);
-    //PhInitializeCircularBuffer_SIZE_T(&processItem->WorkingSetHistory, PhStatisticsSampleCount);
+    if (PhEnableCompressedProcessHistory)
+    {
+        ULONG i;
+
+        // The ordinary buffers only hold the latest sample, so code that reads them directly
+        // still sees current values.
+        historySize = 1;
+        processItem->CompressedHistory = PhAllocate(sizeof(PH_COMPRESSED_CIRCULAR_BUFFER) * MaxProcessHistory);
+
+        for (i = 0; i < MaxProcessHistory; i++)
+        {
+            PhInitializeCompressedCircularBuffer(
+                &processItem->CompressedHistory[i],
+                PhStatisticsSampleCount,
+                i == ProcessCpuKernelHistory || i == ProcessCpuUserHistory ?
+                PH_COMPRESSED_CIRCULAR_BUFFER_XOR : PH_COMPRESSED_CIRCULAR_BUFFER_DELTA
+                );
+        }
+    }
+    else
+    {
+        historySize = PhStatisticsSampleCount;
+    }
+
+    PhInitializeCircularBufferEx_FLOAT(&processItem->CpuKernelHistory, historySize, &PhpProcessProviderArena);
+    PhInitializeCircularBufferEx_FLOAT(&processItem->CpuUserHistory, historySize, &PhpProcessProviderArena);
+    PhInitializeCircularBufferEx_ULONG64(&processItem->IoReadHistory, historySize, &PhpProcessProviderArena);
+    PhInitializeCircularBufferEx_ULONG64(&processItem->IoWriteHistory, historySize, &PhpProcessProviderArena);
+    PhInitializeCircularBufferEx_ULONG64(&processItem->IoOtherHistory, historySize, &PhpProcessProviderArena);
+    PhInitializeCircularBufferEx_SIZE_T(&processItem->PrivateBytesHistory, historySize, &PhpProcessProviderArena);
+    //PhInitializeCircularBuffer_SIZE_T(&processItem->WorkingSetHistory, historySize);
 
     PhEmCallObjectOperation(EmProcessItemType, processItem, EmObjectCreate);
 
@@ -469,6 +997,14 @@ VOID PhpProcessItemDeleteProcedure(
     PhDeleteCircularBuffer_SIZE_T(&processItem->PrivateBytesHistory);
     //PhDeleteCircularBuffer_SIZE_T(&processItem->WorkingSetHistory);
 
+    if (processItem->CompressedHistory)
+    {
+        for (i = 0; i < MaxProcessHistory; i++)
+            PhDeleteCompressedCircularBuffer(&processItem->CompressedHistory[i]);
+
+        PhFree(processItem->CompressedHistory);
+    }
+
     if (processItem->ServiceList)
     {
         PPH_SERVICE_ITEM serviceItem;
@@ -484,8 +1020,17 @@ VOID PhpProcessItemDeleteProcedure(
     if (processItem->ProcessName) PhDereferenceObject(processItem->ProcessName);
     if (processItem->FileName) PhDereferenceObject(processItem->FileName);
     if (processItem->CommandLine) PhDereferenceObject(processItem->CommandLine);
-    if (processItem->SmallIcon) DestroyIcon(processItem->SmallIcon);
-    if (processItem->LargeIcon) DestroyIcon(processItem->LargeIcon);
+
+    if (processItem->Icons)
+    {
+        PhDereferenceObject(processItem->Icons);
+    }
+    else
+    {
+        if (processItem->SmallIcon) DestroyIcon(processItem->SmallIcon);
+        if (processItem->LargeIcon) DestroyIcon(processItem->LargeIcon);
+    }
+
     PhDeleteImageVersionInfo(&processItem->VersionInfo);
     if (processItem->UserName) PhDereferenceObject(processItem->UserName);
     if (processItem->JobName) PhDereferenceObject(processItem->JobName);
@@ -493,164 +1038,487 @@ VOID PhpProcessItemDeleteProcedure(
     if (processItem->PackageFullName) PhDereferenceObject(processItem->PackageFullName);
 
     if (processItem->QueryHandle) NtClose(processItem->QueryHandle);
+    if (processItem->VmReadHandle) NtClose(processItem->VmReadHandle);
 
     if (processItem->Record) PhDereferenceProcessRecord(processItem->Record);
 }
 
-FORCEINLINE BOOLEAN PhCompareProcessItem(
-    _In_ PPH_PROCESS_ITEM Value1,
-    _In_ PPH_PROCESS_ITEM Value2
+static PPH_PROCESS_ID_INDEX_TABLE PhpAllocateProcessIdIndexTable(
+    _In_ ULONG Capacity
     )
 {
-    return Value1->ProcessId == Value2->ProcessId;
+    PPH_PROCESS_ID_INDEX_TABLE table;
+    ULONG allocatedCount;
+
+    allocatedCount = PhRoundUpToPowerOfTwo(max(Capacity, PH_PROCESS_ID_INDEX_MINIMUM_SIZE));
+    table = PhAllocate(FIELD_OFFSET(PH_PROCESS_ID_INDEX_TABLE, Entries) + sizeof(PH_PROCESS_ID_INDEX_ENTRY) * allocatedCount);
+    table->AllocatedCount = allocatedCount;
+    memset(table->Entries, 0, sizeof(PH_PROCESS_ID_INDEX_ENTRY) * allocatedCount);
+
+    return table;
 }
 
-FORCEINLINE ULONG PhHashProcessItem(
-    _In_ PPH_PROCESS_ITEM Value
+VOID PhpInitializeProcessIdIndex(
+    _Out_ PPH_PROCESS_ID_INDEX Index,
+    _In_ ULONG InitialCapacity,
+    _In_ BOOLEAN Shared
     )
 {
-    return HandleToUlong(Value->ProcessId) / 4;
+    Index->Table = PhpAllocateProcessIdIndexTable(InitialCapacity);
+    Index->Count = 0;
+    Index->TombstoneCount = 0;
+    Index->Shared = Shared;
 }
 
 /**
- * Finds a process item in the hash set.
+ * Locates the slot for a process ID.
  *
- * \param ProcessId The process ID of the process item.
- *
- * \remarks The hash set must be locked before calling this
- * function. The reference count of the found process item is
- * not incremented.
+ * \return The slot containing \a ProcessId, or the empty slot at the end of
+ * its probe sequence.
  */
-PPH_PROCESS_ITEM PhpLookupProcessItem(
+FORCEINLINE PPH_PROCESS_ID_INDEX_ENTRY PhpLocateProcessIdIndex(
+    _In_ PPH_PROCESS_ID_INDEX_TABLE Table,
     _In_ HANDLE ProcessId
     )
 {
-    PH_PROCESS_ITEM lookupProcessItem;
-    PPH_HASH_ENTRY entry;
-    PPH_PROCESS_ITEM processItem;
+    ULONG mask;
+    ULONG i;
+    PVOID value;
 
-    lookupProcessItem.ProcessId = ProcessId;
-    entry = PhFindEntryHashSet(
-        PhProcessHashSet,
-        PH_HASH_SET_SIZE(PhProcessHashSet),
-        PhHashProcessItem(&lookupProcessItem)
-        );
+    mask = Table->AllocatedCount - 1;
+    i = PROCESS_ID_TO_INDEX_HASH(ProcessId) & mask;
 
-    for (; entry; entry = entry->Next)
+    // The table is never more than half full, so this always terminates.
+    while (value = *(PVOID volatile *)&Table->Entries[i].Value)
     {
-        processItem = CONTAINING_RECORD(entry, PH_PROCESS_ITEM, HashEntry);
+        if (value != PH_PROCESS_ID_INDEX_TOMBSTONE && Table->Entries[i].ProcessId == ProcessId)
+            break;
 
-        if (PhCompareProcessItem(&lookupProcessItem, processItem))
-            return processItem;
+        i = (i + 1) & mask;
     }
 
-    return NULL;
+    return &Table->Entries[i];
 }
 
-/**
- * Finds and references a process item.
- *
- * \param ProcessId The process ID of the process item.
- *
- * \return The found process item.
- */
-PPH_PROCESS_ITEM PhReferenceProcessItem(
-    _In_ HANDLE ProcessId
+VOID PhpResizeProcessIdIndex(
+    _Inout_ PPH_PROCESS_ID_INDEX Index,
+    _In_ ULONG NewCapacity
     )
 {
-    PPH_PROCESS_ITEM processItem;
+    PPH_PROCESS_ID_INDEX_TABLE oldTable;
+    PPH_PROCESS_ID_INDEX_TABLE newTable;
+    ULONG i;
+    PVOID value;
 
-    PhAcquireQueuedLockShared(&PhProcessHashSetLock);
+    oldTable = Index->Table;
+    newTable = PhpAllocateProcessIdIndexTable(NewCapacity);
 
-    processItem = PhpLookupProcessItem(ProcessId);
+    for (i = 0; i < oldTable->AllocatedCount; i++)
+    {
+        value = oldTable->Entries[i].Value;
 
-    if (processItem)
-        PhReferenceObject(processItem);
+        if (value && value != PH_PROCESS_ID_INDEX_TOMBSTONE)
+            *PhpLocateProcessIdIndex(newTable, oldTable->Entries[i].ProcessId) = oldTable->Entries[i];
+    }
 
-    PhReleaseQueuedLockShared(&PhProcessHashSetLock);
+    // Publish the filled-in table.
+    _InterlockedExchangePointer(&Index->Table, newTable);
+    Index->TombstoneCount = 0;
 
-    return processItem;
+    if (Index->Shared)
+        PhFreeAfterEpoch(oldTable);
+    else
+        PhFree(oldTable);
 }
 
 /**
- * Enumerates the process items.
- *
- * \param ProcessItems A variable which receives an array of
- * pointers to process items. You must free the buffer with
- * PhFree() when you no longer need it.
- * \param NumberOfProcessItems A variable which receives the
- * number of process items returned in \a ProcessItems.
+ * Adds or replaces an entry in a process ID index.
  */
-VOID PhEnumProcessItems(
-    _Out_opt_ PPH_PROCESS_ITEM **ProcessItems,
-    _Out_ PULONG NumberOfProcessItems
+VOID PhpAddProcessIdIndex(
+    _Inout_ PPH_PROCESS_ID_INDEX Index,
+    _In_ HANDLE ProcessId,
+    _In_ PVOID Value
     )
 {
-    PPH_PROCESS_ITEM *processItems;
-    ULONG numberOfProcessItems;
-    ULONG count = 0;
-    ULONG i;
-    PPH_HASH_ENTRY entry;
-    PPH_PROCESS_ITEM processItem;
-
-    if (!ProcessItems)
-    {
-        *NumberOfProcessItems = PhProcessHashSetCount;
-        return;
-    }
+    PPH_PROCESS_ID_INDEX_ENTRY entry;
 
-    PhAcquireQueuedLockShared(&PhProcessHashSetLock);
+    // Keep the load factor (including tombstones) at or below 1/2. The new table is sized from
+    // the live entries only, so a table full of tombstones is rebuilt at the same size.
+    if ((Index->Count + Index->TombstoneCount + 1) * 2 > Index->Table->AllocatedCount)
+        PhpResizeProcessIdIndex(Index, (Index->Count + 1) * 3);
 
-    numberOfProcessItems = PhProcessHashSetCount;
-    processItems = PhAllocate(sizeof(PPH_PROCESS_ITEM) * numberOfProcessItems);
+    entry = PhpLocateProcessIdIndex(Index->Table, ProcessId);
 
-    for (i = 0; i < PH_HASH_SET_SIZE(PhProcessHashSet); i++)
+    if (!entry->Value)
     {
-        for (entry = PhProcessHashSet[i]; entry; entry = entry->Next)
-        {
-            processItem = CONTAINING_RECORD(entry, PH_PROCESS_ITEM, HashEntry);
-            PhReferenceObject(processItem);
-            processItems[count++] = processItem;
-        }
+        Index->Count++;
+        entry->ProcessId = ProcessId;
     }
 
-    PhReleaseQueuedLockShared(&PhProcessHashSetLock);
-
-    *ProcessItems = processItems;
-    *NumberOfProcessItems = numberOfProcessItems;
+    // Readers check the value first, so it has to be stored after the key.
+    _InterlockedExchangePointer(&entry->Value, Value);
 }
 
-VOID PhpAddProcessItem(
-    _In_ _Assume_refs_(1) PPH_PROCESS_ITEM ProcessItem
+FORCEINLINE PVOID PhpFindProcessIdIndex(
+    _In_ PPH_PROCESS_ID_INDEX Index,
+    _In_ HANDLE ProcessId
     )
 {
-    PhAddEntryHashSet(
-        PhProcessHashSet,
-        PH_HASH_SET_SIZE(PhProcessHashSet),
-        &ProcessItem->HashEntry,
-        PhHashProcessItem(ProcessItem)
-        );
-    PhProcessHashSetCount++;
+    PPH_PROCESS_ID_INDEX_TABLE table;
+
+    table = *(PPH_PROCESS_ID_INDEX_TABLE volatile *)&Index->Table;
+
+    return *(PVOID volatile *)&PhpLocateProcessIdIndex(table, ProcessId)->Value;
 }
 
-VOID PhpRemoveProcessItem(
-    _In_ PPH_PROCESS_ITEM ProcessItem
+/**
+ * Removes an entry from a process ID index.
+ *
+ * \remarks The entry is replaced with a tombstone so that concurrent readers still
+ * find the entries after it.
+ */
+VOID PhpRemoveProcessIdIndex(
+    _Inout_ PPH_PROCESS_ID_INDEX Index,
+    _In_ HANDLE ProcessId
     )
 {
-    PhRemoveEntryHashSet(PhProcessHashSet, PH_HASH_SET_SIZE(PhProcessHashSet), &ProcessItem->HashEntry);
-    PhProcessHashSetCount--;
-    PhDereferenceObject(ProcessItem);
+    PPH_PROCESS_ID_INDEX_ENTRY entry;
+
+    entry = PhpLocateProcessIdIndex(Index->Table, ProcessId);
+
+    if (!entry->Value)
+        return;
+
+    _InterlockedExchangePointer(&entry->Value, PH_PROCESS_ID_INDEX_TOMBSTONE);
+    Index->Count--;
+    Index->TombstoneCount++;
+
+    // Shrink when the table is mostly empty so that the dead-process scan stays cheap.
+    if (Index->Count * 8 < Index->Table->AllocatedCount && Index->Table->AllocatedCount > PH_PROCESS_ID_INDEX_MINIMUM_SIZE)
+        PhpResizeProcessIdIndex(Index, Index->Count * 2);
 }
 
-INT NTAPI PhpVerifyCacheCompareFunction(
-    _In_ PPH_AVL_LINKS Links1,
-    _In_ PPH_AVL_LINKS Links2
+/**
+ * Removes all entries from a process ID index and makes sure that it
+ * can hold at least the specified number of entries without resizing.
+ *
+ * \remarks This function must not be used on shared indexes.
+ */
+VOID PhpResetProcessIdIndex(
+    _Inout_ PPH_PROCESS_ID_INDEX Index,
+    _In_ ULONG Capacity
+    )
+{
+    ULONG newAllocatedCount;
+
+    assert(!Index->Shared);
+
+    newAllocatedCount = PhRoundUpToPowerOfTwo(max(Capacity * 2, PH_PROCESS_ID_INDEX_MINIMUM_SIZE));
+
+    if (newAllocatedCount > Index->Table->AllocatedCount || newAllocatedCount * 4 <= Index->Table->AllocatedCount)
+    {
+        PhFree(Index->Table);
+        Index->Table = PhpAllocateProcessIdIndexTable(newAllocatedCount);
+    }
+    else
+    {
+        memset(Index->Table->Entries, 0, sizeof(PH_PROCESS_ID_INDEX_ENTRY) * Index->Table->AllocatedCount);
+    }
+
+    Index->Count = 0;
+    Index->TombstoneCount = 0;
+}
+
+/**
+ * Finds a process item in the hash set.
+ *
+ * \param ProcessId The process ID of the process item.
+ *
+ * \remarks The caller must be inside an epoch (see PhEnterEpoch())
+ * or be the process provider. The reference count of the found
+ * process item is not incremented.
+ */
+PPH_PROCESS_ITEM PhpLookupProcessItem(
+    _In_ HANDLE ProcessId
+    )
+{
+    return PhpFindProcessIdIndex(&PhpProcessItemIndex, ProcessId);
+}
+
+/**
+ * Finds and references a process item.
+ *
+ * \param ProcessId The process ID of the process item.
+ *
+ * \return The found process item.
+ */
+PPH_PROCESS_ITEM PhReferenceProcessItem(
+    _In_ HANDLE ProcessId
+    )
+{
+    PPH_PROCESS_ITEM processItem;
+    PH_EPOCH_GUARD guard;
+
+    PhEnterEpoch(&guard);
+
+    processItem = PhpLookupProcessItem(ProcessId);
+
+    if (processItem)
+        PhReferenceObject(processItem);
+
+    PhLeaveEpoch(&guard);
+
+    return processItem;
+}
+
+/**
+ * Enumerates the process items.
+ *
+ * \param ProcessItems A variable which receives an array of
+ * pointers to process items. You must free the buffer with
+ * PhFree() when you no longer need it.
+ * \param NumberOfProcessItems A variable which receives the
+ * number of process items returned in \a ProcessItems.
+ */
+VOID PhEnumProcessItems(
+    _Out_opt_ PPH_PROCESS_ITEM **ProcessItems,
+    _Out_ PULONG NumberOfProcessItems
+    )
+{
+    PPH_PROCESS_ITEM *processItems;
+    ULONG count = 0;
+    ULONG i;
+    PH_EPOCH_GUARD guard;
+    PPH_PROCESS_ID_INDEX_TABLE table;
+    PPH_PROCESS_ITEM processItem;
+
+    if (!ProcessItems)
+    {
+        *NumberOfProcessItems = PhpProcessItemIndex.Count;
+        return;
+    }
+
+    // The provider may add and remove items while we walk the table, so the buffer is sized
+    // for the most items the table can hold.
+    PhEnterEpoch(&guard);
+
+    table = *(PPH_PROCESS_ID_INDEX_TABLE volatile *)&PhpProcessItemIndex.Table;
+    processItems = PhAllocate(sizeof(PPH_PROCESS_ITEM) * (table->AllocatedCount / 2));
+
+    for (i = 0; i < table->AllocatedCount; i++)
+    {
+        processItem = *(PVOID volatile *)&table->Entries[i].Value;
+
+        if (processItem && processItem != PH_PROCESS_ID_INDEX_TOMBSTONE)
+        {
+            PhReferenceObject(processItem);
+            processItems[count++] = processItem;
+        }
+    }
+
+    PhLeaveEpoch(&guard);
+
+    *ProcessItems = processItems;
+    *NumberOfProcessItems = count;
+}
+
+VOID NTAPI PhpProcessJobDeleteProcedure(
+    _In_ PVOID Object,
+    _In_ ULONG Flags
+    )
+{
+    PPH_PROCESS_JOB job = Object;
+
+    if (job->JobName) PhDereferenceObject(job->JobName);
+    if (job->ProcessIds) PhFree(job->ProcessIds);
+}
+
+/**
+ * Rebuilds the job index from the current process list.
+ *
+ * \param Processes The process list from the current update.
+ *
+ * \remarks Each job is opened once, through the first of its members that we come across,
+ * and its process ID list is used for all of its other members. A process in a nested job
+ * is counted in the innermost job of that first member.
+ */
+VOID PhpUpdateProcessJobIndex(
+    _In_ PVOID Processes
+    )
+{
+    PH_PROCESS_ID_INDEX index;
+    PPH_LIST list;
+    PH_PROCESS_ID_INDEX oldIndex;
+    PPH_LIST oldList;
+    ULONG i;
+
+    // Without KProcessHacker we can't get a handle to the job of another process.
+    if (!KphIsConnected() && !PhpProcessJobList)
+        return;
+
+    PhpInitializeProcessIdIndex(&index, 0, FALSE);
+    list = PhCreateList(8);
+
+    if (KphIsConnected())
+    {
+        PSYSTEM_PROCESS_INFORMATION process;
+
+        process = PH_FIRST_PROCESS(Processes);
+
+        do
+        {
+            NTSTATUS status;
+            PPH_PROCESS_ITEM processItem;
+            HANDLE jobHandle = NULL;
+            PJOBOBJECT_BASIC_PROCESS_ID_LIST processIdList;
+            JOBOBJECT_BASIC_LIMIT_INFORMATION basicLimits;
+            PPH_PROCESS_JOB job;
+
+            if (PhpFindProcessIdIndex(&index, process->UniqueProcessId))
+                continue;
+
+            processItem = PhpLookupProcessItem(process->UniqueProcessId);
+
+            if (!processItem || !processItem->IsInJob || !processItem->QueryHandle)
+                continue;
+
+            status = KphOpenProcessJob(processItem->QueryHandle, JOB_OBJECT_QUERY, &jobHandle);
+
+            if (!NT_SUCCESS(status) || status == STATUS_PROCESS_NOT_IN_JOB || !jobHandle)
+                continue;
+
+            if (NT_SUCCESS(PhGetJobProcessIdList(jobHandle, &processIdList)))
+            {
+                job = PhCreateObject(sizeof(PH_PROCESS_JOB), PhpProcessJobType);
+                memset(job, 0, sizeof(PH_PROCESS_JOB));
+                PhSetReference(&job->JobName, processItem->JobName);
+                job->ProcessIds = PhAllocate(sizeof(HANDLE) * max(processIdList->NumberOfProcessIdsInList, 1));
+
+                if (NT_SUCCESS(PhGetJobBasicLimits(jobHandle, &basicLimits)))
+                    job->IsSignificant = basicLimits.LimitFlags != JOB_OBJECT_LIMIT_SILENT_BREAKAWAY_OK;
+
+                for (i = 0; i < processIdList->NumberOfProcessIdsInList; i++)
+                {
+                    HANDLE processId = (HANDLE)processIdList->ProcessIdList[i];
+                    PPH_PROCESS_ITEM memberItem;
+
+                    if (PhpFindProcessIdIndex(&index, processId))
+                        continue;
+
+                    PhpAddProcessIdIndex(&index, processId, job);
+                    job->ProcessIds[job->NumberOfProcesses++] = processId;
+
+                    if (memberItem = PhpLookupProcessItem(processId))
+                    {
+                        job->CpuUsage += memberItem->CpuUsage;
+                        job->PrivateBytes += memberItem->VmCounters.PagefileUsage;
+                        job->WorkingSetSize += memberItem->VmCounters.WorkingSetSize;
+                    }
+                }
+
+                PhAddItemList(list, job);
+                PhFree(processIdList);
+            }
+
+            NtClose(jobHandle);
+        } while (process = PH_NEXT_PROCESS(process));
+    }
+
+    PhAcquireQueuedLockExclusive(&PhpProcessJobIndexLock);
+    oldIndex = PhpProcessJobIndex;
+    oldList = PhpProcessJobList;
+    PhpProcessJobIndex = index;
+    PhpProcessJobList = list;
+    PhReleaseQueuedLockExclusive(&PhpProcessJobIndexLock);
+
+    if (oldList)
+    {
+        for (i = 0; i < oldList->Count; i++)
+            PhDereferenceObject(oldList->Items[i]);
+
+        PhDereferenceObject(oldList);
+        PhFree(oldIndex.Table);
+    }
+}
+
+/**
+ * Finds the job of a process.
+ *
+ * \param ProcessId The ID of the process.
+ *
+ * \return The job that contains the process, or NULL if the process is not in a
+ * job or its job could not be opened. You must dereference the object when you
+ * no longer need it.
+ *
+ * \remarks The job index is rebuilt on every update of the process provider and
+ * requires KProcessHacker.
+ */
+PPH_PROCESS_JOB PhReferenceProcessJob(
+    _In_ HANDLE ProcessId
+    )
+{
+    PPH_PROCESS_JOB job = NULL;
+
+    PhAcquireQueuedLockShared(&PhpProcessJobIndexLock);
+
+    if (PhpProcessJobList && (job = PhpFindProcessIdIndex(&PhpProcessJobIndex, ProcessId)))
+        PhReferenceObject(job);
+
+    PhReleaseQueuedLockShared(&PhpProcessJobIndexLock);
+
+    return job;
+}
+
+/**
+ * Enumerates the jobs in the job index.
+ *
+ * \param Jobs A variable which receives an array of jobs. You must dereference
+ * each job and free the array using PhFree() when you no longer need them.
+ * \param NumberOfJobs A variable which receives the number of jobs.
+ */
+VOID PhEnumProcessJobs(
+    _Out_ PPH_PROCESS_JOB **Jobs,
+    _Out_ PULONG NumberOfJobs
+    )
+{
+    PPH_PROCESS_JOB *jobs;
+    ULONG count = 0;
+    ULONG i;
+
+    PhAcquireQueuedLockShared(&PhpProcessJobIndexLock);
+
+    if (PhpProcessJobList)
+        count = PhpProcessJobList->Count;
+
+    jobs = PhAllocate(sizeof(PPH_PROCESS_JOB) * max(count, 1));
+
+    for (i = 0; i < count; i++)
+    {
+        jobs[i] = PhpProcessJobList->Items[i];
+        PhReferenceObject(jobs[i]);
+    }
+
+    PhReleaseQueuedLockShared(&PhpProcessJobIndexLock);
+
+    *Jobs = jobs;
+    *NumberOfJobs = count;
+}
+
+VOID PhpAddProcessItem(
+    _In_ _Assume_refs_(1) PPH_PROCESS_ITEM ProcessItem
     )
 {
-    PPH_VERIFY_CACHE_ENTRY entry1 = CONTAINING_RECORD(Links1, PH_VERIFY_CACHE_ENTRY, Links);
-    PPH_VERIFY_CACHE_ENTRY entry2 = CONTAINING_RECORD(Links2, PH_VERIFY_CACHE_ENTRY, Links);
+    PhpAddProcessIdIndex(&PhpProcessItemIndex, ProcessItem->ProcessId, ProcessItem);
+}
 
-    return PhCompareString(entry1->FileName, entry2->FileName, TRUE);
+VOID PhpRemoveProcessItem(
+    _In_ PPH_PROCESS_ITEM ProcessItem
+    )
+{
+    PhpRemoveProcessIdIndex(&PhpProcessItemIndex, ProcessItem->ProcessId);
+    PhpInvalidateClientIdNames(ProcessItem->ProcessId);
+    // Readers may still be looking at the item.
+    PhDereferenceObjectAfterEpoch(ProcessItem);
 }
 
 VERIFY_RESULT PhVerifyFileWithAdditionalCatalog(
@@ -712,382 +1580,293 @@ VERIFY_RESULT PhVerifyFileWithAdditionalCatalog(
     return result;
 }
 
-/**
- * Verifies a file's digital signature, using a cached
- * result if possible.
- *
- * \param FileName A file name.
- * \param ProcessItem An associated process item.
- * \param SignerName A variable which receives a pointer
- * to a string containing the signer name. You must free
- * the string using PhDereferenceObject() when you no
- * longer need it. Note that the signer name may be NULL
- * if it is not valid.
- * \param CachedOnly Specify TRUE to fail the function when
- * no cached result exists.
- *
- * \return A VERIFY_RESULT value.
- */
-VERIFY_RESULT PhVerifyFileCached(
-    _In_ PPH_STRING FileName,
-    _In_opt_ PWSTR PackageFullName,
-    _Out_opt_ PPH_STRING *SignerName,
-    _In_ BOOLEAN CachedOnly
+static VOID NTAPI PhpQueryStage1Image(
+    _Inout_ PPH_PROCESS_QUERY_S1_DATA Data,
+    _Inout_ PPH_PROCESS_QUERY_S1_STATE State
     )
 {
-#ifdef PH_ENABLE_VERIFY_CACHE
-    PPH_AVL_LINKS links;
-    PPH_VERIFY_CACHE_ENTRY entry;
-    PH_VERIFY_CACHE_ENTRY lookupEntry;
-
-    lookupEntry.FileName = FileName;
-
-    PhAcquireQueuedLockShared(&PhpVerifyCacheLock);
-    links = PhFindElementAvlTree(&PhpVerifyCacheSet, &lookupEntry.Links);
-    PhReleaseQueuedLockShared(&PhpVerifyCacheLock);
+    PPH_PROCESS_ITEM processItem = Data->Header.ProcessItem;
 
-    if (links)
+    if (processItem->FileName)
     {
-        entry = CONTAINING_RECORD(links, PH_VERIFY_CACHE_ENTRY, Links);
-
-        if (SignerName)
-            PhSetReference(SignerName, entry->VerifySignerName);
+        // Version info. This also creates the image cache entry that the icons are
+        // cached on.
+        PhInitializeImageVersionInfoCached(&Data->VersionInfo, processItem->FileName);
 
-        return entry->VerifyResult;
+        // Small icon, large icon. Processes running the same image share these.
+        Data->Icons = PhReferenceImageIconsCached(processItem->FileName);
     }
-    else
-    {
-        VERIFY_RESULT result;
-        PPH_STRING signerName;
 
-        if (!CachedOnly)
-        {
-            PH_VERIFY_FILE_INFO info;
-
-            memset(&info, 0, sizeof(PH_VERIFY_FILE_INFO));
-            info.FileName = FileName->Buffer;
-            info.Flags = PH_VERIFY_PREVENT_NETWORK_ACCESS;
-            result = PhVerifyFileWithAdditionalCatalog(&info, PackageFullName, &signerName);
-
-            if (result != VrTrusted)
-                PhClearReference(&signerName);
-        }
-        else
-        {
-            result = VrUnknown;
-            signerName = NULL;
-        }
+    // Use the default EXE icon if we didn't get the file's icon.
+    if (!Data->Icons)
+        Data->Icons = PhReferenceStockImageIcons();
+}
 
-        if (result != VrUnknown)
-        {
-            entry = PhAllocate(sizeof(PH_VERIFY_CACHE_ENTRY));
-            entry->FileName = FileName;
-            entry->VerifyResult = result;
-            entry->VerifySignerName = signerName;
+static VOID NTAPI PhpQueryStage1Wow64(
+    _Inout_ PPH_PROCESS_QUERY_S1_DATA Data,
+    _Inout_ PPH_PROCESS_QUERY_S1_STATE State
+    )
+{
+#ifdef _WIN64
+    HANDLE processHandle;
 
-            PhAcquireQueuedLockExclusive(&PhpVerifyCacheLock);
-            links = PhAddElementAvlTree(&PhpVerifyCacheSet, &entry->Links);
-            PhReleaseQueuedLockExclusive(&PhpVerifyCacheLock);
+    if (NT_SUCCESS(PhOpenProcess(&processHandle, ProcessQueryAccess, Data->Header.ProcessItem->ProcessId)))
+    {
+        if (NT_SUCCESS(PhGetProcessIsWow64(processHandle, &Data->IsWow64)))
+            Data->IsWow64Valid = TRUE;
 
-            if (!links)
-            {
-                // We successfully added the cache entry. Add references.
+        NtClose(processHandle);
+    }
+#else
+    Data->IsWow64Valid = TRUE;
+#endif
 
-                PhReferenceObject(entry->FileName);
+    State->IsWow64 = Data->IsWow64;
+    State->IsWow64Valid = Data->IsWow64Valid;
+}
 
-                if (entry->VerifySignerName)
-                    PhReferenceObject(entry->VerifySignerName);
-            }
-            else
-            {
-                // Entry already exists.
-                PhFree(entry);
-            }
-        }
+static VOID NTAPI PhpQueryStage1CommandLine(
+    _Inout_ PPH_PROCESS_QUERY_S1_DATA Data,
+    _Inout_ PPH_PROCESS_QUERY_S1_STATE State
+    )
+{
+    NTSTATUS status;
+    HANDLE processId = Data->Header.ProcessItem->ProcessId;
+    HANDLE processHandle;
+    BOOLEAN queryAccess = FALSE;
+    BOOLEAN isPosix = FALSE;
+    PPH_STRING commandLine;
+    ULONG i;
 
-        if (SignerName)
-        {
-            *SignerName = signerName;
-        }
-        else
-        {
-            if (signerName)
-                PhDereferenceObject(signerName);
-        }
+    status = PhOpenProcess(&processHandle, ProcessQueryAccess | PROCESS_VM_READ, processId);
 
-        return result;
+    if (!NT_SUCCESS(status) && WindowsVersion >= WINDOWS_8_1)
+    {
+        queryAccess = TRUE;
+        status = PhOpenProcess(&processHandle, ProcessQueryAccess, processId);
     }
-#else
-    VERIFY_RESULT result;
-    PPH_STRING signerName;
-    PH_VERIFY_FILE_INFO info;
 
-    memset(&info, 0, sizeof(PH_VERIFY_FILE_INFO));
-    info.FileName = FileName->Buffer;
-    info.Flags = PH_VERIFY_PREVENT_NETWORK_ACCESS;
-    result = PhVerifyFileWithAdditionalCatalog(&info, PackageFullName, &signerName);
-
-    if (result != VrTrusted)
-        PhClearReference(&signerName);
+    if (!NT_SUCCESS(status))
+        return;
 
-    if (SignerName)
+    if (!queryAccess)
     {
-        *SignerName = signerName;
+        status = PhGetProcessIsPosix(processHandle, &isPosix);
+        Data->IsPosix = isPosix;
     }
-    else
+
+    if (!NT_SUCCESS(status) || !isPosix)
     {
-        if (signerName)
-            PhDereferenceObject(signerName);
-    }
+        status = PhGetProcessCommandLine(processHandle, &commandLine);
 
-    return result;
+        if (NT_SUCCESS(status))
+        {
+            // Some command lines (e.g. from taskeng.exe) have nulls in them.
+            // Since Windows can't display them, we'll replace them with
+            // spaces.
+            for (i = 0; i < (ULONG)commandLine->Length / 2; i++)
+            {
+                if (commandLine->Buffer[i] == 0)
+                    commandLine->Buffer[i] = ' ';
+            }
+        }
+    }
+    else
+    {
+        // Get the POSIX command line.
+        status = PhGetProcessPosixCommandLine(processHandle, &commandLine);
+    }
+
+    if (NT_SUCCESS(status))
+    {
+        Data->CommandLine = commandLine;
+    }
+
+    NtClose(processHandle);
+}
+
+static VOID NTAPI PhpQueryStage1DotNet(
+    _Inout_ PPH_PROCESS_QUERY_S1_DATA Data,
+    _Inout_ PPH_PROCESS_QUERY_S1_STATE State
+    )
+{
+    HANDLE processId = Data->Header.ProcessItem->ProcessId;
+    HANDLE processHandle;
+    BOOLEAN isDotNet = FALSE;
+
+    if (!NT_SUCCESS(PhOpenProcess(&processHandle, ProcessQueryAccess | PROCESS_VM_READ, processId)))
+        return;
+
+    PhGetProcessIsDotNetEx(
+        processId,
+        processHandle,
+#ifdef _WIN64
+        State->IsWow64Valid ? PH_CLR_NO_WOW64_CHECK | (State->IsWow64 ? PH_CLR_KNOWN_IS_WOW64 : 0) : 0,
+#else
+        0,
 #endif
+        &isDotNet,
+        NULL
+        );
+    Data->IsDotNet = isDotNet;
+
+    NtClose(processHandle);
 }
 
-VOID PhpProcessQueryStage1(
-    _Inout_ PPH_PROCESS_QUERY_S1_DATA Data
+static VOID NTAPI PhpQueryStage1Token(
+    _Inout_ PPH_PROCESS_QUERY_S1_DATA Data,
+    _Inout_ PPH_PROCESS_QUERY_S1_STATE State
     )
 {
-    NTSTATUS status;
-    PPH_PROCESS_ITEM processItem = Data->Header.ProcessItem;
-    HANDLE processId = processItem->ProcessId;
-    HANDLE processHandleLimited = NULL;
+    HANDLE processHandle;
+    HANDLE tokenHandle;
 
-    PhOpenProcess(&processHandleLimited, ProcessQueryAccess, processId);
+    if (!WINDOWS_HAS_UAC)
+        return;
+    if (!NT_SUCCESS(PhOpenProcess(&processHandle, ProcessQueryAccess, Data->Header.ProcessItem->ProcessId)))
+        return;
 
-    if (processItem->FileName)
+    if (NT_SUCCESS(PhOpenProcessToken(&tokenHandle, TOKEN_QUERY, processHandle)))
     {
-        // Small icon, large icon.
-        if (ExtractIconEx(
-            processItem->FileName->Buffer,
-            0,
-            &Data->LargeIcon,
-            &Data->SmallIcon,
-            1
-            ) == 0)
+        // Elevation
+        if (NT_SUCCESS(PhGetTokenElevationType(
+            tokenHandle,
+            &Data->ElevationType
+            )))
         {
-            Data->LargeIcon = NULL;
-            Data->SmallIcon = NULL;
+            Data->IsElevated = Data->ElevationType == TokenElevationTypeFull;
         }
 
-        // Version info.
-        PhInitializeImageVersionInfo(&Data->VersionInfo, processItem->FileName->Buffer);
+        // Integrity
+        PhGetTokenIntegrityLevel(
+            tokenHandle,
+            &Data->IntegrityLevel,
+            &Data->IntegrityString
+            );
+
+        NtClose(tokenHandle);
     }
 
-    // Use the default EXE icon if we didn't get the file's icon.
-    {
-        if (!Data->SmallIcon || !Data->LargeIcon)
-        {
-            if (Data->SmallIcon)
-            {
-                DestroyIcon(Data->SmallIcon);
-                Data->SmallIcon = NULL;
-            }
-            else if (Data->LargeIcon)
-            {
-                DestroyIcon(Data->LargeIcon);
-                Data->LargeIcon = NULL;
-            }
+    NtClose(processHandle);
+}
 
-            PhGetStockApplicationIcon(&Data->SmallIcon, &Data->LargeIcon);
-            Data->SmallIcon = DuplicateIcon(NULL, Data->SmallIcon);
-            Data->LargeIcon = DuplicateIcon(NULL, Data->LargeIcon);
-        }
-    }
+static VOID NTAPI PhpQueryStage1Job(
+    _Inout_ PPH_PROCESS_QUERY_S1_DATA Data,
+    _Inout_ PPH_PROCESS_QUERY_S1_STATE State
+    )
+{
+    NTSTATUS status;
+    HANDLE processHandle;
 
-#ifdef _WIN64
-    // WOW64
-    if (processHandleLimited)
-    {
-        if (NT_SUCCESS(PhGetProcessIsWow64(processHandleLimited, &Data->IsWow64)))
-            Data->IsWow64Valid = TRUE;
-    }
-#else
-    Data->IsWow64Valid = TRUE;
-#endif
+    if (!NT_SUCCESS(PhOpenProcess(&processHandle, ProcessQueryAccess, Data->Header.ProcessItem->ProcessId)))
+        return;
 
-    // POSIX, command line, .NET
+    if (KphIsConnected())
     {
-        HANDLE processHandle;
-        BOOLEAN queryAccess = FALSE;
+        HANDLE jobHandle = NULL;
 
-        status = PhOpenProcess(
-            &processHandle,
-            ProcessQueryAccess | PROCESS_VM_READ,
-            processId
+        status = KphOpenProcessJob(
+            processHandle,
+            JOB_OBJECT_QUERY,
+            &jobHandle
             );
 
-        if (!NT_SUCCESS(status) && WindowsVersion >= WINDOWS_8_1)
-        {
-            queryAccess = TRUE;
-            status = PhOpenProcess(
-                &processHandle,
-                ProcessQueryAccess,
-                processId
-                );
-        }
-
-        if (NT_SUCCESS(status))
+        if (NT_SUCCESS(status) && status != STATUS_PROCESS_NOT_IN_JOB && jobHandle)
         {
-            BOOLEAN isPosix = FALSE;
-            BOOLEAN isDotNet = FALSE;
-            PPH_STRING commandLine;
-            ULONG i;
-
-            if (!queryAccess)
-            {
-                status = PhGetProcessIsPosix(processHandle, &isPosix);
-                Data->IsPosix = isPosix;
-            }
-
-            if (!NT_SUCCESS(status) || !isPosix)
-            {
-                status = PhGetProcessCommandLine(processHandle, &commandLine);
+            JOBOBJECT_BASIC_LIMIT_INFORMATION basicLimits;
 
-                if (NT_SUCCESS(status))
-                {
-                    // Some command lines (e.g. from taskeng.exe) have nulls in them.
-                    // Since Windows can't display them, we'll replace them with
-                    // spaces.
-                    for (i = 0; i < (ULONG)commandLine->Length / 2; i++)
-                    {
-                        if (commandLine->Buffer[i] == 0)
-                            commandLine->Buffer[i] = ' ';
-                    }
-                }
-            }
-            else
-            {
-                // Get the POSIX command line.
-                status = PhGetProcessPosixCommandLine(processHandle, &commandLine);
-            }
+            Data->IsInJob = TRUE;
 
-            if (NT_SUCCESS(status))
-            {
-                Data->CommandLine = commandLine;
-            }
+            PhGetHandleInformation(
+                NtCurrentProcess(),
+                jobHandle,
+                -1,
+                NULL,
+                NULL,
+                NULL,
+                &Data->JobName
+                );
 
-            if (!queryAccess)
+            // Process Explorer only recognizes processes as being in jobs if they
+            // don't have the silent-breakaway-OK limit as their only limit.
+            // Emulate this behaviour.
+            if (NT_SUCCESS(PhGetJobBasicLimits(jobHandle, &basicLimits)))
             {
-                PhGetProcessIsDotNetEx(
-                    processId,
-                    processHandle,
-#ifdef _WIN64
-                    PH_CLR_NO_WOW64_CHECK | (Data->IsWow64 ? PH_CLR_KNOWN_IS_WOW64 : 0),
-#else
-                    0,
-#endif
-                    &isDotNet,
-                    NULL
-                    );
-                Data->IsDotNet = isDotNet;
+                Data->IsInSignificantJob =
+                    basicLimits.LimitFlags != JOB_OBJECT_LIMIT_SILENT_BREAKAWAY_OK;
             }
 
-            NtClose(processHandle);
+            NtClose(jobHandle);
         }
     }
-
-    // Token information
-    if (processHandleLimited)
+    else
     {
-        if (WINDOWS_HAS_UAC)
-        {
-            HANDLE tokenHandle;
+        // KProcessHacker not available. We can determine if the process is
+        // in a job, but we can't get a handle to the job.
 
-            status = PhOpenProcessToken(&tokenHandle, TOKEN_QUERY, processHandleLimited);
+        status = NtIsProcessInJob(processHandle, NULL);
 
-            if (NT_SUCCESS(status))
-            {
-                // Elevation
-                if (NT_SUCCESS(PhGetTokenElevationType(
-                    tokenHandle,
-                    &Data->ElevationType
-                    )))
-                {
-                    Data->IsElevated = Data->ElevationType == TokenElevationTypeFull;
-                }
+        if (NT_SUCCESS(status))
+            Data->IsInJob = status == STATUS_PROCESS_IN_JOB;
+    }
 
-                // Integrity
-                PhGetTokenIntegrityLevel(
-                    tokenHandle,
-                    &Data->IntegrityLevel,
-                    &Data->IntegrityString
-                    );
+    NtClose(processHandle);
+}
 
-                NtClose(tokenHandle);
-            }
-        }
-    }
+static VOID NTAPI PhpQueryStage1Host(
+    _Inout_ PPH_PROCESS_QUERY_S1_DATA Data,
+    _Inout_ PPH_PROCESS_QUERY_S1_STATE State
+    )
+{
+    HANDLE processHandle;
 
-    // Job
-    if (processHandleLimited)
-    {
-        if (KphIsConnected())
-        {
-            HANDLE jobHandle = NULL;
+    if (!WINDOWS_HAS_CONSOLE_HOST && !WINDOWS_HAS_IMMERSIVE)
+        return;
+    if (!NT_SUCCESS(PhOpenProcess(&processHandle, ProcessQueryAccess, Data->Header.ProcessItem->ProcessId)))
+        return;
 
-            status = KphOpenProcessJob(
-                processHandleLimited,
-                JOB_OBJECT_QUERY,
-                &jobHandle
-                );
+    // Console host process
+    if (WINDOWS_HAS_CONSOLE_HOST)
+        PhGetProcessConsoleHostProcessId(processHandle, &Data->ConsoleHostProcessId);
 
-            if (NT_SUCCESS(status) && status != STATUS_PROCESS_NOT_IN_JOB && jobHandle)
-            {
-                JOBOBJECT_BASIC_LIMIT_INFORMATION basicLimits;
-
-                Data->IsInJob = TRUE;
-
-                PhGetHandleInformation(
-                    NtCurrentProcess(),
-                    jobHandle,
-                    -1,
-                    NULL,
-                    NULL,
-                    NULL,
-                    &Data->JobName
-                    );
-
-                // Process Explorer only recognizes processes as being in jobs if they
-                // don't have the silent-breakaway-OK limit as their only limit.
-                // Emulate this behaviour.
-                if (NT_SUCCESS(PhGetJobBasicLimits(jobHandle, &basicLimits)))
-                {
-                    Data->IsInSignificantJob =
-                        basicLimits.LimitFlags != JOB_OBJECT_LIMIT_SILENT_BREAKAWAY_OK;
-                }
+    // Package full name
+    if (WINDOWS_HAS_IMMERSIVE)
+        Data->PackageFullName = PhGetProcessPackageFullName(processHandle);
 
-                NtClose(jobHandle);
-            }
-        }
-        else
-        {
-            // KProcessHacker not available. We can determine if the process is
-            // in a job, but we can't get a handle to the job.
+    NtClose(processHandle);
+}
 
-            status = NtIsProcessInJob(processHandleLimited, NULL);
+// The stage 1 sub-queries, in an order that satisfies their dependencies.
+static PH_PROCESS_QUERY_S1_TASK PhpProcessQueryStage1Tasks[] =
+{
+    { PH_PROCESS_STAGE1_COMMAND_LINE, 0, PhpQueryStage1CommandLine },
+    { PH_PROCESS_STAGE1_WOW64, 0, PhpQueryStage1Wow64 },
+    { PH_PROCESS_STAGE1_TOKEN, 0, PhpQueryStage1Token },
+    { PH_PROCESS_STAGE1_HOST, 0, PhpQueryStage1Host },
+    { PH_PROCESS_STAGE1_JOB, 0, PhpQueryStage1Job },
+    { PH_PROCESS_STAGE1_IMAGE, 0, PhpQueryStage1Image },
+    { PH_PROCESS_STAGE1_DOTNET, PH_PROCESS_STAGE1_WOW64, PhpQueryStage1DotNet }
+};
 
-            if (NT_SUCCESS(status))
-                Data->IsInJob = status == STATUS_PROCESS_IN_JOB;
-        }
-    }
+/**
+ * Performs stage 1 queries for a process on the current thread.
+ *
+ * \param Data The query data. Only the parts specified in \a Data->Parts are queried.
+ */
+VOID PhpProcessQueryStage1(
+    _Inout_ PPH_PROCESS_QUERY_S1_DATA Data
+    )
+{
+    PH_PROCESS_QUERY_S1_STATE state;
+    ULONG i;
 
-    // Console host process
-    if (processHandleLimited && WINDOWS_HAS_CONSOLE_HOST)
-    {
-        PhGetProcessConsoleHostProcessId(processHandleLimited, &Data->ConsoleHostProcessId);
-    }
+    memset(&state, 0, sizeof(PH_PROCESS_QUERY_S1_STATE));
 
-    // Package full name
-    if (processHandleLimited && WINDOWS_HAS_IMMERSIVE)
+    for (i = 0; i < RTL_NUMBER_OF(PhpProcessQueryStage1Tasks); i++)
     {
-        Data->PackageFullName = PhGetProcessPackageFullName(processHandleLimited);
+        if (Data->Parts & PhpProcessQueryStage1Tasks[i].Part)
+            PhpProcessQueryStage1Tasks[i].Routine(Data, &state);
     }
-
-    if (processHandleLimited)
-        NtClose(processHandleLimited);
-
-    PhpQueueProcessQueryStage2(processItem);
 }
 
 VOID PhpProcessQueryStage2(
@@ -1135,121 +1914,585 @@ VOID PhpProcessQueryStage2(
     }
 }
 
-NTSTATUS PhpProcessQueryStage1Worker(
-    _In_ PVOID Parameter
+static PPH_PROCESS_QUERY_S1_STATE PhpCreateProcessQueryStage1State(
+    VOID
+    )
+{
+    PPH_PROCESS_QUERY_S1_STATE state;
+
+    state = PhAllocate(sizeof(PH_PROCESS_QUERY_S1_STATE));
+    memset(state, 0, sizeof(PH_PROCESS_QUERY_S1_STATE));
+    state->RefCount = 1;
+
+    return state;
+}
+
+static VOID PhpDereferenceProcessQueryStage1State(
+    _In_ PPH_PROCESS_QUERY_S1_STATE State
+    )
+{
+    if (_InterlockedDecrement(&State->RefCount) == 0)
+        PhFree(State);
+}
+
+/**
+ * Queues the stage 1 sub-queries whose dependencies have completed and which have not been
+ * queued yet.
+ *
+ * \param ProcessItem The process item.
+ * \param State The stage 1 state of the process item.
+ * \param Priority TRUE to queue the sub-queries in the priority lane.
+ */
+static VOID PhpQueueReadyProcessQueryStage1Parts(
+    _In_ PPH_PROCESS_ITEM ProcessItem,
+    _In_ PPH_PROCESS_QUERY_S1_STATE State,
+    _In_ BOOLEAN Priority
+    )
+{
+    ULONG completedParts = State->CompletedParts;
+    ULONG i;
+
+    for (i = 0; i < RTL_NUMBER_OF(PhpProcessQueryStage1Tasks); i++)
+    {
+        PPH_PROCESS_QUERY_S1_TASK task = &PhpProcessQueryStage1Tasks[i];
+
+        if ((State->QueuedParts & task->Part) || (completedParts & task->Dependencies) != task->Dependencies)
+            continue;
+
+        // Two workers may complete dependencies of the same part at the same time.
+        if (_InterlockedOr(&State->QueuedParts, task->Part) & task->Part)
+            continue;
+
+        _InterlockedIncrement(&State->RefCount);
+        PhpQueueProcessQueryRequest(ProcessItem, 1, task->Part, State, Priority);
+    }
+}
+
+VOID PhpProcessQueryStage1Worker(
+    _In_ PPH_PROCESS_QUERY_REQUEST Request
     )
 {
     PPH_PROCESS_QUERY_S1_DATA data;
-    PPH_PROCESS_ITEM processItem = (PPH_PROCESS_ITEM)Parameter;
+    PPH_PROCESS_QUERY_S1_STATE state = Request->State;
+    ULONG completedParts;
+    ULONG i;
 
     data = PhAllocate(sizeof(PH_PROCESS_QUERY_S1_DATA));
     memset(data, 0, sizeof(PH_PROCESS_QUERY_S1_DATA));
     data->Header.Stage = 1;
-    data->Header.ProcessItem = processItem;
+    data->Header.ProcessItem = Request->ProcessItem;
+    data->Header.Priority = Request->Priority;
+    data->Parts = Request->Part;
 
-    PhpProcessQueryStage1(data);
+    for (i = 0; i < RTL_NUMBER_OF(PhpProcessQueryStage1Tasks); i++)
+    {
+        if (PhpProcessQueryStage1Tasks[i].Part == Request->Part)
+        {
+            PhpProcessQueryStage1Tasks[i].Routine(data, state);
+            break;
+        }
+    }
 
+    // Publish the result right away instead of waiting for the other parts.
     RtlInterlockedPushEntrySList(&PhProcessQueryDataListHead, &data->Header.ListEntry);
 
-    return STATUS_SUCCESS;
+    completedParts = _InterlockedOr(&state->CompletedParts, Request->Part) | Request->Part;
+
+    // Only the worker which completes the last part sees all of them.
+    if (completedParts == PH_PROCESS_STAGE1_ALL)
+        PhpQueueProcessQueryStage2(Request->ProcessItem, Request->Priority);
+    else
+        PhpQueueReadyProcessQueryStage1Parts(Request->ProcessItem, state, Request->Priority);
+
+    PhpDereferenceProcessQueryStage1State(state);
 }
 
-NTSTATUS PhpProcessQueryStage2Worker(
-    _In_ PVOID Parameter
+VOID PhpProcessQueryStage2Worker(
+    _In_ PPH_PROCESS_ITEM ProcessItem,
+    _In_ BOOLEAN Priority
     )
 {
     PPH_PROCESS_QUERY_S2_DATA data;
-    PPH_PROCESS_ITEM processItem = (PPH_PROCESS_ITEM)Parameter;
 
     data = PhAllocate(sizeof(PH_PROCESS_QUERY_S2_DATA));
     memset(data, 0, sizeof(PH_PROCESS_QUERY_S2_DATA));
     data->Header.Stage = 2;
-    data->Header.ProcessItem = processItem;
+    data->Header.ProcessItem = ProcessItem;
+    data->Header.Priority = Priority;
 
     PhpProcessQueryStage2(data);
 
     RtlInterlockedPushEntrySList(&PhProcessQueryDataListHead, &data->Header.ListEntry);
+}
+
+NTSTATUS PhpProcessQueryWorker(
+    _In_ PVOID Parameter
+    )
+{
+    PLIST_ENTRY listEntry;
+    PPH_PROCESS_QUERY_REQUEST request;
+
+    // Each queued work item corresponds to exactly one request, but not necessarily the one
+    // that was queued along with it. Always take from the priority lane first.
+
+    PhAcquireQueuedLockExclusive(&PhpProcessQueryListLock);
+
+    if (!IsListEmpty(&PhpProcessQueryPriorityListHead))
+    {
+        listEntry = RemoveHeadList(&PhpProcessQueryPriorityListHead);
+        PhpProcessQueryStatistics.PriorityQueuedCount--;
+    }
+    else
+    {
+        listEntry = RemoveHeadList(&PhpProcessQueryNormalListHead);
+    }
+
+    PhpProcessQueryStatistics.QueuedCount--;
+    PhpProcessQueryStatistics.RunningCount++;
+
+    PhReleaseQueuedLockExclusive(&PhpProcessQueryListLock);
+
+    request = CONTAINING_RECORD(listEntry, PH_PROCESS_QUERY_REQUEST, ListEntry);
+
+    if (request->Stage == 1)
+        PhpProcessQueryStage1Worker(request);
+    else
+        PhpProcessQueryStage2Worker(request->ProcessItem, request->Priority);
+
+    PhFree(request);
+
+    PhAcquireQueuedLockExclusive(&PhpProcessQueryListLock);
+    PhpProcessQueryStatistics.RunningCount--;
+    PhpProcessQueryStatistics.TotalCompleted++;
+    PhReleaseQueuedLockExclusive(&PhpProcessQueryListLock);
 
     return STATUS_SUCCESS;
 }
 
-VOID PhpQueueProcessQueryStage1(
-    _In_ PPH_PROCESS_ITEM ProcessItem
+VOID PhpQueueProcessQueryRequest(
+    _In_ PPH_PROCESS_ITEM ProcessItem,
+    _In_ ULONG Stage,
+    _In_ ULONG Part,
+    _In_opt_ PPH_PROCESS_QUERY_S1_STATE State,
+    _In_ BOOLEAN Priority
     )
 {
+    PPH_PROCESS_QUERY_REQUEST request;
+
     // Ref: dereferenced when the provider update function removes the item from
     // the queue.
     PhReferenceObject(ProcessItem);
-    PhQueueItemGlobalWorkQueue(PhpProcessQueryStage1Worker, ProcessItem);
+
+    request = PhAllocate(sizeof(PH_PROCESS_QUERY_REQUEST));
+    request->Stage = Stage;
+    request->Priority = Priority;
+    request->ProcessItem = ProcessItem;
+    request->Part = Part;
+    request->State = State;
+
+    PhAcquireQueuedLockExclusive(&PhpProcessQueryListLock);
+
+    if (Priority)
+    {
+        InsertTailList(&PhpProcessQueryPriorityListHead, &request->ListEntry);
+        PhpProcessQueryStatistics.PriorityQueuedCount++;
+    }
+    else
+    {
+        InsertTailList(&PhpProcessQueryNormalListHead, &request->ListEntry);
+    }
+
+    PhpProcessQueryStatistics.QueuedCount++;
+    PhpProcessQueryStatistics.TotalQueued++;
+
+    if (PhpProcessQueryStatistics.PeakQueuedCount < PhpProcessQueryStatistics.QueuedCount)
+        PhpProcessQueryStatistics.PeakQueuedCount = PhpProcessQueryStatistics.QueuedCount;
+
+    PhReleaseQueuedLockExclusive(&PhpProcessQueryListLock);
+
+    PhQueueItemWorkQueue(&PhpProcessQueryWorkQueue, PhpProcessQueryWorker, NULL);
 }
 
-VOID PhpQueueProcessQueryStage2(
+VOID PhpQueueProcessQueryStage1(
     _In_ PPH_PROCESS_ITEM ProcessItem
     )
+{
+    PPH_PROCESS_QUERY_S1_STATE state;
+
+    // Queue the parts without dependencies. The rest are queued by the workers as their
+    // dependencies complete.
+    state = PhpCreateProcessQueryStage1State();
+    PhpQueueReadyProcessQueryStage1Parts(ProcessItem, state, FALSE);
+    PhpDereferenceProcessQueryStage1State(state);
+}
+
+VOID PhpQueueProcessQueryStage2(
+    _In_ PPH_PROCESS_ITEM ProcessItem,
+    _In_ BOOLEAN Priority
+    )
 {
     if (PhEnableProcessQueryStage2)
     {
-        PhReferenceObject(ProcessItem);
-        PhQueueItemGlobalWorkQueue(PhpProcessQueryStage2Worker, ProcessItem);
+        PhpQueueProcessQueryRequest(ProcessItem, 2, 0, NULL, Priority);
     }
 }
 
-VOID PhpFillProcessItemStage1(
-    _In_ PPH_PROCESS_QUERY_S1_DATA Data
+/**
+ * Moves any pending stage 1 or stage 2 queries for a process item into the
+ * priority lane. This should be called for processes that are visible to the
+ * user.
+ *
+ * \param ProcessItem A process item.
+ */
+VOID PhPrioritizeProcessQuery(
+    _In_ PPH_PROCESS_ITEM ProcessItem
     )
 {
-    PPH_PROCESS_ITEM processItem = Data->Header.ProcessItem;
+    PLIST_ENTRY listEntry;
+    PPH_PROCESS_QUERY_REQUEST request;
+
+    PhAcquireQueuedLockExclusive(&PhpProcessQueryListLock);
+
+    listEntry = PhpProcessQueryNormalListHead.Flink;
 
-    processItem->CommandLine = Data->CommandLine;
-    processItem->SmallIcon = Data->SmallIcon;
-    processItem->LargeIcon = Data->LargeIcon;
-    memcpy(&processItem->VersionInfo, &Data->VersionInfo, sizeof(PH_IMAGE_VERSION_INFO));
-    processItem->ElevationType = Data->ElevationType;
-    processItem->IntegrityLevel = Data->IntegrityLevel;
-    processItem->IntegrityString = Data->IntegrityString;
-    processItem->JobName = Data->JobName;
-    processItem->ConsoleHostProcessId = Data->ConsoleHostProcessId;
-    processItem->PackageFullName = Data->PackageFullName;
-    processItem->IsDotNet = Data->IsDotNet;
-    processItem->IsElevated = Data->IsElevated;
-    processItem->IsInJob = Data->IsInJob;
-    processItem->IsInSignificantJob = Data->IsInSignificantJob;
-    processItem->IsPosix = Data->IsPosix;
-    processItem->IsWow64 = Data->IsWow64;
-    processItem->IsWow64Valid = Data->IsWow64Valid;
-
-    PhSwapReference(&processItem->Record->CommandLine, processItem->CommandLine);
+    while (listEntry != &PhpProcessQueryNormalListHead)
+    {
+        request = CONTAINING_RECORD(listEntry, PH_PROCESS_QUERY_REQUEST, ListEntry);
+        listEntry = listEntry->Flink;
+
+        if (request->ProcessItem == ProcessItem)
+        {
+            RemoveEntryList(&request->ListEntry);
+            InsertTailList(&PhpProcessQueryPriorityListHead, &request->ListEntry);
+            request->Priority = TRUE;
+            PhpProcessQueryStatistics.PriorityQueuedCount++;
+        }
+    }
+
+    PhReleaseQueuedLockExclusive(&PhpProcessQueryListLock);
 }
 
-VOID PhpFillProcessItemStage2(
-    _In_ PPH_PROCESS_QUERY_S2_DATA Data
+/**
+ * Retrieves queue depth counters for the process query work queue.
+ *
+ * \param Statistics A variable which receives the counters.
+ */
+VOID PhGetProcessQueryStatistics(
+    _Out_ PPH_PROCESS_QUERY_STATISTICS Statistics
     )
 {
-    PPH_PROCESS_ITEM processItem = Data->Header.ProcessItem;
-
-    processItem->VerifyResult = Data->VerifyResult;
-    processItem->VerifySignerName = Data->VerifySignerName;
-    processItem->IsPacked = Data->IsPacked;
-    processItem->ImportFunctions = Data->ImportFunctions;
-    processItem->ImportModules = Data->ImportModules;
+    PhAcquireQueuedLockShared(&PhpProcessQueryListLock);
+    *Statistics = PhpProcessQueryStatistics;
+    PhReleaseQueuedLockShared(&PhpProcessQueryListLock);
 }
 
-VOID PhpFillProcessItem(
-    _Inout_ PPH_PROCESS_ITEM ProcessItem,
-    _In_ PSYSTEM_PROCESS_INFORMATION Process
+VOID PhpFillProcessItemStage1(
+    _In_ PPH_PROCESS_QUERY_S1_DATA Data
     )
 {
-    NTSTATUS status;
+    PPH_PROCESS_ITEM processItem = Data->Header.ProcessItem;
+    ULONG parts = Data->Parts;
+
+    if (parts & PH_PROCESS_STAGE1_IMAGE)
+    {
+        processItem->Icons = Data->Icons;
+        processItem->SmallIcon = Data->Icons->SmallIcon;
+        processItem->LargeIcon = Data->Icons->LargeIcon;
+        memcpy(&processItem->VersionInfo, &Data->VersionInfo, sizeof(PH_IMAGE_VERSION_INFO));
+    }
+
+    if (parts & PH_PROCESS_STAGE1_WOW64)
+    {
+        processItem->IsWow64 = Data->IsWow64;
+        processItem->IsWow64Valid = Data->IsWow64Valid;
+    }
+
+    if (parts & PH_PROCESS_STAGE1_COMMAND_LINE)
+    {
+        processItem->CommandLine = Data->CommandLine;
+        processItem->IsPosix = Data->IsPosix;
+        PhSwapReference(&processItem->Record->CommandLine, processItem->CommandLine);
+    }
+
+    if (parts & PH_PROCESS_STAGE1_DOTNET)
+    {
+        processItem->IsDotNet = Data->IsDotNet;
+    }
+
+    if (parts & PH_PROCESS_STAGE1_TOKEN)
+    {
+        processItem->ElevationType = Data->ElevationType;
+        processItem->IsElevated = Data->IsElevated;
+        processItem->IntegrityLevel = Data->IntegrityLevel;
+        processItem->IntegrityString = Data->IntegrityString;
+    }
+
+    if (parts & PH_PROCESS_STAGE1_JOB)
+    {
+        processItem->JobName = Data->JobName;
+        processItem->IsInJob = Data->IsInJob;
+        processItem->IsInSignificantJob = Data->IsInSignificantJob;
+    }
+
+    if (parts & PH_PROCESS_STAGE1_HOST)
+    {
+        processItem->ConsoleHostProcessId = Data->ConsoleHostProcessId;
+        processItem->PackageFullName = Data->PackageFullName;
+    }
+
+    // This must come after the fields are written, because other threads check the flags
+    // before reading the fields.
+    if ((_InterlockedOr(&processItem->Stage1Flags, parts) | parts) == PH_PROCESS_STAGE1_ALL)
+        PhSetEvent(&processItem->Stage1Event);
+}
+
+VOID PhpFillProcessItemStage2(
+    _In_ PPH_PROCESS_QUERY_S2_DATA Data
+    )
+{
+    PPH_PROCESS_ITEM processItem = Data->Header.ProcessItem;
+
+    processItem->VerifyResult = Data->VerifyResult;
+    processItem->VerifySignerName = Data->VerifySignerName;
+    processItem->IsPacked = Data->IsPacked;
+    processItem->ImportFunctions = Data->ImportFunctions;
+    processItem->ImportModules = Data->ImportModules;
+}
+
+VOID NTAPI PhpProcessInformationSnapshotDeleteProcedure(
+    _In_ PVOID Object,
+    _In_ ULONG Flags
+    )
+{
+    PPH_PROCESS_INFORMATION_SNAPSHOT snapshot = Object;
+
+    if (snapshot->OwnsBuffer)
+        PhFreePage(snapshot->Processes);
+
+    PhFree(snapshot->Entries);
+}
+
+static int __cdecl PhpProcessInformationSnapshotEntryCompare(
+    _In_ const void *elem1,
+    _In_ const void *elem2
+    )
+{
+    return uintptrcmp(
+        (ULONG_PTR)((PPH_PROCESS_INFORMATION_SNAPSHOT_ENTRY)elem1)->ProcessId,
+        (ULONG_PTR)((PPH_PROCESS_INFORMATION_SNAPSHOT_ENTRY)elem2)->ProcessId
+        );
+}
+
+PPH_PROCESS_INFORMATION_SNAPSHOT PhpCreateProcessInformationSnapshot(
+    _In_ PVOID Processes,
+    _In_ ULONG RunId
+    )
+{
+    PPH_PROCESS_INFORMATION_SNAPSHOT snapshot;
+    PSYSTEM_PROCESS_INFORMATION process;
+    ULONG numberOfProcesses;
+
+    numberOfProcesses = 0;
+    process = PH_FIRST_PROCESS(Processes);
+
+    do
+    {
+        numberOfProcesses++;
+    } while (process = PH_NEXT_PROCESS(process));
+
+    snapshot = PhCreateObject(sizeof(PH_PROCESS_INFORMATION_SNAPSHOT), PhpProcessInformationSnapshotType);
+    snapshot->RunId = RunId;
+    snapshot->Processes = Processes;
+    snapshot->NumberOfProcesses = numberOfProcesses;
+    snapshot->Entries = PhAllocate(numberOfProcesses * sizeof(PH_PROCESS_INFORMATION_SNAPSHOT_ENTRY));
+    snapshot->OwnsBuffer = FALSE;
+
+    numberOfProcesses = 0;
+    process = PH_FIRST_PROCESS(Processes);
+
+    do
+    {
+        snapshot->Entries[numberOfProcesses].ProcessId = process->UniqueProcessId;
+        snapshot->Entries[numberOfProcesses].Process = process;
+        numberOfProcesses++;
+    } while (process = PH_NEXT_PROCESS(process));
+
+    qsort(snapshot->Entries, numberOfProcesses, sizeof(PH_PROCESS_INFORMATION_SNAPSHOT_ENTRY), PhpProcessInformationSnapshotEntryCompare);
+
+    return snapshot;
+}
+
+/**
+ * Gets the process information from the most recent update of the process provider.
+ *
+ * \return The snapshot, or NULL if none is available. You must dereference the snapshot
+ * using PhDereferenceObject() when you no longer need it.
+ *
+ * \remarks This lets other providers use the same snapshot as the process provider
+ * instead of querying the system again. The snapshot remains valid for as long as it is
+ * referenced.
+ */
+PPH_PROCESS_INFORMATION_SNAPSHOT PhReferenceProcessInformationSnapshot(
+    VOID
+    )
+{
+    PPH_PROCESS_INFORMATION_SNAPSHOT snapshot;
+
+    // The buffers of replayed data can't be handed over to a snapshot (see
+    // PhpRetireProcessInformationSnapshot), so they can't be kept beyond an update.
+    if (PhProviderDataSource)
+        return NULL;
+
+    PhAcquireQueuedLockShared(&PhpProcessInformationSnapshotLock);
+
+    if (snapshot = PhProcessInformationSnapshot)
+        PhReferenceObject(snapshot);
+
+    PhReleaseQueuedLockShared(&PhpProcessInformationSnapshotLock);
+
+    return snapshot;
+}
+
+/**
+ * Finds the information for a process in a snapshot.
+ *
+ * \param Snapshot A process information snapshot.
+ * \param ProcessId The ID of the process.
+ *
+ * \return The process information, or NULL if the process was not found.
+ */
+PSYSTEM_PROCESS_INFORMATION PhFindProcessInformationSnapshot(
+    _In_ PPH_PROCESS_INFORMATION_SNAPSHOT Snapshot,
+    _In_ HANDLE ProcessId
+    )
+{
+    PH_PROCESS_INFORMATION_SNAPSHOT_ENTRY lookupEntry;
+    PPH_PROCESS_INFORMATION_SNAPSHOT_ENTRY entry;
+
+    lookupEntry.ProcessId = ProcessId;
+    entry = bsearch(
+        &lookupEntry,
+        Snapshot->Entries,
+        Snapshot->NumberOfProcesses,
+        sizeof(PH_PROCESS_INFORMATION_SNAPSHOT_ENTRY),
+        PhpProcessInformationSnapshotEntryCompare
+        );
+
+    return entry ? entry->Process : NULL;
+}
+
+/**
+ * Releases the snapshot from two updates ago, before its buffer is reused.
+ */
+VOID PhpRetireProcessInformationSnapshot(
+    VOID
+    )
+{
+    PPH_PROCESS_INFORMATION_SNAPSHOT snapshot;
+
+    if (!(snapshot = PhpPreviousProcessInformationSnapshot))
+        return;
+
+    PhpPreviousProcessInformationSnapshot = NULL;
+
+    // The snapshot is no longer published, so the reference count can only go down. If
+    // someone else is still using it, give it the buffer and let the process snapshot
+    // allocate a new one.
+    if (!PhProviderDataSource && PhReferenceObjectEx(snapshot, 0) > 1)
+    {
+        if (PhDetachProcessSnapshotBuffer(&PhpProcessSnapshot, snapshot->Processes))
+            snapshot->OwnsBuffer = TRUE;
+    }
+
+    PhDereferenceObject(snapshot);
+}
+
+/**
+ * Resolves the user names of all new processes in a snapshot with a single LSA request, so that
+ * PhpFillProcessItem finds them in the SID cache.
+ */
+VOID PhpLookupNewProcessUserNames(
+    _In_ PVOID Processes
+    )
+{
+    PSYSTEM_PROCESS_INFORMATION process;
+    PPH_LIST tokenUsers = NULL;
+    PSID *sids;
+    ULONG i;
+
+    process = PH_FIRST_PROCESS(Processes);
+
+    do
+    {
+        HANDLE processHandle;
+        HANDLE tokenHandle;
+        PTOKEN_USER user;
+
+        if (process->UniqueProcessId == SYSTEM_IDLE_PROCESS_ID || process->UniqueProcessId == SYSTEM_PROCESS_ID)
+            continue;
+        if (PhpLookupProcessItem(process->UniqueProcessId))
+            continue;
+
+        if (NT_SUCCESS(PhOpenProcess(&processHandle, ProcessQueryAccess, process->UniqueProcessId)))
+        {
+            if (NT_SUCCESS(PhOpenProcessToken(&tokenHandle, TOKEN_QUERY, processHandle)))
+            {
+                if (NT_SUCCESS(PhGetTokenUser(tokenHandle, &user)))
+                {
+                    if (!tokenUsers)
+                        tokenUsers = PhCreateList(32);
+
+                    PhAddItemList(tokenUsers, user);
+                }
+
+                NtClose(tokenHandle);
+            }
+
+            NtClose(processHandle);
+        }
+    } while (process = PH_NEXT_PROCESS(process));
+
+    if (!tokenUsers)
+        return;
+
+    sids = PhAllocate(tokenUsers->Count * sizeof(PSID));
+
+    for (i = 0; i < tokenUsers->Count; i++)
+        sids[i] = ((PTOKEN_USER)tokenUsers->Items[i])->User.Sid;
+
+    PhLookupSidsToCache(tokenUsers->Count, sids);
+    PhFree(sids);
+
+    for (i = 0; i < tokenUsers->Count; i++)
+        PhFree(tokenUsers->Items[i]);
+
+    PhDereferenceObject(tokenUsers);
+}
+
+VOID PhpFillProcessItem(
+    _Inout_ PPH_PROCESS_ITEM ProcessItem,
+    _In_ PSYSTEM_PROCESS_INFORMATION Process
+    )
+{
+    NTSTATUS status;
     HANDLE processHandle = NULL;
 
     ProcessItem->ParentProcessId = Process->InheritedFromUniqueProcessId;
     ProcessItem->SessionId = Process->SessionId;
     ProcessItem->CreateTime = Process->CreateTime;
 
+    // Names, file names and user names are shared by many processes, so we intern them.
     if (ProcessItem->ProcessId != SYSTEM_IDLE_PROCESS_ID)
-        ProcessItem->ProcessName = PhCreateStringFromUnicodeString(&Process->ImageName);
+    {
+        PH_STRINGREF processName;
+
+        PhUnicodeStringToStringRef(&Process->ImageName, &processName);
+        ProcessItem->ProcessName = PhInternStringRef(&processName);
+    }
     else
+    {
         ProcessItem->ProcessName = PhCreateString(SYSTEM_IDLE_PROCESS_NAME);
+    }
 
     PhPrintUInt32(ProcessItem->ParentProcessIdString, HandleToUlong(ProcessItem->ParentProcessId));
     PhPrintUInt32(ProcessItem->SessionIdString, ProcessItem->SessionId);
@@ -1301,6 +2544,9 @@ VOID PhpFillProcessItem(
                 PhDereferenceObject(fileName);
             }
         }
+
+        if (ProcessItem->FileName)
+            PhMoveReference(&ProcessItem->FileName, PhInternString(ProcessItem->FileName));
     }
 
     // Token-related information
@@ -1371,121 +2617,608 @@ VOID PhpFillProcessItem(
         }
     }
 
+    if (ProcessItem->UserName)
+        PhMoveReference(&ProcessItem->UserName, PhInternString(ProcessItem->UserName));
+
     NtClose(processHandle);
 }
 
-FORCEINLINE VOID PhpUpdateDynamicInfoProcessItem(
+/**
+ * Updates the fields of a process item that are supplied directly by the process snapshot.
+ *
+ * \return A combination of PH_PROCESS_CHANGE_* flags describing the fields that changed.
+ */
+FORCEINLINE ULONG PhpUpdateDynamicInfoProcessItem(
     _Inout_ PPH_PROCESS_ITEM ProcessItem,
     _In_ PSYSTEM_PROCESS_INFORMATION Process
     )
 {
-    ProcessItem->BasePriority = Process->BasePriority;
+    ULONG changes = 0;
+    ULONG priorityClass = 0;
+    PVM_COUNTERS_EX vmCounters;
+    PIO_COUNTERS ioCounters;
 
     if (ProcessItem->QueryHandle)
     {
-        PROCESS_PRIORITY_CLASS priorityClass;
+        PROCESS_PRIORITY_CLASS processPriorityClass;
+
+        priorityClass = ProcessItem->PriorityClass;
 
         if (NT_SUCCESS(NtQueryInformationProcess(
             ProcessItem->QueryHandle,
             ProcessPriorityClass,
-            &priorityClass,
+            &processPriorityClass,
             sizeof(PROCESS_PRIORITY_CLASS),
             NULL
             )))
         {
-            ProcessItem->PriorityClass = priorityClass.PriorityClass;
+            priorityClass = processPriorityClass.PriorityClass;
         }
     }
-    else
+
+    if (ProcessItem->BasePriority != Process->BasePriority || ProcessItem->PriorityClass != priorityClass)
+    {
+        ProcessItem->BasePriority = Process->BasePriority;
+        ProcessItem->PriorityClass = priorityClass;
+        changes |= PH_PROCESS_CHANGE_PRIORITY;
+    }
+
+    if (ProcessItem->KernelTime.QuadPart != Process->KernelTime.QuadPart ||
+        ProcessItem->UserTime.QuadPart != Process->UserTime.QuadPart)
+    {
+        ProcessItem->KernelTime = Process->KernelTime;
+        ProcessItem->UserTime = Process->UserTime;
+        changes |= PH_PROCESS_CHANGE_CPUTIME;
+    }
+
+    if (ProcessItem->NumberOfHandles != Process->HandleCount)
     {
-        ProcessItem->PriorityClass = 0;
+        ProcessItem->NumberOfHandles = Process->HandleCount;
+        changes |= PH_PROCESS_CHANGE_HANDLES;
     }
 
-    ProcessItem->KernelTime = Process->KernelTime;
-    ProcessItem->UserTime = Process->UserTime;
-    ProcessItem->NumberOfHandles = Process->HandleCount;
-    ProcessItem->NumberOfThreads = Process->NumberOfThreads;
-    ProcessItem->WorkingSetPrivateSize = (SIZE_T)Process->WorkingSetPrivateSize.QuadPart;
-    ProcessItem->PeakNumberOfThreads = Process->NumberOfThreadsHighWatermark;
-    ProcessItem->HardFaultCount = Process->HardFaultCount;
+    if (ProcessItem->NumberOfThreads != Process->NumberOfThreads ||
+        ProcessItem->PeakNumberOfThreads != Process->NumberOfThreadsHighWatermark)
+    {
+        ProcessItem->NumberOfThreads = Process->NumberOfThreads;
+        ProcessItem->PeakNumberOfThreads = Process->NumberOfThreadsHighWatermark;
+        changes |= PH_PROCESS_CHANGE_THREADS;
+    }
 
     // Update VM and I/O counters.
-    ProcessItem->VmCounters = *(PVM_COUNTERS_EX)&Process->PeakVirtualSize;
-    ProcessItem->IoCounters = *(PIO_COUNTERS)&Process->ReadOperationCount;
+
+    vmCounters = (PVM_COUNTERS_EX)&Process->PeakVirtualSize;
+    ioCounters = (PIO_COUNTERS)&Process->ReadOperationCount;
+
+    if (ProcessItem->VmCounters.PageFaultCount != vmCounters->PageFaultCount ||
+        ProcessItem->HardFaultCount != Process->HardFaultCount)
+    {
+        ProcessItem->VmCounters.PageFaultCount = vmCounters->PageFaultCount;
+        ProcessItem->HardFaultCount = Process->HardFaultCount;
+        changes |= PH_PROCESS_CHANGE_PAGEFAULTS;
+    }
+
+    // The page fault count is already equal at this point, so this only detects changes to
+    // the other counters.
+    if (!RtlEqualMemory(&ProcessItem->VmCounters, vmCounters, sizeof(VM_COUNTERS_EX)) ||
+        ProcessItem->WorkingSetPrivateSize != (SIZE_T)Process->WorkingSetPrivateSize.QuadPart)
+    {
+        ProcessItem->VmCounters = *vmCounters;
+        ProcessItem->WorkingSetPrivateSize = (SIZE_T)Process->WorkingSetPrivateSize.QuadPart;
+        changes |= PH_PROCESS_CHANGE_MEMORY;
+    }
+
+    if (!RtlEqualMemory(&ProcessItem->IoCounters, ioCounters, sizeof(IO_COUNTERS)))
+    {
+        ProcessItem->IoCounters = *ioCounters;
+        changes |= PH_PROCESS_CHANGE_IO;
+    }
+
+    return changes;
 }
 
-VOID PhpUpdatePerfInformation(
-    VOID
+static PSYSTEM_PROCESS_INFORMATION PhpNextProcessForUpdate(
+    _In_ PSYSTEM_PROCESS_INFORMATION Process,
+    _In_ BOOLEAN IsCycleCpuUsageEnabled
     )
 {
-    NtQuerySystemInformation(
-        SystemPerformanceInformation,
-        &PhPerfInformation,
-        sizeof(SYSTEM_PERFORMANCE_INFORMATION),
-        NULL
-        );
+    // Trick ourselves into thinking that the fake processes
+    // are on the list.
+    if (Process == &PhInterruptsProcessInformation)
+    {
+        return NULL;
+    }
+    else if (Process == &PhDpcsProcessInformation)
+    {
+        return &PhInterruptsProcessInformation;
+    }
+    else
+    {
+        Process = PH_NEXT_PROCESS(Process);
 
-    PhUpdateDelta(&PhIoReadDelta, PhPerfInformation.IoReadTransferCount.QuadPart);
-    PhUpdateDelta(&PhIoWriteDelta, PhPerfInformation.IoWriteTransferCount.QuadPart);
-    PhUpdateDelta(&PhIoOtherDelta, PhPerfInformation.IoOtherTransferCount.QuadPart);
+        if (Process == NULL)
+        {
+            if (IsCycleCpuUsageEnabled)
+                Process = &PhInterruptsProcessInformation;
+            else
+                Process = &PhDpcsProcessInformation;
+        }
+
+        return Process;
+    }
 }
 
-VOID PhpUpdateCpuInformation(
-    _In_ BOOLEAN SetCpuUsage,
-    _Out_ PULONG64 TotalTime
+static VOID PhpResizeProcessMetricsTable(
+    _Inout_ PPH_PROCESS_METRICS_TABLE Table,
+    _In_ ULONG Count
     )
 {
+    ULONG allocatedCount;
+    PVOID buffer;
     ULONG i;
-    ULONG64 totalTime;
 
-    NtQuerySystemInformation(
-        SystemProcessorPerformanceInformation,
-        PhCpuInformation,
-        sizeof(SYSTEM_PROCESSOR_PERFORMANCE_INFORMATION) * (ULONG)PhSystemBasicInformation.NumberOfProcessors,
-        NULL
+    if (Count <= Table->AllocatedCount)
+        return;
+
+    allocatedCount = PhRoundUpToPowerOfTwo(max(Count, 256));
+
+    // The 64-bit arrays come first so that they are all aligned.
+    buffer = PhAllocate(
+        sizeof(ULONG64) * PhMaxProcessMetric * 2 * allocatedCount +
+        sizeof(PPH_PROCESS_ITEM) * allocatedCount +
+        sizeof(FLOAT) * 3 * allocatedCount
         );
 
-    // Zero the CPU totals.
-    memset(&PhCpuTotals, 0, sizeof(SYSTEM_PROCESSOR_PERFORMANCE_INFORMATION));
+    if (Table->Buffer)
+        PhFree(Table->Buffer);
 
-    for (i = 0; i < (ULONG)PhSystemBasicInformation.NumberOfProcessors; i++)
+    Table->Buffer = buffer;
+    Table->AllocatedCount = allocatedCount;
+
+    for (i = 0; i < PhMaxProcessMetric; i++)
     {
-        PSYSTEM_PROCESSOR_PERFORMANCE_INFORMATION cpuInfo =
-            &PhCpuInformation[i];
+        Table->Values[i] = buffer;
+        buffer = PTR_ADD_OFFSET(buffer, sizeof(ULONG64) * allocatedCount);
+        Table->Deltas[i] = buffer;
+        buffer = PTR_ADD_OFFSET(buffer, sizeof(ULONG64) * allocatedCount);
+    }
 
-        // KernelTime includes idle time.
-        cpuInfo->KernelTime.QuadPart -= cpuInfo->IdleTime.QuadPart;
-        cpuInfo->KernelTime.QuadPart += cpuInfo->DpcTime.QuadPart + cpuInfo->InterruptTime.QuadPart;
+    Table->Items = buffer;
+    buffer = PTR_ADD_OFFSET(buffer, sizeof(PPH_PROCESS_ITEM) * allocatedCount);
+    Table->CpuUsage = buffer;
+    buffer = PTR_ADD_OFFSET(buffer, sizeof(FLOAT) * allocatedCount);
+    Table->CpuKernelUsage = buffer;
+    buffer = PTR_ADD_OFFSET(buffer, sizeof(FLOAT) * allocatedCount);
+    Table->CpuUserUsage = buffer;
+}
 
-        PhCpuTotals.DpcTime.QuadPart += cpuInfo->DpcTime.QuadPart;
-        PhCpuTotals.IdleTime.QuadPart += cpuInfo->IdleTime.QuadPart;
-        PhCpuTotals.InterruptCount += cpuInfo->InterruptCount;
-        PhCpuTotals.InterruptTime.QuadPart += cpuInfo->InterruptTime.QuadPart;
-        PhCpuTotals.KernelTime.QuadPart += cpuInfo->KernelTime.QuadPart;
-        PhCpuTotals.UserTime.QuadPart += cpuInfo->UserTime.QuadPart;
+static VOID PhpGatherProcessMetrics(
+    _Inout_ PPH_PROCESS_METRICS_TABLE Table,
+    _In_ PVOID Processes,
+    _In_ BOOLEAN IsCycleCpuUsageEnabled
+    )
+{
+    PSYSTEM_PROCESS_INFORMATION process;
+    ULONG i;
 
-        PhUpdateDelta(&PhCpusKernelDelta[i], cpuInfo->KernelTime.QuadPart);
-        PhUpdateDelta(&PhCpusUserDelta[i], cpuInfo->UserTime.QuadPart);
-        PhUpdateDelta(&PhCpusIdleDelta[i], cpuInfo->IdleTime.QuadPart);
+    // The fake processes are visited as well, so leave room for them.
+    PhpResizeProcessMetricsTable(Table, PhTotalProcesses + 2);
 
-        if (SetCpuUsage)
-        {
-            totalTime = PhCpusKernelDelta[i].Delta + PhCpusUserDelta[i].Delta + PhCpusIdleDelta[i].Delta;
+    Table->Count = 0;
+    Table->IdleIndex = ULONG_MAX;
 
-            if (totalTime != 0)
-            {
-                PhCpusKernelUsage[i] = (FLOAT)PhCpusKernelDelta[i].Delta / totalTime;
-                PhCpusUserUsage[i] = (FLOAT)PhCpusUserDelta[i].Delta / totalTime;
-            }
-            else
-            {
-                PhCpusKernelUsage[i] = 0;
-                PhCpusUserUsage[i] = 0;
-            }
+    // This must visit the processes in the same order as the main update pass, and take the
+    // same existing process items. Processes without an item get one during that pass and are
+    // not in the table.
+    process = PH_FIRST_PROCESS(Processes);
+
+    while (process)
+    {
+        PPH_PROCESS_ITEM processItem;
+
+        if (processItem = PhpLookupProcessItem(process->UniqueProcessId))
+        {
+            i = Table->Count++;
+
+            Table->Items[i] = processItem;
+
+            if (processItem->ProcessId == NULL)
+                Table->IdleIndex = i;
+
+            Table->Values[PhProcessMetricKernelTime][i] = process->KernelTime.QuadPart;
+            Table->Values[PhProcessMetricUserTime][i] = process->UserTime.QuadPart;
+            Table->Values[PhProcessMetricCycleTime][i] = process->CycleTime;
+            Table->Values[PhProcessMetricIoRead][i] = process->ReadTransferCount.QuadPart;
+            Table->Values[PhProcessMetricIoWrite][i] = process->WriteTransferCount.QuadPart;
+            Table->Values[PhProcessMetricIoOther][i] = process->OtherTransferCount.QuadPart;
+            Table->Values[PhProcessMetricIoReadCount][i] = process->ReadOperationCount.QuadPart;
+            Table->Values[PhProcessMetricIoWriteCount][i] = process->WriteOperationCount.QuadPart;
+            Table->Values[PhProcessMetricIoOtherCount][i] = process->OtherOperationCount.QuadPart;
+            Table->Values[PhProcessMetricPrivateBytes][i] = process->PagefileUsage;
+
+            Table->Deltas[PhProcessMetricKernelTime][i] = processItem->CpuKernelDelta.Value;
+            Table->Deltas[PhProcessMetricUserTime][i] = processItem->CpuUserDelta.Value;
+            Table->Deltas[PhProcessMetricCycleTime][i] = processItem->CycleTimeDelta.Value;
+            Table->Deltas[PhProcessMetricIoRead][i] = processItem->IoReadDelta.Value;
+            Table->Deltas[PhProcessMetricIoWrite][i] = processItem->IoWriteDelta.Value;
+            Table->Deltas[PhProcessMetricIoOther][i] = processItem->IoOtherDelta.Value;
+            Table->Deltas[PhProcessMetricIoReadCount][i] = processItem->IoReadCountDelta.Value;
+            Table->Deltas[PhProcessMetricIoWriteCount][i] = processItem->IoWriteCountDelta.Value;
+            Table->Deltas[PhProcessMetricIoOtherCount][i] = processItem->IoOtherCountDelta.Value;
+            Table->Deltas[PhProcessMetricPrivateBytes][i] = processItem->PrivateBytesDelta.Value;
         }
+
+        process = PhpNextProcessForUpdate(process, IsCycleCpuUsageEnabled);
     }
+}
 
-    PhUpdateDelta(&PhCpuKernelDelta, PhCpuTotals.KernelTime.QuadPart);
+static VOID PhpComputeProcessMetricsPartition(
+    _Inout_ PPH_PROCESS_METRICS_PARTITION Partition
+    )
+{
+    PPH_PROCESS_METRICS_TABLE table = Partition->Table;
+    ULONG startIndex = Partition->StartIndex;
+    ULONG endIndex = Partition->EndIndex;
+    ULONG64 sysTotalTime = Partition->SysTotalTime;
+    ULONG64 sysTotalCycleTime = Partition->SysTotalCycleTime;
+    PULONG64 kernelDeltas = table->Deltas[PhProcessMetricKernelTime];
+    PULONG64 userDeltas = table->Deltas[PhProcessMetricUserTime];
+    PULONG64 userTimes = table->Values[PhProcessMetricUserTime];
+    PULONG64 cycleDeltas = table->Deltas[PhProcessMetricCycleTime];
+    PULONG64 ioReadDeltas = table->Deltas[PhProcessMetricIoRead];
+    PULONG64 ioWriteDeltas = table->Deltas[PhProcessMetricIoWrite];
+    PULONG64 ioOtherDeltas = table->Deltas[PhProcessMetricIoOther];
+    PULONG64 privateBytes = table->Values[PhProcessMetricPrivateBytes];
+    PFLOAT cpuUsage = table->CpuUsage;
+    PFLOAT cpuKernelUsage = table->CpuKernelUsage;
+    PFLOAT cpuUserUsage = table->CpuUserUsage;
+    ULONG i;
+    ULONG j;
+
+    for (j = 0; j < PhMaxProcessMetric; j++)
+    {
+        PULONG64 values = table->Values[j];
+        PULONG64 deltas = table->Deltas[j];
+
+        for (i = startIndex; i < endIndex; i++)
+            deltas[i] = values[i] - deltas[i];
+    }
+
+    if (Partition->IsCycleCpuUsageEnabled)
+    {
+        for (i = startIndex; i < endIndex; i++)
+        {
+            FLOAT newCpuUsage;
+            FLOAT totalDelta;
+
+            newCpuUsage = (FLOAT)cycleDeltas[i] / sysTotalCycleTime;
+
+            // Calculate the kernel/user CPU usage based on the kernel/user time. If the kernel and
+            // user deltas are both zero, we'll just have to use an estimate. Currently, we split
+            // the CPU usage evenly across the kernel and user components, except when the total
+            // user time is zero, in which case we assign it all to the kernel component.
+
+            totalDelta = (FLOAT)(kernelDeltas[i] + userDeltas[i]);
+
+            if (totalDelta != 0)
+            {
+                cpuKernelUsage[i] = newCpuUsage * ((FLOAT)kernelDeltas[i] / totalDelta);
+                cpuUserUsage[i] = newCpuUsage * ((FLOAT)userDeltas[i] / totalDelta);
+            }
+            else if (userTimes[i] != 0)
+            {
+                cpuKernelUsage[i] = newCpuUsage / 2;
+                cpuUserUsage[i] = newCpuUsage / 2;
+            }
+            else
+            {
+                cpuKernelUsage[i] = newCpuUsage;
+                cpuUserUsage[i] = 0;
+            }
+
+            cpuUsage[i] = newCpuUsage;
+        }
+    }
+    else
+    {
+        for (i = startIndex; i < endIndex; i++)
+        {
+            cpuKernelUsage[i] = (FLOAT)kernelDeltas[i] / sysTotalTime;
+            cpuUserUsage[i] = (FLOAT)userDeltas[i] / sysTotalTime;
+            cpuUsage[i] = cpuKernelUsage[i] + cpuUserUsage[i];
+        }
+    }
+
+    // Max. values. The first process wins a tie. I/O for Other is not included because it is
+    // too generic.
+
+    Partition->MaxCpuValue = 0;
+    Partition->MaxCpuIndex = ULONG_MAX;
+    Partition->MaxIoValue = 0;
+    Partition->MaxIoIndex = ULONG_MAX;
+
+    for (i = startIndex; i < endIndex; i++)
+    {
+        if (i == table->IdleIndex)
+            continue;
+
+        if (Partition->MaxCpuValue < cpuUsage[i])
+        {
+            Partition->MaxCpuValue = cpuUsage[i];
+            Partition->MaxCpuIndex = i;
+        }
+
+        if (Partition->MaxIoValue < ioReadDeltas[i] + ioWriteDeltas[i])
+        {
+            Partition->MaxIoValue = ioReadDeltas[i] + ioWriteDeltas[i];
+            Partition->MaxIoIndex = i;
+        }
+    }
+
+    // History. Each buffer is only written by the partition that owns the process item, and
+    // nothing else writes to it until the provider thread has waited for all partitions.
+
+    for (i = startIndex; i < endIndex; i++)
+    {
+        PPH_PROCESS_ITEM processItem = table->Items[i];
+
+        PhAddItemCircularBuffer_ULONG64(&processItem->IoReadHistory, ioReadDeltas[i]);
+        PhAddItemCircularBuffer_ULONG64(&processItem->IoWriteHistory, ioWriteDeltas[i]);
+        PhAddItemCircularBuffer_ULONG64(&processItem->IoOtherHistory, ioOtherDeltas[i]);
+        PhAddItemCircularBuffer_SIZE_T(&processItem->PrivateBytesHistory, (SIZE_T)privateBytes[i]);
+        PhAddItemCircularBuffer_FLOAT(&processItem->CpuKernelHistory, cpuKernelUsage[i]);
+        PhAddItemCircularBuffer_FLOAT(&processItem->CpuUserHistory, cpuUserUsage[i]);
+
+        if (processItem->CompressedHistory)
+        {
+            PhAddItemCompressedCircularBuffer(&processItem->CompressedHistory[ProcessIoReadHistory], ioReadDeltas[i]);
+            PhAddItemCompressedCircularBuffer(&processItem->CompressedHistory[ProcessIoWriteHistory], ioWriteDeltas[i]);
+            PhAddItemCompressedCircularBuffer(&processItem->CompressedHistory[ProcessIoOtherHistory], ioOtherDeltas[i]);
+            PhAddItemCompressedCircularBuffer(&processItem->CompressedHistory[ProcessPrivateBytesHistory], privateBytes[i]);
+            PhAddFloatItemCompressedCircularBuffer(&processItem->CompressedHistory[ProcessCpuKernelHistory], cpuKernelUsage[i]);
+            PhAddFloatItemCompressedCircularBuffer(&processItem->CompressedHistory[ProcessCpuUserHistory], cpuUserUsage[i]);
+        }
+    }
+}
+
+static NTSTATUS PhpComputeProcessMetricsWorker(
+    _In_ PVOID Parameter
+    )
+{
+    PPH_PROCESS_METRICS_PARTITION partition = Parameter;
+
+    PhpComputeProcessMetricsPartition(partition);
+
+    if (_InterlockedDecrement(partition->RemainingCount) == 0)
+        PhSetEvent(partition->CompletedEvent);
+
+    return STATUS_SUCCESS;
+}
+
+static VOID PhpComputeProcessMetrics(
+    _Inout_ PPH_PROCESS_METRICS_TABLE Table,
+    _In_ BOOLEAN IsCycleCpuUsageEnabled,
+    _In_ ULONG64 SysTotalTime,
+    _In_ ULONG64 SysTotalCycleTime
+    )
+{
+    static BOOLEAN workQueueInitialized = FALSE;
+    static PH_WORK_QUEUE workQueue;
+    // This is not on the stack because the last worker may still be inside PhSetEvent after
+    // we have woken up and returned.
+    static PH_EVENT completedEvent;
+
+    PH_PROCESS_METRICS_PARTITION partitions[PH_PROCESS_METRICS_MAXIMUM_PARTITIONS];
+    ULONG numberOfPartitions;
+    ULONG partitionSize;
+    volatile LONG remainingCount;
+    FLOAT maxCpuValue;
+    ULONG64 maxIoValue;
+    ULONG i;
+
+    // Small tables are not worth the cost of waking up other threads.
+    numberOfPartitions = Table->Count / PH_PROCESS_METRICS_PARTITION_SIZE;
+    numberOfPartitions = min(numberOfPartitions, PhSystemBasicInformation.NumberOfProcessors);
+    numberOfPartitions = min(numberOfPartitions, PH_PROCESS_METRICS_MAXIMUM_PARTITIONS);
+
+    if (numberOfPartitions == 0)
+        numberOfPartitions = 1;
+
+    partitionSize = (Table->Count + numberOfPartitions - 1) / numberOfPartitions;
+
+    for (i = 0; i < numberOfPartitions; i++)
+    {
+        partitions[i].Table = Table;
+        partitions[i].StartIndex = min(i * partitionSize, Table->Count);
+        partitions[i].EndIndex = min((i + 1) * partitionSize, Table->Count);
+        partitions[i].IsCycleCpuUsageEnabled = IsCycleCpuUsageEnabled;
+        partitions[i].SysTotalTime = SysTotalTime;
+        partitions[i].SysTotalCycleTime = SysTotalCycleTime;
+        partitions[i].RemainingCount = &remainingCount;
+        partitions[i].CompletedEvent = &completedEvent;
+    }
+
+    if (numberOfPartitions > 1)
+    {
+        if (!workQueueInitialized)
+        {
+            PhInitializeWorkQueue(&workQueue, 0, PH_PROCESS_METRICS_MAXIMUM_PARTITIONS - 1, 1000);
+            workQueueInitialized = TRUE;
+        }
+
+        remainingCount = numberOfPartitions - 1;
+        PhInitializeEvent(&completedEvent);
+
+        for (i = 1; i < numberOfPartitions; i++)
+            PhQueueItemWorkQueue(&workQueue, PhpComputeProcessMetricsWorker, &partitions[i]);
+
+        // The provider thread takes the first partition itself.
+        PhpComputeProcessMetricsPartition(&partitions[0]);
+        PhWaitForEvent(&completedEvent, NULL);
+    }
+    else
+    {
+        PhpComputeProcessMetricsPartition(&partitions[0]);
+    }
+
+    // Merge the maximums in partition order, so that the result does not depend on which
+    // partition finished first.
+
+    maxCpuValue = 0;
+    maxIoValue = 0;
+    Table->MaxCpuIndex = ULONG_MAX;
+    Table->MaxIoIndex = ULONG_MAX;
+
+    for (i = 0; i < numberOfPartitions; i++)
+    {
+        if (partitions[i].MaxCpuIndex != ULONG_MAX && maxCpuValue < partitions[i].MaxCpuValue)
+        {
+            maxCpuValue = partitions[i].MaxCpuValue;
+            Table->MaxCpuIndex = partitions[i].MaxCpuIndex;
+        }
+
+        if (partitions[i].MaxIoIndex != ULONG_MAX && maxIoValue < partitions[i].MaxIoValue)
+        {
+            maxIoValue = partitions[i].MaxIoValue;
+            Table->MaxIoIndex = partitions[i].MaxIoIndex;
+        }
+    }
+}
+
+FORCEINLINE VOID PhpStoreProcessMetrics(
+    _In_ PPH_PROCESS_METRICS_TABLE Table,
+    _In_ ULONG Index,
+    _Inout_ PPH_PROCESS_ITEM ProcessItem
+    )
+{
+#define PH_STORE_PROCESS_METRIC(Delta, Metric, Type) \
+    ((Delta).Value = (Type)Table->Values[Metric][Index], (Delta).Delta = (Type)Table->Deltas[Metric][Index])
+
+    PH_STORE_PROCESS_METRIC(ProcessItem->CpuKernelDelta, PhProcessMetricKernelTime, ULONG64);
+    PH_STORE_PROCESS_METRIC(ProcessItem->CpuUserDelta, PhProcessMetricUserTime, ULONG64);
+    PH_STORE_PROCESS_METRIC(ProcessItem->CycleTimeDelta, PhProcessMetricCycleTime, ULONG64);
+    PH_STORE_PROCESS_METRIC(ProcessItem->IoReadDelta, PhProcessMetricIoRead, ULONG64);
+    PH_STORE_PROCESS_METRIC(ProcessItem->IoWriteDelta, PhProcessMetricIoWrite, ULONG64);
+    PH_STORE_PROCESS_METRIC(ProcessItem->IoOtherDelta, PhProcessMetricIoOther, ULONG64);
+    PH_STORE_PROCESS_METRIC(ProcessItem->IoReadCountDelta, PhProcessMetricIoReadCount, ULONG64);
+    PH_STORE_PROCESS_METRIC(ProcessItem->IoWriteCountDelta, PhProcessMetricIoWriteCount, ULONG64);
+    PH_STORE_PROCESS_METRIC(ProcessItem->IoOtherCountDelta, PhProcessMetricIoOtherCount, ULONG64);
+    PH_STORE_PROCESS_METRIC(ProcessItem->PrivateBytesDelta, PhProcessMetricPrivateBytes, ULONG_PTR);
+
+#undef PH_STORE_PROCESS_METRIC
+}
+
+VOID PhpUpdatePerfInformation(
+    VOID
+    )
+{
+    NtQuerySystemInformation(
+        SystemPerformanceInformation,
+        &PhPerfInformation,
+        sizeof(SYSTEM_PERFORMANCE_INFORMATION),
+        NULL
+        );
+
+    PhUpdateDelta(&PhIoReadDelta, PhPerfInformation.IoReadTransferCount.QuadPart);
+    PhUpdateDelta(&PhIoWriteDelta, PhPerfInformation.IoWriteTransferCount.QuadPart);
+    PhUpdateDelta(&PhIoOtherDelta, PhPerfInformation.IoOtherTransferCount.QuadPart);
+}
+
+VOID PhpUpdateCpusUsage(
+    VOID
+    )
+{
+    ULONG numberOfCpus = PhNumberOfCpus;
+    PPH_UINT64_DELTA kernelDelta = PhCpusKernelDelta;
+    PPH_UINT64_DELTA userDelta = PhCpusUserDelta;
+    PPH_UINT64_DELTA idleDelta = PhCpusIdleDelta;
+    PFLOAT kernelUsage = PhCpusKernelUsage;
+    PFLOAT userUsage = PhCpusUserUsage;
+    ULONG i;
+
+    // This loop has no branches on the common path and writes the usage arrays
+    // sequentially, which keeps it cheap even on machines with hundreds of CPUs.
+    for (i = 0; i < numberOfCpus; i++)
+    {
+        ULONG64 totalTime;
+        FLOAT scale;
+
+        totalTime = kernelDelta[i].Delta + userDelta[i].Delta + idleDelta[i].Delta;
+        scale = totalTime != 0 ? 1 / (FLOAT)totalTime : 0;
+        kernelUsage[i] = (FLOAT)kernelDelta[i].Delta * scale;
+        userUsage[i] = (FLOAT)userDelta[i].Delta * scale;
+    }
+
+    // NUMA node aggregates
+    {
+        PULONG64 nodeKernel = PhpNumaNodesTotals;
+        PULONG64 nodeUser = nodeKernel + PhNumberOfNumaNodes;
+        PULONG64 nodeTotal = nodeUser + PhNumberOfNumaNodes;
+
+        memset(PhpNumaNodesTotals, 0, sizeof(ULONG64) * PhNumberOfNumaNodes * 3);
+
+        for (i = 0; i < numberOfCpus; i++)
+        {
+            USHORT node = PhCpuNumaNodes[i];
+
+            nodeKernel[node] += kernelDelta[i].Delta;
+            nodeUser[node] += userDelta[i].Delta;
+            nodeTotal[node] += kernelDelta[i].Delta + userDelta[i].Delta + idleDelta[i].Delta;
+        }
+
+        for (i = 0; i < PhNumberOfNumaNodes; i++)
+        {
+            FLOAT scale;
+
+            scale = nodeTotal[i] != 0 ? 1 / (FLOAT)nodeTotal[i] : 0;
+            PhNumaNodesKernelUsage[i] = (FLOAT)nodeKernel[i] * scale;
+            PhNumaNodesUserUsage[i] = (FLOAT)nodeUser[i] * scale;
+        }
+    }
+}
+
+VOID PhpUpdateCpuInformation(
+    _In_ BOOLEAN SetCpuUsage,
+    _Out_ PULONG64 TotalTime
+    )
+{
+    ULONG i;
+    ULONG64 totalTime;
+
+    PhQueryCpuInformation(
+        SystemProcessorPerformanceInformation,
+        PhCpuInformation,
+        sizeof(SYSTEM_PROCESSOR_PERFORMANCE_INFORMATION)
+        );
+
+    // Zero the CPU totals.
+    memset(&PhCpuTotals, 0, sizeof(SYSTEM_PROCESSOR_PERFORMANCE_INFORMATION));
+
+    for (i = 0; i < PhNumberOfCpus; i++)
+    {
+        PSYSTEM_PROCESSOR_PERFORMANCE_INFORMATION cpuInfo =
+            &PhCpuInformation[i];
+
+        // KernelTime includes idle time.
+        cpuInfo->KernelTime.QuadPart -= cpuInfo->IdleTime.QuadPart;
+        cpuInfo->KernelTime.QuadPart += cpuInfo->DpcTime.QuadPart + cpuInfo->InterruptTime.QuadPart;
+
+        PhCpuTotals.DpcTime.QuadPart += cpuInfo->DpcTime.QuadPart;
+        PhCpuTotals.IdleTime.QuadPart += cpuInfo->IdleTime.QuadPart;
+        PhCpuTotals.InterruptCount += cpuInfo->InterruptCount;
+        PhCpuTotals.InterruptTime.QuadPart += cpuInfo->InterruptTime.QuadPart;
+        PhCpuTotals.KernelTime.QuadPart += cpuInfo->KernelTime.QuadPart;
+        PhCpuTotals.UserTime.QuadPart += cpuInfo->UserTime.QuadPart;
+
+        PhUpdateDelta(&PhCpusKernelDelta[i], cpuInfo->KernelTime.QuadPart);
+        PhUpdateDelta(&PhCpusUserDelta[i], cpuInfo->UserTime.QuadPart);
+        PhUpdateDelta(&PhCpusIdleDelta[i], cpuInfo->IdleTime.QuadPart);
+    }
+
+    if (SetCpuUsage)
+        PhpUpdateCpusUsage();
+
+    PhUpdateDelta(&PhCpuKernelDelta, PhCpuTotals.KernelTime.QuadPart);
     PhUpdateDelta(&PhCpuUserDelta, PhCpuTotals.UserTime.QuadPart);
     PhUpdateDelta(&PhCpuIdleDelta, PhCpuTotals.IdleTime.QuadPart);
 
@@ -1519,16 +3252,15 @@ VOID PhpUpdateCpuCycleInformation(
     // We need to query this separately because the idle cycle time in SYSTEM_PROCESS_INFORMATION
     // doesn't give us data for individual processors.
 
-    NtQuerySystemInformation(
+    PhQueryCpuInformation(
         SystemProcessorIdleCycleTimeInformation,
         PhCpuIdleCycleTime,
-        sizeof(LARGE_INTEGER) * (ULONG)PhSystemBasicInformation.NumberOfProcessors,
-        NULL
+        sizeof(LARGE_INTEGER)
         );
 
     total = 0;
 
-    for (i = 0; i < (ULONG)PhSystemBasicInformation.NumberOfProcessors; i++)
+    for (i = 0; i < PhNumberOfCpus; i++)
     {
         //PhUpdateDelta(&PhCpusIdleCycleDelta[i], PhCpuIdleCycleTime[i].QuadPart);
         total += PhCpuIdleCycleTime[i].QuadPart;
@@ -1539,16 +3271,15 @@ VOID PhpUpdateCpuCycleInformation(
 
     // System
 
-    NtQuerySystemInformation(
+    PhQueryCpuInformation(
         SystemProcessorCycleTimeInformation,
         PhCpuSystemCycleTime,
-        sizeof(LARGE_INTEGER) * (ULONG)PhSystemBasicInformation.NumberOfProcessors,
-        NULL
+        sizeof(LARGE_INTEGER)
         );
 
     total = 0;
 
-    for (i = 0; i < (ULONG)PhSystemBasicInformation.NumberOfProcessors; i++)
+    for (i = 0; i < PhNumberOfCpus; i++)
     {
         total += PhCpuSystemCycleTime[i].QuadPart;
     }
@@ -1561,10 +3292,8 @@ VOID PhpUpdateCpuCycleUsageInformation(
     _In_ ULONG64 IdleCycleTime
     )
 {
-    ULONG i;
     FLOAT baseCpuUsage;
     FLOAT totalTimeDelta;
-    ULONG64 totalTime;
 
     // Cycle time is not only lacking for kernel/user components, but also for individual
     // processors. We can get the total idle cycle time for individual processors but
@@ -1610,21 +3339,7 @@ VOID PhpUpdateCpuCycleUsageInformation(
         PhCpuUserUsage = baseCpuUsage / 2;
     }
 
-    for (i = 0; i < (ULONG)PhSystemBasicInformation.NumberOfProcessors; i++)
-    {
-        totalTime = PhCpusKernelDelta[i].Delta + PhCpusUserDelta[i].Delta + PhCpusIdleDelta[i].Delta;
-
-        if (totalTime != 0)
-        {
-            PhCpusKernelUsage[i] = (FLOAT)PhCpusKernelDelta[i].Delta / totalTime;
-            PhCpusUserUsage[i] = (FLOAT)PhCpusUserDelta[i].Delta / totalTime;
-        }
-        else
-        {
-            PhCpusKernelUsage[i] = 0;
-            PhCpusUserUsage[i] = 0;
-        }
-    }
+    PhpUpdateCpusUsage();
 }
 
 VOID PhpInitializeProcessStatistics(
@@ -1633,27 +3348,35 @@ VOID PhpInitializeProcessStatistics(
 {
     ULONG i;
 
-    PhInitializeCircularBuffer_ULONG(&PhTimeHistory, PhStatisticsSampleCount);
-    PhInitializeCircularBuffer_FLOAT(&PhCpuKernelHistory, PhStatisticsSampleCount);
-    PhInitializeCircularBuffer_FLOAT(&PhCpuUserHistory, PhStatisticsSampleCount);
-    PhInitializeCircularBuffer_ULONG64(&PhIoReadHistory, PhStatisticsSampleCount);
-    PhInitializeCircularBuffer_ULONG64(&PhIoWriteHistory, PhStatisticsSampleCount);
-    PhInitializeCircularBuffer_ULONG64(&PhIoOtherHistory, PhStatisticsSampleCount);
-    PhInitializeCircularBuffer_ULONG(&PhCommitHistory, PhStatisticsSampleCount);
-    PhInitializeCircularBuffer_ULONG(&PhPhysicalHistory, PhStatisticsSampleCount);
-    PhInitializeCircularBuffer_ULONG(&PhMaxCpuHistory, PhStatisticsSampleCount);
-    PhInitializeCircularBuffer_ULONG(&PhMaxIoHistory, PhStatisticsSampleCount);
+    PhInitializeCircularBufferEx_ULONG(&PhTimeHistory, PhStatisticsSampleCount, &PhpProcessProviderArena);
+    PhInitializeCircularBufferEx_FLOAT(&PhCpuKernelHistory, PhStatisticsSampleCount, &PhpProcessProviderArena);
+    PhInitializeCircularBufferEx_FLOAT(&PhCpuUserHistory, PhStatisticsSampleCount, &PhpProcessProviderArena);
+    PhInitializeCircularBufferEx_ULONG64(&PhIoReadHistory, PhStatisticsSampleCount, &PhpProcessProviderArena);
+    PhInitializeCircularBufferEx_ULONG64(&PhIoWriteHistory, PhStatisticsSampleCount, &PhpProcessProviderArena);
+    PhInitializeCircularBufferEx_ULONG64(&PhIoOtherHistory, PhStatisticsSampleCount, &PhpProcessProviderArena);
+    PhInitializeCircularBufferEx_ULONG(&PhCommitHistory, PhStatisticsSampleCount, &PhpProcessProviderArena);
+    PhInitializeCircularBufferEx_ULONG(&PhPhysicalHistory, PhStatisticsSampleCount, &PhpProcessProviderArena);
+    PhInitializeCircularBufferEx_ULONG(&PhMaxCpuHistory, PhStatisticsSampleCount, &PhpProcessProviderArena);
+    PhInitializeCircularBufferEx_ULONG(&PhMaxIoHistory, PhStatisticsSampleCount, &PhpProcessProviderArena);
 #ifdef PH_RECORD_MAX_USAGE
-    PhInitializeCircularBuffer_FLOAT(&PhMaxCpuUsageHistory, PhStatisticsSampleCount);
-    PhInitializeCircularBuffer_ULONG64(&PhMaxIoReadOtherHistory, PhStatisticsSampleCount);
-    PhInitializeCircularBuffer_ULONG64(&PhMaxIoWriteHistory, PhStatisticsSampleCount);
+    PhInitializeCircularBufferEx_FLOAT(&PhMaxCpuUsageHistory, PhStatisticsSampleCount, &PhpProcessProviderArena);
+    PhInitializeCircularBufferEx_ULONG64(&PhMaxIoReadOtherHistory, PhStatisticsSampleCount, &PhpProcessProviderArena);
+    PhInitializeCircularBufferEx_ULONG64(&PhMaxIoWriteHistory, PhStatisticsSampleCount, &PhpProcessProviderArena);
 #endif
 
-    for (i = 0; i < (ULONG)PhSystemBasicInformation.NumberOfProcessors; i++)
+    for (i = 0; i < PhNumberOfCpus; i++)
     {
-        PhInitializeCircularBuffer_FLOAT(&PhCpusKernelHistory[i], PhStatisticsSampleCount);
-        PhInitializeCircularBuffer_FLOAT(&PhCpusUserHistory[i], PhStatisticsSampleCount);
+        PhInitializeCircularBuffer_FLOAT(&PhCpusKernelHistory[i], 1);
+        PhInitializeCircularBuffer_FLOAT(&PhCpusUserHistory[i], 1);
     }
+
+    PhCpusHistory.Size = PhRoundUpToPowerOfTwo(PhStatisticsSampleCount);
+    PhCpusHistory.SizeMinusOne = PhCpusHistory.Size - 1;
+    PhCpusHistory.Count = 0;
+    PhCpusHistory.Index = 0;
+    PhCpusHistory.NumberOfCpus = PhNumberOfCpus;
+    PhCpusHistory.RowLength = (PhCpusHistory.NumberOfCpus * 2 + 15) & ~15;
+    PhCpusHistory.Data = PhAllocateArena(&PhpProcessProviderArena, sizeof(FLOAT) * PhCpusHistory.RowLength * PhCpusHistory.Size, NULL);
 }
 
 VOID PhpUpdateSystemHistory(
@@ -1661,6 +3384,7 @@ VOID PhpUpdateSystemHistory(
     )
 {
     ULONG i;
+    PFLOAT row;
     LARGE_INTEGER systemTime;
     ULONG secondsSince1980;
 
@@ -1669,7 +3393,15 @@ VOID PhpUpdateSystemHistory(
     PhAddItemCircularBuffer_FLOAT(&PhCpuUserHistory, PhCpuUserUsage);
 
     // CPUs
-    for (i = 0; i < (ULONG)PhSystemBasicInformation.NumberOfProcessors; i++)
+    PhCpusHistory.Index = (PhCpusHistory.Index - 1) & PhCpusHistory.SizeMinusOne;
+    row = PhGetCpusHistoryRow(0);
+    memcpy(row, PhCpusKernelUsage, sizeof(FLOAT) * PhCpusHistory.NumberOfCpus);
+    memcpy(row + PhCpusHistory.NumberOfCpus, PhCpusUserUsage, sizeof(FLOAT) * PhCpusHistory.NumberOfCpus);
+
+    if (PhCpusHistory.Count < PhCpusHistory.Size)
+        PhCpusHistory.Count++;
+
+    for (i = 0; i < PhNumberOfCpus; i++)
     {
         PhAddItemCircularBuffer_FLOAT(&PhCpusKernelHistory[i], PhCpusKernelUsage[i]);
         PhAddItemCircularBuffer_FLOAT(&PhCpusUserHistory[i], PhCpusUserUsage[i]);
@@ -1760,6 +3492,336 @@ PPH_STRING PhGetStatisticsTimeString(
     }
 }
 
+// System graph series are cached for the two most recently requested sizes, since the I/O
+// series is scaled to the maximum of the samples that are shown. This covers the main window
+// toolbar graphs and the system information window at the same time.
+#define PH_SYSTEM_GRAPH_SERIES_SLOTS 2
+
+typedef struct _PH_SYSTEM_GRAPH_SERIES_SLOT
+{
+    BOOLEAN Valid;
+    ULONG SequenceNumber;
+    ULONG Count;
+    ULONG AllocatedCount;
+    PFLOAT Data1;
+    PFLOAT Data2;
+} PH_SYSTEM_GRAPH_SERIES_SLOT, *PPH_SYSTEM_GRAPH_SERIES_SLOT;
+
+static PH_SYSTEM_GRAPH_SERIES_SLOT PhpSystemGraphSeriesSlots[SystemGraphSeriesMaximum][PH_SYSTEM_GRAPH_SERIES_SLOTS];
+static ULONG PhpSystemGraphSeriesNextSlot[SystemGraphSeriesMaximum];
+
+static VOID PhpComputeSystemGraphSeries(
+    _In_ PH_SYSTEM_GRAPH_SERIES Series,
+    _Inout_ PPH_SYSTEM_GRAPH_SERIES_SLOT Slot
+    )
+{
+    ULONG count = Slot->Count;
+    ULONG i;
+
+    switch (Series)
+    {
+    case SystemGraphCpuSeries:
+        PhCopyCircularBuffer_FLOAT(&PhCpuKernelHistory, Slot->Data1, count);
+        PhCopyCircularBuffer_FLOAT(&PhCpuUserHistory, Slot->Data2, count);
+        break;
+    case SystemGraphPhysicalSeries:
+        for (i = 0; i < count; i++)
+            Slot->Data1[i] = (FLOAT)PhGetItemCircularBuffer_ULONG(&PhPhysicalHistory, i);
+
+        if (PhSystemBasicInformation.NumberOfPhysicalPages != 0)
+            PhDivideSinglesBySingle(Slot->Data1, (FLOAT)PhSystemBasicInformation.NumberOfPhysicalPages, count);
+
+        break;
+    case SystemGraphCommitSeries:
+        for (i = 0; i < count; i++)
+            Slot->Data1[i] = (FLOAT)PhGetItemCircularBuffer_ULONG(&PhCommitHistory, i);
+
+        if (PhPerfInformation.CommitLimit != 0)
+            PhDivideSinglesBySingle(Slot->Data1, (FLOAT)PhPerfInformation.CommitLimit, count);
+
+        break;
+    case SystemGraphIoSeries:
+        {
+            FLOAT max = 0;
+
+            for (i = 0; i < count; i++)
+            {
+                FLOAT data1;
+                FLOAT data2;
+
+                Slot->Data1[i] = data1 =
+                    (FLOAT)PhGetItemCircularBuffer_ULONG64(&PhIoReadHistory, i) +
+                    (FLOAT)PhGetItemCircularBuffer_ULONG64(&PhIoOtherHistory, i);
+                Slot->Data2[i] = data2 =
+                    (FLOAT)PhGetItemCircularBuffer_ULONG64(&PhIoWriteHistory, i);
+
+                if (max < data1 + data2)
+                    max = data1 + data2;
+            }
+
+            // Minimum scaling of 1 MB.
+            if (max < 1024 * 1024)
+                max = 1024 * 1024;
+
+            PhDivideSinglesBySingle(Slot->Data1, max, count);
+            PhDivideSinglesBySingle(Slot->Data2, max, count);
+        }
+        break;
+    }
+}
+
+/**
+ * Gets the scaled data for a system graph, starting with the latest sample.
+ *
+ * \param Series The series.
+ * \param Count The number of samples to get. This must not be greater than the number of
+ * samples in the underlying history.
+ * \param Data1 A buffer which receives the first line of the series.
+ * \param Data2 A buffer which receives the second line of the series, if it has one.
+ *
+ * \remarks The series are computed at most once per update for each size, and shared by
+ * every graph that shows them. This function must only be called from the main thread.
+ */
+VOID PhGetSystemGraphSeries(
+    _In_ PH_SYSTEM_GRAPH_SERIES Series,
+    _In_ ULONG Count,
+    _Out_writes_(Count) PFLOAT Data1,
+    _Out_writes_opt_(Count) PFLOAT Data2
+    )
+{
+    PPH_SYSTEM_GRAPH_SERIES_SLOT slot = NULL;
+    ULONG i;
+
+    if (Series >= SystemGraphSeriesMaximum || Count == 0)
+        return;
+
+    for (i = 0; i < PH_SYSTEM_GRAPH_SERIES_SLOTS; i++)
+    {
+        if (PhpSystemGraphSeriesSlots[Series][i].Valid && PhpSystemGraphSeriesSlots[Series][i].Count == Count)
+        {
+            slot = &PhpSystemGraphSeriesSlots[Series][i];
+            break;
+        }
+    }
+
+    if (!slot)
+    {
+        slot = &PhpSystemGraphSeriesSlots[Series][PhpSystemGraphSeriesNextSlot[Series]];
+        PhpSystemGraphSeriesNextSlot[Series] = (PhpSystemGraphSeriesNextSlot[Series] + 1) % PH_SYSTEM_GRAPH_SERIES_SLOTS;
+
+        if (slot->AllocatedCount < Count)
+        {
+            if (slot->Data1) PhFree(slot->Data1);
+            if (slot->Data2) PhFree(slot->Data2);
+
+            slot->AllocatedCount = Count;
+            slot->Data1 = PhAllocate(sizeof(FLOAT) * Count);
+            slot->Data2 = PhAllocate(sizeof(FLOAT) * Count);
+        }
+
+        slot->Count = Count;
+        slot->Valid = FALSE;
+    }
+
+    if (!slot->Valid || slot->SequenceNumber != PhTimeSequenceNumber)
+    {
+        PhpComputeSystemGraphSeries(Series, slot);
+        slot->SequenceNumber = PhTimeSequenceNumber;
+        slot->Valid = TRUE;
+    }
+
+    memcpy(Data1, slot->Data1, sizeof(FLOAT) * Count);
+
+    if (Data2)
+        memcpy(Data2, slot->Data2, sizeof(FLOAT) * Count);
+}
+
+/**
+ * Copies the usage history of a CPU, starting with the latest sample.
+ *
+ * \param Cpu The index of the CPU.
+ * \param KernelDestination A buffer which receives the kernel usage.
+ * \param UserDestination A buffer which receives the user usage.
+ * \param Count The number of samples to copy.
+ */
+VOID PhCopyCpuHistory(
+    _In_ ULONG Cpu,
+    _Out_writes_(Count) PFLOAT KernelDestination,
+    _Out_writes_(Count) PFLOAT UserDestination,
+    _In_ ULONG Count
+    )
+{
+    ULONG i;
+
+    if (Count > PhCpusHistory.Count)
+        Count = PhCpusHistory.Count;
+
+    for (i = 0; i < Count; i++)
+    {
+        PFLOAT row = PhGetCpusHistoryRow(i);
+
+        KernelDestination[i] = row[Cpu];
+        UserDestination[i] = row[PhCpusHistory.NumberOfCpus + Cpu];
+    }
+}
+
+/**
+ * Gets the number of samples in a process history.
+ *
+ * \param ProcessItem A process item.
+ * \param Type The history.
+ */
+ULONG PhGetProcessItemHistoryCount(
+    _In_ PPH_PROCESS_ITEM ProcessItem,
+    _In_ PH_PROCESS_HISTORY_TYPE Type
+    )
+{
+    if (ProcessItem->CompressedHistory)
+        return ProcessItem->CompressedHistory[Type].Count;
+
+    switch (Type)
+    {
+    case ProcessCpuKernelHistory:
+        return ProcessItem->CpuKernelHistory.Count;
+    case ProcessCpuUserHistory:
+        return ProcessItem->CpuUserHistory.Count;
+    case ProcessIoReadHistory:
+        return ProcessItem->IoReadHistory.Count;
+    case ProcessIoWriteHistory:
+        return ProcessItem->IoWriteHistory.Count;
+    case ProcessIoOtherHistory:
+        return ProcessItem->IoOtherHistory.Count;
+    case ProcessPrivateBytesHistory:
+        return ProcessItem->PrivateBytesHistory.Count;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * Gets a sample from an I/O or private bytes history.
+ *
+ * \param ProcessItem A process item.
+ * \param Type The history.
+ * \param Index The index of the sample. Sample 0 is the latest.
+ */
+ULONG64 PhGetProcessItemHistoryInteger(
+    _In_ PPH_PROCESS_ITEM ProcessItem,
+    _In_ PH_PROCESS_HISTORY_TYPE Type,
+    _In_ ULONG Index
+    )
+{
+    if (ProcessItem->CompressedHistory)
+        return PhGetItemCompressedCircularBuffer(&ProcessItem->CompressedHistory[Type], Index);
+
+    switch (Type)
+    {
+    case ProcessIoReadHistory:
+        return PhGetItemCircularBuffer_ULONG64(&ProcessItem->IoReadHistory, Index);
+    case ProcessIoWriteHistory:
+        return PhGetItemCircularBuffer_ULONG64(&ProcessItem->IoWriteHistory, Index);
+    case ProcessIoOtherHistory:
+        return PhGetItemCircularBuffer_ULONG64(&ProcessItem->IoOtherHistory, Index);
+    case ProcessPrivateBytesHistory:
+        return PhGetItemCircularBuffer_SIZE_T(&ProcessItem->PrivateBytesHistory, Index);
+    default:
+        return 0;
+    }
+}
+
+/**
+ * Gets a sample from a process history as a floating-point value.
+ *
+ * \param ProcessItem A process item.
+ * \param Type The history.
+ * \param Index The index of the sample. Sample 0 is the latest.
+ */
+FLOAT PhGetProcessItemHistoryFloat(
+    _In_ PPH_PROCESS_ITEM ProcessItem,
+    _In_ PH_PROCESS_HISTORY_TYPE Type,
+    _In_ ULONG Index
+    )
+{
+    if (Type == ProcessCpuKernelHistory || Type == ProcessCpuUserHistory)
+    {
+        if (ProcessItem->CompressedHistory)
+            return PhGetFloatItemCompressedCircularBuffer(&ProcessItem->CompressedHistory[Type], Index);
+
+        if (Type == ProcessCpuKernelHistory)
+            return PhGetItemCircularBuffer_FLOAT(&ProcessItem->CpuKernelHistory, Index);
+        else
+            return PhGetItemCircularBuffer_FLOAT(&ProcessItem->CpuUserHistory, Index);
+    }
+
+    return (FLOAT)PhGetProcessItemHistoryInteger(ProcessItem, Type, Index);
+}
+
+/**
+ * Copies samples from a process history as floating-point values, starting with
+ * the latest sample.
+ *
+ * \param ProcessItem A process item.
+ * \param Type The history.
+ * \param Destination A buffer which receives the samples.
+ * \param Count The number of samples to copy.
+ */
+VOID PhCopyProcessItemHistory(
+    _In_ PPH_PROCESS_ITEM ProcessItem,
+    _In_ PH_PROCESS_HISTORY_TYPE Type,
+    _Out_writes_(Count) PFLOAT Destination,
+    _In_ ULONG Count
+    )
+{
+    BOOLEAN isFloat;
+    ULONG i;
+
+    isFloat = Type == ProcessCpuKernelHistory || Type == ProcessCpuUserHistory;
+
+    if (ProcessItem->CompressedHistory)
+    {
+        PPH_COMPRESSED_CIRCULAR_BUFFER buffer = &ProcessItem->CompressedHistory[Type];
+        PULONG64 values;
+
+        if (Count > buffer->Count)
+            Count = buffer->Count;
+
+        if (Count == 0)
+            return;
+
+        // Decode the chunks sequentially instead of looking up each sample.
+        values = PhAllocate(sizeof(ULONG64) * Count);
+        PhCopyCompressedCircularBuffer(buffer, values, Count);
+
+        for (i = 0; i < Count; i++)
+        {
+            if (isFloat)
+            {
+                ULONG value = (ULONG)values[i];
+                Destination[i] = *(PFLOAT)&value;
+            }
+            else
+            {
+                Destination[i] = (FLOAT)values[i];
+            }
+        }
+
+        PhFree(values);
+    }
+    else if (Type == ProcessCpuKernelHistory)
+    {
+        PhCopyCircularBuffer_FLOAT(&ProcessItem->CpuKernelHistory, Destination, Count);
+    }
+    else if (Type == ProcessCpuUserHistory)
+    {
+        PhCopyCircularBuffer_FLOAT(&ProcessItem->CpuUserHistory, Destination, Count);
+    }
+    else
+    {
+        for (i = 0; i < Count; i++)
+            Destination[i] = (FLOAT)PhGetProcessItemHistoryInteger(ProcessItem, Type, i);
+    }
+}
+
 VOID PhFlushProcessQueryData(
     _In_ BOOLEAN SendModifiedEvent
     )
@@ -1782,7 +3844,6 @@ VOID PhFlushProcessQueryData(
         if (data->Stage == 1)
         {
             PhpFillProcessItemStage1((PPH_PROCESS_QUERY_S1_DATA)data);
-            PhSetEvent(&data->ProcessItem->Stage1Event);
             processed = TRUE;
         }
         else if (data->Stage == 2)
@@ -1811,48 +3872,342 @@ VOID PhFlushProcessQueryData(
             }
         }
 
-        PhDereferenceObject(data->ProcessItem);
-        PhFree(data);
+        PhDereferenceObject(data->ProcessItem);
+        PhFree(data);
+    }
+}
+
+VOID PhpGetProcessThreadInformation(
+    _In_ PSYSTEM_PROCESS_INFORMATION Process,
+    _Out_opt_ PBOOLEAN IsSuspended,
+    _Out_opt_ PBOOLEAN IsPartiallySuspended,
+    _Out_opt_ PULONG ContextSwitches
+    )
+{
+    ULONG i;
+    BOOLEAN isSuspended;
+    BOOLEAN isPartiallySuspended;
+    ULONG contextSwitches;
+
+    isSuspended = PH_IS_REAL_PROCESS_ID(Process->UniqueProcessId);
+    isPartiallySuspended = FALSE;
+    contextSwitches = 0;
+
+    for (i = 0; i < Process->NumberOfThreads; i++)
+    {
+        if (Process->Threads[i].ThreadState != Waiting ||
+            Process->Threads[i].WaitReason != Suspended)
+        {
+            isSuspended = FALSE;
+        }
+        else
+        {
+            isPartiallySuspended = TRUE;
+        }
+
+        contextSwitches += Process->Threads[i].ContextSwitches;
+    }
+
+    if (IsSuspended)
+        *IsSuspended = isSuspended;
+    if (IsPartiallySuspended)
+        *IsPartiallySuspended = isPartiallySuspended;
+    if (ContextSwitches)
+        *ContextSwitches = contextSwitches;
+}
+
+VOID PhpClearPendingProcesses(
+    VOID
+    )
+{
+    ULONG enumerationKey;
+    PPH_KEY_VALUE_PAIR entry;
+    PPH_SHORT_LIVED_PROCESS pendingProcess;
+
+    if (!PhpPendingProcessHashtable)
+        return;
+
+    enumerationKey = 0;
+
+    while (PhEnumHashtable(PhpPendingProcessHashtable, &entry, &enumerationKey))
+    {
+        pendingProcess = entry->Value;
+        PhClearReference(&pendingProcess->ProcessName);
+        PhFree(pendingProcess);
+    }
+
+    PhClearHashtable(PhpPendingProcessHashtable);
+}
+
+/**
+ * Starts tracking a process that may exit before the next snapshot.
+ *
+ * \param ProcessId The ID of the process.
+ * \param ParentProcessId The ID of the parent process.
+ * \param CreateTime The creation time of the process.
+ * \param ProcessName The name of the process. The function takes ownership of the
+ * reference.
+ */
+VOID PhpAddPendingProcess(
+    _In_ HANDLE ProcessId,
+    _In_ HANDLE ParentProcessId,
+    _In_ PLARGE_INTEGER CreateTime,
+    _In_opt_ _Assume_refs_(1) PPH_STRING ProcessName
+    )
+{
+    PPH_SHORT_LIVED_PROCESS pendingProcess;
+
+    if (!PhpPendingProcessHashtable)
+        PhpPendingProcessHashtable = PhCreateSimpleHashtable(64);
+
+    // Both KProcessHacker and a plugin may report the same process.
+    if (PhFindItemSimpleHashtable(PhpPendingProcessHashtable, ProcessId))
+    {
+        if (ProcessName)
+            PhDereferenceObject(ProcessName);
+
+        return;
+    }
+
+    pendingProcess = PhAllocate(sizeof(PH_SHORT_LIVED_PROCESS));
+    pendingProcess->ProcessId = ProcessId;
+    pendingProcess->ParentProcessId = ParentProcessId;
+    pendingProcess->CreateTime = *CreateTime;
+    pendingProcess->ExitTime.QuadPart = 0;
+    pendingProcess->ProcessName = ProcessName;
+
+    PhAddItemSimpleHashtable(PhpPendingProcessHashtable, ProcessId, pendingProcess);
+}
+
+/**
+ * Creates a dead process record for a process that was never seen in a snapshot, so that
+ * the process can still be found by PhFindProcessRecord.
+ */
+VOID PhpAddShortLivedProcessRecord(
+    _In_ PPH_SHORT_LIVED_PROCESS ShortLivedProcess
+    )
+{
+    PPH_PROCESS_RECORD processRecord;
+
+    processRecord = PhAllocate(sizeof(PH_PROCESS_RECORD));
+    memset(processRecord, 0, sizeof(PH_PROCESS_RECORD));
+
+    InitializeListHead(&processRecord->ListEntry);
+    InitializeListHead(&processRecord->DeadListEntry);
+    processRecord->RefCount = 1;
+    // There is no process item to hold the initial reference, so it is released when the
+    // record is purged.
+    processRecord->Flags = PH_PROCESS_RECORD_STAT_REF;
+
+    processRecord->ProcessId = ShortLivedProcess->ProcessId;
+    processRecord->ParentProcessId = ShortLivedProcess->ParentProcessId;
+    processRecord->CreateTime = ShortLivedProcess->CreateTime;
+
+    if (ShortLivedProcess->ProcessName)
+        PhSetReference(&processRecord->ProcessName, ShortLivedProcess->ProcessName);
+    else
+        processRecord->ProcessName = PhReferenceEmptyString();
+
+    PhpAddProcessRecord(processRecord);
+    PhpMarkProcessRecordDead(processRecord, &ShortLivedProcess->ExitTime);
+}
+
+/**
+ * Stops tracking a process that has exited.
+ *
+ * \param PidIndex The index of processes in the current snapshot.
+ * \param ProcessId The ID of the process.
+ * \param ExitTime The exit time of the process.
+ */
+VOID PhpCompletePendingProcess(
+    _In_ PPH_PROCESS_ID_INDEX PidIndex,
+    _In_ HANDLE ProcessId,
+    _In_ PLARGE_INTEGER ExitTime
+    )
+{
+    PPH_SHORT_LIVED_PROCESS pendingProcess;
+
+    if (!PhpPendingProcessHashtable)
+        return;
+
+    pendingProcess = PhFindItemSimpleHashtable2(PhpPendingProcessHashtable, ProcessId);
+
+    if (!pendingProcess)
+        return;
+
+    PhRemoveItemSimpleHashtable(PhpPendingProcessHashtable, ProcessId);
+
+    // If the process made it into a snapshot, the normal add and remove events
+    // take care of it.
+    if (!PhpFindProcessIdIndex(PidIndex, ProcessId))
+    {
+        pendingProcess->ExitTime = *ExitTime;
+        PhpAddShortLivedProcessRecord(pendingProcess);
+        PhInvokeCallback(&PhShortLivedProcessEvent, pendingProcess);
+    }
+
+    PhClearReference(&pendingProcess->ProcessName);
+    PhFree(pendingProcess);
+}
+
+/**
+ * Reads process events published by KProcessHacker since the last update.
+ *
+ * \param PidIndex The index of processes in the current snapshot.
+ *
+ * \remarks The snapshot is still the source of truth. Events are only used to find
+ * processes that were created and exited between two snapshots, which would otherwise
+ * never be seen.
+ */
+VOID PhpProcessKphEvents(
+    _In_ PPH_PROCESS_ID_INDEX PidIndex
+    )
+{
+    NTSTATUS status;
+    KPH_EVENT event;
+
+    if (!PhpKphEventRing)
+    {
+        if (PhpKphEventRingAttempted || !KphIsConnected())
+            return;
+
+        PhpKphEventRingAttempted = TRUE;
+
+        if (!NT_SUCCESS(KphMapEventRing(&PhpKphEventRing)))
+        {
+            PhpKphEventRing = NULL;
+            return;
+        }
+
+        KphInitializeEventReader(&PhpKphEventReader, PhpKphEventRing);
+    }
+
+    while (TRUE)
+    {
+        status = KphReadEvent(&PhpKphEventReader, &event);
+
+        if (status == STATUS_NO_MORE_ENTRIES)
+            break;
+
+        if (status == STATUS_DATA_OVERRUN)
+        {
+            // Some events were lost, so the pending processes can't be matched reliably.
+            PhpClearPendingProcesses();
+            continue;
+        }
+
+        if (event.Type == KphEventProcessCreate)
+        {
+            event.ImageFileName[sizeof(event.ImageFileName) - 1] = 0;
+
+            PhpAddPendingProcess(
+                event.ProcessId,
+                event.ParentProcessId,
+                &event.Time,
+                PhConvertMultiByteToUtf16(event.ImageFileName)
+                );
+        }
+        else if (event.Type == KphEventProcessExit)
+        {
+            PhpCompletePendingProcess(PidIndex, event.ProcessId, &event.Time);
+        }
+    }
+}
+
+/**
+ * Applies the process hints queued by plugins since the last update.
+ *
+ * \param PidIndex The index of processes in the current snapshot.
+ *
+ * \remarks Hints are treated the same way as KProcessHacker events.
+ */
+VOID PhpProcessProviderHints(
+    _In_ PPH_PROCESS_ID_INDEX PidIndex
+    )
+{
+    PPH_LIST hintList;
+    PPH_PROCESS_PROVIDER_HINT hint;
+    ULONG i;
+
+    PhAcquireQueuedLockExclusive(&PhpProcessHintListLock);
+    hintList = PhpProcessHintList;
+    PhpProcessHintList = NULL;
+    PhReleaseQueuedLockExclusive(&PhpProcessHintListLock);
+
+    if (!hintList)
+        return;
+
+    for (i = 0; i < hintList->Count; i++)
+    {
+        hint = hintList->Items[i];
+
+        if (hint->Type == ProcessProviderHintProcessCreate)
+        {
+            PhpAddPendingProcess(hint->ProcessId, hint->ParentProcessId, &hint->Time, hint->ImageName);
+            hint->ImageName = NULL;
+        }
+        else if (hint->Type == ProcessProviderHintProcessExit)
+        {
+            PhpCompletePendingProcess(PidIndex, hint->ProcessId, &hint->Time);
+        }
+
+        PhClearReference(&hint->ImageName);
+        PhFree(hint);
     }
+
+    PhDereferenceObject(hintList);
 }
 
-VOID PhpGetProcessThreadInformation(
-    _In_ PSYSTEM_PROCESS_INFORMATION Process,
-    _Out_opt_ PBOOLEAN IsSuspended,
-    _Out_opt_ PBOOLEAN IsPartiallySuspended,
-    _Out_opt_ PULONG ContextSwitches
+/**
+ * Stops tracking pending processes which have appeared in the current snapshot.
+ *
+ * \param PidIndex The index of processes in the current snapshot.
+ */
+VOID PhpPrunePendingProcesses(
+    _In_ PPH_PROCESS_ID_INDEX PidIndex
     )
 {
+    PPH_SHORT_LIVED_PROCESS pendingProcess;
+    ULONG enumerationKey;
+    PPH_KEY_VALUE_PAIR entry;
+    PPH_LIST processIdsToRemove;
     ULONG i;
-    BOOLEAN isSuspended;
-    BOOLEAN isPartiallySuspended;
-    ULONG contextSwitches;
 
-    isSuspended = PH_IS_REAL_PROCESS_ID(Process->UniqueProcessId);
-    isPartiallySuspended = FALSE;
-    contextSwitches = 0;
+    if (!PhpPendingProcessHashtable)
+        return;
 
-    for (i = 0; i < Process->NumberOfThreads; i++)
+    // Processes that are in the snapshot no longer need to be tracked.
+
+    processIdsToRemove = NULL;
+    enumerationKey = 0;
+
+    while (PhEnumHashtable(PhpPendingProcessHashtable, &entry, &enumerationKey))
     {
-        if (Process->Threads[i].ThreadState != Waiting ||
-            Process->Threads[i].WaitReason != Suspended)
+        if (PhpFindProcessIdIndex(PidIndex, entry->Key))
         {
-            isSuspended = FALSE;
+            if (!processIdsToRemove)
+                processIdsToRemove = PhCreateList(4);
+
+            PhAddItemList(processIdsToRemove, entry->Key);
         }
-        else
+    }
+
+    if (processIdsToRemove)
+    {
+        for (i = 0; i < processIdsToRemove->Count; i++)
         {
-            isPartiallySuspended = TRUE;
+            pendingProcess = PhFindItemSimpleHashtable2(PhpPendingProcessHashtable, processIdsToRemove->Items[i]);
+            PhRemoveItemSimpleHashtable(PhpPendingProcessHashtable, processIdsToRemove->Items[i]);
+            PhClearReference(&pendingProcess->ProcessName);
+            PhFree(pendingProcess);
         }
 
-        contextSwitches += Process->Threads[i].ContextSwitches;
+        PhDereferenceObject(processIdsToRemove);
     }
 
-    if (IsSuspended)
-        *IsSuspended = isSuspended;
-    if (IsPartiallySuspended)
-        *IsPartiallySuspended = isPartiallySuspended;
-    if (ContextSwitches)
-        *ContextSwitches = contextSwitches;
+    // Exit events can be missed if the ring wraps, so don't let the table grow forever.
+    if (PhpPendingProcessHashtable->Count > 1024)
+        PhpClearPendingProcesses();
 }
 
 VOID PhProcessProviderUpdate(
@@ -1860,7 +4215,8 @@ VOID PhProcessProviderUpdate(
     )
 {
     static ULONG runCount = 0;
-    static PSYSTEM_PROCESS_INFORMATION pidBuckets[PROCESS_ID_BUCKETS];
+    static PH_PROCESS_ID_INDEX pidIndex;
+    static PH_PROCESS_METRICS_TABLE metricsTable;
 
     // Note about locking:
     // Since this is the only function that is allowed to
@@ -1870,31 +4226,37 @@ VOID PhProcessProviderUpdate(
 
     PVOID processes;
     PSYSTEM_PROCESS_INFORMATION process;
-    ULONG bucketIndex;
 
     BOOLEAN isCycleCpuUsageEnabled = FALSE;
 
     ULONG64 sysTotalTime; // total time for this update period
     ULONG64 sysTotalCycleTime = 0; // total cycle time for this update period
     ULONG64 sysIdleCycleTime = 0; // total idle cycle time for this update period
-    FLOAT maxCpuValue = 0;
+    ULONG metricsIndex = 0;
     PPH_PROCESS_ITEM maxCpuProcessItem = NULL;
-    ULONG64 maxIoValue = 0;
     PPH_PROCESS_ITEM maxIoProcessItem = NULL;
 
     // Pre-update tasks
 
-    if (runCount % 5 == 0)
+    // Device arrivals and removals are picked up through WM_DEVICECHANGE. This catches drive
+    // letters that are created without a broadcast (such as subst), and only rebuilds the
+    // prefix table when something has actually changed.
+    if (runCount % 30 == 0)
     {
         PhUpdateDosDevicePrefixes();
     }
 
-    if (runCount % 512 == 0) // yes, a very long time
+    if (runCount % 60 == 59)
     {
-        if (PhEnablePurgeProcessRecords)
-            PhPurgeProcessRecords();
+        PhTrimObjectTypeFreeLists();
+        PhTrimInternedStrings();
     }
 
+    // This only looks at records that have fallen out of the statistics window, so it is
+    // cheap enough to run on every update.
+    if (PhEnablePurgeProcessRecords)
+        PhPurgeProcessRecords();
+
     isCycleCpuUsageEnabled = WindowsVersion >= WINDOWS_7 && PhEnableCycleCpuUsage;
 
     if (!PhProcessStatisticsInitialized)
@@ -1926,8 +4288,20 @@ VOID PhProcessProviderUpdate(
     PhTotalThreads = 0;
     PhTotalHandles = 0;
 
-    if (!NT_SUCCESS(PhEnumProcesses(&processes)))
-        return;
+    // The snapshot keeps the previous buffer alive, so PhProcessInformation stays valid
+    // until it is replaced below.
+    PhpRetireProcessInformationSnapshot();
+
+    if (PhProviderDataSource)
+    {
+        if (!NT_SUCCESS(PhProviderDataSource->QueryProcesses(&processes)))
+            return;
+    }
+    else
+    {
+        if (!NT_SUCCESS(PhUpdateProcessSnapshot(&PhpProcessSnapshot, &processes)))
+            return;
+    }
 
     // Notes on cycle-based CPU usage:
     //
@@ -1950,12 +4324,14 @@ VOID PhProcessProviderUpdate(
     // The second method is used here, but the adjustments must be done before the main new/modified
     // pass. We need take into account new, existing and terminated processes.
 
-    // Create the PID hash set. This contains the process information structures returned by
-    // PhEnumProcesses, distinct from the process item hash set.
-    // Note that we use the UniqueProcessKey field as the next node pointer to avoid having to
-    // allocate extra memory.
+    // Create the PID index. This contains the process information structures returned by
+    // PhEnumProcesses, distinct from the process item index. It is sized from the
+    // previous process count and kept across updates to avoid reallocating.
 
-    memset(pidBuckets, 0, sizeof(pidBuckets));
+    if (!pidIndex.Table)
+        PhpInitializeProcessIdIndex(&pidIndex, PhpProcessItemIndex.Count * 2, FALSE);
+    else
+        PhpResetProcessIdIndex(&pidIndex, PhpProcessItemIndex.Count);
 
     process = PH_FIRST_PROCESS(processes);
 
@@ -1971,9 +4347,7 @@ VOID PhProcessProviderUpdate(
             process->KernelTime = PhCpuTotals.IdleTime;
         }
 
-        bucketIndex = PROCESS_ID_TO_BUCKET_INDEX(process->UniqueProcessId);
-        process->UniqueProcessKey = (ULONG_PTR)pidBuckets[bucketIndex];
-        pidBuckets[bucketIndex] = process;
+        PhpAddProcessIdIndex(&pidIndex, process->UniqueProcessId, process);
 
         if (isCycleCpuUsageEnabled)
         {
@@ -2002,19 +4376,25 @@ VOID PhProcessProviderUpdate(
         PhInterruptsProcessInformation.KernelTime = PhCpuTotals.InterruptTime;
     }
 
+    PhpProcessKphEvents(&pidIndex);
+    PhpProcessProviderHints(&pidIndex);
+    PhpPrunePendingProcesses(&pidIndex);
+
     // Look for dead processes.
     {
         PPH_LIST processesToRemove = NULL;
         ULONG i;
-        PPH_HASH_ENTRY entry;
         PPH_PROCESS_ITEM processItem;
         PSYSTEM_PROCESS_INFORMATION processEntry;
 
-        for (i = 0; i < PH_HASH_SET_SIZE(PhProcessHashSet); i++)
+        // Items are only removed from the index after this scan, so iterating over the
+        // slots directly is safe.
+        for (i = 0; i < PhpProcessItemIndex.Table->AllocatedCount; i++)
         {
-            for (entry = PhProcessHashSet[i]; entry; entry = entry->Next)
+            processItem = PhpProcessItemIndex.Table->Entries[i].Value;
+
+            if (processItem && processItem != PH_PROCESS_ID_INDEX_TOMBSTONE)
             {
-                processItem = CONTAINING_RECORD(entry, PH_PROCESS_ITEM, HashEntry);
 
                 // Check if the process still exists. Note that we take into account PID re-use by
                 // checking CreateTime as well.
@@ -2029,10 +4409,7 @@ VOID PhProcessProviderUpdate(
                 }
                 else
                 {
-                    processEntry = pidBuckets[PROCESS_ID_TO_BUCKET_INDEX(processItem->ProcessId)];
-
-                    while (processEntry && processEntry->UniqueProcessId != processItem->ProcessId)
-                        processEntry = (PSYSTEM_PROCESS_INFORMATION)processEntry->UniqueProcessKey;
+                    processEntry = PhpFindProcessIdIndex(&pidIndex, processItem->ProcessId);
                 }
 
                 if (!processEntry || processEntry->CreateTime.QuadPart != processItem->CreateTime.QuadPart)
@@ -2052,7 +4429,11 @@ VOID PhProcessProviderUpdate(
                             exitTime = times.ExitTime;
                         }
 
-                        if (isCycleCpuUsageEnabled)
+                        // The cycle time of live processes comes straight from the snapshot, so this
+                        // is the only per-process cycle time query. A process that had no threads at the
+                        // last update cannot have consumed any more cycles since then, so its last
+                        // snapshot value is already final.
+                        if (isCycleCpuUsageEnabled && processItem->NumberOfThreads != 0)
                         {
                             if (NT_SUCCESS(PhGetProcessCycleTime(processItem->QueryHandle, &finalCycleTime)))
                             {
@@ -2072,14 +4453,14 @@ VOID PhProcessProviderUpdate(
                     if (exitTime.QuadPart == 0)
                         PhQuerySystemTime(&exitTime);
 
-                    processItem->Record->Flags |= PH_PROCESS_RECORD_DEAD;
-                    processItem->Record->ExitTime = exitTime;
+                    PhpMarkProcessRecordDead(processItem->Record, &exitTime);
 
                     // Raise the process removed event.
                     // See PhFlushProcessQueryData for why we need to lock here.
                     PhAcquireQueuedLockExclusive(&processItem->RemoveLock);
                     PhInvokeCallback(&PhProcessRemovedEvent, processItem);
                     PhReleaseQueuedLockExclusive(&processItem->RemoveLock);
+                    PhAddProviderUpdateBatchItem(&PhpProcessUpdateBatch, PH_PROVIDER_UPDATE_REMOVED, processItem);
 
                     if (!processesToRemove)
                         processesToRemove = PhCreateList(2);
@@ -2089,17 +4470,13 @@ VOID PhProcessProviderUpdate(
             }
         }
 
-        // Lock only if we have something to do.
         if (processesToRemove)
         {
-            PhAcquireQueuedLockExclusive(&PhProcessHashSetLock);
-
             for (i = 0; i < processesToRemove->Count; i++)
             {
                 PhpRemoveProcessItem((PPH_PROCESS_ITEM)processesToRemove->Items[i]);
             }
 
-            PhReleaseQueuedLockExclusive(&PhProcessHashSetLock);
             PhDereferenceObject(processesToRemove);
         }
     }
@@ -2114,6 +4491,18 @@ VOID PhProcessProviderUpdate(
 
     PhCpuTotalCycleDelta = sysTotalCycleTime;
 
+    // Resolving user names one process at a time can take seconds when a domain controller is
+    // slow to respond.
+    PhpLookupNewProcessUserNames(processes);
+
+    PhpGatherProcessMetrics(&metricsTable, processes, isCycleCpuUsageEnabled);
+    PhpComputeProcessMetrics(&metricsTable, isCycleCpuUsageEnabled, sysTotalTime, sysTotalCycleTime);
+
+    if (metricsTable.MaxCpuIndex != ULONG_MAX)
+        maxCpuProcessItem = metricsTable.Items[metricsTable.MaxCpuIndex];
+    if (metricsTable.MaxIoIndex != ULONG_MAX)
+        maxIoProcessItem = metricsTable.Items[metricsTable.MaxIoIndex];
+
     // Look for new processes and update existing ones.
     process = PH_FIRST_PROCESS(processes);
 
@@ -2169,6 +4558,7 @@ VOID PhProcessProviderUpdate(
 
             processItem->IsSuspended = isSuspended;
             processItem->IsPartiallySuspended = isPartiallySuspended;
+            processItem->ChangeMask = PH_PROCESS_CHANGE_ALL;
 
             // If this is the first run of the provider, queue the
             // process query tasks. Otherwise, perform stage 1
@@ -2180,9 +4570,10 @@ VOID PhProcessProviderUpdate(
                 memset(&data, 0, sizeof(PH_PROCESS_QUERY_S1_DATA));
                 data.Header.Stage = 1;
                 data.Header.ProcessItem = processItem;
+                data.Parts = PH_PROCESS_STAGE1_ALL;
                 PhpProcessQueryStage1(&data);
                 PhpFillProcessItemStage1(&data);
-                PhSetEvent(&processItem->Stage1Event);
+                PhpQueueProcessQueryStage2(processItem, FALSE);
             }
             else
             {
@@ -2193,13 +4584,12 @@ VOID PhProcessProviderUpdate(
             PhUpdateProcessItemServices(processItem);
 
             // Add the process item to the hashtable.
-            PhAcquireQueuedLockExclusive(&PhProcessHashSetLock);
             PhpAddProcessItem(processItem);
-            PhReleaseQueuedLockExclusive(&PhProcessHashSetLock);
 
             // Raise the process added event.
             PhInvokeCallback(&PhProcessAddedEvent, processItem);
             processItem->AddedEventSent = TRUE;
+            PhAddProviderUpdateBatchItem(&PhpProcessUpdateBatch, PH_PROVIDER_UPDATE_ADDED, processItem);
 
             // (Ref: for the process item being in the hashtable.)
             // Instead of referencing then dereferencing we simply don't do anything.
@@ -2208,103 +4598,56 @@ VOID PhProcessProviderUpdate(
         else
         {
             BOOLEAN modified = FALSE;
+            ULONG changes;
             BOOLEAN isSuspended;
             BOOLEAN isPartiallySuspended;
             ULONG contextSwitches;
+            ULONG metricsSlot;
             FLOAT newCpuUsage;
             FLOAT kernelCpuUsage;
             FLOAT userCpuUsage;
 
-            PhpGetProcessThreadInformation(process, &isSuspended, &isPartiallySuspended, &contextSwitches);
-            PhpUpdateDynamicInfoProcessItem(processItem, process);
+            metricsSlot = metricsIndex++;
+            assert(metricsTable.Items[metricsSlot] == processItem);
 
-            // Update the deltas.
-            PhUpdateDelta(&processItem->CpuKernelDelta, process->KernelTime.QuadPart);
-            PhUpdateDelta(&processItem->CpuUserDelta, process->UserTime.QuadPart);
-            PhUpdateDelta(&processItem->IoReadDelta, process->ReadTransferCount.QuadPart);
-            PhUpdateDelta(&processItem->IoWriteDelta, process->WriteTransferCount.QuadPart);
-            PhUpdateDelta(&processItem->IoOtherDelta, process->OtherTransferCount.QuadPart);
-            PhUpdateDelta(&processItem->IoReadCountDelta, process->ReadOperationCount.QuadPart);
-            PhUpdateDelta(&processItem->IoWriteCountDelta, process->WriteOperationCount.QuadPart);
-            PhUpdateDelta(&processItem->IoOtherCountDelta, process->OtherOperationCount.QuadPart);
+            PhpGetProcessThreadInformation(process, &isSuspended, &isPartiallySuspended, &contextSwitches);
+            changes = PhpUpdateDynamicInfoProcessItem(processItem, process);
+
+            // Columns showing deltas also change when a counter stops changing.
+            if (processItem->IoReadDelta.Delta != 0 || processItem->IoWriteDelta.Delta != 0 || processItem->IoOtherDelta.Delta != 0 ||
+                processItem->IoReadCountDelta.Delta != 0 || processItem->IoWriteCountDelta.Delta != 0 || processItem->IoOtherCountDelta.Delta != 0)
+                changes |= PH_PROCESS_CHANGE_IO;
+            if (processItem->PageFaultsDelta.Delta != 0)
+                changes |= PH_PROCESS_CHANGE_PAGEFAULTS;
+            if (processItem->PrivateBytesDelta.Delta != 0)
+                changes |= PH_PROCESS_CHANGE_MEMORY;
+            if (processItem->ContextSwitchesDelta.Delta != 0 || processItem->ContextSwitchesDelta.Value != contextSwitches)
+                changes |= PH_PROCESS_CHANGE_CONTEXTSWITCHES;
+            if (processItem->CycleTimeDelta.Delta != 0 || processItem->CycleTimeDelta.Value != process->CycleTime)
+                changes |= PH_PROCESS_CHANGE_CYCLES;
+
+            // Update the deltas. Most of them have already been computed in the metrics table.
+            PhpStoreProcessMetrics(&metricsTable, metricsSlot, processItem);
             PhUpdateDelta(&processItem->ContextSwitchesDelta, contextSwitches);
             PhUpdateDelta(&processItem->PageFaultsDelta, process->PageFaultCount);
-            PhUpdateDelta(&processItem->CycleTimeDelta, process->CycleTime);
-            PhUpdateDelta(&processItem->PrivateBytesDelta, process->PagefileUsage);
 
+            // The history buffers have already been updated by PhpComputeProcessMetrics.
             processItem->SequenceNumber++;
-            PhAddItemCircularBuffer_ULONG64(&processItem->IoReadHistory, processItem->IoReadDelta.Delta);
-            PhAddItemCircularBuffer_ULONG64(&processItem->IoWriteHistory, processItem->IoWriteDelta.Delta);
-            PhAddItemCircularBuffer_ULONG64(&processItem->IoOtherHistory, processItem->IoOtherDelta.Delta);
-
-            PhAddItemCircularBuffer_SIZE_T(&processItem->PrivateBytesHistory, processItem->VmCounters.PagefileUsage);
-            //PhAddItemCircularBuffer_SIZE_T(&processItem->WorkingSetHistory, processItem->VmCounters.WorkingSetSize);
 
             if (InterlockedExchange(&processItem->JustProcessed, 0) != 0)
                 modified = TRUE;
 
-            if (isCycleCpuUsageEnabled)
-            {
-                FLOAT totalDelta;
-
-                newCpuUsage = (FLOAT)processItem->CycleTimeDelta.Delta / sysTotalCycleTime;
-
-                // Calculate the kernel/user CPU usage based on the kernel/user time. If the kernel and
-                // user deltas are both zero, we'll just have to use an estimate. Currently, we split
-                // the CPU usage evenly across the kernel and user components, except when the total
-                // user time is zero, in which case we assign it all to the kernel component.
-
-                totalDelta = (FLOAT)(processItem->CpuKernelDelta.Delta + processItem->CpuUserDelta.Delta);
-
-                if (totalDelta != 0)
-                {
-                    kernelCpuUsage = newCpuUsage * ((FLOAT)processItem->CpuKernelDelta.Delta / totalDelta);
-                    userCpuUsage = newCpuUsage * ((FLOAT)processItem->CpuUserDelta.Delta / totalDelta);
-                }
-                else
-                {
-                    if (processItem->UserTime.QuadPart != 0)
-                    {
-                        kernelCpuUsage = newCpuUsage / 2;
-                        userCpuUsage = newCpuUsage / 2;
-                    }
-                    else
-                    {
-                        kernelCpuUsage = newCpuUsage;
-                        userCpuUsage = 0;
-                    }
-                }
-            }
-            else
-            {
-                kernelCpuUsage = (FLOAT)processItem->CpuKernelDelta.Delta / sysTotalTime;
-                userCpuUsage = (FLOAT)processItem->CpuUserDelta.Delta / sysTotalTime;
-                newCpuUsage = kernelCpuUsage + userCpuUsage;
-            }
-
-            processItem->CpuUsage = newCpuUsage;
-            processItem->CpuKernelUsage = kernelCpuUsage;
-            processItem->CpuUserUsage = userCpuUsage;
-
-            PhAddItemCircularBuffer_FLOAT(&processItem->CpuKernelHistory, kernelCpuUsage);
-            PhAddItemCircularBuffer_FLOAT(&processItem->CpuUserHistory, userCpuUsage);
+            newCpuUsage = metricsTable.CpuUsage[metricsSlot];
+            kernelCpuUsage = metricsTable.CpuKernelUsage[metricsSlot];
+            userCpuUsage = metricsTable.CpuUserUsage[metricsSlot];
 
-            // Max. values
-
-            if (processItem->ProcessId != NULL)
+            if (processItem->CpuUsage != newCpuUsage || processItem->CpuKernelUsage != kernelCpuUsage ||
+                processItem->CpuUserUsage != userCpuUsage)
             {
-                if (maxCpuValue < newCpuUsage)
-                {
-                    maxCpuValue = newCpuUsage;
-                    maxCpuProcessItem = processItem;
-                }
-
-                // I/O for Other is not included because it is too generic.
-                if (maxIoValue < processItem->IoReadDelta.Delta + processItem->IoWriteDelta.Delta)
-                {
-                    maxIoValue = processItem->IoReadDelta.Delta + processItem->IoWriteDelta.Delta;
-                    maxIoProcessItem = processItem;
-                }
+                processItem->CpuUsage = newCpuUsage;
+                processItem->CpuKernelUsage = kernelCpuUsage;
+                processItem->CpuUserUsage = userCpuUsage;
+                changes |= PH_PROCESS_CHANGE_CPU;
             }
 
             // Debugged
@@ -2318,6 +4661,7 @@ VOID PhProcessProviderUpdate(
                     )) && processItem->IsBeingDebugged != isBeingDebugged)
                 {
                     processItem->IsBeingDebugged = isBeingDebugged;
+                    changes |= PH_PROCESS_CHANGE_STATE;
                     modified = TRUE;
                 }
             }
@@ -2326,10 +4670,15 @@ VOID PhProcessProviderUpdate(
             if (processItem->IsSuspended != isSuspended)
             {
                 processItem->IsSuspended = isSuspended;
+                changes |= PH_PROCESS_CHANGE_STATE;
                 modified = TRUE;
             }
 
-            processItem->IsPartiallySuspended = isPartiallySuspended;
+            if (processItem->IsPartiallySuspended != isPartiallySuspended)
+            {
+                processItem->IsPartiallySuspended = isPartiallySuspended;
+                changes |= PH_PROCESS_CHANGE_STATE;
+            }
 
             // .NET
             if (processItem->UpdateIsDotNet)
@@ -2339,6 +4688,7 @@ VOID PhProcessProviderUpdate(
                 if (NT_SUCCESS(PhGetProcessIsDotNet(processItem->ProcessId, &isDotNet)))
                 {
                     processItem->IsDotNet = isDotNet;
+                    changes |= PH_PROCESS_CHANGE_STATE;
                     modified = TRUE;
                 }
 
@@ -2355,47 +4705,40 @@ VOID PhProcessProviderUpdate(
                 if (processItem->IsImmersive != isImmersive)
                 {
                     processItem->IsImmersive = isImmersive;
+                    changes |= PH_PROCESS_CHANGE_STATE;
                     modified = TRUE;
                 }
             }
 
+            processItem->ChangeMask = changes;
+
             if (modified)
             {
                 PhInvokeCallback(&PhProcessModifiedEvent, processItem);
+                PhAddProviderUpdateBatchItem(&PhpProcessUpdateBatch, PH_PROVIDER_UPDATE_MODIFIED, processItem);
             }
 
             // No reference added by PhpLookupProcessItem.
         }
 
-        // Trick ourselves into thinking that the fake processes
-        // are on the list.
-        if (process == &PhInterruptsProcessInformation)
-        {
-            process = NULL;
-        }
-        else if (process == &PhDpcsProcessInformation)
-        {
-            process = &PhInterruptsProcessInformation;
-        }
-        else
-        {
-            process = PH_NEXT_PROCESS(process);
-
-            if (process == NULL)
-            {
-                if (isCycleCpuUsageEnabled)
-                    process = &PhInterruptsProcessInformation;
-                else
-                    process = &PhDpcsProcessInformation;
-            }
-        }
+        process = PhpNextProcessForUpdate(process, isCycleCpuUsageEnabled);
     }
 
-    if (PhProcessInformation)
-        PhFree(PhProcessInformation);
+    PhpUpdateProcessJobIndex(processes);
 
     PhProcessInformation = processes;
 
+    {
+        PPH_PROCESS_INFORMATION_SNAPSHOT snapshot;
+
+        snapshot = PhpCreateProcessInformationSnapshot(processes, runCount);
+
+        PhAcquireQueuedLockExclusive(&PhpProcessInformationSnapshotLock);
+        PhpPreviousProcessInformationSnapshot = PhProcessInformationSnapshot;
+        PhProcessInformationSnapshot = snapshot;
+        PhReleaseQueuedLockExclusive(&PhpProcessInformationSnapshotLock);
+    }
+
     if (PhpTsProcesses)
     {
         WinStationFreeGAPMemory(0, PhpTsProcesses, PhpTsNumberOfProcesses);
@@ -2461,6 +4804,11 @@ VOID PhProcessProviderUpdate(
         }
     }
 
+    PhReclaimEpoch();
+    PhEnforceMemoryBudget();
+    PhUpdateHandleStatistics();
+
+    PhFlushProviderUpdateBatch(&PhpProcessUpdateBatch);
     PhInvokeCallback(&PhProcessesUpdatedEvent, NULL);
     runCount++;
 }
@@ -2475,6 +4823,7 @@ PPH_PROCESS_RECORD PhpCreateProcessRecord(
     memset(processRecord, 0, sizeof(PH_PROCESS_RECORD));
 
     InitializeListHead(&processRecord->ListEntry);
+    InitializeListHead(&processRecord->DeadListEntry);
     processRecord->RefCount = 1;
 
     processRecord->ProcessId = ProcessItem->ProcessId;
@@ -2577,6 +4926,8 @@ VOID PhpAddProcessRecord(
         InsertTailList(&processRecord->ListEntry, &ProcessRecord->ListEntry);
     }
 
+    PhAddElementAvlTree(&PhpProcessRecordIndex, &ProcessRecord->IndexLinks);
+
     PhReleaseQueuedLockExclusive(&PhProcessRecordListLock);
 }
 
@@ -2604,9 +4955,48 @@ VOID PhpRemoveProcessRecord(
             PhProcessRecordList->Items[i] = CONTAINING_RECORD(headProcessRecord->ListEntry.Flink, PH_PROCESS_RECORD, ListEntry);
     }
 
+    PhRemoveElementAvlTree(&PhpProcessRecordIndex, &ProcessRecord->IndexLinks);
+    // This is a no-op if the record is not dead or has already been purged.
+    RemoveEntryList(&ProcessRecord->DeadListEntry);
+
+    PhReleaseQueuedLockExclusive(&PhProcessRecordListLock);
+}
+
+VOID PhpMarkProcessRecordDead(
+    _Inout_ PPH_PROCESS_RECORD ProcessRecord,
+    _In_ PLARGE_INTEGER ExitTime
+    )
+{
+    PhAcquireQueuedLockExclusive(&PhProcessRecordListLock);
+
+    ProcessRecord->Flags |= PH_PROCESS_RECORD_DEAD;
+    ProcessRecord->ExitTime = *ExitTime;
+    InsertTailList(&PhpDeadProcessRecordListHead, &ProcessRecord->DeadListEntry);
+
     PhReleaseQueuedLockExclusive(&PhProcessRecordListLock);
 }
 
+LONG NTAPI PhpProcessRecordIndexCompareFunction(
+    _In_ PPH_AVL_LINKS Links1,
+    _In_ PPH_AVL_LINKS Links2
+    )
+{
+    PPH_PROCESS_RECORD record1 = CONTAINING_RECORD(Links1, PH_PROCESS_RECORD, IndexLinks);
+    PPH_PROCESS_RECORD record2 = CONTAINING_RECORD(Links2, PH_PROCESS_RECORD, IndexLinks);
+    int result;
+
+    result = uintptrcmp((ULONG_PTR)record1->ProcessId, (ULONG_PTR)record2->ProcessId);
+
+    if (result == 0)
+        result = uint64cmp(record1->CreateTime.QuadPart, record2->CreateTime.QuadPart);
+    // Records can share a process ID and creation time (e.g. pseudo-processes), so fall
+    // back to the address to keep every element distinct.
+    if (result == 0)
+        result = uintptrcmp((ULONG_PTR)record1, (ULONG_PTR)record2);
+
+    return result;
+}
+
 VOID PhReferenceProcessRecord(
     _In_ PPH_PROCESS_RECORD ProcessRecord
     )
@@ -2649,23 +5039,37 @@ VOID PhDereferenceProcessRecord(
 }
 
 PPH_PROCESS_RECORD PhpFindProcessRecord(
-    _In_ PPH_PROCESS_RECORD ProcessRecord,
-    _In_ HANDLE ProcessId
+    _In_ HANDLE ProcessId,
+    _In_ PLARGE_INTEGER Time
     )
 {
-    PPH_PROCESS_RECORD startProcessRecord;
+    PPH_AVL_LINKS links;
+    PPH_PROCESS_RECORD processRecord;
+    PPH_PROCESS_RECORD bestProcessRecord = NULL;
 
-    startProcessRecord = ProcessRecord;
+    // Find the last record that is not greater than (ProcessId, Time).
+    links = PhRootElementAvlTree(&PhpProcessRecordIndex);
 
-    do
+    while (links)
     {
-        if (ProcessRecord->ProcessId == ProcessId)
-            return ProcessRecord;
+        processRecord = CONTAINING_RECORD(links, PH_PROCESS_RECORD, IndexLinks);
 
-        ProcessRecord = CONTAINING_RECORD(ProcessRecord->ListEntry.Flink, PH_PROCESS_RECORD, ListEntry);
-    } while (ProcessRecord != startProcessRecord);
+        if ((ULONG_PTR)processRecord->ProcessId < (ULONG_PTR)ProcessId ||
+            (processRecord->ProcessId == ProcessId && processRecord->CreateTime.QuadPart <= Time->QuadPart))
+        {
+            bestProcessRecord = processRecord;
+            links = links->Right;
+        }
+        else
+        {
+            links = links->Left;
+        }
+    }
 
-    return NULL;
+    if (bestProcessRecord && bestProcessRecord->ProcessId == ProcessId)
+        return bestProcessRecord;
+    else
+        return NULL;
 }
 
 /**
@@ -2693,57 +5097,36 @@ PPH_PROCESS_RECORD PhFindProcessRecord(
 
     PhAcquireQueuedLockShared(&PhProcessRecordListLock);
 
-    processRecord = PhpSearchProcessRecordList(Time, &i, NULL);
-
-    if (!processRecord)
+    if (ProcessId)
     {
-        // This is expected. Now we search backwards to find the newest matching element
-        // older than the given time.
-
-        found = FALSE;
+        processRecord = PhpFindProcessRecord(ProcessId, Time);
+        found = !!processRecord;
+    }
+    else
+    {
+        processRecord = PhpSearchProcessRecordList(Time, &i, NULL);
+        found = !!processRecord;
 
-        while (TRUE)
+        if (!processRecord)
         {
-            processRecord = (PPH_PROCESS_RECORD)PhProcessRecordList->Items[i];
+            // This is expected. Now we search backwards to find the newest element older
+            // than the given time.
 
-            if (processRecord->CreateTime.QuadPart < Time->QuadPart)
+            while (TRUE)
             {
-                if (ProcessId)
-                {
-                    processRecord = PhpFindProcessRecord(processRecord, ProcessId);
+                processRecord = (PPH_PROCESS_RECORD)PhProcessRecordList->Items[i];
 
-                    if (processRecord)
-                        found = TRUE;
-                }
-                else
+                if (processRecord->CreateTime.QuadPart < Time->QuadPart)
                 {
                     found = TRUE;
+                    break;
                 }
 
-                if (found)
+                if (i == 0)
                     break;
-            }
-
-            if (i == 0)
-                break;
-
-            i--;
-        }
-    }
-    else
-    {
-        if (ProcessId)
-        {
-            processRecord = PhpFindProcessRecord(processRecord, ProcessId);
 
-            if (processRecord)
-                found = TRUE;
-            else
-                found = FALSE;
-        }
-        else
-        {
-            found = TRUE;
+                i--;
+            }
         }
     }
 
@@ -2765,59 +5148,60 @@ PPH_PROCESS_RECORD PhFindProcessRecord(
 
 /**
  * Deletes unused process records.
+ *
+ * \remarks Only records whose processes exited before the oldest statistics time
+ * are examined, so the cost of this function does not depend on the total number
+ * of records.
  */
 VOID PhPurgeProcessRecords(
     VOID
     )
 {
     PPH_PROCESS_RECORD processRecord;
-    PPH_PROCESS_RECORD startProcessRecord;
     ULONG i;
+    ULONG count = 0;
     LARGE_INTEGER threshold;
     PPH_LIST derefList = NULL;
 
-    if (PhProcessRecordList->Count == 0)
+    if (IsListEmpty(&PhpDeadProcessRecordListHead))
         return;
 
     // Get the oldest statistics time.
     PhGetStatisticsTime(NULL, PhTimeHistory.Count - 1, &threshold);
 
-    PhAcquireQueuedLockShared(&PhProcessRecordListLock);
+    PhAcquireQueuedLockExclusive(&PhProcessRecordListLock);
 
-    for (i = 0; i < PhProcessRecordList->Count; i++)
+    // The dead list is in the order processes were removed from the process list,
+    // which is close enough to exit time order for us to stop at the first record
+    // that is still inside the statistics window.
+    while (!IsListEmpty(&PhpDeadProcessRecordListHead) && count < PH_PROCESS_RECORD_PURGE_LIMIT)
     {
-        processRecord = PhProcessRecordList->Items[i];
-        startProcessRecord = processRecord;
-
-        do
-        {
-            ULONG requiredFlags;
+        processRecord = CONTAINING_RECORD(PhpDeadProcessRecordListHead.Flink, PH_PROCESS_RECORD, DeadListEntry);
 
-            requiredFlags = PH_PROCESS_RECORD_DEAD | PH_PROCESS_RECORD_STAT_REF;
+        // Check if the process exit time is before the oldest statistics time.
+        // If so we can dereference the process record.
+        if (processRecord->ExitTime.QuadPart >= threshold.QuadPart)
+            break;
 
-            if ((processRecord->Flags & requiredFlags) == requiredFlags)
-            {
-                // Check if the process exit time is before the oldest statistics time.
-                // If so we can dereference the process record.
-                if (processRecord->ExitTime.QuadPart < threshold.QuadPart)
-                {
-                    // Clear the stat ref bit; this is to make sure we don't try to
-                    // dereference the record twice (e.g. if someone else currently holds
-                    // a reference to the record and it doesn't get removed immediately).
-                    processRecord->Flags &= ~PH_PROCESS_RECORD_STAT_REF;
+        RemoveEntryList(&processRecord->DeadListEntry);
+        InitializeListHead(&processRecord->DeadListEntry);
+        count++;
 
-                    if (!derefList)
-                        derefList = PhCreateList(2);
+        if (processRecord->Flags & PH_PROCESS_RECORD_STAT_REF)
+        {
+            // Clear the stat ref bit; this is to make sure we don't try to
+            // dereference the record twice (e.g. if someone else currently holds
+            // a reference to the record and it doesn't get removed immediately).
+            processRecord->Flags &= ~PH_PROCESS_RECORD_STAT_REF;
 
-                    PhAddItemList(derefList, processRecord);
-                }
-            }
+            if (!derefList)
+                derefList = PhCreateList(2);
 
-            processRecord = CONTAINING_RECORD(processRecord->ListEntry.Flink, PH_PROCESS_RECORD, ListEntry);
-        } while (processRecord != startProcessRecord);
+            PhAddItemList(derefList, processRecord);
+        }
     }
 
-    PhReleaseQueuedLockShared(&PhProcessRecordListLock);
+    PhReleaseQueuedLockExclusive(&PhProcessRecordListLock);
 
     if (derefList)
     {
@@ -2837,11 +5221,12 @@ PPH_PROCESS_ITEM PhReferenceProcessItemForParent(
     )
 {
     PPH_PROCESS_ITEM processItem;
+    PH_EPOCH_GUARD guard;
 
     if (ParentProcessId == ProcessId) // for cases where the parent PID = PID (e.g. System Idle Process)
         return NULL;
 
-    PhAcquireQueuedLockShared(&PhProcessHashSetLock);
+    PhEnterEpoch(&guard);
 
     processItem = PhpLookupProcessItem(ParentProcessId);
 
@@ -2853,7 +5238,7 @@ PPH_PROCESS_ITEM PhReferenceProcessItemForParent(
     else
         processItem = NULL;
 
-    PhReleaseQueuedLockShared(&PhProcessHashSetLock);
+    PhLeaveEpoch(&guard);
 
     return processItem;
 }
@@ -2863,8 +5248,9 @@ PPH_PROCESS_ITEM PhReferenceProcessItemForRecord(
     )
 {
     PPH_PROCESS_ITEM processItem;
+    PH_EPOCH_GUARD guard;
 
-    PhAcquireQueuedLockShared(&PhProcessHashSetLock);
+    PhEnterEpoch(&guard);
 
     processItem = PhpLookupProcessItem(Record->ProcessId);
 
@@ -2873,7 +5259,127 @@ PPH_PROCESS_ITEM PhReferenceProcessItemForRecord(
     else
         processItem = NULL;
 
-    PhReleaseQueuedLockShared(&PhProcessHashSetLock);
+    PhLeaveEpoch(&guard);
 
     return processItem;
 }
+
+/**
+ * Tells the providers about a change before the next update notices it.
+ *
+ * \param Hint The hint. The structure is copied, and the image name (if any) is referenced.
+ *
+ * \remarks This function can be called from any thread. Process creation and exit hints
+ * bring the next process provider update forward and are used to record processes which
+ * exit before they appear in a snapshot. Image load and unload hints make the module
+ * providers of the process enumerate modules on their next update.
+ */
+VOID PhQueueProcessProviderHint(
+    _In_ PPH_PROCESS_PROVIDER_HINT Hint
+    )
+{
+    PPH_PROCESS_PROVIDER_HINT copy;
+    ULONG64 tickCount;
+
+    if (Hint->Type == ProcessProviderHintImageLoad || Hint->Type == ProcessProviderHintImageUnload)
+    {
+        PhHintModuleProviders(Hint->ProcessId);
+        return;
+    }
+
+    copy = PhAllocateCopy(Hint, sizeof(PH_PROCESS_PROVIDER_HINT));
+
+    if (copy->ImageName)
+        PhReferenceObject(copy->ImageName);
+
+    PhAcquireQueuedLockExclusive(&PhpProcessHintListLock);
+
+    if (!PhpProcessHintList)
+        PhpProcessHintList = PhCreateList(16);
+
+    // The list is only emptied by the process provider, so don't let it grow forever
+    // while updates are paused.
+    if (PhpProcessHintList->Count < PH_PROCESS_HINT_LIMIT)
+    {
+        PhAddItemList(PhpProcessHintList, copy);
+        copy = NULL;
+    }
+
+    PhReleaseQueuedLockExclusive(&PhpProcessHintListLock);
+
+    if (copy)
+    {
+        PhClearReference(&copy->ImageName);
+        PhFree(copy);
+        return;
+    }
+
+    // Bursts of process creation would otherwise run the process provider continuously.
+    tickCount = NtGetTickCount64();
+
+    if (tickCount - PhpLastProcessHintEventTime >= PH_PROCESS_HINT_EVENT_INTERVAL)
+    {
+        PhpLastProcessHintEventTime = tickCount;
+        PhInvokeCallback(&PhProcessProviderHintEvent, NULL);
+    }
+}
+
+/**
+ * Gets a cached handle to a process that can be used to query information and read memory.
+ *
+ * \param ProcessItem A process item. The caller must hold a reference to it.
+ * \param DesiredAccess The access required. This should be a combination of
+ * PROCESS_QUERY_INFORMATION, PROCESS_QUERY_LIMITED_INFORMATION and PROCESS_VM_READ.
+ * \param ProcessHandle A variable which receives the handle.
+ *
+ * \return STATUS_ACCESS_DENIED if the cached handle does not have the requested access.
+ *
+ * \remarks The handle is opened the first time this function is called and is shared by
+ * every caller, including plugins. Do not close it or change its attributes. It remains
+ * valid until the process item is deleted.
+ */
+NTSTATUS PhGetProcessItemVmReadHandle(
+    _In_ PPH_PROCESS_ITEM ProcessItem,
+    _In_ ACCESS_MASK DesiredAccess,
+    _Out_ PHANDLE ProcessHandle
+    )
+{
+    if (PhBeginInitOnce(&ProcessItem->VmReadHandleInitOnce))
+    {
+        HANDLE processHandle = NULL;
+        ACCESS_MASK grantedAccess;
+        NTSTATUS status;
+
+        // We don't retry if the open fails. The access to a process rarely changes, and
+        // retrying would bring back the repeated opens this cache is meant to avoid.
+
+        grantedAccess = PROCESS_QUERY_INFORMATION | PROCESS_QUERY_LIMITED_INFORMATION | PROCESS_VM_READ;
+        status = PhOpenProcess(&processHandle, PROCESS_QUERY_INFORMATION | PROCESS_VM_READ, ProcessItem->ProcessId);
+
+        if (!NT_SUCCESS(status) && WINDOWS_HAS_LIMITED_ACCESS)
+        {
+            grantedAccess = PROCESS_QUERY_LIMITED_INFORMATION | PROCESS_VM_READ;
+            status = PhOpenProcess(&processHandle, PROCESS_QUERY_LIMITED_INFORMATION | PROCESS_VM_READ, ProcessItem->ProcessId);
+        }
+
+        ProcessItem->VmReadHandleStatus = status;
+
+        if (NT_SUCCESS(status))
+        {
+            ProcessItem->VmReadHandle = processHandle;
+            ProcessItem->VmReadHandleAccess = grantedAccess;
+        }
+
+        PhEndInitOnce(&ProcessItem->VmReadHandleInitOnce);
+    }
+
+    if (!NT_SUCCESS(ProcessItem->VmReadHandleStatus))
+        return ProcessItem->VmReadHandleStatus;
+
+    if ((ProcessItem->VmReadHandleAccess & DesiredAccess) != DesiredAccess)
+        return STATUS_ACCESS_DENIED;
+
+    *ProcessHandle = ProcessItem->VmReadHandle;
+
+    return STATUS_SUCCESS;
+}
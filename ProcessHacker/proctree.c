@@ -35,6 +35,7 @@
 #include <cpysave.h>
 #include <emenu.h>
 #include <verify.h>
+#include <ntgdi.h>
 
 typedef enum _PHP_AGGREGATE_TYPE
 {
@@ -50,6 +51,28 @@ typedef enum _PHP_AGGREGATE_LOCATION
     AggregateLocationProcessItem
 } PHP_AGGREGATE_LOCATION;
 
+typedef struct _PHP_AGGREGATE_FIELD
+{
+    PHP_AGGREGATE_TYPE Type;
+    SIZE_T ItemFieldOffset;
+    SIZE_T AggregateFieldOffset;
+} PHP_AGGREGATE_FIELD, *PPHP_AGGREGATE_FIELD;
+
+// The process item fields that are maintained in PH_PROCESS_NODE_AGGREGATES.
+static PHP_AGGREGATE_FIELD PhpAggregateFields[] =
+{
+    { AggregateTypeFloat, FIELD_OFFSET(PH_PROCESS_ITEM, CpuUsage), FIELD_OFFSET(PH_PROCESS_NODE_AGGREGATES, CpuUsage) },
+    { AggregateTypeInt32, FIELD_OFFSET(PH_PROCESS_ITEM, NumberOfThreads), FIELD_OFFSET(PH_PROCESS_NODE_AGGREGATES, NumberOfThreads) },
+    { AggregateTypeInt32, FIELD_OFFSET(PH_PROCESS_ITEM, NumberOfHandles), FIELD_OFFSET(PH_PROCESS_NODE_AGGREGATES, NumberOfHandles) },
+    { AggregateTypeIntPtr, FIELD_OFFSET(PH_PROCESS_ITEM, VmCounters.PagefileUsage), FIELD_OFFSET(PH_PROCESS_NODE_AGGREGATES, PagefileUsage) },
+    { AggregateTypeIntPtr, FIELD_OFFSET(PH_PROCESS_ITEM, VmCounters.WorkingSetSize), FIELD_OFFSET(PH_PROCESS_NODE_AGGREGATES, WorkingSetSize) },
+    { AggregateTypeInt64, FIELD_OFFSET(PH_PROCESS_ITEM, IoReadDelta.Delta), FIELD_OFFSET(PH_PROCESS_NODE_AGGREGATES, IoReadDelta) },
+    { AggregateTypeInt64, FIELD_OFFSET(PH_PROCESS_ITEM, IoWriteDelta.Delta), FIELD_OFFSET(PH_PROCESS_NODE_AGGREGATES, IoWriteDelta) },
+    { AggregateTypeInt64, FIELD_OFFSET(PH_PROCESS_ITEM, IoOtherDelta.Delta), FIELD_OFFSET(PH_PROCESS_NODE_AGGREGATES, IoOtherDelta) },
+    { AggregateTypeInt64, FIELD_OFFSET(PH_PROCESS_ITEM, CycleTimeDelta.Value), FIELD_OFFSET(PH_PROCESS_NODE_AGGREGATES, CycleTime) },
+    { AggregateTypeInt64, FIELD_OFFSET(PH_PROCESS_ITEM, CycleTimeDelta.Delta), FIELD_OFFSET(PH_PROCESS_NODE_AGGREGATES, CycleTimeDelta) }
+};
+
 VOID PhpRemoveProcessNode(
     _In_ PPH_PROCESS_NODE ProcessNode
     );
@@ -58,10 +81,30 @@ VOID PhpUpdateNeedCyclesInformation(
     VOID
     );
 
+VOID PhpUpdateNeedHandleStatistics(
+    VOID
+    );
+
+VOID PhpComputeProcessNodeAggregates(
+    _Inout_ PPH_PROCESS_NODE ProcessNode
+    );
+
+VOID PhpLinkProcessNodeAggregates(
+    _Inout_ PPH_PROCESS_NODE ProcessNode
+    );
+
+VOID PhpUnlinkProcessNodeAggregates(
+    _In_ PPH_PROCESS_NODE ProcessNode
+    );
+
 VOID PhpUpdateProcessNodeCycles(
     _Inout_ PPH_PROCESS_NODE ProcessNode
     );
 
+VOID PhpInitializeProcessColumnChangeMasks(
+    VOID
+    );
+
 LONG PhpProcessTreeNewPostSortFunction(
     _In_ LONG Result,
     _In_ PVOID Node1,
@@ -85,12 +128,24 @@ static PH_CM_MANAGER ProcessTreeListCm;
 static PPH_HASH_ENTRY ProcessNodeHashSet[256] = PH_HASH_SET_INIT; // hashtable of all nodes
 static PPH_LIST ProcessNodeList; // list of all nodes, used when sorting is enabled
 static PPH_LIST ProcessNodeRootList; // list of root nodes
+static BOOLEAN ProcessNodeRemovalBatch = FALSE;
+static PPH_HASHTABLE ProcessNodeDirtySiblingLists = NULL; // sibling lists with holes, compacted at the end of a removal batch
 
 BOOLEAN PhProcessTreeListStateHighlighting = TRUE;
 static PPH_POINTER_LIST ProcessNodeStateList = NULL; // list of nodes which need to be processed
 
 static PH_TN_FILTER_SUPPORT FilterSupport;
 static BOOLEAN NeedCyclesInformation = FALSE;
+static BOOLEAN NeedHandleStatistics = FALSE;
+static PPH_HANDLE_STATISTICS HandleStatistics = NULL;
+static ULONG HandleTypeColumnTypeIndices[PHPRTLC_HANDLETYPES_COUNT];
+static ULONG ProcessNodeTickCount = 0;
+
+// The process item fields that each column's text is computed from (see PH_PROCESS_CHANGE_*).
+// Columns with a mask of 0 only change when the node is updated, and the text of columns
+// with a mask of PHP_COLUMN_VOLATILE is recomputed on every tick.
+#define PHP_COLUMN_VOLATILE 0xffffffff
+static ULONG ProcessColumnChangeMasks[PHPRTLC_MAXIMUM];
 
 static HDC GraphContext = NULL;
 static ULONG GraphContextWidth = 0;
@@ -105,6 +160,83 @@ VOID PhProcessTreeListInitialization(
 {
     ProcessNodeList = PhCreateList(40);
     ProcessNodeRootList = PhCreateList(10);
+
+    PhpInitializeProcessColumnChangeMasks();
+}
+
+VOID PhpInitializeProcessColumnChangeMasks(
+    VOID
+    )
+{
+    ULONG i;
+
+    // Anything not listed here is computed on the GUI thread or depends on the current time.
+    for (i = 0; i < PHPRTLC_MAXIMUM; i++)
+        ProcessColumnChangeMasks[i] = PHP_COLUMN_VOLATILE;
+
+    ProcessColumnChangeMasks[PHPRTLC_NAME] = 0;
+    ProcessColumnChangeMasks[PHPRTLC_PID] = 0;
+    ProcessColumnChangeMasks[PHPRTLC_USERNAME] = 0;
+    ProcessColumnChangeMasks[PHPRTLC_DESCRIPTION] = 0;
+    ProcessColumnChangeMasks[PHPRTLC_COMPANYNAME] = 0;
+    ProcessColumnChangeMasks[PHPRTLC_VERSION] = 0;
+    ProcessColumnChangeMasks[PHPRTLC_FILENAME] = 0;
+    ProcessColumnChangeMasks[PHPRTLC_COMMANDLINE] = 0;
+    ProcessColumnChangeMasks[PHPRTLC_SESSIONID] = 0;
+    ProcessColumnChangeMasks[PHPRTLC_INTEGRITY] = 0;
+    ProcessColumnChangeMasks[PHPRTLC_STARTTIME] = 0;
+    ProcessColumnChangeMasks[PHPRTLC_VERIFICATIONSTATUS] = 0;
+    ProcessColumnChangeMasks[PHPRTLC_VERIFIEDSIGNER] = 0;
+    ProcessColumnChangeMasks[PHPRTLC_ASLR] = 0;
+    ProcessColumnChangeMasks[PHPRTLC_BITS] = 0;
+    ProcessColumnChangeMasks[PHPRTLC_ELEVATION] = 0;
+    ProcessColumnChangeMasks[PHPRTLC_SUBSYSTEM] = 0;
+    ProcessColumnChangeMasks[PHPRTLC_PACKAGENAME] = 0;
+    ProcessColumnChangeMasks[PHPRTLC_CFGUARD] = 0;
+
+    ProcessColumnChangeMasks[PHPRTLC_CPU] = PH_PROCESS_CHANGE_CPU;
+
+    ProcessColumnChangeMasks[PHPRTLC_IOTOTALRATE] = PH_PROCESS_CHANGE_IO;
+    ProcessColumnChangeMasks[PHPRTLC_IORORATE] = PH_PROCESS_CHANGE_IO;
+    ProcessColumnChangeMasks[PHPRTLC_IOWRATE] = PH_PROCESS_CHANGE_IO;
+
+    for (i = PHPRTLC_IOREADS; i <= PHPRTLC_IOOTHERDELTA; i++)
+        ProcessColumnChangeMasks[i] = PH_PROCESS_CHANGE_IO;
+
+    ProcessColumnChangeMasks[PHPRTLC_PRIVATEBYTES] = PH_PROCESS_CHANGE_MEMORY;
+    ProcessColumnChangeMasks[PHPRTLC_PEAKPRIVATEBYTES] = PH_PROCESS_CHANGE_MEMORY;
+    ProcessColumnChangeMasks[PHPRTLC_WORKINGSET] = PH_PROCESS_CHANGE_MEMORY;
+    ProcessColumnChangeMasks[PHPRTLC_PEAKWORKINGSET] = PH_PROCESS_CHANGE_MEMORY;
+    ProcessColumnChangeMasks[PHPRTLC_PRIVATEWS] = PH_PROCESS_CHANGE_MEMORY;
+    ProcessColumnChangeMasks[PHPRTLC_VIRTUALSIZE] = PH_PROCESS_CHANGE_MEMORY;
+    ProcessColumnChangeMasks[PHPRTLC_PEAKVIRTUALSIZE] = PH_PROCESS_CHANGE_MEMORY;
+    ProcessColumnChangeMasks[PHPRTLC_PAGEDPOOL] = PH_PROCESS_CHANGE_MEMORY;
+    ProcessColumnChangeMasks[PHPRTLC_PEAKPAGEDPOOL] = PH_PROCESS_CHANGE_MEMORY;
+    ProcessColumnChangeMasks[PHPRTLC_NONPAGEDPOOL] = PH_PROCESS_CHANGE_MEMORY;
+    ProcessColumnChangeMasks[PHPRTLC_PEAKNONPAGEDPOOL] = PH_PROCESS_CHANGE_MEMORY;
+    ProcessColumnChangeMasks[PHPRTLC_PRIVATEBYTESDELTA] = PH_PROCESS_CHANGE_MEMORY;
+
+    ProcessColumnChangeMasks[PHPRTLC_PAGEFAULTS] = PH_PROCESS_CHANGE_PAGEFAULTS;
+    ProcessColumnChangeMasks[PHPRTLC_PAGEFAULTSDELTA] = PH_PROCESS_CHANGE_PAGEFAULTS;
+
+    ProcessColumnChangeMasks[PHPRTLC_PRIORITYCLASS] = PH_PROCESS_CHANGE_PRIORITY;
+    ProcessColumnChangeMasks[PHPRTLC_BASEPRIORITY] = PH_PROCESS_CHANGE_PRIORITY;
+    ProcessColumnChangeMasks[PHPRTLC_THREADS] = PH_PROCESS_CHANGE_THREADS;
+    ProcessColumnChangeMasks[PHPRTLC_HANDLES] = PH_PROCESS_CHANGE_HANDLES;
+
+    ProcessColumnChangeMasks[PHPRTLC_TOTALCPUTIME] = PH_PROCESS_CHANGE_CPUTIME;
+    ProcessColumnChangeMasks[PHPRTLC_KERNELCPUTIME] = PH_PROCESS_CHANGE_CPUTIME;
+    ProcessColumnChangeMasks[PHPRTLC_USERCPUTIME] = PH_PROCESS_CHANGE_CPUTIME;
+
+    ProcessColumnChangeMasks[PHPRTLC_CONTEXTSWITCHES] = PH_PROCESS_CHANGE_CONTEXTSWITCHES;
+    ProcessColumnChangeMasks[PHPRTLC_CONTEXTSWITCHESDELTA] = PH_PROCESS_CHANGE_CONTEXTSWITCHES;
+
+    // Before Windows 7 the cycle counts are queried by PhpUpdateProcessNodeCycles.
+    if (WindowsVersion >= WINDOWS_7)
+    {
+        ProcessColumnChangeMasks[PHPRTLC_CYCLES] = PH_PROCESS_CHANGE_CYCLES;
+        ProcessColumnChangeMasks[PHPRTLC_CYCLESDELTA] = PH_PROCESS_CHANGE_CYCLES;
+    }
 }
 
 VOID PhInitializeProcessTreeList(
@@ -207,6 +339,12 @@ VOID PhInitializeProcessTreeList(
     PhAddTreeNewColumn(hwnd, PHPRTLC_APPID, FALSE, L"App ID", 160, PH_ALIGN_LEFT, -1, 0);
     PhAddTreeNewColumn(hwnd, PHPRTLC_DPIAWARENESS, FALSE, L"DPI Awareness", 110, PH_ALIGN_LEFT, -1, 0);
     PhAddTreeNewColumnEx(hwnd, PHPRTLC_CFGUARD, FALSE, L"CF Guard", 70, PH_ALIGN_LEFT, -1, 0, TRUE);
+    PhAddTreeNewColumnEx(hwnd, PHPRTLC_FILEHANDLES, FALSE, L"File Handles", 45, PH_ALIGN_RIGHT, -1, DT_RIGHT, TRUE);
+    PhAddTreeNewColumnEx(hwnd, PHPRTLC_KEYHANDLES, FALSE, L"Key Handles", 45, PH_ALIGN_RIGHT, -1, DT_RIGHT, TRUE);
+    PhAddTreeNewColumnEx(hwnd, PHPRTLC_EVENTHANDLES, FALSE, L"Event Handles", 45, PH_ALIGN_RIGHT, -1, DT_RIGHT, TRUE);
+    PhAddTreeNewColumnEx(hwnd, PHPRTLC_SECTIONHANDLES, FALSE, L"Section Handles", 45, PH_ALIGN_RIGHT, -1, DT_RIGHT, TRUE);
+    PhAddTreeNewColumnEx(hwnd, PHPRTLC_THREADHANDLES, FALSE, L"Thread Handles", 45, PH_ALIGN_RIGHT, -1, DT_RIGHT, TRUE);
+    PhAddTreeNewColumnEx(hwnd, PHPRTLC_PROCESSHANDLES, FALSE, L"Process Handles", 45, PH_ALIGN_RIGHT, -1, DT_RIGHT, TRUE);
 
     TreeNew_SetRedraw(hwnd, TRUE);
 
@@ -246,6 +384,7 @@ VOID PhLoadSettingsProcessTreeList(
     }
 
     PhpUpdateNeedCyclesInformation();
+    PhpUpdateNeedHandleStatistics();
 }
 
 VOID PhSaveSettingsProcessTreeList(
@@ -302,14 +441,103 @@ FORCEINLINE BOOLEAN PhpValidateParentCreateTime(
         Parent->ProcessItem->CreateTime.QuadPart <= Child->ProcessItem->CreateTime.QuadPart;
 }
 
-PPH_PROCESS_NODE PhAddProcessNode(
+static VOID PhpAddProcessNodeSibling(
+    _In_ PPH_LIST List,
+    _In_ PPH_PROCESS_NODE ProcessNode
+    )
+{
+    ProcessNode->SiblingIndex = List->Count;
+    PhAddItemList(List, ProcessNode);
+}
+
+/**
+ * Removes the holes left in a sibling list by removed nodes.
+ *
+ * \param List The children of a node, or the root list.
+ */
+static VOID PhpCompactProcessNodeSiblings(
+    _In_ PPH_LIST List
+    )
+{
+    ULONG i;
+    ULONG j;
+
+    for (i = 0, j = 0; i < List->Count; i++)
+    {
+        PPH_PROCESS_NODE node = List->Items[i];
+
+        if (!node)
+            continue;
+
+        node->SiblingIndex = j;
+        List->Items[j++] = node;
+    }
+
+    List->Count = j;
+}
+
+/**
+ * Removes a node from its parent's children or from the root list.
+ *
+ * \param ProcessNode The process node.
+ *
+ * \remarks The order of the siblings is shown when the tree isn't sorted, so the node leaves a
+ * hole which is removed by compacting the list. During a removal batch, each list is compacted
+ * once at the end of the batch instead of once per node.
+ */
+static VOID PhpRemoveProcessNodeSibling(
+    _In_ PPH_PROCESS_NODE ProcessNode
+    )
+{
+    PPH_LIST list;
+
+    list = ProcessNode->Parent ? ProcessNode->Parent->Children : ProcessNodeRootList;
+    list->Items[ProcessNode->SiblingIndex] = NULL;
+
+    if (!ProcessNodeRemovalBatch)
+    {
+        PhpCompactProcessNodeSiblings(list);
+        return;
+    }
+
+    if (!ProcessNodeDirtySiblingLists)
+        ProcessNodeDirtySiblingLists = PhCreateSimpleHashtable(8);
+
+    if (!PhFindItemSimpleHashtable(ProcessNodeDirtySiblingLists, list))
+    {
+        // The parent may also be removed in this batch.
+        PhReferenceObject(list);
+        PhAddItemSimpleHashtable(ProcessNodeDirtySiblingLists, list, NULL);
+    }
+}
+
+static VOID PhpCompactDirtyProcessNodeSiblings(
+    VOID
+    )
+{
+    ULONG enumerationKey;
+    PPH_KEY_VALUE_PAIR entry;
+
+    if (!ProcessNodeDirtySiblingLists || ProcessNodeDirtySiblingLists->Count == 0)
+        return;
+
+    enumerationKey = 0;
+
+    while (PhEnumHashtable(ProcessNodeDirtySiblingLists, &entry, &enumerationKey))
+    {
+        PhpCompactProcessNodeSiblings(entry->Key);
+        PhDereferenceObject(entry->Key);
+    }
+
+    PhClearHashtable(ProcessNodeDirtySiblingLists);
+}
+
+static PPH_PROCESS_NODE PhpCreateProcessNode(
     _In_ PPH_PROCESS_ITEM ProcessItem,
     _In_ ULONG RunId
     )
 {
     PPH_PROCESS_NODE processNode;
-    PPH_PROCESS_NODE parentNode;
-    ULONG i;
 
     processNode = PhAllocate(PhEmGetObjectSize(EmProcessNodeType, sizeof(PH_PROCESS_NODE)));
     memset(processNode, 0, sizeof(PH_PROCESS_NODE));
@@ -331,59 +559,19 @@ PPH_PROCESS_NODE PhAddProcessNode(
     processNode->ProcessItem = ProcessItem;
     PhReferenceObject(ProcessItem);
 
-    memset(processNode->TextCache, 0, sizeof(PH_STRINGREF) * PHPRTLC_MAXIMUM);
+    memset(processNode->TextCache, 0, sizeof(PH_STRINGREF) * PHPRTLC_TEXT_CACHE_SIZE);
     processNode->Node.TextCache = processNode->TextCache;
-    processNode->Node.TextCacheSize = PHPRTLC_MAXIMUM;
+    processNode->Node.TextCacheSize = PHPRTLC_TEXT_CACHE_SIZE;
 
     processNode->Children = PhCreateList(1);
 
-    // Find this process' parent and add the process to it if we found it.
-    if (
-        (parentNode = PhFindProcessNode(ProcessItem->ParentProcessId)) &&
-        PhpValidateParentCreateTime(processNode, parentNode)
-        )
-    {
-        PhAddItemList(parentNode->Children, processNode);
-        processNode->Parent = parentNode;
-    }
-    else
-    {
-        // No parent, add to root list.
-        processNode->Parent = NULL;
-        PhAddItemList(ProcessNodeRootList, processNode);
-    }
-
-    // Find this process' children and move them to this node.
-
-    for (i = 0; i < ProcessNodeRootList->Count; i++)
-    {
-        PPH_PROCESS_NODE node = ProcessNodeRootList->Items[i];
-
-        if (
-            node != processNode && // for cases where the parent PID = PID (e.g. System Idle Process)
-            node->ProcessItem->ParentProcessId == ProcessItem->ProcessId &&
-            PhpValidateParentCreateTime(node, processNode)
-            )
-        {
-            node->Parent = processNode;
-            PhAddItemList(processNode->Children, node);
-        }
-    }
-
-    for (i = 0; i < processNode->Children->Count; i++)
-    {
-        PhRemoveItemList(
-            ProcessNodeRootList,
-            PhFindItemList(ProcessNodeRootList, processNode->Children->Items[i])
-            );
-    }
-
     PhAddEntryHashSet(
         ProcessNodeHashSet,
         PH_HASH_SET_SIZE(ProcessNodeHashSet),
         &processNode->HashEntry,
         PhHashProcessNode(processNode)
         );
+    processNode->ListIndex = ProcessNodeList->Count;
     PhAddItemList(ProcessNodeList, processNode);
 
     if (PhCsCollapseServicesOnStart)
@@ -420,6 +608,60 @@ PPH_PROCESS_NODE PhAddProcessNode(
     if (WindowsVersion >= WINDOWS_7 && PhEnableCycleCpuUsage && ProcessItem->ProcessId == INTERRUPTS_PROCESS_ID)
         PhInitializeStringRef(&processNode->DescriptionText, L"Interrupts and DPCs");
 
+    return processNode;
+}
+
+PPH_PROCESS_NODE PhAddProcessNode(
+    _In_ PPH_PROCESS_ITEM ProcessItem,
+    _In_ ULONG RunId
+    )
+{
+    PPH_PROCESS_NODE processNode;
+    PPH_PROCESS_NODE parentNode;
+    ULONG i;
+
+    // Look for the parent before this node is added to the hash set, for cases where the parent
+    // PID = PID.
+    parentNode = PhFindProcessNode(ProcessItem->ParentProcessId);
+    processNode = PhpCreateProcessNode(ProcessItem, RunId);
+
+    // Find this process' parent and add the process to it if we found it.
+    if (parentNode && PhpValidateParentCreateTime(processNode, parentNode))
+    {
+        PhpAddProcessNodeSibling(parentNode->Children, processNode);
+        processNode->Parent = parentNode;
+    }
+    else
+    {
+        // No parent, add to root list.
+        processNode->Parent = NULL;
+        PhpAddProcessNodeSibling(ProcessNodeRootList, processNode);
+    }
+
+    // Find this process' children and move them to this node. The root list is compacted once
+    // afterwards instead of searching it for each child.
+
+    for (i = 0; i < ProcessNodeRootList->Count; i++)
+    {
+        PPH_PROCESS_NODE node = ProcessNodeRootList->Items[i];
+
+        if (
+            node != processNode && // for cases where the parent PID = PID (e.g. System Idle Process)
+            node->ProcessItem->ParentProcessId == ProcessItem->ProcessId &&
+            PhpValidateParentCreateTime(node, processNode)
+            )
+        {
+            ProcessNodeRootList->Items[i] = NULL;
+            node->Parent = processNode;
+            PhpAddProcessNodeSibling(processNode->Children, node);
+        }
+    }
+
+    if (processNode->Children->Count != 0)
+        PhpCompactProcessNodeSiblings(ProcessNodeRootList);
+
+    PhpLinkProcessNodeAggregates(processNode);
+
     if (FilterSupport.FilterList)
         processNode->Node.Visible = PhApplyTreeNewFiltersToNode(&FilterSupport, &processNode->Node);
 
@@ -430,6 +672,98 @@ PPH_PROCESS_NODE PhAddProcessNode(
     return processNode;
 }
 
+/**
+ * Creates nodes for a set of processes and links them into the tree in one pass.
+ *
+ * \param ProcessItems The process items to add.
+ * \param NumberOfProcessItems The number of elements in \a ProcessItems.
+ * \param RunId The provider run ID of the processes.
+ * \param ProcessNodes An array which receives the new node for each process item.
+ *
+ * \remarks The result is the same as calling PhAddProcessNode() for each item, but the parent of
+ * each node is found with a hash lookup instead of a scan of the root list, and the tree is
+ * restructured once. This is used when the process list is first populated.
+ */
+VOID PhAddProcessNodes(
+    _In_reads_(NumberOfProcessItems) PPH_PROCESS_ITEM *ProcessItems,
+    _In_ ULONG NumberOfProcessItems,
+    _In_ ULONG RunId,
+    _Out_writes_(NumberOfProcessItems) PPH_PROCESS_NODE *ProcessNodes
+    )
+{
+    ULONG oldRootCount;
+    ULONG i;
+    ULONG j;
+
+    oldRootCount = ProcessNodeRootList->Count;
+
+    // Create all nodes first so that parents can be found regardless of the order of the items.
+    for (i = 0; i < NumberOfProcessItems; i++)
+        ProcessNodes[i] = PhpCreateProcessNode(ProcessItems[i], RunId);
+
+    for (i = 0; i < NumberOfProcessItems; i++)
+    {
+        PPH_PROCESS_NODE processNode = ProcessNodes[i];
+        PPH_PROCESS_NODE parentNode;
+
+        if (
+            (parentNode = PhFindProcessNode(processNode->ProcessItem->ParentProcessId)) &&
+            parentNode != processNode &&
+            PhpValidateParentCreateTime(processNode, parentNode)
+            )
+        {
+            PhpAddProcessNodeSibling(parentNode->Children, processNode);
+            processNode->Parent = parentNode;
+        }
+        else
+        {
+            processNode->Parent = NULL;
+            PhpAddProcessNodeSibling(ProcessNodeRootList, processNode);
+        }
+    }
+
+    // Move existing root nodes whose parent has just been added. The root list is compacted in
+    // place.
+    for (i = 0, j = 0; i < ProcessNodeRootList->Count; i++)
+    {
+        PPH_PROCESS_NODE node = ProcessNodeRootList->Items[i];
+        PPH_PROCESS_NODE parentNode;
+
+        if (
+            i < oldRootCount &&
+            (parentNode = PhFindProcessNode(node->ProcessItem->ParentProcessId)) &&
+            parentNode != node &&
+            PhpValidateParentCreateTime(node, parentNode)
+            )
+        {
+            node->Parent = parentNode;
+            PhpAddProcessNodeSibling(parentNode->Children, node);
+            continue;
+        }
+
+        node->SiblingIndex = j;
+        ProcessNodeRootList->Items[j++] = node;
+    }
+
+    ProcessNodeRootList->Count = j;
+
+    // Most of the tree has changed, so recompute all aggregates instead of adjusting ancestors.
+    for (i = 0; i < ProcessNodeRootList->Count; i++)
+        PhpComputeProcessNodeAggregates(ProcessNodeRootList->Items[i]);
+
+    for (i = 0; i < NumberOfProcessItems; i++)
+    {
+        PPH_PROCESS_NODE processNode = ProcessNodes[i];
+
+        if (FilterSupport.FilterList)
+            processNode->Node.Visible = PhApplyTreeNewFiltersToNode(&FilterSupport, &processNode->Node);
+
+        PhEmCallObjectOperation(EmProcessNodeType, processNode, EmObjectCreate);
+    }
+
+    TreeNew_NodesStructured(ProcessTreeListHandle);
+}
+
 PPH_PROCESS_NODE PhFindProcessNode(
     _In_ HANDLE ProcessId
     )
@@ -484,39 +818,41 @@ VOID PhpRemoveProcessNode(
     _In_ PPH_PROCESS_NODE ProcessNode
     )
 {
-    ULONG index;
+    PPH_PROCESS_NODE lastNode;
     ULONG i;
 
     PhEmCallObjectOperation(EmProcessNodeType, ProcessNode, EmObjectDelete);
 
-    if (ProcessNode->Parent)
-    {
-        // Remove the node from its parent.
-
-        if ((index = PhFindItemList(ProcessNode->Parent->Children, ProcessNode)) != -1)
-            PhRemoveItemList(ProcessNode->Parent->Children, index);
-    }
-    else
-    {
-        // Remove the node from the root list.
+    // The node's children become roots, so its whole subtree leaves its ancestors.
+    PhpUnlinkProcessNodeAggregates(ProcessNode);
 
-        if ((index = PhFindItemList(ProcessNodeRootList, ProcessNode)) != -1)
-            PhRemoveItemList(ProcessNodeRootList, index);
-    }
+    // Remove the node from its parent or from the root list.
+    PhpRemoveProcessNodeSibling(ProcessNode);
 
-    // Move the node's children to the root list.
+    // Move the node's children to the root list. Some of them may already have been removed in
+    // the current batch.
     for (i = 0; i < ProcessNode->Children->Count; i++)
     {
         PPH_PROCESS_NODE node = ProcessNode->Children->Items[i];
 
+        if (!node)
+            continue;
+
         node->Parent = NULL;
-        PhAddItemList(ProcessNodeRootList, node);
+        PhpAddProcessNodeSibling(ProcessNodeRootList, node);
     }
 
-    // Remove from list and cleanup.
+    // The list may still be waiting to be compacted, so make sure that it doesn't refer to the
+    // children that have moved.
+    PhClearList(ProcessNode->Children);
 
-    if ((index = PhFindItemList(ProcessNodeList, ProcessNode)) != -1)
-        PhRemoveItemList(ProcessNodeList, index);
+    // Remove from list and cleanup. The order of the list only matters when sorting, and the list
+    // is sorted again before it is used, so the last node takes this node's place.
+
+    lastNode = ProcessNodeList->Items[ProcessNodeList->Count - 1];
+    ProcessNodeList->Items[ProcessNode->ListIndex] = lastNode;
+    lastNode->ListIndex = ProcessNode->ListIndex;
+    ProcessNodeList->Count--;
 
     PhDereferenceObject(ProcessNode->Children);
 
@@ -525,17 +861,20 @@ VOID PhpRemoveProcessNode(
 
     if (ProcessNode->TooltipText) PhDereferenceObject(ProcessNode->TooltipText);
 
+    if (ProcessNode->NameSortKey) PhDereferenceObject(ProcessNode->NameSortKey);
+    if (ProcessNode->FileNameSortKey) PhDereferenceObject(ProcessNode->FileNameSortKey);
+
     if (ProcessNode->IoTotalRateText) PhDereferenceObject(ProcessNode->IoTotalRateText);
-    if (ProcessNode->PrivateBytesText) PhDereferenceObject(ProcessNode->PrivateBytesText);
-    if (ProcessNode->PeakPrivateBytesText) PhDereferenceObject(ProcessNode->PeakPrivateBytesText);
-    if (ProcessNode->WorkingSetText) PhDereferenceObject(ProcessNode->WorkingSetText);
-    if (ProcessNode->PeakWorkingSetText) PhDereferenceObject(ProcessNode->PeakWorkingSetText);
-    if (ProcessNode->PrivateWsText) PhDereferenceObject(ProcessNode->PrivateWsText);
-    if (ProcessNode->SharedWsText) PhDereferenceObject(ProcessNode->SharedWsText);
-    if (ProcessNode->ShareableWsText) PhDereferenceObject(ProcessNode->ShareableWsText);
-    if (ProcessNode->VirtualSizeText) PhDereferenceObject(ProcessNode->VirtualSizeText);
-    if (ProcessNode->PeakVirtualSizeText) PhDereferenceObject(ProcessNode->PeakVirtualSizeText);
-    if (ProcessNode->PageFaultsText) PhDereferenceObject(ProcessNode->PageFaultsText);
+    PhDeleteCachedFormat(&ProcessNode->PrivateBytesText);
+    PhDeleteCachedFormat(&ProcessNode->PeakPrivateBytesText);
+    PhDeleteCachedFormat(&ProcessNode->WorkingSetText);
+    PhDeleteCachedFormat(&ProcessNode->PeakWorkingSetText);
+    PhDeleteCachedFormat(&ProcessNode->PrivateWsText);
+    PhDeleteCachedFormat(&ProcessNode->SharedWsText);
+    PhDeleteCachedFormat(&ProcessNode->ShareableWsText);
+    PhDeleteCachedFormat(&ProcessNode->VirtualSizeText);
+    PhDeleteCachedFormat(&ProcessNode->PeakVirtualSizeText);
+    PhDeleteCachedFormat(&ProcessNode->PageFaultsText);
     if (ProcessNode->IoRoRateText) PhDereferenceObject(ProcessNode->IoRoRateText);
     if (ProcessNode->IoWRateText) PhDereferenceObject(ProcessNode->IoWRateText);
     if (ProcessNode->StartTimeText) PhDereferenceObject(ProcessNode->StartTimeText);
@@ -543,19 +882,19 @@ VOID PhpRemoveProcessNode(
     if (ProcessNode->WindowTitleText) PhDereferenceObject(ProcessNode->WindowTitleText);
     if (ProcessNode->CyclesText) PhDereferenceObject(ProcessNode->CyclesText);
     if (ProcessNode->CyclesDeltaText) PhDereferenceObject(ProcessNode->CyclesDeltaText);
-    if (ProcessNode->ContextSwitchesText) PhDereferenceObject(ProcessNode->ContextSwitchesText);
-    if (ProcessNode->ContextSwitchesDeltaText) PhDereferenceObject(ProcessNode->ContextSwitchesDeltaText);
-    if (ProcessNode->PageFaultsDeltaText) PhDereferenceObject(ProcessNode->PageFaultsDeltaText);
+    PhDeleteCachedFormat(&ProcessNode->ContextSwitchesText);
+    PhDeleteCachedFormat(&ProcessNode->ContextSwitchesDeltaText);
+    PhDeleteCachedFormat(&ProcessNode->PageFaultsDeltaText);
 
     for (i = 0; i < PHPRTLC_IOGROUP_COUNT; i++)
-        if (ProcessNode->IoGroupText[i]) PhDereferenceObject(ProcessNode->IoGroupText[i]);
-
-    if (ProcessNode->PagedPoolText) PhDereferenceObject(ProcessNode->PagedPoolText);
-    if (ProcessNode->PeakPagedPoolText) PhDereferenceObject(ProcessNode->PeakPagedPoolText);
-    if (ProcessNode->NonPagedPoolText) PhDereferenceObject(ProcessNode->NonPagedPoolText);
-    if (ProcessNode->PeakNonPagedPoolText) PhDereferenceObject(ProcessNode->PeakNonPagedPoolText);
-    if (ProcessNode->MinimumWorkingSetText) PhDereferenceObject(ProcessNode->MinimumWorkingSetText);
-    if (ProcessNode->MaximumWorkingSetText) PhDereferenceObject(ProcessNode->MaximumWorkingSetText);
+        PhDeleteCachedFormat(&ProcessNode->IoGroupText[i]);
+
+    PhDeleteCachedFormat(&ProcessNode->PagedPoolText);
+    PhDeleteCachedFormat(&ProcessNode->PeakPagedPoolText);
+    PhDeleteCachedFormat(&ProcessNode->NonPagedPoolText);
+    PhDeleteCachedFormat(&ProcessNode->PeakNonPagedPoolText);
+    PhDeleteCachedFormat(&ProcessNode->MinimumWorkingSetText);
+    PhDeleteCachedFormat(&ProcessNode->MaximumWorkingSetText);
     if (ProcessNode->PrivateBytesDeltaText) PhDereferenceObject(ProcessNode->PrivateBytesDeltaText);
 
     PhDeleteGraphBuffers(&ProcessNode->CpuGraphBuffers);
@@ -573,36 +912,112 @@ VOID PhUpdateProcessNode(
     _In_ PPH_PROCESS_NODE ProcessNode
     )
 {
-    memset(ProcessNode->TextCache, 0, sizeof(PH_STRINGREF) * PHPRTLC_MAXIMUM);
+    PhUpdateProcessNodeEx(ProcessNode, TRUE);
+}
 
-    if (ProcessNode->TooltipText)
-    {
-        PhDereferenceObject(ProcessNode->TooltipText);
-        ProcessNode->TooltipText = NULL;
-    }
+/**
+ * Updates a process node after its process item has changed.
+ *
+ * \param ProcessNode The process node.
+ * \param InvalidateTooltip TRUE to discard the cached tooltip text. If FALSE, the tooltip
+ * is only rebuilt when the fields it depends on have changed (see PhGetProcessTooltipKey()).
+ */
+VOID PhUpdateProcessNodeEx(
+    _In_ PPH_PROCESS_NODE ProcessNode,
+    _In_ BOOLEAN InvalidateTooltip
+    )
+{
+    memset(ProcessNode->TextCache, 0, sizeof(PH_STRINGREF) * PHPRTLC_TEXT_CACHE_SIZE);
+
+    if (InvalidateTooltip)
+        PhClearReference(&ProcessNode->TooltipText);
 
     PhInvalidateTreeNewNode(&ProcessNode->Node, TN_CACHE_COLOR | TN_CACHE_ICON);
     TreeNew_InvalidateNode(ProcessTreeListHandle, &ProcessNode->Node);
 }
 
+VOID PhInvalidateProcessNodeTooltip(
+    _In_ PPH_PROCESS_ITEM ProcessItem
+    )
+{
+    PPH_PROCESS_NODE processNode;
+
+    if (processNode = PhFindProcessNode(ProcessItem->ProcessId))
+    {
+        if (processNode->ProcessItem == ProcessItem)
+        {
+            PhClearReference(&processNode->TooltipText);
+
+            // The tooltip may be showing the old text.
+            TreeNew_UpdateTooltip(ProcessTreeListHandle);
+        }
+    }
+}
+
 VOID PhTickProcessNodes(
     VOID
     )
 {
     ULONG i;
-    PH_TREENEW_VIEW_PARTS viewParts;
     BOOLEAN fullyInvalidated;
-    RECT rect;
+
+    ProcessNodeTickCount++;
+
+    // The handle type columns all use the statistics from the last process provider update.
+    if (NeedHandleStatistics)
+        PhMoveReference(&HandleStatistics, PhReferenceHandleStatistics());
+    else
+        PhClearReference(&HandleStatistics);
 
     // Text invalidation, node updates
 
     for (i = 0; i < ProcessNodeList->Count; i++)
     {
         PPH_PROCESS_NODE node = ProcessNodeList->Items[i];
+        ULONG sequenceNumber;
+        ULONG changeMask;
+        ULONG j;
+
+        sequenceNumber = node->ProcessItem->SequenceNumber;
+
+        // Only invalidate the text of columns whose fields have changed. We have to invalidate
+        // everything if we missed an update, or if the values might be aggregated from
+        // descendant nodes.
+        if (PhCsPropagateCpuUsage && node->Children->Count != 0)
+            changeMask = PH_PROCESS_CHANGE_ALL;
+        else if (sequenceNumber == node->TickSequenceNumber)
+            changeMask = 0;
+        else if (sequenceNumber - node->TickSequenceNumber == 1)
+            changeMask = node->ProcessItem->ChangeMask;
+        else
+            changeMask = PH_PROCESS_CHANGE_ALL;
+
+        node->TickSequenceNumber = sequenceNumber;
 
         // The name and PID never change, so we don't invalidate that.
-        memset(&node->TextCache[2], 0, sizeof(PH_STRINGREF) * (PHPRTLC_MAXIMUM - 2));
-        node->ValidMask &= PHPN_OSCONTEXT | PHPN_IMAGE | PHPN_DPIAWARENESS; // Items that always remain valid
+        if (changeMask == PH_PROCESS_CHANGE_ALL)
+        {
+            memset(&node->TextCache[2], 0, sizeof(PH_STRINGREF) * (PHPRTLC_MAXIMUM - 2));
+        }
+        else
+        {
+            for (j = 2; j < PHPRTLC_MAXIMUM; j++)
+            {
+                if (ProcessColumnChangeMasks[j] == PHP_COLUMN_VOLATILE || (ProcessColumnChangeMasks[j] & changeMask))
+                    PhInitializeEmptyStringRef(&node->TextCache[j]);
+            }
+        }
+
+        // We don't know what plugin columns depend on, so their text is valid for one tick.
+        memset(&node->TextCache[PHPRTLC_MAXIMUM], 0, sizeof(PH_STRINGREF) * PHPRTLC_PLUGIN_CACHE_COUNT);
+
+        // The extra information is only queried when a node is drawn or sorted, so all we do here
+        // is mark it as stale. Slow items are refreshed on a different tick for each process so
+        // that the queries don't all happen at once.
+        if ((ProcessNodeTickCount + HandleToUlong(node->ProcessId) / 4) % PHPN_SLOW_REFRESH_TICKS == 0)
+            node->ValidMask &= PHPN_PERMANENT_MASK;
+        else
+            node->ValidMask &= PHPN_PERMANENT_MASK | PHPN_SLOW_MASK;
 
         // Invalidate graph buffers.
         node->CpuGraphBuffers.Valid = FALSE;
@@ -614,6 +1029,11 @@ VOID PhTickProcessNodes(
             PhpUpdateProcessNodeCycles(node);
     }
 
+    // Every process' values change on each update, so the aggregates are rebuilt in one pass
+    // instead of propagating a delta for each node.
+    for (i = 0; i < ProcessNodeRootList->Count; i++)
+        PhpComputeProcessNodeAggregates(ProcessNodeRootList->Items[i]);
+
     fullyInvalidated = FALSE;
 
     if (ProcessTreeListSortOrder != NoSortOrder)
@@ -623,20 +1043,21 @@ VOID PhTickProcessNodes(
         fullyInvalidated = TRUE;
     }
 
-    // State highlighting
+    // State highlighting. Nodes that are removed here leave holes in the sibling lists, which are
+    // compacted once at the end. Redraw stays disabled until then so that the tree isn't
+    // restructured while the holes are present.
+    TreeNew_SetRedraw(ProcessTreeListHandle, FALSE);
+    ProcessNodeRemovalBatch = TRUE;
     PH_TICK_SH_STATE_TN(PH_PROCESS_NODE, ShState, ProcessNodeStateList, PhpRemoveProcessNode, PhCsHighlightingDuration, ProcessTreeListHandle, TRUE, &fullyInvalidated);
+    ProcessNodeRemovalBatch = FALSE;
+    PhpCompactDirtyProcessNodeSiblings();
+    TreeNew_SetRedraw(ProcessTreeListHandle, TRUE);
 
     if (!fullyInvalidated)
     {
-        // The first column doesn't need to be invalidated because the process name never changes, and
-        // icon changes are handled by the modified event. This small optimization can save more than
-        // 10 million cycles per update (on my machine).
-        TreeNew_GetViewParts(ProcessTreeListHandle, &viewParts);
-        rect.left = viewParts.NormalLeft;
-        rect.top = viewParts.HeaderHeight;
-        rect.right = viewParts.ClientRect.right - viewParts.VScrollWidth;
-        rect.bottom = viewParts.ClientRect.bottom;
-        InvalidateRect(ProcessTreeListHandle, &rect, FALSE);
+        // Only the cells whose text or colors have changed are redrawn. Restructuring the tree (above)
+        // does the same thing.
+        TreeNew_InvalidateChangedCells(ProcessTreeListHandle);
     }
 }
 
@@ -752,6 +1173,129 @@ FORCEINLINE VOID PhpAccumulateField(
     }
 }
 
+FORCEINLINE VOID PhpSubtractField(
+    _Inout_ PVOID Accumulator,
+    _In_ PVOID Value,
+    _In_ PHP_AGGREGATE_TYPE Type
+    )
+{
+    switch (Type)
+    {
+    case AggregateTypeFloat:
+        *(PFLOAT)Accumulator -= *(PFLOAT)Value;
+        break;
+    case AggregateTypeInt32:
+        *(PULONG)Accumulator -= *(PULONG)Value;
+        break;
+    case AggregateTypeInt64:
+        *(PULONG64)Accumulator -= *(PULONG64)Value;
+        break;
+    case AggregateTypeIntPtr:
+        *(PULONG_PTR)Accumulator -= *(PULONG_PTR)Value;
+        break;
+    }
+}
+
+static VOID PhpAccumulateAggregates(
+    _Inout_ PPH_PROCESS_NODE_AGGREGATES Accumulator,
+    _In_ PPH_PROCESS_NODE_AGGREGATES Aggregates,
+    _In_ BOOLEAN Subtract
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < RTL_NUMBER_OF(PhpAggregateFields); i++)
+    {
+        PVOID accumulator = PTR_ADD_OFFSET(Accumulator, PhpAggregateFields[i].AggregateFieldOffset);
+        PVOID value = PTR_ADD_OFFSET(Aggregates, PhpAggregateFields[i].AggregateFieldOffset);
+
+        if (Subtract)
+            PhpSubtractField(accumulator, value, PhpAggregateFields[i].Type);
+        else
+            PhpAccumulateField(accumulator, value, PhpAggregateFields[i].Type);
+    }
+}
+
+/**
+ * Sets the aggregates of a node to its own values plus the aggregates of its children.
+ *
+ * \param ProcessNode The node.
+ * \param Recursive TRUE to recompute the aggregates of all descendants first, FALSE to use the
+ * aggregates that the children already have.
+ */
+static VOID PhpSumProcessNodeAggregates(
+    _Inout_ PPH_PROCESS_NODE ProcessNode,
+    _In_ BOOLEAN Recursive
+    )
+{
+    ULONG i;
+
+    memset(&ProcessNode->Aggregates, 0, sizeof(PH_PROCESS_NODE_AGGREGATES));
+
+    for (i = 0; i < RTL_NUMBER_OF(PhpAggregateFields); i++)
+    {
+        PhpAccumulateField(
+            PTR_ADD_OFFSET(&ProcessNode->Aggregates, PhpAggregateFields[i].AggregateFieldOffset),
+            PTR_ADD_OFFSET(ProcessNode->ProcessItem, PhpAggregateFields[i].ItemFieldOffset),
+            PhpAggregateFields[i].Type
+            );
+    }
+
+    for (i = 0; i < ProcessNode->Children->Count; i++)
+    {
+        PPH_PROCESS_NODE node = ProcessNode->Children->Items[i];
+
+        if (Recursive)
+            PhpSumProcessNodeAggregates(node, TRUE);
+
+        PhpAccumulateAggregates(&ProcessNode->Aggregates, &node->Aggregates, FALSE);
+    }
+}
+
+VOID PhpComputeProcessNodeAggregates(
+    _Inout_ PPH_PROCESS_NODE ProcessNode
+    )
+{
+    PhpSumProcessNodeAggregates(ProcessNode, TRUE);
+}
+
+/**
+ * Updates aggregates after a node has been linked into the tree.
+ *
+ * \param ProcessNode The new node. Its children must already have valid aggregates.
+ */
+VOID PhpLinkProcessNodeAggregates(
+    _Inout_ PPH_PROCESS_NODE ProcessNode
+    )
+{
+    PPH_PROCESS_NODE_AGGREGATES delta;
+    PPH_PROCESS_NODE node;
+
+    PhpSumProcessNodeAggregates(ProcessNode, FALSE);
+
+    // Any children that were moved to this node were roots, so the ancestors haven't counted
+    // any part of this subtree yet.
+    delta = &ProcessNode->Aggregates;
+
+    for (node = ProcessNode->Parent; node; node = node->Parent)
+        PhpAccumulateAggregates(&node->Aggregates, delta, FALSE);
+}
+
+/**
+ * Updates aggregates before a node is unlinked from the tree along with its descendants.
+ *
+ * \param ProcessNode The node being removed.
+ */
+VOID PhpUnlinkProcessNodeAggregates(
+    _In_ PPH_PROCESS_NODE ProcessNode
+    )
+{
+    PPH_PROCESS_NODE node;
+
+    for (node = ProcessNode->Parent; node; node = node->Parent)
+        PhpAccumulateAggregates(&node->Aggregates, &ProcessNode->Aggregates, TRUE);
+}
+
 static VOID PhpAggregateField(
     _In_ PPH_PROCESS_NODE ProcessNode,
     _In_ PHP_AGGREGATE_TYPE Type,
@@ -778,12 +1322,31 @@ static VOID PhpAggregateFieldIfNeeded(
     _Inout_ PVOID AggregatedValue
     )
 {
+    ULONG i;
+
     if (!PhCsPropagateCpuUsage || ProcessNode->Node.Expanded || ProcessTreeListSortOrder != NoSortOrder)
     {
         PhpAccumulateField(AggregatedValue, PhpFieldForAggregate(ProcessNode, Location, FieldOffset), Type);
     }
     else
     {
+        if (Location == AggregateLocationProcessItem)
+        {
+            for (i = 0; i < RTL_NUMBER_OF(PhpAggregateFields); i++)
+            {
+                if (PhpAggregateFields[i].ItemFieldOffset == FieldOffset)
+                {
+                    PhpAccumulateField(
+                        AggregatedValue,
+                        PTR_ADD_OFFSET(&ProcessNode->Aggregates, PhpAggregateFields[i].AggregateFieldOffset),
+                        Type
+                        );
+                    return;
+                }
+            }
+        }
+
+        // This field isn't maintained, so walk the subtree.
         PhpAggregateField(ProcessNode, Type, Location, FieldOffset, AggregatedValue);
     }
 }
@@ -797,10 +1360,10 @@ static VOID PhpUpdateProcessNodeWsCounters(
         BOOLEAN success = FALSE;
         HANDLE processHandle;
 
-        if (NT_SUCCESS(PhOpenProcess(
-            &processHandle,
+        if (NT_SUCCESS(PhGetProcessItemVmReadHandle(
+            ProcessNode->ProcessItem,
             PROCESS_QUERY_INFORMATION,
-            ProcessNode->ProcessItem->ProcessId
+            &processHandle
             )))
         {
             if (NT_SUCCESS(PhGetProcessWsCounters(
@@ -808,8 +1371,6 @@ static VOID PhpUpdateProcessNodeWsCounters(
                 &ProcessNode->WsCounters
                 )))
                 success = TRUE;
-
-            NtClose(processHandle);
         }
 
         if (!success)
@@ -819,6 +1380,81 @@ static VOID PhpUpdateProcessNodeWsCounters(
     }
 }
 
+// Before Windows 10, the GDI shared handle table contains the handles of every process in our
+// session. We count the handles of all processes in one pass over the table per tick instead of
+// calling GetGuiResources for each process.
+static PUSHORT GdiHandleCounts = NULL; // indexed by process ID / 4
+static ULONG GdiHandleCountsTickCount = 0;
+static BOOLEAN GdiHandleCountsValid = FALSE;
+static BOOLEAN GdiHandleCountsUsable = FALSE;
+
+static VOID PhpCountGdiHandles(
+    VOID
+    )
+{
+    PGDI_SHARED_MEMORY gdiShared;
+    ULONG sessionId;
+    ULONG i;
+
+    GdiHandleCountsTickCount = ProcessNodeTickCount;
+    GdiHandleCountsValid = TRUE;
+    GdiHandleCountsUsable = FALSE;
+
+    if (!(gdiShared = (PGDI_SHARED_MEMORY)NtCurrentPeb()->GdiSharedHandleTable))
+        return;
+
+    // The table only stores the low 16 bits of process IDs, so the counts are ambiguous if any
+    // process in our session has a larger ID.
+
+    sessionId = NtCurrentPeb()->SessionId;
+
+    for (i = 0; i < ProcessNodeList->Count; i++)
+    {
+        PPH_PROCESS_NODE node = ProcessNodeList->Items[i];
+
+        if (node->ProcessItem->SessionId == sessionId && HandleToUlong(node->ProcessId) > 0xffff)
+            return;
+    }
+
+    if (!GdiHandleCounts)
+        GdiHandleCounts = PhAllocate(sizeof(USHORT) * (0x10000 / 4));
+
+    memset(GdiHandleCounts, 0, sizeof(USHORT) * (0x10000 / 4));
+
+    for (i = 0; i < GDI_MAX_HANDLE_COUNT; i++)
+    {
+        PGDI_HANDLE_ENTRY handle = &gdiShared->Handles[i];
+
+        if (GDI_CLIENT_TYPE_FROM_UNIQUE(handle->Unique) == 0)
+            continue;
+
+        GdiHandleCounts[handle->Owner.ProcessId / 4]++;
+    }
+
+    GdiHandleCountsUsable = TRUE;
+}
+
+static BOOLEAN PhpGetGdiHandleCountFromSharedTable(
+    _In_ PPH_PROCESS_ITEM ProcessItem,
+    _Out_ PULONG Count
+    )
+{
+    if (WindowsVersion >= WINDOWS_10)
+        return FALSE;
+    if (ProcessItem->SessionId != NtCurrentPeb()->SessionId)
+        return FALSE;
+
+    if (!GdiHandleCountsValid || GdiHandleCountsTickCount != ProcessNodeTickCount)
+        PhpCountGdiHandles();
+
+    if (!GdiHandleCountsUsable)
+        return FALSE;
+
+    *Count = GdiHandleCounts[HandleToUlong(ProcessItem->ProcessId) / 4];
+
+    return TRUE;
+}
+
 static VOID PhpUpdateProcessNodeGdiUserHandles(
     _Inout_ PPH_PROCESS_NODE ProcessNode
     )
@@ -827,7 +1463,9 @@ static VOID PhpUpdateProcessNodeGdiUserHandles(
     {
         if (ProcessNode->ProcessItem->QueryHandle)
         {
-            ProcessNode->GdiHandles = GetGuiResources(ProcessNode->ProcessItem->QueryHandle, GR_GDIOBJECTS);
+            if (!PhpGetGdiHandleCountFromSharedTable(ProcessNode->ProcessItem, &ProcessNode->GdiHandles))
+                ProcessNode->GdiHandles = GetGuiResources(ProcessNode->ProcessItem->QueryHandle, GR_GDIOBJECTS);
+
             ProcessNode->UserHandles = GetGuiResources(ProcessNode->ProcessItem->QueryHandle, GR_USEROBJECTS);
         }
         else
@@ -900,14 +1538,13 @@ static VOID PhpUpdateProcessNodeDepStatus(
         if (TRUE)
 #endif
         {
-            if (NT_SUCCESS(PhOpenProcess(
-                &processHandle,
+            if (NT_SUCCESS(PhGetProcessItemVmReadHandle(
+                ProcessNode->ProcessItem,
                 PROCESS_QUERY_INFORMATION,
-                ProcessNode->ProcessItem->ProcessId
+                &processHandle
                 )))
             {
                 PhGetProcessDepStatus(processHandle, &depStatus);
-                NtClose(processHandle);
             }
         }
         else
@@ -968,7 +1605,7 @@ static VOID PhpUpdateProcessOsContext(
 
         if (WindowsVersion >= WINDOWS_7)
         {
-            if (NT_SUCCESS(PhOpenProcess(&processHandle, ProcessQueryAccess | PROCESS_VM_READ, ProcessNode->ProcessId)))
+            if (NT_SUCCESS(PhGetProcessItemVmReadHandle(ProcessNode->ProcessItem, ProcessQueryAccess | PROCESS_VM_READ, &processHandle)))
             {
                 if (NT_SUCCESS(PhGetProcessSwitchContext(processHandle, &ProcessNode->OsContextGuid)))
                 {
@@ -985,8 +1622,6 @@ static VOID PhpUpdateProcessOsContext(
                     else if (memcmp(&ProcessNode->OsContextGuid, &XP_CONTEXT_GUID, sizeof(GUID)) == 0)
                         ProcessNode->OsContextVersion = WINDOWS_XP;
                 }
-
-                NtClose(processHandle);
             }
         }
 
@@ -1034,7 +1669,7 @@ static VOID PhpUpdateProcessNodeImage(
         PVOID imageBaseAddress;
         PH_REMOTE_MAPPED_IMAGE mappedImage;
 
-        if (NT_SUCCESS(PhOpenProcess(&processHandle, ProcessQueryAccess | PROCESS_VM_READ, ProcessNode->ProcessId)))
+        if (NT_SUCCESS(PhGetProcessItemVmReadHandle(ProcessNode->ProcessItem, ProcessQueryAccess | PROCESS_VM_READ, &processHandle)))
         {
             if (NT_SUCCESS(PhGetProcessBasicInformation(processHandle, &basicInfo)))
             {
@@ -1065,8 +1700,6 @@ static VOID PhpUpdateProcessNodeImage(
                     }
                 }
             }
-
-            NtClose(processHandle);
         }
 
         ProcessNode->ValidMask |= PHPN_IMAGE;
@@ -1085,17 +1718,12 @@ static VOID PhpUpdateProcessNodeAppId(
 
         PhClearReference(&ProcessNode->AppIdText);
 
-        if (!NT_SUCCESS(PhOpenProcess(&processHandle, ProcessQueryAccess | PROCESS_VM_READ, ProcessNode->ProcessId)))
+        if (!NT_SUCCESS(PhGetProcessItemVmReadHandle(ProcessNode->ProcessItem, ProcessQueryAccess | PROCESS_VM_READ, &processHandle)))
         {
-            if (WindowsVersion >= WINDOWS_7)
-            {
-                if (!NT_SUCCESS(PhOpenProcess(&processHandle, ProcessQueryAccess, ProcessNode->ProcessId)))
-                    goto Done;
-            }
+            if (WindowsVersion >= WINDOWS_7 && ProcessNode->ProcessItem->QueryHandle)
+                processHandle = ProcessNode->ProcessItem->QueryHandle;
             else
-            {
                 goto Done;
-            }
         }
 
         if (NT_SUCCESS(PhGetProcessWindowTitle(
@@ -1110,8 +1738,6 @@ static VOID PhpUpdateProcessNodeAppId(
                 PhDereferenceObject(windowTitle);
         }
 
-        NtClose(processHandle);
-
 Done:
         ProcessNode->ValidMask |= PHPN_APPID;
     }
@@ -1181,6 +1807,75 @@ static VOID PhpUpdateNeedCyclesInformation(
     }
 }
 
+static VOID PhpUpdateNeedHandleStatistics(
+    VOID
+    )
+{
+    static PH_INITONCE initOnce = PH_INITONCE_INIT;
+    static PWSTR typeNames[PHPRTLC_HANDLETYPES_COUNT] =
+    {
+        L"File", L"Key", L"Event", L"Section", L"Thread", L"Process"
+    };
+
+    PH_TREENEW_COLUMN column;
+    ULONG i;
+
+    NeedHandleStatistics = FALSE;
+
+    for (i = 0; i < PHPRTLC_HANDLETYPES_COUNT; i++)
+    {
+        TreeNew_GetColumn(ProcessTreeListHandle, PHPRTLC_FILEHANDLES + i, &column);
+
+        if (column.Visible)
+        {
+            NeedHandleStatistics = TRUE;
+            break;
+        }
+    }
+
+    if (NeedHandleStatistics && PhBeginInitOnce(&initOnce))
+    {
+        for (i = 0; i < PHPRTLC_HANDLETYPES_COUNT; i++)
+        {
+            UNICODE_STRING typeName;
+
+            RtlInitUnicodeString(&typeName, typeNames[i]);
+            HandleTypeColumnTypeIndices[i] = PhGetObjectTypeNumber(&typeName);
+        }
+
+        PhEndInitOnce(&initOnce);
+    }
+
+    PhSetEnabledHandleStatistics(NeedHandleStatistics);
+}
+
+static VOID PhpUpdateProcessNodeHandleTypes(
+    _Inout_ PPH_PROCESS_NODE ProcessNode
+    )
+{
+    if (!(ProcessNode->ValidMask & PHPN_HANDLETYPES))
+    {
+        PULONG counts = NULL;
+        ULONG typeIndex;
+        ULONG i;
+
+        if (HandleStatistics)
+            counts = PhGetProcessCountsHandleStatistics(HandleStatistics, ProcessNode->ProcessId);
+
+        for (i = 0; i < PHPRTLC_HANDLETYPES_COUNT; i++)
+        {
+            typeIndex = HandleTypeColumnTypeIndices[i];
+
+            if (counts && typeIndex < HandleStatistics->NumberOfTypes)
+                ProcessNode->HandleTypeCounts[i] = counts[typeIndex];
+            else
+                ProcessNode->HandleTypeCounts[i] = 0;
+        }
+
+        ProcessNode->ValidMask |= PHPN_HANDLETYPES;
+    }
+}
+
 static VOID PhpUpdateProcessNodeCycles(
     _Inout_ PPH_PROCESS_NODE ProcessNode
     )
@@ -1194,19 +1889,18 @@ static VOID PhpUpdateProcessNodeCycles(
         // System Idle Process requires special treatment.
 
         idleThreadCycleTimes = PhAllocate(
-            sizeof(ULARGE_INTEGER) * (ULONG)PhSystemBasicInformation.NumberOfProcessors
+            sizeof(ULARGE_INTEGER) * PhNumberOfCpus
             );
 
-        if (NT_SUCCESS(NtQuerySystemInformation(
+        if (NT_SUCCESS(PhQueryCpuInformation(
             SystemProcessorIdleCycleTimeInformation,
             idleThreadCycleTimes,
-            sizeof(ULARGE_INTEGER) * (ULONG)PhSystemBasicInformation.NumberOfProcessors,
-            NULL
+            sizeof(ULARGE_INTEGER)
             )))
         {
             cycleTime = 0;
 
-            for (i = 0; i < (ULONG)PhSystemBasicInformation.NumberOfProcessors; i++)
+            for (i = 0; i < PhNumberOfCpus; i++)
                 cycleTime += idleThreadCycleTimes[i].QuadPart;
 
             PhUpdateDelta(&ProcessNode->CyclesDelta, cycleTime);
@@ -1268,9 +1962,38 @@ LONG PhpProcessTreeNewPostSortFunction(
     return PhModifySort(Result, SortOrder);
 }
 
+static PPH_BYTES PhpGetProcessNodeSortKey(
+    _Inout_ PPH_BYTES *SortKey,
+    _In_opt_ PPH_STRING String
+    )
+{
+    // The names sorted this way never change once the process item has been
+    // published, so the key only has to be created once.
+    if (!*SortKey && String)
+        *SortKey = PhCreateNaturalSortKey(&String->sr, TRUE);
+
+    return *SortKey;
+}
+
+static int PhpCompareProcessNodeSortKeys(
+    _In_opt_ PPH_BYTES Key1,
+    _In_opt_ PPH_BYTES Key2
+    )
+{
+    if (Key1 && Key2)
+        return PhCompareNaturalSortKey(Key1, Key2);
+    else if (!Key1)
+        return !Key2 ? 0 : -1;
+    else
+        return 1;
+}
+
 BEGIN_SORT_FUNCTION(Name)
 {
-    sortResult = PhCompareString(processItem1->ProcessName, processItem2->ProcessName, TRUE);
+    sortResult = PhpCompareProcessNodeSortKeys(
+        PhpGetProcessNodeSortKey(&node1->NameSortKey, processItem1->ProcessName),
+        PhpGetProcessNodeSortKey(&node2->NameSortKey, processItem2->ProcessName)
+        );
 }
 END_SORT_FUNCTION
 
@@ -1342,10 +2065,9 @@ END_SORT_FUNCTION
 
 BEGIN_SORT_FUNCTION(FileName)
 {
-    sortResult = PhCompareStringWithNull(
-        processItem1->FileName,
-        processItem2->FileName,
-        TRUE
+    sortResult = PhpCompareProcessNodeSortKeys(
+        PhpGetProcessNodeSortKey(&node1->FileNameSortKey, processItem1->FileName),
+        PhpGetProcessNodeSortKey(&node2->FileNameSortKey, processItem2->FileName)
         );
 }
 END_SORT_FUNCTION
@@ -1835,6 +2557,54 @@ BEGIN_SORT_FUNCTION(CfGuard)
 }
 END_SORT_FUNCTION
 
+BEGIN_SORT_FUNCTION(FileHandles)
+{
+    PhpUpdateProcessNodeHandleTypes(node1);
+    PhpUpdateProcessNodeHandleTypes(node2);
+    sortResult = uintcmp(node1->HandleTypeCounts[0], node2->HandleTypeCounts[0]);
+}
+END_SORT_FUNCTION
+
+BEGIN_SORT_FUNCTION(KeyHandles)
+{
+    PhpUpdateProcessNodeHandleTypes(node1);
+    PhpUpdateProcessNodeHandleTypes(node2);
+    sortResult = uintcmp(node1->HandleTypeCounts[1], node2->HandleTypeCounts[1]);
+}
+END_SORT_FUNCTION
+
+BEGIN_SORT_FUNCTION(EventHandles)
+{
+    PhpUpdateProcessNodeHandleTypes(node1);
+    PhpUpdateProcessNodeHandleTypes(node2);
+    sortResult = uintcmp(node1->HandleTypeCounts[2], node2->HandleTypeCounts[2]);
+}
+END_SORT_FUNCTION
+
+BEGIN_SORT_FUNCTION(SectionHandles)
+{
+    PhpUpdateProcessNodeHandleTypes(node1);
+    PhpUpdateProcessNodeHandleTypes(node2);
+    sortResult = uintcmp(node1->HandleTypeCounts[3], node2->HandleTypeCounts[3]);
+}
+END_SORT_FUNCTION
+
+BEGIN_SORT_FUNCTION(ThreadHandles)
+{
+    PhpUpdateProcessNodeHandleTypes(node1);
+    PhpUpdateProcessNodeHandleTypes(node2);
+    sortResult = uintcmp(node1->HandleTypeCounts[4], node2->HandleTypeCounts[4]);
+}
+END_SORT_FUNCTION
+
+BEGIN_SORT_FUNCTION(ProcessHandles)
+{
+    PhpUpdateProcessNodeHandleTypes(node1);
+    PhpUpdateProcessNodeHandleTypes(node2);
+    sortResult = uintcmp(node1->HandleTypeCounts[5], node2->HandleTypeCounts[5]);
+}
+END_SORT_FUNCTION
+
 BOOLEAN NTAPI PhpProcessTreeNewCallback(
     _In_ HWND hwnd,
     _In_ PH_TREENEW_MESSAGE Message,
@@ -1950,10 +2720,17 @@ BOOLEAN NTAPI PhpProcessTreeNewCallback(
                         SORT_FUNCTION(PackageName),
                         SORT_FUNCTION(AppId),
                         SORT_FUNCTION(DpiAwareness),
-                        SORT_FUNCTION(CfGuard)
+                        SORT_FUNCTION(CfGuard),
+                        SORT_FUNCTION(FileHandles),
+                        SORT_FUNCTION(KeyHandles),
+                        SORT_FUNCTION(EventHandles),
+                        SORT_FUNCTION(SectionHandles),
+                        SORT_FUNCTION(ThreadHandles),
+                        SORT_FUNCTION(ProcessHandles)
                     };
                     static PH_INITONCE initOnce = PH_INITONCE_INIT;
                     int (__cdecl *sortFunction)(const void *, const void *);
+                    ULONG i;
 
                     if (PhBeginInitOnce(&initOnce))
                     {
@@ -1982,10 +2759,13 @@ BOOLEAN NTAPI PhpProcessTreeNewCallback(
 
                         if (sortFunction)
                         {
-                            qsort(ProcessNodeList->Items, ProcessNodeList->Count, sizeof(PVOID), sortFunction);
+                            PhSortItemsIncremental(ProcessNodeList->Items, ProcessNodeList->Count, sortFunction);
                         }
                     }
 
+                    for (i = 0; i < ProcessNodeList->Count; i++)
+                        ((PPH_PROCESS_NODE)ProcessNodeList->Items[i])->ListIndex = i;
+
                     getChildren->Children = (PPH_TREENEW_NODE *)ProcessNodeList->Items;
                     getChildren->NumberOfChildren = ProcessNodeList->Count;
                 }
@@ -2012,6 +2792,16 @@ BOOLEAN NTAPI PhpProcessTreeNewCallback(
             node = (PPH_PROCESS_NODE)getCellText->Node;
             processItem = node->ProcessItem;
 
+            // Cell text is only requested for visible nodes, so this is a good time to make sure
+            // the process gets its icon and version information before everything else.
+            if (!node->QueryPrioritized)
+            {
+                node->QueryPrioritized = TRUE;
+
+                if (!PhTestEvent(&processItem->Stage1Event))
+                    PhPrioritizeProcessQuery(processItem);
+            }
+
             switch (getCellText->Id)
             {
             case PHPRTLC_NAME:
@@ -2084,8 +2874,7 @@ BOOLEAN NTAPI PhpProcessTreeNewCallback(
                 {
                     SIZE_T value = 0;
                     PhpAggregateFieldIfNeeded(node, AggregateTypeIntPtr, AggregateLocationProcessItem, FIELD_OFFSET(PH_PROCESS_ITEM, VmCounters.PagefileUsage), &value);
-                    PhMoveReference(&node->PrivateBytesText, PhFormatSize(value, -1));
-                    getCellText->Text = node->PrivateBytesText->sr;
+                    getCellText->Text = PhFormatSizeCached(&node->PrivateBytesText, value)->sr;
                 }
                 break;
             case PHPRTLC_USERNAME:
@@ -2110,54 +2899,45 @@ BOOLEAN NTAPI PhpProcessTreeNewCallback(
                 getCellText->Text = PhGetStringRef(processItem->CommandLine);
                 break;
             case PHPRTLC_PEAKPRIVATEBYTES:
-                PhMoveReference(&node->PeakPrivateBytesText, PhFormatSize(processItem->VmCounters.PeakPagefileUsage, -1));
-                getCellText->Text = node->PeakPrivateBytesText->sr;
+                getCellText->Text = PhFormatSizeCached(&node->PeakPrivateBytesText, processItem->VmCounters.PeakPagefileUsage)->sr;
                 break;
             case PHPRTLC_WORKINGSET:
                 {
                     SIZE_T value = 0;
                     PhpAggregateFieldIfNeeded(node, AggregateTypeIntPtr, AggregateLocationProcessItem, FIELD_OFFSET(PH_PROCESS_ITEM, VmCounters.WorkingSetSize), &value);
-                    PhMoveReference(&node->WorkingSetText, PhFormatSize(value, -1));
-                    getCellText->Text = node->WorkingSetText->sr;
+                    getCellText->Text = PhFormatSizeCached(&node->WorkingSetText, value)->sr;
                 }
                 break;
             case PHPRTLC_PEAKWORKINGSET:
-                PhMoveReference(&node->PeakWorkingSetText, PhFormatSize(processItem->VmCounters.PeakWorkingSetSize, -1));
-                getCellText->Text = node->PeakWorkingSetText->sr;
+                getCellText->Text = PhFormatSizeCached(&node->PeakWorkingSetText, processItem->VmCounters.PeakWorkingSetSize)->sr;
                 break;
             case PHPRTLC_PRIVATEWS:
                 if (WindowsVersion >= WINDOWS_7)
                 {
-                    PhMoveReference(&node->PrivateWsText, PhFormatSize(processItem->WorkingSetPrivateSize, -1));
+                    getCellText->Text = PhFormatSizeCached(&node->PrivateWsText, processItem->WorkingSetPrivateSize)->sr;
                 }
                 else
                 {
                     PhpUpdateProcessNodeWsCounters(node);
-                    PhMoveReference(&node->PrivateWsText, PhFormatSize((ULONG64)node->WsCounters.NumberOfPrivatePages * PAGE_SIZE, -1));
+                    getCellText->Text = PhFormatSizeCached(&node->PrivateWsText, (ULONG64)node->WsCounters.NumberOfPrivatePages * PAGE_SIZE)->sr;
                 }
-                getCellText->Text = node->PrivateWsText->sr;
                 break;
             case PHPRTLC_SHAREDWS:
                 PhpUpdateProcessNodeWsCounters(node);
-                PhMoveReference(&node->SharedWsText, PhFormatSize((ULONG64)node->WsCounters.NumberOfSharedPages * PAGE_SIZE, -1));
-                getCellText->Text = node->SharedWsText->sr;
+                getCellText->Text = PhFormatSizeCached(&node->SharedWsText, (ULONG64)node->WsCounters.NumberOfSharedPages * PAGE_SIZE)->sr;
                 break;
             case PHPRTLC_SHAREABLEWS:
                 PhpUpdateProcessNodeWsCounters(node);
-                PhMoveReference(&node->ShareableWsText, PhFormatSize((ULONG64)node->WsCounters.NumberOfShareablePages * PAGE_SIZE, -1));
-                getCellText->Text = node->ShareableWsText->sr;
+                getCellText->Text = PhFormatSizeCached(&node->ShareableWsText, (ULONG64)node->WsCounters.NumberOfShareablePages * PAGE_SIZE)->sr;
                 break;
             case PHPRTLC_VIRTUALSIZE:
-                PhMoveReference(&node->VirtualSizeText, PhFormatSize(processItem->VmCounters.VirtualSize, -1));
-                getCellText->Text = node->VirtualSizeText->sr;
+                getCellText->Text = PhFormatSizeCached(&node->VirtualSizeText, processItem->VmCounters.VirtualSize)->sr;
                 break;
             case PHPRTLC_PEAKVIRTUALSIZE:
-                PhMoveReference(&node->PeakVirtualSizeText, PhFormatSize(processItem->VmCounters.PeakVirtualSize, -1));
-                getCellText->Text = node->PeakVirtualSizeText->sr;
+                getCellText->Text = PhFormatSizeCached(&node->PeakVirtualSizeText, processItem->VmCounters.PeakVirtualSize)->sr;
                 break;
             case PHPRTLC_PAGEFAULTS:
-                PhMoveReference(&node->PageFaultsText, PhFormatUInt64(processItem->VmCounters.PageFaultCount, TRUE));
-                getCellText->Text = node->PageFaultsText->sr;
+                getCellText->Text = PhFormatUInt64Cached(&node->PageFaultsText, processItem->VmCounters.PageFaultCount, TRUE)->sr;
                 break;
             case PHPRTLC_SESSIONID:
                 PhInitializeStringRefLongHint(&getCellText->Text, processItem->SessionIdString);
@@ -2427,85 +3207,73 @@ BOOLEAN NTAPI PhpProcessTreeNewCallback(
             case PHPRTLC_CONTEXTSWITCHES:
                 if (processItem->ContextSwitchesDelta.Value != 0)
                 {
-                    PhMoveReference(&node->ContextSwitchesText, PhFormatUInt64(processItem->ContextSwitchesDelta.Value, TRUE));
-                    getCellText->Text = node->ContextSwitchesText->sr;
+                    getCellText->Text = PhFormatUInt64Cached(&node->ContextSwitchesText, processItem->ContextSwitchesDelta.Value, TRUE)->sr;
                 }
                 break;
             case PHPRTLC_CONTEXTSWITCHESDELTA:
                 if ((LONG)processItem->ContextSwitchesDelta.Delta > 0) // the delta may be negative if a thread exits - just don't show anything
                 {
-                    PhMoveReference(&node->ContextSwitchesDeltaText, PhFormatUInt64(processItem->ContextSwitchesDelta.Delta, TRUE));
-                    getCellText->Text = node->ContextSwitchesDeltaText->sr;
+                    getCellText->Text = PhFormatUInt64Cached(&node->ContextSwitchesDeltaText, processItem->ContextSwitchesDelta.Delta, TRUE)->sr;
                 }
                 break;
             case PHPRTLC_PAGEFAULTSDELTA:
                 if (processItem->PageFaultsDelta.Delta != 0)
                 {
-                    PhMoveReference(&node->PageFaultsDeltaText, PhFormatUInt64(processItem->PageFaultsDelta.Delta, TRUE));
-                    getCellText->Text = node->PageFaultsDeltaText->sr;
+                    getCellText->Text = PhFormatUInt64Cached(&node->PageFaultsDeltaText, processItem->PageFaultsDelta.Delta, TRUE)->sr;
                 }
                 break;
             case PHPRTLC_IOREADS:
                 if (processItem->IoReadCountDelta.Value != 0)
                 {
-                    PhMoveReference(&node->IoGroupText[0], PhFormatUInt64(processItem->IoReadCountDelta.Value, TRUE));
-                    getCellText->Text = node->IoGroupText[0]->sr;
+                    getCellText->Text = PhFormatUInt64Cached(&node->IoGroupText[0], processItem->IoReadCountDelta.Value, TRUE)->sr;
                 }
                 break;
             case PHPRTLC_IOWRITES:
                 if (processItem->IoWriteCountDelta.Value != 0)
                 {
-                    PhMoveReference(&node->IoGroupText[1], PhFormatUInt64(processItem->IoWriteCountDelta.Value, TRUE));
-                    getCellText->Text = node->IoGroupText[1]->sr;
+                    getCellText->Text = PhFormatUInt64Cached(&node->IoGroupText[1], processItem->IoWriteCountDelta.Value, TRUE)->sr;
                 }
                 break;
             case PHPRTLC_IOOTHER:
                 if (processItem->IoOtherCountDelta.Value != 0)
                 {
-                    PhMoveReference(&node->IoGroupText[2], PhFormatUInt64(processItem->IoOtherCountDelta.Value, TRUE));
-                    getCellText->Text = node->IoGroupText[2]->sr;
+                    getCellText->Text = PhFormatUInt64Cached(&node->IoGroupText[2], processItem->IoOtherCountDelta.Value, TRUE)->sr;
                 }
                 break;
             case PHPRTLC_IOREADBYTES:
                 if (processItem->IoReadDelta.Value != 0)
                 {
-                    PhMoveReference(&node->IoGroupText[3], PhFormatSize(processItem->IoReadDelta.Value, -1));
-                    getCellText->Text = node->IoGroupText[3]->sr;
+                    getCellText->Text = PhFormatSizeCached(&node->IoGroupText[3], processItem->IoReadDelta.Value)->sr;
                 }
                 break;
             case PHPRTLC_IOWRITEBYTES:
                 if (processItem->IoWriteDelta.Value != 0)
                 {
-                    PhMoveReference(&node->IoGroupText[4], PhFormatSize(processItem->IoWriteDelta.Value, -1));
-                    getCellText->Text = node->IoGroupText[4]->sr;
+                    getCellText->Text = PhFormatSizeCached(&node->IoGroupText[4], processItem->IoWriteDelta.Value)->sr;
                 }
                 break;
             case PHPRTLC_IOOTHERBYTES:
                 if (processItem->IoOtherDelta.Value != 0)
                 {
-                    PhMoveReference(&node->IoGroupText[5], PhFormatSize(processItem->IoOtherDelta.Value, -1));
-                    getCellText->Text = node->IoGroupText[5]->sr;
+                    getCellText->Text = PhFormatSizeCached(&node->IoGroupText[5], processItem->IoOtherDelta.Value)->sr;
                 }
                 break;
             case PHPRTLC_IOREADSDELTA:
                 if (processItem->IoReadCountDelta.Delta != 0)
                 {
-                    PhMoveReference(&node->IoGroupText[6], PhFormatUInt64(processItem->IoReadCountDelta.Delta, TRUE));
-                    getCellText->Text = node->IoGroupText[6]->sr;
+                    getCellText->Text = PhFormatUInt64Cached(&node->IoGroupText[6], processItem->IoReadCountDelta.Delta, TRUE)->sr;
                 }
                 break;
             case PHPRTLC_IOWRITESDELTA:
                 if (processItem->IoWriteCountDelta.Delta != 0)
                 {
-                    PhMoveReference(&node->IoGroupText[7], PhFormatUInt64(processItem->IoWriteCountDelta.Delta, TRUE));
-                    getCellText->Text = node->IoGroupText[7]->sr;
+                    getCellText->Text = PhFormatUInt64Cached(&node->IoGroupText[7], processItem->IoWriteCountDelta.Delta, TRUE)->sr;
                 }
                 break;
             case PHPRTLC_IOOTHERDELTA:
                 if (processItem->IoOtherCountDelta.Delta != 0)
                 {
-                    PhMoveReference(&node->IoGroupText[8], PhFormatUInt64(processItem->IoOtherCountDelta.Delta, TRUE));
-                    getCellText->Text = node->IoGroupText[8]->sr;
+                    getCellText->Text = PhFormatUInt64Cached(&node->IoGroupText[8], processItem->IoOtherCountDelta.Delta, TRUE)->sr;
                 }
                 break;
             case PHPRTLC_OSCONTEXT:
@@ -2541,30 +3309,24 @@ BOOLEAN NTAPI PhpProcessTreeNewCallback(
                 }
                 break;
             case PHPRTLC_PAGEDPOOL:
-                PhMoveReference(&node->PagedPoolText, PhFormatSize(processItem->VmCounters.QuotaPagedPoolUsage, -1));
-                getCellText->Text = node->PagedPoolText->sr;
+                getCellText->Text = PhFormatSizeCached(&node->PagedPoolText, processItem->VmCounters.QuotaPagedPoolUsage)->sr;
                 break;
             case PHPRTLC_PEAKPAGEDPOOL:
-                PhMoveReference(&node->PeakPagedPoolText, PhFormatSize(processItem->VmCounters.QuotaPeakPagedPoolUsage, -1));
-                getCellText->Text = node->PeakPagedPoolText->sr;
+                getCellText->Text = PhFormatSizeCached(&node->PeakPagedPoolText, processItem->VmCounters.QuotaPeakPagedPoolUsage)->sr;
                 break;
             case PHPRTLC_NONPAGEDPOOL:
-                PhMoveReference(&node->NonPagedPoolText, PhFormatSize(processItem->VmCounters.QuotaNonPagedPoolUsage, -1));
-                getCellText->Text = node->NonPagedPoolText->sr;
+                getCellText->Text = PhFormatSizeCached(&node->NonPagedPoolText, processItem->VmCounters.QuotaNonPagedPoolUsage)->sr;
                 break;
             case PHPRTLC_PEAKNONPAGEDPOOL:
-                PhMoveReference(&node->PeakNonPagedPoolText, PhFormatSize(processItem->VmCounters.QuotaPeakNonPagedPoolUsage, -1));
-                getCellText->Text = node->PeakNonPagedPoolText->sr;
+                getCellText->Text = PhFormatSizeCached(&node->PeakNonPagedPoolText, processItem->VmCounters.QuotaPeakNonPagedPoolUsage)->sr;
                 break;
             case PHPRTLC_MINIMUMWORKINGSET:
                 PhpUpdateProcessNodeQuotaLimits(node);
-                PhMoveReference(&node->MinimumWorkingSetText, PhFormatSize(node->MinimumWorkingSetSize, -1));
-                getCellText->Text = node->MinimumWorkingSetText->sr;
+                getCellText->Text = PhFormatSizeCached(&node->MinimumWorkingSetText, node->MinimumWorkingSetSize)->sr;
                 break;
             case PHPRTLC_MAXIMUMWORKINGSET:
                 PhpUpdateProcessNodeQuotaLimits(node);
-                PhMoveReference(&node->MaximumWorkingSetText, PhFormatSize(node->MaximumWorkingSetSize, -1));
-                getCellText->Text = node->MaximumWorkingSetText->sr;
+                getCellText->Text = PhFormatSizeCached(&node->MaximumWorkingSetText, node->MaximumWorkingSetSize)->sr;
                 break;
             case PHPRTLC_PRIVATEBYTESDELTA:
                 {
@@ -2660,6 +3422,19 @@ BOOLEAN NTAPI PhpProcessTreeNewCallback(
                     PhInitializeStringRef(&getCellText->Text, L"N/A");
                 }
                 break;
+            case PHPRTLC_FILEHANDLES:
+            case PHPRTLC_KEYHANDLES:
+            case PHPRTLC_EVENTHANDLES:
+            case PHPRTLC_SECTIONHANDLES:
+            case PHPRTLC_THREADHANDLES:
+            case PHPRTLC_PROCESSHANDLES:
+                {
+                    ULONG index = getCellText->Id - PHPRTLC_FILEHANDLES;
+
+                    PhpUpdateProcessNodeHandleTypes(node);
+                    PhpFormatInt32GroupDigits(node->HandleTypeCounts[index], node->HandleTypeCountsText[index], sizeof(node->HandleTypeCountsText[index]), &getCellText->Text);
+                }
+                break;
             default:
                 return FALSE;
             }
@@ -2759,6 +3534,7 @@ BOOLEAN NTAPI PhpProcessTreeNewCallback(
         {
             PPH_TREENEW_GET_CELL_TOOLTIP getCellTooltip = Parameter1;
             ULONG tickCount;
+            ULONG tooltipKey;
 
             node = (PPH_PROCESS_NODE)getCellTooltip->Node;
 
@@ -2767,10 +3543,15 @@ BOOLEAN NTAPI PhpProcessTreeNewCallback(
 
             tickCount = GetTickCount();
 
-            if ((LONG)(node->TooltipTextValidToTickCount - tickCount) < 0)
+            tooltipKey = PhGetProcessTooltipKey(node->ProcessItem);
+
+            if ((LONG)(node->TooltipTextValidToTickCount - tickCount) < 0 || node->TooltipKey != tooltipKey)
                 PhClearReference(&node->TooltipText);
             if (!node->TooltipText)
+            {
                 node->TooltipText = PhGetProcessTooltipText(node->ProcessItem, &node->TooltipTextValidToTickCount);
+                node->TooltipKey = tooltipKey;
+            }
 
             if (!PhIsNullOrEmptyString(node->TooltipText))
             {
@@ -2826,14 +3607,14 @@ BOOLEAN NTAPI PhpProcessTreeNewCallback(
                     PhGetDrawInfoGraphBuffers(
                         &node->CpuGraphBuffers,
                         &drawInfo,
-                        processItem->CpuKernelHistory.Count
+                        PhGetProcessItemHistoryCount(processItem, ProcessCpuKernelHistory)
                         );
 
                     if (!node->CpuGraphBuffers.Valid)
                     {
-                        PhCopyCircularBuffer_FLOAT(&processItem->CpuKernelHistory,
+                        PhCopyProcessItemHistory(processItem, ProcessCpuKernelHistory,
                             node->CpuGraphBuffers.Data1, drawInfo.LineDataCount);
-                        PhCopyCircularBuffer_FLOAT(&processItem->CpuUserHistory,
+                        PhCopyProcessItemHistory(processItem, ProcessCpuUserHistory,
                             node->CpuGraphBuffers.Data2, drawInfo.LineDataCount);
                         node->CpuGraphBuffers.Valid = TRUE;
                     }
@@ -2848,20 +3629,16 @@ BOOLEAN NTAPI PhpProcessTreeNewCallback(
                     PhGetDrawInfoGraphBuffers(
                         &node->PrivateGraphBuffers,
                         &drawInfo,
-                        processItem->PrivateBytesHistory.Count
+                        PhGetProcessItemHistoryCount(processItem, ProcessPrivateBytesHistory)
                         );
 
                     if (!node->PrivateGraphBuffers.Valid)
                     {
-                        ULONG i;
                         FLOAT total;
                         FLOAT max;
 
-                        for (i = 0; i < drawInfo.LineDataCount; i++)
-                        {
-                            node->PrivateGraphBuffers.Data1[i] =
-                                (FLOAT)PhGetItemCircularBuffer_SIZE_T(&processItem->PrivateBytesHistory, i);
-                        }
+                        PhCopyProcessItemHistory(processItem, ProcessPrivateBytesHistory,
+                            node->PrivateGraphBuffers.Data1, drawInfo.LineDataCount);
 
                         // This makes it easier for the user to see what processes are hogging memory.
                         // Scaling is still *not* consistent across all graphs.
@@ -2896,7 +3673,7 @@ BOOLEAN NTAPI PhpProcessTreeNewCallback(
                     PhGetDrawInfoGraphBuffers(
                         &node->IoGraphBuffers,
                         &drawInfo,
-                        processItem->IoReadHistory.Count
+                        PhGetProcessItemHistoryCount(processItem, ProcessIoReadHistory)
                         );
 
                     if (!node->IoGraphBuffers.Valid)
@@ -2911,10 +3688,10 @@ BOOLEAN NTAPI PhpProcessTreeNewCallback(
                             FLOAT data2;
 
                             node->IoGraphBuffers.Data1[i] = data1 =
-                                (FLOAT)PhGetItemCircularBuffer_ULONG64(&processItem->IoReadHistory, i) +
-                                (FLOAT)PhGetItemCircularBuffer_ULONG64(&processItem->IoOtherHistory, i);
+                                PhGetProcessItemHistoryFloat(processItem, ProcessIoReadHistory, i) +
+                                PhGetProcessItemHistoryFloat(processItem, ProcessIoOtherHistory, i);
                             node->IoGraphBuffers.Data2[i] = data2 =
-                                (FLOAT)PhGetItemCircularBuffer_ULONG64(&processItem->IoWriteHistory, i);
+                                PhGetProcessItemHistoryFloat(processItem, ProcessIoWriteHistory, i);
 
                             if (max < data1 + data2)
                                 max = data1 + data2;
@@ -3049,7 +3826,10 @@ BOOLEAN NTAPI PhpProcessTreeNewCallback(
             PhHandleTreeNewColumnMenu(&data);
 
             if (data.ProcessedId == PH_TN_COLUMN_MENU_HIDE_COLUMN_ID || data.ProcessedId == PH_TN_COLUMN_MENU_CHOOSE_COLUMNS_ID)
+            {
                 PhpUpdateNeedCyclesInformation();
+                PhpUpdateNeedHandleStatistics();
+            }
 
             PhDeleteTreeNewColumnMenu(&data);
         }
@@ -3165,7 +3945,7 @@ VOID PhInvalidateAllProcessNodes(
     {
         PPH_PROCESS_NODE node = ProcessNodeList->Items[i];
 
-        memset(node->TextCache, 0, sizeof(PH_STRINGREF) * PHPRTLC_MAXIMUM);
+        memset(node->TextCache, 0, sizeof(PH_STRINGREF) * PHPRTLC_TEXT_CACHE_SIZE);
         PhInvalidateTreeNewNode(&node->Node, TN_CACHE_COLOR);
         node->ValidMask = 0;
 
@@ -3372,32 +4152,108 @@ VOID PhCopyProcessTree(
     PhDereferenceObject(text);
 }
 
+typedef struct _PHP_WRITE_PROCESS_TREE_CONTEXT
+{
+    PULONG DisplayToId;
+    PWSTR *DisplayToText;
+    // The nodes in tree order, and the depth of each node.
+    PPH_PROCESS_NODE *Nodes;
+    PULONG Levels;
+    ULONG Count;
+    PH_STRING_BUILDER FirstColumn;
+} PHP_WRITE_PROCESS_TREE_CONTEXT, *PPHP_WRITE_PROCESS_TREE_CONTEXT;
+
+VOID PhpFlattenProcessNodes(
+    _In_ PPH_PROCESS_NODE Node,
+    _In_ ULONG Level,
+    _Inout_ PPHP_WRITE_PROCESS_TREE_CONTEXT Context
+    )
+{
+    ULONG i;
+
+    Context->Nodes[Context->Count] = Node;
+    Context->Levels[Context->Count] = Level;
+    Context->Count++;
+
+    for (i = 0; i < Node->Children->Count; i++)
+        PhpFlattenProcessNodes(Node->Children->Items[i], Level + 1, Context);
+}
+
+VOID NTAPI PhpWriteProcessTreeGetCell(
+    _In_ ULONG Row,
+    _In_ ULONG Column,
+    _Out_ PPH_STRINGREF Text,
+    _In_opt_ PVOID Context
+    )
+{
+    PPHP_WRITE_PROCESS_TREE_CONTEXT context = Context;
+    PH_TREENEW_GET_CELL_TEXT getCellText;
+    ULONG level;
+
+    PhInitializeEmptyStringRef(Text);
+
+    if (Row == 0)
+    {
+        if (context->DisplayToText[Column])
+            PhInitializeStringRefLongHint(Text, context->DisplayToText[Column]);
+
+        return;
+    }
+
+    getCellText.Node = &context->Nodes[Row - 1]->Node;
+    getCellText.Id = context->DisplayToId[Column];
+    PhInitializeEmptyStringRef(&getCellText.Text);
+    TreeNew_GetCellText(ProcessTreeListHandle, &getCellText);
+
+    level = context->Levels[Row - 1];
+
+    if (Column != 0 || level == 0)
+    {
+        *Text = getCellText.Text;
+    }
+    else
+    {
+        // If this is the first column in the row, add some indentation.
+        PhRemoveEndStringBuilder(&context->FirstColumn, context->FirstColumn.String->Length / sizeof(WCHAR));
+        PhAppendCharStringBuilder2(&context->FirstColumn, ' ', level * 2);
+        PhAppendStringBuilder(&context->FirstColumn, &getCellText.Text);
+        *Text = context->FirstColumn.String->sr;
+    }
+}
+
 VOID PhWriteProcessTree(
     _Inout_ PPH_FILE_STREAM FileStream,
     _In_ ULONG Mode
     )
 {
-    PPH_LIST lines;
+    PHP_WRITE_PROCESS_TREE_CONTEXT context;
+    ULONG columns;
     ULONG i;
 
-    lines = PhGetProcessTreeListLines(
-        ProcessTreeListHandle,
-        ProcessNodeList->Count,
-        ProcessNodeRootList,
-        Mode
-        );
+    PhMapDisplayIndexTreeNew(ProcessTreeListHandle, &context.DisplayToId, &context.DisplayToText, &columns);
 
-    for (i = 0; i < lines->Count; i++)
-    {
-        PPH_STRING line;
+    context.Nodes = PhAllocate(sizeof(PPH_PROCESS_NODE) * ProcessNodeList->Count);
+    context.Levels = PhAllocate(sizeof(ULONG) * ProcessNodeList->Count);
+    context.Count = 0;
+    PhInitializeStringBuilder(&context.FirstColumn, 0x100);
 
-        line = lines->Items[i];
-        PhWriteStringAsUtf8FileStream(FileStream, &line->sr);
-        PhDereferenceObject(line);
-        PhWriteStringAsUtf8FileStream2(FileStream, L"\r\n");
-    }
+    for (i = 0; i < ProcessNodeRootList->Count; i++)
+        PhpFlattenProcessNodes(ProcessNodeRootList->Items[i], 0, &context);
+
+    PhWriteTextTable(
+        FileStream,
+        context.Count + 1, // +1 for the column headers
+        columns,
+        Mode,
+        PhpWriteProcessTreeGetCell,
+        &context
+        );
 
-    PhDereferenceObject(lines);
+    PhDeleteStringBuilder(&context.FirstColumn);
+    PhFree(context.Levels);
+    PhFree(context.Nodes);
+    PhFree(context.DisplayToText);
+    PhFree(context.DisplayToId);
 }
 
 PPH_LIST PhDuplicateProcessNodeList(
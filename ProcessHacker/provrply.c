@@ -0,0 +1,721 @@
+/*
+ * Process Hacker -
+ *   provider data replay
+ *
+ * Copyright (C) 2016 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The replay command records the raw process information, system handle table and connection
+ * tables that the process, handle and network providers query, and later feeds them back to
+ * the providers through PhProviderDataSource. This allows provider updates for a large system
+ * to be measured on any machine.
+ *
+ * ProcessHacker.exe -c -ctype replay -caction capture -cobject file [-cvalue ticks]
+ *   [-interval milliseconds]
+ *
+ * records the given number of ticks (10 by default) to the file.
+ *
+ * ProcessHacker.exe -c -ctype replay -caction run -cobject file [-cvalue passes] [-pid id]
+ *
+ * replays every tick in the file the given number of times (once by default), and writes a
+ * row for each tick to standard output:
+ *
+ * pass,tick,process_us,handle_us,network_us,allocations,objects_created
+ *
+ * The handle provider runs for the process given by -pid, or otherwise the process with the
+ * most handles in the first tick. That process usually doesn't exist on the replaying machine,
+ * so handle names are resolved against this process instead and their cost is not meaningful.
+ * The allocation columns are only filled in by debug builds, which keep the phlib statistics.
+ *
+ * Captures can only be replayed by a build with the same pointer size.
+ */
+
+#include <phapp.h>
+#include <phintrnl.h>
+
+#define PH_REPLAY_MAGIC ('YRHP')
+#define PH_REPLAY_VERSION 1
+
+#define PH_REPLAY_RECORD_PROCESSES 0
+#define PH_REPLAY_RECORD_HANDLES 1
+#define PH_REPLAY_RECORD_NETWORK_TABLE 2 // followed by the other network tables
+#define PH_REPLAY_RECORD_MAXIMUM (PH_REPLAY_RECORD_NETWORK_TABLE + PH_NETWORK_TABLE_MAXIMUM)
+
+#define PH_REPLAY_OPTION_INTERVAL 1
+#define PH_REPLAY_OPTION_PID 2
+
+typedef struct _PH_REPLAY_HEADER
+{
+    ULONG Magic;
+    ULONG Version;
+    ULONG PointerSize;
+    ULONG Reserved;
+} PH_REPLAY_HEADER, *PPH_REPLAY_HEADER;
+
+typedef struct _PH_REPLAY_RECORD
+{
+    ULONG Type;
+    ULONG Tick;
+    ULONG Size; // size of the data following this header, which is padded to 8 bytes
+    ULONG Reserved;
+    ULONG64 BaseAddress; // address of the data when it was captured
+} PH_REPLAY_RECORD, *PPH_REPLAY_RECORD;
+
+#define PH_REPLAY_RECORD_DATA(Record) ((PVOID)((PPH_REPLAY_RECORD)(Record) + 1))
+
+typedef struct _PH_REPLAY_TICK
+{
+    PPH_REPLAY_RECORD Records[PH_REPLAY_RECORD_MAXIMUM];
+} PH_REPLAY_TICK, *PPH_REPLAY_TICK;
+
+typedef struct _PH_REPLAY
+{
+    PVOID ViewBase;
+    SIZE_T ViewSize;
+    PPH_REPLAY_TICK Ticks;
+    ULONG NumberOfTicks;
+    ULONG CurrentTick;
+
+    // The previous process buffer must stay valid while the next one is in use, so the
+    // process information is copied into two alternating buffers.
+    ULONG ProcessBufferIndex;
+    PVOID ProcessBuffers[2];
+    SIZE_T ProcessBufferSizes[2];
+} PH_REPLAY, *PPH_REPLAY;
+
+typedef struct _PH_REPLAY_OPTIONS
+{
+    ULONG Interval;
+    HANDLE ProcessId;
+} PH_REPLAY_OPTIONS, *PPH_REPLAY_OPTIONS;
+
+PPH_PROVIDER_DATA_SOURCE PhProviderDataSource = NULL;
+
+static PH_REPLAY PhpReplay;
+
+static BOOLEAN NTAPI PhpReplayOptionCallback(
+    _In_opt_ PPH_COMMAND_LINE_OPTION Option,
+    _In_opt_ PPH_STRING Value,
+    _In_opt_ PVOID Context
+    )
+{
+    PPH_REPLAY_OPTIONS options = Context;
+    ULONG64 integer;
+
+    if (Option)
+    {
+        switch (Option->Id)
+        {
+        case PH_REPLAY_OPTION_INTERVAL:
+            if (PhStringToInteger64(&Value->sr, 10, &integer))
+                options->Interval = (ULONG)integer;
+            break;
+        case PH_REPLAY_OPTION_PID:
+            if (PhStringToInteger64(&Value->sr, 10, &integer))
+                options->ProcessId = (HANDLE)(ULONG_PTR)integer;
+            break;
+        }
+    }
+
+    return TRUE;
+}
+
+static NTSTATUS PhpWriteReplayRecord(
+    _Inout_ PPH_FILE_STREAM FileStream,
+    _In_ ULONG Type,
+    _In_ ULONG Tick,
+    _In_reads_bytes_(Size) PVOID Buffer,
+    _In_ ULONG Size
+    )
+{
+    static UCHAR padding[8] = { 0 };
+    NTSTATUS status;
+    PH_REPLAY_RECORD record;
+
+    record.Type = Type;
+    record.Tick = Tick;
+    record.Size = Size;
+    record.Reserved = 0;
+    record.BaseAddress = (ULONG64)(ULONG_PTR)Buffer;
+
+    if (!NT_SUCCESS(status = PhWriteFileStream(FileStream, &record, sizeof(PH_REPLAY_RECORD))))
+        return status;
+    if (!NT_SUCCESS(status = PhWriteFileStream(FileStream, Buffer, Size)))
+        return status;
+
+    if (Size & 7)
+        status = PhWriteFileStream(FileStream, padding, 8 - (Size & 7));
+
+    return status;
+}
+
+static NTSTATUS PhpCaptureReplay(
+    _Inout_ PPH_FILE_STREAM FileStream,
+    _In_ ULONG NumberOfTicks,
+    _In_ ULONG Interval
+    )
+{
+    NTSTATUS status;
+    PH_REPLAY_HEADER header;
+    PH_PROCESS_SNAPSHOT processSnapshot;
+    PVOID processes;
+    PSYSTEM_HANDLE_INFORMATION_EX handles;
+    PVOID table;
+    ULONG tableSize;
+    LARGE_INTEGER interval;
+    ULONG tick;
+    ULONG i;
+
+    header.Magic = PH_REPLAY_MAGIC;
+    header.Version = PH_REPLAY_VERSION;
+    header.PointerSize = sizeof(PVOID);
+    header.Reserved = 0;
+
+    if (!NT_SUCCESS(status = PhWriteFileStream(FileStream, &header, sizeof(PH_REPLAY_HEADER))))
+        return status;
+
+    PhInitializeProcessSnapshot(&processSnapshot, SystemProcessInformation);
+
+    for (tick = 0; tick < NumberOfTicks; tick++)
+    {
+        if (tick != 0)
+        {
+            interval.QuadPart = -(LONGLONG)Interval * PH_TIMEOUT_MS;
+            NtDelayExecution(FALSE, &interval);
+        }
+
+        if (NT_SUCCESS(PhUpdateProcessSnapshot(&processSnapshot, &processes)))
+        {
+            status = PhpWriteReplayRecord(FileStream, PH_REPLAY_RECORD_PROCESSES, tick, processes, processSnapshot.DataLength);
+
+            if (!NT_SUCCESS(status))
+                break;
+        }
+
+        if (NT_SUCCESS(PhEnumHandlesEx(&handles)))
+        {
+            status = PhpWriteReplayRecord(
+                FileStream,
+                PH_REPLAY_RECORD_HANDLES,
+                tick,
+                handles,
+                FIELD_OFFSET(SYSTEM_HANDLE_INFORMATION_EX, Handles) +
+                (ULONG)handles->NumberOfHandles * sizeof(SYSTEM_HANDLE_TABLE_ENTRY_INFO_EX)
+                );
+            PhFree(handles);
+
+            if (!NT_SUCCESS(status))
+                break;
+        }
+
+        for (i = 0; i < PH_NETWORK_TABLE_MAXIMUM; i++)
+        {
+            if (table = PhQueryNetworkTable(i, &tableSize))
+            {
+                if (!NT_SUCCESS(status = PhpWriteReplayRecord(FileStream, PH_REPLAY_RECORD_NETWORK_TABLE + i, tick, table, tableSize)))
+                    break;
+            }
+        }
+
+        if (!NT_SUCCESS(status))
+            break;
+    }
+
+    PhDeleteProcessSnapshot(&processSnapshot);
+
+    return status;
+}
+
+static NTSTATUS PhpOpenReplay(
+    _In_ PWSTR FileName,
+    _Out_ PPH_REPLAY Replay
+    )
+{
+    NTSTATUS status;
+    PPH_REPLAY_HEADER header;
+    PUCHAR position;
+    PUCHAR end;
+    ULONG allocatedTicks;
+
+    memset(Replay, 0, sizeof(PH_REPLAY));
+
+    if (!NT_SUCCESS(status = PhMapViewOfEntireFile(FileName, NULL, TRUE, &Replay->ViewBase, &Replay->ViewSize)))
+        return status;
+
+    header = Replay->ViewBase;
+
+    if (Replay->ViewSize < sizeof(PH_REPLAY_HEADER) ||
+        header->Magic != PH_REPLAY_MAGIC ||
+        header->Version != PH_REPLAY_VERSION)
+    {
+        NtUnmapViewOfSection(NtCurrentProcess(), Replay->ViewBase);
+        return STATUS_INVALID_IMAGE_FORMAT;
+    }
+
+    if (header->PointerSize != sizeof(PVOID))
+    {
+        NtUnmapViewOfSection(NtCurrentProcess(), Replay->ViewBase);
+        return STATUS_IMAGE_MACHINE_TYPE_MISMATCH;
+    }
+
+    allocatedTicks = 16;
+    Replay->Ticks = PhAllocate(sizeof(PH_REPLAY_TICK) * allocatedTicks);
+    memset(Replay->Ticks, 0, sizeof(PH_REPLAY_TICK) * allocatedTicks);
+
+    position = (PUCHAR)Replay->ViewBase + sizeof(PH_REPLAY_HEADER);
+    end = (PUCHAR)Replay->ViewBase + Replay->ViewSize;
+
+    while ((SIZE_T)(end - position) >= sizeof(PH_REPLAY_RECORD))
+    {
+        PPH_REPLAY_RECORD record = (PPH_REPLAY_RECORD)position;
+        SIZE_T storedSize;
+
+        storedSize = ((SIZE_T)record->Size + 7) & ~(SIZE_T)7;
+
+        // Stop at a record that was only partially written.
+        if ((SIZE_T)(end - position) - sizeof(PH_REPLAY_RECORD) < storedSize)
+            break;
+        if (record->Type >= PH_REPLAY_RECORD_MAXIMUM)
+            break;
+
+        if (record->Tick >= allocatedTicks)
+        {
+            ULONG newAllocatedTicks;
+
+            newAllocatedTicks = max(allocatedTicks * 2, record->Tick + 1);
+            Replay->Ticks = PhReAllocate(Replay->Ticks, sizeof(PH_REPLAY_TICK) * newAllocatedTicks);
+            memset(&Replay->Ticks[allocatedTicks], 0, sizeof(PH_REPLAY_TICK) * (newAllocatedTicks - allocatedTicks));
+            allocatedTicks = newAllocatedTicks;
+        }
+
+        Replay->Ticks[record->Tick].Records[record->Type] = record;
+
+        if (Replay->NumberOfTicks <= record->Tick)
+            Replay->NumberOfTicks = record->Tick + 1;
+
+        position += sizeof(PH_REPLAY_RECORD) + storedSize;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static VOID PhpCloseReplay(
+    _In_ PPH_REPLAY Replay
+    )
+{
+    if (Replay->ProcessBuffers[0])
+        PhFreePage(Replay->ProcessBuffers[0]);
+    if (Replay->ProcessBuffers[1])
+        PhFreePage(Replay->ProcessBuffers[1]);
+
+    PhFree(Replay->Ticks);
+    NtUnmapViewOfSection(NtCurrentProcess(), Replay->ViewBase);
+}
+
+static NTSTATUS NTAPI PhpReplayQueryProcesses(
+    _Out_ PVOID *Processes
+    )
+{
+    PPH_REPLAY_RECORD record;
+    ULONG index;
+    PUCHAR buffer;
+    ULONG offset;
+    ULONG_PTR nameOffset;
+    PSYSTEM_PROCESS_INFORMATION process;
+
+    record = PhpReplay.Ticks[PhpReplay.CurrentTick].Records[PH_REPLAY_RECORD_PROCESSES];
+
+    if (!record || record->Size < sizeof(SYSTEM_PROCESS_INFORMATION))
+        return STATUS_NO_MORE_ENTRIES;
+
+    index = PhpReplay.ProcessBufferIndex ^ 1;
+
+    if (PhpReplay.ProcessBufferSizes[index] < record->Size)
+    {
+        if (PhpReplay.ProcessBuffers[index])
+            PhFreePage(PhpReplay.ProcessBuffers[index]);
+
+        PhpReplay.ProcessBuffers[index] = PhAllocatePage(record->Size, &PhpReplay.ProcessBufferSizes[index]);
+
+        if (!PhpReplay.ProcessBuffers[index])
+        {
+            PhpReplay.ProcessBufferSizes[index] = 0;
+            return STATUS_NO_MEMORY;
+        }
+    }
+
+    buffer = PhpReplay.ProcessBuffers[index];
+    memcpy(buffer, PH_REPLAY_RECORD_DATA(record), record->Size);
+
+    // The image names point into the buffer that was captured. Rebase them, and cut the list
+    // short if an entry doesn't fit.
+
+    offset = 0;
+
+    while (TRUE)
+    {
+        process = (PSYSTEM_PROCESS_INFORMATION)(buffer + offset);
+
+        if (process->ImageName.Buffer)
+        {
+            nameOffset = (ULONG_PTR)process->ImageName.Buffer - (ULONG_PTR)record->BaseAddress;
+
+            if (nameOffset < record->Size && process->ImageName.Length <= record->Size - nameOffset)
+            {
+                process->ImageName.Buffer = (PWCH)(buffer + nameOffset);
+            }
+            else
+            {
+                process->ImageName.Length = 0;
+                process->ImageName.MaximumLength = 0;
+                process->ImageName.Buffer = NULL;
+            }
+        }
+
+        if (process->NextEntryOffset == 0)
+            break;
+
+        if (process->NextEntryOffset > record->Size - offset ||
+            record->Size - offset - process->NextEntryOffset < sizeof(SYSTEM_PROCESS_INFORMATION))
+        {
+            process->NextEntryOffset = 0;
+            break;
+        }
+
+        offset += process->NextEntryOffset;
+    }
+
+    PhpReplay.ProcessBufferIndex = index;
+    *Processes = buffer;
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS NTAPI PhpReplayQueryHandles(
+    _Out_ PSYSTEM_HANDLE_INFORMATION_EX *Handles
+    )
+{
+    PPH_REPLAY_RECORD record;
+    PSYSTEM_HANDLE_INFORMATION_EX handles;
+
+    record = PhpReplay.Ticks[PhpReplay.CurrentTick].Records[PH_REPLAY_RECORD_HANDLES];
+
+    if (!record || record->Size < FIELD_OFFSET(SYSTEM_HANDLE_INFORMATION_EX, Handles))
+        return STATUS_NO_MORE_ENTRIES;
+
+    handles = PhAllocate(record->Size);
+    memcpy(handles, PH_REPLAY_RECORD_DATA(record), record->Size);
+
+    if (handles->NumberOfHandles > (record->Size - FIELD_OFFSET(SYSTEM_HANDLE_INFORMATION_EX, Handles)) / sizeof(SYSTEM_HANDLE_TABLE_ENTRY_INFO_EX))
+        handles->NumberOfHandles = (record->Size - FIELD_OFFSET(SYSTEM_HANDLE_INFORMATION_EX, Handles)) / sizeof(SYSTEM_HANDLE_TABLE_ENTRY_INFO_EX);
+
+    *Handles = handles;
+
+    return STATUS_SUCCESS;
+}
+
+static PVOID NTAPI PhpReplayQueryNetworkTable(
+    _In_ ULONG TableIndex
+    )
+{
+    PPH_REPLAY_RECORD record;
+
+    if (TableIndex >= PH_NETWORK_TABLE_MAXIMUM)
+        return NULL;
+
+    record = PhpReplay.Ticks[PhpReplay.CurrentTick].Records[PH_REPLAY_RECORD_NETWORK_TABLE + TableIndex];
+
+    // The size was derived from the number of entries when the table was captured.
+    if (!record || record->Size < sizeof(ULONG))
+        return NULL;
+
+    return PH_REPLAY_RECORD_DATA(record);
+}
+
+static PH_PROVIDER_DATA_SOURCE PhpReplayDataSource =
+{
+    PhpReplayQueryProcesses,
+    PhpReplayQueryHandles,
+    PhpReplayQueryNetworkTable
+};
+
+/**
+ * Finds the process with the most handles in the first tick that has a handle table.
+ */
+static HANDLE PhpFindReplayHandleProcess(
+    _In_ PPH_REPLAY Replay
+    )
+{
+    PPH_REPLAY_RECORD record = NULL;
+    PSYSTEM_HANDLE_INFORMATION_EX handles;
+    ULONG_PTR numberOfHandles;
+    PPH_HASHTABLE countHashtable;
+    PH_HASHTABLE_ENUM_CONTEXT enumContext;
+    PPH_KEY_VALUE_PAIR pair;
+    HANDLE processId;
+    ULONG_PTR maximumCount;
+    ULONG_PTR i;
+
+    for (i = 0; i < Replay->NumberOfTicks; i++)
+    {
+        if (record = Replay->Ticks[i].Records[PH_REPLAY_RECORD_HANDLES])
+            break;
+    }
+
+    if (!record || record->Size < FIELD_OFFSET(SYSTEM_HANDLE_INFORMATION_EX, Handles))
+        return NULL;
+
+    handles = PH_REPLAY_RECORD_DATA(record);
+    numberOfHandles = min(
+        handles->NumberOfHandles,
+        (record->Size - FIELD_OFFSET(SYSTEM_HANDLE_INFORMATION_EX, Handles)) / sizeof(SYSTEM_HANDLE_TABLE_ENTRY_INFO_EX)
+        );
+    countHashtable = PhCreateSimpleHashtable(256);
+
+    for (i = 0; i < numberOfHandles; i++)
+    {
+        PVOID *count;
+
+        count = PhFindItemSimpleHashtable(countHashtable, (PVOID)handles->Handles[i].UniqueProcessId);
+
+        if (count)
+            *count = (PVOID)((ULONG_PTR)*count + 1);
+        else
+            PhAddItemSimpleHashtable(countHashtable, (PVOID)handles->Handles[i].UniqueProcessId, (PVOID)1);
+    }
+
+    processId = NULL;
+    maximumCount = 0;
+    PhBeginEnumHashtable(countHashtable, &enumContext);
+
+    while (pair = PhNextEnumHashtable(&enumContext))
+    {
+        if ((ULONG_PTR)pair->Value > maximumCount)
+        {
+            processId = pair->Key;
+            maximumCount = (ULONG_PTR)pair->Value;
+        }
+    }
+
+    PhDereferenceObject(countHashtable);
+
+    return processId;
+}
+
+static ULONG64 PhpReplayElapsedMicroseconds(
+    _In_ PLARGE_INTEGER Start,
+    _In_ PLARGE_INTEGER Frequency
+    )
+{
+    LARGE_INTEGER end;
+
+    NtQueryPerformanceCounter(&end, NULL);
+
+    return (ULONG64)(end.QuadPart - Start->QuadPart) * 1000000 / Frequency->QuadPart;
+}
+
+static NTSTATUS PhpRunReplay(
+    _Inout_ PPH_FILE_STREAM FileStream,
+    _In_ ULONG NumberOfPasses,
+    _In_opt_ HANDLE ProcessId
+    )
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    PPH_HANDLE_PROVIDER handleProvider;
+    PH_STRING_BUILDER stringBuilder;
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER start;
+    ULONG64 processTime;
+    ULONG64 handleTime;
+    ULONG64 networkTime;
+#ifdef DEBUG
+    ULONG allocations;
+    ULONG objectsCreated;
+#endif
+    ULONG pass;
+    ULONG tick;
+
+    if (!ProcessId)
+        ProcessId = PhpFindReplayHandleProcess(&PhpReplay);
+
+    // Host names are not needed, and would cost a lookup for every remote address.
+    PhEnableNetworkProviderResolve = FALSE;
+    PhProviderDataSource = &PhpReplayDataSource;
+
+    handleProvider = PhCreateHandleProvider(ProcessId);
+
+    if (!handleProvider->ProcessHandle)
+    {
+        NtDuplicateObject(
+            NtCurrentProcess(),
+            NtCurrentProcess(),
+            NtCurrentProcess(),
+            &handleProvider->ProcessHandle,
+            PROCESS_DUP_HANDLE,
+            0,
+            0
+            );
+    }
+
+    NtQueryPerformanceCounter(&frequency, &frequency);
+    PhInitializeStringBuilder(&stringBuilder, 0x100);
+    PhAppendStringBuilder2(&stringBuilder, L"pass,tick,process_us,handle_us,network_us,allocations,objects_created\r\n");
+
+    for (pass = 0; pass < NumberOfPasses; pass++)
+    {
+        for (tick = 0; tick < PhpReplay.NumberOfTicks; tick++)
+        {
+            PhpReplay.CurrentTick = tick;
+#ifdef DEBUG
+            allocations = PhLibStatisticsBlock.BaseAllocations;
+            objectsCreated = PhLibStatisticsBlock.RefObjectsCreated;
+#endif
+
+            NtQueryPerformanceCounter(&start, NULL);
+            PhProcessProviderUpdate(NULL);
+            processTime = PhpReplayElapsedMicroseconds(&start, &frequency);
+
+            NtQueryPerformanceCounter(&start, NULL);
+            PhHandleProviderUpdate(handleProvider);
+            handleTime = PhpReplayElapsedMicroseconds(&start, &frequency);
+
+            NtQueryPerformanceCounter(&start, NULL);
+            PhNetworkProviderUpdate(NULL);
+            networkTime = PhpReplayElapsedMicroseconds(&start, &frequency);
+
+            PhAppendFormatStringBuilder(
+                &stringBuilder,
+                L"%u,%u,%I64u,%I64u,%I64u,",
+                pass,
+                tick,
+                processTime,
+                handleTime,
+                networkTime
+                );
+#ifdef DEBUG
+            PhAppendFormatStringBuilder(
+                &stringBuilder,
+                L"%u,%u",
+                PhLibStatisticsBlock.BaseAllocations - allocations,
+                PhLibStatisticsBlock.RefObjectsCreated - objectsCreated
+                );
+#else
+            PhAppendCharStringBuilder(&stringBuilder, ',');
+#endif
+            PhAppendStringBuilder2(&stringBuilder, L"\r\n");
+
+            status = PhWriteStringAsUtf8FileStreamEx(FileStream, stringBuilder.String->Buffer, stringBuilder.String->Length);
+            PhRemoveEndStringBuilder(&stringBuilder, stringBuilder.String->Length / sizeof(WCHAR));
+
+            if (!NT_SUCCESS(status) || !NT_SUCCESS(status = PhFlushFileStream(FileStream, FALSE)))
+                break;
+        }
+
+        if (!NT_SUCCESS(status))
+            break;
+    }
+
+    PhDeleteStringBuilder(&stringBuilder);
+    PhDereferenceObject(handleProvider);
+    PhProviderDataSource = NULL;
+
+    return status;
+}
+
+NTSTATUS PhCommandModeReplay(
+    VOID
+    )
+{
+    static PH_COMMAND_LINE_OPTION commandLineOptions[] =
+    {
+        { PH_REPLAY_OPTION_INTERVAL, L"interval", MandatoryArgumentType },
+        { PH_REPLAY_OPTION_PID, L"pid", MandatoryArgumentType }
+    };
+    NTSTATUS status;
+    PH_REPLAY_OPTIONS options;
+    PH_STRINGREF commandLine;
+    PPH_FILE_STREAM fileStream;
+    ULONG64 count;
+
+    if (!PhStartupParameters.CommandObject)
+        return STATUS_INVALID_PARAMETER;
+
+    count = 0;
+
+    if (PhStartupParameters.CommandValue)
+    {
+        if (!PhStringToInteger64(&PhStartupParameters.CommandValue->sr, 10, &count) || count == 0)
+            return STATUS_INVALID_PARAMETER;
+    }
+
+    options.Interval = PhGetIntegerSetting(L"UpdateInterval");
+    options.ProcessId = NULL;
+
+    PhUnicodeStringToStringRef(&NtCurrentPeb()->ProcessParameters->CommandLine, &commandLine);
+    PhParseCommandLine(
+        &commandLine,
+        commandLineOptions,
+        sizeof(commandLineOptions) / sizeof(PH_COMMAND_LINE_OPTION),
+        PH_COMMAND_LINE_IGNORE_UNKNOWN_OPTIONS,
+        PhpReplayOptionCallback,
+        &options
+        );
+
+    if (PhEqualString2(PhStartupParameters.CommandAction, L"capture", TRUE))
+    {
+        if (!NT_SUCCESS(status = PhCreateFileStream(
+            &fileStream,
+            PhStartupParameters.CommandObject->Buffer,
+            FILE_GENERIC_WRITE,
+            FILE_SHARE_READ,
+            FILE_OVERWRITE_IF,
+            0
+            )))
+            return status;
+
+        status = PhpCaptureReplay(fileStream, count != 0 ? (ULONG)count : 10, options.Interval);
+        PhDereferenceObject(fileStream);
+    }
+    else if (PhEqualString2(PhStartupParameters.CommandAction, L"run", TRUE))
+    {
+        HANDLE outputHandle;
+
+        outputHandle = NtCurrentPeb()->ProcessParameters->StandardOutput;
+
+        if (!outputHandle || outputHandle == INVALID_HANDLE_VALUE)
+            return STATUS_INVALID_HANDLE;
+
+        if (!NT_SUCCESS(status = PhpOpenReplay(PhStartupParameters.CommandObject->Buffer, &PhpReplay)))
+            return status;
+
+        if (NT_SUCCESS(status = PhCreateFileStream2(&fileStream, outputHandle, PH_FILE_STREAM_HANDLE_UNOWNED, 0x1000)))
+        {
+            status = PhpRunReplay(fileStream, count != 0 ? (ULONG)count : 1, options.ProcessId);
+            PhDereferenceObject(fileStream);
+        }
+
+        PhpCloseReplay(&PhpReplay);
+    }
+    else
+    {
+        status = STATUS_INVALID_PARAMETER;
+    }
+
+    return status;
+}
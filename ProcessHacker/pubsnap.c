@@ -0,0 +1,153 @@
+/*
+ * Process Hacker -
+ *   shared memory snapshot publication
+ *
+ * Copyright (C) 2016 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <phapp.h>
+#include <settings.h>
+#include <pubsnap.h>
+
+static HANDLE PhpSnapshotSectionHandle;
+static PPH_SNAPSHOT_HEADER PhpSnapshot;
+static PH_CALLBACK_REGISTRATION PhpSnapshotProcessesUpdatedRegistration;
+
+static VOID PhpSnapshotProcessesUpdatedHandler(
+    _In_opt_ PVOID Parameter,
+    _In_opt_ PVOID Context
+    )
+{
+    PPH_PROCESS_ITEM *processItems;
+    ULONG numberOfProcessItems;
+    ULONG count;
+    ULONG i;
+
+    PhEnumProcessItems(&processItems, &numberOfProcessItems);
+
+    // Make the sequence number odd so that readers retry.
+    _InterlockedIncrement(&PhpSnapshot->Sequence);
+    MemoryBarrier();
+
+    PhQuerySystemTime(&PhpSnapshot->Time);
+    PhpSnapshot->UpdateInterval = PhCsUpdateInterval;
+    PhpSnapshot->CpuKernelUsage = PhCpuKernelUsage;
+    PhpSnapshot->CpuUserUsage = PhCpuUserUsage;
+
+    count = min(numberOfProcessItems, PH_SNAPSHOT_MAXIMUM_PROCESSES);
+
+    for (i = 0; i < count; i++)
+    {
+        PPH_PROCESS_ITEM processItem = processItems[i];
+        PPH_SNAPSHOT_PROCESS entry = &PhpSnapshot->Entries[i];
+        SIZE_T nameLength;
+
+        entry->ProcessId = HandleToUlong(processItem->ProcessId);
+        entry->ParentProcessId = HandleToUlong(processItem->ParentProcessId);
+        entry->CreateTime = processItem->CreateTime;
+
+        nameLength = min(processItem->ProcessName->Length / sizeof(WCHAR), PH_SNAPSHOT_NAME_LENGTH - 1);
+        memcpy(entry->Name, processItem->ProcessName->Buffer, nameLength * sizeof(WCHAR));
+        entry->Name[nameLength] = 0;
+
+        entry->CpuUsage = processItem->CpuUsage;
+        entry->CpuKernelUsage = processItem->CpuKernelUsage;
+        entry->CpuUserUsage = processItem->CpuUserUsage;
+        entry->NumberOfThreads = processItem->NumberOfThreads;
+        entry->CycleTimeDelta = processItem->CycleTimeDelta.Delta;
+        entry->IoReadDelta = processItem->IoReadDelta.Delta;
+        entry->IoWriteDelta = processItem->IoWriteDelta.Delta;
+        entry->IoOtherDelta = processItem->IoOtherDelta.Delta;
+        entry->PrivateBytes = processItem->VmCounters.PagefileUsage;
+        entry->WorkingSetSize = processItem->VmCounters.WorkingSetSize;
+        entry->NumberOfHandles = processItem->NumberOfHandles;
+        entry->SessionId = processItem->SessionId;
+    }
+
+    PhpSnapshot->NumberOfEntries = count;
+
+    MemoryBarrier();
+    _InterlockedIncrement(&PhpSnapshot->Sequence);
+
+    PhDereferenceObjects(processItems, numberOfProcessItems);
+    PhFree(processItems);
+}
+
+VOID PhSnapshotPublicationInitialization(
+    VOID
+    )
+{
+    if (!PhGetIntegerSetting(L"EnableSnapshotPublication"))
+        return;
+
+    PhpSnapshotSectionHandle = CreateFileMapping(
+        INVALID_HANDLE_VALUE,
+        NULL,
+        PAGE_READWRITE,
+        0,
+        sizeof(PH_SNAPSHOT_HEADER),
+        PH_SNAPSHOT_SECTION_NAME
+        );
+
+    if (!PhpSnapshotSectionHandle)
+        return;
+
+    // Another instance is already publishing.
+    if (GetLastError() == ERROR_ALREADY_EXISTS)
+    {
+        NtClose(PhpSnapshotSectionHandle);
+        PhpSnapshotSectionHandle = NULL;
+        return;
+    }
+
+    PhpSnapshot = MapViewOfFile(PhpSnapshotSectionHandle, FILE_MAP_WRITE, 0, 0, 0);
+
+    if (!PhpSnapshot)
+    {
+        NtClose(PhpSnapshotSectionHandle);
+        PhpSnapshotSectionHandle = NULL;
+        return;
+    }
+
+    // The section is zero-filled, so only the layout needs to be filled in.
+    PhpSnapshot->Version = PH_SNAPSHOT_VERSION;
+    PhpSnapshot->HeaderSize = FIELD_OFFSET(PH_SNAPSHOT_HEADER, Entries);
+    PhpSnapshot->EntrySize = sizeof(PH_SNAPSHOT_PROCESS);
+    PhpSnapshot->MaximumEntries = PH_SNAPSHOT_MAXIMUM_PROCESSES;
+
+    PhRegisterCallback(
+        &PhProcessesUpdatedEvent,
+        PhpSnapshotProcessesUpdatedHandler,
+        NULL,
+        &PhpSnapshotProcessesUpdatedRegistration
+        );
+}
+
+VOID PhSnapshotPublicationUninitialization(
+    VOID
+    )
+{
+    if (!PhpSnapshot)
+        return;
+
+    PhUnregisterCallback(&PhProcessesUpdatedEvent, &PhpSnapshotProcessesUpdatedRegistration);
+    UnmapViewOfFile(PhpSnapshot);
+    NtClose(PhpSnapshotSectionHandle);
+    PhpSnapshot = NULL;
+    PhpSnapshotSectionHandle = NULL;
+}
@@ -0,0 +1,794 @@
+/*
+ * Process Hacker -
+ *   statistics recorder
+ *
+ * Copyright (C) 2016 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The recorder appends every process provider sample to the file named by the RecordingFileName
+ * setting. The file consists of a header followed by self-describing blocks, each holding up to
+ * PH_RECORDING_BLOCK_SAMPLES samples. Within a block the values are stored by column: all sample
+ * times, then all kernel CPU values, and so on, followed by the per-process columns and the
+ * process create/exit events. Similar values end up next to each other, so blocks compress well.
+ *
+ * Readers map the file and build a block index by walking the block headers, which hold the
+ * time range of each block. Seeking to a time only requires decompressing a single block. A block
+ * is only written once it is complete, so a truncated file loses at most the last block.
+ *
+ * ProcessHacker.exe -c -ctype recording -caction dump -cobject file [-cvalue time]
+ *
+ * writes the samples in a recording as CSV to standard output, starting at the given time in
+ * milliseconds since 1970. The rows are:
+ *
+ * system,time,cpu_kernel,cpu_user,io_read,io_write,io_other,commit_pages,physical_pages
+ * process,time,pid,cpu,io_read,io_write,private_bytes,working_set
+ * create|exit,time,pid,parent_pid,name
+ */
+
+#include <phapp.h>
+#include <settings.h>
+
+#define PH_RECORDING_MAGIC ('CRHP')
+#define PH_RECORDING_VERSION 1
+#define PH_RECORDING_BLOCK_MAGIC ('KLBR')
+#define PH_RECORDING_BLOCK_SAMPLES 60
+
+#define PH_RECORDING_BLOCK_COMPRESSED 0x1
+
+#define PH_RECORDING_EVENT_CREATE 1
+#define PH_RECORDING_EVENT_EXIT 2
+
+typedef struct _PH_RECORDING_HEADER
+{
+    ULONG Magic;
+    ULONG Version;
+    ULONG NumberOfCpus;
+    ULONG PageSize;
+} PH_RECORDING_HEADER, *PPH_RECORDING_HEADER;
+
+typedef struct _PH_RECORDING_BLOCK_HEADER
+{
+    ULONG Magic;
+    ULONG Flags;
+    ULONG StoredSize; // size of the data following this header
+    ULONG UncompressedSize;
+    ULONG NumberOfSamples;
+    ULONG NumberOfProcessRows;
+    ULONG NumberOfEvents;
+    ULONG StringsSize;
+    LARGE_INTEGER FirstTime;
+    LARGE_INTEGER LastTime;
+} PH_RECORDING_BLOCK_HEADER, *PPH_RECORDING_BLOCK_HEADER;
+
+typedef enum _PH_RECORDING_COLUMN
+{
+    // System columns, one value per sample
+    RecordingSampleTime, // LONG64
+    RecordingCpuKernel, // FLOAT
+    RecordingCpuUser, // FLOAT
+    RecordingIoRead, // ULONG64
+    RecordingIoWrite, // ULONG64
+    RecordingIoOther, // ULONG64
+    RecordingCommitPages, // ULONG
+    RecordingPhysicalPages, // ULONG
+
+    // Process columns, one value per process per sample
+    RecordingProcessSample, // ULONG
+    RecordingProcessId, // ULONG
+    RecordingProcessCpu, // FLOAT
+    RecordingProcessIoRead, // ULONG64
+    RecordingProcessIoWrite, // ULONG64
+    RecordingProcessPrivateBytes, // ULONG64
+    RecordingProcessWorkingSet, // ULONG64
+
+    // Event columns, one value per event
+    RecordingEventTime, // LONG64
+    RecordingEventType, // ULONG
+    RecordingEventProcessId, // ULONG
+    RecordingEventParentProcessId, // ULONG
+    RecordingEventNameOffset, // ULONG, in bytes from the start of the strings
+    RecordingEventNameLength, // ULONG, in bytes
+
+    RecordingStrings,
+    RecordingMaximumColumn
+} PH_RECORDING_COLUMN;
+
+static UCHAR PhpRecordingColumnSizes[RecordingMaximumColumn] =
+{
+    8, 4, 4, 8, 8, 8, 4, 4,
+    4, 4, 4, 8, 8, 8, 8,
+    8, 4, 4, 4, 4, 4,
+    1
+};
+
+typedef struct _PH_RECORDING_BLOCK_INDEX
+{
+    PPH_RECORDING_BLOCK_HEADER Header;
+    LARGE_INTEGER FirstTime;
+    LARGE_INTEGER LastTime;
+} PH_RECORDING_BLOCK_INDEX, *PPH_RECORDING_BLOCK_INDEX;
+
+typedef struct _PH_RECORDING
+{
+    PVOID ViewBase;
+    SIZE_T ViewSize;
+    PPH_RECORDING_BLOCK_INDEX Blocks;
+    ULONG NumberOfBlocks;
+} PH_RECORDING, *PPH_RECORDING;
+
+typedef struct _PH_RECORDING_BLOCK
+{
+    PPH_RECORDING_BLOCK_HEADER Header;
+    PUCHAR Buffer;
+    PVOID Columns[RecordingMaximumColumn];
+} PH_RECORDING_BLOCK, *PPH_RECORDING_BLOCK;
+
+static PH_QUEUED_LOCK PhpRecorderLock = PH_QUEUED_LOCK_INIT;
+static PPH_FILE_STREAM PhpRecorderFileStream;
+static PH_BYTES_BUILDER PhpRecorderColumns[RecordingMaximumColumn];
+static PH_RECORDING_BLOCK_HEADER PhpRecorderBlock;
+static PVOID PhpRecorderWorkSpace;
+
+static PH_CALLBACK_REGISTRATION PhpRecorderProcessAddedRegistration;
+static PH_CALLBACK_REGISTRATION PhpRecorderProcessRemovedRegistration;
+static PH_CALLBACK_REGISTRATION PhpRecorderProcessesUpdatedRegistration;
+
+static VOID PhpRecorderAppend(
+    _In_ PH_RECORDING_COLUMN Column,
+    _In_ PVOID Value
+    )
+{
+    PhAppendBytesBuilderEx(&PhpRecorderColumns[Column], Value, PhpRecordingColumnSizes[Column], 0, NULL);
+}
+
+static VOID PhpRecorderAppendULong(
+    _In_ PH_RECORDING_COLUMN Column,
+    _In_ ULONG Value
+    )
+{
+    PhpRecorderAppend(Column, &Value);
+}
+
+static VOID PhpRecorderAppendULong64(
+    _In_ PH_RECORDING_COLUMN Column,
+    _In_ ULONG64 Value
+    )
+{
+    PhpRecorderAppend(Column, &Value);
+}
+
+static VOID PhpRecorderAppendFloat(
+    _In_ PH_RECORDING_COLUMN Column,
+    _In_ FLOAT Value
+    )
+{
+    PhpRecorderAppend(Column, &Value);
+}
+
+static VOID PhpRecorderAddEvent(
+    _In_ ULONG Type,
+    _In_ PPH_PROCESS_ITEM ProcessItem
+    )
+{
+    LARGE_INTEGER time;
+    SIZE_T nameOffset;
+
+    if (Type == PH_RECORDING_EVENT_CREATE && ProcessItem->CreateTime.QuadPart != 0)
+        time = ProcessItem->CreateTime;
+    else
+        PhQuerySystemTime(&time);
+
+    PhAppendBytesBuilderEx(
+        &PhpRecorderColumns[RecordingStrings],
+        ProcessItem->ProcessName->Buffer,
+        ProcessItem->ProcessName->Length,
+        0,
+        &nameOffset
+        );
+
+    PhpRecorderAppendULong64(RecordingEventTime, time.QuadPart);
+    PhpRecorderAppendULong(RecordingEventType, Type);
+    PhpRecorderAppendULong(RecordingEventProcessId, HandleToUlong(ProcessItem->ProcessId));
+    PhpRecorderAppendULong(RecordingEventParentProcessId, HandleToUlong(ProcessItem->ParentProcessId));
+    PhpRecorderAppendULong(RecordingEventNameOffset, (ULONG)nameOffset);
+    PhpRecorderAppendULong(RecordingEventNameLength, (ULONG)ProcessItem->ProcessName->Length);
+    PhpRecorderBlock.NumberOfEvents++;
+}
+
+static VOID PhpRecorderWriteBlock(
+    VOID
+    )
+{
+    PH_BYTES_BUILDER data;
+    ULONG i;
+    PUCHAR storedBuffer;
+    ULONG storedSize;
+
+    if (PhpRecorderBlock.NumberOfSamples == 0 && PhpRecorderBlock.NumberOfEvents == 0)
+        return;
+
+    if (PhpRecorderBlock.NumberOfSamples == 0)
+    {
+        // Keep the block times ordered for readers even if only events were recorded.
+        PhQuerySystemTime(&PhpRecorderBlock.FirstTime);
+        PhpRecorderBlock.LastTime = PhpRecorderBlock.FirstTime;
+    }
+
+    PhpRecorderBlock.StringsSize = (ULONG)PhpRecorderColumns[RecordingStrings].Bytes->Length;
+
+    PhInitializeBytesBuilder(&data, 0x10000);
+
+    for (i = 0; i < RecordingMaximumColumn; i++)
+    {
+        PhAppendBytesBuilderEx(
+            &data,
+            PhpRecorderColumns[i].Bytes->Buffer,
+            PhpRecorderColumns[i].Bytes->Length,
+            0,
+            NULL
+            );
+        PhpRecorderColumns[i].Bytes->Length = 0;
+    }
+
+    PhpRecorderBlock.Magic = PH_RECORDING_BLOCK_MAGIC;
+    PhpRecorderBlock.Flags = 0;
+    PhpRecorderBlock.UncompressedSize = (ULONG)data.Bytes->Length;
+
+    storedBuffer = (PUCHAR)data.Bytes->Buffer;
+    storedSize = PhpRecorderBlock.UncompressedSize;
+
+    if (PhpRecorderWorkSpace)
+    {
+        PUCHAR compressedBuffer;
+        ULONG compressedSize;
+
+        compressedBuffer = PhAllocate(PhpRecorderBlock.UncompressedSize);
+
+        // If the data doesn't get any smaller, we store it as is.
+        if (NT_SUCCESS(RtlCompressBuffer(
+            COMPRESSION_FORMAT_LZNT1 | COMPRESSION_ENGINE_STANDARD,
+            (PUCHAR)data.Bytes->Buffer,
+            PhpRecorderBlock.UncompressedSize,
+            compressedBuffer,
+            PhpRecorderBlock.UncompressedSize,
+            4096,
+            &compressedSize,
+            PhpRecorderWorkSpace
+            )) && compressedSize < PhpRecorderBlock.UncompressedSize)
+        {
+            PhpRecorderBlock.Flags |= PH_RECORDING_BLOCK_COMPRESSED;
+            storedBuffer = compressedBuffer;
+            storedSize = compressedSize;
+        }
+        else
+        {
+            PhFree(compressedBuffer);
+        }
+    }
+
+    PhpRecorderBlock.StoredSize = storedSize;
+
+    PhWriteFileStream(PhpRecorderFileStream, &PhpRecorderBlock, sizeof(PH_RECORDING_BLOCK_HEADER));
+    PhWriteFileStream(PhpRecorderFileStream, storedBuffer, storedSize);
+    PhFlushFileStream(PhpRecorderFileStream, FALSE);
+
+    if (storedBuffer != (PUCHAR)data.Bytes->Buffer)
+        PhFree(storedBuffer);
+
+    PhDeleteBytesBuilder(&data);
+
+    memset(&PhpRecorderBlock, 0, sizeof(PH_RECORDING_BLOCK_HEADER));
+}
+
+static VOID PhpRecorderProcessAddedHandler(
+    _In_opt_ PVOID Parameter,
+    _In_opt_ PVOID Context
+    )
+{
+    PhAcquireQueuedLockExclusive(&PhpRecorderLock);
+
+    if (PhpRecorderFileStream)
+        PhpRecorderAddEvent(PH_RECORDING_EVENT_CREATE, Parameter);
+
+    PhReleaseQueuedLockExclusive(&PhpRecorderLock);
+}
+
+static VOID PhpRecorderProcessRemovedHandler(
+    _In_opt_ PVOID Parameter,
+    _In_opt_ PVOID Context
+    )
+{
+    PhAcquireQueuedLockExclusive(&PhpRecorderLock);
+
+    if (PhpRecorderFileStream)
+        PhpRecorderAddEvent(PH_RECORDING_EVENT_EXIT, Parameter);
+
+    PhReleaseQueuedLockExclusive(&PhpRecorderLock);
+}
+
+static VOID PhpRecorderProcessesUpdatedHandler(
+    _In_opt_ PVOID Parameter,
+    _In_opt_ PVOID Context
+    )
+{
+    LARGE_INTEGER time;
+    PPH_PROCESS_ITEM *processItems;
+    ULONG numberOfProcessItems;
+    ULONG i;
+
+    PhAcquireQueuedLockExclusive(&PhpRecorderLock);
+
+    if (!PhpRecorderFileStream)
+    {
+        PhReleaseQueuedLockExclusive(&PhpRecorderLock);
+        return;
+    }
+
+    PhQuerySystemTime(&time);
+
+    if (PhpRecorderBlock.NumberOfSamples == 0)
+        PhpRecorderBlock.FirstTime = time;
+
+    PhpRecorderBlock.LastTime = time;
+
+    PhpRecorderAppendULong64(RecordingSampleTime, time.QuadPart);
+    PhpRecorderAppendFloat(RecordingCpuKernel, PhCpuKernelUsage);
+    PhpRecorderAppendFloat(RecordingCpuUser, PhCpuUserUsage);
+    PhpRecorderAppendULong64(RecordingIoRead, PhIoReadDelta.Delta);
+    PhpRecorderAppendULong64(RecordingIoWrite, PhIoWriteDelta.Delta);
+    PhpRecorderAppendULong64(RecordingIoOther, PhIoOtherDelta.Delta);
+    PhpRecorderAppendULong(RecordingCommitPages, PhPerfInformation.CommittedPages);
+    PhpRecorderAppendULong(RecordingPhysicalPages, PhSystemBasicInformation.NumberOfPhysicalPages - PhPerfInformation.AvailablePages);
+
+    PhEnumProcessItems(&processItems, &numberOfProcessItems);
+
+    for (i = 0; i < numberOfProcessItems; i++)
+    {
+        PPH_PROCESS_ITEM processItem = processItems[i];
+
+        PhpRecorderAppendULong(RecordingProcessSample, PhpRecorderBlock.NumberOfSamples);
+        PhpRecorderAppendULong(RecordingProcessId, HandleToUlong(processItem->ProcessId));
+        PhpRecorderAppendFloat(RecordingProcessCpu, processItem->CpuUsage);
+        PhpRecorderAppendULong64(RecordingProcessIoRead, processItem->IoReadDelta.Delta);
+        PhpRecorderAppendULong64(RecordingProcessIoWrite, processItem->IoWriteDelta.Delta);
+        PhpRecorderAppendULong64(RecordingProcessPrivateBytes, processItem->VmCounters.PagefileUsage);
+        PhpRecorderAppendULong64(RecordingProcessWorkingSet, processItem->VmCounters.WorkingSetSize);
+    }
+
+    PhpRecorderBlock.NumberOfProcessRows += numberOfProcessItems;
+    PhpRecorderBlock.NumberOfSamples++;
+
+    PhDereferenceObjects(processItems, numberOfProcessItems);
+    PhFree(processItems);
+
+    if (PhpRecorderBlock.NumberOfSamples >= PH_RECORDING_BLOCK_SAMPLES)
+        PhpRecorderWriteBlock();
+
+    PhReleaseQueuedLockExclusive(&PhpRecorderLock);
+}
+
+VOID PhRecorderInitialization(
+    VOID
+    )
+{
+    PPH_STRING fileName;
+    LARGE_INTEGER fileSize;
+    ULONG compressBufferWorkSpaceSize;
+    ULONG compressFragmentWorkSpaceSize;
+    ULONG i;
+
+    fileName = PhGetStringSetting(L"RecordingFileName");
+
+    if (fileName->Length == 0)
+    {
+        PhDereferenceObject(fileName);
+        return;
+    }
+
+    if (!NT_SUCCESS(PhCreateFileStream(
+        &PhpRecorderFileStream,
+        fileName->Buffer,
+        FILE_GENERIC_WRITE,
+        FILE_SHARE_READ,
+        FILE_OPEN_IF,
+        PH_FILE_STREAM_APPEND
+        )))
+    {
+        PhDereferenceObject(fileName);
+        return;
+    }
+
+    PhDereferenceObject(fileName);
+
+    if (NT_SUCCESS(PhGetFileSize(PhpRecorderFileStream->FileHandle, &fileSize)) && fileSize.QuadPart == 0)
+    {
+        PH_RECORDING_HEADER header;
+
+        header.Magic = PH_RECORDING_MAGIC;
+        header.Version = PH_RECORDING_VERSION;
+        header.NumberOfCpus = PhNumberOfCpus;
+        header.PageSize = PAGE_SIZE;
+        PhWriteFileStream(PhpRecorderFileStream, &header, sizeof(PH_RECORDING_HEADER));
+    }
+
+    for (i = 0; i < RecordingMaximumColumn; i++)
+        PhInitializeBytesBuilder(&PhpRecorderColumns[i], 0x1000);
+
+    if (NT_SUCCESS(RtlGetCompressionWorkSpaceSize(
+        COMPRESSION_FORMAT_LZNT1 | COMPRESSION_ENGINE_STANDARD,
+        &compressBufferWorkSpaceSize,
+        &compressFragmentWorkSpaceSize
+        )))
+    {
+        PhpRecorderWorkSpace = PhAllocate(compressBufferWorkSpaceSize);
+    }
+
+    PhRegisterCallback(
+        &PhProcessAddedEvent,
+        PhpRecorderProcessAddedHandler,
+        NULL,
+        &PhpRecorderProcessAddedRegistration
+        );
+    PhRegisterCallback(
+        &PhProcessRemovedEvent,
+        PhpRecorderProcessRemovedHandler,
+        NULL,
+        &PhpRecorderProcessRemovedRegistration
+        );
+    PhRegisterCallback(
+        &PhProcessesUpdatedEvent,
+        PhpRecorderProcessesUpdatedHandler,
+        NULL,
+        &PhpRecorderProcessesUpdatedRegistration
+        );
+}
+
+VOID PhRecorderUninitialization(
+    VOID
+    )
+{
+    PhAcquireQueuedLockExclusive(&PhpRecorderLock);
+
+    if (PhpRecorderFileStream)
+    {
+        // Write out the partial block.
+        PhpRecorderWriteBlock();
+        PhClearReference(&PhpRecorderFileStream);
+    }
+
+    PhReleaseQueuedLockExclusive(&PhpRecorderLock);
+}
+
+static NTSTATUS PhpOpenRecording(
+    _In_ PWSTR FileName,
+    _Out_ PPH_RECORDING Recording
+    )
+{
+    NTSTATUS status;
+    PPH_RECORDING_HEADER header;
+    PUCHAR position;
+    PUCHAR end;
+    ULONG allocatedBlocks;
+
+    memset(Recording, 0, sizeof(PH_RECORDING));
+
+    if (!NT_SUCCESS(status = PhMapViewOfEntireFile(FileName, NULL, TRUE, &Recording->ViewBase, &Recording->ViewSize)))
+        return status;
+
+    header = Recording->ViewBase;
+
+    if (Recording->ViewSize < sizeof(PH_RECORDING_HEADER) ||
+        header->Magic != PH_RECORDING_MAGIC ||
+        header->Version != PH_RECORDING_VERSION)
+    {
+        NtUnmapViewOfSection(NtCurrentProcess(), Recording->ViewBase);
+        return STATUS_INVALID_IMAGE_FORMAT;
+    }
+
+    allocatedBlocks = 64;
+    Recording->Blocks = PhAllocate(sizeof(PH_RECORDING_BLOCK_INDEX) * allocatedBlocks);
+
+    position = (PUCHAR)Recording->ViewBase + sizeof(PH_RECORDING_HEADER);
+    end = (PUCHAR)Recording->ViewBase + Recording->ViewSize;
+
+    while ((SIZE_T)(end - position) >= sizeof(PH_RECORDING_BLOCK_HEADER))
+    {
+        PPH_RECORDING_BLOCK_HEADER blockHeader = (PPH_RECORDING_BLOCK_HEADER)position;
+
+        // Stop at a block that was only partially written.
+        if (blockHeader->Magic != PH_RECORDING_BLOCK_MAGIC)
+            break;
+        if ((SIZE_T)(end - position) - sizeof(PH_RECORDING_BLOCK_HEADER) < blockHeader->StoredSize)
+            break;
+
+        if (Recording->NumberOfBlocks == allocatedBlocks)
+        {
+            allocatedBlocks *= 2;
+            Recording->Blocks = PhReAllocate(Recording->Blocks, sizeof(PH_RECORDING_BLOCK_INDEX) * allocatedBlocks);
+        }
+
+        Recording->Blocks[Recording->NumberOfBlocks].Header = blockHeader;
+        Recording->Blocks[Recording->NumberOfBlocks].FirstTime = blockHeader->FirstTime;
+        Recording->Blocks[Recording->NumberOfBlocks].LastTime = blockHeader->LastTime;
+        Recording->NumberOfBlocks++;
+
+        position += sizeof(PH_RECORDING_BLOCK_HEADER) + blockHeader->StoredSize;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static VOID PhpCloseRecording(
+    _In_ PPH_RECORDING Recording
+    )
+{
+    PhFree(Recording->Blocks);
+    NtUnmapViewOfSection(NtCurrentProcess(), Recording->ViewBase);
+}
+
+/**
+ * Finds the first block that contains samples at or after the specified time.
+ */
+static ULONG PhpSeekRecording(
+    _In_ PPH_RECORDING Recording,
+    _In_ PLARGE_INTEGER Time
+    )
+{
+    ULONG low;
+    ULONG high;
+    ULONG middle;
+
+    low = 0;
+    high = Recording->NumberOfBlocks;
+
+    while (low < high)
+    {
+        middle = low + (high - low) / 2;
+
+        if (Recording->Blocks[middle].LastTime.QuadPart < Time->QuadPart)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    return low;
+}
+
+static NTSTATUS PhpReadRecordingBlock(
+    _In_ PPH_RECORDING Recording,
+    _In_ ULONG Index,
+    _Out_ PPH_RECORDING_BLOCK Block
+    )
+{
+    PPH_RECORDING_BLOCK_HEADER header;
+    PUCHAR data;
+    ULONG counts[RecordingMaximumColumn];
+    ULONG64 totalSize;
+    ULONG i;
+
+    header = Recording->Blocks[Index].Header;
+    data = (PUCHAR)(header + 1);
+
+    for (i = RecordingSampleTime; i <= RecordingPhysicalPages; i++)
+        counts[i] = header->NumberOfSamples;
+    for (i = RecordingProcessSample; i <= RecordingProcessWorkingSet; i++)
+        counts[i] = header->NumberOfProcessRows;
+    for (i = RecordingEventTime; i <= RecordingEventNameLength; i++)
+        counts[i] = header->NumberOfEvents;
+
+    counts[RecordingStrings] = header->StringsSize;
+    totalSize = 0;
+
+    for (i = 0; i < RecordingMaximumColumn; i++)
+        totalSize += (ULONG64)counts[i] * PhpRecordingColumnSizes[i];
+
+    if (totalSize != header->UncompressedSize)
+        return STATUS_DATA_ERROR;
+    if (!(header->Flags & PH_RECORDING_BLOCK_COMPRESSED) && header->StoredSize != header->UncompressedSize)
+        return STATUS_DATA_ERROR;
+
+    Block->Header = header;
+    Block->Buffer = NULL;
+
+    if (header->Flags & PH_RECORDING_BLOCK_COMPRESSED)
+    {
+        NTSTATUS status;
+        ULONG uncompressedSize;
+
+        Block->Buffer = PhAllocate(header->UncompressedSize);
+
+        if (!NT_SUCCESS(status = RtlDecompressBuffer(
+            COMPRESSION_FORMAT_LZNT1,
+            Block->Buffer,
+            header->UncompressedSize,
+            data,
+            header->StoredSize,
+            &uncompressedSize
+            )) || uncompressedSize != header->UncompressedSize)
+        {
+            PhFree(Block->Buffer);
+            return NT_SUCCESS(status) ? STATUS_DATA_ERROR : status;
+        }
+
+        data = Block->Buffer;
+    }
+
+    for (i = 0; i < RecordingMaximumColumn; i++)
+    {
+        Block->Columns[i] = data;
+        data += counts[i] * PhpRecordingColumnSizes[i];
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static ULONG64 PhpRecordingUnixTime(
+    _In_ LONG64 Time
+    )
+{
+    // 100ns intervals between 1601 and 1970.
+    if (Time < 116444736000000000)
+        return 0;
+
+    return (ULONG64)(Time - 116444736000000000) / PH_TICKS_PER_MS;
+}
+
+static VOID PhpDumpRecordingBlock(
+    _Inout_ PPH_FILE_STREAM FileStream,
+    _Inout_ PPH_STRING_BUILDER StringBuilder,
+    _In_ PPH_RECORDING_BLOCK Block,
+    _In_ LONG64 StartTime
+    )
+{
+    PLONG64 sampleTimes = Block->Columns[RecordingSampleTime];
+    PULONG processSamples = Block->Columns[RecordingProcessSample];
+    PLONG64 eventTimes = Block->Columns[RecordingEventTime];
+    PULONG eventTypes = Block->Columns[RecordingEventType];
+    ULONG i;
+
+    for (i = 0; i < Block->Header->NumberOfSamples; i++)
+    {
+        if (sampleTimes[i] < StartTime)
+            continue;
+
+        PhAppendFormatStringBuilder(
+            StringBuilder,
+            L"system,%I64u,%.2f,%.2f,%I64u,%I64u,%I64u,%u,%u\r\n",
+            PhpRecordingUnixTime(sampleTimes[i]),
+            ((PFLOAT)Block->Columns[RecordingCpuKernel])[i] * 100,
+            ((PFLOAT)Block->Columns[RecordingCpuUser])[i] * 100,
+            ((PULONG64)Block->Columns[RecordingIoRead])[i],
+            ((PULONG64)Block->Columns[RecordingIoWrite])[i],
+            ((PULONG64)Block->Columns[RecordingIoOther])[i],
+            ((PULONG)Block->Columns[RecordingCommitPages])[i],
+            ((PULONG)Block->Columns[RecordingPhysicalPages])[i]
+            );
+    }
+
+    for (i = 0; i < Block->Header->NumberOfProcessRows; i++)
+    {
+        if (processSamples[i] >= Block->Header->NumberOfSamples || sampleTimes[processSamples[i]] < StartTime)
+            continue;
+
+        PhAppendFormatStringBuilder(
+            StringBuilder,
+            L"process,%I64u,%u,%.2f,%I64u,%I64u,%I64u,%I64u\r\n",
+            PhpRecordingUnixTime(sampleTimes[processSamples[i]]),
+            ((PULONG)Block->Columns[RecordingProcessId])[i],
+            ((PFLOAT)Block->Columns[RecordingProcessCpu])[i] * 100,
+            ((PULONG64)Block->Columns[RecordingProcessIoRead])[i],
+            ((PULONG64)Block->Columns[RecordingProcessIoWrite])[i],
+            ((PULONG64)Block->Columns[RecordingProcessPrivateBytes])[i],
+            ((PULONG64)Block->Columns[RecordingProcessWorkingSet])[i]
+            );
+    }
+
+    for (i = 0; i < Block->Header->NumberOfEvents; i++)
+    {
+        ULONG nameOffset = ((PULONG)Block->Columns[RecordingEventNameOffset])[i];
+        ULONG nameLength = ((PULONG)Block->Columns[RecordingEventNameLength])[i];
+
+        if (eventTimes[i] < StartTime)
+            continue;
+        if (nameOffset > Block->Header->StringsSize || nameLength > Block->Header->StringsSize - nameOffset)
+            continue;
+
+        PhAppendFormatStringBuilder(
+            StringBuilder,
+            L"%s,%I64u,%u,%u,\"",
+            eventTypes[i] == PH_RECORDING_EVENT_CREATE ? L"create" : L"exit",
+            PhpRecordingUnixTime(eventTimes[i]),
+            ((PULONG)Block->Columns[RecordingEventProcessId])[i],
+            ((PULONG)Block->Columns[RecordingEventParentProcessId])[i]
+            );
+        PhAppendStringBuilderEx(
+            StringBuilder,
+            (PWCHAR)((PUCHAR)Block->Columns[RecordingStrings] + nameOffset),
+            nameLength
+            );
+        PhAppendStringBuilder2(StringBuilder, L"\"\r\n");
+    }
+
+    PhWriteStringAsUtf8FileStreamEx(FileStream, StringBuilder->String->Buffer, StringBuilder->String->Length);
+    PhRemoveEndStringBuilder(StringBuilder, StringBuilder->String->Length / sizeof(WCHAR));
+}
+
+NTSTATUS PhCommandModeDumpRecording(
+    VOID
+    )
+{
+    NTSTATUS status;
+    PH_RECORDING recording;
+    PPH_FILE_STREAM fileStream;
+    PH_STRING_BUILDER stringBuilder;
+    HANDLE outputHandle;
+    ULONG64 startTime;
+    LARGE_INTEGER time;
+    ULONG i;
+
+    if (!PhEqualString2(PhStartupParameters.CommandAction, L"dump", TRUE) || !PhStartupParameters.CommandObject)
+        return STATUS_INVALID_PARAMETER;
+
+    startTime = 0;
+    time.QuadPart = 0;
+
+    if (PhStartupParameters.CommandValue)
+    {
+        if (!PhStringToInteger64(&PhStartupParameters.CommandValue->sr, 10, &startTime))
+            return STATUS_INVALID_PARAMETER;
+
+        time.QuadPart = startTime * PH_TICKS_PER_MS + 116444736000000000;
+    }
+
+    outputHandle = NtCurrentPeb()->ProcessParameters->StandardOutput;
+
+    if (!outputHandle || outputHandle == INVALID_HANDLE_VALUE)
+        return STATUS_INVALID_HANDLE;
+
+    if (!NT_SUCCESS(status = PhpOpenRecording(PhStartupParameters.CommandObject->Buffer, &recording)))
+        return status;
+
+    if (!NT_SUCCESS(status = PhCreateFileStream2(&fileStream, outputHandle, PH_FILE_STREAM_HANDLE_UNOWNED, 0x1000)))
+    {
+        PhpCloseRecording(&recording);
+        return status;
+    }
+
+    PhInitializeStringBuilder(&stringBuilder, 0x1000);
+
+    for (i = PhpSeekRecording(&recording, &time); i < recording.NumberOfBlocks; i++)
+    {
+        PH_RECORDING_BLOCK block;
+
+        if (!NT_SUCCESS(status = PhpReadRecordingBlock(&recording, i, &block)))
+            break;
+
+        PhpDumpRecordingBlock(fileStream, &stringBuilder, &block, time.QuadPart);
+
+        if (block.Buffer)
+            PhFree(block.Buffer);
+    }
+
+    PhDeleteStringBuilder(&stringBuilder);
+    PhFlushFileStream(fileStream, FALSE);
+    PhDereferenceObject(fileStream);
+    PhpCloseRecording(&recording);
+
+    return status;
+}
@@ -0,0 +1,783 @@
+/*
+ * Process Hacker -
+ *   remote monitoring
+ *
+ * Copyright (C) 2016 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * ProcessHacker.exe -c -ctype remote -caction serve [-interval milliseconds]
+ *
+ * runs the process provider without any windows and publishes its state on a named pipe that
+ * only administrators can open. Named pipes are reachable from other computers, which the ALPC
+ * port used by phsvc is not. Each message contains the changes since the previous tick:
+ * processes that were added or removed, and only the fields that changed for the others. A new
+ * client first receives a message containing the full state.
+ *
+ * ProcessHacker.exe -c -ctype remote -caction watch -cobject computer
+ *
+ * connects to a server and writes each change as a JSON line to standard output.
+ */
+
+#include <phapp.h>
+#include <settings.h>
+
+#define PH_REMOTE_PIPE_NAME L"\\pipe\\ProcessHackerRemote"
+#define PH_REMOTE_MAGIC ('TMRP')
+#define PH_REMOTE_BUFFER_SIZE 0x10000
+
+#define PH_REMOTE_MESSAGE_FULL 1
+#define PH_REMOTE_MESSAGE_DELTA 2
+
+#define PH_REMOTE_RECORD_ADD 1
+#define PH_REMOTE_RECORD_REMOVE 2
+#define PH_REMOTE_RECORD_UPDATE 3
+
+#define PH_REMOTE_FIELD_PARENT_PROCESS_ID 0x1
+#define PH_REMOTE_FIELD_NAME 0x2
+#define PH_REMOTE_FIELD_CPU 0x4
+#define PH_REMOTE_FIELD_PRIVATE_BYTES 0x8
+#define PH_REMOTE_FIELD_WORKING_SET 0x10
+#define PH_REMOTE_FIELD_IO_READ 0x20
+#define PH_REMOTE_FIELD_IO_WRITE 0x40
+#define PH_REMOTE_FIELD_THREADS 0x80
+#define PH_REMOTE_FIELD_HANDLES 0x100
+#define PH_REMOTE_FIELD_ALL 0x1ff
+
+typedef struct _PH_REMOTE_MESSAGE_HEADER
+{
+    ULONG Magic;
+    ULONG Type;
+    ULONG Sequence;
+    ULONG NumberOfRecords;
+    LARGE_INTEGER Time;
+} PH_REMOTE_MESSAGE_HEADER, *PPH_REMOTE_MESSAGE_HEADER;
+
+// Each record is a PH_REMOTE_RECORD_HEADER followed by the fields in Fields, in the order of
+// the field bits. The name is stored as a USHORT length in bytes followed by the characters.
+typedef struct _PH_REMOTE_RECORD_HEADER
+{
+    ULONG ProcessId;
+    USHORT Kind;
+    USHORT Fields;
+} PH_REMOTE_RECORD_HEADER, *PPH_REMOTE_RECORD_HEADER;
+
+typedef struct _PH_REMOTE_PROCESS_STATE
+{
+    ULONG ProcessId;
+    ULONG Sequence;
+    LARGE_INTEGER CreateTime;
+
+    ULONG ParentProcessId;
+    PPH_STRING Name;
+    FLOAT CpuUsage;
+    ULONG64 PrivateBytes;
+    ULONG64 WorkingSet;
+    ULONG64 IoRead;
+    ULONG64 IoWrite;
+    ULONG NumberOfThreads;
+    ULONG NumberOfHandles;
+} PH_REMOTE_PROCESS_STATE, *PPH_REMOTE_PROCESS_STATE;
+
+typedef struct _PH_REMOTE_CLIENT
+{
+    HANDLE PipeHandle;
+    BOOLEAN NeedsFullState;
+} PH_REMOTE_CLIENT, *PPH_REMOTE_CLIENT;
+
+static PH_QUEUED_LOCK PhpRemoteClientListLock = PH_QUEUED_LOCK_INIT;
+static PPH_LIST PhpRemoteClientList;
+
+static BOOLEAN NTAPI PhpRemoteProcessStateCompareFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    )
+{
+    return ((PPH_REMOTE_PROCESS_STATE)Entry1)->ProcessId == ((PPH_REMOTE_PROCESS_STATE)Entry2)->ProcessId;
+}
+
+static ULONG NTAPI PhpRemoteProcessStateHashFunction(
+    _In_ PVOID Entry
+    )
+{
+    return PhHashInt32(((PPH_REMOTE_PROCESS_STATE)Entry)->ProcessId);
+}
+
+static PPH_HASHTABLE PhpCreateRemoteProcessStateTable(
+    VOID
+    )
+{
+    return PhCreateHashtable(
+        sizeof(PH_REMOTE_PROCESS_STATE),
+        PhpRemoteProcessStateCompareFunction,
+        PhpRemoteProcessStateHashFunction,
+        256
+        );
+}
+
+static VOID PhpWriteRemoteRecord(
+    _Inout_ PPH_BYTES_BUILDER Message,
+    _In_ PPH_REMOTE_PROCESS_STATE State,
+    _In_ USHORT Kind,
+    _In_ USHORT Fields
+    )
+{
+    PH_REMOTE_RECORD_HEADER header;
+
+    header.ProcessId = State->ProcessId;
+    header.Kind = Kind;
+    header.Fields = Fields;
+    PhAppendBytesBuilderEx(Message, &header, sizeof(PH_REMOTE_RECORD_HEADER), 0, NULL);
+
+    if (Fields & PH_REMOTE_FIELD_PARENT_PROCESS_ID)
+        PhAppendBytesBuilderEx(Message, &State->ParentProcessId, sizeof(ULONG), 0, NULL);
+
+    if (Fields & PH_REMOTE_FIELD_NAME)
+    {
+        USHORT length = (USHORT)min(State->Name->Length, MAXUSHORT & ~1);
+
+        PhAppendBytesBuilderEx(Message, &length, sizeof(USHORT), 0, NULL);
+        PhAppendBytesBuilderEx(Message, State->Name->Buffer, length, 0, NULL);
+    }
+
+    if (Fields & PH_REMOTE_FIELD_CPU)
+        PhAppendBytesBuilderEx(Message, &State->CpuUsage, sizeof(FLOAT), 0, NULL);
+    if (Fields & PH_REMOTE_FIELD_PRIVATE_BYTES)
+        PhAppendBytesBuilderEx(Message, &State->PrivateBytes, sizeof(ULONG64), 0, NULL);
+    if (Fields & PH_REMOTE_FIELD_WORKING_SET)
+        PhAppendBytesBuilderEx(Message, &State->WorkingSet, sizeof(ULONG64), 0, NULL);
+    if (Fields & PH_REMOTE_FIELD_IO_READ)
+        PhAppendBytesBuilderEx(Message, &State->IoRead, sizeof(ULONG64), 0, NULL);
+    if (Fields & PH_REMOTE_FIELD_IO_WRITE)
+        PhAppendBytesBuilderEx(Message, &State->IoWrite, sizeof(ULONG64), 0, NULL);
+    if (Fields & PH_REMOTE_FIELD_THREADS)
+        PhAppendBytesBuilderEx(Message, &State->NumberOfThreads, sizeof(ULONG), 0, NULL);
+    if (Fields & PH_REMOTE_FIELD_HANDLES)
+        PhAppendBytesBuilderEx(Message, &State->NumberOfHandles, sizeof(ULONG), 0, NULL);
+
+    ((PPH_REMOTE_MESSAGE_HEADER)Message->Bytes->Buffer)->NumberOfRecords++;
+}
+
+static VOID PhpBeginRemoteMessage(
+    _Out_ PPH_BYTES_BUILDER Message,
+    _In_ ULONG Type,
+    _In_ ULONG Sequence,
+    _In_ PLARGE_INTEGER Time
+    )
+{
+    PH_REMOTE_MESSAGE_HEADER header;
+
+    header.Magic = PH_REMOTE_MAGIC;
+    header.Type = Type;
+    header.Sequence = Sequence;
+    header.NumberOfRecords = 0;
+    header.Time = *Time;
+
+    PhInitializeBytesBuilder(Message, 0x1000);
+    PhAppendBytesBuilderEx(Message, &header, sizeof(PH_REMOTE_MESSAGE_HEADER), 0, NULL);
+}
+
+/**
+ * Updates the published state from the process provider and builds a message containing the
+ * changes.
+ */
+static VOID PhpUpdateRemoteState(
+    _Inout_ PPH_HASHTABLE StateTable,
+    _Inout_ PPH_BYTES_BUILDER Delta,
+    _In_ ULONG Sequence
+    )
+{
+    PPH_PROCESS_ITEM *processItems;
+    ULONG numberOfProcessItems;
+    PH_HASHTABLE_ENUM_CONTEXT enumContext;
+    PPH_REMOTE_PROCESS_STATE state;
+    PPH_LIST removedList;
+    ULONG i;
+
+    PhEnumProcessItems(&processItems, &numberOfProcessItems);
+
+    for (i = 0; i < numberOfProcessItems; i++)
+    {
+        PPH_PROCESS_ITEM processItem = processItems[i];
+        PH_REMOTE_PROCESS_STATE lookupState;
+        PH_REMOTE_PROCESS_STATE newState;
+        USHORT fields;
+
+        newState.ProcessId = HandleToUlong(processItem->ProcessId);
+        newState.Sequence = Sequence;
+        newState.CreateTime = processItem->CreateTime;
+        newState.ParentProcessId = HandleToUlong(processItem->ParentProcessId);
+        newState.Name = processItem->ProcessName;
+        newState.CpuUsage = processItem->CpuUsage;
+        newState.PrivateBytes = processItem->VmCounters.PagefileUsage;
+        newState.WorkingSet = processItem->VmCounters.WorkingSetSize;
+        newState.IoRead = processItem->IoReadDelta.Value;
+        newState.IoWrite = processItem->IoWriteDelta.Value;
+        newState.NumberOfThreads = processItem->NumberOfThreads;
+        newState.NumberOfHandles = processItem->NumberOfHandles;
+
+        lookupState.ProcessId = newState.ProcessId;
+        state = PhFindEntryHashtable(StateTable, &lookupState);
+
+        if (state && state->CreateTime.QuadPart != newState.CreateTime.QuadPart)
+        {
+            // The process ID was reused.
+            PhpWriteRemoteRecord(Delta, state, PH_REMOTE_RECORD_REMOVE, 0);
+            PhClearReference(&state->Name);
+            PhRemoveEntryHashtable(StateTable, state);
+            state = NULL;
+        }
+
+        if (!state)
+        {
+            PhReferenceObject(newState.Name);
+            state = PhAddEntryHashtableEx(StateTable, &newState, NULL);
+            PhpWriteRemoteRecord(Delta, state, PH_REMOTE_RECORD_ADD, PH_REMOTE_FIELD_ALL);
+            continue;
+        }
+
+        fields = 0;
+
+        if (state->ParentProcessId != newState.ParentProcessId)
+            fields |= PH_REMOTE_FIELD_PARENT_PROCESS_ID;
+        if (!PhEqualString(state->Name, newState.Name, FALSE))
+            fields |= PH_REMOTE_FIELD_NAME;
+        if (state->CpuUsage != newState.CpuUsage)
+            fields |= PH_REMOTE_FIELD_CPU;
+        if (state->PrivateBytes != newState.PrivateBytes)
+            fields |= PH_REMOTE_FIELD_PRIVATE_BYTES;
+        if (state->WorkingSet != newState.WorkingSet)
+            fields |= PH_REMOTE_FIELD_WORKING_SET;
+        if (state->IoRead != newState.IoRead)
+            fields |= PH_REMOTE_FIELD_IO_READ;
+        if (state->IoWrite != newState.IoWrite)
+            fields |= PH_REMOTE_FIELD_IO_WRITE;
+        if (state->NumberOfThreads != newState.NumberOfThreads)
+            fields |= PH_REMOTE_FIELD_THREADS;
+        if (state->NumberOfHandles != newState.NumberOfHandles)
+            fields |= PH_REMOTE_FIELD_HANDLES;
+
+        PhSwapReference(&state->Name, newState.Name);
+        newState.Name = state->Name;
+        *state = newState;
+
+        if (fields != 0)
+            PhpWriteRemoteRecord(Delta, state, PH_REMOTE_RECORD_UPDATE, fields);
+    }
+
+    PhDereferenceObjects(processItems, numberOfProcessItems);
+    PhFree(processItems);
+
+    // Anything not seen in this tick has exited.
+
+    removedList = PhCreateList(8);
+    PhBeginEnumHashtable(StateTable, &enumContext);
+
+    while (state = PhNextEnumHashtable(&enumContext))
+    {
+        if (state->Sequence != Sequence)
+            PhAddItemList(removedList, UlongToHandle(state->ProcessId));
+    }
+
+    for (i = 0; i < removedList->Count; i++)
+    {
+        PH_REMOTE_PROCESS_STATE lookupState;
+
+        lookupState.ProcessId = HandleToUlong(removedList->Items[i]);
+        state = PhFindEntryHashtable(StateTable, &lookupState);
+        PhpWriteRemoteRecord(Delta, state, PH_REMOTE_RECORD_REMOVE, 0);
+        PhClearReference(&state->Name);
+        PhRemoveEntryHashtable(StateTable, state);
+    }
+
+    PhDereferenceObject(removedList);
+}
+
+static VOID PhpBuildRemoteFullState(
+    _In_ PPH_HASHTABLE StateTable,
+    _Inout_ PPH_BYTES_BUILDER Message
+    )
+{
+    PH_HASHTABLE_ENUM_CONTEXT enumContext;
+    PPH_REMOTE_PROCESS_STATE state;
+
+    PhBeginEnumHashtable(StateTable, &enumContext);
+
+    while (state = PhNextEnumHashtable(&enumContext))
+        PhpWriteRemoteRecord(Message, state, PH_REMOTE_RECORD_ADD, PH_REMOTE_FIELD_ALL);
+}
+
+static NTSTATUS PhpRemoteListenerThreadStart(
+    _In_ PVOID Parameter
+    )
+{
+    static SID_IDENTIFIER_AUTHORITY ntAuthority = SECURITY_NT_AUTHORITY;
+    PSECURITY_DESCRIPTOR securityDescriptor;
+    ULONG sdAllocationLength;
+    UCHAR administratorsSidBuffer[FIELD_OFFSET(SID, SubAuthority) + sizeof(ULONG) * 2];
+    PSID administratorsSid;
+    PACL dacl;
+    SECURITY_ATTRIBUTES securityAttributes;
+    PH_FORMAT format[2];
+    PPH_STRING pipeName;
+
+    // Only administrators can connect.
+
+    administratorsSid = (PSID)administratorsSidBuffer;
+    RtlInitializeSid(administratorsSid, &ntAuthority, 2);
+    *RtlSubAuthoritySid(administratorsSid, 0) = SECURITY_BUILTIN_DOMAIN_RID;
+    *RtlSubAuthoritySid(administratorsSid, 1) = DOMAIN_ALIAS_RID_ADMINS;
+
+    sdAllocationLength = SECURITY_DESCRIPTOR_MIN_LENGTH +
+        (ULONG)sizeof(ACL) +
+        (ULONG)sizeof(ACCESS_ALLOWED_ACE) +
+        RtlLengthSid(administratorsSid);
+
+    securityDescriptor = PhAllocate(sdAllocationLength);
+    dacl = (PACL)((PCHAR)securityDescriptor + SECURITY_DESCRIPTOR_MIN_LENGTH);
+
+    RtlCreateSecurityDescriptor(securityDescriptor, SECURITY_DESCRIPTOR_REVISION);
+    RtlCreateAcl(dacl, sdAllocationLength - SECURITY_DESCRIPTOR_MIN_LENGTH, ACL_REVISION);
+    RtlAddAccessAllowedAce(dacl, ACL_REVISION, GENERIC_ALL, administratorsSid);
+    RtlSetDaclSecurityDescriptor(securityDescriptor, TRUE, dacl, FALSE);
+
+    securityAttributes.nLength = sizeof(SECURITY_ATTRIBUTES);
+    securityAttributes.lpSecurityDescriptor = securityDescriptor;
+    securityAttributes.bInheritHandle = FALSE;
+
+    PhInitFormatS(&format[0], L"\\\\.");
+    PhInitFormatS(&format[1], PH_REMOTE_PIPE_NAME);
+    pipeName = PhFormat(format, 2, 0);
+
+    while (TRUE)
+    {
+        HANDLE pipeHandle;
+        PPH_REMOTE_CLIENT client;
+
+        pipeHandle = CreateNamedPipe(
+            pipeName->Buffer,
+            PIPE_ACCESS_OUTBOUND,
+            PIPE_TYPE_MESSAGE | PIPE_WAIT,
+            PIPE_UNLIMITED_INSTANCES,
+            PH_REMOTE_BUFFER_SIZE,
+            0,
+            0,
+            &securityAttributes
+            );
+
+        if (pipeHandle == INVALID_HANDLE_VALUE)
+            break;
+
+        if (!ConnectNamedPipe(pipeHandle, NULL) && GetLastError() != ERROR_PIPE_CONNECTED)
+        {
+            CloseHandle(pipeHandle);
+            continue;
+        }
+
+        client = PhAllocate(sizeof(PH_REMOTE_CLIENT));
+        client->PipeHandle = pipeHandle;
+        client->NeedsFullState = TRUE;
+
+        PhAcquireQueuedLockExclusive(&PhpRemoteClientListLock);
+        PhAddItemList(PhpRemoteClientList, client);
+        PhReleaseQueuedLockExclusive(&PhpRemoteClientListLock);
+    }
+
+    PhDereferenceObject(pipeName);
+    PhFree(securityDescriptor);
+
+    return STATUS_SUCCESS;
+}
+
+static BOOLEAN NTAPI PhpRemoteOptionCallback(
+    _In_opt_ PPH_COMMAND_LINE_OPTION Option,
+    _In_opt_ PPH_STRING Value,
+    _In_opt_ PVOID Context
+    )
+{
+    ULONG64 integer;
+
+    if (Option && Option->Id == 1)
+    {
+        if (PhStringToInteger64(&Value->sr, 10, &integer) && integer != 0)
+            *(PULONG)Context = (ULONG)integer;
+    }
+
+    return TRUE;
+}
+
+static NTSTATUS PhpRemoteServe(
+    VOID
+    )
+{
+    static PH_COMMAND_LINE_OPTION options[] =
+    {
+        { 1, L"interval", MandatoryArgumentType }
+    };
+    PH_STRINGREF commandLine;
+    ULONG interval;
+    PPH_HASHTABLE stateTable;
+    ULONG sequence;
+    HANDLE threadHandle;
+
+    interval = PhGetIntegerSetting(L"UpdateInterval");
+
+    PhUnicodeStringToStringRef(&NtCurrentPeb()->ProcessParameters->CommandLine, &commandLine);
+    PhParseCommandLine(
+        &commandLine,
+        options,
+        sizeof(options) / sizeof(PH_COMMAND_LINE_OPTION),
+        PH_COMMAND_LINE_IGNORE_UNKNOWN_OPTIONS,
+        PhpRemoteOptionCallback,
+        &interval
+        );
+
+    PhpRemoteClientList = PhCreateList(4);
+
+    if (!(threadHandle = PhCreateThread(0, PhpRemoteListenerThreadStart, NULL)))
+        return STATUS_UNSUCCESSFUL;
+
+    NtClose(threadHandle);
+
+    stateTable = PhpCreateRemoteProcessStateTable();
+    sequence = 0;
+
+    // The server runs until the process is terminated.
+    while (TRUE)
+    {
+        PH_BYTES_BUILDER delta;
+        PH_BYTES_BUILDER full;
+        BOOLEAN fullBuilt;
+        LARGE_INTEGER time;
+        LARGE_INTEGER timeout;
+        ULONG i;
+
+        sequence++;
+        PhProcessProviderUpdate(NULL);
+        PhQuerySystemTime(&time);
+
+        PhpBeginRemoteMessage(&delta, PH_REMOTE_MESSAGE_DELTA, sequence, &time);
+        PhpUpdateRemoteState(stateTable, &delta, sequence);
+        fullBuilt = FALSE;
+
+        PhAcquireQueuedLockExclusive(&PhpRemoteClientListLock);
+
+        for (i = 0; i < PhpRemoteClientList->Count; i++)
+        {
+            PPH_REMOTE_CLIENT client = PhpRemoteClientList->Items[i];
+            PPH_BYTES_BUILDER message;
+            ULONG bytesWritten;
+
+            if (client->NeedsFullState)
+            {
+                if (!fullBuilt)
+                {
+                    PhpBeginRemoteMessage(&full, PH_REMOTE_MESSAGE_FULL, sequence, &time);
+                    PhpBuildRemoteFullState(stateTable, &full);
+                    fullBuilt = TRUE;
+                }
+
+                message = &full;
+                client->NeedsFullState = FALSE;
+            }
+            else
+            {
+                message = &delta;
+            }
+
+            // Clients that disconnect or stop reading are dropped.
+            if (!WriteFile(client->PipeHandle, message->Bytes->Buffer, (ULONG)message->Bytes->Length, &bytesWritten, NULL))
+            {
+                CloseHandle(client->PipeHandle);
+                PhFree(client);
+                PhRemoveItemList(PhpRemoteClientList, i);
+                i--;
+            }
+        }
+
+        PhReleaseQueuedLockExclusive(&PhpRemoteClientListLock);
+
+        if (fullBuilt)
+            PhDeleteBytesBuilder(&full);
+
+        PhDeleteBytesBuilder(&delta);
+
+        timeout.QuadPart = -(LONGLONG)interval * PH_TIMEOUT_MS;
+        NtDelayExecution(FALSE, &timeout);
+    }
+}
+
+static VOID PhpAppendJsonString(
+    _Inout_ PPH_STRING_BUILDER StringBuilder,
+    _In_ PWCHAR Buffer,
+    _In_ SIZE_T Length
+    )
+{
+    SIZE_T i;
+
+    PhAppendCharStringBuilder(StringBuilder, '"');
+
+    for (i = 0; i < Length / sizeof(WCHAR); i++)
+    {
+        if (Buffer[i] == '"' || Buffer[i] == '\\')
+        {
+            PhAppendCharStringBuilder(StringBuilder, '\\');
+            PhAppendCharStringBuilder(StringBuilder, Buffer[i]);
+        }
+        else if (Buffer[i] < ' ')
+        {
+            PhAppendFormatStringBuilder(StringBuilder, L"\\u%04x", Buffer[i]);
+        }
+        else
+        {
+            PhAppendCharStringBuilder(StringBuilder, Buffer[i]);
+        }
+    }
+
+    PhAppendCharStringBuilder(StringBuilder, '"');
+}
+
+#define PHP_REMOTE_READ(Type, Variable) \
+    do { \
+        if ((SIZE_T)(end - position) < sizeof(Type)) return FALSE; \
+        Variable = *(Type UNALIGNED *)position; \
+        position += sizeof(Type); \
+    } while (0)
+
+static BOOLEAN PhpFormatRemoteMessage(
+    _In_reads_bytes_(Length) PUCHAR Buffer,
+    _In_ ULONG Length,
+    _Inout_ PPH_STRING_BUILDER StringBuilder
+    )
+{
+    static PWSTR kindNames[] = { L"", L"add", L"remove", L"update" };
+    PPH_REMOTE_MESSAGE_HEADER header;
+    PUCHAR position;
+    PUCHAR end;
+    ULONG i;
+
+    if (Length < sizeof(PH_REMOTE_MESSAGE_HEADER))
+        return FALSE;
+
+    header = (PPH_REMOTE_MESSAGE_HEADER)Buffer;
+
+    if (header->Magic != PH_REMOTE_MAGIC)
+        return FALSE;
+
+    position = Buffer + sizeof(PH_REMOTE_MESSAGE_HEADER);
+    end = Buffer + Length;
+
+    for (i = 0; i < header->NumberOfRecords; i++)
+    {
+        PH_REMOTE_RECORD_HEADER record;
+        ULONG ulongValue;
+        ULONG64 ulong64Value;
+        FLOAT floatValue;
+
+        PHP_REMOTE_READ(PH_REMOTE_RECORD_HEADER, record);
+
+        if (record.Kind < PH_REMOTE_RECORD_ADD || record.Kind > PH_REMOTE_RECORD_UPDATE)
+            return FALSE;
+
+        PhAppendFormatStringBuilder(
+            StringBuilder,
+            L"{\"sequence\":%u,\"full\":%s,\"op\":\"%s\",\"pid\":%u",
+            header->Sequence,
+            header->Type == PH_REMOTE_MESSAGE_FULL ? L"true" : L"false",
+            kindNames[record.Kind],
+            record.ProcessId
+            );
+
+        if (record.Fields & PH_REMOTE_FIELD_PARENT_PROCESS_ID)
+        {
+            PHP_REMOTE_READ(ULONG, ulongValue);
+            PhAppendFormatStringBuilder(StringBuilder, L",\"ppid\":%u", ulongValue);
+        }
+
+        if (record.Fields & PH_REMOTE_FIELD_NAME)
+        {
+            USHORT length;
+
+            PHP_REMOTE_READ(USHORT, length);
+
+            if ((SIZE_T)(end - position) < length)
+                return FALSE;
+
+            PhAppendStringBuilder2(StringBuilder, L",\"name\":");
+            PhpAppendJsonString(StringBuilder, (PWCHAR)position, length);
+            position += length;
+        }
+
+        if (record.Fields & PH_REMOTE_FIELD_CPU)
+        {
+            PHP_REMOTE_READ(FLOAT, floatValue);
+            PhAppendFormatStringBuilder(StringBuilder, L",\"cpu\":%.2f", floatValue * 100);
+        }
+
+        if (record.Fields & PH_REMOTE_FIELD_PRIVATE_BYTES)
+        {
+            PHP_REMOTE_READ(ULONG64, ulong64Value);
+            PhAppendFormatStringBuilder(StringBuilder, L",\"private_bytes\":%I64u", ulong64Value);
+        }
+
+        if (record.Fields & PH_REMOTE_FIELD_WORKING_SET)
+        {
+            PHP_REMOTE_READ(ULONG64, ulong64Value);
+            PhAppendFormatStringBuilder(StringBuilder, L",\"working_set\":%I64u", ulong64Value);
+        }
+
+        if (record.Fields & PH_REMOTE_FIELD_IO_READ)
+        {
+            PHP_REMOTE_READ(ULONG64, ulong64Value);
+            PhAppendFormatStringBuilder(StringBuilder, L",\"io_read_bytes\":%I64u", ulong64Value);
+        }
+
+        if (record.Fields & PH_REMOTE_FIELD_IO_WRITE)
+        {
+            PHP_REMOTE_READ(ULONG64, ulong64Value);
+            PhAppendFormatStringBuilder(StringBuilder, L",\"io_write_bytes\":%I64u", ulong64Value);
+        }
+
+        if (record.Fields & PH_REMOTE_FIELD_THREADS)
+        {
+            PHP_REMOTE_READ(ULONG, ulongValue);
+            PhAppendFormatStringBuilder(StringBuilder, L",\"threads\":%u", ulongValue);
+        }
+
+        if (record.Fields & PH_REMOTE_FIELD_HANDLES)
+        {
+            PHP_REMOTE_READ(ULONG, ulongValue);
+            PhAppendFormatStringBuilder(StringBuilder, L",\"handles\":%u", ulongValue);
+        }
+
+        PhAppendStringBuilder2(StringBuilder, L"}\r\n");
+    }
+
+    return TRUE;
+}
+
+static NTSTATUS PhpRemoteWatch(
+    VOID
+    )
+{
+    NTSTATUS status;
+    PH_FORMAT format[3];
+    PPH_STRING pipeName;
+    HANDLE pipeHandle;
+    ULONG mode;
+    HANDLE outputHandle;
+    PPH_FILE_STREAM fileStream;
+    PH_STRING_BUILDER stringBuilder;
+    PUCHAR buffer;
+    ULONG bufferSize;
+    ULONG offset;
+
+    if (!PhStartupParameters.CommandObject)
+        return STATUS_INVALID_PARAMETER;
+
+    outputHandle = NtCurrentPeb()->ProcessParameters->StandardOutput;
+
+    if (!outputHandle || outputHandle == INVALID_HANDLE_VALUE)
+        return STATUS_INVALID_HANDLE;
+
+    PhInitFormatS(&format[0], L"\\\\");
+    PhInitFormatSR(&format[1], PhStartupParameters.CommandObject->sr);
+    PhInitFormatS(&format[2], PH_REMOTE_PIPE_NAME);
+    pipeName = PhFormat(format, 3, 0);
+
+    pipeHandle = CreateFile(
+        pipeName->Buffer,
+        GENERIC_READ | FILE_WRITE_ATTRIBUTES,
+        0,
+        NULL,
+        OPEN_EXISTING,
+        0,
+        NULL
+        );
+    PhDereferenceObject(pipeName);
+
+    if (pipeHandle == INVALID_HANDLE_VALUE)
+        return PhDosErrorToNtStatus(GetLastError());
+
+    mode = PIPE_READMODE_MESSAGE;
+    SetNamedPipeHandleState(pipeHandle, &mode, NULL, NULL);
+
+    if (!NT_SUCCESS(status = PhCreateFileStream2(&fileStream, outputHandle, PH_FILE_STREAM_HANDLE_UNOWNED, 0x1000)))
+    {
+        CloseHandle(pipeHandle);
+        return status;
+    }
+
+    PhInitializeStringBuilder(&stringBuilder, 0x1000);
+    bufferSize = PH_REMOTE_BUFFER_SIZE;
+    buffer = PhAllocate(bufferSize);
+    offset = 0;
+
+    while (TRUE)
+    {
+        ULONG bytesRead;
+
+        if (!ReadFile(pipeHandle, buffer + offset, bufferSize - offset, &bytesRead, NULL))
+        {
+            if (GetLastError() == ERROR_MORE_DATA)
+            {
+                // The message is larger than our buffer. Keep what we have and read the rest.
+                offset += bytesRead;
+                bufferSize *= 2;
+                buffer = PhReAllocate(buffer, bufferSize);
+                continue;
+            }
+
+            status = PhDosErrorToNtStatus(GetLastError());
+            break;
+        }
+
+        if (!PhpFormatRemoteMessage(buffer, offset + bytesRead, &stringBuilder))
+        {
+            status = STATUS_DATA_ERROR;
+            break;
+        }
+
+        offset = 0;
+
+        PhWriteStringAsUtf8FileStreamEx(fileStream, stringBuilder.String->Buffer, stringBuilder.String->Length);
+        PhRemoveEndStringBuilder(&stringBuilder, stringBuilder.String->Length / sizeof(WCHAR));
+
+        if (!NT_SUCCESS(status = PhFlushFileStream(fileStream, FALSE)))
+            break;
+    }
+
+    PhFree(buffer);
+    PhDeleteStringBuilder(&stringBuilder);
+    PhDereferenceObject(fileStream);
+    CloseHandle(pipeHandle);
+
+    return status;
+}
+
+NTSTATUS PhCommandModeRemote(
+    VOID
+    )
+{
+    if (PhEqualString2(PhStartupParameters.CommandAction, L"serve", TRUE))
+        return PhpRemoteServe();
+    else if (PhEqualString2(PhStartupParameters.CommandAction, L"watch", TRUE))
+        return PhpRemoteWatch();
+    else
+        return STATUS_INVALID_PARAMETER;
+}
@@ -120,6 +120,7 @@
 #define IDD_MINIINFO_LIST               210
 #define IDR_MINIINFO                    211
 #define IDR_MINIINFO_PROCESS            212
+#define IDD_JOBS                        214
 #define IDC_TERMINATE                   1003
 #define IDC_FILEICON                    1005
 #define IDC_FILE                        1006
@@ -527,6 +528,8 @@
 #define IDC_ZLISTMODIFIEDPAGEFILE_V     1373
 #define IDC_SECTION                     1375
 #define IDC_REGEX                       1377
+#define IDC_PATTERN                     1378
+#define IDC_SNAPSHOT                    1379
 #define ID_MAINWND_PROCESSTL            2001
 #define ID_MAINWND_SERVICETL            2002
 #define ID_MAINWND_NETWORKTL            2003
@@ -728,6 +731,10 @@
 #define ID_PROCESS_GOTOPROCESS          40287
 #define ID_MINIINFO_REFRESH             40288
 #define ID_MINIINFO_REFRESHAUTOMATICALLY 40289
+#define ID_ANALYZE_CPUPROFILE           40290
+#define ID_MEMORY_TAKESNAPSHOT          40291
+#define ID_MEMORY_COMPARESNAPSHOT       40292
+#define ID_TOOLS_JOBS                   40293
 #define IDDYNAMIC                       50000
 #define IDPLUGINS                       55000
 
@@ -735,9 +742,9 @@
 // 
 #ifdef APSTUDIO_INVOKED
 #ifndef APSTUDIO_READONLY_SYMBOLS
-#define _APS_NEXT_RESOURCE_VALUE        214
-#define _APS_NEXT_COMMAND_VALUE         40290
-#define _APS_NEXT_CONTROL_VALUE         1378
+#define _APS_NEXT_RESOURCE_VALUE        215
+#define _APS_NEXT_COMMAND_VALUE         40294
+#define _APS_NEXT_CONTROL_VALUE         1380
 #define _APS_NEXT_SYMED_VALUE           169
 #endif
 #endif
@@ -32,6 +32,12 @@
  * The get/set functions are very strict. If the wrong function is used
  * (the get-integer-setting function is used on a string setting) or
  * the setting does not exist, an exception will be raised.
+ *
+ * Parsing the XML file is slow when there are many settings, so a binary
+ * copy of the settings is kept next to it and used at startup when the
+ * XML file has not been touched since. The XML file is only rewritten if
+ * a setting has actually changed (or someone else has written to the
+ * file).
  */
 
 #define PH_SETTINGS_PRIVATE
@@ -45,6 +51,9 @@ PH_QUEUED_LOCK PhSettingsLock = PH_QUEUED_LOCK_INIT;
 
 PPH_LIST PhIgnoredSettings;
 
+static BOOLEAN PhpSettingsModified = FALSE;
+static LARGE_INTEGER PhpSettingsLastWriteTime = { 0 };
+
 // These macros make sure the C strings can be seamlessly converted into
 // PH_STRINGREFs at compile time, for a small speed boost.
 
@@ -72,19 +81,25 @@ VOID PhSettingsInitialization(
     PhIgnoredSettings = PhCreateList(4);
 
     PhpAddIntegerSetting(L"AllowOnlyOneInstance", L"1");
+    PhpAddIntegerSetting(L"BackgroundUpdateInterval", L"1388"); // 5000ms
     PhpAddIntegerSetting(L"CloseOnEscape", L"0");
     PhpAddIntegerSetting(L"CollapseServicesOnStart", L"0");
     PhpAddStringSetting(L"DbgHelpPath", L"dbghelp.dll");
     PhpAddStringSetting(L"DbgHelpSearchPath", L"");
     PhpAddIntegerSetting(L"DbgHelpUndecorate", L"1");
+    PhpAddIntegerSetting(L"DbgHelpIndexCache", L"1");
     PhpAddStringSetting(L"DisabledPlugins", L"");
     PhpAddIntegerSetting(L"ElevationLevel", L"1"); // PromptElevateAction
+    PhpAddIntegerSetting(L"EnableBackgroundMode", L"1");
+    PhpAddIntegerSetting(L"EnableCompressedProcessHistory", L"0");
     PhpAddIntegerSetting(L"EnableCycleCpuUsage", L"1");
     PhpAddIntegerSetting(L"EnableInstantTooltips", L"0");
     PhpAddIntegerSetting(L"EnableKph", L"1");
     PhpAddIntegerSetting(L"EnableNetworkResolve", L"1");
+    PhpAddIntegerSetting(L"EnablePersistentVerifyCache", L"1");
     PhpAddIntegerSetting(L"EnablePlugins", L"1");
     PhpAddIntegerSetting(L"EnableServiceNonPoll", L"0");
+    PhpAddIntegerSetting(L"EnableSnapshotPublication", L"0");
     PhpAddIntegerSetting(L"EnableStage2", L"1");
     PhpAddIntegerSetting(L"EnableWarnings", L"1");
     PhpAddStringSetting(L"EnvironmentListViewColumns", L"");
@@ -114,6 +129,7 @@ VOID PhSettingsInitialization(
     PhpAddIntegerSetting(L"IconSingleClick", L"0");
     PhpAddIntegerSetting(L"IconTogglesVisibility", L"1");
     PhpAddIntegerSetting(L"LogEntries", L"200"); // 512
+    PhpAddStringSetting(L"LogFileName", L"");
     PhpAddStringSetting(L"LogListViewColumns", L"");
     PhpAddIntegerPairSetting(L"LogWindowPosition", L"300,300");
     PhpAddIntegerPairSetting(L"LogWindowSize", L"450,500");
@@ -124,6 +140,7 @@ VOID PhSettingsInitialization(
     PhpAddIntegerSetting(L"MainWindowState", L"1");
     PhpAddIntegerSetting(L"MaxSizeUnit", L"6");
     PhpAddIntegerSetting(L"MemEditBytesPerRow", L"10"); // 16
+    PhpAddIntegerSetting(L"MemoryBudget", L"0"); // in MB, 0 means no budget
     PhpAddStringSetting(L"MemEditGotoChoices", L"");
     PhpAddIntegerPairSetting(L"MemEditPosition", L"450,450");
     PhpAddIntegerPairSetting(L"MemEditSize", L"600,500");
@@ -152,9 +169,15 @@ VOID PhSettingsInitialization(
     PhpAddStringSetting(L"ProcessTreeListSort", L"0,0"); // 0, NoSortOrder
     PhpAddStringSetting(L"ProcPropPage", L"General");
     PhpAddIntegerPairSetting(L"ProcPropPosition", L"200,200");
+    PhpAddIntegerSetting(L"ProcPropPrewarm", L"1");
     PhpAddIntegerPairSetting(L"ProcPropSize", L"460,580");
+    PhpAddIntegerSetting(L"ProfilerDuration", L"1e"); // 30 seconds
+    PhpAddIntegerSetting(L"ProfilerMaximumOverhead", L"a"); // percent of elapsed time
+    PhpAddIntegerSetting(L"ProfilerMaximumThreads", L"4");
+    PhpAddIntegerSetting(L"ProfilerSampleInterval", L"a"); // milliseconds
     PhpAddStringSetting(L"ProgramInspectExecutables", L"peview.exe \"%s\"");
     PhpAddIntegerSetting(L"PropagateCpuUsage", L"0");
+    PhpAddStringSetting(L"RecordingFileName", L"");
     PhpAddStringSetting(L"RunAsProgram", L"");
     PhpAddStringSetting(L"RunAsUserName", L"");
     PhpAddIntegerSetting(L"SampleCount", L"200"); // 512
@@ -219,6 +242,7 @@ VOID PhSettingsInitialization(
 
     PhpAddIntegerSetting(L"GraphShowText", L"1");
     PhpAddIntegerSetting(L"GraphColorMode", L"0");
+    PhpAddIntegerSetting(L"GraphRenderer", L"0"); // 0: GDI, 1: Direct2D
     PhpAddIntegerSetting(L"ColorCpuKernel", L"00ff00");
     PhpAddIntegerSetting(L"ColorCpuUser", L"0000ff");
     PhpAddIntegerSetting(L"ColorIoReadOther", L"00ffff");
@@ -448,6 +472,17 @@ static PVOID PhpLookupSetting(
     return setting;
 }
 
+static BOOLEAN PhpIsStringSettingEqual(
+    _In_ PPH_SETTING Setting,
+    _In_ PPH_STRINGREF Value
+    )
+{
+    if (!Setting->u.Pointer)
+        return Value->Length == 0;
+
+    return PhEqualStringRef(&((PPH_STRING)Setting->u.Pointer)->sr, Value, FALSE);
+}
+
 _May_raise_ ULONG PhGetIntegerSetting(
     _In_ PWSTR Name
     )
@@ -569,7 +604,11 @@ _May_raise_ VOID PhSetIntegerSetting(
 
     if (setting && setting->Type == IntegerSettingType)
     {
-        setting->u.Integer = Value;
+        if (setting->u.Integer != Value)
+        {
+            setting->u.Integer = Value;
+            PhpSettingsModified = TRUE;
+        }
     }
 
     PhReleaseQueuedLockExclusive(&PhSettingsLock);
@@ -594,7 +633,11 @@ _May_raise_ VOID PhSetIntegerPairSetting(
 
     if (setting && setting->Type == IntegerPairSettingType)
     {
-        setting->u.IntegerPair = Value;
+        if (setting->u.IntegerPair.X != Value.X || setting->u.IntegerPair.Y != Value.Y)
+        {
+            setting->u.IntegerPair = Value;
+            PhpSettingsModified = TRUE;
+        }
     }
 
     PhReleaseQueuedLockExclusive(&PhSettingsLock);
@@ -610,8 +653,10 @@ _May_raise_ VOID PhSetStringSetting(
 {
     PPH_SETTING setting;
     PH_STRINGREF name;
+    PH_STRINGREF value;
 
     PhInitializeStringRef(&name, Name);
+    PhInitializeStringRef(&value, Value);
 
     PhAcquireQueuedLockExclusive(&PhSettingsLock);
 
@@ -619,8 +664,12 @@ _May_raise_ VOID PhSetStringSetting(
 
     if (setting && setting->Type == StringSettingType)
     {
-        PhpFreeSettingValue(StringSettingType, setting);
-        setting->u.Pointer = PhCreateString(Value);
+        if (!PhpIsStringSettingEqual(setting, &value))
+        {
+            PhpFreeSettingValue(StringSettingType, setting);
+            setting->u.Pointer = PhCreateString2(&value);
+            PhpSettingsModified = TRUE;
+        }
     }
 
     PhReleaseQueuedLockExclusive(&PhSettingsLock);
@@ -645,8 +694,12 @@ _May_raise_ VOID PhSetStringSetting2(
 
     if (setting && setting->Type == StringSettingType)
     {
-        PhpFreeSettingValue(StringSettingType, setting);
-        setting->u.Pointer = PhCreateString2(Value);
+        if (!PhpIsStringSettingEqual(setting, Value))
+        {
+            PhpFreeSettingValue(StringSettingType, setting);
+            setting->u.Pointer = PhCreateString2(Value);
+            PhpSettingsModified = TRUE;
+        }
     }
 
     PhReleaseQueuedLockExclusive(&PhSettingsLock);
@@ -741,6 +794,267 @@ mxml_type_t PhpSettingsLoadCallback(
     return MXML_OPAQUE;
 }
 
+/**
+ * Loads the value of a setting. Unrecognized settings are added to the list of ignored settings.
+ * The settings lock must be held exclusively.
+ *
+ * \param Name The name of the setting.
+ * \param Value The value of the setting.
+ */
+static VOID PhpLoadSetting(
+    _In_ PPH_STRINGREF Name,
+    _In_ PPH_STRING Value
+    )
+{
+    PPH_SETTING setting;
+
+    setting = PhpLookupSetting(Name);
+
+    if (setting)
+    {
+        PhpFreeSettingValue(setting->Type, setting);
+
+        if (!PhpSettingFromString(
+            setting->Type,
+            &Value->sr,
+            Value,
+            setting
+            ))
+        {
+            PhpSettingFromString(
+                setting->Type,
+                &setting->DefaultValue,
+                NULL,
+                setting
+                );
+        }
+    }
+    else
+    {
+        setting = PhAllocate(sizeof(PH_SETTING));
+        setting->Name.Buffer = PhAllocate(Name->Length + sizeof(WCHAR));
+        memcpy(setting->Name.Buffer, Name->Buffer, Name->Length);
+        setting->Name.Buffer[Name->Length / sizeof(WCHAR)] = 0;
+        setting->Name.Length = Name->Length;
+        PhReferenceObject(Value);
+        setting->u.Pointer = Value;
+
+        PhAddItemList(PhIgnoredSettings, setting);
+    }
+}
+
+/**
+ * Loads settings from the settings cache.
+ *
+ * \param FileName The file name of the settings file.
+ * \param FileInformation The current attributes of the settings file.
+ *
+ * \return TRUE if the cache was up to date and the settings were loaded, otherwise FALSE.
+ */
+static BOOLEAN PhpLoadSettingsCache(
+    _In_ PWSTR FileName,
+    _In_ PFILE_NETWORK_OPEN_INFORMATION FileInformation
+    )
+{
+    BOOLEAN result = FALSE;
+    PPH_STRING cacheFileName;
+    PVOID viewBase;
+    SIZE_T viewSize;
+    PPH_SETTINGS_CACHE_HEADER header;
+    PPH_SETTINGS_CACHE_ENTRY entry;
+    PUCHAR position;
+    PUCHAR end;
+    SIZE_T entrySize;
+    ULONG i;
+
+    cacheFileName = PhConcatStrings2(FileName, PH_SETTINGS_CACHE_SUFFIX);
+
+    if (!NT_SUCCESS(PhMapViewOfEntireFile(cacheFileName->Buffer, NULL, TRUE, &viewBase, &viewSize)))
+    {
+        PhDereferenceObject(cacheFileName);
+        return FALSE;
+    }
+
+    PhDereferenceObject(cacheFileName);
+
+    header = viewBase;
+
+    if (
+        viewSize < sizeof(PH_SETTINGS_CACHE_HEADER) ||
+        header->Magic != PH_SETTINGS_CACHE_MAGIC ||
+        header->Version != PH_SETTINGS_CACHE_VERSION ||
+        header->XmlLastWriteTime.QuadPart != FileInformation->LastWriteTime.QuadPart ||
+        header->XmlEndOfFile.QuadPart != FileInformation->EndOfFile.QuadPart
+        )
+        goto CleanupExit;
+
+    // Validate the entries before we load any of them.
+
+    position = (PUCHAR)(header + 1);
+    end = (PUCHAR)viewBase + viewSize;
+
+    for (i = 0; i < header->NumberOfEntries; i++)
+    {
+        if ((SIZE_T)(end - position) < sizeof(PH_SETTINGS_CACHE_ENTRY))
+            goto CleanupExit;
+
+        entry = (PPH_SETTINGS_CACHE_ENTRY)position;
+        entrySize = ALIGN_UP(sizeof(PH_SETTINGS_CACHE_ENTRY) + entry->NameLength + entry->ValueLength, ULONG);
+
+        if (
+            (entry->NameLength & 1) || (entry->ValueLength & 1) ||
+            entry->ValueLength > (ULONG)(end - position) ||
+            (SIZE_T)(end - position) < entrySize
+            )
+            goto CleanupExit;
+
+        position += entrySize;
+    }
+
+    position = (PUCHAR)(header + 1);
+
+    PhAcquireQueuedLockExclusive(&PhSettingsLock);
+
+    for (i = 0; i < header->NumberOfEntries; i++)
+    {
+        PH_STRINGREF name;
+        PPH_STRING value;
+
+        entry = (PPH_SETTINGS_CACHE_ENTRY)position;
+        name.Buffer = (PWCHAR)(entry + 1);
+        name.Length = entry->NameLength;
+        value = PhCreateStringEx((PWCHAR)PTR_ADD_OFFSET(name.Buffer, name.Length), entry->ValueLength);
+
+        PhpLoadSetting(&name, value);
+        PhDereferenceObject(value);
+
+        position += ALIGN_UP(sizeof(PH_SETTINGS_CACHE_ENTRY) + entry->NameLength + entry->ValueLength, ULONG);
+    }
+
+    PhReleaseQueuedLockExclusive(&PhSettingsLock);
+
+    result = TRUE;
+
+CleanupExit:
+    NtUnmapViewOfSection(NtCurrentProcess(), viewBase);
+
+    return result;
+}
+
+static VOID PhpAppendSettingsCacheEntry(
+    _Inout_ PPH_BYTES_BUILDER BytesBuilder,
+    _In_ PPH_STRINGREF Name,
+    _In_ PPH_STRINGREF Value
+    )
+{
+    static ULONG zero = 0;
+    PH_SETTINGS_CACHE_ENTRY entry;
+    SIZE_T length;
+
+    entry.NameLength = (USHORT)Name->Length;
+    entry.Reserved = 0;
+    entry.ValueLength = (ULONG)Value->Length;
+
+    PhAppendBytesBuilderEx(BytesBuilder, &entry, sizeof(PH_SETTINGS_CACHE_ENTRY), 0, NULL);
+    PhAppendBytesBuilderEx(BytesBuilder, Name->Buffer, Name->Length, 0, NULL);
+    PhAppendBytesBuilderEx(BytesBuilder, Value->Buffer, Value->Length, 0, NULL);
+
+    length = BytesBuilder->Bytes->Length;
+
+    if (length != ALIGN_UP(length, ULONG))
+        PhAppendBytesBuilderEx(BytesBuilder, &zero, ALIGN_UP(length, ULONG) - length, 0, NULL);
+}
+
+/**
+ * Writes the current settings to the settings cache.
+ *
+ * \param FileName The file name of the settings file.
+ * \param FileInformation The attributes of the settings file that correspond to the current
+ * settings.
+ */
+static VOID PhpSaveSettingsCache(
+    _In_ PWSTR FileName,
+    _In_ PFILE_NETWORK_OPEN_INFORMATION FileInformation
+    )
+{
+    PH_BYTES_BUILDER bytesBuilder;
+    PH_SETTINGS_CACHE_HEADER header;
+    PPH_SETTINGS_CACHE_HEADER headerInBuffer;
+    PH_HASHTABLE_ENUM_CONTEXT enumContext;
+    PPH_SETTING setting;
+    ULONG numberOfEntries;
+    ULONG i;
+    PPH_STRING cacheFileName;
+    HANDLE fileHandle;
+    IO_STATUS_BLOCK isb;
+
+    PhInitializeBytesBuilder(&bytesBuilder, 0x4000);
+
+    memset(&header, 0, sizeof(PH_SETTINGS_CACHE_HEADER));
+    header.Magic = PH_SETTINGS_CACHE_MAGIC;
+    header.Version = PH_SETTINGS_CACHE_VERSION;
+    header.XmlLastWriteTime = FileInformation->LastWriteTime;
+    header.XmlEndOfFile = FileInformation->EndOfFile;
+    PhAppendBytesBuilderEx(&bytesBuilder, &header, sizeof(PH_SETTINGS_CACHE_HEADER), 0, NULL);
+
+    numberOfEntries = 0;
+
+    PhAcquireQueuedLockShared(&PhSettingsLock);
+
+    PhBeginEnumHashtable(PhSettingsHashtable, &enumContext);
+
+    while (setting = PhNextEnumHashtable(&enumContext))
+    {
+        PPH_STRING settingValue;
+
+        settingValue = PhpSettingToString(setting->Type, setting);
+        PhpAppendSettingsCacheEntry(&bytesBuilder, &setting->Name, &settingValue->sr);
+        PhDereferenceObject(settingValue);
+        numberOfEntries++;
+    }
+
+    for (i = 0; i < PhIgnoredSettings->Count; i++)
+    {
+        setting = PhIgnoredSettings->Items[i];
+        PhpAppendSettingsCacheEntry(&bytesBuilder, &setting->Name, &((PPH_STRING)setting->u.Pointer)->sr);
+        numberOfEntries++;
+    }
+
+    PhReleaseQueuedLockShared(&PhSettingsLock);
+
+    headerInBuffer = (PPH_SETTINGS_CACHE_HEADER)PhOffsetBytesBuilder(&bytesBuilder, 0);
+    headerInBuffer->NumberOfEntries = numberOfEntries;
+
+    cacheFileName = PhConcatStrings2(FileName, PH_SETTINGS_CACHE_SUFFIX);
+
+    if (NT_SUCCESS(PhCreateFileWin32(
+        &fileHandle,
+        cacheFileName->Buffer,
+        FILE_GENERIC_WRITE,
+        FILE_ATTRIBUTE_NORMAL,
+        FILE_SHARE_READ,
+        FILE_OVERWRITE_IF,
+        FILE_NON_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT
+        )))
+    {
+        NtWriteFile(
+            fileHandle,
+            NULL,
+            NULL,
+            NULL,
+            &isb,
+            bytesBuilder.Bytes->Buffer,
+            (ULONG)bytesBuilder.Bytes->Length,
+            NULL,
+            NULL
+            );
+        NtClose(fileHandle);
+    }
+
+    PhDereferenceObject(cacheFileName);
+    PhDeleteBytesBuilder(&bytesBuilder);
+}
+
 NTSTATUS PhLoadSettings(
     _In_ PWSTR FileName
     )
@@ -748,11 +1062,23 @@ NTSTATUS PhLoadSettings(
     NTSTATUS status;
     HANDLE fileHandle;
     LARGE_INTEGER fileSize;
+    FILE_NETWORK_OPEN_INFORMATION fileInformation;
+    BOOLEAN fileInformationValid;
     mxml_node_t *topNode;
     mxml_node_t *currentNode;
 
     PhpClearIgnoredSettings();
 
+    fileInformationValid = NT_SUCCESS(PhQueryFullAttributesFileWin32(FileName, &fileInformation));
+
+    if (fileInformationValid && PhpLoadSettingsCache(FileName, &fileInformation))
+    {
+        PhpSettingsLastWriteTime = fileInformation.LastWriteTime;
+        PhUpdateCachedSettings();
+
+        return STATUS_SUCCESS;
+    }
+
     status = PhCreateFileWin32(
         &fileHandle,
         FileName,
@@ -807,43 +1133,7 @@ NTSTATUS PhLoadSettings(
             settingValue = PhGetOpaqueXmlNodeText(currentNode);
 
             PhAcquireQueuedLockExclusive(&PhSettingsLock);
-
-            {
-                PPH_SETTING setting;
-
-                setting = PhpLookupSetting(&settingName->sr);
-
-                if (setting)
-                {
-                    PhpFreeSettingValue(setting->Type, setting);
-
-                    if (!PhpSettingFromString(
-                        setting->Type,
-                        &settingValue->sr,
-                        settingValue,
-                        setting
-                        ))
-                    {
-                        PhpSettingFromString(
-                            setting->Type,
-                            &setting->DefaultValue,
-                            NULL,
-                            setting
-                            );
-                    }
-                }
-                else
-                {
-                    setting = PhAllocate(sizeof(PH_SETTING));
-                    setting->Name.Buffer = PhAllocateCopy(settingName->Buffer, settingName->Length + sizeof(WCHAR));
-                    setting->Name.Length = settingName->Length;
-                    PhReferenceObject(settingValue);
-                    setting->u.Pointer = settingValue;
-
-                    PhAddItemList(PhIgnoredSettings, setting);
-                }
-            }
-
+            PhpLoadSetting(&settingName->sr, settingValue);
             PhReleaseQueuedLockExclusive(&PhSettingsLock);
 
             PhDereferenceObject(settingValue);
@@ -857,6 +1147,12 @@ NTSTATUS PhLoadSettings(
 
     PhUpdateCachedSettings();
 
+    if (fileInformationValid)
+    {
+        PhpSettingsLastWriteTime = fileInformation.LastWriteTime;
+        PhpSaveSettingsCache(FileName, &fileInformation);
+    }
+
     return STATUS_SUCCESS;
 }
 
@@ -909,19 +1205,33 @@ mxml_node_t *PhpCreateSettingElement(
     return settingNode;
 }
 
-NTSTATUS PhSaveSettings(
+static NTSTATUS PhpSaveSettings(
     _In_ PWSTR FileName
     )
 {
     NTSTATUS status;
     HANDLE fileHandle;
+    FILE_NETWORK_OPEN_INFORMATION fileInformation;
     mxml_node_t *topNode;
     PH_HASHTABLE_ENUM_CONTEXT enumContext;
     PPH_SETTING setting;
 
+    // Don't rewrite the file if nothing has changed since we last read or wrote it.
+    if (
+        !PhpSettingsModified &&
+        NT_SUCCESS(PhQueryFullAttributesFileWin32(FileName, &fileInformation)) &&
+        fileInformation.LastWriteTime.QuadPart == PhpSettingsLastWriteTime.QuadPart
+        )
+    {
+        return STATUS_SUCCESS;
+    }
+
     topNode = mxmlNewElement(MXML_NO_PARENT, "settings");
 
-    PhAcquireQueuedLockShared(&PhSettingsLock);
+    PhAcquireQueuedLockExclusive(&PhSettingsLock);
+
+    // Any changes made after this point will be picked up by the next save.
+    PhpSettingsModified = FALSE;
 
     PhBeginEnumHashtable(PhSettingsHashtable, &enumContext);
 
@@ -948,7 +1258,7 @@ NTSTATUS PhSaveSettings(
         }
     }
 
-    PhReleaseQueuedLockShared(&PhSettingsLock);
+    PhReleaseQueuedLockExclusive(&PhSettingsLock);
 
     // Create the directory if it does not exist.
     {
@@ -983,6 +1293,7 @@ NTSTATUS PhSaveSettings(
 
     if (!NT_SUCCESS(status))
     {
+        PhpSettingsModified = TRUE;
         mxmlDelete(topNode);
         return status;
     }
@@ -991,9 +1302,35 @@ NTSTATUS PhSaveSettings(
     mxmlDelete(topNode);
     NtClose(fileHandle);
 
+    if (NT_SUCCESS(PhQueryFullAttributesFileWin32(FileName, &fileInformation)))
+    {
+        PhpSettingsLastWriteTime = fileInformation.LastWriteTime;
+        PhpSaveSettingsCache(FileName, &fileInformation);
+    }
+
     return STATUS_SUCCESS;
 }
 
+NTSTATUS PhSaveSettings(
+    _In_ PWSTR FileName
+    )
+{
+    NTSTATUS status;
+
+    if (PhTraceEnabled(PH_TRACE_KEYWORD_SETTINGS))
+    {
+        PhTraceSettingsSaveStart(FileName);
+        status = PhpSaveSettings(FileName);
+        PhTraceSettingsSaveStop(FileName, status);
+    }
+    else
+    {
+        status = PhpSaveSettings(FileName);
+    }
+
+    return status;
+}
+
 VOID PhResetSettings(
     VOID
     )
@@ -1011,6 +1348,8 @@ VOID PhResetSettings(
         PhpSettingFromString(setting->Type, &setting->DefaultValue, NULL, setting);
     }
 
+    PhpSettingsModified = TRUE;
+
     PhReleaseQueuedLockExclusive(&PhSettingsLock);
 }
 
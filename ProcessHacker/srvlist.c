@@ -218,6 +218,7 @@ PPH_SERVICE_NODE PhAddServiceNode(
     serviceNode->Node.TextCacheSize = PHSVTLC_MAXIMUM;
 
     PhAddEntryHashtable(ServiceNodeHashtable, &serviceNode);
+    serviceNode->ListIndex = ServiceNodeList->Count;
     PhAddItemList(ServiceNodeList, serviceNode);
 
     if (FilterSupport.FilterList)
@@ -279,14 +280,17 @@ VOID PhpRemoveServiceNode(
     _In_ PPH_SERVICE_NODE ServiceNode
     )
 {
-    ULONG index;
+    PPH_SERVICE_NODE lastNode;
 
     PhEmCallObjectOperation(EmServiceNodeType, ServiceNode, EmObjectDelete);
 
-    // Remove from list and cleanup.
+    // Remove from list and cleanup. The list is sorted again before it is used, so the last node
+    // takes this node's place.
 
-    if ((index = PhFindItemList(ServiceNodeList, ServiceNode)) != -1)
-        PhRemoveItemList(ServiceNodeList, index);
+    lastNode = ServiceNodeList->Items[ServiceNodeList->Count - 1];
+    ServiceNodeList->Items[ServiceNode->ListIndex] = lastNode;
+    lastNode->ListIndex = ServiceNode->ListIndex;
+    ServiceNodeList->Count--;
 
     if (ServiceNode->BinaryPath) PhDereferenceObject(ServiceNode->BinaryPath);
     if (ServiceNode->LoadOrderGroup) PhDereferenceObject(ServiceNode->LoadOrderGroup);
@@ -510,6 +514,7 @@ BOOLEAN NTAPI PhpServiceTreeNewCallback(
                     SORT_FUNCTION(Description)
                 };
                 int (__cdecl *sortFunction)(const void *, const void *);
+                ULONG i;
 
                 if (!PhCmForwardSort(
                     (PPH_TREENEW_NODE *)ServiceNodeList->Items,
@@ -526,10 +531,13 @@ BOOLEAN NTAPI PhpServiceTreeNewCallback(
 
                     if (sortFunction)
                     {
-                        qsort(ServiceNodeList->Items, ServiceNodeList->Count, sizeof(PVOID), sortFunction);
+                        PhSortItemsIncremental(ServiceNodeList->Items, ServiceNodeList->Count, sortFunction);
                     }
                 }
 
+                for (i = 0; i < ServiceNodeList->Count; i++)
+                    ((PPH_SERVICE_NODE)ServiceNodeList->Items[i])->ListIndex = i;
+
                 getChildren->Children = (PPH_TREENEW_NODE *)ServiceNodeList->Items;
                 getChildren->NumberOfChildren = ServiceNodeList->Count;
             }
@@ -814,20 +822,5 @@ VOID PhWriteServiceList(
     _In_ ULONG Mode
     )
 {
-    PPH_LIST lines;
-    ULONG i;
-
-    lines = PhGetGenericTreeNewLines(ServiceTreeListHandle, Mode);
-
-    for (i = 0; i < lines->Count; i++)
-    {
-        PPH_STRING line;
-
-        line = lines->Items[i];
-        PhWriteStringAsUtf8FileStream(FileStream, &line->sr);
-        PhDereferenceObject(line);
-        PhWriteStringAsUtf8FileStream2(FileStream, L"\r\n");
-    }
-
-    PhDereferenceObject(lines);
+    PhWriteGenericTreeNew(FileStream, ServiceTreeListHandle, Mode);
 }
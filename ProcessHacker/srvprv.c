@@ -23,6 +23,7 @@
 #include <phapp.h>
 #include <winevt.h>
 #include <extmgri.h>
+#include <phplug.h>
 
 typedef DWORD (WINAPI *_NotifyServiceStatusChangeW)(
     _In_ SC_HANDLE hService,
@@ -49,12 +50,20 @@ typedef struct _PHP_SERVICE_NOTIFY_CONTEXT
 {
     LIST_ENTRY ListEntry;
     SC_HANDLE ServiceHandle;
-    PPH_STRING ServiceName; // Valid only when adding
+    PPH_STRING ServiceName; // Not valid for the service manager
     BOOLEAN IsServiceManager;
     PHP_SERVICE_NOTIFY_STATE State;
     SERVICE_NOTIFY Buffer;
 } PHP_SERVICE_NOTIFY_CONTEXT, *PPHP_SERVICE_NOTIFY_CONTEXT;
 
+typedef struct _PHP_SERVICE_STATUS_CHANGE
+{
+    PPH_STRING ServiceName;
+    SERVICE_STATUS_PROCESS ServiceStatus;
+} PHP_SERVICE_STATUS_CHANGE, *PPHP_SERVICE_STATUS_CHANGE;
+
+#define PH_SERVICE_FULL_UPDATE_INTERVAL (60 * 1000) // ms
+
 VOID NTAPI PhpServiceItemDeleteProcedure(
     _In_ PVOID Object,
     _In_ ULONG Flags
@@ -83,15 +92,24 @@ VOID PhpInitializeServiceNonPoll(
     VOID
     );
 
+typedef struct _PH_SERVICE_ITEM_SNAPSHOT
+{
+    ULONG Count;
+    PPH_SERVICE_ITEM Items[1];
+} PH_SERVICE_ITEM_SNAPSHOT, *PPH_SERVICE_ITEM_SNAPSHOT;
+
 PPH_OBJECT_TYPE PhServiceItemType;
 
 PPH_HASHTABLE PhServiceHashtable;
 PH_QUEUED_LOCK PhServiceHashtableLock = PH_QUEUED_LOCK_INIT;
+static PPH_SERVICE_ITEM_SNAPSHOT PhpServiceItemSnapshot = NULL;
+static PPH_HASHTABLE PhpPendingServiceHashtable; // process ID to PPH_LIST of pending service items
 
 PHAPPAPI PH_CALLBACK_DECLARE(PhServiceAddedEvent);
 PHAPPAPI PH_CALLBACK_DECLARE(PhServiceModifiedEvent);
 PHAPPAPI PH_CALLBACK_DECLARE(PhServiceRemovedEvent);
 PHAPPAPI PH_CALLBACK_DECLARE(PhServicesUpdatedEvent);
+static PH_PROVIDER_UPDATE_BATCH PhpServiceUpdateBatch = PH_PROVIDER_UPDATE_BATCH_INIT(GeneralCallbackServiceProviderUpdated);
 
 BOOLEAN PhEnableServiceNonPoll = FALSE;
 static BOOLEAN PhpNonPollInitialized = FALSE;
@@ -100,7 +118,9 @@ static HANDLE PhpNonPollThreadHandle;
 static ULONG PhpNonPollGate;
 static _NotifyServiceStatusChangeW NotifyServiceStatusChangeW_I;
 static HANDLE PhpNonPollEventHandle;
-static PH_QUEUED_LOCK PhpNonPollServiceListLock = PH_QUEUED_LOCK_INIT;
+static ULONG PhpNonPollNeedsFullUpdate;
+static PH_QUEUED_LOCK PhpNonPollStatusChangeListLock = PH_QUEUED_LOCK_INIT;
+static PPH_LIST PhpNonPollStatusChangeList; // status changes queued by the non-poll thread
 static LIST_ENTRY PhpNonPollServiceListHead;
 static LIST_ENTRY PhpNonPollServicePendingListHead;
 
@@ -115,6 +135,8 @@ BOOLEAN PhServiceProviderInitialization(
         PhpServiceHashtableHashFunction,
         40
         );
+    PhRegisterLockStatistics(&PhServiceHashtableLock, L"PhServiceHashtableLock");
+    PhpPendingServiceHashtable = PhCreateSimpleHashtable(16);
 
     return TRUE;
 }
@@ -232,6 +254,81 @@ VOID PhMarkNeedsConfigUpdateServiceItem(
     )
 {
     ServiceItem->NeedsConfigUpdate = TRUE;
+    // Make sure the change is picked up even if there are no notifications.
+    PhpNonPollGate = 1;
+}
+
+/**
+ * Enumerates the service items.
+ *
+ * \param ServiceItems A variable which receives an array of pointers to service items. You
+ * must free the buffer with PhFree() when you no longer need it.
+ * \param NumberOfServiceItems A variable which receives the number of service items returned
+ * in \a ServiceItems.
+ *
+ * \remarks The service items are referenced; dereference them with PhDereferenceObject() when
+ * you no longer need them. The items are those present at the end of the last update.
+ */
+VOID PhEnumServiceItems(
+    _Out_opt_ PPH_SERVICE_ITEM **ServiceItems,
+    _Out_ PULONG NumberOfServiceItems
+    )
+{
+    PPH_SERVICE_ITEM *serviceItems;
+    PH_EPOCH_GUARD guard;
+    PPH_SERVICE_ITEM_SNAPSHOT snapshot;
+    ULONG count;
+    ULONG i;
+
+    PhEnterEpoch(&guard);
+
+    snapshot = *(PPH_SERVICE_ITEM_SNAPSHOT volatile *)&PhpServiceItemSnapshot;
+    count = snapshot ? snapshot->Count : 0;
+
+    if (!ServiceItems)
+    {
+        PhLeaveEpoch(&guard);
+        *NumberOfServiceItems = count;
+        return;
+    }
+
+    serviceItems = PhAllocate(sizeof(PPH_SERVICE_ITEM) * count);
+
+    for (i = 0; i < count; i++)
+    {
+        PhReferenceObject(snapshot->Items[i]);
+        serviceItems[i] = snapshot->Items[i];
+    }
+
+    PhLeaveEpoch(&guard);
+
+    *ServiceItems = serviceItems;
+    *NumberOfServiceItems = count;
+}
+
+static VOID PhpPublishServiceItemSnapshot(
+    VOID
+    )
+{
+    PPH_SERVICE_ITEM_SNAPSHOT snapshot;
+    PPH_SERVICE_ITEM_SNAPSHOT oldSnapshot;
+    PH_HASHTABLE_ENUM_CONTEXT enumContext;
+    PPH_SERVICE_ITEM *serviceItem;
+    ULONG count = 0;
+
+    // Only the provider thread modifies the hashtable, so we don't need the lock to read it.
+    snapshot = PhAllocate(FIELD_OFFSET(PH_SERVICE_ITEM_SNAPSHOT, Items) + sizeof(PPH_SERVICE_ITEM) * PhServiceHashtable->Count);
+    PhBeginEnumHashtable(PhServiceHashtable, &enumContext);
+
+    while (serviceItem = PhNextEnumHashtable(&enumContext))
+        snapshot->Items[count++] = *serviceItem;
+
+    snapshot->Count = count;
+
+    oldSnapshot = _InterlockedExchangePointer(&PhpServiceItemSnapshot, snapshot);
+
+    if (oldSnapshot)
+        PhFreeAfterEpoch(oldSnapshot);
 }
 
 VOID PhpRemoveServiceItem(
@@ -239,7 +336,8 @@ VOID PhpRemoveServiceItem(
     )
 {
     PhRemoveEntryHashtable(PhServiceHashtable, &ServiceItem);
-    PhDereferenceObject(ServiceItem);
+    // The item may still be in the published snapshot.
+    PhDereferenceObjectAfterEpoch(ServiceItem);
 }
 
 PH_SERVICE_CHANGE PhGetServiceChange(
@@ -293,28 +391,88 @@ PH_SERVICE_CHANGE PhGetServiceChange(
     return -1;
 }
 
+/**
+ * Marks a service item as waiting for its process item to be created.
+ *
+ * \param ServiceItem The service item. The item is added to the pending index under its current
+ * process ID.
+ */
+static VOID PhpAddPendingService(
+    _In_ PPH_SERVICE_ITEM ServiceItem
+    )
+{
+    PPH_LIST pendingServices;
+
+    if (ServiceItem->PendingProcess)
+        return;
+
+    if (!(pendingServices = PhFindItemSimpleHashtable2(PhpPendingServiceHashtable, ServiceItem->ProcessId)))
+    {
+        pendingServices = PhCreateList(2);
+        PhAddItemSimpleHashtable(PhpPendingServiceHashtable, ServiceItem->ProcessId, pendingServices);
+    }
+
+    PhAddItemList(pendingServices, ServiceItem);
+    ServiceItem->PendingProcess = TRUE;
+}
+
+/**
+ * Removes a service item from the pending index.
+ *
+ * \param ServiceItem The service item.
+ * \param ProcessId The process ID that the item was added under.
+ */
+static VOID PhpRemovePendingService(
+    _In_ PPH_SERVICE_ITEM ServiceItem,
+    _In_ HANDLE ProcessId
+    )
+{
+    PPH_LIST pendingServices;
+    ULONG index;
+
+    if (!ServiceItem->PendingProcess)
+        return;
+
+    if (pendingServices = PhFindItemSimpleHashtable2(PhpPendingServiceHashtable, ProcessId))
+    {
+        if ((index = PhFindItemList(pendingServices, ServiceItem)) != -1)
+            PhRemoveItemList(pendingServices, index);
+
+        if (pendingServices->Count == 0)
+        {
+            PhRemoveItemSimpleHashtable(PhpPendingServiceHashtable, ProcessId);
+            PhDereferenceObject(pendingServices);
+        }
+    }
+
+    ServiceItem->PendingProcess = FALSE;
+}
+
 VOID PhUpdateProcessItemServices(
     _In_ PPH_PROCESS_ITEM ProcessItem
     )
 {
-    PH_HASHTABLE_ENUM_CONTEXT enumContext;
-    PPH_SERVICE_ITEM *serviceItem;
+    PPH_LIST pendingServices;
+    ULONG i;
 
     // We don't need to lock as long as the service provider
     // never runs concurrently with the process provider. This
     // is currently true.
 
-    PhBeginEnumHashtable(PhServiceHashtable, &enumContext);
-
-    while (serviceItem = PhNextEnumHashtable(&enumContext))
+    if (pendingServices = PhFindItemSimpleHashtable2(PhpPendingServiceHashtable, ProcessItem->ProcessId))
     {
-        if (
-            (*serviceItem)->PendingProcess &&
-            (*serviceItem)->ProcessId == ProcessItem->ProcessId
-            )
+        PhRemoveItemSimpleHashtable(PhpPendingServiceHashtable, ProcessItem->ProcessId);
+
+        for (i = 0; i < pendingServices->Count; i++)
         {
-            PhpAddProcessItemService(ProcessItem, *serviceItem);
+            PPH_SERVICE_ITEM serviceItem = pendingServices->Items[i];
+
+            // The list is no longer in the index, so just clear the flag.
+            serviceItem->PendingProcess = FALSE;
+            PhpAddProcessItemService(ProcessItem, serviceItem);
         }
+
+        PhDereferenceObject(pendingServices);
     }
 }
 
@@ -336,7 +494,7 @@ VOID PhpAddProcessItemService(
 
     PhReleaseQueuedLockExclusive(&ProcessItem->ServiceListLock);
 
-    ServiceItem->PendingProcess = FALSE;
+    PhpRemovePendingService(ServiceItem, ProcessItem->ProcessId);
     ProcessItem->JustProcessed = 1;
 }
 
@@ -433,6 +591,205 @@ static ULONG PhpHashServiceNameEntry(
     return PhHashStringRef(&Value->Name, TRUE);
 }
 
+static VOID PhpUpdateServiceItem(
+    _In_ SC_HANDLE ScManagerHandle,
+    _In_ PPH_SERVICE_ITEM ServiceItem,
+    _In_ LPSERVICE_STATUS_PROCESS ServiceStatus
+    )
+{
+    if (
+        ServiceItem->Type != ServiceStatus->dwServiceType ||
+        ServiceItem->State != ServiceStatus->dwCurrentState ||
+        ServiceItem->ControlsAccepted != ServiceStatus->dwControlsAccepted ||
+        ServiceItem->ProcessId != UlongToHandle(ServiceStatus->dwProcessId) ||
+        ServiceItem->NeedsConfigUpdate
+        )
+    {
+        PH_SERVICE_MODIFIED_DATA serviceModifiedData;
+        PH_SERVICE_CHANGE serviceChange;
+
+        // The service has been "modified".
+
+        serviceModifiedData.Service = ServiceItem;
+        memset(&serviceModifiedData.OldService, 0, sizeof(PH_SERVICE_ITEM));
+        serviceModifiedData.OldService.Type = ServiceItem->Type;
+        serviceModifiedData.OldService.State = ServiceItem->State;
+        serviceModifiedData.OldService.ControlsAccepted = ServiceItem->ControlsAccepted;
+        serviceModifiedData.OldService.ProcessId = ServiceItem->ProcessId;
+
+        // The pending index is keyed by the process ID.
+        if (ServiceItem->ProcessId != UlongToHandle(ServiceStatus->dwProcessId))
+            PhpRemovePendingService(ServiceItem, ServiceItem->ProcessId);
+
+        // Update the service item.
+        ServiceItem->Type = ServiceStatus->dwServiceType;
+        ServiceItem->State = ServiceStatus->dwCurrentState;
+        ServiceItem->ControlsAccepted = ServiceStatus->dwControlsAccepted;
+        ServiceItem->ProcessId = UlongToHandle(ServiceStatus->dwProcessId);
+
+        if (ServiceItem->ProcessId)
+            PhPrintUInt32(ServiceItem->ProcessIdString, HandleToUlong(ServiceItem->ProcessId));
+        else
+            ServiceItem->ProcessIdString[0] = 0;
+
+        // Add/remove the service from its process.
+
+        serviceChange = PhGetServiceChange(&serviceModifiedData);
+
+        if (
+            (serviceChange == ServiceStarted && ServiceItem->ProcessId) ||
+            (serviceChange == ServiceStopped && serviceModifiedData.OldService.ProcessId)
+            )
+        {
+            PPH_PROCESS_ITEM processItem;
+
+            if (serviceChange == ServiceStarted)
+                processItem = PhReferenceProcessItem(ServiceItem->ProcessId);
+            else
+                processItem = PhReferenceProcessItem(serviceModifiedData.OldService.ProcessId);
+
+            if (processItem)
+            {
+                if (serviceChange == ServiceStarted)
+                    PhpAddProcessItemService(processItem, ServiceItem);
+                else
+                    PhpRemoveProcessItemService(processItem, ServiceItem);
+
+                PhDereferenceObject(processItem);
+            }
+            else
+            {
+                if (serviceChange == ServiceStarted)
+                    PhpAddPendingService(ServiceItem);
+                else
+                    PhpRemovePendingService(ServiceItem, ServiceItem->ProcessId);
+            }
+        }
+        else if (
+            ServiceItem->State == SERVICE_RUNNING &&
+            ServiceItem->ProcessId != serviceModifiedData.OldService.ProcessId &&
+            ServiceItem->ProcessId
+            )
+        {
+            PPH_PROCESS_ITEM processItem;
+
+            // The service stopped and started, and the only change we have detected
+            // is in the process ID.
+
+            if (processItem = PhReferenceProcessItem(serviceModifiedData.OldService.ProcessId))
+            {
+                PhpRemoveProcessItemService(processItem, ServiceItem);
+                PhDereferenceObject(processItem);
+            }
+
+            if (processItem = PhReferenceProcessItem(ServiceItem->ProcessId))
+            {
+                PhpAddProcessItemService(processItem, ServiceItem);
+                PhDereferenceObject(processItem);
+            }
+            else
+            {
+                PhpAddPendingService(ServiceItem);
+            }
+        }
+
+        // Do a config update if necessary.
+        if (ServiceItem->NeedsConfigUpdate)
+        {
+            PhpUpdateServiceItemConfig(ScManagerHandle, ServiceItem);
+            ServiceItem->NeedsConfigUpdate = FALSE;
+        }
+
+        // Raise the service modified event.
+        PhInvokeCallback(&PhServiceModifiedEvent, &serviceModifiedData);
+        PhAddProviderUpdateBatchItem(&PhpServiceUpdateBatch, PH_PROVIDER_UPDATE_MODIFIED, ServiceItem);
+    }
+}
+
+static PPH_LIST PhpTakeServiceStatusChanges(
+    VOID
+    )
+{
+    PPH_LIST statusChanges;
+
+    PhAcquireQueuedLockExclusive(&PhpNonPollStatusChangeListLock);
+    statusChanges = PhpNonPollStatusChangeList;
+    PhpNonPollStatusChangeList = NULL;
+    PhReleaseQueuedLockExclusive(&PhpNonPollStatusChangeListLock);
+
+    return statusChanges;
+}
+
+static VOID PhpFreeServiceStatusChange(
+    _In_ PPHP_SERVICE_STATUS_CHANGE StatusChange
+    )
+{
+    PhDereferenceObject(StatusChange->ServiceName);
+    PhFree(StatusChange);
+}
+
+static VOID PhpClearServiceStatusChanges(
+    VOID
+    )
+{
+    PPH_LIST statusChanges;
+    ULONG i;
+
+    if (statusChanges = PhpTakeServiceStatusChanges())
+    {
+        for (i = 0; i < statusChanges->Count; i++)
+            PhpFreeServiceStatusChange(statusChanges->Items[i]);
+
+        PhDereferenceObject(statusChanges);
+    }
+}
+
+static VOID PhpProcessServiceStatusChanges(
+    _In_ SC_HANDLE ScManagerHandle
+    )
+{
+    PPH_LIST statusChanges;
+    PH_HASHTABLE_ENUM_CONTEXT enumContext;
+    PPH_SERVICE_ITEM *serviceItem;
+    ULONG i;
+
+    if (statusChanges = PhpTakeServiceStatusChanges())
+    {
+        // The changes are in the order that they were received.
+        for (i = 0; i < statusChanges->Count; i++)
+        {
+            PPHP_SERVICE_STATUS_CHANGE statusChange = statusChanges->Items[i];
+            PPH_SERVICE_ITEM changedServiceItem;
+
+            if (changedServiceItem = PhpLookupServiceItem(&statusChange->ServiceName->sr))
+                PhpUpdateServiceItem(ScManagerHandle, changedServiceItem, &statusChange->ServiceStatus);
+
+            PhpFreeServiceStatusChange(statusChange);
+        }
+
+        PhDereferenceObject(statusChanges);
+    }
+
+    // Configuration changes don't generate notifications, so pick up the items that have been
+    // marked by PhMarkNeedsConfigUpdateServiceItem.
+
+    PhBeginEnumHashtable(PhServiceHashtable, &enumContext);
+
+    while (serviceItem = PhNextEnumHashtable(&enumContext))
+    {
+        if ((*serviceItem)->NeedsConfigUpdate)
+        {
+            SERVICE_STATUS_PROCESS serviceStatus;
+
+            serviceStatus.dwServiceType = (*serviceItem)->Type;
+            serviceStatus.dwCurrentState = (*serviceItem)->State;
+            serviceStatus.dwControlsAccepted = (*serviceItem)->ControlsAccepted;
+            serviceStatus.dwProcessId = HandleToUlong((*serviceItem)->ProcessId);
+            PhpUpdateServiceItem(ScManagerHandle, *serviceItem, &serviceStatus);
+        }
+    }
+}
+
 VOID PhServiceProviderUpdate(
     _In_ PVOID Object
     )
@@ -445,10 +802,14 @@ VOID PhServiceProviderUpdate(
     static ULONG nameEntriesCount;
     static ULONG nameEntriesAllocated = 0;
 
+    static ULONG64 lastFullUpdateTime = 0;
+
     LPENUM_SERVICE_STATUS_PROCESS services;
     ULONG numberOfServices;
     ULONG i;
     PPH_HASH_ENTRY hashEntry;
+    BOOLEAN itemsChanged = FALSE;
+    BOOLEAN fullUpdate = TRUE;
 
     // We always execute the first run, and we only initialize non-polling after the first run.
     if (PhEnableServiceNonPoll && runCount != 0)
@@ -463,13 +824,19 @@ VOID PhServiceProviderUpdate(
             PhpNonPollInitialized = TRUE;
         }
 
-        if (PhpNonPollActive)
+        // Status changes are applied from the notifications. We only enumerate all services when
+        // services are created or deleted, when notifications may have been lost, and every
+        // PH_SERVICE_FULL_UPDATE_INTERVAL as a fallback.
+        if (PhpNonPollActive && NtGetTickCount64() - lastFullUpdateTime < PH_SERVICE_FULL_UPDATE_INTERVAL)
         {
             if (InterlockedExchange(&PhpNonPollGate, 0) == 0)
             {
                 // Non-poll gate is closed; skip all processing.
                 goto UpdateEnd;
             }
+
+            if (InterlockedExchange(&PhpNonPollNeedsFullUpdate, 0) == 0)
+                fullUpdate = FALSE;
         }
     }
 
@@ -481,11 +848,27 @@ VOID PhServiceProviderUpdate(
             return;
     }
 
+    if (!fullUpdate)
+    {
+        PhpProcessServiceStatusChanges(scManagerHandle);
+        goto UpdateEnd;
+    }
+
+    if (PhpNonPollActive)
+    {
+        // The enumeration supersedes any status changes that have been queued so far.
+        InterlockedExchange(&PhpNonPollGate, 0);
+        InterlockedExchange(&PhpNonPollNeedsFullUpdate, 0);
+        PhpClearServiceStatusChanges();
+    }
+
     services = PhEnumServices(scManagerHandle, 0, 0, &numberOfServices);
 
     if (!services)
         return;
 
+    lastFullUpdateTime = NtGetTickCount64();
+
     // Build a hash set containing the service names.
 
     // This has caused a massive decrease in background CPU usage, and
@@ -556,6 +939,8 @@ VOID PhServiceProviderUpdate(
 
             if (!found)
             {
+                PhpRemovePendingService(*serviceItem, (*serviceItem)->ProcessId);
+
                 // Remove the service from its process.
                 if ((*serviceItem)->ProcessId)
                 {
@@ -572,6 +957,7 @@ VOID PhServiceProviderUpdate(
 
                 // Raise the service removed event.
                 PhInvokeCallback(&PhServiceRemovedEvent, *serviceItem);
+                PhAddProviderUpdateBatchItem(&PhpServiceUpdateBatch, PH_PROVIDER_UPDATE_REMOVED, *serviceItem);
 
                 if (!servicesToRemove)
                     servicesToRemove = PhCreateList(2);
@@ -591,6 +977,7 @@ VOID PhServiceProviderUpdate(
 
             PhReleaseQueuedLockExclusive(&PhServiceHashtableLock);
             PhDereferenceObject(servicesToRemove);
+            itemsChanged = TRUE;
         }
     }
 
@@ -636,7 +1023,7 @@ VOID PhServiceProviderUpdate(
                         // The process doesn't exist yet (to us). Set the pending
                         // flag and when the process is added this will be
                         // fixed.
-                        serviceItem->PendingProcess = TRUE;
+                        PhpAddPendingService(serviceItem);
                     }
                 }
 
@@ -644,114 +1031,15 @@ VOID PhServiceProviderUpdate(
                 PhAcquireQueuedLockExclusive(&PhServiceHashtableLock);
                 PhAddEntryHashtable(PhServiceHashtable, &serviceItem);
                 PhReleaseQueuedLockExclusive(&PhServiceHashtableLock);
+                itemsChanged = TRUE;
 
                 // Raise the service added event.
                 PhInvokeCallback(&PhServiceAddedEvent, serviceItem);
+                PhAddProviderUpdateBatchItem(&PhpServiceUpdateBatch, PH_PROVIDER_UPDATE_ADDED, serviceItem);
             }
             else
             {
-                if (
-                    serviceItem->Type != serviceEntry->ServiceStatusProcess.dwServiceType ||
-                    serviceItem->State != serviceEntry->ServiceStatusProcess.dwCurrentState ||
-                    serviceItem->ControlsAccepted != serviceEntry->ServiceStatusProcess.dwControlsAccepted ||
-                    serviceItem->ProcessId != UlongToHandle(serviceEntry->ServiceStatusProcess.dwProcessId) ||
-                    serviceItem->NeedsConfigUpdate
-                    )
-                {
-                    PH_SERVICE_MODIFIED_DATA serviceModifiedData;
-                    PH_SERVICE_CHANGE serviceChange;
-
-                    // The service has been "modified".
-
-                    serviceModifiedData.Service = serviceItem;
-                    memset(&serviceModifiedData.OldService, 0, sizeof(PH_SERVICE_ITEM));
-                    serviceModifiedData.OldService.Type = serviceItem->Type;
-                    serviceModifiedData.OldService.State = serviceItem->State;
-                    serviceModifiedData.OldService.ControlsAccepted = serviceItem->ControlsAccepted;
-                    serviceModifiedData.OldService.ProcessId = serviceItem->ProcessId;
-
-                    // Update the service item.
-                    serviceItem->Type = serviceEntry->ServiceStatusProcess.dwServiceType;
-                    serviceItem->State = serviceEntry->ServiceStatusProcess.dwCurrentState;
-                    serviceItem->ControlsAccepted = serviceEntry->ServiceStatusProcess.dwControlsAccepted;
-                    serviceItem->ProcessId = UlongToHandle(serviceEntry->ServiceStatusProcess.dwProcessId);
-
-                    if (serviceItem->ProcessId)
-                        PhPrintUInt32(serviceItem->ProcessIdString, HandleToUlong(serviceItem->ProcessId));
-                    else
-                        serviceItem->ProcessIdString[0] = 0;
-
-                    // Add/remove the service from its process.
-
-                    serviceChange = PhGetServiceChange(&serviceModifiedData);
-
-                    if (
-                        (serviceChange == ServiceStarted && serviceItem->ProcessId) ||
-                        (serviceChange == ServiceStopped && serviceModifiedData.OldService.ProcessId)
-                        )
-                    {
-                        PPH_PROCESS_ITEM processItem;
-
-                        if (serviceChange == ServiceStarted)
-                            processItem = PhReferenceProcessItem(serviceItem->ProcessId);
-                        else
-                            processItem = PhReferenceProcessItem(serviceModifiedData.OldService.ProcessId);
-
-                        if (processItem)
-                        {
-                            if (serviceChange == ServiceStarted)
-                                PhpAddProcessItemService(processItem, serviceItem);
-                            else
-                                PhpRemoveProcessItemService(processItem, serviceItem);
-
-                            PhDereferenceObject(processItem);
-                        }
-                        else
-                        {
-                            if (serviceChange == ServiceStarted)
-                                serviceItem->PendingProcess = TRUE;
-                            else
-                                serviceItem->PendingProcess = FALSE;
-                        }
-                    }
-                    else if (
-                        serviceItem->State == SERVICE_RUNNING &&
-                        serviceItem->ProcessId != serviceModifiedData.OldService.ProcessId &&
-                        serviceItem->ProcessId
-                        )
-                    {
-                        PPH_PROCESS_ITEM processItem;
-
-                        // The service stopped and started, and the only change we have detected
-                        // is in the process ID.
-
-                        if (processItem = PhReferenceProcessItem(serviceModifiedData.OldService.ProcessId))
-                        {
-                            PhpRemoveProcessItemService(processItem, serviceItem);
-                            PhDereferenceObject(processItem);
-                        }
-
-                        if (processItem = PhReferenceProcessItem(serviceItem->ProcessId))
-                        {
-                            PhpAddProcessItemService(processItem, serviceItem);
-                            PhDereferenceObject(processItem);
-                        }
-                        else
-                        {
-                            serviceItem->PendingProcess = TRUE;
-                        }
-                    }
-
-                    // Do a config update if necessary.
-                    if (serviceItem->NeedsConfigUpdate)
-                    {
-                        PhpUpdateServiceItemConfig(scManagerHandle, serviceItem);
-                        serviceItem->NeedsConfigUpdate = FALSE;
-                    }
-
-                    // Raise the service modified event.
-                    PhInvokeCallback(&PhServiceModifiedEvent, &serviceModifiedData);
-                }
+                PhpUpdateServiceItem(scManagerHandle, serviceItem, &serviceEntry->ServiceStatusProcess);
             }
         }
     }
@@ -759,6 +1047,12 @@ VOID PhServiceProviderUpdate(
     PhFree(services);
 
 UpdateEnd:
+    if (itemsChanged || !PhpServiceItemSnapshot)
+        PhpPublishServiceItemSnapshot();
+
+    PhReclaimEpoch();
+
+    PhFlushProviderUpdateBatch(&PhpServiceUpdateBatch);
     PhInvokeCallback(&PhServicesUpdatedEvent, NULL);
     runCount++;
 }
@@ -805,6 +1099,28 @@ VOID CALLBACK PhpServiceNonPollScNotifyCallback(
             LocalFree(notifyBuffer->pszServiceNames);
         }
 
+        if (notifyContext->IsServiceManager)
+        {
+            // Services have been created or deleted.
+            PhpNonPollNeedsFullUpdate = 1;
+        }
+        else
+        {
+            PPHP_SERVICE_STATUS_CHANGE statusChange;
+
+            statusChange = PhAllocate(sizeof(PHP_SERVICE_STATUS_CHANGE));
+            PhSetReference(&statusChange->ServiceName, notifyContext->ServiceName);
+            statusChange->ServiceStatus = notifyBuffer->ServiceStatus;
+
+            PhAcquireQueuedLockExclusive(&PhpNonPollStatusChangeListLock);
+
+            if (!PhpNonPollStatusChangeList)
+                PhpNonPollStatusChangeList = PhCreateList(16);
+
+            PhAddItemList(PhpNonPollStatusChangeList, statusChange);
+            PhReleaseQueuedLockExclusive(&PhpNonPollStatusChangeListLock);
+        }
+
         notifyContext->State = SnNotify;
         RemoveEntryList(&notifyContext->ListEntry);
         InsertTailList(&PhpNonPollServicePendingListHead, &notifyContext->ListEntry);
@@ -817,12 +1133,16 @@ VOID CALLBACK PhpServiceNonPollScNotifyCallback(
             RemoveEntryList(&notifyContext->ListEntry);
             InsertTailList(&PhpNonPollServicePendingListHead, &notifyContext->ListEntry);
         }
+
+        PhpNonPollNeedsFullUpdate = 1;
     }
     else
     {
         notifyContext->State = SnNotify;
         RemoveEntryList(&notifyContext->ListEntry);
         InsertTailList(&PhpNonPollServicePendingListHead, &notifyContext->ListEntry);
+        // We don't know what the notification was for.
+        PhpNonPollNeedsFullUpdate = 1;
     }
 
     PhpNonPollGate = 1;
@@ -882,6 +1202,7 @@ NTSTATUS PhpServiceNonPollThreadStart(
                 notifyContext = PhAllocate(sizeof(PHP_SERVICE_NOTIFY_CONTEXT));
                 memset(notifyContext, 0, sizeof(PHP_SERVICE_NOTIFY_CONTEXT));
                 notifyContext->ServiceHandle = serviceHandle;
+                notifyContext->ServiceName = PhCreateString(services[i].lpServiceName);
                 notifyContext->State = SnNotify;
                 InsertTailList(&PhpNonPollServicePendingListHead, &notifyContext->ListEntry);
             }
@@ -922,7 +1243,6 @@ NTSTATUS PhpServiceNonPollThreadStart(
                         continue;
                     }
 
-                    PhClearReference(&notifyContext->ServiceName);
                     notifyContext->State = SnNotify;
                     goto NotifyCase;
                 case SnRemoving:
@@ -974,6 +1294,10 @@ NotifyCase:
                 break;
         }
 
+        // Notifications may have been lost while we re-open the handles.
+        PhpNonPollNeedsFullUpdate = 1;
+        PhpNonPollGate = 1;
+
         // Execute all pending callbacks.
         NtTestAlert();
 
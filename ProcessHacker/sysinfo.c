@@ -91,6 +91,7 @@ static HTHEME ThemeData;
 static BOOLEAN ThemeHasItemBackground;
 
 static PPH_SYSINFO_SECTION CpuSection;
+static PH_GRAPH_ENVELOPE CpuSectionEnvelope;
 static HWND CpuDialog;
 static PH_LAYOUT_MANAGER CpuLayoutManager;
 static RECT CpuGraphMargin;
@@ -99,6 +100,11 @@ static PH_GRAPH_STATE CpuGraphState;
 static HWND *CpusGraphHandle;
 static PPH_GRAPH_STATE CpusGraphState;
 static BOOLEAN OneGraphPerCpu;
+static HWND CpuHeatmapHandle;
+static PH_GRAPH_STATE CpuHeatmapState;
+static PULONG CpuHeatmapRows;
+static ULONG CpuHeatmapNumberOfRows;
+static ULONG CpuHeatmapTooltipCpu;
 static HWND CpuPanel;
 static ULONG CpuTicked;
 static ULONG NumberOfProcessors;
@@ -175,7 +181,7 @@ NTSTATUS PhSipSysInfoThreadStart(
     HACCEL acceleratorTable;
     BOOLEAN processed;
 
-    PhInitializeAutoPool(&autoPool);
+    PhInitializeAutoPoolEx(&autoPool, PH_AUTO_POOL_USE_ARENA);
 
     PhSipWindow = CreateDialog(
         PhInstanceHandle,
@@ -1957,6 +1963,11 @@ BOOLEAN PhSipCpuSectionCallback(
 {
     switch (Message)
     {
+    case SysInfoCreate:
+        {
+            PhInitializeGraphEnvelope(&CpuSectionEnvelope);
+        }
+        return TRUE;
     case SysInfoDestroy:
         {
             if (CpuDialog)
@@ -1964,6 +1975,8 @@ BOOLEAN PhSipCpuSectionCallback(
                 PhSipUninitializeCpuDialog();
                 CpuDialog = NULL;
             }
+
+            PhDeleteGraphEnvelope(&CpuSectionEnvelope);
         }
         return TRUE;
     case SysInfoTick:
@@ -1989,30 +2002,38 @@ BOOLEAN PhSipCpuSectionCallback(
 
             drawInfo->Flags = PH_GRAPH_USE_GRID | PH_GRAPH_USE_LINE_2;
             Section->Parameters->ColorSetupFunction(drawInfo, PhCsColorCpuKernel, PhCsColorCpuUser);
-            PhGetDrawInfoGraphBuffers(&Section->GraphState.Buffers, drawInfo, PhCpuKernelHistory.Count);
 
+            // The whole history is shown, with the spikes of each group of samples kept.
             if (!Section->GraphState.Valid)
             {
-                PhCopyCircularBuffer_FLOAT(&PhCpuKernelHistory, Section->GraphState.Data1, drawInfo->LineDataCount);
-                PhCopyCircularBuffer_FLOAT(&PhCpuUserHistory, Section->GraphState.Data2, drawInfo->LineDataCount);
+                PhUpdateGraphEnvelope(
+                    &CpuSectionEnvelope,
+                    &PhCpuKernelHistory,
+                    &PhCpuUserHistory,
+                    PH_GRAPH_DATA_COUNT(drawInfo->Width, drawInfo->Step)
+                    );
                 Section->GraphState.Valid = TRUE;
             }
+
+            PhGetDrawInfoGraphEnvelope(&CpuSectionEnvelope, drawInfo);
         }
         return TRUE;
     case SysInfoGraphGetTooltipText:
         {
             PPH_SYSINFO_GRAPH_GET_TOOLTIP_TEXT getTooltipText = Parameter1;
+            ULONG index;
             FLOAT cpuKernel;
             FLOAT cpuUser;
 
-            cpuKernel = PhGetItemCircularBuffer_FLOAT(&PhCpuKernelHistory, getTooltipText->Index);
-            cpuUser = PhGetItemCircularBuffer_FLOAT(&PhCpuUserHistory, getTooltipText->Index);
+            index = PhGetSampleIndexGraphEnvelope(&CpuSectionEnvelope, getTooltipText->Index);
+            cpuKernel = PhGetItemCircularBuffer_FLOAT(&PhCpuKernelHistory, index);
+            cpuUser = PhGetItemCircularBuffer_FLOAT(&PhCpuUserHistory, index);
 
             PhMoveReference(&Section->GraphState.TooltipText, PhFormatString(
                 L"%.2f%%%s\n%s",
                 (cpuKernel + cpuUser) * 100,
-                PhGetStringOrEmpty(PhSipGetMaxCpuString(getTooltipText->Index)),
-                ((PPH_STRING)PhAutoDereferenceObject(PhGetStatisticsTimeString(NULL, getTooltipText->Index)))->Buffer
+                PhGetStringOrEmpty(PhSipGetMaxCpuString(index)),
+                ((PPH_STRING)PhAutoDereferenceObject(PhGetStatisticsTimeString(NULL, index)))->Buffer
                 ));
             getTooltipText->Text = Section->GraphState.TooltipText->sr;
         }
@@ -2041,17 +2062,20 @@ VOID PhSipInitializeCpuDialog(
     PhInitializeDelta(&DpcsDelta);
     PhInitializeDelta(&SystemCallsDelta);
 
-    NumberOfProcessors = (ULONG)PhSystemBasicInformation.NumberOfProcessors;
+    NumberOfProcessors = PhNumberOfCpus;
     CpusGraphHandle = PhAllocate(sizeof(HWND) * NumberOfProcessors);
     CpusGraphState = PhAllocate(sizeof(PH_GRAPH_STATE) * NumberOfProcessors);
     InterruptInformation = PhAllocate(sizeof(SYSTEM_INTERRUPT_INFORMATION) * NumberOfProcessors);
     PowerInformation = PhAllocate(sizeof(PROCESSOR_POWER_INFORMATION) * NumberOfProcessors);
 
     PhInitializeGraphState(&CpuGraphState);
+    PhInitializeGraphState(&CpuHeatmapState);
 
     for (i = 0; i < NumberOfProcessors; i++)
         PhInitializeGraphState(&CpusGraphState[i]);
 
+    PhSipInitializeCpuHeatmap();
+
     CpuTicked = 0;
 
     if (!NT_SUCCESS(NtPowerInformation(
@@ -2079,10 +2103,12 @@ VOID PhSipUninitializeCpuDialog(
     ULONG i;
 
     PhDeleteGraphState(&CpuGraphState);
+    PhDeleteGraphState(&CpuHeatmapState);
 
     for (i = 0; i < NumberOfProcessors; i++)
         PhDeleteGraphState(&CpusGraphState[i]);
 
+    PhFree(CpuHeatmapRows);
     PhFree(CpusGraphHandle);
     PhFree(CpusGraphState);
     PhFree(InterruptInformation);
@@ -2105,11 +2131,10 @@ VOID PhSipTickCpuDialog(
 
     dpcCount = 0;
 
-    if (NT_SUCCESS(NtQuerySystemInformation(
+    if (NT_SUCCESS(PhQueryCpuInformation(
         SystemInterruptInformation,
         InterruptInformation,
-        sizeof(SYSTEM_INTERRUPT_INFORMATION) * NumberOfProcessors,
-        NULL
+        sizeof(SYSTEM_INTERRUPT_INFORMATION)
         )))
     {
         for (i = 0; i < NumberOfProcessors; i++)
@@ -2224,6 +2249,10 @@ INT_PTR CALLBACK PhSipCpuDialogProc(
             {
                 PhSipNotifyCpuGraph(-1, header);
             }
+            else if (CpuHeatmapHandle && header->hwndFrom == CpuHeatmapHandle)
+            {
+                PhSipNotifyCpuHeatmap(header);
+            }
             else
             {
                 for (i = 0; i < NumberOfProcessors; i++)
@@ -2297,6 +2326,31 @@ VOID PhSipCreateCpuGraphs(
         );
     Graph_SetTooltip(CpuGraphHandle, TRUE);
 
+    CpuHeatmapHandle = NULL;
+    memset(CpusGraphHandle, 0, sizeof(HWND) * NumberOfProcessors);
+
+    if (NumberOfProcessors > PH_SYSINFO_CPU_HEATMAP_THRESHOLD)
+    {
+        // Hundreds of tiny graphs are unreadable and slow to update, so we draw all CPUs in a
+        // single control instead.
+        CpuHeatmapHandle = CreateWindow(
+            PH_GRAPH_CLASSNAME,
+            NULL,
+            WS_CHILD | WS_BORDER | GC_STYLE_DRAW_PANEL,
+            0,
+            0,
+            3,
+            3,
+            CpuDialog,
+            NULL,
+            PhInstanceHandle,
+            NULL
+            );
+        Graph_SetTooltip(CpuHeatmapHandle, TRUE);
+
+        return;
+    }
+
     for (i = 0; i < NumberOfProcessors; i++)
     {
         CpusGraphHandle[i] = CreateWindow(
@@ -2324,13 +2378,13 @@ VOID PhSipLayoutCpuGraphs(
     HDWP deferHandle;
 
     GetClientRect(CpuDialog, &clientRect);
-    deferHandle = BeginDeferWindowPos(OneGraphPerCpu ? NumberOfProcessors : 1);
+    deferHandle = BeginDeferWindowPos(OneGraphPerCpu && !CpuHeatmapHandle ? NumberOfProcessors : 1);
 
-    if (!OneGraphPerCpu)
+    if (!OneGraphPerCpu || CpuHeatmapHandle)
     {
         deferHandle = DeferWindowPos(
             deferHandle,
-            CpuGraphHandle,
+            OneGraphPerCpu ? CpuHeatmapHandle : CpuGraphHandle,
             NULL,
             CpuGraphMargin.left,
             CpuGraphMargin.top,
@@ -2418,6 +2472,12 @@ VOID PhSipSetOneGraphPerCpu(
 
     ShowWindow(CpuGraphHandle, !OneGraphPerCpu ? SW_SHOW : SW_HIDE);
 
+    if (CpuHeatmapHandle)
+    {
+        ShowWindow(CpuHeatmapHandle, OneGraphPerCpu ? SW_SHOW : SW_HIDE);
+        return;
+    }
+
     for (i = 0; i < NumberOfProcessors; i++)
     {
         ShowWindow(CpusGraphHandle[i], OneGraphPerCpu ? SW_SHOW : SW_HIDE);
@@ -2449,8 +2509,7 @@ VOID PhSipNotifyCpuGraph(
 
                 if (!CpuGraphState.Valid)
                 {
-                    PhCopyCircularBuffer_FLOAT(&PhCpuKernelHistory, CpuGraphState.Data1, drawInfo->LineDataCount);
-                    PhCopyCircularBuffer_FLOAT(&PhCpuUserHistory, CpuGraphState.Data2, drawInfo->LineDataCount);
+                    PhGetSystemGraphSeries(SystemGraphCpuSeries, drawInfo->LineDataCount, CpuGraphState.Data1, CpuGraphState.Data2);
                     CpuGraphState.Valid = TRUE;
                 }
             }
@@ -2464,8 +2523,7 @@ VOID PhSipNotifyCpuGraph(
 
                 if (!CpusGraphState[Index].Valid)
                 {
-                    PhCopyCircularBuffer_FLOAT(&PhCpusKernelHistory[Index], CpusGraphState[Index].Data1, drawInfo->LineDataCount);
-                    PhCopyCircularBuffer_FLOAT(&PhCpusUserHistory[Index], CpusGraphState[Index].Data2, drawInfo->LineDataCount);
+                    PhCopyCpuHistory(Index, CpusGraphState[Index].Data1, CpusGraphState[Index].Data2, drawInfo->LineDataCount);
                     CpusGraphState[Index].Valid = TRUE;
                 }
             }
@@ -2504,8 +2562,8 @@ VOID PhSipNotifyCpuGraph(
                         FLOAT cpuKernel;
                         FLOAT cpuUser;
 
-                        cpuKernel = PhGetItemCircularBuffer_FLOAT(&PhCpusKernelHistory[Index], getTooltipText->Index);
-                        cpuUser = PhGetItemCircularBuffer_FLOAT(&PhCpusUserHistory[Index], getTooltipText->Index);
+                        cpuKernel = PhGetCpuKernelHistory(Index, getTooltipText->Index);
+                        cpuUser = PhGetCpuUserHistory(Index, getTooltipText->Index);
 
                         PhMoveReference(&CpusGraphState[Index].TooltipText, PhFormatString(
                             L"%.2f%% (K: %.2f%%, U: %.2f%%)%s\n%s",
@@ -2544,6 +2602,221 @@ VOID PhSipNotifyCpuGraph(
     }
 }
 
+VOID PhSipInitializeCpuHeatmap(
+    VOID
+    )
+{
+    ULONG node;
+    ULONG i;
+
+    // Order the rows by NUMA node and leave an empty row between nodes. Processors are
+    // already numbered group by group.
+
+    CpuHeatmapRows = PhAllocate(sizeof(ULONG) * (NumberOfProcessors + PhNumberOfNumaNodes));
+    CpuHeatmapNumberOfRows = 0;
+
+    for (node = 0; node < PhNumberOfNumaNodes; node++)
+    {
+        BOOLEAN found = FALSE;
+
+        for (i = 0; i < NumberOfProcessors; i++)
+        {
+            if (PhCpuNumaNodes[i] != node)
+                continue;
+
+            if (!found && CpuHeatmapNumberOfRows != 0)
+                CpuHeatmapRows[CpuHeatmapNumberOfRows++] = -1;
+
+            CpuHeatmapRows[CpuHeatmapNumberOfRows++] = i;
+            found = TRUE;
+        }
+    }
+}
+
+VOID PhSipNotifyCpuHeatmap(
+    _In_ NMHDR *Header
+    )
+{
+    switch (Header->code)
+    {
+    case GCN_GETDRAWINFO:
+        {
+            PPH_GRAPH_GETDRAWINFO getDrawInfo = (PPH_GRAPH_GETDRAWINFO)Header;
+            PPH_GRAPH_DRAW_INFO drawInfo = getDrawInfo->DrawInfo;
+
+            // The graph itself is covered by the heatmap in GCN_DRAWPANEL; it only provides
+            // the buffering and the tooltip index.
+            drawInfo->Flags = PH_GRAPH_USE_LINE_2;
+            drawInfo->Step = PH_SYSINFO_CPU_HEATMAP_CELL_WIDTH;
+            PhSiSetColorsGraphDrawInfo(drawInfo, PhCsColorCpuKernel, PhCsColorCpuUser);
+            PhGraphStateGetDrawInfo(
+                &CpuHeatmapState,
+                getDrawInfo,
+                PhCpuKernelHistory.Count
+                );
+
+            if (!CpuHeatmapState.Valid)
+            {
+                PhGetSystemGraphSeries(SystemGraphCpuSeries, drawInfo->LineDataCount, CpuHeatmapState.Data1, CpuHeatmapState.Data2);
+                CpuHeatmapState.Valid = TRUE;
+            }
+        }
+        break;
+    case GCN_DRAWPANEL:
+        {
+            PPH_GRAPH_DRAWPANEL drawPanel = (PPH_GRAPH_DRAWPANEL)Header;
+            PH_GRAPH_DRAW_INFO drawInfo;
+
+            Graph_GetDrawInfo(CpuHeatmapHandle, &drawInfo);
+            PhSipDrawCpuHeatmap(drawPanel->hdc, &drawPanel->Rect, drawInfo.LineDataCount, drawInfo.BackColor);
+        }
+        break;
+    case GCN_GETTOOLTIPTEXT:
+        {
+            PPH_GRAPH_GETTOOLTIPTEXT getTooltipText = (PPH_GRAPH_GETTOOLTIPTEXT)Header;
+            POINT point;
+            RECT clientRect;
+            ULONG row;
+            ULONG cpu;
+
+            if (getTooltipText->Index >= getTooltipText->TotalCount)
+                break;
+
+            GetCursorPos(&point);
+            ScreenToClient(CpuHeatmapHandle, &point);
+            GetClientRect(CpuHeatmapHandle, &clientRect);
+
+            if (point.y < 0 || point.y >= clientRect.bottom)
+                break;
+
+            row = point.y * CpuHeatmapNumberOfRows / clientRect.bottom;
+            cpu = CpuHeatmapRows[row];
+
+            if (cpu == -1)
+                break;
+
+            if (CpuHeatmapState.TooltipIndex != getTooltipText->Index || CpuHeatmapTooltipCpu != cpu)
+            {
+                FLOAT cpuKernel;
+                FLOAT cpuUser;
+
+                cpuKernel = PhGetCpuKernelHistory(cpu, getTooltipText->Index);
+                cpuUser = PhGetCpuUserHistory(cpu, getTooltipText->Index);
+
+                PhMoveReference(&CpuHeatmapState.TooltipText, PhFormatString(
+                    L"CPU %u: %.2f%% (K: %.2f%%, U: %.2f%%)%s\n%s",
+                    cpu,
+                    (cpuKernel + cpuUser) * 100,
+                    cpuKernel * 100,
+                    cpuUser * 100,
+                    PhGetStringOrEmpty(PhSipGetMaxCpuString(getTooltipText->Index)),
+                    ((PPH_STRING)PhAutoDereferenceObject(PhGetStatisticsTimeString(NULL, getTooltipText->Index)))->Buffer
+                    ));
+                CpuHeatmapState.TooltipIndex = getTooltipText->Index;
+                CpuHeatmapTooltipCpu = cpu;
+            }
+
+            getTooltipText->Text = CpuHeatmapState.TooltipText->sr;
+        }
+        break;
+    }
+}
+
+VOID PhSipDrawCpuHeatmap(
+    _In_ HDC hdc,
+    _In_ PRECT Rect,
+    _In_ ULONG NumberOfColumns,
+    _In_ COLORREF BackColor
+    )
+{
+    BITMAPINFO bitmapInfo;
+    PULONG bits;
+    ULONG backColor;
+    ULONG row;
+    ULONG column;
+    LONG width;
+
+    SetDCBrushColor(hdc, BackColor);
+    FillRect(hdc, Rect, GetStockObject(DC_BRUSH));
+
+    if (NumberOfColumns == 0 || CpuHeatmapNumberOfRows == 0)
+        return;
+
+    // Build a bitmap with one pixel per CPU per time slice (newest on the right) and stretch
+    // it over the control in a single blit.
+
+    bits = PhAllocate(sizeof(ULONG) * NumberOfColumns * CpuHeatmapNumberOfRows);
+    backColor = _byteswap_ulong(BackColor) >> 8;
+
+    for (row = 0; row < CpuHeatmapNumberOfRows; row++)
+    {
+        ULONG cpu = CpuHeatmapRows[row];
+        PULONG rowBits = &bits[row * NumberOfColumns];
+
+        if (cpu == -1)
+        {
+            PhFillMemoryUlong(rowBits, backColor, NumberOfColumns);
+            continue;
+        }
+
+        for (column = 0; column < NumberOfColumns; column++)
+        {
+            ULONG index = NumberOfColumns - column - 1;
+            FLOAT value;
+
+            value = PhGetCpuKernelHistory(cpu, index) + PhGetCpuUserHistory(cpu, index);
+
+            if (value < 0)
+                value = 0;
+            if (value > 1)
+                value = 1;
+
+            rowBits[column] = _byteswap_ulong(PhSipBlendColor(BackColor, PhCsColorCpuUser, value)) >> 8;
+        }
+    }
+
+    memset(&bitmapInfo, 0, sizeof(BITMAPINFO));
+    bitmapInfo.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    bitmapInfo.bmiHeader.biWidth = NumberOfColumns;
+    bitmapInfo.bmiHeader.biHeight = -(LONG)CpuHeatmapNumberOfRows; // top-down
+    bitmapInfo.bmiHeader.biPlanes = 1;
+    bitmapInfo.bmiHeader.biBitCount = 32;
+    bitmapInfo.bmiHeader.biCompression = BI_RGB;
+
+    width = NumberOfColumns * PH_SYSINFO_CPU_HEATMAP_CELL_WIDTH;
+    SetStretchBltMode(hdc, COLORONCOLOR);
+    StretchDIBits(
+        hdc,
+        Rect->right - width,
+        Rect->top,
+        width,
+        Rect->bottom - Rect->top,
+        0,
+        0,
+        NumberOfColumns,
+        CpuHeatmapNumberOfRows,
+        bits,
+        &bitmapInfo,
+        DIB_RGB_COLORS,
+        SRCCOPY
+        );
+
+    PhFree(bits);
+}
+
+COLORREF PhSipBlendColor(
+    _In_ COLORREF Color1,
+    _In_ COLORREF Color2,
+    _In_ FLOAT Fraction
+    )
+{
+    return RGB(
+        GetRValue(Color1) + (LONG)((GetRValue(Color2) - GetRValue(Color1)) * Fraction),
+        GetGValue(Color1) + (LONG)((GetGValue(Color2) - GetGValue(Color1)) * Fraction),
+        GetBValue(Color1) + (LONG)((GetBValue(Color2) - GetBValue(Color1)) * Fraction)
+        );
+}
+
 VOID PhSipUpdateCpuGraphs(
     VOID
     )
@@ -2557,6 +2830,16 @@ VOID PhSipUpdateCpuGraphs(
     Graph_UpdateTooltip(CpuGraphHandle);
     InvalidateRect(CpuGraphHandle, NULL, FALSE);
 
+    if (CpuHeatmapHandle)
+    {
+        CpuHeatmapState.Valid = FALSE;
+        CpuHeatmapState.TooltipIndex = -1;
+        Graph_Draw(CpuHeatmapHandle);
+        Graph_UpdateTooltip(CpuHeatmapHandle);
+        InvalidateRect(CpuHeatmapHandle, NULL, FALSE);
+        return;
+    }
+
     for (i = 0; i < NumberOfProcessors; i++)
     {
         CpusGraphState[i].Valid = FALSE;
@@ -2906,7 +3189,6 @@ BOOLEAN PhSipMemorySectionCallback(
     case SysInfoGraphGetDrawInfo:
         {
             PPH_GRAPH_DRAW_INFO drawInfo = Parameter1;
-            ULONG i;
 
             if (PhGetIntegerSetting(L"ShowCommitInSummary"))
             {
@@ -2916,21 +3198,7 @@ BOOLEAN PhSipMemorySectionCallback(
 
                 if (!Section->GraphState.Valid)
                 {
-                    for (i = 0; i < drawInfo->LineDataCount; i++)
-                    {
-                        Section->GraphState.Data1[i] = (FLOAT)PhGetItemCircularBuffer_ULONG(&PhCommitHistory, i);
-                    }
-
-                    if (PhPerfInformation.CommitLimit != 0)
-                    {
-                        // Scale the data.
-                        PhDivideSinglesBySingle(
-                            Section->GraphState.Data1,
-                            (FLOAT)PhPerfInformation.CommitLimit,
-                            drawInfo->LineDataCount
-                            );
-                    }
-
+                    PhGetSystemGraphSeries(SystemGraphCommitSeries, drawInfo->LineDataCount, Section->GraphState.Data1, NULL);
                     Section->GraphState.Valid = TRUE;
                 }
             }
@@ -2942,21 +3210,7 @@ BOOLEAN PhSipMemorySectionCallback(
 
                 if (!Section->GraphState.Valid)
                 {
-                    for (i = 0; i < drawInfo->LineDataCount; i++)
-                    {
-                        Section->GraphState.Data1[i] = (FLOAT)PhGetItemCircularBuffer_ULONG(&PhPhysicalHistory, i);
-                    }
-
-                    if (PhSystemBasicInformation.NumberOfPhysicalPages != 0)
-                    {
-                        // Scale the data.
-                        PhDivideSinglesBySingle(
-                            Section->GraphState.Data1,
-                            (FLOAT)PhSystemBasicInformation.NumberOfPhysicalPages,
-                            drawInfo->LineDataCount
-                            );
-                    }
-
+                    PhGetSystemGraphSeries(SystemGraphPhysicalSeries, drawInfo->LineDataCount, Section->GraphState.Data1, NULL);
                     Section->GraphState.Valid = TRUE;
                 }
             }
@@ -3309,7 +3563,6 @@ VOID PhSipNotifyCommitGraph(
         {
             PPH_GRAPH_GETDRAWINFO getDrawInfo = (PPH_GRAPH_GETDRAWINFO)Header;
             PPH_GRAPH_DRAW_INFO drawInfo = getDrawInfo->DrawInfo;
-            ULONG i;
 
             drawInfo->Flags = PH_GRAPH_USE_GRID;
             PhSiSetColorsGraphDrawInfo(drawInfo, PhCsColorPrivate, 0);
@@ -3322,21 +3575,7 @@ VOID PhSipNotifyCommitGraph(
 
             if (!CommitGraphState.Valid)
             {
-                for (i = 0; i < drawInfo->LineDataCount; i++)
-                {
-                    CommitGraphState.Data1[i] = (FLOAT)PhGetItemCircularBuffer_ULONG(&PhCommitHistory, i);
-                }
-
-                if (PhPerfInformation.CommitLimit != 0)
-                {
-                    // Scale the data.
-                    PhDivideSinglesBySingle(
-                        CommitGraphState.Data1,
-                        (FLOAT)PhPerfInformation.CommitLimit,
-                        drawInfo->LineDataCount
-                        );
-                }
-
+                PhGetSystemGraphSeries(SystemGraphCommitSeries, drawInfo->LineDataCount, CommitGraphState.Data1, NULL);
                 CommitGraphState.Valid = TRUE;
             }
         }
@@ -3377,7 +3616,6 @@ VOID PhSipNotifyPhysicalGraph(
         {
             PPH_GRAPH_GETDRAWINFO getDrawInfo = (PPH_GRAPH_GETDRAWINFO)Header;
             PPH_GRAPH_DRAW_INFO drawInfo = getDrawInfo->DrawInfo;
-            ULONG i;
 
             drawInfo->Flags = PH_GRAPH_USE_GRID;
             PhSiSetColorsGraphDrawInfo(drawInfo, PhCsColorPhysical, 0);
@@ -3390,21 +3628,7 @@ VOID PhSipNotifyPhysicalGraph(
 
             if (!PhysicalGraphState.Valid)
             {
-                for (i = 0; i < drawInfo->LineDataCount; i++)
-                {
-                    PhysicalGraphState.Data1[i] = (FLOAT)PhGetItemCircularBuffer_ULONG(&PhPhysicalHistory, i);
-                }
-
-                if (PhSystemBasicInformation.NumberOfPhysicalPages != 0)
-                {
-                    // Scale the data.
-                    PhDivideSinglesBySingle(
-                        PhysicalGraphState.Data1,
-                        (FLOAT)PhSystemBasicInformation.NumberOfPhysicalPages,
-                        drawInfo->LineDataCount
-                        );
-                }
-
+                PhGetSystemGraphSeries(SystemGraphPhysicalSeries, drawInfo->LineDataCount, PhysicalGraphState.Data1, NULL);
                 PhysicalGraphState.Valid = TRUE;
             }
         }
@@ -3766,8 +3990,6 @@ BOOLEAN PhSipIoSectionCallback(
     case SysInfoGraphGetDrawInfo:
         {
             PPH_GRAPH_DRAW_INFO drawInfo = Parameter1;
-            ULONG i;
-            FLOAT max;
 
             drawInfo->Flags = PH_GRAPH_USE_GRID | PH_GRAPH_USE_LINE_2;
             Section->Parameters->ColorSetupFunction(drawInfo, PhCsColorIoReadOther, PhCsColorIoWrite);
@@ -3775,40 +3997,7 @@ BOOLEAN PhSipIoSectionCallback(
 
             if (!Section->GraphState.Valid)
             {
-                max = 0;
-
-                for (i = 0; i < drawInfo->LineDataCount; i++)
-                {
-                    FLOAT data1;
-                    FLOAT data2;
-
-                    Section->GraphState.Data1[i] = data1 =
-                        (FLOAT)PhGetItemCircularBuffer_ULONG64(&PhIoReadHistory, i) +
-                        (FLOAT)PhGetItemCircularBuffer_ULONG64(&PhIoOtherHistory, i);
-                    Section->GraphState.Data2[i] = data2 =
-                        (FLOAT)PhGetItemCircularBuffer_ULONG64(&PhIoWriteHistory, i);
-
-                    if (max < data1 + data2)
-                        max = data1 + data2;
-                }
-
-                // Minimum scaling of 1 MB.
-                if (max < 1024 * 1024)
-                    max = 1024 * 1024;
-
-                // Scale the data.
-
-                PhDivideSinglesBySingle(
-                    Section->GraphState.Data1,
-                    max,
-                    drawInfo->LineDataCount
-                    );
-                PhDivideSinglesBySingle(
-                    Section->GraphState.Data2,
-                    max,
-                    drawInfo->LineDataCount
-                    );
-
+                PhGetSystemGraphSeries(SystemGraphIoSeries, drawInfo->LineDataCount, Section->GraphState.Data1, Section->GraphState.Data2);
                 Section->GraphState.Valid = TRUE;
             }
         }
@@ -3991,7 +4180,6 @@ VOID PhSipNotifyIoGraph(
         {
             PPH_GRAPH_GETDRAWINFO getDrawInfo = (PPH_GRAPH_GETDRAWINFO)Header;
             PPH_GRAPH_DRAW_INFO drawInfo = getDrawInfo->DrawInfo;
-            ULONG i;
 
             drawInfo->Flags = PH_GRAPH_USE_GRID | PH_GRAPH_USE_LINE_2;
             PhSiSetColorsGraphDrawInfo(drawInfo, PhCsColorIoReadOther, PhCsColorIoWrite);
@@ -4004,40 +4192,7 @@ VOID PhSipNotifyIoGraph(
 
             if (!IoGraphState.Valid)
             {
-                FLOAT max = 0;
-
-                for (i = 0; i < drawInfo->LineDataCount; i++)
-                {
-                    FLOAT data1;
-                    FLOAT data2;
-
-                    IoGraphState.Data1[i] = data1 =
-                        (FLOAT)PhGetItemCircularBuffer_ULONG64(&PhIoReadHistory, i) +
-                        (FLOAT)PhGetItemCircularBuffer_ULONG64(&PhIoOtherHistory, i);
-                    IoGraphState.Data2[i] = data2 =
-                        (FLOAT)PhGetItemCircularBuffer_ULONG64(&PhIoWriteHistory, i);
-
-                    if (max < data1 + data2)
-                        max = data1 + data2;
-                }
-
-                // Minimum scaling of 1 MB.
-                if (max < 1024 * 1024)
-                    max = 1024 * 1024;
-
-                // Scale the data.
-
-                PhDivideSinglesBySingle(
-                    IoGraphState.Data1,
-                    max,
-                    drawInfo->LineDataCount
-                    );
-                PhDivideSinglesBySingle(
-                    IoGraphState.Data2,
-                    max,
-                    drawInfo->LineDataCount
-                    );
-
+                PhGetSystemGraphSeries(SystemGraphIoSeries, drawInfo->LineDataCount, IoGraphState.Data1, IoGraphState.Data2);
                 IoGraphState.Valid = TRUE;
             }
         }
@@ -284,7 +284,7 @@ VOID PhpDestroyThreadNode(
 {
     PhEmCallObjectOperation(EmThreadNodeType, ThreadNode, EmObjectDelete);
 
-    if (ThreadNode->CyclesDeltaText) PhDereferenceObject(ThreadNode->CyclesDeltaText);
+    PhDeleteCachedFormat(&ThreadNode->CyclesDeltaText);
     if (ThreadNode->StartAddressText) PhDereferenceObject(ThreadNode->StartAddressText);
     if (ThreadNode->PriorityText) PhDereferenceObject(ThreadNode->PriorityText);
 
@@ -534,16 +534,14 @@ BOOLEAN NTAPI PhpThreadTreeNewCallback(
                 {
                     if (threadItem->CyclesDelta.Delta != threadItem->CyclesDelta.Value && threadItem->CyclesDelta.Delta != 0)
                     {
-                        PhMoveReference(&node->CyclesDeltaText, PhFormatUInt64(threadItem->CyclesDelta.Delta, TRUE));
-                        getCellText->Text = node->CyclesDeltaText->sr;
+                        getCellText->Text = PhFormatUInt64Cached(&node->CyclesDeltaText, threadItem->CyclesDelta.Delta, TRUE)->sr;
                     }
                 }
                 else
                 {
                     if (threadItem->ContextSwitchesDelta.Delta != threadItem->ContextSwitchesDelta.Value && threadItem->ContextSwitchesDelta.Delta != 0)
                     {
-                        PhMoveReference(&node->CyclesDeltaText, PhFormatUInt64(threadItem->ContextSwitchesDelta.Delta, TRUE));
-                        getCellText->Text = node->CyclesDeltaText->sr;
+                        getCellText->Text = PhFormatUInt64Cached(&node->CyclesDeltaText, threadItem->ContextSwitchesDelta.Delta, TRUE)->sr;
                     }
                 }
                 break;
@@ -0,0 +1,565 @@
+/*
+ * Process Hacker -
+ *   sampling CPU profiler
+ *
+ * Copyright (C) 2016 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The profiler periodically walks the stacks of the threads in a process that used the
+ * most CPU time during the last update interval. The thread provider supplies the CPU
+ * deltas used to rank the threads, and its symbol provider (with its symbol indexes)
+ * resolves the frames. Each sample is merged into a call tree, and the tree is written
+ * out in the folded stack format ("outer;inner;leaf count") understood by flame graph
+ * tools once the profiling duration has elapsed or the process has exited.
+ *
+ * Sampling is paced so that the time spent walking stacks stays below a configurable
+ * fraction of the elapsed time.
+ */
+
+#include <phapp.h>
+#include <settings.h>
+#include <symprv.h>
+
+#define PH_PROFILER_MAXIMUM_FRAMES 64
+#define PH_PROFILER_MAXIMUM_THREADS 64
+
+typedef struct _PH_PROFILER_NODE
+{
+    struct _PH_PROFILER_NODE *Parent;
+    PPH_STRING Symbol;
+    ULONG Count;
+    ULONG SelfCount;
+    PPH_LIST Children;
+} PH_PROFILER_NODE, *PPH_PROFILER_NODE;
+
+typedef struct _PH_THREAD_PROFILER
+{
+    HANDLE ProcessId;
+    PPH_STRING ProcessName;
+    PPH_STRING FileName;
+    HANDLE ProcessHandle;
+
+    PPH_THREAD_PROVIDER ThreadProvider;
+    PH_CALLBACK_REGISTRATION ThreadProviderRegistration;
+
+    ULONG SampleInterval;
+    ULONG MaximumThreads;
+    ULONG MaximumOverhead;
+    ULONG Duration;
+
+    PPH_HASHTABLE SymbolHashtable; // address to symbol
+    PPH_HASHTABLE ThreadHandleHashtable; // thread ID to handle
+
+    PPH_PROFILER_NODE Root;
+    ULONG NumberOfSamples;
+} PH_THREAD_PROFILER, *PPH_THREAD_PROFILER;
+
+typedef struct _PH_PROFILER_WALK_CONTEXT
+{
+    ULONG NumberOfFrames;
+    ULONG64 Frames[PH_PROFILER_MAXIMUM_FRAMES];
+} PH_PROFILER_WALK_CONTEXT, *PPH_PROFILER_WALK_CONTEXT;
+
+static PPH_PROFILER_NODE PhpCreateProfilerNode(
+    _In_opt_ PPH_PROFILER_NODE Parent,
+    _In_opt_ PPH_STRING Symbol
+    )
+{
+    PPH_PROFILER_NODE node;
+
+    node = PhAllocate(sizeof(PH_PROFILER_NODE));
+    memset(node, 0, sizeof(PH_PROFILER_NODE));
+    node->Parent = Parent;
+    PhSetReference(&node->Symbol, Symbol);
+
+    if (Parent)
+    {
+        if (!Parent->Children)
+            Parent->Children = PhCreateList(4);
+
+        PhAddItemList(Parent->Children, node);
+    }
+
+    return node;
+}
+
+static VOID PhpDestroyProfilerNode(
+    _In_ PPH_PROFILER_NODE Node
+    )
+{
+    ULONG i;
+
+    if (Node->Children)
+    {
+        for (i = 0; i < Node->Children->Count; i++)
+            PhpDestroyProfilerNode(Node->Children->Items[i]);
+
+        PhDereferenceObject(Node->Children);
+    }
+
+    PhClearReference(&Node->Symbol);
+    PhFree(Node);
+}
+
+static PPH_PROFILER_NODE PhpFindOrCreateChildProfilerNode(
+    _In_ PPH_PROFILER_NODE Parent,
+    _In_ PPH_STRING Symbol
+    )
+{
+    ULONG i;
+    PPH_PROFILER_NODE node;
+
+    if (Parent->Children)
+    {
+        for (i = 0; i < Parent->Children->Count; i++)
+        {
+            node = Parent->Children->Items[i];
+
+            if (node->Symbol == Symbol || PhEqualString(node->Symbol, Symbol, FALSE))
+                return node;
+        }
+    }
+
+    return PhpCreateProfilerNode(Parent, Symbol);
+}
+
+static PPH_STRING PhpGetProfilerSymbol(
+    _In_ PPH_THREAD_PROFILER Profiler,
+    _In_ ULONG64 Address
+    )
+{
+    PPH_STRING symbol;
+    ULONG_PTR indexOfPlus;
+
+    if (symbol = PhFindItemSimpleHashtable2(Profiler->SymbolHashtable, (PVOID)Address))
+        return symbol;
+
+    symbol = PhGetSymbolFromAddress(
+        Profiler->ThreadProvider->SymbolProvider,
+        Address,
+        NULL,
+        NULL,
+        NULL,
+        NULL
+        );
+
+    if (symbol)
+    {
+        // Samples are aggregated by function, so drop the displacement.
+        indexOfPlus = PhFindLastCharInString(symbol, 0, '+');
+
+        if (indexOfPlus != -1 && indexOfPlus != 0)
+            PhMoveReference(&symbol, PhSubstring(symbol, 0, indexOfPlus));
+    }
+    else
+    {
+        symbol = PhFormatString(L"0x%Ix", (ULONG_PTR)Address);
+    }
+
+    PhAddItemSimpleHashtable(Profiler->SymbolHashtable, (PVOID)Address, symbol);
+
+    return symbol;
+}
+
+static BOOLEAN NTAPI PhpProfilerWalkThreadStackCallback(
+    _In_ PPH_THREAD_STACK_FRAME StackFrame,
+    _In_opt_ PVOID Context
+    )
+{
+    PPH_PROFILER_WALK_CONTEXT context = Context;
+
+    context->Frames[context->NumberOfFrames++] = (ULONG64)StackFrame->PcAddress;
+
+    return context->NumberOfFrames < PH_PROFILER_MAXIMUM_FRAMES;
+}
+
+static HANDLE PhpGetProfilerThreadHandle(
+    _In_ PPH_THREAD_PROFILER Profiler,
+    _In_ HANDLE ThreadId
+    )
+{
+    PVOID *value;
+    HANDLE threadHandle;
+
+    if (value = PhFindItemSimpleHashtable(Profiler->ThreadHandleHashtable, ThreadId))
+        return *value;
+
+    if (!NT_SUCCESS(PhOpenThread(
+        &threadHandle,
+        ThreadQueryAccess | THREAD_GET_CONTEXT | THREAD_SUSPEND_RESUME,
+        ThreadId
+        )))
+    {
+        threadHandle = NULL;
+    }
+
+    // Failures are remembered as well so that we don't keep trying to open the thread.
+    PhAddItemSimpleHashtable(Profiler->ThreadHandleHashtable, ThreadId, threadHandle);
+
+    return threadHandle;
+}
+
+static VOID PhpSampleThread(
+    _In_ PPH_THREAD_PROFILER Profiler,
+    _In_ HANDLE ThreadId
+    )
+{
+    HANDLE threadHandle;
+    CLIENT_ID clientId;
+    PH_PROFILER_WALK_CONTEXT walkContext;
+    PPH_PROFILER_NODE node;
+    ULONG i;
+
+    if (!(threadHandle = PhpGetProfilerThreadHandle(Profiler, ThreadId)))
+        return;
+
+    clientId.UniqueProcess = Profiler->ProcessId;
+    clientId.UniqueThread = ThreadId;
+    walkContext.NumberOfFrames = 0;
+
+    PhWalkThreadStack(
+        threadHandle,
+        Profiler->ThreadProvider->SymbolProvider->ProcessHandle,
+        &clientId,
+        Profiler->ThreadProvider->SymbolProvider,
+        PH_WALK_I386_STACK | PH_WALK_AMD64_STACK | PH_WALK_KERNEL_STACK,
+        PhpProfilerWalkThreadStackCallback,
+        &walkContext
+        );
+
+    if (walkContext.NumberOfFrames == 0)
+        return;
+
+    // Frames are reported innermost first, but the tree is rooted at the outermost frame.
+    node = Profiler->Root;
+    node->Count++;
+
+    for (i = walkContext.NumberOfFrames; i != 0; i--)
+    {
+        node = PhpFindOrCreateChildProfilerNode(node, PhpGetProfilerSymbol(Profiler, walkContext.Frames[i - 1]));
+        node->Count++;
+    }
+
+    node->SelfCount++;
+    Profiler->NumberOfSamples++;
+}
+
+static ULONG PhpSelectProfilerThreads(
+    _In_ PPH_THREAD_PROFILER Profiler,
+    _Out_writes_(PH_PROFILER_MAXIMUM_THREADS) PHANDLE ThreadIds
+    )
+{
+    PPH_THREAD_PROVIDER threadProvider = Profiler->ThreadProvider;
+    ULONG64 deltas[PH_PROFILER_MAXIMUM_THREADS];
+    ULONG count;
+    ULONG enumerationKey;
+    PPH_THREAD_ITEM *threadItem;
+    ULONG64 delta;
+    ULONG i;
+
+    count = 0;
+    enumerationKey = 0;
+
+    PhAcquireFastLockShared(&threadProvider->ThreadHashtableLock);
+
+    while (PhEnumHashtable(threadProvider->ThreadHashtable, (PVOID *)&threadItem, &enumerationKey))
+    {
+        delta = (*threadItem)->CpuKernelDelta.Delta + (*threadItem)->CpuUserDelta.Delta;
+
+        // Idle threads would only contribute wait stacks.
+        if (delta == 0)
+            continue;
+
+        // Insertion into a short list sorted by descending delta.
+        if (count < Profiler->MaximumThreads)
+            i = count++;
+        else if (delta > deltas[count - 1])
+            i = count - 1;
+        else
+            continue;
+
+        while (i != 0 && deltas[i - 1] < delta)
+        {
+            deltas[i] = deltas[i - 1];
+            ThreadIds[i] = ThreadIds[i - 1];
+            i--;
+        }
+
+        deltas[i] = delta;
+        ThreadIds[i] = (*threadItem)->ThreadId;
+    }
+
+    PhReleaseFastLockShared(&threadProvider->ThreadHashtableLock);
+
+    return count;
+}
+
+static VOID PhpWriteProfilerNode(
+    _In_ PPH_FILE_STREAM FileStream,
+    _In_ PPH_PROFILER_NODE Node,
+    _Inout_ PPH_STRING_BUILDER Path
+    )
+{
+    SIZE_T pathLength;
+    ULONG i;
+
+    pathLength = Path->String->Length;
+
+    if (Node->Symbol)
+    {
+        if (pathLength != 0)
+            PhAppendCharStringBuilder(Path, ';');
+
+        PhAppendStringBuilder(Path, &Node->Symbol->sr);
+
+        if (Node->SelfCount != 0)
+        {
+            PhWriteStringAsUtf8FileStream(FileStream, &Path->String->sr);
+            PhWriteStringFormatAsUtf8FileStream(FileStream, L" %u\r\n", Node->SelfCount);
+        }
+    }
+
+    if (Node->Children)
+    {
+        for (i = 0; i < Node->Children->Count; i++)
+            PhpWriteProfilerNode(FileStream, Node->Children->Items[i], Path);
+    }
+
+    PhRemoveEndStringBuilder(Path, (Path->String->Length - pathLength) / sizeof(WCHAR));
+}
+
+static NTSTATUS PhpSaveProfile(
+    _In_ PPH_THREAD_PROFILER Profiler
+    )
+{
+    NTSTATUS status;
+    PPH_FILE_STREAM fileStream;
+    PH_STRING_BUILDER path;
+
+    if (!NT_SUCCESS(status = PhCreateFileStream(
+        &fileStream,
+        Profiler->FileName->Buffer,
+        FILE_GENERIC_WRITE,
+        FILE_SHARE_READ,
+        FILE_OVERWRITE_IF,
+        0
+        )))
+        return status;
+
+    PhInitializeStringBuilder(&path, 256);
+    PhpWriteProfilerNode(fileStream, Profiler->Root, &path);
+    PhDeleteStringBuilder(&path);
+
+    PhDereferenceObject(fileStream);
+
+    return STATUS_SUCCESS;
+}
+
+static VOID PhpDestroyThreadProfiler(
+    _In_ PPH_THREAD_PROFILER Profiler
+    )
+{
+    PH_HASHTABLE_ENUM_CONTEXT enumContext;
+    PPH_KEY_VALUE_PAIR entry;
+
+    PhUnregisterThreadProvider(Profiler->ThreadProvider, &Profiler->ThreadProviderRegistration);
+    PhSetTerminatingThreadProvider(Profiler->ThreadProvider);
+    PhDereferenceObject(Profiler->ThreadProvider);
+
+    PhBeginEnumHashtable(Profiler->SymbolHashtable, &enumContext);
+
+    while (entry = PhNextEnumHashtable(&enumContext))
+        PhDereferenceObject(entry->Value);
+
+    PhDereferenceObject(Profiler->SymbolHashtable);
+
+    PhBeginEnumHashtable(Profiler->ThreadHandleHashtable, &enumContext);
+
+    while (entry = PhNextEnumHashtable(&enumContext))
+    {
+        if (entry->Value)
+            NtClose(entry->Value);
+    }
+
+    PhDereferenceObject(Profiler->ThreadHandleHashtable);
+
+    PhpDestroyProfilerNode(Profiler->Root);
+
+    if (Profiler->ProcessHandle)
+        NtClose(Profiler->ProcessHandle);
+
+    PhDereferenceObject(Profiler->ProcessName);
+    PhDereferenceObject(Profiler->FileName);
+    PhFree(Profiler);
+}
+
+static NTSTATUS PhpThreadProfilerThreadStart(
+    _In_ PVOID Parameter
+    )
+{
+    PPH_THREAD_PROFILER profiler = Parameter;
+    HANDLE threadIds[PH_PROFILER_MAXIMUM_THREADS];
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER startCounter;
+    LARGE_INTEGER sampleStartCounter;
+    LARGE_INTEGER counter;
+    ULONG64 sampleTime;
+    ULONG64 waitTime;
+    LARGE_INTEGER timeout;
+    ULONG count;
+    ULONG i;
+    NTSTATUS status;
+    PPH_STRING message;
+
+    PhLoadSymbolsThreadProvider(profiler->ThreadProvider);
+
+    NtQueryPerformanceCounter(&startCounter, &frequency);
+
+    while (TRUE)
+    {
+        NtQueryPerformanceCounter(&sampleStartCounter, NULL);
+
+        if ((ULONG64)(sampleStartCounter.QuadPart - startCounter.QuadPart) >= (ULONG64)frequency.QuadPart * profiler->Duration)
+            break;
+
+        count = PhpSelectProfilerThreads(profiler, threadIds);
+
+        for (i = 0; i < count; i++)
+            PhpSampleThread(profiler, threadIds[i]);
+
+        NtQueryPerformanceCounter(&counter, NULL);
+
+        // Wait long enough that sampling takes up at most MaximumOverhead percent of the time.
+        sampleTime = (ULONG64)(counter.QuadPart - sampleStartCounter.QuadPart) * 1000 / frequency.QuadPart;
+        waitTime = sampleTime * 100 / profiler->MaximumOverhead;
+
+        if (waitTime > sampleTime)
+            waitTime -= sampleTime;
+        else
+            waitTime = 0;
+
+        if (waitTime < profiler->SampleInterval)
+            waitTime = profiler->SampleInterval;
+
+        timeout.QuadPart = -(LONGLONG)waitTime * PH_TIMEOUT_MS;
+
+        if (profiler->ProcessHandle)
+        {
+            // Stop early if the process exits.
+            if (NtWaitForSingleObject(profiler->ProcessHandle, FALSE, &timeout) != STATUS_TIMEOUT)
+                break;
+        }
+        else
+        {
+            NtDelayExecution(FALSE, &timeout);
+        }
+    }
+
+    status = PhpSaveProfile(profiler);
+
+    if (NT_SUCCESS(status))
+    {
+        message = PhFormatString(
+            L"CPU profile of %s (%u) saved to %s (%u samples)",
+            profiler->ProcessName->Buffer,
+            HandleToUlong(profiler->ProcessId),
+            profiler->FileName->Buffer,
+            profiler->NumberOfSamples
+            );
+    }
+    else
+    {
+        PPH_STRING statusMessage;
+
+        statusMessage = PhGetNtMessage(status);
+        message = PhFormatString(
+            L"Unable to save the CPU profile of %s (%u) to %s: %s",
+            profiler->ProcessName->Buffer,
+            HandleToUlong(profiler->ProcessId),
+            profiler->FileName->Buffer,
+            PhGetStringOrDefault(statusMessage, L"Unknown error")
+            );
+        PhClearReference(&statusMessage);
+    }
+
+    PhLogMessageEntry(PH_LOG_ENTRY_MESSAGE, message);
+    PhDereferenceObject(message);
+
+    PhpDestroyThreadProfiler(profiler);
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * Starts profiling the threads of a process in the background.
+ *
+ * \param ProcessItem The process to profile.
+ * \param FileName The file to write the profile to when profiling finishes.
+ *
+ * \remarks The sampling interval, the number of threads sampled each time,
+ * the maximum overhead and the duration are taken from the ProfilerSampleInterval,
+ * ProfilerMaximumThreads, ProfilerMaximumOverhead and ProfilerDuration settings.
+ * The result is reported in the log.
+ */
+VOID PhStartThreadProfiler(
+    _In_ PPH_PROCESS_ITEM ProcessItem,
+    _In_ PPH_STRING FileName
+    )
+{
+    PPH_THREAD_PROFILER profiler;
+    HANDLE threadHandle;
+
+    profiler = PhAllocate(sizeof(PH_THREAD_PROFILER));
+    memset(profiler, 0, sizeof(PH_THREAD_PROFILER));
+    profiler->ProcessId = ProcessItem->ProcessId;
+    PhSetReference(&profiler->ProcessName, ProcessItem->ProcessName);
+    PhSetReference(&profiler->FileName, FileName);
+    PhOpenProcess(&profiler->ProcessHandle, SYNCHRONIZE, ProcessItem->ProcessId);
+
+    profiler->SampleInterval = PhGetIntegerSetting(L"ProfilerSampleInterval");
+    profiler->MaximumThreads = PhGetIntegerSetting(L"ProfilerMaximumThreads");
+    profiler->MaximumOverhead = PhGetIntegerSetting(L"ProfilerMaximumOverhead");
+    profiler->Duration = PhGetIntegerSetting(L"ProfilerDuration");
+
+    if (profiler->SampleInterval == 0)
+        profiler->SampleInterval = 1;
+    if (profiler->MaximumThreads == 0)
+        profiler->MaximumThreads = 1;
+    if (profiler->MaximumThreads > PH_PROFILER_MAXIMUM_THREADS)
+        profiler->MaximumThreads = PH_PROFILER_MAXIMUM_THREADS;
+    if (profiler->MaximumOverhead == 0 || profiler->MaximumOverhead > 100)
+        profiler->MaximumOverhead = 100;
+
+    profiler->SymbolHashtable = PhCreateSimpleHashtable(1024);
+    profiler->ThreadHandleHashtable = PhCreateSimpleHashtable(16);
+    profiler->Root = PhpCreateProfilerNode(NULL, NULL);
+
+    // The thread provider keeps the CPU deltas used to rank the threads up to date.
+    profiler->ThreadProvider = PhCreateThreadProvider(ProcessItem->ProcessId);
+    PhRegisterThreadProvider(profiler->ThreadProvider, &profiler->ThreadProviderRegistration);
+
+    if (threadHandle = PhCreateThread(0, PhpThreadProfilerThreadStart, profiler))
+    {
+        NtClose(threadHandle);
+    }
+    else
+    {
+        PhpDestroyThreadProfiler(profiler);
+    }
+}
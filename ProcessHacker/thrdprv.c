@@ -29,6 +29,7 @@
 
 #define PH_THRDPRV_PRIVATE
 #include <phapp.h>
+#include <settings.h>
 #include <kphuser.h>
 #include <symprv.h>
 #include <extmgri.h>
@@ -53,6 +54,41 @@ typedef struct _PH_THREAD_SYMBOL_LOAD_CONTEXT
     PPH_SYMBOL_PROVIDER SymbolProvider;
 } PH_THREAD_SYMBOL_LOAD_CONTEXT, *PPH_THREAD_SYMBOL_LOAD_CONTEXT;
 
+// Start addresses resolved to a function, shared by all thread providers. Most threads
+// start in a handful of functions (thread pool workers, CRT and CLR thread routines), so
+// this avoids loading the same symbols again for every process.
+
+#define PH_START_ADDRESS_CACHE_LIMIT 4096
+
+typedef struct _PH_START_ADDRESS_CACHE_ENTRY
+{
+    PPH_STRING FileName;
+    ULONG64 Rva;
+    PPH_STRING Symbol;
+} PH_START_ADDRESS_CACHE_ENTRY, *PPH_START_ADDRESS_CACHE_ENTRY;
+
+// Symbol prefetching runs on its own queue at very low I/O priority, so that it never delays
+// the thread queries of open windows.
+
+#define PH_SYMBOL_PREFETCH_MAXIMUM_MODULES 16
+
+typedef struct _PH_SYMBOL_PREFETCH_MODULE
+{
+    PPH_STRING FileName;
+    PVOID BaseAddress;
+    ULONG Size;
+    ULONG Count;
+} PH_SYMBOL_PREFETCH_MODULE, *PPH_SYMBOL_PREFETCH_MODULE;
+
+// Results of the batched GUI thread queries, indexed the same way as the threads in the
+// process snapshot.
+
+typedef struct _PH_THREAD_WIN32_QUERY
+{
+    NTSTATUS Status;
+    PVOID Win32Thread;
+} PH_THREAD_WIN32_QUERY, *PPH_THREAD_WIN32_QUERY;
+
 VOID NTAPI PhpThreadProviderDeleteProcedure(
     _In_ PVOID Object,
     _In_ ULONG Flags
@@ -72,6 +108,15 @@ ULONG NTAPI PhpThreadHashtableHashFunction(
     _In_ PVOID Entry
     );
 
+BOOLEAN NTAPI PhpStartAddressCacheEqualFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    );
+
+ULONG NTAPI PhpStartAddressCacheHashFunction(
+    _In_ PVOID Entry
+    );
+
 VOID PhpThreadProviderCallbackHandler(
     _In_opt_ PVOID Parameter,
     _In_opt_ PVOID Context
@@ -79,7 +124,7 @@ VOID PhpThreadProviderCallbackHandler(
 
 VOID PhpThreadProviderUpdate(
     _In_ PPH_THREAD_PROVIDER ThreadProvider,
-    _In_ PVOID ProcessInformation
+    _In_opt_ PSYSTEM_PROCESS_INFORMATION Process
     );
 
 PPH_OBJECT_TYPE PhThreadProviderType;
@@ -88,19 +133,39 @@ PPH_OBJECT_TYPE PhThreadItemType;
 PH_WORK_QUEUE PhThreadProviderWorkQueue;
 PH_INITONCE PhThreadProviderWorkQueueInitOnce = PH_INITONCE_INIT;
 
+static PPH_HASHTABLE PhpStartAddressCacheHashtable;
+static PH_QUEUED_LOCK PhpStartAddressCacheLock = PH_QUEUED_LOCK_INIT;
+
+static PH_WORK_QUEUE PhpSymbolPrefetchWorkQueue;
+static PH_INITONCE PhpSymbolPrefetchWorkQueueInitOnce = PH_INITONCE_INIT;
+
 BOOLEAN PhThreadProviderInitialization(
     VOID
     )
 {
+    PH_OBJECT_TYPE_PARAMETERS parameters;
+
     PhThreadProviderType = PhCreateObjectType(L"ThreadProvider", 0, PhpThreadProviderDeleteProcedure);
-    PhThreadItemType = PhCreateObjectType(L"ThreadItem", 0, PhpThreadItemDeleteProcedure);
+
+    parameters.FreeListSize = 0;
+    parameters.FreeListCount = 256;
+    PhThreadItemType = PhCreateObjectTypeEx(L"ThreadItem", PH_OBJECT_TYPE_USE_FREE_LIST, PhpThreadItemDeleteProcedure, &parameters);
+
+    PhpStartAddressCacheHashtable = PhCreateHashtableEx(
+        sizeof(PH_START_ADDRESS_CACHE_ENTRY),
+        PhpStartAddressCacheEqualFunction,
+        PhpStartAddressCacheHashFunction,
+        256,
+        PH_HASHTABLE_INCREMENTAL_RESIZE
+        );
 
     return TRUE;
 }
 
 VOID PhpQueueThreadWorkQueueItem(
     _In_ PTHREAD_START_ROUTINE Function,
-    _In_opt_ PVOID Context
+    _In_opt_ PVOID Context,
+    _In_opt_ PPH_WORK_QUEUE_ENVIRONMENT Environment
     )
 {
     if (PhBeginInitOnce(&PhThreadProviderWorkQueueInitOnce))
@@ -109,7 +174,7 @@ VOID PhpQueueThreadWorkQueueItem(
         PhEndInitOnce(&PhThreadProviderWorkQueueInitOnce);
     }
 
-    PhQueueItemWorkQueue(&PhThreadProviderWorkQueue, Function, Context);
+    PhQueueItemWorkQueueEx(&PhThreadProviderWorkQueue, Function, Context, NULL, Environment);
 }
 
 PPH_THREAD_PROVIDER PhCreateThreadProvider(
@@ -131,6 +196,7 @@ PPH_THREAD_PROVIDER PhCreateThreadProvider(
         20
         );
     PhInitializeFastLock(&threadProvider->ThreadHashtableLock);
+    PhRegisterLockStatistics(&threadProvider->ThreadHashtableLock, L"ThreadProvider->ThreadHashtableLock");
 
     PhInitializeCallback(&threadProvider->ThreadAddedEvent);
     PhInitializeCallback(&threadProvider->ThreadModifiedEvent);
@@ -149,9 +215,11 @@ PPH_THREAD_PROVIDER PhCreateThreadProvider(
 
     RtlInitializeSListHead(&threadProvider->QueryListHead);
     PhInitializeQueuedLock(&threadProvider->LoadSymbolsLock);
+    PhRegisterLockStatistics(&threadProvider->LoadSymbolsLock, L"ThreadProvider->LoadSymbolsLock");
 
     threadProvider->RunId = 1;
     threadProvider->SymbolsLoadedRunId = 0; // Force symbols to be loaded the first time we try to resolve an address
+    threadProvider->CancelToken = PhCreateWorkQueueCancelToken();
 
     PhEmCallObjectOperation(EmThreadProviderType, threadProvider, EmObjectCreate);
 
@@ -172,6 +240,8 @@ VOID PhpThreadProviderDeleteProcedure(
     PhDereferenceAllThreadItems(threadProvider);
 
     PhDereferenceObject(threadProvider->ThreadHashtable);
+    PhUnregisterLockStatistics(&threadProvider->ThreadHashtableLock);
+    PhUnregisterLockStatistics(&threadProvider->LoadSymbolsLock);
     PhDeleteFastLock(&threadProvider->ThreadHashtableLock);
     PhDeleteCallback(&threadProvider->ThreadAddedEvent);
     PhDeleteCallback(&threadProvider->ThreadModifiedEvent);
@@ -201,6 +271,8 @@ VOID PhpThreadProviderDeleteProcedure(
     // We don't close the process handle because it is owned by
     // the symbol provider.
     if (threadProvider->SymbolProvider) PhDereferenceObject(threadProvider->SymbolProvider);
+
+    PhDereferenceObject(threadProvider->CancelToken);
 }
 
 VOID PhRegisterThreadProvider(
@@ -221,11 +293,33 @@ VOID PhUnregisterThreadProvider(
     PhDereferenceObject(ThreadProvider);
 }
 
+/**
+ * Pauses or resumes updates of a registered thread provider.
+ *
+ * \param ThreadProvider The thread provider.
+ * \param Enabled TRUE to resume updates, FALSE to pause them.
+ *
+ * \remarks The first update after the provider is resumed reports zero deltas, so that
+ * the time spent paused doesn't show up as CPU usage.
+ */
+VOID PhSetEnabledThreadProvider(
+    _Inout_ PPH_THREAD_PROVIDER ThreadProvider,
+    _In_ BOOLEAN Enabled
+    )
+{
+    if (Enabled && ThreadProvider->Disabled)
+        ThreadProvider->RebaseDeltas = TRUE;
+
+    ThreadProvider->Disabled = !Enabled;
+}
+
 VOID PhSetTerminatingThreadProvider(
     _Inout_ PPH_THREAD_PROVIDER ThreadProvider
     )
 {
     ThreadProvider->Terminating = TRUE;
+    // Drop the queries which haven't started yet. This releases their references to the provider.
+    PhCancelWorkQueueCancelToken(ThreadProvider->CancelToken);
 }
 
 static BOOLEAN LoadSymbolsEnumGenericModulesCallback(
@@ -486,6 +580,104 @@ VOID PhpRemoveThreadItem(
     PhDereferenceObject(ThreadItem);
 }
 
+BOOLEAN NTAPI PhpStartAddressCacheEqualFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    )
+{
+    PPH_START_ADDRESS_CACHE_ENTRY entry1 = Entry1;
+    PPH_START_ADDRESS_CACHE_ENTRY entry2 = Entry2;
+
+    return entry1->Rva == entry2->Rva && PhEqualString(entry1->FileName, entry2->FileName, TRUE);
+}
+
+ULONG NTAPI PhpStartAddressCacheHashFunction(
+    _In_ PVOID Entry
+    )
+{
+    PPH_START_ADDRESS_CACHE_ENTRY entry = Entry;
+
+    return PhHashStringRef(&entry->FileName->sr, TRUE) ^ PhHashInt64(entry->Rva);
+}
+
+BOOLEAN PhpLookupStartAddressCache(
+    _In_ PPH_SYMBOL_PROVIDER SymbolProvider,
+    _In_ ULONG64 Address,
+    _Out_ PPH_STRING *Symbol,
+    _Out_ PPH_STRING *FileName
+    )
+{
+    PH_START_ADDRESS_CACHE_ENTRY lookupEntry;
+    PPH_START_ADDRESS_CACHE_ENTRY entry;
+    ULONG64 baseAddress;
+    PPH_STRING fileName;
+
+    baseAddress = PhGetModuleFromAddress(SymbolProvider, Address, &fileName);
+
+    if (!fileName)
+        return FALSE;
+
+    lookupEntry.FileName = fileName;
+    lookupEntry.Rva = Address - baseAddress;
+
+    PhAcquireQueuedLockShared(&PhpStartAddressCacheLock);
+
+    if (entry = PhFindEntryHashtable(PhpStartAddressCacheHashtable, &lookupEntry))
+        PhSetReference(Symbol, entry->Symbol);
+
+    PhReleaseQueuedLockShared(&PhpStartAddressCacheLock);
+
+    if (!entry)
+    {
+        PhDereferenceObject(fileName);
+        return FALSE;
+    }
+
+    *FileName = fileName;
+
+    return TRUE;
+}
+
+VOID PhpAddStartAddressCache(
+    _In_ PPH_SYMBOL_PROVIDER SymbolProvider,
+    _In_ ULONG64 Address,
+    _In_ PPH_STRING Symbol
+    )
+{
+    PH_START_ADDRESS_CACHE_ENTRY lookupEntry;
+    PPH_START_ADDRESS_CACHE_ENTRY entry;
+    ULONG64 baseAddress;
+    PPH_STRING fileName;
+    BOOLEAN added;
+
+    baseAddress = PhGetModuleFromAddress(SymbolProvider, Address, &fileName);
+
+    if (!fileName)
+        return;
+
+    lookupEntry.FileName = fileName;
+    lookupEntry.Rva = Address - baseAddress;
+
+    PhAcquireQueuedLockExclusive(&PhpStartAddressCacheLock);
+
+    if (PhpStartAddressCacheHashtable->Count < PH_START_ADDRESS_CACHE_LIMIT)
+    {
+        entry = PhAddEntryHashtableEx(PhpStartAddressCacheHashtable, &lookupEntry, &added);
+
+        if (added)
+        {
+            // The entry owns the file name reference.
+            fileName = NULL;
+            PhSetReference(&entry->Symbol, Symbol);
+        }
+    }
+
+    PhReleaseQueuedLockExclusive(&PhpStartAddressCacheLock);
+
+    if (fileName)
+        PhDereferenceObject(fileName);
+}
+
 NTSTATUS PhpThreadQueryWorker(
     _In_ PVOID Parameter
     )
@@ -504,6 +696,17 @@ NTSTATUS PhpThreadQueryWorker(
     if (data->ThreadProvider->SymbolsLoadedRunId == 0)
         PhLoadSymbolsThreadProvider(data->ThreadProvider);
 
+    if (PhpLookupStartAddressCache(
+        data->ThreadProvider->SymbolProvider,
+        data->ThreadItem->StartAddress,
+        &data->StartAddressString,
+        &data->ThreadItem->StartAddressFileName
+        ))
+    {
+        data->StartAddressResolveLevel = PhsrlFunction;
+        goto StartAddressResolved;
+    }
+
     data->StartAddressString = PhGetSymbolFromAddress(
         data->ThreadProvider->SymbolProvider,
         data->ThreadItem->StartAddress,
@@ -531,6 +734,19 @@ NTSTATUS PhpThreadQueryWorker(
             );
     }
 
+    // Only cache complete results. Module-level results can improve once more symbols
+    // have been loaded.
+    if (data->StartAddressResolveLevel == PhsrlFunction && data->StartAddressString)
+    {
+        PhpAddStartAddressCache(
+            data->ThreadProvider->SymbolProvider,
+            data->ThreadItem->StartAddress,
+            data->StartAddressString
+            );
+    }
+
+StartAddressResolved:
+
     newSymbolsLoading = _InterlockedDecrement(&data->ThreadProvider->SymbolsLoading);
 
     if (newSymbolsLoading == 0)
@@ -578,12 +794,25 @@ Done:
     return STATUS_SUCCESS;
 }
 
+VOID NTAPI PhpThreadQueryCancelFunction(
+    _In_ PUSER_THREAD_START_ROUTINE Function,
+    _In_ PVOID Context
+    )
+{
+    PPH_THREAD_QUERY_DATA data = (PPH_THREAD_QUERY_DATA)Context;
+
+    PhDereferenceObject(data->ThreadProvider);
+    PhDereferenceObject(data->ThreadItem);
+    PhFree(data);
+}
+
 VOID PhpQueueThreadQuery(
     _In_ PPH_THREAD_PROVIDER ThreadProvider,
     _In_ PPH_THREAD_ITEM ThreadItem
     )
 {
     PPH_THREAD_QUERY_DATA data;
+    PH_WORK_QUEUE_ENVIRONMENT environment;
 
     data = PhAllocate(sizeof(PH_THREAD_QUERY_DATA));
     memset(data, 0, sizeof(PH_THREAD_QUERY_DATA));
@@ -591,7 +820,11 @@ VOID PhpQueueThreadQuery(
     PhSetReference(&data->ThreadItem, ThreadItem);
     data->RunId = ThreadProvider->RunId;
 
-    PhpQueueThreadWorkQueueItem(PhpThreadQueryWorker, data);
+    PhInitializeWorkQueueEnvironment(&environment);
+    environment.CancelToken = ThreadProvider->CancelToken;
+    environment.CancelFunction = PhpThreadQueryCancelFunction;
+
+    PhpQueueThreadWorkQueueItem(PhpThreadQueryWorker, data, &environment);
 }
 
 PPH_STRING PhpGetThreadBasicStartAddress(
@@ -653,7 +886,7 @@ static NTSTATUS PhpGetThreadCycleTime(
     }
     else
     {
-        if (HandleToUlong(ThreadItem->ThreadId) < (ULONG)PhSystemBasicInformation.NumberOfProcessors)
+        if (HandleToUlong(ThreadItem->ThreadId) < PhNumberOfCpus)
         {
             *CycleTime = PhCpuIdleCycleTime[HandleToUlong(ThreadItem->ThreadId)].QuadPart;
             return STATUS_SUCCESS;
@@ -663,6 +896,100 @@ static NTSTATUS PhpGetThreadCycleTime(
     return STATUS_INVALID_PARAMETER;
 }
 
+static LONG PhpGetThreadPriorityWin32(
+    _In_ PPH_THREAD_PROVIDER ThreadProvider,
+    _In_ PPH_THREAD_ITEM ThreadItem,
+    _In_ PSYSTEM_PROCESS_INFORMATION Process,
+    _In_ PSYSTEM_THREAD_INFORMATION Thread
+    )
+{
+    KPRIORITY lowestPriority;
+    KPRIORITY highestPriority;
+
+    if (ThreadProvider->ProcessId == SYSTEM_IDLE_PROCESS_ID)
+        return THREAD_PRIORITY_ERROR_RETURN;
+
+    // The Win32 priority is the base priority of the thread relative to the base priority of
+    // its process, which the snapshot already gives us. Only the priorities at the ends of the
+    // range are ambiguous: a "highest" thread in a high priority process has the same base
+    // priority as a "time critical" one, so we have to ask the thread in that case.
+
+    if (Process->BasePriority >= LOW_REALTIME_PRIORITY)
+    {
+        lowestPriority = LOW_REALTIME_PRIORITY;
+        highestPriority = HIGH_PRIORITY;
+    }
+    else
+    {
+        lowestPriority = LOW_PRIORITY + 1;
+        highestPriority = LOW_REALTIME_PRIORITY - 1;
+    }
+
+    if (Thread->BasePriority <= lowestPriority || Thread->BasePriority >= highestPriority)
+        return GetThreadPriority(ThreadItem->ThreadHandle);
+
+    return Thread->BasePriority - Process->BasePriority;
+}
+
+static VOID PhpQueryWin32Threads(
+    _In_ PPH_THREAD_PROVIDER ThreadProvider,
+    _In_ PSYSTEM_THREAD_INFORMATION Threads,
+    _In_ ULONG NumberOfThreads,
+    _Out_writes_(NumberOfThreads) PPH_THREAD_WIN32_QUERY Queries
+    )
+{
+    KPH_BATCH batch;
+    ULONG threadIndices[KPH_BATCH_MAXIMUM_OPERATIONS];
+    ULONG i;
+    ULONG j;
+
+    // Send the queries for existing threads to the driver a batch at a time instead of one
+    // request per thread.
+
+    KphInitializeBatch(&batch);
+
+    for (i = 0; i < NumberOfThreads; i++)
+    {
+        PPH_THREAD_ITEM threadItem;
+
+        Queries[i].Status = STATUS_UNSUCCESSFUL;
+        Queries[i].Win32Thread = NULL;
+
+        threadItem = PhReferenceThreadItem(ThreadProvider, Threads[i].ClientId.UniqueThread);
+
+        if (!threadItem)
+            continue;
+
+        // Thread items are only removed by the provider thread, so the handle stays valid
+        // until the batch is executed.
+        if (threadItem->ThreadHandle)
+        {
+            threadIndices[batch.NumberOfOperations] = i;
+            KphBatchQueryInformationThread(
+                &batch,
+                threadItem->ThreadHandle,
+                KphThreadWin32Thread,
+                &Queries[i].Win32Thread,
+                sizeof(PVOID),
+                NULL,
+                NULL
+                );
+        }
+
+        PhDereferenceObject(threadItem);
+
+        if (batch.NumberOfOperations == KPH_BATCH_MAXIMUM_OPERATIONS || (i == NumberOfThreads - 1 && batch.NumberOfOperations != 0))
+        {
+            KphExecuteBatch(&batch);
+
+            for (j = 0; j < batch.NumberOfOperations; j++)
+                Queries[threadIndices[j]].Status = batch.Operations[j].Status;
+
+            KphInitializeBatch(&batch);
+        }
+    }
+}
+
 PPH_STRING PhGetThreadPriorityWin32String(
     _In_ LONG PriorityWin32
     )
@@ -694,11 +1021,18 @@ VOID PhThreadProviderInitialUpdate(
     _In_ PPH_THREAD_PROVIDER ThreadProvider
     )
 {
+    PPH_PROCESS_INFORMATION_SNAPSHOT snapshot;
     PVOID processes;
 
-    if (NT_SUCCESS(PhEnumProcesses(&processes)))
+    // Use the process provider's snapshot if there is one.
+    if (snapshot = PhReferenceProcessInformationSnapshot())
+    {
+        PhpThreadProviderUpdate(ThreadProvider, PhFindProcessInformationSnapshot(snapshot, ThreadProvider->ProcessId));
+        PhDereferenceObject(snapshot);
+    }
+    else if (NT_SUCCESS(PhEnumProcesses(&processes)))
     {
-        PhpThreadProviderUpdate(ThreadProvider, processes);
+        PhpThreadProviderUpdate(ThreadProvider, PhFindProcessInformation(processes, ThreadProvider->ProcessId));
         PhFree(processes);
     }
 }
@@ -708,15 +1042,24 @@ VOID PhpThreadProviderCallbackHandler(
     _In_opt_ PVOID Context
     )
 {
-    if (PhProcessInformation)
+    PPH_THREAD_PROVIDER threadProvider = Context;
+
+    if (threadProvider->Disabled)
+        return;
+
+    // We are running on the process provider's thread, so its snapshot can be used directly.
+    if (PhProcessInformationSnapshot)
     {
-        PhpThreadProviderUpdate((PPH_THREAD_PROVIDER)Context, PhProcessInformation);
+        PhpThreadProviderUpdate(
+            threadProvider,
+            PhFindProcessInformationSnapshot(PhProcessInformationSnapshot, threadProvider->ProcessId)
+            );
     }
 }
 
 VOID PhpThreadProviderUpdate(
     _In_ PPH_THREAD_PROVIDER ThreadProvider,
-    _In_ PVOID ProcessInformation
+    _In_opt_ PSYSTEM_PROCESS_INFORMATION Process
     )
 {
     PPH_THREAD_PROVIDER threadProvider = ThreadProvider;
@@ -724,9 +1067,10 @@ VOID PhpThreadProviderUpdate(
     SYSTEM_PROCESS_INFORMATION localProcess;
     PSYSTEM_THREAD_INFORMATION threads;
     ULONG numberOfThreads;
+    PPH_THREAD_WIN32_QUERY win32Queries = NULL;
     ULONG i;
 
-    process = PhFindProcessInformation(ProcessInformation, threadProvider->ProcessId);
+    process = Process;
 
     if (!process)
     {
@@ -815,7 +1159,7 @@ VOID PhpThreadProviderUpdate(
 
             if (data->StartAddressResolveLevel == PhsrlFunction && data->StartAddressString)
             {
-                PhSwapReference(&data->ThreadItem->StartAddressString, data->StartAddressString);
+                PhMoveReference(&data->ThreadItem->StartAddressString, PhInternString(data->StartAddressString));
                 data->ThreadItem->StartAddressResolveLevel = data->StartAddressResolveLevel;
             }
 
@@ -829,6 +1173,12 @@ VOID PhpThreadProviderUpdate(
         }
     }
 
+    if (numberOfThreads != 0 && KphIsConnected())
+    {
+        win32Queries = PhAllocate(sizeof(PH_THREAD_WIN32_QUERY) * numberOfThreads);
+        PhpQueryWin32Threads(threadProvider, threads, numberOfThreads, win32Queries);
+    }
+
     // Look for new threads and update existing ones.
     for (i = 0; i < numberOfThreads; i++)
     {
@@ -905,7 +1255,7 @@ VOID PhpThreadProviderUpdate(
             threadItem->StartAddress = (ULONG64)startAddress;
 
             // Get the Win32 priority.
-            threadItem->PriorityWin32 = GetThreadPriority(threadItem->ThreadHandle);
+            threadItem->PriorityWin32 = PhpGetThreadPriorityWin32(threadProvider, threadItem, process, thread);
 
             if (threadProvider->SymbolsLoadedRunId != 0)
             {
@@ -1062,6 +1412,17 @@ VOID PhpThreadProviderUpdate(
             PhUpdateDelta(&threadItem->CpuKernelDelta, threadItem->KernelTime.QuadPart);
             PhUpdateDelta(&threadItem->CpuUserDelta, threadItem->UserTime.QuadPart);
 
+            if (threadProvider->RebaseDeltas)
+            {
+                // These deltas cover the whole time the provider was paused, not one update
+                // interval.
+                threadItem->ContextSwitchesDelta.Delta = 0;
+                threadItem->CyclesDelta.Delta = 0;
+                threadItem->CpuKernelDelta.Delta = 0;
+                threadItem->CpuUserDelta.Delta = 0;
+                modified = TRUE;
+            }
+
             // Update the CPU usage.
             // If the cycle time isn't available, we'll fall back to using the CPU time.
             if (WINDOWS_HAS_CYCLE_TIME && PhEnableCycleCpuUsage && (threadProvider->ProcessId == SYSTEM_IDLE_PROCESS_ID || threadItem->ThreadHandle))
@@ -1078,7 +1439,7 @@ VOID PhpThreadProviderUpdate(
             {
                 LONG oldPriorityWin32 = threadItem->PriorityWin32;
 
-                threadItem->PriorityWin32 = GetThreadPriority(threadItem->ThreadHandle);
+                threadItem->PriorityWin32 = PhpGetThreadPriorityWin32(threadProvider, threadItem, process, thread);
 
                 if (threadItem->PriorityWin32 != oldPriorityWin32)
                 {
@@ -1088,21 +1449,13 @@ VOID PhpThreadProviderUpdate(
 
             // Update the GUI thread status.
 
-            if (threadItem->ThreadHandle && KphIsConnected())
+            if (threadItem->ThreadHandle && win32Queries)
             {
-                PVOID win32Thread;
-
-                if (NT_SUCCESS(KphQueryInformationThread(
-                    threadItem->ThreadHandle,
-                    KphThreadWin32Thread,
-                    &win32Thread,
-                    sizeof(PVOID),
-                    NULL
-                    )))
+                if (NT_SUCCESS(win32Queries[i].Status))
                 {
                     BOOLEAN oldIsGuiThread = threadItem->IsGuiThread;
 
-                    threadItem->IsGuiThread = win32Thread != NULL;
+                    threadItem->IsGuiThread = win32Queries[i].Win32Thread != NULL;
 
                     if (threadItem->IsGuiThread != oldIsGuiThread)
                         modified = TRUE;
@@ -1131,6 +1484,329 @@ VOID PhpThreadProviderUpdate(
         }
     }
 
+    if (win32Queries)
+        PhFree(win32Queries);
+
     PhInvokeCallback(&threadProvider->UpdatedEvent, NULL);
     threadProvider->RunId++;
+    threadProvider->RebaseDeltas = FALSE;
+}
+
+VOID PhpQueueSymbolPrefetchWorkQueueItem(
+    _In_ PTHREAD_START_ROUTINE Function,
+    _In_opt_ PVOID Context
+    )
+{
+    if (PhBeginInitOnce(&PhpSymbolPrefetchWorkQueueInitOnce))
+    {
+        PhInitializeWorkQueue(&PhpSymbolPrefetchWorkQueue, 0, 1, 1000);
+        PhEndInitOnce(&PhpSymbolPrefetchWorkQueueInitOnce);
+    }
+
+    PhQueueItemWorkQueue(&PhpSymbolPrefetchWorkQueue, Function, Context);
+}
+
+NTSTATUS PhpPrefetchSymbolsThreadProviderWorker(
+    _In_ PVOID Parameter
+    )
+{
+    PPH_THREAD_PROVIDER threadProvider = Parameter;
+    PPH_PROCESS_INFORMATION_SNAPSHOT snapshot;
+    PVOID processes = NULL;
+    PSYSTEM_PROCESS_INFORMATION process;
+    ULONG i;
+
+    PhSetThreadIoPriority(NtCurrentThread(), IoPriorityVeryLow);
+
+    if (threadProvider->Terminating || !threadProvider->SymbolProvider)
+        goto CleanupExit;
+
+    if (threadProvider->SymbolsLoadedRunId == 0)
+        PhLoadSymbolsThreadProvider(threadProvider);
+
+    if (snapshot = PhReferenceProcessInformationSnapshot())
+    {
+        process = PhFindProcessInformationSnapshot(snapshot, threadProvider->ProcessId);
+    }
+    else
+    {
+        if (!NT_SUCCESS(PhEnumProcesses(&processes)))
+            goto CleanupExit;
+
+        process = PhFindProcessInformation(processes, threadProvider->ProcessId);
+    }
+
+    // Resolve the start address of every thread. This builds the symbol index for each module
+    // that a thread starts in, and fills the start address cache used by thread queries.
+
+    if (process)
+    {
+        for (i = 0; i < process->NumberOfThreads && !threadProvider->Terminating; i++)
+        {
+            HANDLE threadHandle;
+            PVOID startAddress = NULL;
+            PH_SYMBOL_RESOLVE_LEVEL resolveLevel;
+            PPH_STRING symbol;
+
+            if (NT_SUCCESS(PhOpenThread(
+                &threadHandle,
+                ThreadQueryAccess,
+                process->Threads[i].ClientId.UniqueThread
+                )))
+            {
+                NtQueryInformationThread(
+                    threadHandle,
+                    ThreadQuerySetWin32StartAddress,
+                    &startAddress,
+                    sizeof(PVOID),
+                    NULL
+                    );
+                NtClose(threadHandle);
+            }
+
+            if (!startAddress)
+                startAddress = process->Threads[i].StartAddress;
+
+            symbol = PhGetSymbolFromAddress(
+                threadProvider->SymbolProvider,
+                (ULONG64)startAddress,
+                &resolveLevel,
+                NULL,
+                NULL,
+                NULL
+                );
+
+            if (symbol)
+            {
+                if (resolveLevel == PhsrlFunction)
+                    PhpAddStartAddressCache(threadProvider->SymbolProvider, (ULONG64)startAddress, symbol);
+
+                PhDereferenceObject(symbol);
+            }
+        }
+    }
+
+    if (snapshot)
+        PhDereferenceObject(snapshot);
+    if (processes)
+        PhFree(processes);
+
+CleanupExit:
+    PhDereferenceObject(threadProvider);
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * Loads symbols for a thread provider in the background.
+ *
+ * \param ThreadProvider A thread provider that has not been registered yet. Symbols for
+ * the process modules and the start addresses of its threads are loaded, so that the
+ * provider can resolve them as soon as it is registered.
+ */
+VOID PhPrefetchSymbolsThreadProvider(
+    _In_ PPH_THREAD_PROVIDER ThreadProvider
+    )
+{
+    PhReferenceObject(ThreadProvider);
+    PhpQueueSymbolPrefetchWorkQueueItem(PhpPrefetchSymbolsThreadProviderWorker, ThreadProvider);
+}
+
+static BOOLEAN NTAPI PhpSymbolPrefetchModuleEqualFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    )
+{
+    return PhEqualString(((PPH_SYMBOL_PREFETCH_MODULE)Entry1)->FileName, ((PPH_SYMBOL_PREFETCH_MODULE)Entry2)->FileName, TRUE);
+}
+
+static ULONG NTAPI PhpSymbolPrefetchModuleHashFunction(
+    _In_ PVOID Entry
+    )
+{
+    return PhHashStringRef(&((PPH_SYMBOL_PREFETCH_MODULE)Entry)->FileName->sr, TRUE);
+}
+
+static BOOLEAN NTAPI PhpCountModulesEnumGenericModulesCallback(
+    _In_ PPH_MODULE_INFO Module,
+    _In_opt_ PVOID Context
+    )
+{
+    PPH_HASHTABLE moduleHashtable = Context;
+    PH_SYMBOL_PREFETCH_MODULE lookupEntry;
+    PPH_SYMBOL_PREFETCH_MODULE entry;
+    BOOLEAN added;
+
+    lookupEntry.FileName = Module->FileName;
+    lookupEntry.BaseAddress = Module->BaseAddress;
+    lookupEntry.Size = Module->Size;
+    lookupEntry.Count = 0;
+
+    entry = PhAddEntryHashtableEx(moduleHashtable, &lookupEntry, &added);
+
+    if (added)
+        PhReferenceObject(entry->FileName);
+
+    entry->Count++;
+
+    return TRUE;
+}
+
+static int __cdecl PhpSymbolPrefetchModuleCompare(
+    _In_ const void *elem1,
+    _In_ const void *elem2
+    )
+{
+    PPH_SYMBOL_PREFETCH_MODULE entry1 = *(PPH_SYMBOL_PREFETCH_MODULE *)elem1;
+    PPH_SYMBOL_PREFETCH_MODULE entry2 = *(PPH_SYMBOL_PREFETCH_MODULE *)elem2;
+
+    return uintcmp(entry2->Count, entry1->Count);
+}
+
+NTSTATUS PhpPrefetchCommonModuleSymbolsWorker(
+    _In_ PVOID Parameter
+    )
+{
+    PVOID processes;
+    PSYSTEM_PROCESS_INFORMATION process;
+    PPH_HASHTABLE moduleHashtable;
+    PPH_LIST moduleList;
+    PPH_SYMBOL_PREFETCH_MODULE entry;
+    PPH_SYMBOL_PROVIDER symbolProvider;
+    PRTL_PROCESS_MODULES kernelModules;
+    PPH_STRING symbol;
+    ULONG enumerationKey;
+    ULONG i;
+
+    PhSetThreadIoPriority(NtCurrentThread(), IoPriorityVeryLow);
+
+    if (!NT_SUCCESS(PhEnumProcesses(&processes)))
+        return STATUS_SUCCESS;
+
+    // Count how many processes have loaded each module.
+
+    moduleHashtable = PhCreateHashtable(
+        sizeof(PH_SYMBOL_PREFETCH_MODULE),
+        PhpSymbolPrefetchModuleEqualFunction,
+        PhpSymbolPrefetchModuleHashFunction,
+        256
+        );
+
+    process = PH_FIRST_PROCESS(processes);
+
+    do
+    {
+        HANDLE processHandle;
+
+        if (process->UniqueProcessId == SYSTEM_IDLE_PROCESS_ID || process->UniqueProcessId == SYSTEM_PROCESS_ID)
+            continue;
+
+        if (NT_SUCCESS(PhOpenProcess(
+            &processHandle,
+            ProcessQueryAccess | PROCESS_VM_READ,
+            process->UniqueProcessId
+            )))
+        {
+            PhEnumGenericModules(
+                process->UniqueProcessId,
+                processHandle,
+                0,
+                PhpCountModulesEnumGenericModulesCallback,
+                moduleHashtable
+                );
+            NtClose(processHandle);
+        }
+    } while (process = PH_NEXT_PROCESS(process));
+
+    PhFree(processes);
+
+    moduleList = PhCreateList(moduleHashtable->Count);
+    enumerationKey = 0;
+
+    while (PhEnumHashtable(moduleHashtable, &entry, &enumerationKey))
+    {
+        if (entry->Count >= 2)
+            PhAddItemList(moduleList, entry);
+    }
+
+    qsort(moduleList->Items, moduleList->Count, sizeof(PVOID), PhpSymbolPrefetchModuleCompare);
+
+    // Resolving one address in each module makes the symbol provider build its symbol index,
+    // which is saved to the index cache. Thread providers created later map the saved index.
+
+    symbolProvider = PhCreateSymbolProvider(NULL);
+    PhLoadSymbolProviderOptions(symbolProvider);
+
+    // Every thread provider loads the kernel as well.
+    if (NT_SUCCESS(PhEnumKernelModules(&kernelModules)))
+    {
+        if (kernelModules->NumberOfModules > 0)
+        {
+            PPH_STRING fileName;
+            PPH_STRING newFileName;
+
+            fileName = PhConvertMultiByteToUtf16(kernelModules->Modules[0].FullPathName);
+            newFileName = PhGetFileName(fileName);
+            PhDereferenceObject(fileName);
+
+            if (PhLoadModuleSymbolProvider(
+                symbolProvider,
+                newFileName->Buffer,
+                (ULONG64)kernelModules->Modules[0].ImageBase,
+                kernelModules->Modules[0].ImageSize
+                ))
+            {
+                symbol = PhGetSymbolFromAddress(symbolProvider, (ULONG64)kernelModules->Modules[0].ImageBase, NULL, NULL, NULL, NULL);
+                PhClearReference(&symbol);
+            }
+
+            PhDereferenceObject(newFileName);
+        }
+
+        PhFree(kernelModules);
+    }
+
+    for (i = 0; i < moduleList->Count && i < PH_SYMBOL_PREFETCH_MAXIMUM_MODULES; i++)
+    {
+        entry = moduleList->Items[i];
+
+        if (PhLoadModuleSymbolProvider(
+            symbolProvider,
+            entry->FileName->Buffer,
+            (ULONG64)entry->BaseAddress,
+            entry->Size
+            ))
+        {
+            symbol = PhGetSymbolFromAddress(symbolProvider, (ULONG64)entry->BaseAddress, NULL, NULL, NULL, NULL);
+            PhClearReference(&symbol);
+        }
+    }
+
+    PhDereferenceObject(symbolProvider);
+    PhDereferenceObject(moduleList);
+
+    enumerationKey = 0;
+
+    while (PhEnumHashtable(moduleHashtable, &entry, &enumerationKey))
+        PhDereferenceObject(entry->FileName);
+
+    PhDereferenceObject(moduleHashtable);
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * Builds symbol indexes in the background for the modules loaded by the most processes.
+ *
+ * \remarks This only helps when the symbol index cache is enabled, because the indexes are
+ * handed to later symbol providers through the cache.
+ */
+VOID PhPrefetchCommonModuleSymbols(
+    VOID
+    )
+{
+    if (!PhGetIntegerSetting(L"DbgHelpIndexCache"))
+        return;
+
+    PhpQueueSymbolPrefetchWorkQueueItem(PhpPrefetchCommonModuleSymbolsWorker, NULL);
 }
@@ -0,0 +1,836 @@
+/*
+ * Process Hacker -
+ *   signature verification cache
+ *
+ * Copyright (C) 2010-2016 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Verification results are kept in an in-memory tree keyed by file name. When
+ * a store is opened, results are also written to a file pool so that they
+ * survive restarts. Each stored record carries the file ID, last write time and
+ * size of the file at the time it was verified; a stored result is only used
+ * once the file has been checked against this key, and results older than
+ * PH_VERIFY_CACHE_REVALIDATE_AGE are re-verified in the background.
+ *
+ * The file pool is not thread-safe, so all access to it happens while
+ * holding PhpVerifyCacheLock exclusively.
+ *
+ * The in-memory tree is registered with the memory budget manager. Trimming
+ * evicts the least recently used entries together with their stored records,
+ * since a file that is verified again writes a new record.
+ */
+
+#include <phapp.h>
+#include <filepool.h>
+#include <verify.h>
+
+#define PH_VERIFY_CACHE_STORE_MAGIC ('cVhP')
+#define PH_VERIFY_CACHE_STORE_VERSION 1
+#define PH_VERIFY_CACHE_STORE_MAXIMUM_ENTRIES 4096
+#define PH_VERIFY_CACHE_REVALIDATE_AGE (7 * PH_TICKS_PER_DAY)
+
+typedef struct _PH_VERIFY_CACHE_STORE_INDEX
+{
+    ULONG Magic;
+    ULONG Version;
+    ULONG Count;
+    ULONG Reserved;
+    ULONG Rvas[PH_VERIFY_CACHE_STORE_MAXIMUM_ENTRIES];
+} PH_VERIFY_CACHE_STORE_INDEX, *PPH_VERIFY_CACHE_STORE_INDEX;
+
+typedef struct _PH_VERIFY_CACHE_STORE_RECORD
+{
+    PH_FILE_CACHE_KEY Key;
+    LARGE_INTEGER VerifyTime;
+    ULONG VerifyResult;
+    USHORT FileNameLength; // in bytes
+    USHORT SignerNameLength; // in bytes
+    WCHAR Buffer[1];
+} PH_VERIFY_CACHE_STORE_RECORD, *PPH_VERIFY_CACHE_STORE_RECORD;
+
+typedef struct _PH_VERIFY_CACHE_ENTRY
+{
+    PH_AVL_LINKS Links;
+
+    PPH_STRING FileName;
+    VERIFY_RESULT VerifyResult;
+    PPH_STRING VerifySignerName;
+
+    PH_FILE_CACHE_KEY Key;
+    LARGE_INTEGER VerifyTime;
+    ULONG Rva; // 0 if the entry is not in the store
+    BOOLEAN Validated; // FALSE if the entry was loaded from the store and has not been checked yet
+    ULONG LastUseTime; // updated without holding the lock exclusively
+} PH_VERIFY_CACHE_ENTRY, *PPH_VERIFY_CACHE_ENTRY;
+
+INT NTAPI PhpVerifyCacheCompareFunction(
+    _In_ PPH_AVL_LINKS Links1,
+    _In_ PPH_AVL_LINKS Links2
+    );
+
+#ifdef PH_ENABLE_VERIFY_CACHE
+static PH_AVL_TREE PhpVerifyCacheSet = PH_AVL_TREE_INIT(PhpVerifyCacheCompareFunction);
+static PH_QUEUED_LOCK PhpVerifyCacheLock = PH_QUEUED_LOCK_INIT;
+
+static PPH_FILE_POOL PhpVerifyCacheStore = NULL;
+static PPH_VERIFY_CACHE_STORE_INDEX PhpVerifyCacheStoreIndex = NULL;
+
+static PH_MEMORY_BUDGET_CLIENT PhpVerifyCacheBudgetClient;
+#endif
+
+/**
+ * Gets information that changes whenever a file is replaced or modified.
+ *
+ * \param FileName A Win32 file name.
+ * \param Key A variable which receives the key.
+ */
+NTSTATUS PhQueryFileCacheKey(
+    _In_ PPH_STRING FileName,
+    _Out_ PPH_FILE_CACHE_KEY Key
+    )
+{
+    NTSTATUS status;
+    HANDLE fileHandle;
+    IO_STATUS_BLOCK isb;
+    FILE_INTERNAL_INFORMATION internalInfo;
+    FILE_NETWORK_OPEN_INFORMATION networkOpenInfo;
+
+    if (!NT_SUCCESS(status = PhCreateFileWin32(
+        &fileHandle,
+        FileName->Buffer,
+        FILE_READ_ATTRIBUTES | SYNCHRONIZE,
+        0,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        FILE_OPEN,
+        FILE_NON_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT
+        )))
+        return status;
+
+    status = NtQueryInformationFile(
+        fileHandle,
+        &isb,
+        &internalInfo,
+        sizeof(FILE_INTERNAL_INFORMATION),
+        FileInternalInformation
+        );
+
+    if (NT_SUCCESS(status))
+    {
+        status = NtQueryInformationFile(
+            fileHandle,
+            &isb,
+            &networkOpenInfo,
+            sizeof(FILE_NETWORK_OPEN_INFORMATION),
+            FileNetworkOpenInformation
+            );
+    }
+
+    if (NT_SUCCESS(status))
+    {
+        Key->FileId = internalInfo.IndexNumber;
+        Key->LastWriteTime = networkOpenInfo.LastWriteTime;
+        Key->EndOfFile = networkOpenInfo.EndOfFile;
+    }
+
+    NtClose(fileHandle);
+
+    return status;
+}
+
+INT NTAPI PhpVerifyCacheCompareFunction(
+    _In_ PPH_AVL_LINKS Links1,
+    _In_ PPH_AVL_LINKS Links2
+    )
+{
+    PPH_VERIFY_CACHE_ENTRY entry1 = CONTAINING_RECORD(Links1, PH_VERIFY_CACHE_ENTRY, Links);
+    PPH_VERIFY_CACHE_ENTRY entry2 = CONTAINING_RECORD(Links2, PH_VERIFY_CACHE_ENTRY, Links);
+
+    return PhCompareString(entry1->FileName, entry2->FileName, TRUE);
+}
+
+#ifdef PH_ENABLE_VERIFY_CACHE
+
+static VOID PhpDeleteVerifyCacheRecord(
+    _Inout_ PPH_VERIFY_CACHE_ENTRY Entry
+    )
+{
+    ULONG i;
+
+    if (!PhpVerifyCacheStore || Entry->Rva == 0)
+    {
+        Entry->Rva = 0;
+        return;
+    }
+
+    for (i = 0; i < PhpVerifyCacheStoreIndex->Count; i++)
+    {
+        if (PhpVerifyCacheStoreIndex->Rvas[i] == Entry->Rva)
+        {
+            PhpVerifyCacheStoreIndex->Count--;
+            PhpVerifyCacheStoreIndex->Rvas[i] = PhpVerifyCacheStoreIndex->Rvas[PhpVerifyCacheStoreIndex->Count];
+            PhpVerifyCacheStoreIndex->Rvas[PhpVerifyCacheStoreIndex->Count] = 0;
+            break;
+        }
+    }
+
+    PhFreeFilePoolByRva(PhpVerifyCacheStore, Entry->Rva);
+    Entry->Rva = 0;
+}
+
+static VOID PhpEvictVerifyCacheRecord(
+    VOID
+    )
+{
+    PPH_AVL_LINKS links;
+    PPH_VERIFY_CACHE_ENTRY entry;
+    PPH_VERIFY_CACHE_ENTRY oldestEntry = NULL;
+
+    for (links = PhMinimumElementAvlTree(&PhpVerifyCacheSet); links; links = PhSuccessorElementAvlTree(links))
+    {
+        entry = CONTAINING_RECORD(links, PH_VERIFY_CACHE_ENTRY, Links);
+
+        if (entry->Rva != 0 && (!oldestEntry || entry->VerifyTime.QuadPart < oldestEntry->VerifyTime.QuadPart))
+            oldestEntry = entry;
+    }
+
+    // The entry stays in memory for the rest of the session.
+    if (oldestEntry)
+        PhpDeleteVerifyCacheRecord(oldestEntry);
+}
+
+static VOID PhpWriteVerifyCacheRecord(
+    _Inout_ PPH_VERIFY_CACHE_ENTRY Entry
+    )
+{
+    PPH_VERIFY_CACHE_STORE_RECORD record;
+    SIZE_T fileNameLength;
+    SIZE_T signerNameLength;
+    ULONG rva;
+
+    if (!PhpVerifyCacheStore)
+        return;
+
+    fileNameLength = Entry->FileName->Length;
+    signerNameLength = Entry->VerifySignerName ? Entry->VerifySignerName->Length : 0;
+
+    if (fileNameLength + signerNameLength > MAXUSHORT)
+        return;
+
+    if (PhpVerifyCacheStoreIndex->Count >= PH_VERIFY_CACHE_STORE_MAXIMUM_ENTRIES)
+    {
+        PhpEvictVerifyCacheRecord();
+
+        if (PhpVerifyCacheStoreIndex->Count >= PH_VERIFY_CACHE_STORE_MAXIMUM_ENTRIES)
+            return;
+    }
+
+    record = PhAllocateFilePool(
+        PhpVerifyCacheStore,
+        (ULONG)(FIELD_OFFSET(PH_VERIFY_CACHE_STORE_RECORD, Buffer) + fileNameLength + signerNameLength),
+        &rva
+        );
+
+    if (!record)
+        return;
+
+    record->Key = Entry->Key;
+    record->VerifyTime = Entry->VerifyTime;
+    record->VerifyResult = Entry->VerifyResult;
+    record->FileNameLength = (USHORT)fileNameLength;
+    record->SignerNameLength = (USHORT)signerNameLength;
+    memcpy(record->Buffer, Entry->FileName->Buffer, fileNameLength);
+
+    if (signerNameLength != 0)
+        memcpy((PCHAR)record->Buffer + fileNameLength, Entry->VerifySignerName->Buffer, signerNameLength);
+
+    PhDereferenceFilePool(PhpVerifyCacheStore, record);
+
+    PhpVerifyCacheStoreIndex->Rvas[PhpVerifyCacheStoreIndex->Count++] = rva;
+    Entry->Rva = rva;
+}
+
+static VOID PhpRemoveVerifyCacheEntry(
+    _Inout_ PPH_VERIFY_CACHE_ENTRY Entry
+    )
+{
+    PhRemoveElementAvlTree(&PhpVerifyCacheSet, &Entry->Links);
+    PhpDeleteVerifyCacheRecord(Entry);
+
+    PhDereferenceObject(Entry->FileName);
+    PhClearReference(&Entry->VerifySignerName);
+    PhFree(Entry);
+}
+
+static SIZE_T PhpGetVerifyCacheEntrySize(
+    _In_ PPH_VERIFY_CACHE_ENTRY Entry
+    )
+{
+    SIZE_T size;
+
+    size = sizeof(PH_VERIFY_CACHE_ENTRY) + Entry->FileName->Length;
+
+    if (Entry->VerifySignerName)
+        size += Entry->VerifySignerName->Length;
+
+    return size;
+}
+
+static SIZE_T NTAPI PhpVerifyCacheQuerySize(
+    _In_opt_ PVOID Context
+    )
+{
+    PPH_AVL_LINKS links;
+    SIZE_T size = 0;
+
+    PhAcquireQueuedLockShared(&PhpVerifyCacheLock);
+
+    for (links = PhMinimumElementAvlTree(&PhpVerifyCacheSet); links; links = PhSuccessorElementAvlTree(links))
+        size += PhpGetVerifyCacheEntrySize(CONTAINING_RECORD(links, PH_VERIFY_CACHE_ENTRY, Links));
+
+    PhReleaseQueuedLockShared(&PhpVerifyCacheLock);
+
+    return size;
+}
+
+static int __cdecl PhpVerifyCacheEntryAgeCompare(
+    _In_ void *context,
+    _In_ const void *elem1,
+    _In_ const void *elem2
+    )
+{
+    ULONG currentTime = *(PULONG)context;
+    PPH_VERIFY_CACHE_ENTRY entry1 = *(PPH_VERIFY_CACHE_ENTRY *)elem1;
+    PPH_VERIFY_CACHE_ENTRY entry2 = *(PPH_VERIFY_CACHE_ENTRY *)elem2;
+
+    // Oldest first.
+    return -uintcmp(currentTime - entry1->LastUseTime, currentTime - entry2->LastUseTime);
+}
+
+static SIZE_T NTAPI PhpVerifyCacheTrim(
+    _In_ SIZE_T BytesToFree,
+    _In_opt_ PVOID Context
+    )
+{
+    PPH_AVL_LINKS links;
+    PPH_LIST entries;
+    PPH_VERIFY_CACHE_ENTRY entry;
+    ULONG currentTime;
+    SIZE_T bytesFreed = 0;
+    ULONG i;
+
+    PhAcquireQueuedLockExclusive(&PhpVerifyCacheLock);
+
+    entries = PhCreateList(PhpVerifyCacheSet.Count);
+
+    for (links = PhMinimumElementAvlTree(&PhpVerifyCacheSet); links; links = PhSuccessorElementAvlTree(links))
+        PhAddItemList(entries, CONTAINING_RECORD(links, PH_VERIFY_CACHE_ENTRY, Links));
+
+    currentTime = NtGetTickCount();
+    qsort_s(entries->Items, entries->Count, sizeof(PVOID), PhpVerifyCacheEntryAgeCompare, &currentTime);
+
+    for (i = 0; i < entries->Count && bytesFreed < BytesToFree; i++)
+    {
+        entry = entries->Items[i];
+        bytesFreed += PhpGetVerifyCacheEntrySize(entry);
+        PhpRemoveVerifyCacheEntry(entry);
+    }
+
+    PhReleaseQueuedLockExclusive(&PhpVerifyCacheLock);
+
+    PhDereferenceObject(entries);
+
+    return bytesFreed;
+}
+
+static VERIFY_RESULT PhpVerifyFileUncached(
+    _In_ PPH_STRING FileName,
+    _In_opt_ PWSTR PackageFullName,
+    _Out_ PPH_STRING *SignerName
+    )
+{
+    VERIFY_RESULT result;
+    PH_VERIFY_FILE_INFO info;
+
+    memset(&info, 0, sizeof(PH_VERIFY_FILE_INFO));
+    info.FileName = FileName->Buffer;
+    info.Flags = PH_VERIFY_PREVENT_NETWORK_ACCESS;
+    result = PhVerifyFileWithAdditionalCatalog(&info, PackageFullName, SignerName);
+
+    if (result != VrTrusted)
+        PhClearReference(SignerName);
+
+    return result;
+}
+
+static NTSTATUS PhpVerifyCacheRevalidateWorker(
+    _In_ PVOID Parameter
+    )
+{
+    PPH_LIST fileNames;
+    PPH_AVL_LINKS links;
+    PPH_VERIFY_CACHE_ENTRY entry;
+    PH_VERIFY_CACHE_ENTRY lookupEntry;
+    LARGE_INTEGER currentTime;
+    ULONG i;
+
+    fileNames = PhCreateList(16);
+    PhQuerySystemTime(&currentTime);
+
+    PhAcquireQueuedLockShared(&PhpVerifyCacheLock);
+
+    for (links = PhMinimumElementAvlTree(&PhpVerifyCacheSet); links; links = PhSuccessorElementAvlTree(links))
+    {
+        entry = CONTAINING_RECORD(links, PH_VERIFY_CACHE_ENTRY, Links);
+
+        if (entry->Rva != 0 && currentTime.QuadPart - entry->VerifyTime.QuadPart >= PH_VERIFY_CACHE_REVALIDATE_AGE)
+        {
+            PhReferenceObject(entry->FileName);
+            PhAddItemList(fileNames, entry->FileName);
+        }
+    }
+
+    PhReleaseQueuedLockShared(&PhpVerifyCacheLock);
+
+    for (i = 0; i < fileNames->Count; i++)
+    {
+        PPH_STRING fileName = fileNames->Items[i];
+        PH_FILE_CACHE_KEY key;
+        VERIFY_RESULT result = VrUnknown;
+        PPH_STRING signerName = NULL;
+        BOOLEAN haveKey;
+
+        haveKey = NT_SUCCESS(PhQueryFileCacheKey(fileName, &key));
+
+        if (haveKey)
+            result = PhpVerifyFileUncached(fileName, NULL, &signerName);
+
+        lookupEntry.FileName = fileName;
+
+        PhAcquireQueuedLockExclusive(&PhpVerifyCacheLock);
+
+        links = PhFindElementAvlTree(&PhpVerifyCacheSet, &lookupEntry.Links);
+
+        if (links)
+        {
+            entry = CONTAINING_RECORD(links, PH_VERIFY_CACHE_ENTRY, Links);
+
+            if (haveKey && result != VrUnknown)
+            {
+                entry->VerifyResult = result;
+                PhMoveReference(&entry->VerifySignerName, signerName);
+                signerName = NULL;
+                entry->Key = key;
+                entry->VerifyTime = currentTime;
+                entry->Validated = TRUE;
+
+                PhpDeleteVerifyCacheRecord(entry);
+                PhpWriteVerifyCacheRecord(entry);
+            }
+            else
+            {
+                // The file is gone or can no longer be verified.
+                PhpRemoveVerifyCacheEntry(entry);
+            }
+        }
+
+        PhReleaseQueuedLockExclusive(&PhpVerifyCacheLock);
+
+        if (signerName)
+            PhDereferenceObject(signerName);
+
+        PhDereferenceObject(fileName);
+    }
+
+    PhDereferenceObject(fileNames);
+
+    return STATUS_SUCCESS;
+}
+
+static VOID PhpLoadVerifyCacheStore(
+    VOID
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < PhpVerifyCacheStoreIndex->Count; i++)
+    {
+        ULONG rva = PhpVerifyCacheStoreIndex->Rvas[i];
+        PPH_VERIFY_CACHE_STORE_RECORD record;
+        PPH_VERIFY_CACHE_ENTRY entry;
+
+        if (!(record = PhReferenceFilePoolByRva(PhpVerifyCacheStore, rva)))
+            continue;
+
+        entry = PhAllocate(sizeof(PH_VERIFY_CACHE_ENTRY));
+        entry->FileName = PhCreateStringEx(record->Buffer, record->FileNameLength);
+        entry->VerifyResult = record->VerifyResult;
+
+        if (record->SignerNameLength != 0)
+            entry->VerifySignerName = PhCreateStringEx((PWCHAR)((PCHAR)record->Buffer + record->FileNameLength), record->SignerNameLength);
+        else
+            entry->VerifySignerName = NULL;
+
+        entry->Key = record->Key;
+        entry->VerifyTime = record->VerifyTime;
+        entry->Rva = rva;
+        entry->Validated = FALSE;
+        entry->LastUseTime = NtGetTickCount();
+
+        PhDereferenceFilePoolByRva(PhpVerifyCacheStore, rva);
+
+        if (PhAddElementAvlTree(&PhpVerifyCacheSet, &entry->Links))
+        {
+            // Duplicate record; drop it.
+            entry->Rva = 0;
+            PhDereferenceObject(entry->FileName);
+            PhClearReference(&entry->VerifySignerName);
+            PhFree(entry);
+
+            PhFreeFilePoolByRva(PhpVerifyCacheStore, rva);
+            PhpVerifyCacheStoreIndex->Count--;
+            PhpVerifyCacheStoreIndex->Rvas[i] = PhpVerifyCacheStoreIndex->Rvas[PhpVerifyCacheStoreIndex->Count];
+            PhpVerifyCacheStoreIndex->Rvas[PhpVerifyCacheStoreIndex->Count] = 0;
+            i--;
+        }
+    }
+}
+
+#endif
+
+VOID PhVerifyCacheInitialization(
+    VOID
+    )
+{
+#ifdef PH_ENABLE_VERIFY_CACHE
+    PhRegisterMemoryBudgetClient(
+        &PhpVerifyCacheBudgetClient,
+        L"Signature verification cache",
+        PhpVerifyCacheQuerySize,
+        PhpVerifyCacheTrim,
+        NULL
+        );
+#endif
+}
+
+/**
+ * Opens a file which stores verification results across sessions.
+ *
+ * \param FileName The file name of the store. The file is created if it
+ * does not exist, and is recreated if it is not a valid store.
+ */
+VOID PhOpenVerifyCacheStore(
+    _In_ PWSTR FileName
+    )
+{
+#ifdef PH_ENABLE_VERIFY_CACHE
+    NTSTATUS status;
+    PPH_FILE_POOL pool;
+    ULONGLONG userContext;
+    ULONG indexRva;
+    PPH_VERIFY_CACHE_STORE_INDEX index = NULL;
+
+    status = PhCreateFilePool2(&pool, FileName, FALSE, 0, FILE_OPEN_IF, NULL);
+
+    if (status == STATUS_BAD_FILE_TYPE || status == STATUS_FILE_CORRUPT_ERROR)
+    {
+        // Not a file pool, an incompatible one, or one that was not closed properly.
+        status = PhCreateFilePool2(&pool, FileName, FALSE, 0, FILE_OVERWRITE_IF, NULL);
+    }
+
+    if (!NT_SUCCESS(status))
+        return;
+
+    PhGetUserContextFilePool(pool, &userContext);
+    indexRva = (ULONG)userContext;
+
+    if (indexRva != 0)
+    {
+        index = PhReferenceFilePoolByRva(pool, indexRva);
+
+        if (index && (index->Magic != PH_VERIFY_CACHE_STORE_MAGIC || index->Version != PH_VERIFY_CACHE_STORE_VERSION ||
+            index->Count > PH_VERIFY_CACHE_STORE_MAXIMUM_ENTRIES))
+        {
+            PhDereferenceFilePool(pool, index);
+            index = NULL;
+
+            // Start over with an empty store.
+            PhDestroyFilePool(pool);
+
+            if (!NT_SUCCESS(PhCreateFilePool2(&pool, FileName, FALSE, 0, FILE_OVERWRITE_IF, NULL)))
+                return;
+        }
+    }
+
+    if (!index)
+    {
+        index = PhAllocateFilePool(pool, sizeof(PH_VERIFY_CACHE_STORE_INDEX), &indexRva);
+
+        if (!index)
+        {
+            PhDestroyFilePool(pool);
+            return;
+        }
+
+        memset(index, 0, sizeof(PH_VERIFY_CACHE_STORE_INDEX));
+        index->Magic = PH_VERIFY_CACHE_STORE_MAGIC;
+        index->Version = PH_VERIFY_CACHE_STORE_VERSION;
+
+        userContext = indexRva;
+        PhSetUserContextFilePool(pool, &userContext);
+    }
+
+    PhAcquireQueuedLockExclusive(&PhpVerifyCacheLock);
+
+    if (!PhpVerifyCacheStore)
+    {
+        PhpVerifyCacheStore = pool;
+        PhpVerifyCacheStoreIndex = index;
+        PhpLoadVerifyCacheStore();
+        pool = NULL;
+    }
+
+    PhReleaseQueuedLockExclusive(&PhpVerifyCacheLock);
+
+    if (pool)
+    {
+        // Someone else opened a store first.
+        PhDereferenceFilePool(pool, index);
+        PhDestroyFilePool(pool);
+        return;
+    }
+
+    PhQueueItemGlobalWorkQueue(PhpVerifyCacheRevalidateWorker, NULL);
+#endif
+}
+
+/**
+ * Closes the verification result store. Results remain cached in memory.
+ */
+VOID PhCloseVerifyCacheStore(
+    VOID
+    )
+{
+#ifdef PH_ENABLE_VERIFY_CACHE
+    PPH_AVL_LINKS links;
+
+    PhAcquireQueuedLockExclusive(&PhpVerifyCacheLock);
+
+    if (PhpVerifyCacheStore)
+    {
+        for (links = PhMinimumElementAvlTree(&PhpVerifyCacheSet); links; links = PhSuccessorElementAvlTree(links))
+            CONTAINING_RECORD(links, PH_VERIFY_CACHE_ENTRY, Links)->Rva = 0;
+
+        PhDereferenceFilePool(PhpVerifyCacheStore, PhpVerifyCacheStoreIndex);
+        PhCommitFilePool(PhpVerifyCacheStore);
+        PhDestroyFilePool(PhpVerifyCacheStore);
+        PhpVerifyCacheStore = NULL;
+        PhpVerifyCacheStoreIndex = NULL;
+    }
+
+    PhReleaseQueuedLockExclusive(&PhpVerifyCacheLock);
+#endif
+}
+
+/**
+ * Verifies a file's digital signature, using a cached
+ * result if possible.
+ *
+ * \param FileName A file name.
+ * \param ProcessItem An associated process item.
+ * \param SignerName A variable which receives a pointer
+ * to a string containing the signer name. You must free
+ * the string using PhDereferenceObject() when you no
+ * longer need it. Note that the signer name may be NULL
+ * if it is not valid.
+ * \param CachedOnly Specify TRUE to fail the function when
+ * no cached result exists.
+ *
+ * \return A VERIFY_RESULT value.
+ */
+VERIFY_RESULT PhVerifyFileCached(
+    _In_ PPH_STRING FileName,
+    _In_opt_ PWSTR PackageFullName,
+    _Out_opt_ PPH_STRING *SignerName,
+    _In_ BOOLEAN CachedOnly
+    )
+{
+#ifdef PH_ENABLE_VERIFY_CACHE
+    PPH_AVL_LINKS links;
+    PPH_VERIFY_CACHE_ENTRY entry;
+    PH_VERIFY_CACHE_ENTRY lookupEntry;
+    VERIFY_RESULT result;
+    PPH_STRING signerName;
+    PH_FILE_CACHE_KEY key;
+    BOOLEAN found = FALSE;
+    BOOLEAN validated = FALSE;
+    BOOLEAN haveKey;
+
+    lookupEntry.FileName = FileName;
+
+    PhAcquireQueuedLockShared(&PhpVerifyCacheLock);
+
+    links = PhFindElementAvlTree(&PhpVerifyCacheSet, &lookupEntry.Links);
+
+    if (links)
+    {
+        entry = CONTAINING_RECORD(links, PH_VERIFY_CACHE_ENTRY, Links);
+
+        // Entries can be updated or removed by other threads, so take a copy of the result.
+        found = TRUE;
+        validated = entry->Validated;
+        entry->LastUseTime = NtGetTickCount();
+        result = entry->VerifyResult;
+        key = entry->Key;
+
+        if (signerName = entry->VerifySignerName)
+            PhReferenceObject(signerName);
+    }
+
+    PhReleaseQueuedLockShared(&PhpVerifyCacheLock);
+
+    if (found && !validated)
+    {
+        PH_FILE_CACHE_KEY currentKey;
+        BOOLEAN valid;
+
+        // This result was loaded from the store. Only use it if the file hasn't changed since.
+        valid = NT_SUCCESS(PhQueryFileCacheKey(FileName, &currentKey)) &&
+            RtlEqualMemory(&currentKey, &key, sizeof(PH_FILE_CACHE_KEY));
+
+        PhAcquireQueuedLockExclusive(&PhpVerifyCacheLock);
+
+        links = PhFindElementAvlTree(&PhpVerifyCacheSet, &lookupEntry.Links);
+
+        if (links)
+        {
+            entry = CONTAINING_RECORD(links, PH_VERIFY_CACHE_ENTRY, Links);
+
+            if (valid)
+                entry->Validated = TRUE;
+            else if (!entry->Validated)
+                PhpRemoveVerifyCacheEntry(entry);
+        }
+
+        PhReleaseQueuedLockExclusive(&PhpVerifyCacheLock);
+
+        if (!valid)
+        {
+            PhClearReference(&signerName);
+            found = FALSE;
+        }
+    }
+
+    if (found)
+    {
+        if (SignerName)
+            *SignerName = signerName;
+        else if (signerName)
+            PhDereferenceObject(signerName);
+
+        return result;
+    }
+
+    if (!CachedOnly)
+    {
+        // Get the key before verifying so that a change during verification invalidates the result.
+        haveKey = NT_SUCCESS(PhQueryFileCacheKey(FileName, &key));
+        result = PhpVerifyFileUncached(FileName, PackageFullName, &signerName);
+    }
+    else
+    {
+        haveKey = FALSE;
+        result = VrUnknown;
+        signerName = NULL;
+    }
+
+    if (result != VrUnknown)
+    {
+        entry = PhAllocate(sizeof(PH_VERIFY_CACHE_ENTRY));
+        entry->FileName = FileName;
+        entry->VerifyResult = result;
+        entry->VerifySignerName = signerName;
+        memset(&entry->Key, 0, sizeof(PH_FILE_CACHE_KEY));
+        PhQuerySystemTime(&entry->VerifyTime);
+        entry->Rva = 0;
+        entry->Validated = TRUE;
+        entry->LastUseTime = NtGetTickCount();
+
+        if (haveKey)
+            entry->Key = key;
+
+        PhAcquireQueuedLockExclusive(&PhpVerifyCacheLock);
+
+        links = PhAddElementAvlTree(&PhpVerifyCacheSet, &entry->Links);
+
+        if (!links)
+        {
+            // We successfully added the cache entry. Add references.
+
+            PhReferenceObject(entry->FileName);
+
+            if (entry->VerifySignerName)
+                PhReferenceObject(entry->VerifySignerName);
+
+            // Packaged files are verified against a catalog from the package, so their results
+            // depend on more than the file itself. Keep those in memory only.
+            if (haveKey && !PackageFullName)
+                PhpWriteVerifyCacheRecord(entry);
+        }
+
+        PhReleaseQueuedLockExclusive(&PhpVerifyCacheLock);
+
+        if (links)
+        {
+            // Entry already exists.
+            PhFree(entry);
+        }
+    }
+
+    if (SignerName)
+    {
+        *SignerName = signerName;
+    }
+    else
+    {
+        if (signerName)
+            PhDereferenceObject(signerName);
+    }
+
+    return result;
+#else
+    VERIFY_RESULT result;
+    PPH_STRING signerName;
+    PH_VERIFY_FILE_INFO info;
+
+    memset(&info, 0, sizeof(PH_VERIFY_FILE_INFO));
+    info.FileName = FileName->Buffer;
+    info.Flags = PH_VERIFY_PREVENT_NETWORK_ACCESS;
+    result = PhVerifyFileWithAdditionalCatalog(&info, PackageFullName, &signerName);
+
+    if (result != VrTrusted)
+        PhClearReference(&signerName);
+
+    if (SignerName)
+        *SignerName = signerName;
+    else if (signerName)
+        PhDereferenceObject(signerName);
+
+    return result;
+#endif
+}
@@ -62,3 +62,9 @@ PH_DEFINE_IMPORT(L"ntdll.dll", NtQueryInformationEnlistment);
 PH_DEFINE_IMPORT(L"ntdll.dll", NtQueryInformationResourceManager);
 PH_DEFINE_IMPORT(L"ntdll.dll", NtQueryInformationTransaction);
 PH_DEFINE_IMPORT(L"ntdll.dll", NtQueryInformationTransactionManager);
+PH_DEFINE_IMPORT(L"ntdll.dll", NtQuerySystemInformationEx);
+PH_DEFINE_IMPORT(L"ntdll.dll", NtSetTimerEx);
+
+PH_DEFINE_IMPORT(L"ntdll.dll", EtwEventRegister);
+PH_DEFINE_IMPORT(L"ntdll.dll", EtwEventSetInformation);
+PH_DEFINE_IMPORT(L"ntdll.dll", EtwEventWriteTransfer);
@@ -0,0 +1,329 @@
+/*
+ * Process Hacker -
+ *   page arena
+ *
+ * Copyright (C) 2016 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * An arena packs long-lived buffers that are swept on every update (e.g. histories and
+ * snapshots) into a small number of large regions, so that they are spread over fewer TLB
+ * entries than the same buffers on the heap.
+ *
+ * If PH_ARENA_LARGE_PAGES is specified and SeLockMemoryPrivilege can be enabled, each region is
+ * a single large page. Otherwise, a region of PH_ARENA_REGION_SIZE bytes is reserved and
+ * committed PH_ARENA_COMMIT_SIZE bytes at a time. Blocks are rounded up to a power of two and
+ * carved out of the current region; freed blocks are kept on a free list for their size and
+ * are reused before new blocks are carved. Regions are only released when the arena is deleted.
+ *
+ * Blocks larger than PH_ARENA_MAXIMUM_BLOCK_SIZE get pages of their own, on large pages if
+ * the block fills at least half of one.
+ */
+
+#include <ph.h>
+
+#define PH_ARENA_REGION_SIZE (1024 * 1024)
+#define PH_ARENA_COMMIT_SIZE (64 * 1024)
+
+static ULONG PhpGetArenaClass(
+    _In_ SIZE_T Size
+    )
+{
+    ULONG shift;
+
+    shift = PH_ARENA_MINIMUM_BLOCK_SHIFT;
+
+    while (((SIZE_T)1 << shift) < Size)
+        shift++;
+
+    return shift - PH_ARENA_MINIMUM_BLOCK_SHIFT;
+}
+
+static PVOID PhpAllocateLargePages(
+    _In_ SIZE_T Size
+    )
+{
+    PVOID baseAddress;
+
+    baseAddress = NULL;
+
+    if (NT_SUCCESS(NtAllocateVirtualMemory(
+        NtCurrentProcess(),
+        &baseAddress,
+        0,
+        &Size,
+        MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES,
+        PAGE_READWRITE
+        )))
+    {
+        return baseAddress;
+    }
+    else
+    {
+        return NULL;
+    }
+}
+
+/**
+ * Initializes an arena.
+ *
+ * \param Arena The arena.
+ * \param Flags A combination of flags.
+ * \li \c PH_ARENA_LARGE_PAGES Use large pages if the process can enable SeLockMemoryPrivilege.
+ */
+VOID NTAPI PhInitializeArena(
+    _Out_ PPH_ARENA Arena,
+    _In_ ULONG Flags
+    )
+{
+    memset(Arena, 0, sizeof(PH_ARENA));
+    PhInitializeQueuedLock(&Arena->Lock);
+
+    if (Flags & PH_ARENA_LARGE_PAGES)
+    {
+        HANDLE tokenHandle;
+
+        Flags &= ~PH_ARENA_LARGE_PAGES;
+        Arena->LargePageSize = GetLargePageMinimum();
+
+        if (Arena->LargePageSize != 0 && NT_SUCCESS(PhOpenProcessToken(
+            &tokenHandle,
+            TOKEN_ADJUST_PRIVILEGES,
+            NtCurrentProcess()
+            )))
+        {
+            if (PhSetTokenPrivilege2(tokenHandle, SE_LOCK_MEMORY_PRIVILEGE, SE_PRIVILEGE_ENABLED))
+                Flags |= PH_ARENA_LARGE_PAGES;
+
+            NtClose(tokenHandle);
+        }
+    }
+
+    Arena->Flags = Flags;
+}
+
+/**
+ * Frees the regions of an arena.
+ *
+ * \param Arena The arena.
+ *
+ * \remarks Blocks larger than PH_ARENA_MAXIMUM_BLOCK_SIZE are not owned by the arena, and must
+ * be freed separately.
+ */
+VOID NTAPI PhDeleteArena(
+    _Inout_ PPH_ARENA Arena
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < Arena->NumberOfRegions; i++)
+        PhFreePage(Arena->Regions[i]);
+
+    if (Arena->Regions)
+        PhFree(Arena->Regions);
+}
+
+static BOOLEAN PhpAllocateArenaRegion(
+    _Inout_ PPH_ARENA Arena
+    )
+{
+    PVOID baseAddress;
+    SIZE_T regionSize;
+    SIZE_T commitSize;
+
+    baseAddress = NULL;
+
+    if (Arena->Flags & PH_ARENA_LARGE_PAGES)
+    {
+        regionSize = Arena->LargePageSize;
+        baseAddress = PhpAllocateLargePages(regionSize);
+
+        // Large pages are hard to find once physical memory is fragmented, so we don't keep
+        // trying.
+        if (!baseAddress)
+            Arena->Flags &= ~PH_ARENA_LARGE_PAGES;
+        else
+            commitSize = regionSize;
+    }
+
+    if (!baseAddress)
+    {
+        regionSize = PH_ARENA_REGION_SIZE;
+
+        if (!NT_SUCCESS(NtAllocateVirtualMemory(
+            NtCurrentProcess(),
+            &baseAddress,
+            0,
+            &regionSize,
+            MEM_RESERVE,
+            PAGE_READWRITE
+            )))
+        {
+            return FALSE;
+        }
+
+        commitSize = 0;
+    }
+
+    if (Arena->NumberOfRegions == Arena->AllocatedRegions)
+    {
+        Arena->AllocatedRegions = Arena->AllocatedRegions ? Arena->AllocatedRegions * 2 : 8;
+        Arena->Regions = PhReAllocate(Arena->Regions, sizeof(PVOID) * Arena->AllocatedRegions);
+    }
+
+    Arena->Regions[Arena->NumberOfRegions++] = baseAddress;
+
+    // Whatever is left of the previous region is abandoned.
+    Arena->NextBlock = baseAddress;
+    Arena->EndOfCommit = (PUCHAR)baseAddress + commitSize;
+    Arena->EndOfRegion = (PUCHAR)baseAddress + regionSize;
+
+    return TRUE;
+}
+
+/**
+ * Allocates a block of memory from an arena.
+ *
+ * \param Arena The arena.
+ * \param Size The number of bytes to allocate.
+ * \param NewSize A variable which receives the number of usable bytes in the block.
+ *
+ * \return A pointer to the block, or NULL if the block could not be allocated. The block is
+ * not initialized.
+ *
+ * \remarks Blocks larger than PH_ARENA_MAXIMUM_BLOCK_SIZE are separate page allocations, and
+ * can also be freed using PhFreePage().
+ */
+_Check_return_
+_Ret_maybenull_
+PVOID NTAPI PhAllocateArena(
+    _Inout_ PPH_ARENA Arena,
+    _In_ SIZE_T Size,
+    _Out_opt_ PSIZE_T NewSize
+    )
+{
+    PVOID block;
+    ULONG blockClass;
+    SIZE_T blockSize;
+
+    if (Size > PH_ARENA_MAXIMUM_BLOCK_SIZE)
+    {
+        // A large page is only worth it if the block would fill at least half of it.
+        if ((Arena->Flags & PH_ARENA_LARGE_PAGES) && Size >= Arena->LargePageSize / 2)
+        {
+            blockSize = ALIGN_UP_BY(Size, Arena->LargePageSize);
+
+            if (block = PhpAllocateLargePages(blockSize))
+            {
+                if (NewSize)
+                    *NewSize = blockSize;
+
+                return block;
+            }
+        }
+
+        return PhAllocatePage(Size, NewSize);
+    }
+
+    blockClass = PhpGetArenaClass(Size);
+    blockSize = (SIZE_T)1 << (blockClass + PH_ARENA_MINIMUM_BLOCK_SHIFT);
+
+    PhAcquireQueuedLockExclusive(&Arena->Lock);
+
+    if (block = Arena->FreeLists[blockClass])
+    {
+        Arena->FreeLists[blockClass] = *(PVOID *)block;
+    }
+    else
+    {
+        if (
+            (SIZE_T)(Arena->EndOfRegion - Arena->NextBlock) < blockSize &&
+            !PhpAllocateArenaRegion(Arena)
+            )
+        {
+            PhReleaseQueuedLockExclusive(&Arena->Lock);
+            return NULL;
+        }
+
+        if ((SIZE_T)(Arena->EndOfCommit - Arena->NextBlock) < blockSize)
+        {
+            PVOID baseAddress;
+            SIZE_T commitSize;
+
+            baseAddress = Arena->EndOfCommit;
+            commitSize = PH_ARENA_COMMIT_SIZE;
+
+            if (!NT_SUCCESS(NtAllocateVirtualMemory(
+                NtCurrentProcess(),
+                &baseAddress,
+                0,
+                &commitSize,
+                MEM_COMMIT,
+                PAGE_READWRITE
+                )))
+            {
+                PhReleaseQueuedLockExclusive(&Arena->Lock);
+                return NULL;
+            }
+
+            Arena->EndOfCommit += commitSize;
+        }
+
+        block = Arena->NextBlock;
+        Arena->NextBlock += blockSize;
+    }
+
+    PhReleaseQueuedLockExclusive(&Arena->Lock);
+
+    if (NewSize)
+        *NewSize = blockSize;
+
+    return block;
+}
+
+/**
+ * Frees a block of memory allocated with PhAllocateArena().
+ *
+ * \param Arena The arena.
+ * \param Memory A pointer to the block.
+ * \param Size The size that was passed to PhAllocateArena(), or the size that it returned.
+ */
+VOID NTAPI PhFreeArena(
+    _Inout_ PPH_ARENA Arena,
+    _Frees_ptr_opt_ PVOID Memory,
+    _In_ SIZE_T Size
+    )
+{
+    ULONG blockClass;
+
+    if (!Memory)
+        return;
+
+    if (Size > PH_ARENA_MAXIMUM_BLOCK_SIZE)
+    {
+        PhFreePage(Memory);
+        return;
+    }
+
+    blockClass = PhpGetArenaClass(Size);
+
+    PhAcquireQueuedLockExclusive(&Arena->Lock);
+    *(PVOID *)Memory = Arena->FreeLists[blockClass];
+    Arena->FreeLists[blockClass] = Memory;
+    PhReleaseQueuedLockExclusive(&Arena->Lock);
+}
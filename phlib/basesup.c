@@ -23,9 +23,9 @@
 /*
  * This file contains basic low-level code as well as general algorithms and data structures.
  *
- * Memory allocation. PhAllocate is a wrapper around RtlAllocateHeap, and always allocates
- * from the phlib heap. PhAllocatePage is a wrapper around NtAllocateVirtualMemory and allocates
- * pages.
+ * Memory allocation. PhAllocate is a wrapper around RtlAllocateHeap, and allocates from the
+ * phlib heap. If the slab allocator is enabled, small blocks are allocated from it instead (see
+ * slab.c). PhAllocatePage is a wrapper around NtAllocateVirtualMemory and allocates pages.
  *
  * Null-terminated strings. The Ph*StringZ functions manipulate null-terminated strings. The
  * copying functions provide a simple way to copy strings which may not be null-terminated, but
@@ -64,11 +64,13 @@
 
 #include <phbase.h>
 #include <phintrnl.h>
+#include <slabp.h>
 #include <math.h>
 
 #define PH_VECTOR_LEVEL_NONE 0
 #define PH_VECTOR_LEVEL_SSE2 1
 #define PH_VECTOR_LEVEL_AVX 2
+#define PH_VECTOR_LEVEL_AVX2 3
 
 typedef struct _PHP_BASE_THREAD_CONTEXT
 {
@@ -96,6 +98,11 @@ VOID NTAPI PhpHashtableDeleteProcedure(
     _In_ ULONG Flags
     );
 
+VOID NTAPI PhpFlatHashtableDeleteProcedure(
+    _In_ PVOID Object,
+    _In_ ULONG Flags
+    );
+
 // Types
 
 PPH_OBJECT_TYPE PhStringType;
@@ -103,12 +110,18 @@ PPH_OBJECT_TYPE PhBytesType;
 PPH_OBJECT_TYPE PhListType;
 PPH_OBJECT_TYPE PhPointerListType;
 PPH_OBJECT_TYPE PhHashtableType;
+PPH_OBJECT_TYPE PhFlatHashtableType;
 
 // Misc.
 
 static BOOLEAN PhpVectorLevel = PH_VECTOR_LEVEL_NONE;
+static ULONG64 PhpHashSeed;
 static PPH_STRING PhSharedEmptyString = NULL;
 
+static PH_INITONCE PhpInternInitOnce = PH_INITONCE_INIT;
+static PPH_HASHTABLE PhpInternHashtable;
+static PH_QUEUED_LOCK PhpInternLock = PH_QUEUED_LOCK_INIT;
+
 // Threads
 
 static PH_FREE_LIST PhpBaseThreadContextFreeList;
@@ -132,6 +145,21 @@ static ULONG PhpPrimeNumbers[] =
     0x3f928f, 0x4c4987, 0x5b8b6f, 0x6dda89
 };
 
+FORCEINLINE ULONG64 PhpHashMix64(
+    _In_ ULONG64 Value
+    )
+{
+    // MurmurHash3 finalizer.
+
+    Value ^= Value >> 33;
+    Value *= 0xff51afd7ed558ccd;
+    Value ^= Value >> 33;
+    Value *= 0xc4ceb9fe1a85ec53;
+    Value ^= Value >> 33;
+
+    return Value;
+}
+
 /**
  * Initializes the base support module.
  */
@@ -140,13 +168,34 @@ BOOLEAN PhInitializeBase(
     )
 {
     PH_OBJECT_TYPE_PARAMETERS parameters;
+    LARGE_INTEGER performanceCounter;
+
+    // Hash codes are never persisted, so they can be seeded differently in each process.
+    // This makes it harder to construct inputs that collide.
+    NtQueryPerformanceCounter(&performanceCounter, NULL);
+    PhpHashSeed = PhpHashMix64((ULONG64)performanceCounter.QuadPart ^ ((ULONG64)HandleToUlong(NtCurrentProcessId()) << 32) ^ (ULONG_PTR)&parameters);
+
+    if (USER_SHARED_DATA->ProcessorFeatures[PF_XMMI64_INSTRUCTIONS_AVAILABLE])
+        PhpVectorLevel = PH_VECTOR_LEVEL_SSE2;
 
     // The following relies on the (technically undefined) value of XState being zero before Windows 7 SP1.
-    // NOTE: This is unused for now.
-    /*if (USER_SHARED_DATA->XState.EnabledFeatures & XSTATE_MASK_AVX)
+    if (PhpVectorLevel >= PH_VECTOR_LEVEL_SSE2 && (USER_SHARED_DATA->XState.EnabledFeatures & XSTATE_MASK_AVX))
+    {
+        INT cpuInfo[4];
+
         PhpVectorLevel = PH_VECTOR_LEVEL_AVX;
-    else*/ if (USER_SHARED_DATA->ProcessorFeatures[PF_XMMI64_INSTRUCTIONS_AVAILABLE])
-        PhpVectorLevel = PH_VECTOR_LEVEL_SSE2;
+
+        // AVX2 support is reported in CPUID leaf 7.
+        __cpuid(cpuInfo, 0);
+
+        if (cpuInfo[0] >= 7)
+        {
+            __cpuidex(cpuInfo, 7, 0);
+
+            if (cpuInfo[1] & 0x20)
+                PhpVectorLevel = PH_VECTOR_LEVEL_AVX2;
+        }
+    }
 
     PhStringType = PhCreateObjectType(L"String", 0, NULL);
     PhBytesType = PhCreateObjectType(L"Bytes", 0, NULL);
@@ -161,9 +210,14 @@ BOOLEAN PhInitializeBase(
     parameters.FreeListCount = 64;
 
     PhHashtableType = PhCreateObjectTypeEx(L"Hashtable", PH_OBJECT_TYPE_USE_FREE_LIST, PhpHashtableDeleteProcedure, &parameters);
+    PhFlatHashtableType = PhCreateObjectType(L"FlatHashtable", 0, PhpFlatHashtableDeleteProcedure);
 
     PhInitializeFreeList(&PhpBaseThreadContextFreeList, sizeof(PHP_BASE_THREAD_CONTEXT), 16);
 
+    // Blocks which were allocated before this point are on the heap, and remain valid.
+    if (Flags & PHLIB_INIT_SLAB_ALLOCATOR)
+        PhSlabInitialization();
+
 #ifdef DEBUG
     PhDbgThreadDbgTlsIndex = TlsAlloc();
     InitializeListHead(&PhDbgThreadListHead);
@@ -217,6 +271,8 @@ NTSTATUS PhpBaseThreadStart(
     if (result == S_OK || result == S_FALSE)
         CoUninitialize();
 
+    PhSlabFlushThreadCache();
+
 #ifdef DEBUG
     PhAcquireQueuedLockExclusive(&PhDbgThreadListLock);
     RemoveEntryList(&dbg.ListEntry);
@@ -362,6 +418,13 @@ PVOID PhAllocate(
     _In_ SIZE_T Size
     )
 {
+    PVOID memory;
+
+    PHLIB_INC_STATISTIC(BaseAllocations);
+
+    if (PhSlabEnabled && Size <= PH_SLAB_MAXIMUM_SIZE && (memory = PhSlabAllocate(Size)))
+        return memory;
+
     return RtlAllocateHeap(PhHeapHandle, HEAP_GENERATE_EXCEPTIONS, Size);
 }
 
@@ -377,6 +440,13 @@ PVOID PhAllocateSafe(
     _In_ SIZE_T Size
     )
 {
+    PVOID memory;
+
+    PHLIB_INC_STATISTIC(BaseAllocations);
+
+    if (PhSlabEnabled && Size <= PH_SLAB_MAXIMUM_SIZE && (memory = PhSlabAllocate(Size)))
+        return memory;
+
     return RtlAllocateHeap(PhHeapHandle, 0, Size);
 }
 
@@ -394,6 +464,18 @@ PVOID PhAllocateExSafe(
     _In_ ULONG Flags
     )
 {
+    PVOID memory;
+
+    PHLIB_INC_STATISTIC(BaseAllocations);
+
+    if (PhSlabEnabled && Size <= PH_SLAB_MAXIMUM_SIZE && (memory = PhSlabAllocate(Size)))
+    {
+        if (Flags & HEAP_ZERO_MEMORY)
+            memset(memory, 0, Size);
+
+        return memory;
+    }
+
     return RtlAllocateHeap(PhHeapHandle, Flags, Size);
 }
 
@@ -407,7 +489,40 @@ VOID PhFree(
     _Frees_ptr_opt_ PVOID Memory
     )
 {
-    RtlFreeHeap(PhHeapHandle, 0, Memory);
+    if (PhIsSlabBlock(Memory))
+        PhSlabFree(Memory);
+    else
+        RtlFreeHeap(PhHeapHandle, 0, Memory);
+}
+
+static PVOID PhpReAllocateSlabBlock(
+    _In_ PVOID Memory,
+    _In_ SIZE_T Size,
+    _In_ BOOLEAN Safe
+    )
+{
+    SIZE_T blockSize;
+    PVOID newMemory;
+
+    blockSize = PhSlabGetBlockSize(Memory);
+
+    if (Size <= blockSize)
+        return Memory;
+
+    if (Safe)
+    {
+        if (!(newMemory = PhAllocateSafe(Size)))
+            return NULL;
+    }
+    else
+    {
+        newMemory = PhAllocate(Size);
+    }
+
+    memcpy(newMemory, Memory, blockSize);
+    PhSlabFree(Memory);
+
+    return newMemory;
 }
 
 /**
@@ -432,6 +547,11 @@ PVOID PhReAllocate(
     _In_ SIZE_T Size
     )
 {
+    PHLIB_INC_STATISTIC(BaseReAllocations);
+
+    if (PhIsSlabBlock(Memory))
+        return PhpReAllocateSlabBlock(Memory, Size, FALSE);
+
     return RtlReAllocateHeap(PhHeapHandle, HEAP_GENERATE_EXCEPTIONS, Memory, Size);
 }
 
@@ -453,6 +573,11 @@ PVOID PhReAllocateSafe(
     _In_ SIZE_T Size
     )
 {
+    PHLIB_INC_STATISTIC(BaseReAllocations);
+
+    if (PhIsSlabBlock(Memory))
+        return PhpReAllocateSlabBlock(Memory, Size, TRUE);
+
     return RtlReAllocateHeap(PhHeapHandle, 0, Memory, Size);
 }
 
@@ -1134,6 +1259,253 @@ LONG PhCompareStringZNatural(
         return PhpCompareStringZNatural(A, B, TRUE);
 }
 
+/**
+ * Creates a sort key for a string. Comparing two keys with
+ * PhCompareNaturalSortKey() gives the same order as comparing the strings
+ * with PhCompareStringZNatural().
+ *
+ * \param String The string.
+ * \param IgnoreCase Whether to ignore character cases.
+ *
+ * \remarks The key is a sequence of big-endian 16-bit units. Spaces are
+ * dropped and every other character is stored as is (upcased if
+ * \a IgnoreCase is TRUE). A run of digits starting with '0' is stored as
+ * '0', followed by the digits and a 0 terminator, so that such runs compare
+ * digit by digit. Any other run is stored as '1', followed by the number of
+ * digits and then the digits, so that longer runs compare greater. Both
+ * markers sort between the characters before and after the digits, just like
+ * the digits themselves.
+ */
+PPH_BYTES PhCreateNaturalSortKey(
+    _In_ PPH_STRINGREF String,
+    _In_ BOOLEAN IgnoreCase
+    )
+{
+    PPH_BYTES key;
+    PWCHAR buffer;
+    SIZE_T count;
+    SIZE_T i;
+    SIZE_T j;
+    SIZE_T runStart;
+    WCHAR c;
+
+    count = String->Length / sizeof(WCHAR);
+    buffer = String->Buffer;
+
+    // Each character needs at most 3 units (e.g. "1" becomes '1', 1, '1').
+    key = PhCreateBytesEx(NULL, count * 3 * sizeof(USHORT));
+    j = 0;
+
+#define PHP_EMIT_SORT_KEY_UNIT(Unit) \
+    do { \
+        key->Buffer[j++] = (CHAR)((USHORT)(Unit) >> 8); \
+        key->Buffer[j++] = (CHAR)(Unit); \
+    } while (0)
+
+    for (i = 0; i < count; )
+    {
+        c = buffer[i];
+
+        if (c == ' ')
+        {
+            i++;
+            continue;
+        }
+
+        if (PhIsDigitCharacter(c))
+        {
+            runStart = i;
+
+            while (i < count && PhIsDigitCharacter(buffer[i]))
+                i++;
+
+            if (c == '0')
+            {
+                PHP_EMIT_SORT_KEY_UNIT('0');
+
+                for (; runStart < i; runStart++)
+                    PHP_EMIT_SORT_KEY_UNIT(buffer[runStart]);
+
+                PHP_EMIT_SORT_KEY_UNIT(0);
+            }
+            else
+            {
+                PHP_EMIT_SORT_KEY_UNIT('1');
+                PHP_EMIT_SORT_KEY_UNIT(min(i - runStart, 0xffff));
+
+                for (; runStart < i; runStart++)
+                    PHP_EMIT_SORT_KEY_UNIT(buffer[runStart]);
+            }
+
+            continue;
+        }
+
+        if (IgnoreCase)
+            c = towupper(c);
+
+        PHP_EMIT_SORT_KEY_UNIT(c);
+        i++;
+    }
+
+#undef PHP_EMIT_SORT_KEY_UNIT
+
+    key->Length = j;
+    key->Buffer[j] = 0;
+
+    return key;
+}
+
+/**
+ * Compares two sort keys created by PhCreateNaturalSortKey().
+ *
+ * \param Key1 The first key.
+ * \param Key2 The second key.
+ */
+LONG PhCompareNaturalSortKey(
+    _In_ PPH_BYTES Key1,
+    _In_ PPH_BYTES Key2
+    )
+{
+    LONG result;
+
+    result = memcmp(Key1->Buffer, Key2->Buffer, min(Key1->Length, Key2->Length));
+
+    if (result == 0)
+        result = uintptrcmp(Key1->Length, Key2->Length);
+
+    return result;
+}
+
+/**
+ * Converts ASCII lowercase letters to uppercase. Other characters are not changed.
+ */
+FORCEINLINE __m128i PhpUpcaseAsciiBlock128(
+    _In_ __m128i Block
+    )
+{
+    __m128i lower;
+
+    lower = _mm_and_si128(
+        _mm_cmpgt_epi16(Block, _mm_set1_epi16(L'a' - 1)),
+        _mm_cmplt_epi16(Block, _mm_set1_epi16(L'z' + 1))
+        );
+
+    return _mm_sub_epi16(Block, _mm_and_si128(lower, _mm_set1_epi16(L'a' - L'A')));
+}
+
+FORCEINLINE __m256i PhpUpcaseAsciiBlock256(
+    _In_ __m256i Block
+    )
+{
+    __m256i lower;
+
+    lower = _mm256_and_si256(
+        _mm256_cmpgt_epi16(Block, _mm256_set1_epi16(L'a' - 1)),
+        _mm256_cmpgt_epi16(_mm256_set1_epi16(L'z' + 1), Block)
+        );
+
+    return _mm256_sub_epi16(Block, _mm256_and_si256(lower, _mm256_set1_epi16(L'a' - L'A')));
+}
+
+/**
+ * Determines if a block contains only ASCII characters.
+ */
+FORCEINLINE BOOLEAN PhpIsAsciiBlock128(
+    _In_ __m128i Block
+    )
+{
+    return _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(Block, _mm_set1_epi16(0xff80)), _mm_setzero_si128())) == 0xffff;
+}
+
+/**
+ * Locates the first character at which two buffers may differ.
+ *
+ * \param Buffer1 The first buffer.
+ * \param Buffer2 The second buffer.
+ * \param Count The number of characters to compare.
+ * \param IgnoreCase TRUE to ignore the case of ASCII letters, otherwise FALSE.
+ *
+ * \return The index of the first character that differs, or \a Count if the
+ * buffers are equal. When ignoring case, only ASCII letters are folded, so
+ * the caller must compare the character at the returned index itself.
+ */
+static SIZE_T PhpFindMismatch(
+    _In_reads_(Count) PWCHAR Buffer1,
+    _In_reads_(Count) PWCHAR Buffer2,
+    _In_ SIZE_T Count,
+    _In_ BOOLEAN IgnoreCase
+    )
+{
+    SIZE_T i;
+    ULONG mask;
+    ULONG index;
+
+    i = 0;
+
+    if (PhpVectorLevel >= PH_VECTOR_LEVEL_AVX2 && Count >= 16)
+    {
+        __m256i b1;
+        __m256i b2;
+
+        do
+        {
+            b1 = _mm256_loadu_si256((__m256i *)(Buffer1 + i));
+            b2 = _mm256_loadu_si256((__m256i *)(Buffer2 + i));
+
+            if (IgnoreCase)
+            {
+                b1 = PhpUpcaseAsciiBlock256(b1);
+                b2 = PhpUpcaseAsciiBlock256(b2);
+            }
+
+            mask = ~(ULONG)_mm256_movemask_epi8(_mm256_cmpeq_epi16(b1, b2));
+
+            if (_BitScanForward(&index, mask))
+            {
+                _mm256_zeroupper();
+                return i + index / sizeof(WCHAR);
+            }
+
+            i += 16;
+        } while (Count - i >= 16);
+
+        _mm256_zeroupper();
+    }
+
+    if (PhpVectorLevel >= PH_VECTOR_LEVEL_SSE2)
+    {
+        __m128i b1;
+        __m128i b2;
+
+        while (Count - i >= 8)
+        {
+            b1 = _mm_loadu_si128((__m128i *)(Buffer1 + i));
+            b2 = _mm_loadu_si128((__m128i *)(Buffer2 + i));
+
+            if (IgnoreCase)
+            {
+                b1 = PhpUpcaseAsciiBlock128(b1);
+                b2 = PhpUpcaseAsciiBlock128(b2);
+            }
+
+            mask = ~_mm_movemask_epi8(_mm_cmpeq_epi16(b1, b2)) & 0xffff;
+
+            if (_BitScanForward(&index, mask))
+                return i + index / sizeof(WCHAR);
+
+            i += 8;
+        }
+    }
+
+    for (; i < Count; i++)
+    {
+        if (Buffer1[i] != Buffer2[i])
+            return i;
+    }
+
+    return Count;
+}
+
 /**
  * Compares two strings.
  *
@@ -1154,7 +1526,8 @@ LONG PhCompareStringRef(
     PWCHAR s2;
     WCHAR c1;
     WCHAR c2;
-    PWCHAR end;
+    SIZE_T length;
+    SIZE_T i;
 
     // Note: this function assumes that the difference between the lengths of
     // the two strings can fit inside a LONG.
@@ -1166,41 +1539,28 @@ LONG PhCompareStringRef(
     s1 = String1->Buffer;
     s2 = String2->Buffer;
 
-    end = (PWCHAR)((PCHAR)s1 + (l1 <= l2 ? l1 : l2));
-
-    if (!IgnoreCase)
-    {
-        while (s1 != end)
-        {
-            c1 = *s1;
-            c2 = *s2;
+    // Shared strings (see PhInternString) are common in sort functions.
+    if (s1 == s2 && l1 == l2)
+        return 0;
 
-            if (c1 != c2)
-                return (LONG)c1 - (LONG)c2;
+    length = (l1 <= l2 ? l1 : l2) / sizeof(WCHAR);
+    i = 0;
 
-            s1++;
-            s2++;
-        }
-    }
-    else
+    while ((i += PhpFindMismatch(s1 + i, s2 + i, length - i, IgnoreCase)) != length)
     {
-        while (s1 != end)
-        {
-            c1 = *s1;
-            c2 = *s2;
+        c1 = s1[i];
+        c2 = s2[i];
 
-            if (c1 != c2)
-            {
-                c1 = RtlUpcaseUnicodeChar(c1);
-                c2 = RtlUpcaseUnicodeChar(c2);
+        if (IgnoreCase)
+        {
+            c1 = RtlUpcaseUnicodeChar(c1);
+            c2 = RtlUpcaseUnicodeChar(c2);
+        }
 
-                if (c1 != c2)
-                    return (LONG)c1 - (LONG)c2;
-            }
+        if (c1 != c2)
+            return (LONG)c1 - (LONG)c2;
 
-            s1++;
-            s2++;
-        }
+        i++;
     }
 
     return (LONG)(l1 - l2);
@@ -1224,9 +1584,8 @@ BOOLEAN PhEqualStringRef(
     SIZE_T l2;
     PWSTR s1;
     PWSTR s2;
-    WCHAR c1;
-    WCHAR c2;
     SIZE_T length;
+    SIZE_T i;
 
     l1 = String1->Length;
     l2 = String2->Length;
@@ -1239,118 +1598,79 @@ BOOLEAN PhEqualStringRef(
     s1 = String1->Buffer;
     s2 = String2->Buffer;
 
-    if (PhpVectorLevel >= PH_VECTOR_LEVEL_SSE2)
+    if (s1 == s2)
+        return TRUE;
+
+    length = l1 / sizeof(WCHAR);
+    i = 0;
+
+    while ((i += PhpFindMismatch(s1 + i, s2 + i, length - i, IgnoreCase)) != length)
     {
-        length = l1 / 16;
+        if (!IgnoreCase || RtlUpcaseUnicodeChar(s1[i]) != RtlUpcaseUnicodeChar(s2[i]))
+            return FALSE;
 
-        if (length != 0)
-        {
-            __m128i b1;
-            __m128i b2;
+        i++;
+    }
 
-            do
-            {
-                b1 = _mm_loadu_si128((__m128i *)s1);
-                b2 = _mm_loadu_si128((__m128i *)s2);
-                b1 = _mm_cmpeq_epi32(b1, b2);
+    return TRUE;
+}
 
-                if (_mm_movemask_epi8(b1) != 0xffff)
-                {
-                    if (!IgnoreCase)
-                    {
-                        return FALSE;
-                    }
-                    else
-                    {
-                        // Compare character-by-character to ignore case.
-                        l1 = length * 16 + (l1 & 15);
-                        l1 /= sizeof(WCHAR);
-                        goto CompareCharacters;
-                    }
-                }
+static ULONG_PTR PhpFindCharInBuffer(
+    _In_reads_(Count) PWCHAR Buffer,
+    _In_ SIZE_T Count,
+    _In_ WCHAR Character,
+    _In_ BOOLEAN IgnoreCase
+    )
+{
+    SIZE_T i;
 
-                s1 += 16 / sizeof(WCHAR);
-                s2 += 16 / sizeof(WCHAR);
-            } while (--length != 0);
+    if (!IgnoreCase)
+    {
+        for (i = 0; i < Count; i++)
+        {
+            if (Buffer[i] == Character)
+                return i;
         }
-
-        // Compare character-by-character because we have no more 16-byte blocks
-        // to compare.
-        l1 = (l1 & 15) / sizeof(WCHAR);
     }
     else
     {
-        length = l1 / sizeof(ULONG_PTR);
-
-        if (length != 0)
+        for (i = 0; i < Count; i++)
         {
-            do
-            {
-                if (*(PULONG_PTR)s1 != *(PULONG_PTR)s2)
-                {
-                    if (!IgnoreCase)
-                    {
-                        return FALSE;
-                    }
-                    else
-                    {
-                        // Compare character-by-character to ignore case.
-                        l1 = length * sizeof(ULONG_PTR) + (l1 & (sizeof(ULONG_PTR) - 1));
-                        l1 /= sizeof(WCHAR);
-                        goto CompareCharacters;
-                    }
-                }
-
-                s1 += sizeof(ULONG_PTR) / sizeof(WCHAR);
-                s2 += sizeof(ULONG_PTR) / sizeof(WCHAR);
-            } while (--length != 0);
+            if (RtlUpcaseUnicodeChar(Buffer[i]) == Character)
+                return i;
         }
-
-        // Compare character-by-character because we have no more ULONG_PTR blocks
-        // to compare.
-        l1 = (l1 & (sizeof(ULONG_PTR) - 1)) / sizeof(WCHAR);
     }
 
-CompareCharacters:
-    if (l1 != 0)
-    {
-        if (!IgnoreCase)
-        {
-            do
-            {
-                c1 = *s1;
-                c2 = *s2;
-
-                if (c1 != c2)
-                    return FALSE;
+    return -1;
+}
 
-                s1++;
-                s2++;
-            } while (--l1 != 0);
+static ULONG_PTR PhpFindLastCharInBuffer(
+    _In_reads_(Count) PWCHAR Buffer,
+    _In_ SIZE_T Count,
+    _In_ WCHAR Character,
+    _In_ BOOLEAN IgnoreCase
+    )
+{
+    SIZE_T i;
+
+    if (!IgnoreCase)
+    {
+        for (i = Count; i != 0; i--)
+        {
+            if (Buffer[i - 1] == Character)
+                return i - 1;
         }
-        else
+    }
+    else
+    {
+        for (i = Count; i != 0; i--)
         {
-            do
-            {
-                c1 = *s1;
-                c2 = *s2;
-
-                if (c1 != c2)
-                {
-                    c1 = RtlUpcaseUnicodeChar(c1);
-                    c2 = RtlUpcaseUnicodeChar(c2);
-
-                    if (c1 != c2)
-                        return FALSE;
-                }
-
-                s1++;
-                s2++;
-            } while (--l1 != 0);
+            if (RtlUpcaseUnicodeChar(Buffer[i - 1]) == Character)
+                return i - 1;
         }
     }
 
-    return TRUE;
+    return -1;
 }
 
 /**
@@ -1371,71 +1691,94 @@ ULONG_PTR PhFindCharInStringRef(
 {
     PWSTR buffer;
     SIZE_T length;
+    SIZE_T i;
+    ULONG_PTR index;
 
     buffer = String->Buffer;
     length = String->Length / sizeof(WCHAR);
+    i = 0;
 
-    if (!IgnoreCase)
+    if (IgnoreCase)
+        Character = RtlUpcaseUnicodeChar(Character);
+
+    // When ignoring case, the vector code only handles blocks of ASCII characters. Blocks
+    // containing other characters are searched one character at a time.
+    if (!IgnoreCase || Character < 0x80)
     {
-        if (PhpVectorLevel >= PH_VECTOR_LEVEL_SSE2)
+        ULONG mask;
+        ULONG bitIndex;
+
+        if (PhpVectorLevel >= PH_VECTOR_LEVEL_AVX2 && length >= 16)
         {
-            SIZE_T length16;
+            __m256i pattern;
+            __m256i block;
 
-            length16 = String->Length / 16;
-            length &= 7;
+            pattern = _mm256_set1_epi16(Character);
 
-            if (length16 != 0)
+            do
             {
-                __m128i pattern;
-                __m128i block;
-                ULONG mask;
-                ULONG index;
+                block = _mm256_loadu_si256((__m256i *)(buffer + i));
+
+                if (IgnoreCase)
+                {
+                    if (!_mm256_testz_si256(block, _mm256_set1_epi16(0xff80)))
+                        break;
 
-                pattern = _mm_set1_epi16(Character);
+                    block = PhpUpcaseAsciiBlock256(block);
+                }
+
+                mask = _mm256_movemask_epi8(_mm256_cmpeq_epi16(block, pattern));
 
-                do
+                if (_BitScanForward(&bitIndex, mask))
                 {
-                    block = _mm_loadu_si128((__m128i *)buffer);
-                    block = _mm_cmpeq_epi16(block, pattern);
-                    mask = _mm_movemask_epi8(block);
+                    _mm256_zeroupper();
+                    return i + bitIndex / sizeof(WCHAR);
+                }
 
-                    if (_BitScanForward(&index, mask))
-                        return (String->Length - length16 * 16) / sizeof(WCHAR) - length + index / 2;
+                i += 16;
+            } while (length - i >= 16);
 
-                    buffer += 16 / sizeof(WCHAR);
-                } while (--length16 != 0);
-            }
+            _mm256_zeroupper();
         }
 
-        if (length != 0)
+        if (PhpVectorLevel >= PH_VECTOR_LEVEL_SSE2)
         {
-            do
+            __m128i pattern;
+            __m128i block;
+
+            pattern = _mm_set1_epi16(Character);
+
+            while (length - i >= 8)
             {
-                if (*buffer == Character)
-                    return String->Length / sizeof(WCHAR) - length;
+                block = _mm_loadu_si128((__m128i *)(buffer + i));
 
-                buffer++;
-            } while (--length != 0);
-        }
-    }
-    else
-    {
-        if (length != 0)
-        {
-            WCHAR c;
+                if (IgnoreCase)
+                {
+                    if (!PhpIsAsciiBlock128(block))
+                    {
+                        if ((index = PhpFindCharInBuffer(buffer + i, 8, Character, TRUE)) != -1)
+                            return i + index;
+
+                        i += 8;
+                        continue;
+                    }
 
-            c = RtlUpcaseUnicodeChar(Character);
+                    block = PhpUpcaseAsciiBlock128(block);
+                }
 
-            do
-            {
-                if (RtlUpcaseUnicodeChar(*buffer) == c)
-                    return String->Length / sizeof(WCHAR) - length;
+                mask = _mm_movemask_epi8(_mm_cmpeq_epi16(block, pattern));
 
-                buffer++;
-            } while (--length != 0);
+                if (_BitScanForward(&bitIndex, mask))
+                    return i + bitIndex / sizeof(WCHAR);
+
+                i += 8;
+            }
         }
     }
 
+    if ((index = PhpFindCharInBuffer(buffer + i, length - i, Character, IgnoreCase)) != -1)
+        return i + index;
+
     return -1;
 }
 
@@ -1456,79 +1799,90 @@ ULONG_PTR PhFindLastCharInStringRef(
     )
 {
     PWCHAR buffer;
-    SIZE_T length;
+    SIZE_T i;
 
-    buffer = (PWCHAR)((PCHAR)String->Buffer + String->Length);
-    length = String->Length / sizeof(WCHAR);
+    buffer = String->Buffer;
+    i = String->Length / sizeof(WCHAR); // the number of characters left to search
 
-    if (!IgnoreCase)
+    if (IgnoreCase)
+        Character = RtlUpcaseUnicodeChar(Character);
+
+    // See PhFindCharInStringRef.
+    if (!IgnoreCase || Character < 0x80)
     {
-        if (PhpVectorLevel >= PH_VECTOR_LEVEL_SSE2)
+        ULONG mask;
+        ULONG bitIndex;
+        ULONG_PTR index;
+
+        if (PhpVectorLevel >= PH_VECTOR_LEVEL_AVX2 && i >= 16)
         {
-            SIZE_T length16;
+            __m256i pattern;
+            __m256i block;
 
-            length16 = String->Length / 16;
-            length &= 7;
+            pattern = _mm256_set1_epi16(Character);
 
-            if (length16 != 0)
+            do
             {
-                __m128i pattern;
-                __m128i block;
-                ULONG mask;
-                ULONG index;
-
-                pattern = _mm_set1_epi16(Character);
-                buffer -= 16 / sizeof(WCHAR);
+                block = _mm256_loadu_si256((__m256i *)(buffer + i - 16));
 
-                do
+                if (IgnoreCase)
                 {
-                    block = _mm_loadu_si128((__m128i *)buffer);
-                    block = _mm_cmpeq_epi16(block, pattern);
-                    mask = _mm_movemask_epi8(block);
+                    if (!_mm256_testz_si256(block, _mm256_set1_epi16(0xff80)))
+                        break;
 
-                    if (_BitScanReverse(&index, mask))
-                        return (length16 - 1) * 16 / sizeof(WCHAR) + length + index / 2;
+                    block = PhpUpcaseAsciiBlock256(block);
+                }
 
-                    buffer -= 16 / sizeof(WCHAR);
-                } while (--length16 != 0);
+                mask = _mm256_movemask_epi8(_mm256_cmpeq_epi16(block, pattern));
 
-                buffer += 16 / sizeof(WCHAR);
-            }
+                if (_BitScanReverse(&bitIndex, mask))
+                {
+                    _mm256_zeroupper();
+                    return i - 16 + bitIndex / sizeof(WCHAR);
+                }
+
+                i -= 16;
+            } while (i >= 16);
+
+            _mm256_zeroupper();
         }
 
-        if (length != 0)
+        if (PhpVectorLevel >= PH_VECTOR_LEVEL_SSE2)
         {
-            buffer--;
+            __m128i pattern;
+            __m128i block;
 
-            do
+            pattern = _mm_set1_epi16(Character);
+
+            while (i >= 8)
             {
-                if (*buffer == Character)
-                    return length - 1;
+                block = _mm_loadu_si128((__m128i *)(buffer + i - 8));
 
-                buffer--;
-            } while (--length != 0);
-        }
-    }
-    else
-    {
-        if (length != 0)
-        {
-            WCHAR c;
+                if (IgnoreCase)
+                {
+                    if (!PhpIsAsciiBlock128(block))
+                    {
+                        if ((index = PhpFindLastCharInBuffer(buffer + i - 8, 8, Character, TRUE)) != -1)
+                            return i - 8 + index;
 
-            c = RtlUpcaseUnicodeChar(Character);
-            buffer--;
+                        i -= 8;
+                        continue;
+                    }
 
-            do
-            {
-                if (RtlUpcaseUnicodeChar(*buffer) == c)
-                    return length - 1;
+                    block = PhpUpcaseAsciiBlock128(block);
+                }
+
+                mask = _mm_movemask_epi8(_mm_cmpeq_epi16(block, pattern));
+
+                if (_BitScanReverse(&bitIndex, mask))
+                    return i - 8 + bitIndex / sizeof(WCHAR);
 
-                buffer--;
-            } while (--length != 0);
+                i -= 8;
+            }
         }
     }
 
-    return -1;
+    return PhpFindLastCharInBuffer(buffer, i, Character, IgnoreCase);
 }
 
 /**
@@ -1550,10 +1904,11 @@ ULONG_PTR PhFindStringInStringRef(
 {
     SIZE_T length1;
     SIZE_T length2;
+    PH_STRINGREF candidates;
     PH_STRINGREF sr1;
     PH_STRINGREF sr2;
     WCHAR c;
-    SIZE_T i;
+    ULONG_PTR index;
 
     length1 = String->Length / sizeof(WCHAR);
     length2 = SubString->Length / sizeof(WCHAR);
@@ -1565,39 +1920,28 @@ ULONG_PTR PhFindStringInStringRef(
     if (length2 == 0)
         return 0;
 
-    sr1.Buffer = String->Buffer;
+    // Use the (vectorized) character search to find each position where the first
+    // character matches, then compare the rest of the substring.
+
+    candidates.Buffer = String->Buffer;
+    candidates.Length = (length1 - length2 + 1) * sizeof(WCHAR);
+    c = *SubString->Buffer;
     sr1.Length = SubString->Length - sizeof(WCHAR);
-    sr2.Buffer = SubString->Buffer;
+    sr2.Buffer = SubString->Buffer + 1;
     sr2.Length = SubString->Length - sizeof(WCHAR);
 
-    if (!IgnoreCase)
+    while ((index = PhFindCharInStringRef(&candidates, c, IgnoreCase)) != -1)
     {
-        c = *sr2.Buffer++;
+        sr1.Buffer = candidates.Buffer + index + 1;
 
-        for (i = length1 - length2 + 1; i != 0; i--)
-        {
-            if (*sr1.Buffer++ == c && PhEqualStringRef(&sr1, &sr2, FALSE))
-            {
-                goto FoundUString;
-            }
-        }
-    }
-    else
-    {
-        c = RtlUpcaseUnicodeChar(*sr2.Buffer++);
+        if (PhEqualStringRef(&sr1, &sr2, IgnoreCase))
+            return (ULONG_PTR)(candidates.Buffer + index - String->Buffer);
 
-        for (i = length1 - length2 + 1; i != 0; i--)
-        {
-            if (RtlUpcaseUnicodeChar(*sr1.Buffer++) == c && PhEqualStringRef(&sr1, &sr2, TRUE))
-            {
-                goto FoundUString;
-            }
-        }
+        candidates.Buffer += index + 1;
+        candidates.Length -= (index + 1) * sizeof(WCHAR);
     }
 
     return -1;
-FoundUString:
-    return (ULONG_PTR)(sr1.Buffer - String->Buffer - 1);
 }
 
 /**
@@ -2902,6 +3246,26 @@ VOID PhZeroExtendToUtf16Buffer(
 {
     SIZE_T inputLength;
 
+    if (PhpVectorLevel >= PH_VECTOR_LEVEL_SSE2)
+    {
+        __m128i zero;
+        __m128i block;
+
+        zero = _mm_setzero_si128();
+        inputLength = InputLength / 16;
+        InputLength &= 15;
+
+        while (inputLength != 0)
+        {
+            block = _mm_loadu_si128((__m128i *)Input);
+            _mm_storeu_si128((__m128i *)Output, _mm_unpacklo_epi8(block, zero));
+            _mm_storeu_si128((__m128i *)(Output + 8), _mm_unpackhi_epi8(block, zero));
+            Input += 16;
+            Output += 16;
+            inputLength--;
+        }
+    }
+
     inputLength = InputLength & -4;
 
     if (inputLength)
@@ -3104,6 +3468,162 @@ PPH_BYTES PhConvertUtf16ToMultiByteEx(
     return bytes;
 }
 
+/**
+ * Determines the number of ASCII characters at the start of a UTF-8 string.
+ *
+ * \param Buffer The UTF-8 string.
+ * \param Length The length of \a Buffer, in bytes.
+ */
+static SIZE_T PhpCountAsciiUtf8(
+    _In_reads_bytes_(Length) PCH Buffer,
+    _In_ SIZE_T Length
+    )
+{
+    SIZE_T i;
+    ULONG mask;
+    ULONG index;
+
+    i = 0;
+
+    if (PhpVectorLevel >= PH_VECTOR_LEVEL_AVX2 && Length >= 32)
+    {
+        do
+        {
+            mask = _mm256_movemask_epi8(_mm256_loadu_si256((__m256i *)(Buffer + i)));
+
+            if (_BitScanForward(&index, mask))
+            {
+                _mm256_zeroupper();
+                return i + index;
+            }
+
+            i += 32;
+        } while (Length - i >= 32);
+
+        _mm256_zeroupper();
+    }
+
+    if (PhpVectorLevel >= PH_VECTOR_LEVEL_SSE2)
+    {
+        while (Length - i >= 16)
+        {
+            mask = _mm_movemask_epi8(_mm_loadu_si128((__m128i *)(Buffer + i)));
+
+            if (_BitScanForward(&index, mask))
+                return i + index;
+
+            i += 16;
+        }
+    }
+
+    while (i < Length && (UCHAR)Buffer[i] < 0x80)
+        i++;
+
+    return i;
+}
+
+/**
+ * Determines the number of ASCII characters at the start of a UTF-16 string.
+ *
+ * \param Buffer The UTF-16 string.
+ * \param Count The length of \a Buffer, in characters.
+ */
+static SIZE_T PhpCountAsciiUtf16(
+    _In_reads_(Count) PWCH Buffer,
+    _In_ SIZE_T Count
+    )
+{
+    SIZE_T i;
+    ULONG mask;
+    ULONG index;
+
+    i = 0;
+
+    if (PhpVectorLevel >= PH_VECTOR_LEVEL_AVX2 && Count >= 16)
+    {
+        __m256i nonAscii;
+
+        nonAscii = _mm256_set1_epi16(0xff80);
+
+        do
+        {
+            mask = ~(ULONG)_mm256_movemask_epi8(_mm256_cmpeq_epi16(
+                _mm256_and_si256(_mm256_loadu_si256((__m256i *)(Buffer + i)), nonAscii),
+                _mm256_setzero_si256()
+                ));
+
+            if (_BitScanForward(&index, mask))
+            {
+                _mm256_zeroupper();
+                return i + index / sizeof(WCHAR);
+            }
+
+            i += 16;
+        } while (Count - i >= 16);
+
+        _mm256_zeroupper();
+    }
+
+    if (PhpVectorLevel >= PH_VECTOR_LEVEL_SSE2)
+    {
+        __m128i nonAscii;
+
+        nonAscii = _mm_set1_epi16(0xff80);
+
+        while (Count - i >= 8)
+        {
+            mask = ~_mm_movemask_epi8(_mm_cmpeq_epi16(
+                _mm_and_si128(_mm_loadu_si128((__m128i *)(Buffer + i)), nonAscii),
+                _mm_setzero_si128()
+                )) & 0xffff;
+
+            if (_BitScanForward(&index, mask))
+                return i + index / sizeof(WCHAR);
+
+            i += 8;
+        }
+    }
+
+    while (i < Count && Buffer[i] < 0x80)
+        i++;
+
+    return i;
+}
+
+/**
+ * Converts ASCII characters from UTF-16 to UTF-8.
+ *
+ * \param Input The UTF-16 characters. Each character must be less than 0x80.
+ * \param Count The number of characters.
+ * \param Output A buffer which receives \a Count bytes.
+ */
+static VOID PhpNarrowAsciiUtf16(
+    _In_reads_(Count) PWCH Input,
+    _In_ SIZE_T Count,
+    _Out_writes_bytes_(Count) PCH Output
+    )
+{
+    if (PhpVectorLevel >= PH_VECTOR_LEVEL_SSE2)
+    {
+        while (Count >= 16)
+        {
+            _mm_storeu_si128((__m128i *)Output, _mm_packus_epi16(
+                _mm_loadu_si128((__m128i *)Input),
+                _mm_loadu_si128((__m128i *)(Input + 8))
+                ));
+            Input += 16;
+            Output += 16;
+            Count -= 16;
+        }
+    }
+
+    while (Count != 0)
+    {
+        *Output++ = (CHAR)*Input++;
+        Count--;
+    }
+}
+
 BOOLEAN PhConvertUtf8ToUtf16Size(
     _Out_ PSIZE_T BytesInUtf16String,
     _In_reads_bytes_(BytesInUtf8String) PCH Utf8String,
@@ -3117,6 +3637,7 @@ BOOLEAN PhConvertUtf8ToUtf16Size(
     SIZE_T bytesInUtf16String;
     ULONG codePoint;
     ULONG numberOfCodeUnits;
+    SIZE_T count;
 
     result = TRUE;
     PhInitializeUnicodeDecoder(&decoder, PH_UNICODE_UTF8);
@@ -3126,6 +3647,15 @@ BOOLEAN PhConvertUtf8ToUtf16Size(
 
     while (inRemaining != 0)
     {
+        // Runs of ASCII characters don't need to go through the decoder.
+        if (decoder.State == 0 && (count = PhpCountAsciiUtf8(in, inRemaining)) != 0)
+        {
+            bytesInUtf16String += count * sizeof(WCHAR);
+            in += count;
+            inRemaining -= count;
+            continue;
+        }
+
         PhWriteUnicodeDecoder(&decoder, (UCHAR)*in);
         in++;
         inRemaining--;
@@ -3162,6 +3692,7 @@ BOOLEAN PhConvertUtf8ToUtf16Buffer(
     ULONG codePoint;
     USHORT codeUnits[2];
     ULONG numberOfCodeUnits;
+    SIZE_T count;
 
     result = TRUE;
     PhInitializeUnicodeDecoder(&decoder, PH_UNICODE_UTF8);
@@ -3173,6 +3704,29 @@ BOOLEAN PhConvertUtf8ToUtf16Buffer(
 
     while (inRemaining != 0)
     {
+        // Runs of ASCII characters don't need to go through the decoder.
+        if (decoder.State == 0 && (count = PhpCountAsciiUtf8(in, inRemaining)) != 0)
+        {
+            bytesInUtf16String += count * sizeof(WCHAR);
+            PhZeroExtendToUtf16Buffer(in, min(count, outRemaining), out);
+
+            if (outRemaining >= count)
+            {
+                out += count;
+                outRemaining -= count;
+            }
+            else
+            {
+                out += outRemaining;
+                outRemaining = 0;
+                result = FALSE;
+            }
+
+            in += count;
+            inRemaining -= count;
+            continue;
+        }
+
         PhWriteUnicodeDecoder(&decoder, (UCHAR)*in);
         in++;
         inRemaining--;
@@ -3267,6 +3821,7 @@ BOOLEAN PhConvertUtf16ToUtf8Size(
     SIZE_T bytesInUtf8String;
     ULONG codePoint;
     ULONG numberOfCodeUnits;
+    SIZE_T count;
 
     result = TRUE;
     PhInitializeUnicodeDecoder(&decoder, PH_UNICODE_UTF16);
@@ -3276,6 +3831,15 @@ BOOLEAN PhConvertUtf16ToUtf8Size(
 
     while (inRemaining != 0)
     {
+        // Runs of ASCII characters don't need to go through the decoder.
+        if (decoder.State == 0 && (count = PhpCountAsciiUtf16(in, inRemaining)) != 0)
+        {
+            bytesInUtf8String += count;
+            in += count;
+            inRemaining -= count;
+            continue;
+        }
+
         PhWriteUnicodeDecoder(&decoder, (USHORT)*in);
         in++;
         inRemaining--;
@@ -3312,6 +3876,7 @@ BOOLEAN PhConvertUtf16ToUtf8Buffer(
     ULONG codePoint;
     UCHAR codeUnits[4];
     ULONG numberOfCodeUnits;
+    SIZE_T count;
 
     result = TRUE;
     PhInitializeUnicodeDecoder(&decoder, PH_UNICODE_UTF16);
@@ -3323,6 +3888,29 @@ BOOLEAN PhConvertUtf16ToUtf8Buffer(
 
     while (inRemaining != 0)
     {
+        // Runs of ASCII characters don't need to go through the decoder.
+        if (decoder.State == 0 && (count = PhpCountAsciiUtf16(in, inRemaining)) != 0)
+        {
+            bytesInUtf8String += count;
+            PhpNarrowAsciiUtf16(in, min(count, outRemaining), out);
+
+            if (outRemaining >= count)
+            {
+                out += count;
+                outRemaining -= count;
+            }
+            else
+            {
+                out += outRemaining;
+                outRemaining = 0;
+                result = FALSE;
+            }
+
+            in += count;
+            inRemaining -= count;
+            continue;
+        }
+
         PhWriteUnicodeDecoder(&decoder, (USHORT)*in);
         in++;
         inRemaining--;
@@ -3440,9 +4028,47 @@ VOID PhInitializeStringBuilder(
     // Write the null terminator.
     StringBuilder->String->Buffer[0] = 0;
 
+    StringBuilder->InlineStorage = NULL;
+
     PHLIB_INC_STATISTIC(BaseStringBuildersCreated);
 }
 
+/**
+ * Initializes a string builder object that uses caller-supplied storage
+ * until the string no longer fits.
+ *
+ * \param StringBuilder A string builder object.
+ * \param Storage A buffer, usually on the stack, which must remain valid
+ * until the string builder is deleted or finalized. The buffer must be
+ * aligned to a pointer boundary.
+ * \param StorageSize The size of \a Storage, in bytes. The storage also
+ * holds the string header, so the capacity is somewhat smaller than this.
+ *
+ * \remarks Until the string outgrows \a Storage, the \a String field
+ * does not point to an object and must not be referenced.
+ */
+VOID PhInitializeStringBuilderInline(
+    _Out_ PPH_STRING_BUILDER StringBuilder,
+    _Out_writes_bytes_(StorageSize) PVOID Storage,
+    _In_ SIZE_T StorageSize
+    )
+{
+    PPH_STRING string;
+
+    assert(StorageSize >= FIELD_OFFSET(PH_STRING, Data) + sizeof(WCHAR));
+
+    // Lay out a string header at the start of the storage, followed by the characters and the
+    // null terminator.
+    string = Storage;
+    string->Length = 0;
+    string->Buffer = string->Data;
+    string->Buffer[0] = 0;
+
+    StringBuilder->AllocatedLength = (StorageSize - FIELD_OFFSET(PH_STRING, Data) - sizeof(WCHAR)) & ~1;
+    StringBuilder->String = string;
+    StringBuilder->InlineStorage = Storage;
+}
+
 /**
  * Frees resources used by a string builder object.
  *
@@ -3452,7 +4078,8 @@ VOID PhDeleteStringBuilder(
     _Inout_ PPH_STRING_BUILDER StringBuilder
     )
 {
-    PhDereferenceObject(StringBuilder->String);
+    if (!StringBuilder->InlineStorage)
+        PhDereferenceObject(StringBuilder->String);
 }
 
 /**
@@ -3470,14 +4097,64 @@ PPH_STRING PhFinalStringBuilderString(
     _Inout_ PPH_STRING_BUILDER StringBuilder
     )
 {
+    if (StringBuilder->InlineStorage)
+        return PhCreateStringEx(StringBuilder->String->Buffer, StringBuilder->String->Length);
+
     return StringBuilder->String;
 }
 
-VOID PhpResizeStringBuilder(
-    _In_ PPH_STRING_BUILDER StringBuilder,
-    _In_ SIZE_T NewCapacity
-    )
-{
+/**
+ * Copies the string constructed by a string builder object to a buffer and
+ * frees resources used by the object.
+ *
+ * \param StringBuilder A string builder object.
+ * \param Buffer A buffer. If NULL, no data is written.
+ * \param BufferLength The number of bytes available in \a Buffer,
+ * including space for the null terminator.
+ * \param ReturnLength The number of bytes required to hold the
+ * string, including the null terminator.
+ *
+ * \return TRUE if the buffer was large enough to hold the entire string,
+ * otherwise FALSE.
+ *
+ * \remarks If the buffer is too small, as much of the string as fits is
+ * written and the result is still null-terminated.
+ */
+BOOLEAN PhFinalStringBuilderToBuffer(
+    _Inout_ PPH_STRING_BUILDER StringBuilder,
+    _Out_writes_bytes_opt_(BufferLength) PWSTR Buffer,
+    _In_opt_ SIZE_T BufferLength,
+    _Out_opt_ PSIZE_T ReturnLength
+    )
+{
+    SIZE_T length;
+    BOOLEAN result;
+
+    length = StringBuilder->String->Length;
+    result = Buffer && BufferLength >= length + sizeof(WCHAR);
+
+    if (Buffer && BufferLength >= sizeof(WCHAR))
+    {
+        SIZE_T copyLength;
+
+        copyLength = min(length, (BufferLength - sizeof(WCHAR)) & ~1);
+        memcpy(Buffer, StringBuilder->String->Buffer, copyLength);
+        Buffer[copyLength / sizeof(WCHAR)] = 0;
+    }
+
+    if (ReturnLength)
+        *ReturnLength = length + sizeof(WCHAR);
+
+    PhDeleteStringBuilder(StringBuilder);
+
+    return result;
+}
+
+VOID PhpResizeStringBuilder(
+    _In_ PPH_STRING_BUILDER StringBuilder,
+    _In_ SIZE_T NewCapacity
+    )
+{
     PPH_STRING newString;
 
     // Double the string size. If that still isn't enough room, just use the new length.
@@ -3500,8 +4177,17 @@ VOID PhpResizeStringBuilder(
     // Copy the old string length.
     newString->Length = StringBuilder->String->Length;
 
-    // Dereference the old string and replace it with the new string.
-    PhMoveReference(&StringBuilder->String, newString);
+    if (StringBuilder->InlineStorage)
+    {
+        // The old string lives in the caller's storage and is not an object.
+        StringBuilder->String = newString;
+        StringBuilder->InlineStorage = NULL;
+    }
+    else
+    {
+        // Dereference the old string and replace it with the new string.
+        PhMoveReference(&StringBuilder->String, newString);
+    }
 
     PHLIB_INC_STATISTIC(BaseStringBuildersResized);
 }
@@ -3514,6 +4200,34 @@ FORCEINLINE VOID PhpWriteNullTerminatorStringBuilder(
     *(PWCHAR)((PCHAR)StringBuilder->String->Buffer + StringBuilder->String->Length) = 0;
 }
 
+/**
+ * Ensures that a string builder object can hold more data without
+ * re-allocating its string.
+ *
+ * \param StringBuilder A string builder object.
+ * \param Length The number of bytes that will be appended to the
+ * current string.
+ */
+VOID PhReserveStringBuilder(
+    _Inout_ PPH_STRING_BUILDER StringBuilder,
+    _In_ SIZE_T Length
+    )
+{
+    SIZE_T newCapacity;
+
+    newCapacity = StringBuilder->String->Length + Length;
+
+    if (newCapacity & 1)
+        newCapacity++;
+
+    if (StringBuilder->AllocatedLength < newCapacity)
+    {
+        // Don't let PhpResizeStringBuilder round the capacity up.
+        StringBuilder->AllocatedLength = newCapacity / 2;
+        PhpResizeStringBuilder(StringBuilder, newCapacity);
+    }
+}
+
 /**
  * Appends a string to the end of a string builder string.
  *
@@ -4232,6 +4946,143 @@ VOID PhRemoveItemsList(
     List->Count -= Count;
 }
 
+static int __cdecl PhpSortItemsSimpleCompare(
+    _In_ void *Context,
+    _In_ const void *Item1,
+    _In_ const void *Item2
+    )
+{
+    return ((PPH_SORT_ITEMS_SIMPLE_FUNCTION)Context)(Item1, Item2);
+}
+
+/**
+ * Sorts an array of pointers, reusing the existing order of the array.
+ *
+ * \param Items The array to sort.
+ * \param Count The number of items in the array.
+ * \param CompareFunction A qsort-compatible comparison function.
+ *
+ * \remarks See PhSortItemsIncrementalEx().
+ */
+VOID PhSortItemsIncremental(
+    _Inout_updates_(Count) PVOID *Items,
+    _In_ ULONG Count,
+    _In_ PPH_SORT_ITEMS_SIMPLE_FUNCTION CompareFunction
+    )
+{
+    PhSortItemsIncrementalEx(Items, Count, PhpSortItemsSimpleCompare, (PVOID)CompareFunction);
+}
+
+/**
+ * Sorts an array of pointers, reusing the existing order of the array.
+ *
+ * \param Items The array to sort.
+ * \param Count The number of items in the array.
+ * \param CompareFunction A qsort_s-compatible comparison function.
+ * \param Context A user-defined value to pass to the comparison function.
+ *
+ * \remarks The array is expected to be mostly sorted already, e.g. a tree list
+ * that was sorted on the last refresh and has had some of its values change.
+ * Items that are out of order are taken out of the array, sorted separately
+ * and then inserted back using a binary search. If too many items are out of
+ * order, the whole array is sorted instead.
+ */
+VOID PhSortItemsIncrementalEx(
+    _Inout_updates_(Count) PVOID *Items,
+    _In_ ULONG Count,
+    _In_ PPH_SORT_ITEMS_FUNCTION CompareFunction,
+    _In_opt_ PVOID Context
+    )
+{
+    PVOID *displaced;
+    ULONG maximumDisplaced;
+    ULONG numberOfDisplaced;
+    ULONG numberOfKept;
+    ULONG i;
+
+    if (Count < PH_INCREMENTAL_SORT_MINIMUM_COUNT)
+    {
+        qsort_s(Items, Count, sizeof(PVOID), CompareFunction, Context);
+        return;
+    }
+
+    maximumDisplaced = Count / PH_INCREMENTAL_SORT_CHURN_DIVISOR;
+    displaced = PhAllocate(maximumDisplaced * sizeof(PVOID));
+    numberOfDisplaced = 0;
+    numberOfKept = 0;
+
+    // Compact the items that are still in order to the start of the array. Note that
+    // numberOfKept + numberOfDisplaced == i at the start of each iteration.
+    for (i = 0; i < Count; i++)
+    {
+        PVOID item = Items[i];
+
+        if (numberOfKept != 0 && CompareFunction(Context, &Items[numberOfKept - 1], &item) > 0)
+        {
+            if (numberOfDisplaced == maximumDisplaced)
+            {
+                // Too much has changed. Put the displaced items back and sort everything.
+                memcpy(&Items[numberOfKept], displaced, numberOfDisplaced * sizeof(PVOID));
+                PhFree(displaced);
+                qsort_s(Items, Count, sizeof(PVOID), CompareFunction, Context);
+                return;
+            }
+
+            // Either the previous item moved up or this item moved down. If the order holds
+            // without the previous item, it is the one that changed.
+            if (numberOfKept == 1 || CompareFunction(Context, &Items[numberOfKept - 2], &item) <= 0)
+            {
+                displaced[numberOfDisplaced++] = Items[numberOfKept - 1];
+                Items[numberOfKept - 1] = item;
+            }
+            else
+            {
+                displaced[numberOfDisplaced++] = item;
+            }
+
+            continue;
+        }
+
+        Items[numberOfKept++] = item;
+    }
+
+    if (numberOfDisplaced != 0)
+    {
+        qsort_s(displaced, numberOfDisplaced, sizeof(PVOID), CompareFunction, Context);
+
+        // Merge from the back so that each kept item is moved at most once.
+        while (numberOfDisplaced != 0)
+        {
+            PVOID item = displaced[numberOfDisplaced - 1];
+            ULONG low = 0;
+            ULONG high = numberOfKept;
+
+            // Find the first kept item that sorts after the displaced item.
+            while (low < high)
+            {
+                ULONG middle = low + (high - low) / 2;
+
+                if (CompareFunction(Context, &Items[middle], &item) > 0)
+                    high = middle;
+                else
+                    low = middle + 1;
+            }
+
+            memmove(
+                &Items[low + numberOfDisplaced],
+                &Items[low],
+                (numberOfKept - low) * sizeof(PVOID)
+                );
+            Items[low + numberOfDisplaced - 1] = item;
+
+            numberOfKept = low;
+            numberOfDisplaced--;
+        }
+    }
+
+    PhFree(displaced);
+}
+
 /**
  * Creates a pointer list object.
  *
@@ -4457,18 +5308,49 @@ FORCEINLINE ULONG PhpValidateHash(
 #endif
 }
 
-FORCEINLINE ULONG PhpIndexFromHash(
-    _In_ PPH_HASHTABLE Hashtable,
-    _In_ ULONG Hash
+FORCEINLINE ULONG PhpIndexFromHashEx(
+    _In_ ULONG Hash,
+    _In_ ULONG NumberOfBuckets
     )
 {
 #ifdef PH_HASHTABLE_POWER_OF_TWO_SIZE
-    return Hash & (Hashtable->AllocatedBuckets - 1);
+    return Hash & (NumberOfBuckets - 1);
 #else
-    return Hash % Hashtable->AllocatedBuckets;
+    return Hash % NumberOfBuckets;
 #endif
 }
 
+FORCEINLINE ULONG PhpIndexFromHash(
+    _In_ PPH_HASHTABLE Hashtable,
+    _In_ ULONG Hash
+    )
+{
+    return PhpIndexFromHashEx(Hash, Hashtable->AllocatedBuckets);
+}
+
+/**
+ * Gets the bucket that contains the entries with a hash code.
+ *
+ * \remarks While a hashtable is being resized incrementally, an entry is in the
+ * old bucket array if its old bucket has not been moved yet, otherwise it is in the
+ * current bucket array.
+ */
+FORCEINLINE PULONG PhpBucketFromHash(
+    _In_ PPH_HASHTABLE Hashtable,
+    _In_ ULONG Hash
+    )
+{
+    if (Hashtable->OldBuckets)
+    {
+        ULONG oldIndex = PhpIndexFromHashEx(Hash, Hashtable->OldAllocatedBuckets);
+
+        if (oldIndex >= Hashtable->MigrateIndex)
+            return &Hashtable->OldBuckets[oldIndex];
+    }
+
+    return &Hashtable->Buckets[PhpIndexFromHash(Hashtable, Hash)];
+}
+
 FORCEINLINE ULONG PhpGetNumberOfBuckets(
     _In_ ULONG Capacity
     )
@@ -4498,6 +5380,34 @@ PPH_HASHTABLE PhCreateHashtable(
     _In_ PPH_HASHTABLE_HASH_FUNCTION HashFunction,
     _In_ ULONG InitialCapacity
     )
+{
+    return PhCreateHashtableEx(EntrySize, CompareFunction, HashFunction, InitialCapacity, 0);
+}
+
+/**
+ * Creates a hashtable object.
+ *
+ * \param EntrySize The size of each hashtable entry,
+ * in bytes.
+ * \param CompareFunction A comparison function that
+ * is executed to compare two hashtable entries.
+ * \param HashFunction A hash function that is executed
+ * to generate a hash code for a hashtable entry.
+ * \param InitialCapacity The number of entries to
+ * allocate storage for initially.
+ * \param Flags A combination of flags.
+ * \li \c PH_HASHTABLE_INCREMENTAL_RESIZE When a large hashtable grows, the entries
+ * are moved to the new buckets a few at a time by later additions and removals
+ * instead of all at once. Use this for hashtables that can hold hundreds of thousands
+ * of entries on a latency-sensitive thread.
+ */
+PPH_HASHTABLE PhCreateHashtableEx(
+    _In_ ULONG EntrySize,
+    _In_ PPH_HASHTABLE_COMPARE_FUNCTION CompareFunction,
+    _In_ PPH_HASHTABLE_HASH_FUNCTION HashFunction,
+    _In_ ULONG InitialCapacity,
+    _In_ ULONG Flags
+    )
 {
     PPH_HASHTABLE hashtable;
 
@@ -4525,6 +5435,11 @@ PPH_HASHTABLE PhCreateHashtable(
     hashtable->FreeEntry = -1;
     hashtable->NextEntry = 0;
 
+    hashtable->Flags = Flags;
+    hashtable->OldAllocatedBuckets = 0;
+    hashtable->OldBuckets = NULL;
+    hashtable->MigrateIndex = 0;
+
     return hashtable;
 }
 
@@ -4537,6 +5452,54 @@ VOID PhpHashtableDeleteProcedure(
 
     PhFree(hashtable->Buckets);
     PhFree(hashtable->Entries);
+
+    if (hashtable->OldBuckets)
+        PhFree(hashtable->OldBuckets);
+}
+
+// Hashtables smaller than this are always resized all at once.
+#define PH_HASHTABLE_INCREMENTAL_MINIMUM_BUCKETS 1024
+// The number of old buckets moved by each addition or removal during an incremental resize.
+// The hashtable doubles in size, so this needs to be at least 1 for the resize to finish
+// before the next one.
+#define PH_HASHTABLE_MIGRATE_BUCKETS 16
+
+/**
+ * Moves entries from the old bucket array to the current bucket array.
+ *
+ * \param Hashtable A hashtable object.
+ * \param Count The number of old buckets to move.
+ */
+VOID PhpMigrateHashtable(
+    _Inout_ PPH_HASHTABLE Hashtable,
+    _In_ ULONG Count
+    )
+{
+    PPH_HASHTABLE_ENTRY entry;
+    ULONG i;
+    ULONG next;
+    ULONG index;
+
+    for (; Count != 0 && Hashtable->MigrateIndex < Hashtable->OldAllocatedBuckets; Count--)
+    {
+        for (i = Hashtable->OldBuckets[Hashtable->MigrateIndex]; i != -1; i = next)
+        {
+            entry = PH_HASHTABLE_GET_ENTRY(Hashtable, i);
+            next = entry->Next;
+
+            index = PhpIndexFromHash(Hashtable, entry->HashCode);
+            entry->Next = Hashtable->Buckets[index];
+            Hashtable->Buckets[index] = i;
+        }
+
+        Hashtable->MigrateIndex++;
+    }
+
+    if (Hashtable->MigrateIndex == Hashtable->OldAllocatedBuckets)
+    {
+        PhFree(Hashtable->OldBuckets);
+        Hashtable->OldBuckets = NULL;
+    }
 }
 
 VOID PhpResizeHashtable(
@@ -4546,11 +5509,37 @@ VOID PhpResizeHashtable(
 {
     PPH_HASHTABLE_ENTRY entry;
     ULONG i;
+    BOOLEAN incremental;
+
+    // If the last resize hasn't finished, the entries are re-distributed below
+    // anyway.
+    if (Hashtable->OldBuckets)
+    {
+        PhFree(Hashtable->OldBuckets);
+        Hashtable->OldBuckets = NULL;
+        incremental = FALSE;
+    }
+    else
+    {
+        incremental = (Hashtable->Flags & PH_HASHTABLE_INCREMENTAL_RESIZE) &&
+            Hashtable->AllocatedBuckets >= PH_HASHTABLE_INCREMENTAL_MINIMUM_BUCKETS;
+    }
+
+    if (incremental)
+    {
+        // Keep the old buckets. The entries are moved by PhpMigrateHashtable.
+        Hashtable->OldAllocatedBuckets = Hashtable->AllocatedBuckets;
+        Hashtable->OldBuckets = Hashtable->Buckets;
+        Hashtable->MigrateIndex = 0;
+    }
+    else
+    {
+        // Note that we don't need to keep the contents.
+        PhFree(Hashtable->Buckets);
+    }
 
-    // Re-allocate the buckets. Note that we don't need to keep the
-    // contents.
+    // Re-allocate the buckets.
     Hashtable->AllocatedBuckets = PhpGetNumberOfBuckets(NewCapacity);
-    PhFree(Hashtable->Buckets);
     Hashtable->Buckets = PhAllocate(sizeof(ULONG) * Hashtable->AllocatedBuckets);
     // Set all bucket values to -1.
     memset(Hashtable->Buckets, 0xff, sizeof(ULONG) * Hashtable->AllocatedBuckets);
@@ -4562,6 +5551,9 @@ VOID PhpResizeHashtable(
         PH_HASHTABLE_ENTRY_SIZE(Hashtable->EntrySize) * Hashtable->AllocatedEntries
         );
 
+    if (incremental)
+        return;
+
     // Re-distribute the entries among the buckets.
 
     // PH_HASHTABLE_GET_ENTRY is quite slow (it involves a multiply), so we use a pointer here.
@@ -4589,18 +5581,21 @@ FORCEINLINE PVOID PhpAddEntryHashtable(
     )
 {
     ULONG hashCode; // hash code of the new entry
-    ULONG index; // bucket index of the new entry
+    PULONG bucket; // bucket of the new entry
     ULONG freeEntry; // index of new entry in entry array
     PPH_HASHTABLE_ENTRY entry; // pointer to new entry in entry array
 
+    if (Hashtable->OldBuckets)
+        PhpMigrateHashtable(Hashtable, PH_HASHTABLE_MIGRATE_BUCKETS);
+
     hashCode = PhpValidateHash(Hashtable->HashFunction(Entry));
-    index = PhpIndexFromHash(Hashtable, hashCode);
+    bucket = PhpBucketFromHash(Hashtable, hashCode);
 
     if (CheckForDuplicate)
     {
         ULONG i;
 
-        for (i = Hashtable->Buckets[index]; i != -1; i = entry->Next)
+        for (i = *bucket; i != -1; i = entry->Next)
         {
             entry = PH_HASHTABLE_GET_ENTRY(Hashtable, i);
 
@@ -4629,7 +5624,7 @@ FORCEINLINE PVOID PhpAddEntryHashtable(
         {
             // Resize the hashtable.
             PhpResizeHashtable(Hashtable, Hashtable->AllocatedBuckets * 2);
-            index = PhpIndexFromHash(Hashtable, hashCode);
+            bucket = PhpBucketFromHash(Hashtable, hashCode);
         }
 
         freeEntry = Hashtable->NextEntry++;
@@ -4638,8 +5633,8 @@ FORCEINLINE PVOID PhpAddEntryHashtable(
 
     // Initialize the entry.
     entry->HashCode = hashCode;
-    entry->Next = Hashtable->Buckets[index];
-    Hashtable->Buckets[index] = freeEntry;
+    entry->Next = *bucket;
+    *bucket = freeEntry;
     // Copy the user-supplied data to the entry.
     memcpy(&entry->Body, Entry, Hashtable->EntrySize);
 
@@ -4725,6 +5720,13 @@ VOID PhClearHashtable(
         Hashtable->FreeEntry = -1;
         Hashtable->NextEntry = 0;
     }
+
+    // All old buckets are empty now.
+    if (Hashtable->OldBuckets)
+    {
+        PhFree(Hashtable->OldBuckets);
+        Hashtable->OldBuckets = NULL;
+    }
 }
 
 /**
@@ -4793,14 +5795,12 @@ PVOID PhFindEntryHashtable(
     )
 {
     ULONG hashCode;
-    ULONG index;
     ULONG i;
     PPH_HASHTABLE_ENTRY entry;
 
     hashCode = PhpValidateHash(Hashtable->HashFunction(Entry));
-    index = PhpIndexFromHash(Hashtable, hashCode);
 
-    for (i = Hashtable->Buckets[index]; i != -1; i = entry->Next)
+    for (i = *PhpBucketFromHash(Hashtable, hashCode); i != -1; i = entry->Next)
     {
         entry = PH_HASHTABLE_GET_ENTRY(Hashtable, i);
 
@@ -4833,16 +5833,19 @@ BOOLEAN PhRemoveEntryHashtable(
     )
 {
     ULONG hashCode;
-    ULONG index;
+    PULONG bucket;
     ULONG i;
     ULONG previousIndex;
     PPH_HASHTABLE_ENTRY entry;
 
+    if (Hashtable->OldBuckets)
+        PhpMigrateHashtable(Hashtable, PH_HASHTABLE_MIGRATE_BUCKETS);
+
     hashCode = PhpValidateHash(Hashtable->HashFunction(Entry));
-    index = PhpIndexFromHash(Hashtable, hashCode);
+    bucket = PhpBucketFromHash(Hashtable, hashCode);
     previousIndex = -1;
 
-    for (i = Hashtable->Buckets[index]; i != -1; i = entry->Next)
+    for (i = *bucket; i != -1; i = entry->Next)
     {
         entry = PH_HASHTABLE_GET_ENTRY(Hashtable, i);
 
@@ -4851,7 +5854,7 @@ BOOLEAN PhRemoveEntryHashtable(
             // Unlink the entry from the bucket.
             if (previousIndex == -1)
             {
-                Hashtable->Buckets[index] = entry->Next;
+                *bucket = entry->Next;
             }
             else
             {
@@ -4873,31 +5876,141 @@ BOOLEAN PhRemoveEntryHashtable(
     return FALSE;
 }
 
+#define PHP_HASH_MULTIPLIER1 0x9e3779b97f4a7c15
+#define PHP_HASH_MULTIPLIER2 0xc2b2ae3d27d4eb4f
+
+FORCEINLINE ULONG64 PhpHashRound(
+    _In_ ULONG64 Hash,
+    _In_ ULONG64 Multiplier,
+    _In_ ULONG64 Word
+    )
+{
+    Hash = (Hash ^ Word) * Multiplier;
+
+    return Hash ^ (Hash >> 29);
+}
+
+/**
+ * Reads the last 1 to 7 bytes of a hash input into a zero-extended word, without reading past
+ * the end of the input.
+ */
+FORCEINLINE ULONG64 PhpReadHashTail(
+    _In_reads_(Length) PUCHAR Bytes,
+    _In_ SIZE_T Length
+    )
+{
+    ULONG64 word = 0;
+    ULONG shift = 0;
+
+    if (Length & 4)
+    {
+        word = *(ULONG UNALIGNED *)Bytes;
+        Bytes += 4;
+        shift = 32;
+    }
+
+    if (Length & 2)
+    {
+        word |= (ULONG64)*(USHORT UNALIGNED *)Bytes << shift;
+        Bytes += 2;
+        shift += 16;
+    }
+
+    if (Length & 1)
+        word |= (ULONG64)*Bytes << shift;
+
+    return word;
+}
+
+FORCEINLINE ULONG PhpHashFinalize(
+    _In_ ULONG64 Hash1,
+    _In_ ULONG64 Hash2
+    )
+{
+    ULONG64 hash;
+
+    hash = PhpHashMix64(Hash1 ^ _rotl64(Hash2, 31));
+
+    return (ULONG)(hash ^ (hash >> 32));
+}
+
+/**
+ * Converts the lowercase ASCII characters in a word of four UTF-16 characters to uppercase.
+ * Other characters are converted using RtlUpcaseUnicodeChar().
+ */
+FORCEINLINE ULONG64 PhpUpcaseHashWord(
+    _In_ ULONG64 Word
+    )
+{
+    ULONG64 geA;
+    ULONG64 gtZ;
+    ULONG i;
+
+    if (!(Word & 0xff80ff80ff80ff80))
+    {
+        // Every character is below 0x80, so adding 0x1f ('a' - 0x80) or 0x05 ('z' + 1 - 0x80)
+        // never carries into the next character and sets bit 7 exactly when the character is at
+        // least 'a' or greater than 'z' respectively.
+        geA = Word + 0x001f001f001f001f;
+        gtZ = Word + 0x0005000500050005;
+
+        return Word - (((geA & ~gtZ) & 0x0080008000800080) >> 2);
+    }
+
+    for (i = 0; i < 64; i += 16)
+    {
+        WCHAR c = (WCHAR)(Word >> i);
+
+        Word = (Word & ~(0xffffULL << i)) | ((ULONG64)(USHORT)RtlUpcaseUnicodeChar(c) << i);
+    }
+
+    return Word;
+}
+
 /**
  * Generates a hash code for a sequence of bytes.
  *
  * \param Bytes A pointer to a byte array.
  * \param Length The number of bytes to hash.
+ *
+ * \remarks The hash is seeded randomly when the process starts. Hash codes must not be persisted
+ * or shared with other processes.
  */
 ULONG PhHashBytes(
     _In_reads_(Length) PUCHAR Bytes,
     _In_ SIZE_T Length
     )
 {
-    ULONG hash = 0;
+    ULONG64 hash1;
+    ULONG64 hash2;
+    ULONG64 word;
 
-    if (Length == 0)
-        return hash;
+    hash1 = PhpHashSeed ^ ((ULONG64)Length * PHP_HASH_MULTIPLIER1);
+    hash2 = PhpHashSeed + PHP_HASH_MULTIPLIER2;
+
+    // Two independent lanes hide the latency of the multiplications.
+    while (Length >= 16)
+    {
+        hash1 = PhpHashRound(hash1, PHP_HASH_MULTIPLIER1, *(ULONG64 UNALIGNED *)Bytes);
+        hash2 = PhpHashRound(hash2, PHP_HASH_MULTIPLIER2, *(ULONG64 UNALIGNED *)(Bytes + 8));
+        Bytes += 16;
+        Length -= 16;
+    }
 
-    // FNV-1a algorithm: http://www.isthe.com/chongo/src/fnv/hash_32a.c
+    if (Length >= 8)
+    {
+        hash1 = PhpHashRound(hash1, PHP_HASH_MULTIPLIER1, *(ULONG64 UNALIGNED *)Bytes);
+        Bytes += 8;
+        Length -= 8;
+    }
 
-    do
+    if (Length != 0)
     {
-        hash ^= *Bytes++;
-        hash *= 0x01000193;
-    } while (--Length != 0);
+        word = PhpReadHashTail(Bytes, Length);
+        hash2 = PhpHashRound(hash2, PHP_HASH_MULTIPLIER2, word);
+    }
 
-    return hash;
+    return PhpHashFinalize(hash1, hash2);
 }
 
 /**
@@ -4905,36 +6018,55 @@ ULONG PhHashBytes(
  *
  * \param String The string to hash.
  * \param IgnoreCase TRUE for a case-insensitive hash function, otherwise FALSE.
+ *
+ * \remarks The hash is seeded randomly when the process starts. Hash codes must not be persisted
+ * or shared with other processes.
  */
 ULONG PhHashStringRef(
     _In_ PPH_STRINGREF String,
     _In_ BOOLEAN IgnoreCase
     )
 {
-    ULONG hash = 0;
-    SIZE_T count;
-    PWCHAR p;
+    ULONG64 hash1;
+    ULONG64 hash2;
+    ULONG64 word;
+    SIZE_T length;
+    PUCHAR p;
 
-    if (String->Length == 0)
-        return 0;
+    if (!IgnoreCase)
+        return PhHashBytes((PUCHAR)String->Buffer, String->Length);
 
-    count = String->Length / sizeof(WCHAR);
-    p = String->Buffer;
+    // This is the same as PhHashBytes, except that each word is converted to uppercase before
+    // being mixed in.
 
-    if (!IgnoreCase)
+    length = String->Length & ~(SIZE_T)1;
+    p = (PUCHAR)String->Buffer;
+
+    hash1 = PhpHashSeed ^ ((ULONG64)length * PHP_HASH_MULTIPLIER1);
+    hash2 = PhpHashSeed + PHP_HASH_MULTIPLIER2;
+
+    while (length >= 16)
     {
-        return PhHashBytes((PUCHAR)String->Buffer, String->Length);
+        hash1 = PhpHashRound(hash1, PHP_HASH_MULTIPLIER1, PhpUpcaseHashWord(*(ULONG64 UNALIGNED *)p));
+        hash2 = PhpHashRound(hash2, PHP_HASH_MULTIPLIER2, PhpUpcaseHashWord(*(ULONG64 UNALIGNED *)(p + 8)));
+        p += 16;
+        length -= 16;
     }
-    else
+
+    if (length >= 8)
     {
-        do
-        {
-            hash ^= (USHORT)RtlUpcaseUnicodeChar(*p++);
-            hash *= 0x01000193;
-        } while (--count != 0);
+        hash1 = PhpHashRound(hash1, PHP_HASH_MULTIPLIER1, PhpUpcaseHashWord(*(ULONG64 UNALIGNED *)p));
+        p += 8;
+        length -= 8;
     }
 
-    return hash;
+    if (length != 0)
+    {
+        word = PhpReadHashTail(p, length);
+        hash2 = PhpHashRound(hash2, PHP_HASH_MULTIPLIER2, PhpUpcaseHashWord(word));
+    }
+
+    return PhpHashFinalize(hash1, hash2);
 }
 
 BOOLEAN NTAPI PhpSimpleHashtableCompareFunction(
@@ -4961,11 +6093,20 @@ PPH_HASHTABLE PhCreateSimpleHashtable(
     _In_ ULONG InitialCapacity
     )
 {
-    return PhCreateHashtable(
+    return PhCreateSimpleHashtableEx(InitialCapacity, 0);
+}
+
+PPH_HASHTABLE PhCreateSimpleHashtableEx(
+    _In_ ULONG InitialCapacity,
+    _In_ ULONG Flags
+    )
+{
+    return PhCreateHashtableEx(
         sizeof(PH_KEY_VALUE_PAIR),
         PhpSimpleHashtableCompareFunction,
         PhpSimpleHashtableHashFunction,
-        InitialCapacity
+        InitialCapacity,
+        Flags
         );
 }
 
@@ -5015,6 +6156,720 @@ BOOLEAN PhRemoveItemSimpleHashtable(
     return PhRemoveEntryHashtable(SimpleHashtable, &lookupEntry);
 }
 
+#define PHP_FLAT_HASHTABLE_GROUP_SIZE 16
+#define PHP_FLAT_HASHTABLE_CONTROL_EMPTY 0x80
+#define PHP_FLAT_HASHTABLE_CONTROL_DELETED 0xfe
+#define PHP_FLAT_HASHTABLE_MINIMUM_CAPACITY PHP_FLAT_HASHTABLE_GROUP_SIZE
+
+// Slots are used up to a load factor of 7/8.
+#define PhpGetFlatHashtableMaximumCount(Capacity) ((Capacity) - (Capacity) / 8)
+
+/**
+ * Gets a bit mask of the control bytes in a group that are equal to a value.
+ */
+FORCEINLINE ULONG PhpMatchFlatHashtableGroup(
+    _In_reads_(PHP_FLAT_HASHTABLE_GROUP_SIZE) PUCHAR Control,
+    _In_ UCHAR Value
+    )
+{
+    if (PhpVectorLevel >= PH_VECTOR_LEVEL_SSE2)
+    {
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((__m128i *)Control), _mm_set1_epi8((CHAR)Value)));
+    }
+    else
+    {
+        ULONG mask = 0;
+        ULONG i;
+
+        for (i = 0; i < PHP_FLAT_HASHTABLE_GROUP_SIZE; i++)
+        {
+            if (Control[i] == Value)
+                mask |= 1 << i;
+        }
+
+        return mask;
+    }
+}
+
+/**
+ * Gets a bit mask of the unused slots (empty or deleted) in a group.
+ */
+FORCEINLINE ULONG PhpMatchUnusedFlatHashtableGroup(
+    _In_reads_(PHP_FLAT_HASHTABLE_GROUP_SIZE) PUCHAR Control
+    )
+{
+    if (PhpVectorLevel >= PH_VECTOR_LEVEL_SSE2)
+    {
+        // Only unused control bytes have the high bit set.
+        return _mm_movemask_epi8(_mm_loadu_si128((__m128i *)Control));
+    }
+    else
+    {
+        ULONG mask = 0;
+        ULONG i;
+
+        for (i = 0; i < PHP_FLAT_HASHTABLE_GROUP_SIZE; i++)
+        {
+            if (Control[i] & 0x80)
+                mask |= 1 << i;
+        }
+
+        return mask;
+    }
+}
+
+FORCEINLINE ULONG PhpHashFlatHashtableEntry(
+    _In_ PPH_FLAT_HASHTABLE Hashtable,
+    _In_ PVOID Entry
+    )
+{
+    ULONG hash;
+
+    if (Hashtable->HashFunction)
+    {
+        hash = Hashtable->HashFunction(Entry);
+    }
+    else
+    {
+        switch (Hashtable->KeySize)
+        {
+        case sizeof(ULONG):
+            hash = PhHashInt32(*(PULONG)Entry);
+            break;
+        case sizeof(ULONG64):
+            hash = PhHashInt64(*(PULONG64)Entry);
+            break;
+        default:
+            hash = PhHashBytes(Entry, Hashtable->KeySize);
+            break;
+        }
+    }
+
+    // The low bits select the slot and the high bits are stored in the control byte, so
+    // make sure both depend on the whole hash code.
+    hash *= 0x9e3779b1;
+    hash ^= hash >> 15;
+
+    return hash;
+}
+
+FORCEINLINE BOOLEAN PhpCompareFlatHashtableEntries(
+    _In_ PPH_FLAT_HASHTABLE Hashtable,
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    )
+{
+    if (Hashtable->CompareFunction)
+        return Hashtable->CompareFunction(Entry1, Entry2);
+
+    switch (Hashtable->KeySize)
+    {
+    case sizeof(ULONG):
+        return *(PULONG)Entry1 == *(PULONG)Entry2;
+    case sizeof(ULONG64):
+        return *(PULONG64)Entry1 == *(PULONG64)Entry2;
+    default:
+        return memcmp(Entry1, Entry2, Hashtable->KeySize) == 0;
+    }
+}
+
+FORCEINLINE UCHAR PhpGetFlatHashtableControl(
+    _In_ ULONG HashCode
+    )
+{
+    return (UCHAR)(HashCode >> 25);
+}
+
+FORCEINLINE VOID PhpSetFlatHashtableControl(
+    _Inout_ PPH_FLAT_HASHTABLE Hashtable,
+    _In_ ULONG Index,
+    _In_ UCHAR Value
+    )
+{
+    // Also update the copy of the first group (if the slot is in it) which follows the
+    // control bytes and allows groups to be loaded with a single unaligned read.
+    Hashtable->Control[Index] = Value;
+    Hashtable->Control[((Index - (PHP_FLAT_HASHTABLE_GROUP_SIZE - 1)) & (Hashtable->Capacity - 1)) + PHP_FLAT_HASHTABLE_GROUP_SIZE - 1] = Value;
+}
+
+static ULONG PhpFindFlatHashtable(
+    _In_ PPH_FLAT_HASHTABLE Hashtable,
+    _In_ PVOID Entry,
+    _In_ ULONG HashCode
+    )
+{
+    ULONG mask;
+    ULONG position;
+    ULONG stride;
+    ULONG match;
+    ULONG bitIndex;
+    ULONG index;
+    UCHAR control;
+
+    mask = Hashtable->Capacity - 1;
+    position = HashCode & mask;
+    stride = 0;
+    control = PhpGetFlatHashtableControl(HashCode);
+
+    // The probe sequence visits every group because the capacity is a power of two, and
+    // it always ends because the hashtable is never full.
+    while (TRUE)
+    {
+        match = PhpMatchFlatHashtableGroup(Hashtable->Control + position, control);
+
+        while (_BitScanForward(&bitIndex, match))
+        {
+            index = (position + bitIndex) & mask;
+
+            if (
+                Hashtable->HashCodes[index] == HashCode &&
+                PhpCompareFlatHashtableEntries(Hashtable, PH_FLAT_HASHTABLE_GET_ENTRY(Hashtable, index), Entry)
+                )
+            {
+                return index;
+            }
+
+            match &= match - 1;
+        }
+
+        if (PhpMatchFlatHashtableGroup(Hashtable->Control + position, PHP_FLAT_HASHTABLE_CONTROL_EMPTY))
+            return -1;
+
+        stride += PHP_FLAT_HASHTABLE_GROUP_SIZE;
+        position = (position + stride) & mask;
+    }
+}
+
+static ULONG PhpFindUnusedFlatHashtable(
+    _In_ PPH_FLAT_HASHTABLE Hashtable,
+    _In_ ULONG HashCode
+    )
+{
+    ULONG mask;
+    ULONG position;
+    ULONG stride;
+    ULONG bitIndex;
+
+    mask = Hashtable->Capacity - 1;
+    position = HashCode & mask;
+    stride = 0;
+
+    while (!_BitScanForward(&bitIndex, PhpMatchUnusedFlatHashtableGroup(Hashtable->Control + position)))
+    {
+        stride += PHP_FLAT_HASHTABLE_GROUP_SIZE;
+        position = (position + stride) & mask;
+    }
+
+    return (position + bitIndex) & mask;
+}
+
+static VOID PhpAllocateFlatHashtable(
+    _Inout_ PPH_FLAT_HASHTABLE Hashtable,
+    _In_ ULONG Capacity
+    )
+{
+    Hashtable->Capacity = Capacity;
+    Hashtable->Count = 0;
+    Hashtable->GrowthLeft = PhpGetFlatHashtableMaximumCount(Capacity);
+    Hashtable->Control = PhAllocate(Capacity + PHP_FLAT_HASHTABLE_GROUP_SIZE - 1);
+    Hashtable->HashCodes = PhAllocate(sizeof(ULONG) * Capacity);
+    Hashtable->Entries = PhAllocate((SIZE_T)Hashtable->EntrySize * Capacity);
+    memset(Hashtable->Control, PHP_FLAT_HASHTABLE_CONTROL_EMPTY, Capacity + PHP_FLAT_HASHTABLE_GROUP_SIZE - 1);
+}
+
+static VOID PhpResizeFlatHashtable(
+    _Inout_ PPH_FLAT_HASHTABLE Hashtable
+    )
+{
+    ULONG oldCapacity;
+    PUCHAR oldControl;
+    PULONG oldHashCodes;
+    PVOID oldEntries;
+    ULONG capacity;
+    ULONG i;
+    ULONG index;
+
+    oldCapacity = Hashtable->Capacity;
+    oldControl = Hashtable->Control;
+    oldHashCodes = Hashtable->HashCodes;
+    oldEntries = Hashtable->Entries;
+
+    // If most of the unavailable slots are deleted entries, rebuilding the hashtable at the
+    // same size is enough.
+    capacity = oldCapacity;
+
+    if (Hashtable->Count >= PhpGetFlatHashtableMaximumCount(oldCapacity) / 2)
+        capacity *= 2;
+
+    PhpAllocateFlatHashtable(Hashtable, capacity);
+
+    for (i = 0; i < oldCapacity; i++)
+    {
+        if (oldControl[i] & 0x80)
+            continue;
+
+        index = PhpFindUnusedFlatHashtable(Hashtable, oldHashCodes[i]);
+        PhpSetFlatHashtableControl(Hashtable, index, oldControl[i]);
+        Hashtable->HashCodes[index] = oldHashCodes[i];
+        memcpy(
+            PH_FLAT_HASHTABLE_GET_ENTRY(Hashtable, index),
+            PTR_ADD_OFFSET(oldEntries, (SIZE_T)i * Hashtable->EntrySize),
+            Hashtable->EntrySize
+            );
+        Hashtable->Count++;
+        Hashtable->GrowthLeft--;
+    }
+
+    PhFree(oldControl);
+    PhFree(oldHashCodes);
+    PhFree(oldEntries);
+}
+
+/**
+ * Creates a flat hashtable object.
+ *
+ * \param EntrySize The size of each hashtable entry,
+ * in bytes.
+ * \param KeySize The size of the key at the start of each
+ * entry, in bytes. This is only used if \a CompareFunction
+ * and \a HashFunction are NULL.
+ * \param CompareFunction A comparison function that
+ * is executed to compare two hashtable entries, or NULL
+ * to compare keys.
+ * \param HashFunction A hash function that is executed
+ * to generate a hash code for a hashtable entry, or NULL
+ * to hash keys.
+ * \param InitialCapacity The number of entries to
+ * allocate storage for initially.
+ *
+ * \remarks Tables that compare keys avoid calling a function
+ * for each entry, and should be used for entries that start
+ * with a handle, pointer or other fixed-size key.
+ */
+PPH_FLAT_HASHTABLE PhCreateFlatHashtable(
+    _In_ ULONG EntrySize,
+    _In_ ULONG KeySize,
+    _In_opt_ PPH_HASHTABLE_COMPARE_FUNCTION CompareFunction,
+    _In_opt_ PPH_HASHTABLE_HASH_FUNCTION HashFunction,
+    _In_ ULONG InitialCapacity
+    )
+{
+    PPH_FLAT_HASHTABLE hashtable;
+    ULONG capacity;
+
+    if (!!CompareFunction != !!HashFunction)
+        PhRaiseStatus(STATUS_INVALID_PARAMETER_MIX);
+    if (!CompareFunction && (KeySize == 0 || KeySize > EntrySize))
+        PhRaiseStatus(STATUS_INVALID_PARAMETER_2);
+
+    hashtable = PhCreateObject(sizeof(PH_FLAT_HASHTABLE), PhFlatHashtableType);
+
+    hashtable->EntrySize = PH_FLAT_HASHTABLE_ENTRY_SIZE(EntrySize);
+    hashtable->KeySize = KeySize;
+    hashtable->CompareFunction = CompareFunction;
+    hashtable->HashFunction = HashFunction;
+
+    // Reserve enough slots for InitialCapacity entries at the maximum load factor.
+    capacity = PhRoundUpToPowerOfTwo(InitialCapacity + InitialCapacity / 7);
+
+    if (capacity < PHP_FLAT_HASHTABLE_MINIMUM_CAPACITY)
+        capacity = PHP_FLAT_HASHTABLE_MINIMUM_CAPACITY;
+
+    PhpAllocateFlatHashtable(hashtable, capacity);
+
+    return hashtable;
+}
+
+VOID PhpFlatHashtableDeleteProcedure(
+    _In_ PVOID Object,
+    _In_ ULONG Flags
+    )
+{
+    PPH_FLAT_HASHTABLE hashtable = (PPH_FLAT_HASHTABLE)Object;
+
+    PhFree(hashtable->Control);
+    PhFree(hashtable->HashCodes);
+    PhFree(hashtable->Entries);
+}
+
+/**
+ * Adds an entry to a flat hashtable.
+ *
+ * \param Hashtable A flat hashtable object.
+ * \param Entry The entry to add.
+ *
+ * \return A pointer to the entry as stored in
+ * the hashtable. This pointer is valid until
+ * the hashtable is modified. If the hashtable
+ * already contained an equal entry, NULL is returned.
+ */
+PVOID PhAddEntryFlatHashtable(
+    _Inout_ PPH_FLAT_HASHTABLE Hashtable,
+    _In_ PVOID Entry
+    )
+{
+    PVOID entry;
+    BOOLEAN added;
+
+    entry = PhAddEntryFlatHashtableEx(Hashtable, Entry, &added);
+
+    if (added)
+        return entry;
+    else
+        return NULL;
+}
+
+/**
+ * Adds an entry to a flat hashtable or returns an existing one.
+ *
+ * \param Hashtable A flat hashtable object.
+ * \param Entry The entry to add.
+ * \param Added A variable which receives TRUE if a
+ * new entry was created, and FALSE if an existing
+ * entry was returned.
+ *
+ * \return A pointer to the entry as stored in
+ * the hashtable. This pointer is valid until
+ * the hashtable is modified. If the hashtable
+ * already contained an equal entry, the existing
+ * entry is returned. Check the value of \a Added to
+ * determine whether the returned entry is new or existing.
+ */
+PVOID PhAddEntryFlatHashtableEx(
+    _Inout_ PPH_FLAT_HASHTABLE Hashtable,
+    _In_ PVOID Entry,
+    _Out_opt_ PBOOLEAN Added
+    )
+{
+    ULONG hashCode;
+    ULONG index;
+    PVOID entry;
+
+    hashCode = PhpHashFlatHashtableEntry(Hashtable, Entry);
+    index = PhpFindFlatHashtable(Hashtable, Entry, hashCode);
+
+    if (index != -1)
+    {
+        if (Added)
+            *Added = FALSE;
+
+        return PH_FLAT_HASHTABLE_GET_ENTRY(Hashtable, index);
+    }
+
+    if (Hashtable->GrowthLeft == 0)
+        PhpResizeFlatHashtable(Hashtable);
+
+    index = PhpFindUnusedFlatHashtable(Hashtable, hashCode);
+
+    // Reusing a deleted slot doesn't make probe sequences any longer.
+    if (Hashtable->Control[index] == PHP_FLAT_HASHTABLE_CONTROL_EMPTY)
+        Hashtable->GrowthLeft--;
+
+    PhpSetFlatHashtableControl(Hashtable, index, PhpGetFlatHashtableControl(hashCode));
+    Hashtable->HashCodes[index] = hashCode;
+    entry = PH_FLAT_HASHTABLE_GET_ENTRY(Hashtable, index);
+    memcpy(entry, Entry, Hashtable->EntrySize);
+    Hashtable->Count++;
+
+    if (Added)
+        *Added = TRUE;
+
+    return entry;
+}
+
+/**
+ * Removes all entries from a flat hashtable.
+ *
+ * \param Hashtable A flat hashtable object.
+ */
+VOID PhClearFlatHashtable(
+    _Inout_ PPH_FLAT_HASHTABLE Hashtable
+    )
+{
+    memset(Hashtable->Control, PHP_FLAT_HASHTABLE_CONTROL_EMPTY, Hashtable->Capacity + PHP_FLAT_HASHTABLE_GROUP_SIZE - 1);
+    Hashtable->Count = 0;
+    Hashtable->GrowthLeft = PhpGetFlatHashtableMaximumCount(Hashtable->Capacity);
+}
+
+/**
+ * Enumerates the entries in a flat hashtable.
+ *
+ * \param Hashtable A flat hashtable object.
+ * \param Entry A variable which receives a pointer to
+ * the hashtable entry. The pointer is valid until
+ * the hashtable is modified.
+ * \param EnumerationKey A variable which is initialized
+ * to 0 before first calling this function.
+ *
+ * \return TRUE if an entry pointer was stored in \a Entry,
+ * FALSE if there are no more entries.
+ *
+ * \remarks Do not modify the hashtable while the
+ * hashtable is being enumerated (between calls to
+ * this function). Otherwise, the function may
+ * behave unexpectedly. You may reset the
+ * \a EnumerationKey variable to 0 if you wish to
+ * restart the enumeration.
+ */
+BOOLEAN PhEnumFlatHashtable(
+    _In_ PPH_FLAT_HASHTABLE Hashtable,
+    _Out_ PVOID *Entry,
+    _Inout_ PULONG EnumerationKey
+    )
+{
+    while (*EnumerationKey < Hashtable->Capacity)
+    {
+        ULONG index = (*EnumerationKey)++;
+
+        if (!(Hashtable->Control[index] & 0x80))
+        {
+            *Entry = PH_FLAT_HASHTABLE_GET_ENTRY(Hashtable, index);
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/**
+ * Locates an entry in a flat hashtable.
+ *
+ * \param Hashtable A flat hashtable object.
+ * \param Entry An entry representing the
+ * entry to find.
+ *
+ * \return A pointer to the entry as stored in
+ * the hashtable. This pointer is valid until
+ * the hashtable is modified. If the entry
+ * could not be found, NULL is returned.
+ *
+ * \remarks The entry specified in \a Entry
+ * can be a partial entry that is filled in enough
+ * so that the comparison and hash functions can
+ * work with them.
+ */
+PVOID PhFindEntryFlatHashtable(
+    _In_ PPH_FLAT_HASHTABLE Hashtable,
+    _In_ PVOID Entry
+    )
+{
+    ULONG index;
+
+    index = PhpFindFlatHashtable(Hashtable, Entry, PhpHashFlatHashtableEntry(Hashtable, Entry));
+
+    if (index != -1)
+        return PH_FLAT_HASHTABLE_GET_ENTRY(Hashtable, index);
+    else
+        return NULL;
+}
+
+/**
+ * Removes an entry from a flat hashtable.
+ *
+ * \param Hashtable A flat hashtable object.
+ * \param Entry The entry to remove.
+ *
+ * \return TRUE if the entry was removed, FALSE if
+ * the entry could not be found.
+ *
+ * \remarks The entry specified in \a Entry can be
+ * an actual entry pointer returned by
+ * PhFindEntryFlatHashtable, or a partial entry.
+ */
+BOOLEAN PhRemoveEntryFlatHashtable(
+    _Inout_ PPH_FLAT_HASHTABLE Hashtable,
+    _In_ PVOID Entry
+    )
+{
+    ULONG index;
+
+    index = PhpFindFlatHashtable(Hashtable, Entry, PhpHashFlatHashtableEntry(Hashtable, Entry));
+
+    if (index == -1)
+        return FALSE;
+
+    // Lookups for other entries may need to probe past this slot, so it can't be marked as
+    // empty.
+    PhpSetFlatHashtableControl(Hashtable, index, PHP_FLAT_HASHTABLE_CONTROL_DELETED);
+    Hashtable->Count--;
+
+    return TRUE;
+}
+
+typedef struct _PHP_INTERN_ENTRY
+{
+    PPH_STRING String;
+    ULONG Hash;
+} PHP_INTERN_ENTRY, *PPHP_INTERN_ENTRY;
+
+static BOOLEAN NTAPI PhpInternCompareFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    )
+{
+    PPHP_INTERN_ENTRY entry1 = Entry1;
+    PPHP_INTERN_ENTRY entry2 = Entry2;
+
+    return entry1->Hash == entry2->Hash && PhEqualStringRef(&entry1->String->sr, &entry2->String->sr, FALSE);
+}
+
+static ULONG NTAPI PhpInternHashFunction(
+    _In_ PVOID Entry
+    )
+{
+    return ((PPHP_INTERN_ENTRY)Entry)->Hash;
+}
+
+static PPH_STRING PhpInternString(
+    _In_ PPH_STRINGREF String,
+    _In_opt_ PPH_STRING StringObject
+    )
+{
+    PH_STRING lookupString;
+    PHP_INTERN_ENTRY lookupEntry;
+    PPHP_INTERN_ENTRY entry;
+    PPH_STRING string;
+    BOOLEAN added;
+
+    if (PhBeginInitOnce(&PhpInternInitOnce))
+    {
+        PhpInternHashtable = PhCreateHashtable(
+            sizeof(PHP_INTERN_ENTRY),
+            PhpInternCompareFunction,
+            PhpInternHashFunction,
+            256
+            );
+        PhEndInitOnce(&PhpInternInitOnce);
+    }
+
+    // The comparison function only looks at the string reference, so a
+    // stack string is enough for lookups.
+    lookupString.sr = *String;
+    lookupEntry.String = &lookupString;
+    lookupEntry.Hash = PhHashStringRef(String, FALSE);
+
+    PhAcquireQueuedLockShared(&PhpInternLock);
+
+    if (entry = PhFindEntryHashtable(PhpInternHashtable, &lookupEntry))
+    {
+        string = entry->String;
+        PhReferenceObject(string);
+    }
+
+    PhReleaseQueuedLockShared(&PhpInternLock);
+
+    if (entry)
+        return string;
+
+    if (StringObject)
+    {
+        lookupEntry.String = StringObject;
+        PhReferenceObject(StringObject);
+    }
+    else
+    {
+        lookupEntry.String = PhCreateStringEx(String->Buffer, String->Length);
+    }
+
+    PhAcquireQueuedLockExclusive(&PhpInternLock);
+
+    // Someone else may have added the string in the meantime.
+    entry = PhAddEntryHashtableEx(PhpInternHashtable, &lookupEntry, &added);
+    string = entry->String;
+    // One reference for the table and one for the caller.
+    PhReferenceObject(string);
+
+    PhReleaseQueuedLockExclusive(&PhpInternLock);
+
+    if (!added)
+        PhDereferenceObject(lookupEntry.String);
+
+    return string;
+}
+
+/**
+ * Gets a shared copy of a string.
+ *
+ * \param String The string to intern. The string may itself become
+ * the shared copy, so it must not be modified after this function is
+ * called.
+ *
+ * \return A string equal to \a String. Equal strings are always
+ * interned as the same object, so interned strings can be compared
+ * by pointer. You must dereference the string when you no longer
+ * need it, and you must not modify it.
+ */
+PPH_STRING PhInternString(
+    _In_ PPH_STRING String
+    )
+{
+    return PhpInternString(&String->sr, String);
+}
+
+/**
+ * Gets a shared copy of a string.
+ *
+ * \param String The string to intern.
+ *
+ * \return A string equal to \a String. See PhInternString() for
+ * details.
+ */
+PPH_STRING PhInternStringRef(
+    _In_ PPH_STRINGREF String
+    )
+{
+    return PhpInternString(String, NULL);
+}
+
+/**
+ * Frees interned strings that are no longer being used.
+ *
+ * \remarks This function should be called periodically.
+ */
+VOID PhTrimInternedStrings(
+    VOID
+    )
+{
+    PPH_LIST unusedList;
+    ULONG enumerationKey;
+    PPHP_INTERN_ENTRY entry;
+    ULONG i;
+
+    if (!PhpInternHashtable)
+        return;
+
+    unusedList = PhCreateList(64);
+
+    PhAcquireQueuedLockExclusive(&PhpInternLock);
+
+    // Strings referenced only by the table are unused. New references can only be
+    // obtained through the table, and we own the lock.
+
+    enumerationKey = 0;
+
+    while (PhEnumHashtable(PhpInternHashtable, &entry, &enumerationKey))
+    {
+        if (PhGetObjectRefCount(entry->String) == 1)
+            PhAddItemList(unusedList, entry);
+    }
+
+    for (i = 0; i < unusedList->Count; i++)
+    {
+        PHP_INTERN_ENTRY removeEntry;
+
+        removeEntry = *(PPHP_INTERN_ENTRY)unusedList->Items[i];
+        unusedList->Items[i] = removeEntry.String;
+        PhRemoveEntryHashtable(PhpInternHashtable, &removeEntry);
+    }
+
+    PhReleaseQueuedLockExclusive(&PhpInternLock);
+
+    for (i = 0; i < unusedList->Count; i++)
+        PhDereferenceObject(unusedList->Items[i]);
+
+    PhDereferenceObject(unusedList);
+}
+
 /**
  * Initializes a free list object.
  *
@@ -5086,35 +6941,180 @@ PVOID PhAllocateFromFreeList(
         entry = PhAllocate(FIELD_OFFSET(PH_FREE_LIST_ENTRY, Body) + FreeList->Size);
     }
 
-    return &entry->Body;
+    return &entry->Body;
+}
+
+/**
+ * Frees a block of memory to a free list.
+ *
+ * \param FreeList A pointer to a free list object.
+ * \param Memory A pointer to a block of memory.
+ */
+VOID PhFreeToFreeList(
+    _Inout_ PPH_FREE_LIST FreeList,
+    _In_ PVOID Memory
+    )
+{
+    PPH_FREE_LIST_ENTRY entry;
+
+    entry = CONTAINING_RECORD(Memory, PH_FREE_LIST_ENTRY, Body);
+
+    // We don't enforce Count <= MaximumCount (that would require locking),
+    // but we do check it.
+    if (FreeList->Count < FreeList->MaximumCount)
+    {
+        RtlInterlockedPushEntrySList(&FreeList->ListHead, &entry->ListEntry);
+        _InterlockedIncrement((PLONG)&FreeList->Count);
+    }
+    else
+    {
+        PhFree(entry);
+    }
+}
+
+/**
+ * Frees blocks from a free list until it contains
+ * at most the specified number of blocks.
+ *
+ * \param FreeList A pointer to a free list object.
+ * \param MaximumCount The number of blocks to keep.
+ */
+VOID PhTrimFreeList(
+    _Inout_ PPH_FREE_LIST FreeList,
+    _In_ ULONG MaximumCount
+    )
+{
+    PSLIST_ENTRY listEntry;
+
+    while (FreeList->Count > MaximumCount)
+    {
+        listEntry = RtlInterlockedPopEntrySList(&FreeList->ListHead);
+
+        if (!listEntry)
+            break;
+
+        _InterlockedDecrement((PLONG)&FreeList->Count);
+        PhFree(CONTAINING_RECORD(listEntry, PH_FREE_LIST_ENTRY, ListEntry));
+    }
+}
+
+static PPH_CALLBACK_TIMING_FUNCTION PhpCallbackTimingFunction = NULL;
+
+typedef struct _PH_CALLBACK_ENTRY
+{
+    /** One reference for the registration and one for each snapshot containing the entry. */
+    LONG RefCount;
+    /** The number of invocations executing the callback function. */
+    LONG Busy;
+    volatile LONG Unregistering;
+    USHORT Flags;
+    PPH_CALLBACK_FUNCTION Function;
+    PVOID Context;
+} PH_CALLBACK_ENTRY, *PPH_CALLBACK_ENTRY;
+
+typedef struct _PH_CALLBACK_SNAPSHOT
+{
+    /** One reference while the snapshot is published and one for each invocation using it. */
+    LONG RefCount;
+    ULONG Count;
+    PPH_CALLBACK_ENTRY Entries[1];
+} PH_CALLBACK_SNAPSHOT, *PPH_CALLBACK_SNAPSHOT;
+
+static VOID PhpDereferenceCallbackEntry(
+    _In_ PPH_CALLBACK_ENTRY Entry
+    )
+{
+    if (_InterlockedDecrement(&Entry->RefCount) == 0)
+        PhFree(Entry);
+}
+
+static VOID PhpDereferenceCallbackSnapshot(
+    _In_ PPH_CALLBACK_SNAPSHOT Snapshot
+    )
+{
+    ULONG i;
+
+    if (_InterlockedDecrement(&Snapshot->RefCount) == 0)
+    {
+        for (i = 0; i < Snapshot->Count; i++)
+            PhpDereferenceCallbackEntry(Snapshot->Entries[i]);
+
+        // An invocation may have read the pointer just before the snapshot was replaced.
+        // It will see the zero reference count and try again, but the memory must remain
+        // valid until it has done so.
+        PhFreeAfterEpoch(Snapshot);
+    }
 }
 
 /**
- * Frees a block of memory to a free list.
- *
- * \param FreeList A pointer to a free list object.
- * \param Memory A pointer to a block of memory.
+ * Replaces the snapshot of a callback object with a copy
+ * of the current list. The list lock must be held in
+ * exclusive mode.
  */
-VOID PhFreeToFreeList(
-    _Inout_ PPH_FREE_LIST FreeList,
-    _In_ PVOID Memory
+static VOID PhpUpdateCallbackSnapshot(
+    _Inout_ PPH_CALLBACK Callback
     )
 {
-    PPH_FREE_LIST_ENTRY entry;
+    PPH_CALLBACK_SNAPSHOT snapshot = NULL;
+    PPH_CALLBACK_SNAPSHOT oldSnapshot;
+    PLIST_ENTRY listEntry;
+    ULONG count;
 
-    entry = CONTAINING_RECORD(Memory, PH_FREE_LIST_ENTRY, Body);
+    count = 0;
 
-    // We don't enforce Count <= MaximumCount (that would require locking),
-    // but we do check it.
-    if (FreeList->Count < FreeList->MaximumCount)
+    for (listEntry = Callback->ListHead.Flink; listEntry != &Callback->ListHead; listEntry = listEntry->Flink)
+        count++;
+
+    if (count != 0)
     {
-        RtlInterlockedPushEntrySList(&FreeList->ListHead, &entry->ListEntry);
-        _InterlockedIncrement((PLONG)&FreeList->Count);
+        snapshot = PhAllocate(FIELD_OFFSET(PH_CALLBACK_SNAPSHOT, Entries) + sizeof(PPH_CALLBACK_ENTRY) * count);
+        snapshot->RefCount = 1;
+        snapshot->Count = 0;
+
+        for (listEntry = Callback->ListHead.Flink; listEntry != &Callback->ListHead; listEntry = listEntry->Flink)
+        {
+            PPH_CALLBACK_ENTRY entry;
+
+            entry = CONTAINING_RECORD(listEntry, PH_CALLBACK_REGISTRATION, ListEntry)->Entry;
+            _InterlockedIncrement(&entry->RefCount);
+            snapshot->Entries[snapshot->Count++] = entry;
+        }
     }
-    else
+
+    oldSnapshot = _InterlockedExchangePointer(&Callback->Snapshot, snapshot);
+
+    if (oldSnapshot)
+        PhpDereferenceCallbackSnapshot(oldSnapshot);
+}
+
+static PPH_CALLBACK_SNAPSHOT PhpReferenceCallbackSnapshot(
+    _In_ PPH_CALLBACK Callback
+    )
+{
+    PH_EPOCH_GUARD guard;
+    PPH_CALLBACK_SNAPSHOT snapshot;
+    LONG refCount;
+
+    PhEnterEpoch(&guard);
+
+    while (TRUE)
     {
-        PhFree(entry);
+        snapshot = *(PPH_CALLBACK_SNAPSHOT volatile *)&Callback->Snapshot;
+
+        if (!snapshot)
+            break;
+
+        refCount = snapshot->RefCount;
+
+        // A reference count of zero means the snapshot has just been replaced, and the new
+        // one has already been published.
+        if (refCount != 0 && _InterlockedCompareExchange(&snapshot->RefCount, refCount + 1, refCount) == refCount)
+            break;
     }
+
+    PhLeaveEpoch(&guard);
+
+    return snapshot;
 }
 
 /**
@@ -5129,6 +7129,7 @@ VOID PhInitializeCallback(
     InitializeListHead(&Callback->ListHead);
     PhInitializeQueuedLock(&Callback->ListLock);
     PhInitializeQueuedLock(&Callback->BusyCondition);
+    Callback->Snapshot = NULL;
 }
 
 /**
@@ -5140,7 +7141,10 @@ VOID PhDeleteCallback(
     _Inout_ PPH_CALLBACK Callback
     )
 {
-    // Nothing for now
+    PPH_CALLBACK_SNAPSHOT snapshot;
+
+    if (snapshot = _InterlockedExchangePointer(&Callback->Snapshot, NULL))
+        PhpDereferenceCallbackSnapshot(snapshot);
 }
 
 /**
@@ -5180,7 +7184,9 @@ VOID PhRegisterCallback(
  * \param Context A user-defined value to pass to the
  * callback function.
  * \param Flags A combination of flags controlling the
- * callback. Set this parameter to 0.
+ * callback.
+ * \li \c PH_CALLBACK_BATCH The callback function receives
+ * a PH_CALLBACK_BATCH structure as its parameter.
  * \param Registration A variable which receives
  * registration information for the callback. Do not
  * modify the contents of this structure and do not
@@ -5195,14 +7201,24 @@ VOID PhRegisterCallbackEx(
     _Out_ PPH_CALLBACK_REGISTRATION Registration
     )
 {
+    PPH_CALLBACK_ENTRY entry;
+
+    entry = PhAllocate(sizeof(PH_CALLBACK_ENTRY));
+    entry->RefCount = 1;
+    entry->Busy = 0;
+    entry->Unregistering = FALSE;
+    entry->Flags = Flags;
+    entry->Function = Function;
+    entry->Context = Context;
+
     Registration->Function = Function;
     Registration->Context = Context;
-    Registration->Busy = 0;
-    Registration->Unregistering = FALSE;
+    Registration->Entry = entry;
     Registration->Flags = Flags;
 
     PhAcquireQueuedLockExclusive(&Callback->ListLock);
     InsertTailList(&Callback->ListHead, &Registration->ListEntry);
+    PhpUpdateCallbackSnapshot(Callback);
     PhReleaseQueuedLockExclusive(&Callback->ListLock);
 }
 
@@ -5223,73 +7239,172 @@ VOID PhUnregisterCallback(
     _Inout_ PPH_CALLBACK_REGISTRATION Registration
     )
 {
-    Registration->Unregistering = TRUE;
+    PPH_CALLBACK_ENTRY entry = Registration->Entry;
+
+    // The exchange is a full barrier. Invocations increment the busy count before checking
+    // this flag, so either they see the flag or we see their busy count below.
+    _InterlockedExchange(&entry->Unregistering, TRUE);
 
     PhAcquireQueuedLockExclusive(&Callback->ListLock);
 
     // Wait for the callback to be unbusy.
-    while (Registration->Busy)
+    while (entry->Busy)
         PhWaitForCondition(&Callback->BusyCondition, &Callback->ListLock, NULL);
 
     RemoveEntryList(&Registration->ListEntry);
+    PhpUpdateCallbackSnapshot(Callback);
 
     PhReleaseQueuedLockExclusive(&Callback->ListLock);
+
+    // Invocations still using an older snapshot keep the entry alive, but they will not
+    // call the function again.
+    PhpDereferenceCallbackEntry(entry);
 }
 
-/**
- * Notifies all registered callback functions.
- *
- * \param Callback A pointer to a callback object.
- * \param Parameter A value to pass to all callback
- * functions.
- */
-VOID PhInvokeCallback(
+static VOID PhpInvokeCallbackSnapshot(
     _In_ PPH_CALLBACK Callback,
-    _In_opt_ PVOID Parameter
+    _In_ PPH_CALLBACK_SNAPSHOT Snapshot,
+    _In_reads_(Count) PVOID *Parameters,
+    _In_ ULONG Count
     )
 {
-    PLIST_ENTRY listEntry;
-
-    PhAcquireQueuedLockShared(&Callback->ListLock);
+    PPH_CALLBACK_TIMING_FUNCTION timingFunction;
+    LARGE_INTEGER startCounter;
+    LARGE_INTEGER endCounter;
+    ULONG i;
+    ULONG j;
 
-    listEntry = Callback->ListHead.Flink;
+    timingFunction = PhpCallbackTimingFunction;
 
-    while (listEntry != &Callback->ListHead)
+    for (i = 0; i < Snapshot->Count; i++)
     {
-        PPH_CALLBACK_REGISTRATION registration;
+        PPH_CALLBACK_ENTRY entry = Snapshot->Entries[i];
         LONG busy;
 
-        registration = CONTAINING_RECORD(listEntry, PH_CALLBACK_REGISTRATION, ListEntry);
-
         // Don't bother executing the callback function if
         // it is being unregistered.
-        if (registration->Unregistering)
+        if (entry->Unregistering)
             continue;
 
-        _InterlockedIncrement(&registration->Busy);
+        _InterlockedIncrement(&entry->Busy);
 
         // Execute the callback function.
 
-        PhReleaseQueuedLockShared(&Callback->ListLock);
-        registration->Function(
-            Parameter,
-            registration->Context
-            );
-        PhAcquireQueuedLockShared(&Callback->ListLock);
+        if (!entry->Unregistering)
+        {
+            if (timingFunction)
+                NtQueryPerformanceCounter(&startCounter, NULL);
+
+            if (entry->Flags & PH_CALLBACK_BATCH)
+            {
+                PH_CALLBACK_BATCH batch;
+
+                batch.Count = Count;
+                batch.Parameters = Parameters;
+                entry->Function(&batch, entry->Context);
+            }
+            else
+            {
+                for (j = 0; j < Count; j++)
+                    entry->Function(Parameters[j], entry->Context);
+            }
+
+            if (timingFunction)
+            {
+                NtQueryPerformanceCounter(&endCounter, NULL);
+                timingFunction(entry->Function, endCounter.QuadPart - startCounter.QuadPart);
+            }
+        }
 
-        busy = _InterlockedDecrement(&registration->Busy);
+        busy = _InterlockedDecrement(&entry->Busy);
 
-        if (registration->Unregistering && busy == 0)
+        if (entry->Unregistering && busy == 0)
         {
             // Someone started unregistering while the callback
-            // function was executing, and we must wake them.
+            // function was executing, and we must wake them. The lock
+            // makes sure they are either waiting already or have not
+            // checked the busy count yet.
+            PhAcquireQueuedLockShared(&Callback->ListLock);
             PhPulseAllCondition(&Callback->BusyCondition);
+            PhReleaseQueuedLockShared(&Callback->ListLock);
         }
+    }
+}
+
+/**
+ * Notifies all registered callback functions.
+ *
+ * \param Callback A pointer to a callback object.
+ * \param Parameter A value to pass to all callback
+ * functions.
+ *
+ * \remarks The callback functions are called without holding
+ * any locks, using a copy of the list that was current when
+ * this function was called.
+ */
+VOID PhInvokeCallback(
+    _In_ PPH_CALLBACK Callback,
+    _In_opt_ PVOID Parameter
+    )
+{
+    PPH_CALLBACK_SNAPSHOT snapshot;
+
+    if (snapshot = PhpReferenceCallbackSnapshot(Callback))
+    {
+        PhpInvokeCallbackSnapshot(Callback, snapshot, &Parameter, 1);
+        PhpDereferenceCallbackSnapshot(snapshot);
+    }
+}
+
+/**
+ * Notifies all registered callback functions of several
+ * parameters at once.
+ *
+ * \param Callback A pointer to a callback object.
+ * \param Parameters An array of values to pass to the
+ * callback functions.
+ * \param Count The number of elements in \a Parameters.
+ *
+ * \remarks Functions registered with PH_CALLBACK_BATCH are
+ * called once with all of the parameters. Other functions are
+ * called once for each parameter, in order.
+ */
+VOID PhInvokeCallbackBatch(
+    _In_ PPH_CALLBACK Callback,
+    _In_reads_(Count) PVOID *Parameters,
+    _In_ ULONG Count
+    )
+{
+    PPH_CALLBACK_SNAPSHOT snapshot;
 
-        listEntry = listEntry->Flink;
+    if (Count == 0)
+        return;
+
+    if (snapshot = PhpReferenceCallbackSnapshot(Callback))
+    {
+        PhpInvokeCallbackSnapshot(Callback, snapshot, Parameters, Count);
+        PhpDereferenceCallbackSnapshot(snapshot);
     }
+}
 
-    PhReleaseQueuedLockShared(&Callback->ListLock);
+/**
+ * Sets a function which receives the time taken by each
+ * callback function invoked by PhInvokeCallback() and
+ * PhInvokeCallbackBatch().
+ *
+ * \param TimingFunction The timing function, or NULL
+ * to stop timing callback functions.
+ *
+ * \remarks The timing function is called on the thread
+ * invoking the callback and must be thread-safe. It may
+ * still be called for a short time after it has been
+ * replaced.
+ */
+VOID PhSetCallbackTimingFunction(
+    _In_opt_ PPH_CALLBACK_TIMING_FUNCTION TimingFunction
+    )
+{
+    _InterlockedExchangePointer((PVOID *)&PhpCallbackTimingFunction, (PVOID)TimingFunction);
 }
 
 /**
@@ -5883,3 +7998,280 @@ VOID FASTCALL PhxfDivideSingle2U(PFLOAT A, FLOAT B, ULONG Count)
 {
     PhDivideSinglesBySingle(A, B, Count);
 }
+
+/**
+ * Finds the largest number in an array.
+ *
+ * \param A The array.
+ * \param Count The number of elements.
+ *
+ * \return The largest element, or 0 if \a Count is 0.
+ */
+ULONG PhMaximumUlongs(
+    _In_reads_(Count) PULONG A,
+    _In_ SIZE_T Count
+    )
+{
+    ULONG maximum;
+
+    if (Count == 0)
+        return 0;
+
+    maximum = A[0];
+
+    if (PhpVectorLevel >= PH_VECTOR_LEVEL_SSE2 && Count >= 4)
+    {
+        __m128i bias;
+        __m128i max;
+        ULONG lanes[4];
+        ULONG i;
+
+        // SSE2 only has signed comparisons, so flip the sign bits of both sides first.
+        bias = _mm_set1_epi32(0x80000000);
+        max = _mm_xor_si128(_mm_set1_epi32(maximum), bias);
+
+        while (Count >= 4)
+        {
+            __m128i a;
+            __m128i greater;
+
+            a = _mm_xor_si128(_mm_loadu_si128((__m128i *)A), bias);
+            greater = _mm_cmpgt_epi32(a, max);
+            max = _mm_or_si128(_mm_and_si128(greater, a), _mm_andnot_si128(greater, max));
+
+            A += 4;
+            Count -= 4;
+        }
+
+        _mm_storeu_si128((__m128i *)lanes, _mm_xor_si128(max, bias));
+
+        for (i = 0; i < 4; i++)
+        {
+            if (maximum < lanes[i])
+                maximum = lanes[i];
+        }
+    }
+
+    while (Count--)
+    {
+        if (maximum < *A)
+            maximum = *A;
+
+        A++;
+    }
+
+    return maximum;
+}
+
+/**
+ * Finds the largest number in an array.
+ *
+ * \param A The array.
+ * \param Count The number of elements.
+ *
+ * \return The largest element, or 0 if \a Count is 0.
+ */
+ULONG64 PhMaximumUlong64s(
+    _In_reads_(Count) PULONG64 A,
+    _In_ SIZE_T Count
+    )
+{
+    ULONG64 maximum1;
+    ULONG64 maximum2;
+
+    if (Count == 0)
+        return 0;
+
+    // SSE2 has no 64-bit comparisons. Two independent maxima still let the compares
+    // overlap.
+
+    maximum1 = A[0];
+    maximum2 = A[0];
+
+    while (Count >= 2)
+    {
+        if (maximum1 < A[0])
+            maximum1 = A[0];
+        if (maximum2 < A[1])
+            maximum2 = A[1];
+
+        A += 2;
+        Count -= 2;
+    }
+
+    if (Count != 0 && maximum1 < A[0])
+        maximum1 = A[0];
+
+    return maximum1 > maximum2 ? maximum1 : maximum2;
+}
+
+/**
+ * Finds the largest number in an array.
+ *
+ * \param A The array.
+ * \param Count The number of elements.
+ *
+ * \return The largest element, or 0 if \a Count is 0.
+ */
+FLOAT PhMaximumSingles(
+    _In_reads_(Count) PFLOAT A,
+    _In_ SIZE_T Count
+    )
+{
+    FLOAT maximum;
+
+    if (Count == 0)
+        return 0;
+
+    maximum = A[0];
+
+    if (PhpVectorLevel >= PH_VECTOR_LEVEL_SSE2 && Count >= 4)
+    {
+        __m128 max;
+
+        max = _mm_set1_ps(maximum);
+
+        while (Count >= 4)
+        {
+            max = _mm_max_ps(max, _mm_loadu_ps(A));
+            A += 4;
+            Count -= 4;
+        }
+
+        max = _mm_max_ps(max, _mm_movehl_ps(max, max));
+        max = _mm_max_ss(max, _mm_shuffle_ps(max, max, 1));
+        maximum = _mm_cvtss_f32(max);
+    }
+
+    while (Count--)
+    {
+        if (maximum < *A)
+            maximum = *A;
+
+        A++;
+    }
+
+    return maximum;
+}
+
+/**
+ * Adds together the numbers in an array.
+ *
+ * \param A The array.
+ * \param Count The number of elements.
+ */
+ULONG64 PhSumUlongs(
+    _In_reads_(Count) PULONG A,
+    _In_ SIZE_T Count
+    )
+{
+    ULONG64 sum = 0;
+
+    if (PhpVectorLevel >= PH_VECTOR_LEVEL_SSE2 && Count >= 4)
+    {
+        __m128i zero;
+        __m128i total;
+        ULONG64 lanes[2];
+
+        // Widen each group of four to two pairs of 64-bit lanes so the sum cannot overflow.
+        zero = _mm_setzero_si128();
+        total = _mm_setzero_si128();
+
+        while (Count >= 4)
+        {
+            __m128i a;
+
+            a = _mm_loadu_si128((__m128i *)A);
+            total = _mm_add_epi64(total, _mm_unpacklo_epi32(a, zero));
+            total = _mm_add_epi64(total, _mm_unpackhi_epi32(a, zero));
+
+            A += 4;
+            Count -= 4;
+        }
+
+        _mm_storeu_si128((__m128i *)lanes, total);
+        sum = lanes[0] + lanes[1];
+    }
+
+    while (Count--)
+        sum += *A++;
+
+    return sum;
+}
+
+/**
+ * Adds together the numbers in an array.
+ *
+ * \param A The array.
+ * \param Count The number of elements.
+ */
+ULONG64 PhSumUlong64s(
+    _In_reads_(Count) PULONG64 A,
+    _In_ SIZE_T Count
+    )
+{
+    ULONG64 sum = 0;
+
+    if (PhpVectorLevel >= PH_VECTOR_LEVEL_SSE2 && Count >= 2)
+    {
+        __m128i total;
+        ULONG64 lanes[2];
+
+        total = _mm_setzero_si128();
+
+        while (Count >= 2)
+        {
+            total = _mm_add_epi64(total, _mm_loadu_si128((__m128i *)A));
+            A += 2;
+            Count -= 2;
+        }
+
+        _mm_storeu_si128((__m128i *)lanes, total);
+        sum = lanes[0] + lanes[1];
+    }
+
+    while (Count--)
+        sum += *A++;
+
+    return sum;
+}
+
+/**
+ * Adds together the numbers in an array.
+ *
+ * \param A The array.
+ * \param Count The number of elements.
+ *
+ * \remarks The elements are not added in order, so the result may differ slightly
+ * from a sequential sum.
+ */
+FLOAT PhSumSingles(
+    _In_reads_(Count) PFLOAT A,
+    _In_ SIZE_T Count
+    )
+{
+    FLOAT sum = 0;
+
+    if (PhpVectorLevel >= PH_VECTOR_LEVEL_SSE2 && Count >= 4)
+    {
+        __m128 total;
+
+        total = _mm_setzero_ps();
+
+        while (Count >= 4)
+        {
+            total = _mm_add_ps(total, _mm_loadu_ps(A));
+            A += 4;
+            Count -= 4;
+        }
+
+        total = _mm_add_ps(total, _mm_movehl_ps(total, total));
+        total = _mm_add_ss(total, _mm_shuffle_ps(total, total, 1));
+        sum = _mm_cvtss_f32(total);
+    }
+
+    while (Count--)
+        sum += *A++;
+
+    return sum;
+}
@@ -26,7 +26,13 @@ PPH_STRING PhaCreateString(
     _In_ PWSTR Buffer
     )
 {
-    return PhAutoDereferenceObject(PhCreateString(Buffer));
+    PPH_STRING string;
+
+    PhBeginAutoPoolArena();
+    string = PhCreateString(Buffer);
+    PhEndAutoPoolArena();
+
+    return PhAutoDereferenceObject(string);
 }
 
 PPH_STRING PhaCreateStringEx(
@@ -34,14 +40,26 @@ PPH_STRING PhaCreateStringEx(
     _In_ SIZE_T Length
     )
 {
-    return PhAutoDereferenceObject(PhCreateStringEx(Buffer, Length));
+    PPH_STRING string;
+
+    PhBeginAutoPoolArena();
+    string = PhCreateStringEx(Buffer, Length);
+    PhEndAutoPoolArena();
+
+    return PhAutoDereferenceObject(string);
 }
 
 PPH_STRING PhaDuplicateString(
     _In_ PPH_STRING String
     )
 {
-    return PhAutoDereferenceObject(PhDuplicateString(String));
+    PPH_STRING string;
+
+    PhBeginAutoPoolArena();
+    string = PhDuplicateString(String);
+    PhEndAutoPoolArena();
+
+    return PhAutoDereferenceObject(string);
 }
 
 PPH_STRING PhaConcatStrings(
@@ -50,10 +68,15 @@ PPH_STRING PhaConcatStrings(
     )
 {
     va_list argptr;
+    PPH_STRING string;
 
     va_start(argptr, Count);
 
-    return PhAutoDereferenceObject(PhConcatStrings_V(Count, argptr));
+    PhBeginAutoPoolArena();
+    string = PhConcatStrings_V(Count, argptr);
+    PhEndAutoPoolArena();
+
+    return PhAutoDereferenceObject(string);
 }
 
 PPH_STRING PhaConcatStrings2(
@@ -61,7 +84,13 @@ PPH_STRING PhaConcatStrings2(
     _In_ PWSTR String2
     )
 {
-    return PhAutoDereferenceObject(PhConcatStrings2(String1, String2));
+    PPH_STRING string;
+
+    PhBeginAutoPoolArena();
+    string = PhConcatStrings2(String1, String2);
+    PhEndAutoPoolArena();
+
+    return PhAutoDereferenceObject(string);
 }
 
 PPH_STRING PhaFormatString(
@@ -70,10 +99,15 @@ PPH_STRING PhaFormatString(
     )
 {
     va_list argptr;
+    PPH_STRING string;
 
     va_start(argptr, Format);
 
-    return PhAutoDereferenceObject(PhFormatString_V(Format, argptr));
+    PhBeginAutoPoolArena();
+    string = PhFormatString_V(Format, argptr);
+    PhEndAutoPoolArena();
+
+    return PhAutoDereferenceObject(string);
 }
 
 PPH_STRING PhaLowerString(
@@ -106,5 +140,11 @@ PPH_STRING PhaSubstring(
     _In_ SIZE_T Count
     )
 {
-    return PhAutoDereferenceObject(PhSubstring(String, StartIndex, Count));
+    PPH_STRING string;
+
+    PhBeginAutoPoolArena();
+    string = PhSubstring(String, StartIndex, Count);
+    PhEndAutoPoolArena();
+
+    return PhAutoDereferenceObject(string);
 }
@@ -1,6 +1,35 @@
 #include <phbase.h>
 #include <circbuf.h>
 
+static PVOID PhpAllocateCircularBufferData(
+    _In_opt_ PPH_ARENA Arena,
+    _In_ SIZE_T Size
+    )
+{
+    PVOID data;
+
+    if (!Arena)
+        return PhAllocate(Size);
+
+    // Fail the same way as PhAllocate.
+    if (!(data = PhAllocateArena(Arena, Size, NULL)))
+        PhRaiseStatus(STATUS_NO_MEMORY);
+
+    return data;
+}
+
+static VOID PhpFreeCircularBufferData(
+    _In_opt_ PPH_ARENA Arena,
+    _In_ PVOID Data,
+    _In_ SIZE_T Size
+    )
+{
+    if (!Arena)
+        PhFree(Data);
+    else
+        PhFreeArena(Arena, Data, Size);
+}
+
 #undef T
 #define T ULONG
 #include "circbuf_i.h"
@@ -20,3 +49,523 @@
 #undef T
 #define T FLOAT
 #include "circbuf_i.h"
+
+static VOID PhpGetRangesCircularBuffer(
+    _In_ ULONG Size,
+    _In_ LONG BufferIndex,
+    _In_ ULONG BufferCount,
+    _In_ ULONG Index,
+    _In_ ULONG Count,
+    _Out_ PULONG Start,
+    _Out_ PULONG FirstCount,
+    _Out_ PULONG SecondCount
+    )
+{
+    ULONG start;
+    ULONG firstCount;
+
+    if (Index >= BufferCount)
+        Count = 0;
+    else if (Count > BufferCount - Index)
+        Count = BufferCount - Index;
+
+#ifdef PH_CIRCULAR_BUFFER_POWER_OF_TWO_SIZE
+    start = (ULONG)(BufferIndex + Index) & (Size - 1);
+#else
+    start = (ULONG)(BufferIndex + Index) % Size;
+#endif
+
+    // The first range runs to the end of the data array, the second one starts again at
+    // the beginning.
+    firstCount = Size - start;
+
+    if (firstCount > Count)
+        firstCount = Count;
+
+    *Start = start;
+    *FirstCount = firstCount;
+    *SecondCount = Count - firstCount;
+}
+
+ULONG PhMaximumCircularBuffer_ULONG(
+    _In_ PPH_CIRCULAR_BUFFER_ULONG Buffer,
+    _In_ ULONG Index,
+    _In_ ULONG Count
+    )
+{
+    ULONG start;
+    ULONG firstCount;
+    ULONG secondCount;
+    ULONG maximum;
+    ULONG maximum2;
+
+    PhpGetRangesCircularBuffer(Buffer->Size, Buffer->Index, Buffer->Count, Index, Count, &start, &firstCount, &secondCount);
+    maximum = PhMaximumUlongs(&Buffer->Data[start], firstCount);
+
+    if (secondCount != 0)
+    {
+        maximum2 = PhMaximumUlongs(Buffer->Data, secondCount);
+
+        if (maximum < maximum2)
+            maximum = maximum2;
+    }
+
+    return maximum;
+}
+
+ULONG64 PhMaximumCircularBuffer_ULONG64(
+    _In_ PPH_CIRCULAR_BUFFER_ULONG64 Buffer,
+    _In_ ULONG Index,
+    _In_ ULONG Count
+    )
+{
+    ULONG start;
+    ULONG firstCount;
+    ULONG secondCount;
+    ULONG64 maximum;
+    ULONG64 maximum2;
+
+    PhpGetRangesCircularBuffer(Buffer->Size, Buffer->Index, Buffer->Count, Index, Count, &start, &firstCount, &secondCount);
+    maximum = PhMaximumUlong64s(&Buffer->Data[start], firstCount);
+
+    if (secondCount != 0)
+    {
+        maximum2 = PhMaximumUlong64s(Buffer->Data, secondCount);
+
+        if (maximum < maximum2)
+            maximum = maximum2;
+    }
+
+    return maximum;
+}
+
+FLOAT PhMaximumCircularBuffer_FLOAT(
+    _In_ PPH_CIRCULAR_BUFFER_FLOAT Buffer,
+    _In_ ULONG Index,
+    _In_ ULONG Count
+    )
+{
+    ULONG start;
+    ULONG firstCount;
+    ULONG secondCount;
+    FLOAT maximum;
+    FLOAT maximum2;
+
+    PhpGetRangesCircularBuffer(Buffer->Size, Buffer->Index, Buffer->Count, Index, Count, &start, &firstCount, &secondCount);
+    maximum = PhMaximumSingles(&Buffer->Data[start], firstCount);
+
+    if (secondCount != 0)
+    {
+        maximum2 = PhMaximumSingles(Buffer->Data, secondCount);
+
+        if (maximum < maximum2)
+            maximum = maximum2;
+    }
+
+    return maximum;
+}
+
+ULONG64 PhSumCircularBuffer_ULONG(
+    _In_ PPH_CIRCULAR_BUFFER_ULONG Buffer,
+    _In_ ULONG Index,
+    _In_ ULONG Count
+    )
+{
+    ULONG start;
+    ULONG firstCount;
+    ULONG secondCount;
+
+    PhpGetRangesCircularBuffer(Buffer->Size, Buffer->Index, Buffer->Count, Index, Count, &start, &firstCount, &secondCount);
+
+    return PhSumUlongs(&Buffer->Data[start], firstCount) + PhSumUlongs(Buffer->Data, secondCount);
+}
+
+ULONG64 PhSumCircularBuffer_ULONG64(
+    _In_ PPH_CIRCULAR_BUFFER_ULONG64 Buffer,
+    _In_ ULONG Index,
+    _In_ ULONG Count
+    )
+{
+    ULONG start;
+    ULONG firstCount;
+    ULONG secondCount;
+
+    PhpGetRangesCircularBuffer(Buffer->Size, Buffer->Index, Buffer->Count, Index, Count, &start, &firstCount, &secondCount);
+
+    return PhSumUlong64s(&Buffer->Data[start], firstCount) + PhSumUlong64s(Buffer->Data, secondCount);
+}
+
+FLOAT PhSumCircularBuffer_FLOAT(
+    _In_ PPH_CIRCULAR_BUFFER_FLOAT Buffer,
+    _In_ ULONG Index,
+    _In_ ULONG Count
+    )
+{
+    ULONG start;
+    ULONG firstCount;
+    ULONG secondCount;
+
+    PhpGetRangesCircularBuffer(Buffer->Size, Buffer->Index, Buffer->Count, Index, Count, &start, &firstCount, &secondCount);
+
+    return PhSumSingles(&Buffer->Data[start], firstCount) + PhSumSingles(Buffer->Data, secondCount);
+}
+
+VOID PhInitializeSlidingMaximum(
+    _Out_ PPH_SLIDING_MAXIMUM Maximum,
+    _In_ ULONG WindowSize
+    )
+{
+    ULONG size;
+
+    if (WindowSize == 0)
+        WindowSize = 1;
+
+    // The window never holds more than WindowSize items.
+    size = PhRoundUpToPowerOfTwo(WindowSize);
+
+    Maximum->WindowSize = WindowSize;
+    Maximum->SizeMinusOne = size - 1;
+    Maximum->Head = 0;
+    Maximum->Count = 0;
+    Maximum->Sequence = 0;
+    Maximum->Values = PhAllocate(sizeof(ULONG64) * size);
+    Maximum->Sequences = PhAllocate(sizeof(ULONG) * size);
+}
+
+VOID PhDeleteSlidingMaximum(
+    _Inout_ PPH_SLIDING_MAXIMUM Maximum
+    )
+{
+    PhFree(Maximum->Sequences);
+    PhFree(Maximum->Values);
+}
+
+VOID PhClearSlidingMaximum(
+    _Inout_ PPH_SLIDING_MAXIMUM Maximum
+    )
+{
+    Maximum->Head = 0;
+    Maximum->Count = 0;
+    Maximum->Sequence = 0;
+}
+
+VOID PhAddItemSlidingMaximum(
+    _Inout_ PPH_SLIDING_MAXIMUM Maximum,
+    _In_ ULONG64 Value
+    )
+{
+    ULONG sequence;
+    ULONG index;
+
+    sequence = Maximum->Sequence++;
+
+    // Drop the oldest item if it has left the window.
+    if (Maximum->Count != 0 && sequence - Maximum->Sequences[Maximum->Head] >= Maximum->WindowSize)
+    {
+        Maximum->Head = (Maximum->Head + 1) & Maximum->SizeMinusOne;
+        Maximum->Count--;
+    }
+
+    // Items that are not larger than the new one can never be the maximum again.
+    while (Maximum->Count != 0 && Maximum->Values[(Maximum->Head + Maximum->Count - 1) & Maximum->SizeMinusOne] <= Value)
+        Maximum->Count--;
+
+    index = (Maximum->Head + Maximum->Count) & Maximum->SizeMinusOne;
+    Maximum->Values[index] = Value;
+    Maximum->Sequences[index] = sequence;
+    Maximum->Count++;
+}
+
+static PUCHAR PhpEncodeCompressedCircularBufferItem(
+    _Out_writes_bytes_(10) PUCHAR Buffer,
+    _In_ ULONG Encoding,
+    _In_ ULONG64 PreviousValue,
+    _In_ ULONG64 Value
+    )
+{
+    ULONG64 encoded;
+
+    if (Encoding == PH_COMPRESSED_CIRCULAR_BUFFER_DELTA)
+    {
+        LONG64 delta = (LONG64)(Value - PreviousValue);
+
+        // Zigzag encoding keeps small negative deltas small.
+        encoded = ((ULONG64)delta << 1) ^ (ULONG64)(delta >> 63);
+    }
+    else
+    {
+        encoded = Value ^ PreviousValue;
+    }
+
+    while (encoded >= 0x80)
+    {
+        *Buffer++ = (UCHAR)encoded | 0x80;
+        encoded >>= 7;
+    }
+
+    *Buffer++ = (UCHAR)encoded;
+
+    return Buffer;
+}
+
+static PUCHAR PhpDecodeCompressedCircularBufferItem(
+    _In_ PUCHAR Buffer,
+    _In_ ULONG Encoding,
+    _In_ ULONG64 PreviousValue,
+    _Out_ PULONG64 Value
+    )
+{
+    ULONG64 encoded = 0;
+    ULONG shift = 0;
+    UCHAR byte;
+
+    do
+    {
+        byte = *Buffer++;
+        encoded |= (ULONG64)(byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+
+    if (Encoding == PH_COMPRESSED_CIRCULAR_BUFFER_DELTA)
+        *Value = PreviousValue + (ULONG64)((LONG64)(encoded >> 1) ^ -(LONG64)(encoded & 1));
+    else
+        *Value = PreviousValue ^ encoded;
+
+    return Buffer;
+}
+
+static ULONG64 PhpDecodeCompressedCircularBufferChunk(
+    _In_ PUCHAR Chunk,
+    _In_ ULONG Encoding,
+    _In_ ULONG Position,
+    _Out_writes_opt_(Position + 1) PULONG64 Values
+    )
+{
+    ULONG64 value = 0;
+    ULONG i;
+
+    for (i = 0; i <= Position; i++)
+    {
+        Chunk = PhpDecodeCompressedCircularBufferItem(Chunk, Encoding, value, &value);
+
+        if (Values)
+            Values[i] = value;
+    }
+
+    return value;
+}
+
+static VOID PhpDropCompressedCircularBufferChunk(
+    _Inout_ PPH_COMPRESSED_CIRCULAR_BUFFER Buffer
+    )
+{
+    PhFree(Buffer->Chunks[Buffer->ChunksIndex]);
+    Buffer->Chunks[Buffer->ChunksIndex] = NULL;
+    Buffer->ChunksIndex = (Buffer->ChunksIndex + 1) % Buffer->ChunksSize;
+    Buffer->ChunksCount--;
+}
+
+/**
+ * Initializes a compressed circular buffer.
+ *
+ * \param Buffer The buffer.
+ * \param Size The maximum number of items the buffer holds.
+ * \param Encoding The way items are encoded. This can be
+ * PH_COMPRESSED_CIRCULAR_BUFFER_DELTA or PH_COMPRESSED_CIRCULAR_BUFFER_XOR.
+ */
+VOID PhInitializeCompressedCircularBuffer(
+    _Out_ PPH_COMPRESSED_CIRCULAR_BUFFER Buffer,
+    _In_ ULONG Size,
+    _In_ ULONG Encoding
+    )
+{
+    Buffer->Size = Size;
+    Buffer->Count = 0;
+    Buffer->Encoding = Encoding;
+
+    // Chunks are only dropped once the remaining items still fill the buffer, so at most
+    // Size / CHUNK_SIZE + 1 full chunks are kept alongside the head.
+    Buffer->ChunksSize = Size / PH_COMPRESSED_CIRCULAR_BUFFER_CHUNK_SIZE + 2;
+    Buffer->ChunksIndex = 0;
+    Buffer->ChunksCount = 0;
+    Buffer->Chunks = PhAllocate(sizeof(PUCHAR) * Buffer->ChunksSize);
+    memset(Buffer->Chunks, 0, sizeof(PUCHAR) * Buffer->ChunksSize);
+
+    Buffer->Head = NULL;
+    Buffer->HeadCount = 0;
+    Buffer->HeadLength = 0;
+    Buffer->HeadAllocatedLength = 0;
+    Buffer->HeadLastValue = 0;
+}
+
+VOID PhDeleteCompressedCircularBuffer(
+    _Inout_ PPH_COMPRESSED_CIRCULAR_BUFFER Buffer
+    )
+{
+    PhClearCompressedCircularBuffer(Buffer);
+    PhFree(Buffer->Chunks);
+}
+
+VOID PhClearCompressedCircularBuffer(
+    _Inout_ PPH_COMPRESSED_CIRCULAR_BUFFER Buffer
+    )
+{
+    while (Buffer->ChunksCount != 0)
+        PhpDropCompressedCircularBufferChunk(Buffer);
+
+    if (Buffer->Head)
+        PhFree(Buffer->Head);
+
+    Buffer->Count = 0;
+    Buffer->ChunksIndex = 0;
+    Buffer->Head = NULL;
+    Buffer->HeadCount = 0;
+    Buffer->HeadLength = 0;
+    Buffer->HeadAllocatedLength = 0;
+    Buffer->HeadLastValue = 0;
+}
+
+/**
+ * Adds an item to a compressed circular buffer. The item becomes item 0,
+ * and the oldest item is discarded if the buffer is full.
+ *
+ * \param Buffer The buffer.
+ * \param Value The value to add. For PH_COMPRESSED_CIRCULAR_BUFFER_XOR buffers,
+ * use PhAddFloatItemCompressedCircularBuffer() instead.
+ */
+VOID PhAddItemCompressedCircularBuffer(
+    _Inout_ PPH_COMPRESSED_CIRCULAR_BUFFER Buffer,
+    _In_ ULONG64 Value
+    )
+{
+    UCHAR encoded[10];
+    USHORT length;
+
+    if (Buffer->HeadCount == PH_COMPRESSED_CIRCULAR_BUFFER_CHUNK_SIZE)
+    {
+        // The head is full. Shrink it to its encoded length and move it to the list of full chunks.
+        Buffer->Chunks[(Buffer->ChunksIndex + Buffer->ChunksCount) % Buffer->ChunksSize] =
+            PhReAllocate(Buffer->Head, Buffer->HeadLength);
+        Buffer->ChunksCount++;
+
+        Buffer->Head = NULL;
+        Buffer->HeadCount = 0;
+        Buffer->HeadLength = 0;
+        Buffer->HeadAllocatedLength = 0;
+    }
+
+    length = (USHORT)(PhpEncodeCompressedCircularBufferItem(
+        encoded,
+        Buffer->Encoding,
+        Buffer->HeadCount != 0 ? Buffer->HeadLastValue : 0,
+        Value
+        ) - encoded);
+
+    if (Buffer->HeadLength + length > Buffer->HeadAllocatedLength)
+    {
+        USHORT newLength;
+
+        newLength = Buffer->HeadAllocatedLength != 0 ? Buffer->HeadAllocatedLength * 2 : 16;
+
+        if (newLength > PH_COMPRESSED_CIRCULAR_BUFFER_MAXIMUM_CHUNK_LENGTH)
+            newLength = PH_COMPRESSED_CIRCULAR_BUFFER_MAXIMUM_CHUNK_LENGTH;
+
+        if (Buffer->Head)
+            Buffer->Head = PhReAllocate(Buffer->Head, newLength);
+        else
+            Buffer->Head = PhAllocate(newLength);
+
+        Buffer->HeadAllocatedLength = newLength;
+    }
+
+    memcpy(Buffer->Head + Buffer->HeadLength, encoded, length);
+    Buffer->HeadLength += length;
+    Buffer->HeadCount++;
+    Buffer->HeadLastValue = Value;
+
+    if (Buffer->Count < Buffer->Size)
+        Buffer->Count++;
+
+    // Drop the oldest chunk once the newer items fill the buffer by themselves.
+    while (Buffer->ChunksCount != 0 &&
+        (Buffer->ChunksCount - 1) * PH_COMPRESSED_CIRCULAR_BUFFER_CHUNK_SIZE + Buffer->HeadCount >= Buffer->Size)
+    {
+        PhpDropCompressedCircularBufferChunk(Buffer);
+    }
+}
+
+/**
+ * Gets an item from a compressed circular buffer.
+ *
+ * \param Buffer The buffer.
+ * \param Index The index of the item. Item 0 is the most recently added item.
+ *
+ * \return The value of the item, or 0 if \a Index is out of range.
+ */
+ULONG64 PhGetItemCompressedCircularBuffer(
+    _In_ PPH_COMPRESSED_CIRCULAR_BUFFER Buffer,
+    _In_ ULONG Index
+    )
+{
+    PUCHAR chunk;
+
+    if (Index >= Buffer->Count)
+        return 0;
+
+    if (Index < Buffer->HeadCount)
+        return PhpDecodeCompressedCircularBufferChunk(Buffer->Head, Buffer->Encoding, Buffer->HeadCount - 1 - Index, NULL);
+
+    Index -= Buffer->HeadCount;
+    chunk = Buffer->Chunks[(Buffer->ChunksIndex + Buffer->ChunksCount - 1 - Index / PH_COMPRESSED_CIRCULAR_BUFFER_CHUNK_SIZE) % Buffer->ChunksSize];
+
+    return PhpDecodeCompressedCircularBufferChunk(
+        chunk,
+        Buffer->Encoding,
+        PH_COMPRESSED_CIRCULAR_BUFFER_CHUNK_SIZE - 1 - Index % PH_COMPRESSED_CIRCULAR_BUFFER_CHUNK_SIZE,
+        NULL
+        );
+}
+
+/**
+ * Copies items from a compressed circular buffer, starting with the most
+ * recently added item.
+ *
+ * \param Buffer The buffer.
+ * \param Destination A buffer which receives the items.
+ * \param Count The maximum number of items to copy.
+ */
+VOID PhCopyCompressedCircularBuffer(
+    _In_ PPH_COMPRESSED_CIRCULAR_BUFFER Buffer,
+    _Out_writes_(Count) PULONG64 Destination,
+    _In_ ULONG Count
+    )
+{
+    ULONG64 values[PH_COMPRESSED_CIRCULAR_BUFFER_CHUNK_SIZE];
+    ULONG copied = 0;
+    ULONG chunkIndex;
+    ULONG i;
+
+    if (Count > Buffer->Count)
+        Count = Buffer->Count;
+
+    if (Buffer->HeadCount != 0)
+    {
+        PhpDecodeCompressedCircularBufferChunk(Buffer->Head, Buffer->Encoding, Buffer->HeadCount - 1, values);
+
+        for (i = Buffer->HeadCount; i != 0 && copied < Count; i--)
+            Destination[copied++] = values[i - 1];
+    }
+
+    for (chunkIndex = Buffer->ChunksCount; chunkIndex != 0 && copied < Count; chunkIndex--)
+    {
+        PhpDecodeCompressedCircularBufferChunk(
+            Buffer->Chunks[(Buffer->ChunksIndex + chunkIndex - 1) % Buffer->ChunksSize],
+            Buffer->Encoding,
+            PH_COMPRESSED_CIRCULAR_BUFFER_CHUNK_SIZE - 1,
+            values
+            );
+
+        for (i = PH_COMPRESSED_CIRCULAR_BUFFER_CHUNK_SIZE; i != 0 && copied < Count; i--)
+            Destination[copied++] = values[i - 1];
+    }
+}
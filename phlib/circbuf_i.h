@@ -6,6 +6,15 @@ VOID T___(PhInitializeCircularBuffer, T)(
     _Out_ T___(PPH_CIRCULAR_BUFFER, T) Buffer,
     _In_ ULONG Size
     )
+{
+    T___(PhInitializeCircularBufferEx, T)(Buffer, Size, NULL);
+}
+
+VOID T___(PhInitializeCircularBufferEx, T)(
+    _Out_ T___(PPH_CIRCULAR_BUFFER, T) Buffer,
+    _In_ ULONG Size,
+    _In_opt_ PPH_ARENA Arena
+    )
 {
 #ifdef PH_CIRCULAR_BUFFER_POWER_OF_TWO_SIZE
     Buffer->Size = PhRoundUpToPowerOfTwo(Size);
@@ -16,14 +25,15 @@ VOID T___(PhInitializeCircularBuffer, T)(
 
     Buffer->Count = 0;
     Buffer->Index = 0;
-    Buffer->Data = PhAllocate(sizeof(T) * Buffer->Size);
+    Buffer->Arena = Arena;
+    Buffer->Data = PhpAllocateCircularBufferData(Arena, sizeof(T) * Buffer->Size);
 }
 
 VOID T___(PhDeleteCircularBuffer, T)(
     _Inout_ T___(PPH_CIRCULAR_BUFFER, T) Buffer
     )
 {
-    PhFree(Buffer->Data);
+    PhpFreeCircularBufferData(Buffer->Arena, Buffer->Data, sizeof(T) * Buffer->Size);
 }
 
 VOID T___(PhResizeCircularBuffer, T)(
@@ -43,7 +53,7 @@ VOID T___(PhResizeCircularBuffer, T)(
     if (NewSize == Buffer->Size)
         return;
 
-    newData = PhAllocate(sizeof(T) * NewSize);
+    newData = PhpAllocateCircularBufferData(Buffer->Arena, sizeof(T) * NewSize);
     tailSize = (ULONG)(Buffer->Size - Buffer->Index);
     headSize = Buffer->Count - tailSize;
 
@@ -75,6 +85,7 @@ VOID T___(PhResizeCircularBuffer, T)(
             Buffer->Count = NewSize;
     }
 
+    PhpFreeCircularBufferData(Buffer->Arena, Buffer->Data, sizeof(T) * Buffer->Size);
     Buffer->Data = newData;
     Buffer->Size = NewSize;
 #ifdef PH_CIRCULAR_BUFFER_POWER_OF_TWO_SIZE
@@ -28,7 +28,7 @@
 
 VOID PhpEscapeStringForCsv(
     _Inout_ PPH_STRING_BUILDER StringBuilder,
-    _In_ PPH_STRING String
+    _In_ PPH_STRINGREF String
     )
 {
     SIZE_T i;
@@ -72,6 +72,77 @@ VOID PhpEscapeStringForCsv(
         PhAppendStringBuilderEx(StringBuilder, runStart, runLength * sizeof(WCHAR));
 }
 
+/**
+ * Appends a formatted text table cell to a line.
+ *
+ * \param StringBuilder The line being built.
+ * \param Text The text of the cell, or NULL if the cell is empty.
+ * \param TabCount The number of tabs needed to fill the biggest cell in the column.
+ * \param Mode The export formatting mode.
+ * \param LastColumn TRUE if this is the last cell in the row, otherwise FALSE.
+ */
+VOID PhpAppendTextTableCell(
+    _Inout_ PPH_STRING_BUILDER StringBuilder,
+    _In_opt_ PPH_STRINGREF Text,
+    _In_ ULONG TabCount,
+    _In_ ULONG Mode,
+    _In_ BOOLEAN LastColumn
+    )
+{
+    ULONG k;
+
+    switch (Mode)
+    {
+    case PH_EXPORT_MODE_TABS:
+        {
+            if (Text)
+            {
+                // Calculate the number of tabs needed.
+                k = (ULONG)(TabCount + 1 - Text->Length / sizeof(WCHAR) / TAB_SIZE);
+
+                PhAppendStringBuilder(StringBuilder, Text);
+            }
+            else
+            {
+                k = TabCount + 1;
+            }
+
+            PhAppendCharStringBuilder2(StringBuilder, '\t', k);
+        }
+        break;
+    case PH_EXPORT_MODE_SPACES:
+        {
+            if (Text)
+            {
+                // Calculate the number of spaces needed.
+                k = (ULONG)((TabCount + 1) * TAB_SIZE - Text->Length / sizeof(WCHAR));
+
+                PhAppendStringBuilder(StringBuilder, Text);
+            }
+            else
+            {
+                k = (TabCount + 1) * TAB_SIZE;
+            }
+
+            PhAppendCharStringBuilder2(StringBuilder, ' ', k);
+        }
+        break;
+    case PH_EXPORT_MODE_CSV:
+        {
+            PhAppendCharStringBuilder(StringBuilder, '\"');
+
+            if (Text)
+                PhpEscapeStringForCsv(StringBuilder, Text);
+
+            PhAppendCharStringBuilder(StringBuilder, '\"');
+
+            if (!LastColumn)
+                PhAppendCharStringBuilder(StringBuilder, ',');
+        }
+        break;
+    }
+}
+
 /**
  * Allocates a text table.
  *
@@ -124,6 +195,8 @@ PPH_LIST PhaFormatTextTable(
     ULONG i;
     ULONG j;
 
+    tabCount = NULL;
+
     if (Mode == PH_EXPORT_MODE_TABS || Mode == PH_EXPORT_MODE_SPACES)
     {
         // Create the tab count array.
@@ -158,79 +231,108 @@ PPH_LIST PhaFormatTextTable(
     for (i = 0; i < Rows; i++)
     {
         PH_STRING_BUILDER stringBuilder;
+        ULONG_PTR storage[128];
 
-        PhInitializeStringBuilder(&stringBuilder, 100);
+        // Build each line on the stack so that only the final string is allocated.
+        PhInitializeStringBuilderInline(&stringBuilder, storage, sizeof(storage));
 
-        switch (Mode)
+        for (j = 0; j < Columns; j++)
         {
-        case PH_EXPORT_MODE_TABS:
-            {
-                for (j = 0; j < Columns; j++)
-                {
-                    ULONG k;
-
-                    if (Table[i][j])
-                    {
-                        // Calculate the number of tabs needed.
-                        k = (ULONG)(tabCount[j] + 1 - Table[i][j]->Length / sizeof(WCHAR) / TAB_SIZE);
-
-                        PhAppendStringBuilder(&stringBuilder, &Table[i][j]->sr);
-                    }
-                    else
-                    {
-                        k = tabCount[j] + 1;
-                    }
-
-                    PhAppendCharStringBuilder2(&stringBuilder, '\t', k);
-                }
-            }
-            break;
-        case PH_EXPORT_MODE_SPACES:
-            {
-                for (j = 0; j < Columns; j++)
-                {
-                    ULONG k;
-
-                    if (Table[i][j])
-                    {
-                        // Calculate the number of spaces needed.
-                        k = (ULONG)((tabCount[j] + 1) * TAB_SIZE - Table[i][j]->Length / sizeof(WCHAR));
-
-                        PhAppendStringBuilder(&stringBuilder, &Table[i][j]->sr);
-                    }
-                    else
-                    {
-                        k = (tabCount[j] + 1) * TAB_SIZE;
-                    }
-
-                    PhAppendCharStringBuilder2(&stringBuilder, ' ', k);
-                }
-            }
-            break;
-        case PH_EXPORT_MODE_CSV:
-            {
-                for (j = 0; j < Columns; j++)
-                {
-                    PhAppendCharStringBuilder(&stringBuilder, '\"');
+            PhpAppendTextTableCell(
+                &stringBuilder,
+                Table[i][j] ? &Table[i][j]->sr : NULL,
+                tabCount ? tabCount[j] : 0,
+                Mode,
+                j == Columns - 1
+                );
+        }
+
+        PhAddItemList(lines, PhFinalStringBuilderString(&stringBuilder));
+    }
+
+    return lines;
+}
+
+/**
+ * Formats a text table directly to a file stream.
+ *
+ * \param FileStream The file stream to write to.
+ * \param Rows The number of rows in the table.
+ * \param Columns The number of columns in the table.
+ * \param Mode The export formatting mode.
+ * \param GetCell A callback function which retrieves the text of a cell. The text only
+ * needs to remain valid until the next call to the callback.
+ * \param Context A user-defined value to pass to the callback function.
+ *
+ * \remarks Unlike PhaFormatTextTable, no cell or line strings are kept in memory. The cell
+ * callback is invoked twice for each cell when aligning with tabs or spaces: once to measure
+ * the columns and once to write the rows.
+ */
+VOID PhWriteTextTable(
+    _Inout_ PPH_FILE_STREAM FileStream,
+    _In_ ULONG Rows,
+    _In_ ULONG Columns,
+    _In_ ULONG Mode,
+    _In_ PPH_TEXT_TABLE_GET_CELL GetCell,
+    _In_opt_ PVOID Context
+    )
+{
+    PULONG tabCount;
+    PH_STRING_BUILDER stringBuilder;
+    PH_STRINGREF text;
+    ULONG i;
+    ULONG j;
+
+    tabCount = NULL;
 
-                    if (Table[i][j])
-                    {
-                        PhpEscapeStringForCsv(&stringBuilder, Table[i][j]);
-                    }
+    if (Mode == PH_EXPORT_MODE_TABS || Mode == PH_EXPORT_MODE_SPACES)
+    {
+        // Only the widths are needed in the first pass.
+
+        tabCount = PhAllocate(sizeof(ULONG) * Columns);
+        memset(tabCount, 0, sizeof(ULONG) * Columns);
+
+        for (i = 0; i < Rows; i++)
+        {
+            for (j = 0; j < Columns; j++)
+            {
+                ULONG newCount;
 
-                    PhAppendCharStringBuilder(&stringBuilder, '\"');
+                GetCell(i, j, &text, Context);
+                newCount = (ULONG)(text.Length / sizeof(WCHAR) / TAB_SIZE);
 
-                    if (j != Columns - 1)
-                        PhAppendCharStringBuilder(&stringBuilder, ',');
-                }
+                if (tabCount[j] < newCount)
+                    tabCount[j] = newCount;
             }
-            break;
         }
+    }
 
-        PhAddItemList(lines, PhFinalStringBuilderString(&stringBuilder));
+    // Reuse a single buffer for every line; the file stream does its own buffering.
+    PhInitializeStringBuilder(&stringBuilder, 0x200);
+
+    for (i = 0; i < Rows; i++)
+    {
+        for (j = 0; j < Columns; j++)
+        {
+            GetCell(i, j, &text, Context);
+            PhpAppendTextTableCell(
+                &stringBuilder,
+                &text,
+                tabCount ? tabCount[j] : 0,
+                Mode,
+                j == Columns - 1
+                );
+        }
+
+        PhAppendStringBuilder2(&stringBuilder, L"\r\n");
+        PhWriteStringAsUtf8FileStream(FileStream, &stringBuilder.String->sr);
+        PhRemoveEndStringBuilder(&stringBuilder, stringBuilder.String->Length / sizeof(WCHAR));
     }
 
-    return lines;
+    PhDeleteStringBuilder(&stringBuilder);
+
+    if (tabCount)
+        PhFree(tabCount);
 }
 
 VOID PhMapDisplayIndexTreeNew(
@@ -401,6 +503,78 @@ PPH_LIST PhGetGenericTreeNewLines(
     return lines;
 }
 
+typedef struct _PH_GENERIC_TREENEW_WRITE_CONTEXT
+{
+    HWND TreeNewHandle;
+    PULONG DisplayToId;
+    PWSTR *DisplayToText;
+} PH_GENERIC_TREENEW_WRITE_CONTEXT, *PPH_GENERIC_TREENEW_WRITE_CONTEXT;
+
+static VOID NTAPI PhpGenericTreeNewGetCell(
+    _In_ ULONG Row,
+    _In_ ULONG Column,
+    _Out_ PPH_STRINGREF Text,
+    _In_opt_ PVOID Context
+    )
+{
+    PPH_GENERIC_TREENEW_WRITE_CONTEXT context = Context;
+    PH_TREENEW_GET_CELL_TEXT getCellText;
+
+    PhInitializeEmptyStringRef(Text);
+
+    if (Row == 0)
+    {
+        // The first row contains the column headers.
+        if (context->DisplayToText[Column])
+            PhInitializeStringRefLongHint(Text, context->DisplayToText[Column]);
+
+        return;
+    }
+
+    getCellText.Node = TreeNew_GetFlatNode(context->TreeNewHandle, Row - 1);
+
+    if (!getCellText.Node)
+        return;
+
+    getCellText.Id = context->DisplayToId[Column];
+    PhInitializeEmptyStringRef(&getCellText.Text);
+    TreeNew_GetCellText(context->TreeNewHandle, &getCellText);
+
+    *Text = getCellText.Text;
+}
+
+/**
+ * Writes the contents of a tree new control to a file stream.
+ *
+ * \param FileStream The file stream to write to.
+ * \param TreeNewHandle A handle to the tree new control.
+ * \param Mode The export formatting mode.
+ */
+VOID PhWriteGenericTreeNew(
+    _Inout_ PPH_FILE_STREAM FileStream,
+    _In_ HWND TreeNewHandle,
+    _In_ ULONG Mode
+    )
+{
+    PH_GENERIC_TREENEW_WRITE_CONTEXT context;
+    ULONG columns;
+
+    context.TreeNewHandle = TreeNewHandle;
+    PhMapDisplayIndexTreeNew(TreeNewHandle, &context.DisplayToId, &context.DisplayToText, &columns);
+
+    PhWriteTextTable(
+        FileStream,
+        TreeNew_GetFlatNodeCount(TreeNewHandle) + 1,
+        columns,
+        Mode,
+        PhpGenericTreeNewGetCell,
+        &context
+        );
+
+    PhFree(context.DisplayToText);
+    PhFree(context.DisplayToId);
+}
+
 VOID PhaMapDisplayIndexListView(
     _In_ HWND ListViewHandle,
     _Out_writes_(Count) PULONG DisplayToId,
@@ -0,0 +1,242 @@
+/*
+ * Process Hacker -
+ *   epoch-based reclamation
+ *
+ * Copyright (C) 2016 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Epochs let readers walk a shared structure without locking while a writer changes it.
+ * Readers bracket their accesses with PhEnterEpoch and PhLeaveEpoch. A writer unlinks
+ * memory or an object from the structure as usual, but instead of freeing it straight
+ * away it calls PhFreeAfterEpoch or PhDereferenceObjectAfterEpoch. The memory is freed
+ * (or the reference released) once every reader that could have seen it has left.
+ *
+ * Each reader claims one of a fixed number of slots and stores the global epoch it
+ * observed there. The global epoch may only advance once every occupied slot holds the
+ * current epoch. Anything retired while the global epoch was E is put on list E mod 3,
+ * and that list is released just before the epoch advances from E + 2 to E + 3. At that
+ * point every reader has entered after the memory was unlinked, so none of them can
+ * still hold a pointer to it.
+ *
+ * Objects are released with PhDereferenceObjectDeferDelete, so delete procedures never
+ * run on the reclaiming thread.
+ */
+
+#include <phbase.h>
+#include <phintrnl.h>
+
+#define PH_EPOCH_NUMBER_OF_SLOTS 64
+#define PH_EPOCH_RECLAIM_THRESHOLD 128
+
+typedef struct _PH_EPOCH_SLOT
+{
+    // 0 if the slot is free, otherwise the observed epoch shifted left by one with the
+    // low bit set.
+    volatile LONG Value;
+    UCHAR Padding[64 - sizeof(LONG)]; // keep readers on separate cache lines
+} PH_EPOCH_SLOT, *PPH_EPOCH_SLOT;
+
+typedef struct _PH_EPOCH_RETIRED_ENTRY
+{
+    struct _PH_EPOCH_RETIRED_ENTRY *Next;
+    PVOID Pointer;
+    BOOLEAN IsObject;
+} PH_EPOCH_RETIRED_ENTRY, *PPH_EPOCH_RETIRED_ENTRY;
+
+static volatile ULONG PhpGlobalEpoch = 0;
+static PH_EPOCH_SLOT PhpEpochSlots[PH_EPOCH_NUMBER_OF_SLOTS];
+static PPH_EPOCH_RETIRED_ENTRY PhpEpochRetiredLists[3];
+static volatile LONG PhpEpochRetiredCount = 0;
+static PH_QUEUED_LOCK PhpEpochReclaimLock = PH_QUEUED_LOCK_INIT;
+
+/**
+ * Enters an epoch. Memory retired with PhFreeAfterEpoch() or
+ * PhDereferenceObjectAfterEpoch() is not released until the caller calls
+ * PhLeaveEpoch().
+ *
+ * \param Guard A variable which receives state for PhLeaveEpoch().
+ *
+ * \remarks Epochs may be nested, but each call must use its own guard. Keep
+ * the time spent in an epoch short, because no memory can be reclaimed while
+ * a reader is inside an old epoch.
+ */
+VOID NTAPI PhEnterEpoch(
+    _Out_ PPH_EPOCH_GUARD Guard
+    )
+{
+    ULONG start;
+    ULONG i;
+    LONG value;
+
+    start = (HandleToUlong(NtCurrentThreadId()) / 4) % PH_EPOCH_NUMBER_OF_SLOTS;
+    i = start;
+
+    while (TRUE)
+    {
+        value = (LONG)((PhpGlobalEpoch << 1) | 1);
+
+        // The exchange is a full barrier, so none of the caller's reads can happen
+        // before the slot has been published.
+        if (PhpEpochSlots[i].Value == 0 && _InterlockedCompareExchange(&PhpEpochSlots[i].Value, value, 0) == 0)
+            break;
+
+        i = (i + 1) % PH_EPOCH_NUMBER_OF_SLOTS;
+
+        if (i == start)
+            YieldProcessor();
+    }
+
+    Guard->Slot = i;
+}
+
+/**
+ * Leaves an epoch.
+ *
+ * \param Guard The guard passed to PhEnterEpoch().
+ */
+VOID NTAPI PhLeaveEpoch(
+    _In_ PPH_EPOCH_GUARD Guard
+    )
+{
+    _InterlockedExchange(&PhpEpochSlots[Guard->Slot].Value, 0);
+}
+
+static VOID PhpRetireEpoch(
+    _In_ PVOID Pointer,
+    _In_ BOOLEAN IsObject
+    )
+{
+    PPH_EPOCH_RETIRED_ENTRY entry;
+    PPH_EPOCH_RETIRED_ENTRY *listHead;
+    PPH_EPOCH_RETIRED_ENTRY oldHead;
+
+    entry = PhAllocate(sizeof(PH_EPOCH_RETIRED_ENTRY));
+    entry->Pointer = Pointer;
+    entry->IsObject = IsObject;
+
+    listHead = &PhpEpochRetiredLists[PhpGlobalEpoch % 3];
+
+    do
+    {
+        oldHead = *(PPH_EPOCH_RETIRED_ENTRY volatile *)listHead;
+        entry->Next = oldHead;
+    } while (_InterlockedCompareExchangePointer(listHead, entry, oldHead) != oldHead);
+
+    if (_InterlockedIncrement(&PhpEpochRetiredCount) >= PH_EPOCH_RECLAIM_THRESHOLD)
+        PhReclaimEpoch();
+}
+
+/**
+ * Frees a block of memory once all current readers have left their epochs.
+ *
+ * \param Memory A pointer to a block of memory allocated with PhAllocate().
+ * The block must already be unreachable for new readers.
+ */
+VOID NTAPI PhFreeAfterEpoch(
+    _In_ _Post_invalid_ PVOID Memory
+    )
+{
+    PhpRetireEpoch(Memory, FALSE);
+}
+
+/**
+ * Dereferences an object once all current readers have left their epochs.
+ *
+ * \param Object A pointer to an object. The reference being released must
+ * already be unreachable for new readers.
+ *
+ * \remarks If this releases the last reference, the object is deleted on
+ * a worker thread (see PhDereferenceObjectDeferDelete()).
+ */
+VOID NTAPI PhDereferenceObjectAfterEpoch(
+    _In_ PVOID Object
+    )
+{
+    PhpRetireEpoch(Object, TRUE);
+}
+
+/**
+ * Attempts to advance the global epoch and releases memory that can no
+ * longer be reached by any reader.
+ *
+ * \remarks This function never blocks. Retiring memory calls this function
+ * automatically once enough memory is pending; writers that retire memory
+ * infrequently should call it periodically so that the memory does not have
+ * to wait for the next writer.
+ */
+VOID NTAPI PhReclaimEpoch(
+    VOID
+    )
+{
+    ULONG epoch;
+    LONG value;
+    LONG slotValue;
+    ULONG i;
+    PPH_EPOCH_RETIRED_ENTRY entry;
+    PPH_EPOCH_RETIRED_ENTRY nextEntry;
+    LONG count;
+
+    if (!PhTryAcquireQueuedLockExclusive(&PhpEpochReclaimLock))
+        return;
+
+    epoch = PhpGlobalEpoch;
+    value = (LONG)((epoch << 1) | 1);
+
+    for (i = 0; i < PH_EPOCH_NUMBER_OF_SLOTS; i++)
+    {
+        slotValue = PhpEpochSlots[i].Value;
+
+        if (slotValue != 0 && slotValue != value)
+        {
+            // A reader is still in the previous epoch.
+            PhReleaseQueuedLockExclusive(&PhpEpochReclaimLock);
+            return;
+        }
+    }
+
+    // Every reader has seen the current epoch, so nothing retired two epochs ago can
+    // still be reachable. That list becomes the list for the next epoch, so it must be
+    // taken before the epoch is advanced.
+    entry = _InterlockedExchangePointer(&PhpEpochRetiredLists[(epoch + 1) % 3], NULL);
+
+    _InterlockedExchange((volatile LONG *)&PhpGlobalEpoch, (LONG)(epoch + 1));
+    PHLIB_INC_STATISTIC(EpEpochsAdvanced);
+
+    PhReleaseQueuedLockExclusive(&PhpEpochReclaimLock);
+
+    count = 0;
+
+    while (entry)
+    {
+        nextEntry = entry->Next;
+
+        if (entry->IsObject)
+            PhDereferenceObjectDeferDelete(entry->Pointer);
+        else
+            PhFree(entry->Pointer);
+
+        PhFree(entry);
+        PHLIB_INC_STATISTIC(EpEntriesReclaimed);
+        count++;
+        entry = nextEntry;
+    }
+
+    if (count != 0)
+        _InterlockedExchangeAdd(&PhpEpochRetiredCount, -count);
+}
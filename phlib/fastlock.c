@@ -116,6 +116,7 @@ _May_raise_ VOID FASTCALL PhfAcquireFastLockExclusive(
     ULONG value;
     ULONG i = 0;
     ULONG spinCount;
+    ULONG64 waitStartTime = 0;
 
     spinCount = PhpGetSpinCount();
 
@@ -136,6 +137,9 @@ _May_raise_ VOID FASTCALL PhfAcquireFastLockExclusive(
         {
             PhpEnsureEventCreated(&FastLock->ExclusiveWakeEvent);
 
+            if (!waitStartTime)
+                waitStartTime = PhBeginLockWait();
+
             if (_InterlockedCompareExchange(
                 &FastLock->Value,
                 value + PH_LOCK_EXCLUSIVE_WAITERS_INC,
@@ -162,9 +166,14 @@ _May_raise_ VOID FASTCALL PhfAcquireFastLockExclusive(
             }
         }
 
+        if (!waitStartTime)
+            waitStartTime = PhBeginLockWait();
+
         i++;
         YieldProcessor();
     }
+
+    PhRecordLockAcquire(FastLock, TRUE, waitStartTime);
 }
 
 _May_raise_ VOID FASTCALL PhfAcquireFastLockShared(
@@ -174,6 +183,7 @@ _May_raise_ VOID FASTCALL PhfAcquireFastLockShared(
     ULONG value;
     ULONG i = 0;
     ULONG spinCount;
+    ULONG64 waitStartTime = 0;
 
     spinCount = PhpGetSpinCount();
 
@@ -211,6 +221,9 @@ _May_raise_ VOID FASTCALL PhfAcquireFastLockShared(
         {
             PhpEnsureEventCreated(&FastLock->SharedWakeEvent);
 
+            if (!waitStartTime)
+                waitStartTime = PhBeginLockWait();
+
             if (_InterlockedCompareExchange(
                 &FastLock->Value,
                 value + PH_LOCK_SHARED_WAITERS_INC,
@@ -228,9 +241,14 @@ _May_raise_ VOID FASTCALL PhfAcquireFastLockShared(
             }
         }
 
+        if (!waitStartTime)
+            waitStartTime = PhBeginLockWait();
+
         i++;
         YieldProcessor();
     }
+
+    PhRecordLockAcquire(FastLock, FALSE, waitStartTime);
 }
 
 VOID FASTCALL PhfReleaseFastLockExclusive(
@@ -239,6 +257,8 @@ VOID FASTCALL PhfReleaseFastLockExclusive(
 {
     ULONG value;
 
+    PhRecordLockRelease(FastLock);
+
     while (TRUE)
     {
         value = FastLock->Value;
@@ -337,11 +357,17 @@ BOOLEAN FASTCALL PhfTryAcquireFastLockExclusive(
     if (value & (PH_LOCK_OWNED | PH_LOCK_EXCLUSIVE_WAKING))
         return FALSE;
 
-    return _InterlockedCompareExchange(
+    if (_InterlockedCompareExchange(
         &FastLock->Value,
         value + PH_LOCK_OWNED,
         value
-        ) == value;
+        ) == value)
+    {
+        PhRecordLockAcquire(FastLock, TRUE, 0);
+        return TRUE;
+    }
+
+    return FALSE;
 }
 
 BOOLEAN FASTCALL PhfTryAcquireFastLockShared(
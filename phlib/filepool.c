@@ -76,12 +76,33 @@
  * Even after a view becomes inactive (has a reference count of 0)
  * it remains mapped in until the maximum number of inactive views
  * is reached.
+ *
+ * Changes are written to the file by the memory manager at any
+ * time, so a file that was in use when the system crashed may have
+ * inconsistent bitmaps or free lists. The file header therefore has
+ * a dirty flag which is written to disk before the allocator first
+ * modifies the file, and which is only cleared by PhCommitFilePool()
+ * after everything else has been flushed. Files which are dirty or
+ * whose header checksum does not match are rejected when opened.
+ *
+ * Since allocations never move, a file can become fragmented.
+ * PhCompactFilePool() copies the live blocks of a file into a new
+ * file, one after the other, and reports where each block went so
+ * that the user can fix up any relative virtual addresses stored
+ * in the blocks.
  */
 
 #include <ph.h>
 #include <filepool.h>
 #include <filepoolp.h>
 
+static ULONG PhpComputeChecksumFilePool(
+    _In_ PPH_FP_FILE_HEADER Header
+    )
+{
+    return PhCrc32(0, (PCHAR)Header, FIELD_OFFSET(PH_FP_FILE_HEADER, Checksum));
+}
+
 /**
  * Creates or opens a file pool.
  *
@@ -177,6 +198,9 @@ NTSTATUS PhCreateFilePool(
 
         for (i = 0; i < PH_FP_FREE_LIST_COUNT; i++)
             header->FreeLists[i] = -1;
+
+        // The file is not valid until it has been committed.
+        header->Flags = PH_FP_FILE_DIRTY;
     }
     else
     {
@@ -186,6 +210,14 @@ NTSTATUS PhCreateFilePool(
             status = STATUS_BAD_FILE_TYPE;
             goto CleanupExit;
         }
+
+        if ((header->Flags & PH_FP_FILE_DIRTY) || header->Checksum != PhpComputeChecksumFilePool(header))
+        {
+            // The file was not committed after it was last changed.
+            PhFppUnmapRange(pool, initialBlock);
+            status = STATUS_FILE_CORRUPT_ERROR;
+            goto CleanupExit;
+        }
     }
 
     pool->SegmentShift = header->SegmentShift;
@@ -193,8 +225,8 @@ NTSTATUS PhCreateFilePool(
 
     pool->BlockShift = pool->SegmentShift - PH_FP_BLOCK_COUNT_SHIFT;
     pool->BlockSize = 1 << pool->BlockShift;
-    pool->FileHeaderBlockSpan = (sizeof(PH_FP_FILE_HEADER) + pool->BlockSize - 1) >> pool->BlockShift;
-    pool->SegmentHeaderBlockSpan = (sizeof(PH_FP_SEGMENT_HEADER) + pool->BlockSize - 1) >> pool->BlockShift;
+    pool->FileHeaderBlockSpan = (FIELD_OFFSET(PH_FP_BLOCK_HEADER, Body) + sizeof(PH_FP_FILE_HEADER) + pool->BlockSize - 1) >> pool->BlockShift;
+    pool->SegmentHeaderBlockSpan = (FIELD_OFFSET(PH_FP_BLOCK_HEADER, Body) + sizeof(PH_FP_SEGMENT_HEADER) + pool->BlockSize - 1) >> pool->BlockShift;
 
     // Unmap the first segment and remap with the new segment size.
 
@@ -400,25 +432,60 @@ VOID PhpSetDefaultFilePoolParameters(
     Parameters->MaximumInactiveViews = 128;
 }
 
+/**
+ * Flushes part of a view to disk.
+ *
+ * \param Pool The file pool.
+ * \param Base The address of the range.
+ * \param Size The size of the range, in bytes.
+ */
+static NTSTATUS PhpFlushFilePool(
+    _In_ PPH_FILE_POOL Pool,
+    _In_ PVOID Base,
+    _In_ SIZE_T Size
+    )
+{
+    IO_STATUS_BLOCK isb;
+
+    return NtFlushVirtualMemory(NtCurrentProcess(), &Base, &Size, &isb);
+}
+
+/**
+ * Marks a file pool as dirty before it is modified.
+ *
+ * \param Pool The file pool.
+ */
+static VOID PhpMarkDirtyFilePool(
+    _Inout_ PPH_FILE_POOL Pool
+    )
+{
+    IO_STATUS_BLOCK isb;
+
+    if (!(Pool->Header->Flags & PH_FP_FILE_DIRTY))
+    {
+        Pool->Header->Flags |= PH_FP_FILE_DIRTY;
+
+        // The flag must be on disk before any of the changes it covers.
+        PhpFlushFilePool(Pool, Pool->FirstBlockOfFirstSegment, PAGE_SIZE);
+        NtFlushBuffersFile(Pool->FileHandle, &isb);
+    }
+}
+
 /**
  * Allocates a block from a file pool.
  *
  * \param Pool The file pool.
  * \param Size The number of bytes to allocate.
+ * \param SegmentIndexHint A variable which contains the index of a
+ * segment to try first, or -1. On success, the variable receives the
+ * index of the segment containing the new block.
  * \param Rva A variable which receives the relative virtual
  * address of the allocated block.
- *
- * \return A pointer to the allocated block. You must call
- * PhDereferenceFilePool() or PhDereferenceFilePoolByRva() when
- * you no longer need a reference to the block.
- *
- * \remarks The returned pointer is not valid beyond the lifetime
- * of the file pool instance. Use the relative virtual address
- * if you need a permanent reference to the allocated block.
  */
-PVOID PhAllocateFilePool(
+static PVOID PhpAllocateFilePool(
     _Inout_ PPH_FILE_POOL Pool,
     _In_ ULONG Size,
+    _Inout_opt_ PULONG SegmentIndexHint,
     _Out_opt_ PULONG Rva
     )
 {
@@ -441,6 +508,33 @@ PVOID PhAllocateFilePool(
         return NULL;
     }
 
+    PhpMarkDirtyFilePool(Pool);
+
+    // Try the hinted segment first. This keeps related blocks together and avoids
+    // scanning the free lists.
+
+    if (SegmentIndexHint && *SegmentIndexHint != -1)
+    {
+        segmentIndex = *SegmentIndexHint;
+        firstBlock = PhFppReferenceSegment(Pool, segmentIndex);
+
+        if (firstBlock)
+        {
+            segmentHeader = PhFppGetHeaderSegment(Pool, firstBlock);
+            freeListIndex = PhFppComputeFreeListIndex(Pool, segmentHeader->FreeBlocks);
+
+            if (segmentHeader->FreeBlocks >= numberOfBlocks)
+            {
+                blockHeader = PhFppAllocateBlocks(Pool, firstBlock, segmentHeader, numberOfBlocks);
+
+                if (blockHeader)
+                    goto BlockAllocated;
+            }
+
+            PhFppDereferenceSegment(Pool, segmentIndex);
+        }
+    }
+
     // Scan each applicable free list and try to allocate from those segments.
 
     freeListLimit = PhFppComputeFreeListIndex(Pool, numberOfBlocks);
@@ -498,6 +592,11 @@ BlockAllocated:
         PhFppInsertFreeList(Pool, newFreeListIndex, segmentIndex, segmentHeader);
     }
 
+    if (SegmentIndexHint)
+    {
+        *SegmentIndexHint = segmentIndex;
+    }
+
     if (Rva)
     {
         *Rva = PhFppEncodeRva(Pool, segmentIndex, firstBlock, &blockHeader->Body);
@@ -506,6 +605,31 @@ BlockAllocated:
     return &blockHeader->Body;
 }
 
+/**
+ * Allocates a block from a file pool.
+ *
+ * \param Pool The file pool.
+ * \param Size The number of bytes to allocate.
+ * \param Rva A variable which receives the relative virtual
+ * address of the allocated block.
+ *
+ * \return A pointer to the allocated block. You must call
+ * PhDereferenceFilePool() or PhDereferenceFilePoolByRva() when
+ * you no longer need a reference to the block.
+ *
+ * \remarks The returned pointer is not valid beyond the lifetime
+ * of the file pool instance. Use the relative virtual address
+ * if you need a permanent reference to the allocated block.
+ */
+PVOID PhAllocateFilePool(
+    _Inout_ PPH_FILE_POOL Pool,
+    _In_ ULONG Size,
+    _Out_opt_ PULONG Rva
+    )
+{
+    return PhpAllocateFilePool(Pool, Size, NULL, Rva);
+}
+
 /**
  * Frees a block.
  *
@@ -525,6 +649,8 @@ VOID PhpFreeFilePool(
     ULONG oldFreeListIndex;
     ULONG newFreeListIndex;
 
+    PhpMarkDirtyFilePool(Pool);
+
     segmentHeader = PhFppGetHeaderSegment(Pool, FirstBlock);
     oldFreeListIndex = PhFppComputeFreeListIndex(Pool, segmentHeader->FreeBlocks);
     PhFppFreeBlocks(Pool, FirstBlock, segmentHeader, PhFppGetHeaderBlock(Pool, Block));
@@ -595,6 +721,139 @@ BOOLEAN PhFreeFilePoolByRva(
     return TRUE;
 }
 
+/**
+ * Allocates a number of blocks from a file pool.
+ *
+ * \param Pool The file pool.
+ * \param Count The number of blocks to allocate.
+ * \param Sizes An array containing the number of bytes to allocate
+ * for each block.
+ * \param Blocks An array which receives pointers to the allocated
+ * blocks. See PhAllocateFilePool() for more information.
+ * \param Rvas An array which receives the relative virtual addresses
+ * of the allocated blocks.
+ *
+ * \return The number of blocks that were allocated. If this is less
+ * than \a Count, the allocation for the next block failed.
+ *
+ * \remarks Each block is allocated from the same segment as the
+ * previous block if possible.
+ */
+ULONG PhAllocateFilePoolBatch(
+    _Inout_ PPH_FILE_POOL Pool,
+    _In_ ULONG Count,
+    _In_reads_(Count) PULONG Sizes,
+    _Out_writes_(Count) PVOID *Blocks,
+    _Out_writes_opt_(Count) PULONG Rvas
+    )
+{
+    ULONG segmentIndexHint;
+    ULONG i;
+
+    segmentIndexHint = -1;
+
+    for (i = 0; i < Count; i++)
+    {
+        Blocks[i] = PhpAllocateFilePool(Pool, Sizes[i], &segmentIndexHint, Rvas ? &Rvas[i] : NULL);
+
+        if (!Blocks[i])
+            break;
+    }
+
+    return i;
+}
+
+/**
+ * Frees a number of blocks allocated by PhAllocateFilePool().
+ *
+ * \param Pool The file pool.
+ * \param Count The number of blocks to free.
+ * \param Rvas An array containing the relative virtual addresses of
+ * the blocks.
+ *
+ * \return The number of blocks that were freed.
+ *
+ * \remarks Each segment is only looked up and moved between free lists
+ * once for each run of blocks that are in the same segment, so sorting
+ * \a Rvas first makes this function faster.
+ */
+ULONG PhFreeFilePoolBatch(
+    _Inout_ PPH_FILE_POOL Pool,
+    _In_ ULONG Count,
+    _In_reads_(Count) PULONG Rvas
+    )
+{
+    ULONG numberOfFreedBlocks;
+    ULONG segmentIndex;
+    ULONG newSegmentIndex;
+    ULONG offset;
+    PPH_FP_BLOCK_HEADER firstBlock;
+    PPH_FP_SEGMENT_HEADER segmentHeader;
+    ULONG oldFreeListIndex;
+    ULONG newFreeListIndex;
+    ULONG i;
+
+    numberOfFreedBlocks = 0;
+    segmentIndex = -1;
+    offset = 0;
+    firstBlock = NULL;
+    segmentHeader = NULL;
+    oldFreeListIndex = 0;
+
+    PhpMarkDirtyFilePool(Pool);
+
+    for (i = 0; i <= Count; i++)
+    {
+        if (i < Count)
+        {
+            offset = PhFppDecodeRva(Pool, Rvas[i], &newSegmentIndex);
+
+            if (offset == -1)
+                continue;
+        }
+        else
+        {
+            newSegmentIndex = -1;
+        }
+
+        if (newSegmentIndex != segmentIndex)
+        {
+            if (segmentIndex != -1)
+            {
+                // Move the previous segment into another free list if needed.
+
+                newFreeListIndex = PhFppComputeFreeListIndex(Pool, segmentHeader->FreeBlocks);
+
+                if (newFreeListIndex != oldFreeListIndex)
+                {
+                    PhFppRemoveFreeList(Pool, oldFreeListIndex, segmentIndex, segmentHeader);
+                    PhFppInsertFreeList(Pool, newFreeListIndex, segmentIndex, segmentHeader);
+                }
+
+                PhFppDereferenceSegment(Pool, segmentIndex);
+                segmentIndex = -1;
+            }
+
+            if (newSegmentIndex == -1)
+                continue;
+
+            firstBlock = PhFppReferenceSegment(Pool, newSegmentIndex);
+
+            if (!firstBlock)
+                continue;
+
+            segmentIndex = newSegmentIndex;
+            segmentHeader = PhFppGetHeaderSegment(Pool, firstBlock);
+            oldFreeListIndex = PhFppComputeFreeListIndex(Pool, segmentHeader->FreeBlocks);
+        }
+
+        PhFppFreeBlocks(Pool, firstBlock, segmentHeader, PhFppGetHeaderBlock(Pool, (PCHAR)firstBlock + offset));
+        numberOfFreedBlocks++;
+    }
+
+    return numberOfFreedBlocks;
+}
+
 /**
  * Increments the reference count for the specified address.
  *
@@ -732,9 +991,265 @@ VOID PhSetUserContextFilePool(
     _In_ PULONGLONG Context
     )
 {
+    PhpMarkDirtyFilePool(Pool);
     Pool->Header->UserContext = *Context;
 }
 
+/**
+ * Writes all changes to a file pool to disk and marks the file as
+ * consistent.
+ *
+ * \param Pool The file pool.
+ *
+ * \remarks Changes made directly to the contents of blocks are only
+ * guaranteed to be on disk after this function returns.
+ */
+NTSTATUS PhCommitFilePool(
+    _Inout_ PPH_FILE_POOL Pool
+    )
+{
+    NTSTATUS status;
+    IO_STATUS_BLOCK isb;
+    ULONG i;
+    PLIST_ENTRY head;
+    PLIST_ENTRY entry;
+    PPH_FILE_POOL_VIEW view;
+
+    if (Pool->ReadOnly)
+        return STATUS_ACCESS_DENIED;
+
+    // Flush every segment that is still mapped. Changes to segments that have already
+    // been unmapped are written when the file buffers are flushed.
+    for (i = 0; i < Pool->ByIndexSize; i++)
+    {
+        if (head = Pool->ByIndexBuckets[i])
+        {
+            entry = head;
+
+            do
+            {
+                view = CONTAINING_RECORD(entry, PH_FILE_POOL_VIEW, ByIndexListEntry);
+                entry = entry->Flink;
+
+                if (!NT_SUCCESS(status = PhpFlushFilePool(Pool, view->Base, Pool->SegmentSize)))
+                    return status;
+            } while (entry != head);
+        }
+    }
+
+    if (!NT_SUCCESS(status = NtFlushBuffersFile(Pool->FileHandle, &isb)))
+        return status;
+
+    // Everything else is on disk, so the header can now be marked as clean.
+
+    Pool->Header->Flags &= ~PH_FP_FILE_DIRTY;
+    Pool->Header->CommitSequence++;
+    Pool->Header->Checksum = PhpComputeChecksumFilePool(Pool->Header);
+
+    if (!NT_SUCCESS(status = PhpFlushFilePool(Pool, Pool->FirstBlockOfFirstSegment, PAGE_SIZE)))
+        return status;
+
+    return NtFlushBuffersFile(Pool->FileHandle, &isb);
+}
+
+/**
+ * Copies the live blocks of a file pool into a new file without gaps.
+ *
+ * \param Pool The file pool. The pool must not be modified while this
+ * function is running.
+ * \param FileName The file name of the new file pool. Any existing
+ * file is overwritten.
+ * \param Parameters Parameters for the new file pool. If NULL, the
+ * segment size of \a Pool is used.
+ * \param NewPool A variable which receives the new file pool.
+ * \param Relocations A variable which receives an array of the old
+ * and new relative virtual addresses of each block, sorted by the old
+ * address. You must free the array using PhFree() when you no longer
+ * need it.
+ * \param NumberOfRelocations A variable which receives the number of
+ * elements in \a Relocations.
+ *
+ * \remarks The user context is copied unchanged. The caller is
+ * responsible for updating any relative virtual addresses stored in
+ * the user context or in the blocks (see PhRelocateRvaFilePool()),
+ * and for committing the new file pool.
+ */
+NTSTATUS PhCompactFilePool(
+    _Inout_ PPH_FILE_POOL Pool,
+    _In_ PWSTR FileName,
+    _In_opt_ PPH_FILE_POOL_PARAMETERS Parameters,
+    _Out_ PPH_FILE_POOL *NewPool,
+    _Out_ PPH_FILE_POOL_RELOCATION *Relocations,
+    _Out_ PULONG NumberOfRelocations
+    )
+{
+    NTSTATUS status;
+    PH_FILE_POOL_PARAMETERS localParameters;
+    PPH_FILE_POOL newPool;
+    PPH_FILE_POOL_RELOCATION relocations;
+    ULONG numberOfRelocations;
+    ULONG allocatedRelocations;
+    ULONG segmentIndexHint;
+    ULONG segmentIndex;
+    ULONG segmentCount;
+    PPH_FP_BLOCK_HEADER firstBlock;
+    PPH_FP_SEGMENT_HEADER segmentHeader;
+    RTL_BITMAP bitmap;
+    ULONG blockIndex;
+    PPH_FP_BLOCK_HEADER blockHeader;
+    ULONG span;
+    ULONG size;
+    PVOID newBlock;
+    ULONG newRva;
+
+    if (!Parameters)
+    {
+        PhpSetDefaultFilePoolParameters(&localParameters);
+        localParameters.SegmentShift = Pool->SegmentShift;
+        Parameters = &localParameters;
+    }
+
+    if (!NT_SUCCESS(status = PhCreateFilePool2(&newPool, FileName, FALSE, 0, FILE_OVERWRITE_IF, Parameters)))
+        return status;
+
+    numberOfRelocations = 0;
+    allocatedRelocations = 64;
+    relocations = PhAllocate(sizeof(PH_FILE_POOL_RELOCATION) * allocatedRelocations);
+    segmentIndexHint = -1;
+    segmentCount = Pool->Header->SegmentCount;
+
+    for (segmentIndex = 0; segmentIndex < segmentCount; segmentIndex++)
+    {
+        firstBlock = PhFppReferenceSegment(Pool, segmentIndex);
+
+        if (!firstBlock)
+        {
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            goto CleanupExit;
+        }
+
+        segmentHeader = PhFppGetHeaderSegment(Pool, firstBlock);
+        RtlInitializeBitMap(&bitmap, segmentHeader->Bitmap, PH_FP_BLOCK_COUNT);
+
+        if (segmentIndex != 0)
+            blockIndex = Pool->SegmentHeaderBlockSpan;
+        else
+            blockIndex = Pool->FileHeaderBlockSpan + Pool->SegmentHeaderBlockSpan;
+
+        // Every allocated span starts with a block header, so walking the bitmap one span
+        // at a time visits each live block once, in order of its address.
+
+        while (blockIndex < PH_FP_BLOCK_COUNT)
+        {
+            if (!RtlCheckBit(&bitmap, blockIndex))
+            {
+                blockIndex++;
+                continue;
+            }
+
+            blockHeader = (PPH_FP_BLOCK_HEADER)((PCHAR)firstBlock + (blockIndex << Pool->BlockShift));
+            span = blockHeader->Span;
+
+            if (span == 0 || span > PH_FP_BLOCK_COUNT - blockIndex)
+            {
+                PhFppDereferenceSegment(Pool, segmentIndex);
+                status = STATUS_FILE_CORRUPT_ERROR;
+                goto CleanupExit;
+            }
+
+            size = (span << Pool->BlockShift) - FIELD_OFFSET(PH_FP_BLOCK_HEADER, Body);
+            newBlock = PhpAllocateFilePool(newPool, size, &segmentIndexHint, &newRva);
+
+            if (!newBlock)
+            {
+                PhFppDereferenceSegment(Pool, segmentIndex);
+                status = STATUS_INSUFFICIENT_RESOURCES;
+                goto CleanupExit;
+            }
+
+            memcpy(newBlock, &blockHeader->Body, size);
+            PhDereferenceFilePool(newPool, newBlock);
+
+            if (numberOfRelocations == allocatedRelocations)
+            {
+                allocatedRelocations *= 2;
+                relocations = PhReAllocate(relocations, sizeof(PH_FILE_POOL_RELOCATION) * allocatedRelocations);
+            }
+
+            relocations[numberOfRelocations].OldRva = PhFppEncodeRva(Pool, segmentIndex, firstBlock, &blockHeader->Body);
+            relocations[numberOfRelocations].NewRva = newRva;
+            numberOfRelocations++;
+
+            blockIndex += span;
+        }
+
+        PhFppDereferenceSegment(Pool, segmentIndex);
+    }
+
+    newPool->Header->UserContext = Pool->Header->UserContext;
+
+CleanupExit:
+    if (NT_SUCCESS(status))
+    {
+        *NewPool = newPool;
+        *Relocations = relocations;
+        *NumberOfRelocations = numberOfRelocations;
+    }
+    else
+    {
+        FILE_DISPOSITION_INFORMATION dispositionInfo;
+        IO_STATUS_BLOCK isb;
+
+        dispositionInfo.DeleteFile = TRUE;
+        NtSetInformationFile(newPool->FileHandle, &isb, &dispositionInfo, sizeof(FILE_DISPOSITION_INFORMATION), FileDispositionInformation);
+        PhDestroyFilePool(newPool);
+        PhFree(relocations);
+    }
+
+    return status;
+}
+
+/**
+ * Finds the new relative virtual address of a block moved by
+ * PhCompactFilePool().
+ *
+ * \param Relocations The relocations returned by PhCompactFilePool().
+ * \param NumberOfRelocations The number of elements in \a Relocations.
+ * \param Rva The relative virtual address of a block in the old file
+ * pool.
+ *
+ * \return The relative virtual address of the block in the new file
+ * pool, or 0 if \a Rva does not refer to a block.
+ */
+ULONG PhRelocateRvaFilePool(
+    _In_reads_(NumberOfRelocations) PPH_FILE_POOL_RELOCATION Relocations,
+    _In_ ULONG NumberOfRelocations,
+    _In_ ULONG Rva
+    )
+{
+    ULONG low;
+    ULONG high;
+    ULONG i;
+
+    low = 0;
+    high = NumberOfRelocations;
+
+    while (low < high)
+    {
+        i = low + (high - low) / 2;
+
+        if (Relocations[i].OldRva == Rva)
+            return Relocations[i].NewRva;
+
+        if (Relocations[i].OldRva < Rva)
+            low = i + 1;
+        else
+            high = i;
+    }
+
+    return 0;
+}
+
 /**
  * Extends a file pool.
  *
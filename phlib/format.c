@@ -30,10 +30,21 @@
  * PhFormat, which returns a string object containing the formatted string,
  * and PhFormatToBuffer, which writes the formatted string to a buffer. The
  * latter is a bit faster due to the lack of resizing logic.
+ *
+ * Integers are converted two digits at a time using a lookup table. Doubles
+ * in normal form with a small precision are rounded exactly using 128-bit
+ * integer arithmetic, and FormatShortestForm produces the shortest string
+ * that converts back to the same double (using the Ryu algorithm); other
+ * floating-point cases are passed to the CRT.
+ *
+ * PhCompileFormat converts a format array into a form that can be reused
+ * many times with different values (e.g. once per tree cell), so that
+ * literal strings are converted and merged only once.
  */
 
 #include <phbase.h>
 #include <locale.h>
+#include "format_ryu.h"
 
 extern ULONG PhMaxSizeUnit;
 
@@ -44,6 +55,8 @@ extern ULONG PhMaxSizeUnit;
 #define PHP_FORMAT_POSITIVE 0x2
 #define PHP_FORMAT_PAD 0x4
 
+#define PHP_FORMAT_IS_LITERAL(Format) (((Format)->Type & FormatTypeMask) <= MultiByteStringZFormatType)
+
 // Internal CRT routine needed for floating-point conversion
 
 errno_t __cdecl _cfltcvt_l(double *arg, char *buffer, size_t sizeInBytes,
@@ -124,6 +137,617 @@ VOID PhpCropZeros(
     }
 }
 
+static CHAR PhpDecimalDigitPairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+// Writes the decimal digits of Value backwards, ending just before Buffer. Buffer is
+// updated to point to the first digit.
+#define PHP_WRITE_DECIMAL_DIGITS(Value, Buffer) \
+    do { \
+        ULONG64 digitValue = (Value); \
+        ULONG digitValue32; \
+        ULONG digitPair; \
+        \
+        while (digitValue > MAXULONG) \
+        { \
+            digitPair = (ULONG)(digitValue % 100); \
+            digitValue /= 100; \
+            *--(Buffer) = PhpDecimalDigitPairs[digitPair * 2 + 1]; \
+            *--(Buffer) = PhpDecimalDigitPairs[digitPair * 2]; \
+        } \
+        \
+        digitValue32 = (ULONG)digitValue; \
+        \
+        while (digitValue32 >= 100) \
+        { \
+            digitPair = digitValue32 % 100; \
+            digitValue32 /= 100; \
+            *--(Buffer) = PhpDecimalDigitPairs[digitPair * 2 + 1]; \
+            *--(Buffer) = PhpDecimalDigitPairs[digitPair * 2]; \
+        } \
+        \
+        if (digitValue32 >= 10) \
+        { \
+            *--(Buffer) = PhpDecimalDigitPairs[digitValue32 * 2 + 1]; \
+            *--(Buffer) = PhpDecimalDigitPairs[digitValue32 * 2]; \
+        } \
+        else \
+        { \
+            *--(Buffer) = (CHAR)('0' + digitValue32); \
+        } \
+    } while (0)
+
+FORCEINLINE ULONG64 PhpMultiply128(
+    _In_ ULONG64 Multiplicand,
+    _In_ ULONG64 Multiplier,
+    _Out_ PULONG64 ProductHigh
+    )
+{
+#if defined(_M_X64)
+    return _umul128(Multiplicand, Multiplier, ProductHigh);
+#else
+    ULONG64 lowLow;
+    ULONG64 lowHigh;
+    ULONG64 highLow;
+    ULONG64 middle1;
+    ULONG64 middle2;
+
+    lowLow = (ULONG64)(ULONG)Multiplicand * (ULONG)Multiplier;
+    lowHigh = (ULONG64)(ULONG)Multiplicand * (ULONG)(Multiplier >> 32);
+    highLow = (ULONG64)(ULONG)(Multiplicand >> 32) * (ULONG)Multiplier;
+
+    middle1 = highLow + (lowLow >> 32);
+    middle2 = lowHigh + (ULONG)middle1;
+    *ProductHigh = (ULONG64)(ULONG)(Multiplicand >> 32) * (ULONG)(Multiplier >> 32) + (middle1 >> 32) + (middle2 >> 32);
+
+    return (middle2 << 32) | (ULONG)lowLow;
+#endif
+}
+
+// Ryu, specialized for doubles. See format_ryu.h.
+
+#define PHP_DOUBLE_MANTISSA_BITS 52
+#define PHP_DOUBLE_EXPONENT_BITS 11
+#define PHP_DOUBLE_BIAS 1023
+
+// ceil(log2(5^e)) for 0 < e <= 3528 (1 for e = 0).
+#define PhpPow5Bits(e) ((LONG)((((ULONG)(e)) * 1217359) >> 19) + 1)
+// floor(log10(2^e)) for 0 <= e <= 1650.
+#define PhpLog10Pow2(e) ((LONG)((((ULONG)(e)) * 78913) >> 18))
+// floor(log10(5^e)) for 0 <= e <= 2620.
+#define PhpLog10Pow5(e) ((LONG)((((ULONG)(e)) * 732923) >> 20))
+
+FORCEINLINE BOOLEAN PhpMultipleOfPowerOf5(
+    _In_ ULONG64 Value,
+    _In_ ULONG Power
+    )
+{
+    ULONG count = 0;
+
+    while (Value % 5 == 0)
+    {
+        Value /= 5;
+        count++;
+    }
+
+    return count >= Power;
+}
+
+// Computes (Multiplicand * Multiplier) >> Shift, where Multiplier is a 128-bit table entry
+// and 64 < Shift < 128.
+FORCEINLINE ULONG64 PhpMultiplyShift64(
+    _In_ ULONG64 Multiplicand,
+    _In_ ULONG64 *Multiplier,
+    _In_ LONG Shift
+    )
+{
+    ULONG64 high0;
+    ULONG64 high1;
+    ULONG64 low1;
+    ULONG64 sum;
+
+    PhpMultiply128(Multiplicand, Multiplier[0], &high0);
+    low1 = PhpMultiply128(Multiplicand, Multiplier[1], &high1);
+    sum = high0 + low1;
+
+    if (sum < high0)
+        high1++;
+
+    Shift -= 64;
+
+    return (high1 << (64 - Shift)) | (sum >> Shift);
+}
+
+/**
+ * Converts a finite, non-zero double to the shortest decimal that rounds to it.
+ *
+ * \param Bits The bits of the double, without the sign bit.
+ * \param Digits A variable which receives the decimal digits.
+ * \param Exponent A variable which receives the decimal exponent.
+ */
+static VOID PhpDoubleToShortestDecimal(
+    _In_ ULONG64 Bits,
+    _Out_ PULONG64 Digits,
+    _Out_ PLONG Exponent
+    )
+{
+    ULONG64 ieeeMantissa;
+    ULONG ieeeExponent;
+    LONG e2;
+    ULONG64 m2;
+    BOOLEAN acceptBounds;
+    ULONG64 mv;
+    ULONG mmShift;
+    ULONG64 vr;
+    ULONG64 vp;
+    ULONG64 vm;
+    LONG e10;
+    BOOLEAN vmIsTrailingZeros = FALSE;
+    BOOLEAN vrIsTrailingZeros = FALSE;
+    LONG removed = 0;
+    ULONG lastRemovedDigit = 0;
+    ULONG64 output;
+
+    ieeeMantissa = Bits & ((1ULL << PHP_DOUBLE_MANTISSA_BITS) - 1);
+    ieeeExponent = (ULONG)(Bits >> PHP_DOUBLE_MANTISSA_BITS);
+
+    if (ieeeExponent == 0)
+    {
+        e2 = 1 - PHP_DOUBLE_BIAS - PHP_DOUBLE_MANTISSA_BITS - 2;
+        m2 = ieeeMantissa;
+    }
+    else
+    {
+        e2 = (LONG)ieeeExponent - PHP_DOUBLE_BIAS - PHP_DOUBLE_MANTISSA_BITS - 2;
+        m2 = (1ULL << PHP_DOUBLE_MANTISSA_BITS) | ieeeMantissa;
+    }
+
+    acceptBounds = (m2 & 1) == 0;
+
+    // Step 2: Determine the interval of valid decimal representations.
+    mv = 4 * m2;
+    mmShift = ieeeMantissa != 0 || ieeeExponent <= 1;
+
+    // Step 3: Convert to a decimal power base using 128-bit arithmetic.
+    if (e2 >= 0)
+    {
+        LONG q;
+        LONG k;
+        LONG i;
+
+        q = PhpLog10Pow2(e2) - (e2 > 3);
+        e10 = q;
+        k = PHP_DOUBLE_POW5_INV_BITCOUNT + PhpPow5Bits(q) - 1;
+        i = -e2 + q + k;
+
+        vr = PhpMultiplyShift64(mv, PhpDoublePow5InvSplit[q], i);
+        vp = PhpMultiplyShift64(mv + 2, PhpDoublePow5InvSplit[q], i);
+        vm = PhpMultiplyShift64(mv - 1 - mmShift, PhpDoublePow5InvSplit[q], i);
+
+        if (q <= 21)
+        {
+            // Only one of mp, mv and mm can be a multiple of 5, if any.
+            if (mv % 5 == 0)
+                vrIsTrailingZeros = PhpMultipleOfPowerOf5(mv, q);
+            else if (acceptBounds)
+                vmIsTrailingZeros = PhpMultipleOfPowerOf5(mv - 1 - mmShift, q);
+            else
+                vp -= PhpMultipleOfPowerOf5(mv + 2, q);
+        }
+    }
+    else
+    {
+        LONG q;
+        LONG i;
+        LONG k;
+        LONG j;
+
+        q = PhpLog10Pow5(-e2) - (-e2 > 1);
+        e10 = q + e2;
+        i = -e2 - q;
+        k = PhpPow5Bits(i) - PHP_DOUBLE_POW5_BITCOUNT;
+        j = q - k;
+
+        vr = PhpMultiplyShift64(mv, PhpDoublePow5Split[i], j);
+        vp = PhpMultiplyShift64(mv + 2, PhpDoublePow5Split[i], j);
+        vm = PhpMultiplyShift64(mv - 1 - mmShift, PhpDoublePow5Split[i], j);
+
+        if (q <= 1)
+        {
+            // mv has at least q trailing zero bits, since it is a multiple of 4.
+            vrIsTrailingZeros = TRUE;
+
+            if (acceptBounds)
+                vmIsTrailingZeros = mmShift == 1; // mm = mv - 1 - mmShift has one trailing zero bit
+            else
+                vp--; // mp = mv + 2 has at least one trailing zero bit
+        }
+        else if (q < 63)
+        {
+            // We need to know whether the full product has at least q trailing zeros.
+            vrIsTrailingZeros = (mv & ((1ULL << q) - 1)) == 0;
+        }
+    }
+
+    // Step 4: Find the shortest decimal representation in the interval.
+    if (vmIsTrailingZeros || vrIsTrailingZeros)
+    {
+        // General case, which happens rarely.
+        while (vp / 10 > vm / 10)
+        {
+            vmIsTrailingZeros &= vm % 10 == 0;
+            vrIsTrailingZeros &= lastRemovedDigit == 0;
+            lastRemovedDigit = (ULONG)(vr % 10);
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+
+        if (vmIsTrailingZeros)
+        {
+            while (vm % 10 == 0)
+            {
+                vrIsTrailingZeros &= lastRemovedDigit == 0;
+                lastRemovedDigit = (ULONG)(vr % 10);
+                vr /= 10;
+                vp /= 10;
+                vm /= 10;
+                removed++;
+            }
+        }
+
+        // Round to even if the exact number is .....50..0.
+        if (vrIsTrailingZeros && lastRemovedDigit == 5 && vr % 2 == 0)
+            lastRemovedDigit = 4;
+
+        output = vr + ((vr == vm && (!acceptBounds || !vmIsTrailingZeros)) || lastRemovedDigit >= 5);
+    }
+    else
+    {
+        BOOLEAN roundUp = FALSE;
+
+        // Remove two digits at a time where possible.
+        if (vp / 100 > vm / 100)
+        {
+            roundUp = vr % 100 >= 50;
+            vr /= 100;
+            vp /= 100;
+            vm /= 100;
+            removed += 2;
+        }
+
+        while (vp / 10 > vm / 10)
+        {
+            roundUp = vr % 10 >= 5;
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+
+        output = vr + (vr == vm || roundUp);
+    }
+
+    *Digits = output;
+    *Exponent = e10 + removed;
+}
+
+/**
+ * Formats a double using the shortest representation that converts back to the same value.
+ *
+ * \param Value The value.
+ * \param Buffer A buffer which receives the null-terminated string. The buffer must be at
+ * least 32 characters long.
+ * \param Flags A combination of FormatStandardForm and FormatUpperCase.
+ *
+ * \return FALSE if the value is infinite or NaN, otherwise TRUE.
+ */
+static BOOLEAN PhpFormatDoubleShortest(
+    _In_ DOUBLE Value,
+    _Out_writes_(32) PSTR Buffer,
+    _In_ ULONG Flags
+    )
+{
+    ULONG64 bits;
+    ULONG64 digits;
+    LONG exponent;
+    CHAR digitBuffer[24];
+    PSTR digitStart;
+    PSTR digitEnd;
+    LONG numberOfDigits;
+    LONG pointPosition;
+    PSTR s;
+
+    memcpy(&bits, &Value, sizeof(ULONG64));
+
+    if (((bits >> PHP_DOUBLE_MANTISSA_BITS) & ((1 << PHP_DOUBLE_EXPONENT_BITS) - 1)) == (1 << PHP_DOUBLE_EXPONENT_BITS) - 1)
+        return FALSE;
+
+    s = Buffer;
+
+    if (bits >> 63)
+        *s++ = '-';
+
+    bits &= ~(1ULL << 63);
+
+    if (bits != 0)
+    {
+        PhpDoubleToShortestDecimal(bits, &digits, &exponent);
+    }
+    else
+    {
+        digits = 0;
+        exponent = 0;
+    }
+
+    digitEnd = digitBuffer + sizeof(digitBuffer);
+    digitStart = digitEnd;
+    PHP_WRITE_DECIMAL_DIGITS(digits, digitStart);
+    numberOfDigits = (LONG)(digitEnd - digitStart);
+    // The value is 0.ddd * 10^pointPosition.
+    pointPosition = numberOfDigits + exponent;
+
+    if (!(Flags & FormatStandardForm) && pointPosition > -6 && pointPosition <= 21)
+    {
+        if (pointPosition <= 0)
+        {
+            // 0.000ddd
+            *s++ = '0';
+            *s++ = (CHAR)PhpFormatDecimalSeparator;
+            memset(s, '0', (SIZE_T)-pointPosition);
+            s += -pointPosition;
+            memcpy(s, digitStart, numberOfDigits);
+            s += numberOfDigits;
+        }
+        else if (pointPosition >= numberOfDigits)
+        {
+            // ddd000
+            memcpy(s, digitStart, numberOfDigits);
+            s += numberOfDigits;
+            memset(s, '0', pointPosition - numberOfDigits);
+            s += pointPosition - numberOfDigits;
+        }
+        else
+        {
+            // dd.d
+            memcpy(s, digitStart, pointPosition);
+            s += pointPosition;
+            *s++ = (CHAR)PhpFormatDecimalSeparator;
+            memcpy(s, digitStart + pointPosition, numberOfDigits - pointPosition);
+            s += numberOfDigits - pointPosition;
+        }
+    }
+    else
+    {
+        ULONG absoluteExponent;
+
+        // d.ddde+XX
+        *s++ = digitStart[0];
+
+        if (numberOfDigits > 1)
+        {
+            *s++ = (CHAR)PhpFormatDecimalSeparator;
+            memcpy(s, digitStart + 1, numberOfDigits - 1);
+            s += numberOfDigits - 1;
+        }
+
+        *s++ = (Flags & FormatUpperCase) ? 'E' : 'e';
+        exponent = pointPosition - 1;
+
+        if (exponent < 0)
+        {
+            *s++ = '-';
+            absoluteExponent = -exponent;
+        }
+        else
+        {
+            *s++ = '+';
+            absoluteExponent = exponent;
+        }
+
+        if (absoluteExponent >= 100)
+        {
+            *s++ = (CHAR)('0' + absoluteExponent / 100);
+            absoluteExponent %= 100;
+        }
+
+        *s++ = PhpDecimalDigitPairs[absoluteExponent * 2];
+        *s++ = PhpDecimalDigitPairs[absoluteExponent * 2 + 1];
+    }
+
+    *s = 0;
+
+    return TRUE;
+}
+
+static ULONG64 PhpPowersOf10[18] =
+{
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+    100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL,
+    10000000000000ULL, 100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+    100000000000000000ULL
+};
+
+/**
+ * Formats a double in normal form with a fixed number of decimal places, rounding the
+ * exact binary value to nearest (ties to even).
+ *
+ * \param Value The value.
+ * \param Precision The number of decimal places.
+ * \param Buffer A buffer which receives the null-terminated string. The buffer must be at
+ * least 48 characters long.
+ *
+ * \return FALSE if the value cannot be handled by this function (it is infinite, NaN, too
+ * large, or too many decimal places were requested), otherwise TRUE.
+ */
+static BOOLEAN PhpFormatDoubleFixed(
+    _In_ DOUBLE Value,
+    _In_ ULONG Precision,
+    _Out_writes_(48) PSTR Buffer
+    )
+{
+    ULONG64 bits;
+    ULONG ieeeExponent;
+    ULONG64 m2;
+    LONG e2;
+    ULONG64 productLow;
+    ULONG64 productHigh;
+    ULONG64 q;
+    CHAR digitBuffer[24];
+    PSTR digitStart;
+    PSTR digitEnd;
+    ULONG numberOfDigits;
+    PSTR s;
+
+    if (Precision > 17)
+        return FALSE;
+
+    memcpy(&bits, &Value, sizeof(ULONG64));
+    ieeeExponent = (ULONG)(bits >> PHP_DOUBLE_MANTISSA_BITS) & ((1 << PHP_DOUBLE_EXPONENT_BITS) - 1);
+    m2 = bits & ((1ULL << PHP_DOUBLE_MANTISSA_BITS) - 1);
+
+    if (ieeeExponent == (1 << PHP_DOUBLE_EXPONENT_BITS) - 1)
+        return FALSE;
+
+    if (ieeeExponent == 0)
+    {
+        e2 = 1 - PHP_DOUBLE_BIAS - PHP_DOUBLE_MANTISSA_BITS;
+    }
+    else
+    {
+        e2 = (LONG)ieeeExponent - PHP_DOUBLE_BIAS - PHP_DOUBLE_MANTISSA_BITS;
+        m2 |= 1ULL << PHP_DOUBLE_MANTISSA_BITS;
+    }
+
+    // Value * 10^Precision = m2 * 10^Precision * 2^e2. The product of the first two terms
+    // is less than 2^110.
+    productLow = PhpMultiply128(m2, PhpPowersOf10[Precision], &productHigh);
+
+    if (e2 >= 0)
+    {
+        if (productHigh != 0 || e2 >= 64 || (productLow >> (63 - e2)) != 0)
+            return FALSE;
+
+        q = productLow << e2;
+    }
+    else
+    {
+        ULONG shift = -e2;
+        ULONG64 remainderLow;
+        ULONG64 remainderHigh;
+        ULONG64 halfLow;
+        ULONG64 halfHigh;
+        LONG compare;
+
+        if (shift >= 128)
+        {
+            // The product is less than 2^110, so the value rounds to zero.
+            q = 0;
+        }
+        else
+        {
+            if (shift >= 64)
+            {
+                q = productHigh >> (shift - 64);
+                remainderLow = productLow;
+                remainderHigh = productHigh & ((1ULL << (shift - 64)) - 1);
+            }
+            else
+            {
+                if ((productHigh >> shift) != 0)
+                    return FALSE;
+
+                q = (productLow >> shift) | (productHigh << (64 - shift));
+                remainderLow = productLow & ((1ULL << shift) - 1);
+                remainderHigh = 0;
+            }
+
+            if (shift <= 64)
+            {
+                halfLow = 1ULL << (shift - 1);
+                halfHigh = 0;
+            }
+            else
+            {
+                halfLow = 0;
+                halfHigh = 1ULL << (shift - 65);
+            }
+
+            if (remainderHigh != halfHigh)
+                compare = remainderHigh > halfHigh ? 1 : -1;
+            else if (remainderLow != halfLow)
+                compare = remainderLow > halfLow ? 1 : -1;
+            else
+                compare = 0;
+
+            if (compare > 0 || (compare == 0 && (q & 1)))
+            {
+                if (q == MAXULONG64)
+                    return FALSE;
+
+                q++;
+            }
+        }
+    }
+
+    digitEnd = digitBuffer + sizeof(digitBuffer);
+    digitStart = digitEnd;
+    PHP_WRITE_DECIMAL_DIGITS(q, digitStart);
+    numberOfDigits = (ULONG)(digitEnd - digitStart);
+
+    // Make sure there is at least one digit before the decimal point.
+    while (numberOfDigits <= Precision)
+    {
+        *--digitStart = '0';
+        numberOfDigits++;
+    }
+
+    s = Buffer;
+
+    if (bits >> 63)
+        *s++ = '-';
+
+    memcpy(s, digitStart, numberOfDigits - Precision);
+    s += numberOfDigits - Precision;
+
+    if (Precision != 0)
+    {
+        *s++ = (CHAR)PhpFormatDecimalSeparator;
+        memcpy(s, digitEnd - Precision, Precision);
+        s += Precision;
+    }
+
+    *s = 0;
+
+    return TRUE;
+}
+
+static BOOLEAN PhpFormatDoubleFast(
+    _In_ DOUBLE Value,
+    _Out_writes_(48) PSTR Buffer,
+    _In_ CHAR Format,
+    _In_ ULONG Precision,
+    _In_ ULONG Flags
+    )
+{
+    if ((Flags & FormatShortestForm) && !(Flags & FormatHexadecimalForm))
+        return PhpFormatDoubleShortest(Value, Buffer, Flags);
+    if (Format == 'f')
+        return PhpFormatDoubleFixed(Value, Precision, Buffer);
+
+    return FALSE;
+}
+
 PPH_STRING PhpResizeFormatBuffer(
     _In_ PPH_STRING String,
     _Inout_ PSIZE_T AllocatedLength,
@@ -149,17 +773,10 @@ PPH_STRING PhpResizeFormatBuffer(
     return newString;
 }
 
-/**
- * Creates a formatted string.
- *
- * \param Format An array of format structures.
- * \param Count The number of structures supplied in \a Format.
- * \param InitialCapacity The number of bytes to reserve initially for
- * the string. If 0 is specified, a default value is used.
- */
-PPH_STRING PhFormat(
+static PPH_STRING PhpFormat(
     _In_reads_(Count) PPH_FORMAT Format,
     _In_ ULONG Count,
+    _In_opt_ PPH_FORMAT_VALUE Values,
     _In_opt_ SIZE_T InitialCapacity
     )
 {
@@ -167,6 +784,7 @@ PPH_STRING PhFormat(
     SIZE_T allocatedLength;
     PWSTR buffer;
     SIZE_T usedLength;
+    ULONG valueIndex = 0;
 
     // Set up the buffer.
 
@@ -184,6 +802,7 @@ PPH_STRING PhFormat(
 #undef ENSURE_BUFFER
 #undef OK_BUFFER
 #undef ADVANCE_BUFFER
+#undef FORMAT_VALUE
 
 #define ENSURE_BUFFER(NeededLength) \
     do { \
@@ -199,6 +818,8 @@ PPH_STRING PhFormat(
 #define ADVANCE_BUFFER(Length) \
     do { buffer += (Length) / sizeof(WCHAR); usedLength += (Length); } while (0)
 
+#define FORMAT_VALUE(Format) (PHP_FORMAT_IS_LITERAL(Format) || !Values ? &(Format)->u : &Values[valueIndex++])
+
 #include "format_i.h"
 
     string->Length = usedLength;
@@ -208,28 +829,10 @@ PPH_STRING PhFormat(
     return string;
 }
 
-/**
- * Writes a formatted string to a buffer.
- *
- * \param Format An array of format structures.
- * \param Count The number of structures supplied in \a Format.
- * \param Buffer A buffer. If NULL, no data is written.
- * \param BufferLength The number of bytes available in \a Buffer,
- * including space for the null terminator.
- * \param ReturnLength The number of bytes required to hold the
- * string, including the null terminator.
- *
- * \return TRUE if the buffer was large enough and the string was
- * written (i.e. \a BufferLength >= \a ReturnLength), otherwise
- * FALSE. In either case, the required number of bytes is stored
- * in \a ReturnLength.
- *
- * \remarks If the function fails but \a BufferLength != 0, a
- * single null byte is written to the start of \a Buffer.
- */
-BOOLEAN PhFormatToBuffer(
+static BOOLEAN PhpFormatToBuffer(
     _In_reads_(Count) PPH_FORMAT Format,
     _In_ ULONG Count,
+    _In_opt_ PPH_FORMAT_VALUE Values,
     _Out_writes_bytes_opt_(BufferLength) PWSTR Buffer,
     _In_opt_ SIZE_T BufferLength,
     _Out_opt_ PSIZE_T ReturnLength
@@ -238,6 +841,7 @@ BOOLEAN PhFormatToBuffer(
     PWSTR buffer;
     SIZE_T usedLength;
     BOOLEAN overrun;
+    ULONG valueIndex = 0;
 
     buffer = Buffer;
     usedLength = 0;
@@ -250,6 +854,7 @@ BOOLEAN PhFormatToBuffer(
 #undef ENSURE_BUFFER
 #undef OK_BUFFER
 #undef ADVANCE_BUFFER
+#undef FORMAT_VALUE
 
 #define ENSURE_BUFFER(NeededLength) \
     do { \
@@ -262,6 +867,8 @@ BOOLEAN PhFormatToBuffer(
 #define ADVANCE_BUFFER(Length) \
     do { buffer += (Length) / sizeof(WCHAR); usedLength += (Length); } while (0)
 
+#define FORMAT_VALUE(Format) (PHP_FORMAT_IS_LITERAL(Format) || !Values ? &(Format)->u : &Values[valueIndex++])
+
 #include "format_i.h"
 
     // Write the null-terminator.
@@ -277,3 +884,270 @@ BOOLEAN PhFormatToBuffer(
 
     return OK_BUFFER;
 }
+
+/**
+ * Creates a formatted string.
+ *
+ * \param Format An array of format structures.
+ * \param Count The number of structures supplied in \a Format.
+ * \param InitialCapacity The number of bytes to reserve initially for
+ * the string. If 0 is specified, a default value is used.
+ */
+PPH_STRING PhFormat(
+    _In_reads_(Count) PPH_FORMAT Format,
+    _In_ ULONG Count,
+    _In_opt_ SIZE_T InitialCapacity
+    )
+{
+    return PhpFormat(Format, Count, NULL, InitialCapacity);
+}
+
+/**
+ * Writes a formatted string to a buffer.
+ *
+ * \param Format An array of format structures.
+ * \param Count The number of structures supplied in \a Format.
+ * \param Buffer A buffer. If NULL, no data is written.
+ * \param BufferLength The number of bytes available in \a Buffer,
+ * including space for the null terminator.
+ * \param ReturnLength The number of bytes required to hold the
+ * string, including the null terminator.
+ *
+ * \return TRUE if the buffer was large enough and the string was
+ * written (i.e. \a BufferLength >= \a ReturnLength), otherwise
+ * FALSE. In either case, the required number of bytes is stored
+ * in \a ReturnLength.
+ *
+ * \remarks If the function fails but \a BufferLength != 0, a
+ * single null byte is written to the start of \a Buffer.
+ */
+BOOLEAN PhFormatToBuffer(
+    _In_reads_(Count) PPH_FORMAT Format,
+    _In_ ULONG Count,
+    _Out_writes_bytes_opt_(BufferLength) PWSTR Buffer,
+    _In_opt_ SIZE_T BufferLength,
+    _Out_opt_ PSIZE_T ReturnLength
+    )
+{
+    return PhpFormatToBuffer(Format, Count, NULL, Buffer, BufferLength, ReturnLength);
+}
+
+static BOOLEAN PhpGetFormatLiteral(
+    _In_ PPH_FORMAT Format,
+    _Out_opt_ PWSTR Buffer,
+    _Out_ PSIZE_T Length
+    )
+{
+    switch (Format->Type & FormatTypeMask)
+    {
+    case CharFormatType:
+        if (Buffer)
+            *Buffer = Format->u.Char;
+        *Length = sizeof(WCHAR);
+        return TRUE;
+    case StringFormatType:
+        if (Buffer)
+            memcpy(Buffer, Format->u.String.Buffer, Format->u.String.Length);
+        *Length = Format->u.String.Length;
+        return TRUE;
+    case StringZFormatType:
+        *Length = PhCountStringZ(Format->u.StringZ) * sizeof(WCHAR);
+        if (Buffer)
+            memcpy(Buffer, Format->u.StringZ, *Length);
+        return TRUE;
+    case MultiByteStringFormatType:
+    case MultiByteStringZFormatType:
+        {
+            PSTR multiByteBuffer;
+            SIZE_T multiByteLength;
+            ULONG bytesInUnicodeString;
+
+            if ((Format->Type & FormatTypeMask) == MultiByteStringFormatType)
+            {
+                multiByteBuffer = Format->u.MultiByteString.Buffer;
+                multiByteLength = Format->u.MultiByteString.Length;
+            }
+            else
+            {
+                multiByteBuffer = Format->u.MultiByteStringZ;
+                multiByteLength = strlen(multiByteBuffer);
+            }
+
+            if (!NT_SUCCESS(RtlMultiByteToUnicodeSize(
+                &bytesInUnicodeString,
+                multiByteBuffer,
+                (ULONG)multiByteLength
+                )))
+            {
+                bytesInUnicodeString = 0;
+            }
+
+            if (Buffer && bytesInUnicodeString != 0)
+            {
+                RtlMultiByteToUnicodeN(
+                    Buffer,
+                    bytesInUnicodeString,
+                    NULL,
+                    multiByteBuffer,
+                    (ULONG)multiByteLength
+                    );
+            }
+
+            *Length = bytesInUnicodeString;
+        }
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+/**
+ * Prepares a format array for repeated use.
+ *
+ * \param Format An array of format structures. The values of character and
+ * string elements are copied; the values of all other elements are ignored.
+ * \param Count The number of structures supplied in \a Format.
+ *
+ * \return The compiled format. You must free it using PhFreeCompiledFormat()
+ * when you no longer need it.
+ *
+ * \remarks Each time the compiled format is used, one value must be supplied
+ * for every element other than a character or string element, in order.
+ */
+PPH_COMPILED_FORMAT PhCompileFormat(
+    _In_reads_(Count) PPH_FORMAT Format,
+    _In_ ULONG Count
+    )
+{
+    PPH_COMPILED_FORMAT compiledFormat;
+    ULONG i;
+    ULONG count;
+    ULONG numberOfValues;
+    SIZE_T literalLength;
+    SIZE_T length;
+    BOOLEAN previousLiteral;
+    PPH_FORMAT format;
+    PWSTR literalBuffer;
+
+#define PHP_FORMAT_IS_ALIGNED(Format) (!!((Format)->Type & (FormatLeftAlign | FormatRightAlign)))
+
+    // Count the elements and the literal characters. Adjacent literals are merged
+    // unless they need to be aligned individually.
+
+    count = 0;
+    numberOfValues = 0;
+    literalLength = 0;
+    previousLiteral = FALSE;
+
+    for (i = 0; i < Count; i++)
+    {
+        if (PhpGetFormatLiteral(&Format[i], NULL, &length))
+        {
+            literalLength += length;
+
+            if (!previousLiteral || PHP_FORMAT_IS_ALIGNED(&Format[i]))
+                count++;
+
+            previousLiteral = !PHP_FORMAT_IS_ALIGNED(&Format[i]);
+        }
+        else
+        {
+            count++;
+            numberOfValues++;
+            previousLiteral = FALSE;
+        }
+    }
+
+    compiledFormat = PhAllocate(sizeof(PH_COMPILED_FORMAT) + sizeof(PH_FORMAT) * count + literalLength);
+    compiledFormat->Count = count;
+    compiledFormat->NumberOfValues = numberOfValues;
+    compiledFormat->Format = (PPH_FORMAT)PTR_ADD_OFFSET(compiledFormat, sizeof(PH_COMPILED_FORMAT));
+    literalBuffer = (PWSTR)PTR_ADD_OFFSET(compiledFormat->Format, sizeof(PH_FORMAT) * count);
+
+    format = compiledFormat->Format - 1;
+    previousLiteral = FALSE;
+
+    for (i = 0; i < Count; i++)
+    {
+        if (PhpGetFormatLiteral(&Format[i], literalBuffer, &length))
+        {
+            if (!previousLiteral || PHP_FORMAT_IS_ALIGNED(&Format[i]))
+            {
+                format++;
+                *format = Format[i];
+                format->Type = StringFormatType | (Format[i].Type & ~FormatTypeMask);
+                format->u.String.Buffer = literalBuffer;
+                format->u.String.Length = 0;
+            }
+
+            format->u.String.Length += length;
+            literalBuffer = (PWSTR)PTR_ADD_OFFSET(literalBuffer, length);
+            previousLiteral = !PHP_FORMAT_IS_ALIGNED(&Format[i]);
+        }
+        else
+        {
+            format++;
+            *format = Format[i];
+            memset(&format->u, 0, sizeof(PH_FORMAT_VALUE));
+            previousLiteral = FALSE;
+        }
+    }
+
+    return compiledFormat;
+}
+
+/**
+ * Frees a compiled format.
+ *
+ * \param CompiledFormat A compiled format created by PhCompileFormat().
+ */
+VOID PhFreeCompiledFormat(
+    _In_ _Post_invalid_ PPH_COMPILED_FORMAT CompiledFormat
+    )
+{
+    PhFree(CompiledFormat);
+}
+
+/**
+ * Creates a formatted string using a compiled format.
+ *
+ * \param CompiledFormat A compiled format created by PhCompileFormat().
+ * \param Values An array of values, one for each element in the original
+ * format array that is not a character or string element.
+ * \param InitialCapacity The number of bytes to reserve initially for
+ * the string. If 0 is specified, a default value is used.
+ */
+PPH_STRING PhFormatCompiled(
+    _In_ PPH_COMPILED_FORMAT CompiledFormat,
+    _In_reads_(CompiledFormat->NumberOfValues) PPH_FORMAT_VALUE Values,
+    _In_opt_ SIZE_T InitialCapacity
+    )
+{
+    return PhpFormat(CompiledFormat->Format, CompiledFormat->Count, Values, InitialCapacity);
+}
+
+/**
+ * Writes a formatted string to a buffer using a compiled format.
+ *
+ * \param CompiledFormat A compiled format created by PhCompileFormat().
+ * \param Values An array of values, one for each element in the original
+ * format array that is not a character or string element.
+ * \param Buffer A buffer. If NULL, no data is written.
+ * \param BufferLength The number of bytes available in \a Buffer,
+ * including space for the null terminator.
+ * \param ReturnLength The number of bytes required to hold the
+ * string, including the null terminator.
+ *
+ * \return TRUE if the buffer was large enough and the string was
+ * written, otherwise FALSE. See PhFormatToBuffer() for details.
+ */
+BOOLEAN PhFormatCompiledToBuffer(
+    _In_ PPH_COMPILED_FORMAT CompiledFormat,
+    _In_reads_(CompiledFormat->NumberOfValues) PPH_FORMAT_VALUE Values,
+    _Out_writes_bytes_opt_(BufferLength) PWSTR Buffer,
+    _In_opt_ SIZE_T BufferLength,
+    _Out_opt_ PSIZE_T ReturnLength
+    )
+{
+    return PhpFormatToBuffer(CompiledFormat->Format, CompiledFormat->Count, Values, Buffer, BufferLength, ReturnLength);
+}
@@ -12,6 +12,8 @@
  *   occurred.
  * * ADVANCE_BUFFER - This macro is passed the number of bytes written to the buffer
  *   and should increment the "buffer" pointer and "usedLength" counter.
+ * * FORMAT_VALUE - This macro is passed the current format structure and returns a
+ *   pointer to the PH_FORMAT_VALUE to use for it.
  * In addition to these macros, the "buffer" and "usedLength" variables are assumed to
  * be present.
  *
@@ -45,6 +47,7 @@
     while (Count--)
     {
         PPH_FORMAT format;
+        PPH_FORMAT_VALUE formatValue;
         SIZE_T partLength;
         WCHAR tempBuffer[BUFFER_SIZE];
         ULONG flags;
@@ -52,6 +55,7 @@
         ULONG64 int64;
 
         format = Format++;
+        formatValue = FORMAT_VALUE(format);
 
         // Save the currently used length so we can compute the
         // part length later.
@@ -133,8 +137,7 @@
     do { \
         r = (ULONG)(Input % radix); \
         Input /= radix; \
-        *temp-- = integerToChar[r]; \
-        tempCount++; \
+        *--temp = integerToChar[r]; \
     } while (0)
 
 #define COMMON_INTEGER_FORMAT(Input, Format) \
@@ -153,10 +156,26 @@
         integerToChar = PhIntegerToChar; \
         if ((Format)->Type & FormatUpperCase) \
             integerToChar = PhIntegerToCharUpper; \
-        temp = tempBuffer + BUFFER_SIZE - 1; \
-        tempCount = 0; \
+        temp = tempBuffer + BUFFER_SIZE; \
         \
-        if (Input != 0) \
+        if (radix == 10) \
+        { \
+            if ((Format)->Type & FormatGroupDigits) \
+            { \
+                while (Input >= 1000) \
+                { \
+                    r = (ULONG)(Input % 1000); \
+                    Input /= 1000; \
+                    *--temp = PhpDecimalDigitPairs[(r % 100) * 2 + 1]; \
+                    *--temp = PhpDecimalDigitPairs[(r % 100) * 2]; \
+                    *--temp = (WCHAR)('0' + r / 100); \
+                    *--temp = PhpFormatThousandSeparator; \
+                } \
+            } \
+            \
+            PHP_WRITE_DECIMAL_DIGITS(Input, temp); \
+        } \
+        else if (Input != 0) \
         { \
             if ((Format)->Type & FormatGroupDigits) \
             { \
@@ -168,12 +187,19 @@
                     \
                     if (++needsSep == 3 && Input != 0) /* get rid of trailing separator */ \
                     { \
-                        *temp-- = PhpFormatThousandSeparator; \
-                        tempCount++; \
+                        *--temp = PhpFormatThousandSeparator; \
                         needsSep = 0; \
                     } \
                 } while (Input != 0); \
             } \
+            else if (radix == 16) \
+            { \
+                do \
+                { \
+                    *--temp = integerToChar[Input & 0xf]; \
+                    Input >>= 4; \
+                } while (Input != 0); \
+            } \
             else \
             { \
                 do \
@@ -184,10 +210,10 @@
         } \
         else \
         { \
-            *temp-- = '0'; \
-            tempCount++; \
+            *--temp = '0'; \
         } \
         \
+        tempCount = (ULONG)(tempBuffer + BUFFER_SIZE - temp); \
         preCount = 0; \
         \
         if (flags & PHP_FORMAT_NEGATIVE) \
@@ -205,7 +231,6 @@
             } \
         } \
         \
-        temp++; \
         ENSURE_BUFFER((preCount + tempCount) * sizeof(WCHAR)); \
         if (OK_BUFFER) \
         { \
@@ -228,11 +253,11 @@
 
 #ifndef _WIN64
         case IntPtrFormatType:
-            int32 = format->u.IntPtr;
+            int32 = formatValue->IntPtr;
             goto CommonMaybeNegativeInt32Format;
 #endif
         case Int32FormatType:
-            int32 = format->u.Int32;
+            int32 = formatValue->Int32;
 
 #ifndef _WIN64
 CommonMaybeNegativeInt32Format:
@@ -246,21 +271,21 @@ CommonMaybeNegativeInt32Format:
             goto CommonInt32Format;
 #ifndef _WIN64
         case UIntPtrFormatType:
-            int32 = format->u.UIntPtr;
+            int32 = formatValue->UIntPtr;
             goto CommonInt32Format;
 #endif
         case UInt32FormatType:
-            int32 = format->u.UInt32;
+            int32 = formatValue->UInt32;
 CommonInt32Format:
             COMMON_INTEGER_FORMAT(int32, format);
             break;
 #ifdef _WIN64
         case IntPtrFormatType:
-            int64 = format->u.IntPtr;
+            int64 = formatValue->IntPtr;
             goto CommonMaybeNegativeInt64Format;
 #endif
         case Int64FormatType:
-            int64 = format->u.Int64;
+            int64 = formatValue->Int64;
 
 #ifdef _WIN64
 CommonMaybeNegativeInt64Format:
@@ -274,18 +299,18 @@ CommonMaybeNegativeInt64Format:
             goto CommonInt64Format;
 #ifdef _WIN64
         case UIntPtrFormatType:
-            int64 = format->u.UIntPtr;
+            int64 = formatValue->UIntPtr;
             goto CommonInt64Format;
 #endif
         case UInt64FormatType:
-            int64 = format->u.UInt64;
+            int64 = formatValue->UInt64;
 CommonInt64Format:
             COMMON_INTEGER_FORMAT(int64, format);
             break;
 
         // Floating point numbers
 
-#define COMMON_DOUBLE_FORMAT(Format) \
+#define COMMON_DOUBLE_FORMAT(Format, Value) \
     do { \
         ULONG precision; \
         DOUBLE value; \
@@ -312,19 +337,23 @@ CommonInt64Format:
         else if ((Format)->Type & FormatHexadecimalForm) \
             c = 'a'; \
         \
-        /* Use MS CRT routines to do the work. */ \
-        \
-        value = (Format)->u.Double; \
+        value = (Value); \
         temp = (PSTR)tempBuffer + 1; /* leave one character so we can insert a prefix if needed */ \
-        _cfltcvt_l( \
-            &value, \
-            temp, \
-            sizeof(tempBuffer) - 1, \
-            c, \
-            precision, \
-            !!((Format)->Type & FormatUpperCase), \
-            PhpFormatUserLocale \
-            ); \
+        \
+        /* Use MS CRT routines for anything the fast paths don't handle. */ \
+        \
+        if (!PhpFormatDoubleFast(value, temp, c, precision, (Format)->Type)) \
+        { \
+            _cfltcvt_l( \
+                &value, \
+                temp, \
+                sizeof(tempBuffer) - 1, \
+                c, \
+                precision, \
+                !!((Format)->Type & FormatUpperCase), \
+                PhpFormatUserLocale \
+                ); \
+        } \
         \
         /* if (((Format)->Type & FormatForceDecimalPoint) && precision == 0) */ \
              /* _forcdecpt_l(tempBufferAnsi, PhpFormatUserLocale); */ \
@@ -465,7 +494,7 @@ CommonInt64Format:
 
         case DoubleFormatType:
             flags = 0;
-            COMMON_DOUBLE_FORMAT(format);
+            COMMON_DOUBLE_FORMAT(format, formatValue->Double);
             break;
 
         // Additional types
@@ -477,9 +506,9 @@ CommonInt64Format:
                 DOUBLE s;
                 PH_FORMAT doubleFormat;
 
-                s = (DOUBLE)format->u.Size;
+                s = (DOUBLE)formatValue->Size;
 
-                if (format->u.Size == 0)
+                if (formatValue->Size == 0)
                 {
                     ENSURE_BUFFER(sizeof(WCHAR));
                     if (OK_BUFFER)
@@ -508,9 +537,8 @@ CommonInt64Format:
                 doubleFormat.Type = DoubleFormatType | FormatUsePrecision | FormatCropZeros | FormatGroupDigits;
                 doubleFormat.Precision = (format->Type & FormatUsePrecision) ? format->Precision : 2;
                 doubleFormat.Width = 0; // stupid compiler
-                doubleFormat.u.Double = s;
                 flags = 0;
-                COMMON_DOUBLE_FORMAT(&doubleFormat);
+                COMMON_DOUBLE_FORMAT(&doubleFormat, s);
 
                 ENSURE_BUFFER(sizeof(WCHAR) + PhpSizeUnitNamesCounted[i].Length);
                 if (OK_BUFFER)
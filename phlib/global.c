@@ -110,6 +110,8 @@ NTSTATUS PhInitializePhLibEx(
     if (!PhInitializeSystem(Flags))
         return STATUS_UNSUCCESSFUL;
 
+    PhInitializeTrace();
+
     return STATUS_SUCCESS;
 }
 
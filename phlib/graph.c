@@ -23,6 +23,8 @@
 #define _PH_GRAPH_PRIVATE
 #include <phgui.h>
 #include <graph.h>
+#include <circbuf.h>
+#include <d2d1.h>
 
 #define COLORREF_TO_BITS(Color) (_byteswap_ulong(Color) >> 8)
 
@@ -48,6 +50,10 @@ typedef struct _PHP_GRAPH_CONTEXT
     PVOID FadeOutBits;
     RECT FadeOutContextRect;
 
+    ID2D1DCRenderTarget *D2DRenderTarget;
+    ID2D1SolidColorBrush *D2DBrush;
+    ID2D1LinearGradientBrush *D2DFadeOutBrush;
+
     HWND TooltipHandle;
     WNDPROC TooltipOldWndProc;
     POINT LastCursorLocation;
@@ -87,6 +93,24 @@ BOOLEAN PhGraphControlInitialization(
     return TRUE;
 }
 
+static VOID PhpDrawGraphText(
+    _In_ HDC hdc,
+    _In_ PPH_GRAPH_DRAW_INFO DrawInfo
+    )
+{
+    if (DrawInfo->Text.Buffer)
+    {
+        // Fill in the text box.
+        SetDCBrushColor(hdc, DrawInfo->TextBoxColor);
+        FillRect(hdc, &DrawInfo->TextBoxRect, GetStockObject(DC_BRUSH));
+
+        // Draw the text.
+        SetTextColor(hdc, DrawInfo->TextColor);
+        SetBkMode(hdc, TRANSPARENT);
+        DrawText(hdc, DrawInfo->Text.Buffer, (ULONG)DrawInfo->Text.Length / 2, &DrawInfo->TextRect, DT_NOCLIP);
+    }
+}
+
 /**
  * Draws a graph.
  *
@@ -342,18 +366,7 @@ VOID PhDrawGraph(
         if (lineList2) PhDereferenceObject(lineList2);
     }
 
-    // Draw the text.
-    if (DrawInfo->Text.Buffer)
-    {
-        // Fill in the text box.
-        SetDCBrushColor(hdc, DrawInfo->TextBoxColor);
-        FillRect(hdc, &DrawInfo->TextBoxRect, GetStockObject(DC_BRUSH));
-
-        // Draw the text.
-        SetTextColor(hdc, DrawInfo->TextColor);
-        SetBkMode(hdc, TRANSPARENT);
-        DrawText(hdc, DrawInfo->Text.Buffer, (ULONG)DrawInfo->Text.Length / 2, &DrawInfo->TextRect, DT_NOCLIP);
-    }
+    PhpDrawGraphText(hdc, DrawInfo);
 }
 
 FORCEINLINE VOID PhpGetGraphPoint(
@@ -396,6 +409,43 @@ FORCEINLINE VOID PhpGetGraphPoint(
     }
 }
 
+FORCEINLINE VOID PhpGetGraphEnvelopePoint(
+    _In_ PPH_GRAPH_DRAW_INFO DrawInfo,
+    _In_ ULONG Index,
+    _Out_ PULONG M1,
+    _Out_ PULONG M2
+    )
+{
+    FLOAT f;
+
+    *M1 = 0;
+    *M2 = 0;
+
+    if (Index < DrawInfo->LineDataCount)
+    {
+        f = DrawInfo->LineDataMinimum1[Index];
+
+        if (f < 0)
+            f = 0;
+        if (f > 1)
+            f = 1;
+
+        *M1 = (ULONG)(f * (DrawInfo->Height - 1));
+
+        if (DrawInfo->Flags & PH_GRAPH_USE_LINE_2)
+        {
+            f = DrawInfo->LineDataMinimum2[Index];
+
+            if (f < 0)
+                f = 0;
+            if (f > 1)
+                f = 1;
+
+            *M2 = (ULONG)(f * (DrawInfo->Height - 1));
+        }
+    }
+}
+
 /**
  * Draws a graph directly to memory.
  *
@@ -409,6 +459,9 @@ FORCEINLINE VOID PhpGetGraphPoint(
  * \li \a Step is fixed at 2.
  * \li If \ref PH_GRAPH_USE_LINE_2 is specified in \a Flags, \ref PH_GRAPH_OVERLAY_LINE_2
  * is never used.
+ *
+ * If \ref PH_GRAPH_USE_ENVELOPE is specified in \a Flags, the line data contains the maximum
+ * of each data point and the outline at each data point is extended down to its minimum.
  */
 VOID PhDrawGraphDirect(
     _In_ HDC hdc,
@@ -434,6 +487,8 @@ VOID PhDrawGraphDirect(
     ULONG h1_left; // current pixel
     ULONG h2; // current pixel
     ULONG h2_left; // current pixel
+    ULONG m1; // line 1 minimum at the current data point
+    ULONG m2; // line 1 + line 2 minimum at the current data point
 
     LONG mid;
     LONG h1_low1;
@@ -481,6 +536,8 @@ VOID PhDrawGraphDirect(
     h1_high2 = 0;
     h2_low2 = MAXLONG;
     h2_high2 = 0;
+    m1 = 0;
+    m2 = 0;
 
     PhpGetGraphPoint(DrawInfo, 0, &h1_i, &h2_i);
 
@@ -508,6 +565,9 @@ VOID PhDrawGraphDirect(
             h1_left = (h1_i + h1_o) / 2;
             h2 = h2_o;
             h2_left = (h2_i + h2_o) / 2;
+
+            if (flags & PH_GRAPH_USE_ENVELOPE)
+                PhpGetGraphEnvelopePoint(DrawInfo, dataIndex - 1, &m1, &m2);
         }
         else
         {
@@ -580,6 +640,10 @@ VOID PhDrawGraphDirect(
         if (h1_high1 < old_high2)
             h1_high1 = old_high2;
 
+        // Extend the line down to the minimum of the data point.
+        if ((flags & PH_GRAPH_USE_ENVELOPE) && !intermediate && (LONG)(m1 * width) < h1_low1)
+            h1_low1 = m1 * width;
+
         // Fix up values for the current horizontal offset.
         h1_low1 += x;
         h1_high1 += x;
@@ -611,6 +675,10 @@ VOID PhDrawGraphDirect(
             if (h2_high1 < old_high2)
                 h2_high1 = old_high2;
 
+            // Extend the line down to the minimum of the data point.
+            if ((flags & PH_GRAPH_USE_ENVELOPE) && !intermediate && (LONG)(m2 * width) < h2_low1)
+                h2_low1 = m2 * width;
+
             // Fix up values for the current horizontal offset.
             h2_low1 += x;
             h2_high1 += x;
@@ -675,17 +743,7 @@ VOID PhDrawGraphDirect(
         x--;
     }
 
-    if (DrawInfo->Text.Buffer)
-    {
-        // Fill in the text box.
-        SetDCBrushColor(hdc, DrawInfo->TextBoxColor);
-        FillRect(hdc, &DrawInfo->TextBoxRect, GetStockObject(DC_BRUSH));
-
-        // Draw the text.
-        SetTextColor(hdc, DrawInfo->TextColor);
-        SetBkMode(hdc, TRANSPARENT);
-        DrawText(hdc, DrawInfo->Text.Buffer, (ULONG)DrawInfo->Text.Length / 2, &DrawInfo->TextRect, DT_NOCLIP);
-    }
+    PhpDrawGraphText(hdc, DrawInfo);
 }
 
 /**
@@ -854,6 +912,12 @@ static VOID PhpDeleteFadeOutContext(
         Context->FadeOutBitmap = NULL;
         Context->FadeOutBits = NULL;
     }
+
+    if (Context->D2DFadeOutBrush)
+    {
+        ID2D1LinearGradientBrush_Release(Context->D2DFadeOutBrush);
+        Context->D2DFadeOutBrush = NULL;
+    }
 }
 
 static VOID PhpCreateFadeOutContext(
@@ -915,6 +979,412 @@ static VOID PhpCreateFadeOutContext(
     }
 }
 
+static ULONG PhpGraphRenderer = PH_GRAPH_RENDERER_GDI;
+static PH_INITONCE PhpGraphD2DInitOnce = PH_INITONCE_INIT;
+static ID2D1Factory *PhpGraphD2DFactory = NULL;
+
+// 06152247-6f50-465a-9245-118bfd3b6007
+static GUID IID_ID2D1Factory_I = { 0x06152247, 0x6f50, 0x465a, { 0x92, 0x45, 0x11, 0x8b, 0xfd, 0x3b, 0x60, 0x07 } };
+
+typedef HRESULT (WINAPI *_D2D1CreateFactory)(
+    _In_ D2D1_FACTORY_TYPE factoryType,
+    _In_ REFIID riid,
+    _In_opt_ CONST D2D1_FACTORY_OPTIONS *pFactoryOptions,
+    _Out_ PVOID *ppIFactory
+    );
+
+static BOOLEAN PhpInitializeGraphD2D(
+    VOID
+    )
+{
+    if (PhBeginInitOnce(&PhpGraphD2DInitOnce))
+    {
+        HMODULE d2d1;
+        _D2D1CreateFactory d2d1CreateFactory;
+        PVOID factory;
+
+        // Direct2D isn't available on Windows XP and Vista without the platform update.
+        if ((d2d1 = LoadLibrary(L"d2d1.dll")) &&
+            (d2d1CreateFactory = (_D2D1CreateFactory)GetProcAddress(d2d1, "D2D1CreateFactory")))
+        {
+            // Graph controls live on more than one GUI thread (e.g. process properties).
+            if (SUCCEEDED(d2d1CreateFactory(D2D1_FACTORY_TYPE_MULTI_THREADED, &IID_ID2D1Factory_I, NULL, &factory)))
+                PhpGraphD2DFactory = factory;
+        }
+
+        PhEndInitOnce(&PhpGraphD2DInitOnce);
+    }
+
+    return !!PhpGraphD2DFactory;
+}
+
+/**
+ * Selects the renderer used by graph controls.
+ *
+ * \param Renderer The renderer to use:
+ * \li \c PH_GRAPH_RENDERER_GDI Graphs are rasterized in memory by PhDrawGraphDirect().
+ * \li \c PH_GRAPH_RENDERER_DIRECT2D Graphs are drawn using Direct2D. Graph controls fall back
+ * to the GDI renderer if a Direct2D operation fails.
+ *
+ * \return TRUE if the renderer was selected, or FALSE if it is not available on this system,
+ * in which case the GDI renderer is used.
+ *
+ * \remarks Existing graph controls switch renderers the next time they are drawn.
+ */
+BOOLEAN PhSetGraphRenderer(
+    _In_ ULONG Renderer
+    )
+{
+    if (Renderer == PH_GRAPH_RENDERER_DIRECT2D && !PhpInitializeGraphD2D())
+    {
+        PhpGraphRenderer = PH_GRAPH_RENDERER_GDI;
+        return FALSE;
+    }
+
+    if (Renderer != PH_GRAPH_RENDERER_DIRECT2D)
+        Renderer = PH_GRAPH_RENDERER_GDI;
+
+    PhpGraphRenderer = Renderer;
+
+    return TRUE;
+}
+
+static VOID PhpDeleteD2DResources(
+    _In_ PPHP_GRAPH_CONTEXT Context
+    )
+{
+    if (Context->D2DFadeOutBrush)
+    {
+        ID2D1LinearGradientBrush_Release(Context->D2DFadeOutBrush);
+        Context->D2DFadeOutBrush = NULL;
+    }
+
+    if (Context->D2DBrush)
+    {
+        ID2D1SolidColorBrush_Release(Context->D2DBrush);
+        Context->D2DBrush = NULL;
+    }
+
+    if (Context->D2DRenderTarget)
+    {
+        ID2D1DCRenderTarget_Release(Context->D2DRenderTarget);
+        Context->D2DRenderTarget = NULL;
+    }
+}
+
+FORCEINLINE D2D1_COLOR_F PhpColorToD2D(
+    _In_ COLORREF Color,
+    _In_ FLOAT Alpha
+    )
+{
+    D2D1_COLOR_F color;
+
+    color.r = (FLOAT)GetRValue(Color) / 255;
+    color.g = (FLOAT)GetGValue(Color) / 255;
+    color.b = (FLOAT)GetBValue(Color) / 255;
+    color.a = Alpha;
+
+    return color;
+}
+
+static ID2D1PathGeometry *PhpCreateGraphGeometryD2D(
+    _In_ PPH_GRAPH_DRAW_INFO DrawInfo,
+    _In_ BOOLEAN Line2,
+    _In_ BOOLEAN Fill
+    )
+{
+    ID2D1PathGeometry *geometry;
+    ID2D1GeometrySink *sink;
+    D2D1_POINT_2F *points;
+    D2D1_POINT_2F point;
+    ULONG numberOfPoints;
+    ULONG i;
+    LONG x;
+    ULONG h1;
+    ULONG h2;
+    ULONG m1;
+    ULONG m2;
+    FLOAT height;
+
+    if (FAILED(ID2D1Factory_CreatePathGeometry(PhpGraphD2DFactory, &geometry)))
+        return NULL;
+
+    if (FAILED(ID2D1PathGeometry_Open(geometry, &sink)))
+    {
+        ID2D1PathGeometry_Release(geometry);
+        return NULL;
+    }
+
+    // Coordinates are in pixels; the line passes through the centers of the pixels that
+    // PhDrawGraphDirect would paint. The last point is at or beyond the left edge.
+    numberOfPoints = PH_GRAPH_DATA_COUNT(DrawInfo->Width, DrawInfo->Step);
+    points = PhAllocate(numberOfPoints * sizeof(D2D1_POINT_2F));
+    height = (FLOAT)DrawInfo->Height;
+    x = DrawInfo->Width - 1;
+    h2 = 0;
+
+    for (i = 0; i < numberOfPoints; i++)
+    {
+        PhpGetGraphPoint(DrawInfo, i, &h1, &h2);
+        points[i].x = x + 0.5f;
+        points[i].y = height - (Line2 ? h2 : h1) - 0.5f;
+        x -= DrawInfo->Step;
+    }
+
+    if (Fill)
+    {
+        point.x = (FLOAT)DrawInfo->Width;
+        point.y = height;
+        ID2D1GeometrySink_BeginFigure(sink, point, D2D1_FIGURE_BEGIN_FILLED);
+        point.y = points[0].y;
+        ID2D1GeometrySink_AddLine(sink, point);
+        ID2D1GeometrySink_AddLines(sink, points, numberOfPoints);
+        point.x = points[numberOfPoints - 1].x;
+        point.y = height;
+        ID2D1GeometrySink_AddLine(sink, point);
+        ID2D1GeometrySink_EndFigure(sink, D2D1_FIGURE_END_CLOSED);
+    }
+    else
+    {
+        ID2D1GeometrySink_BeginFigure(sink, points[0], D2D1_FIGURE_BEGIN_HOLLOW);
+        ID2D1GeometrySink_AddLines(sink, points + 1, numberOfPoints - 1);
+        ID2D1GeometrySink_EndFigure(sink, D2D1_FIGURE_END_OPEN);
+
+        if (DrawInfo->Flags & PH_GRAPH_USE_ENVELOPE)
+        {
+            // Extend the outline down to the minimum of each data point.
+            for (i = 0; i < numberOfPoints && i < DrawInfo->LineDataCount; i++)
+            {
+                PhpGetGraphEnvelopePoint(DrawInfo, i, &m1, &m2);
+                point.x = points[i].x;
+                point.y = height - (Line2 ? m2 : m1) - 0.5f;
+
+                if (point.y > points[i].y)
+                {
+                    ID2D1GeometrySink_BeginFigure(sink, points[i], D2D1_FIGURE_BEGIN_HOLLOW);
+                    ID2D1GeometrySink_AddLine(sink, point);
+                    ID2D1GeometrySink_EndFigure(sink, D2D1_FIGURE_END_OPEN);
+                }
+            }
+        }
+    }
+
+    PhFree(points);
+    ID2D1GeometrySink_Close(sink);
+    ID2D1GeometrySink_Release(sink);
+
+    return geometry;
+}
+
+static VOID PhpDrawGraphLineD2D(
+    _In_ PPHP_GRAPH_CONTEXT Context,
+    _In_ BOOLEAN Line2,
+    _In_ BOOLEAN Fill,
+    _In_ COLORREF Color
+    )
+{
+    ID2D1RenderTarget *renderTarget = (ID2D1RenderTarget *)Context->D2DRenderTarget;
+    ID2D1PathGeometry *geometry;
+    D2D1_COLOR_F color;
+
+    if (!(geometry = PhpCreateGraphGeometryD2D(&Context->DrawInfo, Line2, Fill)))
+        return;
+
+    color = PhpColorToD2D(Color, 1);
+    ID2D1SolidColorBrush_SetColor(Context->D2DBrush, &color);
+
+    if (Fill)
+        ID2D1RenderTarget_FillGeometry(renderTarget, (ID2D1Geometry *)geometry, (ID2D1Brush *)Context->D2DBrush, NULL);
+    else
+        ID2D1RenderTarget_DrawGeometry(renderTarget, (ID2D1Geometry *)geometry, (ID2D1Brush *)Context->D2DBrush, 1, NULL);
+
+    ID2D1PathGeometry_Release(geometry);
+}
+
+static VOID PhpDrawGraphGridD2D(
+    _In_ PPHP_GRAPH_CONTEXT Context
+    )
+{
+    ID2D1RenderTarget *renderTarget = (ID2D1RenderTarget *)Context->D2DRenderTarget;
+    PPH_GRAPH_DRAW_INFO drawInfo = &Context->DrawInfo;
+    D2D1_COLOR_F color;
+    D2D1_POINT_2F point0;
+    D2D1_POINT_2F point1;
+    LONG x;
+    ULONG y;
+
+    if (drawInfo->GridWidth == 0 || drawInfo->GridHeight == 0)
+        return;
+
+    color = PhpColorToD2D(drawInfo->GridColor, 1);
+    ID2D1SolidColorBrush_SetColor(Context->D2DBrush, &color);
+
+    // The lines are at the same positions as the ones drawn by PhDrawGraphDirect.
+
+    x = drawInfo->Width - 1 - ((drawInfo->GridStart * drawInfo->Step) % drawInfo->GridWidth + 1) % drawInfo->GridWidth;
+    point0.y = 0;
+    point1.y = (FLOAT)drawInfo->Height;
+
+    for (; x >= 0; x -= drawInfo->GridWidth)
+    {
+        point0.x = point1.x = x + 0.5f;
+        ID2D1RenderTarget_DrawLine(renderTarget, point0, point1, (ID2D1Brush *)Context->D2DBrush, 1, NULL);
+    }
+
+    point0.x = 0;
+    point1.x = (FLOAT)drawInfo->Width;
+
+    for (y = drawInfo->GridHeight; y < drawInfo->Height; y += drawInfo->GridHeight)
+    {
+        point0.y = point1.y = drawInfo->Height - y - 0.5f;
+        ID2D1RenderTarget_DrawLine(renderTarget, point0, point1, (ID2D1Brush *)Context->D2DBrush, 1, NULL);
+    }
+}
+
+static BOOLEAN PhpCreateFadeOutBrushD2D(
+    _In_ PPHP_GRAPH_CONTEXT Context
+    )
+{
+    ID2D1RenderTarget *renderTarget = (ID2D1RenderTarget *)Context->D2DRenderTarget;
+    D2D1_GRADIENT_STOP stops[5];
+    ID2D1GradientStopCollection *stopCollection;
+    D2D1_LINEAR_GRADIENT_BRUSH_PROPERTIES properties;
+    ULONG i;
+    HRESULT result;
+
+    // Approximate the quadratic falloff used by PhpCreateFadeOutContext.
+    for (i = 0; i < RTL_NUMBER_OF(stops); i++)
+    {
+        stops[i].position = (FLOAT)i / (RTL_NUMBER_OF(stops) - 1);
+        stops[i].color = PhpColorToD2D(Context->Options.FadeOutBackColor, 1 - stops[i].position * stops[i].position);
+    }
+
+    if (FAILED(ID2D1RenderTarget_CreateGradientStopCollection(
+        renderTarget,
+        stops,
+        RTL_NUMBER_OF(stops),
+        D2D1_GAMMA_2_2,
+        D2D1_EXTEND_MODE_CLAMP,
+        &stopCollection
+        )))
+        return FALSE;
+
+    properties.startPoint.x = 0;
+    properties.startPoint.y = 0;
+    properties.endPoint.x = (FLOAT)Context->Options.FadeOutWidth;
+    properties.endPoint.y = 0;
+
+    result = ID2D1RenderTarget_CreateLinearGradientBrush(
+        renderTarget,
+        &properties,
+        NULL,
+        stopCollection,
+        &Context->D2DFadeOutBrush
+        );
+    ID2D1GradientStopCollection_Release(stopCollection);
+
+    return SUCCEEDED(result);
+}
+
+static BOOLEAN PhpDrawGraphControlD2D(
+    _In_ PPHP_GRAPH_CONTEXT Context
+    )
+{
+    PPH_GRAPH_DRAW_INFO drawInfo = &Context->DrawInfo;
+    ID2D1RenderTarget *renderTarget;
+    D2D1_COLOR_F color;
+    HRESULT result;
+
+    if (!Context->D2DRenderTarget)
+    {
+        D2D1_RENDER_TARGET_PROPERTIES properties;
+
+        memset(&properties, 0, sizeof(D2D1_RENDER_TARGET_PROPERTIES));
+        properties.type = D2D1_RENDER_TARGET_TYPE_DEFAULT;
+        properties.pixelFormat.format = DXGI_FORMAT_B8G8R8A8_UNORM;
+        properties.pixelFormat.alphaMode = D2D1_ALPHA_MODE_IGNORE;
+        // Use 96 DPI so that one unit is one pixel, as in the GDI renderer.
+        properties.dpiX = 96;
+        properties.dpiY = 96;
+        properties.usage = D2D1_RENDER_TARGET_USAGE_NONE;
+        properties.minLevel = D2D1_FEATURE_LEVEL_DEFAULT;
+
+        if (FAILED(ID2D1Factory_CreateDCRenderTarget(PhpGraphD2DFactory, &properties, &Context->D2DRenderTarget)))
+            return FALSE;
+    }
+
+    renderTarget = (ID2D1RenderTarget *)Context->D2DRenderTarget;
+
+    if (!Context->D2DBrush)
+    {
+        color = PhpColorToD2D(0, 1);
+
+        if (FAILED(ID2D1RenderTarget_CreateSolidColorBrush(renderTarget, &color, NULL, &Context->D2DBrush)))
+            goto ErrorExit;
+    }
+
+    if ((Context->Style & GC_STYLE_FADEOUT) && !Context->D2DFadeOutBrush)
+    {
+        if (!PhpCreateFadeOutBrushD2D(Context))
+            goto ErrorExit;
+    }
+
+    // The render target draws directly into the buffered context, so text, panels and
+    // GCM_GETBUFFEREDCONTEXT work the same way as with the GDI renderer.
+    if (FAILED(ID2D1DCRenderTarget_BindDC(Context->D2DRenderTarget, Context->BufferedContext, &Context->BufferedContextRect)))
+        goto ErrorExit;
+
+    ID2D1RenderTarget_BeginDraw(renderTarget);
+    ID2D1RenderTarget_SetAntialiasMode(renderTarget, D2D1_ANTIALIAS_MODE_ALIASED);
+
+    color = PhpColorToD2D(drawInfo->BackColor, 1);
+    ID2D1RenderTarget_Clear(renderTarget, &color);
+
+    // Fill in the background.
+
+    if (drawInfo->Flags & PH_GRAPH_USE_LINE_2)
+        PhpDrawGraphLineD2D(Context, TRUE, TRUE, drawInfo->LineBackColor2);
+
+    PhpDrawGraphLineD2D(Context, FALSE, TRUE, drawInfo->LineBackColor1);
+
+    // Draw the grid.
+
+    if (drawInfo->Flags & PH_GRAPH_USE_GRID)
+        PhpDrawGraphGridD2D(Context);
+
+    // Draw the outline (line 1 is allowed to paint over line 2).
+
+    if (drawInfo->Flags & PH_GRAPH_USE_LINE_2)
+        PhpDrawGraphLineD2D(Context, TRUE, FALSE, drawInfo->LineColor2);
+
+    PhpDrawGraphLineD2D(Context, FALSE, FALSE, drawInfo->LineColor1);
+
+    if (Context->Style & GC_STYLE_FADEOUT)
+    {
+        D2D1_RECT_F rect;
+
+        rect.left = 0;
+        rect.top = 0;
+        rect.right = (FLOAT)Context->Options.FadeOutWidth;
+        rect.bottom = (FLOAT)drawInfo->Height;
+        ID2D1RenderTarget_FillRectangle(renderTarget, &rect, (ID2D1Brush *)Context->D2DFadeOutBrush);
+    }
+
+    result = ID2D1RenderTarget_EndDraw(renderTarget, NULL, NULL);
+
+    if (FAILED(result))
+        goto ErrorExit;
+
+    PhpDrawGraphText(Context->BufferedContext, drawInfo);
+
+    return TRUE;
+
+ErrorExit:
+    // Recreate everything next time (this also handles D2DERR_RECREATE_TARGET).
+    PhpDeleteD2DResources(Context);
+    return FALSE;
+}
+
 VOID PhpUpdateDrawInfo(
     _In_ HWND hwnd,
     _In_ PPHP_GRAPH_CONTEXT Context
@@ -938,10 +1408,18 @@ VOID PhpDrawGraphControl(
     _In_ PPHP_GRAPH_CONTEXT Context
     )
 {
-    if (Context->BufferedBits)
-        PhDrawGraphDirect(Context->BufferedContext, Context->BufferedBits, &Context->DrawInfo);
+    if (!(PhpGraphRenderer == PH_GRAPH_RENDERER_DIRECT2D && Context->BufferedBits && PhpDrawGraphControlD2D(Context)))
+    {
+        // Use the GDI renderer. The Direct2D renderer draws the fade-out itself, so we only
+        // keep its resources while it is in use.
+        if (Context->D2DRenderTarget)
+            PhpDeleteD2DResources(Context);
 
-    if (Context->Style & GC_STYLE_FADEOUT)
+        if (Context->BufferedBits)
+            PhDrawGraphDirect(Context->BufferedContext, Context->BufferedBits, &Context->DrawInfo);
+    }
+
+    if ((Context->Style & GC_STYLE_FADEOUT) && !Context->D2DRenderTarget)
     {
         BLENDFUNCTION blendFunction;
 
@@ -1042,6 +1520,7 @@ LRESULT CALLBACK PhpGraphWndProc(
                 DestroyWindow(context->TooltipHandle);
 
             PhpDeleteFadeOutContext(context);
+            PhpDeleteD2DResources(context);
             PhpDeleteBufferedContext(context);
             PhpFreeGraphContext(context);
             SetWindowLongPtr(hwnd, 0, (LONG_PTR)NULL);
@@ -1418,6 +1897,191 @@ VOID PhGetDrawInfoGraphBuffers(
     DrawInfo->LineData2 = Buffers->Data2;
 }
 
+/**
+ * Initializes a graph envelope.
+ *
+ * \param Envelope The graph envelope.
+ */
+VOID PhInitializeGraphEnvelope(
+    _Out_ PPH_GRAPH_ENVELOPE Envelope
+    )
+{
+    memset(Envelope, 0, sizeof(PH_GRAPH_ENVELOPE));
+}
+
+/**
+ * Frees resources used by a graph envelope.
+ *
+ * \param Envelope The graph envelope.
+ */
+VOID PhDeleteGraphEnvelope(
+    _Inout_ PPH_GRAPH_ENVELOPE Envelope
+    )
+{
+    if (Envelope->Data1) PhFree(Envelope->Data1);
+    if (Envelope->Data2) PhFree(Envelope->Data2);
+    if (Envelope->Minimum1) PhFree(Envelope->Minimum1);
+    if (Envelope->Minimum2) PhFree(Envelope->Minimum2);
+}
+
+static VOID PhpAddSampleGraphEnvelope(
+    _Inout_ PPH_GRAPH_ENVELOPE Envelope,
+    _In_ FLOAT Value1,
+    _In_ FLOAT Value2
+    )
+{
+    FLOAT total;
+
+    total = Value1 + Value2;
+
+    if (Envelope->Count == 0 || Envelope->NewestCount == Envelope->SamplesPerPoint)
+    {
+        ULONG count;
+
+        // Start a new point.
+
+        count = Envelope->Count;
+
+        if (count == Envelope->NumberOfPoints)
+            count--;
+
+        memmove(&Envelope->Data1[1], &Envelope->Data1[0], count * sizeof(FLOAT));
+        memmove(&Envelope->Data2[1], &Envelope->Data2[0], count * sizeof(FLOAT));
+        memmove(&Envelope->Minimum1[1], &Envelope->Minimum1[0], count * sizeof(FLOAT));
+        memmove(&Envelope->Minimum2[1], &Envelope->Minimum2[0], count * sizeof(FLOAT));
+
+        Envelope->Data1[0] = Value1;
+        Envelope->Data2[0] = Value2;
+        Envelope->Minimum1[0] = Value1;
+        Envelope->Minimum2[0] = total;
+        Envelope->NewestTotal = total;
+        Envelope->Count = count + 1;
+        Envelope->NewestCount = 1;
+    }
+    else
+    {
+        if (Envelope->Data1[0] < Value1)
+            Envelope->Data1[0] = Value1;
+        if (Envelope->Minimum1[0] > Value1)
+            Envelope->Minimum1[0] = Value1;
+        if (Envelope->NewestTotal < total)
+            Envelope->NewestTotal = total;
+        if (Envelope->Minimum2[0] > total)
+            Envelope->Minimum2[0] = total;
+
+        Envelope->Data2[0] = Envelope->NewestTotal - Envelope->Data1[0];
+        Envelope->NewestCount++;
+    }
+}
+
+/**
+ * Updates a graph envelope with the samples added to a history since the last update.
+ *
+ * \param Envelope The graph envelope.
+ * \param History1 The history for line 1.
+ * \param History2 The history for line 2, or NULL if there is no line 2.
+ * \param NumberOfPoints The number of data points that the graph can display. See
+ * PH_GRAPH_DATA_COUNT().
+ *
+ * \remarks The envelope is rebuilt from the whole history when the graph has been resized or
+ * the history has grown enough to change the number of samples per point. Otherwise only the
+ * new samples are processed, so this function must be called at least once every time the
+ * history wraps around.
+ */
+VOID PhUpdateGraphEnvelope(
+    _Inout_ PPH_GRAPH_ENVELOPE Envelope,
+    _In_ PPH_CIRCULAR_BUFFER_FLOAT History1,
+    _In_opt_ PPH_CIRCULAR_BUFFER_FLOAT History2,
+    _In_ ULONG NumberOfPoints
+    )
+{
+    ULONG samplesPerPoint;
+    ULONG newSamples;
+    LONG i;
+
+    if (NumberOfPoints == 0)
+        NumberOfPoints = 1;
+
+    samplesPerPoint = (History1->Count + NumberOfPoints - 1) / NumberOfPoints;
+
+    if (samplesPerPoint == 0)
+        samplesPerPoint = 1;
+
+    if (Envelope->SamplesPerPoint != samplesPerPoint || Envelope->NumberOfPoints != NumberOfPoints)
+    {
+        if (Envelope->AllocatedCount < NumberOfPoints)
+        {
+            PhDeleteGraphEnvelope(Envelope);
+
+            Envelope->AllocatedCount = NumberOfPoints;
+            Envelope->Data1 = PhAllocate(NumberOfPoints * sizeof(FLOAT));
+            Envelope->Data2 = PhAllocate(NumberOfPoints * sizeof(FLOAT));
+            Envelope->Minimum1 = PhAllocate(NumberOfPoints * sizeof(FLOAT));
+            Envelope->Minimum2 = PhAllocate(NumberOfPoints * sizeof(FLOAT));
+        }
+
+        Envelope->SamplesPerPoint = samplesPerPoint;
+        Envelope->NumberOfPoints = NumberOfPoints;
+        Envelope->Count = 0;
+        newSamples = History1->Count;
+    }
+    else
+    {
+        newSamples = (ULONG)(Envelope->Index - History1->Index) & History1->SizeMinusOne;
+
+        if (newSamples > History1->Count)
+            newSamples = History1->Count;
+    }
+
+    // Add the samples from oldest to newest.
+    for (i = (LONG)newSamples - 1; i >= 0; i--)
+    {
+        PhpAddSampleGraphEnvelope(
+            Envelope,
+            PhGetItemCircularBuffer_FLOAT(History1, i),
+            History2 ? PhGetItemCircularBuffer_FLOAT(History2, i) : 0
+            );
+    }
+
+    Envelope->Index = History1->Index;
+}
+
+/**
+ * Sets up a graphing information structure with the data points of a graph envelope.
+ *
+ * \param Envelope The graph envelope.
+ * \param DrawInfo The graphing information structure.
+ */
+VOID PhGetDrawInfoGraphEnvelope(
+    _In_ PPH_GRAPH_ENVELOPE Envelope,
+    _Inout_ PPH_GRAPH_DRAW_INFO DrawInfo
+    )
+{
+    DrawInfo->Flags |= PH_GRAPH_USE_ENVELOPE;
+    DrawInfo->LineDataCount = Envelope->Count;
+    DrawInfo->LineData1 = Envelope->Data1;
+    DrawInfo->LineData2 = Envelope->Data2;
+    DrawInfo->LineDataMinimum1 = Envelope->Minimum1;
+    DrawInfo->LineDataMinimum2 = Envelope->Minimum2;
+}
+
+/**
+ * Gets the index of the newest history sample in a data point of a graph envelope.
+ *
+ * \param Envelope The graph envelope.
+ * \param Index The index of the data point.
+ */
+ULONG PhGetSampleIndexGraphEnvelope(
+    _In_ PPH_GRAPH_ENVELOPE Envelope,
+    _In_ ULONG Index
+    )
+{
+    if (Index == 0)
+        return 0;
+
+    return Envelope->NewestCount + (Index - 1) * Envelope->SamplesPerPoint;
+}
+
 VOID PhInitializeGraphState(
     _Out_ PPH_GRAPH_STATE State
     )
@@ -895,7 +895,7 @@ BOOLEAN PhModalPropertySheet(
     BOOL result;
     MSG message;
 
-    PhInitializeAutoPool(&autoPool);
+    PhInitializeAutoPoolEx(&autoPool, PH_AUTO_POOL_USE_ARENA);
 
     oldFocus = GetFocus();
     topLevelOwner = Header->hwndParent;
@@ -87,6 +87,11 @@ VOID PhpCreateHexEditContext(
     context->SelStart = -1;
     context->SelEnd = -1;
 
+    InitializeListHead(&context->PageListHead);
+    PhInitializeRundownProtection(&context->PrefetchRundown);
+    PhInitializeQueuedLock(&context->PrefetchLock);
+    InitializeListHead(&context->PrefetchListHead);
+
     *Context = context;
 }
 
@@ -95,6 +100,7 @@ VOID PhpFreeHexEditContext(
     )
 {
     if (!Context->UserBuffer && Context->Data) PhFree(Context->Data);
+    PhpHexEditDeletePages(Context);
     if (Context->CharBuffer) PhFree(Context->CharBuffer);
     if (Context->Font) DeleteObject(Context->Font);
     PhFree(Context);
@@ -114,6 +120,7 @@ LRESULT CALLBACK PhpHexEditWndProc(
     if (uMsg == WM_CREATE)
     {
         PhpCreateHexEditContext(&context);
+        context->WindowHandle = hwnd;
         SetWindowLongPtr(hwnd, 0, (LONG_PTR)context);
     }
 
@@ -146,7 +153,7 @@ LRESULT CALLBACK PhpHexEditWndProc(
         break;
     case WM_SETFOCUS:
         {
-            if (context->Data && !PhpHexEditHasSelected(context))
+            if (PhpHexEditHasData(context) && !PhpHexEditHasSelected(context))
             {
                 if (context->EditPosition.x == 0 && context->ShowAddress)
                     PhpHexEditCreateAddressCaret(hwnd, context);
@@ -176,7 +183,7 @@ LRESULT CALLBACK PhpHexEditWndProc(
             GetScrollInfo(hwnd, SB_VERT, &scrollInfo);
             currentPosition = scrollInfo.nTrackPos;
 
-            if (context->Data)
+            if (PhpHexEditHasData(context))
             {
                 LONG mult;
 
@@ -239,7 +246,7 @@ LRESULT CALLBACK PhpHexEditWndProc(
         {
             SHORT wheelDelta = GET_WHEEL_DELTA_WPARAM(wParam);
 
-            if (context->Data)
+            if (PhpHexEditHasData(context))
             {
                 ULONG wheelScrollLines;
 
@@ -281,7 +288,7 @@ LRESULT CALLBACK PhpHexEditWndProc(
 
             SetFocus(hwnd);
 
-            if (context->Data)
+            if (PhpHexEditHasData(context))
             {
                 POINT point;
 
@@ -359,7 +366,7 @@ LRESULT CALLBACK PhpHexEditWndProc(
             cursorPos.y = (LONG)(SHORT)HIWORD(lParam);
 
             if (
-                context->Data &&
+                PhpHexEditHasData(context) &&
                 context->HasCapture &&
                 context->SelStart != -1
                 )
@@ -409,7 +416,7 @@ LRESULT CALLBACK PhpHexEditWndProc(
         {
             ULONG c = (ULONG)wParam;
 
-            if (!context->Data)
+            if (!PhpHexEditHasData(context))
                 goto DefaultHandler;
             if (c == '\t')
                 goto DefaultHandler;
@@ -469,20 +476,20 @@ LRESULT CALLBACK PhpHexEditWndProc(
 
                     if (context->CurrentMode == EDIT_HIGH)
                     {
-                        context->Data[context->CurrentAddress] =
-                            (UCHAR)((context->Data[context->CurrentAddress] & 0x0f) | (b << 4));
+                        PhpHexEditSetByte(context, context->CurrentAddress,
+                            (UCHAR)((PhpHexEditGetByte(context, context->CurrentAddress) & 0x0f) | (b << 4)));
                     }
                     else
                     {
-                        context->Data[context->CurrentAddress] =
-                            (UCHAR)((context->Data[context->CurrentAddress] & 0xf0) | b);
+                        PhpHexEditSetByte(context, context->CurrentAddress,
+                            (UCHAR)((PhpHexEditGetByte(context, context->CurrentAddress) & 0xf0) | b));
                     }
 
                     PhpHexEditMove(hwnd, context, 1, 0);
                 }
                 break;
             case EDIT_ASCII:
-                context->Data[context->CurrentAddress] = (UCHAR)c;
+                PhpHexEditSetByte(context, context->CurrentAddress, (UCHAR)c);
                 PhpHexEditMove(hwnd, context, 1, 0);
                 break;
             }
@@ -826,6 +833,37 @@ LRESULT CALLBACK PhpHexEditWndProc(
 
             return (LPARAM)context->Data;
         }
+    case HEM_SETDATASOURCE:
+        {
+            PhpHexEditSetDataSource(hwnd, context, (PPH_HEXEDIT_DATA_SOURCE)lParam);
+        }
+        return TRUE;
+    case HEM_FLUSH:
+        return PhpHexEditFlush(context);
+    case HEM_REFRESH:
+        {
+            // Changes which have not been written are discarded.
+            PhpHexEditDeletePages(context);
+            REDRAW_WINDOW(hwnd);
+        }
+        return TRUE;
+    case HEM_READDATA:
+        {
+            PPH_HEXEDIT_READ_DATA readData = (PPH_HEXEDIT_READ_DATA)lParam;
+
+            if (!PhpHexEditHasData(context))
+                return FALSE;
+            if (readData->Offset > (ULONG)context->Length || readData->Length > (ULONG)context->Length - readData->Offset)
+                return FALSE;
+
+            PhpHexEditReadRange(context, readData->Offset, readData->Buffer, readData->Length);
+        }
+        return TRUE;
+    case HEM_PREFETCHCOMPLETE:
+        {
+            PhpHexEditCompletePrefetch(context);
+        }
+        return TRUE;
     case HEM_SETSEL:
         {
             LONG selStart = (LONG)wParam;
@@ -1037,7 +1075,7 @@ VOID PhpHexEditOnPaint(
 
     buffer = Context->CharBuffer;
 
-    if (Context->Data)
+    if (PhpHexEditHasData(Context))
     {
         // Get character dimensions.
         if (Context->Update)
@@ -1117,7 +1155,7 @@ VOID PhpHexEditOnPaint(
 
                 for (i = Context->TopIndex; i < selStart && y < height; i++)
                 {
-                    PhpPrintHex(bufferDc, Context, buffer, Context->Data[i], &x, &y, &n);
+                    PhpPrintHex(bufferDc, Context, buffer, PhpHexEditGetByte(Context, i), &x, &y, &n);
                 }
 
                 // Bytes in the selection
@@ -1127,7 +1165,7 @@ VOID PhpHexEditOnPaint(
 
                 for (; i < selEnd && i < Context->Length && y < height; i++)
                 {
-                    PhpPrintHex(bufferDc, Context, buffer, Context->Data[i], &x, &y, &n);
+                    PhpPrintHex(bufferDc, Context, buffer, PhpHexEditGetByte(Context, i), &x, &y, &n);
                 }
 
                 // Bytes after the selection
@@ -1137,7 +1175,7 @@ VOID PhpHexEditOnPaint(
 
                 for (; i < Context->Length && y < height; i++)
                 {
-                    PhpPrintHex(bufferDc, Context, buffer, Context->Data[i], &x, &y, &n);
+                    PhpPrintHex(bufferDc, Context, buffer, PhpHexEditGetByte(Context, i), &x, &y, &n);
                 }
             }
             else
@@ -1150,7 +1188,7 @@ VOID PhpHexEditOnPaint(
 
                     for (n = 0; n < Context->BytesPerRow && i < Context->Length; n++)
                     {
-                        TO_HEX(p, Context->Data[i]);
+                        TO_HEX(p, PhpHexEditGetByte(Context, i));
                         *p++ = ' ';
                         i++;
                     }
@@ -1213,7 +1251,7 @@ VOID PhpHexEditOnPaint(
 
                 for (i = Context->TopIndex; i < selStart && y < height; i++)
                 {
-                    PhpPrintAscii(bufferDc, Context, Context->Data[i], &x, &y, &n);
+                    PhpPrintAscii(bufferDc, Context, PhpHexEditGetByte(Context, i), &x, &y, &n);
                 }
 
                 // Bytes in the selection
@@ -1223,7 +1261,7 @@ VOID PhpHexEditOnPaint(
 
                 for (; i < selEnd && i < Context->Length && y < height; i++)
                 {
-                    PhpPrintAscii(bufferDc, Context, Context->Data[i], &x, &y, &n);
+                    PhpPrintAscii(bufferDc, Context, PhpHexEditGetByte(Context, i), &x, &y, &n);
                 }
 
                 // Bytes after the selection
@@ -1233,7 +1271,7 @@ VOID PhpHexEditOnPaint(
 
                 for (; i < Context->Length && y < height; i++)
                 {
-                    PhpPrintAscii(bufferDc, Context, Context->Data[i], &x, &y, &n);
+                    PhpPrintAscii(bufferDc, Context, PhpHexEditGetByte(Context, i), &x, &y, &n);
                 }
             }
             else
@@ -1246,7 +1284,9 @@ VOID PhpHexEditOnPaint(
 
                     for (n = 0; n < Context->BytesPerRow && i < Context->Length; n++)
                     {
-                        *p++ = IS_PRINTABLE(Context->Data[i]) ? Context->Data[i] : '.'; // 1
+                        UCHAR byte = PhpHexEditGetByte(Context, i);
+
+                        *p++ = IS_PRINTABLE(byte) ? byte : '.'; // 1
                         i++;
                     }
 
@@ -1261,6 +1301,9 @@ VOID PhpHexEditOnPaint(
     SelectObject(bufferDc, oldBufferBitmap);
     DeleteObject(bufferBitmap);
     DeleteDC(bufferDc);
+
+    if (Context->HasDataSource)
+        PhpHexEditPrefetch(Context);
 }
 
 VOID PhpHexEditUpdateScrollbars(
@@ -1573,7 +1616,7 @@ VOID PhpHexEditCopyEdit(
             if (binaryMemory)
             {
                 PUCHAR p = GlobalLock(binaryMemory);
-                memcpy(p, &Context->Data[Context->SelStart], length);
+                PhpHexEditReadRange(Context, Context->SelStart, p, length);
                 GlobalUnlock(binaryMemory);
 
                 hexMemory = GlobalAlloc(GMEM_MOVEABLE | GMEM_ZEROINIT, (length * 3 + 1) * sizeof(WCHAR));
@@ -1587,7 +1630,7 @@ VOID PhpHexEditCopyEdit(
 
                     for (i = 0; i < length; i++)
                     {
-                        TO_HEX(pw, Context->Data[Context->SelStart + i]);
+                        TO_HEX(pw, PhpHexEditGetByte(Context, Context->SelStart + i));
                         *pw++ = ' ';
                     }
                     *pw = 0;
@@ -1612,7 +1655,7 @@ VOID PhpHexEditCopyEdit(
             if (binaryMemory)
             {
                 PUCHAR p = GlobalLock(binaryMemory);
-                memcpy(p, &Context->Data[Context->SelStart], length);
+                PhpHexEditReadRange(Context, Context->SelStart, p, length);
                 GlobalUnlock(binaryMemory);
 
                 if (asciiMemory)
@@ -1620,7 +1663,7 @@ VOID PhpHexEditCopyEdit(
                     ULONG i;
 
                     p = GlobalLock(asciiMemory);
-                    memcpy(p, &Context->Data[Context->SelStart], length);
+                    PhpHexEditReadRange(Context, Context->SelStart, p, length);
 
                     for (i = 0; i < length; i++)
                     {
@@ -1715,7 +1758,7 @@ VOID PhpHexEditPasteEdit(
                     length = Context->Length - paste;
             }
 
-            memcpy(&Context->Data[paste], p, length);
+            PhpHexEditWriteRange(Context, paste, p, length);
             GlobalUnlock(memory);
 
             Context->CurrentAddress = oldCurrentAddress;
@@ -1822,6 +1865,12 @@ VOID PhpHexEditSetBuffer(
     _In_ ULONG Length
     )
 {
+    if (Context->HasDataSource)
+    {
+        PhpHexEditDeletePages(Context);
+        Context->HasDataSource = FALSE;
+    }
+
     Context->Data = Data;
     PhpHexEditSetSel(hwnd, Context, -1, -1);
     Context->Length = Length;
@@ -1849,3 +1898,421 @@ VOID PhpHexEditSetData(
     Context->UserBuffer = FALSE;
     Context->AllowLengthChange = TRUE;
 }
+
+static PPHP_HEXEDIT_PAGE PhpHexEditLookupPage(
+    _In_ PPHP_HEXEDIT_CONTEXT Context,
+    _In_ ULONG Index
+    )
+{
+    PLIST_ENTRY listEntry;
+
+    for (listEntry = Context->PageListHead.Flink; listEntry != &Context->PageListHead; listEntry = listEntry->Flink)
+    {
+        PPHP_HEXEDIT_PAGE page = CONTAINING_RECORD(listEntry, PHP_HEXEDIT_PAGE, ListEntry);
+
+        if (page->Index == Index)
+            return page;
+    }
+
+    return NULL;
+}
+
+static VOID PhpHexEditInsertPage(
+    _In_ PPHP_HEXEDIT_CONTEXT Context,
+    _In_ PPHP_HEXEDIT_PAGE Page
+    )
+{
+    PLIST_ENTRY listEntry;
+
+    // Evict the least recently used clean page. Dirty pages stay until they are written
+    // back or discarded, so the cache can grow beyond its limit while there are many
+    // unsaved changes.
+    if (Context->NumberOfPages >= PHP_HEXEDIT_CACHE_PAGES)
+    {
+        for (listEntry = Context->PageListHead.Blink; listEntry != &Context->PageListHead; listEntry = listEntry->Blink)
+        {
+            PPHP_HEXEDIT_PAGE page = CONTAINING_RECORD(listEntry, PHP_HEXEDIT_PAGE, ListEntry);
+
+            if (!page->Dirty)
+            {
+                if (Context->LastPage == page)
+                    Context->LastPage = NULL;
+
+                RemoveEntryList(&page->ListEntry);
+                PhFree(page);
+                Context->NumberOfPages--;
+                break;
+            }
+        }
+    }
+
+    InsertHeadList(&Context->PageListHead, &Page->ListEntry);
+    Context->NumberOfPages++;
+}
+
+static VOID PhpHexEditReadPage(
+    _In_ PPHP_HEXEDIT_CONTEXT Context,
+    _Inout_ PPHP_HEXEDIT_PAGE Page
+    )
+{
+    ULONG offset;
+    ULONG length;
+
+    offset = Page->Index * PH_HEXEDIT_PAGE_SIZE;
+    length = min(PH_HEXEDIT_PAGE_SIZE, (ULONG)Context->Length - offset);
+
+    Page->Dirty = FALSE;
+    Page->Unreadable = !NT_SUCCESS(Context->DataSource.ReadPage(
+        Context->DataSource.Context,
+        offset,
+        Page->Data,
+        length
+        ));
+
+    if (Page->Unreadable)
+        memset(Page->Data, 0, PH_HEXEDIT_PAGE_SIZE);
+    else if (length < PH_HEXEDIT_PAGE_SIZE)
+        memset(Page->Data + length, 0, PH_HEXEDIT_PAGE_SIZE - length);
+}
+
+static BOOLEAN PhpHexEditMergePrefetchedPages(
+    _In_ PPHP_HEXEDIT_CONTEXT Context
+    )
+{
+    LIST_ENTRY listHead;
+    PLIST_ENTRY listEntry;
+    BOOLEAN merged = FALSE;
+
+    if (IsListEmpty(&Context->PrefetchListHead))
+        return FALSE;
+
+    PhAcquireQueuedLockExclusive(&Context->PrefetchLock);
+
+    listHead = Context->PrefetchListHead;
+
+    if (IsListEmpty(&listHead))
+    {
+        PhReleaseQueuedLockExclusive(&Context->PrefetchLock);
+        return FALSE;
+    }
+
+    listHead.Flink->Blink = &listHead;
+    listHead.Blink->Flink = &listHead;
+    InitializeListHead(&Context->PrefetchListHead);
+
+    PhReleaseQueuedLockExclusive(&Context->PrefetchLock);
+
+    while (!IsListEmpty(&listHead))
+    {
+        PPHP_HEXEDIT_PAGE page;
+
+        listEntry = RemoveHeadList(&listHead);
+        page = CONTAINING_RECORD(listEntry, PHP_HEXEDIT_PAGE, ListEntry);
+
+        // The page may have been read while the prefetch was running.
+        if (PhpHexEditLookupPage(Context, page->Index))
+        {
+            PhFree(page);
+            continue;
+        }
+
+        PhpHexEditInsertPage(Context, page);
+        merged = TRUE;
+    }
+
+    return merged;
+}
+
+PPHP_HEXEDIT_PAGE PhpHexEditGetPage(
+    _In_ PPHP_HEXEDIT_CONTEXT Context,
+    _In_ ULONG Index
+    )
+{
+    PPHP_HEXEDIT_PAGE page;
+
+    page = PhpHexEditLookupPage(Context, Index);
+
+    if (!page && PhpHexEditMergePrefetchedPages(Context))
+        page = PhpHexEditLookupPage(Context, Index);
+
+    if (page)
+    {
+        RemoveEntryList(&page->ListEntry);
+        InsertHeadList(&Context->PageListHead, &page->ListEntry);
+    }
+    else
+    {
+        page = PhAllocate(sizeof(PHP_HEXEDIT_PAGE));
+        page->Index = Index;
+        PhpHexEditReadPage(Context, page);
+        PhpHexEditInsertPage(Context, page);
+    }
+
+    Context->LastPage = page;
+
+    return page;
+}
+
+VOID PhpHexEditSetByte(
+    _In_ PPHP_HEXEDIT_CONTEXT Context,
+    _In_ LONG Index,
+    _In_ UCHAR Byte
+    )
+{
+    PPHP_HEXEDIT_PAGE page;
+
+    if (!Context->HasDataSource)
+    {
+        Context->Data[Index] = Byte;
+        return;
+    }
+
+    page = PhpHexEditGetPage(Context, (ULONG)Index / PH_HEXEDIT_PAGE_SIZE);
+
+    if (page->Unreadable)
+        return;
+
+    page->Data[(ULONG)Index % PH_HEXEDIT_PAGE_SIZE] = Byte;
+    page->Dirty = TRUE;
+}
+
+VOID PhpHexEditReadRange(
+    _In_ PPHP_HEXEDIT_CONTEXT Context,
+    _In_ LONG Offset,
+    _Out_writes_bytes_(Length) PVOID Buffer,
+    _In_ ULONG Length
+    )
+{
+    ULONG offset;
+    ULONG pageOffset;
+    ULONG length;
+    PPHP_HEXEDIT_PAGE page;
+
+    if (!Context->HasDataSource)
+    {
+        memcpy(Buffer, &Context->Data[Offset], Length);
+        return;
+    }
+
+    for (offset = 0; offset < Length; offset += length)
+    {
+        pageOffset = ((ULONG)Offset + offset) % PH_HEXEDIT_PAGE_SIZE;
+        length = min(PH_HEXEDIT_PAGE_SIZE - pageOffset, Length - offset);
+        page = PhpHexEditGetPage(Context, ((ULONG)Offset + offset) / PH_HEXEDIT_PAGE_SIZE);
+        memcpy(PTR_ADD_OFFSET(Buffer, offset), page->Data + pageOffset, length);
+    }
+}
+
+VOID PhpHexEditWriteRange(
+    _In_ PPHP_HEXEDIT_CONTEXT Context,
+    _In_ LONG Offset,
+    _In_reads_bytes_(Length) PVOID Buffer,
+    _In_ ULONG Length
+    )
+{
+    ULONG offset;
+    ULONG pageOffset;
+    ULONG length;
+    PPHP_HEXEDIT_PAGE page;
+
+    if (!Context->HasDataSource)
+    {
+        memcpy(&Context->Data[Offset], Buffer, Length);
+        return;
+    }
+
+    for (offset = 0; offset < Length; offset += length)
+    {
+        pageOffset = ((ULONG)Offset + offset) % PH_HEXEDIT_PAGE_SIZE;
+        length = min(PH_HEXEDIT_PAGE_SIZE - pageOffset, Length - offset);
+        page = PhpHexEditGetPage(Context, ((ULONG)Offset + offset) / PH_HEXEDIT_PAGE_SIZE);
+
+        if (!page->Unreadable)
+        {
+            memcpy(page->Data + pageOffset, PTR_ADD_OFFSET(Buffer, offset), length);
+            page->Dirty = TRUE;
+        }
+    }
+}
+
+VOID PhpHexEditSetDataSource(
+    _In_ HWND hwnd,
+    _In_ PPHP_HEXEDIT_CONTEXT Context,
+    _In_opt_ PPH_HEXEDIT_DATA_SOURCE DataSource
+    )
+{
+    PhpHexEditDeletePages(Context);
+
+    if (!Context->UserBuffer && Context->Data)
+        PhFree(Context->Data);
+
+    Context->Data = NULL;
+
+    if (DataSource)
+    {
+        Context->DataSource = *DataSource;
+        Context->HasDataSource = TRUE;
+        Context->Length = (LONG)min(DataSource->Length, MAXLONG);
+    }
+    else
+    {
+        memset(&Context->DataSource, 0, sizeof(PH_HEXEDIT_DATA_SOURCE));
+        Context->HasDataSource = FALSE;
+        Context->Length = 0;
+    }
+
+    Context->CurrentAddress = 0;
+    Context->EditPosition.x = Context->EditPosition.y = 0;
+    Context->CurrentMode = EDIT_HIGH;
+    Context->TopIndex = 0;
+    Context->Update = TRUE;
+
+    Context->UserBuffer = TRUE;
+    Context->AllowLengthChange = FALSE;
+
+    PhpHexEditSetSel(hwnd, Context, -1, -1);
+}
+
+VOID PhpHexEditDeletePages(
+    _In_ PPHP_HEXEDIT_CONTEXT Context
+    )
+{
+    PLIST_ENTRY listEntry;
+
+    // The prefetcher uses the data source and the page lists, so wait for it to finish.
+    PhWaitForRundownProtection(&Context->PrefetchRundown);
+    PhInitializeRundownProtection(&Context->PrefetchRundown);
+    Context->PrefetchPending = FALSE;
+
+    while (!IsListEmpty(&Context->PrefetchListHead))
+    {
+        listEntry = RemoveHeadList(&Context->PrefetchListHead);
+        PhFree(CONTAINING_RECORD(listEntry, PHP_HEXEDIT_PAGE, ListEntry));
+    }
+
+    while (!IsListEmpty(&Context->PageListHead))
+    {
+        listEntry = RemoveHeadList(&Context->PageListHead);
+        PhFree(CONTAINING_RECORD(listEntry, PHP_HEXEDIT_PAGE, ListEntry));
+    }
+
+    Context->NumberOfPages = 0;
+    Context->LastPage = NULL;
+}
+
+NTSTATUS PhpHexEditFlush(
+    _In_ PPHP_HEXEDIT_CONTEXT Context
+    )
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    NTSTATUS pageStatus;
+    PLIST_ENTRY listEntry;
+
+    if (!Context->HasDataSource)
+        return STATUS_SUCCESS;
+    if (!Context->DataSource.WritePage)
+        return STATUS_NOT_SUPPORTED;
+
+    for (listEntry = Context->PageListHead.Flink; listEntry != &Context->PageListHead; listEntry = listEntry->Flink)
+    {
+        PPHP_HEXEDIT_PAGE page = CONTAINING_RECORD(listEntry, PHP_HEXEDIT_PAGE, ListEntry);
+        ULONG offset;
+
+        if (!page->Dirty)
+            continue;
+
+        offset = page->Index * PH_HEXEDIT_PAGE_SIZE;
+        pageStatus = Context->DataSource.WritePage(
+            Context->DataSource.Context,
+            offset,
+            page->Data,
+            min(PH_HEXEDIT_PAGE_SIZE, (ULONG)Context->Length - offset)
+            );
+
+        // Pages which could not be written stay dirty so that they can be retried.
+        if (NT_SUCCESS(pageStatus))
+            page->Dirty = FALSE;
+        else if (NT_SUCCESS(status))
+            status = pageStatus;
+    }
+
+    return status;
+}
+
+static NTSTATUS NTAPI PhpHexEditPrefetchWorker(
+    _In_ PVOID Parameter
+    )
+{
+    PPHP_HEXEDIT_PREFETCH prefetch = Parameter;
+    PPHP_HEXEDIT_CONTEXT context = prefetch->Context;
+    ULONG i;
+
+    for (i = 0; i < prefetch->NumberOfPages; i++)
+    {
+        PPHP_HEXEDIT_PAGE page;
+
+        page = PhAllocate(sizeof(PHP_HEXEDIT_PAGE));
+        page->Index = prefetch->Indices[i];
+        PhpHexEditReadPage(context, page);
+
+        PhAcquireQueuedLockExclusive(&context->PrefetchLock);
+        InsertTailList(&context->PrefetchListHead, &page->ListEntry);
+        PhReleaseQueuedLockExclusive(&context->PrefetchLock);
+    }
+
+    PostMessage(context->WindowHandle, HEM_PREFETCHCOMPLETE, 0, 0);
+    PhFree(prefetch);
+    PhReleaseRundownProtection(&context->PrefetchRundown);
+
+    return STATUS_SUCCESS;
+}
+
+VOID PhpHexEditPrefetch(
+    _In_ PPHP_HEXEDIT_CONTEXT Context
+    )
+{
+    PPHP_HEXEDIT_PREFETCH prefetch;
+    ULONG numberOfPages;
+    ULONG firstPage;
+    ULONG lastPage;
+    ULONG i;
+
+    if (Context->PrefetchPending || Context->Length == 0)
+        return;
+
+    PhpHexEditMergePrefetchedPages(Context);
+
+    numberOfPages = ((ULONG)Context->Length + PH_HEXEDIT_PAGE_SIZE - 1) / PH_HEXEDIT_PAGE_SIZE;
+    firstPage = (ULONG)Context->TopIndex / PH_HEXEDIT_PAGE_SIZE;
+    lastPage = ((ULONG)Context->TopIndex + Context->LinesPerPage * Context->BytesPerRow) / PH_HEXEDIT_PAGE_SIZE;
+
+    prefetch = PhAllocate(sizeof(PHP_HEXEDIT_PREFETCH));
+    prefetch->Context = Context;
+    prefetch->NumberOfPages = 0;
+
+    // Read ahead in both directions, nearest pages first.
+    for (i = 1; i <= PHP_HEXEDIT_PREFETCH_PAGES / 2; i++)
+    {
+        if (lastPage + i < numberOfPages && !PhpHexEditLookupPage(Context, lastPage + i))
+            prefetch->Indices[prefetch->NumberOfPages++] = lastPage + i;
+        if (firstPage >= i && !PhpHexEditLookupPage(Context, firstPage - i))
+            prefetch->Indices[prefetch->NumberOfPages++] = firstPage - i;
+    }
+
+    if (prefetch->NumberOfPages == 0 || !PhAcquireRundownProtection(&Context->PrefetchRundown))
+    {
+        PhFree(prefetch);
+        return;
+    }
+
+    Context->PrefetchPending = TRUE;
+    PhQueueItemGlobalWorkQueue(PhpHexEditPrefetchWorker, prefetch);
+}
+
+VOID PhpHexEditCompletePrefetch(
+    _In_ PPHP_HEXEDIT_CONTEXT Context
+    )
+{
+    Context->PrefetchPending = FALSE;
+    PhpHexEditMergePrefetchedPages(Context);
+}
@@ -95,6 +95,17 @@ VOID PhpReleaseCallWithTimeoutThread(
     _Inout_ PPHP_CALL_WITH_TIMEOUT_THREAD_CONTEXT ThreadContext
     );
 
+NTSTATUS PhpStartCallWithTimeout(
+    _Inout_ PPHP_CALL_WITH_TIMEOUT_THREAD_CONTEXT ThreadContext,
+    _In_ PUSER_THREAD_START_ROUTINE Routine,
+    _In_opt_ PVOID Context
+    );
+
+NTSTATUS PhpFinishCallWithTimeout(
+    _Inout_ PPHP_CALL_WITH_TIMEOUT_THREAD_CONTEXT ThreadContext,
+    _In_ NTSTATUS WaitStatus
+    );
+
 NTSTATUS PhpCallWithTimeout(
     _Inout_ PPHP_CALL_WITH_TIMEOUT_THREAD_CONTEXT ThreadContext,
     _In_ PUSER_THREAD_START_ROUTINE Routine,
@@ -1549,11 +1560,10 @@ VOID PhpReleaseCallWithTimeoutThread(
     PhSetWakeEvent(&PhpCallWithTimeoutThreadReleaseEvent, NULL);
 }
 
-NTSTATUS PhpCallWithTimeout(
+NTSTATUS PhpStartCallWithTimeout(
     _Inout_ PPHP_CALL_WITH_TIMEOUT_THREAD_CONTEXT ThreadContext,
     _In_ PUSER_THREAD_START_ROUTINE Routine,
-    _In_opt_ PVOID Context,
-    _In_ PLARGE_INTEGER Timeout
+    _In_opt_ PVOID Context
     )
 {
     NTSTATUS status;
@@ -1603,25 +1613,49 @@ NTSTATUS PhpCallWithTimeout(
     ThreadContext->Context = Context;
 
     NtSetEvent(ThreadContext->StartEventHandle, NULL);
-    status = NtWaitForSingleObject(ThreadContext->CompletedEventHandle, FALSE, Timeout);
 
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS PhpFinishCallWithTimeout(
+    _Inout_ PPHP_CALL_WITH_TIMEOUT_THREAD_CONTEXT ThreadContext,
+    _In_ NTSTATUS WaitStatus
+    )
+{
     ThreadContext->Routine = NULL;
     MemoryBarrier();
     ThreadContext->Context = NULL;
 
-    if (status != STATUS_WAIT_0)
+    if (WaitStatus != STATUS_WAIT_0)
     {
         // The operation timed out, or there was an error. Kill the thread.
         // On Vista and above, the thread stack is freed automatically.
         NtTerminateThread(ThreadContext->ThreadHandle, STATUS_UNSUCCESSFUL);
-        status = NtWaitForSingleObject(ThreadContext->ThreadHandle, FALSE, NULL);
+        NtWaitForSingleObject(ThreadContext->ThreadHandle, FALSE, NULL);
         NtClose(ThreadContext->ThreadHandle);
         ThreadContext->ThreadHandle = NULL;
 
-        status = STATUS_UNSUCCESSFUL;
+        return STATUS_UNSUCCESSFUL;
     }
 
-    return status;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS PhpCallWithTimeout(
+    _Inout_ PPHP_CALL_WITH_TIMEOUT_THREAD_CONTEXT ThreadContext,
+    _In_ PUSER_THREAD_START_ROUTINE Routine,
+    _In_opt_ PVOID Context,
+    _In_ PLARGE_INTEGER Timeout
+    )
+{
+    NTSTATUS status;
+
+    if (!NT_SUCCESS(status = PhpStartCallWithTimeout(ThreadContext, Routine, Context)))
+        return status;
+
+    status = NtWaitForSingleObject(ThreadContext->CompletedEventHandle, FALSE, Timeout);
+
+    return PhpFinishCallWithTimeout(ThreadContext, status);
 }
 
 NTSTATUS PhpCallWithTimeoutThreadStart(
@@ -1825,4 +1859,365 @@ NTSTATUS PhCallKphDuplicateObjectWithTimeout(
     context->u.KphDuplicateObject.Options = Options;
 
     return PhpCommonQueryObjectWithTimeout(context);
-}
\ No newline at end of file
+}
+
+typedef struct _PHP_HANDLE_NAME_QUERY_SLOT
+{
+    PPHP_CALL_WITH_TIMEOUT_THREAD_CONTEXT ThreadContext;
+    PPH_HANDLE_NAME_QUERY Query;
+    HANDLE DupHandle;
+    ULONG Attempts;
+    ULONG64 Deadline;
+
+    POBJECT_NAME_INFORMATION Buffer;
+    ULONG BufferSize;
+    ULONG ReturnLength;
+    NTSTATUS Status;
+} PHP_HANDLE_NAME_QUERY_SLOT, *PPHP_HANDLE_NAME_QUERY_SLOT;
+
+NTSTATUS PhpHandleNameQueryRoutine(
+    _In_ PVOID Parameter
+    )
+{
+    PPHP_HANDLE_NAME_QUERY_SLOT slot = Parameter;
+
+    // This thread may be terminated at any point, so it must not allocate memory or
+    // acquire locks. The buffer is managed by the dispatching thread.
+    slot->Status = NtQueryObject(
+        slot->DupHandle,
+        ObjectNameInformation,
+        slot->Buffer,
+        slot->BufferSize,
+        &slot->ReturnLength
+        );
+
+    return STATUS_SUCCESS;
+}
+
+VOID PhpCompleteHandleNameQuery(
+    _In_ HANDLE ProcessHandle,
+    _Inout_ PPH_HANDLE_NAME_QUERY Query,
+    _In_ NTSTATUS Status,
+    _In_opt_ _Assume_refs_(1) PPH_STRING ObjectName,
+    _In_opt_ PPH_HANDLE_NAME_QUERY_CALLBACK Callback,
+    _In_opt_ PVOID Context
+    )
+{
+    Query->Status = Status;
+    Query->ObjectName = ObjectName;
+
+    if (ObjectName && Query->TypeName)
+    {
+        PhpGetBestObjectName(
+            ProcessHandle,
+            Query->Handle,
+            ObjectName,
+            Query->TypeName,
+            &Query->BestObjectName
+            );
+    }
+
+    if (Callback)
+        Callback(Query, Context);
+}
+
+BOOLEAN PhpStartHandleNameQuery(
+    _In_ HANDLE ProcessHandle,
+    _Inout_ PPHP_HANDLE_NAME_QUERY_SLOT Slot,
+    _Inout_ PPH_HANDLE_NAME_QUERY Query,
+    _In_ ULONG Timeout,
+    _In_opt_ PPH_HANDLE_NAME_QUERY_CALLBACK Callback,
+    _In_opt_ PVOID Context
+    )
+{
+    NTSTATUS status;
+    HANDLE dupHandle;
+
+    if (ProcessHandle != NtCurrentProcess())
+    {
+        status = NtDuplicateObject(
+            ProcessHandle,
+            Query->Handle,
+            NtCurrentProcess(),
+            &dupHandle,
+            0,
+            0,
+            0
+            );
+
+        if (!NT_SUCCESS(status))
+        {
+            PhpCompleteHandleNameQuery(ProcessHandle, Query, status, NULL, Callback, Context);
+            return FALSE;
+        }
+    }
+    else
+    {
+        dupHandle = Query->Handle;
+    }
+
+    // Type names never hang, so they are queried on this thread.
+    status = PhpGetObjectTypeName(ProcessHandle, dupHandle, Query->ObjectTypeNumber, &Query->TypeName);
+
+    if (NT_SUCCESS(status))
+    {
+        Slot->Query = Query;
+        Slot->DupHandle = dupHandle;
+        Slot->Attempts = 8;
+        Slot->Deadline = NtGetTickCount64() + Timeout;
+
+        status = PhpStartCallWithTimeout(Slot->ThreadContext, PhpHandleNameQueryRoutine, Slot);
+
+        if (NT_SUCCESS(status))
+            return TRUE;
+
+        Slot->Query = NULL;
+        Slot->DupHandle = NULL;
+    }
+
+    if (ProcessHandle != NtCurrentProcess())
+        NtClose(dupHandle);
+
+    PhpCompleteHandleNameQuery(ProcessHandle, Query, status, NULL, Callback, Context);
+
+    return FALSE;
+}
+
+VOID PhpEndHandleNameQuery(
+    _In_ HANDLE ProcessHandle,
+    _Inout_ PPHP_HANDLE_NAME_QUERY_SLOT Slot,
+    _In_ NTSTATUS WaitStatus,
+    _In_ ULONG Timeout,
+    _In_opt_ PPH_HANDLE_NAME_QUERY_CALLBACK Callback,
+    _In_opt_ PVOID Context
+    )
+{
+    NTSTATUS status;
+    PPH_HANDLE_NAME_QUERY query;
+    PPH_STRING objectName = NULL;
+
+    status = PhpFinishCallWithTimeout(Slot->ThreadContext, WaitStatus);
+
+    if (NT_SUCCESS(status))
+    {
+        status = Slot->Status;
+
+        // The I/O subsystem sometimes gives us the wrong return lengths, so retry a few
+        // times with a bigger buffer.
+        if ((status == STATUS_BUFFER_OVERFLOW || status == STATUS_INFO_LENGTH_MISMATCH ||
+            status == STATUS_BUFFER_TOO_SMALL) && --Slot->Attempts != 0)
+        {
+            PhFree(Slot->Buffer);
+            Slot->BufferSize = Slot->ReturnLength > Slot->BufferSize ? Slot->ReturnLength : Slot->BufferSize * 2;
+            Slot->Buffer = PhAllocate(Slot->BufferSize);
+            Slot->Deadline = NtGetTickCount64() + Timeout;
+
+            if (NT_SUCCESS(status = PhpStartCallWithTimeout(Slot->ThreadContext, PhpHandleNameQueryRoutine, Slot)))
+                return;
+        }
+
+        if (NT_SUCCESS(status))
+            objectName = PhCreateStringFromUnicodeString(&Slot->Buffer->Name);
+    }
+
+    if (ProcessHandle != NtCurrentProcess())
+        NtClose(Slot->DupHandle);
+
+    query = Slot->Query;
+    Slot->Query = NULL;
+    Slot->DupHandle = NULL;
+
+    PhpCompleteHandleNameQuery(ProcessHandle, query, status, objectName, Callback, Context);
+}
+
+/**
+ * Queries the names of a set of handles, protecting against object types that
+ * can hang (such as named pipes).
+ *
+ * \param ProcessHandle A handle to the process which owns the handles. The handle
+ * must have PROCESS_DUP_HANDLE access.
+ * \param Queries An array of queries. Handle and ObjectTypeNumber must be set
+ * for each query. TypeName, ObjectName and BestObjectName receive the names, or
+ * NULL if they could not be queried, and Status receives the result of the name
+ * query. The caller must dereference the strings.
+ * \param Count The number of queries.
+ * \param Timeout The maximum time allowed for each name query, in milliseconds,
+ * or 0 to use the default of one second.
+ * \param Callback A function which is called on the current thread as each query
+ * completes. Queries complete in no particular order.
+ * \param Context A user-defined value to pass to the callback function.
+ *
+ * \remarks The names are queried in parallel by the same threads as
+ * PhCallWithTimeout(). This thread waits on all of them at once and terminates
+ * any thread whose query runs for longer than \a Timeout.
+ */
+VOID PhQueryHandleNamesWithTimeout(
+    _In_ HANDLE ProcessHandle,
+    _Inout_updates_(Count) PPH_HANDLE_NAME_QUERY Queries,
+    _In_ ULONG Count,
+    _In_opt_ ULONG Timeout,
+    _In_opt_ PPH_HANDLE_NAME_QUERY_CALLBACK Callback,
+    _In_opt_ PVOID Context
+    )
+{
+    NTSTATUS status;
+    PPHP_HANDLE_NAME_QUERY_SLOT slots;
+    HANDLE events[PH_QUERY_HACK_MAX_THREADS];
+    ULONG eventSlots[PH_QUERY_HACK_MAX_THREADS];
+    ULONG numberOfSlots;
+    ULONG numberOfEvents;
+    ULONG nextQuery;
+    ULONG64 deadline;
+    ULONG64 currentTime;
+    LARGE_INTEGER timeout;
+    LARGE_INTEGER zeroTimeout;
+    ULONG i;
+
+    for (i = 0; i < Count; i++)
+    {
+        Queries[i].Status = STATUS_PENDING;
+        Queries[i].TypeName = NULL;
+        Queries[i].ObjectName = NULL;
+        Queries[i].BestObjectName = NULL;
+    }
+
+    if (Count == 0)
+        return;
+
+    if (Timeout == 0)
+        Timeout = 1000;
+
+    // KPH can query names without hanging. We can't use the timeout method on XP
+    // because hanging threads can't even be terminated, so PhGetHandleInformationEx
+    // gives up on file names there.
+    if (KphIsConnected() || WindowsVersion <= WINDOWS_XP)
+    {
+        NTSTATUS subStatus;
+
+        for (i = 0; i < Count; i++)
+        {
+            status = PhGetHandleInformationEx(
+                ProcessHandle,
+                Queries[i].Handle,
+                Queries[i].ObjectTypeNumber,
+                0,
+                &subStatus,
+                NULL,
+                &Queries[i].TypeName,
+                &Queries[i].ObjectName,
+                &Queries[i].BestObjectName,
+                NULL
+                );
+
+            Queries[i].Status = NT_SUCCESS(status) ? subStatus : status;
+
+            if (Callback)
+                Callback(&Queries[i], Context);
+        }
+
+        return;
+    }
+
+    slots = PhAllocate(sizeof(PHP_HANDLE_NAME_QUERY_SLOT) * PH_QUERY_HACK_MAX_THREADS);
+    memset(slots, 0, sizeof(PHP_HANDLE_NAME_QUERY_SLOT) * PH_QUERY_HACK_MAX_THREADS);
+
+    // Take as many query threads as we can use, but only wait for the first one.
+
+    zeroTimeout.QuadPart = 0;
+    numberOfSlots = 0;
+
+    while (numberOfSlots < Count && numberOfSlots < PH_QUERY_HACK_MAX_THREADS)
+    {
+        PPHP_CALL_WITH_TIMEOUT_THREAD_CONTEXT threadContext;
+
+        if (!(threadContext = PhpAcquireCallWithTimeoutThread(numberOfSlots == 0 ? NULL : &zeroTimeout)))
+            break;
+
+        slots[numberOfSlots].ThreadContext = threadContext;
+        slots[numberOfSlots].BufferSize = 0x200;
+        slots[numberOfSlots].Buffer = PhAllocate(0x200);
+        numberOfSlots++;
+    }
+
+    nextQuery = 0;
+
+    while (TRUE)
+    {
+        // Give each idle thread a query.
+        for (i = 0; i < numberOfSlots; i++)
+        {
+            while (!slots[i].Query && nextQuery < Count)
+            {
+                PhpStartHandleNameQuery(ProcessHandle, &slots[i], &Queries[nextQuery], Timeout, Callback, Context);
+                nextQuery++;
+            }
+        }
+
+        numberOfEvents = 0;
+        deadline = MAXULONG64;
+
+        for (i = 0; i < numberOfSlots; i++)
+        {
+            if (slots[i].Query)
+            {
+                events[numberOfEvents] = slots[i].ThreadContext->CompletedEventHandle;
+                eventSlots[numberOfEvents] = i;
+                numberOfEvents++;
+
+                if (deadline > slots[i].Deadline)
+                    deadline = slots[i].Deadline;
+            }
+        }
+
+        if (numberOfEvents == 0)
+            break;
+
+        currentTime = NtGetTickCount64();
+        timeout.QuadPart = deadline > currentTime ? -(LONGLONG)(deadline - currentTime) * PH_TIMEOUT_MS : 0;
+
+        status = NtWaitForMultipleObjects(numberOfEvents, events, WaitAny, FALSE, &timeout);
+
+        if (status >= STATUS_WAIT_0 && status < STATUS_WAIT_0 + numberOfEvents)
+        {
+            PhpEndHandleNameQuery(ProcessHandle, &slots[eventSlots[status - STATUS_WAIT_0]], STATUS_WAIT_0, Timeout, Callback, Context);
+        }
+        else
+        {
+            currentTime = NtGetTickCount64();
+
+            for (i = 0; i < numberOfEvents; i++)
+            {
+                PPHP_HANDLE_NAME_QUERY_SLOT slot = &slots[eventSlots[i]];
+
+                if (status == STATUS_TIMEOUT && currentTime < slot->Deadline)
+                    continue;
+
+                // The query may have completed just after the wait timed out. Otherwise
+                // the thread is terminated.
+                PhpEndHandleNameQuery(
+                    ProcessHandle,
+                    slot,
+                    NtWaitForSingleObject(slot->ThreadContext->CompletedEventHandle, FALSE, &zeroTimeout),
+                    Timeout,
+                    Callback,
+                    Context
+                    );
+            }
+        }
+    }
+
+    // If no query threads could be acquired, the remaining queries fail.
+    while (nextQuery < Count)
+    {
+        PhpCompleteHandleNameQuery(ProcessHandle, &Queries[nextQuery], STATUS_UNSUCCESSFUL, NULL, Callback, Context);
+        nextQuery++;
+    }
+
+    for (i = 0; i < numberOfSlots; i++)
+    {
+        PhFree(slots[i].Buffer);
+        PhpReleaseCallWithTimeoutThread(slots[i].ThreadContext);
+    }
+
+    PhFree(slots);
+}
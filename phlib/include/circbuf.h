@@ -23,4 +23,248 @@
 #define T FLOAT
 #include "circbuf_h.h"
 
+// Range aggregates
+
+// Index is the index of the newest item in the range (0 is the most recently added item)
+// and Count is the number of items, going back in time. The range is clipped to the items
+// that are in the buffer. Ranges that wrap around the end of the buffer are handled as two
+// contiguous scans.
+
+PHLIBAPI
+ULONG
+NTAPI
+PhMaximumCircularBuffer_ULONG(
+    _In_ PPH_CIRCULAR_BUFFER_ULONG Buffer,
+    _In_ ULONG Index,
+    _In_ ULONG Count
+    );
+
+PHLIBAPI
+ULONG64
+NTAPI
+PhMaximumCircularBuffer_ULONG64(
+    _In_ PPH_CIRCULAR_BUFFER_ULONG64 Buffer,
+    _In_ ULONG Index,
+    _In_ ULONG Count
+    );
+
+PHLIBAPI
+FLOAT
+NTAPI
+PhMaximumCircularBuffer_FLOAT(
+    _In_ PPH_CIRCULAR_BUFFER_FLOAT Buffer,
+    _In_ ULONG Index,
+    _In_ ULONG Count
+    );
+
+PHLIBAPI
+ULONG64
+NTAPI
+PhSumCircularBuffer_ULONG(
+    _In_ PPH_CIRCULAR_BUFFER_ULONG Buffer,
+    _In_ ULONG Index,
+    _In_ ULONG Count
+    );
+
+PHLIBAPI
+ULONG64
+NTAPI
+PhSumCircularBuffer_ULONG64(
+    _In_ PPH_CIRCULAR_BUFFER_ULONG64 Buffer,
+    _In_ ULONG Index,
+    _In_ ULONG Count
+    );
+
+PHLIBAPI
+FLOAT
+NTAPI
+PhSumCircularBuffer_FLOAT(
+    _In_ PPH_CIRCULAR_BUFFER_FLOAT Buffer,
+    _In_ ULONG Index,
+    _In_ ULONG Count
+    );
+
+// Sliding maximum
+
+// Keeps the maximum of the last WindowSize items added, in O(1) amortized time per item.
+// Only items that could still become the maximum are stored: each new item discards the
+// smaller items before it, so the stored values are always decreasing and the oldest one
+// is the maximum.
+
+typedef struct _PH_SLIDING_MAXIMUM
+{
+    ULONG WindowSize;
+    ULONG SizeMinusOne;
+    ULONG Head; // index of the oldest stored item
+    ULONG Count;
+    ULONG Sequence; // number of items added
+    PULONG64 Values;
+    PULONG Sequences;
+} PH_SLIDING_MAXIMUM, *PPH_SLIDING_MAXIMUM;
+
+PHLIBAPI
+VOID
+NTAPI
+PhInitializeSlidingMaximum(
+    _Out_ PPH_SLIDING_MAXIMUM Maximum,
+    _In_ ULONG WindowSize
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhDeleteSlidingMaximum(
+    _Inout_ PPH_SLIDING_MAXIMUM Maximum
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhClearSlidingMaximum(
+    _Inout_ PPH_SLIDING_MAXIMUM Maximum
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhAddItemSlidingMaximum(
+    _Inout_ PPH_SLIDING_MAXIMUM Maximum,
+    _In_ ULONG64 Value
+    );
+
+FORCEINLINE ULONG64 PhGetSlidingMaximum(
+    _In_ PPH_SLIDING_MAXIMUM Maximum
+    )
+{
+    if (Maximum->Count == 0)
+        return 0;
+
+    return Maximum->Values[Maximum->Head];
+}
+
+// Non-negative FLOAT values compare the same way as their bit patterns.
+
+FORCEINLINE VOID PhAddFloatItemSlidingMaximum(
+    _Inout_ PPH_SLIDING_MAXIMUM Maximum,
+    _In_ FLOAT Value
+    )
+{
+    PhAddItemSlidingMaximum(Maximum, Value > 0 ? *(PULONG)&Value : 0);
+}
+
+FORCEINLINE FLOAT PhGetFloatSlidingMaximum(
+    _In_ PPH_SLIDING_MAXIMUM Maximum
+    )
+{
+    ULONG value;
+
+    value = (ULONG)PhGetSlidingMaximum(Maximum);
+
+    return *(PFLOAT)&value;
+}
+
+// Compressed circular buffer
+
+// Samples are stored in chunks of PH_COMPRESSED_CIRCULAR_BUFFER_CHUNK_SIZE items. Each chunk
+// is encoded independently, so random access only needs to decode part of one chunk. The
+// newest chunk is appended to in place; once full it is shrunk to its encoded length and
+// a new chunk is started. The oldest chunk is discarded as a whole when it falls out of
+// the buffer.
+
+#define PH_COMPRESSED_CIRCULAR_BUFFER_CHUNK_SIZE 32
+#define PH_COMPRESSED_CIRCULAR_BUFFER_MAXIMUM_CHUNK_LENGTH (PH_COMPRESSED_CIRCULAR_BUFFER_CHUNK_SIZE * 10)
+
+// Each value is stored as the zigzag-encoded difference from the previous value.
+// Best for counters and sizes.
+#define PH_COMPRESSED_CIRCULAR_BUFFER_DELTA 0
+// Each value is stored as its bit pattern XOR'ed with that of the previous value.
+// Use this for FLOAT values.
+#define PH_COMPRESSED_CIRCULAR_BUFFER_XOR 1
+
+typedef struct _PH_COMPRESSED_CIRCULAR_BUFFER
+{
+    ULONG Size;
+    ULONG Count;
+    ULONG Encoding;
+
+    PUCHAR *Chunks; // full chunks, oldest first
+    ULONG ChunksSize;
+    ULONG ChunksIndex;
+    ULONG ChunksCount;
+
+    PUCHAR Head;
+    USHORT HeadCount;
+    USHORT HeadLength;
+    USHORT HeadAllocatedLength;
+    ULONG64 HeadLastValue;
+} PH_COMPRESSED_CIRCULAR_BUFFER, *PPH_COMPRESSED_CIRCULAR_BUFFER;
+
+PHLIBAPI
+VOID
+NTAPI
+PhInitializeCompressedCircularBuffer(
+    _Out_ PPH_COMPRESSED_CIRCULAR_BUFFER Buffer,
+    _In_ ULONG Size,
+    _In_ ULONG Encoding
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhDeleteCompressedCircularBuffer(
+    _Inout_ PPH_COMPRESSED_CIRCULAR_BUFFER Buffer
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhClearCompressedCircularBuffer(
+    _Inout_ PPH_COMPRESSED_CIRCULAR_BUFFER Buffer
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhAddItemCompressedCircularBuffer(
+    _Inout_ PPH_COMPRESSED_CIRCULAR_BUFFER Buffer,
+    _In_ ULONG64 Value
+    );
+
+PHLIBAPI
+ULONG64
+NTAPI
+PhGetItemCompressedCircularBuffer(
+    _In_ PPH_COMPRESSED_CIRCULAR_BUFFER Buffer,
+    _In_ ULONG Index
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhCopyCompressedCircularBuffer(
+    _In_ PPH_COMPRESSED_CIRCULAR_BUFFER Buffer,
+    _Out_writes_(Count) PULONG64 Destination,
+    _In_ ULONG Count
+    );
+
+FORCEINLINE VOID PhAddFloatItemCompressedCircularBuffer(
+    _Inout_ PPH_COMPRESSED_CIRCULAR_BUFFER Buffer,
+    _In_ FLOAT Value
+    )
+{
+    PhAddItemCompressedCircularBuffer(Buffer, *(PULONG)&Value);
+}
+
+FORCEINLINE FLOAT PhGetFloatItemCompressedCircularBuffer(
+    _In_ PPH_COMPRESSED_CIRCULAR_BUFFER Buffer,
+    _In_ ULONG Index
+    )
+{
+    ULONG value;
+
+    value = (ULONG)PhGetItemCompressedCircularBuffer(Buffer, Index);
+
+    return *(PFLOAT)&value;
+}
+
 #endif
@@ -11,6 +11,7 @@ typedef struct T___(_PH_CIRCULAR_BUFFER, T)
     ULONG Count;
     LONG Index;
     T *Data;
+    PPH_ARENA Arena;
 } T___(PH_CIRCULAR_BUFFER, T), *T___(PPH_CIRCULAR_BUFFER, T);
 
 PHLIBAPI
@@ -21,6 +22,15 @@ T___(PhInitializeCircularBuffer, T)(
     _In_ ULONG Size
     );
 
+PHLIBAPI
+VOID
+NTAPI
+T___(PhInitializeCircularBufferEx, T)(
+    _Out_ T___(PPH_CIRCULAR_BUFFER, T) Buffer,
+    _In_ ULONG Size,
+    _In_opt_ PPH_ARENA Arena
+    );
+
 PHLIBAPI
 VOID
 NTAPI
@@ -18,6 +18,23 @@ PPH_LIST PhaFormatTextTable(
     _In_ ULONG Mode
     );
 
+typedef VOID (NTAPI *PPH_TEXT_TABLE_GET_CELL)(
+    _In_ ULONG Row,
+    _In_ ULONG Column,
+    _Out_ PPH_STRINGREF Text,
+    _In_opt_ PVOID Context
+    );
+
+PHLIBAPI
+VOID PhWriteTextTable(
+    _Inout_ PPH_FILE_STREAM FileStream,
+    _In_ ULONG Rows,
+    _In_ ULONG Columns,
+    _In_ ULONG Mode,
+    _In_ PPH_TEXT_TABLE_GET_CELL GetCell,
+    _In_opt_ PVOID Context
+    );
+
 VOID PhMapDisplayIndexTreeNew(
     _In_ HWND TreeNewHandle,
     _Out_opt_ PULONG *DisplayToId,
@@ -37,6 +54,13 @@ PPH_LIST PhGetGenericTreeNewLines(
     _In_ ULONG Mode
     );
 
+PHLIBAPI
+VOID PhWriteGenericTreeNew(
+    _Inout_ PPH_FILE_STREAM FileStream,
+    _In_ HWND TreeNewHandle,
+    _In_ ULONG Mode
+    );
+
 VOID PhaMapDisplayIndexListView(
     _In_ HWND ListViewHandle,
     _Out_writes_(Count) PULONG DisplayToId,
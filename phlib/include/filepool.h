@@ -27,6 +27,11 @@
 /** The number of free lists for segments. */
 #define PH_FP_FREE_LIST_COUNT 8
 
+// The file header records whether the file was cleanly committed. Any change made by the
+// allocator itself marks the file as dirty first, and PhCommitFilePool() writes all data
+// to disk before clearing the flag and storing a checksum of the header. A file that was
+// not committed after its last change is rejected when it is opened.
+
 // Block flags
 /** The block is the beginning of a large allocation (one that spans several segments). */
 #define PH_FP_BLOCK_LARGE_ALLOCATION 0x1
@@ -49,7 +54,11 @@ typedef struct _PH_FP_SEGMENT_HEADER
     ULONG Reserved[13];
 } PH_FP_SEGMENT_HEADER, *PPH_FP_SEGMENT_HEADER;
 
-#define PH_FP_MAGIC ('loPF')
+#define PH_FP_MAGIC ('2oPF')
+
+// File flags
+/** The file has been changed since it was last committed. */
+#define PH_FP_FILE_DIRTY 0x1
 
 typedef struct _PH_FP_FILE_HEADER
 {
@@ -58,6 +67,12 @@ typedef struct _PH_FP_FILE_HEADER
     ULONG SegmentCount;
     ULONGLONG UserContext;
     ULONG FreeLists[PH_FP_FREE_LIST_COUNT];
+    ULONG Flags; // PH_FP_FILE_*
+    ULONG Reserved;
+    /** The number of times the file has been committed. */
+    ULONGLONG CommitSequence;
+    /** A CRC32 of all preceding fields, valid when the file is not dirty. */
+    ULONG Checksum;
 } PH_FP_FILE_HEADER, *PPH_FP_FILE_HEADER;
 
 // Runtime
@@ -76,6 +91,12 @@ typedef struct _PH_FILE_POOL_PARAMETERS
     ULONG MaximumInactiveViews;
 } PH_FILE_POOL_PARAMETERS, *PPH_FILE_POOL_PARAMETERS;
 
+typedef struct _PH_FILE_POOL_RELOCATION
+{
+    ULONG OldRva;
+    ULONG NewRva;
+} PH_FILE_POOL_RELOCATION, *PPH_FILE_POOL_RELOCATION;
+
 typedef struct _PH_FILE_POOL
 {
     HANDLE FileHandle;
@@ -137,6 +158,20 @@ BOOLEAN PhFreeFilePoolByRva(
     _In_ ULONG Rva
     );
 
+ULONG PhAllocateFilePoolBatch(
+    _Inout_ PPH_FILE_POOL Pool,
+    _In_ ULONG Count,
+    _In_reads_(Count) PULONG Sizes,
+    _Out_writes_(Count) PVOID *Blocks,
+    _Out_writes_opt_(Count) PULONG Rvas
+    );
+
+ULONG PhFreeFilePoolBatch(
+    _Inout_ PPH_FILE_POOL Pool,
+    _In_ ULONG Count,
+    _In_reads_(Count) PULONG Rvas
+    );
+
 VOID PhReferenceFilePool(
     _Inout_ PPH_FILE_POOL Pool,
     _In_ PVOID Address
@@ -172,4 +207,23 @@ VOID PhSetUserContextFilePool(
     _In_ PULONGLONG Context
     );
 
+NTSTATUS PhCommitFilePool(
+    _Inout_ PPH_FILE_POOL Pool
+    );
+
+NTSTATUS PhCompactFilePool(
+    _Inout_ PPH_FILE_POOL Pool,
+    _In_ PWSTR FileName,
+    _In_opt_ PPH_FILE_POOL_PARAMETERS Parameters,
+    _Out_ PPH_FILE_POOL *NewPool,
+    _Out_ PPH_FILE_POOL_RELOCATION *Relocations,
+    _Out_ PULONG NumberOfRelocations
+    );
+
+ULONG PhRelocateRvaFilePool(
+    _In_reads_(NumberOfRelocations) PPH_FILE_POOL_RELOCATION Relocations,
+    _In_ ULONG NumberOfRelocations,
+    _In_ ULONG Rva
+    );
+
 #endif
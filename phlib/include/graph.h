@@ -11,6 +11,7 @@ extern RECT PhNormalGraphTextPadding;
 #define PH_GRAPH_USE_GRID 0x1
 #define PH_GRAPH_USE_LINE_2 0x10
 #define PH_GRAPH_OVERLAY_LINE_2 0x20
+#define PH_GRAPH_USE_ENVELOPE 0x40
 
 typedef struct _PH_GRAPH_DRAW_INFO
 {
@@ -42,6 +43,10 @@ typedef struct _PH_GRAPH_DRAW_INFO
     RECT TextBoxRect;
     COLORREF TextColor;
     COLORREF TextBoxColor;
+
+    // Envelope (PH_GRAPH_USE_ENVELOPE, PhDrawGraphDirect only)
+    PFLOAT LineDataMinimum1;
+    PFLOAT LineDataMinimum2; // minimum of line 1 + line 2
 } PH_GRAPH_DRAW_INFO, *PPH_GRAPH_DRAW_INFO;
 
 // Graph control
@@ -65,6 +70,14 @@ VOID PhDrawGraphDirect(
     _In_ PPH_GRAPH_DRAW_INFO DrawInfo
     );
 
+#define PH_GRAPH_RENDERER_GDI 0
+#define PH_GRAPH_RENDERER_DIRECT2D 1
+
+PHLIBAPI
+BOOLEAN PhSetGraphRenderer(
+    _In_ ULONG Renderer
+    );
+
 PHLIBAPI
 VOID PhSetGraphText(
     _In_ HDC hdc,
@@ -187,6 +200,61 @@ VOID PhGetDrawInfoGraphBuffers(
     _In_ ULONG DataCount
     );
 
+// Graph envelope
+
+struct _PH_CIRCULAR_BUFFER_FLOAT;
+
+/**
+ * A graph envelope keeps the minimum and maximum of each group of samples in a history, so
+ * that a history longer than the graph is wide can be drawn without losing spikes. Each data
+ * point covers SamplesPerPoint samples, and the newest point may be incomplete.
+ */
+typedef struct _PH_GRAPH_ENVELOPE
+{
+    ULONG SamplesPerPoint;
+    ULONG NumberOfPoints; // the maximum number of points
+    ULONG Count; // the number of valid points
+    ULONG NewestCount; // the number of samples in the newest point
+    LONG Index; // the index of the history at the last update
+    FLOAT NewestTotal; // maximum of line 1 + line 2 in the newest point
+
+    ULONG AllocatedCount;
+    PFLOAT Data1; // maximum of line 1
+    PFLOAT Data2; // maximum of line 1 + line 2, minus Data1
+    PFLOAT Minimum1;
+    PFLOAT Minimum2; // minimum of line 1 + line 2
+} PH_GRAPH_ENVELOPE, *PPH_GRAPH_ENVELOPE;
+
+PHLIBAPI
+VOID PhInitializeGraphEnvelope(
+    _Out_ PPH_GRAPH_ENVELOPE Envelope
+    );
+
+PHLIBAPI
+VOID PhDeleteGraphEnvelope(
+    _Inout_ PPH_GRAPH_ENVELOPE Envelope
+    );
+
+PHLIBAPI
+VOID PhUpdateGraphEnvelope(
+    _Inout_ PPH_GRAPH_ENVELOPE Envelope,
+    _In_ struct _PH_CIRCULAR_BUFFER_FLOAT *History1,
+    _In_opt_ struct _PH_CIRCULAR_BUFFER_FLOAT *History2,
+    _In_ ULONG NumberOfPoints
+    );
+
+PHLIBAPI
+VOID PhGetDrawInfoGraphEnvelope(
+    _In_ PPH_GRAPH_ENVELOPE Envelope,
+    _Inout_ PPH_GRAPH_DRAW_INFO DrawInfo
+    );
+
+PHLIBAPI
+ULONG PhGetSampleIndexGraphEnvelope(
+    _In_ PPH_GRAPH_ENVELOPE Envelope,
+    _In_ ULONG Index
+    );
+
 // Graph control state
 
 // The basic buffer management structure was moved out of this section because
@@ -18,6 +18,45 @@ BOOLEAN PhHexEditInitialization(
 #define HEM_SETSEL (WM_USER + 4)
 #define HEM_SETEDITMODE (WM_USER + 5)
 #define HEM_SETBYTESPERROW (WM_USER + 6)
+#define HEM_SETDATASOURCE (WM_USER + 7)
+#define HEM_FLUSH (WM_USER + 8)
+#define HEM_REFRESH (WM_USER + 9)
+#define HEM_READDATA (WM_USER + 10)
+
+// A data source lets the control show data which is not in memory. The data is read one
+// page at a time as it becomes visible, and pages around the visible area are read ahead
+// on a worker thread. Only pages which have been changed are written back.
+
+#define PH_HEXEDIT_PAGE_SIZE 0x1000
+
+typedef NTSTATUS (NTAPI *PPH_HEXEDIT_READ_PAGE)(
+    _In_ PVOID Context,
+    _In_ ULONG Offset,
+    _Out_writes_bytes_(Length) PVOID Buffer,
+    _In_ ULONG Length
+    );
+
+typedef NTSTATUS (NTAPI *PPH_HEXEDIT_WRITE_PAGE)(
+    _In_ PVOID Context,
+    _In_ ULONG Offset,
+    _In_reads_bytes_(Length) PVOID Buffer,
+    _In_ ULONG Length
+    );
+
+typedef struct _PH_HEXEDIT_DATA_SOURCE
+{
+    ULONG Length;
+    PPH_HEXEDIT_READ_PAGE ReadPage; // may be called from any thread
+    PPH_HEXEDIT_WRITE_PAGE WritePage; // optional
+    PVOID Context;
+} PH_HEXEDIT_DATA_SOURCE, *PPH_HEXEDIT_DATA_SOURCE;
+
+typedef struct _PH_HEXEDIT_READ_DATA
+{
+    ULONG Offset;
+    ULONG Length;
+    PVOID Buffer;
+} PH_HEXEDIT_READ_DATA, *PPH_HEXEDIT_READ_DATA;
 
 #define HexEdit_SetBuffer(hWnd, Buffer, Length) \
     SendMessage((hWnd), HEM_SETBUFFER, (WPARAM)(Length), (LPARAM)(Buffer))
@@ -37,4 +76,16 @@ BOOLEAN PhHexEditInitialization(
 #define HexEdit_SetBytesPerRow(hWnd, BytesPerRow) \
     SendMessage((hWnd), HEM_SETBYTESPERROW, (WPARAM)(BytesPerRow), 0)
 
+#define HexEdit_SetDataSource(hWnd, DataSource) \
+    SendMessage((hWnd), HEM_SETDATASOURCE, 0, (LPARAM)(DataSource))
+
+#define HexEdit_Flush(hWnd) \
+    ((NTSTATUS)SendMessage((hWnd), HEM_FLUSH, 0, 0))
+
+#define HexEdit_Refresh(hWnd) \
+    SendMessage((hWnd), HEM_REFRESH, 0, 0)
+
+#define HexEdit_ReadData(hWnd, ReadData) \
+    SendMessage((hWnd), HEM_READDATA, 0, (LPARAM)(ReadData))
+
 #endif
@@ -1,11 +1,36 @@
 #ifndef _PH_HEXEDITP_H
 #define _PH_HEXEDITP_H
 
+#define PHP_HEXEDIT_CACHE_PAGES 256 // clean pages kept in the cache
+#define PHP_HEXEDIT_PREFETCH_PAGES 16 // pages read ahead around the visible area
+
+typedef struct _PHP_HEXEDIT_PAGE
+{
+    LIST_ENTRY ListEntry;
+    ULONG Index;
+    BOOLEAN Dirty;
+    BOOLEAN Unreadable; // shown as zeros and cannot be changed
+    UCHAR Data[PH_HEXEDIT_PAGE_SIZE];
+} PHP_HEXEDIT_PAGE, *PPHP_HEXEDIT_PAGE;
+
 typedef struct _PHP_HEXEDIT_CONTEXT
 {
     PUCHAR Data;
     LONG Length;
     BOOLEAN UserBuffer;
+
+    HWND WindowHandle;
+    BOOLEAN HasDataSource;
+    PH_HEXEDIT_DATA_SOURCE DataSource;
+    LIST_ENTRY PageListHead; // most recently used first
+    ULONG NumberOfPages;
+    PPHP_HEXEDIT_PAGE LastPage;
+
+    PH_RUNDOWN_PROTECT PrefetchRundown;
+    PH_QUEUED_LOCK PrefetchLock;
+    LIST_ENTRY PrefetchListHead; // pages read ahead but not yet added to the cache
+    BOOLEAN PrefetchPending;
+
     LONG TopIndex; // index of first visible byte on screen
 
     LONG CurrentAddress;
@@ -50,6 +75,15 @@ typedef struct _PHP_HEXEDIT_CONTEXT
 #define REDRAW_WINDOW(hwnd) \
     RedrawWindow((hwnd), NULL, NULL, RDW_INVALIDATE | RDW_UPDATENOW | RDW_ERASE)
 
+#define HEM_PREFETCHCOMPLETE (WM_USER + 100)
+
+typedef struct _PHP_HEXEDIT_PREFETCH
+{
+    PPHP_HEXEDIT_CONTEXT Context;
+    ULONG NumberOfPages;
+    ULONG Indices[PHP_HEXEDIT_PREFETCH_PAGES];
+} PHP_HEXEDIT_PREFETCH, *PPHP_HEXEDIT_PREFETCH;
+
 VOID PhpCreateHexEditContext(
     _Out_ PPHP_HEXEDIT_CONTEXT *Context
     );
@@ -83,6 +117,78 @@ VOID PhpHexEditUpdateScrollbars(
     _In_ PPHP_HEXEDIT_CONTEXT Context
     );
 
+FORCEINLINE BOOLEAN PhpHexEditHasData(
+    _In_ PPHP_HEXEDIT_CONTEXT Context
+    )
+{
+    return Context->Data || Context->HasDataSource;
+}
+
+PPHP_HEXEDIT_PAGE PhpHexEditGetPage(
+    _In_ PPHP_HEXEDIT_CONTEXT Context,
+    _In_ ULONG Index
+    );
+
+FORCEINLINE UCHAR PhpHexEditGetByte(
+    _In_ PPHP_HEXEDIT_CONTEXT Context,
+    _In_ LONG Index
+    )
+{
+    PPHP_HEXEDIT_PAGE page;
+
+    if (!Context->HasDataSource)
+        return Context->Data[Index];
+
+    page = Context->LastPage;
+
+    if (!page || page->Index != (ULONG)Index / PH_HEXEDIT_PAGE_SIZE)
+        page = PhpHexEditGetPage(Context, (ULONG)Index / PH_HEXEDIT_PAGE_SIZE);
+
+    return page->Data[(ULONG)Index % PH_HEXEDIT_PAGE_SIZE];
+}
+
+VOID PhpHexEditSetByte(
+    _In_ PPHP_HEXEDIT_CONTEXT Context,
+    _In_ LONG Index,
+    _In_ UCHAR Byte
+    );
+
+VOID PhpHexEditReadRange(
+    _In_ PPHP_HEXEDIT_CONTEXT Context,
+    _In_ LONG Offset,
+    _Out_writes_bytes_(Length) PVOID Buffer,
+    _In_ ULONG Length
+    );
+
+VOID PhpHexEditWriteRange(
+    _In_ PPHP_HEXEDIT_CONTEXT Context,
+    _In_ LONG Offset,
+    _In_reads_bytes_(Length) PVOID Buffer,
+    _In_ ULONG Length
+    );
+
+VOID PhpHexEditSetDataSource(
+    _In_ HWND hwnd,
+    _In_ PPHP_HEXEDIT_CONTEXT Context,
+    _In_opt_ PPH_HEXEDIT_DATA_SOURCE DataSource
+    );
+
+VOID PhpHexEditDeletePages(
+    _In_ PPHP_HEXEDIT_CONTEXT Context
+    );
+
+NTSTATUS PhpHexEditFlush(
+    _In_ PPHP_HEXEDIT_CONTEXT Context
+    );
+
+VOID PhpHexEditPrefetch(
+    _In_ PPHP_HEXEDIT_CONTEXT Context
+    );
+
+VOID PhpHexEditCompletePrefetch(
+    _In_ PPHP_HEXEDIT_CONTEXT Context
+    );
+
 FORCEINLINE BOOLEAN PhpHexEditHasSelected(
     _In_ PPHP_HEXEDIT_CONTEXT Context
     )
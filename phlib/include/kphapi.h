@@ -48,6 +48,41 @@ typedef struct _KPH_PROCESS_HANDLE_INFORMATION
     KPH_PROCESS_HANDLE Handles[1];
 } KPH_PROCESS_HANDLE_INFORMATION, *PKPH_PROCESS_HANDLE_INFORMATION;
 
+// Handle values in a process handle table always fit in 32 bits.
+typedef struct _KPH_PROCESS_HANDLE_COMPACT
+{
+    ULONG Handle;
+    ACCESS_MASK GrantedAccess;
+    USHORT ObjectTypeIndex;
+    USHORT HandleAttributes;
+} KPH_PROCESS_HANDLE_COMPACT, *PKPH_PROCESS_HANDLE_COMPACT;
+
+typedef struct _KPH_PROCESS_HANDLE_COMPACT_INFORMATION
+{
+    ULONG HandleCount;
+    KPH_PROCESS_HANDLE_COMPACT Handles[1];
+} KPH_PROCESS_HANDLE_COMPACT_INFORMATION, *PKPH_PROCESS_HANDLE_COMPACT_INFORMATION;
+
+#define KPH_HANDLE_FILTER_OBJECT_TYPE 0x1 // only include handles whose type is in ObjectTypeMask
+#define KPH_HANDLE_FILTER_HANDLE_RANGE 0x2 // only include handles from MinimumHandle to MaximumHandle
+#define KPH_HANDLE_FILTER_COMPACT 0x4 // return KPH_PROCESS_HANDLE_COMPACT_INFORMATION
+#define KPH_HANDLE_FILTER_VALID_FLAGS 0x7
+
+#define KPH_HANDLE_FILTER_MAX_TYPE_INDEX 256
+
+typedef struct _KPH_HANDLE_FILTER
+{
+    ULONG Flags;
+    ULONG ObjectTypeMask[KPH_HANDLE_FILTER_MAX_TYPE_INDEX / 32];
+    HANDLE MinimumHandle;
+    HANDLE MaximumHandle;
+} KPH_HANDLE_FILTER, *PKPH_HANDLE_FILTER;
+
+#define KPH_HANDLE_FILTER_SET_TYPE(Filter, TypeIndex) \
+    ((Filter)->ObjectTypeMask[(TypeIndex) / 32] |= 1UL << ((TypeIndex) % 32))
+#define KPH_HANDLE_FILTER_TEST_TYPE(Filter, TypeIndex) \
+    (((Filter)->ObjectTypeMask[(TypeIndex) / 32] & (1UL << ((TypeIndex) % 32))) != 0)
+
 // Object information
 
 typedef enum _KPH_OBJECT_INFORMATION_CLASS
@@ -83,6 +118,27 @@ typedef struct _KPH_FILE_OBJECT_DRIVER
     HANDLE DriverHandle;
 } KPH_FILE_OBJECT_DRIVER, *PKPH_FILE_OBJECT_DRIVER;
 
+// Batched object information
+
+#define KPH_OBJECT_BATCH_LIMIT 1024
+
+typedef struct _KPH_OBJECT_BATCH_ENTRY
+{
+    HANDLE Handle;
+    NTSTATUS Status; // if this is not successful, the remaining fields are not valid
+    OBJECT_BASIC_INFORMATION BasicInformation;
+    USHORT ObjectTypeIndex;
+    USHORT NameLength; // in bytes
+    NTSTATUS NameStatus;
+    ULONG NameOffset; // from the start of the buffer, not null-terminated
+} KPH_OBJECT_BATCH_ENTRY, *PKPH_OBJECT_BATCH_ENTRY;
+
+typedef struct _KPH_OBJECT_BATCH_INFORMATION
+{
+    ULONG NumberOfEntries;
+    KPH_OBJECT_BATCH_ENTRY Entries[1];
+} KPH_OBJECT_BATCH_INFORMATION, *PKPH_OBJECT_BATCH_INFORMATION;
+
 // Driver information
 
 typedef enum _DRIVER_INFORMATION_CLASS
@@ -172,12 +228,105 @@ typedef struct _KPH_DYN_CONFIGURATION
 
 // No features defined.
 
+// Batches
+
+#define KPH_BATCH_MAXIMUM_OPERATIONS 16
+
+typedef struct _KPH_BATCH_OPERATION
+{
+    ULONG ControlCode;
+    ULONG InputLength;
+    PVOID Input;
+    NTSTATUS Status;
+} KPH_BATCH_OPERATION, *PKPH_BATCH_OPERATION;
+
+// Virtual memory
+
+#define KPH_VM_READ_MAXIMUM_RANGES 256
+
+typedef struct _KPH_VM_READ_RANGE
+{
+    PVOID BaseAddress;
+    SIZE_T Length;
+    NTSTATUS Status; // output
+    SIZE_T NumberOfBytesRead; // output
+} KPH_VM_READ_RANGE, *PKPH_VM_READ_RANGE;
+
+// Process enumeration
+
+#define KPH_PROCESS_ID_LIMIT 0x40000
+
+#define KPH_PROCESS_ENTRY_EXITED 0x1
+
+typedef struct _KPH_PROCESS_ENTRY
+{
+    HANDLE ProcessId;
+    PVOID Object;
+    LARGE_INTEGER CreateTime;
+    ULONG Flags;
+    CHAR ImageFileName[16];
+} KPH_PROCESS_ENTRY, *PKPH_PROCESS_ENTRY;
+
+typedef struct _KPH_PROCESS_LIST
+{
+    ULONG NumberOfProcesses;
+    KPH_PROCESS_ENTRY Processes[1];
+} KPH_PROCESS_LIST, *PKPH_PROCESS_LIST;
+
+// Stack traces
+
+typedef struct _KPH_THREAD_BACKTRACE
+{
+    ULONG NextEntryOffset;
+    NTSTATUS Status;
+    HANDLE ThreadId;
+    ULONG NumberOfKernelFrames;
+    ULONG NumberOfUserFrames;
+    PVOID Frames[1]; // kernel-mode frames, then user-mode frames
+} KPH_THREAD_BACKTRACE, *PKPH_THREAD_BACKTRACE;
+
+// Events
+
+#define KPH_EVENT_RING_NUMBER_OF_ENTRIES 4096 // must be a power of two
+
+typedef enum _KPH_EVENT_TYPE
+{
+    KphEventProcessCreate = 1, // ProcessId, ParentProcessId, ImageFileName
+    KphEventProcessExit, // ProcessId
+    KphEventThreadCreate, // ProcessId, ThreadId
+    KphEventThreadExit, // ProcessId, ThreadId
+    KphEventImageLoad // ProcessId, ImageBase, ImageSize
+} KPH_EVENT_TYPE;
+
+typedef struct _KPH_EVENT
+{
+    // The position of the event plus one once the event has been written.
+    volatile ULONG Sequence;
+    KPH_EVENT_TYPE Type;
+    LARGE_INTEGER Time;
+    HANDLE ProcessId;
+    HANDLE ParentProcessId;
+    HANDLE ThreadId;
+    PVOID ImageBase;
+    SIZE_T ImageSize;
+    CHAR ImageFileName[16];
+} KPH_EVENT, *PKPH_EVENT;
+
+typedef struct _KPH_EVENT_RING
+{
+    // The number of events that have been written or are being written.
+    volatile ULONG Head;
+    ULONG NumberOfEntries;
+    KPH_EVENT Entries[KPH_EVENT_RING_NUMBER_OF_ENTRIES];
+} KPH_EVENT_RING, *PKPH_EVENT_RING;
+
 // Control codes
 
 #define KPH_CTL_CODE(x) CTL_CODE(KPH_DEVICE_TYPE, 0x800 + x, METHOD_NEITHER, FILE_ANY_ACCESS)
 
 // General
 #define KPH_GETFEATURES KPH_CTL_CODE(0)
+#define KPH_BATCH KPH_CTL_CODE(1)
 
 // Processes
 #define KPH_OPENPROCESS KPH_CTL_CODE(50)
@@ -191,6 +340,9 @@ typedef struct _KPH_DYN_CONFIGURATION
 #define KPH_READVIRTUALMEMORYUNSAFE KPH_CTL_CODE(58)
 #define KPH_QUERYINFORMATIONPROCESS KPH_CTL_CODE(59)
 #define KPH_SETINFORMATIONPROCESS KPH_CTL_CODE(60)
+#define KPH_READVIRTUALMEMORYSCATTER KPH_CTL_CODE(61)
+#define KPH_CAPTURESTACKBACKTRACEPROCESS KPH_CTL_CODE(62)
+#define KPH_ENUMERATEPROCESSES KPH_CTL_CODE(63)
 
 // Threads
 #define KPH_OPENTHREAD KPH_CTL_CODE(100)
@@ -208,9 +360,14 @@ typedef struct _KPH_DYN_CONFIGURATION
 #define KPH_QUERYINFORMATIONOBJECT KPH_CTL_CODE(151)
 #define KPH_SETINFORMATIONOBJECT KPH_CTL_CODE(152)
 #define KPH_DUPLICATEOBJECT KPH_CTL_CODE(153)
+#define KPH_ENUMERATEPROCESSHANDLESEX KPH_CTL_CODE(154)
+#define KPH_QUERYINFORMATIONOBJECTS KPH_CTL_CODE(155)
 
 // Misc.
 #define KPH_OPENDRIVER KPH_CTL_CODE(200)
 #define KPH_QUERYINFORMATIONDRIVER KPH_CTL_CODE(201)
 
+// Events
+#define KPH_MAPEVENTRING KPH_CTL_CODE(250)
+
 #endif
\ No newline at end of file
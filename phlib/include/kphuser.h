@@ -149,6 +149,24 @@ KphReadVirtualMemoryUnsafe(
     _Out_opt_ PSIZE_T NumberOfBytesRead
     );
 
+NTSTATUS
+NTAPI
+KphReadVirtualMemoryScatter(
+    _In_ HANDLE ProcessHandle,
+    _Inout_updates_(NumberOfRanges) PKPH_VM_READ_RANGE Ranges,
+    _In_ ULONG NumberOfRanges,
+    _Out_writes_bytes_(BufferSize) PVOID Buffer,
+    _In_ SIZE_T BufferSize
+    );
+
+NTSTATUS
+NTAPI
+KphEnumerateProcesses(
+    _Out_writes_bytes_(BufferLength) PVOID Buffer,
+    _In_ ULONG BufferLength,
+    _Out_opt_ PULONG ReturnLength
+    );
+
 NTSTATUS
 NTAPI
 KphQueryInformationProcess(
@@ -223,6 +241,17 @@ KphCaptureStackBackTraceThread(
     _Out_opt_ PULONG BackTraceHash
     );
 
+NTSTATUS
+NTAPI
+KphCaptureStackBackTraceProcess(
+    _In_ HANDLE ProcessHandle,
+    _In_ ULONG FramesToSkip,
+    _In_ ULONG FramesToCapture,
+    _Out_writes_bytes_(BufferLength) PVOID Buffer,
+    _In_ ULONG BufferLength,
+    _Out_opt_ PULONG ReturnLength
+    );
+
 NTSTATUS
 NTAPI
 KphQueryInformationThread(
@@ -258,6 +287,24 @@ KphEnumerateProcessHandles2(
     _Out_ PKPH_PROCESS_HANDLE_INFORMATION *Handles
     );
 
+NTSTATUS
+NTAPI
+KphEnumerateProcessHandlesEx(
+    _In_ HANDLE ProcessHandle,
+    _In_opt_ PKPH_HANDLE_FILTER Filter,
+    _Out_writes_bytes_(BufferLength) PVOID Buffer,
+    _In_opt_ ULONG BufferLength,
+    _Out_opt_ PULONG ReturnLength
+    );
+
+NTSTATUS
+NTAPI
+KphEnumerateProcessHandlesEx2(
+    _In_ HANDLE ProcessHandle,
+    _In_opt_ PKPH_HANDLE_FILTER Filter,
+    _Out_ PVOID *Handles
+    );
+
 NTSTATUS
 NTAPI
 KphQueryInformationObject(
@@ -269,6 +316,26 @@ KphQueryInformationObject(
     _Out_opt_ PULONG ReturnLength
     );
 
+NTSTATUS
+NTAPI
+KphQueryInformationObjects(
+    _In_ HANDLE ProcessHandle,
+    _In_reads_(NumberOfHandles) PHANDLE Handles,
+    _In_ ULONG NumberOfHandles,
+    _Out_writes_bytes_(BufferLength) PVOID Buffer,
+    _In_ ULONG BufferLength,
+    _Out_opt_ PULONG ReturnLength
+    );
+
+NTSTATUS
+NTAPI
+KphQueryInformationObjects2(
+    _In_ HANDLE ProcessHandle,
+    _In_reads_(NumberOfHandles) PHANDLE Handles,
+    _In_ ULONG NumberOfHandles,
+    _Out_ PKPH_OBJECT_BATCH_INFORMATION *Information
+    );
+
 NTSTATUS
 NTAPI
 KphSetInformationObject(
@@ -308,6 +375,105 @@ KphQueryInformationDriver(
     _Out_opt_ PULONG ReturnLength
     );
 
+// Batches let several independent requests be sent to the driver at once. The
+// batch must not be moved after operations have been added to it.
+
+typedef struct _KPH_BATCH
+{
+    ULONG NumberOfOperations;
+    KPH_BATCH_OPERATION Operations[KPH_BATCH_MAXIMUM_OPERATIONS];
+    ULONG_PTR Inputs[KPH_BATCH_MAXIMUM_OPERATIONS][16];
+} KPH_BATCH, *PKPH_BATCH;
+
+FORCEINLINE
+VOID
+KphInitializeBatch(
+    _Out_ PKPH_BATCH Batch
+    )
+{
+    Batch->NumberOfOperations = 0;
+}
+
+NTSTATUS
+NTAPI
+KphAddBatchOperation(
+    _Inout_ PKPH_BATCH Batch,
+    _In_ ULONG KphControlCode,
+    _In_reads_bytes_(InputLength) PVOID Input,
+    _In_ ULONG InputLength,
+    _Out_opt_ PULONG Index
+    );
+
+NTSTATUS
+NTAPI
+KphBatchOpenProcess(
+    _Inout_ PKPH_BATCH Batch,
+    _Out_ PHANDLE ProcessHandle,
+    _In_ ACCESS_MASK DesiredAccess,
+    _In_ PCLIENT_ID ClientId,
+    _Out_opt_ PULONG Index
+    );
+
+NTSTATUS
+NTAPI
+KphBatchQueryInformationProcess(
+    _Inout_ PKPH_BATCH Batch,
+    _In_ HANDLE ProcessHandle,
+    _In_ KPH_PROCESS_INFORMATION_CLASS ProcessInformationClass,
+    _Out_writes_bytes_(ProcessInformationLength) PVOID ProcessInformation,
+    _In_ ULONG ProcessInformationLength,
+    _Out_opt_ PULONG ReturnLength,
+    _Out_opt_ PULONG Index
+    );
+
+NTSTATUS
+NTAPI
+KphBatchQueryInformationThread(
+    _Inout_ PKPH_BATCH Batch,
+    _In_ HANDLE ThreadHandle,
+    _In_ KPH_THREAD_INFORMATION_CLASS ThreadInformationClass,
+    _Out_writes_bytes_(ThreadInformationLength) PVOID ThreadInformation,
+    _In_ ULONG ThreadInformationLength,
+    _Out_opt_ PULONG ReturnLength,
+    _Out_opt_ PULONG Index
+    );
+
+NTSTATUS
+NTAPI
+KphExecuteBatch(
+    _Inout_ PKPH_BATCH Batch
+    );
+
+NTSTATUS
+NTAPI
+KphMapEventRing(
+    _Out_ PKPH_EVENT_RING *EventRing
+    );
+
+typedef struct _KPH_EVENT_READER
+{
+    PKPH_EVENT_RING Ring;
+    ULONG Position;
+} KPH_EVENT_READER, *PKPH_EVENT_READER;
+
+FORCEINLINE
+VOID
+KphInitializeEventReader(
+    _Out_ PKPH_EVENT_READER Reader,
+    _In_ PKPH_EVENT_RING Ring
+    )
+{
+    Reader->Ring = Ring;
+    Reader->Position = Ring->Head;
+}
+
+NTSTATUS
+NTAPI
+KphReadEvent(
+    _Inout_ PKPH_EVENT_READER Reader,
+    _Out_ PKPH_EVENT Event
+    );
+
 // kphdata
 
 NTSTATUS
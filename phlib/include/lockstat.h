@@ -0,0 +1,150 @@
+#ifndef _PH_LOCKSTAT_H
+#define _PH_LOCKSTAT_H
+
+// Lock statistics record acquire counts, contention, wait times and hold times
+// for queued locks and fast locks. They are compiled in when PH_LOCK_STATISTICS
+// is defined (the default for debug builds), are only recorded for locks
+// registered with PhRegisterLockStatistics, and only while recording has been
+// turned on with PhSetLockStatisticsEnabled.
+
+#if defined(DEBUG) && !defined(PH_LOCK_STATISTICS)
+#define PH_LOCK_STATISTICS
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PH_LOCK_STATISTICS_MAXIMUM_NAMES 64
+
+typedef struct _PH_LOCK_STATISTICS
+{
+    PWSTR Name;
+    ULONG NumberOfLocks;
+    ULONG64 ExclusiveAcquireCount;
+    ULONG64 SharedAcquireCount;
+    ULONG64 ContendedCount;
+    /** The total time spent waiting for the lock, in microseconds. */
+    ULONG64 TotalWaitTime;
+    /** The longest time the lock was held in exclusive mode, in microseconds. */
+    ULONG64 MaximumHoldTime;
+} PH_LOCK_STATISTICS, *PPH_LOCK_STATISTICS;
+
+typedef struct _PH_LOCK_STATISTICS_INFORMATION
+{
+    BOOLEAN Available;
+    BOOLEAN Enabled;
+    ULONG NumberOfEntries;
+    PH_LOCK_STATISTICS Entries[PH_LOCK_STATISTICS_MAXIMUM_NAMES];
+} PH_LOCK_STATISTICS_INFORMATION, *PPH_LOCK_STATISTICS_INFORMATION;
+
+PHLIBAPI
+VOID
+NTAPI
+PhGetLockStatistics(
+    _Out_ PPH_LOCK_STATISTICS_INFORMATION Information
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhSetLockStatisticsEnabled(
+    _In_ BOOLEAN Enabled
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhResetLockStatistics(
+    VOID
+    );
+
+#ifdef PH_LOCK_STATISTICS
+
+PHLIBAPI extern BOOLEAN PhLockStatisticsEnabled;
+
+PHLIBAPI
+VOID
+NTAPI
+PhRegisterLockStatistics(
+    _In_ PVOID Lock,
+    _In_ PWSTR Name
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhUnregisterLockStatistics(
+    _In_ PVOID Lock
+    );
+
+PHLIBAPI
+VOID
+FASTCALL
+PhfRecordLockAcquire(
+    _In_ PVOID Lock,
+    _In_ BOOLEAN Exclusive,
+    _In_ ULONG64 WaitStartTime
+    );
+
+PHLIBAPI
+VOID
+FASTCALL
+PhfRecordLockRelease(
+    _In_ PVOID Lock
+    );
+
+#else
+
+#define PhRegisterLockStatistics(Lock, Name)
+#define PhUnregisterLockStatistics(Lock)
+
+#endif
+
+// Hooks used by the lock implementations. These compile to nothing when lock statistics
+// are not available.
+
+FORCEINLINE ULONG64 PhBeginLockWait(
+    VOID
+    )
+{
+#ifdef PH_LOCK_STATISTICS
+    LARGE_INTEGER performanceCounter;
+
+    if (PhLockStatisticsEnabled)
+    {
+        NtQueryPerformanceCounter(&performanceCounter, NULL);
+        return performanceCounter.QuadPart;
+    }
+#endif
+
+    return 0;
+}
+
+FORCEINLINE VOID PhRecordLockAcquire(
+    _In_ PVOID Lock,
+    _In_ BOOLEAN Exclusive,
+    _In_ ULONG64 WaitStartTime
+    )
+{
+#ifdef PH_LOCK_STATISTICS
+    if (PhLockStatisticsEnabled)
+        PhfRecordLockAcquire(Lock, Exclusive, WaitStartTime);
+#endif
+}
+
+FORCEINLINE VOID PhRecordLockRelease(
+    _In_ PVOID Lock
+    )
+{
+#ifdef PH_LOCK_STATISTICS
+    if (PhLockStatisticsEnabled)
+        PhfRecordLockRelease(Lock);
+#endif
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
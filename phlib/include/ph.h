@@ -177,6 +177,25 @@ PhReadVirtualMemory(
     _Out_opt_ PSIZE_T NumberOfBytesRead
     );
 
+typedef struct _PH_VIRTUAL_MEMORY_RANGE
+{
+    PVOID BaseAddress;
+    SIZE_T Length;
+    NTSTATUS Status; // output
+    SIZE_T NumberOfBytesRead; // output
+} PH_VIRTUAL_MEMORY_RANGE, *PPH_VIRTUAL_MEMORY_RANGE;
+
+PHLIBAPI
+NTSTATUS
+NTAPI
+PhReadVirtualMemoryScatter(
+    _In_ HANDLE ProcessHandle,
+    _Inout_updates_(NumberOfRanges) PPH_VIRTUAL_MEMORY_RANGE Ranges,
+    _In_ ULONG NumberOfRanges,
+    _Out_writes_bytes_(BufferSize) PVOID Buffer,
+    _In_ SIZE_T BufferSize
+    );
+
 PHLIBAPI
 NTSTATUS
 NTAPI
@@ -711,6 +730,14 @@ PhEnumKernelModules(
     _Out_ PRTL_PROCESS_MODULES *Modules
     );
 
+PHLIBAPI
+NTSTATUS
+NTAPI
+PhGetKernelModulesChecksum(
+    _Out_ PULONG NumberOfModules,
+    _Out_ PULONG Checksum
+    );
+
 NTSTATUS
 NTAPI
 PhEnumKernelModulesEx(
@@ -773,6 +800,75 @@ PhEnumProcessesForSession(
     _In_ ULONG SessionId
     );
 
+#define PH_PROCESS_SNAPSHOT_INITIAL_SIZE 0x10000
+#define PH_PROCESS_SNAPSHOT_SHRINK_THRESHOLD 16
+
+/**
+ * A reusable process snapshot. Two page-aligned buffers are used
+ * alternately, so the buffer returned by the previous update remains
+ * valid while the next one is being filled. The buffers can be
+ * allocated from an arena in order to use large pages.
+ */
+typedef struct _PH_PROCESS_SNAPSHOT
+{
+    SYSTEM_INFORMATION_CLASS SystemInformationClass;
+    ULONG SessionId;
+    ULONG CurrentIndex;
+    ULONG ShrinkCount;
+    ULONG DataLength;
+    PVOID Buffers[2];
+    SIZE_T BufferSizes[2];
+    PPH_ARENA Arena;
+} PH_PROCESS_SNAPSHOT, *PPH_PROCESS_SNAPSHOT;
+
+PHLIBAPI
+VOID
+NTAPI
+PhInitializeProcessSnapshot(
+    _Out_ PPH_PROCESS_SNAPSHOT Snapshot,
+    _In_ SYSTEM_INFORMATION_CLASS SystemInformationClass
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhInitializeProcessSnapshotEx(
+    _Out_ PPH_PROCESS_SNAPSHOT Snapshot,
+    _In_ SYSTEM_INFORMATION_CLASS SystemInformationClass,
+    _In_opt_ PPH_ARENA Arena
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhInitializeProcessSnapshotForSession(
+    _Out_ PPH_PROCESS_SNAPSHOT Snapshot,
+    _In_ ULONG SessionId
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhDeleteProcessSnapshot(
+    _Inout_ PPH_PROCESS_SNAPSHOT Snapshot
+    );
+
+PHLIBAPI
+NTSTATUS
+NTAPI
+PhUpdateProcessSnapshot(
+    _Inout_ PPH_PROCESS_SNAPSHOT Snapshot,
+    _Out_ PVOID *Processes
+    );
+
+PHLIBAPI
+BOOLEAN
+NTAPI
+PhDetachProcessSnapshotBuffer(
+    _Inout_ PPH_PROCESS_SNAPSHOT Snapshot,
+    _In_ PVOID Buffer
+    );
+
 PHLIBAPI
 PSYSTEM_PROCESS_INFORMATION
 NTAPI
@@ -1114,6 +1210,21 @@ PhGetSidFullName(
     _Out_opt_ PSID_NAME_USE NameUse
     );
 
+PHLIBAPI
+NTSTATUS
+NTAPI
+PhLookupSidsToCache(
+    _In_ ULONG Count,
+    _In_reads_(Count) PSID *Sids
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhFlushSidCache(
+    VOID
+    );
+
 PHLIBAPI
 PPH_STRING
 NTAPI
@@ -1254,6 +1365,35 @@ PhCallKphDuplicateObjectWithTimeout(
     _In_ ULONG Options
     );
 
+typedef struct _PH_HANDLE_NAME_QUERY
+{
+    HANDLE Handle;
+    ULONG ObjectTypeNumber;
+    PVOID Context;
+
+    NTSTATUS Status;
+    PPH_STRING TypeName;
+    PPH_STRING ObjectName;
+    PPH_STRING BestObjectName;
+} PH_HANDLE_NAME_QUERY, *PPH_HANDLE_NAME_QUERY;
+
+typedef VOID (NTAPI *PPH_HANDLE_NAME_QUERY_CALLBACK)(
+    _Inout_ PPH_HANDLE_NAME_QUERY Query,
+    _In_opt_ PVOID Context
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhQueryHandleNamesWithTimeout(
+    _In_ HANDLE ProcessHandle,
+    _Inout_updates_(Count) PPH_HANDLE_NAME_QUERY Queries,
+    _In_ ULONG Count,
+    _In_opt_ ULONG Timeout,
+    _In_opt_ PPH_HANDLE_NAME_QUERY_CALLBACK Callback,
+    _In_opt_ PVOID Context
+    );
+
 // mapimg
 
 typedef struct _PH_MAPPED_IMAGE
@@ -1442,6 +1582,17 @@ PhGetMappedImageExportFunctionRemote(
     _Out_ PVOID *Function
     );
 
+PHLIBAPI
+NTSTATUS
+NTAPI
+PhGetImageExportRvaCached(
+    _In_ PWSTR FileName,
+    _In_opt_ PSTR ProcedureName,
+    _In_opt_ USHORT ProcedureNumber,
+    _Out_ PULONG Rva,
+    _Out_opt_ PUSHORT Magic
+    );
+
 #define PH_MAPPED_IMAGE_DELAY_IMPORTS 0x1
 
 typedef struct _PH_MAPPED_IMAGE_IMPORTS
@@ -1928,10 +2079,8 @@ PhWriteStringFormatAsUtf8FileStream(
 
 // provider
 
-#if defined(DEBUG)
 extern PPH_LIST PhDbgProviderList;
 extern PH_QUEUED_LOCK PhDbgProviderListLock;
-#endif
 
 typedef enum _PH_PROVIDER_THREAD_STATE
 {
@@ -1947,6 +2096,10 @@ typedef VOID (NTAPI *PPH_PROVIDER_FUNCTION)(
 struct _PH_PROVIDER_THREAD;
 typedef struct _PH_PROVIDER_THREAD *PPH_PROVIDER_THREAD;
 
+// Bucket 0 counts runs shorter than 1ms, bucket i counts runs of [2^(i-1), 2^i) ms, and the last
+// bucket counts everything longer.
+#define PH_PROVIDER_RUN_TIME_BUCKETS 16
+
 typedef struct _PH_PROVIDER_REGISTRATION
 {
     LIST_ENTRY ListEntry;
@@ -1957,6 +2110,15 @@ typedef struct _PH_PROVIDER_REGISTRATION
     BOOLEAN Enabled;
     BOOLEAN Unregistering;
     BOOLEAN Boosting;
+    BOOLEAN Background;
+
+    ULONG Interval; // 0 to run at the interval of the provider thread
+    ULONG EffectiveInterval; // Interval after adjusting for the run time, or 0
+    ULONG64 LastRunTickCount;
+    ULONG AverageRunTime; // in microseconds
+    ULONG LastRunTime; // in microseconds
+    ULONG Lag; // milliseconds by which the last scheduled run started late
+    ULONG RunTimeHistogram[PH_PROVIDER_RUN_TIME_BUCKETS];
 } PH_PROVIDER_REGISTRATION, *PPH_PROVIDER_REGISTRATION;
 
 typedef struct _PH_PROVIDER_THREAD
@@ -1964,6 +2126,7 @@ typedef struct _PH_PROVIDER_THREAD
     HANDLE ThreadHandle;
     HANDLE TimerHandle;
     ULONG Interval;
+    ULONG BackgroundInterval; // 0 if not in background mode
     PH_PROVIDER_THREAD_STATE State;
 
     PH_QUEUED_LOCK Lock;
@@ -2008,6 +2171,14 @@ PhSetIntervalProviderThread(
     _In_ ULONG Interval
     );
 
+PHLIBAPI
+VOID
+NTAPI
+PhSetBackgroundModeProviderThread(
+    _Inout_ PPH_PROVIDER_THREAD ProviderThread,
+    _In_ ULONG BackgroundInterval
+    );
+
 PHLIBAPI
 VOID
 NTAPI
@@ -2055,6 +2226,22 @@ PhSetEnabledProvider(
     _In_ BOOLEAN Enabled
     );
 
+PHLIBAPI
+VOID
+NTAPI
+PhSetBackgroundProvider(
+    _Inout_ PPH_PROVIDER_REGISTRATION Registration,
+    _In_ BOOLEAN Background
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhSetIntervalProvider(
+    _Inout_ PPH_PROVIDER_REGISTRATION Registration,
+    _In_ ULONG Interval
+    );
+
 // svcsup
 
 extern WCHAR *PhServiceTypeStrings[10];
@@ -3117,7 +3304,8 @@ typedef enum _PH_HASH_ALGORITHM
 {
     Md5HashAlgorithm,
     Sha1HashAlgorithm,
-    Crc32HashAlgorithm
+    Crc32HashAlgorithm,
+    Sha256HashAlgorithm
 } PH_HASH_ALGORITHM;
 
 typedef struct _PH_HASH_CONTEXT
@@ -3143,6 +3331,16 @@ PhUpdateHash(
     _In_ ULONG Length
     );
 
+PHLIBAPI
+VOID
+NTAPI
+PhUpdateHashMultiple(
+    _Inout_updates_(Count) PPH_HASH_CONTEXT *Contexts,
+    _In_reads_(Count) PVOID *Buffers,
+    _In_ ULONG Length,
+    _In_ ULONG Count
+    );
+
 PHLIBAPI
 BOOLEAN
 NTAPI
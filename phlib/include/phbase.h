@@ -38,6 +38,8 @@
 #include <phnt.h>
 #include <phsup.h>
 #include <ref.h>
+#include <lockstat.h>
+#include <trace.h>
 #include <fastlock.h>
 #include <queuedlock.h>
 
@@ -125,6 +127,8 @@ PHLIBAPI extern ACCESS_MASK ThreadAllAccess;
 // Misc.
 /** Retrieves token information (e.g. elevation status). */
 #define PHLIB_INIT_TOKEN_INFO 0x100000
+/** Serves small allocations from the slab allocator instead of the heap. */
+#define PHLIB_INIT_SLAB_ALLOCATOR 0x200000
 
 NTSTATUS
 PhInitializePhLib(
@@ -353,6 +357,36 @@ PhFreePage(
     _Frees_ptr_opt_ PVOID Memory
     );
 
+// Slab allocator
+
+#define PH_SLAB_NUMBER_OF_CLASSES 15
+/** The largest allocation size served by the slab allocator. */
+#define PH_SLAB_MAXIMUM_SIZE 1024
+
+typedef struct _PH_SLAB_CLASS_STATISTICS
+{
+    ULONG BlockSize;
+    ULONG NumberOfSlabs;
+    ULONG64 Allocations;
+    ULONG64 Frees;
+} PH_SLAB_CLASS_STATISTICS, *PPH_SLAB_CLASS_STATISTICS;
+
+typedef struct _PH_SLAB_STATISTICS
+{
+    BOOLEAN Enabled;
+    ULONG NumberOfThreadCaches;
+    SIZE_T ReservedSize;
+    SIZE_T CommittedSize;
+    PH_SLAB_CLASS_STATISTICS Classes[PH_SLAB_NUMBER_OF_CLASSES];
+} PH_SLAB_STATISTICS, *PPH_SLAB_STATISTICS;
+
+PHLIBAPI
+VOID
+NTAPI
+PhGetSlabStatistics(
+    _Out_ PPH_SLAB_STATISTICS Statistics
+    );
+
 FORCEINLINE
 PVOID
 PhAllocateCopy(
@@ -1911,6 +1945,24 @@ PhCreateBytes2(
     return PhCreateBytesEx(Bytes->Buffer, Bytes->Length);
 }
 
+// Sort keys
+
+PHLIBAPI
+PPH_BYTES
+NTAPI
+PhCreateNaturalSortKey(
+    _In_ PPH_STRINGREF String,
+    _In_ BOOLEAN IgnoreCase
+    );
+
+PHLIBAPI
+LONG
+NTAPI
+PhCompareNaturalSortKey(
+    _In_ PPH_BYTES Key1,
+    _In_ PPH_BYTES Key2
+    );
+
 // Unicode
 
 #define PH_UNICODE_BYTE_ORDER_MARK 0xfeff
@@ -2173,6 +2225,11 @@ typedef struct _PH_STRING_BUILDER
      * correct length.
      */
     PPH_STRING String;
+    /**
+     * The storage passed to PhInitializeStringBuilderInline(), or NULL. While this is set,
+     * \a String points into the storage and is not an object.
+     */
+    PVOID InlineStorage;
 } PH_STRING_BUILDER, *PPH_STRING_BUILDER;
 
 PHLIBAPI
@@ -2183,6 +2240,23 @@ PhInitializeStringBuilder(
     _In_ SIZE_T InitialCapacity
     );
 
+PHLIBAPI
+VOID
+NTAPI
+PhInitializeStringBuilderInline(
+    _Out_ PPH_STRING_BUILDER StringBuilder,
+    _Out_writes_bytes_(StorageSize) PVOID Storage,
+    _In_ SIZE_T StorageSize
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhReserveStringBuilder(
+    _Inout_ PPH_STRING_BUILDER StringBuilder,
+    _In_ SIZE_T Length
+    );
+
 PHLIBAPI
 VOID
 NTAPI
@@ -2197,6 +2271,16 @@ PhFinalStringBuilderString(
     _Inout_ PPH_STRING_BUILDER StringBuilder
     );
 
+PHLIBAPI
+BOOLEAN
+NTAPI
+PhFinalStringBuilderToBuffer(
+    _Inout_ PPH_STRING_BUILDER StringBuilder,
+    _Out_writes_bytes_opt_(BufferLength) PWSTR Buffer,
+    _In_opt_ SIZE_T BufferLength,
+    _Out_opt_ PSIZE_T ReturnLength
+    );
+
 PHLIBAPI
 VOID
 NTAPI
@@ -2505,6 +2589,43 @@ typedef LONG (NTAPI *PPH_COMPARE_FUNCTION)(
     _In_opt_ PVOID Context
     );
 
+// Incremental sorting
+
+/** Arrays smaller than this are always sorted in full. */
+#define PH_INCREMENTAL_SORT_MINIMUM_COUNT 32
+/** The array is sorted in full when more than 1/n of its items are out of order. */
+#define PH_INCREMENTAL_SORT_CHURN_DIVISOR 8
+
+typedef int (__cdecl *PPH_SORT_ITEMS_SIMPLE_FUNCTION)(
+    _In_ const void *Item1,
+    _In_ const void *Item2
+    );
+
+typedef int (__cdecl *PPH_SORT_ITEMS_FUNCTION)(
+    _In_ void *Context,
+    _In_ const void *Item1,
+    _In_ const void *Item2
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhSortItemsIncremental(
+    _Inout_updates_(Count) PVOID *Items,
+    _In_ ULONG Count,
+    _In_ PPH_SORT_ITEMS_SIMPLE_FUNCTION CompareFunction
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhSortItemsIncrementalEx(
+    _Inout_updates_(Count) PVOID *Items,
+    _In_ ULONG Count,
+    _In_ PPH_SORT_ITEMS_FUNCTION CompareFunction,
+    _In_opt_ PVOID Context
+    );
+
 // Pointer list
 
 extern PPH_OBJECT_TYPE PhPointerListType;
@@ -2841,6 +2962,7 @@ PhResizeHashSet(
 // Hashtable
 
 extern PPH_OBJECT_TYPE PhHashtableType;
+extern PPH_OBJECT_TYPE PhFlatHashtableType;
 
 typedef struct _PH_HASHTABLE_ENTRY
 {
@@ -2892,6 +3014,11 @@ typedef ULONG (NTAPI *PPH_HASHTABLE_HASH_FUNCTION)(
 // Enables 2^32-1 possible hash codes instead of only 2^31
 //#define PH_HASHTABLE_FULL_HASH
 
+// Hashtable flags
+
+/** Moves entries to the new buckets a few at a time after the hashtable grows, instead of all at once. */
+#define PH_HASHTABLE_INCREMENTAL_RESIZE 0x1
+
 /**
  * A hashtable structure.
  */
@@ -2921,6 +3048,17 @@ typedef struct _PH_HASHTABLE
      * count of entries that were ever allocated.
      */
     ULONG NextEntry;
+
+    /** A combination of PH_HASHTABLE_* flags. */
+    ULONG Flags;
+    /** The number of buckets before the hashtable grew. */
+    ULONG OldAllocatedBuckets;
+    /** The bucket array before the hashtable grew, or NULL if all entries are in the
+     * current bucket array.
+     */
+    PULONG OldBuckets;
+    /** Old buckets before this index have been moved to the current bucket array. */
+    ULONG MigrateIndex;
 } PH_HASHTABLE, *PPH_HASHTABLE;
 
 #define PH_HASHTABLE_ENTRY_SIZE(InnerSize) (FIELD_OFFSET(PH_HASHTABLE_ENTRY, Body) + (InnerSize))
@@ -2941,6 +3079,17 @@ PhCreateHashtable(
     _In_ ULONG InitialCapacity
     );
 
+PHLIBAPI
+PPH_HASHTABLE
+NTAPI
+PhCreateHashtableEx(
+    _In_ ULONG EntrySize,
+    _In_ PPH_HASHTABLE_COMPARE_FUNCTION CompareFunction,
+    _In_ PPH_HASHTABLE_HASH_FUNCTION HashFunction,
+    _In_ ULONG InitialCapacity,
+    _In_ ULONG Flags
+    );
+
 PHLIBAPI
 PVOID
 NTAPI
@@ -3104,6 +3253,14 @@ PhCreateSimpleHashtable(
     _In_ ULONG InitialCapacity
     );
 
+PHLIBAPI
+PPH_HASHTABLE
+NTAPI
+PhCreateSimpleHashtableEx(
+    _In_ ULONG InitialCapacity,
+    _In_ ULONG Flags
+    );
+
 PHLIBAPI
 PVOID
 NTAPI
@@ -3147,6 +3304,129 @@ PhRemoveItemSimpleHashtable(
     _In_opt_ PVOID Key
     );
 
+// Flat hashtable
+
+/**
+ * A flat hashtable is an open addressing hashtable which stores entries inline.
+ * Each slot has a control byte containing 7 bits of the hash code of its entry,
+ * and lookups check 16 control bytes at a time before comparing any entries.
+ * Tables created with a key size instead of compare and hash functions compare
+ * and hash the start of each entry directly.
+ */
+typedef struct _PH_FLAT_HASHTABLE
+{
+    /** Size of each entry, in bytes. */
+    ULONG EntrySize;
+    /** Size of the key at the start of each entry. Only used if there are no functions. */
+    ULONG KeySize;
+    /** The comparison function, or NULL to compare keys. */
+    PPH_HASHTABLE_COMPARE_FUNCTION CompareFunction;
+    /** The hash function, or NULL to hash keys. */
+    PPH_HASHTABLE_HASH_FUNCTION HashFunction;
+
+    /** The number of slots. This is always a power of two. */
+    ULONG Capacity;
+    /** Number of entries in the hashtable. */
+    ULONG Count;
+    /** Number of entries that can be added before the hashtable is resized. */
+    ULONG GrowthLeft;
+
+    /** Control bytes for each slot, followed by a copy of the first group. */
+    PUCHAR Control;
+    /** Hash codes for each slot. */
+    PULONG HashCodes;
+    /** The slots. */
+    PVOID Entries;
+} PH_FLAT_HASHTABLE, *PPH_FLAT_HASHTABLE;
+
+#define PH_FLAT_HASHTABLE_ENTRY_ALIGNMENT (sizeof(PVOID))
+#define PH_FLAT_HASHTABLE_ENTRY_SIZE(InnerSize) (((InnerSize) + PH_FLAT_HASHTABLE_ENTRY_ALIGNMENT - 1) & ~(PH_FLAT_HASHTABLE_ENTRY_ALIGNMENT - 1))
+#define PH_FLAT_HASHTABLE_GET_ENTRY(Hashtable, Index) \
+    PTR_ADD_OFFSET((Hashtable)->Entries, (SIZE_T)(Index) * (Hashtable)->EntrySize)
+
+PHLIBAPI
+PPH_FLAT_HASHTABLE
+NTAPI
+PhCreateFlatHashtable(
+    _In_ ULONG EntrySize,
+    _In_ ULONG KeySize,
+    _In_opt_ PPH_HASHTABLE_COMPARE_FUNCTION CompareFunction,
+    _In_opt_ PPH_HASHTABLE_HASH_FUNCTION HashFunction,
+    _In_ ULONG InitialCapacity
+    );
+
+PHLIBAPI
+PVOID
+NTAPI
+PhAddEntryFlatHashtable(
+    _Inout_ PPH_FLAT_HASHTABLE Hashtable,
+    _In_ PVOID Entry
+    );
+
+PHLIBAPI
+PVOID
+NTAPI
+PhAddEntryFlatHashtableEx(
+    _Inout_ PPH_FLAT_HASHTABLE Hashtable,
+    _In_ PVOID Entry,
+    _Out_opt_ PBOOLEAN Added
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhClearFlatHashtable(
+    _Inout_ PPH_FLAT_HASHTABLE Hashtable
+    );
+
+PHLIBAPI
+BOOLEAN
+NTAPI
+PhEnumFlatHashtable(
+    _In_ PPH_FLAT_HASHTABLE Hashtable,
+    _Out_ PVOID *Entry,
+    _Inout_ PULONG EnumerationKey
+    );
+
+PHLIBAPI
+PVOID
+NTAPI
+PhFindEntryFlatHashtable(
+    _In_ PPH_FLAT_HASHTABLE Hashtable,
+    _In_ PVOID Entry
+    );
+
+PHLIBAPI
+BOOLEAN
+NTAPI
+PhRemoveEntryFlatHashtable(
+    _Inout_ PPH_FLAT_HASHTABLE Hashtable,
+    _In_ PVOID Entry
+    );
+
+// String interning
+
+PHLIBAPI
+PPH_STRING
+NTAPI
+PhInternString(
+    _In_ PPH_STRING String
+    );
+
+PHLIBAPI
+PPH_STRING
+NTAPI
+PhInternStringRef(
+    _In_ PPH_STRINGREF String
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhTrimInternedStrings(
+    VOID
+    );
+
 // Free list
 
 typedef struct _PH_FREE_LIST
@@ -3203,6 +3483,14 @@ PhFreeToFreeList(
     _In_ PVOID Memory
     );
 
+PHLIBAPI
+VOID
+NTAPI
+PhTrimFreeList(
+    _Inout_ PPH_FREE_LIST FreeList,
+    _In_ ULONG MaximumCount
+    );
+
 // Callback
 
 /**
@@ -3218,6 +3506,23 @@ typedef VOID (NTAPI *PPH_CALLBACK_FUNCTION)(
     _In_opt_ PVOID Context
     );
 
+/**
+ * The parameter passed to callback functions registered
+ * with PH_CALLBACK_BATCH.
+ */
+typedef struct _PH_CALLBACK_BATCH
+{
+    /** The number of parameters. */
+    ULONG Count;
+    /** The parameters given to PhInvokeCallback() or
+     * PhInvokeCallbackBatch(). */
+    PVOID *Parameters;
+} PH_CALLBACK_BATCH, *PPH_CALLBACK_BATCH;
+
+/** The callback function receives a PH_CALLBACK_BATCH
+ * structure instead of each parameter separately. */
+#define PH_CALLBACK_BATCH 0x1
+
 /**
  * A callback registration structure.
  */
@@ -3230,13 +3535,10 @@ typedef struct _PH_CALLBACK_REGISTRATION
     /** A user-defined value to be passed to the
      * callback function. */
     PVOID Context;
-    /** A value indicating whether the registration
-     * structure is being used. */
-    LONG Busy;
-    /** Whether the registration structure is being
-     * removed. */
-    BOOLEAN Unregistering;
-    BOOLEAN Reserved;
+    /** The state shared with the registrant arrays.
+     * It outlives the registration structure while
+     * an invocation is still using it. */
+    PVOID Entry;
     /** Flags controlling the callback. */
     USHORT Flags;
 } PH_CALLBACK_REGISTRATION, *PPH_CALLBACK_REGISTRATION;
@@ -3255,9 +3557,25 @@ typedef struct _PH_CALLBACK
     PH_QUEUED_LOCK ListLock;
     /** A condition variable pulsed when the callback becomes free. */
     PH_QUEUED_LOCK BusyCondition;
+    /** A copy of the list used for invoking the callback
+     * functions. It is replaced whenever the list changes. */
+    PVOID Snapshot;
 } PH_CALLBACK, *PPH_CALLBACK;
 
-#define PH_CALLBACK_DECLARE(Name) PH_CALLBACK Name = { &Name.ListHead, &Name.ListHead, PH_QUEUED_LOCK_INIT, PH_QUEUED_LOCK_INIT }
+#define PH_CALLBACK_DECLARE(Name) PH_CALLBACK Name = { &Name.ListHead, &Name.ListHead, PH_QUEUED_LOCK_INIT, PH_QUEUED_LOCK_INIT, NULL }
+
+/**
+ * A function which receives the time taken by each
+ * callback function.
+ *
+ * \param Function The callback function that was executed.
+ * \param Time The time taken by the function, in
+ * performance counter ticks.
+ */
+typedef VOID (NTAPI *PPH_CALLBACK_TIMING_FUNCTION)(
+    _In_ PPH_CALLBACK_FUNCTION Function,
+    _In_ ULONG64 Time
+    );
 
 PHLIBAPI
 VOID
@@ -3310,6 +3628,22 @@ PhInvokeCallback(
     _In_opt_ PVOID Parameter
     );
 
+PHLIBAPI
+VOID
+NTAPI
+PhInvokeCallbackBatch(
+    _In_ PPH_CALLBACK Callback,
+    _In_reads_(Count) PVOID *Parameters,
+    _In_ ULONG Count
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhSetCallbackTimingFunction(
+    _In_opt_ PPH_CALLBACK_TIMING_FUNCTION TimingFunction
+    );
+
 // General
 
 PHLIBAPI
@@ -3424,6 +3758,54 @@ PhDivideSinglesBySingle(
 /** Deprecated. Use PhDivideSinglesBySingle instead. */
 PHLIBAPI VOID FASTCALL PhxfDivideSingle2U(PFLOAT A, FLOAT B, ULONG Count);
 
+PHLIBAPI
+ULONG
+NTAPI
+PhMaximumUlongs(
+    _In_reads_(Count) PULONG A,
+    _In_ SIZE_T Count
+    );
+
+PHLIBAPI
+ULONG64
+NTAPI
+PhMaximumUlong64s(
+    _In_reads_(Count) PULONG64 A,
+    _In_ SIZE_T Count
+    );
+
+PHLIBAPI
+FLOAT
+NTAPI
+PhMaximumSingles(
+    _In_reads_(Count) PFLOAT A,
+    _In_ SIZE_T Count
+    );
+
+PHLIBAPI
+ULONG64
+NTAPI
+PhSumUlongs(
+    _In_reads_(Count) PULONG A,
+    _In_ SIZE_T Count
+    );
+
+PHLIBAPI
+ULONG64
+NTAPI
+PhSumUlong64s(
+    _In_reads_(Count) PULONG64 A,
+    _In_ SIZE_T Count
+    );
+
+PHLIBAPI
+FLOAT
+NTAPI
+PhSumSingles(
+    _In_reads_(Count) PFLOAT A,
+    _In_ SIZE_T Count
+    );
+
 // Format
 
 typedef enum _PH_FORMAT_TYPE
@@ -3461,6 +3843,10 @@ typedef enum _PH_FORMAT_TYPE
     FormatForceDecimalPoint = 0x4000,
     /** Trailing zeros and possibly the decimal point are trimmed */
     FormatCropZeros = 0x8000,
+    /** Use the shortest form that converts back to the same value. The precision is ignored.
+     * Normal form is used unless the exponent is very large or small, or FormatStandardForm is
+     * specified. */
+    FormatShortestForm = 0x80000,
 
     // Floating-point and integer flags
     /** Group digits (with floating-point, only works when in normal form) */
@@ -3481,6 +3867,27 @@ typedef enum _PH_FORMAT_TYPE
     FormatUpperCase = 0x20000000
 } PH_FORMAT_TYPE;
 
+/**
+ * The value of an element to be formatted to a string.
+ */
+typedef union _PH_FORMAT_VALUE
+{
+    WCHAR Char;
+    PH_STRINGREF String;
+    PWSTR StringZ;
+    PH_BYTESREF MultiByteString;
+    PSTR MultiByteStringZ;
+    LONG Int32;
+    LONG64 Int64;
+    LONG_PTR IntPtr;
+    ULONG UInt32;
+    ULONG64 UInt64;
+    ULONG_PTR UIntPtr;
+    DOUBLE Double;
+
+    ULONG64 Size;
+} PH_FORMAT_VALUE, *PPH_FORMAT_VALUE;
+
 /**
  * Describes an element to be formatted to a string.
  */
@@ -3505,23 +3912,8 @@ typedef struct _PH_FORMAT
     /** The meaning of this field depends on the element type. For \a Size,
      * this field specifies the minimum size unit. */
     UCHAR Parameter;
-    union
-    {
-        WCHAR Char;
-        PH_STRINGREF String;
-        PWSTR StringZ;
-        PH_BYTESREF MultiByteString;
-        PSTR MultiByteStringZ;
-        LONG Int32;
-        LONG64 Int64;
-        LONG_PTR IntPtr;
-        ULONG UInt32;
-        ULONG64 UInt64;
-        ULONG_PTR UIntPtr;
-        DOUBLE Double;
-
-        ULONG64 Size;
-    } u;
+    /** The value of the element. */
+    PH_FORMAT_VALUE u;
 } PH_FORMAT, *PPH_FORMAT;
 
 // Convenience macros
@@ -3540,6 +3932,7 @@ typedef struct _PH_FORMAT
 #define PhInitFormatF(f, v, p) do { (f)->Type = DoubleFormatType | FormatUsePrecision; (f)->u.Double = (v); (f)->Precision = (p); } while (0)
 #define PhInitFormatE(f, v, p) do { (f)->Type = DoubleFormatType | FormatStandardForm | FormatUsePrecision; (f)->u.Double = (v); (f)->Precision = (p); } while (0)
 #define PhInitFormatA(f, v, p) do { (f)->Type = DoubleFormatType | FormatHexadecimalForm | FormatUsePrecision; (f)->u.Double = (v); (f)->Precision = (p); } while (0)
+#define PhInitFormatR(f, v) do { (f)->Type = DoubleFormatType | FormatShortestForm; (f)->u.Double = (v); } while (0)
 #define PhInitFormatSize(f, v) do { (f)->Type = SizeFormatType; (f)->u.Size = (v); } while (0)
 
 PHLIBAPI
@@ -3562,6 +3955,55 @@ PhFormatToBuffer(
     _Out_opt_ PSIZE_T ReturnLength
     );
 
+/**
+ * A format array prepared for repeated use. Character and string elements are
+ * stored as literals; the values of all other elements are supplied each time
+ * the format is used.
+ */
+typedef struct _PH_COMPILED_FORMAT
+{
+    /** The number of elements in \a Format. */
+    ULONG Count;
+    /** The number of values required by the format. */
+    ULONG NumberOfValues;
+    PPH_FORMAT Format;
+} PH_COMPILED_FORMAT, *PPH_COMPILED_FORMAT;
+
+PHLIBAPI
+PPH_COMPILED_FORMAT
+NTAPI
+PhCompileFormat(
+    _In_reads_(Count) PPH_FORMAT Format,
+    _In_ ULONG Count
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhFreeCompiledFormat(
+    _In_ _Post_invalid_ PPH_COMPILED_FORMAT CompiledFormat
+    );
+
+PHLIBAPI
+PPH_STRING
+NTAPI
+PhFormatCompiled(
+    _In_ PPH_COMPILED_FORMAT CompiledFormat,
+    _In_reads_(CompiledFormat->NumberOfValues) PPH_FORMAT_VALUE Values,
+    _In_opt_ SIZE_T InitialCapacity
+    );
+
+PHLIBAPI
+BOOLEAN
+NTAPI
+PhFormatCompiledToBuffer(
+    _In_ PPH_COMPILED_FORMAT CompiledFormat,
+    _In_reads_(CompiledFormat->NumberOfValues) PPH_FORMAT_VALUE Values,
+    _Out_writes_bytes_opt_(BufferLength) PWSTR Buffer,
+    _In_opt_ SIZE_T BufferLength,
+    _Out_opt_ PSIZE_T ReturnLength
+    );
+
 // basesupa
 
 PHLIBAPI
@@ -3937,17 +4379,25 @@ PhSetInformationHandleTable(
 
 // workqueue
 
-#if !defined(_PH_WORKQUEUE_PRIVATE) && defined(DEBUG)
+#if !defined(_PH_WORKQUEUE_PRIVATE)
 extern PPH_LIST PhDbgWorkQueueList;
 extern PH_QUEUED_LOCK PhDbgWorkQueueListLock;
 #endif
 
+#define PH_WORK_QUEUE_WORK_STEALING 0x1
+
+#define PH_WORK_QUEUE_PRIORITY_HIGH 0
+#define PH_WORK_QUEUE_PRIORITY_NORMAL 1
+#define PH_WORK_QUEUE_PRIORITY_LOW 2
+#define PH_WORK_QUEUE_PRIORITY_COUNT 3
+
 typedef struct _PH_WORK_QUEUE
 {
     PH_RUNDOWN_PROTECT RundownProtect;
     BOOLEAN Terminating;
+    ULONG Flags;
 
-    LIST_ENTRY QueueListHead;
+    LIST_ENTRY QueueListHeads[PH_WORK_QUEUE_PRIORITY_COUNT];
     PH_QUEUED_LOCK QueueLock;
     PH_QUEUED_LOCK QueueEmptyCondition;
 
@@ -3958,7 +4408,14 @@ typedef struct _PH_WORK_QUEUE
     PH_QUEUED_LOCK StateLock;
     HANDLE SemaphoreHandle;
     ULONG CurrentThreads;
-    ULONG BusyCount;
+    ULONG BusyCount; // queued and executing items
+    ULONG ExecutingCount;
+
+    // Work stealing mode
+    struct _PH_WORK_QUEUE_ITEM *volatile InjectionListHeads[PH_WORK_QUEUE_PRIORITY_COUNT];
+    struct _PH_WORK_QUEUE_DEQUE *Deques;
+    ULONG IdleCount;
+    ULONG QueuedCount;
 } PH_WORK_QUEUE, *PPH_WORK_QUEUE;
 
 typedef VOID (NTAPI *PPH_WORK_QUEUE_ITEM_DELETE_FUNCTION)(
@@ -3966,12 +4423,34 @@ typedef VOID (NTAPI *PPH_WORK_QUEUE_ITEM_DELETE_FUNCTION)(
     _In_ PVOID Context
     );
 
+typedef struct _PH_WORK_QUEUE_CANCEL_TOKEN
+{
+    BOOLEAN Cancelled;
+} PH_WORK_QUEUE_CANCEL_TOKEN, *PPH_WORK_QUEUE_CANCEL_TOKEN;
+
+typedef struct _PH_WORK_QUEUE_ENVIRONMENT
+{
+    ULONG Priority;
+    ULONG Timeout; // the item is dropped if it has not started after this many milliseconds, or 0
+    PPH_WORK_QUEUE_CANCEL_TOKEN CancelToken;
+    PPH_WORK_QUEUE_ITEM_DELETE_FUNCTION CancelFunction; // called instead of the function when the item is dropped
+} PH_WORK_QUEUE_ENVIRONMENT, *PPH_WORK_QUEUE_ENVIRONMENT;
+
 typedef struct _PH_WORK_QUEUE_ITEM
 {
-    LIST_ENTRY ListEntry;
+    union
+    {
+        LIST_ENTRY ListEntry;
+        struct _PH_WORK_QUEUE_ITEM *Next;
+    };
     PUSER_THREAD_START_ROUTINE Function;
     PVOID Context;
     PPH_WORK_QUEUE_ITEM_DELETE_FUNCTION DeleteFunction;
+
+    ULONG Priority;
+    ULONG64 Deadline;
+    PPH_WORK_QUEUE_CANCEL_TOKEN CancelToken;
+    PPH_WORK_QUEUE_ITEM_DELETE_FUNCTION CancelFunction;
 } PH_WORK_QUEUE_ITEM, *PPH_WORK_QUEUE_ITEM;
 
 VOID
@@ -3989,6 +4468,17 @@ PhInitializeWorkQueue(
     _In_ ULONG NoWorkTimeout
     );
 
+PHLIBAPI
+VOID
+NTAPI
+PhInitializeWorkQueueEx(
+    _Out_ PPH_WORK_QUEUE WorkQueue,
+    _In_ ULONG MinimumThreads,
+    _In_ ULONG MaximumThreads,
+    _In_ ULONG NoWorkTimeout,
+    _In_ ULONG Flags
+    );
+
 PHLIBAPI
 VOID
 NTAPI
@@ -4012,12 +4502,41 @@ PhQueueItemWorkQueue(
     _In_opt_ PVOID Context
     );
 
+PHLIBAPI
 VOID
+NTAPI
 PhQueueItemWorkQueueEx(
     _Inout_ PPH_WORK_QUEUE WorkQueue,
     _In_ PUSER_THREAD_START_ROUTINE Function,
     _In_opt_ PVOID Context,
-    _In_opt_ PPH_WORK_QUEUE_ITEM_DELETE_FUNCTION DeleteFunction
+    _In_opt_ PPH_WORK_QUEUE_ITEM_DELETE_FUNCTION DeleteFunction,
+    _In_opt_ PPH_WORK_QUEUE_ENVIRONMENT Environment
+    );
+
+FORCEINLINE
+VOID
+PhInitializeWorkQueueEnvironment(
+    _Out_ PPH_WORK_QUEUE_ENVIRONMENT Environment
+    )
+{
+    Environment->Priority = PH_WORK_QUEUE_PRIORITY_NORMAL;
+    Environment->Timeout = 0;
+    Environment->CancelToken = NULL;
+    Environment->CancelFunction = NULL;
+}
+
+PHLIBAPI
+PPH_WORK_QUEUE_CANCEL_TOKEN
+NTAPI
+PhCreateWorkQueueCancelToken(
+    VOID
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhCancelWorkQueueCancelToken(
+    _Inout_ PPH_WORK_QUEUE_CANCEL_TOKEN CancelToken
     );
 
 PHLIBAPI
@@ -4028,6 +4547,180 @@ PhQueueItemGlobalWorkQueue(
     _In_opt_ PVOID Context
     );
 
+// epoch
+
+typedef struct _PH_EPOCH_GUARD
+{
+    ULONG Slot;
+} PH_EPOCH_GUARD, *PPH_EPOCH_GUARD;
+
+PHLIBAPI
+VOID
+NTAPI
+PhEnterEpoch(
+    _Out_ PPH_EPOCH_GUARD Guard
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhLeaveEpoch(
+    _In_ PPH_EPOCH_GUARD Guard
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhFreeAfterEpoch(
+    _In_ _Post_invalid_ PVOID Memory
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhDereferenceObjectAfterEpoch(
+    _In_ PVOID Object
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhReclaimEpoch(
+    VOID
+    );
+
+// memory budget
+
+typedef SIZE_T (NTAPI *PPH_MEMORY_BUDGET_QUERY_SIZE)(
+    _In_opt_ PVOID Context
+    );
+
+typedef SIZE_T (NTAPI *PPH_MEMORY_BUDGET_TRIM)(
+    _In_ SIZE_T BytesToFree,
+    _In_opt_ PVOID Context
+    );
+
+typedef VOID (NTAPI *PPH_MEMORY_BUDGET_ENUM_CALLBACK)(
+    _In_ PWSTR Name,
+    _In_ SIZE_T Size,
+    _In_ SIZE_T BytesTrimmed,
+    _In_opt_ PVOID Context
+    );
+
+typedef struct _PH_MEMORY_BUDGET_CLIENT
+{
+    LIST_ENTRY ListEntry;
+    PWSTR Name;
+    PPH_MEMORY_BUDGET_QUERY_SIZE QuerySize;
+    PPH_MEMORY_BUDGET_TRIM Trim;
+    PVOID Context;
+
+    SIZE_T LastSize;
+    SIZE_T BytesTrimmed;
+} PH_MEMORY_BUDGET_CLIENT, *PPH_MEMORY_BUDGET_CLIENT;
+
+PHLIBAPI
+VOID
+NTAPI
+PhRegisterMemoryBudgetClient(
+    _Out_ PPH_MEMORY_BUDGET_CLIENT Client,
+    _In_ PWSTR Name,
+    _In_ PPH_MEMORY_BUDGET_QUERY_SIZE QuerySize,
+    _In_ PPH_MEMORY_BUDGET_TRIM Trim,
+    _In_opt_ PVOID Context
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhUnregisterMemoryBudgetClient(
+    _Inout_ PPH_MEMORY_BUDGET_CLIENT Client
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhSetMemoryBudget(
+    _In_ SIZE_T Budget
+    );
+
+PHLIBAPI
+SIZE_T
+NTAPI
+PhEnforceMemoryBudget(
+    VOID
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhEnumMemoryBudgetClients(
+    _In_ PPH_MEMORY_BUDGET_ENUM_CALLBACK Callback,
+    _In_opt_ PVOID Context
+    );
+
+// arena
+
+#define PH_ARENA_LARGE_PAGES 0x1
+
+/** Blocks are rounded up to a power of two, starting at 2^PH_ARENA_MINIMUM_BLOCK_SHIFT bytes. */
+#define PH_ARENA_MINIMUM_BLOCK_SHIFT 6
+#define PH_ARENA_MAXIMUM_BLOCK_SHIFT 15
+#define PH_ARENA_NUMBER_OF_CLASSES (PH_ARENA_MAXIMUM_BLOCK_SHIFT - PH_ARENA_MINIMUM_BLOCK_SHIFT + 1)
+/** The largest block that is carved out of the regions of an arena. */
+#define PH_ARENA_MAXIMUM_BLOCK_SIZE (1 << PH_ARENA_MAXIMUM_BLOCK_SHIFT)
+
+typedef struct _PH_ARENA
+{
+    PH_QUEUED_LOCK Lock;
+    ULONG Flags;
+    SIZE_T LargePageSize;
+
+    // Protected by Lock
+    PUCHAR NextBlock;
+    PUCHAR EndOfCommit;
+    PUCHAR EndOfRegion;
+    PVOID FreeLists[PH_ARENA_NUMBER_OF_CLASSES];
+    PVOID *Regions;
+    ULONG NumberOfRegions;
+    ULONG AllocatedRegions;
+} PH_ARENA, *PPH_ARENA;
+
+PHLIBAPI
+VOID
+NTAPI
+PhInitializeArena(
+    _Out_ PPH_ARENA Arena,
+    _In_ ULONG Flags
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhDeleteArena(
+    _Inout_ PPH_ARENA Arena
+    );
+
+_Check_return_
+_Ret_maybenull_
+PHLIBAPI
+PVOID
+NTAPI
+PhAllocateArena(
+    _Inout_ PPH_ARENA Arena,
+    _In_ SIZE_T Size,
+    _Out_opt_ PSIZE_T NewSize
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhFreeArena(
+    _Inout_ PPH_ARENA Arena,
+    _Frees_ptr_opt_ PVOID Memory,
+    _In_ SIZE_T Size
+    );
+
 // data
 
 // SIDs
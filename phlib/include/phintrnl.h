@@ -4,6 +4,8 @@
 typedef struct _PHLIB_STATISTICS_BLOCK
 {
     // basesup
+    ULONG BaseAllocations;
+    ULONG BaseReAllocations;
     ULONG BaseThreadsCreated;
     ULONG BaseThreadsCreateFailed;
     ULONG BaseStringBuildersCreated;
@@ -18,28 +20,48 @@ typedef struct _PHLIB_STATISTICS_BLOCK
     ULONG RefObjectsFreedToSmallFreeList;
     ULONG RefObjectsAllocatedFromTypeFreeList;
     ULONG RefObjectsFreedToTypeFreeList;
+    ULONG RefObjectsAllocatedFromArena;
     ULONG RefObjectsDeleteDeferred;
     ULONG RefAutoPoolsCreated;
     ULONG RefAutoPoolsDestroyed;
     ULONG RefAutoPoolsDynamicAllocated;
     ULONG RefAutoPoolsDynamicResized;
+    ULONG RefAutoPoolArenasAllocated;
+    ULONG RefAutoPoolArenasEscaped;
 
     // queuedlock
     ULONG QlBlockSpins;
     ULONG QlBlockWaits;
     ULONG QlAcquireExclusiveBlocks;
     ULONG QlAcquireSharedBlocks;
+    ULONG QlOptimizations;
+    ULONG QlWakes;
+    ULONG QlWakesDeferred;
+    ULONG QlWaitersWoken;
+    ULONG QlKeyedEventReleases;
 
     // workqueue
     ULONG WqWorkQueueThreadsCreated;
     ULONG WqWorkQueueThreadsCreateFailed;
     ULONG WqWorkItemsQueued;
+    ULONG WqWorkItemsStolen;
+    ULONG WqWorkItemsDropped;
+
+    // epoch
+    ULONG EpEpochsAdvanced;
+    ULONG EpEntriesReclaimed;
 } PHLIB_STATISTICS_BLOCK;
 
 #ifdef DEBUG
 extern PHLIB_STATISTICS_BLOCK PhLibStatisticsBlock;
 #endif
 
+// ref
+
+LONG PhGetObjectRefCount(
+    _In_ PVOID Object
+    );
+
 #ifdef DEBUG
 #define PHLIB_INC_STATISTIC(Name) (_InterlockedIncrement(&PhLibStatisticsBlock.Name))
 #else
@@ -522,6 +522,57 @@ PhSetThreadAffinityMask(
         );
 }
 
+/**
+ * Gets a thread's processor group affinity.
+ *
+ * \param ThreadHandle A handle to a thread. The handle
+ * must have THREAD_QUERY_LIMITED_INFORMATION access.
+ * \param GroupAffinity A variable which receives the processor
+ * group and the affinity mask within that group.
+ *
+ * \remarks This function requires Windows 7 or above.
+ */
+FORCEINLINE
+NTSTATUS
+PhGetThreadGroupAffinity(
+    _In_ HANDLE ThreadHandle,
+    _Out_ PGROUP_AFFINITY GroupAffinity
+    )
+{
+    return NtQueryInformationThread(
+        ThreadHandle,
+        ThreadGroupInformation,
+        GroupAffinity,
+        sizeof(GROUP_AFFINITY),
+        NULL
+        );
+}
+
+/**
+ * Sets a thread's processor group affinity.
+ *
+ * \param ThreadHandle A handle to a thread. The handle
+ * must have THREAD_SET_INFORMATION access.
+ * \param GroupAffinity The new processor group and affinity
+ * mask. The reserved members must be zero.
+ *
+ * \remarks This function requires Windows 7 or above.
+ */
+FORCEINLINE
+NTSTATUS
+PhSetThreadGroupAffinity(
+    _In_ HANDLE ThreadHandle,
+    _In_ GROUP_AFFINITY GroupAffinity
+    )
+{
+    return NtSetInformationThread(
+        ThreadHandle,
+        ThreadGroupInformation,
+        &GroupAffinity,
+        sizeof(GROUP_AFFINITY)
+        );
+}
+
 FORCEINLINE
 NTSTATUS
 PhGetJobBasicAndIoAccounting(
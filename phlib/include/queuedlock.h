@@ -190,6 +190,10 @@ FORCEINLINE VOID PhAcquireQueuedLockExclusive(
         // Owned bit was already set. Slow path.
         PhfAcquireQueuedLockExclusive(QueuedLock);
     }
+    else
+    {
+        PhRecordLockAcquire(QueuedLock, TRUE, 0);
+    }
 }
 
 _Acquires_shared_lock_(*QueuedLock)
@@ -205,6 +209,10 @@ FORCEINLINE VOID PhAcquireQueuedLockShared(
     {
         PhfAcquireQueuedLockShared(QueuedLock);
     }
+    else
+    {
+        PhRecordLockAcquire(QueuedLock, FALSE, 0);
+    }
 }
 
 _When_(return != 0, _Acquires_exclusive_lock_(*QueuedLock))
@@ -214,6 +222,7 @@ FORCEINLINE BOOLEAN PhTryAcquireQueuedLockExclusive(
 {
     if (!_InterlockedBitTestAndSetPointer((PLONG_PTR)&QueuedLock->Value, PH_QUEUED_LOCK_OWNED_SHIFT))
     {
+        PhRecordLockAcquire(QueuedLock, TRUE, 0);
         return TRUE;
     }
     else
@@ -229,6 +238,8 @@ FORCEINLINE VOID PhReleaseQueuedLockExclusive(
 {
     ULONG_PTR value;
 
+    PhRecordLockRelease(QueuedLock);
+
     value = (ULONG_PTR)_InterlockedExchangeAddPointer((PLONG_PTR)&QueuedLock->Value, -(LONG_PTR)PH_QUEUED_LOCK_OWNED);
 
     if ((value & (PH_QUEUED_LOCK_WAITERS | PH_QUEUED_LOCK_TRAVERSING)) == PH_QUEUED_LOCK_WAITERS)
@@ -78,7 +78,10 @@ extern PPH_CREATE_OBJECT_HOOK PhDbgCreateObjectHook;
 
 typedef struct _PH_OBJECT_TYPE_PARAMETERS
 {
+    /** The size of objects to cache, or 0 to use the size of the first object created.
+     * Objects of any other size are not cached. */
     SIZE_T FreeListSize;
+    /** The maximum number of objects to cache. */
     ULONG FreeListCount;
 } PH_OBJECT_TYPE_PARAMETERS, *PPH_OBJECT_TYPE_PARAMETERS;
 
@@ -89,8 +92,34 @@ typedef struct _PH_OBJECT_TYPE_INFORMATION
     USHORT Flags;
     UCHAR TypeIndex;
     UCHAR Reserved;
+    SIZE_T NumberOfBytes; // 0 on 32-bit systems
+    SIZE_T PeakNumberOfBytes; // 0 on 32-bit systems
+    ULONG NumberOfAllocations;
 } PH_OBJECT_TYPE_INFORMATION, *PPH_OBJECT_TYPE_INFORMATION;
 
+typedef BOOLEAN (NTAPI *PPH_ENUM_OBJECT_TYPE_CALLBACK)(
+    _In_ PPH_OBJECT_TYPE_INFORMATION Information,
+    _In_opt_ PVOID Context
+    );
+
+#define PH_OBJECT_ALLOCATION_SITE_FRAMES 8
+
+typedef struct _PH_OBJECT_ALLOCATION_SITE_INFORMATION
+{
+    PWSTR TypeName;
+    UCHAR TypeIndex;
+    UCHAR Reserved;
+    USHORT NumberOfFrames;
+    PVOID Frames[PH_OBJECT_ALLOCATION_SITE_FRAMES];
+    ULONG NumberOfSamples;
+    ULONG64 NumberOfBytes; // total size of the sampled objects
+} PH_OBJECT_ALLOCATION_SITE_INFORMATION, *PPH_OBJECT_ALLOCATION_SITE_INFORMATION;
+
+typedef BOOLEAN (NTAPI *PPH_ENUM_OBJECT_ALLOCATION_SITE_CALLBACK)(
+    _In_ PPH_OBJECT_ALLOCATION_SITE_INFORMATION Information,
+    _In_opt_ PVOID Context
+    );
+
 NTSTATUS PhInitializeRef(
     VOID
     );
@@ -185,6 +214,50 @@ PhGetObjectTypeInformation(
     _Out_ PPH_OBJECT_TYPE_INFORMATION Information
     );
 
+PHLIBAPI
+VOID
+NTAPI
+PhEnumObjectTypeInformation(
+    _In_ PPH_ENUM_OBJECT_TYPE_CALLBACK Callback,
+    _In_opt_ PVOID Context
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhSetObjectAllocationSampling(
+    _In_ ULONG Interval
+    );
+
+PHLIBAPI
+ULONG
+NTAPI
+PhGetObjectAllocationSampling(
+    VOID
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhResetObjectAllocationSites(
+    VOID
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhEnumObjectAllocationSites(
+    _In_ PPH_ENUM_OBJECT_ALLOCATION_SITE_CALLBACK Callback,
+    _In_opt_ PVOID Context
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhTrimObjectTypeFreeLists(
+    VOID
+    );
+
 PHLIBAPI
 PVOID
 NTAPI
@@ -253,6 +326,13 @@ PhClearReference(
 /** The maximum size of the dynamic array for it to be
  * kept after the auto-release pool is drained. */
 #define PH_AUTO_POOL_DYNAMIC_BIG_SIZE 256
+/** The size of each block of memory in an auto-release pool arena. */
+#define PH_AUTO_POOL_ARENA_SIZE 0x4000
+/** The maximum size of an object allocated from an arena. */
+#define PH_AUTO_POOL_ARENA_MAXIMUM_OBJECT_SIZE 0x400
+
+/** Temporary objects are allocated from an arena owned by the pool. */
+#define PH_AUTO_POOL_USE_ARENA 0x1
 
 /**
  * An auto-dereference pool can be used for
@@ -273,6 +353,10 @@ typedef struct _PH_AUTO_POOL
     PVOID *DynamicObjects;
 
     struct _PH_AUTO_POOL *NextPool;
+
+    ULONG Flags;
+    ULONG ArenaDepth;
+    struct _PH_AUTO_POOL_ARENA *Arena;
 } PH_AUTO_POOL, *PPH_AUTO_POOL;
 
 PHLIBAPI
@@ -282,6 +366,14 @@ PhInitializeAutoPool(
     _Out_ PPH_AUTO_POOL AutoPool
     );
 
+PHLIBAPI
+VOID
+NTAPI
+PhInitializeAutoPoolEx(
+    _Out_ PPH_AUTO_POOL AutoPool,
+    _In_ ULONG Flags
+    );
+
 _May_raise_
 PHLIBAPI
 VOID
@@ -305,6 +397,20 @@ PhAutoDereferenceObject(
     _In_opt_ PVOID Object
     );
 
+PHLIBAPI
+VOID
+NTAPI
+PhBeginAutoPoolArena(
+    VOID
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhEndAutoPoolArena(
+    VOID
+    );
+
 /** Deprecated. Use PhAutoDereferenceObject instead. */
 PHLIBAPI VOID NTAPI PhaDereferenceObject(PVOID Object);
 
@@ -29,6 +29,7 @@
 #define PH_OBJECT_FROM_SMALL_FREE_LIST 0x1
 /** The object was allocated from the type free list. */
 #define PH_OBJECT_FROM_TYPE_FREE_LIST 0x2
+#define PH_OBJECT_FROM_ARENA 0x4
 
 /**
  * The object header contains object manager information
@@ -49,7 +50,7 @@ typedef struct _PH_OBJECT_HEADER
             UCHAR Flags;
             UCHAR Reserved1;
 #ifdef _WIN64
-            ULONG Reserved2;
+            ULONG Size; // size of the body, for the object type statistics
 #endif
         };
         SLIST_ENTRY DeferDeleteListEntry;
@@ -72,7 +73,7 @@ C_ASSERT(FIELD_OFFSET(PH_OBJECT_HEADER, DeferDeleteListEntry) == 0x0);
 C_ASSERT(FIELD_OFFSET(PH_OBJECT_HEADER, TypeIndex) == 0x8);
 C_ASSERT(FIELD_OFFSET(PH_OBJECT_HEADER, Flags) == 0xa);
 C_ASSERT(FIELD_OFFSET(PH_OBJECT_HEADER, Reserved1) == 0xb);
-C_ASSERT(FIELD_OFFSET(PH_OBJECT_HEADER, Reserved2) == 0xc);
+C_ASSERT(FIELD_OFFSET(PH_OBJECT_HEADER, Size) == 0xc);
 C_ASSERT(FIELD_OFFSET(PH_OBJECT_HEADER, Body) == 0x10);
 #else
 C_ASSERT(FIELD_OFFSET(PH_OBJECT_HEADER, RefCount) == 0x0);
@@ -123,12 +124,21 @@ typedef struct _PH_OBJECT_TYPE
     UCHAR Reserved;
     /** The total number of objects of this type that are alive. */
     ULONG NumberOfObjects;
+    /** The total size of the bodies of the objects that are alive. This is only
+     * recorded on 64-bit systems, where the object header has room for the size. */
+    SIZE_T NumberOfBytes;
+    /** The largest value of NumberOfBytes so far. */
+    SIZE_T PeakNumberOfBytes;
+    /** The total number of objects of this type that have been created. This wraps around. */
+    ULONG NumberOfAllocations;
     /** An optional procedure called when objects of this type are freed. */
     PPH_TYPE_DELETE_PROCEDURE DeleteProcedure;
     /** The name of the type. */
     PWSTR Name;
     /** A free list to use when allocating for this type. */
     PH_FREE_LIST FreeList;
+    /** Whether the free list has been unused since it was last trimmed. */
+    BOOLEAN FreeListIdle;
 } PH_OBJECT_TYPE, *PPH_OBJECT_TYPE;
 
 /**
@@ -149,6 +159,32 @@ PhpInterlockedIncrementSafe(
     return _InterlockedIncrementNoZero(RefCount);
 }
 
+typedef struct _PH_AUTO_POOL_ARENA
+{
+    /** One reference for each live object, and one for the owning pool if this is its current arena. */
+    LONG RefCount;
+    /** The offset of the first free byte. */
+    ULONG Offset;
+} PH_AUTO_POOL_ARENA, *PPH_AUTO_POOL_ARENA;
+
+/** Each object in an arena is preceded by a pointer to the arena, padded to keep the object header aligned. */
+#define PH_AUTO_POOL_ARENA_OBJECT_PREFIX_SIZE MEMORY_ALLOCATION_ALIGNMENT
+#define PH_AUTO_POOL_ARENA_DATA_OFFSET ALIGN_UP_BY(sizeof(PH_AUTO_POOL_ARENA), MEMORY_ALLOCATION_ALIGNMENT)
+
+/** The maximum number of distinct allocation sites that are recorded. */
+#define PH_OBJECT_ALLOCATION_SITE_LIMIT 4096
+
+typedef struct _PH_OBJECT_ALLOCATION_SITE
+{
+    /** The hash of the frames, as computed by RtlCaptureStackBackTrace. */
+    ULONG Hash;
+    UCHAR TypeIndex;
+    USHORT NumberOfFrames;
+    PVOID Frames[PH_OBJECT_ALLOCATION_SITE_FRAMES];
+    ULONG NumberOfSamples;
+    ULONG64 NumberOfBytes;
+} PH_OBJECT_ALLOCATION_SITE, *PPH_OBJECT_ALLOCATION_SITE;
+
 PPH_OBJECT_HEADER PhpAllocateObject(
     _In_ PPH_OBJECT_TYPE ObjectType,
     _In_ SIZE_T ObjectSize
@@ -158,6 +194,11 @@ VOID PhpFreeObject(
     _In_ PPH_OBJECT_HEADER ObjectHeader
     );
 
+VOID PhpSampleObjectAllocation(
+    _In_ PPH_OBJECT_TYPE ObjectType,
+    _In_ SIZE_T ObjectSize
+    );
+
 VOID PhpDeferDeleteObject(
     _In_ PPH_OBJECT_HEADER ObjectHeader
     );
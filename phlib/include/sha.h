@@ -25,4 +25,33 @@ VOID A_SHAFinal(
     _Out_writes_bytes_(20) UCHAR *Hash
     );
 
+typedef struct
+{
+    ULONG State[8];
+    ULONG64 Count;
+    UCHAR Buffer[64];
+} SHA256_CTX;
+
+VOID Sha256Init(
+    _Out_ SHA256_CTX *Context
+    );
+
+VOID Sha256Update(
+    _Inout_ SHA256_CTX *Context,
+    _In_reads_bytes_(Length) UCHAR *Input,
+    _In_ ULONG Length
+    );
+
+VOID Sha256UpdateMultiple(
+    _Inout_updates_(Count) SHA256_CTX **Contexts,
+    _In_reads_(Count) UCHAR **Inputs,
+    _In_ ULONG Length,
+    _In_ ULONG Count
+    );
+
+VOID Sha256Final(
+    _Inout_ SHA256_CTX *Context,
+    _Out_writes_bytes_(32) UCHAR *Hash
+    );
+
 #endif
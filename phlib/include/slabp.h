@@ -0,0 +1,77 @@
+/*
+ * Process Hacker -
+ *   internal slab allocator
+ *
+ * Copyright (C) 2016 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PH_SLABP_H
+#define _PH_SLABP_H
+
+/** The size of each slab. All blocks in a slab belong to the same size class. */
+#define PH_SLAB_SIZE (64 * 1024)
+#define PH_SLAB_SHIFT 16
+/** The size of the region reserved for slabs. */
+#ifdef _WIN64
+#define PH_SLAB_REGION_SIZE (1024 * 1024 * 1024)
+#else
+#define PH_SLAB_REGION_SIZE (64 * 1024 * 1024)
+#endif
+/** Size classes are multiples of this value. */
+#define PH_SLAB_GRANULARITY 16
+/** The number of blocks moved between a thread cache and the depot at once. */
+#define PH_SLAB_MAGAZINE_SIZE 32
+
+extern BOOLEAN PhSlabEnabled;
+extern PVOID PhSlabBase;
+extern SIZE_T PhSlabRegionSize;
+
+BOOLEAN PhSlabInitialization(
+    VOID
+    );
+
+PVOID PhSlabAllocate(
+    _In_ SIZE_T Size
+    );
+
+VOID PhSlabFree(
+    _In_ PVOID Memory
+    );
+
+SIZE_T PhSlabGetBlockSize(
+    _In_ PVOID Memory
+    );
+
+VOID PhSlabFlushThreadCache(
+    VOID
+    );
+
+/**
+ * Determines whether a block of memory was allocated by the slab allocator.
+ */
+FORCEINLINE
+BOOLEAN
+PhIsSlabBlock(
+    _In_opt_ PVOID Memory
+    )
+{
+    // PhSlabRegionSize is 0 when the slab allocator is disabled.
+    return (ULONG_PTR)Memory - (ULONG_PTR)PhSlabBase < PhSlabRegionSize;
+}
+
+#endif
@@ -73,6 +73,13 @@ PhSymbolProviderCompleteInitialization(
     _In_opt_ PVOID DbgHelpBase
     );
 
+PHLIBAPI
+VOID
+NTAPI
+PhPrefetchSymbolProvider(
+    VOID
+    );
+
 PHLIBAPI
 PPH_SYMBOL_PROVIDER
 NTAPI
@@ -147,6 +154,13 @@ PhSetSearchPathSymbolProvider(
     _In_ PWSTR Path
     );
 
+PHLIBAPI
+VOID
+NTAPI
+PhSetSymbolIndexCacheDirectory(
+    _In_opt_ PWSTR Directory
+    );
+
 #ifdef _WIN64
 NTSTATUS
 NTAPI
@@ -291,4 +305,34 @@ PhWalkThreadStack(
     _In_opt_ PVOID Context
     );
 
+/**
+ * A callback function passed to PhWalkProcessStacks()
+ * and called for each stack frame.
+ *
+ * \param ThreadId The ID of the thread that the stack frame
+ * belongs to.
+ * \param StackFrame A structure providing information about
+ * the stack frame.
+ * \param Context A user-defined value passed to
+ * PhWalkProcessStacks().
+ *
+ * \return TRUE to continue the stack walk, FALSE to
+ * stop.
+ */
+typedef BOOLEAN (NTAPI *PPH_WALK_PROCESS_STACK_CALLBACK)(
+    _In_ HANDLE ThreadId,
+    _In_ PPH_THREAD_STACK_FRAME StackFrame,
+    _In_opt_ PVOID Context
+    );
+
+PHLIBAPI
+NTSTATUS
+NTAPI
+PhWalkProcessStacks(
+    _In_ HANDLE ProcessHandle,
+    _In_ ULONG Flags,
+    _In_ PPH_WALK_PROCESS_STACK_CALLBACK Callback,
+    _In_opt_ PVOID Context
+    );
+
 #endif
@@ -120,6 +120,12 @@ typedef BOOL (WINAPI *_SymUnloadModule64)(
     _In_ DWORD64 BaseOfDll
     );
 
+typedef BOOL (WINAPI *_SymGetModuleInfoW64)(
+    _In_ HANDLE hProcess,
+    _In_ DWORD64 qwAddr,
+    _Out_ PIMAGEHLP_MODULEW64 ModuleInfo
+    );
+
 typedef PVOID (WINAPI *_SymFunctionTableAccess64)(
     _In_ HANDLE hProcess,
     _In_ DWORD64 AddrBase
@@ -0,0 +1,131 @@
+#ifndef _PH_TRACE_H
+#define _PH_TRACE_H
+
+// Process Hacker registers an ETW provider named "ProcessHacker"
+// ({62134317-8f4c-5c63-a9ad-52661cfd4eaa}, the GUID derived from the name) which writes
+// self-describing TraceLogging events, so that its own work can be viewed next to the rest
+// of the system in WPA without installing a manifest. Events are grouped by keyword.
+// PhTraceKeywords tracks the keywords that sessions have enabled, and callers check
+// PhTraceEnabled before calling the PhTrace functions, so the cost when no session is
+// listening is a single load and test.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PH_TRACE_KEYWORD_PROVIDER 0x1
+#define PH_TRACE_KEYWORD_WORK_QUEUE 0x2
+#define PH_TRACE_KEYWORD_SYMBOLS 0x4
+#define PH_TRACE_KEYWORD_KPH 0x8
+#define PH_TRACE_KEYWORD_PAINT 0x10
+#define PH_TRACE_KEYWORD_SETTINGS 0x20
+
+PHLIBAPI extern ULONG64 PhTraceKeywords;
+
+FORCEINLINE BOOLEAN PhTraceEnabled(
+    _In_ ULONG64 Keyword
+    )
+{
+    return (PhTraceKeywords & Keyword) != 0;
+}
+
+VOID PhInitializeTrace(
+    VOID
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhTraceProviderRunStart(
+    _In_ PVOID Function
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhTraceProviderRunStop(
+    _In_ PVOID Function
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhTraceWorkItemStart(
+    _In_ PVOID Function,
+    _In_opt_ PVOID Context
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhTraceWorkItemStop(
+    _In_ PVOID Function,
+    _In_ NTSTATUS Status
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhTraceSymbolLoadStart(
+    _In_ PWSTR FileName,
+    _In_ ULONG64 BaseAddress
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhTraceSymbolLoadStop(
+    _In_ PWSTR FileName,
+    _In_ ULONG64 BaseAddress,
+    _In_ BOOLEAN Success
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhTraceKphRequestStart(
+    _In_ ULONG ControlCode
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhTraceKphRequestStop(
+    _In_ ULONG ControlCode,
+    _In_ NTSTATUS Status
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhTracePaintStart(
+    _In_ HWND WindowHandle
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhTracePaintStop(
+    _In_ HWND WindowHandle
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhTraceSettingsSaveStart(
+    _In_ PWSTR FileName
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhTraceSettingsSaveStop(
+    _In_ PWSTR FileName,
+    _In_ NTSTATUS Status
+    );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -100,6 +100,8 @@ typedef struct _PH_TREENEW_NODE
 // Extended flags
 #define TN_FLAG_ITEM_DRAG_SELECT 0x1
 #define TN_FLAG_NO_UNFOLDING_TOOLTIPS 0x2
+#define TN_FLAG_SEARCH_INDEX 0x4 // keep a sorted index of the first column for incremental search
+#define TN_FLAG_VIRTUAL 0x8 // flat list where the owner provides nodes by index, see TreeNew_SetVirtualCount
 
 // Callback flags
 #define TN_CACHE 0x1
@@ -213,6 +215,8 @@ typedef enum _PH_TREENEW_MESSAGE
     TreeNewDestroying,
     TreeNewGetDialogCode, // ULONG Parameter1, PULONG Parameter2
 
+    TreeNewGetVirtualNode, // PPH_TREENEW_GET_VIRTUAL_NODE Parameter1
+
     MaxTreeNewMessage
 } PH_TREENEW_MESSAGE;
 
@@ -233,6 +237,19 @@ typedef struct _PH_TREENEW_GET_CHILDREN
     PPH_TREENEW_NODE *Children; // can be NULL if no children
 } PH_TREENEW_GET_CHILDREN, *PPH_TREENEW_GET_CHILDREN;
 
+// Sent in virtual mode (TN_FLAG_VIRTUAL) for each row that the control needs. The owner keeps
+// the order of the rows (including sorting), and the selection state lives in the nodes it
+// returns. The same node must be returned for the same row until the owner calls
+// TreeNew_NodesStructured or TreeNew_SetVirtualCount, and a node that is removed must not be
+// freed until that call returns.
+typedef struct _PH_TREENEW_GET_VIRTUAL_NODE
+{
+    ULONG Flags;
+    ULONG Index;
+
+    PPH_TREENEW_NODE Node;
+} PH_TREENEW_GET_VIRTUAL_NODE, *PPH_TREENEW_GET_VIRTUAL_NODE;
+
 typedef struct _PH_TREENEW_IS_LEAF
 {
     ULONG Flags;
@@ -390,7 +407,10 @@ typedef struct _PH_TREENEW_SEARCH_EVENT
 #define TNM_SETEMPTYTEXT (WM_USER + 43)
 #define TNM_SETROWHEIGHT (WM_USER + 44)
 #define TNM_ISFLATNODEVALID (WM_USER + 45)
-#define TNM_LAST (WM_USER + 45)
+#define TNM_INVALIDATECHANGEDCELLS (WM_USER + 46)
+#define TNM_SETVIRTUALCOUNT (WM_USER + 47)
+#define TNM_UPDATETOOLTIP (WM_USER + 48)
+#define TNM_LAST (WM_USER + 48)
 
 #define TreeNew_SetCallback(hWnd, Callback, Context) \
     SendMessage((hWnd), TNM_SETCALLBACK, (WPARAM)(Context), (LPARAM)(Callback))
@@ -521,6 +541,17 @@ typedef struct _PH_TREENEW_SEARCH_EVENT
 #define TreeNew_IsFlatNodeValid(hWnd) \
     ((BOOLEAN)SendMessage((hWnd), TNM_ISFLATNODEVALID, 0, 0))
 
+#define TreeNew_InvalidateChangedCells(hWnd) \
+    SendMessage((hWnd), TNM_INVALIDATECHANGEDCELLS, 0, 0)
+
+#define TreeNew_SetVirtualCount(hWnd, Count) \
+    SendMessage((hWnd), TNM_SETVIRTUALCOUNT, (WPARAM)(Count), 0)
+
+// Asks for the text of the current tooltip again, e.g. after the owner has finished building
+// it in the background.
+#define TreeNew_UpdateTooltip(hWnd) \
+    SendMessage((hWnd), TNM_UPDATETOOLTIP, 0, 0)
+
 typedef struct _PH_TREENEW_VIEW_PARTS
 {
     RECT ClientRect;
@@ -59,7 +59,8 @@ typedef struct _PH_TREENEW_CONTEXT
             ULONG DragSelectionActive : 1;
             ULONG SelectionRectangleAlpha : 1; // use alpha blending for the selection rectangle
             ULONG CustomRowHeight : 1;
-            ULONG Spare : 4;
+            ULONG SearchIndexValid : 1;
+            ULONG Spare : 3;
         };
         ULONG Flags;
     };
@@ -111,7 +112,9 @@ typedef struct _PH_TREENEW_CONTEXT
     LONG TrackOldFixedWidth;
     ULONG DividerHot; // 0 for un-hot, 100 for completely hot
 
-    PPH_LIST FlatList;
+    PPH_LIST FlatList; // not used in virtual mode
+    ULONG VirtualCount; // number of rows in virtual mode, updated when the tree is restructured
+    ULONG NewVirtualCount;
 
     ULONG SortColumn; // ID of the column to sort by
     PH_SORT_ORDER SortOrder;
@@ -124,6 +127,12 @@ typedef struct _PH_TREENEW_CONTEXT
     ULONG SearchStringCount;
     ULONG AllocatedSearchString;
 
+    // Index for TN_FLAG_SEARCH_INDEX, built when a search is performed after rows have changed
+    struct _PH_TREENEW_SEARCH_ENTRY *SearchIndex; // sorted by text, then by flat index
+    ULONG SearchIndexCount;
+    ULONG SearchIndexColumnId;
+    PWCHAR SearchIndexText;
+
     ULONG TooltipIndex;
     ULONG TooltipId;
     PPH_STRING TooltipText;
@@ -154,8 +163,51 @@ typedef struct _PH_TREENEW_CONTEXT
     HRGN SuspendUpdateRegion;
 
     PH_STRINGREF EmptyText;
+
+    PULONG CellStates; // hashes of the visible cells as they were last painted, by view row and column ID
+    ULONG CellStateRows;
+    ULONG CellStateColumns;
+    LONG CellStateRowHeight;
+    LONG CellStateHeaderHeight;
+    LONG CellStateNormalLeft;
+    LONG CellStateHScrollPosition;
+
+    PPH_HASHTABLE TextExtentCache; // measured text, keyed by font and text
 } PH_TREENEW_CONTEXT, *PPH_TREENEW_CONTEXT;
 
+PPH_TREENEW_NODE PhTnpGetVirtualNode(
+    _In_ PPH_TREENEW_CONTEXT Context,
+    _In_ ULONG Index
+    );
+
+FORCEINLINE ULONG PhTnpGetFlatCount(
+    _In_ PPH_TREENEW_CONTEXT Context
+    )
+{
+    if (Context->ExtendedFlags & TN_FLAG_VIRTUAL)
+        return Context->VirtualCount;
+    else
+        return Context->FlatList->Count;
+}
+
+FORCEINLINE PPH_TREENEW_NODE PhTnpGetFlatNode(
+    _In_ PPH_TREENEW_CONTEXT Context,
+    _In_ ULONG Index
+    )
+{
+    if (Context->ExtendedFlags & TN_FLAG_VIRTUAL)
+        return PhTnpGetVirtualNode(Context, Index);
+    else
+        return Context->FlatList->Items[Index];
+}
+
+typedef struct _PH_TREENEW_TEXT_EXTENT
+{
+    HFONT Font;
+    PH_STRINGREF Text; // owned copy of the text
+    SIZE Size;
+} PH_TREENEW_TEXT_EXTENT, *PPH_TREENEW_TEXT_EXTENT;
+
 LRESULT CALLBACK PhTnpWndProc(
     _In_ HWND hwnd,
     _In_ UINT uMsg,
@@ -615,6 +667,28 @@ BOOLEAN PhTnpDefaultIncrementalSearch(
     _In_ BOOLEAN Wrap
     );
 
+typedef struct _PH_TREENEW_SEARCH_ENTRY
+{
+    ULONG Index; // flat index of the node
+    ULONG Offset; // offset of the text in SearchIndexText, in characters
+    ULONG Length; // length of the text, in characters
+} PH_TREENEW_SEARCH_ENTRY, *PPH_TREENEW_SEARCH_ENTRY;
+
+VOID PhTnpBuildSearchIndex(
+    _In_ PPH_TREENEW_CONTEXT Context
+    );
+
+VOID PhTnpDeleteSearchIndex(
+    _In_ PPH_TREENEW_CONTEXT Context
+    );
+
+BOOLEAN PhTnpIndexedIncrementalSearch(
+    _In_ PPH_TREENEW_CONTEXT Context,
+    _Inout_ PPH_TREENEW_SEARCH_EVENT SearchEvent,
+    _In_ BOOLEAN Partial,
+    _In_ BOOLEAN Wrap
+    );
+
 // Scrolling
 
 VOID PhTnpUpdateScrollBars(
@@ -645,12 +719,13 @@ VOID PhTnpPaint(
     _In_ HWND hwnd,
     _In_ PPH_TREENEW_CONTEXT Context,
     _In_ HDC hdc,
-    _In_ PRECT PaintRect
+    _In_ PRECT PaintRect,
+    _In_opt_ HRGN UpdateRegion
     );
 
 VOID PhTnpPrepareRowForDraw(
     _In_ PPH_TREENEW_CONTEXT Context,
-    _In_ HDC hdc,
+    _In_opt_ HDC hdc,
     _Inout_ PPH_TREENEW_NODE Node
     );
 
@@ -686,6 +761,46 @@ VOID PhTnpDrawThemedBorder(
     _In_ HDC hdc
     );
 
+// Cell states
+
+VOID PhTnpResetCellStates(
+    _In_ PPH_TREENEW_CONTEXT Context
+    );
+
+BOOLEAN PhTnpEnsureCellStates(
+    _In_ PPH_TREENEW_CONTEXT Context
+    );
+
+VOID PhTnpScrollCellStates(
+    _In_ PPH_TREENEW_CONTEXT Context,
+    _In_ LONG DeltaRows,
+    _In_ LONG DeltaX
+    );
+
+ULONG PhTnpHashRowState(
+    _In_ PPH_TREENEW_CONTEXT Context,
+    _In_ PPH_TREENEW_NODE Node,
+    _In_ LONG RowIndex
+    );
+
+ULONG PhTnpHashCellState(
+    _In_ PPH_TREENEW_CONTEXT Context,
+    _In_ PPH_TREENEW_NODE Node,
+    _In_ PPH_TREENEW_COLUMN Column,
+    _In_ LONG RowIndex,
+    _In_ ULONG RowHash
+    );
+
+VOID PhTnpInvalidateChangedCells(
+    _In_ PPH_TREENEW_CONTEXT Context
+    );
+
+BOOLEAN PhTnpRegionContainsRect(
+    _In_ HRGN Region,
+    _In_ HRGN ScratchRegion,
+    _In_ PRECT Rect
+    );
+
 // Tooltips
 
 VOID PhTnpInitializeTooltips(
@@ -769,6 +884,29 @@ VOID PhTnpDestroyBufferedContext(
     _In_ PPH_TREENEW_CONTEXT Context
     );
 
+// Text measurement
+
+BOOLEAN PhTnpGetTextExtent(
+    _In_ PPH_TREENEW_CONTEXT Context,
+    _In_opt_ HDC hdc,
+    _In_ HFONT Font,
+    _In_ PPH_STRINGREF Text,
+    _Out_ PSIZE Size
+    );
+
+VOID PhTnpClearTextExtentCache(
+    _In_ PPH_TREENEW_CONTEXT Context
+    );
+
+BOOLEAN NTAPI PhTnpTextExtentCompareFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    );
+
+ULONG NTAPI PhTnpTextExtentHashFunction(
+    _In_ PVOID Entry
+    );
+
 // Support functions
 
 VOID PhTnpGetMessagePos(
@@ -796,6 +934,13 @@ VOID PhTnpGetMessagePos(
 #define TNP_ANIMATE_DIVIDER_INCREMENT 17
 #define TNP_ANIMATE_DIVIDER_DECREMENT 2
 
+#define TNP_CELL_STATE_UNKNOWN 0 // the cell must be redrawn
+#define TNP_CELL_STATE_EMPTY 1 // the row is past the last node
+
+#define TNP_TEXT_EXTENT_CACHE_LIMIT 16384
+
+#define TNP_HASH_COMBINE(Hash, Value) (((Hash) ^ (ULONG)(Value)) * 0x01000193)
+
 #define TNP_HIT_TEST_FIXED_DIVIDER(X, Context) \
     ((Context)->FixedDividerVisible && (X) >= (Context)->FixedWidth - 8 && (X) < (Context)->FixedWidth + 8)
 #define TNP_HIT_TEST_PLUS_MINUS_GLYPH(X, NodeLevel) \
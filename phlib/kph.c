@@ -450,9 +450,14 @@ NTSTATUS KphpDeviceIoControl(
     _In_ ULONG InBufferLength
     )
 {
+    NTSTATUS status;
     IO_STATUS_BLOCK isb;
+    BOOLEAN trace;
+
+    if (trace = PhTraceEnabled(PH_TRACE_KEYWORD_KPH))
+        PhTraceKphRequestStart(KphControlCode);
 
-    return NtDeviceIoControlFile(
+    status = NtDeviceIoControlFile(
         PhKphHandle,
         NULL,
         NULL,
@@ -464,6 +469,11 @@ NTSTATUS KphpDeviceIoControl(
         NULL,
         0
         );
+
+    if (trace)
+        PhTraceKphRequestStop(KphControlCode, status);
+
+    return status;
 }
 
 NTSTATUS KphGetFeatures(
@@ -674,6 +684,50 @@ NTSTATUS KphReadVirtualMemoryUnsafe(
         );
 }
 
+NTSTATUS KphReadVirtualMemoryScatter(
+    _In_ HANDLE ProcessHandle,
+    _Inout_updates_(NumberOfRanges) PKPH_VM_READ_RANGE Ranges,
+    _In_ ULONG NumberOfRanges,
+    _Out_writes_bytes_(BufferSize) PVOID Buffer,
+    _In_ SIZE_T BufferSize
+    )
+{
+    struct
+    {
+        HANDLE ProcessHandle;
+        PKPH_VM_READ_RANGE Ranges;
+        ULONG NumberOfRanges;
+        PVOID Buffer;
+        SIZE_T BufferSize;
+    } input = { ProcessHandle, Ranges, NumberOfRanges, Buffer, BufferSize };
+
+    return KphpDeviceIoControl(
+        KPH_READVIRTUALMEMORYSCATTER,
+        &input,
+        sizeof(input)
+        );
+}
+
+NTSTATUS KphEnumerateProcesses(
+    _Out_writes_bytes_(BufferLength) PVOID Buffer,
+    _In_ ULONG BufferLength,
+    _Out_opt_ PULONG ReturnLength
+    )
+{
+    struct
+    {
+        PVOID Buffer;
+        ULONG BufferLength;
+        PULONG ReturnLength;
+    } input = { Buffer, BufferLength, ReturnLength };
+
+    return KphpDeviceIoControl(
+        KPH_ENUMERATEPROCESSES,
+        &input,
+        sizeof(input)
+        );
+}
+
 NTSTATUS KphQueryInformationProcess(
     _In_ HANDLE ProcessHandle,
     _In_ KPH_PROCESS_INFORMATION_CLASS ProcessInformationClass,
@@ -866,6 +920,32 @@ NTSTATUS KphCaptureStackBackTraceThread(
         );
 }
 
+NTSTATUS KphCaptureStackBackTraceProcess(
+    _In_ HANDLE ProcessHandle,
+    _In_ ULONG FramesToSkip,
+    _In_ ULONG FramesToCapture,
+    _Out_writes_bytes_(BufferLength) PVOID Buffer,
+    _In_ ULONG BufferLength,
+    _Out_opt_ PULONG ReturnLength
+    )
+{
+    struct
+    {
+        HANDLE ProcessHandle;
+        ULONG FramesToSkip;
+        ULONG FramesToCapture;
+        PVOID Buffer;
+        ULONG BufferLength;
+        PULONG ReturnLength;
+    } input = { ProcessHandle, FramesToSkip, FramesToCapture, Buffer, BufferLength, ReturnLength };
+
+    return KphpDeviceIoControl(
+        KPH_CAPTURESTACKBACKTRACEPROCESS,
+        &input,
+        sizeof(input)
+        );
+}
+
 NTSTATUS KphQueryInformationThread(
     _In_ HANDLE ThreadHandle,
     _In_ KPH_THREAD_INFORMATION_CLASS ThreadInformationClass,
@@ -976,6 +1056,84 @@ NTSTATUS KphEnumerateProcessHandles2(
     return status;
 }
 
+NTSTATUS KphEnumerateProcessHandlesEx(
+    _In_ HANDLE ProcessHandle,
+    _In_opt_ PKPH_HANDLE_FILTER Filter,
+    _Out_writes_bytes_(BufferLength) PVOID Buffer,
+    _In_opt_ ULONG BufferLength,
+    _Out_opt_ PULONG ReturnLength
+    )
+{
+    struct
+    {
+        HANDLE ProcessHandle;
+        PKPH_HANDLE_FILTER Filter;
+        PVOID Buffer;
+        ULONG BufferLength;
+        PULONG ReturnLength;
+    } input = { ProcessHandle, Filter, Buffer, BufferLength, ReturnLength };
+
+    return KphpDeviceIoControl(
+        KPH_ENUMERATEPROCESSHANDLESEX,
+        &input,
+        sizeof(input)
+        );
+}
+
+/**
+ * Enumerates the handles of a process that match a filter.
+ *
+ * \param ProcessHandle A handle to a process.
+ * \param Filter A filter which is evaluated by the driver, or NULL to return all handles.
+ * \param Handles A variable which receives a pointer to a buffer containing handle information.
+ * This is a KPH_PROCESS_HANDLE_COMPACT_INFORMATION structure if the filter specifies
+ * KPH_HANDLE_FILTER_COMPACT, otherwise it is a KPH_PROCESS_HANDLE_INFORMATION structure. You must
+ * free the buffer with PhFree() when you no longer need it.
+ */
+NTSTATUS KphEnumerateProcessHandlesEx2(
+    _In_ HANDLE ProcessHandle,
+    _In_opt_ PKPH_HANDLE_FILTER Filter,
+    _Out_ PVOID *Handles
+    )
+{
+    NTSTATUS status;
+    PVOID buffer;
+    ULONG bufferSize = 2048;
+
+    buffer = PhAllocate(bufferSize);
+
+    while (TRUE)
+    {
+        status = KphEnumerateProcessHandlesEx(
+            ProcessHandle,
+            Filter,
+            buffer,
+            bufferSize,
+            &bufferSize
+            );
+
+        if (status == STATUS_BUFFER_TOO_SMALL)
+        {
+            PhFree(buffer);
+            buffer = PhAllocate(bufferSize);
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    if (!NT_SUCCESS(status))
+    {
+        PhFree(buffer);
+        return status;
+    }
+
+    *Handles = buffer;
+
+    return status;
+}
+
 NTSTATUS KphQueryInformationObject(
     _In_ HANDLE ProcessHandle,
     _In_ HANDLE Handle,
@@ -1002,6 +1160,91 @@ NTSTATUS KphQueryInformationObject(
         );
 }
 
+NTSTATUS KphQueryInformationObjects(
+    _In_ HANDLE ProcessHandle,
+    _In_reads_(NumberOfHandles) PHANDLE Handles,
+    _In_ ULONG NumberOfHandles,
+    _Out_writes_bytes_(BufferLength) PVOID Buffer,
+    _In_ ULONG BufferLength,
+    _Out_opt_ PULONG ReturnLength
+    )
+{
+    struct
+    {
+        HANDLE ProcessHandle;
+        PHANDLE Handles;
+        ULONG NumberOfHandles;
+        PVOID Buffer;
+        ULONG BufferLength;
+        PULONG ReturnLength;
+    } input = { ProcessHandle, Handles, NumberOfHandles, Buffer, BufferLength, ReturnLength };
+
+    return KphpDeviceIoControl(
+        KPH_QUERYINFORMATIONOBJECTS,
+        &input,
+        sizeof(input)
+        );
+}
+
+/**
+ * Queries basic information, the type index and the name of multiple objects in one request.
+ *
+ * \param ProcessHandle A handle to the process which owns the handles.
+ * \param Handles An array of handles in the process.
+ * \param NumberOfHandles The number of elements in \a Handles. This must not be greater than
+ * KPH_OBJECT_BATCH_LIMIT.
+ * \param Information A variable which receives a pointer to a buffer containing the information.
+ * The entries are in the same order as \a Handles. You must free the buffer with PhFree() when you
+ * no longer need it.
+ */
+NTSTATUS KphQueryInformationObjects2(
+    _In_ HANDLE ProcessHandle,
+    _In_reads_(NumberOfHandles) PHANDLE Handles,
+    _In_ ULONG NumberOfHandles,
+    _Out_ PKPH_OBJECT_BATCH_INFORMATION *Information
+    )
+{
+    NTSTATUS status;
+    PVOID buffer;
+    ULONG bufferSize;
+
+    // Start with enough space for the entries and a reasonably sized name for each.
+    bufferSize = FIELD_OFFSET(KPH_OBJECT_BATCH_INFORMATION, Entries) + NumberOfHandles * (sizeof(KPH_OBJECT_BATCH_ENTRY) + 0x80);
+    buffer = PhAllocate(bufferSize);
+
+    while (TRUE)
+    {
+        status = KphQueryInformationObjects(
+            ProcessHandle,
+            Handles,
+            NumberOfHandles,
+            buffer,
+            bufferSize,
+            &bufferSize
+            );
+
+        if (status == STATUS_BUFFER_TOO_SMALL)
+        {
+            PhFree(buffer);
+            buffer = PhAllocate(bufferSize);
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    if (!NT_SUCCESS(status))
+    {
+        PhFree(buffer);
+        return status;
+    }
+
+    *Information = buffer;
+
+    return status;
+}
+
 NTSTATUS KphSetInformationObject(
     _In_ HANDLE ProcessHandle,
     _In_ HANDLE Handle,
@@ -1105,3 +1348,261 @@ NTSTATUS KphQueryInformationDriver(
         sizeof(input)
         );
 }
+
+/**
+ * Adds an operation to a batch.
+ *
+ * \param Batch The batch.
+ * \param KphControlCode The control code of the operation.
+ * \param Input The input buffer for the operation. The buffer is copied.
+ * \param InputLength The size of \a Input, in bytes.
+ * \param Index A variable which receives the index of the operation in
+ * the batch's Operations array.
+ */
+NTSTATUS KphAddBatchOperation(
+    _Inout_ PKPH_BATCH Batch,
+    _In_ ULONG KphControlCode,
+    _In_reads_bytes_(InputLength) PVOID Input,
+    _In_ ULONG InputLength,
+    _Out_opt_ PULONG Index
+    )
+{
+    PKPH_BATCH_OPERATION operation;
+
+    if (Batch->NumberOfOperations == KPH_BATCH_MAXIMUM_OPERATIONS)
+        return STATUS_INSUFFICIENT_RESOURCES;
+    if (InputLength > sizeof(Batch->Inputs[0]))
+        return STATUS_INVALID_BUFFER_SIZE;
+
+    operation = &Batch->Operations[Batch->NumberOfOperations];
+    memcpy(Batch->Inputs[Batch->NumberOfOperations], Input, InputLength);
+    operation->ControlCode = KphControlCode;
+    operation->InputLength = InputLength;
+    operation->Input = Batch->Inputs[Batch->NumberOfOperations];
+    operation->Status = STATUS_PENDING;
+
+    if (Index)
+        *Index = Batch->NumberOfOperations;
+
+    Batch->NumberOfOperations++;
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS KphBatchOpenProcess(
+    _Inout_ PKPH_BATCH Batch,
+    _Out_ PHANDLE ProcessHandle,
+    _In_ ACCESS_MASK DesiredAccess,
+    _In_ PCLIENT_ID ClientId,
+    _Out_opt_ PULONG Index
+    )
+{
+    struct
+    {
+        PHANDLE ProcessHandle;
+        ACCESS_MASK DesiredAccess;
+        PCLIENT_ID ClientId;
+    } input = { ProcessHandle, DesiredAccess, ClientId };
+
+    return KphAddBatchOperation(
+        Batch,
+        KPH_OPENPROCESS,
+        &input,
+        sizeof(input),
+        Index
+        );
+}
+
+NTSTATUS KphBatchQueryInformationProcess(
+    _Inout_ PKPH_BATCH Batch,
+    _In_ HANDLE ProcessHandle,
+    _In_ KPH_PROCESS_INFORMATION_CLASS ProcessInformationClass,
+    _Out_writes_bytes_(ProcessInformationLength) PVOID ProcessInformation,
+    _In_ ULONG ProcessInformationLength,
+    _Out_opt_ PULONG ReturnLength,
+    _Out_opt_ PULONG Index
+    )
+{
+    struct
+    {
+        HANDLE ProcessHandle;
+        KPH_PROCESS_INFORMATION_CLASS ProcessInformationClass;
+        PVOID ProcessInformation;
+        ULONG ProcessInformationLength;
+        PULONG ReturnLength;
+    } input = { ProcessHandle, ProcessInformationClass, ProcessInformation, ProcessInformationLength, ReturnLength };
+
+    return KphAddBatchOperation(
+        Batch,
+        KPH_QUERYINFORMATIONPROCESS,
+        &input,
+        sizeof(input),
+        Index
+        );
+}
+
+NTSTATUS KphBatchQueryInformationThread(
+    _Inout_ PKPH_BATCH Batch,
+    _In_ HANDLE ThreadHandle,
+    _In_ KPH_THREAD_INFORMATION_CLASS ThreadInformationClass,
+    _Out_writes_bytes_(ThreadInformationLength) PVOID ThreadInformation,
+    _In_ ULONG ThreadInformationLength,
+    _Out_opt_ PULONG ReturnLength,
+    _Out_opt_ PULONG Index
+    )
+{
+    struct
+    {
+        HANDLE ThreadHandle;
+        KPH_THREAD_INFORMATION_CLASS ThreadInformationClass;
+        PVOID ThreadInformation;
+        ULONG ThreadInformationLength;
+        PULONG ReturnLength;
+    } input = { ThreadHandle, ThreadInformationClass, ThreadInformation, ThreadInformationLength, ReturnLength };
+
+    return KphAddBatchOperation(
+        Batch,
+        KPH_QUERYINFORMATIONTHREAD,
+        &input,
+        sizeof(input),
+        Index
+        );
+}
+
+/**
+ * Executes the operations in a batch.
+ *
+ * \param Batch The batch. The status of each operation is stored in the
+ * Status field of its entry in the Operations array.
+ *
+ * \return STATUS_SUCCESS if every operation was executed, even if some of
+ * them failed. Otherwise, the error applies to all operations.
+ *
+ * \remarks The operations are executed in order with a single request to
+ * the driver. They must not depend on each other's results, because pointer
+ * arguments are captured before any of the operations run. If the driver
+ * does not support batches, the operations are sent one at a time.
+ */
+NTSTATUS KphExecuteBatch(
+    _Inout_ PKPH_BATCH Batch
+    )
+{
+    static BOOLEAN batchNotSupported = FALSE;
+
+    NTSTATUS status;
+    ULONG i;
+
+    if (Batch->NumberOfOperations == 0)
+        return STATUS_SUCCESS;
+
+    if (!batchNotSupported)
+    {
+        struct
+        {
+            PKPH_BATCH_OPERATION Operations;
+            ULONG NumberOfOperations;
+        } input = { Batch->Operations, Batch->NumberOfOperations };
+
+        status = KphpDeviceIoControl(
+            KPH_BATCH,
+            &input,
+            sizeof(input)
+            );
+
+        if (status != STATUS_INVALID_DEVICE_REQUEST)
+        {
+            if (!NT_SUCCESS(status))
+            {
+                for (i = 0; i < Batch->NumberOfOperations; i++)
+                    Batch->Operations[i].Status = status;
+            }
+
+            return status;
+        }
+
+        // Older drivers don't know about batches.
+        batchNotSupported = TRUE;
+    }
+
+    for (i = 0; i < Batch->NumberOfOperations; i++)
+    {
+        Batch->Operations[i].Status = KphpDeviceIoControl(
+            Batch->Operations[i].ControlCode,
+            Batch->Operations[i].Input,
+            Batch->Operations[i].InputLength
+            );
+    }
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS KphMapEventRing(
+    _Out_ PKPH_EVENT_RING *EventRing
+    )
+{
+    struct
+    {
+        PVOID *BaseAddress;
+    } input = { EventRing };
+
+    return KphpDeviceIoControl(
+        KPH_MAPEVENTRING,
+        &input,
+        sizeof(input)
+        );
+}
+
+/**
+ * Reads the next event from an event ring.
+ *
+ * \param Reader An event reader initialized with KphInitializeEventReader().
+ * \param Event A variable which receives a copy of the event.
+ *
+ * \return STATUS_SUCCESS if an event was read, STATUS_NO_MORE_ENTRIES if
+ * there are no more events yet, or STATUS_DATA_OVERRUN if the driver has
+ * overwritten events that the reader had not read yet. In the last case the
+ * reader skips to the newest event and the caller should fall back to a full
+ * snapshot.
+ */
+NTSTATUS KphReadEvent(
+    _Inout_ PKPH_EVENT_READER Reader,
+    _Out_ PKPH_EVENT Event
+    )
+{
+    PKPH_EVENT_RING ring = Reader->Ring;
+    ULONG position = Reader->Position;
+    PKPH_EVENT entry;
+
+    if (ring->Head - position > KPH_EVENT_RING_NUMBER_OF_ENTRIES)
+        goto OverrunExit;
+    if (ring->Head == position)
+        return STATUS_NO_MORE_ENTRIES;
+
+    entry = &ring->Entries[position & (KPH_EVENT_RING_NUMBER_OF_ENTRIES - 1)];
+
+    if (entry->Sequence != position + 1)
+    {
+        // Either the event is still being written or we have been lapped.
+        if (ring->Head - position > KPH_EVENT_RING_NUMBER_OF_ENTRIES)
+            goto OverrunExit;
+
+        return STATUS_NO_MORE_ENTRIES;
+    }
+
+    MemoryBarrier();
+    memcpy(Event, (PVOID)entry, sizeof(KPH_EVENT));
+    MemoryBarrier();
+
+    // Make sure a writer didn't start overwriting the event while we were copying it.
+    if (entry->Sequence != position + 1)
+        goto OverrunExit;
+
+    Reader->Position = position + 1;
+
+    return STATUS_SUCCESS;
+
+OverrunExit:
+    Reader->Position = ring->Head;
+
+    return STATUS_DATA_OVERRUN;
+}
\ No newline at end of file
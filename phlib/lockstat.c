@@ -0,0 +1,400 @@
+/*
+ * Process Hacker -
+ *   lock statistics
+ *
+ * Copyright (C) 2016 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Statistics are kept per registration name, so that (for example) the locks of all
+ * thread providers are reported together. Each registered lock gets a slot in an
+ * open addressing table keyed by the lock's address. Slots are looked up without
+ * locking because the lookup happens on every acquire and release; registration
+ * fills in a slot before publishing its address, and unregistration replaces the
+ * address with a tombstone so that probe sequences stay intact.
+ *
+ * Hold times are only measured for exclusive owners, since there is nowhere to store
+ * the acquire time of each shared owner.
+ */
+
+#include <phbase.h>
+
+#ifdef PH_LOCK_STATISTICS
+
+#define PH_LOCK_STATISTICS_NUMBER_OF_SLOTS 1024 // must be a power of two
+#define PH_LOCK_STATISTICS_SLOT_DELETED ((PVOID)1)
+
+typedef struct _PH_LOCK_STATISTICS_ENTRY
+{
+    PWSTR Name;
+    ULONG NumberOfLocks;
+    volatile ULONG64 ExclusiveAcquireCount;
+    volatile ULONG64 SharedAcquireCount;
+    volatile ULONG64 ContendedCount;
+    volatile ULONG64 TotalWaitTime;
+    volatile ULONG64 MaximumHoldTime;
+} PH_LOCK_STATISTICS_ENTRY, *PPH_LOCK_STATISTICS_ENTRY;
+
+typedef struct _PH_LOCK_STATISTICS_SLOT
+{
+    PVOID volatile Lock;
+    ULONG EntryIndex;
+    // Only modified by the exclusive owner of the lock.
+    ULONG64 AcquireTime;
+} PH_LOCK_STATISTICS_SLOT, *PPH_LOCK_STATISTICS_SLOT;
+
+BOOLEAN PhLockStatisticsEnabled = FALSE;
+
+static PH_QUEUED_LOCK PhpLockStatisticsLock = PH_QUEUED_LOCK_INIT;
+static PH_LOCK_STATISTICS_ENTRY PhpLockStatisticsEntries[PH_LOCK_STATISTICS_MAXIMUM_NAMES];
+static ULONG PhpNumberOfLockStatisticsEntries = 0;
+static PH_LOCK_STATISTICS_SLOT PhpLockStatisticsSlots[PH_LOCK_STATISTICS_NUMBER_OF_SLOTS];
+static LARGE_INTEGER PhpLockStatisticsFrequency;
+
+FORCEINLINE VOID PhpAddLockStatistic(
+    _Inout_ volatile ULONG64 *Value,
+    _In_ ULONG64 Increment
+    )
+{
+#ifdef _WIN64
+    _InterlockedExchangeAdd64((volatile LONG64 *)Value, Increment);
+#else
+    ULONG64 value;
+
+    do
+    {
+        value = *Value;
+    } while ((ULONG64)_InterlockedCompareExchange64((volatile LONG64 *)Value, value + Increment, value) != value);
+#endif
+}
+
+FORCEINLINE VOID PhpMaximumLockStatistic(
+    _Inout_ volatile ULONG64 *Value,
+    _In_ ULONG64 NewValue
+    )
+{
+    ULONG64 value;
+
+    while ((value = *Value) < NewValue)
+    {
+        if ((ULONG64)_InterlockedCompareExchange64((volatile LONG64 *)Value, NewValue, value) == value)
+            break;
+    }
+}
+
+FORCEINLINE ULONG64 PhpQueryLockStatisticsTime(
+    VOID
+    )
+{
+    LARGE_INTEGER performanceCounter;
+
+    NtQueryPerformanceCounter(&performanceCounter, NULL);
+
+    return performanceCounter.QuadPart;
+}
+
+static PPH_LOCK_STATISTICS_SLOT PhpFindLockStatisticsSlot(
+    _In_ PVOID Lock
+    )
+{
+    ULONG index;
+    ULONG i;
+    PVOID lock;
+
+    index = PhHashIntPtr((ULONG_PTR)Lock) & (PH_LOCK_STATISTICS_NUMBER_OF_SLOTS - 1);
+
+    for (i = 0; i < PH_LOCK_STATISTICS_NUMBER_OF_SLOTS; i++)
+    {
+        lock = PhpLockStatisticsSlots[index].Lock;
+
+        if (lock == Lock)
+            return &PhpLockStatisticsSlots[index];
+        if (!lock)
+            break;
+
+        index = (index + 1) & (PH_LOCK_STATISTICS_NUMBER_OF_SLOTS - 1);
+    }
+
+    return NULL;
+}
+
+/**
+ * Starts recording statistics for a lock.
+ *
+ * \param Lock A queued lock or fast lock.
+ * \param Name The name to report the statistics under. Locks registered with the
+ * same name share their statistics. The string must remain valid for the lifetime of
+ * the process.
+ */
+VOID NTAPI PhRegisterLockStatistics(
+    _In_ PVOID Lock,
+    _In_ PWSTR Name
+    )
+{
+    ULONG entryIndex;
+    ULONG index;
+    ULONG i;
+    PPH_LOCK_STATISTICS_SLOT freeSlot = NULL;
+    PVOID lock;
+
+    PhAcquireQueuedLockExclusive(&PhpLockStatisticsLock);
+
+    if (PhpFindLockStatisticsSlot(Lock))
+        goto CleanupExit;
+
+    for (entryIndex = 0; entryIndex < PhpNumberOfLockStatisticsEntries; entryIndex++)
+    {
+        if (PhEqualStringZ(PhpLockStatisticsEntries[entryIndex].Name, Name, FALSE))
+            break;
+    }
+
+    if (entryIndex == PhpNumberOfLockStatisticsEntries)
+    {
+        if (PhpNumberOfLockStatisticsEntries == PH_LOCK_STATISTICS_MAXIMUM_NAMES)
+            goto CleanupExit;
+
+        PhpLockStatisticsEntries[entryIndex].Name = Name;
+        PhpNumberOfLockStatisticsEntries++;
+    }
+
+    index = PhHashIntPtr((ULONG_PTR)Lock) & (PH_LOCK_STATISTICS_NUMBER_OF_SLOTS - 1);
+
+    for (i = 0; i < PH_LOCK_STATISTICS_NUMBER_OF_SLOTS; i++)
+    {
+        lock = PhpLockStatisticsSlots[index].Lock;
+
+        if (!lock || lock == PH_LOCK_STATISTICS_SLOT_DELETED)
+        {
+            freeSlot = &PhpLockStatisticsSlots[index];
+            break;
+        }
+
+        index = (index + 1) & (PH_LOCK_STATISTICS_NUMBER_OF_SLOTS - 1);
+    }
+
+    if (freeSlot)
+    {
+        freeSlot->EntryIndex = entryIndex;
+        freeSlot->AcquireTime = 0;
+        PhpLockStatisticsEntries[entryIndex].NumberOfLocks++;
+
+        // Publish the slot only after it has been filled in.
+        _InterlockedExchangePointer((PVOID *)&freeSlot->Lock, Lock);
+    }
+
+CleanupExit:
+    PhReleaseQueuedLockExclusive(&PhpLockStatisticsLock);
+}
+
+/**
+ * Stops recording statistics for a lock. This must be called before the memory
+ * containing the lock is freed.
+ *
+ * \param Lock A lock registered with PhRegisterLockStatistics().
+ */
+VOID NTAPI PhUnregisterLockStatistics(
+    _In_ PVOID Lock
+    )
+{
+    PPH_LOCK_STATISTICS_SLOT slot;
+
+    PhAcquireQueuedLockExclusive(&PhpLockStatisticsLock);
+
+    if (slot = PhpFindLockStatisticsSlot(Lock))
+    {
+        PhpLockStatisticsEntries[slot->EntryIndex].NumberOfLocks--;
+        _InterlockedExchangePointer((PVOID *)&slot->Lock, PH_LOCK_STATISTICS_SLOT_DELETED);
+    }
+
+    PhReleaseQueuedLockExclusive(&PhpLockStatisticsLock);
+}
+
+/**
+ * Records an acquire of a lock. Call PhRecordLockAcquire() instead of calling this
+ * function directly.
+ *
+ * \param Lock The lock that was acquired.
+ * \param Exclusive TRUE if the lock was acquired in exclusive mode, otherwise FALSE.
+ * \param WaitStartTime The value returned by PhBeginLockWait() when the caller
+ * started waiting for the lock, or 0 if the lock was acquired without contention.
+ */
+VOID FASTCALL PhfRecordLockAcquire(
+    _In_ PVOID Lock,
+    _In_ BOOLEAN Exclusive,
+    _In_ ULONG64 WaitStartTime
+    )
+{
+    PPH_LOCK_STATISTICS_SLOT slot;
+    PPH_LOCK_STATISTICS_ENTRY entry;
+    ULONG64 time = 0;
+
+    if (!(slot = PhpFindLockStatisticsSlot(Lock)))
+        return;
+
+    entry = &PhpLockStatisticsEntries[slot->EntryIndex];
+
+    if (Exclusive)
+        PhpAddLockStatistic(&entry->ExclusiveAcquireCount, 1);
+    else
+        PhpAddLockStatistic(&entry->SharedAcquireCount, 1);
+
+    if (WaitStartTime || Exclusive)
+        time = PhpQueryLockStatisticsTime();
+
+    if (WaitStartTime)
+    {
+        PhpAddLockStatistic(&entry->ContendedCount, 1);
+        PhpAddLockStatistic(&entry->TotalWaitTime, time - WaitStartTime);
+    }
+
+    if (Exclusive)
+        slot->AcquireTime = time;
+}
+
+/**
+ * Records a release of a lock in exclusive mode. Call PhRecordLockRelease() instead
+ * of calling this function directly.
+ *
+ * \param Lock The lock that is about to be released.
+ */
+VOID FASTCALL PhfRecordLockRelease(
+    _In_ PVOID Lock
+    )
+{
+    PPH_LOCK_STATISTICS_SLOT slot;
+    ULONG64 acquireTime;
+
+    if (!(slot = PhpFindLockStatisticsSlot(Lock)))
+        return;
+
+    acquireTime = slot->AcquireTime;
+
+    if (acquireTime)
+    {
+        slot->AcquireTime = 0;
+        PhpMaximumLockStatistic(
+            &PhpLockStatisticsEntries[slot->EntryIndex].MaximumHoldTime,
+            PhpQueryLockStatisticsTime() - acquireTime
+            );
+    }
+}
+
+#endif
+
+/**
+ * Gets statistics for all registered locks.
+ *
+ * \param Information A variable which receives the statistics.
+ */
+VOID NTAPI PhGetLockStatistics(
+    _Out_ PPH_LOCK_STATISTICS_INFORMATION Information
+    )
+{
+#ifdef PH_LOCK_STATISTICS
+    ULONG i;
+    ULONG64 frequency;
+
+    memset(Information, 0, sizeof(PH_LOCK_STATISTICS_INFORMATION));
+    Information->Available = TRUE;
+    Information->Enabled = PhLockStatisticsEnabled;
+
+    // Convert performance counter ticks to microseconds.
+    frequency = PhpLockStatisticsFrequency.QuadPart ? PhpLockStatisticsFrequency.QuadPart : 1000000;
+
+    PhAcquireQueuedLockShared(&PhpLockStatisticsLock);
+
+    for (i = 0; i < PhpNumberOfLockStatisticsEntries; i++)
+    {
+        PPH_LOCK_STATISTICS_ENTRY entry = &PhpLockStatisticsEntries[i];
+        PPH_LOCK_STATISTICS statistics = &Information->Entries[i];
+
+        statistics->Name = entry->Name;
+        statistics->NumberOfLocks = entry->NumberOfLocks;
+        statistics->ExclusiveAcquireCount = entry->ExclusiveAcquireCount;
+        statistics->SharedAcquireCount = entry->SharedAcquireCount;
+        statistics->ContendedCount = entry->ContendedCount;
+        statistics->TotalWaitTime = entry->TotalWaitTime * 1000000 / frequency;
+        statistics->MaximumHoldTime = entry->MaximumHoldTime * 1000000 / frequency;
+    }
+
+    Information->NumberOfEntries = PhpNumberOfLockStatisticsEntries;
+
+    PhReleaseQueuedLockShared(&PhpLockStatisticsLock);
+#else
+    memset(Information, 0, sizeof(PH_LOCK_STATISTICS_INFORMATION));
+#endif
+}
+
+/**
+ * Starts or stops recording lock statistics.
+ *
+ * \param Enabled TRUE to start recording, FALSE to stop recording.
+ */
+VOID NTAPI PhSetLockStatisticsEnabled(
+    _In_ BOOLEAN Enabled
+    )
+{
+#ifdef PH_LOCK_STATISTICS
+    ULONG i;
+
+    PhAcquireQueuedLockExclusive(&PhpLockStatisticsLock);
+
+    if (Enabled && !PhLockStatisticsEnabled)
+    {
+        LARGE_INTEGER performanceCounter;
+
+        NtQueryPerformanceCounter(&performanceCounter, &PhpLockStatisticsFrequency);
+
+        // Locks acquired while recording was off would otherwise report their hold time
+        // from an old acquire.
+        for (i = 0; i < PH_LOCK_STATISTICS_NUMBER_OF_SLOTS; i++)
+            PhpLockStatisticsSlots[i].AcquireTime = 0;
+    }
+
+    PhLockStatisticsEnabled = Enabled;
+
+    PhReleaseQueuedLockExclusive(&PhpLockStatisticsLock);
+#endif
+}
+
+/**
+ * Clears the statistics of all registered locks.
+ */
+VOID NTAPI PhResetLockStatistics(
+    VOID
+    )
+{
+#ifdef PH_LOCK_STATISTICS
+    ULONG i;
+
+    PhAcquireQueuedLockExclusive(&PhpLockStatisticsLock);
+
+    for (i = 0; i < PhpNumberOfLockStatisticsEntries; i++)
+    {
+        PPH_LOCK_STATISTICS_ENTRY entry = &PhpLockStatisticsEntries[i];
+
+        entry->ExclusiveAcquireCount = 0;
+        entry->SharedAcquireCount = 0;
+        entry->ContendedCount = 0;
+        entry->TotalWaitTime = 0;
+        entry->MaximumHoldTime = 0;
+    }
+
+    PhReleaseQueuedLockExclusive(&PhpLockStatisticsLock);
+#endif
+}
@@ -31,8 +31,25 @@
 
 #include <ph.h>
 
+#define PH_SID_CACHE_TIMEOUT (10 * 60 * 1000) // 10 minutes
+#define PH_SID_CACHE_NEGATIVE_TIMEOUT (60 * 1000) // 1 minute
+#define PH_SID_CACHE_MAXIMUM_ENTRIES 4096
+
+typedef struct _PH_SID_CACHE_ENTRY
+{
+    PSID Sid;
+    PPH_STRING Name; // NULL if the SID could not be resolved
+    PPH_STRING DomainName;
+    SID_NAME_USE NameUse;
+    ULONG64 ExpiryTime;
+} PH_SID_CACHE_ENTRY, *PPH_SID_CACHE_ENTRY;
+
 static LSA_HANDLE PhLookupPolicyHandle = NULL;
 
+static PH_INITONCE PhSidCacheInitOnce = PH_INITONCE_INIT;
+static PPH_HASHTABLE PhSidCacheHashtable;
+static PH_QUEUED_LOCK PhSidCacheLock = PH_QUEUED_LOCK_INIT;
+
 NTSTATUS PhOpenLsaPolicy(
     _Out_ PLSA_HANDLE PolicyHandle,
     _In_ ACCESS_MASK DesiredAccess,
@@ -368,6 +385,264 @@ NTSTATUS PhLookupName(
     return status;
 }
 
+static BOOLEAN NTAPI PhpSidCacheEqualFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    )
+{
+    PPH_SID_CACHE_ENTRY entry1 = Entry1;
+    PPH_SID_CACHE_ENTRY entry2 = Entry2;
+
+    return RtlEqualSid(entry1->Sid, entry2->Sid);
+}
+
+static ULONG NTAPI PhpSidCacheHashFunction(
+    _In_ PVOID Entry
+    )
+{
+    PPH_SID_CACHE_ENTRY entry = Entry;
+
+    return PhHashBytes((PUCHAR)entry->Sid, RtlLengthSid(entry->Sid));
+}
+
+static VOID PhpDeleteSidCacheEntry(
+    _In_ PPH_SID_CACHE_ENTRY Entry
+    )
+{
+    PhFree(Entry->Sid);
+    PhClearReference(&Entry->Name);
+    PhClearReference(&Entry->DomainName);
+}
+
+static VOID PhpInitializeSidCache(
+    VOID
+    )
+{
+    if (PhBeginInitOnce(&PhSidCacheInitOnce))
+    {
+        PhSidCacheHashtable = PhCreateHashtable(
+            sizeof(PH_SID_CACHE_ENTRY),
+            PhpSidCacheEqualFunction,
+            PhpSidCacheHashFunction,
+            64
+            );
+
+        PhEndInitOnce(&PhSidCacheInitOnce);
+    }
+}
+
+/**
+ * Adds an entry to the SID cache, replacing any existing entry.
+ *
+ * \remarks The cache lock must be held exclusively. The cache takes
+ * ownership of the references to \a Name and \a DomainName.
+ */
+static VOID PhpAddSidCacheEntry(
+    _In_ PSID Sid,
+    _In_opt_ PPH_STRING Name,
+    _In_opt_ PPH_STRING DomainName,
+    _In_ SID_NAME_USE NameUse,
+    _In_ ULONG64 CurrentTime
+    )
+{
+    PH_SID_CACHE_ENTRY entry;
+    PPH_SID_CACHE_ENTRY existingEntry;
+
+    entry.Sid = Sid;
+
+    if (existingEntry = PhFindEntryHashtable(PhSidCacheHashtable, &entry))
+    {
+        PhMoveReference(&existingEntry->Name, Name);
+        PhMoveReference(&existingEntry->DomainName, DomainName);
+        existingEntry->NameUse = NameUse;
+        existingEntry->ExpiryTime = CurrentTime + (Name ? PH_SID_CACHE_TIMEOUT : PH_SID_CACHE_NEGATIVE_TIMEOUT);
+        return;
+    }
+
+    // This is a simple way to keep the cache from growing forever. The entries are cheap to
+    // recreate.
+    if (PhSidCacheHashtable->Count >= PH_SID_CACHE_MAXIMUM_ENTRIES)
+    {
+        ULONG enumerationKey = 0;
+        PPH_SID_CACHE_ENTRY oldEntry;
+
+        while (PhEnumHashtable(PhSidCacheHashtable, &oldEntry, &enumerationKey))
+            PhpDeleteSidCacheEntry(oldEntry);
+
+        PhClearHashtable(PhSidCacheHashtable);
+    }
+
+    entry.Sid = PhAllocateCopy(Sid, RtlLengthSid(Sid));
+    entry.Name = Name;
+    entry.DomainName = DomainName;
+    entry.NameUse = NameUse;
+    entry.ExpiryTime = CurrentTime + (Name ? PH_SID_CACHE_TIMEOUT : PH_SID_CACHE_NEGATIVE_TIMEOUT);
+    PhAddEntryHashtable(PhSidCacheHashtable, &entry);
+}
+
+/**
+ * Resolves SIDs using LSA and stores the results in the SID cache.
+ */
+static NTSTATUS PhpLookupSidsAndCache(
+    _In_ ULONG Count,
+    _In_reads_(Count) PSID *Sids
+    )
+{
+    NTSTATUS status;
+    PLSA_REFERENCED_DOMAIN_LIST referencedDomains;
+    PLSA_TRANSLATED_NAME names;
+    ULONG64 currentTime;
+    ULONG i;
+
+    referencedDomains = NULL;
+    names = NULL;
+
+    status = LsaLookupSids(
+        PhGetLookupPolicyHandle(),
+        Count,
+        Sids,
+        &referencedDomains,
+        &names
+        );
+    currentTime = NtGetTickCount64();
+
+    PhAcquireQueuedLockExclusive(&PhSidCacheLock);
+
+    for (i = 0; i < Count; i++)
+    {
+        PPH_STRING name = NULL;
+        PPH_STRING domainName = NULL;
+        SID_NAME_USE nameUse = SidTypeUnknown;
+
+        // If the lookup failed completely (for example, because a domain controller could not
+        // be reached), we still add negative entries so that we don't keep waiting on it.
+        if (NT_SUCCESS(status) && names[i].Use != SidTypeInvalid && names[i].Use != SidTypeUnknown)
+        {
+            name = PhCreateStringFromUnicodeString(&names[i].Name);
+            nameUse = names[i].Use;
+
+            if (names[i].DomainIndex >= 0)
+                domainName = PhCreateStringFromUnicodeString(&referencedDomains->Domains[names[i].DomainIndex].Name);
+        }
+
+        PhpAddSidCacheEntry(Sids[i], name, domainName, nameUse, currentTime);
+    }
+
+    PhReleaseQueuedLockExclusive(&PhSidCacheLock);
+
+    // LsaLookupSids allocates memory even if it returns STATUS_NONE_MAPPED.
+    if (referencedDomains)
+        LsaFreeMemory(referencedDomains);
+    if (names)
+        LsaFreeMemory(names);
+
+    return status;
+}
+
+/**
+ * Looks up a SID in the SID cache.
+ *
+ * \return TRUE if a current entry was found, otherwise FALSE.
+ */
+static BOOLEAN PhpLookupSidCache(
+    _In_ PSID Sid,
+    _In_ BOOLEAN IncludeDomain,
+    _Out_ PPH_STRING *FullName,
+    _Out_opt_ PSID_NAME_USE NameUse
+    )
+{
+    PH_SID_CACHE_ENTRY lookupEntry;
+    PPH_SID_CACHE_ENTRY entry;
+    BOOLEAN found = FALSE;
+
+    lookupEntry.Sid = Sid;
+
+    PhAcquireQueuedLockShared(&PhSidCacheLock);
+
+    entry = PhFindEntryHashtable(PhSidCacheHashtable, &lookupEntry);
+
+    if (entry && NtGetTickCount64() < entry->ExpiryTime)
+    {
+        found = TRUE;
+
+        if (!entry->Name)
+        {
+            *FullName = NULL;
+        }
+        else if (IncludeDomain && !PhIsNullOrEmptyString(entry->DomainName))
+        {
+            *FullName = PhConcatStrings(3, entry->DomainName->Buffer, L"\\", entry->Name->Buffer);
+        }
+        else
+        {
+            PhReferenceObject(entry->Name);
+            *FullName = entry->Name;
+        }
+
+        if (entry->Name && NameUse)
+            *NameUse = entry->NameUse;
+    }
+
+    PhReleaseQueuedLockShared(&PhSidCacheLock);
+
+    return found;
+}
+
+/**
+ * Resolves the names of multiple SIDs using a single LSA request.
+ *
+ * \param Count The number of SIDs.
+ * \param Sids An array of SIDs.
+ *
+ * \remarks The results are stored in a process-wide cache, so later
+ * calls to PhGetSidFullName() for these SIDs return immediately. SIDs
+ * which are already cached are not looked up again.
+ */
+NTSTATUS PhLookupSidsToCache(
+    _In_ ULONG Count,
+    _In_reads_(Count) PSID *Sids
+    )
+{
+    NTSTATUS status;
+    PSID *pendingSids;
+    ULONG numberOfPendingSids;
+    PH_SID_CACHE_ENTRY lookupEntry;
+    PPH_SID_CACHE_ENTRY entry;
+    ULONG64 currentTime;
+    ULONG i;
+
+    PhpInitializeSidCache();
+
+    if (Count == 0)
+        return STATUS_SUCCESS;
+
+    pendingSids = PhAllocate(Count * sizeof(PSID));
+    numberOfPendingSids = 0;
+    currentTime = NtGetTickCount64();
+
+    PhAcquireQueuedLockShared(&PhSidCacheLock);
+
+    for (i = 0; i < Count; i++)
+    {
+        lookupEntry.Sid = Sids[i];
+        entry = PhFindEntryHashtable(PhSidCacheHashtable, &lookupEntry);
+
+        if (!entry || currentTime >= entry->ExpiryTime)
+            pendingSids[numberOfPendingSids++] = Sids[i];
+    }
+
+    PhReleaseQueuedLockShared(&PhSidCacheLock);
+
+    if (numberOfPendingSids != 0)
+        status = PhpLookupSidsAndCache(numberOfPendingSids, pendingSids);
+    else
+        status = STATUS_SUCCESS;
+
+    PhFree(pendingSids);
+
+    return status;
+}
+
 /**
  * Gets the name of a SID.
  *
@@ -383,6 +658,9 @@ NTSTATUS PhLookupName(
  * using PhDereferenceObject() when you no longer
  * need it. If an error occurs, the function
  * returns NULL.
+ *
+ * \remarks Results (including failures) are cached for a
+ * period of time. See PhLookupSidsToCache().
  */
 PPH_STRING PhGetSidFullName(
     _In_ PSID Sid,
@@ -390,77 +668,41 @@ PPH_STRING PhGetSidFullName(
     _Out_opt_ PSID_NAME_USE NameUse
     )
 {
-    NTSTATUS status;
     PPH_STRING fullName;
-    LSA_HANDLE policyHandle;
-    PLSA_REFERENCED_DOMAIN_LIST referencedDomains;
-    PLSA_TRANSLATED_NAME names;
 
-    policyHandle = PhGetLookupPolicyHandle();
+    PhpInitializeSidCache();
 
-    referencedDomains = NULL;
-    names = NULL;
+    if (PhpLookupSidCache(Sid, IncludeDomain, &fullName, NameUse))
+        return fullName;
 
-    if (NT_SUCCESS(status = LsaLookupSids(
-        policyHandle,
-        1,
-        &Sid,
-        &referencedDomains,
-        &names
-        )))
-    {
-        if (names[0].Use != SidTypeInvalid && names[0].Use != SidTypeUnknown)
-        {
-            PWSTR domainNameBuffer;
-            ULONG domainNameLength;
+    PhpLookupSidsAndCache(1, &Sid);
 
-            if (IncludeDomain && names[0].DomainIndex >= 0)
-            {
-                PLSA_TRUST_INFORMATION trustInfo;
+    if (PhpLookupSidCache(Sid, IncludeDomain, &fullName, NameUse))
+        return fullName;
 
-                trustInfo = &referencedDomains->Domains[names[0].DomainIndex];
-                domainNameBuffer = trustInfo->Name.Buffer;
-                domainNameLength = trustInfo->Name.Length;
-            }
-            else
-            {
-                domainNameBuffer = NULL;
-                domainNameLength = 0;
-            }
+    return NULL;
+}
 
-            if (domainNameBuffer && domainNameLength != 0)
-            {
-                fullName = PhCreateStringEx(NULL, domainNameLength + sizeof(WCHAR) + names[0].Name.Length);
-                memcpy(&fullName->Buffer[0], domainNameBuffer, domainNameLength);
-                fullName->Buffer[domainNameLength / sizeof(WCHAR)] = '\\';
-                memcpy(&fullName->Buffer[domainNameLength / sizeof(WCHAR) + 1], names[0].Name.Buffer, names[0].Name.Length);
-            }
-            else
-            {
-                fullName = PhCreateStringFromUnicodeString(&names[0].Name);
-            }
+/**
+ * Removes all entries from the SID cache.
+ */
+VOID PhFlushSidCache(
+    VOID
+    )
+{
+    ULONG enumerationKey = 0;
+    PPH_SID_CACHE_ENTRY entry;
 
-            if (NameUse)
-            {
-                *NameUse = names[0].Use;
-            }
-        }
-        else
-        {
-            fullName = NULL;
-        }
-    }
-    else
-    {
-        fullName = NULL;
-    }
+    PhpInitializeSidCache();
 
-    if (referencedDomains)
-        LsaFreeMemory(referencedDomains);
-    if (names)
-        LsaFreeMemory(names);
+    PhAcquireQueuedLockExclusive(&PhSidCacheLock);
+
+    while (PhEnumHashtable(PhSidCacheHashtable, &entry, &enumerationKey))
+        PhpDeleteSidCacheEntry(entry);
+
+    PhClearHashtable(PhSidCacheHashtable);
 
-    return fullName;
+    PhReleaseQueuedLockExclusive(&PhSidCacheLock);
 }
 
 /**
@@ -42,6 +42,35 @@ ULONG PhpLookupMappedImageExportName(
     _In_ PSTR Name
     );
 
+#define PH_EXPORT_INDEX_CACHE_MAXIMUM 32
+#define PH_EXPORT_INDEX_FORWARDER ULONG_MAX
+
+typedef struct _PH_EXPORT_INDEX_NAME
+{
+    PSTR Name;
+    ULONG Hash;
+    ULONG Index; // unbiased ordinal
+} PH_EXPORT_INDEX_NAME, *PPH_EXPORT_INDEX_NAME;
+
+// A copy of the parts of an export table needed to resolve procedures in other processes.
+typedef struct _PH_EXPORT_INDEX
+{
+    PPH_STRING FileName;
+    LARGE_INTEGER LastWriteTime;
+    LARGE_INTEGER EndOfFile;
+    USHORT Magic;
+
+    ULONG Base;
+    ULONG NumberOfFunctions;
+    PULONG AddressTable; // PH_EXPORT_INDEX_FORWARDER for forwarded exports
+    PPH_HASHTABLE NameHashtable;
+    PSTR NameBuffer;
+} PH_EXPORT_INDEX, *PPH_EXPORT_INDEX;
+
+static PH_INITONCE PhpExportIndexCacheInitOnce = PH_INITONCE_INIT;
+static PPH_HASHTABLE PhpExportIndexCache;
+static PH_QUEUED_LOCK PhpExportIndexCacheLock = PH_QUEUED_LOCK_INIT;
+
 NTSTATUS PhInitializeMappedImage(
     _Out_ PPH_MAPPED_IMAGE MappedImage,
     _In_ PVOID ViewBase,
@@ -783,6 +812,309 @@ NTSTATUS PhGetMappedImageExportFunctionRemote(
     return STATUS_SUCCESS;
 }
 
+static BOOLEAN PhpExportIndexNameCompareFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    )
+{
+    PPH_EXPORT_INDEX_NAME name1 = Entry1;
+    PPH_EXPORT_INDEX_NAME name2 = Entry2;
+
+    return name1->Hash == name2->Hash && strcmp(name1->Name, name2->Name) == 0;
+}
+
+static ULONG PhpExportIndexNameHashFunction(
+    _In_ PVOID Entry
+    )
+{
+    return ((PPH_EXPORT_INDEX_NAME)Entry)->Hash;
+}
+
+static BOOLEAN PhpExportIndexCacheCompareFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    )
+{
+    return PhEqualString((*(PPH_EXPORT_INDEX *)Entry1)->FileName, (*(PPH_EXPORT_INDEX *)Entry2)->FileName, TRUE);
+}
+
+static ULONG PhpExportIndexCacheHashFunction(
+    _In_ PVOID Entry
+    )
+{
+    return PhHashStringRef(&(*(PPH_EXPORT_INDEX *)Entry)->FileName->sr, TRUE);
+}
+
+static VOID PhpDestroyExportIndex(
+    _In_ _Post_invalid_ PPH_EXPORT_INDEX Index
+    )
+{
+    PhDereferenceObject(Index->FileName);
+
+    if (Index->AddressTable) PhFree(Index->AddressTable);
+    if (Index->NameHashtable) PhDereferenceObject(Index->NameHashtable);
+    if (Index->NameBuffer) PhFree(Index->NameBuffer);
+
+    PhFree(Index);
+}
+
+static NTSTATUS PhpCreateExportIndex(
+    _In_ PWSTR FileName,
+    _In_ PFILE_NETWORK_OPEN_INFORMATION FileInformation,
+    _Out_ PPH_EXPORT_INDEX *Index
+    )
+{
+    NTSTATUS status;
+    PH_MAPPED_IMAGE mappedImage;
+    PH_MAPPED_IMAGE_EXPORTS exports;
+    PPH_EXPORT_INDEX index;
+    ULONG numberOfNames;
+    ULONG i;
+
+    if (!NT_SUCCESS(status = PhLoadMappedImage(FileName, NULL, TRUE, &mappedImage)))
+        return status;
+
+    index = PhAllocate(sizeof(PH_EXPORT_INDEX));
+    memset(index, 0, sizeof(PH_EXPORT_INDEX));
+    index->FileName = PhCreateString(FileName);
+    index->LastWriteTime = FileInformation->LastWriteTime;
+    index->EndOfFile = FileInformation->EndOfFile;
+    index->Magic = mappedImage.Magic;
+
+    if (!NT_SUCCESS(status = PhGetMappedImageExports(&exports, &mappedImage)))
+        goto CleanupExit;
+
+    __try
+    {
+        SIZE_T nameBufferSize = 0;
+        PSTR nameBuffer;
+
+        index->Base = exports.ExportDirectory->Base;
+        index->NumberOfFunctions = exports.ExportDirectory->NumberOfFunctions;
+        index->AddressTable = PhAllocate(max(index->NumberOfFunctions, 1) * sizeof(ULONG));
+
+        for (i = 0; i < index->NumberOfFunctions; i++)
+        {
+            ULONG rva = exports.AddressTable[i];
+
+            if (
+                (rva >= exports.DataDirectory->VirtualAddress) &&
+                (rva < exports.DataDirectory->VirtualAddress + exports.DataDirectory->Size)
+                )
+                rva = PH_EXPORT_INDEX_FORWARDER;
+
+            index->AddressTable[i] = rva;
+        }
+
+        numberOfNames = min(exports.ExportDirectory->NumberOfNames, index->NumberOfFunctions);
+
+        // Copy all of the names into one buffer so the image can be unmapped.
+
+        for (i = 0; i < numberOfNames; i++)
+        {
+            PSTR name;
+
+            if (name = PhMappedImageRvaToVa(&mappedImage, exports.NamePointerTable[i], NULL))
+                nameBufferSize += strlen(name) + 1;
+        }
+
+        index->NameBuffer = nameBuffer = PhAllocate(max(nameBufferSize, 1));
+        index->NameHashtable = PhCreateHashtable(
+            sizeof(PH_EXPORT_INDEX_NAME),
+            PhpExportIndexNameCompareFunction,
+            PhpExportIndexNameHashFunction,
+            max(numberOfNames, 1)
+            );
+
+        for (i = 0; i < numberOfNames; i++)
+        {
+            PSTR name;
+            SIZE_T length;
+            PH_EXPORT_INDEX_NAME entry;
+
+            if (!(name = PhMappedImageRvaToVa(&mappedImage, exports.NamePointerTable[i], NULL)))
+                continue;
+
+            length = strlen(name);
+
+            if ((SIZE_T)(nameBuffer - index->NameBuffer) + length + 1 > nameBufferSize)
+                break;
+
+            memcpy(nameBuffer, name, length + 1);
+            entry.Name = nameBuffer;
+            entry.Hash = PhHashBytes((PUCHAR)nameBuffer, length);
+            entry.Index = exports.OrdinalTable[i];
+            PhAddEntryHashtable(index->NameHashtable, &entry);
+            nameBuffer += length + 1;
+        }
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER)
+    {
+        status = GetExceptionCode();
+    }
+
+CleanupExit:
+    PhUnloadMappedImage(&mappedImage);
+
+    if (NT_SUCCESS(status))
+        *Index = index;
+    else
+        PhpDestroyExportIndex(index);
+
+    return status;
+}
+
+static NTSTATUS PhpLookupExportIndex(
+    _In_ PPH_EXPORT_INDEX Index,
+    _In_opt_ PSTR Name,
+    _In_opt_ USHORT Ordinal,
+    _Out_ PULONG Rva
+    )
+{
+    ULONG functionIndex;
+
+    if (Name)
+    {
+        PH_EXPORT_INDEX_NAME lookupEntry;
+        PPH_EXPORT_INDEX_NAME entry;
+
+        if (!Index->NameHashtable)
+            return STATUS_PROCEDURE_NOT_FOUND;
+
+        lookupEntry.Name = Name;
+        lookupEntry.Hash = PhHashBytes((PUCHAR)Name, strlen(Name));
+
+        if (!(entry = PhFindEntryHashtable(Index->NameHashtable, &lookupEntry)))
+            return STATUS_PROCEDURE_NOT_FOUND;
+
+        functionIndex = entry->Index;
+    }
+    else
+    {
+        functionIndex = (USHORT)(Ordinal - (USHORT)Index->Base);
+    }
+
+    if (functionIndex >= Index->NumberOfFunctions)
+        return STATUS_PROCEDURE_NOT_FOUND;
+
+    if (Index->AddressTable[functionIndex] == PH_EXPORT_INDEX_FORWARDER)
+        return STATUS_NOT_SUPPORTED; // forwarders are not supported for remote lookup
+
+    *Rva = Index->AddressTable[functionIndex];
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * Gets the RVA of an exported procedure using a cached index of
+ * the image's export table.
+ *
+ * \param FileName The file name of the image.
+ * \param ProcedureName The name of the procedure.
+ * \param ProcedureNumber The ordinal of the procedure.
+ * \param Rva A variable which receives the RVA of the procedure.
+ * \param Magic A variable which receives the optional header magic
+ * of the image.
+ *
+ * \remarks The index is shared by all callers and is rebuilt when
+ * the size or last write time of the file changes. Forwarded exports
+ * are not supported.
+ */
+NTSTATUS PhGetImageExportRvaCached(
+    _In_ PWSTR FileName,
+    _In_opt_ PSTR ProcedureName,
+    _In_opt_ USHORT ProcedureNumber,
+    _Out_ PULONG Rva,
+    _Out_opt_ PUSHORT Magic
+    )
+{
+    NTSTATUS status;
+    FILE_NETWORK_OPEN_INFORMATION fileInformation;
+    PH_EXPORT_INDEX lookupIndex;
+    PPH_EXPORT_INDEX lookupIndexPtr = &lookupIndex;
+    PPH_EXPORT_INDEX *entry;
+    PPH_EXPORT_INDEX index;
+
+    if (PhBeginInitOnce(&PhpExportIndexCacheInitOnce))
+    {
+        PhpExportIndexCache = PhCreateHashtable(
+            sizeof(PPH_EXPORT_INDEX),
+            PhpExportIndexCacheCompareFunction,
+            PhpExportIndexCacheHashFunction,
+            PH_EXPORT_INDEX_CACHE_MAXIMUM
+            );
+        PhEndInitOnce(&PhpExportIndexCacheInitOnce);
+    }
+
+    if (!NT_SUCCESS(status = PhQueryFullAttributesFileWin32(FileName, &fileInformation)))
+        return status;
+
+    lookupIndex.FileName = PhCreateString(FileName);
+
+    PhAcquireQueuedLockShared(&PhpExportIndexCacheLock);
+
+    if (
+        (entry = PhFindEntryHashtable(PhpExportIndexCache, &lookupIndexPtr)) &&
+        (*entry)->LastWriteTime.QuadPart == fileInformation.LastWriteTime.QuadPart &&
+        (*entry)->EndOfFile.QuadPart == fileInformation.EndOfFile.QuadPart
+        )
+    {
+        status = PhpLookupExportIndex(*entry, ProcedureName, ProcedureNumber, Rva);
+
+        if (Magic)
+            *Magic = (*entry)->Magic;
+
+        PhReleaseQueuedLockShared(&PhpExportIndexCacheLock);
+        PhDereferenceObject(lookupIndex.FileName);
+
+        return status;
+    }
+
+    PhReleaseQueuedLockShared(&PhpExportIndexCacheLock);
+
+    // Build the index outside of the lock, since it requires mapping the whole image.
+
+    if (!NT_SUCCESS(status = PhpCreateExportIndex(FileName, &fileInformation, &index)))
+    {
+        PhDereferenceObject(lookupIndex.FileName);
+        return status;
+    }
+
+    status = PhpLookupExportIndex(index, ProcedureName, ProcedureNumber, Rva);
+
+    if (Magic)
+        *Magic = index->Magic;
+
+    PhAcquireQueuedLockExclusive(&PhpExportIndexCacheLock);
+
+    // Replace any stale index for this file.
+    if (entry = PhFindEntryHashtable(PhpExportIndexCache, &lookupIndexPtr))
+    {
+        PPH_EXPORT_INDEX oldIndex = *entry;
+
+        PhRemoveEntryHashtable(PhpExportIndexCache, &lookupIndexPtr);
+        PhpDestroyExportIndex(oldIndex);
+    }
+
+    if (PhpExportIndexCache->Count >= PH_EXPORT_INDEX_CACHE_MAXIMUM)
+    {
+        ULONG enumerationKey = 0;
+
+        while (PhEnumHashtable(PhpExportIndexCache, &entry, &enumerationKey))
+            PhpDestroyExportIndex(*entry);
+
+        PhClearHashtable(PhpExportIndexCache);
+    }
+
+    PhAddEntryHashtable(PhpExportIndexCache, &index);
+
+    PhReleaseQueuedLockExclusive(&PhpExportIndexCacheLock);
+
+    PhDereferenceObject(lookupIndex.FileName);
+
+    return status;
+}
+
 ULONG PhpLookupMappedImageExportName(
     _In_ PPH_MAPPED_IMAGE_EXPORTS Exports,
     _In_ PSTR Name
@@ -1176,16 +1508,166 @@ NTSTATUS PhGetMappedImageDelayImports(
     return STATUS_SUCCESS;
 }
 
+#define PH_CHECKSUM_PARALLEL_THRESHOLD (8 * 1024 * 1024) // in words
+#define PH_CHECKSUM_MAXIMUM_THREADS 8
+
+typedef struct _PH_CHECKSUM_CHUNK
+{
+    PUSHORT Buffer;
+    SIZE_T Count;
+    ULONG64 Sum;
+} PH_CHECKSUM_CHUNK, *PPH_CHECKSUM_CHUNK;
+
+/**
+ * Adds 16-bit words without folding.
+ *
+ * \param Buffer The words to add.
+ * \param Count The number of words.
+ *
+ * \return The exact sum of the words.
+ */
+static ULONG64 PhpSumWords(
+    _In_reads_(Count) PUSHORT Buffer,
+    _In_ SIZE_T Count
+    )
+{
+    ULONG64 sum = 0;
+    SIZE_T i = 0;
+
+    if (USER_SHARED_DATA->ProcessorFeatures[PF_XMMI64_INSTRUCTIONS_AVAILABLE])
+    {
+        __m128i zero = _mm_setzero_si128();
+        ULONG lanes[4];
+
+        while (Count - i >= 8)
+        {
+            __m128i accumulator = _mm_setzero_si128();
+            SIZE_T blocks;
+
+            // Each 32-bit lane receives two words per block, so it cannot overflow within
+            // 0x8000 blocks.
+            blocks = min((Count - i) / 8, 0x8000);
+
+            while (blocks--)
+            {
+                __m128i block = _mm_loadu_si128((__m128i *)(Buffer + i));
+
+                accumulator = _mm_add_epi32(accumulator, _mm_unpacklo_epi16(block, zero));
+                accumulator = _mm_add_epi32(accumulator, _mm_unpackhi_epi16(block, zero));
+                i += 8;
+            }
+
+            _mm_storeu_si128((__m128i *)lanes, accumulator);
+            sum += (ULONG64)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        }
+    }
+
+    for (; i < Count; i++)
+        sum += Buffer[i];
+
+    return sum;
+}
+
+static NTSTATUS PhpCheckSumChunkThreadStart(
+    _In_ PVOID Parameter
+    )
+{
+    PPH_CHECKSUM_CHUNK chunk = Parameter;
+
+    chunk->Sum = PhpSumWords(chunk->Buffer, chunk->Count);
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * Adds 16-bit words, splitting large buffers between multiple threads.
+ *
+ * \param Buffer The words to add.
+ * \param Count The number of words.
+ *
+ * \return The exact sum of the words.
+ */
+static ULONG64 PhpSumWordsParallel(
+    _In_reads_(Count) PUSHORT Buffer,
+    _In_ SIZE_T Count
+    )
+{
+    PH_CHECKSUM_CHUNK chunks[PH_CHECKSUM_MAXIMUM_THREADS];
+    HANDLE threadHandles[PH_CHECKSUM_MAXIMUM_THREADS];
+    ULONG numberOfChunks;
+    SIZE_T chunkSize;
+    ULONG64 sum;
+    ULONG i;
+
+    numberOfChunks = min(PhSystemBasicInformation.NumberOfProcessors, PH_CHECKSUM_MAXIMUM_THREADS);
+
+    if (Count < PH_CHECKSUM_PARALLEL_THRESHOLD || numberOfChunks <= 1)
+        return PhpSumWords(Buffer, Count);
+
+    chunkSize = Count / numberOfChunks;
+
+    for (i = 0; i < numberOfChunks; i++)
+    {
+        chunks[i].Buffer = Buffer + i * chunkSize;
+        chunks[i].Count = i == numberOfChunks - 1 ? Count - i * chunkSize : chunkSize;
+        chunks[i].Sum = 0;
+    }
+
+    // The first chunk is done on this thread. Chunks whose thread cannot be created are done
+    // here as well.
+    for (i = 1; i < numberOfChunks; i++)
+    {
+        if (!(threadHandles[i] = PhCreateThread(0, PhpCheckSumChunkThreadStart, &chunks[i])))
+            PhpCheckSumChunkThreadStart(&chunks[i]);
+    }
+
+    PhpCheckSumChunkThreadStart(&chunks[0]);
+    sum = chunks[0].Sum;
+
+    for (i = 1; i < numberOfChunks; i++)
+    {
+        if (threadHandles[i])
+        {
+            NtWaitForSingleObject(threadHandles[i], FALSE, NULL);
+            NtClose(threadHandles[i]);
+        }
+
+        sum += chunks[i].Sum;
+    }
+
+    return sum;
+}
+
 USHORT PhCheckSum(
     _In_ ULONG Sum,
     _In_reads_(Count) PUSHORT Buffer,
     _In_ ULONG Count
     )
 {
-    while (Count--)
+    ULONG64 total;
+
+    if (Count != 0)
     {
+        // The first addition can overflow if Sum is large. After it has been folded, none of
+        // the remaining additions can overflow.
         Sum += *Buffer++;
         Sum = (Sum >> 16) + (Sum & 0xffff);
+        Count--;
+
+        // Folding with end-around carry preserves the sum modulo 0xffff. The running sum can
+        // only be zero if everything added so far is zero; otherwise, the folded result is in
+        // the range [1, 0xffff]. This means we can add the words exactly and reduce once.
+        if (Count != 0)
+        {
+            total = Sum + PhpSumWordsParallel(Buffer, Count);
+
+            if (total == 0)
+                return 0;
+
+            Sum = (ULONG)(total % 0xffff);
+
+            return Sum != 0 ? (USHORT)Sum : 0xffff;
+        }
     }
 
     Sum = (Sum >> 16) + Sum;
@@ -0,0 +1,258 @@
+/*
+ * Process Hacker -
+ *   cache memory budget
+ *
+ * Copyright (C) 2016 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Caches that can grow with the number of files, processes or objects on the system register
+ * here with two callbacks: one that reports how many bytes the cache is using, and one that
+ * evicts its least recently used entries. PhEnforceMemoryBudget compares the private bytes of
+ * the process against the budget, and asks the caches to give back the excess in proportion
+ * to their size. The caches are also trimmed by half while the system reports that physical
+ * memory is low, regardless of the budget.
+ *
+ * Enforcement is polled rather than driven by a wait on the low memory event, because the
+ * event stays signaled for as long as the condition lasts. Callers are expected to call
+ * PhEnforceMemoryBudget periodically, e.g. on every provider update.
+ */
+
+#include <phbase.h>
+
+static PH_QUEUED_LOCK PhpMemoryBudgetLock = PH_QUEUED_LOCK_INIT;
+static LIST_ENTRY PhpMemoryBudgetClientListHead = { &PhpMemoryBudgetClientListHead, &PhpMemoryBudgetClientListHead };
+static SIZE_T PhpMemoryBudget = 0;
+static HANDLE PhpLowMemoryEventHandle = NULL;
+static BOOLEAN PhpLowMemoryEventOpened = FALSE;
+
+/**
+ * Registers a cache with the memory budget manager.
+ *
+ * \param Client A structure which is initialized and kept by the manager until
+ * PhUnregisterMemoryBudgetClient() is called. The structure must remain valid until then.
+ * \param Name The name of the cache.
+ * \param QuerySize A callback which returns the number of bytes used by the cache. This is
+ * called on every enforcement, so it should be cheap.
+ * \param Trim A callback which frees at least the specified number of bytes, if possible, by
+ * evicting the least recently used entries of the cache. It returns the number of bytes that
+ * were freed.
+ * \param Context A user-defined value to pass to the callbacks.
+ */
+VOID NTAPI PhRegisterMemoryBudgetClient(
+    _Out_ PPH_MEMORY_BUDGET_CLIENT Client,
+    _In_ PWSTR Name,
+    _In_ PPH_MEMORY_BUDGET_QUERY_SIZE QuerySize,
+    _In_ PPH_MEMORY_BUDGET_TRIM Trim,
+    _In_opt_ PVOID Context
+    )
+{
+    Client->Name = Name;
+    Client->QuerySize = QuerySize;
+    Client->Trim = Trim;
+    Client->Context = Context;
+    Client->LastSize = 0;
+    Client->BytesTrimmed = 0;
+
+    PhAcquireQueuedLockExclusive(&PhpMemoryBudgetLock);
+    InsertTailList(&PhpMemoryBudgetClientListHead, &Client->ListEntry);
+    PhReleaseQueuedLockExclusive(&PhpMemoryBudgetLock);
+}
+
+/**
+ * Unregisters a cache from the memory budget manager.
+ *
+ * \param Client The structure passed to PhRegisterMemoryBudgetClient().
+ *
+ * \remarks The callbacks of the client are not called after this function returns.
+ */
+VOID NTAPI PhUnregisterMemoryBudgetClient(
+    _Inout_ PPH_MEMORY_BUDGET_CLIENT Client
+    )
+{
+    PhAcquireQueuedLockExclusive(&PhpMemoryBudgetLock);
+    RemoveEntryList(&Client->ListEntry);
+    PhReleaseQueuedLockExclusive(&PhpMemoryBudgetLock);
+}
+
+/**
+ * Sets the maximum number of private bytes for the current process.
+ *
+ * \param Budget The budget in bytes, or 0 for no budget.
+ */
+VOID NTAPI PhSetMemoryBudget(
+    _In_ SIZE_T Budget
+    )
+{
+    PhAcquireQueuedLockExclusive(&PhpMemoryBudgetLock);
+    PhpMemoryBudget = Budget;
+    PhReleaseQueuedLockExclusive(&PhpMemoryBudgetLock);
+}
+
+static BOOLEAN PhpIsLowMemoryCondition(
+    VOID
+    )
+{
+    static UNICODE_STRING eventName = RTL_CONSTANT_STRING(L"\\KernelObjects\\LowMemoryCondition");
+
+    EVENT_BASIC_INFORMATION basicInfo;
+
+    if (!PhpLowMemoryEventOpened)
+    {
+        OBJECT_ATTRIBUTES objectAttributes;
+
+        PhpLowMemoryEventOpened = TRUE;
+
+        InitializeObjectAttributes(
+            &objectAttributes,
+            &eventName,
+            0,
+            NULL,
+            NULL
+            );
+
+        if (!NT_SUCCESS(NtOpenEvent(&PhpLowMemoryEventHandle, EVENT_QUERY_STATE, &objectAttributes)))
+            PhpLowMemoryEventHandle = NULL;
+    }
+
+    if (!PhpLowMemoryEventHandle)
+        return FALSE;
+
+    if (!NT_SUCCESS(NtQueryEvent(
+        PhpLowMemoryEventHandle,
+        EventBasicInformation,
+        &basicInfo,
+        sizeof(EVENT_BASIC_INFORMATION),
+        NULL
+        )))
+        return FALSE;
+
+    return basicInfo.EventState != 0;
+}
+
+/**
+ * Trims the registered caches if the current process is over its memory budget, or if
+ * physical memory is low.
+ *
+ * \return The number of bytes freed by the caches.
+ */
+SIZE_T NTAPI PhEnforceMemoryBudget(
+    VOID
+    )
+{
+    PLIST_ENTRY listEntry;
+    PPH_MEMORY_BUDGET_CLIENT client;
+    VM_COUNTERS_EX vmCounters;
+    BOOLEAN lowMemory;
+    SIZE_T totalSize;
+    SIZE_T excess;
+    SIZE_T bytesToFree;
+    SIZE_T bytesFreed;
+
+    PhAcquireQueuedLockExclusive(&PhpMemoryBudgetLock);
+
+    excess = 0;
+
+    if (PhpMemoryBudget != 0 && NT_SUCCESS(NtQueryInformationProcess(
+        NtCurrentProcess(),
+        ProcessVmCounters,
+        &vmCounters,
+        sizeof(VM_COUNTERS_EX),
+        NULL
+        )))
+    {
+        // Trim an extra eighth of the budget so that we don't end up trimming on every call
+        // while hovering around the budget.
+        if (vmCounters.PrivateUsage > PhpMemoryBudget)
+            excess = vmCounters.PrivateUsage - PhpMemoryBudget + PhpMemoryBudget / 8;
+    }
+
+    lowMemory = PhpIsLowMemoryCondition();
+
+    // Querying the sizes of the caches isn't free, so we only do it when we need to trim.
+    if ((excess == 0 && !lowMemory) || IsListEmpty(&PhpMemoryBudgetClientListHead))
+    {
+        PhReleaseQueuedLockExclusive(&PhpMemoryBudgetLock);
+        return 0;
+    }
+
+    totalSize = 0;
+
+    for (listEntry = PhpMemoryBudgetClientListHead.Flink; listEntry != &PhpMemoryBudgetClientListHead; listEntry = listEntry->Flink)
+    {
+        client = CONTAINING_RECORD(listEntry, PH_MEMORY_BUDGET_CLIENT, ListEntry);
+        client->LastSize = client->QuerySize(client->Context);
+        totalSize += client->LastSize;
+    }
+
+    if (lowMemory)
+        excess = max(excess, totalSize / 2);
+
+    excess = min(excess, totalSize);
+    bytesFreed = 0;
+
+    if (excess != 0)
+    {
+        for (listEntry = PhpMemoryBudgetClientListHead.Flink; listEntry != &PhpMemoryBudgetClientListHead; listEntry = listEntry->Flink)
+        {
+            client = CONTAINING_RECORD(listEntry, PH_MEMORY_BUDGET_CLIENT, ListEntry);
+
+            if (client->LastSize == 0)
+                continue;
+
+            // Each cache gives back its share of the excess.
+            bytesToFree = (SIZE_T)((ULONG64)excess * client->LastSize / totalSize) + 1;
+            bytesToFree = client->Trim(min(bytesToFree, client->LastSize), client->Context);
+            client->BytesTrimmed += bytesToFree;
+            bytesFreed += bytesToFree;
+        }
+
+        // Give the freed memory back to the system.
+        RtlCompactHeap(PhHeapHandle, 0);
+    }
+
+    PhReleaseQueuedLockExclusive(&PhpMemoryBudgetLock);
+
+    return bytesFreed;
+}
+
+/**
+ * Gets the sizes of the registered caches.
+ *
+ * \param Callback A function which is called for each cache, with the cache's size as of the
+ * last time it was trimmed and the total number of bytes it has trimmed.
+ * \param Context A user-defined value to pass to the callback.
+ */
+VOID NTAPI PhEnumMemoryBudgetClients(
+    _In_ PPH_MEMORY_BUDGET_ENUM_CALLBACK Callback,
+    _In_opt_ PVOID Context
+    )
+{
+    PLIST_ENTRY listEntry;
+    PPH_MEMORY_BUDGET_CLIENT client;
+
+    PhAcquireQueuedLockShared(&PhpMemoryBudgetLock);
+
+    for (listEntry = PhpMemoryBudgetClientListHead.Flink; listEntry != &PhpMemoryBudgetClientListHead; listEntry = listEntry->Flink)
+    {
+        client = CONTAINING_RECORD(listEntry, PH_MEMORY_BUDGET_CLIENT, ListEntry);
+        Callback(client->Name, client->LastSize, client->BytesTrimmed, Context);
+    }
+
+    PhReleaseQueuedLockShared(&PhpMemoryBudgetLock);
+}
@@ -27,30 +27,88 @@
 #define PH_DEVICE_PREFIX_LENGTH 64
 #define PH_DEVICE_MUP_PREFIX_MAX_COUNT 16
 
+typedef struct _PHP_MODULE_NAMES
+{
+    PPH_STRING FullDllName;
+    PPH_STRING BaseDllName;
+} PHP_MODULE_NAMES, *PPHP_MODULE_NAMES;
+
 typedef BOOLEAN (NTAPI *PPHP_ENUM_PROCESS_MODULES_CALLBACK)(
     _In_ HANDLE ProcessHandle,
     _In_ PLDR_DATA_TABLE_ENTRY Entry,
     _In_ PVOID AddressOfEntry,
-    _In_opt_ PVOID Context1,
-    _In_opt_ PVOID Context2
+    _In_opt_ PVOID Context,
+    _In_opt_ PPHP_MODULE_NAMES Names
     );
 
 typedef BOOLEAN (NTAPI *PPHP_ENUM_PROCESS_MODULES32_CALLBACK)(
     _In_ HANDLE ProcessHandle,
     _In_ PLDR_DATA_TABLE_ENTRY32 Entry,
     _In_ ULONG AddressOfEntry,
-    _In_opt_ PVOID Context1,
-    _In_opt_ PVOID Context2
+    _In_opt_ PVOID Context,
+    _In_opt_ PPHP_MODULE_NAMES Names
     );
 
+#define PHP_ENUM_PROCESS_MODULES_READ_NAMES 0x1
+
+#define PHP_REMOTE_SPAN_SIZE (PAGE_SIZE * 2)
+#define PHP_REMOTE_SPAN_COUNT 8
+
+typedef struct _PHP_REMOTE_SPAN_READER
+{
+    HANDLE ProcessHandle;
+    ULONG NextSpan;
+    ULONG_PTR BaseAddress[PHP_REMOTE_SPAN_COUNT];
+    SIZE_T Length[PHP_REMOTE_SPAN_COUNT];
+    PUCHAR Buffer; // PHP_REMOTE_SPAN_COUNT spans of PHP_REMOTE_SPAN_SIZE bytes
+} PHP_REMOTE_SPAN_READER, *PPHP_REMOTE_SPAN_READER;
+
+typedef struct _PHP_MODULE_NAME_ENTRY
+{
+    ULONG64 EntryAddress;
+    ULONG64 DllBase;
+    ULONG64 FullDllNameAddress;
+    ULONG64 BaseDllNameAddress;
+    USHORT FullDllNameLength;
+    USHORT BaseDllNameLength;
+    PPH_STRING FullDllName;
+    PPH_STRING BaseDllName;
+} PHP_MODULE_NAME_ENTRY, *PPHP_MODULE_NAME_ENTRY;
+
+#define PHP_MODULE_NAME_CACHE_SIZE 8
+
+typedef struct _PHP_MODULE_NAME_CACHE
+{
+    HANDLE ProcessId;
+    ULONG64 PebAddress;
+    PPH_HASHTABLE Entries; // PHP_MODULE_NAME_ENTRY, keyed by EntryAddress
+} PHP_MODULE_NAME_CACHE, *PPHP_MODULE_NAME_CACHE;
+
+typedef struct _PH_DEVICE_PREFIX_ENTRY
+{
+    PH_STRINGREF Prefix;
+    WCHAR DriveLetter; // 0 for network providers
+} PH_DEVICE_PREFIX_ENTRY, *PPH_DEVICE_PREFIX_ENTRY;
+
+// An immutable snapshot of all device prefixes. Each group of entries is sorted by descending
+// prefix length, so a lookup can skip every prefix that is longer than the name.
+typedef struct _PH_DEVICE_PREFIX_TABLE
+{
+    ULONG NumberOfDosEntries;
+    ULONG NumberOfMupEntries;
+    PH_DEVICE_PREFIX_ENTRY Entries[1];
+} PH_DEVICE_PREFIX_TABLE, *PPH_DEVICE_PREFIX_TABLE;
+
 static PH_INITONCE PhDevicePrefixesInitOnce = PH_INITONCE_INIT;
 
-static UNICODE_STRING PhDevicePrefixes[26];
+// The prefixes below are only used to build the table, and are protected by this lock.
 static PH_QUEUED_LOCK PhDevicePrefixesLock = PH_QUEUED_LOCK_INIT;
-
+static UNICODE_STRING PhDevicePrefixes[26];
 static PPH_STRING PhDeviceMupPrefixes[PH_DEVICE_MUP_PREFIX_MAX_COUNT] = { 0 };
 static ULONG PhDeviceMupPrefixesCount = 0;
-static PH_QUEUED_LOCK PhDeviceMupPrefixesLock = PH_QUEUED_LOCK_INIT;
+
+// Readers access the table inside an epoch; replaced tables are freed with PhFreeAfterEpoch.
+static PPH_DEVICE_PREFIX_TABLE PhDevicePrefixTable = NULL;
 
 static PH_INITONCE PhPredefineKeyInitOnce = PH_INITONCE_INIT;
 static UNICODE_STRING PhPredefineKeyNames[PH_KEY_MAXIMUM_PREDEFINE] =
@@ -522,6 +580,143 @@ NTSTATUS PhReadVirtualMemory(
     return status;
 }
 
+C_ASSERT(sizeof(PH_VIRTUAL_MEMORY_RANGE) == sizeof(KPH_VM_READ_RANGE));
+C_ASSERT(FIELD_OFFSET(PH_VIRTUAL_MEMORY_RANGE, Status) == FIELD_OFFSET(KPH_VM_READ_RANGE, Status));
+C_ASSERT(FIELD_OFFSET(PH_VIRTUAL_MEMORY_RANGE, NumberOfBytesRead) == FIELD_OFFSET(KPH_VM_READ_RANGE, NumberOfBytesRead));
+
+/**
+ * Copies several ranges of memory from another process into the
+ * current process.
+ *
+ * \param ProcessHandle A handle to a process. The handle must
+ * have PROCESS_VM_READ access.
+ * \param Ranges An array of ranges to copy. On return, the Status
+ * and NumberOfBytesRead members of each range are set.
+ * \param NumberOfRanges The number of elements in \a Ranges.
+ * \param Buffer A buffer which receives the copied memory. The
+ * ranges are stored one after another in the order given.
+ * \param BufferSize The size of \a Buffer, in bytes.
+ *
+ * \return STATUS_SUCCESS if every range was copied, or
+ * STATUS_PARTIAL_COPY if at least one range could not be copied.
+ *
+ * \remarks When KProcessHacker is connected, all of the ranges are
+ * copied with a single request to the driver.
+ */
+NTSTATUS PhReadVirtualMemoryScatter(
+    _In_ HANDLE ProcessHandle,
+    _Inout_updates_(NumberOfRanges) PPH_VIRTUAL_MEMORY_RANGE Ranges,
+    _In_ ULONG NumberOfRanges,
+    _Out_writes_bytes_(BufferSize) PVOID Buffer,
+    _In_ SIZE_T BufferSize
+    )
+{
+    static BOOLEAN scatterNotSupported = FALSE;
+
+    NTSTATUS status;
+    SIZE_T totalLength;
+    PUCHAR buffer;
+    BOOLEAN allSucceeded;
+    ULONG i;
+    ULONG j;
+
+    totalLength = 0;
+
+    for (i = 0; i < NumberOfRanges; i++)
+    {
+        if (totalLength + Ranges[i].Length < totalLength)
+            return STATUS_INVALID_PARAMETER;
+
+        totalLength += Ranges[i].Length;
+    }
+
+    if (totalLength > BufferSize)
+        return STATUS_BUFFER_TOO_SMALL;
+
+    buffer = Buffer;
+    allSucceeded = TRUE;
+
+    if (KphIsConnected() && !scatterNotSupported)
+    {
+        ULONG count;
+
+        // The driver limits the number of ranges per request.
+        for (i = 0; i < NumberOfRanges; i += count)
+        {
+            count = min(NumberOfRanges - i, KPH_VM_READ_MAXIMUM_RANGES);
+            totalLength = 0;
+
+            for (j = i; j < i + count; j++)
+                totalLength += Ranges[j].Length;
+
+            status = KphReadVirtualMemoryScatter(
+                ProcessHandle,
+                (PKPH_VM_READ_RANGE)Ranges + i,
+                count,
+                buffer,
+                totalLength
+                );
+
+            if (status == STATUS_INVALID_DEVICE_REQUEST)
+            {
+                // Older versions of the driver don't support this request.
+                scatterNotSupported = TRUE;
+                break;
+            }
+
+            if (!NT_SUCCESS(status))
+            {
+                allSucceeded = FALSE;
+
+                // The ranges are only updated if the request itself succeeded.
+                if (status != STATUS_PARTIAL_COPY)
+                {
+                    for (j = i; j < i + count; j++)
+                    {
+                        Ranges[j].Status = status;
+                        Ranges[j].NumberOfBytesRead = 0;
+                    }
+                }
+            }
+
+            buffer += totalLength;
+        }
+
+        if (!scatterNotSupported)
+            return allSucceeded ? STATUS_SUCCESS : STATUS_PARTIAL_COPY;
+
+        buffer = Buffer;
+        allSucceeded = TRUE;
+    }
+
+    for (i = 0; i < NumberOfRanges; i++)
+    {
+        Ranges[i].NumberOfBytesRead = 0;
+
+        if (Ranges[i].Length != 0)
+        {
+            Ranges[i].Status = PhReadVirtualMemory(
+                ProcessHandle,
+                Ranges[i].BaseAddress,
+                buffer,
+                Ranges[i].Length,
+                &Ranges[i].NumberOfBytesRead
+                );
+
+            if (!NT_SUCCESS(Ranges[i].Status))
+                allSucceeded = FALSE;
+        }
+        else
+        {
+            Ranges[i].Status = STATUS_SUCCESS;
+        }
+
+        buffer += Ranges[i].Length;
+    }
+
+    return allSucceeded ? STATUS_SUCCESS : STATUS_PARTIAL_COPY;
+}
+
 /**
  * Copies memory from the current process into another process.
  *
@@ -3347,169 +3542,633 @@ NTSTATUS PhDuplicateObject(
         );
 }
 
-NTSTATUS PhpEnumProcessModules(
-    _In_ HANDLE ProcessHandle,
-    _In_ PPHP_ENUM_PROCESS_MODULES_CALLBACK Callback,
-    _In_opt_ PVOID Context1,
-    _In_opt_ PVOID Context2
+static VOID PhpInitializeRemoteSpanReader(
+    _Out_ PPHP_REMOTE_SPAN_READER Reader,
+    _In_ HANDLE ProcessHandle
     )
 {
-    NTSTATUS status;
-    PROCESS_BASIC_INFORMATION basicInfo;
-    PPEB_LDR_DATA ldr;
-    PEB_LDR_DATA pebLdrData;
-    PLIST_ENTRY startLink;
-    PLIST_ENTRY currentLink;
-    ULONG dataTableEntrySize;
-    LDR_DATA_TABLE_ENTRY currentEntry;
-    ULONG i;
-
-    // Get the PEB address.
-    status = PhGetProcessBasicInformation(ProcessHandle, &basicInfo);
-
-    if (!NT_SUCCESS(status))
-        return status;
-
-    // Read the address of the loader data.
-    status = PhReadVirtualMemory(
-        ProcessHandle,
-        PTR_ADD_OFFSET(basicInfo.PebBaseAddress, FIELD_OFFSET(PEB, Ldr)),
-        &ldr,
-        sizeof(PVOID),
-        NULL
-        );
+    memset(Reader, 0, sizeof(PHP_REMOTE_SPAN_READER));
+    Reader->ProcessHandle = ProcessHandle;
+    Reader->Buffer = PhAllocate(PHP_REMOTE_SPAN_COUNT * PHP_REMOTE_SPAN_SIZE);
+}
 
-    if (!NT_SUCCESS(status))
-        return status;
+static VOID PhpDeleteRemoteSpanReader(
+    _Inout_ PPHP_REMOTE_SPAN_READER Reader
+    )
+{
+    PhFree(Reader->Buffer);
+}
 
-    // Read the loader data.
-    status = PhReadVirtualMemory(
-        ProcessHandle,
-        ldr,
-        &pebLdrData,
-        sizeof(PEB_LDR_DATA),
-        NULL
-        );
+/**
+ * Copies memory from a span which has already been read.
+ *
+ * \return TRUE if the memory was entirely contained in a span,
+ * otherwise FALSE.
+ */
+static BOOLEAN PhpCopyRemoteSpan(
+    _In_ PPHP_REMOTE_SPAN_READER Reader,
+    _In_ ULONG_PTR BaseAddress,
+    _Out_writes_bytes_(Length) PVOID Buffer,
+    _In_ SIZE_T Length
+    )
+{
+    ULONG i;
 
-    if (!NT_SUCCESS(status))
-        return status;
+    for (i = 0; i < PHP_REMOTE_SPAN_COUNT; i++)
+    {
+        if (
+            Reader->Length[i] != 0 &&
+            BaseAddress >= Reader->BaseAddress[i] &&
+            BaseAddress - Reader->BaseAddress[i] <= Reader->Length[i] &&
+            Length <= Reader->Length[i] - (BaseAddress - Reader->BaseAddress[i])
+            )
+        {
+            memcpy(
+                Buffer,
+                Reader->Buffer + i * PHP_REMOTE_SPAN_SIZE + (BaseAddress - Reader->BaseAddress[i]),
+                Length
+                );
 
-    if (!pebLdrData.Initialized)
-        return STATUS_UNSUCCESSFUL;
+            return TRUE;
+        }
+    }
 
-    if (WindowsVersion >= WINDOWS_8)
-        dataTableEntrySize = LDR_DATA_TABLE_ENTRY_SIZE_WIN8;
-    else if (WindowsVersion >= WINDOWS_7)
-        dataTableEntrySize = LDR_DATA_TABLE_ENTRY_SIZE_WIN7;
-    else
-        dataTableEntrySize = LDR_DATA_TABLE_ENTRY_SIZE_WINXP;
+    return FALSE;
+}
 
-    // Traverse the linked list (in load order).
+/**
+ * Reads memory from a process through a small cache of page-aligned
+ * spans. Loader entries are allocated from the process heap one after
+ * another, so most of them are served from a span which was read for
+ * an earlier entry.
+ */
+static NTSTATUS PhpReadRemoteSpan(
+    _Inout_ PPHP_REMOTE_SPAN_READER Reader,
+    _In_ ULONG_PTR BaseAddress,
+    _Out_writes_bytes_(Length) PVOID Buffer,
+    _In_ SIZE_T Length
+    )
+{
+    NTSTATUS status;
+    ULONG index;
+    ULONG_PTR spanBase;
+    SIZE_T spanLength;
 
-    i = 0;
-    startLink = PTR_ADD_OFFSET(ldr, FIELD_OFFSET(PEB_LDR_DATA, InLoadOrderModuleList));
-    currentLink = pebLdrData.InLoadOrderModuleList.Flink;
+    if (PhpCopyRemoteSpan(Reader, BaseAddress, Buffer, Length))
+        return STATUS_SUCCESS;
 
-    while (
-        currentLink != startLink &&
-        i <= PH_ENUM_PROCESS_MODULES_LIMIT
-        )
+    if (Length <= PAGE_SIZE)
     {
-        PVOID addressOfEntry;
+        index = Reader->NextSpan;
+        Reader->NextSpan = (index + 1) % PHP_REMOTE_SPAN_COUNT;
+        spanBase = BaseAddress & ~(ULONG_PTR)(PAGE_SIZE - 1);
+        spanLength = PHP_REMOTE_SPAN_SIZE;
 
-        addressOfEntry = CONTAINING_RECORD(currentLink, LDR_DATA_TABLE_ENTRY, InLoadOrderLinks);
         status = PhReadVirtualMemory(
-            ProcessHandle,
-            addressOfEntry,
-            &currentEntry,
-            dataTableEntrySize,
+            Reader->ProcessHandle,
+            (PVOID)spanBase,
+            Reader->Buffer + index * PHP_REMOTE_SPAN_SIZE,
+            spanLength,
             NULL
             );
 
         if (!NT_SUCCESS(status))
-            return status;
-
-        // Make sure the entry is valid.
-        if (currentEntry.DllBase)
         {
-            // Execute the callback.
-            if (!Callback(
-                ProcessHandle,
-                &currentEntry,
-                addressOfEntry,
-                Context1,
-                Context2
-                ))
-                break;
+            // The next page may not be committed.
+            spanLength = PAGE_SIZE;
+            status = PhReadVirtualMemory(
+                Reader->ProcessHandle,
+                (PVOID)spanBase,
+                Reader->Buffer + index * PHP_REMOTE_SPAN_SIZE,
+                spanLength,
+                NULL
+                );
         }
 
-        currentLink = currentEntry.InLoadOrderLinks.Flink;
-        i++;
+        if (NT_SUCCESS(status))
+        {
+            Reader->BaseAddress[index] = spanBase;
+            Reader->Length[index] = spanLength;
+
+            if (PhpCopyRemoteSpan(Reader, BaseAddress, Buffer, Length))
+                return STATUS_SUCCESS;
+        }
+        else
+        {
+            Reader->Length[index] = 0;
+        }
     }
 
-    return status;
+    return PhReadVirtualMemory(
+        Reader->ProcessHandle,
+        (PVOID)BaseAddress,
+        Buffer,
+        Length,
+        NULL
+        );
 }
 
-BOOLEAN NTAPI PhpEnumProcessModulesCallback(
-    _In_ HANDLE ProcessHandle,
-    _In_ PLDR_DATA_TABLE_ENTRY Entry,
-    _In_ PVOID AddressOfEntry,
-    _In_opt_ PVOID Context1,
-    _In_opt_ PVOID Context2
+static BOOLEAN NTAPI PhpModuleNameEntryEqualFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
     )
 {
-    NTSTATUS status;
-    PPH_ENUM_PROCESS_MODULES_PARAMETERS parameters;
-    BOOLEAN cont;
-    PPH_STRING mappedFileName;
-    PWSTR fullDllNameOriginal;
-    PWSTR fullDllNameBuffer;
-    PWSTR baseDllNameOriginal;
-    PWSTR baseDllNameBuffer;
+    return ((PPHP_MODULE_NAME_ENTRY)Entry1)->EntryAddress == ((PPHP_MODULE_NAME_ENTRY)Entry2)->EntryAddress;
+}
 
-    parameters = Context1;
-    mappedFileName = NULL;
+static ULONG NTAPI PhpModuleNameEntryHashFunction(
+    _In_ PVOID Entry
+    )
+{
+    return PhHashInt64(((PPHP_MODULE_NAME_ENTRY)Entry)->EntryAddress);
+}
 
-    if (parameters->Flags & PH_ENUM_PROCESS_MODULES_TRY_MAPPED_FILE_NAME)
+static VOID PhpDestroyModuleNameEntries(
+    _In_ PPH_HASHTABLE Entries
+    )
+{
+    PPHP_MODULE_NAME_ENTRY entry;
+    ULONG enumerationKey;
+
+    enumerationKey = 0;
+
+    while (PhEnumHashtable(Entries, &entry, &enumerationKey))
     {
-        PhGetProcessMappedFileName(ProcessHandle, Entry->DllBase, &mappedFileName);
+        PhDereferenceObject(entry->FullDllName);
+        PhDereferenceObject(entry->BaseDllName);
     }
 
-    if (mappedFileName)
-    {
-        ULONG_PTR indexOfLastBackslash;
+    PhDereferenceObject(Entries);
+}
 
-        PhStringRefToUnicodeString(&mappedFileName->sr, &Entry->FullDllName);
-        indexOfLastBackslash = PhFindLastCharInString(mappedFileName, 0, '\\');
+/**
+ * Creates the name strings of a set of loader entries which were not
+ * found in the name cache. Strings which lie in a span we have already
+ * read are copied directly, and the rest are read with a single
+ * scatter read.
+ *
+ * \param Reader The span reader used to walk the loader entries.
+ * \param Names The loader entries.
+ * \param Count The number of elements in \a Names.
+ * \param BaseDllName TRUE to create the base DLL names, FALSE to
+ * create the full DLL names. The full DLL names must be created first.
+ */
+static VOID PhpReadModuleNameStrings(
+    _In_ PPHP_REMOTE_SPAN_READER Reader,
+    _Inout_updates_(Count) PPHP_MODULE_NAME_ENTRY Names,
+    _In_ ULONG Count,
+    _In_ BOOLEAN BaseDllName
+    )
+{
+    PPH_VIRTUAL_MEMORY_RANGE ranges;
+    PULONG rangeIndices;
+    ULONG numberOfRanges;
+    SIZE_T totalLength;
+    PUCHAR buffer;
+    SIZE_T offset;
+    ULONG i;
 
-        if (indexOfLastBackslash != -1)
+    ranges = PhAllocate(Count * sizeof(PH_VIRTUAL_MEMORY_RANGE));
+    rangeIndices = PhAllocate(Count * sizeof(ULONG));
+    numberOfRanges = 0;
+    totalLength = 0;
+
+    for (i = 0; i < Count; i++)
+    {
+        PPHP_MODULE_NAME_ENTRY name = &Names[i];
+        PPH_STRING *string;
+        ULONG64 address;
+        USHORT length;
+
+        if (BaseDllName)
         {
-            Entry->BaseDllName.Buffer = Entry->FullDllName.Buffer + indexOfLastBackslash + 1;
-            Entry->BaseDllName.Length = Entry->FullDllName.Length - (USHORT)indexOfLastBackslash * 2 - 2;
-            Entry->BaseDllName.MaximumLength = Entry->BaseDllName.Length;
+            string = &name->BaseDllName;
+            address = name->BaseDllNameAddress;
+            length = name->BaseDllNameLength;
         }
         else
         {
-            Entry->BaseDllName = Entry->FullDllName;
+            string = &name->FullDllName;
+            address = name->FullDllNameAddress;
+            length = name->FullDllNameLength;
         }
-    }
-    else
-    {
-        // Read the full DLL name string and add a null terminator.
 
-        fullDllNameOriginal = Entry->FullDllName.Buffer;
-        fullDllNameBuffer = PhAllocate(Entry->FullDllName.Length + 2);
-        Entry->FullDllName.Buffer = fullDllNameBuffer;
+        if (*string)
+            continue;
 
-        if (NT_SUCCESS(status = PhReadVirtualMemory(
-            ProcessHandle,
-            fullDllNameOriginal,
-            fullDllNameBuffer,
-            Entry->FullDllName.Length,
-            NULL
-            )))
+        if (length == 0 || (length & 1) || address == 0)
         {
-            fullDllNameBuffer[Entry->FullDllName.Length / 2] = 0;
+            *string = PhReferenceEmptyString();
+            continue;
+        }
+
+        // Try to use the full DLL name.
+        if (
+            BaseDllName &&
+            name->FullDllName->Length != 0 &&
+            address >= name->FullDllNameAddress &&
+            address + length >= address &&
+            address + length <= name->FullDllNameAddress + name->FullDllName->Length
+            )
+        {
+            *string = PhCreateStringEx(
+                (PWCHAR)PTR_ADD_OFFSET(name->FullDllName->Buffer, address - name->FullDllNameAddress),
+                length
+                );
+            continue;
+        }
+
+        *string = PhCreateStringEx(NULL, length);
+
+        if (!PhpCopyRemoteSpan(Reader, (ULONG_PTR)address, (*string)->Buffer, length))
+        {
+            PhClearReference(string);
+            ranges[numberOfRanges].BaseAddress = (PVOID)(ULONG_PTR)address;
+            ranges[numberOfRanges].Length = length;
+            rangeIndices[numberOfRanges] = i;
+            numberOfRanges++;
+            totalLength += length;
+        }
+    }
+
+    if (numberOfRanges != 0)
+    {
+        buffer = PhAllocate(totalLength);
+        PhReadVirtualMemoryScatter(Reader->ProcessHandle, ranges, numberOfRanges, buffer, totalLength);
+        offset = 0;
+
+        for (i = 0; i < numberOfRanges; i++)
+        {
+            PPHP_MODULE_NAME_ENTRY name = &Names[rangeIndices[i]];
+            PPH_STRING string;
+
+            if (NT_SUCCESS(ranges[i].Status) && ranges[i].NumberOfBytesRead == ranges[i].Length)
+                string = PhCreateStringEx((PWCHAR)(buffer + offset), ranges[i].Length);
+            else
+                string = PhReferenceEmptyString();
+
+            if (BaseDllName)
+                name->BaseDllName = string;
+            else
+                name->FullDllName = string;
+
+            offset += ranges[i].Length;
+        }
+
+        PhFree(buffer);
+    }
+
+    PhFree(rangeIndices);
+    PhFree(ranges);
+}
+
+/**
+ * Gets the names of a set of loader entries. Names are cached per
+ * process, and an entry is only read again when its base address or
+ * the address or length of one of its names has changed.
+ *
+ * \param Reader The span reader used to walk the loader entries.
+ * \param ProcessId The ID of the process.
+ * \param PebAddress The address of the PEB that the loader entries
+ * belong to. This distinguishes the native and 32-bit lists of a
+ * WOW64 process.
+ * \param Names The loader entries. On return, the FullDllName and
+ * BaseDllName members contain references to the names.
+ * \param Count The number of elements in \a Names.
+ */
+static VOID PhpQueryModuleNames(
+    _In_ PPHP_REMOTE_SPAN_READER Reader,
+    _In_ HANDLE ProcessId,
+    _In_ ULONG64 PebAddress,
+    _Inout_updates_(Count) PPHP_MODULE_NAME_ENTRY Names,
+    _In_ ULONG Count
+    )
+{
+    static PHP_MODULE_NAME_CACHE cacheSlots[PHP_MODULE_NAME_CACHE_SIZE];
+    static ULONG nextCacheSlot = 0;
+    static PH_QUEUED_LOCK cacheLock = PH_QUEUED_LOCK_INIT;
+
+    PPHP_MODULE_NAME_CACHE cache;
+    PPH_HASHTABLE entries;
+    ULONG i;
+
+    cache = NULL;
+
+    PhAcquireQueuedLockExclusive(&cacheLock);
+
+    for (i = 0; i < PHP_MODULE_NAME_CACHE_SIZE; i++)
+    {
+        if (cacheSlots[i].Entries && cacheSlots[i].ProcessId == ProcessId && cacheSlots[i].PebAddress == PebAddress)
+        {
+            cache = &cacheSlots[i];
+            break;
+        }
+    }
+
+    if (cache)
+    {
+        for (i = 0; i < Count; i++)
+        {
+            PPHP_MODULE_NAME_ENTRY entry;
+
+            entry = PhFindEntryHashtable(cache->Entries, &Names[i]);
+
+            if (
+                entry &&
+                entry->DllBase == Names[i].DllBase &&
+                entry->FullDllNameAddress == Names[i].FullDllNameAddress &&
+                entry->FullDllNameLength == Names[i].FullDllNameLength &&
+                entry->BaseDllNameAddress == Names[i].BaseDllNameAddress &&
+                entry->BaseDllNameLength == Names[i].BaseDllNameLength
+                )
+            {
+                PhSetReference(&Names[i].FullDllName, entry->FullDllName);
+                PhSetReference(&Names[i].BaseDllName, entry->BaseDllName);
+            }
+        }
+    }
+
+    PhReleaseQueuedLockExclusive(&cacheLock);
+
+    PhpReadModuleNameStrings(Reader, Names, Count, FALSE);
+    PhpReadModuleNameStrings(Reader, Names, Count, TRUE);
+
+    // Replace the cached names with the current list, so that unloaded
+    // modules are dropped.
+
+    entries = PhCreateHashtable(
+        sizeof(PHP_MODULE_NAME_ENTRY),
+        PhpModuleNameEntryEqualFunction,
+        PhpModuleNameEntryHashFunction,
+        Count
+        );
+
+    for (i = 0; i < Count; i++)
+    {
+        if (PhAddEntryHashtable(entries, &Names[i]))
+        {
+            PhReferenceObject(Names[i].FullDllName);
+            PhReferenceObject(Names[i].BaseDllName);
+        }
+    }
+
+    PhAcquireQueuedLockExclusive(&cacheLock);
+
+    if (!cache || cache->ProcessId != ProcessId || cache->PebAddress != PebAddress)
+    {
+        cache = &cacheSlots[nextCacheSlot];
+        nextCacheSlot = (nextCacheSlot + 1) % PHP_MODULE_NAME_CACHE_SIZE;
+        cache->ProcessId = ProcessId;
+        cache->PebAddress = PebAddress;
+    }
+
+    if (cache->Entries)
+        PhpDestroyModuleNameEntries(cache->Entries);
+
+    cache->Entries = entries;
+
+    PhReleaseQueuedLockExclusive(&cacheLock);
+}
+
+NTSTATUS PhpEnumProcessModules(
+    _In_ HANDLE ProcessHandle,
+    _In_ ULONG Flags,
+    _In_ PPHP_ENUM_PROCESS_MODULES_CALLBACK Callback,
+    _In_opt_ PVOID Context
+    )
+{
+    NTSTATUS status;
+    PROCESS_BASIC_INFORMATION basicInfo;
+    PPEB_LDR_DATA ldr;
+    PEB_LDR_DATA pebLdrData;
+    PLIST_ENTRY startLink;
+    PLIST_ENTRY currentLink;
+    ULONG dataTableEntrySize;
+    LDR_DATA_TABLE_ENTRY currentEntry;
+    PHP_REMOTE_SPAN_READER reader;
+    PLDR_DATA_TABLE_ENTRY entries;
+    PPHP_MODULE_NAME_ENTRY names;
+    ULONG count;
+    ULONG capacity;
+    ULONG i;
+
+    // Get the PEB address.
+    status = PhGetProcessBasicInformation(ProcessHandle, &basicInfo);
+
+    if (!NT_SUCCESS(status))
+        return status;
+
+    // Read the address of the loader data.
+    status = PhReadVirtualMemory(
+        ProcessHandle,
+        PTR_ADD_OFFSET(basicInfo.PebBaseAddress, FIELD_OFFSET(PEB, Ldr)),
+        &ldr,
+        sizeof(PVOID),
+        NULL
+        );
+
+    if (!NT_SUCCESS(status))
+        return status;
+
+    // Read the loader data.
+    status = PhReadVirtualMemory(
+        ProcessHandle,
+        ldr,
+        &pebLdrData,
+        sizeof(PEB_LDR_DATA),
+        NULL
+        );
+
+    if (!NT_SUCCESS(status))
+        return status;
+
+    if (!pebLdrData.Initialized)
+        return STATUS_UNSUCCESSFUL;
+
+    if (WindowsVersion >= WINDOWS_8)
+        dataTableEntrySize = LDR_DATA_TABLE_ENTRY_SIZE_WIN8;
+    else if (WindowsVersion >= WINDOWS_7)
+        dataTableEntrySize = LDR_DATA_TABLE_ENTRY_SIZE_WIN7;
+    else
+        dataTableEntrySize = LDR_DATA_TABLE_ENTRY_SIZE_WINXP;
+
+    // Traverse the linked list (in load order). We collect all of the entries before executing
+    // the callback so that their names can be read together.
+
+    PhpInitializeRemoteSpanReader(&reader, ProcessHandle);
+    entries = NULL;
+    names = NULL;
+    count = 0;
+    capacity = 0;
+
+    i = 0;
+    startLink = PTR_ADD_OFFSET(ldr, FIELD_OFFSET(PEB_LDR_DATA, InLoadOrderModuleList));
+    currentLink = pebLdrData.InLoadOrderModuleList.Flink;
+
+    while (
+        currentLink != startLink &&
+        i <= PH_ENUM_PROCESS_MODULES_LIMIT
+        )
+    {
+        PVOID addressOfEntry;
+
+        addressOfEntry = CONTAINING_RECORD(currentLink, LDR_DATA_TABLE_ENTRY, InLoadOrderLinks);
+        status = PhpReadRemoteSpan(
+            &reader,
+            (ULONG_PTR)addressOfEntry,
+            &currentEntry,
+            dataTableEntrySize
+            );
+
+        if (!NT_SUCCESS(status))
+            break;
+
+        // Make sure the entry is valid.
+        if (currentEntry.DllBase)
+        {
+            if (count == capacity)
+            {
+                if (capacity == 0)
+                {
+                    capacity = 64;
+                    entries = PhAllocate(capacity * sizeof(LDR_DATA_TABLE_ENTRY));
+                    names = PhAllocate(capacity * sizeof(PHP_MODULE_NAME_ENTRY));
+                }
+                else
+                {
+                    capacity *= 2;
+                    entries = PhReAllocate(entries, capacity * sizeof(LDR_DATA_TABLE_ENTRY));
+                    names = PhReAllocate(names, capacity * sizeof(PHP_MODULE_NAME_ENTRY));
+                }
+            }
+
+            entries[count] = currentEntry;
+            memset(&names[count], 0, sizeof(PHP_MODULE_NAME_ENTRY));
+            names[count].EntryAddress = (ULONG_PTR)addressOfEntry;
+            names[count].DllBase = (ULONG_PTR)currentEntry.DllBase;
+            names[count].FullDllNameAddress = (ULONG_PTR)currentEntry.FullDllName.Buffer;
+            names[count].FullDllNameLength = currentEntry.FullDllName.Length;
+            names[count].BaseDllNameAddress = (ULONG_PTR)currentEntry.BaseDllName.Buffer;
+            names[count].BaseDllNameLength = currentEntry.BaseDllName.Length;
+            count++;
+        }
+
+        currentLink = currentEntry.InLoadOrderLinks.Flink;
+        i++;
+    }
+
+    if (count != 0 && (Flags & PHP_ENUM_PROCESS_MODULES_READ_NAMES))
+    {
+        PhpQueryModuleNames(
+            &reader,
+            basicInfo.UniqueProcessId,
+            (ULONG_PTR)basicInfo.PebBaseAddress,
+            names,
+            count
+            );
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        PHP_MODULE_NAMES moduleNames;
+
+        moduleNames.FullDllName = names[i].FullDllName;
+        moduleNames.BaseDllName = names[i].BaseDllName;
+
+        // Execute the callback.
+        if (!Callback(
+            ProcessHandle,
+            &entries[i],
+            (PVOID)(ULONG_PTR)names[i].EntryAddress,
+            Context,
+            (Flags & PHP_ENUM_PROCESS_MODULES_READ_NAMES) ? &moduleNames : NULL
+            ))
+            break;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        PhClearReference(&names[i].FullDllName);
+        PhClearReference(&names[i].BaseDllName);
+    }
+
+    if (entries)
+    {
+        PhFree(entries);
+        PhFree(names);
+    }
+
+    PhpDeleteRemoteSpanReader(&reader);
+
+    return status;
+}
+
+BOOLEAN NTAPI PhpEnumProcessModulesCallback(
+    _In_ HANDLE ProcessHandle,
+    _In_ PLDR_DATA_TABLE_ENTRY Entry,
+    _In_ PVOID AddressOfEntry,
+    _In_opt_ PVOID Context,
+    _In_opt_ PPHP_MODULE_NAMES Names
+    )
+{
+    NTSTATUS status;
+    PPH_ENUM_PROCESS_MODULES_PARAMETERS parameters;
+    BOOLEAN cont;
+    PPH_STRING mappedFileName;
+    PWSTR fullDllNameOriginal;
+    PWSTR fullDllNameBuffer;
+    PWSTR baseDllNameOriginal;
+    PWSTR baseDllNameBuffer;
+
+    parameters = Context;
+    mappedFileName = NULL;
+
+    if (parameters->Flags & PH_ENUM_PROCESS_MODULES_TRY_MAPPED_FILE_NAME)
+    {
+        PhGetProcessMappedFileName(ProcessHandle, Entry->DllBase, &mappedFileName);
+    }
+
+    if (mappedFileName)
+    {
+        ULONG_PTR indexOfLastBackslash;
+
+        PhStringRefToUnicodeString(&mappedFileName->sr, &Entry->FullDllName);
+        indexOfLastBackslash = PhFindLastCharInString(mappedFileName, 0, '\\');
+
+        if (indexOfLastBackslash != -1)
+        {
+            Entry->BaseDllName.Buffer = Entry->FullDllName.Buffer + indexOfLastBackslash + 1;
+            Entry->BaseDllName.Length = Entry->FullDllName.Length - (USHORT)indexOfLastBackslash * 2 - 2;
+            Entry->BaseDllName.MaximumLength = Entry->BaseDllName.Length;
+        }
+        else
+        {
+            Entry->BaseDllName = Entry->FullDllName;
+        }
+    }
+    else if (Names)
+    {
+        // The names were read by the walker.
+        PhStringRefToUnicodeString(&Names->FullDllName->sr, &Entry->FullDllName);
+        PhStringRefToUnicodeString(&Names->BaseDllName->sr, &Entry->BaseDllName);
+    }
+    else
+    {
+        // Read the full DLL name string and add a null terminator.
+
+        fullDllNameOriginal = Entry->FullDllName.Buffer;
+        fullDllNameBuffer = PhAllocate(Entry->FullDllName.Length + 2);
+        Entry->FullDllName.Buffer = fullDllNameBuffer;
+
+        if (NT_SUCCESS(status = PhReadVirtualMemory(
+            ProcessHandle,
+            fullDllNameOriginal,
+            fullDllNameBuffer,
+            Entry->FullDllName.Length,
+            NULL
+            )))
+        {
+            fullDllNameBuffer[Entry->FullDllName.Length / 2] = 0;
         }
         else
         {
@@ -3564,7 +4223,7 @@ BOOLEAN NTAPI PhpEnumProcessModulesCallback(
     {
         PhDereferenceObject(mappedFileName);
     }
-    else
+    else if (!Names)
     {
         PhFree(fullDllNameBuffer);
 
@@ -3616,11 +4275,13 @@ NTSTATUS PhEnumProcessModulesEx(
     _In_ PPH_ENUM_PROCESS_MODULES_PARAMETERS Parameters
     )
 {
+    // The mapped file names are queried for each module, so there is no point in reading the
+    // names in advance.
     return PhpEnumProcessModules(
         ProcessHandle,
+        (Parameters->Flags & PH_ENUM_PROCESS_MODULES_TRY_MAPPED_FILE_NAME) ? 0 : PHP_ENUM_PROCESS_MODULES_READ_NAMES,
         PhpEnumProcessModulesCallback,
-        Parameters,
-        NULL
+        Parameters
         );
 }
 
@@ -3635,11 +4296,11 @@ BOOLEAN NTAPI PhpSetProcessModuleLoadCountCallback(
     _In_ HANDLE ProcessHandle,
     _In_ PLDR_DATA_TABLE_ENTRY Entry,
     _In_ PVOID AddressOfEntry,
-    _In_opt_ PVOID Context1,
-    _In_opt_ PVOID Context2
+    _In_opt_ PVOID Context,
+    _In_opt_ PPHP_MODULE_NAMES Names
     )
 {
-    PSET_PROCESS_MODULE_LOAD_COUNT_CONTEXT context = Context1;
+    PSET_PROCESS_MODULE_LOAD_COUNT_CONTEXT context = Context;
 
     if (Entry->DllBase == context->BaseAddress)
     {
@@ -3683,9 +4344,9 @@ NTSTATUS PhSetProcessModuleLoadCount(
 
     status = PhpEnumProcessModules(
         ProcessHandle,
+        0,
         PhpSetProcessModuleLoadCountCallback,
-        &context,
-        NULL
+        &context
         );
 
     if (!NT_SUCCESS(status))
@@ -3696,12 +4357,13 @@ NTSTATUS PhSetProcessModuleLoadCount(
 
 NTSTATUS PhpEnumProcessModules32(
     _In_ HANDLE ProcessHandle,
+    _In_ ULONG Flags,
     _In_ PPHP_ENUM_PROCESS_MODULES32_CALLBACK Callback,
-    _In_opt_ PVOID Context1,
-    _In_opt_ PVOID Context2
+    _In_opt_ PVOID Context
     )
 {
     NTSTATUS status;
+    PROCESS_BASIC_INFORMATION basicInfo;
     PPEB32 peb;
     ULONG ldr; // PEB_LDR_DATA32 *32
     PEB_LDR_DATA32 pebLdrData;
@@ -3709,8 +4371,19 @@ NTSTATUS PhpEnumProcessModules32(
     ULONG currentLink; // LIST_ENTRY32 *32
     ULONG dataTableEntrySize;
     LDR_DATA_TABLE_ENTRY32 currentEntry;
+    PHP_REMOTE_SPAN_READER reader;
+    PLDR_DATA_TABLE_ENTRY32 entries;
+    PPHP_MODULE_NAME_ENTRY names;
+    ULONG count;
+    ULONG capacity;
     ULONG i;
 
+    // Get the process ID, which is used to cache the module names.
+    status = PhGetProcessBasicInformation(ProcessHandle, &basicInfo);
+
+    if (!NT_SUCCESS(status))
+        return status;
+
     // Get the 32-bit PEB address.
     status = PhGetProcessPeb32(ProcessHandle, &peb);
 
@@ -3754,7 +4427,13 @@ NTSTATUS PhpEnumProcessModules32(
     else
         dataTableEntrySize = LDR_DATA_TABLE_ENTRY_SIZE_WINXP_32;
 
-    // Traverse the linked list (in load order).
+    // Traverse the linked list (in load order). See PhpEnumProcessModules.
+
+    PhpInitializeRemoteSpanReader(&reader, ProcessHandle);
+    entries = NULL;
+    names = NULL;
+    count = 0;
+    capacity = 0;
 
     i = 0;
     startLink = (ULONG)(ldr + FIELD_OFFSET(PEB_LDR_DATA32, InLoadOrderModuleList));
@@ -3768,35 +4447,93 @@ NTSTATUS PhpEnumProcessModules32(
         ULONG addressOfEntry;
 
         addressOfEntry = PtrToUlong(CONTAINING_RECORD(UlongToPtr(currentLink), LDR_DATA_TABLE_ENTRY32, InLoadOrderLinks));
-        status = PhReadVirtualMemory(
-            ProcessHandle,
-            UlongToPtr(addressOfEntry),
+        status = PhpReadRemoteSpan(
+            &reader,
+            addressOfEntry,
             &currentEntry,
-            dataTableEntrySize,
-            NULL
+            dataTableEntrySize
             );
 
         if (!NT_SUCCESS(status))
-            return status;
+            break;
 
         // Make sure the entry is valid.
         if (currentEntry.DllBase)
         {
-            // Execute the callback.
-            if (!Callback(
-                ProcessHandle,
-                &currentEntry,
-                addressOfEntry,
-                Context1,
-                Context2
-                ))
-                break;
+            if (count == capacity)
+            {
+                if (capacity == 0)
+                {
+                    capacity = 64;
+                    entries = PhAllocate(capacity * sizeof(LDR_DATA_TABLE_ENTRY32));
+                    names = PhAllocate(capacity * sizeof(PHP_MODULE_NAME_ENTRY));
+                }
+                else
+                {
+                    capacity *= 2;
+                    entries = PhReAllocate(entries, capacity * sizeof(LDR_DATA_TABLE_ENTRY32));
+                    names = PhReAllocate(names, capacity * sizeof(PHP_MODULE_NAME_ENTRY));
+                }
+            }
+
+            entries[count] = currentEntry;
+            memset(&names[count], 0, sizeof(PHP_MODULE_NAME_ENTRY));
+            names[count].EntryAddress = addressOfEntry;
+            names[count].DllBase = currentEntry.DllBase;
+            names[count].FullDllNameAddress = currentEntry.FullDllName.Buffer;
+            names[count].FullDllNameLength = currentEntry.FullDllName.Length;
+            names[count].BaseDllNameAddress = currentEntry.BaseDllName.Buffer;
+            names[count].BaseDllNameLength = currentEntry.BaseDllName.Length;
+            count++;
         }
 
         currentLink = currentEntry.InLoadOrderLinks.Flink;
         i++;
     }
 
+    if (count != 0 && (Flags & PHP_ENUM_PROCESS_MODULES_READ_NAMES))
+    {
+        PhpQueryModuleNames(
+            &reader,
+            basicInfo.UniqueProcessId,
+            (ULONG_PTR)peb,
+            names,
+            count
+            );
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        PHP_MODULE_NAMES moduleNames;
+
+        moduleNames.FullDllName = names[i].FullDllName;
+        moduleNames.BaseDllName = names[i].BaseDllName;
+
+        // Execute the callback.
+        if (!Callback(
+            ProcessHandle,
+            &entries[i],
+            (ULONG)names[i].EntryAddress,
+            Context,
+            (Flags & PHP_ENUM_PROCESS_MODULES_READ_NAMES) ? &moduleNames : NULL
+            ))
+            break;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        PhClearReference(&names[i].FullDllName);
+        PhClearReference(&names[i].BaseDllName);
+    }
+
+    if (entries)
+    {
+        PhFree(entries);
+        PhFree(names);
+    }
+
+    PhpDeleteRemoteSpanReader(&reader);
+
     return status;
 }
 
@@ -3804,12 +4541,13 @@ BOOLEAN NTAPI PhpEnumProcessModules32Callback(
     _In_ HANDLE ProcessHandle,
     _In_ PLDR_DATA_TABLE_ENTRY32 Entry,
     _In_ ULONG AddressOfEntry,
-    _In_opt_ PVOID Context1,
-    _In_opt_ PVOID Context2
+    _In_opt_ PVOID Context,
+    _In_opt_ PPHP_MODULE_NAMES Names
     )
 {
     static PH_STRINGREF system32String = PH_STRINGREF_INIT(L"\\system32\\");
 
+    NTSTATUS status;
     PPH_ENUM_PROCESS_MODULES_PARAMETERS parameters;
     BOOLEAN cont;
     LDR_DATA_TABLE_ENTRY nativeEntry;
@@ -3819,7 +4557,7 @@ BOOLEAN NTAPI PhpEnumProcessModules32Callback(
     PH_STRINGREF fullDllName;
     PH_STRINGREF systemRootString;
 
-    parameters = Context1;
+    parameters = Context;
 
     // Convert the 32-bit entry to a native-sized entry.
 
@@ -3865,39 +4603,58 @@ BOOLEAN NTAPI PhpEnumProcessModules32Callback(
     }
     else
     {
-        // Read the base DLL name string and add a null terminator.
+        if (Names)
+        {
+            // The names were read by the walker. We still need our own copy of the full DLL
+            // name because it may be modified below.
 
-        baseDllNameBuffer = PhAllocate(nativeEntry.BaseDllName.Length + 2);
+            PhStringRefToUnicodeString(&Names->BaseDllName->sr, &nativeEntry.BaseDllName);
+            baseDllNameBuffer = NULL;
 
-        if (NT_SUCCESS(PhReadVirtualMemory(
-            ProcessHandle,
-            nativeEntry.BaseDllName.Buffer,
-            baseDllNameBuffer,
-            nativeEntry.BaseDllName.Length,
-            NULL
-            )))
-        {
-            baseDllNameBuffer[nativeEntry.BaseDllName.Length / 2] = 0;
+            nativeEntry.FullDllName.Length = (USHORT)Names->FullDllName->Length;
+            fullDllNameBuffer = PhAllocate(nativeEntry.FullDllName.Length + 2);
+            memcpy(fullDllNameBuffer, Names->FullDllName->Buffer, nativeEntry.FullDllName.Length);
+            status = STATUS_SUCCESS;
         }
         else
         {
-            baseDllNameBuffer[0] = 0;
-            nativeEntry.BaseDllName.Length = 0;
-        }
+            // Read the base DLL name string and add a null terminator.
 
-        nativeEntry.BaseDllName.Buffer = baseDllNameBuffer;
+            baseDllNameBuffer = PhAllocate(nativeEntry.BaseDllName.Length + 2);
 
-        // Read the full DLL name string and add a null terminator.
+            if (NT_SUCCESS(PhReadVirtualMemory(
+                ProcessHandle,
+                nativeEntry.BaseDllName.Buffer,
+                baseDllNameBuffer,
+                nativeEntry.BaseDllName.Length,
+                NULL
+                )))
+            {
+                baseDllNameBuffer[nativeEntry.BaseDllName.Length / 2] = 0;
+            }
+            else
+            {
+                baseDllNameBuffer[0] = 0;
+                nativeEntry.BaseDllName.Length = 0;
+            }
 
-        fullDllNameBuffer = PhAllocate(nativeEntry.FullDllName.Length + 2);
+            nativeEntry.BaseDllName.Buffer = baseDllNameBuffer;
 
-        if (NT_SUCCESS(PhReadVirtualMemory(
-            ProcessHandle,
-            nativeEntry.FullDllName.Buffer,
-            fullDllNameBuffer,
-            nativeEntry.FullDllName.Length,
-            NULL
-            )))
+            // Read the full DLL name string.
+
+            fullDllNameBuffer = PhAllocate(nativeEntry.FullDllName.Length + 2);
+            status = PhReadVirtualMemory(
+                ProcessHandle,
+                nativeEntry.FullDllName.Buffer,
+                fullDllNameBuffer,
+                nativeEntry.FullDllName.Length,
+                NULL
+                );
+        }
+
+        // Add a null terminator to the full DLL name.
+
+        if (NT_SUCCESS(status))
         {
             fullDllNameBuffer[nativeEntry.FullDllName.Length / 2] = 0;
 
@@ -3946,7 +4703,9 @@ BOOLEAN NTAPI PhpEnumProcessModules32Callback(
     }
     else
     {
-        PhFree(baseDllNameBuffer);
+        if (baseDllNameBuffer)
+            PhFree(baseDllNameBuffer);
+
         PhFree(fullDllNameBuffer);
     }
 
@@ -4008,9 +4767,9 @@ NTSTATUS PhEnumProcessModules32Ex(
 {
     return PhpEnumProcessModules32(
         ProcessHandle,
+        (Parameters->Flags & PH_ENUM_PROCESS_MODULES_TRY_MAPPED_FILE_NAME) ? 0 : PHP_ENUM_PROCESS_MODULES_READ_NAMES,
         PhpEnumProcessModules32Callback,
-        Parameters,
-        NULL
+        Parameters
         );
 }
 
@@ -4018,11 +4777,11 @@ BOOLEAN NTAPI PhpSetProcessModuleLoadCount32Callback(
     _In_ HANDLE ProcessHandle,
     _In_ PLDR_DATA_TABLE_ENTRY32 Entry,
     _In_ ULONG AddressOfEntry,
-    _In_opt_ PVOID Context1,
-    _In_opt_ PVOID Context2
+    _In_opt_ PVOID Context,
+    _In_opt_ PPHP_MODULE_NAMES Names
     )
 {
-    PSET_PROCESS_MODULE_LOAD_COUNT_CONTEXT context = Context1;
+    PSET_PROCESS_MODULE_LOAD_COUNT_CONTEXT context = Context;
 
     if (UlongToPtr(Entry->DllBase) == context->BaseAddress)
     {
@@ -4071,9 +4830,9 @@ NTSTATUS PhSetProcessModuleLoadCount32(
 
     status = PhpEnumProcessModules32(
         ProcessHandle,
+        0,
         PhpSetProcessModuleLoadCount32Callback,
-        &context,
-        NULL
+        &context
         );
 
     if (!NT_SUCCESS(status))
@@ -4133,17 +4892,19 @@ NTSTATUS PhGetProcedureAddressRemote(
     )
 {
     NTSTATUS status;
-    PH_MAPPED_IMAGE mappedImage;
-    PH_MAPPED_IMAGE_EXPORTS exports;
+    ULONG rva;
+    USHORT magic;
     GET_PROCEDURE_ADDRESS_REMOTE_CONTEXT context;
 
-    if (!NT_SUCCESS(status = PhLoadMappedImage(FileName, NULL, TRUE, &mappedImage)))
+    // The export index is cached, so repeated calls (e.g. for different processes) don't need
+    // to map and parse the image again.
+    if (!NT_SUCCESS(status = PhGetImageExportRvaCached(FileName, ProcedureName, (USHORT)ProcedureNumber, &rva, &magic)))
         return status;
 
     PhInitializeStringRef(&context.FileName, FileName);
     context.DllBase = NULL;
 
-    if (mappedImage.Magic == IMAGE_NT_OPTIONAL_HDR32_MAGIC)
+    if (magic == IMAGE_NT_OPTIONAL_HDR32_MAGIC)
     {
 #ifdef _WIN64
         status = PhEnumProcessModules32(ProcessHandle, PhpGetProcedureAddressRemoteCallback, &context);
@@ -4161,27 +4922,12 @@ NTSTATUS PhGetProcedureAddressRemote(
     }
 
     if (!NT_SUCCESS(status))
-        goto CleanupExit;
-
-    if (!NT_SUCCESS(status = PhGetMappedImageExports(&exports, &mappedImage)))
-        goto CleanupExit;
-
-    status = PhGetMappedImageExportFunctionRemote(
-        &exports,
-        ProcedureName,
-        (USHORT)ProcedureNumber,
-        context.DllBase,
-        ProcedureAddress
-        );
+        return status;
 
-    if (NT_SUCCESS(status))
-    {
-        if (DllBase)
-            *DllBase = context.DllBase;
-    }
+    *ProcedureAddress = PTR_ADD_OFFSET(context.DllBase, rva);
 
-CleanupExit:
-    PhUnloadMappedImage(&mappedImage);
+    if (DllBase)
+        *DllBase = context.DllBase;
 
     return status;
 }
@@ -4204,30 +4950,74 @@ NTSTATUS PhEnumKernelModules(
 
     buffer = PhAllocate(bufferSize);
 
-    status = NtQuerySystemInformation(
-        SystemModuleInformation,
-        buffer,
-        bufferSize,
-        &bufferSize
-        );
+    status = NtQuerySystemInformation(
+        SystemModuleInformation,
+        buffer,
+        bufferSize,
+        &bufferSize
+        );
+
+    if (status == STATUS_INFO_LENGTH_MISMATCH)
+    {
+        PhFree(buffer);
+        buffer = PhAllocate(bufferSize);
+
+        status = NtQuerySystemInformation(
+            SystemModuleInformation,
+            buffer,
+            bufferSize,
+            &bufferSize
+            );
+    }
+
+    if (!NT_SUCCESS(status))
+        return status;
+
+    *Modules = buffer;
+
+    return status;
+}
+
+/**
+ * Gets a value which changes when a kernel module is
+ * loaded or unloaded.
+ *
+ * \param NumberOfModules A variable which receives the
+ * number of kernel modules.
+ * \param Checksum A variable which receives a checksum
+ * of the base addresses, sizes and load order of the
+ * kernel modules.
+ *
+ * \remarks This is much cheaper than converting and
+ * comparing the module list, and can be used to decide
+ * whether the list needs to be enumerated again.
+ */
+NTSTATUS PhGetKernelModulesChecksum(
+    _Out_ PULONG NumberOfModules,
+    _Out_ PULONG Checksum
+    )
+{
+    NTSTATUS status;
+    PRTL_PROCESS_MODULES modules;
+    ULONG checksum;
+    ULONG i;
+
+    if (!NT_SUCCESS(status = PhEnumKernelModules(&modules)))
+        return status;
+
+    checksum = 0;
 
-    if (status == STATUS_INFO_LENGTH_MISMATCH)
+    for (i = 0; i < modules->NumberOfModules; i++)
     {
-        PhFree(buffer);
-        buffer = PhAllocate(bufferSize);
-
-        status = NtQuerySystemInformation(
-            SystemModuleInformation,
-            buffer,
-            bufferSize,
-            &bufferSize
-            );
+        checksum = checksum * 37 + PhHashIntPtr((ULONG_PTR)modules->Modules[i].ImageBase);
+        checksum = checksum * 37 + modules->Modules[i].ImageSize;
+        checksum = checksum * 37 + modules->Modules[i].LoadOrderIndex;
     }
 
-    if (!NT_SUCCESS(status))
-        return status;
+    *NumberOfModules = modules->NumberOfModules;
+    *Checksum = checksum;
 
-    *Modules = buffer;
+    PhFree(modules);
 
     return status;
 }
@@ -4392,7 +5182,9 @@ NTSTATUS PhEnumProcessesEx(
         return status;
     }
 
-    if (bufferSize <= 0x40000) initialBufferSize[classIndex] = bufferSize;
+    // Remember the size for next time, with some room for new processes so that we don't
+    // have to go through the retry loop above on large systems.
+    initialBufferSize[classIndex] = bufferSize + bufferSize / 8;
     *Processes = buffer;
 
     return status;
@@ -4456,12 +5248,257 @@ NTSTATUS PhEnumProcessesForSession(
         return status;
     }
 
-    if (bufferSize <= 0x20000) initialBufferSize = bufferSize;
+    initialBufferSize = bufferSize + bufferSize / 8;
+    *Processes = buffer;
+
+    return status;
+}
+
+/**
+ * Initializes a process snapshot.
+ *
+ * \param Snapshot The snapshot object.
+ * \param SystemInformationClass The information class to query,
+ * either SystemProcessInformation, SystemExtendedProcessInformation
+ * or SystemFullProcessInformation.
+ */
+VOID PhInitializeProcessSnapshot(
+    _Out_ PPH_PROCESS_SNAPSHOT Snapshot,
+    _In_ SYSTEM_INFORMATION_CLASS SystemInformationClass
+    )
+{
+    PhInitializeProcessSnapshotEx(Snapshot, SystemInformationClass, NULL);
+}
+
+/**
+ * Initializes a process snapshot.
+ *
+ * \param Snapshot The snapshot object.
+ * \param SystemInformationClass The information class to query,
+ * either SystemProcessInformation, SystemExtendedProcessInformation
+ * or SystemFullProcessInformation.
+ * \param Arena The arena from which the buffers are allocated, or
+ * NULL to allocate them using PhAllocatePage(). The arena must
+ * remain valid until the snapshot is deleted.
+ */
+VOID PhInitializeProcessSnapshotEx(
+    _Out_ PPH_PROCESS_SNAPSHOT Snapshot,
+    _In_ SYSTEM_INFORMATION_CLASS SystemInformationClass,
+    _In_opt_ PPH_ARENA Arena
+    )
+{
+    memset(Snapshot, 0, sizeof(PH_PROCESS_SNAPSHOT));
+    Snapshot->SystemInformationClass = SystemInformationClass;
+    Snapshot->Arena = Arena;
+}
+
+/**
+ * Initializes a process snapshot for a session.
+ *
+ * \param Snapshot The snapshot object.
+ * \param SessionId A session ID.
+ */
+VOID PhInitializeProcessSnapshotForSession(
+    _Out_ PPH_PROCESS_SNAPSHOT Snapshot,
+    _In_ ULONG SessionId
+    )
+{
+    memset(Snapshot, 0, sizeof(PH_PROCESS_SNAPSHOT));
+    Snapshot->SystemInformationClass = SystemSessionProcessInformation;
+    Snapshot->SessionId = SessionId;
+}
+
+/**
+ * Frees the buffers used by a process snapshot.
+ *
+ * \param Snapshot The snapshot object.
+ */
+VOID PhDeleteProcessSnapshot(
+    _Inout_ PPH_PROCESS_SNAPSHOT Snapshot
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < 2; i++)
+    {
+        if (Snapshot->Buffers[i])
+        {
+            PhFreePage(Snapshot->Buffers[i]);
+            Snapshot->Buffers[i] = NULL;
+            Snapshot->BufferSizes[i] = 0;
+        }
+    }
+}
+
+static PVOID PhpAllocateProcessSnapshotBuffer(
+    _In_ PPH_PROCESS_SNAPSHOT Snapshot,
+    _In_ SIZE_T Size,
+    _Out_ PSIZE_T NewSize
+    )
+{
+    // Only blocks larger than PH_ARENA_MAXIMUM_BLOCK_SIZE are taken from the arena, so that every
+    // buffer can be freed using PhFreePage().
+    if (Snapshot->Arena && Size > PH_ARENA_MAXIMUM_BLOCK_SIZE)
+        return PhAllocateArena(Snapshot->Arena, Size, NewSize);
+    else
+        return PhAllocatePage(Size, NewSize);
+}
+
+NTSTATUS PhpQueryProcessSnapshot(
+    _In_ PPH_PROCESS_SNAPSHOT Snapshot,
+    _Out_writes_bytes_(BufferLength) PVOID Buffer,
+    _In_ ULONG BufferLength,
+    _Out_ PULONG ReturnLength
+    )
+{
+    if (Snapshot->SystemInformationClass == SystemSessionProcessInformation)
+    {
+        SYSTEM_SESSION_PROCESS_INFORMATION sessionProcessInfo;
+
+        sessionProcessInfo.SessionId = Snapshot->SessionId;
+        sessionProcessInfo.SizeOfBuf = BufferLength;
+        sessionProcessInfo.Buffer = Buffer;
+
+        return NtQuerySystemInformation(
+            SystemSessionProcessInformation,
+            &sessionProcessInfo,
+            sizeof(SYSTEM_SESSION_PROCESS_INFORMATION),
+            ReturnLength // size of the inner buffer gets returned
+            );
+    }
+    else
+    {
+        return NtQuerySystemInformation(
+            Snapshot->SystemInformationClass,
+            Buffer,
+            BufferLength,
+            ReturnLength
+            );
+    }
+}
+
+/**
+ * Updates a process snapshot.
+ *
+ * \param Snapshot The snapshot object.
+ * \param Processes A variable which receives a pointer to a
+ * buffer containing process information. The buffer is owned
+ * by the snapshot and must not be freed. It remains valid until
+ * PhUpdateProcessSnapshot() is called twice more or the snapshot
+ * is deleted.
+ *
+ * \remarks The buffer is filled in-place and may be modified by
+ * the caller. When the system needs less than a quarter of a
+ * buffer for \ref PH_PROCESS_SNAPSHOT_SHRINK_THRESHOLD consecutive
+ * updates, the buffer is shrunk the next time it is reused.
+ */
+NTSTATUS PhUpdateProcessSnapshot(
+    _Inout_ PPH_PROCESS_SNAPSHOT Snapshot,
+    _Out_ PVOID *Processes
+    )
+{
+    NTSTATUS status;
+    ULONG index;
+    PVOID buffer;
+    SIZE_T bufferSize;
+    ULONG returnLength;
+
+    // Fill the buffer that was not returned last time. The current buffer may still be in use
+    // by the caller.
+    index = Snapshot->CurrentIndex ^ 1;
+    buffer = Snapshot->Buffers[index];
+    bufferSize = Snapshot->BufferSizes[index];
+
+    if (buffer && Snapshot->ShrinkCount >= PH_PROCESS_SNAPSHOT_SHRINK_THRESHOLD)
+    {
+        PhFreePage(buffer);
+        buffer = NULL;
+        Snapshot->ShrinkCount = 0;
+    }
+
+    if (!buffer)
+    {
+        if (Snapshot->DataLength != 0)
+            bufferSize = Snapshot->DataLength + Snapshot->DataLength / 8;
+        else
+            bufferSize = PH_PROCESS_SNAPSHOT_INITIAL_SIZE;
+
+        buffer = PhpAllocateProcessSnapshotBuffer(Snapshot, bufferSize, &bufferSize);
+    }
+
+    while (TRUE)
+    {
+        if (!buffer)
+        {
+            status = STATUS_NO_MEMORY;
+            break;
+        }
+
+        status = PhpQueryProcessSnapshot(Snapshot, buffer, (ULONG)bufferSize, &returnLength);
+
+        if (status == STATUS_BUFFER_TOO_SMALL || status == STATUS_INFO_LENGTH_MISMATCH)
+        {
+            // Grow with some room for new processes so that the next update doesn't have to
+            // reallocate again.
+            PhFreePage(buffer);
+            bufferSize = returnLength + returnLength / 8;
+            buffer = PhpAllocateProcessSnapshotBuffer(Snapshot, bufferSize, &bufferSize);
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    Snapshot->Buffers[index] = buffer;
+    Snapshot->BufferSizes[index] = buffer ? bufferSize : 0;
+
+    if (!NT_SUCCESS(status))
+        return status;
+
+    if (returnLength < bufferSize / 4 && bufferSize > PH_PROCESS_SNAPSHOT_INITIAL_SIZE)
+        Snapshot->ShrinkCount++;
+    else
+        Snapshot->ShrinkCount = 0;
+
+    Snapshot->CurrentIndex = index;
+    Snapshot->DataLength = returnLength;
     *Processes = buffer;
 
     return status;
 }
 
+/**
+ * Removes a buffer from a process snapshot, so that it is not
+ * overwritten by later updates.
+ *
+ * \param Snapshot The snapshot object.
+ * \param Buffer A buffer returned by PhUpdateProcessSnapshot().
+ *
+ * \return TRUE if the buffer was detached, otherwise FALSE. If
+ * the function returns TRUE, the caller owns the buffer and must
+ * free it using PhFreePage().
+ */
+BOOLEAN PhDetachProcessSnapshotBuffer(
+    _Inout_ PPH_PROCESS_SNAPSHOT Snapshot,
+    _In_ PVOID Buffer
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < 2; i++)
+    {
+        if (Snapshot->Buffers[i] == Buffer)
+        {
+            Snapshot->Buffers[i] = NULL;
+            Snapshot->BufferSizes[i] = 0;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
 /**
  * Finds the process information structure for a
  * specific process.
@@ -5262,6 +6299,114 @@ VOID PhInitializeDevicePrefixes(
     }
 }
 
+static int __cdecl PhpDevicePrefixEntryCompare(
+    _In_ const void *elem1,
+    _In_ const void *elem2
+    )
+{
+    PPH_DEVICE_PREFIX_ENTRY entry1 = (PPH_DEVICE_PREFIX_ENTRY)elem1;
+    PPH_DEVICE_PREFIX_ENTRY entry2 = (PPH_DEVICE_PREFIX_ENTRY)elem2;
+    int result;
+
+    // Longest prefix first. Ties are broken by drive letter so that the lowest letter wins,
+    // as it did when the drives were searched in order.
+    result = uintptrcmp(entry2->Prefix.Length, entry1->Prefix.Length);
+
+    if (result == 0)
+        result = uintcmp(entry1->DriveLetter, entry2->DriveLetter);
+
+    return result;
+}
+
+/**
+ * Builds a new device prefix table and replaces the current one.
+ *
+ * \remarks PhDevicePrefixesLock must be held exclusively.
+ */
+static VOID PhpPublishDevicePrefixTable(
+    VOID
+    )
+{
+    PPH_DEVICE_PREFIX_TABLE table;
+    PPH_DEVICE_PREFIX_TABLE oldTable;
+    ULONG numberOfEntries;
+    SIZE_T stringsLength;
+    PWCHAR stringBuffer;
+    ULONG i;
+
+    numberOfEntries = 0;
+    stringsLength = 0;
+
+    for (i = 0; i < 26; i++)
+    {
+        if (PhDevicePrefixes[i].Length != 0)
+        {
+            numberOfEntries++;
+            stringsLength += PhDevicePrefixes[i].Length;
+        }
+    }
+
+    for (i = 0; i < PhDeviceMupPrefixesCount; i++)
+    {
+        if (PhDeviceMupPrefixes[i]->Length != 0)
+        {
+            numberOfEntries++;
+            stringsLength += PhDeviceMupPrefixes[i]->Length;
+        }
+    }
+
+    // The strings are stored in the same block as the table so that it can be freed in one go.
+    table = PhAllocate(
+        FIELD_OFFSET(PH_DEVICE_PREFIX_TABLE, Entries) +
+        max(numberOfEntries, 1) * sizeof(PH_DEVICE_PREFIX_ENTRY) +
+        stringsLength
+        );
+    table->NumberOfDosEntries = 0;
+    table->NumberOfMupEntries = 0;
+    stringBuffer = (PWCHAR)&table->Entries[max(numberOfEntries, 1)];
+
+    for (i = 0; i < 26; i++)
+    {
+        PPH_DEVICE_PREFIX_ENTRY entry;
+
+        if (PhDevicePrefixes[i].Length == 0)
+            continue;
+
+        entry = &table->Entries[table->NumberOfDosEntries++];
+        memcpy(stringBuffer, PhDevicePrefixes[i].Buffer, PhDevicePrefixes[i].Length);
+        entry->Prefix.Buffer = stringBuffer;
+        entry->Prefix.Length = PhDevicePrefixes[i].Length;
+        entry->DriveLetter = (WCHAR)('A' + i);
+        stringBuffer += PhDevicePrefixes[i].Length / sizeof(WCHAR);
+    }
+
+    for (i = 0; i < PhDeviceMupPrefixesCount; i++)
+    {
+        PPH_DEVICE_PREFIX_ENTRY entry;
+
+        if (PhDeviceMupPrefixes[i]->Length == 0)
+            continue;
+
+        entry = &table->Entries[table->NumberOfDosEntries + table->NumberOfMupEntries++];
+        memcpy(stringBuffer, PhDeviceMupPrefixes[i]->Buffer, PhDeviceMupPrefixes[i]->Length);
+        entry->Prefix.Buffer = stringBuffer;
+        entry->Prefix.Length = PhDeviceMupPrefixes[i]->Length;
+        entry->DriveLetter = 0;
+        stringBuffer += PhDeviceMupPrefixes[i]->Length / sizeof(WCHAR);
+    }
+
+    qsort(table->Entries, table->NumberOfDosEntries, sizeof(PH_DEVICE_PREFIX_ENTRY), PhpDevicePrefixEntryCompare);
+    qsort(&table->Entries[table->NumberOfDosEntries], table->NumberOfMupEntries, sizeof(PH_DEVICE_PREFIX_ENTRY), PhpDevicePrefixEntryCompare);
+
+    oldTable = _InterlockedExchangePointer(&PhDevicePrefixTable, table);
+
+    if (oldTable)
+    {
+        PhFreeAfterEpoch(oldTable);
+        PhReclaimEpoch();
+    }
+}
+
 VOID PhUpdateMupDevicePrefixes(
     VOID
     )
@@ -5299,7 +6444,7 @@ VOID PhUpdateMupDevicePrefixes(
     if (!providerOrder)
         return;
 
-    PhAcquireQueuedLockExclusive(&PhDeviceMupPrefixesLock);
+    PhAcquireQueuedLockExclusive(&PhDevicePrefixesLock);
 
     for (i = 0; i < PhDeviceMupPrefixesCount; i++)
     {
@@ -5355,26 +6500,30 @@ VOID PhUpdateMupDevicePrefixes(
         }
     }
 
-    PhReleaseQueuedLockExclusive(&PhDeviceMupPrefixesLock);
+    PhpPublishDevicePrefixTable();
+
+    PhReleaseQueuedLockExclusive(&PhDevicePrefixesLock);
 
     PhDereferenceObject(providerOrder);
 }
 
-/**
- * Updates the DOS device names array.
- */
-VOID PhUpdateDosDevicePrefixes(
+static VOID PhpUpdateDosDevicePrefixes(
     VOID
     )
 {
     WCHAR deviceNameBuffer[7] = L"\\??\\ :";
+    WCHAR targetBuffer[PH_DEVICE_PREFIX_LENGTH];
+    BOOLEAN changed = FALSE;
     ULONG i;
 
+    PhAcquireQueuedLockExclusive(&PhDevicePrefixesLock);
+
     for (i = 0; i < 26; i++)
     {
         HANDLE linkHandle;
         OBJECT_ATTRIBUTES oa;
         UNICODE_STRING deviceName;
+        UNICODE_STRING target;
 
         deviceNameBuffer[4] = (WCHAR)('A' + i);
         deviceName.Buffer = deviceNameBuffer;
@@ -5388,32 +6537,69 @@ VOID PhUpdateDosDevicePrefixes(
             NULL
             );
 
+        target.Length = 0;
+        target.MaximumLength = sizeof(targetBuffer);
+        target.Buffer = targetBuffer;
+
         if (NT_SUCCESS(NtOpenSymbolicLinkObject(
             &linkHandle,
             SYMBOLIC_LINK_QUERY,
             &oa
             )))
         {
-            PhAcquireQueuedLockExclusive(&PhDevicePrefixesLock);
-
             if (!NT_SUCCESS(NtQuerySymbolicLinkObject(
                 linkHandle,
-                &PhDevicePrefixes[i],
+                &target,
                 NULL
                 )))
             {
-                PhDevicePrefixes[i].Length = 0;
+                target.Length = 0;
             }
 
-            PhReleaseQueuedLockExclusive(&PhDevicePrefixesLock);
-
             NtClose(linkHandle);
         }
-        else
+
+        if (!RtlEqualUnicodeString(&target, &PhDevicePrefixes[i], FALSE))
         {
-            PhDevicePrefixes[i].Length = 0;
+            memcpy(PhDevicePrefixes[i].Buffer, target.Buffer, target.Length);
+            PhDevicePrefixes[i].Length = target.Length;
+            changed = TRUE;
         }
     }
+
+    if (changed || !PhDevicePrefixTable)
+        PhpPublishDevicePrefixTable();
+
+    PhReleaseQueuedLockExclusive(&PhDevicePrefixesLock);
+}
+
+static VOID PhpInitializeDevicePrefixTable(
+    VOID
+    )
+{
+    if (PhBeginInitOnce(&PhDevicePrefixesInitOnce))
+    {
+        PhInitializeDevicePrefixes();
+        PhpUpdateDosDevicePrefixes();
+        PhUpdateMupDevicePrefixes();
+
+        PhEndInitOnce(&PhDevicePrefixesInitOnce);
+    }
+}
+
+/**
+ * Updates the DOS device names array.
+ *
+ * \remarks The lookup table used by PhResolveDevicePrefix() is only rebuilt if a
+ * drive letter has changed, so this function is cheap enough to call whenever a
+ * device may have arrived or been removed.
+ */
+VOID PhUpdateDosDevicePrefixes(
+    VOID
+    )
+{
+    PhpInitializeDevicePrefixTable();
+    PhpUpdateDosDevicePrefixes();
 }
 
 /**
@@ -5429,104 +6615,80 @@ PPH_STRING PhResolveDevicePrefix(
     _In_ PPH_STRING Name
     )
 {
+    PH_EPOCH_GUARD guard;
+    PPH_DEVICE_PREFIX_TABLE table;
+    PPH_DEVICE_PREFIX_ENTRY entry;
     ULONG i;
     PPH_STRING newName = NULL;
 
-    if (PhBeginInitOnce(&PhDevicePrefixesInitOnce))
-    {
-        PhInitializeDevicePrefixes();
-        PhUpdateDosDevicePrefixes();
-        PhUpdateMupDevicePrefixes();
+    PhpInitializeDevicePrefixTable();
 
-        PhEndInitOnce(&PhDevicePrefixesInitOnce);
-    }
+    PhEnterEpoch(&guard);
+
+    table = *(PPH_DEVICE_PREFIX_TABLE volatile *)&PhDevicePrefixTable;
 
     // Go through the DOS devices and try to find a matching prefix.
-    for (i = 0; i < 26; i++)
+    for (i = 0; i < table->NumberOfDosEntries; i++)
     {
-        BOOLEAN isPrefix = FALSE;
-        PH_STRINGREF prefix;
-
-        PhAcquireQueuedLockShared(&PhDevicePrefixesLock);
-
-        PhUnicodeStringToStringRef(&PhDevicePrefixes[i], &prefix);
+        entry = &table->Entries[i];
 
-        if (prefix.Length != 0)
-        {
-            if (PhStartsWithStringRef(&Name->sr, &prefix, TRUE))
-            {
-                // To ensure we match the longest prefix, make sure the next character is a backslash or
-                // the path is equal to the prefix.
-                if (Name->Length == prefix.Length || Name->Buffer[prefix.Length / sizeof(WCHAR)] == '\\')
-                {
-                    isPrefix = TRUE;
-                }
-            }
-        }
+        if (entry->Prefix.Length > Name->Length)
+            continue;
 
-        PhReleaseQueuedLockShared(&PhDevicePrefixesLock);
+        // To ensure we match the longest prefix, make sure the next character is a backslash or
+        // the path is equal to the prefix. This is much cheaper than the comparison itself.
+        if (Name->Length != entry->Prefix.Length && Name->Buffer[entry->Prefix.Length / sizeof(WCHAR)] != '\\')
+            continue;
 
-        if (isPrefix)
+        if (PhStartsWithStringRef(&Name->sr, &entry->Prefix, TRUE))
         {
             // <letter>:path
-            newName = PhCreateStringEx(NULL, 2 * sizeof(WCHAR) + Name->Length - prefix.Length);
-            newName->Buffer[0] = (WCHAR)('A' + i);
+            newName = PhCreateStringEx(NULL, 2 * sizeof(WCHAR) + Name->Length - entry->Prefix.Length);
+            newName->Buffer[0] = entry->DriveLetter;
             newName->Buffer[1] = ':';
             memcpy(
                 &newName->Buffer[2],
-                &Name->Buffer[prefix.Length / sizeof(WCHAR)],
-                Name->Length - prefix.Length
+                &Name->Buffer[entry->Prefix.Length / sizeof(WCHAR)],
+                Name->Length - entry->Prefix.Length
                 );
 
             break;
         }
     }
 
-    if (i == 26)
+    if (!newName)
     {
         // Resolve network providers.
 
-        PhAcquireQueuedLockShared(&PhDeviceMupPrefixesLock);
-
-        for (i = 0; i < PhDeviceMupPrefixesCount; i++)
+        for (i = 0; i < table->NumberOfMupEntries; i++)
         {
-            BOOLEAN isPrefix = FALSE;
-            SIZE_T prefixLength;
-
-            prefixLength = PhDeviceMupPrefixes[i]->Length;
+            entry = &table->Entries[table->NumberOfDosEntries + i];
 
-            if (prefixLength != 0)
-            {
-                if (PhStartsWithString(Name, PhDeviceMupPrefixes[i], TRUE))
-                {
-                    // To ensure we match the longest prefix, make sure the next character is a backslash.
-                    // Don't resolve if the name *is* the prefix. Otherwise, we will end up with a useless
-                    // string like "\".
-                    if (Name->Length != prefixLength && Name->Buffer[prefixLength / sizeof(WCHAR)] == '\\')
-                    {
-                        isPrefix = TRUE;
-                    }
-                }
-            }
+            // Don't resolve if the name *is* the prefix. Otherwise, we will end up with a useless
+            // string like "\".
+            if (entry->Prefix.Length >= Name->Length)
+                continue;
+            if (Name->Buffer[entry->Prefix.Length / sizeof(WCHAR)] != '\\')
+                continue;
 
-            if (isPrefix)
+            if (PhStartsWithStringRef(&Name->sr, &entry->Prefix, TRUE))
             {
                 // \path
-                newName = PhCreateStringEx(NULL, 1 * sizeof(WCHAR) + Name->Length - prefixLength);
+                newName = PhCreateStringEx(NULL, 1 * sizeof(WCHAR) + Name->Length - entry->Prefix.Length);
                 newName->Buffer[0] = '\\';
                 memcpy(
                     &newName->Buffer[1],
-                    &Name->Buffer[prefixLength / sizeof(WCHAR)],
-                    Name->Length - prefixLength
+                    &Name->Buffer[entry->Prefix.Length / sizeof(WCHAR)],
+                    Name->Length - entry->Prefix.Length
                     );
 
                 break;
             }
         }
-
-        PhReleaseQueuedLockShared(&PhDeviceMupPrefixesLock);
     }
 
+    PhLeaveEpoch(&guard);
+
     return newName;
 }
 
@@ -41,14 +41,43 @@
  * when boosted, always run on the same provider thread. The other option
  * would be to have the boosting thread run the provider function
  * directly, which would involve unnecessary blocking and synchronization.
+ *
+ * A provider thread can be placed in background mode, for example when
+ * its output is not being displayed. In background mode only providers
+ * which have been marked as background providers are run, and the
+ * interval is changed to a (usually longer) background interval. The
+ * timer is made coalescable when possible so that the system can batch
+ * our wake-ups with other timers. Boosting works as usual.
+ *
+ * Providers can have their own interval, which should be a multiple of
+ * the interval of their provider thread; the provider is skipped on
+ * timer ticks where it is not due. The run time of every provider is
+ * measured and recorded in a histogram. When a provider takes more than
+ * half of its interval to run, its interval is extended so that it does
+ * not monopolize the provider thread. Providers which are expensive
+ * should be registered on a separate provider thread so that they
+ * don't delay other providers.
  */
 
 #include <ph.h>
+#include <apiimport.h>
 
-#ifdef DEBUG
+// TIMER_SET_COALESCABLE_TIMER_INFO is only declared when targeting Windows 7.
+typedef struct _PH_COALESCABLE_TIMER_INFO
+{
+    LARGE_INTEGER DueTime;
+    PTIMER_APC_ROUTINE TimerApcRoutine;
+    PVOID TimerContext;
+    PVOID WakeContext;
+    ULONG Period;
+    ULONG TolerableDelay;
+    PBOOLEAN PreviousState;
+} PH_COALESCABLE_TIMER_INFO, *PPH_COALESCABLE_TIMER_INFO;
+
+// The list of provider threads is used by the debug console and the diagnostics sampler, so we
+// maintain it in release builds as well.
 PPH_LIST PhDbgProviderList;
 PH_QUEUED_LOCK PhDbgProviderListLock = PH_QUEUED_LOCK_INIT;
-#endif
 
 /**
  * Initializes a provider thread.
@@ -64,19 +93,18 @@ VOID PhInitializeProviderThread(
     ProviderThread->ThreadHandle = NULL;
     ProviderThread->TimerHandle = NULL;
     ProviderThread->Interval = Interval;
+    ProviderThread->BackgroundInterval = 0;
     ProviderThread->State = ProviderThreadStopped;
 
     PhInitializeQueuedLock(&ProviderThread->Lock);
     InitializeListHead(&ProviderThread->ListHead);
     ProviderThread->BoostCount = 0;
 
-#ifdef DEBUG
     PhAcquireQueuedLockExclusive(&PhDbgProviderListLock);
     if (!PhDbgProviderList)
         PhDbgProviderList = PhCreateList(4);
     PhAddItemList(PhDbgProviderList, ProviderThread);
     PhReleaseQueuedLockExclusive(&PhDbgProviderListLock);
-#endif
 }
 
 /**
@@ -88,17 +116,165 @@ VOID PhDeleteProviderThread(
     _Inout_ PPH_PROVIDER_THREAD ProviderThread
     )
 {
-#ifdef DEBUG
     ULONG index;
-#endif
-    // Nothing
 
-#ifdef DEBUG
     PhAcquireQueuedLockExclusive(&PhDbgProviderListLock);
     if ((index = PhFindItemList(PhDbgProviderList, ProviderThread)) != -1)
         PhRemoveItemList(PhDbgProviderList, index);
     PhReleaseQueuedLockExclusive(&PhDbgProviderListLock);
-#endif
+}
+
+/**
+ * Sets the timer of a provider thread according to its current mode.
+ *
+ * \param ProviderThread A pointer to a provider thread object.
+ * \param Immediate TRUE to signal the timer as soon as possible, FALSE
+ * to signal it after one interval.
+ */
+VOID PhpSetTimerProviderThread(
+    _In_ PPH_PROVIDER_THREAD ProviderThread,
+    _In_ BOOLEAN Immediate
+    )
+{
+    LARGE_INTEGER dueTime;
+    ULONG interval;
+
+    if (!ProviderThread->TimerHandle)
+        return;
+
+    interval = ProviderThread->BackgroundInterval != 0 ? ProviderThread->BackgroundInterval : ProviderThread->Interval;
+
+    if (Immediate)
+        dueTime.QuadPart = -1;
+    else
+        dueTime.QuadPart = -(LONGLONG)interval * PH_TIMEOUT_MS;
+
+    if (ProviderThread->BackgroundInterval != 0 && WindowsVersion >= WINDOWS_7)
+    {
+        _NtSetTimerEx NtSetTimerEx_I;
+        PH_COALESCABLE_TIMER_INFO timerInfo;
+
+        if (NtSetTimerEx_I = NtSetTimerEx_Import())
+        {
+            memset(&timerInfo, 0, sizeof(PH_COALESCABLE_TIMER_INFO));
+            timerInfo.DueTime = dueTime;
+            timerInfo.Period = interval;
+            // Nobody is watching, so it doesn't matter if we are a bit late.
+            timerInfo.TolerableDelay = interval / 4;
+
+            if (NT_SUCCESS(NtSetTimerEx_I(
+                ProviderThread->TimerHandle,
+                TimerSetCoalescableTimer,
+                &timerInfo,
+                sizeof(PH_COALESCABLE_TIMER_INFO)
+                )))
+                return;
+        }
+    }
+
+    NtSetTimer(ProviderThread->TimerHandle, &dueTime, NULL, NULL, FALSE, interval, NULL);
+}
+
+/**
+ * Determines whether a provider should run on the current timer tick.
+ *
+ * \param ProviderThread The provider thread.
+ * \param Registration The provider.
+ * \param TickCount The tick count of the current timer tick.
+ */
+BOOLEAN PhpIsProviderDue(
+    _In_ PPH_PROVIDER_THREAD ProviderThread,
+    _In_ PPH_PROVIDER_REGISTRATION Registration,
+    _In_ ULONG64 TickCount
+    )
+{
+    ULONG interval;
+
+    interval = Registration->EffectiveInterval != 0 ? Registration->EffectiveInterval : Registration->Interval;
+
+    if (interval == 0 || Registration->LastRunTickCount == 0)
+        return TRUE;
+
+    // Allow for timer jitter by running the provider if it would otherwise be late by more than
+    // half a tick.
+    return TickCount - Registration->LastRunTickCount + ProviderThread->Interval / 2 >= interval;
+}
+
+/**
+ * Records the time a provider took to run, and adjusts its interval if
+ * necessary.
+ *
+ * \param ProviderThread The provider thread.
+ * \param Registration The provider.
+ * \param RunTime The run time, in microseconds.
+ */
+VOID PhpUpdateProviderRunTime(
+    _In_ PPH_PROVIDER_THREAD ProviderThread,
+    _Inout_ PPH_PROVIDER_REGISTRATION Registration,
+    _In_ ULONG RunTime
+    )
+{
+    ULONG bucket;
+    ULONG interval;
+
+    if (!_BitScanReverse(&bucket, RunTime / 1000))
+        bucket = 0;
+    else
+        bucket++;
+
+    if (bucket >= PH_PROVIDER_RUN_TIME_BUCKETS)
+        bucket = PH_PROVIDER_RUN_TIME_BUCKETS - 1;
+
+    Registration->RunTimeHistogram[bucket]++;
+    Registration->LastRunTime = RunTime;
+
+    // Exponential moving average with a weight of 1/8.
+    if (Registration->AverageRunTime == 0)
+        Registration->AverageRunTime = RunTime;
+    else
+        Registration->AverageRunTime = Registration->AverageRunTime - Registration->AverageRunTime / 8 + RunTime / 8;
+
+    interval = Registration->Interval != 0 ? Registration->Interval : ProviderThread->Interval;
+
+    if (Registration->AverageRunTime / 1000 > interval / 2)
+        Registration->EffectiveInterval = Registration->AverageRunTime / 1000 * 2;
+    else
+        Registration->EffectiveInterval = 0;
+}
+
+/**
+ * Records how late a provider is in starting its run.
+ *
+ * \param ProviderThread The provider thread.
+ * \param Registration The provider, before its last run tick count is updated.
+ *
+ * \remarks The lag includes timer delays, skipped ticks and the time spent
+ * waiting for the providers before it in the same pass.
+ */
+VOID PhpUpdateProviderLag(
+    _In_ PPH_PROVIDER_THREAD ProviderThread,
+    _Inout_ PPH_PROVIDER_REGISTRATION Registration
+    )
+{
+    ULONG threadInterval;
+    ULONG interval;
+    ULONG64 dueTickCount;
+    ULONG64 tickCount;
+
+    if (Registration->LastRunTickCount == 0)
+        return;
+
+    threadInterval = ProviderThread->BackgroundInterval != 0 ? ProviderThread->BackgroundInterval : ProviderThread->Interval;
+    interval = Registration->EffectiveInterval != 0 ? Registration->EffectiveInterval : Registration->Interval;
+
+    // A provider whose interval is shorter than that of its thread runs on every tick.
+    if (interval < threadInterval)
+        interval = threadInterval;
+
+    dueTickCount = Registration->LastRunTickCount + interval;
+    tickCount = NtGetTickCount64();
+
+    Registration->Lag = tickCount > dueTickCount ? (ULONG)(tickCount - dueTickCount) : 0;
 }
 
 NTSTATUS NTAPI PhpProviderThreadStart(
@@ -112,6 +288,12 @@ NTSTATUS NTAPI PhpProviderThreadStart(
     PPH_PROVIDER_FUNCTION providerFunction;
     PVOID object;
     LIST_ENTRY tempListHead;
+    ULONG64 tickCount;
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER startCounter;
+    LARGE_INTEGER endCounter;
+
+    NtQueryPerformanceCounter(&startCounter, &frequency);
 
     while (providerThread->State != ProviderThreadStopping)
     {
@@ -127,6 +309,7 @@ NTSTATUS NTAPI PhpProviderThreadStart(
         // must be in a list (main list or the temp list).
 
         InitializeListHead(&tempListHead);
+        tickCount = NtGetTickCount64();
 
         PhAcquireQueuedLockExclusive(&providerThread->Lock);
 
@@ -166,6 +349,10 @@ NTSTATUS NTAPI PhpProviderThreadStart(
             {
                 if (!registration->Enabled || registration->Unregistering)
                     continue;
+                if (providerThread->BackgroundInterval != 0 && !registration->Background)
+                    continue;
+                if (!PhpIsProviderDue(providerThread, registration, tickCount))
+                    continue;
             }
             else
             {
@@ -198,12 +385,42 @@ NTSTATUS NTAPI PhpProviderThreadStart(
 
             registration->RunId++;
 
+            if (status != STATUS_ALERTED)
+                PhpUpdateProviderLag(providerThread, registration);
+
+            registration->LastRunTickCount = tickCount;
+
             PhReleaseQueuedLockExclusive(&providerThread->Lock);
+
+            if (PhTraceEnabled(PH_TRACE_KEYWORD_PROVIDER))
+                PhTraceProviderRunStart(providerFunction);
+
+            NtQueryPerformanceCounter(&startCounter, NULL);
             providerFunction(object);
+            NtQueryPerformanceCounter(&endCounter, NULL);
+
+            if (PhTraceEnabled(PH_TRACE_KEYWORD_PROVIDER))
+                PhTraceProviderRunStop(providerFunction);
+
             PhAcquireQueuedLockExclusive(&providerThread->Lock);
 
             if (object)
                 PhDereferenceObject(object);
+
+            // The provider may have been unregistered (and the registration freed) while we were
+            // running it. It is still valid if and only if it is still in the temp list.
+            for (listEntry = tempListHead.Flink; listEntry != &tempListHead; listEntry = listEntry->Flink)
+            {
+                if (listEntry == &registration->ListEntry)
+                {
+                    PhpUpdateProviderRunTime(
+                        providerThread,
+                        registration,
+                        (ULONG)((endCounter.QuadPart - startCounter.QuadPart) * 1000000 / frequency.QuadPart)
+                        );
+                    break;
+                }
+            }
         }
 
         // Re-add the items in the temp list to the main list.
@@ -250,7 +467,7 @@ VOID PhStartProviderThread(
 
     // Create and set the timer.
     NtCreateTimer(&ProviderThread->TimerHandle, TIMER_ALL_ACCESS, NULL, SynchronizationTimer);
-    PhSetIntervalProviderThread(ProviderThread, ProviderThread->Interval);
+    PhpSetTimerProviderThread(ProviderThread, FALSE);
 
     // Create and start the thread.
     ProviderThread->ThreadHandle = PhCreateThread(
@@ -302,13 +519,34 @@ VOID PhSetIntervalProviderThread(
 {
     ProviderThread->Interval = Interval;
 
-    if (ProviderThread->TimerHandle)
-    {
-        LARGE_INTEGER interval;
+    if (ProviderThread->BackgroundInterval == 0)
+        PhpSetTimerProviderThread(ProviderThread, FALSE);
+}
 
-        interval.QuadPart = -(LONGLONG)Interval * PH_TIMEOUT_MS;
-        NtSetTimer(ProviderThread->TimerHandle, &interval, NULL, NULL, FALSE, Interval, NULL);
-    }
+/**
+ * Enters or leaves background mode for a provider thread.
+ *
+ * \param ProviderThread A pointer to a provider thread object.
+ * \param BackgroundInterval The interval between each run in background
+ * mode, in milliseconds, or 0 to leave background mode.
+ *
+ * \remarks In background mode, only providers for which
+ * PhSetBackgroundProvider() has been called are run. When leaving
+ * background mode, all enabled providers are run immediately.
+ */
+VOID PhSetBackgroundModeProviderThread(
+    _Inout_ PPH_PROVIDER_THREAD ProviderThread,
+    _In_ ULONG BackgroundInterval
+    )
+{
+    BOOLEAN leaving;
+
+    if (ProviderThread->BackgroundInterval == BackgroundInterval)
+        return;
+
+    leaving = BackgroundInterval == 0;
+    ProviderThread->BackgroundInterval = BackgroundInterval;
+    PhpSetTimerProviderThread(ProviderThread, leaving);
 }
 
 /**
@@ -339,6 +577,14 @@ VOID PhRegisterProvider(
     Registration->Enabled = FALSE;
     Registration->Unregistering = FALSE;
     Registration->Boosting = FALSE;
+    Registration->Background = FALSE;
+    Registration->Interval = 0;
+    Registration->EffectiveInterval = 0;
+    Registration->LastRunTickCount = 0;
+    Registration->AverageRunTime = 0;
+    Registration->LastRunTime = 0;
+    Registration->Lag = 0;
+    memset(Registration->RunTimeHistogram, 0, sizeof(Registration->RunTimeHistogram));
 
     if (Object)
         PhReferenceObject(Object);
@@ -493,3 +739,37 @@ VOID PhSetEnabledProvider(
 {
     Registration->Enabled = Enabled;
 }
+
+/**
+ * Sets whether a provider runs when its provider thread is in
+ * background mode.
+ *
+ * \param Registration A pointer to the registration object for
+ * a provider.
+ * \param Background TRUE if the provider has consumers which need
+ * it while in background mode, otherwise FALSE.
+ */
+VOID PhSetBackgroundProvider(
+    _Inout_ PPH_PROVIDER_REGISTRATION Registration,
+    _In_ BOOLEAN Background
+    )
+{
+    Registration->Background = Background;
+}
+
+/**
+ * Sets the run interval for a provider.
+ *
+ * \param Registration A pointer to the registration object for
+ * a provider.
+ * \param Interval The interval between each run, in milliseconds,
+ * or 0 to use the interval of the provider thread. This should be
+ * a multiple of the interval of the provider thread.
+ */
+VOID PhSetIntervalProvider(
+    _Inout_ PPH_PROVIDER_REGISTRATION Registration,
+    _In_ ULONG Interval
+    )
+{
+    Registration->Interval = Interval;
+}
@@ -356,8 +356,12 @@ _May_raise_ FORCEINLINE VOID PhpUnblockQueuedWaitBlock(
 {
     NTSTATUS status;
 
+    PHLIB_INC_STATISTIC(QlWaitersWoken);
+
     if (!_interlockedbittestandreset((PLONG)&WaitBlock->Flags, PH_QUEUED_WAITER_SPINNING_SHIFT))
     {
+        PHLIB_INC_STATISTIC(QlKeyedEventReleases);
+
         if (!NT_SUCCESS(status = NtReleaseKeyedEvent(
             PhQueuedLockKeyedEventHandle,
             WaitBlock,
@@ -407,6 +411,8 @@ FORCEINLINE VOID PhpOptimizeQueuedLockListEx(
 
         // Perform the optimization.
 
+        PHLIB_INC_STATISTIC(QlOptimizations);
+
         waitBlock = PhGetQueuedLockWaitBlock(value);
         firstWaitBlock = waitBlock;
 
@@ -493,6 +499,8 @@ FORCEINLINE PPH_QUEUED_WAIT_BLOCK PhpPrepareToWakeQueuedLock(
     PPH_QUEUED_WAIT_BLOCK lastWaitBlock;
     PPH_QUEUED_WAIT_BLOCK previousWaitBlock;
 
+    PHLIB_INC_STATISTIC(QlWakes);
+
     value = Value;
 
     while (TRUE)
@@ -517,7 +525,10 @@ FORCEINLINE PPH_QUEUED_WAIT_BLOCK PhpPrepareToWakeQueuedLock(
                 (PVOID)newValue,
                 (PVOID)value
                 )) == value)
+            {
+                PHLIB_INC_STATISTIC(QlWakesDeferred);
                 return NULL;
+            }
 
             value = newValue;
         }
@@ -684,7 +695,9 @@ VOID FASTCALL PhfAcquireQueuedLockExclusive(
     ULONG_PTR currentValue;
     BOOLEAN optimize;
     PH_QUEUED_WAIT_BLOCK waitBlock;
+    ULONG64 waitStartTime;
 
+    waitStartTime = PhBeginLockWait();
     value = QueuedLock->Value;
 
     while (TRUE)
@@ -720,6 +733,8 @@ VOID FASTCALL PhfAcquireQueuedLockExclusive(
 
         value = newValue;
     }
+
+    PhRecordLockAcquire(QueuedLock, TRUE, waitStartTime);
 }
 
 /**
@@ -736,7 +751,9 @@ VOID FASTCALL PhfAcquireQueuedLockShared(
     ULONG_PTR currentValue;
     BOOLEAN optimize;
     PH_QUEUED_WAIT_BLOCK waitBlock;
+    ULONG64 waitStartTime;
 
+    waitStartTime = PhBeginLockWait();
     value = QueuedLock->Value;
 
     while (TRUE)
@@ -782,6 +799,8 @@ VOID FASTCALL PhfAcquireQueuedLockShared(
 
         value = newValue;
     }
+
+    PhRecordLockAcquire(QueuedLock, FALSE, waitStartTime);
 }
 
 /**
@@ -797,6 +816,8 @@ VOID FASTCALL PhfReleaseQueuedLockExclusive(
     ULONG_PTR newValue;
     ULONG_PTR currentValue;
 
+    PhRecordLockRelease(QueuedLock);
+
     value = QueuedLock->Value;
 
     while (TRUE)
@@ -34,6 +34,12 @@ ULONG PhObjectTypeCount = 0;
 PPH_OBJECT_TYPE PhObjectTypeTable[PH_OBJECT_TYPE_TABLE_SIZE];
 
 static ULONG PhpAutoPoolTlsIndex;
+static LONG PhpAutoPoolArenaCount = 0;
+
+static ULONG PhpObjectSiteSamplingInterval = 0;
+static LONG PhpObjectSiteSamplingCounter = 0;
+static PH_QUEUED_LOCK PhpObjectSiteLock = PH_QUEUED_LOCK_INIT;
+static PPH_HASHTABLE PhpObjectSiteHashtable = NULL;
 
 #ifdef DEBUG
 LIST_ENTRY PhDbgObjectListHead;
@@ -107,6 +113,36 @@ _May_raise_ PVOID PhCreateObject(
 
     // Object type statistics.
     _InterlockedIncrement((PLONG)&ObjectType->NumberOfObjects);
+    _InterlockedIncrement((PLONG)&ObjectType->NumberOfAllocations);
+#ifdef _WIN64
+    {
+        SIZE_T numberOfBytes;
+        SIZE_T peakNumberOfBytes;
+        SIZE_T oldPeakNumberOfBytes;
+
+        objectHeader->Size = (ULONG)min(ObjectSize, MAXULONG);
+        numberOfBytes = _InterlockedExchangeAdd64((PLONG64)&ObjectType->NumberOfBytes, objectHeader->Size) + objectHeader->Size;
+        peakNumberOfBytes = ObjectType->PeakNumberOfBytes;
+
+        // The peak only changes while a type is growing, so this loop almost never runs.
+        while (numberOfBytes > peakNumberOfBytes)
+        {
+            oldPeakNumberOfBytes = _InterlockedCompareExchange64(
+                (PLONG64)&ObjectType->PeakNumberOfBytes,
+                numberOfBytes,
+                peakNumberOfBytes
+                );
+
+            if (oldPeakNumberOfBytes == peakNumberOfBytes)
+                break;
+
+            peakNumberOfBytes = oldPeakNumberOfBytes;
+        }
+    }
+#endif
+
+    if (PhpObjectSiteSamplingInterval != 0)
+        PhpSampleObjectAllocation(ObjectType, ObjectSize);
 
     // Initialize the object header.
     objectHeader->RefCount = 1;
@@ -226,6 +262,22 @@ BOOLEAN PhReferenceObjectSafe(
     return result;
 }
 
+/**
+ * Gets the current reference count of an object.
+ *
+ * \param Object A pointer to an object.
+ *
+ * \remarks The result is only meaningful if the caller
+ * knows that no other references can be obtained
+ * concurrently.
+ */
+LONG PhGetObjectRefCount(
+    _In_ PVOID Object
+    )
+{
+    return PhObjectToObjectHeader(Object)->RefCount;
+}
+
 /**
  * Dereferences the specified object.
  * The object will be freed if its reference count reaches 0.
@@ -401,8 +453,12 @@ PPH_OBJECT_TYPE PhCreateObjectTypeEx(
     objectType->Flags = (USHORT)Flags;
     objectType->TypeIndex = (USHORT)_InterlockedIncrement(&PhObjectTypeCount) - 1;
     objectType->NumberOfObjects = 0;
+    objectType->NumberOfBytes = 0;
+    objectType->PeakNumberOfBytes = 0;
+    objectType->NumberOfAllocations = 0;
     objectType->DeleteProcedure = DeleteProcedure;
     objectType->Name = Name;
+    objectType->FreeListIdle = FALSE;
 
     if (objectType->TypeIndex < PH_OBJECT_TYPE_TABLE_SIZE)
         PhObjectTypeTable[objectType->TypeIndex] = objectType;
@@ -413,9 +469,11 @@ PPH_OBJECT_TYPE PhCreateObjectTypeEx(
     {
         if (Flags & PH_OBJECT_TYPE_USE_FREE_LIST)
         {
+            // A size of 0 means that the free list size is taken from the first object
+            // allocated (see PhpAllocateObject).
             PhInitializeFreeList(
                 &objectType->FreeList,
-                PhAddObjectHeaderSize(Parameters->FreeListSize),
+                Parameters->FreeListSize != 0 ? PhAddObjectHeaderSize(Parameters->FreeListSize) : 0,
                 Parameters->FreeListCount
                 );
         }
@@ -424,6 +482,37 @@ PPH_OBJECT_TYPE PhCreateObjectTypeEx(
     return objectType;
 }
 
+/**
+ * Frees cached objects of types that have not been used recently.
+ *
+ * \remarks The free list of an object type is emptied if no objects were
+ * allocated from it since the last call to this function. This function
+ * should be called periodically.
+ */
+VOID PhTrimObjectTypeFreeLists(
+    VOID
+    )
+{
+    ULONG numberOfTypes;
+    ULONG i;
+    PPH_OBJECT_TYPE objectType;
+
+    numberOfTypes = min(PhObjectTypeCount, PH_OBJECT_TYPE_TABLE_SIZE);
+
+    for (i = 0; i < numberOfTypes; i++)
+    {
+        objectType = PhObjectTypeTable[i];
+
+        if (!objectType || !(objectType->Flags & PH_OBJECT_TYPE_USE_FREE_LIST))
+            continue;
+
+        if (objectType->FreeListIdle)
+            PhTrimFreeList(&objectType->FreeList, 0);
+        else
+            objectType->FreeListIdle = TRUE;
+    }
+}
+
 /**
  * Gets information about an object type.
  *
@@ -439,6 +528,237 @@ VOID PhGetObjectTypeInformation(
     Information->NumberOfObjects = ObjectType->NumberOfObjects;
     Information->Flags = ObjectType->Flags;
     Information->TypeIndex = ObjectType->TypeIndex;
+    Information->Reserved = 0;
+    Information->NumberOfBytes = ObjectType->NumberOfBytes;
+    Information->PeakNumberOfBytes = ObjectType->PeakNumberOfBytes;
+    Information->NumberOfAllocations = ObjectType->NumberOfAllocations;
+}
+
+/**
+ * Enumerates all object types.
+ *
+ * \param Callback A function which receives information about each object
+ * type. The function returns TRUE to continue the enumeration.
+ * \param Context A user-defined value to pass to the callback function.
+ *
+ * \remarks The counts are read without synchronization and may be slightly
+ * out of date, which makes this function cheap enough for periodic sampling.
+ */
+VOID PhEnumObjectTypeInformation(
+    _In_ PPH_ENUM_OBJECT_TYPE_CALLBACK Callback,
+    _In_opt_ PVOID Context
+    )
+{
+    ULONG numberOfTypes;
+    ULONG i;
+    PH_OBJECT_TYPE_INFORMATION information;
+
+    numberOfTypes = min(PhObjectTypeCount, PH_OBJECT_TYPE_TABLE_SIZE);
+
+    for (i = 0; i < numberOfTypes; i++)
+    {
+        if (!PhObjectTypeTable[i])
+            continue;
+
+        PhGetObjectTypeInformation(PhObjectTypeTable[i], &information);
+
+        if (!Callback(&information, Context))
+            break;
+    }
+}
+
+static BOOLEAN NTAPI PhpObjectSiteCompareFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    )
+{
+    PPH_OBJECT_ALLOCATION_SITE site1 = Entry1;
+    PPH_OBJECT_ALLOCATION_SITE site2 = Entry2;
+
+    return
+        site1->Hash == site2->Hash &&
+        site1->TypeIndex == site2->TypeIndex &&
+        site1->NumberOfFrames == site2->NumberOfFrames &&
+        memcmp(site1->Frames, site2->Frames, site1->NumberOfFrames * sizeof(PVOID)) == 0;
+}
+
+static ULONG NTAPI PhpObjectSiteHashFunction(
+    _In_ PVOID Entry
+    )
+{
+    PPH_OBJECT_ALLOCATION_SITE site = Entry;
+
+    return site->Hash ^ site->TypeIndex;
+}
+
+/**
+ * Records the call stack of a sampled object allocation.
+ *
+ * \param ObjectType The type of the object.
+ * \param ObjectSize The size of the object.
+ *
+ * \remarks This function must not create any objects, since it is called
+ * by PhCreateObject.
+ */
+DECLSPEC_NOINLINE VOID PhpSampleObjectAllocation(
+    _In_ PPH_OBJECT_TYPE ObjectType,
+    _In_ SIZE_T ObjectSize
+    )
+{
+    ULONG interval;
+    PH_OBJECT_ALLOCATION_SITE site;
+    PPH_OBJECT_ALLOCATION_SITE entry;
+
+    interval = PhpObjectSiteSamplingInterval;
+
+    if (interval == 0 || (ULONG)_InterlockedIncrement(&PhpObjectSiteSamplingCounter) % interval != 0)
+        return;
+
+    // Skip this function and PhCreateObject.
+    site.NumberOfFrames = RtlCaptureStackBackTrace(2, PH_OBJECT_ALLOCATION_SITE_FRAMES, site.Frames, &site.Hash);
+    memset(
+        &site.Frames[site.NumberOfFrames],
+        0,
+        sizeof(site.Frames) - site.NumberOfFrames * sizeof(PVOID)
+        );
+    site.TypeIndex = ObjectType->TypeIndex;
+
+    PhAcquireQueuedLockExclusive(&PhpObjectSiteLock);
+
+    if (PhpObjectSiteHashtable)
+    {
+        entry = PhFindEntryHashtable(PhpObjectSiteHashtable, &site);
+
+        if (!entry && PhpObjectSiteHashtable->Count < PH_OBJECT_ALLOCATION_SITE_LIMIT)
+        {
+            site.NumberOfSamples = 0;
+            site.NumberOfBytes = 0;
+            entry = PhAddEntryHashtableEx(PhpObjectSiteHashtable, &site, NULL);
+        }
+
+        if (entry)
+        {
+            entry->NumberOfSamples++;
+            entry->NumberOfBytes += ObjectSize;
+        }
+    }
+
+    PhReleaseQueuedLockExclusive(&PhpObjectSiteLock);
+}
+
+/**
+ * Enables or disables allocation site sampling.
+ *
+ * \param Interval The call stack of every \a Interval-th object allocation is
+ * recorded. Specify 0 to disable sampling.
+ *
+ * \remarks Sites that have already been recorded are kept when sampling is
+ * disabled. Use PhResetObjectAllocationSites() to discard them. When sampling
+ * is disabled, PhCreateObject only pays for a single comparison.
+ */
+VOID PhSetObjectAllocationSampling(
+    _In_ ULONG Interval
+    )
+{
+    if (Interval != 0 && !PhpObjectSiteHashtable)
+    {
+        PPH_HASHTABLE hashtable;
+
+        // Create the hashtable before we enable sampling, since hashtables are
+        // objects themselves.
+        hashtable = PhCreateHashtable(
+            sizeof(PH_OBJECT_ALLOCATION_SITE),
+            PhpObjectSiteCompareFunction,
+            PhpObjectSiteHashFunction,
+            64
+            );
+
+        if (_InterlockedCompareExchangePointer(&PhpObjectSiteHashtable, hashtable, NULL) != NULL)
+            PhDereferenceObject(hashtable);
+    }
+
+    PhpObjectSiteSamplingInterval = Interval;
+}
+
+/**
+ * Gets the current allocation site sampling interval, or 0 if sampling is
+ * disabled.
+ */
+ULONG PhGetObjectAllocationSampling(
+    VOID
+    )
+{
+    return PhpObjectSiteSamplingInterval;
+}
+
+/**
+ * Discards all recorded allocation sites.
+ */
+VOID PhResetObjectAllocationSites(
+    VOID
+    )
+{
+    PhAcquireQueuedLockExclusive(&PhpObjectSiteLock);
+
+    if (PhpObjectSiteHashtable)
+        PhClearHashtable(PhpObjectSiteHashtable);
+
+    PhReleaseQueuedLockExclusive(&PhpObjectSiteLock);
+}
+
+/**
+ * Enumerates the recorded allocation sites.
+ *
+ * \param Callback A function which receives information about each site. The
+ * function returns TRUE to continue the enumeration.
+ * \param Context A user-defined value to pass to the callback function.
+ *
+ * \remarks The sites are copied before the callback is invoked, so the
+ * callback may create objects.
+ */
+VOID PhEnumObjectAllocationSites(
+    _In_ PPH_ENUM_OBJECT_ALLOCATION_SITE_CALLBACK Callback,
+    _In_opt_ PVOID Context
+    )
+{
+    PPH_OBJECT_ALLOCATION_SITE sites = NULL;
+    ULONG numberOfSites = 0;
+    PPH_OBJECT_ALLOCATION_SITE site;
+    ULONG enumerationKey;
+    ULONG i;
+    PH_OBJECT_ALLOCATION_SITE_INFORMATION information;
+
+    PhAcquireQueuedLockExclusive(&PhpObjectSiteLock);
+
+    if (PhpObjectSiteHashtable && PhpObjectSiteHashtable->Count != 0)
+    {
+        sites = PhAllocate(PhpObjectSiteHashtable->Count * sizeof(PH_OBJECT_ALLOCATION_SITE));
+        enumerationKey = 0;
+
+        while (PhEnumHashtable(PhpObjectSiteHashtable, (PVOID *)&site, &enumerationKey))
+            sites[numberOfSites++] = *site;
+    }
+
+    PhReleaseQueuedLockExclusive(&PhpObjectSiteLock);
+
+    for (i = 0; i < numberOfSites; i++)
+    {
+        site = &sites[i];
+
+        information.TypeName = PhObjectTypeTable[site->TypeIndex]->Name;
+        information.TypeIndex = site->TypeIndex;
+        information.Reserved = 0;
+        information.NumberOfFrames = site->NumberOfFrames;
+        memcpy(information.Frames, site->Frames, sizeof(information.Frames));
+        information.NumberOfSamples = site->NumberOfSamples;
+        information.NumberOfBytes = site->NumberOfBytes;
+
+        if (!Callback(&information, Context))
+            break;
+    }
+
+    if (sites)
+        PhFree(sites);
 }
 
 /**
@@ -447,6 +767,59 @@ VOID PhGetObjectTypeInformation(
  * \param ObjectType The type of the object.
  * \param ObjectSize The size of the object, excluding the header.
  */
+FORCEINLINE PPH_AUTO_POOL PhpGetCurrentAutoPool(
+    VOID
+    );
+
+static VOID PhpDereferenceAutoPoolArena(
+    _In_ PPH_AUTO_POOL_ARENA Arena
+    )
+{
+    if (_InterlockedDecrement(&Arena->RefCount) == 0)
+        PhFree(Arena);
+}
+
+/**
+ * Allocates storage for an object from the arena of an auto-dereference pool.
+ */
+static PPH_OBJECT_HEADER PhpAllocateObjectFromArena(
+    _Inout_ PPH_AUTO_POOL AutoPool,
+    _In_ SIZE_T ObjectSize
+    )
+{
+    PPH_AUTO_POOL_ARENA arena;
+    SIZE_T size;
+    PVOID block;
+    PPH_OBJECT_HEADER objectHeader;
+
+    size = ALIGN_UP_BY(PH_AUTO_POOL_ARENA_OBJECT_PREFIX_SIZE + PhAddObjectHeaderSize(ObjectSize), MEMORY_ALLOCATION_ALIGNMENT);
+    arena = AutoPool->Arena;
+
+    if (!arena || arena->Offset + size > PH_AUTO_POOL_ARENA_SIZE)
+    {
+        // Retire the current arena. It is freed when its last object is freed.
+        if (arena)
+            PhpDereferenceAutoPoolArena(arena);
+
+        arena = PhAllocate(PH_AUTO_POOL_ARENA_SIZE);
+        arena->RefCount = 1;
+        arena->Offset = PH_AUTO_POOL_ARENA_DATA_OFFSET;
+        AutoPool->Arena = arena;
+        REF_STAT_UP(RefAutoPoolArenasAllocated);
+    }
+
+    block = PTR_ADD_OFFSET(arena, arena->Offset);
+    arena->Offset += (ULONG)size;
+    _InterlockedIncrement(&arena->RefCount);
+
+    *(PPH_AUTO_POOL_ARENA *)block = arena;
+    objectHeader = PTR_ADD_OFFSET(block, PH_AUTO_POOL_ARENA_OBJECT_PREFIX_SIZE);
+    objectHeader->Flags = PH_OBJECT_FROM_ARENA;
+    REF_STAT_UP(RefObjectsAllocatedFromArena);
+
+    return objectHeader;
+}
+
 PPH_OBJECT_HEADER PhpAllocateObject(
     _In_ PPH_OBJECT_TYPE ObjectType,
     _In_ SIZE_T ObjectSize
@@ -454,15 +827,42 @@ PPH_OBJECT_HEADER PhpAllocateObject(
 {
     PPH_OBJECT_HEADER objectHeader;
 
+    // Only look up the current pool if some thread is using an arena.
+    if (PhpAutoPoolArenaCount != 0 && ObjectSize <= PH_AUTO_POOL_ARENA_MAXIMUM_OBJECT_SIZE)
+    {
+        PPH_AUTO_POOL autoPool = PhpGetCurrentAutoPool();
+
+        if (autoPool && autoPool->ArenaDepth != 0)
+            return PhpAllocateObjectFromArena(autoPool, ObjectSize);
+    }
+
     if (ObjectType->Flags & PH_OBJECT_TYPE_USE_FREE_LIST)
     {
-        assert(ObjectType->FreeList.Size == PhAddObjectHeaderSize(ObjectSize));
+        SIZE_T size;
+
+        size = PhAddObjectHeaderSize(ObjectSize);
+
+        // Types whose object size is only known at run time (e.g. objects with plugin
+        // extensions) specify a size of 0 and use the size of the first object.
+        if (ObjectType->FreeList.Size == 0)
+            _InterlockedCompareExchangePointer((PVOID *)&ObjectType->FreeList.Size, (PVOID)size, NULL);
+
+        if (ObjectType->FreeList.Size == size)
+        {
+            if (ObjectType->FreeListIdle)
+                ObjectType->FreeListIdle = FALSE;
+
+            objectHeader = PhAllocateFromFreeList(&ObjectType->FreeList);
+            objectHeader->Flags = PH_OBJECT_FROM_TYPE_FREE_LIST;
+            REF_STAT_UP(RefObjectsAllocatedFromTypeFreeList);
+
+            return objectHeader;
+        }
 
-        objectHeader = PhAllocateFromFreeList(&ObjectType->FreeList);
-        objectHeader->Flags = PH_OBJECT_FROM_TYPE_FREE_LIST;
-        REF_STAT_UP(RefObjectsAllocatedFromTypeFreeList);
+        // Objects of a different size can't be stored in the free list.
     }
-    else if (ObjectSize <= PH_OBJECT_SMALL_OBJECT_SIZE)
+
+    if (ObjectSize <= PH_OBJECT_SMALL_OBJECT_SIZE)
     {
         objectHeader = PhAllocateFromFreeList(&PhObjectSmallFreeList);
         objectHeader->Flags = PH_OBJECT_FROM_SMALL_FREE_LIST;
@@ -494,6 +894,9 @@ VOID PhpFreeObject(
 
     // Object type statistics.
     _InterlockedDecrement(&objectType->NumberOfObjects);
+#ifdef _WIN64
+    _InterlockedExchangeAdd64((PLONG64)&objectType->NumberOfBytes, -(LONG64)ObjectHeader->Size);
+#endif
 
 #ifdef DEBUG
     PhAcquireQueuedLockExclusive(&PhDbgObjectListLock);
@@ -519,6 +922,11 @@ VOID PhpFreeObject(
         PhFreeToFreeList(&PhObjectSmallFreeList, ObjectHeader);
         REF_STAT_UP(RefObjectsFreedToSmallFreeList);
     }
+    else if (ObjectHeader->Flags & PH_OBJECT_FROM_ARENA)
+    {
+        // The storage is reclaimed along with the rest of the arena.
+        PhpDereferenceAutoPoolArena(*(PPH_AUTO_POOL_ARENA *)PTR_SUB_OFFSET(ObjectHeader, PH_AUTO_POOL_ARENA_OBJECT_PREFIX_SIZE));
+    }
     else
     {
         PhFree(ObjectHeader);
@@ -632,12 +1040,44 @@ _May_raise_ FORCEINLINE VOID PhpSetCurrentAutoPool(
 VOID PhInitializeAutoPool(
     _Out_ PPH_AUTO_POOL AutoPool
     )
+{
+    PhInitializeAutoPoolEx(AutoPool, 0);
+}
+
+/**
+ * Initializes an auto-dereference pool and sets it as the current pool
+ * for the current thread. You must call PhDeleteAutoPool() before storage
+ * for the auto-dereference pool is freed.
+ *
+ * \param AutoPool The auto-dereference pool to initialize.
+ * \param Flags A combination of flags.
+ * \li \c PH_AUTO_POOL_USE_ARENA Small objects created between calls to
+ * PhBeginAutoPoolArena() and PhEndAutoPoolArena() (such as those created by
+ * PhaFormatString()) are allocated from a block of memory owned by the pool
+ * instead of the heap. The block is reused when the pool is drained. A block
+ * which still contains live objects at that time is kept until those objects
+ * are freed.
+ *
+ * \remarks Always store auto-dereference pools in local variables, and do
+ * not share the pool with any other functions.
+ */
+VOID PhInitializeAutoPoolEx(
+    _Out_ PPH_AUTO_POOL AutoPool,
+    _In_ ULONG Flags
+    )
 {
     AutoPool->StaticCount = 0;
     AutoPool->DynamicCount = 0;
     AutoPool->DynamicAllocated = 0;
     AutoPool->DynamicObjects = NULL;
 
+    AutoPool->Flags = Flags;
+    AutoPool->ArenaDepth = 0;
+    AutoPool->Arena = NULL;
+
+    if (Flags & PH_AUTO_POOL_USE_ARENA)
+        _InterlockedIncrement(&PhpAutoPoolArenaCount);
+
     // Add the pool to the stack.
     AutoPool->NextPool = PhpGetCurrentAutoPool();
     PhpSetCurrentAutoPool(AutoPool);
@@ -669,6 +1109,14 @@ _May_raise_ VOID PhDeleteAutoPool(
     if (AutoPool->DynamicObjects)
         PhFree(AutoPool->DynamicObjects);
 
+    if (AutoPool->Flags & PH_AUTO_POOL_USE_ARENA)
+    {
+        if (AutoPool->Arena)
+            PhpDereferenceAutoPoolArena(AutoPool->Arena);
+
+        _InterlockedDecrement(&PhpAutoPoolArenaCount);
+    }
+
     REF_STAT_UP(RefAutoPoolsDestroyed);
 }
 
@@ -704,6 +1152,23 @@ VOID PhDrainAutoPool(
             AutoPool->DynamicObjects = NULL;
         }
     }
+
+    if (AutoPool->Arena)
+    {
+        // If every object in the arena has been freed, we can start again from the beginning.
+        // Only we can create objects in the arena, so the reference count can't go up again.
+        if (AutoPool->Arena->RefCount == 1)
+        {
+            AutoPool->Arena->Offset = PH_AUTO_POOL_ARENA_DATA_OFFSET;
+        }
+        else
+        {
+            // Some objects are still referenced elsewhere. Leave the arena to them.
+            PhpDereferenceAutoPoolArena(AutoPool->Arena);
+            AutoPool->Arena = NULL;
+            REF_STAT_UP(RefAutoPoolArenasEscaped);
+        }
+    }
 }
 
 /**
@@ -765,6 +1230,41 @@ _May_raise_ PVOID PhAutoDereferenceObject(
     return Object;
 }
 
+/**
+ * Starts allocating small objects from the arena of the current
+ * auto-dereference pool, if the pool has one. Calls may be nested.
+ *
+ * \remarks Only use this for objects which are added to the pool. Objects
+ * that are kept after the pool is drained stay valid, but keep the memory
+ * of their arena allocated.
+ */
+VOID PhBeginAutoPoolArena(
+    VOID
+    )
+{
+    PPH_AUTO_POOL autoPool = PhpGetCurrentAutoPool();
+
+    if (autoPool && (autoPool->Flags & PH_AUTO_POOL_USE_ARENA))
+        autoPool->ArenaDepth++;
+}
+
+/**
+ * Stops allocating objects from the arena of the current auto-dereference
+ * pool.
+ */
+VOID PhEndAutoPoolArena(
+    VOID
+    )
+{
+    PPH_AUTO_POOL autoPool = PhpGetCurrentAutoPool();
+
+    if (autoPool && (autoPool->Flags & PH_AUTO_POOL_USE_ARENA))
+    {
+        assert(autoPool->ArenaDepth != 0);
+        autoPool->ArenaDepth--;
+    }
+}
+
 VOID PhaDereferenceObject(PVOID Object)
 {
     if (!Object)
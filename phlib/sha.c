@@ -19,8 +19,68 @@
 
 /* This code was modified for Process Hacker. */
 
+/* The SHA-NI kernels follow the reference code in Intel's "Intel SHA Extensions" paper,
+   and SHA-256 follows FIPS 180-4. */
+
 #include <phbase.h>
 #include <sha.h>
+#include <immintrin.h>
+
+#define PHP_SHA_FEATURE_SHANI 0x1
+#define PHP_SHA_FEATURE_AVX2 0x2
+#define PHP_SHA_FEATURE_INITIALIZED 0x80000000
+
+static ULONG PhpShaFeatures = 0;
+
+static ULONG PhpSha256K[64] =
+{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+/* Determines which accelerated kernels can be used. */
+static ULONG PhpGetShaFeatures(
+    VOID
+    )
+{
+    ULONG features;
+    INT cpuInfo[4];
+    INT leaf1Ecx;
+
+    features = PhpShaFeatures;
+
+    if (features & PHP_SHA_FEATURE_INITIALIZED)
+        return features;
+
+    features = PHP_SHA_FEATURE_INITIALIZED;
+    __cpuid(cpuInfo, 0);
+
+    if (cpuInfo[0] >= 7)
+    {
+        __cpuid(cpuInfo, 1);
+        leaf1Ecx = cpuInfo[2];
+        __cpuidex(cpuInfo, 7, 0);
+
+        // The SHA-NI kernels also need SSSE3 and SSE4.1.
+        if ((cpuInfo[1] & 0x20000000) && (leaf1Ecx & 0x200) && (leaf1Ecx & 0x80000))
+            features |= PHP_SHA_FEATURE_SHANI;
+
+        // See PhInitializeBase for the XState check.
+        if ((cpuInfo[1] & 0x20) && (USER_SHARED_DATA->XState.EnabledFeatures & XSTATE_MASK_AVX))
+            features |= PHP_SHA_FEATURE_AVX2;
+    }
+
+    // Several threads may get here at the same time, but they all compute the same value.
+    PhpShaFeatures = features;
+
+    return features;
+}
 
 /* SHA1 Helper Macros */
 
@@ -88,6 +148,200 @@ static void SHATransform(ULONG State[5], UCHAR Buffer[64])
    a = b = c = d = e = 0;
 }
 
+/* Hash 512-bit blocks using the SHA extensions. */
+static void SHATransformShaNi(ULONG State[5], UCHAR *Input, ULONG NumberOfBlocks)
+{
+    __m128i abcd, abcdSave, e0, e0Save, e1;
+    __m128i msg0, msg1, msg2, msg3;
+    __m128i mask;
+
+    mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+    abcd = _mm_shuffle_epi32(_mm_loadu_si128((__m128i *)State), 0x1b);
+    e0 = _mm_set_epi32(State[4], 0, 0, 0);
+
+    for (; NumberOfBlocks != 0; NumberOfBlocks--, Input += 64)
+    {
+        abcdSave = abcd;
+        e0Save = e0;
+
+        // Rounds 0-3
+        msg0 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *)(Input + 0)), mask);
+        e0 = _mm_add_epi32(e0, msg0);
+        e1 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+        // Rounds 4-7
+        msg1 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *)(Input + 16)), mask);
+        e1 = _mm_sha1nexte_epu32(e1, msg1);
+        e0 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+        msg0 = _mm_sha1msg1_epu32(msg0, msg1);
+
+        // Rounds 8-11
+        msg2 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *)(Input + 32)), mask);
+        e0 = _mm_sha1nexte_epu32(e0, msg2);
+        e1 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+        msg1 = _mm_sha1msg1_epu32(msg1, msg2);
+        msg0 = _mm_xor_si128(msg0, msg2);
+
+        // Rounds 12-15
+        msg3 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *)(Input + 48)), mask);
+        e1 = _mm_sha1nexte_epu32(e1, msg3);
+        e0 = abcd;
+        msg0 = _mm_sha1msg2_epu32(msg0, msg3);
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+        msg2 = _mm_sha1msg1_epu32(msg2, msg3);
+        msg1 = _mm_xor_si128(msg1, msg3);
+
+        // Rounds 16-19
+        e0 = _mm_sha1nexte_epu32(e0, msg0);
+        e1 = abcd;
+        msg1 = _mm_sha1msg2_epu32(msg1, msg0);
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+        msg3 = _mm_sha1msg1_epu32(msg3, msg0);
+        msg2 = _mm_xor_si128(msg2, msg0);
+
+        // Rounds 20-23
+        e1 = _mm_sha1nexte_epu32(e1, msg1);
+        e0 = abcd;
+        msg2 = _mm_sha1msg2_epu32(msg2, msg1);
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 1);
+        msg0 = _mm_sha1msg1_epu32(msg0, msg1);
+        msg3 = _mm_xor_si128(msg3, msg1);
+
+        // Rounds 24-27
+        e0 = _mm_sha1nexte_epu32(e0, msg2);
+        e1 = abcd;
+        msg3 = _mm_sha1msg2_epu32(msg3, msg2);
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 1);
+        msg1 = _mm_sha1msg1_epu32(msg1, msg2);
+        msg0 = _mm_xor_si128(msg0, msg2);
+
+        // Rounds 28-31
+        e1 = _mm_sha1nexte_epu32(e1, msg3);
+        e0 = abcd;
+        msg0 = _mm_sha1msg2_epu32(msg0, msg3);
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 1);
+        msg2 = _mm_sha1msg1_epu32(msg2, msg3);
+        msg1 = _mm_xor_si128(msg1, msg3);
+
+        // Rounds 32-35
+        e0 = _mm_sha1nexte_epu32(e0, msg0);
+        e1 = abcd;
+        msg1 = _mm_sha1msg2_epu32(msg1, msg0);
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 1);
+        msg3 = _mm_sha1msg1_epu32(msg3, msg0);
+        msg2 = _mm_xor_si128(msg2, msg0);
+
+        // Rounds 36-39
+        e1 = _mm_sha1nexte_epu32(e1, msg1);
+        e0 = abcd;
+        msg2 = _mm_sha1msg2_epu32(msg2, msg1);
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 1);
+        msg0 = _mm_sha1msg1_epu32(msg0, msg1);
+        msg3 = _mm_xor_si128(msg3, msg1);
+
+        // Rounds 40-43
+        e0 = _mm_sha1nexte_epu32(e0, msg2);
+        e1 = abcd;
+        msg3 = _mm_sha1msg2_epu32(msg3, msg2);
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 2);
+        msg1 = _mm_sha1msg1_epu32(msg1, msg2);
+        msg0 = _mm_xor_si128(msg0, msg2);
+
+        // Rounds 44-47
+        e1 = _mm_sha1nexte_epu32(e1, msg3);
+        e0 = abcd;
+        msg0 = _mm_sha1msg2_epu32(msg0, msg3);
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 2);
+        msg2 = _mm_sha1msg1_epu32(msg2, msg3);
+        msg1 = _mm_xor_si128(msg1, msg3);
+
+        // Rounds 48-51
+        e0 = _mm_sha1nexte_epu32(e0, msg0);
+        e1 = abcd;
+        msg1 = _mm_sha1msg2_epu32(msg1, msg0);
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 2);
+        msg3 = _mm_sha1msg1_epu32(msg3, msg0);
+        msg2 = _mm_xor_si128(msg2, msg0);
+
+        // Rounds 52-55
+        e1 = _mm_sha1nexte_epu32(e1, msg1);
+        e0 = abcd;
+        msg2 = _mm_sha1msg2_epu32(msg2, msg1);
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 2);
+        msg0 = _mm_sha1msg1_epu32(msg0, msg1);
+        msg3 = _mm_xor_si128(msg3, msg1);
+
+        // Rounds 56-59
+        e0 = _mm_sha1nexte_epu32(e0, msg2);
+        e1 = abcd;
+        msg3 = _mm_sha1msg2_epu32(msg3, msg2);
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 2);
+        msg1 = _mm_sha1msg1_epu32(msg1, msg2);
+        msg0 = _mm_xor_si128(msg0, msg2);
+
+        // Rounds 60-63
+        e1 = _mm_sha1nexte_epu32(e1, msg3);
+        e0 = abcd;
+        msg0 = _mm_sha1msg2_epu32(msg0, msg3);
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+        msg2 = _mm_sha1msg1_epu32(msg2, msg3);
+        msg1 = _mm_xor_si128(msg1, msg3);
+
+        // Rounds 64-67
+        e0 = _mm_sha1nexte_epu32(e0, msg0);
+        e1 = abcd;
+        msg1 = _mm_sha1msg2_epu32(msg1, msg0);
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 3);
+        msg3 = _mm_sha1msg1_epu32(msg3, msg0);
+        msg2 = _mm_xor_si128(msg2, msg0);
+
+        // Rounds 68-71
+        e1 = _mm_sha1nexte_epu32(e1, msg1);
+        e0 = abcd;
+        msg2 = _mm_sha1msg2_epu32(msg2, msg1);
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+        msg3 = _mm_xor_si128(msg3, msg1);
+
+        // Rounds 72-75
+        e0 = _mm_sha1nexte_epu32(e0, msg2);
+        e1 = abcd;
+        msg3 = _mm_sha1msg2_epu32(msg3, msg2);
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 3);
+
+        // Rounds 76-79
+        e1 = _mm_sha1nexte_epu32(e1, msg3);
+        e0 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+
+        e0 = _mm_sha1nexte_epu32(e0, e0Save);
+        abcd = _mm_add_epi32(abcd, abcdSave);
+    }
+
+    _mm_storeu_si128((__m128i *)State, _mm_shuffle_epi32(abcd, 0x1b));
+    State[4] = _mm_extract_epi32(e0, 3);
+}
+
+static void SHATransformBlocks(A_SHA_CTX *Context, UCHAR *Input, ULONG NumberOfBlocks)
+{
+   if (PhpGetShaFeatures() & PHP_SHA_FEATURE_SHANI)
+   {
+      SHATransformShaNi(Context->state, Input, NumberOfBlocks);
+      return;
+   }
+
+   /* SHATransform modifies the block, so the caller's data has to be copied first. */
+   for (; NumberOfBlocks != 0; NumberOfBlocks--, Input += 64)
+   {
+      if (Input != Context->buffer)
+         RtlCopyMemory(Context->buffer, Input, 64);
+
+      SHATransform(Context->state, Context->buffer);
+   }
+}
+
 VOID A_SHAInit(
     _Out_ A_SHA_CTX *Context
     )
@@ -109,6 +363,7 @@ VOID A_SHAUpdate(
     )
 {
    ULONG InputContentSize;
+   ULONG NumberOfBlocks;
 
    InputContentSize = Context->count[1] & 63;
    Context->count[1] += Length;
@@ -116,24 +371,31 @@ VOID A_SHAUpdate(
       Context->count[0]++;
    Context->count[0] += (Length >> 29);
 
-   if (InputContentSize + Length < 64)
-   {
-      RtlCopyMemory(&Context->buffer[InputContentSize], Input,
-                    Length);
-   }
-   else
+   if (InputContentSize != 0)
    {
-      while (InputContentSize + Length >= 64)
+      if (InputContentSize + Length < 64)
       {
-         RtlCopyMemory(Context->buffer + InputContentSize, Input,
-                       64 - InputContentSize);
-         Input += 64 - InputContentSize;
-         Length -= 64 - InputContentSize;
-         SHATransform(Context->state, Context->buffer);
-         InputContentSize = 0;
+         RtlCopyMemory(&Context->buffer[InputContentSize], Input, Length);
+         return;
       }
-      RtlCopyMemory(Context->buffer + InputContentSize, Input, Length);
+
+      RtlCopyMemory(&Context->buffer[InputContentSize], Input, 64 - InputContentSize);
+      Input += 64 - InputContentSize;
+      Length -= 64 - InputContentSize;
+      SHATransformBlocks(Context, Context->buffer, 1);
+   }
+
+   /* Whole blocks are hashed straight from the input. */
+   NumberOfBlocks = Length / 64;
+
+   if (NumberOfBlocks != 0)
+   {
+      SHATransformBlocks(Context, Input, NumberOfBlocks);
+      Input += NumberOfBlocks * 64;
+      Length -= NumberOfBlocks * 64;
    }
+
+   RtlCopyMemory(Context->buffer, Input, Length);
 }
 
 VOID A_SHAFinal(
@@ -170,3 +432,496 @@ VOID A_SHAFinal(
 
    A_SHAInit(Context);
 }
+
+/* SHA-256 */
+
+#define PHP_SHA256_ROR(x, n) (_rotr((x), (n)))
+#define PHP_SHA256_CH(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define PHP_SHA256_MAJ(x, y, z) (((x) & (y)) | ((z) & ((x) | (y))))
+#define PHP_SHA256_S0(x) (PHP_SHA256_ROR(x, 2) ^ PHP_SHA256_ROR(x, 13) ^ PHP_SHA256_ROR(x, 22))
+#define PHP_SHA256_S1(x) (PHP_SHA256_ROR(x, 6) ^ PHP_SHA256_ROR(x, 11) ^ PHP_SHA256_ROR(x, 25))
+#define PHP_SHA256_G0(x) (PHP_SHA256_ROR(x, 7) ^ PHP_SHA256_ROR(x, 18) ^ ((x) >> 3))
+#define PHP_SHA256_G1(x) (PHP_SHA256_ROR(x, 17) ^ PHP_SHA256_ROR(x, 19) ^ ((x) >> 10))
+
+static VOID PhpSha256Transform(
+    _Inout_ ULONG State[8],
+    _In_ PUCHAR Input,
+    _In_ ULONG NumberOfBlocks
+    )
+{
+    ULONG w[64];
+    ULONG a, b, c, d, e, f, g, h;
+    ULONG t1, t2;
+    ULONG i;
+
+    for (; NumberOfBlocks != 0; NumberOfBlocks--, Input += 64)
+    {
+        for (i = 0; i < 16; i++)
+            w[i] = _byteswap_ulong(*(PULONG)(Input + i * 4));
+
+        for (i = 16; i < 64; i++)
+            w[i] = PHP_SHA256_G1(w[i - 2]) + w[i - 7] + PHP_SHA256_G0(w[i - 15]) + w[i - 16];
+
+        a = State[0];
+        b = State[1];
+        c = State[2];
+        d = State[3];
+        e = State[4];
+        f = State[5];
+        g = State[6];
+        h = State[7];
+
+        for (i = 0; i < 64; i++)
+        {
+            t1 = h + PHP_SHA256_S1(e) + PHP_SHA256_CH(e, f, g) + PhpSha256K[i] + w[i];
+            t2 = PHP_SHA256_S0(a) + PHP_SHA256_MAJ(a, b, c);
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        State[0] += a;
+        State[1] += b;
+        State[2] += c;
+        State[3] += d;
+        State[4] += e;
+        State[5] += f;
+        State[6] += g;
+        State[7] += h;
+    }
+}
+
+static VOID PhpSha256TransformShaNi(
+    _Inout_ ULONG State[8],
+    _In_ PUCHAR Input,
+    _In_ ULONG NumberOfBlocks
+    )
+{
+    __m128i state0, state1;
+    __m128i abefSave, cdghSave;
+    __m128i msg, msg0, msg1, msg2, msg3;
+    __m128i mask;
+    __m128i temp;
+
+    mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    // The instructions work on the state as ABEF and CDGH.
+    temp = _mm_shuffle_epi32(_mm_loadu_si128((__m128i *)&State[0]), 0xb1); // CDAB
+    state1 = _mm_shuffle_epi32(_mm_loadu_si128((__m128i *)&State[4]), 0x1b); // EFGH
+    state0 = _mm_alignr_epi8(temp, state1, 8); // ABEF
+    state1 = _mm_blend_epi16(state1, temp, 0xf0); // CDGH
+
+    for (; NumberOfBlocks != 0; NumberOfBlocks--, Input += 64)
+    {
+        abefSave = state0;
+        cdghSave = state1;
+
+        // Rounds 0-3
+        msg0 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *)(Input + 0)), mask);
+        msg = _mm_add_epi32(msg0, _mm_loadu_si128((__m128i *)&PhpSha256K[0]));
+        state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+        state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0e));
+
+        // Rounds 4-7
+        msg1 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *)(Input + 16)), mask);
+        msg = _mm_add_epi32(msg1, _mm_loadu_si128((__m128i *)&PhpSha256K[4]));
+        state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+        state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0e));
+        msg0 = _mm_sha256msg1_epu32(msg0, msg1);
+
+        // Rounds 8-11
+        msg2 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *)(Input + 32)), mask);
+        msg = _mm_add_epi32(msg2, _mm_loadu_si128((__m128i *)&PhpSha256K[8]));
+        state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+        state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0e));
+        msg1 = _mm_sha256msg1_epu32(msg1, msg2);
+
+        // Rounds 12-15
+        msg3 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *)(Input + 48)), mask);
+        msg = _mm_add_epi32(msg3, _mm_loadu_si128((__m128i *)&PhpSha256K[12]));
+        state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+        msg0 = _mm_add_epi32(msg0, _mm_alignr_epi8(msg3, msg2, 4));
+        msg0 = _mm_sha256msg2_epu32(msg0, msg3);
+        state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0e));
+        msg2 = _mm_sha256msg1_epu32(msg2, msg3);
+
+        // Rounds 16-19
+        msg = _mm_add_epi32(msg0, _mm_loadu_si128((__m128i *)&PhpSha256K[16]));
+        state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+        msg1 = _mm_add_epi32(msg1, _mm_alignr_epi8(msg0, msg3, 4));
+        msg1 = _mm_sha256msg2_epu32(msg1, msg0);
+        state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0e));
+        msg3 = _mm_sha256msg1_epu32(msg3, msg0);
+
+        // Rounds 20-23
+        msg = _mm_add_epi32(msg1, _mm_loadu_si128((__m128i *)&PhpSha256K[20]));
+        state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+        msg2 = _mm_add_epi32(msg2, _mm_alignr_epi8(msg1, msg0, 4));
+        msg2 = _mm_sha256msg2_epu32(msg2, msg1);
+        state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0e));
+        msg0 = _mm_sha256msg1_epu32(msg0, msg1);
+
+        // Rounds 24-27
+        msg = _mm_add_epi32(msg2, _mm_loadu_si128((__m128i *)&PhpSha256K[24]));
+        state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+        msg3 = _mm_add_epi32(msg3, _mm_alignr_epi8(msg2, msg1, 4));
+        msg3 = _mm_sha256msg2_epu32(msg3, msg2);
+        state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0e));
+        msg1 = _mm_sha256msg1_epu32(msg1, msg2);
+
+        // Rounds 28-31
+        msg = _mm_add_epi32(msg3, _mm_loadu_si128((__m128i *)&PhpSha256K[28]));
+        state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+        msg0 = _mm_add_epi32(msg0, _mm_alignr_epi8(msg3, msg2, 4));
+        msg0 = _mm_sha256msg2_epu32(msg0, msg3);
+        state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0e));
+        msg2 = _mm_sha256msg1_epu32(msg2, msg3);
+
+        // Rounds 32-35
+        msg = _mm_add_epi32(msg0, _mm_loadu_si128((__m128i *)&PhpSha256K[32]));
+        state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+        msg1 = _mm_add_epi32(msg1, _mm_alignr_epi8(msg0, msg3, 4));
+        msg1 = _mm_sha256msg2_epu32(msg1, msg0);
+        state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0e));
+        msg3 = _mm_sha256msg1_epu32(msg3, msg0);
+
+        // Rounds 36-39
+        msg = _mm_add_epi32(msg1, _mm_loadu_si128((__m128i *)&PhpSha256K[36]));
+        state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+        msg2 = _mm_add_epi32(msg2, _mm_alignr_epi8(msg1, msg0, 4));
+        msg2 = _mm_sha256msg2_epu32(msg2, msg1);
+        state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0e));
+        msg0 = _mm_sha256msg1_epu32(msg0, msg1);
+
+        // Rounds 40-43
+        msg = _mm_add_epi32(msg2, _mm_loadu_si128((__m128i *)&PhpSha256K[40]));
+        state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+        msg3 = _mm_add_epi32(msg3, _mm_alignr_epi8(msg2, msg1, 4));
+        msg3 = _mm_sha256msg2_epu32(msg3, msg2);
+        state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0e));
+        msg1 = _mm_sha256msg1_epu32(msg1, msg2);
+
+        // Rounds 44-47
+        msg = _mm_add_epi32(msg3, _mm_loadu_si128((__m128i *)&PhpSha256K[44]));
+        state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+        msg0 = _mm_add_epi32(msg0, _mm_alignr_epi8(msg3, msg2, 4));
+        msg0 = _mm_sha256msg2_epu32(msg0, msg3);
+        state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0e));
+        msg2 = _mm_sha256msg1_epu32(msg2, msg3);
+
+        // Rounds 48-51
+        msg = _mm_add_epi32(msg0, _mm_loadu_si128((__m128i *)&PhpSha256K[48]));
+        state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+        msg1 = _mm_add_epi32(msg1, _mm_alignr_epi8(msg0, msg3, 4));
+        msg1 = _mm_sha256msg2_epu32(msg1, msg0);
+        state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0e));
+        msg3 = _mm_sha256msg1_epu32(msg3, msg0);
+
+        // Rounds 52-55
+        msg = _mm_add_epi32(msg1, _mm_loadu_si128((__m128i *)&PhpSha256K[52]));
+        state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+        msg2 = _mm_add_epi32(msg2, _mm_alignr_epi8(msg1, msg0, 4));
+        msg2 = _mm_sha256msg2_epu32(msg2, msg1);
+        state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0e));
+
+        // Rounds 56-59
+        msg = _mm_add_epi32(msg2, _mm_loadu_si128((__m128i *)&PhpSha256K[56]));
+        state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+        msg3 = _mm_add_epi32(msg3, _mm_alignr_epi8(msg2, msg1, 4));
+        msg3 = _mm_sha256msg2_epu32(msg3, msg2);
+        state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0e));
+
+        // Rounds 60-63
+        msg = _mm_add_epi32(msg3, _mm_loadu_si128((__m128i *)&PhpSha256K[60]));
+        state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+        state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0e));
+
+        state0 = _mm_add_epi32(state0, abefSave);
+        state1 = _mm_add_epi32(state1, cdghSave);
+    }
+
+    temp = _mm_shuffle_epi32(state0, 0x1b); // FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xb1); // DCHG
+    _mm_storeu_si128((__m128i *)&State[0], _mm_blend_epi16(temp, state1, 0xf0)); // DCBA
+    _mm_storeu_si128((__m128i *)&State[4], _mm_alignr_epi8(state1, temp, 8)); // HGFE
+}
+
+#define PHP_SHA256X8_ROR(x, n) _mm256_or_si256(_mm256_srli_epi32((x), (n)), _mm256_slli_epi32((x), 32 - (n)))
+#define PHP_SHA256X8_LOAD(Inputs, Offset) _mm256_setr_epi32( \
+    _byteswap_ulong(*(PULONG)((Inputs)[0] + (Offset))), _byteswap_ulong(*(PULONG)((Inputs)[1] + (Offset))), \
+    _byteswap_ulong(*(PULONG)((Inputs)[2] + (Offset))), _byteswap_ulong(*(PULONG)((Inputs)[3] + (Offset))), \
+    _byteswap_ulong(*(PULONG)((Inputs)[4] + (Offset))), _byteswap_ulong(*(PULONG)((Inputs)[5] + (Offset))), \
+    _byteswap_ulong(*(PULONG)((Inputs)[6] + (Offset))), _byteswap_ulong(*(PULONG)((Inputs)[7] + (Offset))))
+
+/* Hashes blocks from eight independent messages at once, one message in each 32-bit lane. */
+static VOID PhpSha256TransformAvx2x8(
+    _Inout_updates_(8) PULONG *States,
+    _In_reads_(8) PUCHAR *Inputs,
+    _In_ ULONG NumberOfBlocks
+    )
+{
+    __m256i v[8];
+    __m256i save[8];
+    __m256i w[16];
+    __m256i s0, s1, t1, t2;
+    PUCHAR inputs[8];
+    ULONG lanes[8];
+    ULONG i;
+    ULONG j;
+
+    for (i = 0; i < 8; i++)
+    {
+        v[i] = _mm256_setr_epi32(States[0][i], States[1][i], States[2][i], States[3][i],
+            States[4][i], States[5][i], States[6][i], States[7][i]);
+        inputs[i] = Inputs[i];
+    }
+
+    for (; NumberOfBlocks != 0; NumberOfBlocks--)
+    {
+        for (i = 0; i < 8; i++)
+            save[i] = v[i];
+
+        for (i = 0; i < 64; i++)
+        {
+            if (i < 16)
+            {
+                w[i] = PHP_SHA256X8_LOAD(inputs, i * 4);
+            }
+            else
+            {
+                s0 = w[(i - 15) & 15];
+                s0 = _mm256_xor_si256(_mm256_xor_si256(PHP_SHA256X8_ROR(s0, 7), PHP_SHA256X8_ROR(s0, 18)), _mm256_srli_epi32(s0, 3));
+                s1 = w[(i - 2) & 15];
+                s1 = _mm256_xor_si256(_mm256_xor_si256(PHP_SHA256X8_ROR(s1, 17), PHP_SHA256X8_ROR(s1, 19)), _mm256_srli_epi32(s1, 10));
+                w[i & 15] = _mm256_add_epi32(_mm256_add_epi32(w[i & 15], s0), _mm256_add_epi32(w[(i - 7) & 15], s1));
+            }
+
+            // v[0..7] hold a..h.
+            s1 = _mm256_xor_si256(_mm256_xor_si256(PHP_SHA256X8_ROR(v[4], 6), PHP_SHA256X8_ROR(v[4], 11)), PHP_SHA256X8_ROR(v[4], 25));
+            t1 = _mm256_xor_si256(v[6], _mm256_and_si256(v[4], _mm256_xor_si256(v[5], v[6])));
+            t1 = _mm256_add_epi32(_mm256_add_epi32(v[7], s1), _mm256_add_epi32(t1, _mm256_set1_epi32(PhpSha256K[i])));
+            t1 = _mm256_add_epi32(t1, w[i & 15]);
+            s0 = _mm256_xor_si256(_mm256_xor_si256(PHP_SHA256X8_ROR(v[0], 2), PHP_SHA256X8_ROR(v[0], 13)), PHP_SHA256X8_ROR(v[0], 22));
+            t2 = _mm256_or_si256(_mm256_and_si256(v[0], v[1]), _mm256_and_si256(v[2], _mm256_or_si256(v[0], v[1])));
+            t2 = _mm256_add_epi32(s0, t2);
+
+            v[7] = v[6];
+            v[6] = v[5];
+            v[5] = v[4];
+            v[4] = _mm256_add_epi32(v[3], t1);
+            v[3] = v[2];
+            v[2] = v[1];
+            v[1] = v[0];
+            v[0] = _mm256_add_epi32(t1, t2);
+        }
+
+        for (i = 0; i < 8; i++)
+        {
+            v[i] = _mm256_add_epi32(v[i], save[i]);
+            inputs[i] += 64;
+        }
+    }
+
+    for (i = 0; i < 8; i++)
+    {
+        _mm256_storeu_si256((__m256i *)lanes, v[i]);
+
+        for (j = 0; j < 8; j++)
+            States[j][i] = lanes[j];
+    }
+
+    _mm256_zeroupper();
+}
+
+static VOID PhpSha256TransformBlocks(
+    _Inout_ ULONG State[8],
+    _In_ PUCHAR Input,
+    _In_ ULONG NumberOfBlocks
+    )
+{
+    if (PhpGetShaFeatures() & PHP_SHA_FEATURE_SHANI)
+        PhpSha256TransformShaNi(State, Input, NumberOfBlocks);
+    else
+        PhpSha256Transform(State, Input, NumberOfBlocks);
+}
+
+VOID Sha256Init(
+    _Out_ SHA256_CTX *Context
+    )
+{
+    Context->State[0] = 0x6a09e667;
+    Context->State[1] = 0xbb67ae85;
+    Context->State[2] = 0x3c6ef372;
+    Context->State[3] = 0xa54ff53a;
+    Context->State[4] = 0x510e527f;
+    Context->State[5] = 0x9b05688c;
+    Context->State[6] = 0x1f83d9ab;
+    Context->State[7] = 0x5be0cd19;
+    Context->Count = 0;
+}
+
+VOID Sha256Update(
+    _Inout_ SHA256_CTX *Context,
+    _In_reads_bytes_(Length) UCHAR *Input,
+    _In_ ULONG Length
+    )
+{
+    ULONG bufferContentSize;
+    ULONG numberOfBlocks;
+
+    bufferContentSize = (ULONG)Context->Count & 63;
+    Context->Count += Length;
+
+    if (bufferContentSize != 0)
+    {
+        if (bufferContentSize + Length < 64)
+        {
+            RtlCopyMemory(&Context->Buffer[bufferContentSize], Input, Length);
+            return;
+        }
+
+        RtlCopyMemory(&Context->Buffer[bufferContentSize], Input, 64 - bufferContentSize);
+        Input += 64 - bufferContentSize;
+        Length -= 64 - bufferContentSize;
+        PhpSha256TransformBlocks(Context->State, Context->Buffer, 1);
+    }
+
+    numberOfBlocks = Length / 64;
+
+    if (numberOfBlocks != 0)
+    {
+        PhpSha256TransformBlocks(Context->State, Input, numberOfBlocks);
+        Input += numberOfBlocks * 64;
+        Length -= numberOfBlocks * 64;
+    }
+
+    RtlCopyMemory(Context->Buffer, Input, Length);
+}
+
+/**
+ * Hashes the same amount of data into several SHA-256 contexts.
+ *
+ * \param Contexts An array of contexts.
+ * \param Inputs An array of buffers, one for each context.
+ * \param Length The number of bytes in each buffer.
+ * \param Count The number of contexts.
+ *
+ * \remarks On processors with AVX2 but without the SHA extensions, up to eight
+ * messages are hashed in parallel. Otherwise this is the same as calling
+ * Sha256Update() for each context.
+ */
+VOID Sha256UpdateMultiple(
+    _Inout_updates_(Count) SHA256_CTX **Contexts,
+    _In_reads_(Count) UCHAR **Inputs,
+    _In_ ULONG Length,
+    _In_ ULONG Count
+    )
+{
+    ULONG dummyState[8];
+    PULONG states[8];
+    PUCHAR inputs[8];
+    ULONG lengths[8];
+    ULONG bufferContentSize;
+    ULONG numberOfBlocks;
+    ULONG count;
+    ULONG i;
+    ULONG j;
+
+    if ((PhpGetShaFeatures() & (PHP_SHA_FEATURE_SHANI | PHP_SHA_FEATURE_AVX2)) != PHP_SHA_FEATURE_AVX2)
+    {
+        for (i = 0; i < Count; i++)
+            Sha256Update(Contexts[i], Inputs[i], Length);
+
+        return;
+    }
+
+    for (i = 0; i < Count; i += count)
+    {
+        count = min(Count - i, 8);
+
+        if (count == 1)
+        {
+            Sha256Update(Contexts[i], Inputs[i], Length);
+            break;
+        }
+
+        numberOfBlocks = MAXULONG;
+
+        for (j = 0; j < count; j++)
+        {
+            inputs[j] = Inputs[i + j];
+            lengths[j] = Length;
+
+            // Complete any partially filled block so that the rest of the input can be hashed
+            // in whole blocks.
+            bufferContentSize = (ULONG)Contexts[i + j]->Count & 63;
+
+            if (bufferContentSize != 0)
+            {
+                bufferContentSize = min(64 - bufferContentSize, Length);
+                Sha256Update(Contexts[i + j], inputs[j], bufferContentSize);
+                inputs[j] += bufferContentSize;
+                lengths[j] -= bufferContentSize;
+            }
+
+            states[j] = Contexts[i + j]->State;
+            numberOfBlocks = min(numberOfBlocks, lengths[j] / 64);
+        }
+
+        if (numberOfBlocks != 0)
+        {
+            // Unused lanes hash the first message again into a scratch state.
+            for (j = count; j < 8; j++)
+            {
+                states[j] = dummyState;
+                inputs[j] = inputs[0];
+            }
+
+            PhpSha256TransformAvx2x8(states, inputs, numberOfBlocks);
+
+            for (j = 0; j < count; j++)
+            {
+                Contexts[i + j]->Count += numberOfBlocks * 64;
+                inputs[j] += numberOfBlocks * 64;
+                lengths[j] -= numberOfBlocks * 64;
+            }
+        }
+
+        for (j = 0; j < count; j++)
+        {
+            if (lengths[j] != 0)
+                Sha256Update(Contexts[i + j], inputs[j], lengths[j]);
+        }
+    }
+}
+
+VOID Sha256Final(
+    _Inout_ SHA256_CTX *Context,
+    _Out_writes_bytes_(32) UCHAR *Hash
+    )
+{
+    UCHAR buffer[72];
+    ULONG bufferContentSize;
+    ULONG padLength;
+    ULONG64 bitCount;
+    ULONG i;
+
+    bufferContentSize = (ULONG)Context->Count & 63;
+    padLength = bufferContentSize < 56 ? 56 - bufferContentSize : 120 - bufferContentSize;
+    bitCount = Context->Count << 3;
+
+    buffer[0] = 0x80;
+    RtlZeroMemory(buffer + 1, padLength - 1);
+    *(PULONG64)(buffer + padLength) = _byteswap_uint64(bitCount);
+    Sha256Update(Context, buffer, padLength + 8);
+
+    for (i = 0; i < 8; i++)
+        ((PULONG)Hash)[i] = _byteswap_ulong(Context->State[i]);
+
+    Sha256Init(Context);
+}
@@ -0,0 +1,552 @@
+/*
+ * Process Hacker -
+ *   slab allocator
+ *
+ * Copyright (C) 2016 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The slab allocator serves small PhAllocate requests without taking the heap lock. It is
+ * enabled by passing PHLIB_INIT_SLAB_ALLOCATOR to PhInitializePhLibEx.
+ *
+ * A single region of address space is reserved at startup and committed one 64 kB slab at a
+ * time. Each slab is carved into blocks of one size class. Since all slabs live in the same
+ * region, PhFree can tell slab blocks from heap blocks with a range check, and the size class
+ * of a block is looked up by its slab index. Blocks allocated before the slab allocator was
+ * initialized, or too large for any size class, simply stay on the heap.
+ *
+ * Each thread keeps a cache of free blocks for every size class, so most allocations and
+ * frees do not use any interlocked operations. When a thread cache has too many free blocks,
+ * a magazine of PH_SLAB_MAGAZINE_SIZE blocks is moved to the per-class depot (an S-list), and
+ * a thread with no free blocks takes a magazine from the depot before carving new blocks out
+ * of a slab. A thread cache is returned to the depots when a thread created with
+ * PhCreateThread exits. Slabs are never decommitted.
+ *
+ * Memory in the depot is linked as follows: the first pointer-sized field of each block links
+ * blocks within a magazine, and the S-list entry of the first block in a magazine overlays that
+ * field; the link is saved in the second pointer-sized field while the magazine is in the
+ * depot. The smallest size class is therefore 2 * sizeof(PVOID).
+ *
+ * The slab allocator is not used if heap debugging features (e.g. page heap, or the debug heap
+ * enabled when running under a debugger) are enabled for the process, so that these tools can
+ * still be used to find memory corruption bugs.
+ */
+
+#include <phbase.h>
+#include <slabp.h>
+
+typedef struct _PHP_SLAB_CLASS
+{
+    SLIST_HEADER Depot;
+    PH_QUEUED_LOCK Lock;
+    ULONG BlockSize;
+    ULONG NumberOfSlabs;
+
+    // Protected by Lock
+    PUCHAR NextBlock;
+    PUCHAR EndOfSlab;
+
+    // Counters of thread caches that have been deleted
+    ULONG64 Allocations;
+    ULONG64 Frees;
+} PHP_SLAB_CLASS, *PPHP_SLAB_CLASS;
+
+typedef struct _PHP_SLAB_MAGAZINE
+{
+    PVOID *Head;
+    ULONG Count;
+    ULONG64 Allocations;
+    ULONG64 Frees;
+} PHP_SLAB_MAGAZINE, *PPHP_SLAB_MAGAZINE;
+
+typedef struct _PHP_SLAB_THREAD_CACHE
+{
+    LIST_ENTRY ListEntry;
+    PHP_SLAB_MAGAZINE Magazines[PH_SLAB_NUMBER_OF_CLASSES];
+} PHP_SLAB_THREAD_CACHE, *PPHP_SLAB_THREAD_CACHE;
+
+BOOLEAN PhSlabEnabled = FALSE;
+PVOID PhSlabBase = NULL;
+SIZE_T PhSlabRegionSize = 0;
+
+static ULONG PhpSlabClassSizes[PH_SLAB_NUMBER_OF_CLASSES] =
+{
+    16, 32, 48, 64, 80, 96, 128, 160, 192, 256, 320, 384, 512, 768, 1024
+};
+static UCHAR PhpSlabSizeToClass[PH_SLAB_MAXIMUM_SIZE / PH_SLAB_GRANULARITY + 1];
+static PHP_SLAB_CLASS PhpSlabClasses[PH_SLAB_NUMBER_OF_CLASSES];
+
+static UCHAR PhpSlabClassMap[PH_SLAB_REGION_SIZE / PH_SLAB_SIZE];
+static LONG PhpSlabNextIndex = 0;
+
+static ULONG PhpSlabTlsIndex;
+static LIST_ENTRY PhpSlabThreadCacheListHead;
+static PH_QUEUED_LOCK PhpSlabThreadCacheListLock = PH_QUEUED_LOCK_INIT;
+static ULONG PhpSlabNumberOfThreadCaches = 0;
+
+BOOLEAN PhSlabInitialization(
+    VOID
+    )
+{
+    PVOID baseAddress;
+    SIZE_T regionSize;
+    ULONG i;
+    ULONG j;
+
+    if (NtCurrentPeb()->NtGlobalFlag & (FLG_HEAP_ENABLE_TAIL_CHECK | FLG_HEAP_ENABLE_FREE_CHECK |
+        FLG_HEAP_VALIDATE_PARAMETERS | FLG_HEAP_VALIDATE_ALL | FLG_HEAP_PAGE_ALLOCS | FLG_USER_STACK_TRACE_DB))
+    {
+        return FALSE;
+    }
+
+    // We read the TLS slot directly from the TEB (see PhpGetSlabThreadCache) because
+    // TlsGetValue clears the last error value, and PhAllocate must not do that.
+    PhpSlabTlsIndex = TlsAlloc();
+
+    if (PhpSlabTlsIndex >= RTL_NUMBER_OF(NtCurrentTeb()->TlsSlots))
+    {
+        if (PhpSlabTlsIndex != TLS_OUT_OF_INDEXES)
+            TlsFree(PhpSlabTlsIndex);
+
+        return FALSE;
+    }
+
+    baseAddress = NULL;
+    regionSize = PH_SLAB_REGION_SIZE;
+
+    if (!NT_SUCCESS(NtAllocateVirtualMemory(
+        NtCurrentProcess(),
+        &baseAddress,
+        0,
+        &regionSize,
+        MEM_RESERVE,
+        PAGE_READWRITE
+        )))
+    {
+        TlsFree(PhpSlabTlsIndex);
+        return FALSE;
+    }
+
+    j = 0;
+
+    for (i = 0; i < RTL_NUMBER_OF(PhpSlabSizeToClass); i++)
+    {
+        while (PhpSlabClassSizes[j] < i * PH_SLAB_GRANULARITY)
+            j++;
+
+        PhpSlabSizeToClass[i] = (UCHAR)j;
+    }
+
+    for (i = 0; i < PH_SLAB_NUMBER_OF_CLASSES; i++)
+    {
+        RtlInitializeSListHead(&PhpSlabClasses[i].Depot);
+        PhInitializeQueuedLock(&PhpSlabClasses[i].Lock);
+        PhpSlabClasses[i].BlockSize = PhpSlabClassSizes[i];
+    }
+
+    InitializeListHead(&PhpSlabThreadCacheListHead);
+
+    PhSlabBase = baseAddress;
+    PhSlabRegionSize = PH_SLAB_REGION_SIZE;
+    PhSlabEnabled = TRUE;
+
+    return TRUE;
+}
+
+static PPHP_SLAB_THREAD_CACHE PhpCreateSlabThreadCache(
+    VOID
+    )
+{
+    PPHP_SLAB_THREAD_CACHE cache;
+
+    cache = RtlAllocateHeap(PhHeapHandle, HEAP_ZERO_MEMORY, sizeof(PHP_SLAB_THREAD_CACHE));
+
+    if (!cache)
+        return NULL;
+
+    PhAcquireQueuedLockExclusive(&PhpSlabThreadCacheListLock);
+    InsertTailList(&PhpSlabThreadCacheListHead, &cache->ListEntry);
+    PhpSlabNumberOfThreadCaches++;
+    PhReleaseQueuedLockExclusive(&PhpSlabThreadCacheListLock);
+
+    NtCurrentTeb()->TlsSlots[PhpSlabTlsIndex] = cache;
+
+    return cache;
+}
+
+FORCEINLINE PPHP_SLAB_THREAD_CACHE PhpGetSlabThreadCache(
+    VOID
+    )
+{
+    PPHP_SLAB_THREAD_CACHE cache;
+
+    cache = NtCurrentTeb()->TlsSlots[PhpSlabTlsIndex];
+
+    if (!cache)
+        cache = PhpCreateSlabThreadCache();
+
+    return cache;
+}
+
+FORCEINLINE ULONG PhpGetSlabBlockClass(
+    _In_ PVOID Memory
+    )
+{
+    return PhpSlabClassMap[((ULONG_PTR)Memory - (ULONG_PTR)PhSlabBase) >> PH_SLAB_SHIFT];
+}
+
+static VOID PhpPushSlabMagazine(
+    _In_ PPHP_SLAB_CLASS Class,
+    _In_ PVOID *Head
+    )
+{
+    // The S-list entry overwrites the link to the next block, so save it.
+    Head[1] = Head[0];
+    RtlInterlockedPushEntrySList(&Class->Depot, (PSLIST_ENTRY)Head);
+}
+
+static PVOID *PhpPopSlabMagazine(
+    _In_ PPHP_SLAB_CLASS Class
+    )
+{
+    PVOID *head;
+
+    head = (PVOID *)RtlInterlockedPopEntrySList(&Class->Depot);
+
+    if (head)
+        head[0] = head[1];
+
+    return head;
+}
+
+static PVOID *PhpCarveSlabBlocks(
+    _In_ ULONG ClassIndex,
+    _Out_ PULONG Count
+    )
+{
+    PPHP_SLAB_CLASS slabClass = &PhpSlabClasses[ClassIndex];
+    PVOID *head = NULL;
+    PVOID *tail = NULL;
+    ULONG count = 0;
+
+    PhAcquireQueuedLockExclusive(&slabClass->Lock);
+
+    while (count < PH_SLAB_MAGAZINE_SIZE)
+    {
+        PVOID *block;
+
+        if (slabClass->NextBlock + slabClass->BlockSize > slabClass->EndOfSlab)
+        {
+            LONG index;
+            PVOID baseAddress;
+            SIZE_T size;
+
+            // Start a new slab. If the region is full, we will have to use the heap for any
+            // further allocations in this size class.
+
+            if (PhpSlabNextIndex >= RTL_NUMBER_OF(PhpSlabClassMap))
+                break;
+
+            index = _InterlockedIncrement(&PhpSlabNextIndex) - 1;
+
+            if (index >= RTL_NUMBER_OF(PhpSlabClassMap))
+                break;
+
+            baseAddress = (PUCHAR)PhSlabBase + ((SIZE_T)index << PH_SLAB_SHIFT);
+            size = PH_SLAB_SIZE;
+
+            if (!NT_SUCCESS(NtAllocateVirtualMemory(
+                NtCurrentProcess(),
+                &baseAddress,
+                0,
+                &size,
+                MEM_COMMIT,
+                PAGE_READWRITE
+                )))
+            {
+                break;
+            }
+
+            PhpSlabClassMap[index] = (UCHAR)ClassIndex;
+            slabClass->NextBlock = baseAddress;
+            slabClass->EndOfSlab = (PUCHAR)baseAddress + PH_SLAB_SIZE;
+            slabClass->NumberOfSlabs++;
+        }
+
+        block = (PVOID *)slabClass->NextBlock;
+        slabClass->NextBlock += slabClass->BlockSize;
+
+        block[0] = NULL;
+
+        if (tail)
+            tail[0] = block;
+        else
+            head = block;
+
+        tail = block;
+        count++;
+    }
+
+    PhReleaseQueuedLockExclusive(&slabClass->Lock);
+
+    *Count = count;
+
+    return head;
+}
+
+static BOOLEAN PhpRefillSlabMagazine(
+    _In_ ULONG ClassIndex,
+    _Inout_ PPHP_SLAB_MAGAZINE Magazine
+    )
+{
+    PVOID *head;
+    ULONG count;
+
+    if (head = PhpPopSlabMagazine(&PhpSlabClasses[ClassIndex]))
+    {
+        PVOID *block;
+
+        // Magazines that were flushed from exiting threads may be partially filled.
+        count = 0;
+
+        for (block = head; block; block = block[0])
+            count++;
+    }
+    else
+    {
+        head = PhpCarveSlabBlocks(ClassIndex, &count);
+
+        if (!head)
+            return FALSE;
+    }
+
+    Magazine->Head = head;
+    Magazine->Count = count;
+
+    return TRUE;
+}
+
+static VOID PhpFlushSlabMagazine(
+    _In_ ULONG ClassIndex,
+    _Inout_ PPHP_SLAB_MAGAZINE Magazine,
+    _In_ ULONG MaximumCount
+    )
+{
+    PPHP_SLAB_CLASS slabClass = &PhpSlabClasses[ClassIndex];
+
+    while (Magazine->Head && MaximumCount != 0)
+    {
+        PVOID *head;
+        PVOID *tail;
+        ULONG count;
+
+        // Detach up to PH_SLAB_MAGAZINE_SIZE blocks and move them to the depot.
+
+        head = Magazine->Head;
+        tail = head;
+        count = 1;
+
+        while (tail[0] && count < PH_SLAB_MAGAZINE_SIZE && count < MaximumCount)
+        {
+            tail = tail[0];
+            count++;
+        }
+
+        Magazine->Head = tail[0];
+        Magazine->Count -= count;
+        MaximumCount -= count;
+        tail[0] = NULL;
+
+        PhpPushSlabMagazine(slabClass, head);
+    }
+}
+
+/**
+ * Allocates a block of memory from the slab allocator.
+ *
+ * \param Size The number of bytes to allocate. This must not be greater than
+ * PH_SLAB_MAXIMUM_SIZE.
+ *
+ * \return A pointer to the allocated block of memory, or NULL if the block could
+ * not be allocated.
+ */
+PVOID PhSlabAllocate(
+    _In_ SIZE_T Size
+    )
+{
+    ULONG classIndex;
+    PPHP_SLAB_THREAD_CACHE cache;
+    PPHP_SLAB_MAGAZINE magazine;
+    PVOID *block;
+
+    assert(Size <= PH_SLAB_MAXIMUM_SIZE);
+
+    classIndex = PhpSlabSizeToClass[(Size + PH_SLAB_GRANULARITY - 1) / PH_SLAB_GRANULARITY];
+    cache = PhpGetSlabThreadCache();
+
+    if (!cache)
+        return NULL;
+
+    magazine = &cache->Magazines[classIndex];
+
+    if (!magazine->Head && !PhpRefillSlabMagazine(classIndex, magazine))
+        return NULL;
+
+    block = magazine->Head;
+    magazine->Head = block[0];
+    magazine->Count--;
+    magazine->Allocations++;
+
+    return block;
+}
+
+/**
+ * Frees a block of memory allocated with PhSlabAllocate().
+ *
+ * \param Memory A pointer to a block of memory.
+ */
+VOID PhSlabFree(
+    _In_ PVOID Memory
+    )
+{
+    ULONG classIndex;
+    PPHP_SLAB_THREAD_CACHE cache;
+    PPHP_SLAB_MAGAZINE magazine;
+    PVOID *block = Memory;
+
+    classIndex = PhpGetSlabBlockClass(Memory);
+    cache = PhpGetSlabThreadCache();
+
+    if (!cache)
+    {
+        // Give the block to the depot as a magazine of its own.
+        block[0] = NULL;
+        PhpPushSlabMagazine(&PhpSlabClasses[classIndex], block);
+        return;
+    }
+
+    magazine = &cache->Magazines[classIndex];
+    block[0] = magazine->Head;
+    magazine->Head = block;
+    magazine->Count++;
+    magazine->Frees++;
+
+    // Keep one full magazine for future allocations.
+    if (magazine->Count >= PH_SLAB_MAGAZINE_SIZE * 2)
+        PhpFlushSlabMagazine(classIndex, magazine, PH_SLAB_MAGAZINE_SIZE);
+}
+
+/**
+ * Gets the usable size of a block of memory allocated with PhSlabAllocate().
+ *
+ * \param Memory A pointer to a block of memory.
+ */
+SIZE_T PhSlabGetBlockSize(
+    _In_ PVOID Memory
+    )
+{
+    return PhpSlabClasses[PhpGetSlabBlockClass(Memory)].BlockSize;
+}
+
+/**
+ * Moves all blocks cached by the current thread to the depots and deletes the thread
+ * cache.
+ */
+VOID PhSlabFlushThreadCache(
+    VOID
+    )
+{
+    PPHP_SLAB_THREAD_CACHE cache;
+    ULONG i;
+
+    if (!PhSlabEnabled)
+        return;
+
+    cache = NtCurrentTeb()->TlsSlots[PhpSlabTlsIndex];
+
+    if (!cache)
+        return;
+
+    NtCurrentTeb()->TlsSlots[PhpSlabTlsIndex] = NULL;
+
+    PhAcquireQueuedLockExclusive(&PhpSlabThreadCacheListLock);
+
+    RemoveEntryList(&cache->ListEntry);
+    PhpSlabNumberOfThreadCaches--;
+
+    for (i = 0; i < PH_SLAB_NUMBER_OF_CLASSES; i++)
+    {
+        PhpFlushSlabMagazine(i, &cache->Magazines[i], ULONG_MAX);
+        PhpSlabClasses[i].Allocations += cache->Magazines[i].Allocations;
+        PhpSlabClasses[i].Frees += cache->Magazines[i].Frees;
+    }
+
+    PhReleaseQueuedLockExclusive(&PhpSlabThreadCacheListLock);
+
+    RtlFreeHeap(PhHeapHandle, 0, cache);
+}
+
+/**
+ * Gets statistics for the slab allocator.
+ *
+ * \param Statistics A variable which receives the statistics.
+ *
+ * \remarks The allocation and free counts are read from other threads without synchronization
+ * and should be treated as approximate.
+ */
+VOID PhGetSlabStatistics(
+    _Out_ PPH_SLAB_STATISTICS Statistics
+    )
+{
+    PLIST_ENTRY listEntry;
+    ULONG i;
+
+    memset(Statistics, 0, sizeof(PH_SLAB_STATISTICS));
+    Statistics->Enabled = PhSlabEnabled;
+
+    if (!PhSlabEnabled)
+        return;
+
+    Statistics->ReservedSize = PhSlabRegionSize;
+
+    PhAcquireQueuedLockShared(&PhpSlabThreadCacheListLock);
+
+    Statistics->NumberOfThreadCaches = PhpSlabNumberOfThreadCaches;
+
+    for (i = 0; i < PH_SLAB_NUMBER_OF_CLASSES; i++)
+    {
+        Statistics->Classes[i].BlockSize = PhpSlabClasses[i].BlockSize;
+        Statistics->Classes[i].NumberOfSlabs = PhpSlabClasses[i].NumberOfSlabs;
+        Statistics->Classes[i].Allocations = PhpSlabClasses[i].Allocations;
+        Statistics->Classes[i].Frees = PhpSlabClasses[i].Frees;
+        Statistics->CommittedSize += (SIZE_T)PhpSlabClasses[i].NumberOfSlabs * PH_SLAB_SIZE;
+    }
+
+    for (listEntry = PhpSlabThreadCacheListHead.Flink; listEntry != &PhpSlabThreadCacheListHead; listEntry = listEntry->Flink)
+    {
+        PPHP_SLAB_THREAD_CACHE cache = CONTAINING_RECORD(listEntry, PHP_SLAB_THREAD_CACHE, ListEntry);
+
+        for (i = 0; i < PH_SLAB_NUMBER_OF_CLASSES; i++)
+        {
+            Statistics->Classes[i].Allocations += cache->Magazines[i].Allocations;
+            Statistics->Classes[i].Frees += cache->Magazines[i].Frees;
+        }
+    }
+
+    PhReleaseQueuedLockShared(&PhpSlabThreadCacheListLock);
+}
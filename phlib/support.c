@@ -4405,6 +4405,7 @@ ULONG PhCrc32(
 
 C_ASSERT(RTL_FIELD_SIZE(PH_HASH_CONTEXT, Context) >= sizeof(MD5_CTX));
 C_ASSERT(RTL_FIELD_SIZE(PH_HASH_CONTEXT, Context) >= sizeof(A_SHA_CTX));
+C_ASSERT(RTL_FIELD_SIZE(PH_HASH_CONTEXT, Context) >= sizeof(SHA256_CTX));
 
 /**
  * Initializes hashing.
@@ -4414,6 +4415,7 @@ C_ASSERT(RTL_FIELD_SIZE(PH_HASH_CONTEXT, Context) >= sizeof(A_SHA_CTX));
  * \li \c Md5HashAlgorithm MD5 (128 bits)
  * \li \c Sha1HashAlgorithm SHA-1 (160 bits)
  * \li \c Crc32HashAlgorithm CRC-32-IEEE 802.3 (32 bits)
+ * \li \c Sha256HashAlgorithm SHA-256 (256 bits)
  */
 VOID PhInitializeHash(
     _Out_ PPH_HASH_CONTEXT Context,
@@ -4433,6 +4435,9 @@ VOID PhInitializeHash(
     case Crc32HashAlgorithm:
         Context->Context[0] = 0;
         break;
+    case Sha256HashAlgorithm:
+        Sha256Init((SHA256_CTX *)Context->Context);
+        break;
     default:
         PhRaiseStatus(STATUS_INVALID_PARAMETER_2);
         break;
@@ -4463,11 +4468,64 @@ VOID PhUpdateHash(
     case Crc32HashAlgorithm:
         Context->Context[0] = PhCrc32(Context->Context[0], (PUCHAR)Buffer, Length);
         break;
+    case Sha256HashAlgorithm:
+        Sha256Update((SHA256_CTX *)Context->Context, (PUCHAR)Buffer, Length);
+        break;
     default:
         PhRaiseStatus(STATUS_INVALID_PARAMETER);
     }
 }
 
+/**
+ * Hashes a block of data into each of several contexts.
+ *
+ * \param Contexts An array of hashing context structures.
+ * \param Buffers An array of blocks, one for each context.
+ * \param Length The number of bytes in each block.
+ * \param Count The number of contexts.
+ *
+ * \remarks This is equivalent to calling PhUpdateHash() for each context,
+ * but SHA-256 contexts may be hashed in parallel. Use this function when
+ * hashing several files at once by reading them in equal-sized chunks.
+ */
+VOID PhUpdateHashMultiple(
+    _Inout_updates_(Count) PPH_HASH_CONTEXT *Contexts,
+    _In_reads_(Count) PVOID *Buffers,
+    _In_ ULONG Length,
+    _In_ ULONG Count
+    )
+{
+    SHA256_CTX *sha256Contexts[8];
+    PUCHAR sha256Buffers[8];
+    ULONG numberOfSha256Contexts;
+    ULONG i;
+
+    numberOfSha256Contexts = 0;
+
+    for (i = 0; i < Count; i++)
+    {
+        if (Contexts[i]->Algorithm == Sha256HashAlgorithm)
+        {
+            sha256Contexts[numberOfSha256Contexts] = (SHA256_CTX *)Contexts[i]->Context;
+            sha256Buffers[numberOfSha256Contexts] = Buffers[i];
+            numberOfSha256Contexts++;
+
+            if (numberOfSha256Contexts == RTL_NUMBER_OF(sha256Contexts))
+            {
+                Sha256UpdateMultiple(sha256Contexts, sha256Buffers, Length, numberOfSha256Contexts);
+                numberOfSha256Contexts = 0;
+            }
+        }
+        else
+        {
+            PhUpdateHash(Contexts[i], Buffers[i], Length);
+        }
+    }
+
+    if (numberOfSha256Contexts != 0)
+        Sha256UpdateMultiple(sha256Contexts, sha256Buffers, Length, numberOfSha256Contexts);
+}
+
 /**
  * Computes the final hash value.
  *
@@ -4521,6 +4579,16 @@ BOOLEAN PhFinalHash(
 
         returnLength = 4;
 
+        break;
+    case Sha256HashAlgorithm:
+        if (HashLength >= 32)
+        {
+            Sha256Final((SHA256_CTX *)Context->Context, (PUCHAR)Hash);
+            result = TRUE;
+        }
+
+        returnLength = 32;
+
         break;
     default:
         PhRaiseStatus(STATUS_INVALID_PARAMETER);
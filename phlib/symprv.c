@@ -31,6 +31,61 @@
 #include <symprv.h>
 #include <symprvp.h>
 
+// Symbol indexes let PhGetSymbolFromAddress resolve addresses without calling into dbghelp,
+// which has to be serialized. The symbols of a module are enumerated once and stored in an
+// array sorted by RVA. The index is immutable once it has been published, and modules are
+// only freed when the symbol provider is deleted, so lookups need no locking at all.
+//
+// If a cache directory has been set, indexes built from a PDB are also saved there, keyed
+// by the PDB signature and age recorded in the image. Later lookups for the same module map
+// the saved index instead of loading the PDB.
+
+#define PH_SYMBOL_INDEX_MAXIMUM_ENTRIES 0x40000
+#define PH_SYMBOL_INDEX_UNAVAILABLE ((PPH_SYMBOL_INDEX)1)
+
+typedef struct _PH_SYMBOL_INDEX_ENTRY
+{
+    ULONG Rva;
+    ULONG NameOffset; // in characters
+    ULONG NameLength; // in characters
+} PH_SYMBOL_INDEX_ENTRY, *PPH_SYMBOL_INDEX_ENTRY;
+
+typedef struct _PH_SYMBOL_INDEX
+{
+    ULONG NumberOfEntries;
+    ULONG NamesLength; // in characters
+    PPH_SYMBOL_INDEX_ENTRY Entries;
+    PWCHAR Names;
+    PPH_STRING NamesString; // if the index was built in memory
+    PVOID ViewBase; // if the index was mapped from the cache
+} PH_SYMBOL_INDEX, *PPH_SYMBOL_INDEX;
+
+#define PH_SYMBOL_INDEX_FILE_MAGIC ('ISHP')
+#define PH_SYMBOL_INDEX_FILE_VERSION 1
+#define PH_SYMBOL_INDEX_FILE_UNDECORATED 0x1
+
+// The file header is followed by the entries and then the names.
+typedef struct _PH_SYMBOL_INDEX_FILE_HEADER
+{
+    ULONG Magic;
+    ULONG Version;
+    GUID Signature;
+    ULONG Age;
+    ULONG Flags;
+    ULONG NumberOfEntries;
+    ULONG NamesLength; // in characters
+} PH_SYMBOL_INDEX_FILE_HEADER, *PPH_SYMBOL_INDEX_FILE_HEADER;
+
+typedef struct _PH_CODEVIEW_RSDS
+{
+    ULONG Magic;
+    GUID Signature;
+    ULONG Age;
+    CHAR PdbFileName[1];
+} PH_CODEVIEW_RSDS, *PPH_CODEVIEW_RSDS;
+
+#define PH_CODEVIEW_RSDS_MAGIC ('SDSR')
+
 typedef struct _PH_SYMBOL_MODULE
 {
     LIST_ENTRY ListEntry;
@@ -39,8 +94,19 @@ typedef struct _PH_SYMBOL_MODULE
     ULONG Size;
     PPH_STRING FileName;
     ULONG BaseNameIndex;
+    PPH_SYMBOL_INDEX volatile SymbolIndex;
 } PH_SYMBOL_MODULE, *PPH_SYMBOL_MODULE;
 
+typedef struct _PH_SYMBOL_INDEX_BUILD_CONTEXT
+{
+    PPH_SYMBOL_MODULE Module;
+    PPH_SYMBOL_INDEX_ENTRY Entries;
+    ULONG NumberOfEntries;
+    ULONG AllocatedEntries;
+    PH_STRING_BUILDER Names;
+    BOOLEAN TooManySymbols;
+} PH_SYMBOL_INDEX_BUILD_CONTEXT, *PPH_SYMBOL_INDEX_BUILD_CONTEXT;
+
 VOID NTAPI PhpSymbolProviderDeleteProcedure(
     _In_ PVOID Object,
     _In_ ULONG Flags
@@ -59,12 +125,20 @@ LONG NTAPI PhpSymbolModuleCompareFunction(
     _In_ PPH_AVL_LINKS Links2
     );
 
+#ifdef _WIN64
+VOID PhpFlushFunctionTableCache(
+    _In_ HANDLE ProcessHandle
+    );
+#endif
+
 PPH_OBJECT_TYPE PhSymbolProviderType;
 
 static PH_INITONCE PhSymInitOnce = PH_INITONCE_INIT;
 DECLSPEC_SELECTANY PH_CALLBACK_DECLARE(PhSymInitCallback);
 
 static HANDLE PhNextFakeHandle = (HANDLE)0;
+static PPH_STRING PhpSymbolIndexCacheDirectory = NULL;
+static PH_QUEUED_LOCK PhpSymbolIndexCacheLock = PH_QUEUED_LOCK_INIT;
 static PH_FAST_LOCK PhSymMutex = PH_FAST_LOCK_INIT;
 
 #define PH_LOCK_SYMBOLS() PhAcquireFastLockExclusive(&PhSymMutex)
@@ -91,6 +165,7 @@ _SymSetSearchPathW SymSetSearchPathW_I;
 _SymUnloadModule64 SymUnloadModule64_I;
 _SymFunctionTableAccess64 SymFunctionTableAccess64_I;
 _SymGetModuleBase64 SymGetModuleBase64_I;
+_SymGetModuleInfoW64 SymGetModuleInfoW64_I;
 _SymRegisterCallbackW64 SymRegisterCallbackW64_I;
 _StackWalk64 StackWalk64_I;
 _MiniDumpWriteDump MiniDumpWriteDump_I;
@@ -102,6 +177,7 @@ BOOLEAN PhSymbolProviderInitialization(
     )
 {
     PhSymbolProviderType = PhCreateObjectType(L"SymbolProvider", 0, PhpSymbolProviderDeleteProcedure);
+    PhRegisterLockStatistics(&PhSymMutex, L"PhSymMutex");
 
     return TRUE;
 }
@@ -145,6 +221,7 @@ VOID PhSymbolProviderCompleteInitialization(
     SymUnloadModule64_I = (PVOID)GetProcAddress(dbghelpHandle, "SymUnloadModule64");
     SymFunctionTableAccess64_I = (PVOID)GetProcAddress(dbghelpHandle, "SymFunctionTableAccess64");
     SymGetModuleBase64_I = (PVOID)GetProcAddress(dbghelpHandle, "SymGetModuleBase64");
+    SymGetModuleInfoW64_I = (PVOID)GetProcAddress(dbghelpHandle, "SymGetModuleInfoW64");
     SymRegisterCallbackW64_I = (PVOID)GetProcAddress(dbghelpHandle, "SymRegisterCallbackW64");
     StackWalk64_I = (PVOID)GetProcAddress(dbghelpHandle, "StackWalk64");
     MiniDumpWriteDump_I = (PVOID)GetProcAddress(dbghelpHandle, "MiniDumpWriteDump");
@@ -155,6 +232,19 @@ VOID PhSymbolProviderCompleteInitialization(
         SymSetOptions_I(SymGetOptions_I() | SYMOPT_DEFERRED_LOADS | SYMOPT_FAVOR_COMPRESSED);
 }
 
+/**
+ * Loads the symbol engine if this has not been done yet.
+ *
+ * \remarks The symbol engine is otherwise loaded the first time a symbol
+ * function is used, which may be on a thread that is waiting for the result.
+ */
+VOID PhPrefetchSymbolProvider(
+    VOID
+    )
+{
+    PhpRegisterSymbolProvider(NULL);
+}
+
 PPH_SYMBOL_PROVIDER PhCreateSymbolProvider(
     _In_opt_ HANDLE ProcessId
     )
@@ -216,6 +306,10 @@ VOID NTAPI PhpSymbolProviderDeleteProcedure(
 
     PhDeleteCallback(&symbolProvider->EventCallback);
 
+#ifdef _WIN64
+    PhpFlushFunctionTableCache(symbolProvider->ProcessHandle);
+#endif
+
     if (SymCleanup_I)
     {
         PH_LOCK_SYMBOLS();
@@ -337,6 +431,23 @@ VOID PhpFreeSymbolModule(
 {
     if (SymbolModule->FileName) PhDereferenceObject(SymbolModule->FileName);
 
+    if (SymbolModule->SymbolIndex && SymbolModule->SymbolIndex != PH_SYMBOL_INDEX_UNAVAILABLE)
+    {
+        PPH_SYMBOL_INDEX index = SymbolModule->SymbolIndex;
+
+        if (index->ViewBase)
+        {
+            NtUnmapViewOfSection(NtCurrentProcess(), index->ViewBase);
+        }
+        else
+        {
+            PhDereferenceObject(index->NamesString);
+            PhFree(index->Entries);
+        }
+
+        PhFree(index);
+    }
+
     PhFree(SymbolModule);
 }
 
@@ -503,6 +614,489 @@ ULONG64 PhGetModuleFromAddress(
     return foundBaseAddress;
 }
 
+static BOOLEAN PhpAddSymbolIndexEntry(
+    _Inout_ PPH_SYMBOL_INDEX_BUILD_CONTEXT Context,
+    _In_ ULONG64 Address,
+    _In_ PWCHAR Name,
+    _In_ ULONG NameLength
+    )
+{
+    PPH_SYMBOL_INDEX_ENTRY entry;
+
+    if (Address < Context->Module->BaseAddress)
+        return TRUE;
+    if (Context->Module->Size != 0 && Address >= Context->Module->BaseAddress + Context->Module->Size)
+        return TRUE;
+
+    if (Context->NumberOfEntries == PH_SYMBOL_INDEX_MAXIMUM_ENTRIES)
+    {
+        // Indexing a huge module would use too much memory. Let dbghelp handle it instead.
+        Context->TooManySymbols = TRUE;
+        return FALSE;
+    }
+
+    if (Context->NumberOfEntries == Context->AllocatedEntries)
+    {
+        Context->AllocatedEntries *= 2;
+        Context->Entries = PhReAllocate(Context->Entries, Context->AllocatedEntries * sizeof(PH_SYMBOL_INDEX_ENTRY));
+    }
+
+    entry = &Context->Entries[Context->NumberOfEntries++];
+    entry->Rva = (ULONG)(Address - Context->Module->BaseAddress);
+    entry->NameOffset = (ULONG)(Context->Names.String->Length / sizeof(WCHAR));
+    entry->NameLength = NameLength;
+    PhAppendStringBuilderEx(&Context->Names, Name, NameLength * sizeof(WCHAR));
+
+    return TRUE;
+}
+
+static BOOL CALLBACK PhpEnumSymbolIndexCallbackW(
+    _In_ PSYMBOL_INFOW SymbolInfo,
+    _In_ ULONG SymbolSize,
+    _In_opt_ PVOID UserContext
+    )
+{
+    return PhpAddSymbolIndexEntry(UserContext, SymbolInfo->Address, SymbolInfo->Name, SymbolInfo->NameLen);
+}
+
+static BOOL CALLBACK PhpEnumSymbolIndexCallback(
+    _In_ PSYMBOL_INFO SymbolInfo,
+    _In_ ULONG SymbolSize,
+    _In_opt_ PVOID UserContext
+    )
+{
+    BOOLEAN result;
+    PPH_STRING name;
+
+    name = PhConvertMultiByteToUtf16Ex(SymbolInfo->Name, SymbolInfo->NameLen);
+    result = PhpAddSymbolIndexEntry(UserContext, SymbolInfo->Address, name->Buffer, (ULONG)(name->Length / sizeof(WCHAR)));
+    PhDereferenceObject(name);
+
+    return result;
+}
+
+static int __cdecl PhpSymbolIndexEntryCompare(
+    _In_ const void *elem1,
+    _In_ const void *elem2
+    )
+{
+    PPH_SYMBOL_INDEX_ENTRY entry1 = (PPH_SYMBOL_INDEX_ENTRY)elem1;
+    PPH_SYMBOL_INDEX_ENTRY entry2 = (PPH_SYMBOL_INDEX_ENTRY)elem2;
+
+    // The name offset increases in enumeration order, so use it to keep the sort stable.
+    if (entry1->Rva != entry2->Rva)
+        return uintcmp(entry1->Rva, entry2->Rva);
+    else
+        return uintcmp(entry1->NameOffset, entry2->NameOffset);
+}
+
+static BOOLEAN PhpGetModulePdbIdentity(
+    _In_ PPH_SYMBOL_MODULE Module,
+    _Out_ PGUID Signature,
+    _Out_ PULONG Age
+    )
+{
+    BOOLEAN result = FALSE;
+    PH_MAPPED_IMAGE mappedImage;
+    PIMAGE_DATA_DIRECTORY dataDirectory;
+    PIMAGE_DEBUG_DIRECTORY debugDirectory;
+    PPH_CODEVIEW_RSDS codeView;
+    ULONG i;
+
+    if (!NT_SUCCESS(PhLoadMappedImage(Module->FileName->Buffer, NULL, TRUE, &mappedImage)))
+        return FALSE;
+
+    __try
+    {
+        if (NT_SUCCESS(PhGetMappedImageDataEntry(&mappedImage, IMAGE_DIRECTORY_ENTRY_DEBUG, &dataDirectory)) &&
+            (debugDirectory = PhMappedImageRvaToVa(&mappedImage, dataDirectory->VirtualAddress, NULL)))
+        {
+            for (i = 0; i < dataDirectory->Size / sizeof(IMAGE_DEBUG_DIRECTORY); i++)
+            {
+                if (debugDirectory[i].Type != IMAGE_DEBUG_TYPE_CODEVIEW ||
+                    debugDirectory[i].SizeOfData < FIELD_OFFSET(PH_CODEVIEW_RSDS, PdbFileName))
+                    continue;
+
+                codeView = PhMappedImageRvaToVa(&mappedImage, debugDirectory[i].AddressOfRawData, NULL);
+
+                if (codeView && codeView->Magic == PH_CODEVIEW_RSDS_MAGIC)
+                {
+                    *Signature = codeView->Signature;
+                    *Age = codeView->Age;
+                    result = TRUE;
+                    break;
+                }
+            }
+        }
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER)
+    {
+        result = FALSE;
+    }
+
+    PhUnloadMappedImage(&mappedImage);
+
+    return result;
+}
+
+static PPH_STRING PhpGetSymbolIndexCacheFileName(
+    _In_ PPH_SYMBOL_MODULE Module,
+    _In_ PGUID Signature,
+    _In_ ULONG Age
+    )
+{
+    PPH_STRING fileName = NULL;
+    PPH_STRING signatureString;
+
+    PhAcquireQueuedLockShared(&PhpSymbolIndexCacheLock);
+
+    if (PhpSymbolIndexCacheDirectory)
+    {
+        signatureString = PhFormatGuid(Signature);
+        fileName = PhFormatString(
+            L"%s\\%s-%s-%x.phsi",
+            PhpSymbolIndexCacheDirectory->Buffer,
+            &Module->FileName->Buffer[Module->BaseNameIndex],
+            signatureString->Buffer,
+            Age
+            );
+        PhDereferenceObject(signatureString);
+    }
+
+    PhReleaseQueuedLockShared(&PhpSymbolIndexCacheLock);
+
+    return fileName;
+}
+
+static PPH_SYMBOL_INDEX PhpLoadCachedSymbolIndex(
+    _In_ PWSTR FileName,
+    _In_ PGUID Signature,
+    _In_ ULONG Age,
+    _In_ ULONG Flags
+    )
+{
+    PVOID viewBase;
+    SIZE_T size;
+    PPH_SYMBOL_INDEX_FILE_HEADER header;
+    PPH_SYMBOL_INDEX_ENTRY entries;
+    PPH_SYMBOL_INDEX index;
+    ULONG i;
+
+    if (!NT_SUCCESS(PhMapViewOfEntireFile(FileName, NULL, TRUE, &viewBase, &size)))
+        return NULL;
+
+    header = viewBase;
+    entries = PTR_ADD_OFFSET(header, sizeof(PH_SYMBOL_INDEX_FILE_HEADER));
+
+    // Validate the file completely, so that lookups never have to check anything.
+
+    if (size < sizeof(PH_SYMBOL_INDEX_FILE_HEADER) ||
+        header->Magic != PH_SYMBOL_INDEX_FILE_MAGIC ||
+        header->Version != PH_SYMBOL_INDEX_FILE_VERSION ||
+        !IsEqualGUID(&header->Signature, Signature) ||
+        header->Age != Age ||
+        header->Flags != Flags ||
+        header->NumberOfEntries > PH_SYMBOL_INDEX_MAXIMUM_ENTRIES ||
+        header->NamesLength > MAXLONG / sizeof(WCHAR) ||
+        size != sizeof(PH_SYMBOL_INDEX_FILE_HEADER) + (SIZE_T)header->NumberOfEntries * sizeof(PH_SYMBOL_INDEX_ENTRY) +
+        (SIZE_T)header->NamesLength * sizeof(WCHAR))
+    {
+        goto InvalidFile;
+    }
+
+    for (i = 0; i < header->NumberOfEntries; i++)
+    {
+        if (i != 0 && entries[i].Rva <= entries[i - 1].Rva)
+            goto InvalidFile;
+        if (entries[i].NameOffset > header->NamesLength || entries[i].NameLength > header->NamesLength - entries[i].NameOffset)
+            goto InvalidFile;
+    }
+
+    index = PhAllocate(sizeof(PH_SYMBOL_INDEX));
+    index->NumberOfEntries = header->NumberOfEntries;
+    index->NamesLength = header->NamesLength;
+    index->Entries = entries;
+    index->Names = (PWCHAR)&entries[header->NumberOfEntries];
+    index->NamesString = NULL;
+    index->ViewBase = viewBase;
+
+    return index;
+
+InvalidFile:
+    NtUnmapViewOfSection(NtCurrentProcess(), viewBase);
+
+    return NULL;
+}
+
+static VOID PhpSaveCachedSymbolIndex(
+    _In_ PWSTR FileName,
+    _In_ PGUID Signature,
+    _In_ ULONG Age,
+    _In_ ULONG Flags,
+    _In_ PPH_SYMBOL_INDEX Index
+    )
+{
+    NTSTATUS status;
+    HANDLE fileHandle;
+    IO_STATUS_BLOCK isb;
+    PH_SYMBOL_INDEX_FILE_HEADER header;
+
+    status = PhCreateFileWin32(
+        &fileHandle,
+        FileName,
+        FILE_GENERIC_WRITE | DELETE,
+        FILE_ATTRIBUTE_NORMAL,
+        FILE_SHARE_READ,
+        FILE_OVERWRITE_IF,
+        FILE_NON_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT
+        );
+
+    if (!NT_SUCCESS(status))
+        return;
+
+    header.Magic = PH_SYMBOL_INDEX_FILE_MAGIC;
+    header.Version = PH_SYMBOL_INDEX_FILE_VERSION;
+    header.Signature = *Signature;
+    header.Age = Age;
+    header.Flags = Flags;
+    header.NumberOfEntries = Index->NumberOfEntries;
+    header.NamesLength = Index->NamesLength;
+
+    status = NtWriteFile(fileHandle, NULL, NULL, NULL, &isb, &header, sizeof(PH_SYMBOL_INDEX_FILE_HEADER), NULL, NULL);
+
+    if (NT_SUCCESS(status) && Index->NumberOfEntries != 0)
+    {
+        status = NtWriteFile(fileHandle, NULL, NULL, NULL, &isb, Index->Entries,
+            Index->NumberOfEntries * sizeof(PH_SYMBOL_INDEX_ENTRY), NULL, NULL);
+    }
+
+    if (NT_SUCCESS(status) && Index->NamesLength != 0)
+    {
+        status = NtWriteFile(fileHandle, NULL, NULL, NULL, &isb, Index->Names,
+            Index->NamesLength * (ULONG)sizeof(WCHAR), NULL, NULL);
+    }
+
+    if (!NT_SUCCESS(status))
+    {
+        FILE_DISPOSITION_INFORMATION dispositionInfo;
+
+        // Don't leave a truncated file behind.
+        dispositionInfo.DeleteFile = TRUE;
+        NtSetInformationFile(fileHandle, &isb, &dispositionInfo, sizeof(FILE_DISPOSITION_INFORMATION), FileDispositionInformation);
+    }
+
+    NtClose(fileHandle);
+}
+
+static PPH_SYMBOL_INDEX PhpBuildSymbolIndex(
+    _In_ PPH_SYMBOL_PROVIDER SymbolProvider,
+    _In_ PPH_SYMBOL_MODULE Module
+    )
+{
+    PPH_SYMBOL_INDEX index;
+    PH_SYMBOL_INDEX_BUILD_CONTEXT context;
+    BOOL result;
+    ULONG i;
+    ULONG j;
+    GUID signature;
+    ULONG age;
+    ULONG flags;
+    PPH_STRING cacheFileName = NULL;
+    BOOLEAN saveToCache = FALSE;
+
+    if (!SymEnumSymbolsW_I && !SymEnumSymbols_I)
+        return PH_SYMBOL_INDEX_UNAVAILABLE;
+
+    flags = 0;
+
+    if (SymGetOptions_I && (SymGetOptions_I() & SYMOPT_UNDNAME))
+        flags |= PH_SYMBOL_INDEX_FILE_UNDECORATED;
+
+    if (Module->FileName && PhpGetModulePdbIdentity(Module, &signature, &age))
+        cacheFileName = PhpGetSymbolIndexCacheFileName(Module, &signature, age);
+
+    PH_LOCK_SYMBOLS();
+
+    // Someone else may have built the index while we were waiting for the lock.
+    if (index = Module->SymbolIndex)
+    {
+        PH_UNLOCK_SYMBOLS();
+        PhClearReference(&cacheFileName);
+        return index;
+    }
+
+    // A saved index means that dbghelp doesn't have to load the PDB at all.
+    if (cacheFileName && (index = PhpLoadCachedSymbolIndex(cacheFileName->Buffer, &signature, age, flags)))
+        goto PublishIndex;
+
+    context.Module = Module;
+    context.NumberOfEntries = 0;
+    context.AllocatedEntries = 256;
+    context.Entries = PhAllocate(context.AllocatedEntries * sizeof(PH_SYMBOL_INDEX_ENTRY));
+    PhInitializeStringBuilder(&context.Names, 0x1000);
+    context.TooManySymbols = FALSE;
+
+    // This loads the symbols for the module if they were deferred.
+    if (SymEnumSymbolsW_I)
+        result = SymEnumSymbolsW_I(SymbolProvider->ProcessHandle, Module->BaseAddress, L"*", PhpEnumSymbolIndexCallbackW, &context);
+    else
+        result = SymEnumSymbols_I(SymbolProvider->ProcessHandle, Module->BaseAddress, "*", PhpEnumSymbolIndexCallback, &context);
+
+    if (result && !context.TooManySymbols)
+    {
+        qsort(context.Entries, context.NumberOfEntries, sizeof(PH_SYMBOL_INDEX_ENTRY), PhpSymbolIndexEntryCompare);
+
+        index = PhAllocate(sizeof(PH_SYMBOL_INDEX));
+        index->Entries = PhAllocate(max(context.NumberOfEntries, 1) * sizeof(PH_SYMBOL_INDEX_ENTRY));
+        index->NamesString = PhFinalStringBuilderString(&context.Names);
+        index->Names = index->NamesString->Buffer;
+        index->NamesLength = (ULONG)(index->NamesString->Length / sizeof(WCHAR));
+        index->ViewBase = NULL;
+
+        // Keep only the first symbol at each address.
+        for (i = 0, j = 0; i < context.NumberOfEntries; i++)
+        {
+            if (j != 0 && index->Entries[j - 1].Rva == context.Entries[i].Rva)
+                continue;
+
+            index->Entries[j++] = context.Entries[i];
+        }
+
+        index->NumberOfEntries = j;
+
+        // Only save indexes built from the PDB the image refers to. Exports or a mismatched
+        // PDB may be replaced by the real symbols later, for example after the search path
+        // changes.
+        if (cacheFileName && SymGetModuleInfoW64_I)
+        {
+            IMAGEHLP_MODULEW64 moduleInfo;
+
+            memset(&moduleInfo, 0, sizeof(IMAGEHLP_MODULEW64));
+            moduleInfo.SizeOfStruct = sizeof(IMAGEHLP_MODULEW64);
+
+            if (SymGetModuleInfoW64_I(SymbolProvider->ProcessHandle, Module->BaseAddress, &moduleInfo) &&
+                moduleInfo.SymType == SymPdb &&
+                IsEqualGUID(&moduleInfo.PdbSig70, &signature) &&
+                moduleInfo.PdbAge == age)
+            {
+                saveToCache = TRUE;
+            }
+        }
+    }
+    else
+    {
+        PhDeleteStringBuilder(&context.Names);
+        index = PH_SYMBOL_INDEX_UNAVAILABLE;
+    }
+
+    PhFree(context.Entries);
+
+PublishIndex:
+    MemoryBarrier();
+    Module->SymbolIndex = index;
+
+    PH_UNLOCK_SYMBOLS();
+
+    if (saveToCache)
+        PhpSaveCachedSymbolIndex(cacheFileName->Buffer, &signature, age, flags, index);
+
+    PhClearReference(&cacheFileName);
+
+    return index;
+}
+
+/**
+ * Looks up an address in the symbol index of its module, building the index if necessary.
+ *
+ * \return TRUE if the address was resolved using the index, otherwise FALSE if the address
+ * does not belong to a known module or the module could not be indexed.
+ */
+static BOOLEAN PhpLookupSymbolIndex(
+    _In_ PPH_SYMBOL_PROVIDER SymbolProvider,
+    _In_ ULONG64 Address,
+    _Out_ PULONG64 BaseAddress,
+    _Out_ PPH_STRING *FileName,
+    _Out_ PPH_STRING *SymbolName,
+    _Out_ PULONG64 Displacement
+    )
+{
+    PH_SYMBOL_MODULE lookupModule;
+    PPH_AVL_LINKS links;
+    PPH_SYMBOL_MODULE module;
+    LONG result;
+    PPH_SYMBOL_INDEX index;
+    ULONG rva;
+    ULONG low;
+    ULONG high;
+    ULONG mid;
+
+    module = NULL;
+    lookupModule.BaseAddress = Address;
+
+    PhAcquireQueuedLockShared(&SymbolProvider->ModulesListLock);
+
+    links = PhFindElementAvlTree2(&SymbolProvider->ModulesSet, &lookupModule.Links, &result);
+
+    if (links && result < 0)
+        links = PhPredecessorElementAvlTree(links);
+
+    if (links)
+    {
+        module = CONTAINING_RECORD(links, PH_SYMBOL_MODULE, Links);
+
+        if (Address >= module->BaseAddress + module->Size)
+            module = NULL;
+    }
+
+    PhReleaseQueuedLockShared(&SymbolProvider->ModulesListLock);
+
+    if (!module)
+        return FALSE;
+
+    if (!(index = module->SymbolIndex))
+        index = PhpBuildSymbolIndex(SymbolProvider, module);
+
+    if (index == PH_SYMBOL_INDEX_UNAVAILABLE)
+        return FALSE;
+
+    // Find the last symbol at or before the address.
+
+    rva = (ULONG)(Address - module->BaseAddress);
+    low = 0;
+    high = index->NumberOfEntries;
+
+    while (low < high)
+    {
+        mid = low + (high - low) / 2;
+
+        if (index->Entries[mid].Rva <= rva)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    *BaseAddress = module->BaseAddress;
+    PhSetReference(FileName, module->FileName);
+
+    if (low != 0)
+    {
+        PPH_SYMBOL_INDEX_ENTRY entry = &index->Entries[low - 1];
+
+        *SymbolName = PhCreateStringEx(
+            index->Names + entry->NameOffset,
+            entry->NameLength * sizeof(WCHAR)
+            );
+        *Displacement = rva - entry->Rva;
+    }
+    else
+    {
+        *SymbolName = NULL;
+        *Displacement = 0;
+    }
+
+    return TRUE;
+}
+
 VOID PhpSymbolInfoAnsiToUnicode(
     _Out_ PSYMBOL_INFOW SymbolInfoW,
     _In_ PSYMBOL_INFO SymbolInfoA
@@ -548,14 +1142,14 @@ PPH_STRING PhGetSymbolFromAddress(
     _Out_opt_ PULONG64 Displacement
     )
 {
-    PSYMBOL_INFOW symbolInfo;
+    PSYMBOL_INFOW symbolInfo = NULL;
     ULONG nameLength;
     PPH_STRING symbol = NULL;
     PH_SYMBOL_RESOLVE_LEVEL resolveLevel;
-    ULONG64 displacement;
+    ULONG64 displacement = 0;
     PPH_STRING modFileName = NULL;
     PPH_STRING modBaseName = NULL;
-    ULONG64 modBase;
+    ULONG64 modBase = 0;
     PPH_STRING symbolName = NULL;
 
     if (Address == 0)
@@ -570,6 +1164,10 @@ PPH_STRING PhGetSymbolFromAddress(
 
     PhpRegisterSymbolProvider(SymbolProvider);
 
+    // Try the symbol index first, which avoids taking the dbghelp lock.
+    if (PhpLookupSymbolIndex(SymbolProvider, Address, &modBase, &modFileName, &symbolName, &displacement))
+        goto SymbolResolved;
+
     if (!SymFromAddrW_I && !SymFromAddr_I)
         return NULL;
 
@@ -691,6 +1289,10 @@ PPH_STRING PhGetSymbolFromAddress(
         PhReleaseQueuedLockShared(&SymbolProvider->ModulesListLock);
     }
 
+    if (symbolInfo->NameLen != 0)
+        symbolName = PhCreateStringEx(symbolInfo->Name, symbolInfo->NameLen * 2);
+
+SymbolResolved:
     // If we don't have a module name, return an address.
     if (!modFileName)
     {
@@ -707,7 +1309,7 @@ PPH_STRING PhGetSymbolFromAddress(
     // If we have a module name but not a symbol name,
     // return the module plus an offset: module+offset.
 
-    if (symbolInfo->NameLen == 0)
+    if (!symbolName)
     {
         PH_FORMAT format[3];
 
@@ -724,7 +1326,6 @@ PPH_STRING PhGetSymbolFromAddress(
     // If we have everything, return the full symbol
     // name: module!symbol+offset.
 
-    symbolName = PhCreateStringEx(symbolInfo->Name, symbolInfo->NameLen * 2);
     resolveLevel = PhsrlFunction;
 
     if (displacement == 0)
@@ -764,7 +1365,7 @@ CleanupExit:
     PhClearReference(&modFileName);
     PhClearReference(&modBaseName);
     PhClearReference(&symbolName);
-    PhFree(symbolInfo);
+    if (symbolInfo) PhFree(symbolInfo);
 
     return symbol;
 }
@@ -871,6 +1472,9 @@ BOOLEAN PhLoadModuleSymbolProvider(
     if (existingLinks)
         return TRUE;
 
+    if (PhTraceEnabled(PH_TRACE_KEYWORD_SYMBOLS))
+        PhTraceSymbolLoadStart(FileName, BaseAddress);
+
     PH_LOCK_SYMBOLS();
 
     if (SymLoadModuleExW_I)
@@ -904,6 +1508,9 @@ BOOLEAN PhLoadModuleSymbolProvider(
 
     PH_UNLOCK_SYMBOLS();
 
+    if (PhTraceEnabled(PH_TRACE_KEYWORD_SYMBOLS))
+        PhTraceSymbolLoadStop(FileName, BaseAddress, baseAddress != 0);
+
     // Add the module to the list, even if we couldn't load symbols for the module.
 
     PhAcquireQueuedLockExclusive(&SymbolProvider->ModulesListLock);
@@ -987,136 +1594,360 @@ VOID PhSetSearchPathSymbolProvider(
     PH_UNLOCK_SYMBOLS();
 }
 
+/**
+ * Sets the directory used to save symbol indexes between sessions.
+ *
+ * \param Directory An existing directory, or NULL to stop using saved
+ * symbol indexes.
+ */
+VOID PhSetSymbolIndexCacheDirectory(
+    _In_opt_ PWSTR Directory
+    )
+{
+    PPH_STRING directory;
+
+    directory = Directory ? PhCreateString(Directory) : NULL;
+
+    PhAcquireQueuedLockExclusive(&PhpSymbolIndexCacheLock);
+    PhMoveReference(&PhpSymbolIndexCacheDirectory, directory);
+    PhReleaseQueuedLockExclusive(&PhpSymbolIndexCacheLock);
+}
+
 #ifdef _WIN64
 
-NTSTATUS PhpLookupDynamicFunctionTable(
+// Stack walks look up the dynamic function table for every frame. The list of tables in a
+// process is read at most once per snapshot interval, and the function entries of each table
+// are read the first time they are needed. The entries of normal tables are kept across
+// snapshots as long as the table is still registered with the same contents; callback tables
+// are read again for every snapshot because the JIT can change them at any time.
+
+#define PH_FUNCTION_TABLE_SNAPSHOT_INTERVAL 1000 // ms
+#define PH_FUNCTION_TABLE_CACHE_MAXIMUM_PROCESSES 64
+
+typedef struct _PH_FUNCTION_TABLE_CACHE_ENTRY
+{
+    PDYNAMIC_FUNCTION_TABLE Address;
+    DYNAMIC_FUNCTION_TABLE Table;
+    BOOLEAN FunctionsRead;
+    PRUNTIME_FUNCTION Functions;
+    ULONG NumberOfFunctions;
+} PH_FUNCTION_TABLE_CACHE_ENTRY, *PPH_FUNCTION_TABLE_CACHE_ENTRY;
+
+typedef struct _PH_FUNCTION_TABLE_CACHE
+{
+    ULONG64 SnapshotTime;
+    ULONG NumberOfTables;
+    PPH_FUNCTION_TABLE_CACHE_ENTRY Tables;
+} PH_FUNCTION_TABLE_CACHE, *PPH_FUNCTION_TABLE_CACHE;
+
+static PPH_HASHTABLE PhpFunctionTableCacheHashtable = NULL; // process handle to PPH_FUNCTION_TABLE_CACHE
+static PH_QUEUED_LOCK PhpFunctionTableCacheLock = PH_QUEUED_LOCK_INIT;
+
+NTSTATUS PhpAccessCallbackFunctionTable(
     _In_ HANDLE ProcessHandle,
-    _In_ ULONG64 Address,
-    _Out_opt_ PDYNAMIC_FUNCTION_TABLE *FunctionTableAddress,
-    _Out_opt_ PDYNAMIC_FUNCTION_TABLE FunctionTable,
-    _Out_writes_bytes_opt_(OutOfProcessCallbackDllBufferSize) PWCHAR OutOfProcessCallbackDllBuffer,
-    _In_ ULONG OutOfProcessCallbackDllBufferSize,
-    _Out_opt_ PUNICODE_STRING OutOfProcessCallbackDllString
+    _In_ PVOID FunctionTableAddress,
+    _In_ PUNICODE_STRING OutOfProcessCallbackDllString,
+    _Out_ PRUNTIME_FUNCTION *Functions,
+    _Out_ PULONG NumberOfFunctions
+    );
+
+NTSTATUS PhpAccessNormalFunctionTable(
+    _In_ HANDLE ProcessHandle,
+    _In_ PDYNAMIC_FUNCTION_TABLE FunctionTable,
+    _Out_ PRUNTIME_FUNCTION *Functions,
+    _Out_ PULONG NumberOfFunctions
+    );
+
+static VOID PhpFreeFunctionTableCacheEntry(
+    _In_ PPH_FUNCTION_TABLE_CACHE_ENTRY Entry
+    )
+{
+    if (Entry->Functions)
+    {
+        if (Entry->Table.Type == RF_CALLBACK)
+            RtlFreeHeap(RtlProcessHeap(), 0, Entry->Functions);
+        else
+            PhFreePage(Entry->Functions);
+
+        Entry->Functions = NULL;
+    }
+}
+
+static VOID PhpFreeFunctionTableCache(
+    _In_ PPH_FUNCTION_TABLE_CACHE Cache
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < Cache->NumberOfTables; i++)
+        PhpFreeFunctionTableCacheEntry(&Cache->Tables[i]);
+
+    if (Cache->Tables)
+        PhFree(Cache->Tables);
+
+    PhFree(Cache);
+}
+
+static VOID PhpReadDynamicFunctionTables(
+    _In_ HANDLE ProcessHandle,
+    _Inout_ PPH_FUNCTION_TABLE_CACHE Cache,
+    _In_opt_ PPH_FUNCTION_TABLE_CACHE OldCache
     )
 {
-    NTSTATUS status;
     PLIST_ENTRY (NTAPI *rtlGetFunctionTableListHead)(VOID);
     PLIST_ENTRY tableListHead;
     LIST_ENTRY tableListHeadEntry;
     PLIST_ENTRY tableListEntry;
-    PDYNAMIC_FUNCTION_TABLE functionTableAddress;
-    DYNAMIC_FUNCTION_TABLE functionTable;
+    PPH_FUNCTION_TABLE_CACHE_ENTRY entry;
+    ULONG allocatedTables;
     ULONG count;
-    SIZE_T numberOfBytesRead;
     ULONG i;
-    BOOLEAN foundNull;
+
+    Cache->NumberOfTables = 0;
+    Cache->Tables = NULL;
 
     rtlGetFunctionTableListHead = PhGetModuleProcAddress(L"ntdll.dll", "RtlGetFunctionTableListHead");
 
     if (!rtlGetFunctionTableListHead)
-        return STATUS_PROCEDURE_NOT_FOUND;
+        return;
 
     tableListHead = rtlGetFunctionTableListHead();
 
-    // Find the function table entry for this address.
-
-    if (!NT_SUCCESS(status = PhReadVirtualMemory(
+    if (!NT_SUCCESS(PhReadVirtualMemory(
         ProcessHandle,
         tableListHead,
         &tableListHeadEntry,
         sizeof(LIST_ENTRY),
         NULL
         )))
-        return status;
+        return;
+
+    allocatedTables = 16;
+    Cache->Tables = PhAllocate(allocatedTables * sizeof(PH_FUNCTION_TABLE_CACHE_ENTRY));
 
     tableListEntry = tableListHeadEntry.Flink;
     count = 0; // make sure we can't be forced into an infinite loop by crafted data
 
     while (tableListEntry != tableListHead && count < PH_ENUM_PROCESS_MODULES_LIMIT)
     {
-        functionTableAddress = CONTAINING_RECORD(tableListEntry, DYNAMIC_FUNCTION_TABLE, ListEntry);
+        if (Cache->NumberOfTables == allocatedTables)
+        {
+            allocatedTables *= 2;
+            Cache->Tables = PhReAllocate(Cache->Tables, allocatedTables * sizeof(PH_FUNCTION_TABLE_CACHE_ENTRY));
+        }
+
+        entry = &Cache->Tables[Cache->NumberOfTables];
+        entry->Address = CONTAINING_RECORD(tableListEntry, DYNAMIC_FUNCTION_TABLE, ListEntry);
+        entry->FunctionsRead = FALSE;
+        entry->Functions = NULL;
+        entry->NumberOfFunctions = 0;
 
-        if (!NT_SUCCESS(status = PhReadVirtualMemory(
+        if (!NT_SUCCESS(PhReadVirtualMemory(
             ProcessHandle,
-            functionTableAddress,
-            &functionTable,
+            entry->Address,
+            &entry->Table,
             sizeof(DYNAMIC_FUNCTION_TABLE),
             NULL
             )))
-            return status;
+            break;
 
-        if (Address >= functionTable.MinimumAddress && Address < functionTable.MaximumAddress)
+        Cache->NumberOfTables++;
+        tableListEntry = entry->Table.ListEntry.Flink;
+        count++;
+
+        if (!OldCache || entry->Table.Type == RF_CALLBACK)
+            continue;
+
+        // Keep the function entries if this table hasn't changed since the last snapshot.
+        for (i = 0; i < OldCache->NumberOfTables; i++)
         {
-            if (OutOfProcessCallbackDllBuffer)
+            PPH_FUNCTION_TABLE_CACHE_ENTRY oldEntry = &OldCache->Tables[i];
+
+            if (oldEntry->Functions &&
+                oldEntry->Address == entry->Address &&
+                oldEntry->Table.Type == entry->Table.Type &&
+                oldEntry->Table.FunctionTable == entry->Table.FunctionTable &&
+                oldEntry->Table.EntryCount == entry->Table.EntryCount &&
+                oldEntry->Table.BaseAddress == entry->Table.BaseAddress &&
+                oldEntry->Table.MinimumAddress == entry->Table.MinimumAddress &&
+                oldEntry->Table.MaximumAddress == entry->Table.MaximumAddress)
             {
-                if (functionTable.OutOfProcessCallbackDll)
-                {
-                    // Read the out-of-process callback DLL path. We don't have a length, so we'll
-                    // just have to read as much as possible.
-
-                    memset(OutOfProcessCallbackDllBuffer, 0xff, OutOfProcessCallbackDllBufferSize);
-                    status = PhReadVirtualMemory(
-                        ProcessHandle,
-                        functionTable.OutOfProcessCallbackDll,
-                        OutOfProcessCallbackDllBuffer,
-                        OutOfProcessCallbackDllBufferSize,
-                        &numberOfBytesRead
-                        );
-
-                    if (status != STATUS_PARTIAL_COPY && !NT_SUCCESS(status))
-                        return status;
-
-                    foundNull = FALSE;
-
-                    for (i = 0; i < OutOfProcessCallbackDllBufferSize / sizeof(WCHAR); i++)
-                    {
-                        if (OutOfProcessCallbackDllBuffer[i] == 0)
-                        {
-                            foundNull = TRUE;
-
-                            if (OutOfProcessCallbackDllString)
-                            {
-                                OutOfProcessCallbackDllString->Buffer = OutOfProcessCallbackDllBuffer;
-                                OutOfProcessCallbackDllString->Length = (USHORT)(i * sizeof(WCHAR));
-                                OutOfProcessCallbackDllString->MaximumLength = OutOfProcessCallbackDllString->Length;
-                            }
-
-                            break;
-                        }
-                    }
-
-                    // If there was no null terminator, then we didn't read the whole string in.
-                    // Fail the operation.
-                    if (!foundNull)
-                        return STATUS_BUFFER_OVERFLOW;
-                }
-                else
-                {
-                    OutOfProcessCallbackDllBuffer[0] = 0;
-
-                    if (OutOfProcessCallbackDllString)
-                    {
-                        OutOfProcessCallbackDllString->Buffer = NULL;
-                        OutOfProcessCallbackDllString->Length = 0;
-                        OutOfProcessCallbackDllString->MaximumLength = 0;
-                    }
-                }
+                entry->FunctionsRead = TRUE;
+                entry->Functions = oldEntry->Functions;
+                entry->NumberOfFunctions = oldEntry->NumberOfFunctions;
+                oldEntry->Functions = NULL;
+                break;
             }
+        }
+    }
+}
+
+/**
+ * Gets the current function table snapshot of a process. The function table cache lock must
+ * be held exclusively.
+ */
+static PPH_FUNCTION_TABLE_CACHE PhpGetFunctionTableCache(
+    _In_ HANDLE ProcessHandle
+    )
+{
+    PPH_FUNCTION_TABLE_CACHE cache;
+    PPH_FUNCTION_TABLE_CACHE oldCache;
+    ULONG64 tickCount;
+
+    if (!PhpFunctionTableCacheHashtable)
+        PhpFunctionTableCacheHashtable = PhCreateSimpleHashtable(8);
+
+    tickCount = NtGetTickCount64();
+    oldCache = PhFindItemSimpleHashtable2(PhpFunctionTableCacheHashtable, ProcessHandle);
+
+    if (oldCache && tickCount - oldCache->SnapshotTime < PH_FUNCTION_TABLE_SNAPSHOT_INTERVAL)
+        return oldCache;
+
+    if (!oldCache && PhpFunctionTableCacheHashtable->Count >= PH_FUNCTION_TABLE_CACHE_MAXIMUM_PROCESSES)
+    {
+        PPH_KEY_VALUE_PAIR pair;
+        ULONG enumerationKey = 0;
+
+        // Too many processes. Someone isn't flushing their handles, so start again.
+        while (PhEnumHashtable(PhpFunctionTableCacheHashtable, &pair, &enumerationKey))
+            PhpFreeFunctionTableCache(pair->Value);
+
+        PhClearHashtable(PhpFunctionTableCacheHashtable);
+    }
+
+    cache = PhAllocate(sizeof(PH_FUNCTION_TABLE_CACHE));
+    cache->SnapshotTime = tickCount;
+    PhpReadDynamicFunctionTables(ProcessHandle, cache, oldCache);
+
+    if (oldCache)
+    {
+        PhRemoveItemSimpleHashtable(PhpFunctionTableCacheHashtable, ProcessHandle);
+        PhpFreeFunctionTableCache(oldCache);
+    }
 
-            if (FunctionTableAddress)
-                *FunctionTableAddress = functionTableAddress;
+    PhAddItemSimpleHashtable(PhpFunctionTableCacheHashtable, ProcessHandle, cache);
 
-            if (FunctionTable)
-                *FunctionTable = functionTable;
+    return cache;
+}
+
+static PPH_FUNCTION_TABLE_CACHE_ENTRY PhpFindFunctionTableCacheEntry(
+    _In_ PPH_FUNCTION_TABLE_CACHE Cache,
+    _In_ ULONG64 Address
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < Cache->NumberOfTables; i++)
+    {
+        if (Address >= Cache->Tables[i].Table.MinimumAddress && Address < Cache->Tables[i].Table.MaximumAddress)
+            return &Cache->Tables[i];
+    }
 
-            return STATUS_SUCCESS;
+    return NULL;
+}
+
+static NTSTATUS PhpReadFunctionTableCacheEntry(
+    _In_ HANDLE ProcessHandle,
+    _Inout_ PPH_FUNCTION_TABLE_CACHE_ENTRY Entry
+    )
+{
+    NTSTATUS status;
+
+    if (Entry->FunctionsRead)
+        return Entry->Functions ? STATUS_SUCCESS : STATUS_NOT_FOUND;
+
+    Entry->FunctionsRead = TRUE;
+
+    if (Entry->Table.Type == RF_CALLBACK)
+    {
+        WCHAR outOfProcessCallbackDll[512];
+        UNICODE_STRING outOfProcessCallbackDllString;
+        SIZE_T numberOfBytesRead;
+        ULONG i;
+
+        if (!Entry->Table.OutOfProcessCallbackDll)
+            return STATUS_INVALID_PARAMETER;
+
+        // Read the out-of-process callback DLL path. We don't have a length, so we'll just have
+        // to read as much as possible.
+
+        memset(outOfProcessCallbackDll, 0xff, sizeof(outOfProcessCallbackDll));
+        status = PhReadVirtualMemory(
+            ProcessHandle,
+            Entry->Table.OutOfProcessCallbackDll,
+            outOfProcessCallbackDll,
+            sizeof(outOfProcessCallbackDll),
+            &numberOfBytesRead
+            );
+
+        if (status != STATUS_PARTIAL_COPY && !NT_SUCCESS(status))
+            return status;
+
+        // If there is no null terminator, then we didn't read the whole string in. Fail the
+        // operation.
+        status = STATUS_BUFFER_OVERFLOW;
+
+        for (i = 0; i < RTL_NUMBER_OF(outOfProcessCallbackDll); i++)
+        {
+            if (outOfProcessCallbackDll[i] == 0)
+            {
+                outOfProcessCallbackDllString.Buffer = outOfProcessCallbackDll;
+                outOfProcessCallbackDllString.Length = (USHORT)(i * sizeof(WCHAR));
+                outOfProcessCallbackDllString.MaximumLength = outOfProcessCallbackDllString.Length;
+                status = STATUS_SUCCESS;
+                break;
+            }
         }
 
-        tableListEntry = functionTable.ListEntry.Flink;
-        count++;
+        if (!NT_SUCCESS(status))
+            return status;
+
+        status = PhpAccessCallbackFunctionTable(
+            ProcessHandle,
+            Entry->Address,
+            &outOfProcessCallbackDllString,
+            &Entry->Functions,
+            &Entry->NumberOfFunctions
+            );
     }
+    else
+    {
+        status = PhpAccessNormalFunctionTable(
+            ProcessHandle,
+            &Entry->Table,
+            &Entry->Functions,
+            &Entry->NumberOfFunctions
+            );
+    }
+
+    if (!NT_SUCCESS(status))
+        Entry->Functions = NULL;
+
+    return status;
+}
+
+/**
+ * Discards the cached function tables of a process.
+ *
+ * \param ProcessHandle The handle that was used for stack walks. This must be called before
+ * the handle is closed.
+ */
+VOID PhpFlushFunctionTableCache(
+    _In_ HANDLE ProcessHandle
+    )
+{
+    PPH_FUNCTION_TABLE_CACHE cache;
 
-    return STATUS_NOT_FOUND;
+    PhAcquireQueuedLockExclusive(&PhpFunctionTableCacheLock);
+
+    if (PhpFunctionTableCacheHashtable &&
+        (cache = PhFindItemSimpleHashtable2(PhpFunctionTableCacheHashtable, ProcessHandle)))
+    {
+        PhRemoveItemSimpleHashtable(PhpFunctionTableCacheHashtable, ProcessHandle);
+        PhpFreeFunctionTableCache(cache);
+    }
+
+    PhReleaseQueuedLockExclusive(&PhpFunctionTableCacheLock);
 }
 
 PRUNTIME_FUNCTION PhpLookupFunctionEntry(
@@ -1265,71 +2096,38 @@ NTSTATUS PhAccessOutOfProcessFunctionEntry(
     )
 {
     NTSTATUS status;
-    PDYNAMIC_FUNCTION_TABLE functionTableAddress;
-    DYNAMIC_FUNCTION_TABLE functionTable;
-    WCHAR outOfProcessCallbackDll[512];
-    UNICODE_STRING outOfProcessCallbackDllString;
-    PRUNTIME_FUNCTION functions;
-    ULONG numberOfFunctions;
+    PPH_FUNCTION_TABLE_CACHE cache;
+    PPH_FUNCTION_TABLE_CACHE_ENTRY entry;
     PRUNTIME_FUNCTION function;
 
-    if (!NT_SUCCESS(status = PhpLookupDynamicFunctionTable(
-        ProcessHandle,
-        ControlPc,
-        &functionTableAddress,
-        &functionTable,
-        outOfProcessCallbackDll,
-        sizeof(outOfProcessCallbackDll),
-        &outOfProcessCallbackDllString
-        )))
-    {
-        return status;
-    }
+    PhAcquireQueuedLockExclusive(&PhpFunctionTableCacheLock);
 
-    if (functionTable.Type == RF_CALLBACK)
+    cache = PhpGetFunctionTableCache(ProcessHandle);
+
+    if (entry = PhpFindFunctionTableCacheEntry(cache, ControlPc))
     {
-        if (!NT_SUCCESS(status = PhpAccessCallbackFunctionTable(
-            ProcessHandle,
-            functionTableAddress,
-            &outOfProcessCallbackDllString,
-            &functions,
-            &numberOfFunctions
-            )))
+        if (NT_SUCCESS(status = PhpReadFunctionTableCacheEntry(ProcessHandle, entry)))
         {
-            return status;
-        }
-
-        function = PhpLookupFunctionEntry(functions, numberOfFunctions, FALSE, ControlPc - functionTable.BaseAddress);
-
-        if (function)
-            *Function = *function;
-        else
-            status = STATUS_NOT_FOUND;
+            function = PhpLookupFunctionEntry(
+                entry->Functions,
+                entry->NumberOfFunctions,
+                entry->Table.Type == RF_SORTED,
+                ControlPc - entry->Table.BaseAddress
+                );
 
-        RtlFreeHeap(RtlProcessHeap(), 0, functions);
+            if (function)
+                *Function = *function;
+            else
+                status = STATUS_NOT_FOUND;
+        }
     }
     else
     {
-        if (!NT_SUCCESS(status = PhpAccessNormalFunctionTable(
-            ProcessHandle,
-            &functionTable,
-            &functions,
-            &numberOfFunctions
-            )))
-        {
-            return status;
-        }
-
-        function = PhpLookupFunctionEntry(functions, numberOfFunctions, functionTable.Type == RF_SORTED, ControlPc - functionTable.BaseAddress);
-
-        if (function)
-            *Function = *function;
-        else
-            status = STATUS_NOT_FOUND;
-
-        PhFreePage(functions);
+        status = STATUS_NOT_FOUND;
     }
 
+    PhReleaseQueuedLockExclusive(&PhpFunctionTableCacheLock);
+
     return status;
 }
 
@@ -1342,26 +2140,18 @@ ULONG64 __stdcall PhGetModuleBase64(
 {
     ULONG64 base;
 #ifdef _WIN64
-    DYNAMIC_FUNCTION_TABLE functionTable;
+    PPH_FUNCTION_TABLE_CACHE_ENTRY entry;
 #endif
 
 #ifdef _WIN64
-    if (NT_SUCCESS(PhpLookupDynamicFunctionTable(
-        hProcess,
-        dwAddr,
-        NULL,
-        &functionTable,
-        NULL,
-        0,
-        NULL
-        )))
-    {
-        base = functionTable.BaseAddress;
-    }
+    PhAcquireQueuedLockExclusive(&PhpFunctionTableCacheLock);
+
+    if (entry = PhpFindFunctionTableCacheEntry(PhpGetFunctionTableCache(hProcess), dwAddr))
+        base = entry->Table.BaseAddress;
     else
-    {
         base = 0;
-    }
+
+    PhReleaseQueuedLockExclusive(&PhpFunctionTableCacheLock);
 #else
     base = 0;
 #endif
@@ -1787,3 +2577,134 @@ ResumeExit:
 
     return status;
 }
+
+/**
+ * Captures the stacks of all threads in a process.
+ *
+ * \param ProcessHandle A handle to a process. The handle can have
+ * any access.
+ * \param Flags A combination of flags.
+ * \li \c PH_WALK_KERNEL_STACK Includes kernel-mode frames.
+ * \li \c PH_WALK_I386_STACK, \c PH_WALK_AMD64_STACK Includes
+ * user-mode frames. These are the frames of the native user-mode
+ * stack; for WOW64 processes they end in the WOW64 layer.
+ * \param Callback A callback function which is executed
+ * for each stack frame.
+ * \param Context A user-defined value to pass to the
+ * callback function.
+ *
+ * \remarks This function requires an active KProcessHacker
+ * connection. The stacks of all threads are captured by the driver
+ * in a single request, without suspending the threads. The frames
+ * only contain the PC address, so callers should use
+ * PhWalkThreadStack() if they need frame or parameter information.
+ */
+NTSTATUS PhWalkProcessStacks(
+    _In_ HANDLE ProcessHandle,
+    _In_ ULONG Flags,
+    _In_ PPH_WALK_PROCESS_STACK_CALLBACK Callback,
+    _In_opt_ PVOID Context
+    )
+{
+    static ULONG initialBufferSize = 0x10000;
+
+    NTSTATUS status;
+    PVOID buffer;
+    ULONG bufferSize;
+    ULONG returnLength;
+    ULONG attempts;
+    PKPH_THREAD_BACKTRACE entry;
+    PH_THREAD_STACK_FRAME threadStackFrame;
+    ULONG i;
+
+    if (!KphIsConnected())
+        return STATUS_NOT_SUPPORTED;
+
+    bufferSize = initialBufferSize;
+    buffer = PhAllocate(bufferSize);
+    attempts = 8;
+
+    while (TRUE)
+    {
+        // 62 limit for XP and Server 2003, as in PhWalkThreadStack.
+        status = KphCaptureStackBackTraceProcess(
+            ProcessHandle,
+            1,
+            62 - 1,
+            buffer,
+            bufferSize,
+            &returnLength
+            );
+
+        if (status != STATUS_BUFFER_TOO_SMALL || --attempts == 0)
+            break;
+
+        PhFree(buffer);
+        bufferSize = returnLength;
+        buffer = PhAllocate(bufferSize);
+    }
+
+    if (!NT_SUCCESS(status))
+    {
+        PhFree(buffer);
+        return status;
+    }
+
+    if (bufferSize <= 0x200000)
+        initialBufferSize = bufferSize;
+
+    if (returnLength == 0)
+    {
+        PhFree(buffer);
+        return STATUS_SUCCESS;
+    }
+
+    memset(&threadStackFrame, 0, sizeof(PH_THREAD_STACK_FRAME));
+    entry = buffer;
+
+    while (TRUE)
+    {
+        if (NT_SUCCESS(entry->Status))
+        {
+            if (Flags & PH_WALK_KERNEL_STACK)
+            {
+                threadStackFrame.Flags = PH_THREAD_STACK_FRAME_KERNEL;
+
+                for (i = 0; i < entry->NumberOfKernelFrames; i++)
+                {
+                    threadStackFrame.PcAddress = entry->Frames[i];
+
+                    if (!Callback(entry->ThreadId, &threadStackFrame, Context))
+                        goto CleanupExit;
+                }
+            }
+
+            if (Flags & (PH_WALK_I386_STACK | PH_WALK_AMD64_STACK))
+            {
+#ifdef _WIN64
+                threadStackFrame.Flags = PH_THREAD_STACK_FRAME_AMD64;
+#else
+                threadStackFrame.Flags = PH_THREAD_STACK_FRAME_I386;
+#endif
+
+                for (i = 0; i < entry->NumberOfUserFrames; i++)
+                {
+                    threadStackFrame.PcAddress = entry->Frames[entry->NumberOfKernelFrames + i];
+
+                    if (!Callback(entry->ThreadId, &threadStackFrame, Context))
+                        goto CleanupExit;
+                }
+            }
+        }
+
+        if (entry->NextEntryOffset == 0)
+            break;
+
+        entry = PTR_ADD_OFFSET(entry, entry->NextEntryOffset);
+    }
+
+CleanupExit:
+    PhFree(buffer);
+
+    return STATUS_SUCCESS;
+}
@@ -0,0 +1,365 @@
+/*
+ * Process Hacker -
+ *   self-tracing ETW provider
+ *
+ * Copyright (C) 2016 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Events are written in the TraceLogging format: each event carries the provider name and
+ * a description of its own fields, so tools can decode them without a manifest. We build
+ * the metadata ourselves instead of using TraceLoggingProvider.h, because its macros import
+ * EventRegister and EventWriteTransfer from advapi32, which do not exist on Windows XP. The
+ * ETW functions are imported from ntdll at run time instead, and tracing is simply not
+ * available on systems without them.
+ *
+ * Start and stop events use the start and stop opcodes, so that WPA can pair them up into
+ * regions on each thread.
+ */
+
+#include <phbase.h>
+#include <apiimport.h>
+
+#define PH_TRACE_PROVIDER_NAME "ProcessHacker"
+#define PH_TRACE_CHANNEL_TRACELOGGING 11
+#define PH_TRACE_LEVEL_INFORMATION 4
+#define PH_TRACE_OPCODE_START 1
+#define PH_TRACE_OPCODE_STOP 2
+
+#define PH_TRACE_DATA_DESCRIPTOR_EVENT_METADATA 1
+#define PH_TRACE_DATA_DESCRIPTOR_PROVIDER_METADATA 2
+
+// TDH_INTYPE values
+#define PH_TRACE_TYPE_UNICODESTRING 1
+#define PH_TRACE_TYPE_UINT32 8
+#define PH_TRACE_TYPE_BOOLEAN 13
+#define PH_TRACE_TYPE_POINTER 16
+#define PH_TRACE_TYPE_HEXINT32 20
+#define PH_TRACE_TYPE_HEXINT64 21
+
+#define PH_TRACE_MAXIMUM_FIELDS 4
+#define PH_TRACE_METADATA_SIZE 128
+
+typedef struct _PH_TRACE_FIELD
+{
+    PSTR Name;
+    UCHAR Type;
+    PVOID Data;
+    ULONG Size;
+} PH_TRACE_FIELD, *PPH_TRACE_FIELD;
+
+ULONG64 PhTraceKeywords = 0;
+
+// {62134317-8f4c-5c63-a9ad-52661cfd4eaa}
+static GUID PhpTraceProviderGuid = { 0x62134317, 0x8f4c, 0x5c63, { 0xa9, 0xad, 0x52, 0x66, 0x1c, 0xfd, 0x4e, 0xaa } };
+static REGHANDLE PhpTraceRegHandle = 0;
+static UCHAR PhpTraceProviderMetadata[sizeof(USHORT) + sizeof(PH_TRACE_PROVIDER_NAME)];
+
+static VOID NTAPI PhpTraceEnableCallback(
+    _In_ LPCGUID SourceId,
+    _In_ ULONG IsEnabled,
+    _In_ UCHAR Level,
+    _In_ ULONGLONG MatchAnyKeyword,
+    _In_ ULONGLONG MatchAllKeyword,
+    _In_opt_ PEVENT_FILTER_DESCRIPTOR FilterData,
+    _Inout_opt_ PVOID CallbackContext
+    )
+{
+    switch (IsEnabled)
+    {
+    case EVENT_CONTROL_CODE_ENABLE_PROVIDER:
+        // All of our events are informational, and a keyword mask of 0 means that the session
+        // wants everything.
+        if (Level == 0 || Level >= PH_TRACE_LEVEL_INFORMATION)
+            PhTraceKeywords = MatchAnyKeyword != 0 ? MatchAnyKeyword : MAXULONG64;
+        else
+            PhTraceKeywords = 0;
+        break;
+    case EVENT_CONTROL_CODE_DISABLE_PROVIDER:
+        PhTraceKeywords = 0;
+        break;
+    }
+}
+
+/**
+ * Registers the ETW provider.
+ */
+VOID PhInitializeTrace(
+    VOID
+    )
+{
+    _EtwEventRegister etwEventRegister;
+    _EtwEventSetInformation etwEventSetInformation;
+
+    if (!(etwEventRegister = EtwEventRegister_Import()))
+        return;
+
+    *(PUSHORT)PhpTraceProviderMetadata = sizeof(PhpTraceProviderMetadata);
+    memcpy(&PhpTraceProviderMetadata[sizeof(USHORT)], PH_TRACE_PROVIDER_NAME, sizeof(PH_TRACE_PROVIDER_NAME));
+
+    if (etwEventRegister(&PhpTraceProviderGuid, PhpTraceEnableCallback, NULL, &PhpTraceRegHandle) != ERROR_SUCCESS)
+    {
+        PhpTraceRegHandle = 0;
+        return;
+    }
+
+    // On Windows 8 and above we can give ETW the provider traits once. Older versions only
+    // see the copy that is included with every event.
+    if (etwEventSetInformation = EtwEventSetInformation_Import())
+    {
+        etwEventSetInformation(
+            PhpTraceRegHandle,
+            EventProviderSetTraits,
+            PhpTraceProviderMetadata,
+            sizeof(PhpTraceProviderMetadata)
+            );
+    }
+}
+
+static VOID PhpAppendTraceMetadata(
+    _Inout_ PUCHAR Metadata,
+    _Inout_ PUSHORT Length,
+    _In_ PSTR String
+    )
+{
+    SIZE_T size;
+
+    size = strlen(String) + 1;
+
+    if (*Length + size <= PH_TRACE_METADATA_SIZE)
+    {
+        memcpy(&Metadata[*Length], String, size);
+        *Length += (USHORT)size;
+    }
+}
+
+/**
+ * Writes an event.
+ *
+ * \param Name The name of the event.
+ * \param Opcode The opcode of the event.
+ * \param Keyword The keyword of the event.
+ * \param NumberOfFields The number of fields.
+ * \param Fields The names, types and values of the fields.
+ */
+static VOID PhpWriteTraceEvent(
+    _In_ PSTR Name,
+    _In_ UCHAR Opcode,
+    _In_ ULONG64 Keyword,
+    _In_ ULONG NumberOfFields,
+    _In_reads_(NumberOfFields) PPH_TRACE_FIELD Fields
+    )
+{
+    _EtwEventWriteTransfer etwEventWriteTransfer;
+    EVENT_DESCRIPTOR eventDescriptor;
+    EVENT_DATA_DESCRIPTOR dataDescriptors[2 + PH_TRACE_MAXIMUM_FIELDS];
+    UCHAR metadata[PH_TRACE_METADATA_SIZE];
+    USHORT metadataLength;
+    ULONG i;
+
+    if (!PhpTraceRegHandle || !(etwEventWriteTransfer = EtwEventWriteTransfer_Import()))
+        return;
+
+    assert(NumberOfFields <= PH_TRACE_MAXIMUM_FIELDS);
+
+    // The event metadata is the total size, the tags (none), the event name, and the name
+    // and type of each field.
+    metadataLength = sizeof(USHORT);
+    metadata[metadataLength++] = 0;
+    PhpAppendTraceMetadata(metadata, &metadataLength, Name);
+
+    for (i = 0; i < NumberOfFields; i++)
+    {
+        PhpAppendTraceMetadata(metadata, &metadataLength, Fields[i].Name);
+
+        if (metadataLength < PH_TRACE_METADATA_SIZE)
+            metadata[metadataLength++] = Fields[i].Type;
+    }
+
+    *(PUSHORT)metadata = metadataLength;
+
+    EventDescCreate(&eventDescriptor, 0, 0, PH_TRACE_CHANNEL_TRACELOGGING, PH_TRACE_LEVEL_INFORMATION, 0, Opcode, Keyword);
+
+    EventDataDescCreate(&dataDescriptors[0], PhpTraceProviderMetadata, sizeof(PhpTraceProviderMetadata));
+    dataDescriptors[0].Reserved = PH_TRACE_DATA_DESCRIPTOR_PROVIDER_METADATA;
+    EventDataDescCreate(&dataDescriptors[1], metadata, metadataLength);
+    dataDescriptors[1].Reserved = PH_TRACE_DATA_DESCRIPTOR_EVENT_METADATA;
+
+    for (i = 0; i < NumberOfFields; i++)
+        EventDataDescCreate(&dataDescriptors[2 + i], Fields[i].Data, Fields[i].Size);
+
+    etwEventWriteTransfer(PhpTraceRegHandle, &eventDescriptor, NULL, NULL, 2 + NumberOfFields, dataDescriptors);
+}
+
+FORCEINLINE VOID PhpInitializeTraceField(
+    _Out_ PPH_TRACE_FIELD Field,
+    _In_ PSTR Name,
+    _In_ UCHAR Type,
+    _In_ PVOID Data,
+    _In_ ULONG Size
+    )
+{
+    Field->Name = Name;
+    Field->Type = Type;
+    Field->Data = Data;
+    Field->Size = Size;
+}
+
+FORCEINLINE VOID PhpInitializeTraceStringField(
+    _Out_ PPH_TRACE_FIELD Field,
+    _In_ PSTR Name,
+    _In_ PWSTR String
+    )
+{
+    PhpInitializeTraceField(Field, Name, PH_TRACE_TYPE_UNICODESTRING, String, (ULONG)(PhCountStringZ(String) + 1) * sizeof(WCHAR));
+}
+
+VOID PhTraceProviderRunStart(
+    _In_ PVOID Function
+    )
+{
+    PH_TRACE_FIELD fields[1];
+
+    PhpInitializeTraceField(&fields[0], "Function", PH_TRACE_TYPE_POINTER, &Function, sizeof(PVOID));
+    PhpWriteTraceEvent("ProviderRun", PH_TRACE_OPCODE_START, PH_TRACE_KEYWORD_PROVIDER, 1, fields);
+}
+
+VOID PhTraceProviderRunStop(
+    _In_ PVOID Function
+    )
+{
+    PH_TRACE_FIELD fields[1];
+
+    PhpInitializeTraceField(&fields[0], "Function", PH_TRACE_TYPE_POINTER, &Function, sizeof(PVOID));
+    PhpWriteTraceEvent("ProviderRun", PH_TRACE_OPCODE_STOP, PH_TRACE_KEYWORD_PROVIDER, 1, fields);
+}
+
+VOID PhTraceWorkItemStart(
+    _In_ PVOID Function,
+    _In_opt_ PVOID Context
+    )
+{
+    PH_TRACE_FIELD fields[2];
+
+    PhpInitializeTraceField(&fields[0], "Function", PH_TRACE_TYPE_POINTER, &Function, sizeof(PVOID));
+    PhpInitializeTraceField(&fields[1], "Context", PH_TRACE_TYPE_POINTER, &Context, sizeof(PVOID));
+    PhpWriteTraceEvent("WorkItem", PH_TRACE_OPCODE_START, PH_TRACE_KEYWORD_WORK_QUEUE, 2, fields);
+}
+
+VOID PhTraceWorkItemStop(
+    _In_ PVOID Function,
+    _In_ NTSTATUS Status
+    )
+{
+    PH_TRACE_FIELD fields[2];
+
+    PhpInitializeTraceField(&fields[0], "Function", PH_TRACE_TYPE_POINTER, &Function, sizeof(PVOID));
+    PhpInitializeTraceField(&fields[1], "Status", PH_TRACE_TYPE_HEXINT32, &Status, sizeof(NTSTATUS));
+    PhpWriteTraceEvent("WorkItem", PH_TRACE_OPCODE_STOP, PH_TRACE_KEYWORD_WORK_QUEUE, 2, fields);
+}
+
+VOID PhTraceSymbolLoadStart(
+    _In_ PWSTR FileName,
+    _In_ ULONG64 BaseAddress
+    )
+{
+    PH_TRACE_FIELD fields[2];
+
+    PhpInitializeTraceStringField(&fields[0], "FileName", FileName);
+    PhpInitializeTraceField(&fields[1], "BaseAddress", PH_TRACE_TYPE_HEXINT64, &BaseAddress, sizeof(ULONG64));
+    PhpWriteTraceEvent("SymbolLoad", PH_TRACE_OPCODE_START, PH_TRACE_KEYWORD_SYMBOLS, 2, fields);
+}
+
+VOID PhTraceSymbolLoadStop(
+    _In_ PWSTR FileName,
+    _In_ ULONG64 BaseAddress,
+    _In_ BOOLEAN Success
+    )
+{
+    PH_TRACE_FIELD fields[3];
+    ULONG success = Success; // TDH booleans are 4 bytes
+
+    PhpInitializeTraceStringField(&fields[0], "FileName", FileName);
+    PhpInitializeTraceField(&fields[1], "BaseAddress", PH_TRACE_TYPE_HEXINT64, &BaseAddress, sizeof(ULONG64));
+    PhpInitializeTraceField(&fields[2], "Success", PH_TRACE_TYPE_BOOLEAN, &success, sizeof(ULONG));
+    PhpWriteTraceEvent("SymbolLoad", PH_TRACE_OPCODE_STOP, PH_TRACE_KEYWORD_SYMBOLS, 3, fields);
+}
+
+VOID PhTraceKphRequestStart(
+    _In_ ULONG ControlCode
+    )
+{
+    PH_TRACE_FIELD fields[1];
+
+    PhpInitializeTraceField(&fields[0], "ControlCode", PH_TRACE_TYPE_HEXINT32, &ControlCode, sizeof(ULONG));
+    PhpWriteTraceEvent("KphRequest", PH_TRACE_OPCODE_START, PH_TRACE_KEYWORD_KPH, 1, fields);
+}
+
+VOID PhTraceKphRequestStop(
+    _In_ ULONG ControlCode,
+    _In_ NTSTATUS Status
+    )
+{
+    PH_TRACE_FIELD fields[2];
+
+    PhpInitializeTraceField(&fields[0], "ControlCode", PH_TRACE_TYPE_HEXINT32, &ControlCode, sizeof(ULONG));
+    PhpInitializeTraceField(&fields[1], "Status", PH_TRACE_TYPE_HEXINT32, &Status, sizeof(NTSTATUS));
+    PhpWriteTraceEvent("KphRequest", PH_TRACE_OPCODE_STOP, PH_TRACE_KEYWORD_KPH, 2, fields);
+}
+
+VOID PhTracePaintStart(
+    _In_ HWND WindowHandle
+    )
+{
+    PH_TRACE_FIELD fields[1];
+
+    PhpInitializeTraceField(&fields[0], "Window", PH_TRACE_TYPE_POINTER, &WindowHandle, sizeof(HWND));
+    PhpWriteTraceEvent("Paint", PH_TRACE_OPCODE_START, PH_TRACE_KEYWORD_PAINT, 1, fields);
+}
+
+VOID PhTracePaintStop(
+    _In_ HWND WindowHandle
+    )
+{
+    PH_TRACE_FIELD fields[1];
+
+    PhpInitializeTraceField(&fields[0], "Window", PH_TRACE_TYPE_POINTER, &WindowHandle, sizeof(HWND));
+    PhpWriteTraceEvent("Paint", PH_TRACE_OPCODE_STOP, PH_TRACE_KEYWORD_PAINT, 1, fields);
+}
+
+VOID PhTraceSettingsSaveStart(
+    _In_ PWSTR FileName
+    )
+{
+    PH_TRACE_FIELD fields[1];
+
+    PhpInitializeTraceStringField(&fields[0], "FileName", FileName);
+    PhpWriteTraceEvent("SettingsSave", PH_TRACE_OPCODE_START, PH_TRACE_KEYWORD_SETTINGS, 1, fields);
+}
+
+VOID PhTraceSettingsSaveStop(
+    _In_ PWSTR FileName,
+    _In_ NTSTATUS Status
+    )
+{
+    PH_TRACE_FIELD fields[2];
+
+    PhpInitializeTraceStringField(&fields[0], "FileName", FileName);
+    PhpInitializeTraceField(&fields[1], "Status", PH_TRACE_TYPE_HEXINT32, &Status, sizeof(NTSTATUS));
+    PhpWriteTraceEvent("SettingsSave", PH_TRACE_OPCODE_STOP, PH_TRACE_KEYWORD_SETTINGS, 2, fields);
+}
@@ -134,7 +134,16 @@ LRESULT CALLBACK PhTnpWndProc(
         return TRUE;
     case WM_PAINT:
         {
-            PhTnpOnPaint(hwnd, context);
+            if (PhTraceEnabled(PH_TRACE_KEYWORD_PAINT))
+            {
+                PhTracePaintStart(hwnd);
+                PhTnpOnPaint(hwnd, context);
+                PhTracePaintStop(hwnd);
+            }
+            else
+            {
+                PhTnpOnPaint(hwnd, context);
+            }
         }
         return 0;
     case WM_PRINTCLIENT:
@@ -373,6 +382,8 @@ VOID PhTnpDestroyTreeNewContext(
     if (Context->SearchString)
         PhFree(Context->SearchString);
 
+    PhTnpDeleteSearchIndex(Context);
+
     if (Context->TooltipText)
         PhDereferenceObject(Context->TooltipText);
 
@@ -382,6 +393,15 @@ VOID PhTnpDestroyTreeNewContext(
     if (Context->SuspendUpdateRegion)
         DeleteObject(Context->SuspendUpdateRegion);
 
+    if (Context->CellStates)
+        PhFree(Context->CellStates);
+
+    if (Context->TextExtentCache)
+    {
+        PhTnpClearTextExtentCache(Context);
+        PhDereferenceObject(Context->TextExtentCache);
+    }
+
     PhFree(Context);
 }
 
@@ -520,6 +540,7 @@ VOID PhTnpOnSize(
         PhTnpDestroyBufferedContext(Context);
     }
 
+    PhTnpResetCellStates(Context);
     PhTnpLayout(Context);
 
     if (Context->TooltipsHandle)
@@ -564,6 +585,9 @@ VOID PhTnpOnSettingChange(
 {
     PhTnpUpdateSystemMetrics(Context);
     PhTnpUpdateTextMetrics(Context);
+    // System colors may have changed.
+    PhTnpResetCellStates(Context);
+    PhTnpClearTextExtentCache(Context);
     PhTnpLayout(Context);
 }
 
@@ -598,6 +622,7 @@ VOID PhTnpOnPaint(
     )
 {
     RECT updateRect;
+    HRGN updateRegion;
     HDC hdc;
     PAINTSTRUCT paintStruct;
 
@@ -635,13 +660,22 @@ VOID PhTnpOnPaint(
             }
         }
 
+        // We need the update region to skip cells that have not been invalidated.
+        updateRegion = CreateRectRgn(0, 0, 0, 0);
+
+        if (GetUpdateRgn(hwnd, updateRegion, FALSE) == ERROR)
+        {
+            DeleteObject(updateRegion);
+            updateRegion = NULL;
+        }
+
         if (hdc = BeginPaint(hwnd, &paintStruct))
         {
             updateRect = paintStruct.rcPaint;
 
             if (Context->BufferedContext)
             {
-                PhTnpPaint(hwnd, Context, Context->BufferedContext, &updateRect);
+                PhTnpPaint(hwnd, Context, Context->BufferedContext, &updateRect, updateRegion);
                 BitBlt(
                     hdc,
                     updateRect.left,
@@ -656,11 +690,14 @@ VOID PhTnpOnPaint(
             }
             else
             {
-                PhTnpPaint(hwnd, Context, hdc, &updateRect);
+                PhTnpPaint(hwnd, Context, hdc, &updateRect, updateRegion);
             }
 
             EndPaint(hwnd, &paintStruct);
         }
+
+        if (updateRegion)
+            DeleteObject(updateRegion);
     }
 }
 
@@ -671,7 +708,7 @@ VOID PhTnpOnPrintClient(
     _In_ ULONG Flags
     )
 {
-    PhTnpPaint(hwnd, Context, hdc, &Context->ClientRect);
+    PhTnpPaint(hwnd, Context, hdc, &Context->ClientRect, NULL);
 }
 
 BOOLEAN PhTnpOnNcPaint(
@@ -1002,8 +1039,8 @@ VOID PhTnpOnXxxButtonXxx(
 
                 if (saveIndex == -1)
                     hitTest.Node = NULL;
-                else if (saveIndex < Context->FlatList->Count)
-                    hitTest.Node = Context->FlatList->Items[saveIndex];
+                else if (saveIndex < PhTnpGetFlatCount(Context))
+                    hitTest.Node = PhTnpGetFlatNode(Context, saveIndex);
                 else
                     return;
 
@@ -1241,9 +1278,9 @@ VOID PhTnpOnContextMenu(
 
         found = FALSE;
 
-        for (i = 0; i < Context->FlatList->Count; i++)
+        for (i = 0; i < PhTnpGetFlatCount(Context); i++)
         {
-            if (((PPH_TREENEW_NODE)Context->FlatList->Items[i])->Selected)
+            if (PhTnpGetFlatNode(Context, i)->Selected)
             {
                 found = TRUE;
                 break;
@@ -1326,7 +1363,7 @@ VOID PhTnpOnVScroll(
     case SB_THUMBPOSITION:
         // Touch scrolling seems to give us Position but not nTrackPos. The problem is that
         // Position is a 16-bit value, so don't use it if we have too many rows.
-        if (Context->FlatList->Count <= 0xffff)
+        if (PhTnpGetFlatCount(Context) <= 0xffff)
             scrollInfo.nPos = Position;
         break;
     case SB_THUMBTRACK:
@@ -1383,7 +1420,7 @@ VOID PhTnpOnHScroll(
     case SB_THUMBPOSITION:
         // Touch scrolling seems to give us Position but not nTrackPos. The problem is that
         // Position is a 16-bit value, so don't use it if we have too many rows.
-        if (Context->FlatList->Count <= 0xffff)
+        if (PhTnpGetFlatCount(Context) <= 0xffff)
             scrollInfo.nPos = Position;
         break;
     case SB_THUMBTRACK:
@@ -1486,7 +1523,7 @@ BOOLEAN PhTnpOnNotify(
                             Context->ResizingColumn = NULL;
 
                             // Redraw the entire window if we are displaying empty text.
-                            if (Context->FlatList->Count == 0 && Context->EmptyText.Length != 0)
+                            if (PhTnpGetFlatCount(Context) == 0 && Context->EmptyText.Length != 0)
                                 InvalidateRect(Context->Handle, NULL, FALSE);
                         }
                         else
@@ -1643,7 +1680,8 @@ ULONG_PTR PhTnpOnUserMessage(
 
             PhTnpRestructureNodes(Context);
             PhTnpLayout(Context);
-            InvalidateRect(Context->Handle, NULL, FALSE);
+            // Rows that have moved are compared by their contents, so unchanged rows are not redrawn.
+            PhTnpInvalidateChangedCells(Context);
         }
         return TRUE;
     case TNM_ADDCOLUMN:
@@ -1758,17 +1796,17 @@ ULONG_PTR PhTnpOnUserMessage(
         return TRUE;
     case TNM_GETFLATNODECOUNT:
         if (!Context->SuspendUpdateStructure)
-            return (LRESULT)Context->FlatList->Count;
+            return (LRESULT)PhTnpGetFlatCount(Context);
         else
             return 0;
     case TNM_GETFLATNODE:
         {
             ULONG index = (ULONG)WParam;
 
-            if (index >= Context->FlatList->Count)
+            if (index >= PhTnpGetFlatCount(Context))
                 return (LRESULT)NULL;
 
-            return (LRESULT)Context->FlatList->Items[index];
+            return (LRESULT)PhTnpGetFlatNode(Context, index);
         }
         break;
     case TNM_GETCELLTEXT:
@@ -1808,6 +1846,9 @@ ULONG_PTR PhTnpOnUserMessage(
             PPH_TREENEW_NODE node = (PPH_TREENEW_NODE)LParam;
             RECT rect;
 
+            // The node's text may have changed.
+            Context->SearchIndexValid = FALSE;
+
             if (!node->Visible)
                 return FALSE;
 
@@ -1821,6 +1862,8 @@ ULONG_PTR PhTnpOnUserMessage(
         {
             RECT rect;
 
+            Context->SearchIndexValid = FALSE;
+
             if (!PhTnpGetRowRects(Context, (ULONG)WParam, (ULONG)LParam, TRUE, &rect))
                 return FALSE;
 
@@ -1890,6 +1933,10 @@ ULONG_PTR PhTnpOnUserMessage(
         return TRUE;
     case TNM_SETEXTENDEDFLAGS:
         Context->ExtendedFlags = (Context->ExtendedFlags & ~(ULONG)WParam) | ((ULONG)LParam & (ULONG)WParam);
+
+        if (!(Context->ExtendedFlags & TN_FLAG_SEARCH_INDEX))
+            PhTnpDeleteSearchIndex(Context);
+
         return TRUE;
     case TNM_GETCALLBACK:
         {
@@ -1961,6 +2008,22 @@ ULONG_PTR PhTnpOnUserMessage(
         return TRUE;
     case TNM_ISFLATNODEVALID:
         return !Context->SuspendUpdateStructure;
+    case TNM_INVALIDATECHANGEDCELLS:
+        PhTnpInvalidateChangedCells(Context);
+        return TRUE;
+    case TNM_SETVIRTUALCOUNT:
+        Context->NewVirtualCount = (ULONG)WParam;
+        return SendMessage(hwnd, TNM_NODESSTRUCTURED, 0, 0);
+    case TNM_UPDATETOOLTIP:
+        {
+            // Make PhTnpGetTooltipText call the owner again.
+            Context->TooltipIndex = -1;
+            Context->TooltipId = -1;
+
+            if (Context->TooltipsHandle)
+                SendMessage(Context->TooltipsHandle, TTM_UPDATE, 0, 0);
+        }
+        return TRUE;
     }
 
     return 0;
@@ -2000,6 +2063,9 @@ VOID PhTnpSetFont(
         Context->TooltipFont = Context->Font;
     }
 
+    PhTnpResetCellStates(Context);
+    // The old font may have been deleted, and its handle may be reused.
+    PhTnpClearTextExtentCache(Context);
     PhTnpUpdateTextMetrics(Context);
 }
 
@@ -2066,6 +2132,8 @@ VOID PhTnpUpdateThemeData(
     _In_ PPH_TREENEW_CONTEXT Context
     )
 {
+    PhTnpResetCellStates(Context);
+
     if (
         IsThemeActive_I &&
         OpenThemeData_I &&
@@ -2185,7 +2253,7 @@ VOID PhTnpLayout(
     PhTnpLayoutHeader(Context);
 
     // Redraw the entire window if we are displaying empty text.
-    if (Context->FlatList->Count == 0 && Context->EmptyText.Length != 0)
+    if (PhTnpGetFlatCount(Context) == 0 && Context->EmptyText.Length != 0)
         InvalidateRect(Context->Handle, NULL, FALSE);
 }
 
@@ -2629,6 +2697,9 @@ VOID PhTnpUpdateColumnMaps(
     ULONG i;
     LONG x;
 
+    // Columns may have moved.
+    PhTnpResetCellStates(Context);
+
     if (Context->AllocatedColumnsByDisplay < Context->NumberOfColumns)
     {
         if (Context->ColumnsByDisplay)
@@ -3067,28 +3138,47 @@ VOID PhTnpAutoSizeColumnHeader(
         ULONG i;
         LONG maximumWidth;
         PH_TREENEW_CELL_PARTS parts;
+        PPH_TREENEW_NODE node;
+        PH_STRINGREF text;
+        SIZE textSize;
         LONG width;
+        HDC hdc;
 
-        if (Context->FlatList->Count == 0)
+        if (PhTnpGetFlatCount(Context) == 0)
             return;
         if (Column->CustomDraw)
             return;
+        if (!(hdc = GetDC(Context->Handle)))
+            return;
 
         maximumWidth = 0;
 
-        for (i = 0; i < Context->FlatList->Count; i++)
+        // This is the same as PhTnpGetCellParts with TN_MEASURE_TEXT, but we use a single DC for
+        // all rows.
+        for (i = 0; i < PhTnpGetFlatCount(Context); i++)
         {
-            if (PhTnpGetCellParts(Context, i, Column, TN_MEASURE_TEXT, &parts) &&
-                (parts.Flags & TN_PART_CELL) && (parts.Flags & TN_PART_CONTENT) && (parts.Flags & TN_PART_TEXT))
+            if (PhTnpGetCellParts(Context, i, Column, 0, &parts) &&
+                (parts.Flags & TN_PART_CELL) && (parts.Flags & TN_PART_CONTENT))
             {
-                width = parts.TextRect.right - parts.TextRect.left; // text width
-                width += parts.ContentRect.left - parts.CellRect.left; // left padding
+                node = PhTnpGetFlatNode(Context, i);
+                PhTnpPrepareRowForDraw(Context, hdc, node);
 
-                if (maximumWidth < width)
-                    maximumWidth = width;
+                if (
+                    PhTnpGetCellText(Context, node, Column->Id, &text) &&
+                    PhTnpGetTextExtent(Context, hdc, node->Font ? node->Font : Context->Font, &text, &textSize)
+                    )
+                {
+                    width = textSize.cx; // text width
+                    width += parts.ContentRect.left - parts.CellRect.left; // left padding
+
+                    if (maximumWidth < width)
+                        maximumWidth = width;
+                }
             }
         }
 
+        ReleaseDC(Context->Handle, hdc);
+
         newWidth = maximumWidth + TNP_CELL_RIGHT_MARGIN; // right padding
 
         if (Column->Fixed)
@@ -3205,6 +3295,30 @@ VOID PhTnpRestructureNodes(
     ULONG numberOfChildren;
     ULONG i;
 
+    if (Context->ExtendedFlags & TN_FLAG_VIRTUAL)
+    {
+        // The owner keeps the rows, so all we need is the row count.
+        Context->SearchIndexValid = FALSE;
+        Context->CanAnyExpand = FALSE;
+        Context->VirtualCount = Context->NewVirtualCount;
+
+        if (Context->FocusNode && (
+            Context->FocusNode->Index >= Context->VirtualCount ||
+            PhTnpGetVirtualNode(Context, Context->FocusNode->Index) != Context->FocusNode
+            ))
+        {
+            Context->FocusNode = NULL;
+        }
+
+        if (Context->HotNodeIndex >= Context->VirtualCount)
+            Context->HotNodeIndex = -1;
+
+        if (Context->MarkNodeIndex >= Context->VirtualCount)
+            Context->MarkNodeIndex = -1;
+
+        return;
+    }
+
     if (!PhTnpGetNodeChildren(Context, NULL, &children, &numberOfChildren))
         return;
 
@@ -3213,6 +3327,7 @@ VOID PhTnpRestructureNodes(
     // follow any pointers.
 
     Context->FocusNodeFound = FALSE;
+    Context->SearchIndexValid = FALSE;
 
     PhClearList(Context->FlatList);
     Context->CanAnyExpand = FALSE;
@@ -3232,6 +3347,36 @@ VOID PhTnpRestructureNodes(
         Context->MarkNodeIndex = -1;
 }
 
+/**
+ * Gets a row from the owner in virtual mode.
+ *
+ * \param Context The tree context.
+ * \param Index The index of the row. This must be less than the current row count.
+ */
+PPH_TREENEW_NODE PhTnpGetVirtualNode(
+    _In_ PPH_TREENEW_CONTEXT Context,
+    _In_ ULONG Index
+    )
+{
+    PH_TREENEW_GET_VIRTUAL_NODE getVirtualNode;
+    PPH_TREENEW_NODE node;
+
+    getVirtualNode.Flags = 0;
+    getVirtualNode.Index = Index;
+    getVirtualNode.Node = NULL;
+
+    Context->Callback(Context->Handle, TreeNewGetVirtualNode, &getVirtualNode, NULL, Context->CallbackContext);
+    node = getVirtualNode.Node;
+    assert(node);
+
+    // Rows are always visible and never have children.
+    node->Visible = TRUE;
+    node->Level = 0;
+    node->Index = Index;
+
+    return node;
+}
+
 VOID PhTnpInsertNodeChildren(
     _In_ PPH_TREENEW_CONTEXT Context,
     _In_ PPH_TREENEW_NODE Node,
@@ -3307,9 +3452,9 @@ VOID PhTnpSetExpandedNode(
 
                 changed = FALSE;
 
-                for (i = Node->Index + 1; i < Context->FlatList->Count; i++)
+                for (i = Node->Index + 1; i < PhTnpGetFlatCount(Context); i++)
                 {
-                    node = Context->FlatList->Items[i];
+                    node = PhTnpGetFlatNode(Context, i);
 
                     if (node->Level <= Node->Level)
                         break; // no more children
@@ -3352,10 +3497,10 @@ BOOLEAN PhTnpGetCellParts(
     LONG iconVerticalMargin;
     LONG currentX;
 
-    if (Index >= Context->FlatList->Count)
+    if (Index >= PhTnpGetFlatCount(Context))
         return FALSE;
 
-    node = Context->FlatList->Items[Index];
+    node = PhTnpGetFlatNode(Context, Index);
     nodeY = Context->HeaderHeight + ((LONG)Index - Context->VScrollPosition) * Context->RowHeight;
 
     Parts->Flags = 0;
@@ -3431,49 +3576,41 @@ BOOLEAN PhTnpGetCellParts(
 
     if (Flags & TN_MEASURE_TEXT)
     {
-        HDC hdc;
         PH_STRINGREF text;
         HFONT font;
         SIZE textSize;
 
-        if (hdc = GetDC(Context->Handle))
+        PhTnpPrepareRowForDraw(Context, NULL, node);
+
+        if (PhTnpGetCellText(Context, node, Column->Id, &text))
         {
-            PhTnpPrepareRowForDraw(Context, hdc, node);
+            if (node->Font)
+                font = node->Font;
+            else
+                font = Context->Font;
 
-            if (PhTnpGetCellText(Context, node, Column->Id, &text))
+            if (PhTnpGetTextExtent(Context, NULL, font, &text, &textSize))
             {
-                if (node->Font)
-                    font = node->Font;
-                else
-                    font = Context->Font;
+                Parts->Flags |= TN_PART_TEXT;
+                Parts->TextRect.left = currentX;
+                Parts->TextRect.right = currentX + textSize.cx;
+                Parts->TextRect.top = Parts->RowRect.top + (Context->RowHeight - textSize.cy) / 2;
+                Parts->TextRect.bottom = Parts->RowRect.bottom - (Context->RowHeight - textSize.cy) / 2;
 
-                SelectObject(hdc, font);
-
-                if (GetTextExtentPoint32(hdc, text.Buffer, (ULONG)text.Length / sizeof(WCHAR), &textSize))
+                if (Column->TextFlags & DT_CENTER)
                 {
-                    Parts->Flags |= TN_PART_TEXT;
-                    Parts->TextRect.left = currentX;
-                    Parts->TextRect.right = currentX + textSize.cx;
-                    Parts->TextRect.top = Parts->RowRect.top + (Context->RowHeight - textSize.cy) / 2;
-                    Parts->TextRect.bottom = Parts->RowRect.bottom - (Context->RowHeight - textSize.cy) / 2;
-
-                    if (Column->TextFlags & DT_CENTER)
-                    {
-                        Parts->TextRect.left = Parts->ContentRect.left / 2 + (Parts->ContentRect.right - textSize.cx) / 2;
-                        Parts->TextRect.right = Parts->ContentRect.left + textSize.cx;
-                    }
-                    else if (Column->TextFlags & DT_RIGHT)
-                    {
-                        Parts->TextRect.right = Parts->ContentRect.right;
-                        Parts->TextRect.left = Parts->TextRect.right - textSize.cx;
-                    }
-
-                    Parts->Text = text;
-                    Parts->Font = font;
+                    Parts->TextRect.left = Parts->ContentRect.left / 2 + (Parts->ContentRect.right - textSize.cx) / 2;
+                    Parts->TextRect.right = Parts->ContentRect.left + textSize.cx;
+                }
+                else if (Column->TextFlags & DT_RIGHT)
+                {
+                    Parts->TextRect.right = Parts->ContentRect.right;
+                    Parts->TextRect.left = Parts->TextRect.right - textSize.cx;
                 }
-            }
 
-            ReleaseDC(Context->Handle, hdc);
+                Parts->Text = text;
+                Parts->Font = font;
+            }
         }
     }
 
@@ -3492,7 +3629,7 @@ BOOLEAN PhTnpGetRowRects(
     LONG endY;
     LONG viewWidth;
 
-    if (End >= Context->FlatList->Count)
+    if (End >= PhTnpGetFlatCount(Context))
         return FALSE;
     if (Start > End)
         return FALSE;
@@ -3560,10 +3697,10 @@ VOID PhTnpHitTest(
         {
             index = (y - Context->HeaderHeight) / Context->RowHeight + Context->VScrollPosition;
 
-            if (index < Context->FlatList->Count)
+            if (index < PhTnpGetFlatCount(Context))
             {
                 HitTest->Flags |= TN_HIT_ITEM;
-                node = Context->FlatList->Items[index];
+                node = PhTnpGetFlatNode(Context, index);
                 HitTest->Node = node;
 
                 if (HitTest->InFlags & TN_TEST_COLUMN)
@@ -3661,10 +3798,10 @@ VOID PhTnpSelectRange(
     ULONG changedStart;
     ULONG changedEnd;
 
-    if (Context->FlatList->Count == 0)
+    if (PhTnpGetFlatCount(Context) == 0)
         return;
 
-    maximum = Context->FlatList->Count - 1;
+    maximum = PhTnpGetFlatCount(Context) - 1;
 
     if (End > maximum)
     {
@@ -3687,7 +3824,7 @@ VOID PhTnpSelectRange(
     {
         for (i = 0; i < Start; i++)
         {
-            node = Context->FlatList->Items[i];
+            node = PhTnpGetFlatNode(Context, i);
 
             if (node->Selected)
             {
@@ -3703,7 +3840,7 @@ VOID PhTnpSelectRange(
 
     for (i = Start; i <= End; i++)
     {
-        node = Context->FlatList->Items[i];
+        node = PhTnpGetFlatNode(Context, i);
 
         if (!node->Unselectable && ((Flags & TN_SELECT_TOGGLE) || node->Selected != targetValue))
         {
@@ -3720,7 +3857,7 @@ VOID PhTnpSelectRange(
     {
         for (i = End + 1; i <= maximum; i++)
         {
-            node = Context->FlatList->Items[i];
+            node = PhTnpGetFlatNode(Context, i);
 
             if (node->Selected)
             {
@@ -3889,7 +4026,7 @@ BOOLEAN PhTnpEnsureVisibleNode(
     LONG deltaY;
     LONG deltaRows;
 
-    if (Index >= Context->FlatList->Count)
+    if (Index >= PhTnpGetFlatCount(Context))
         return FALSE;
 
     viewTop = Context->HeaderHeight;
@@ -4116,7 +4253,7 @@ BOOLEAN PhTnpProcessFocusKey(
         return FALSE;
     }
 
-    count = Context->FlatList->Count;
+    count = PhTnpGetFlatCount(Context);
 
     if (count == 0)
         return TRUE;
@@ -4228,7 +4365,7 @@ BOOLEAN PhTnpProcessFocusKey(
     controlKey = GetKeyState(VK_CONTROL) < 0;
     shiftKey = GetKeyState(VK_SHIFT) < 0;
 
-    Context->FocusNode = Context->FlatList->Items[index];
+    Context->FocusNode = PhTnpGetFlatNode(Context, index);
     PhTnpSetHotNode(Context, Context->FocusNode, FALSE);
 
     if (shiftKey && Context->MarkNodeIndex != -1)
@@ -4353,7 +4490,7 @@ BOOLEAN PhTnpProcessNodeKey(
                 while (i != 0)
                 {
                     i--;
-                    newNode = Context->FlatList->Items[i];
+                    newNode = PhTnpGetFlatNode(Context, i);
 
                     if (newNode->Level == targetLevel)
                     {
@@ -4390,9 +4527,9 @@ BOOLEAN PhTnpProcessNodeKey(
                 }
                 else
                 {
-                    if (Context->FocusNode->Index + 1 < Context->FlatList->Count)
+                    if (Context->FocusNode->Index + 1 < PhTnpGetFlatCount(Context))
                     {
-                        newNode = Context->FlatList->Items[Context->FocusNode->Index + 1];
+                        newNode = PhTnpGetFlatNode(Context, Context->FocusNode->Index + 1);
 
                         if (newNode->Level == Context->FocusNode->Level + 1)
                         {
@@ -4432,7 +4569,7 @@ VOID PhTnpProcessSearchKey(
     ULONG changedEnd;
     RECT rect;
 
-    if (Context->FlatList->Count == 0)
+    if (PhTnpGetFlatCount(Context) == 0)
         return;
 
     messageTime = GetMessageTime();
@@ -4495,7 +4632,7 @@ VOID PhTnpProcessSearchKey(
             // If it's a new search, start at the next item so the user doesn't find the same item again.
             searchEvent.StartIndex++;
 
-            if (searchEvent.StartIndex == Context->FlatList->Count)
+            if (searchEvent.StartIndex == PhTnpGetFlatCount(Context))
                 searchEvent.StartIndex = 0;
         }
     }
@@ -4535,10 +4672,10 @@ VOID PhTnpProcessSearchKey(
         return;
     }
 
-    if (searchEvent.FoundIndex < 0 || searchEvent.FoundIndex >= (LONG)Context->FlatList->Count)
+    if (searchEvent.FoundIndex < 0 || searchEvent.FoundIndex >= (LONG)PhTnpGetFlatCount(Context))
         return;
 
-    foundNode = Context->FlatList->Items[searchEvent.FoundIndex];
+    foundNode = PhTnpGetFlatNode(Context, searchEvent.FoundIndex);
     Context->FocusNode = foundNode;
     PhTnpEnsureVisibleNode(Context, searchEvent.FoundIndex);
     PhTnpSetHotNode(Context, foundNode, FALSE);
@@ -4564,11 +4701,14 @@ BOOLEAN PhTnpDefaultIncrementalSearch(
     LONG foundIndex;
     BOOLEAN firstTime;
 
-    if (Context->FlatList->Count == 0)
+    if (PhTnpGetFlatCount(Context) == 0)
         return FALSE;
     if (!Context->FirstColumn)
         return FALSE;
 
+    if (Context->ExtendedFlags & TN_FLAG_SEARCH_INDEX)
+        return PhTnpIndexedIncrementalSearch(Context, SearchEvent, Partial, Wrap);
+
     startIndex = SearchEvent->StartIndex;
     currentIndex = startIndex;
     foundIndex = -1;
@@ -4578,7 +4718,7 @@ BOOLEAN PhTnpDefaultIncrementalSearch(
     {
         PH_STRINGREF text;
 
-        if (currentIndex >= (LONG)Context->FlatList->Count)
+        if (currentIndex >= (LONG)PhTnpGetFlatCount(Context))
         {
             if (Wrap)
                 currentIndex = 0;
@@ -4594,7 +4734,7 @@ BOOLEAN PhTnpDefaultIncrementalSearch(
         if (!firstTime && currentIndex == startIndex)
             break;
 
-        if (PhTnpGetCellText(Context, Context->FlatList->Items[currentIndex], Context->FirstColumn->Id, &text))
+        if (PhTnpGetCellText(Context, PhTnpGetFlatNode(Context, currentIndex), Context->FirstColumn->Id, &text))
         {
             if (Partial)
             {
@@ -4623,6 +4763,200 @@ BOOLEAN PhTnpDefaultIncrementalSearch(
     return TRUE;
 }
 
+static int __cdecl PhTnpCompareSearchEntries(
+    _In_ void *context,
+    _In_ const void *elem1,
+    _In_ const void *elem2
+    )
+{
+    PWCHAR text = context;
+    PPH_TREENEW_SEARCH_ENTRY entry1 = (PPH_TREENEW_SEARCH_ENTRY)elem1;
+    PPH_TREENEW_SEARCH_ENTRY entry2 = (PPH_TREENEW_SEARCH_ENTRY)elem2;
+    PH_STRINGREF string1;
+    PH_STRINGREF string2;
+    LONG result;
+
+    string1.Buffer = text + entry1->Offset;
+    string1.Length = entry1->Length * sizeof(WCHAR);
+    string2.Buffer = text + entry2->Offset;
+    string2.Length = entry2->Length * sizeof(WCHAR);
+    result = PhCompareStringRef(&string1, &string2, TRUE);
+
+    if (result == 0)
+        result = uintcmp(entry1->Index, entry2->Index);
+
+    return result;
+}
+
+/**
+ * Builds the search index for the first column.
+ *
+ * \remarks The text of each row is copied, so the index stays usable while the owner changes
+ * its cell text buffers. The index is invalidated when the tree is restructured or nodes are
+ * invalidated, and is rebuilt by the next search.
+ */
+VOID PhTnpBuildSearchIndex(
+    _In_ PPH_TREENEW_CONTEXT Context
+    )
+{
+    PPH_TREENEW_SEARCH_ENTRY entries;
+    PWCHAR text;
+    SIZE_T textCount;
+    SIZE_T allocatedText;
+    ULONG i;
+
+    PhTnpDeleteSearchIndex(Context);
+
+    if (!Context->FirstColumn)
+        return;
+
+    entries = PhAllocate(sizeof(PH_TREENEW_SEARCH_ENTRY) * max(PhTnpGetFlatCount(Context), 1));
+    allocatedText = max(PhTnpGetFlatCount(Context), 1) * 16;
+    text = PhAllocate(allocatedText * sizeof(WCHAR));
+    textCount = 0;
+
+    for (i = 0; i < PhTnpGetFlatCount(Context); i++)
+    {
+        PH_STRINGREF cellText;
+        SIZE_T length;
+
+        if (!PhTnpGetCellText(Context, PhTnpGetFlatNode(Context, i), Context->FirstColumn->Id, &cellText))
+            PhInitializeEmptyStringRef(&cellText);
+
+        length = cellText.Length / sizeof(WCHAR);
+
+        if (textCount + length > allocatedText)
+        {
+            allocatedText = max(allocatedText * 2, textCount + length);
+            text = PhReAllocate(text, allocatedText * sizeof(WCHAR));
+        }
+
+        memcpy(text + textCount, cellText.Buffer, length * sizeof(WCHAR));
+        entries[i].Index = i;
+        entries[i].Offset = (ULONG)textCount;
+        entries[i].Length = (ULONG)length;
+        textCount += length;
+    }
+
+    qsort_s(entries, PhTnpGetFlatCount(Context), sizeof(PH_TREENEW_SEARCH_ENTRY), PhTnpCompareSearchEntries, text);
+
+    Context->SearchIndex = entries;
+    Context->SearchIndexCount = PhTnpGetFlatCount(Context);
+    Context->SearchIndexColumnId = Context->FirstColumn->Id;
+    Context->SearchIndexText = text;
+    Context->SearchIndexValid = TRUE;
+}
+
+VOID PhTnpDeleteSearchIndex(
+    _In_ PPH_TREENEW_CONTEXT Context
+    )
+{
+    if (Context->SearchIndex)
+    {
+        PhFree(Context->SearchIndex);
+        Context->SearchIndex = NULL;
+    }
+
+    if (Context->SearchIndexText)
+    {
+        PhFree(Context->SearchIndexText);
+        Context->SearchIndexText = NULL;
+    }
+
+    Context->SearchIndexCount = 0;
+    Context->SearchIndexValid = FALSE;
+}
+
+/**
+ * Performs an incremental search using the search index.
+ *
+ * \remarks The result is the same as the linear search: the first matching row at or after the
+ * start index, wrapping around if requested. Matching rows are found with a binary search, so
+ * only the rows that match are examined.
+ */
+BOOLEAN PhTnpIndexedIncrementalSearch(
+    _In_ PPH_TREENEW_CONTEXT Context,
+    _Inout_ PPH_TREENEW_SEARCH_EVENT SearchEvent,
+    _In_ BOOLEAN Partial,
+    _In_ BOOLEAN Wrap
+    )
+{
+    ULONG low;
+    ULONG high;
+    ULONG startIndex;
+    ULONG foundIndex;
+    ULONG firstIndex;
+    ULONG i;
+
+    if (
+        !Context->SearchIndexValid ||
+        Context->SearchIndexColumnId != Context->FirstColumn->Id ||
+        Context->SearchIndexCount != PhTnpGetFlatCount(Context)
+        )
+    {
+        PhTnpBuildSearchIndex(Context);
+
+        if (!Context->SearchIndexValid)
+            return FALSE;
+    }
+
+    // Find the first entry that isn't less than the search string. All entries that start with
+    // the search string follow it.
+
+    low = 0;
+    high = Context->SearchIndexCount;
+
+    while (low < high)
+    {
+        ULONG mid = low + (high - low) / 2;
+        PH_STRINGREF text;
+
+        text.Buffer = Context->SearchIndexText + Context->SearchIndex[mid].Offset;
+        text.Length = Context->SearchIndex[mid].Length * sizeof(WCHAR);
+
+        if (PhCompareStringRef(&text, &SearchEvent->String, TRUE) < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    startIndex = (ULONG)SearchEvent->StartIndex;
+    foundIndex = -1;
+    firstIndex = -1;
+
+    for (i = low; i < Context->SearchIndexCount; i++)
+    {
+        PPH_TREENEW_SEARCH_ENTRY entry = &Context->SearchIndex[i];
+        PH_STRINGREF text;
+
+        text.Buffer = Context->SearchIndexText + entry->Offset;
+        text.Length = entry->Length * sizeof(WCHAR);
+
+        if (Partial)
+        {
+            if (!PhStartsWithStringRef(&text, &SearchEvent->String, TRUE))
+                break;
+        }
+        else
+        {
+            if (!PhEqualStringRef(&text, &SearchEvent->String, TRUE))
+                break;
+        }
+
+        if (entry->Index >= startIndex && entry->Index < foundIndex)
+            foundIndex = entry->Index;
+        if (entry->Index < firstIndex)
+            firstIndex = entry->Index;
+    }
+
+    if (foundIndex == -1 && Wrap)
+        foundIndex = firstIndex;
+
+    SearchEvent->FoundIndex = (LONG)foundIndex;
+
+    return TRUE;
+}
+
 VOID PhTnpUpdateScrollBars(
     _In_ PPH_TREENEW_CONTEXT Context
     )
@@ -4644,7 +4978,7 @@ VOID PhTnpUpdateScrollBars(
     height = clientRect.bottom - Context->HeaderHeight;
 
     contentWidth = Context->TotalViewX;
-    contentHeight = (LONG)Context->FlatList->Count * Context->RowHeight;
+    contentHeight = (LONG)PhTnpGetFlatCount(Context) * Context->RowHeight;
 
     if (contentHeight > height)
     {
@@ -4669,7 +5003,7 @@ VOID PhTnpUpdateScrollBars(
 
     scrollInfo.fMask = SIF_RANGE | SIF_PAGE;
     scrollInfo.nMin = 0;
-    scrollInfo.nMax = Context->FlatList->Count != 0 ? Context->FlatList->Count - 1 : 0;
+    scrollInfo.nMax = PhTnpGetFlatCount(Context) != 0 ? PhTnpGetFlatCount(Context) - 1 : 0;
     scrollInfo.nPage = height / Context->RowHeight;
     SetScrollInfo(Context->VScrollHandle, SB_CTL, &scrollInfo, TRUE);
 
@@ -4761,7 +5095,7 @@ VOID PhTnpScroll(
         if (DeltaRows == MINLONG)
             scrollInfo.nPos = 0;
         else if (DeltaRows == MAXLONG)
-            scrollInfo.nPos = Context->FlatList->Count - 1;
+            scrollInfo.nPos = PhTnpGetFlatCount(Context) - 1;
         else
             scrollInfo.nPos += DeltaRows;
 
@@ -4802,6 +5136,8 @@ VOID PhTnpProcessScroll(
     RECT rect;
     LONG deltaY;
 
+    PhTnpScrollCellStates(Context, DeltaRows, DeltaX);
+
     rect.top = Context->HeaderHeight;
     rect.bottom = Context->ClientRect.bottom;
 
@@ -4823,7 +5159,7 @@ VOID PhTnpProcessScroll(
     else
     {
         // Don't scroll if there are no rows. This is especially important if the user wants us to display empty text.
-        if (Context->FlatList->Count != 0)
+        if (PhTnpGetFlatCount(Context) != 0)
         {
             deltaY = DeltaRows * Context->RowHeight;
 
@@ -4897,7 +5233,8 @@ VOID PhTnpPaint(
     _In_ HWND hwnd,
     _In_ PPH_TREENEW_CONTEXT Context,
     _In_ HDC hdc,
-    _In_ PRECT PaintRect
+    _In_ PRECT PaintRect,
+    _In_opt_ HRGN UpdateRegion
     )
 {
     RECT viewRect;
@@ -4918,11 +5255,25 @@ VOID PhTnpPaint(
     LONG normalUpdateRightIndex;
     LONG normalTotalX;
     RECT cellRect;
+    RECT visibleRect;
     HBRUSH backBrush;
     HRGN oldClipRegion;
+    HRGN scratchRegion;
+    PULONG cellStates;
+    ULONG rowHash;
 
     PhTnpInitializeThemeData(Context);
 
+    // Record the state of the cells that we paint. This is only possible if we are painting to the
+    // window, in which case we know the update region. The selection rectangle is drawn over the
+    // cells, so we don't record anything while it is visible.
+    scratchRegion = NULL;
+    cellStates = NULL;
+    rowHash = 0;
+
+    if (UpdateRegion && !Context->DragSelectionActive && PhTnpEnsureCellStates(Context))
+        scratchRegion = CreateRectRgn(0, 0, 0, 0);
+
     viewRect = Context->ClientRect;
 
     if (Context->VScrollVisible)
@@ -4949,8 +5300,8 @@ VOID PhTnpPaint(
     firstRowToUpdate += vScrollPosition;
     lastRowToUpdate += vScrollPosition;
 
-    if (lastRowToUpdate >= (LONG)Context->FlatList->Count)
-        lastRowToUpdate = Context->FlatList->Count - 1; // becomes -1 when there are no items, handled correctly by loop below
+    if (lastRowToUpdate >= (LONG)PhTnpGetFlatCount(Context))
+        lastRowToUpdate = PhTnpGetFlatCount(Context) - 1; // becomes -1 when there are no items, handled correctly by loop below
 
     // Determine whether the fixed column needs painting, and which normal columns need painting.
 
@@ -4999,12 +5350,30 @@ VOID PhTnpPaint(
 
     for (i = firstRowToUpdate; i <= lastRowToUpdate; i++)
     {
-        node = Context->FlatList->Items[i];
+        node = PhTnpGetFlatNode(Context, i);
+
+        // Skip rows that are only in the bounding rectangle of the update region.
+        if (UpdateRegion && !RectInRegion(UpdateRegion, &rowRect))
+        {
+            rowRect.top += Context->RowHeight;
+            rowRect.bottom += Context->RowHeight;
+            continue;
+        }
 
         // Prepare the row for drawing.
 
         PhTnpPrepareRowForDraw(Context, hdc, node);
 
+        if (scratchRegion && (ULONG)(i - vScrollPosition) < Context->CellStateRows)
+        {
+            cellStates = &Context->CellStates[(i - vScrollPosition) * Context->CellStateColumns];
+            rowHash = PhTnpHashRowState(Context, node, i);
+        }
+        else
+        {
+            cellStates = NULL;
+        }
+
         if (node->Selected && !Context->ThemeHasItemBackground)
         {
             // Non-themed background
@@ -5078,7 +5447,17 @@ VOID PhTnpPaint(
         {
             cellRect.left = 0;
             cellRect.right = Context->FixedWidth;
-            PhTnpDrawCell(Context, hdc, &cellRect, node, Context->FixedColumn, i, -1);
+
+            if (!UpdateRegion || RectInRegion(UpdateRegion, &cellRect))
+            {
+                PhTnpDrawCell(Context, hdc, &cellRect, node, Context->FixedColumn, i, -1);
+
+                if (cellStates)
+                {
+                    cellStates[Context->FixedColumn->Id] = PhTnpRegionContainsRect(UpdateRegion, scratchRegion, &cellRect) ?
+                        PhTnpHashCellState(Context, node, Context->FixedColumn, i, rowHash) : TNP_CELL_STATE_UNKNOWN;
+                }
+            }
         }
 
         // Paint the normal columns.
@@ -5104,7 +5483,24 @@ VOID PhTnpPaint(
 
                 cellRect.left = cellRect.right;
                 cellRect.right = cellRect.left + column->Width;
+
+                visibleRect = cellRect;
+
+                if (visibleRect.left < Context->NormalLeft)
+                    visibleRect.left = Context->NormalLeft;
+                if (visibleRect.right > viewRect.right)
+                    visibleRect.right = viewRect.right;
+
+                if (UpdateRegion && !RectInRegion(UpdateRegion, &visibleRect))
+                    continue;
+
                 PhTnpDrawCell(Context, hdc, &cellRect, node, column, i, j);
+
+                if (cellStates)
+                {
+                    cellStates[column->Id] = PhTnpRegionContainsRect(UpdateRegion, scratchRegion, &visibleRect) ?
+                        PhTnpHashCellState(Context, node, column, i, rowHash) : TNP_CELL_STATE_UNKNOWN;
+                }
             }
 
             SelectClipRgn(hdc, oldClipRegion);
@@ -5119,11 +5515,43 @@ VOID PhTnpPaint(
         rowRect.bottom += Context->RowHeight;
     }
 
-    if (lastRowToUpdate == Context->FlatList->Count - 1) // works even if there are no items
+    if (lastRowToUpdate == PhTnpGetFlatCount(Context) - 1) // works even if there are no items
     {
         // Fill the rest of the space on the bottom with the window color.
         rowRect.bottom = viewRect.bottom;
         FillRect(hdc, &rowRect, GetSysColorBrush(COLOR_WINDOW));
+
+        if (scratchRegion)
+        {
+            ULONG row;
+            RECT emptyRowRect;
+
+            // Record which of the empty rows have been painted.
+
+            emptyRowRect.left = 0;
+            emptyRowRect.right = viewRect.right;
+
+            for (row = PhTnpGetFlatCount(Context) - vScrollPosition; row < Context->CellStateRows; row++)
+            {
+                emptyRowRect.top = Context->HeaderHeight + row * Context->RowHeight;
+                emptyRowRect.bottom = emptyRowRect.top + Context->RowHeight;
+
+                if (RectInRegion(UpdateRegion, &emptyRowRect))
+                {
+                    cellStates = &Context->CellStates[row * Context->CellStateColumns];
+
+                    if (PhTnpRegionContainsRect(UpdateRegion, scratchRegion, &emptyRowRect))
+                    {
+                        for (j = 0; j < (LONG)Context->CellStateColumns; j++)
+                            cellStates[j] = TNP_CELL_STATE_EMPTY;
+                    }
+                    else
+                    {
+                        memset(cellStates, 0, sizeof(ULONG) * Context->CellStateColumns);
+                    }
+                }
+            }
+        }
     }
 
     if (normalTotalX < viewRect.right && viewRect.right > PaintRect->left && normalTotalX < PaintRect->right)
@@ -5136,7 +5564,7 @@ VOID PhTnpPaint(
         FillRect(hdc, &rowRect, GetSysColorBrush(COLOR_WINDOW));
     }
 
-    if (Context->FlatList->Count == 0 && Context->EmptyText.Length != 0)
+    if (PhTnpGetFlatCount(Context) == 0 && Context->EmptyText.Length != 0)
     {
         RECT textRect;
 
@@ -5164,11 +5592,14 @@ VOID PhTnpPaint(
     {
         PhTnpDrawSelectionRectangle(Context, hdc, &Context->DragRect);
     }
+
+    if (scratchRegion)
+        DeleteObject(scratchRegion);
 }
 
 VOID PhTnpPrepareRowForDraw(
     _In_ PPH_TREENEW_CONTEXT Context,
-    _In_ HDC hdc,
+    _In_opt_ HDC hdc,
     _Inout_ PPH_TREENEW_NODE Node
     )
 {
@@ -5441,6 +5872,9 @@ VOID PhTnpDrawCell(
 
     if (PhTnpGetCellText(Context, Node, Column->Id, &text))
     {
+        SIZE textSize;
+        LONG textX;
+
         if (!(textFlags & (DT_PATH_ELLIPSIS | DT_WORD_ELLIPSIS)))
             textFlags |= DT_END_ELLIPSIS;
 
@@ -5452,13 +5886,42 @@ VOID PhTnpDrawCell(
         if (font)
             oldFont = SelectObject(hdc, font);
 
-        DrawText(
-            hdc,
-            text.Buffer,
-            (ULONG)text.Length / 2,
-            &textRect,
-            textFlags
-            );
+        if (
+            PhTnpGetTextExtent(Context, hdc, font ? font : Context->Font, &text, &textSize) &&
+            textSize.cx <= textRect.right - textRect.left
+            )
+        {
+            // The text fits, so we can draw it directly instead of having DrawText measure it again
+            // to find out whether it needs an ellipsis.
+
+            if (textFlags & DT_RIGHT)
+                textX = textRect.right - textSize.cx;
+            else if (textFlags & DT_CENTER)
+                textX = textRect.left + (textRect.right - textRect.left - textSize.cx) / 2;
+            else
+                textX = textRect.left;
+
+            ExtTextOut(
+                hdc,
+                textX,
+                textRect.top + (textRect.bottom - textRect.top - textSize.cy) / 2,
+                0,
+                NULL,
+                text.Buffer,
+                (ULONG)text.Length / 2,
+                NULL
+                );
+        }
+        else
+        {
+            DrawText(
+                hdc,
+                text.Buffer,
+                (ULONG)text.Length / 2,
+                &textRect,
+                textFlags
+                );
+        }
 
         if (font)
             SelectObject(hdc, oldFont);
@@ -5718,6 +6181,273 @@ VOID PhTnpDrawThemedBorder(
     }
 }
 
+VOID PhTnpResetCellStates(
+    _In_ PPH_TREENEW_CONTEXT Context
+    )
+{
+    if (Context->CellStates)
+        memset(Context->CellStates, 0, sizeof(ULONG) * Context->CellStateRows * Context->CellStateColumns);
+}
+
+BOOLEAN PhTnpEnsureCellStates(
+    _In_ PPH_TREENEW_CONTEXT Context
+    )
+{
+    LONG viewHeight;
+    ULONG rows;
+    ULONG columns;
+
+    viewHeight = Context->ClientRect.bottom - Context->HeaderHeight;
+    rows = viewHeight > 0 ? (viewHeight + Context->RowHeight - 1) / Context->RowHeight : 0;
+    columns = Context->NextId;
+
+    if (rows == 0 || columns == 0)
+        return FALSE;
+
+    if (Context->CellStateRows != rows || Context->CellStateColumns != columns)
+    {
+        if (Context->CellStates)
+            PhFree(Context->CellStates);
+
+        Context->CellStates = PhAllocate(sizeof(ULONG) * rows * columns);
+        Context->CellStateRows = rows;
+        Context->CellStateColumns = columns;
+        PhTnpResetCellStates(Context);
+    }
+    else if (
+        Context->CellStateRowHeight != Context->RowHeight ||
+        Context->CellStateHeaderHeight != Context->HeaderHeight ||
+        Context->CellStateNormalLeft != Context->NormalLeft ||
+        Context->CellStateHScrollPosition != Context->HScrollPosition
+        )
+    {
+        // The cells have moved without the window contents being scrolled.
+        PhTnpResetCellStates(Context);
+    }
+
+    Context->CellStateRowHeight = Context->RowHeight;
+    Context->CellStateHeaderHeight = Context->HeaderHeight;
+    Context->CellStateNormalLeft = Context->NormalLeft;
+    Context->CellStateHScrollPosition = Context->HScrollPosition;
+
+    return TRUE;
+}
+
+VOID PhTnpScrollCellStates(
+    _In_ PPH_TREENEW_CONTEXT Context,
+    _In_ LONG DeltaRows,
+    _In_ LONG DeltaX
+    )
+{
+    ULONG rowSize;
+    ULONG rows;
+
+    if (!Context->CellStates)
+        return;
+
+    // The states are indexed by view row, so they have to move along with the window contents.
+    // Horizontal scrolling moves the cells and their contents together.
+
+    if (Context->CellStateHScrollPosition != Context->HScrollPosition - DeltaX)
+    {
+        PhTnpResetCellStates(Context);
+        return;
+    }
+
+    Context->CellStateHScrollPosition = Context->HScrollPosition;
+
+    rowSize = sizeof(ULONG) * Context->CellStateColumns;
+
+    if (DeltaRows >= (LONG)Context->CellStateRows || -DeltaRows >= (LONG)Context->CellStateRows)
+    {
+        PhTnpResetCellStates(Context);
+    }
+    else if (DeltaRows > 0)
+    {
+        rows = Context->CellStateRows - DeltaRows;
+        memmove(Context->CellStates, (PCHAR)Context->CellStates + DeltaRows * rowSize, rows * rowSize);
+        memset((PCHAR)Context->CellStates + rows * rowSize, 0, DeltaRows * rowSize);
+    }
+    else if (DeltaRows < 0)
+    {
+        rows = Context->CellStateRows + DeltaRows;
+        memmove((PCHAR)Context->CellStates - DeltaRows * rowSize, Context->CellStates, rows * rowSize);
+        memset(Context->CellStates, 0, -DeltaRows * rowSize);
+    }
+}
+
+ULONG PhTnpHashRowState(
+    _In_ PPH_TREENEW_CONTEXT Context,
+    _In_ PPH_TREENEW_NODE Node,
+    _In_ LONG RowIndex
+    )
+{
+    ULONG hash = 0x811c9dc5;
+
+    // This must include everything that PhTnpPaint uses to draw the row background. The node must
+    // have been prepared by PhTnpPrepareRowForDraw.
+
+    hash = TNP_HASH_COMBINE(hash, Node->Selected);
+    hash = TNP_HASH_COMBINE(hash, Node->Selected && Context->HasFocus);
+    hash = TNP_HASH_COMBINE(hash, (ULONG)RowIndex == Context->HotNodeIndex);
+    hash = TNP_HASH_COMBINE(hash, Node->s.DrawForeColor);
+    hash = TNP_HASH_COMBINE(hash, Node->s.DrawBackColor);
+    hash = TNP_HASH_COMBINE(hash, PhHashIntPtr((ULONG_PTR)Node->Font));
+
+    return hash;
+}
+
+ULONG PhTnpHashCellState(
+    _In_ PPH_TREENEW_CONTEXT Context,
+    _In_ PPH_TREENEW_NODE Node,
+    _In_ PPH_TREENEW_COLUMN Column,
+    _In_ LONG RowIndex,
+    _In_ ULONG RowHash
+    )
+{
+    ULONG hash;
+    PH_STRINGREF text;
+
+    // We don't know what custom drawn cells look like.
+    if (Column->CustomDraw)
+        return TNP_CELL_STATE_UNKNOWN;
+
+    // This must include everything that PhTnpDrawCell uses.
+
+    hash = TNP_HASH_COMBINE(RowHash, Column->Width);
+    hash = TNP_HASH_COMBINE(hash, Column->TextFlags);
+
+    if (Column == Context->FirstColumn)
+    {
+        hash = TNP_HASH_COMBINE(hash, Node->Level);
+        hash = TNP_HASH_COMBINE(hash, Context->CanAnyExpand);
+        hash = TNP_HASH_COMBINE(hash, Node->s.IsLeaf);
+        hash = TNP_HASH_COMBINE(hash, Node->Expanded);
+        hash = TNP_HASH_COMBINE(hash, (ULONG)RowIndex == Context->HotNodeIndex && Node->s.PlusMinusHot);
+        hash = TNP_HASH_COMBINE(hash, PhHashIntPtr((ULONG_PTR)Node->Icon));
+    }
+
+    if (PhTnpGetCellText(Context, Node, Column->Id, &text))
+        hash = TNP_HASH_COMBINE(hash, PhHashStringRef(&text, FALSE));
+
+    // Don't collide with the special states.
+    if (hash <= TNP_CELL_STATE_EMPTY)
+        hash += TNP_CELL_STATE_EMPTY + 1;
+
+    return hash;
+}
+
+/**
+ * Invalidates the visible cells whose contents differ from what was last painted.
+ *
+ * \remarks This allows callers to invalidate the whole view on every update without redrawing
+ * cells that have not changed. Custom drawn cells are always invalidated.
+ */
+VOID PhTnpInvalidateChangedCells(
+    _In_ PPH_TREENEW_CONTEXT Context
+    )
+{
+    LONG viewRight;
+    ULONG row;
+    ULONG index;
+    ULONG j;
+    PULONG cellStates;
+    PPH_TREENEW_NODE node;
+    PPH_TREENEW_COLUMN column;
+    ULONG rowHash;
+    ULONG hash;
+    LONG x;
+    RECT cellRect;
+
+    if (
+        Context->EnableRedraw <= 0 ||
+        Context->DragSelectionActive ||
+        (PhTnpGetFlatCount(Context) == 0 && Context->EmptyText.Length != 0) ||
+        !PhTnpEnsureCellStates(Context)
+        )
+    {
+        InvalidateRect(Context->Handle, NULL, FALSE);
+        return;
+    }
+
+    viewRight = Context->ClientRect.right - (Context->VScrollVisible ? Context->VScrollWidth : 0);
+    cellRect.top = Context->HeaderHeight;
+
+    for (row = 0; row < Context->CellStateRows; row++)
+    {
+        cellStates = &Context->CellStates[row * Context->CellStateColumns];
+        index = Context->VScrollPosition + row;
+        cellRect.bottom = cellRect.top + Context->RowHeight;
+
+        if (index >= PhTnpGetFlatCount(Context))
+        {
+            for (j = 0; j < Context->CellStateColumns; j++)
+            {
+                if (cellStates[j] != TNP_CELL_STATE_EMPTY)
+                {
+                    cellRect.left = 0;
+                    cellRect.right = viewRight;
+                    InvalidateRect(Context->Handle, &cellRect, FALSE);
+                    break;
+                }
+            }
+        }
+        else
+        {
+            node = PhTnpGetFlatNode(Context, index);
+            PhTnpPrepareRowForDraw(Context, NULL, node);
+            rowHash = PhTnpHashRowState(Context, node, index);
+
+            if (Context->FixedColumnVisible)
+            {
+                column = Context->FixedColumn;
+                hash = PhTnpHashCellState(Context, node, column, index, rowHash);
+
+                if (hash == TNP_CELL_STATE_UNKNOWN || cellStates[column->Id] != hash)
+                {
+                    cellRect.left = 0;
+                    cellRect.right = Context->FixedWidth;
+                    InvalidateRect(Context->Handle, &cellRect, FALSE);
+                }
+            }
+
+            x = Context->NormalLeft - Context->HScrollPosition;
+
+            for (j = 0; j < Context->NumberOfColumnsByDisplay; j++)
+            {
+                column = Context->ColumnsByDisplay[j];
+
+                if (x + column->Width > Context->NormalLeft && x < viewRight)
+                {
+                    hash = PhTnpHashCellState(Context, node, column, index, rowHash);
+
+                    if (hash == TNP_CELL_STATE_UNKNOWN || cellStates[column->Id] != hash)
+                    {
+                        cellRect.left = max(x, Context->NormalLeft);
+                        cellRect.right = min(x + column->Width, viewRight);
+                        InvalidateRect(Context->Handle, &cellRect, FALSE);
+                    }
+                }
+
+                x += column->Width;
+            }
+        }
+
+        cellRect.top = cellRect.bottom;
+    }
+}
+
+BOOLEAN PhTnpRegionContainsRect(
+    _In_ HRGN Region,
+    _In_ HRGN ScratchRegion,
+    _In_ PRECT Rect
+    )
+{
+    SetRectRgn(ScratchRegion, Rect->left, Rect->top, Rect->right, Rect->bottom);
+
+    return CombineRgn(ScratchRegion, ScratchRegion, Region, RGN_DIFF) == NULLREGION;
+}
+
 VOID PhTnpInitializeTooltips(
     _In_ PPH_TREENEW_CONTEXT Context
     )
@@ -6402,7 +7132,7 @@ VOID PhTnpDragSelect(
                 viewLeft = Context->FixedColumnVisible ? 0 : -Context->HScrollPosition;
                 viewTop = Context->HeaderHeight - Context->VScrollPosition;
                 viewRight = Context->NormalLeft + Context->TotalViewX - Context->HScrollPosition;
-                viewBottom = Context->HeaderHeight + ((LONG)Context->FlatList->Count - Context->VScrollPosition) * Context->RowHeight;
+                viewBottom = Context->HeaderHeight + ((LONG)PhTnpGetFlatCount(Context) - Context->VScrollPosition) * Context->RowHeight;
 
                 temp = Context->ClientRect.right - (Context->VScrollVisible ? Context->VScrollWidth : 0);
                 viewRight = max(viewRight, temp);
@@ -6532,8 +7262,8 @@ VOID PhTnpProcessDragSelect(
 
     if (firstRow < 0)
         firstRow = 0;
-    if (lastRow >= (LONG)Context->FlatList->Count)
-        lastRow = Context->FlatList->Count - 1;
+    if (lastRow >= (LONG)PhTnpGetFlatCount(Context))
+        lastRow = PhTnpGetFlatCount(Context) - 1;
 
     rowRect.left = 0;
     rowRect.top = Context->HeaderHeight + (firstRow - Context->VScrollPosition) * Context->RowHeight;
@@ -6549,7 +7279,7 @@ VOID PhTnpProcessDragSelect(
         BOOLEAN inOldRect;
         BOOLEAN inNewRect;
 
-        node = Context->FlatList->Items[i];
+        node = PhTnpGetFlatNode(Context, i);
 
         inOldRect = rowRect.top < OldRect->bottom && rowRect.bottom > OldRect->top &&
             rowRect.left < OldRect->right && rowRect.right > OldRect->left;
@@ -6642,6 +7372,102 @@ VOID PhTnpDestroyBufferedContext(
     Context->BufferedBitmap = NULL;
 }
 
+BOOLEAN PhTnpGetTextExtent(
+    _In_ PPH_TREENEW_CONTEXT Context,
+    _In_opt_ HDC hdc,
+    _In_ HFONT Font,
+    _In_ PPH_STRINGREF Text,
+    _Out_ PSIZE Size
+    )
+{
+    PH_TREENEW_TEXT_EXTENT lookupEntry;
+    PPH_TREENEW_TEXT_EXTENT entry;
+    HDC measureDc;
+    HFONT oldFont;
+    BOOLEAN result;
+
+    if (!Context->TextExtentCache)
+    {
+        Context->TextExtentCache = PhCreateHashtable(
+            sizeof(PH_TREENEW_TEXT_EXTENT),
+            PhTnpTextExtentCompareFunction,
+            PhTnpTextExtentHashFunction,
+            256
+            );
+    }
+
+    lookupEntry.Font = Font;
+    lookupEntry.Text = *Text;
+
+    if (entry = PhFindEntryHashtable(Context->TextExtentCache, &lookupEntry))
+    {
+        *Size = entry->Size;
+        return TRUE;
+    }
+
+    if (hdc)
+        measureDc = hdc;
+    else if (!(measureDc = GetDC(Context->Handle)))
+        return FALSE;
+
+    oldFont = SelectObject(measureDc, Font);
+    result = !!GetTextExtentPoint32(measureDc, Text->Buffer, (ULONG)Text->Length / sizeof(WCHAR), Size);
+    SelectObject(measureDc, oldFont);
+
+    if (!hdc)
+        ReleaseDC(Context->Handle, measureDc);
+
+    if (result)
+    {
+        if (Context->TextExtentCache->Count >= TNP_TEXT_EXTENT_CACHE_LIMIT)
+            PhTnpClearTextExtentCache(Context);
+
+        lookupEntry.Text.Buffer = PhAllocateCopy(Text->Buffer, Text->Length);
+        lookupEntry.Size = *Size;
+        PhAddEntryHashtable(Context->TextExtentCache, &lookupEntry);
+    }
+
+    return result;
+}
+
+VOID PhTnpClearTextExtentCache(
+    _In_ PPH_TREENEW_CONTEXT Context
+    )
+{
+    PH_HASHTABLE_ENUM_CONTEXT enumContext;
+    PPH_TREENEW_TEXT_EXTENT entry;
+
+    if (!Context->TextExtentCache)
+        return;
+
+    PhBeginEnumHashtable(Context->TextExtentCache, &enumContext);
+
+    while (entry = PhNextEnumHashtable(&enumContext))
+        PhFree(entry->Text.Buffer);
+
+    PhClearHashtable(Context->TextExtentCache);
+}
+
+BOOLEAN NTAPI PhTnpTextExtentCompareFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    )
+{
+    PPH_TREENEW_TEXT_EXTENT entry1 = Entry1;
+    PPH_TREENEW_TEXT_EXTENT entry2 = Entry2;
+
+    return entry1->Font == entry2->Font && PhEqualStringRef(&entry1->Text, &entry2->Text, FALSE);
+}
+
+ULONG NTAPI PhTnpTextExtentHashFunction(
+    _In_ PVOID Entry
+    )
+{
+    PPH_TREENEW_TEXT_EXTENT entry = Entry;
+
+    return PhHashStringRef(&entry->Text, FALSE) ^ PhHashIntPtr((ULONG_PTR)entry->Font);
+}
+
 VOID PhTnpGetMessagePos(
     _In_ HWND hwnd,
     _Out_ PPOINT ClientPoint
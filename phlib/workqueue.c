@@ -20,10 +20,32 @@
  * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+/*
+ * In work stealing mode, each worker thread owns a fixed-size deque. The owner pushes and pops
+ * items at the bottom of its deque without taking any locks, while idle workers steal items from
+ * the top. Items queued from outside the worker threads are pushed onto a lock-free injection list,
+ * which a worker takes as a whole and moves onto its deque. Idle workers sleep on the semaphore,
+ * which is only released when some worker is idle.
+ */
+
 #define _PH_WORKQUEUE_PRIVATE
 #include <phbase.h>
 #include <phintrnl.h>
 
+#define PH_WORK_QUEUE_DEQUE_SIZE 256 // must be a power of two
+
+typedef struct _PH_WORK_QUEUE_DEQUE
+{
+    PPH_WORK_QUEUE WorkQueue;
+    ULONG Index;
+    BOOLEAN InUse;
+
+    volatile ULONG Top;
+    PPH_WORK_QUEUE_ITEM Items[PH_WORK_QUEUE_DEQUE_SIZE];
+    // Kept apart from Top, which is modified by other threads.
+    volatile ULONG Bottom;
+} PH_WORK_QUEUE_DEQUE, *PPH_WORK_QUEUE_DEQUE;
+
 HANDLE PhpGetSemaphoreWorkQueue(
     _Inout_ PPH_WORK_QUEUE WorkQueue
     );
@@ -36,29 +58,38 @@ NTSTATUS PhpWorkQueueThreadStart(
     _In_ PVOID Parameter
     );
 
+NTSTATUS PhpWorkQueueStealingThreadStart(
+    _In_ PVOID Parameter
+    );
+
+PPH_OBJECT_TYPE PhWorkQueueCancelTokenType;
+
 static PH_FREE_LIST PhWorkQueueItemFreeList;
+static ULONG PhpWorkQueueDequeTlsIndex;
 static PH_WORK_QUEUE PhGlobalWorkQueue;
 static PH_INITONCE PhGlobalWorkQueueInitOnce = PH_INITONCE_INIT;
-#ifdef DEBUG
+// The list of work queues is used by the debug console and the diagnostics sampler, so we
+// maintain it in release builds as well.
 PPH_LIST PhDbgWorkQueueList;
 PH_QUEUED_LOCK PhDbgWorkQueueListLock = PH_QUEUED_LOCK_INIT;
-#endif
 
 VOID PhWorkQueueInitialization(
     VOID
     )
 {
+    PhWorkQueueCancelTokenType = PhCreateObjectType(L"WorkQueueCancelToken", 0, NULL);
     PhInitializeFreeList(&PhWorkQueueItemFreeList, sizeof(PH_WORK_QUEUE_ITEM), 32);
+    // If this fails, items queued by worker threads go through the injection list.
+    PhpWorkQueueDequeTlsIndex = TlsAlloc();
 
-#ifdef DEBUG
     PhDbgWorkQueueList = PhCreateList(4);
-#endif
 }
 
 FORCEINLINE PPH_WORK_QUEUE_ITEM PhpCreateWorkQueueItem(
     _In_ PUSER_THREAD_START_ROUTINE Function,
     _In_opt_ PVOID Context,
-    _In_opt_ PPH_WORK_QUEUE_ITEM_DELETE_FUNCTION DeleteFunction
+    _In_opt_ PPH_WORK_QUEUE_ITEM_DELETE_FUNCTION DeleteFunction,
+    _In_opt_ PPH_WORK_QUEUE_ENVIRONMENT Environment
     )
 {
     PPH_WORK_QUEUE_ITEM workQueueItem;
@@ -68,6 +99,26 @@ FORCEINLINE PPH_WORK_QUEUE_ITEM PhpCreateWorkQueueItem(
     workQueueItem->Context = Context;
     workQueueItem->DeleteFunction = DeleteFunction;
 
+    if (Environment)
+    {
+        assert(Environment->Priority < PH_WORK_QUEUE_PRIORITY_COUNT);
+
+        workQueueItem->Priority = Environment->Priority;
+        workQueueItem->Deadline = Environment->Timeout != 0 ? NtGetTickCount64() + Environment->Timeout : 0;
+        workQueueItem->CancelToken = Environment->CancelToken;
+        workQueueItem->CancelFunction = Environment->CancelFunction;
+
+        if (workQueueItem->CancelToken)
+            PhReferenceObject(workQueueItem->CancelToken);
+    }
+    else
+    {
+        workQueueItem->Priority = PH_WORK_QUEUE_PRIORITY_NORMAL;
+        workQueueItem->Deadline = 0;
+        workQueueItem->CancelToken = NULL;
+        workQueueItem->CancelFunction = NULL;
+    }
+
     return workQueueItem;
 }
 
@@ -78,14 +129,176 @@ FORCEINLINE VOID PhpDestroyWorkQueueItem(
     if (WorkQueueItem->DeleteFunction)
         WorkQueueItem->DeleteFunction(WorkQueueItem->Function, WorkQueueItem->Context);
 
+    if (WorkQueueItem->CancelToken)
+        PhDereferenceObject(WorkQueueItem->CancelToken);
+
     PhFreeToFreeList(&PhWorkQueueItemFreeList, WorkQueueItem);
 }
 
+/**
+ * Frees a work queue item which will never be executed.
+ */
+FORCEINLINE VOID PhpDropWorkQueueItem(
+    _In_ PPH_WORK_QUEUE_ITEM WorkQueueItem
+    )
+{
+    if (WorkQueueItem->CancelFunction)
+        WorkQueueItem->CancelFunction(WorkQueueItem->Function, WorkQueueItem->Context);
+
+    PhpDestroyWorkQueueItem(WorkQueueItem);
+}
+
 FORCEINLINE VOID PhpExecuteWorkQueueItem(
     _Inout_ PPH_WORK_QUEUE_ITEM WorkQueueItem
     )
 {
-    WorkQueueItem->Function(WorkQueueItem->Context);
+    // Items which were cancelled or have passed their deadline while waiting in the queue are
+    // dropped instead.
+    if ((WorkQueueItem->CancelToken && WorkQueueItem->CancelToken->Cancelled) ||
+        (WorkQueueItem->Deadline != 0 && NtGetTickCount64() >= WorkQueueItem->Deadline))
+    {
+        PHLIB_INC_STATISTIC(WqWorkItemsDropped);
+
+        if (WorkQueueItem->CancelFunction)
+            WorkQueueItem->CancelFunction(WorkQueueItem->Function, WorkQueueItem->Context);
+
+        return;
+    }
+
+    if (PhTraceEnabled(PH_TRACE_KEYWORD_WORK_QUEUE))
+    {
+        NTSTATUS status;
+
+        PhTraceWorkItemStart(WorkQueueItem->Function, WorkQueueItem->Context);
+        status = WorkQueueItem->Function(WorkQueueItem->Context);
+        PhTraceWorkItemStop(WorkQueueItem->Function, status);
+    }
+    else
+    {
+        WorkQueueItem->Function(WorkQueueItem->Context);
+    }
+}
+
+/**
+ * Pushes an item onto the bottom of a deque. Only the owner of the deque may call this function.
+ *
+ * \return TRUE if the item was pushed, or FALSE if the deque is full.
+ */
+FORCEINLINE BOOLEAN PhpPushWorkQueueDeque(
+    _Inout_ PPH_WORK_QUEUE_DEQUE Deque,
+    _In_ PPH_WORK_QUEUE_ITEM WorkQueueItem
+    )
+{
+    ULONG bottom;
+
+    bottom = Deque->Bottom;
+
+    if (bottom - Deque->Top >= PH_WORK_QUEUE_DEQUE_SIZE)
+        return FALSE;
+
+    Deque->Items[bottom & (PH_WORK_QUEUE_DEQUE_SIZE - 1)] = WorkQueueItem;
+    // Publish the item before the new bottom.
+    _InterlockedExchange((volatile LONG *)&Deque->Bottom, bottom + 1);
+
+    return TRUE;
+}
+
+/**
+ * Pops the most recently pushed item from the bottom of a deque. Only the owner of the deque may
+ * call this function.
+ */
+FORCEINLINE PPH_WORK_QUEUE_ITEM PhpPopWorkQueueDeque(
+    _Inout_ PPH_WORK_QUEUE_DEQUE Deque
+    )
+{
+    ULONG bottom;
+    ULONG top;
+    PPH_WORK_QUEUE_ITEM workQueueItem;
+
+    bottom = Deque->Bottom - 1;
+    // The new bottom must be visible to stealers before we read the top.
+    _InterlockedExchange((volatile LONG *)&Deque->Bottom, bottom);
+    top = Deque->Top;
+
+    if ((LONG)(bottom - top) < 0)
+    {
+        // The deque is empty.
+        Deque->Bottom = top;
+        return NULL;
+    }
+
+    workQueueItem = Deque->Items[bottom & (PH_WORK_QUEUE_DEQUE_SIZE - 1)];
+
+    if (bottom != top)
+        return workQueueItem;
+
+    // This is the last item, and a stealer may be trying to take it too.
+    if ((ULONG)_InterlockedCompareExchange((volatile LONG *)&Deque->Top, top + 1, top) != top)
+        workQueueItem = NULL;
+
+    Deque->Bottom = top + 1;
+
+    return workQueueItem;
+}
+
+/**
+ * Steals the oldest item from the top of a deque. Any thread may call this function.
+ */
+FORCEINLINE PPH_WORK_QUEUE_ITEM PhpStealWorkQueueDeque(
+    _Inout_ PPH_WORK_QUEUE_DEQUE Deque
+    )
+{
+    ULONG top;
+    ULONG bottom;
+    PPH_WORK_QUEUE_ITEM workQueueItem;
+
+    top = Deque->Top;
+    bottom = Deque->Bottom;
+
+    if ((LONG)(bottom - top) <= 0)
+        return NULL;
+
+    workQueueItem = Deque->Items[top & (PH_WORK_QUEUE_DEQUE_SIZE - 1)];
+
+    // If this fails, the owner or another stealer took the item.
+    if ((ULONG)_InterlockedCompareExchange((volatile LONG *)&Deque->Top, top + 1, top) != top)
+        return NULL;
+
+    return workQueueItem;
+}
+
+FORCEINLINE VOID PhpPushInjectionListWorkQueue(
+    _Inout_ PPH_WORK_QUEUE WorkQueue,
+    _In_ PPH_WORK_QUEUE_ITEM WorkQueueItem
+    )
+{
+    PPH_WORK_QUEUE_ITEM head;
+
+    // The list is only ever removed as a whole, so this is not affected by the ABA problem.
+    do
+    {
+        head = WorkQueue->InjectionListHeads[WorkQueueItem->Priority];
+        WorkQueueItem->Next = head;
+    } while (_InterlockedCompareExchangePointer(
+        (PVOID volatile *)&WorkQueue->InjectionListHeads[WorkQueueItem->Priority],
+        WorkQueueItem,
+        head
+        ) != head);
+}
+
+FORCEINLINE BOOLEAN PhpIsQueueEmptyWorkQueue(
+    _In_ PPH_WORK_QUEUE WorkQueue
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < PH_WORK_QUEUE_PRIORITY_COUNT; i++)
+    {
+        if (!IsListEmpty(&WorkQueue->QueueListHeads[i]))
+            return FALSE;
+    }
+
+    return TRUE;
 }
 
 /**
@@ -105,10 +318,44 @@ VOID PhInitializeWorkQueue(
     _In_ ULONG NoWorkTimeout
     )
 {
+    PhInitializeWorkQueueEx(WorkQueue, MinimumThreads, MaximumThreads, NoWorkTimeout, 0);
+}
+
+/**
+ * Initializes a work queue.
+ *
+ * \param WorkQueue A work queue object.
+ * \param MinimumThreads The suggested minimum number of threads to keep alive, even
+ * when there is no work to be performed.
+ * \param MaximumThreads The suggested maximum number of threads to create.
+ * \param NoWorkTimeout The number of milliseconds after which threads without work
+ * will terminate.
+ * \param Flags A combination of flags.
+ * \li \c PH_WORK_QUEUE_WORK_STEALING Each worker thread keeps its own queue of items and
+ * takes items from other threads when it runs out. This avoids contention on a single
+ * queue lock when there are many worker threads, but items are no longer executed in a strict
+ * first-in, first-out order.
+ */
+VOID PhInitializeWorkQueueEx(
+    _Out_ PPH_WORK_QUEUE WorkQueue,
+    _In_ ULONG MinimumThreads,
+    _In_ ULONG MaximumThreads,
+    _In_ ULONG NoWorkTimeout,
+    _In_ ULONG Flags
+    )
+{
+    ULONG i;
+
     PhInitializeRundownProtection(&WorkQueue->RundownProtect);
     WorkQueue->Terminating = FALSE;
+    WorkQueue->Flags = Flags;
+
+    for (i = 0; i < PH_WORK_QUEUE_PRIORITY_COUNT; i++)
+    {
+        InitializeListHead(&WorkQueue->QueueListHeads[i]);
+        WorkQueue->InjectionListHeads[i] = NULL;
+    }
 
-    InitializeListHead(&WorkQueue->QueueListHead);
     PhInitializeQueuedLock(&WorkQueue->QueueLock);
     PhInitializeQueuedLock(&WorkQueue->QueueEmptyCondition);
 
@@ -121,12 +368,30 @@ VOID PhInitializeWorkQueue(
     WorkQueue->SemaphoreHandle = NULL;
     WorkQueue->CurrentThreads = 0;
     WorkQueue->BusyCount = 0;
+    WorkQueue->ExecutingCount = 0;
+
+    WorkQueue->Deques = NULL;
+    WorkQueue->IdleCount = 0;
+    WorkQueue->QueuedCount = 0;
+
+    if ((Flags & PH_WORK_QUEUE_WORK_STEALING) && MaximumThreads != 0)
+    {
+        // There is one deque for each thread that can exist at a time.
+        WorkQueue->Deques = PhAllocate(sizeof(PH_WORK_QUEUE_DEQUE) * MaximumThreads);
+
+        for (i = 0; i < MaximumThreads; i++)
+        {
+            WorkQueue->Deques[i].WorkQueue = WorkQueue;
+            WorkQueue->Deques[i].Index = i;
+            WorkQueue->Deques[i].InUse = FALSE;
+            WorkQueue->Deques[i].Top = 0;
+            WorkQueue->Deques[i].Bottom = 0;
+        }
+    }
 
-#ifdef DEBUG
     PhAcquireQueuedLockExclusive(&PhDbgWorkQueueListLock);
     PhAddItemList(PhDbgWorkQueueList, WorkQueue);
     PhReleaseQueuedLockExclusive(&PhDbgWorkQueueListLock);
-#endif
 }
 
 /**
@@ -140,16 +405,13 @@ VOID PhDeleteWorkQueue(
 {
     PLIST_ENTRY listEntry;
     PPH_WORK_QUEUE_ITEM workQueueItem;
-#ifdef DEBUG
+    ULONG i;
     ULONG index;
-#endif
 
-#ifdef DEBUG
     PhAcquireQueuedLockExclusive(&PhDbgWorkQueueListLock);
     if ((index = PhFindItemList(PhDbgWorkQueueList, WorkQueue)) != -1)
         PhRemoveItemList(PhDbgWorkQueueList, index);
     PhReleaseQueuedLockExclusive(&PhDbgWorkQueueListLock);
-#endif
 
     // Wait for all worker threads to exit.
 
@@ -163,13 +425,44 @@ VOID PhDeleteWorkQueue(
 
     // Free all un-executed work items.
 
-    listEntry = WorkQueue->QueueListHead.Flink;
+    for (i = 0; i < PH_WORK_QUEUE_PRIORITY_COUNT; i++)
+    {
+        listEntry = WorkQueue->QueueListHeads[i].Flink;
 
-    while (listEntry != &WorkQueue->QueueListHead)
+        while (listEntry != &WorkQueue->QueueListHeads[i])
+        {
+            workQueueItem = CONTAINING_RECORD(listEntry, PH_WORK_QUEUE_ITEM, ListEntry);
+            listEntry = listEntry->Flink;
+            PhpDropWorkQueueItem(workQueueItem);
+        }
+    }
+
+    if (WorkQueue->Flags & PH_WORK_QUEUE_WORK_STEALING)
     {
-        workQueueItem = CONTAINING_RECORD(listEntry, PH_WORK_QUEUE_ITEM, ListEntry);
-        listEntry = listEntry->Flink;
-        PhpDestroyWorkQueueItem(workQueueItem);
+        PPH_WORK_QUEUE_ITEM nextItem;
+
+        for (i = 0; i < PH_WORK_QUEUE_PRIORITY_COUNT; i++)
+        {
+            workQueueItem = WorkQueue->InjectionListHeads[i];
+
+            while (workQueueItem)
+            {
+                nextItem = workQueueItem->Next;
+                PhpDropWorkQueueItem(workQueueItem);
+                workQueueItem = nextItem;
+            }
+        }
+
+        if (WorkQueue->Deques)
+        {
+            for (i = 0; i < WorkQueue->MaximumThreads; i++)
+            {
+                while (workQueueItem = PhpStealWorkQueueDeque(&WorkQueue->Deques[i]))
+                    PhpDropWorkQueueItem(workQueueItem);
+            }
+
+            PhFree(WorkQueue->Deques);
+        }
     }
 
     if (WorkQueue->SemaphoreHandle)
@@ -187,8 +480,16 @@ VOID PhWaitForWorkQueue(
 {
     PhAcquireQueuedLockExclusive(&WorkQueue->QueueLock);
 
-    while (!IsListEmpty(&WorkQueue->QueueListHead))
-        PhWaitForCondition(&WorkQueue->QueueEmptyCondition, &WorkQueue->QueueLock, NULL);
+    if (WorkQueue->Flags & PH_WORK_QUEUE_WORK_STEALING)
+    {
+        while (WorkQueue->QueuedCount != 0)
+            PhWaitForCondition(&WorkQueue->QueueEmptyCondition, &WorkQueue->QueueLock, NULL);
+    }
+    else
+    {
+        while (!PhpIsQueueEmptyWorkQueue(WorkQueue))
+            PhWaitForCondition(&WorkQueue->QueueEmptyCondition, &WorkQueue->QueueLock, NULL);
+    }
 
     PhReleaseQueuedLockExclusive(&WorkQueue->QueueLock);
 }
@@ -226,12 +527,34 @@ BOOLEAN PhpCreateWorkQueueThread(
     )
 {
     HANDLE threadHandle;
+    PPH_WORK_QUEUE_DEQUE deque = NULL;
+    ULONG i;
 
     // Make sure the structure doesn't get deleted while the thread is running.
     if (!PhAcquireRundownProtection(&WorkQueue->RundownProtect))
         return FALSE;
 
-    threadHandle = PhCreateThread(0, PhpWorkQueueThreadStart, WorkQueue);
+    if (WorkQueue->Flags & PH_WORK_QUEUE_WORK_STEALING)
+    {
+        // Give the thread a deque. There is always a free one because the caller holds the
+        // state lock and there are fewer than MaximumThreads threads.
+        for (i = 0; i < WorkQueue->MaximumThreads; i++)
+        {
+            if (!WorkQueue->Deques[i].InUse)
+            {
+                deque = &WorkQueue->Deques[i];
+                deque->InUse = TRUE;
+                break;
+            }
+        }
+
+        assert(deque);
+        threadHandle = PhCreateThread(0, PhpWorkQueueStealingThreadStart, deque);
+    }
+    else
+    {
+        threadHandle = PhCreateThread(0, PhpWorkQueueThreadStart, WorkQueue);
+    }
 
     if (threadHandle)
     {
@@ -244,6 +567,10 @@ BOOLEAN PhpCreateWorkQueueThread(
     else
     {
         PHLIB_INC_STATISTIC(WqWorkQueueThreadsCreateFailed);
+
+        if (deque)
+            deque->InUse = FALSE;
+
         PhReleaseRundownProtection(&WorkQueue->RundownProtect);
         return FALSE;
     }
@@ -302,25 +629,35 @@ NTSTATUS PhpWorkQueueThreadStart(
 
         if (status == STATUS_WAIT_0 && !workQueue->Terminating)
         {
-            PLIST_ENTRY listEntry;
+            PLIST_ENTRY listEntry = NULL;
+            ULONG i;
 
-            // Dequeue the work item.
+            // Dequeue the oldest work item with the highest priority.
 
             PhAcquireQueuedLockExclusive(&workQueue->QueueLock);
 
-            listEntry = RemoveHeadList(&workQueue->QueueListHead);
+            for (i = 0; i < PH_WORK_QUEUE_PRIORITY_COUNT; i++)
+            {
+                if (!IsListEmpty(&workQueue->QueueListHeads[i]))
+                {
+                    listEntry = RemoveHeadList(&workQueue->QueueListHeads[i]);
+                    break;
+                }
+            }
 
-            if (IsListEmpty(&workQueue->QueueListHead))
+            if (PhpIsQueueEmptyWorkQueue(workQueue))
                 PhPulseCondition(&workQueue->QueueEmptyCondition);
 
             PhReleaseQueuedLockExclusive(&workQueue->QueueLock);
 
             // Make sure we got work.
-            if (listEntry != &workQueue->QueueListHead)
+            if (listEntry)
             {
                 workQueueItem = CONTAINING_RECORD(listEntry, PH_WORK_QUEUE_ITEM, ListEntry);
 
+                _InterlockedIncrement(&workQueue->ExecutingCount);
                 PhpExecuteWorkQueueItem(workQueueItem);
+                _InterlockedDecrement(&workQueue->ExecutingCount);
                 _InterlockedDecrement(&workQueue->BusyCount);
 
                 PhpDestroyWorkQueueItem(workQueueItem);
@@ -353,6 +690,203 @@ NTSTATUS PhpWorkQueueThreadStart(
     return STATUS_SUCCESS;
 }
 
+static BOOLEAN PhpHasWorkWorkQueue(
+    _In_ PPH_WORK_QUEUE WorkQueue
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < PH_WORK_QUEUE_PRIORITY_COUNT; i++)
+    {
+        if (WorkQueue->InjectionListHeads[i])
+            return TRUE;
+    }
+
+    for (i = 0; i < WorkQueue->MaximumThreads; i++)
+    {
+        if ((LONG)(WorkQueue->Deques[i].Bottom - WorkQueue->Deques[i].Top) > 0)
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+/**
+ * Moves everything on an injection list onto a deque.
+ */
+static VOID PhpTakeInjectionListWorkQueue(
+    _Inout_ PPH_WORK_QUEUE WorkQueue,
+    _Inout_ PPH_WORK_QUEUE_DEQUE Deque,
+    _In_ ULONG Priority
+    )
+{
+    PPH_WORK_QUEUE_ITEM workQueueItem;
+    PPH_WORK_QUEUE_ITEM nextItem;
+
+    if (!WorkQueue->InjectionListHeads[Priority])
+        return;
+
+    // The list is in reverse order, so pushing the items in list order leaves the oldest item at
+    // the bottom where we pop it first.
+
+    workQueueItem = _InterlockedExchangePointer((PVOID volatile *)&WorkQueue->InjectionListHeads[Priority], NULL);
+
+    while (workQueueItem)
+    {
+        nextItem = workQueueItem->Next;
+
+        if (!PhpPushWorkQueueDeque(Deque, workQueueItem))
+        {
+            // The deque is full. Put the rest back.
+            while (workQueueItem)
+            {
+                nextItem = workQueueItem->Next;
+                PhpPushInjectionListWorkQueue(WorkQueue, workQueueItem);
+                workQueueItem = nextItem;
+            }
+
+            break;
+        }
+
+        workQueueItem = nextItem;
+    }
+}
+
+static PPH_WORK_QUEUE_ITEM PhpFindWorkWorkQueue(
+    _Inout_ PPH_WORK_QUEUE WorkQueue,
+    _Inout_ PPH_WORK_QUEUE_DEQUE Deque
+    )
+{
+    PPH_WORK_QUEUE_ITEM workQueueItem;
+    ULONG i;
+
+    // High priority items go on top of our own items, since we pop from the bottom.
+    PhpTakeInjectionListWorkQueue(WorkQueue, Deque, PH_WORK_QUEUE_PRIORITY_HIGH);
+
+    if (workQueueItem = PhpPopWorkQueueDeque(Deque))
+        return workQueueItem;
+
+    for (i = PH_WORK_QUEUE_PRIORITY_HIGH + 1; i < PH_WORK_QUEUE_PRIORITY_COUNT; i++)
+    {
+        PhpTakeInjectionListWorkQueue(WorkQueue, Deque, i);
+
+        if (workQueueItem = PhpPopWorkQueueDeque(Deque))
+            return workQueueItem;
+    }
+
+    // Steal from the other workers, starting with the one after us.
+    for (i = 1; i < WorkQueue->MaximumThreads; i++)
+    {
+        PPH_WORK_QUEUE_DEQUE victim = &WorkQueue->Deques[(Deque->Index + i) % WorkQueue->MaximumThreads];
+
+        if (workQueueItem = PhpStealWorkQueueDeque(victim))
+        {
+            PHLIB_INC_STATISTIC(WqWorkItemsStolen);
+            return workQueueItem;
+        }
+    }
+
+    return NULL;
+}
+
+NTSTATUS PhpWorkQueueStealingThreadStart(
+    _In_ PVOID Parameter
+    )
+{
+    PPH_WORK_QUEUE_DEQUE deque = (PPH_WORK_QUEUE_DEQUE)Parameter;
+    PPH_WORK_QUEUE workQueue = deque->WorkQueue;
+
+    if (PhpWorkQueueDequeTlsIndex != TLS_OUT_OF_INDEXES)
+        TlsSetValue(PhpWorkQueueDequeTlsIndex, deque);
+
+    while (TRUE)
+    {
+        NTSTATUS status;
+        LARGE_INTEGER timeout;
+        PPH_WORK_QUEUE_ITEM workQueueItem;
+        BOOLEAN terminate;
+
+        if (!workQueue->Terminating && (workQueueItem = PhpFindWorkWorkQueue(workQueue, deque)))
+        {
+            if (_InterlockedDecrement(&workQueue->QueuedCount) == 0)
+            {
+                PhAcquireQueuedLockExclusive(&workQueue->QueueLock);
+                PhPulseCondition(&workQueue->QueueEmptyCondition);
+                PhReleaseQueuedLockExclusive(&workQueue->QueueLock);
+            }
+
+            // Wake up another worker if there is more work.
+            if (workQueue->IdleCount != 0 && PhpHasWorkWorkQueue(workQueue))
+                NtReleaseSemaphore(PhpGetSemaphoreWorkQueue(workQueue), 1, NULL);
+
+            _InterlockedIncrement(&workQueue->ExecutingCount);
+            PhpExecuteWorkQueueItem(workQueueItem);
+            _InterlockedDecrement(&workQueue->ExecutingCount);
+            _InterlockedDecrement(&workQueue->BusyCount);
+
+            PhpDestroyWorkQueueItem(workQueueItem);
+
+            continue;
+        }
+
+        // Announce that we are idle, then check for work again. Whoever queues an item after
+        // our check sees the idle count and releases the semaphore.
+        _InterlockedIncrement(&workQueue->IdleCount);
+
+        if (!workQueue->Terminating && PhpHasWorkWorkQueue(workQueue))
+        {
+            _InterlockedDecrement(&workQueue->IdleCount);
+            continue;
+        }
+
+        if (!workQueue->Terminating)
+        {
+            // Wait for work.
+            status = NtWaitForSingleObject(
+                PhpGetSemaphoreWorkQueue(workQueue),
+                FALSE,
+                PhTimeoutFromMilliseconds(&timeout, workQueue->NoWorkTimeout)
+                );
+        }
+        else
+        {
+            status = STATUS_UNSUCCESSFUL;
+        }
+
+        _InterlockedDecrement(&workQueue->IdleCount);
+
+        if (status == STATUS_WAIT_0 && !workQueue->Terminating)
+            continue;
+
+        // No work arrived before the timeout passed, or we are terminating, or some error occurred.
+        // Our deque is empty unless we are terminating, in which case the remaining items are
+        // freed by PhDeleteWorkQueue.
+
+        terminate = FALSE;
+
+        PhAcquireQueuedLockExclusive(&workQueue->StateLock);
+
+        if (workQueue->Terminating || workQueue->CurrentThreads > workQueue->MinimumThreads)
+        {
+            deque->InUse = FALSE;
+            workQueue->CurrentThreads--;
+            terminate = TRUE;
+        }
+
+        PhReleaseQueuedLockExclusive(&workQueue->StateLock);
+
+        if (terminate)
+            break;
+    }
+
+    if (PhpWorkQueueDequeTlsIndex != TLS_OUT_OF_INDEXES)
+        TlsSetValue(PhpWorkQueueDequeTlsIndex, NULL);
+
+    PhReleaseRundownProtection(&workQueue->RundownProtect);
+
+    return STATUS_SUCCESS;
+}
+
 /**
  * Queues a work item to a work queue.
  *
@@ -366,7 +900,7 @@ VOID PhQueueItemWorkQueue(
     _In_opt_ PVOID Context
     )
 {
-    PhQueueItemWorkQueueEx(WorkQueue, Function, Context, NULL);
+    PhQueueItemWorkQueueEx(WorkQueue, Function, Context, NULL, NULL);
 }
 
 /**
@@ -376,25 +910,56 @@ VOID PhQueueItemWorkQueue(
  * \param Function A function to execute.
  * \param Context A user-defined value to pass to the function.
  * \param DeleteFunction A callback function that is executed when the work queue item is about to be freed.
+ * \param Environment The priority, timeout and cancel token of the work item. Use
+ * PhInitializeWorkQueueEnvironment() to initialize this structure. If NULL, the item has
+ * normal priority and is never dropped.
+ *
+ * \remarks If the item is cancelled using its cancel token or its timeout passes before it
+ * starts executing, the cancel function in \a Environment is called instead of \a Function.
+ * The delete function is called in either case.
  */
 VOID PhQueueItemWorkQueueEx(
     _Inout_ PPH_WORK_QUEUE WorkQueue,
     _In_ PUSER_THREAD_START_ROUTINE Function,
     _In_opt_ PVOID Context,
-    _In_opt_ PPH_WORK_QUEUE_ITEM_DELETE_FUNCTION DeleteFunction
+    _In_opt_ PPH_WORK_QUEUE_ITEM_DELETE_FUNCTION DeleteFunction,
+    _In_opt_ PPH_WORK_QUEUE_ENVIRONMENT Environment
     )
 {
     PPH_WORK_QUEUE_ITEM workQueueItem;
 
-    workQueueItem = PhpCreateWorkQueueItem(Function, Context, DeleteFunction);
+    workQueueItem = PhpCreateWorkQueueItem(Function, Context, DeleteFunction, Environment);
 
-    // Enqueue the work item.
-    PhAcquireQueuedLockExclusive(&WorkQueue->QueueLock);
-    InsertTailList(&WorkQueue->QueueListHead, &workQueueItem->ListEntry);
-    _InterlockedIncrement(&WorkQueue->BusyCount);
-    PhReleaseQueuedLockExclusive(&WorkQueue->QueueLock);
-    // Signal the semaphore once to let a worker thread continue.
-    NtReleaseSemaphore(PhpGetSemaphoreWorkQueue(WorkQueue), 1, NULL);
+    if (WorkQueue->Flags & PH_WORK_QUEUE_WORK_STEALING)
+    {
+        PPH_WORK_QUEUE_DEQUE deque = NULL;
+
+        _InterlockedIncrement(&WorkQueue->BusyCount);
+        _InterlockedIncrement(&WorkQueue->QueuedCount);
+
+        // Items queued by our own worker threads go onto the worker's deque, where they are
+        // executed next. Low priority items wait on the injection list instead.
+        if (PhpWorkQueueDequeTlsIndex != TLS_OUT_OF_INDEXES && workQueueItem->Priority != PH_WORK_QUEUE_PRIORITY_LOW)
+            deque = TlsGetValue(PhpWorkQueueDequeTlsIndex);
+
+        if (!deque || deque->WorkQueue != WorkQueue || !PhpPushWorkQueueDeque(deque, workQueueItem))
+            PhpPushInjectionListWorkQueue(WorkQueue, workQueueItem);
+
+        // Only wake up a worker if one is waiting. The interlocked operation above ensures this
+        // read happens after the item is visible.
+        if (WorkQueue->IdleCount != 0)
+            NtReleaseSemaphore(PhpGetSemaphoreWorkQueue(WorkQueue), 1, NULL);
+    }
+    else
+    {
+        // Enqueue the work item.
+        PhAcquireQueuedLockExclusive(&WorkQueue->QueueLock);
+        InsertTailList(&WorkQueue->QueueListHeads[workQueueItem->Priority], &workQueueItem->ListEntry);
+        _InterlockedIncrement(&WorkQueue->BusyCount);
+        PhReleaseQueuedLockExclusive(&WorkQueue->QueueLock);
+        // Signal the semaphore once to let a worker thread continue.
+        NtReleaseSemaphore(PhpGetSemaphoreWorkQueue(WorkQueue), 1, NULL);
+    }
 
     PHLIB_INC_STATISTIC(WqWorkItemsQueued);
 
@@ -440,3 +1005,36 @@ VOID PhQueueItemGlobalWorkQueue(
         Context
         );
 }
+
+/**
+ * Creates a cancel token for work queue items.
+ *
+ * \return A cancel token object. Dereference the object when you no longer need it.
+ */
+PPH_WORK_QUEUE_CANCEL_TOKEN PhCreateWorkQueueCancelToken(
+    VOID
+    )
+{
+    PPH_WORK_QUEUE_CANCEL_TOKEN cancelToken;
+
+    cancelToken = PhCreateObject(sizeof(PH_WORK_QUEUE_CANCEL_TOKEN), PhWorkQueueCancelTokenType);
+    cancelToken->Cancelled = FALSE;
+
+    return cancelToken;
+}
+
+/**
+ * Cancels all work queue items associated with a cancel token.
+ *
+ * \param CancelToken A cancel token object.
+ *
+ * \remarks Items which have already started executing are not affected. They can check the
+ * \a Cancelled field of the token themselves.
+ */
+VOID PhCancelWorkQueueCancelToken(
+    _Inout_ PPH_WORK_QUEUE_CANCEL_TOKEN CancelToken
+    )
+{
+    CancelToken->Cancelled = TRUE;
+    MemoryBarrier();
+}
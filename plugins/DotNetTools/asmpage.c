@@ -36,6 +36,12 @@
 #define DNA_TYPE_CLR 1
 #define DNA_TYPE_APPDOMAIN 2
 #define DNA_TYPE_ASSEMBLY 3
+#define DNA_TYPE_MODULE 4 // records only
+
+#define DNA_MSG_RECORDS (WM_APP + 101)
+#define DNA_MSG_COMPLETED (WM_APP + 102)
+
+#define DNA_CACHE_MAXIMUM 8
 
 typedef struct _DNA_NODE
 {
@@ -43,6 +49,7 @@ typedef struct _DNA_NODE
 
     struct _DNA_NODE *Parent;
     PPH_LIST Children;
+    BOOLEAN ChildrenUnsorted;
 
     PH_STRINGREF TextCache[DNATNC_MAXIMUM];
 
@@ -86,12 +93,44 @@ typedef struct _ASMPAGE_CONTEXT
     ULONG TraceResult;
     LONG TraceHandleActive;
     TRACEHANDLE TraceHandle;
+    HANDLE EnumThreadHandle;
+    BOOLEAN Cancelled;
 
     HWND TnHandle;
     PPH_LIST NodeList;
     PPH_LIST NodeRootList;
+
+    LONG RecordsPosted;
+    PH_QUEUED_LOCK PendingRecordsLock;
+    PPH_LIST PendingRecords; // records from the trace thread that haven't been added to the tree yet
+    PPH_LIST RecordList; // records that have been added to the tree
 } ASMPAGE_CONTEXT, *PASMPAGE_CONTEXT;
 
+// A rundown event. Records are created on the trace thread and added to the tree on the
+// window's thread, and completed enumerations are cached so that the page can be filled in
+// immediately the next time it is opened.
+typedef struct _DNA_RECORD
+{
+    ULONG Type;
+    BOOLEAN ClrV2;
+    USHORT ClrInstanceID;
+    ULONG64 Id; // AppDomain or assembly ID
+    ULONG64 ParentId; // AppDomain ID for assemblies, assembly ID for modules
+
+    PPH_STRING Name; // CLR or AppDomain display name, or fully qualified assembly name
+    PPH_STRING IdText;
+    PPH_STRING FlagsText;
+    PPH_STRING PathText;
+    PPH_STRING NativePathText;
+} DNA_RECORD, *PDNA_RECORD;
+
+typedef struct _DNA_CACHE_ENTRY
+{
+    HANDLE ProcessId;
+    LARGE_INTEGER CreateTime;
+    PPH_LIST RecordList;
+} DNA_CACHE_ENTRY, *PDNA_CACHE_ENTRY;
+
 typedef struct _FLAG_DEFINITION
 {
     PWSTR Name;
@@ -118,6 +157,9 @@ INT_PTR CALLBACK DotNetAsmPageDlgProc(
     );
 
 static UNICODE_STRING DotNetLoggerName = RTL_CONSTANT_STRING(L"PhDnLogger");
+static PPH_OBJECT_TYPE DnaRecordType;
+static PPH_LIST DnaCacheList; // most recently used last
+static PH_QUEUED_LOCK DnaCacheLock = PH_QUEUED_LOCK_INIT;
 static GUID ClrRuntimeProviderGuid = { 0xe13c0d23, 0xccbc, 0x4e12, { 0x93, 0x1b, 0xd9, 0xcc, 0x2e, 0xee, 0x27, 0xe4 } };
 static GUID ClrRundownProviderGuid = { 0xa669021c, 0xc450, 0x4609, { 0xa0, 0x35, 0x5a, 0xf5, 0x9a, 0xf4, 0xdf, 0x18 } };
 
@@ -208,6 +250,73 @@ PPH_STRING FlagsToString(
     return PhFinalStringBuilderString(&sb);
 }
 
+static VOID NTAPI DnaRecordDeleteProcedure(
+    _In_ PVOID Object,
+    _In_ ULONG Flags
+    )
+{
+    PDNA_RECORD record = Object;
+
+    PhClearReference(&record->Name);
+    PhClearReference(&record->IdText);
+    PhClearReference(&record->FlagsText);
+    PhClearReference(&record->PathText);
+    PhClearReference(&record->NativePathText);
+}
+
+static VOID InitializeDnaRecords(
+    VOID
+    )
+{
+    static PH_INITONCE initOnce = PH_INITONCE_INIT;
+
+    if (PhBeginInitOnce(&initOnce))
+    {
+        DnaRecordType = PhCreateObjectType(L"DnaRecord", 0, DnaRecordDeleteProcedure);
+        DnaCacheList = PhCreateList(DNA_CACHE_MAXIMUM);
+        PhEndInitOnce(&initOnce);
+    }
+}
+
+static PDNA_RECORD CreateRecord(
+    _In_ ULONG Type
+    )
+{
+    PDNA_RECORD record;
+
+    record = PhCreateObject(sizeof(DNA_RECORD), DnaRecordType);
+    memset(record, 0, sizeof(DNA_RECORD));
+    record->Type = Type;
+
+    return record;
+}
+
+static VOID DestroyRecordList(
+    _In_ PPH_LIST List
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < List->Count; i++)
+        PhDereferenceObject(List->Items[i]);
+
+    PhDereferenceObject(List);
+}
+
+static VOID QueueRecord(
+    _In_ PASMPAGE_CONTEXT Context,
+    _In_ PDNA_RECORD Record
+    )
+{
+    PhAcquireQueuedLockExclusive(&Context->PendingRecordsLock);
+    PhAddItemList(Context->PendingRecords, Record);
+    PhReleaseQueuedLockExclusive(&Context->PendingRecordsLock);
+
+    // Records that arrive before the window gets to the message are picked up with it.
+    if (_InterlockedExchange(&Context->RecordsPosted, 1) == 0)
+        PostMessage(Context->WindowHandle, DNA_MSG_RECORDS, 0, 0);
+}
+
 PDNA_NODE AddNode(
     _Inout_ PASMPAGE_CONTEXT Context
     )
@@ -353,6 +462,24 @@ PDNA_NODE FindAssemblyNode2(
     return NULL;
 }
 
+PDNA_NODE FindClrV2AssemblyNode(
+    _In_ PDNA_NODE ClrV2Node,
+    _In_ PPH_STRING PathText
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < ClrV2Node->Children->Count; i++)
+    {
+        PDNA_NODE node = ClrV2Node->Children->Items[i];
+
+        if (PhEqualString(node->PathText, PathText, TRUE))
+            return node;
+    }
+
+    return NULL;
+}
+
 static int __cdecl AssemblyNodeNameCompareFunction(
     _In_ const void *elem1,
     _In_ const void *elem2
@@ -364,6 +491,320 @@ static int __cdecl AssemblyNodeNameCompareFunction(
     return PhCompareStringRef(&node1->StructureText, &node2->StructureText, TRUE);
 }
 
+/**
+ * Adds the information from a record to the tree.
+ *
+ * \param Context The page context.
+ * \param Record The record.
+ *
+ * \return TRUE if the tree was changed, or FALSE if the record is a duplicate or its parent
+ * hasn't been seen.
+ */
+static BOOLEAN ApplyRecord(
+    _In_ PASMPAGE_CONTEXT Context,
+    _In_ PDNA_RECORD Record
+    )
+{
+    PDNA_NODE parentNode;
+    PDNA_NODE node;
+
+    switch (Record->Type)
+    {
+    case DNA_TYPE_CLR:
+        {
+            // Check for duplicates.
+            if (FindClrNode(Context, Record->ClrInstanceID))
+                return FALSE;
+
+            node = AddNode(Context);
+            node->Type = DNA_TYPE_CLR;
+            node->u.Clr.ClrInstanceID = Record->ClrInstanceID;
+            PhSetReference(&node->u.Clr.DisplayName, Record->Name);
+            node->StructureText = node->u.Clr.DisplayName->sr;
+            PhSetReference(&node->IdText, Record->IdText);
+            PhSetReference(&node->FlagsText, Record->FlagsText);
+            PhSetReference(&node->PathText, Record->PathText);
+
+            PhAddItemList(Context->NodeRootList, node);
+        }
+        return TRUE;
+    case DNA_TYPE_APPDOMAIN:
+        {
+            // Find the CLR node to add the AppDomain node to.
+            if (!(parentNode = FindClrNode(Context, Record->ClrInstanceID)))
+                return FALSE;
+
+            // Check for duplicates.
+            if (FindAppDomainNode(parentNode, Record->Id))
+                return FALSE;
+
+            node = AddNode(Context);
+            node->Type = DNA_TYPE_APPDOMAIN;
+            node->u.AppDomain.AppDomainID = Record->Id;
+            PhSetReference(&node->u.AppDomain.DisplayName, Record->Name);
+            node->StructureText = node->u.AppDomain.DisplayName->sr;
+            PhSetReference(&node->IdText, Record->IdText);
+            PhSetReference(&node->FlagsText, Record->FlagsText);
+
+            PhAddItemList(parentNode->Children, node);
+        }
+        return TRUE;
+    case DNA_TYPE_ASSEMBLY:
+        {
+            if (Record->ClrV2)
+            {
+                ULONG_PTR indexOfBackslash;
+                ULONG_PTR indexOfLastDot;
+
+                if (!(parentNode = Context->ClrV2Node))
+                    return FALSE;
+
+                // Check for duplicates.
+                if (FindClrV2AssemblyNode(parentNode, Record->PathText))
+                    return FALSE;
+
+                node = AddNode(Context);
+                node->Type = DNA_TYPE_ASSEMBLY;
+                PhSetReference(&node->FlagsText, Record->FlagsText);
+                PhSetReference(&node->PathText, Record->PathText);
+                PhSetReference(&node->NativePathText, Record->NativePathText);
+
+                // Use the name between the last backslash and the last dot for the structure column text.
+                // (E.g. C:\...\AcmeSoft.BigLib.dll -> AcmeSoft.BigLib)
+
+                indexOfBackslash = PhFindLastCharInString(node->PathText, 0, '\\');
+                indexOfLastDot = PhFindLastCharInString(node->PathText, 0, '.');
+
+                if (indexOfBackslash != -1)
+                {
+                    node->StructureText.Buffer = node->PathText->Buffer + indexOfBackslash + 1;
+
+                    if (indexOfLastDot != -1 && indexOfLastDot > indexOfBackslash)
+                    {
+                        node->StructureText.Length = (indexOfLastDot - indexOfBackslash - 1) * sizeof(WCHAR);
+                    }
+                    else
+                    {
+                        node->StructureText.Length = node->PathText->Length - indexOfBackslash * sizeof(WCHAR) - sizeof(WCHAR);
+                    }
+                }
+                else
+                {
+                    node->StructureText = node->PathText->sr;
+                }
+            }
+            else
+            {
+                PH_STRINGREF remainingPart;
+
+                // Find the AppDomain node to add the Assembly node to.
+
+                parentNode = FindClrNode(Context, Record->ClrInstanceID);
+
+                if (parentNode)
+                    parentNode = FindAppDomainNode(parentNode, Record->ParentId);
+
+                if (!parentNode)
+                    return FALSE;
+
+                // Check for duplicates.
+                if (FindAssemblyNode(parentNode, Record->Id))
+                    return FALSE;
+
+                node = AddNode(Context);
+                node->Type = DNA_TYPE_ASSEMBLY;
+                node->u.Assembly.AssemblyID = Record->Id;
+                PhSetReference(&node->u.Assembly.FullyQualifiedAssemblyName, Record->Name);
+
+                // Display only the assembly name, not the whole fully qualified name.
+                if (!PhSplitStringRefAtChar(&node->u.Assembly.FullyQualifiedAssemblyName->sr, ',', &node->StructureText, &remainingPart))
+                    node->StructureText = node->u.Assembly.FullyQualifiedAssemblyName->sr;
+
+                PhSetReference(&node->IdText, Record->IdText);
+                PhSetReference(&node->FlagsText, Record->FlagsText);
+            }
+
+            PhAddItemList(parentNode->Children, node);
+            parentNode->ChildrenUnsorted = TRUE;
+        }
+        return TRUE;
+    case DNA_TYPE_MODULE:
+        {
+            BOOLEAN changed = FALSE;
+
+            // Find the Assembly node to set the path on.
+
+            node = FindClrNode(Context, Record->ClrInstanceID);
+
+            if (node)
+                node = FindAssemblyNode2(node, Record->ParentId);
+
+            if (!node)
+                return FALSE;
+
+            // The tree may have cached the existing text, so we never replace it.
+
+            if (!node->PathText && Record->PathText)
+            {
+                PhSetReference(&node->PathText, Record->PathText);
+                changed = TRUE;
+            }
+
+            if (!node->NativePathText && Record->NativePathText)
+            {
+                PhSetReference(&node->NativePathText, Record->NativePathText);
+                changed = TRUE;
+            }
+
+            return changed;
+        }
+    }
+
+    return FALSE;
+}
+
+static VOID UpdateAsmTree(
+    _In_ PASMPAGE_CONTEXT Context
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < Context->NodeList->Count; i++)
+    {
+        PDNA_NODE node = Context->NodeList->Items[i];
+
+        if (node->ChildrenUnsorted)
+        {
+            // Sort the assemblies.
+            qsort(node->Children->Items, node->Children->Count, sizeof(PVOID), AssemblyNodeNameCompareFunction);
+            node->ChildrenUnsorted = FALSE;
+        }
+    }
+
+    TreeNew_NodesStructured(Context->TnHandle);
+}
+
+static VOID ProcessPendingRecords(
+    _In_ PASMPAGE_CONTEXT Context
+    )
+{
+    PPH_LIST records;
+    BOOLEAN changed = FALSE;
+    ULONG i;
+
+    _InterlockedExchange(&Context->RecordsPosted, 0);
+
+    PhAcquireQueuedLockExclusive(&Context->PendingRecordsLock);
+    records = Context->PendingRecords;
+    Context->PendingRecords = PhCreateList(64);
+    PhReleaseQueuedLockExclusive(&Context->PendingRecordsLock);
+
+    for (i = 0; i < records->Count; i++)
+    {
+        PDNA_RECORD record = records->Items[i];
+
+        if (ApplyRecord(Context, record))
+        {
+            PhAddItemList(Context->RecordList, record); // pass on the reference
+            changed = TRUE;
+        }
+        else
+        {
+            PhDereferenceObject(record);
+        }
+    }
+
+    PhDereferenceObject(records);
+
+    if (changed)
+        UpdateAsmTree(Context);
+}
+
+static BOOLEAN ApplyCachedRecords(
+    _In_ PASMPAGE_CONTEXT Context
+    )
+{
+    BOOLEAN found = FALSE;
+    ULONG i;
+    ULONG j;
+
+    PhAcquireQueuedLockShared(&DnaCacheLock);
+
+    for (i = 0; i < DnaCacheList->Count; i++)
+    {
+        PDNA_CACHE_ENTRY entry = DnaCacheList->Items[i];
+
+        if (entry->ProcessId == Context->ProcessItem->ProcessId && entry->CreateTime.QuadPart == Context->ProcessItem->CreateTime.QuadPart)
+        {
+            for (j = 0; j < entry->RecordList->Count; j++)
+            {
+                PDNA_RECORD record = entry->RecordList->Items[j];
+
+                if (ApplyRecord(Context, record))
+                {
+                    PhReferenceObject(record);
+                    PhAddItemList(Context->RecordList, record);
+                }
+            }
+
+            found = TRUE;
+            break;
+        }
+    }
+
+    PhReleaseQueuedLockShared(&DnaCacheLock);
+
+    if (found)
+        UpdateAsmTree(Context);
+
+    return found;
+}
+
+static VOID SaveRecordsToCache(
+    _In_ PASMPAGE_CONTEXT Context
+    )
+{
+    PDNA_CACHE_ENTRY entry;
+    ULONG i;
+
+    entry = PhAllocate(sizeof(DNA_CACHE_ENTRY));
+    entry->ProcessId = Context->ProcessItem->ProcessId;
+    entry->CreateTime = Context->ProcessItem->CreateTime;
+    entry->RecordList = PhCreateList(Context->RecordList->Count);
+
+    for (i = 0; i < Context->RecordList->Count; i++)
+    {
+        PhReferenceObject(Context->RecordList->Items[i]);
+        PhAddItemList(entry->RecordList, Context->RecordList->Items[i]);
+    }
+
+    PhAcquireQueuedLockExclusive(&DnaCacheLock);
+
+    // Remove the old entry for this process ID, or the least recently used entry if the cache
+    // is full.
+    for (i = 0; i < DnaCacheList->Count; i++)
+    {
+        if (((PDNA_CACHE_ENTRY)DnaCacheList->Items[i])->ProcessId == entry->ProcessId)
+            break;
+    }
+
+    if (i == DnaCacheList->Count && DnaCacheList->Count >= DNA_CACHE_MAXIMUM)
+        i = 0;
+
+    if (i < DnaCacheList->Count)
+    {
+        PDNA_CACHE_ENTRY oldEntry = DnaCacheList->Items[i];
+
+        PhRemoveItemList(DnaCacheList, i);
+        DestroyRecordList(oldEntry->RecordList);
+        PhFree(oldEntry);
+    }
+
+    PhAddItemList(DnaCacheList, entry);
+
+    PhReleaseQueuedLockExclusive(&DnaCacheLock);
+}
+
 BOOLEAN NTAPI DotNetAsmTreeNewCallback(
     _In_ HWND hwnd,
     _In_ PH_TREENEW_MESSAGE Message,
@@ -392,12 +833,6 @@ BOOLEAN NTAPI DotNetAsmTreeNewCallback(
             }
             else
             {
-                if (node->Type == DNA_TYPE_APPDOMAIN || node == context->ClrV2Node)
-                {
-                    // Sort the assemblies.
-                    qsort(node->Children->Items, node->Children->Count, sizeof(PVOID), AssemblyNodeNameCompareFunction);
-                }
-
                 getChildren->Children = (PPH_TREENEW_NODE *)node->Children->Items;
                 getChildren->NumberOfChildren = node->Children->Count;
             }
@@ -559,118 +994,81 @@ VOID NTAPI DotNetEventCallback(
         case RuntimeInformationDCStart:
             {
                 PRuntimeInformationRundown data = EventRecord->UserData;
-                PDNA_NODE node;
+                PDNA_RECORD record;
                 PPH_STRING startupFlagsString;
                 PPH_STRING startupModeString;
 
-                // Check for duplicates.
-                if (FindClrNode(context, data->ClrInstanceID))
-                    break;
-
-                node = AddNode(context);
-                node->Type = DNA_TYPE_CLR;
-                node->u.Clr.ClrInstanceID = data->ClrInstanceID;
-                node->u.Clr.DisplayName = PhFormatString(L"CLR v%u.%u.%u.%u", data->VMMajorVersion, data->VMMinorVersion, data->VMBuildNumber, data->VMQfeNumber);
-                node->StructureText = node->u.Clr.DisplayName->sr;
-                node->IdText = PhFormatString(L"%u", data->ClrInstanceID);
+                record = CreateRecord(DNA_TYPE_CLR);
+                record->ClrInstanceID = data->ClrInstanceID;
+                record->Name = PhFormatString(L"CLR v%u.%u.%u.%u", data->VMMajorVersion, data->VMMinorVersion, data->VMBuildNumber, data->VMQfeNumber);
+                record->IdText = PhFormatString(L"%u", data->ClrInstanceID);
 
                 startupFlagsString = FlagsToString(data->StartupFlags, StartupFlagsMap, sizeof(StartupFlagsMap));
                 startupModeString = FlagsToString(data->StartupMode, StartupModeMap, sizeof(StartupModeMap));
 
                 if (startupFlagsString->Length != 0 && startupModeString->Length != 0)
                 {
-                    node->FlagsText = PhConcatStrings(3, startupFlagsString->Buffer, L", ", startupModeString->Buffer);
+                    record->FlagsText = PhConcatStrings(3, startupFlagsString->Buffer, L", ", startupModeString->Buffer);
                     PhDereferenceObject(startupFlagsString);
                     PhDereferenceObject(startupModeString);
                 }
                 else if (startupFlagsString->Length != 0)
                 {
-                    node->FlagsText = startupFlagsString;
+                    record->FlagsText = startupFlagsString;
                     PhDereferenceObject(startupModeString);
                 }
                 else if (startupModeString->Length != 0)
                 {
-                    node->FlagsText = startupModeString;
+                    record->FlagsText = startupModeString;
+                    PhDereferenceObject(startupFlagsString);
+                }
+                else
+                {
                     PhDereferenceObject(startupFlagsString);
+                    PhDereferenceObject(startupModeString);
                 }
 
                 if (data->CommandLine[0])
-                    node->PathText = PhCreateString(data->CommandLine);
+                    record->PathText = PhCreateString(data->CommandLine);
 
-                PhAddItemList(context->NodeRootList, node);
+                QueueRecord(context, record);
             }
             break;
         case AppDomainDCStart_V1:
             {
                 PAppDomainLoadUnloadRundown_V1 data = EventRecord->UserData;
                 SIZE_T appDomainNameLength;
-                USHORT clrInstanceID;
-                PDNA_NODE parentNode;
-                PDNA_NODE node;
+                PDNA_RECORD record;
 
                 appDomainNameLength = PhCountStringZ(data->AppDomainName) * sizeof(WCHAR);
-                clrInstanceID = *(PUSHORT)((PCHAR)data + FIELD_OFFSET(AppDomainLoadUnloadRundown_V1, AppDomainName) + appDomainNameLength + sizeof(WCHAR) + sizeof(ULONG));
 
-                // Find the CLR node to add the AppDomain node to.
-                parentNode = FindClrNode(context, clrInstanceID);
+                record = CreateRecord(DNA_TYPE_APPDOMAIN);
+                record->ClrInstanceID = *(PUSHORT)((PCHAR)data + FIELD_OFFSET(AppDomainLoadUnloadRundown_V1, AppDomainName) + appDomainNameLength + sizeof(WCHAR) + sizeof(ULONG));
+                record->Id = data->AppDomainID;
+                record->Name = PhConcatStrings2(L"AppDomain: ", data->AppDomainName);
+                record->IdText = PhFormatString(L"%I64u", data->AppDomainID);
+                record->FlagsText = FlagsToString(data->AppDomainFlags, AppDomainFlagsMap, sizeof(AppDomainFlagsMap));
 
-                if (parentNode)
-                {
-                    // Check for duplicates.
-                    if (FindAppDomainNode(parentNode, data->AppDomainID))
-                        break;
-
-                    node = AddNode(context);
-                    node->Type = DNA_TYPE_APPDOMAIN;
-                    node->u.AppDomain.AppDomainID = data->AppDomainID;
-                    node->u.AppDomain.DisplayName = PhConcatStrings2(L"AppDomain: ", data->AppDomainName);
-                    node->StructureText = node->u.AppDomain.DisplayName->sr;
-                    node->IdText = PhFormatString(L"%I64u", data->AppDomainID);
-                    node->FlagsText = FlagsToString(data->AppDomainFlags, AppDomainFlagsMap, sizeof(AppDomainFlagsMap));
-
-                    PhAddItemList(parentNode->Children, node);
-                }
+                QueueRecord(context, record);
             }
             break;
         case AssemblyDCStart_V1:
             {
                 PAssemblyLoadUnloadRundown_V1 data = EventRecord->UserData;
                 SIZE_T fullyQualifiedAssemblyNameLength;
-                USHORT clrInstanceID;
-                PDNA_NODE parentNode;
-                PDNA_NODE node;
-                PH_STRINGREF remainingPart;
+                PDNA_RECORD record;
 
                 fullyQualifiedAssemblyNameLength = PhCountStringZ(data->FullyQualifiedAssemblyName) * sizeof(WCHAR);
-                clrInstanceID = *(PUSHORT)((PCHAR)data + FIELD_OFFSET(AssemblyLoadUnloadRundown_V1, FullyQualifiedAssemblyName) + fullyQualifiedAssemblyNameLength + sizeof(WCHAR));
-
-                // Find the AppDomain node to add the Assembly node to.
-
-                parentNode = FindClrNode(context, clrInstanceID);
-
-                if (parentNode)
-                    parentNode = FindAppDomainNode(parentNode, data->AppDomainID);
-
-                if (parentNode)
-                {
-                    // Check for duplicates.
-                    if (FindAssemblyNode(parentNode, data->AssemblyID))
-                        break;
-
-                    node = AddNode(context);
-                    node->Type = DNA_TYPE_ASSEMBLY;
-                    node->u.Assembly.AssemblyID = data->AssemblyID;
-                    node->u.Assembly.FullyQualifiedAssemblyName = PhCreateStringEx(data->FullyQualifiedAssemblyName, fullyQualifiedAssemblyNameLength);
-
-                    // Display only the assembly name, not the whole fully qualified name.
-                    if (!PhSplitStringRefAtChar(&node->u.Assembly.FullyQualifiedAssemblyName->sr, ',', &node->StructureText, &remainingPart))
-                        node->StructureText = node->u.Assembly.FullyQualifiedAssemblyName->sr;
 
-                    node->IdText = PhFormatString(L"%I64u", data->AssemblyID);
-                    node->FlagsText = FlagsToString(data->AssemblyFlags, AssemblyFlagsMap, sizeof(AssemblyFlagsMap));
+                record = CreateRecord(DNA_TYPE_ASSEMBLY);
+                record->ClrInstanceID = *(PUSHORT)((PCHAR)data + FIELD_OFFSET(AssemblyLoadUnloadRundown_V1, FullyQualifiedAssemblyName) + fullyQualifiedAssemblyNameLength + sizeof(WCHAR));
+                record->Id = data->AssemblyID;
+                record->ParentId = data->AppDomainID;
+                record->Name = PhCreateStringEx(data->FullyQualifiedAssemblyName, fullyQualifiedAssemblyNameLength);
+                record->IdText = PhFormatString(L"%I64u", data->AssemblyID);
+                record->FlagsText = FlagsToString(data->AssemblyFlags, AssemblyFlagsMap, sizeof(AssemblyFlagsMap));
 
-                    PhAddItemList(parentNode->Children, node);
-                }
+                QueueRecord(context, record);
             }
             break;
         case ModuleDCStart_V1:
@@ -680,29 +1078,22 @@ VOID NTAPI DotNetEventCallback(
                 SIZE_T moduleILPathLength;
                 PWSTR moduleNativePath;
                 SIZE_T moduleNativePathLength;
-                USHORT clrInstanceID;
-                PDNA_NODE node;
+                PDNA_RECORD record;
 
                 moduleILPath = data->ModuleILPath;
                 moduleILPathLength = PhCountStringZ(moduleILPath) * sizeof(WCHAR);
                 moduleNativePath = (PWSTR)((PCHAR)moduleILPath + moduleILPathLength + sizeof(WCHAR));
                 moduleNativePathLength = PhCountStringZ(moduleNativePath) * sizeof(WCHAR);
-                clrInstanceID = *(PUSHORT)((PCHAR)moduleNativePath + moduleNativePathLength + sizeof(WCHAR));
-
-                // Find the Assembly node to set the path on.
-
-                node = FindClrNode(context, clrInstanceID);
 
-                if (node)
-                    node = FindAssemblyNode2(node, data->AssemblyID);
+                record = CreateRecord(DNA_TYPE_MODULE);
+                record->ClrInstanceID = *(PUSHORT)((PCHAR)moduleNativePath + moduleNativePathLength + sizeof(WCHAR));
+                record->ParentId = data->AssemblyID;
+                record->PathText = PhCreateStringEx(moduleILPath, moduleILPathLength);
 
-                if (node)
-                {
-                    PhMoveReference(&node->PathText, PhCreateStringEx(moduleILPath, moduleILPathLength));
+                if (moduleNativePathLength != 0)
+                    record->NativePathText = PhCreateStringEx(moduleNativePath, moduleNativePathLength);
 
-                    if (moduleNativePathLength != 0)
-                        PhMoveReference(&node->NativePathText, PhCreateStringEx(moduleNativePath, moduleNativePathLength));
-                }
+                QueueRecord(context, record);
             }
             break;
         case DCStartComplete_V1:
@@ -728,9 +1119,7 @@ VOID NTAPI DotNetEventCallback(
                     SIZE_T moduleILPathLength;
                     PWSTR moduleNativePath;
                     SIZE_T moduleNativePathLength;
-                    PDNA_NODE node;
-                    ULONG_PTR indexOfBackslash;
-                    ULONG_PTR indexOfLastDot;
+                    PDNA_RECORD record;
 
                     moduleILPath = data->ModuleILPath;
                     moduleILPathLength = PhCountStringZ(moduleILPath) * sizeof(WCHAR);
@@ -739,39 +1128,15 @@ VOID NTAPI DotNetEventCallback(
 
                     if (context->ClrV2Node && (moduleILPathLength != 0 || moduleNativePathLength != 0))
                     {
-                        node = AddNode(context);
-                        node->Type = DNA_TYPE_ASSEMBLY;
-                        node->FlagsText = FlagsToString(data->ModuleFlags, ModuleFlagsMap, sizeof(ModuleFlagsMap));
-                        node->PathText = PhCreateStringEx(moduleILPath, moduleILPathLength);
+                        record = CreateRecord(DNA_TYPE_ASSEMBLY);
+                        record->ClrV2 = TRUE;
+                        record->FlagsText = FlagsToString(data->ModuleFlags, ModuleFlagsMap, sizeof(ModuleFlagsMap));
+                        record->PathText = PhCreateStringEx(moduleILPath, moduleILPathLength);
 
                         if (moduleNativePathLength != 0)
-                            node->NativePathText = PhCreateStringEx(moduleNativePath, moduleNativePathLength);
-
-                        // Use the name between the last backslash and the last dot for the structure column text.
-                        // (E.g. C:\...\AcmeSoft.BigLib.dll -> AcmeSoft.BigLib)
-
-                        indexOfBackslash = PhFindLastCharInString(node->PathText, 0, '\\');
-                        indexOfLastDot = PhFindLastCharInString(node->PathText, 0, '.');
-
-                        if (indexOfBackslash != -1)
-                        {
-                            node->StructureText.Buffer = node->PathText->Buffer + indexOfBackslash + 1;
-
-                            if (indexOfLastDot != -1 && indexOfLastDot > indexOfBackslash)
-                            {
-                                node->StructureText.Length = (indexOfLastDot - indexOfBackslash - 1) * sizeof(WCHAR);
-                            }
-                            else
-                            {
-                                node->StructureText.Length = node->PathText->Length - indexOfBackslash * sizeof(WCHAR) - sizeof(WCHAR);
-                            }
-                        }
-                        else
-                        {
-                            node->StructureText = node->PathText->sr;
-                        }
-
-                        PhAddItemList(context->ClrV2Node->Children, node);
+                            record->NativePathText = PhCreateStringEx(moduleNativePath, moduleNativePathLength);
+
+                        QueueRecord(context, record);
                     }
                 }
                 break;
@@ -808,8 +1173,18 @@ ULONG ProcessDotNetTrace(
     if (traceHandle == INVALID_PROCESSTRACE_HANDLE)
         return GetLastError();
 
-    Context->TraceHandleActive = 1;
     Context->TraceHandle = traceHandle;
+    _InterlockedExchange(&Context->TraceHandleActive, 1);
+
+    // The page may have been closed while we were setting up the trace.
+    if (Context->Cancelled)
+    {
+        if (_InterlockedExchange(&Context->TraceHandleActive, 0) == 1)
+            CloseTrace(traceHandle);
+
+        return ERROR_CANCELLED;
+    }
+
     result = ProcessTrace(&traceHandle, 1, NULL, NULL);
 
     if (_InterlockedExchange(&Context->TraceHandleActive, 0) == 1)
@@ -921,6 +1296,93 @@ ULONG UpdateDotNetTraceInfoWithTimeout(
     return Context->TraceResult;
 }
 
+NTSTATUS DotNetAsmEnumThreadStart(
+    _In_ PVOID Parameter
+    )
+{
+    PASMPAGE_CONTEXT context = Parameter;
+    ULONG result = 0;
+    BOOLEAN timeoutReached = FALSE;
+    LARGE_INTEGER timeout;
+
+    // Records are sent to the window as they arrive, so the page fills in while the
+    // rundown is still running.
+
+    timeout.QuadPart = -10 * PH_TIMEOUT_SEC;
+
+    if (context->ClrVersions & PH_CLR_VERSION_2_0)
+    {
+        result = UpdateDotNetTraceInfoWithTimeout(context, TRUE, &timeout);
+
+        if (result == ERROR_TIMEOUT)
+        {
+            timeoutReached = TRUE;
+            result = ERROR_SUCCESS;
+        }
+    }
+
+    if (!context->Cancelled && (context->ClrVersions & PH_CLR_VERSION_4_ABOVE))
+    {
+        result = UpdateDotNetTraceInfoWithTimeout(context, FALSE, &timeout);
+
+        if (result == ERROR_TIMEOUT)
+        {
+            timeoutReached = TRUE;
+            result = ERROR_SUCCESS;
+        }
+    }
+
+    PostMessage(context->WindowHandle, DNA_MSG_COMPLETED, timeoutReached, result);
+
+    return STATUS_SUCCESS;
+}
+
+VOID ShowAsmPageError(
+    _In_ PASMPAGE_CONTEXT Context,
+    _In_ ULONG Result
+    )
+{
+    HWND hwndDlg = Context->WindowHandle;
+
+    ShowWindow(Context->TnHandle, SW_HIDE);
+    ShowWindow(GetDlgItem(hwndDlg, IDC_ERROR), SW_SHOW);
+
+    if (Result == ERROR_ACCESS_DENIED)
+    {
+        SetDlgItemText(hwndDlg, IDC_ERROR, L"Unable to start the event tracing session. Make sure Process Hacker is running with administrative privileges.");
+    }
+    else if (Result == ERROR_INSTALL_SUSPEND)
+    {
+        SetDlgItemText(hwndDlg, IDC_ERROR, L"Unable to start the event tracing session because the process is suspended.");
+    }
+    else if (Result == ERROR_TIMEOUT)
+    {
+        SetDlgItemText(hwndDlg, IDC_ERROR, L"The event tracing session timed out.");
+    }
+    else
+    {
+        SetDlgItemText(hwndDlg, IDC_ERROR,
+            PhaConcatStrings2(L"Unable to start the event tracing session: %s", PhGetStringOrDefault(PhGetWin32Message(Result), L"Unknown error"))->Buffer);
+    }
+}
+
+BOOLEAN HasNonClrNode(
+    _In_ PASMPAGE_CONTEXT Context
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < Context->NodeList->Count; i++)
+    {
+        PDNA_NODE node = Context->NodeList->Items[i];
+
+        if (node->Type != DNA_TYPE_CLR)
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
 BOOLEAN IsProcessSuspended(
     _In_ HANDLE ProcessId
     )
@@ -964,9 +1426,7 @@ INT_PTR CALLBACK DotNetAsmPageDlgProc(
     {
     case WM_INITDIALOG:
         {
-            ULONG result = 0;
             PPH_STRING settings;
-            LARGE_INTEGER timeout;
             HWND tnHandle;
 
             context = PhAllocate(sizeof(ASMPAGE_CONTEXT));
@@ -981,6 +1441,11 @@ INT_PTR CALLBACK DotNetAsmPageDlgProc(
             context->NodeList = PhCreateList(64);
             context->NodeRootList = PhCreateList(2);
 
+            InitializeDnaRecords();
+            PhInitializeQueuedLock(&context->PendingRecordsLock);
+            context->PendingRecords = PhCreateList(64);
+            context->RecordList = PhCreateList(64);
+
             tnHandle = GetDlgItem(hwndDlg, IDC_LIST);
             context->TnHandle = tnHandle;
 
@@ -1000,102 +1465,37 @@ INT_PTR CALLBACK DotNetAsmPageDlgProc(
             PhCmLoadSettings(tnHandle, &settings->sr);
             PhDereferenceObject(settings);
 
-            SetCursor(LoadCursor(NULL, IDC_WAIT));
-
-            if (
-                !IsProcessSuspended(processItem->ProcessId) ||
-                PhShowMessage(hwndDlg, MB_ICONWARNING | MB_YESNO, L".NET assembly enumeration may not work properly because the process is currently suspended. Do you want to continue?") == IDYES
-                )
+            if (context->ClrVersions & PH_CLR_VERSION_1_0)
             {
-                BOOLEAN timeoutReached = FALSE;
-                BOOLEAN nonClrNode = FALSE;
-                ULONG i;
-
-                if (context->ClrVersions & PH_CLR_VERSION_1_0)
-                {
-                    AddFakeClrNode(context, L"CLR v1.0.3705"); // what PE displays
-                }
-
-                if (context->ClrVersions & PH_CLR_VERSION_1_1)
-                {
-                    AddFakeClrNode(context, L"CLR v1.1.4322");
-                }
-
-                timeout.QuadPart = -10 * PH_TIMEOUT_SEC;
-
-                if (context->ClrVersions & PH_CLR_VERSION_2_0)
-                {
-                    context->ClrV2Node = AddFakeClrNode(context, L"CLR v2.0.50727");
-                    result = UpdateDotNetTraceInfoWithTimeout(context, TRUE, &timeout);
-
-                    if (result == ERROR_TIMEOUT)
-                    {
-                        timeoutReached = TRUE;
-                        result = ERROR_SUCCESS;
-                    }
-                }
-
-                if (context->ClrVersions & PH_CLR_VERSION_4_ABOVE)
-                {
-                    result = UpdateDotNetTraceInfoWithTimeout(context, FALSE, &timeout);
-
-                    if (result == ERROR_TIMEOUT)
-                    {
-                        timeoutReached = TRUE;
-                        result = ERROR_SUCCESS;
-                    }
-                }
-
-                TreeNew_NodesStructured(tnHandle);
-
-                // If we reached the timeout, check whether we got any data back.
-                if (timeoutReached)
-                {
-                    for (i = 0; i < context->NodeList->Count; i++)
-                    {
-                        PDNA_NODE node = context->NodeList->Items[i];
-
-                        if (node->Type != DNA_TYPE_CLR)
-                        {
-                            nonClrNode = TRUE;
-                            break;
-                        }
-                    }
+                AddFakeClrNode(context, L"CLR v1.0.3705"); // what PE displays
+            }
 
-                    if (!nonClrNode)
-                        result = ERROR_TIMEOUT;
-                }
+            if (context->ClrVersions & PH_CLR_VERSION_1_1)
+            {
+                AddFakeClrNode(context, L"CLR v1.1.4322");
             }
-            else
+
+            if (context->ClrVersions & PH_CLR_VERSION_2_0)
             {
-                result = ERROR_INSTALL_SUSPEND;
+                context->ClrV2Node = AddFakeClrNode(context, L"CLR v2.0.50727");
             }
 
+            // Show what we found the last time the page was opened for this process. The
+            // rundown below picks up anything that has been loaded since then.
+            ApplyCachedRecords(context);
             TreeNew_SetRedraw(tnHandle, TRUE);
-            SetCursor(LoadCursor(NULL, IDC_ARROW));
 
-            if (result != 0)
+            if (
+                !IsProcessSuspended(processItem->ProcessId) ||
+                PhShowMessage(hwndDlg, MB_ICONWARNING | MB_YESNO, L".NET assembly enumeration may not work properly because the process is currently suspended. Do you want to continue?") == IDYES
+                )
             {
-                ShowWindow(tnHandle, SW_HIDE);
-                ShowWindow(GetDlgItem(hwndDlg, IDC_ERROR), SW_SHOW);
-
-                if (result == ERROR_ACCESS_DENIED)
-                {
-                    SetDlgItemText(hwndDlg, IDC_ERROR, L"Unable to start the event tracing session. Make sure Process Hacker is running with administrative privileges.");
-                }
-                else if (result == ERROR_INSTALL_SUSPEND)
-                {
-                    SetDlgItemText(hwndDlg, IDC_ERROR, L"Unable to start the event tracing session because the process is suspended.");
-                }
-                else if (result == ERROR_TIMEOUT)
-                {
-                    SetDlgItemText(hwndDlg, IDC_ERROR, L"The event tracing session timed out.");
-                }
-                else
-                {
-                    SetDlgItemText(hwndDlg, IDC_ERROR,
-                        PhaConcatStrings2(L"Unable to start the event tracing session: %s", PhGetStringOrDefault(PhGetWin32Message(result), L"Unknown error"))->Buffer);
-                }
+                context->EnumThreadHandle = PhCreateThread(0, DotNetAsmEnumThreadStart, context);
+            }
+            else
+            {
+                if (!HasNonClrNode(context))
+                    ShowAsmPageError(context, ERROR_INSTALL_SUSPEND);
             }
         }
         break;
@@ -1104,6 +1504,20 @@ INT_PTR CALLBACK DotNetAsmPageDlgProc(
             PPH_STRING settings;
             ULONG i;
 
+            // Stop the rundown if it's still running.
+            context->Cancelled = TRUE;
+
+            if (context->EnumThreadHandle)
+            {
+                if (_InterlockedExchange(&context->TraceHandleActive, 0) == 1)
+                {
+                    CloseTrace(context->TraceHandle);
+                }
+
+                NtWaitForSingleObject(context->EnumThreadHandle, FALSE, NULL);
+                NtClose(context->EnumThreadHandle);
+            }
+
             settings = PhCmSaveSettings(context->TnHandle);
             PhSetStringSetting2(SETTING_NAME_ASM_TREE_LIST_COLUMNS, &settings->sr);
             PhDereferenceObject(settings);
@@ -1113,11 +1527,39 @@ INT_PTR CALLBACK DotNetAsmPageDlgProc(
 
             PhDereferenceObject(context->NodeList);
             PhDereferenceObject(context->NodeRootList);
+            DestroyRecordList(context->PendingRecords);
+            DestroyRecordList(context->RecordList);
             PhFree(context);
 
             PhPropPageDlgProcDestroy(hwndDlg);
         }
         break;
+    case DNA_MSG_RECORDS:
+        {
+            ProcessPendingRecords(context);
+        }
+        break;
+    case DNA_MSG_COMPLETED:
+        {
+            BOOLEAN timeoutReached = (BOOLEAN)wParam;
+            ULONG result = (ULONG)lParam;
+
+            ProcessPendingRecords(context);
+
+            NtClose(context->EnumThreadHandle);
+            context->EnumThreadHandle = NULL;
+
+            if (result == 0 && !timeoutReached)
+            {
+                SaveRecordsToCache(context);
+            }
+            else if (!HasNonClrNode(context))
+            {
+                // If we reached the timeout, we didn't get any data back.
+                ShowAsmPageError(context, result != 0 ? result : ERROR_TIMEOUT);
+            }
+        }
+        break;
     case WM_SHOWWINDOW:
         {
             PPH_LAYOUT_ITEM dialogItem;
@@ -23,6 +23,20 @@
 #include "dn.h"
 #include "clrsup.h"
 
+#define DN_RUNTIME_NAME_CACHE_LIMIT (64 * 1024)
+
+typedef struct _DN_RUNTIME_NAME_ENTRY
+{
+    HANDLE ProcessId;
+    ULONG64 Address;
+    PPH_STRING Name; // NULL if the address isn't managed code
+    ULONG64 Displacement;
+} DN_RUNTIME_NAME_ENTRY, *PDN_RUNTIME_NAME_ENTRY;
+
+static PPH_HASHTABLE DnRuntimeNameHashtable;
+static PH_QUEUED_LOCK DnRuntimeNameHashtableLock = PH_QUEUED_LOCK_INIT;
+static PH_CALLBACK_REGISTRATION DnRuntimeNameProcessRemovedCallbackRegistration;
+
 static GUID IID_ICLRDataTarget_I = { 0x3e11ccee, 0xd08b, 0x43e5, { 0xaf, 0x01, 0x32, 0x71, 0x7a, 0x64, 0xda, 0x03 } };
 static GUID IID_IXCLRDataProcess = { 0x5c552ab6, 0xfc09, 0x4cb3, { 0x8e, 0x36, 0x22, 0xfa, 0x03, 0xc7, 0x98, 0xb7 } };
 
@@ -138,6 +152,172 @@ PPH_STRING GetRuntimeNameByAddressClrProcess(
     return buffer;
 }
 
+static BOOLEAN NTAPI DnRuntimeNameHashtableCompareFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    )
+{
+    PDN_RUNTIME_NAME_ENTRY entry1 = Entry1;
+    PDN_RUNTIME_NAME_ENTRY entry2 = Entry2;
+
+    return entry1->ProcessId == entry2->ProcessId && entry1->Address == entry2->Address;
+}
+
+static ULONG NTAPI DnRuntimeNameHashtableHashFunction(
+    _In_ PVOID Entry
+    )
+{
+    PDN_RUNTIME_NAME_ENTRY entry = Entry;
+
+    return PhHashIntPtr((ULONG_PTR)entry->ProcessId) ^ PhHashInt64(entry->Address);
+}
+
+static VOID FlushRuntimeNameCacheLocked(
+    _In_opt_ HANDLE ProcessId
+    )
+{
+    PH_HASHTABLE_ENUM_CONTEXT enumContext;
+    PDN_RUNTIME_NAME_ENTRY entry;
+
+    PhBeginEnumHashtable(DnRuntimeNameHashtable, &enumContext);
+
+    while (entry = PhNextEnumHashtable(&enumContext))
+    {
+        if (!ProcessId || entry->ProcessId == ProcessId)
+        {
+            if (entry->Name)
+                PhDereferenceObject(entry->Name);
+
+            PhRemoveEntryHashtable(DnRuntimeNameHashtable, entry);
+        }
+    }
+}
+
+static VOID NTAPI DnRuntimeNameProcessRemovedCallback(
+    _In_opt_ PVOID Parameter,
+    _In_opt_ PVOID Context
+    )
+{
+    PPH_PROCESS_ITEM processItem = Parameter;
+
+    FlushRuntimeNameCache(processItem->ProcessId);
+}
+
+VOID InitializeRuntimeNameCache(
+    VOID
+    )
+{
+    DnRuntimeNameHashtable = PhCreateHashtable(
+        sizeof(DN_RUNTIME_NAME_ENTRY),
+        DnRuntimeNameHashtableCompareFunction,
+        DnRuntimeNameHashtableHashFunction,
+        256
+        );
+
+    PhRegisterCallback(
+        &PhProcessRemovedEvent,
+        DnRuntimeNameProcessRemovedCallback,
+        NULL,
+        &DnRuntimeNameProcessRemovedCallbackRegistration
+        );
+}
+
+/**
+ * Looks up a managed symbol in the runtime name cache.
+ *
+ * \param ProcessId The ID of the process.
+ * \param Address The code address.
+ * \param Name A variable which receives a reference to the method name, or NULL if the address
+ * is known not to belong to managed code.
+ * \param Displacement A variable which receives the offset of \a Address from the start of the
+ * method.
+ *
+ * \return TRUE if the address was found in the cache, otherwise FALSE.
+ */
+BOOLEAN LookupRuntimeNameCache(
+    _In_ HANDLE ProcessId,
+    _In_ ULONG64 Address,
+    _Out_ PPH_STRING *Name,
+    _Out_ PULONG64 Displacement
+    )
+{
+    DN_RUNTIME_NAME_ENTRY lookupEntry;
+    PDN_RUNTIME_NAME_ENTRY entry;
+    BOOLEAN found = FALSE;
+
+    lookupEntry.ProcessId = ProcessId;
+    lookupEntry.Address = Address;
+
+    PhAcquireQueuedLockShared(&DnRuntimeNameHashtableLock);
+
+    if (entry = PhFindEntryHashtable(DnRuntimeNameHashtable, &lookupEntry))
+    {
+        if (entry->Name)
+            PhReferenceObject(entry->Name);
+
+        *Name = entry->Name;
+        *Displacement = entry->Displacement;
+        found = TRUE;
+    }
+
+    PhReleaseQueuedLockShared(&DnRuntimeNameHashtableLock);
+
+    return found;
+}
+
+/**
+ * Adds the result of a managed symbol lookup to the runtime name cache.
+ *
+ * \param ProcessId The ID of the process.
+ * \param Address The code address.
+ * \param Name The method name, or NULL if the address doesn't belong to managed code.
+ * \param Displacement The offset of \a Address from the start of the method.
+ */
+VOID AddRuntimeNameCache(
+    _In_ HANDLE ProcessId,
+    _In_ ULONG64 Address,
+    _In_opt_ PPH_STRING Name,
+    _In_ ULONG64 Displacement
+    )
+{
+    DN_RUNTIME_NAME_ENTRY entry;
+    BOOLEAN added;
+
+    entry.ProcessId = ProcessId;
+    entry.Address = Address;
+    entry.Name = Name;
+    entry.Displacement = Displacement;
+
+    PhAcquireQueuedLockExclusive(&DnRuntimeNameHashtableLock);
+
+    // Code addresses can be reused when methods are re-JITted or collectible assemblies are
+    // unloaded, so we don't let stale entries build up forever.
+    if (DnRuntimeNameHashtable->Count >= DN_RUNTIME_NAME_CACHE_LIMIT)
+        FlushRuntimeNameCacheLocked(NULL);
+
+    PhAddEntryHashtableEx(DnRuntimeNameHashtable, &entry, &added);
+
+    if (added && Name)
+        PhReferenceObject(Name);
+
+    PhReleaseQueuedLockExclusive(&DnRuntimeNameHashtableLock);
+}
+
+/**
+ * Removes cached managed symbols.
+ *
+ * \param ProcessId The ID of the process whose entries are to be removed, or NULL to remove all
+ * entries.
+ */
+VOID FlushRuntimeNameCache(
+    _In_opt_ HANDLE ProcessId
+    )
+{
+    PhAcquireQueuedLockExclusive(&DnRuntimeNameHashtableLock);
+    FlushRuntimeNameCacheLocked(ProcessId);
+    PhReleaseQueuedLockExclusive(&DnRuntimeNameHashtableLock);
+}
+
 PPH_STRING GetNameXClrDataAppDomain(
     _In_ PVOID AppDomain
     )
@@ -56,6 +56,13 @@ static _RtlCreateBoundaryDescriptor RtlCreateBoundaryDescriptor_I = NULL;
 static _RtlDeleteBoundaryDescriptor RtlDeleteBoundaryDescriptor_I = NULL;
 static _RtlAddSIDToBoundaryDescriptor RtlAddSIDToBoundaryDescriptor_I = NULL;
 
+// Mapped IPC blocks, keyed by process ID. Views are kept mapped until the process exits so that
+// refreshing counters doesn't have to open the private namespace and map the section again.
+static PPH_OBJECT_TYPE DnIpcBlockType;
+static PPH_HASHTABLE DnIpcBlockHashtable;
+static PH_QUEUED_LOCK DnIpcBlockHashtableLock = PH_QUEUED_LOCK_INIT;
+static PH_CALLBACK_REGISTRATION DnProcessRemovedCallbackRegistration;
+
 static PPH_STRING GeneratePrivateName(_In_ HANDLE ProcessId)
 {
     return PhaFormatString(L"Global\\" CorLegacyPrivateIPCBlock, HandleToUlong(ProcessId));
@@ -412,40 +419,324 @@ BOOLEAN OpenDotNetPublicControlBlock_V4(
     return result;
 }
 
+static VOID NTAPI DnIpcBlockDeleteProcedure(
+    _In_ PVOID Object,
+    _In_ ULONG Flags
+    )
+{
+    PDN_IPC_BLOCK block = Object;
+
+    if (block->PublicBlockAddress)
+        NtUnmapViewOfSection(NtCurrentProcess(), block->PublicBlockAddress);
+    if (block->PublicBlockHandle)
+        NtClose(block->PublicBlockHandle);
+    if (block->PrivateBlockAddress)
+        NtUnmapViewOfSection(NtCurrentProcess(), block->PrivateBlockAddress);
+    if (block->PrivateBlockHandle)
+        NtClose(block->PrivateBlockHandle);
+}
+
+static BOOLEAN NTAPI DnIpcBlockHashtableCompareFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    )
+{
+    return (*(PDN_IPC_BLOCK *)Entry1)->ProcessId == (*(PDN_IPC_BLOCK *)Entry2)->ProcessId;
+}
+
+static ULONG NTAPI DnIpcBlockHashtableHashFunction(
+    _In_ PVOID Entry
+    )
+{
+    return PhHashIntPtr((ULONG_PTR)(*(PDN_IPC_BLOCK *)Entry)->ProcessId);
+}
+
+static VOID NTAPI DnProcessRemovedCallback(
+    _In_opt_ PVOID Parameter,
+    _In_opt_ PVOID Context
+    )
+{
+    PPH_PROCESS_ITEM processItem = Parameter;
+    DN_IPC_BLOCK lookupBlock;
+    PDN_IPC_BLOCK lookupBlockPtr = &lookupBlock;
+    PDN_IPC_BLOCK *entry;
+    PDN_IPC_BLOCK block = NULL;
+
+    lookupBlock.ProcessId = processItem->ProcessId;
+
+    PhAcquireQueuedLockExclusive(&DnIpcBlockHashtableLock);
+
+    if (entry = PhFindEntryHashtable(DnIpcBlockHashtable, &lookupBlockPtr))
+    {
+        block = *entry;
+        PhRemoveEntryHashtable(DnIpcBlockHashtable, &lookupBlockPtr);
+    }
+
+    PhReleaseQueuedLockExclusive(&DnIpcBlockHashtableLock);
+
+    // Pages that are still using the block keep their own references.
+    if (block)
+        PhDereferenceObject(block);
+}
+
+VOID InitializeDotNetIpcBlockCache(
+    VOID
+    )
+{
+    DnIpcBlockType = PhCreateObjectType(L"DnIpcBlock", 0, DnIpcBlockDeleteProcedure);
+    DnIpcBlockHashtable = PhCreateHashtable(
+        sizeof(PDN_IPC_BLOCK),
+        DnIpcBlockHashtableCompareFunction,
+        DnIpcBlockHashtableHashFunction,
+        16
+        );
+
+    PhRegisterCallback(
+        &PhProcessRemovedEvent,
+        DnProcessRemovedCallback,
+        NULL,
+        &DnProcessRemovedCallbackRegistration
+        );
+}
+
+/**
+ * Gets the cached IPC block information for a process.
+ *
+ * \param ProcessItem The process.
+ * \param ClrV4 TRUE if the process uses CLR v4, otherwise FALSE.
+ *
+ * \return A referenced IPC block object. The sections are mapped on demand by
+ * GetDotNetPublicIpcBlock() and GetDotNetPrivateIpcBlock().
+ */
+PDN_IPC_BLOCK ReferenceDotNetIpcBlock(
+    _In_ PPH_PROCESS_ITEM ProcessItem,
+    _In_ BOOLEAN ClrV4
+    )
+{
+    DN_IPC_BLOCK lookupBlock;
+    PDN_IPC_BLOCK lookupBlockPtr = &lookupBlock;
+    PDN_IPC_BLOCK *entry;
+    PDN_IPC_BLOCK block;
+    PDN_IPC_BLOCK staleBlock = NULL;
+
+    lookupBlock.ProcessId = ProcessItem->ProcessId;
+
+    PhAcquireQueuedLockExclusive(&DnIpcBlockHashtableLock);
+
+    if (entry = PhFindEntryHashtable(DnIpcBlockHashtable, &lookupBlockPtr))
+    {
+        block = *entry;
+
+        if (block->CreateTime.QuadPart == ProcessItem->CreateTime.QuadPart && block->ClrV4 == ClrV4)
+        {
+            PhReferenceObject(block);
+            PhReleaseQueuedLockExclusive(&DnIpcBlockHashtableLock);
+
+            return block;
+        }
+
+        // The process ID was re-used, or the process loaded a newer CLR.
+        staleBlock = block;
+        PhRemoveEntryHashtable(DnIpcBlockHashtable, &lookupBlockPtr);
+    }
+
+    block = PhCreateObject(sizeof(DN_IPC_BLOCK), DnIpcBlockType);
+    memset(block, 0, sizeof(DN_IPC_BLOCK));
+    block->ProcessId = ProcessItem->ProcessId;
+    block->CreateTime = ProcessItem->CreateTime;
+    block->ClrV4 = ClrV4;
+    block->IsImmersive = ProcessItem->IsImmersive == 1 ? TRUE : FALSE;
+
+    PhAddEntryHashtable(DnIpcBlockHashtable, &block);
+    PhReferenceObject(block);
+
+    PhReleaseQueuedLockExclusive(&DnIpcBlockHashtableLock);
+
+    if (staleBlock)
+        PhDereferenceObject(staleBlock);
+
+    return block;
+}
+
+/**
+ * Gets the address of the CLR public IPC block table, mapping it if necessary.
+ *
+ * \param Block An IPC block object.
+ * \param ProcessHandle A handle to the process. The handle must have PROCESS_QUERY_LIMITED_INFORMATION
+ * access for immersive processes.
+ *
+ * \return The address of the mapped view, or NULL if the block could not be opened.
+ */
+PVOID GetDotNetPublicIpcBlock(
+    _In_ PDN_IPC_BLOCK Block,
+    _In_ HANDLE ProcessHandle
+    )
+{
+    PVOID address;
+
+    PhAcquireQueuedLockExclusive(&DnIpcBlockHashtableLock);
+
+    if (!Block->PublicBlockAddress)
+    {
+        // Failures aren't cached because the CLR may not have created the block yet.
+        if (Block->ClrV4)
+        {
+            OpenDotNetPublicControlBlock_V4(
+                Block->IsImmersive,
+                ProcessHandle,
+                Block->ProcessId,
+                &Block->PublicBlockHandle,
+                &Block->PublicBlockAddress
+                );
+        }
+        else
+        {
+            OpenDotNetPublicControlBlock_V2(
+                Block->ProcessId,
+                &Block->PublicBlockHandle,
+                &Block->PublicBlockAddress
+                );
+        }
+    }
+
+    address = Block->PublicBlockAddress;
+
+    PhReleaseQueuedLockExclusive(&DnIpcBlockHashtableLock);
+
+    return address;
+}
+
+/**
+ * Gets the address of the CLR legacy private IPC block, mapping it if necessary.
+ *
+ * \param Block An IPC block object.
+ *
+ * \return The address of the mapped view, or NULL if the block could not be opened.
+ */
+PVOID GetDotNetPrivateIpcBlock(
+    _In_ PDN_IPC_BLOCK Block
+    )
+{
+    PVOID address;
+
+    PhAcquireQueuedLockExclusive(&DnIpcBlockHashtableLock);
+
+    if (!Block->PrivateBlockAddress)
+    {
+        HANDLE sectionHandle;
+        LARGE_INTEGER sectionOffset = { 0 };
+        SIZE_T viewSize = 0;
+        PPH_STRING name;
+
+        if (Block->ClrV4)
+            name = GeneratePrivateNameV4(Block->ProcessId);
+        else
+            name = GeneratePrivateName(Block->ProcessId);
+
+        if (sectionHandle = OpenFileMapping(FILE_MAP_ALL_ACCESS, TRUE, name->Buffer))
+        {
+            if (NT_SUCCESS(NtMapViewOfSection(
+                sectionHandle,
+                NtCurrentProcess(),
+                &Block->PrivateBlockAddress,
+                0,
+                viewSize,
+                &sectionOffset,
+                &viewSize,
+                ViewShare,
+                0,
+                PAGE_READONLY
+                )))
+            {
+                Block->PrivateBlockHandle = sectionHandle;
+            }
+            else
+            {
+                Block->PrivateBlockAddress = NULL;
+                NtClose(sectionHandle);
+            }
+        }
+    }
+
+    address = Block->PrivateBlockAddress;
+
+    PhReleaseQueuedLockExclusive(&DnIpcBlockHashtableLock);
+
+    return address;
+}
+
+/**
+ * Copies the performance counter blocks of a set of processes.
+ *
+ * \param Snapshots An array of snapshot structures. On input, Block, ProcessHandle, Wow64,
+ * Buffer and BufferSize must be set. On output, Valid indicates whether Buffer contains a copy
+ * of the process' counters.
+ * \param Count The number of elements in \a Snapshots.
+ *
+ * \return The number of valid snapshots.
+ */
+ULONG SnapshotDotNetPerfIpcBlocks(
+    _Inout_updates_(Count) PDN_PERF_SNAPSHOT Snapshots,
+    _In_ ULONG Count
+    )
+{
+    ULONG validCount = 0;
+    ULONG i;
+
+    // Map everything first so that the counters are copied as close together in time as possible.
+    for (i = 0; i < Count; i++)
+    {
+        Snapshots[i].Valid = !!GetDotNetPublicIpcBlock(Snapshots[i].Block, Snapshots[i].ProcessHandle);
+    }
+
+    for (i = 0; i < Count; i++)
+    {
+        PDN_PERF_SNAPSHOT snapshot = &Snapshots[i];
+        PVOID perfBlock;
+
+        if (!snapshot->Valid)
+            continue;
+
+        snapshot->Valid = FALSE;
+
+        if (snapshot->Block->ClrV4)
+            perfBlock = GetPerfIpcBlock_V4(snapshot->Wow64, snapshot->Block->PublicBlockAddress);
+        else
+            perfBlock = GetPerfIpcBlock_V2(snapshot->Wow64, snapshot->Block->PublicBlockAddress);
+
+        if (!perfBlock)
+            continue;
+
+        __try
+        {
+            memcpy(snapshot->Buffer, perfBlock, snapshot->BufferSize);
+            snapshot->Valid = TRUE;
+            validCount++;
+        }
+        __except (EXCEPTION_EXECUTE_HANDLER)
+        {
+            NOTHING;
+        }
+    }
+
+    return validCount;
+}
+
 PPH_LIST QueryDotNetAppDomainsForPid_V2(
     _In_ BOOLEAN Wow64,
     _In_ HANDLE ProcessHandle,
-    _In_ HANDLE ProcessId
+    _In_ PDN_IPC_BLOCK IpcBlock
     )
 {
     HANDLE legacyPrivateBlockMutexHandle = NULL;
-    HANDLE legacyPrivateBlockHandle = NULL;
     PVOID ipcControlBlockTable = NULL;
-    LARGE_INTEGER sectionOffset = { 0 };
-    SIZE_T viewSize = 0;
     PPH_LIST appDomainsList = PhCreateList(1);
 
     __try
     {
-        if (!(legacyPrivateBlockHandle = OpenFileMapping(FILE_MAP_ALL_ACCESS, TRUE, GeneratePrivateName(ProcessId)->Buffer)))
+        if (!(ipcControlBlockTable = GetDotNetPrivateIpcBlock(IpcBlock)))
             __leave;
 
-        if (!NT_SUCCESS(NtMapViewOfSection(
-            legacyPrivateBlockHandle,
-            NtCurrentProcess(),
-            &ipcControlBlockTable,
-            0,
-            viewSize,
-            &sectionOffset,
-            &viewSize,
-            ViewShare,
-            0,
-            PAGE_READONLY
-            )))
-        {
-            __leave;
-        }
-
         if (Wow64)
         {
             LARGE_INTEGER timeout;
@@ -765,16 +1056,6 @@ PPH_LIST QueryDotNetAppDomainsForPid_V2(
             NtReleaseMutant(legacyPrivateBlockMutexHandle, NULL);
             NtClose(legacyPrivateBlockMutexHandle);
         }
-
-        if (ipcControlBlockTable)
-        {
-            NtUnmapViewOfSection(NtCurrentProcess(), ipcControlBlockTable);
-        }
-
-        if (legacyPrivateBlockHandle)
-        {
-            NtClose(legacyPrivateBlockHandle);
-        }
     }
 
     return appDomainsList;
@@ -783,37 +1064,18 @@ PPH_LIST QueryDotNetAppDomainsForPid_V2(
 PPH_LIST QueryDotNetAppDomainsForPid_V4(
     _In_ BOOLEAN Wow64,
     _In_ HANDLE ProcessHandle,
-    _In_ HANDLE ProcessId
+    _In_ PDN_IPC_BLOCK IpcBlock
     )
 {
     HANDLE legacyPrivateBlockMutexHandle = NULL;
-    HANDLE legacyPrivateBlockHandle = NULL;
     PVOID ipcControlBlockTable = NULL;
-    LARGE_INTEGER sectionOffset = { 0 };
-    SIZE_T viewSize = 0;
     PPH_LIST appDomainsList = PhCreateList(1);
 
     __try
     {
-        if (!(legacyPrivateBlockHandle = OpenFileMapping(FILE_MAP_ALL_ACCESS, TRUE, GeneratePrivateNameV4(ProcessId)->Buffer)))
+        if (!(ipcControlBlockTable = GetDotNetPrivateIpcBlock(IpcBlock)))
             __leave;
 
-        if (!NT_SUCCESS(NtMapViewOfSection(
-            legacyPrivateBlockHandle,
-            NtCurrentProcess(),
-            &ipcControlBlockTable,
-            0,
-            viewSize,
-            &sectionOffset,
-            &viewSize,
-            ViewShare,
-            0,
-            PAGE_READONLY
-            )))
-        {
-            __leave;
-        }
-
         if (Wow64)
         {
             LARGE_INTEGER timeout;
@@ -1144,16 +1406,6 @@ PPH_LIST QueryDotNetAppDomainsForPid_V4(
             NtReleaseMutant(legacyPrivateBlockMutexHandle, NULL);
             NtClose(legacyPrivateBlockMutexHandle);
         }
-
-        if (ipcControlBlockTable)
-        {
-            NtUnmapViewOfSection(NtCurrentProcess(), ipcControlBlockTable);
-        }
-
-        if (legacyPrivateBlockHandle)
-        {
-            NtClose(legacyPrivateBlockHandle);
-        }
     }
 
     return appDomainsList;
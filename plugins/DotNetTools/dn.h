@@ -49,6 +49,52 @@ typedef struct _DN_THREAD_ITEM
 
 // counters
 
+typedef struct _DN_IPC_BLOCK
+{
+    HANDLE ProcessId;
+    LARGE_INTEGER CreateTime;
+    BOOLEAN ClrV4;
+    BOOLEAN IsImmersive;
+
+    HANDLE PublicBlockHandle;
+    PVOID PublicBlockAddress;
+    HANDLE PrivateBlockHandle;
+    PVOID PrivateBlockAddress;
+} DN_IPC_BLOCK, *PDN_IPC_BLOCK;
+
+typedef struct _DN_PERF_SNAPSHOT
+{
+    PDN_IPC_BLOCK Block;
+    HANDLE ProcessHandle;
+    BOOLEAN Wow64;
+    BOOLEAN Valid;
+    PVOID Buffer; // PerfCounterIPCControlBlock or PerfCounterIPCControlBlock_Wow64
+    ULONG BufferSize;
+} DN_PERF_SNAPSHOT, *PDN_PERF_SNAPSHOT;
+
+VOID InitializeDotNetIpcBlockCache(
+    VOID
+    );
+
+PDN_IPC_BLOCK ReferenceDotNetIpcBlock(
+    _In_ PPH_PROCESS_ITEM ProcessItem,
+    _In_ BOOLEAN ClrV4
+    );
+
+PVOID GetDotNetPublicIpcBlock(
+    _In_ PDN_IPC_BLOCK Block,
+    _In_ HANDLE ProcessHandle
+    );
+
+PVOID GetDotNetPrivateIpcBlock(
+    _In_ PDN_IPC_BLOCK Block
+    );
+
+ULONG SnapshotDotNetPerfIpcBlocks(
+    _Inout_updates_(Count) PDN_PERF_SNAPSHOT Snapshots,
+    _In_ ULONG Count
+    );
+
 PVOID GetPerfIpcBlock_V2(
     _In_ BOOLEAN Wow64,
     _In_ PVOID BlockTableAddress
@@ -75,14 +121,38 @@ BOOLEAN OpenDotNetPublicControlBlock_V4(
 
 PPH_LIST QueryDotNetAppDomainsForPid_V2(
     _In_ BOOLEAN Wow64,
-    _In_ HANDLE ProcessHandle, 
-    _In_ HANDLE ProcessId
+    _In_ HANDLE ProcessHandle,
+    _In_ PDN_IPC_BLOCK IpcBlock
     );
 
 PPH_LIST QueryDotNetAppDomainsForPid_V4(
     _In_ BOOLEAN Wow64,
-    _In_ HANDLE ProcessHandle, 
-    _In_ HANDLE ProcessId
+    _In_ HANDLE ProcessHandle,
+    _In_ PDN_IPC_BLOCK IpcBlock
+    );
+
+// clrsup
+
+VOID InitializeRuntimeNameCache(
+    VOID
+    );
+
+BOOLEAN LookupRuntimeNameCache(
+    _In_ HANDLE ProcessId,
+    _In_ ULONG64 Address,
+    _Out_ PPH_STRING *Name,
+    _Out_ PULONG64 Displacement
+    );
+
+VOID AddRuntimeNameCache(
+    _In_ HANDLE ProcessId,
+    _In_ ULONG64 Address,
+    _In_opt_ PPH_STRING Name,
+    _In_ ULONG64 Displacement
+    );
+
+VOID FlushRuntimeNameCache(
+    _In_opt_ HANDLE ProcessId
     );
 
 // asmpage
@@ -46,7 +46,8 @@ static VOID NTAPI LoadCallback(
     _In_opt_ PVOID Context
     )
 {
-    NOTHING;
+    InitializeDotNetIpcBlockCache();
+    InitializeRuntimeNameCache();
 }
 
 static VOID NTAPI UnloadCallback(
@@ -67,8 +67,7 @@ typedef struct _PERFPAGE_CONTEXT
     BOOLEAN IsWow64;
     DOTNET_CATEGORY CategoryIndex;
     HANDLE ProcessHandle;
-    HANDLE BlockTableHandle;
-    PVOID BlockTableAddress;
+    PDN_IPC_BLOCK IpcBlock;
 
     PH_CALLBACK_REGISTRATION ProcessesUpdatedCallbackRegistration;
 } PERFPAGE_CONTEXT, *PPERFPAGE_CONTEXT;
@@ -394,7 +393,7 @@ static VOID AddProcessAppDomains(
         PPH_LIST processAppDomains = QueryDotNetAppDomainsForPid_V4(
             Context->IsWow64,
             Context->ProcessHandle,
-            Context->ProcessItem->ProcessId
+            Context->IpcBlock
             );
 
         for (ULONG i = 0; i < processAppDomains->Count; i++)
@@ -410,7 +409,7 @@ static VOID AddProcessAppDomains(
         PPH_LIST processAppDomains = QueryDotNetAppDomainsForPid_V2(
             Context->IsWow64,
             Context->ProcessHandle,
-            Context->ProcessItem->ProcessId
+            Context->IpcBlock
             );
 
         for (ULONG i = 0; i < processAppDomains->Count; i++)
@@ -431,6 +430,12 @@ static VOID UpdateCounterData(
     )
 {
     PVOID perfStatBlock = NULL;
+    DN_PERF_SNAPSHOT snapshot;
+    union
+    {
+        PerfCounterIPCControlBlock Native;
+        PerfCounterIPCControlBlock_Wow64 Wow64;
+    } perfBlockCopy;
     Perf_GC dotNetPerfGC;
     Perf_Contexts dotNetPerfContext;
     Perf_Interop dotNetPerfInterop;
@@ -440,24 +445,18 @@ static VOID UpdateCounterData(
     Perf_Jit dotNetPerfJit;
     Perf_Security dotNetPerfSecurity;
 
-    if (Context->ClrV4)
-    {
-        perfStatBlock = GetPerfIpcBlock_V4(
-            Context->IsWow64,
-            Context->BlockTableAddress
-            );
-    }
-    else
-    {
-        perfStatBlock = GetPerfIpcBlock_V2(
-            Context->IsWow64,
-            Context->BlockTableAddress
-            );
-    }
+    // Work on a copy so that the counters don't change while we are reading them.
+    snapshot.Block = Context->IpcBlock;
+    snapshot.ProcessHandle = Context->ProcessHandle;
+    snapshot.Wow64 = Context->IsWow64;
+    snapshot.Buffer = &perfBlockCopy;
+    snapshot.BufferSize = Context->IsWow64 ? sizeof(PerfCounterIPCControlBlock_Wow64) : sizeof(PerfCounterIPCControlBlock);
 
-    if (!perfStatBlock)
+    if (SnapshotDotNetPerfIpcBlocks(&snapshot, 1) == 0)
         return;
 
+    perfStatBlock = &perfBlockCopy;
+
     if (Context->IsWow64)
     {
         PerfCounterIPCControlBlock_Wow64* perfBlock = perfStatBlock;
@@ -760,37 +759,19 @@ static INT_PTR CALLBACK DotNetPerfPageDlgProc(
                         context->ClrV4 = TRUE;
                     }
                 }
-
-                // Skip AppDomain enumeration of 'Modern' .NET applications as they don't expose the CLR 'Private IPC' block.
-                if (!context->ProcessItem->IsImmersive)
-                {
-                    AddProcessAppDomains(hwndDlg, context);
-                }
             }
 
-            if (context->ClrV4)
+            context->IpcBlock = ReferenceDotNetIpcBlock(context->ProcessItem, context->ClrV4);
+
+            // Skip AppDomain enumeration of 'Modern' .NET applications as they don't expose the CLR 'Private IPC' block.
+            if (context->ProcessHandle && !context->ProcessItem->IsImmersive)
             {
-                if (OpenDotNetPublicControlBlock_V4(
-                    context->ProcessItem->IsImmersive == 1 ? TRUE : FALSE,
-                    context->ProcessHandle,
-                    context->ProcessItem->ProcessId,
-                    &context->BlockTableHandle,
-                    &context->BlockTableAddress
-                    ))
-                {
-                    context->ControlBlockValid = TRUE;
-                }
+                AddProcessAppDomains(hwndDlg, context);
             }
-            else
+
+            if (GetDotNetPublicIpcBlock(context->IpcBlock, context->ProcessHandle))
             {
-                if (OpenDotNetPublicControlBlock_V2(
-                    context->ProcessItem->ProcessId,
-                    &context->BlockTableHandle,
-                    &context->BlockTableAddress
-                    ))
-                {
-                    context->ControlBlockValid = TRUE;
-                }
+                context->ControlBlockValid = TRUE;
             }
 
             if (context->ControlBlockValid)
@@ -814,14 +795,9 @@ static INT_PTR CALLBACK DotNetPerfPageDlgProc(
                 &context->ProcessesUpdatedCallbackRegistration
                 );
 
-            if (context->BlockTableAddress)
-            {
-                NtUnmapViewOfSection(NtCurrentProcess(), context->BlockTableAddress);
-            }
-
-            if (context->BlockTableHandle)
+            if (context->IpcBlock)
             {
-                NtClose(context->BlockTableHandle);
+                PhDereferenceObject(context->IpcBlock);
             }
 
             if (context->ProcessHandle)
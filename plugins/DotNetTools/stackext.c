@@ -123,7 +123,7 @@ VOID ProcessThreadStackControl(
         {
             PTHREAD_STACK_CONTEXT context = FindThreadStackContext(Control->UniqueKey);
             PPH_STRING managedSymbol = NULL;
-            ULONG64 displacement;
+            ULONG64 displacement = 0;
 
             if (!context)
                 return;
@@ -158,11 +158,27 @@ VOID ProcessThreadStackControl(
                 }
 #endif
 
-                managedSymbol = GetRuntimeNameByAddressClrProcess(
-                    context->Support,
+                // Stacks of busy processes tend to contain the same methods every time they are
+                // refreshed, so we keep the results in a per-process cache.
+                if (!LookupRuntimeNameCache(
+                    context->ProcessId,
                     (ULONG64)Control->u.ResolveSymbol.StackFrame->PcAddress,
+                    &managedSymbol,
                     &displacement
-                    );
+                    ))
+                {
+                    managedSymbol = GetRuntimeNameByAddressClrProcess(
+                        context->Support,
+                        (ULONG64)Control->u.ResolveSymbol.StackFrame->PcAddress,
+                        &displacement
+                        );
+                    AddRuntimeNameCache(
+                        context->ProcessId,
+                        (ULONG64)Control->u.ResolveSymbol.StackFrame->PcAddress,
+                        managedSymbol,
+                        displacement
+                        );
+                }
             }
 #ifdef _WIN64
             else if (context->IsWow64 && context->ConnectedToPhSvc)
@@ -193,11 +209,30 @@ VOID ProcessThreadStackControl(
                     Control->u.ResolveSymbol.StackFrame->StackAddress = predictedEsp;
                 }
 
-                managedSymbol = CallGetRuntimeNameByAddress(
+                if (!LookupRuntimeNameCache(
                     context->ProcessId,
                     (ULONG64)Control->u.ResolveSymbol.StackFrame->PcAddress,
+                    &managedSymbol,
                     &displacement
-                    );
+                    ))
+                {
+                    managedSymbol = CallGetRuntimeNameByAddress(
+                        context->ProcessId,
+                        (ULONG64)Control->u.ResolveSymbol.StackFrame->PcAddress,
+                        &displacement
+                        );
+
+                    // Failures here can also come from the server, so we only cache names.
+                    if (managedSymbol)
+                    {
+                        AddRuntimeNameCache(
+                            context->ProcessId,
+                            (ULONG64)Control->u.ResolveSymbol.StackFrame->PcAddress,
+                            managedSymbol,
+                            displacement
+                            );
+                    }
+                }
             }
 #endif
 
@@ -4,6 +4,8 @@
 #define PLUGIN_NAME L"ProcessHacker.ExtendedNotifications"
 #define SETTING_NAME_ENABLE_GROWL (PLUGIN_NAME L".EnableGrowl")
 #define SETTING_NAME_LOG_FILENAME (PLUGIN_NAME L".LogFileName")
+#define SETTING_NAME_LOG_MAXIMUM_SIZE (PLUGIN_NAME L".LogMaximumSize")
+#define SETTING_NAME_LOG_ROTATE_INTERVAL (PLUGIN_NAME L".LogRotateInterval")
 #define SETTING_NAME_PROCESS_LIST (PLUGIN_NAME L".ProcessList")
 #define SETTING_NAME_SERVICE_LIST (PLUGIN_NAME L".ServiceList")
 
@@ -21,10 +23,51 @@ typedef struct _FILTER_ENTRY
     PPH_STRING Filter;
 } FILTER_ENTRY, *PFILTER_ENTRY;
 
+// filter
+
+typedef struct _FILTER_TRIE
+{
+    PPH_LIST Nodes;
+    PPH_HASHTABLE Edges;
+} FILTER_TRIE, *PFILTER_TRIE;
+
+typedef struct _FILTER_RULE_SET
+{
+    FILTER_TRIE Forward; // names and prefixes
+    FILTER_TRIE Reverse; // suffixes
+    PPH_LIST WildcardRules; // indices of the remaining filters, in order
+} FILTER_RULE_SET, *PFILTER_RULE_SET;
+
+typedef struct _FILTER_MATCHER
+{
+    PPH_LIST FilterList;
+    FILTER_RULE_SET Names;
+    FILTER_RULE_SET FileNames;
+} FILTER_MATCHER, *PFILTER_MATCHER;
+
+VOID CompileFilterList(
+    _Out_ PFILTER_MATCHER Matcher,
+    _In_ PPH_LIST FilterList
+    );
+
+VOID DeleteFilterMatcher(
+    _Inout_ PFILTER_MATCHER Matcher
+    );
+
+BOOLEAN MatchFilterList(
+    _In_ PFILTER_MATCHER Matcher,
+    _In_ PPH_STRING String,
+    _Out_ FILTER_TYPE *FilterType
+    );
+
 // filelog
 
 VOID FileLogInitialization(
     VOID
     );
 
+VOID FileLogUninitialization(
+    VOID
+    );
+
 #endif
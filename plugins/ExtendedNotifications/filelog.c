@@ -23,46 +23,133 @@
 #include <phdk.h>
 #include "extnoti.h"
 
+// Maximum number of entries waiting to be written. Further entries are dropped.
+#define FILE_LOG_MAXIMUM_PENDING 4096
+// How long the writer waits for more entries before writing a partial batch.
+#define FILE_LOG_BATCH_DELAY 500
+
+typedef struct _FILE_LOG_ITEM
+{
+    SLIST_ENTRY ListEntry;
+    LARGE_INTEGER Time;
+    PPH_STRING Text;
+} FILE_LOG_ITEM, *PFILE_LOG_ITEM;
+
 VOID NTAPI LoggedCallback(
     _In_opt_ PVOID Parameter,
     _In_opt_ PVOID Context
     );
 
+NTSTATUS FileLogWriterThreadStart(
+    _In_ PVOID Parameter
+    );
+
+PPH_STRING LogFileName = NULL;
 PPH_FILE_STREAM LogFileStream = NULL;
 PH_CALLBACK_REGISTRATION LoggedCallbackRegistration;
 
-VOID FileLogInitialization(
+// Entries are pushed by whichever thread logs them and popped in batches by the writer thread.
+SLIST_HEADER LogItemListHead;
+volatile LONG LogItemCount = 0;
+volatile LONG LogItemsDropped = 0;
+HANDLE LogWriterEventHandle = NULL;
+HANDLE LogWriterThreadHandle = NULL;
+BOOLEAN LogWriterExiting = FALSE;
+
+ULONG64 LogFileSize;
+ULONG64 LogMaximumSize;
+ULONG64 LogRotateInterval;
+LARGE_INTEGER LogOpenTime;
+
+static NTSTATUS OpenLogFile(
     VOID
     )
 {
     NTSTATUS status;
-    PPH_STRING fileName;
+    LARGE_INTEGER fileSize;
 
-    fileName = PhGetStringSetting(SETTING_NAME_LOG_FILENAME);
+    status = PhCreateFileStream(
+        &LogFileStream,
+        LogFileName->Buffer,
+        FILE_GENERIC_WRITE,
+        FILE_SHARE_READ,
+        FILE_OPEN_IF,
+        PH_FILE_STREAM_APPEND
+        );
 
-    if (fileName->Length != 0)
+    if (NT_SUCCESS(status))
     {
-        status = PhCreateFileStream(
-            &LogFileStream,
-            fileName->Buffer,
-            FILE_GENERIC_WRITE,
-            FILE_SHARE_READ,
-            FILE_OPEN_IF,
-            PH_FILE_STREAM_APPEND | PH_FILE_STREAM_UNBUFFERED
-            );
-
-        if (NT_SUCCESS(status))
-        {
-            PhRegisterCallback(
-                &PhLoggedCallback,
-                LoggedCallback,
-                NULL,
-                &LoggedCallbackRegistration
-                );
-        }
+        if (NT_SUCCESS(PhGetFileSize(LogFileStream->FileHandle, &fileSize)))
+            LogFileSize = fileSize.QuadPart;
+        else
+            LogFileSize = 0;
+
+        PhQuerySystemTime(&LogOpenTime);
     }
 
-    PhDereferenceObject(fileName);
+    return status;
+}
+
+VOID FileLogInitialization(
+    VOID
+    )
+{
+    LogFileName = PhGetStringSetting(SETTING_NAME_LOG_FILENAME);
+
+    if (LogFileName->Length == 0)
+    {
+        PhClearReference(&LogFileName);
+        return;
+    }
+
+    LogMaximumSize = (ULONG64)PhGetIntegerSetting(SETTING_NAME_LOG_MAXIMUM_SIZE) * 1024;
+    LogRotateInterval = (ULONG64)PhGetIntegerSetting(SETTING_NAME_LOG_ROTATE_INTERVAL) * 60 * PH_TICKS_PER_SEC;
+
+    if (!NT_SUCCESS(OpenLogFile()))
+    {
+        PhClearReference(&LogFileName);
+        return;
+    }
+
+    RtlInitializeSListHead(&LogItemListHead);
+
+    if (!NT_SUCCESS(NtCreateEvent(&LogWriterEventHandle, EVENT_ALL_ACCESS, NULL, SynchronizationEvent, FALSE)))
+    {
+        PhClearReference(&LogFileStream);
+        PhClearReference(&LogFileName);
+        return;
+    }
+
+    LogWriterThreadHandle = PhCreateThread(0, FileLogWriterThreadStart, NULL);
+
+    PhRegisterCallback(
+        &PhLoggedCallback,
+        LoggedCallback,
+        NULL,
+        &LoggedCallbackRegistration
+        );
+}
+
+VOID FileLogUninitialization(
+    VOID
+    )
+{
+    if (!LogWriterThreadHandle)
+        return;
+
+    PhUnregisterCallback(&PhLoggedCallback, &LoggedCallbackRegistration);
+
+    // The writer drains the queue before it exits.
+    LogWriterExiting = TRUE;
+    NtSetEvent(LogWriterEventHandle, NULL);
+    NtWaitForSingleObject(LogWriterThreadHandle, FALSE, NULL);
+
+    NtClose(LogWriterThreadHandle);
+    LogWriterThreadHandle = NULL;
+    NtClose(LogWriterEventHandle);
+    LogWriterEventHandle = NULL;
+    PhClearReference(&LogFileStream);
+    PhClearReference(&LogFileName);
 }
 
 VOID NTAPI LoggedCallback(
@@ -71,14 +158,142 @@ VOID NTAPI LoggedCallback(
     )
 {
     PPH_LOG_ENTRY logEntry = Parameter;
-    PPH_STRING formattedTime;
-    PPH_STRING formatted;
+    PFILE_LOG_ITEM item;
 
-    formattedTime = PhFormatDateTime(NULL);
-    formatted = PhFormatLogEntry(logEntry);
+    if (!logEntry)
+        return;
 
-    PhWriteStringFormatAsUtf8FileStream(LogFileStream, L"%s: %s\r\n", formattedTime->Buffer, formatted->Buffer);
+    if (_InterlockedIncrement(&LogItemCount) > FILE_LOG_MAXIMUM_PENDING)
+    {
+        _InterlockedDecrement(&LogItemCount);
+        _InterlockedIncrement(&LogItemsDropped);
+        return;
+    }
+
+    // The entry can only be formatted here because the strings it refers to
+    // may be gone by the time the writer gets to it.
+    item = PhAllocate(sizeof(FILE_LOG_ITEM));
+    item->Time = logEntry->Time;
+    item->Text = PhFormatLogEntry(logEntry);
+
+    // Only wake the writer if it might be waiting for the first entry of a batch.
+    if (!RtlInterlockedPushEntrySList(&LogItemListHead, &item->ListEntry))
+        NtSetEvent(LogWriterEventHandle, NULL);
+}
+
+static VOID RotateLogFile(
+    VOID
+    )
+{
+    PPH_STRING oldFileName;
+
+    PhFlushFileStream(LogFileStream, FALSE);
+    PhClearReference(&LogFileStream);
+
+    oldFileName = PhConcatStrings2(LogFileName->Buffer, L".old");
+    MoveFileEx(LogFileName->Buffer, oldFileName->Buffer, MOVEFILE_REPLACE_EXISTING);
+    PhDereferenceObject(oldFileName);
+
+    OpenLogFile();
+}
+
+static VOID WriteLogItems(
+    _In_ PSLIST_ENTRY ListEntry
+    )
+{
+    PSLIST_ENTRY reversed = NULL;
+    PSLIST_ENTRY next;
+    PH_STRING_BUILDER stringBuilder;
+    PPH_STRING string;
+    LONG dropped;
+    LONG count = 0;
+
+    // The list is in LIFO order; reverse it so entries are written in the order they were logged.
+    while (ListEntry)
+    {
+        next = ListEntry->Next;
+        ListEntry->Next = reversed;
+        reversed = ListEntry;
+        ListEntry = next;
+    }
+
+    PhInitializeStringBuilder(&stringBuilder, 0x400);
+
+    if (dropped = _InterlockedExchange(&LogItemsDropped, 0))
+        PhAppendFormatStringBuilder(&stringBuilder, L"%u log entries were dropped\r\n", dropped);
+
+    for (ListEntry = reversed; ListEntry; ListEntry = next)
+    {
+        PFILE_LOG_ITEM item = CONTAINING_RECORD(ListEntry, FILE_LOG_ITEM, ListEntry);
+        SYSTEMTIME systemTime;
+        PPH_STRING dateTime;
+
+        next = ListEntry->Next;
+
+        PhLargeIntegerToLocalSystemTime(&systemTime, &item->Time);
+        dateTime = PhFormatDateTime(&systemTime);
+        PhAppendFormatStringBuilder(&stringBuilder, L"%s: %s\r\n", dateTime->Buffer, item->Text->Buffer);
+        PhDereferenceObject(dateTime);
+
+        PhDereferenceObject(item->Text);
+        PhFree(item);
+        count++;
+    }
+
+    _InterlockedExchangeAdd(&LogItemCount, -count);
+
+    string = PhFinalStringBuilderString(&stringBuilder);
+
+    if (LogFileStream && string->Length != 0)
+    {
+        LARGE_INTEGER fileSize;
+
+        PhWriteStringAsUtf8FileStreamEx(LogFileStream, string->Buffer, string->Length);
+        PhFlushFileStream(LogFileStream, FALSE);
+
+        if (NT_SUCCESS(PhGetFileSize(LogFileStream->FileHandle, &fileSize)))
+            LogFileSize = fileSize.QuadPart;
+    }
+
+    PhDereferenceObject(string);
+}
+
+NTSTATUS FileLogWriterThreadStart(
+    _In_ PVOID Parameter
+    )
+{
+    LARGE_INTEGER timeout;
+    LARGE_INTEGER currentTime;
+    PSLIST_ENTRY listEntry;
+
+    while (TRUE)
+    {
+        NtWaitForSingleObject(LogWriterEventHandle, FALSE, NULL);
+
+        // Give other entries a chance to arrive so that they are written together.
+        if (!LogWriterExiting)
+        {
+            timeout.QuadPart = -FILE_LOG_BATCH_DELAY * PH_TIMEOUT_MS;
+            NtDelayExecution(FALSE, &timeout);
+        }
+
+        if (LogFileStream)
+        {
+            PhQuerySystemTime(&currentTime);
+
+            if ((LogMaximumSize != 0 && LogFileSize >= LogMaximumSize) ||
+                (LogRotateInterval != 0 && (ULONG64)(currentTime.QuadPart - LogOpenTime.QuadPart) >= LogRotateInterval))
+            {
+                RotateLogFile();
+            }
+        }
+
+        if (listEntry = RtlInterlockedFlushSList(&LogItemListHead))
+            WriteLogItems(listEntry);
+
+        if (LogWriterExiting)
+            break;
+    }
 
-    PhDereferenceObject(formatted);
-    PhDereferenceObject(formattedTime);
+    return STATUS_SUCCESS;
 }
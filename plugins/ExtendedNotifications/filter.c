@@ -0,0 +1,373 @@
+/*
+ * Process Hacker Extended Notifications -
+ *   filter matching
+ *
+ * Copyright (C) 2016 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A filter list is matched in order, and the first filter that matches decides whether the
+ * notification is shown. Most filters are plain names ("notepad.exe"), prefixes ("C:\Windows\*")
+ * or suffixes ("*\svchost.exe"), so these are compiled into two tries of upper-case characters:
+ * a forward trie for names and prefixes, and a reverse trie for suffixes. Each trie node records
+ * the index of the first filter that ends there, so walking the string once through each trie
+ * gives the first matching filter of these kinds.
+ *
+ * The remaining filters (with question marks or inner asterisks) are matched one by one, but
+ * only those which come before the best match found in the tries.
+ */
+
+#include <phdk.h>
+#include "extnoti.h"
+
+#define FILTER_NO_RULE MAXULONG
+
+typedef struct _FILTER_TRIE_NODE
+{
+    ULONG ExactRule;
+    ULONG PrefixRule;
+} FILTER_TRIE_NODE, *PFILTER_TRIE_NODE;
+
+typedef struct _FILTER_TRIE_EDGE
+{
+    ULONG Node;
+    WCHAR Character;
+    ULONG Child;
+} FILTER_TRIE_EDGE, *PFILTER_TRIE_EDGE;
+
+static BOOLEAN NTAPI FilterTrieEdgeCompareFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    )
+{
+    PFILTER_TRIE_EDGE edge1 = Entry1;
+    PFILTER_TRIE_EDGE edge2 = Entry2;
+
+    return edge1->Node == edge2->Node && edge1->Character == edge2->Character;
+}
+
+static ULONG NTAPI FilterTrieEdgeHashFunction(
+    _In_ PVOID Entry
+    )
+{
+    PFILTER_TRIE_EDGE edge = Entry;
+
+    return PhHashInt64(((ULONG64)edge->Node << 16) | edge->Character);
+}
+
+static VOID InitializeFilterTrie(
+    _Out_ PFILTER_TRIE Trie
+    )
+{
+    PFILTER_TRIE_NODE root;
+
+    Trie->Nodes = PhCreateList(16);
+    Trie->Edges = PhCreateHashtable(
+        sizeof(FILTER_TRIE_EDGE),
+        FilterTrieEdgeCompareFunction,
+        FilterTrieEdgeHashFunction,
+        64
+        );
+
+    root = PhAllocate(sizeof(FILTER_TRIE_NODE));
+    root->ExactRule = FILTER_NO_RULE;
+    root->PrefixRule = FILTER_NO_RULE;
+    PhAddItemList(Trie->Nodes, root);
+}
+
+static VOID DeleteFilterTrie(
+    _Inout_ PFILTER_TRIE Trie
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < Trie->Nodes->Count; i++)
+        PhFree(Trie->Nodes->Items[i]);
+
+    PhDereferenceObject(Trie->Nodes);
+    PhDereferenceObject(Trie->Edges);
+}
+
+static ULONG FindFilterTrieChild(
+    _In_ PFILTER_TRIE Trie,
+    _In_ ULONG Node,
+    _In_ WCHAR Character
+    )
+{
+    FILTER_TRIE_EDGE lookupEdge;
+    PFILTER_TRIE_EDGE edge;
+
+    lookupEdge.Node = Node;
+    lookupEdge.Character = towupper(Character);
+    edge = PhFindEntryHashtable(Trie->Edges, &lookupEdge);
+
+    return edge ? edge->Child : FILTER_NO_RULE;
+}
+
+/**
+ * Adds a literal string to a trie.
+ *
+ * \param Trie The trie.
+ * \param Buffer The characters of the string.
+ * \param Length The number of characters.
+ * \param Reverse TRUE to add the characters from last to first.
+ *
+ * \return The node at the end of the string.
+ */
+static PFILTER_TRIE_NODE AddFilterTrieString(
+    _Inout_ PFILTER_TRIE Trie,
+    _In_ PWCHAR Buffer,
+    _In_ SIZE_T Length,
+    _In_ BOOLEAN Reverse
+    )
+{
+    ULONG node = 0;
+    SIZE_T i;
+
+    for (i = 0; i < Length; i++)
+    {
+        WCHAR c = Reverse ? Buffer[Length - i - 1] : Buffer[i];
+        ULONG child;
+
+        child = FindFilterTrieChild(Trie, node, c);
+
+        if (child == FILTER_NO_RULE)
+        {
+            FILTER_TRIE_EDGE edge;
+            PFILTER_TRIE_NODE newNode;
+
+            newNode = PhAllocate(sizeof(FILTER_TRIE_NODE));
+            newNode->ExactRule = FILTER_NO_RULE;
+            newNode->PrefixRule = FILTER_NO_RULE;
+            child = Trie->Nodes->Count;
+            PhAddItemList(Trie->Nodes, newNode);
+
+            edge.Node = node;
+            edge.Character = towupper(c);
+            edge.Child = child;
+            PhAddEntryHashtable(Trie->Edges, &edge);
+        }
+
+        node = child;
+    }
+
+    return Trie->Nodes->Items[node];
+}
+
+/**
+ * Finds the first rule in a trie which matches a string.
+ *
+ * \param Trie The trie.
+ * \param String The string.
+ * \param Reverse TRUE to walk the string from last to first.
+ *
+ * \return The index of the rule, or FILTER_NO_RULE if no rule matches.
+ */
+static ULONG MatchFilterTrie(
+    _In_ PFILTER_TRIE Trie,
+    _In_ PPH_STRINGREF String,
+    _In_ BOOLEAN Reverse
+    )
+{
+    PFILTER_TRIE_NODE trieNode;
+    ULONG node = 0;
+    ULONG rule;
+    SIZE_T length;
+    SIZE_T i;
+
+    length = String->Length / sizeof(WCHAR);
+    trieNode = Trie->Nodes->Items[0];
+    rule = trieNode->PrefixRule;
+
+    for (i = 0; i < length; i++)
+    {
+        node = FindFilterTrieChild(Trie, node, Reverse ? String->Buffer[length - i - 1] : String->Buffer[i]);
+
+        if (node == FILTER_NO_RULE)
+            return rule;
+
+        trieNode = Trie->Nodes->Items[node];
+        rule = min(rule, trieNode->PrefixRule);
+    }
+
+    return min(rule, trieNode->ExactRule);
+}
+
+static VOID InitializeFilterRuleSet(
+    _Out_ PFILTER_RULE_SET RuleSet
+    )
+{
+    InitializeFilterTrie(&RuleSet->Forward);
+    InitializeFilterTrie(&RuleSet->Reverse);
+    RuleSet->WildcardRules = PhCreateList(4);
+}
+
+static VOID DeleteFilterRuleSet(
+    _Inout_ PFILTER_RULE_SET RuleSet
+    )
+{
+    DeleteFilterTrie(&RuleSet->Forward);
+    DeleteFilterTrie(&RuleSet->Reverse);
+    PhDereferenceObject(RuleSet->WildcardRules);
+}
+
+static VOID AddFilterRuleSet(
+    _Inout_ PFILTER_RULE_SET RuleSet,
+    _In_ PPH_STRING Filter,
+    _In_ ULONG Rule
+    )
+{
+    PWCHAR buffer = Filter->Buffer;
+    SIZE_T length = Filter->Length / sizeof(WCHAR);
+    PFILTER_TRIE_NODE node;
+    ULONG_PTR questionIndex;
+    ULONG_PTR starIndex;
+    ULONG_PTR lastStarIndex;
+
+    questionIndex = PhFindCharInString(Filter, 0, '?');
+    starIndex = PhFindCharInString(Filter, 0, '*');
+    lastStarIndex = PhFindLastCharInString(Filter, 0, '*');
+
+    // Rules are added in order, so a node that already has a rule keeps it.
+
+    if (questionIndex == -1 && starIndex == -1)
+    {
+        node = AddFilterTrieString(&RuleSet->Forward, buffer, length, FALSE);
+
+        if (node->ExactRule == FILTER_NO_RULE)
+            node->ExactRule = Rule;
+    }
+    else if (questionIndex == -1 && starIndex == length - 1 && lastStarIndex == starIndex)
+    {
+        node = AddFilterTrieString(&RuleSet->Forward, buffer, length - 1, FALSE);
+
+        if (node->PrefixRule == FILTER_NO_RULE)
+            node->PrefixRule = Rule;
+    }
+    else if (questionIndex == -1 && starIndex == 0 && lastStarIndex == 0)
+    {
+        node = AddFilterTrieString(&RuleSet->Reverse, buffer + 1, length - 1, TRUE);
+
+        if (node->PrefixRule == FILTER_NO_RULE)
+            node->PrefixRule = Rule;
+    }
+    else
+    {
+        PhAddItemList(RuleSet->WildcardRules, UlongToPtr(Rule));
+    }
+}
+
+static ULONG MatchFilterRuleSet(
+    _In_ PFILTER_RULE_SET RuleSet,
+    _In_ PPH_LIST FilterList,
+    _In_ PPH_STRING String
+    )
+{
+    ULONG rule;
+    ULONG i;
+
+    rule = MatchFilterTrie(&RuleSet->Forward, &String->sr, FALSE);
+    rule = min(rule, MatchFilterTrie(&RuleSet->Reverse, &String->sr, TRUE));
+
+    for (i = 0; i < RuleSet->WildcardRules->Count; i++)
+    {
+        ULONG wildcardRule = PtrToUlong(RuleSet->WildcardRules->Items[i]);
+        PFILTER_ENTRY entry;
+
+        // The wildcard rules are in order, so none of the remaining rules can win.
+        if (wildcardRule >= rule)
+            break;
+
+        entry = FilterList->Items[wildcardRule];
+
+        if (PhMatchWildcards(entry->Filter->Buffer, String->Buffer, TRUE))
+            return wildcardRule;
+    }
+
+    return rule;
+}
+
+/**
+ * Compiles a filter list for matching.
+ *
+ * \param Matcher A variable which receives the compiled filter list.
+ * \param FilterList The filter list. The list must not be modified until the matcher
+ * is deleted using DeleteFilterMatcher().
+ */
+VOID CompileFilterList(
+    _Out_ PFILTER_MATCHER Matcher,
+    _In_ PPH_LIST FilterList
+    )
+{
+    ULONG i;
+
+    Matcher->FilterList = FilterList;
+    InitializeFilterRuleSet(&Matcher->Names);
+    InitializeFilterRuleSet(&Matcher->FileNames);
+
+    for (i = 0; i < FilterList->Count; i++)
+    {
+        PFILTER_ENTRY entry = FilterList->Items[i];
+
+        AddFilterRuleSet(&Matcher->Names, entry->Filter, i);
+
+        // Only filters with backslashes are used when matching a file name.
+        if (PhFindCharInString(entry->Filter, 0, '\\') != -1)
+            AddFilterRuleSet(&Matcher->FileNames, entry->Filter, i);
+    }
+}
+
+VOID DeleteFilterMatcher(
+    _Inout_ PFILTER_MATCHER Matcher
+    )
+{
+    DeleteFilterRuleSet(&Matcher->Names);
+    DeleteFilterRuleSet(&Matcher->FileNames);
+}
+
+/**
+ * Finds the first filter which matches a string.
+ *
+ * \param Matcher A compiled filter list.
+ * \param String The process name, file name or service name.
+ * \param FilterType A variable which receives the type of the filter.
+ *
+ * \return TRUE if a filter matched, otherwise FALSE.
+ */
+BOOLEAN MatchFilterList(
+    _In_ PFILTER_MATCHER Matcher,
+    _In_ PPH_STRING String,
+    _Out_ FILTER_TYPE *FilterType
+    )
+{
+    ULONG rule;
+    PFILTER_ENTRY entry;
+
+    if (PhFindCharInString(String, 0, '\\') != -1)
+        rule = MatchFilterRuleSet(&Matcher->FileNames, Matcher->FilterList, String);
+    else
+        rule = MatchFilterRuleSet(&Matcher->Names, Matcher->FilterList, String);
+
+    if (rule == FILTER_NO_RULE)
+        return FALSE;
+
+    entry = Matcher->FilterList->Items[rule];
+    *FilterType = entry->Type;
+
+    return TRUE;
+}
@@ -31,6 +31,11 @@ VOID NTAPI LoadCallback(
     _In_opt_ PVOID Context
     );
 
+VOID NTAPI UnloadCallback(
+    _In_opt_ PVOID Parameter,
+    _In_opt_ PVOID Context
+    );
+
 VOID NTAPI ShowOptionsCallback(
     _In_opt_ PVOID Parameter,
     _In_opt_ PVOID Context
@@ -83,11 +88,14 @@ INT_PTR CALLBACK GrowlDlgProc(
 
 PPH_PLUGIN PluginInstance;
 PH_CALLBACK_REGISTRATION PluginLoadCallbackRegistration;
+PH_CALLBACK_REGISTRATION PluginUnloadCallbackRegistration;
 PH_CALLBACK_REGISTRATION PluginShowOptionsCallbackRegistration;
 PH_CALLBACK_REGISTRATION NotifyEventCallbackRegistration;
 
 PPH_LIST ProcessFilterList;
 PPH_LIST ServiceFilterList;
+FILTER_MATCHER ProcessFilterMatcher;
+FILTER_MATCHER ServiceFilterMatcher;
 
 PSTR GrowlNotifications[] =
 {
@@ -128,6 +136,12 @@ LOGICAL DllMain(
                 NULL,
                 &PluginLoadCallbackRegistration
                 );
+            PhRegisterCallback(
+                PhGetPluginCallback(PluginInstance, PluginCallbackUnload),
+                UnloadCallback,
+                NULL,
+                &PluginUnloadCallbackRegistration
+                );
             PhRegisterCallback(
                 PhGetPluginCallback(PluginInstance, PluginCallbackShowOptions),
                 ShowOptionsCallback,
@@ -147,6 +161,8 @@ LOGICAL DllMain(
                 {
                     { IntegerSettingType, SETTING_NAME_ENABLE_GROWL, L"0" },
                     { StringSettingType, SETTING_NAME_LOG_FILENAME, L"" },
+                    { IntegerSettingType, SETTING_NAME_LOG_MAXIMUM_SIZE, L"0" }, // KB, 0 for no limit
+                    { IntegerSettingType, SETTING_NAME_LOG_ROTATE_INTERVAL, L"0" }, // minutes, 0 for no limit
                     { StringSettingType, SETTING_NAME_PROCESS_LIST, L"\\i*" },
                     { StringSettingType, SETTING_NAME_SERVICE_LIST, L"\\i*" }
                 };
@@ -156,6 +172,8 @@ LOGICAL DllMain(
 
             ProcessFilterList = PhCreateList(10);
             ServiceFilterList = PhCreateList(10);
+            CompileFilterList(&ProcessFilterMatcher, ProcessFilterList);
+            CompileFilterList(&ServiceFilterMatcher, ServiceFilterList);
         }
         break;
     }
@@ -324,11 +342,15 @@ VOID NTAPI LoadCallback(
     PPH_STRING string;
 
     string = PhGetStringSetting(SETTING_NAME_PROCESS_LIST);
+    DeleteFilterMatcher(&ProcessFilterMatcher);
     LoadFilterList(ProcessFilterList, string);
+    CompileFilterList(&ProcessFilterMatcher, ProcessFilterList);
     PhDereferenceObject(string);
 
     string = PhGetStringSetting(SETTING_NAME_SERVICE_LIST);
+    DeleteFilterMatcher(&ServiceFilterMatcher);
     LoadFilterList(ServiceFilterList, string);
+    CompileFilterList(&ServiceFilterMatcher, ServiceFilterList);
     PhDereferenceObject(string);
 
     FileLogInitialization();
@@ -339,6 +361,14 @@ VOID NTAPI LoadCallback(
     }
 }
 
+VOID NTAPI UnloadCallback(
+    _In_opt_ PVOID Parameter,
+    _In_opt_ PVOID Context
+    )
+{
+    FileLogUninitialization();
+}
+
 VOID NTAPI ShowOptionsCallback(
     _In_opt_ PVOID Parameter,
     _In_opt_ PVOID Context
@@ -393,40 +423,6 @@ VOID NTAPI ShowOptionsCallback(
     PropertySheet(&propSheetHeader);
 }
 
-BOOLEAN MatchFilterList(
-    _In_ PPH_LIST FilterList,
-    _In_ PPH_STRING String,
-    _Out_ FILTER_TYPE *FilterType
-    )
-{
-    ULONG i;
-    BOOLEAN isFileName;
-
-    isFileName = PhFindCharInString(String, 0, '\\') != -1;
-
-    for (i = 0; i < FilterList->Count; i++)
-    {
-        PFILTER_ENTRY entry = FilterList->Items[i];
-
-        if (isFileName && PhFindCharInString(entry->Filter, 0, '\\') == -1)
-            continue; // ignore filters without backslashes if we're matching a file name
-
-        if (entry->Filter->Length == 2 && entry->Filter->Buffer[0] == '*') // shortcut
-        {
-            *FilterType = entry->Type;
-            return TRUE;
-        }
-
-        if (PhMatchWildcards(entry->Filter->Buffer, String->Buffer, TRUE))
-        {
-            *FilterType = entry->Type;
-            return TRUE;
-        }
-    }
-
-    return FALSE;
-}
-
 VOID NTAPI NotifyEventCallback(
     _In_opt_ PVOID Parameter,
     _In_opt_ PVOID Context
@@ -447,10 +443,10 @@ VOID NTAPI NotifyEventCallback(
         processItem = notifyEvent->Parameter;
 
         if (processItem->FileName)
-            found = MatchFilterList(ProcessFilterList, processItem->FileName, &filterType);
+            found = MatchFilterList(&ProcessFilterMatcher, processItem->FileName, &filterType);
 
         if (!found)
-            MatchFilterList(ProcessFilterList, processItem->ProcessName, &filterType);
+            MatchFilterList(&ProcessFilterMatcher, processItem->ProcessName, &filterType);
 
         break;
 
@@ -460,7 +456,7 @@ VOID NTAPI NotifyEventCallback(
     case PH_NOTIFY_SERVICE_STOP:
         serviceItem = notifyEvent->Parameter;
 
-        MatchFilterList(ServiceFilterList, serviceItem->Name, &filterType);
+        MatchFilterList(&ServiceFilterMatcher, serviceItem->Name, &filterType);
 
         break;
     }
@@ -935,8 +931,10 @@ INT_PTR CALLBACK ProcessesDlgProc(
                 {
                     PPH_STRING string;
 
+                    DeleteFilterMatcher(&ProcessFilterMatcher);
                     ClearFilterList(ProcessFilterList);
                     CopyFilterList(ProcessFilterList, EditingProcessFilterList);
+                    CompileFilterList(&ProcessFilterMatcher, ProcessFilterList);
 
                     string = SaveFilterList(ProcessFilterList);
                     PhSetStringSetting2(SETTING_NAME_PROCESS_LIST, &string->sr);
@@ -999,8 +997,10 @@ INT_PTR CALLBACK ServicesDlgProc(
                 {
                     PPH_STRING string;
 
+                    DeleteFilterMatcher(&ServiceFilterMatcher);
                     ClearFilterList(ServiceFilterList);
                     CopyFilterList(ServiceFilterList, EditingServiceFilterList);
+                    CompileFilterList(&ServiceFilterMatcher, ServiceFilterList);
 
                     string = SaveFilterList(ServiceFilterList);
                     PhSetStringSetting2(SETTING_NAME_SERVICE_LIST, &string->sr);
@@ -31,6 +31,18 @@ typedef struct _SERVICE_LIST_CONTEXT
     PH_LAYOUT_MANAGER LayoutManager;
 } SERVICE_LIST_CONTEXT, *PSERVICE_LIST_CONTEXT;
 
+typedef struct _ES_DEPENDENCY_NODE
+{
+    PPH_STRING ServiceName;
+    PPH_LIST Dependencies; // service names, excluding groups
+    ULONG Win32Result;
+    BOOLEAN Stale;
+} ES_DEPENDENCY_NODE, *PES_DEPENDENCY_NODE;
+
+static PPH_HASHTABLE EspDependencyGraph = NULL;
+static PH_QUEUED_LOCK EspDependencyGraphLock = PH_QUEUED_LOCK_INIT;
+static PH_CALLBACK_REGISTRATION ServiceProviderUpdatedCallbackRegistration;
+
 LPENUM_SERVICE_STATUS EsEnumDependentServices(
     _In_ SC_HANDLE ServiceHandle,
     _In_opt_ ULONG State,
@@ -86,6 +98,384 @@ LPENUM_SERVICE_STATUS EsEnumDependentServices(
     return buffer;
 }
 
+static BOOLEAN NTAPI EspDependencyNodeEqualFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    )
+{
+    PES_DEPENDENCY_NODE node1 = *(PES_DEPENDENCY_NODE *)Entry1;
+    PES_DEPENDENCY_NODE node2 = *(PES_DEPENDENCY_NODE *)Entry2;
+
+    return PhEqualString(node1->ServiceName, node2->ServiceName, TRUE);
+}
+
+static ULONG NTAPI EspDependencyNodeHashFunction(
+    _In_ PVOID Entry
+    )
+{
+    PES_DEPENDENCY_NODE node = *(PES_DEPENDENCY_NODE *)Entry;
+
+    return PhHashStringRef(&node->ServiceName->sr, TRUE);
+}
+
+static VOID EspClearDependencyNode(
+    _Inout_ PES_DEPENDENCY_NODE Node
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < Node->Dependencies->Count; i++)
+        PhDereferenceObject(Node->Dependencies->Items[i]);
+
+    PhClearList(Node->Dependencies);
+}
+
+static VOID EspDestroyDependencyNode(
+    _In_ PES_DEPENDENCY_NODE Node
+    )
+{
+    EspClearDependencyNode(Node);
+    PhDereferenceObject(Node->Dependencies);
+    PhDereferenceObject(Node->ServiceName);
+    PhFree(Node);
+}
+
+static PES_DEPENDENCY_NODE EspFindDependencyNode(
+    _In_ PPH_STRING ServiceName
+    )
+{
+    ES_DEPENDENCY_NODE lookupNode;
+    PES_DEPENDENCY_NODE lookupNodePtr = &lookupNode;
+    PES_DEPENDENCY_NODE *node;
+
+    lookupNode.ServiceName = ServiceName;
+    node = PhFindEntryHashtable(EspDependencyGraph, &lookupNodePtr);
+
+    if (node)
+        return *node;
+    else
+        return NULL;
+}
+
+/**
+ * Adds a service to the dependency graph, or marks its existing node as stale so that its
+ * configuration is queried again the next time the graph is used.
+ *
+ * \param ServiceName The name of the service.
+ *
+ * \remarks The dependency graph lock must be held exclusively.
+ */
+static PES_DEPENDENCY_NODE EspAddDependencyNode(
+    _In_ PPH_STRING ServiceName
+    )
+{
+    PES_DEPENDENCY_NODE node;
+
+    if (node = EspFindDependencyNode(ServiceName))
+    {
+        node->Stale = TRUE;
+        return node;
+    }
+
+    node = PhAllocate(sizeof(ES_DEPENDENCY_NODE));
+    memset(node, 0, sizeof(ES_DEPENDENCY_NODE));
+    PhSetReference(&node->ServiceName, ServiceName);
+    node->Dependencies = PhCreateList(4);
+    node->Stale = TRUE;
+
+    PhAddEntryHashtable(EspDependencyGraph, &node);
+
+    return node;
+}
+
+static VOID EspUpdateDependencyNode(
+    _In_ SC_HANDLE ScManagerHandle,
+    _Inout_ PES_DEPENDENCY_NODE Node
+    )
+{
+    SC_HANDLE serviceHandle;
+    LPQUERY_SERVICE_CONFIG serviceConfig;
+
+    EspClearDependencyNode(Node);
+    Node->Win32Result = 0;
+    Node->Stale = FALSE;
+
+    if (!(serviceHandle = OpenService(ScManagerHandle, Node->ServiceName->Buffer, SERVICE_QUERY_CONFIG)))
+    {
+        Node->Win32Result = GetLastError();
+        return;
+    }
+
+    if (serviceConfig = PhGetServiceConfig(serviceHandle))
+    {
+        PWSTR dependency;
+        ULONG dependencyLength;
+
+        if (dependency = serviceConfig->lpDependencies)
+        {
+            while (dependencyLength = (ULONG)PhCountStringZ(dependency))
+            {
+                if (dependency[0] != SC_GROUP_IDENTIFIER)
+                    PhAddItemList(Node->Dependencies, PhCreateStringEx(dependency, dependencyLength * sizeof(WCHAR)));
+
+                dependency += dependencyLength + 1;
+            }
+        }
+
+        PhFree(serviceConfig);
+    }
+    else
+    {
+        Node->Win32Result = GetLastError();
+    }
+
+    CloseServiceHandle(serviceHandle);
+}
+
+/**
+ * Brings the dependency graph up to date. The graph is built from the service configurations
+ * the first time it is needed. After that, only the services which the service provider has
+ * reported as added or modified are queried again.
+ *
+ * \return A Win32 error code, or 0 if the graph was updated.
+ *
+ * \remarks The dependency graph lock must be held exclusively.
+ */
+static ULONG EspUpdateDependencyGraph(
+    VOID
+    )
+{
+    SC_HANDLE scManagerHandle;
+    PES_DEPENDENCY_NODE *node;
+    ULONG enumerationKey;
+
+    if (!(scManagerHandle = OpenSCManager(NULL, NULL, SC_MANAGER_CONNECT | SC_MANAGER_ENUMERATE_SERVICE)))
+        return GetLastError();
+
+    if (!EspDependencyGraph)
+    {
+        LPENUM_SERVICE_STATUS_PROCESS services;
+        ULONG numberOfServices;
+        ULONG i;
+
+        if (!(services = PhEnumServices(scManagerHandle, 0, 0, &numberOfServices)))
+        {
+            ULONG win32Result = GetLastError();
+
+            CloseServiceHandle(scManagerHandle);
+
+            return win32Result;
+        }
+
+        EspDependencyGraph = PhCreateHashtable(
+            sizeof(PES_DEPENDENCY_NODE),
+            EspDependencyNodeEqualFunction,
+            EspDependencyNodeHashFunction,
+            numberOfServices
+            );
+
+        for (i = 0; i < numberOfServices; i++)
+        {
+            PPH_STRING serviceName;
+
+            serviceName = PhCreateString(services[i].lpServiceName);
+            EspAddDependencyNode(serviceName);
+            PhDereferenceObject(serviceName);
+        }
+
+        PhFree(services);
+    }
+
+    enumerationKey = 0;
+
+    while (PhEnumHashtable(EspDependencyGraph, &node, &enumerationKey))
+    {
+        if ((*node)->Stale)
+            EspUpdateDependencyNode(scManagerHandle, *node);
+    }
+
+    CloseServiceHandle(scManagerHandle);
+
+    return 0;
+}
+
+static VOID NTAPI ServiceProviderUpdatedCallback(
+    _In_opt_ PVOID Parameter,
+    _In_opt_ PVOID Context
+    )
+{
+    PPH_PLUGIN_PROVIDER_UPDATE update = Parameter;
+    ULONG i;
+
+    PhAcquireQueuedLockExclusive(&EspDependencyGraphLock);
+
+    // The graph is only built once a dependencies page needs it.
+    if (EspDependencyGraph)
+    {
+        for (i = 0; i < update->NumberOfAddedItems; i++)
+            EspAddDependencyNode(((PPH_SERVICE_ITEM)update->AddedItems[i])->Name);
+
+        // We can't tell whether the configuration of a modified service changed, so we just
+        // query it again the next time the graph is used.
+        for (i = 0; i < update->NumberOfModifiedItems; i++)
+            EspAddDependencyNode(((PPH_SERVICE_ITEM)update->ModifiedItems[i])->Name);
+
+        for (i = 0; i < update->NumberOfRemovedItems; i++)
+        {
+            PES_DEPENDENCY_NODE node;
+
+            if (node = EspFindDependencyNode(((PPH_SERVICE_ITEM)update->RemovedItems[i])->Name))
+            {
+                PhRemoveEntryHashtable(EspDependencyGraph, &node);
+                EspDestroyDependencyNode(node);
+            }
+        }
+    }
+
+    PhReleaseQueuedLockExclusive(&EspDependencyGraphLock);
+}
+
+VOID EsInitializeDependencyGraph(
+    VOID
+    )
+{
+    PhRegisterCallback(
+        PhGetGeneralCallback(GeneralCallbackServiceProviderUpdated),
+        ServiceProviderUpdatedCallback,
+        NULL,
+        &ServiceProviderUpdatedCallbackRegistration
+        );
+}
+
+/**
+ * Gets the services that a service depends on.
+ *
+ * \param ServiceName The name of the service.
+ * \param Win32Result A variable which receives a Win32 error code if the dependencies could not
+ * be determined.
+ *
+ * \return A list of referenced service items, or NULL if the dependencies could not be
+ * determined. You must dereference the items and the list when you no longer need them.
+ */
+PPH_LIST EsQueryServiceDependencies(
+    _In_ PPH_STRING ServiceName,
+    _Out_ PULONG Win32Result
+    )
+{
+    PPH_LIST serviceList = NULL;
+    PES_DEPENDENCY_NODE node;
+    PPH_SERVICE_ITEM serviceItem;
+    ULONG win32Result;
+    ULONG i;
+
+    PhAcquireQueuedLockExclusive(&EspDependencyGraphLock);
+
+    if (!(win32Result = EspUpdateDependencyGraph()))
+    {
+        if (!(node = EspFindDependencyNode(ServiceName)))
+        {
+            // The service was created after the last service provider run.
+            node = EspAddDependencyNode(ServiceName);
+            win32Result = EspUpdateDependencyGraph();
+        }
+
+        if (!win32Result && !(win32Result = node->Win32Result))
+        {
+            serviceList = PhCreateList(node->Dependencies->Count + 1);
+
+            for (i = 0; i < node->Dependencies->Count; i++)
+            {
+                if (serviceItem = PhReferenceServiceItem(((PPH_STRING)node->Dependencies->Items[i])->Buffer))
+                    PhAddItemList(serviceList, serviceItem);
+            }
+        }
+    }
+
+    PhReleaseQueuedLockExclusive(&EspDependencyGraphLock);
+
+    *Win32Result = win32Result;
+
+    return serviceList;
+}
+
+/**
+ * Gets the services that depend on a service, either directly or through other services.
+ *
+ * \param ServiceName The name of the service.
+ * \param Win32Result A variable which receives a Win32 error code if the dependents could not
+ * be determined.
+ *
+ * \return A list of referenced service items, or NULL if the dependents could not be
+ * determined. You must dereference the items and the list when you no longer need them.
+ */
+PPH_LIST EsQueryServiceDependents(
+    _In_ PPH_STRING ServiceName,
+    _Out_ PULONG Win32Result
+    )
+{
+    PPH_LIST serviceList = NULL;
+    PPH_LIST dependentList;
+    PES_DEPENDENCY_NODE *node;
+    PPH_SERVICE_ITEM serviceItem;
+    PPH_STRING currentName;
+    ULONG enumerationKey;
+    ULONG win32Result;
+    ULONG index;
+    ULONG i;
+
+    PhAcquireQueuedLockExclusive(&EspDependencyGraphLock);
+
+    if (!(win32Result = EspUpdateDependencyGraph()))
+    {
+        // Walk the graph breadth-first, like EnumDependentServices. The list doubles as the
+        // queue, and each dependent is only added once, which also takes care of cycles.
+        dependentList = PhCreateList(8);
+
+        for (index = 0; index <= dependentList->Count; index++)
+        {
+            if (index == 0)
+                currentName = ServiceName;
+            else
+                currentName = ((PES_DEPENDENCY_NODE)dependentList->Items[index - 1])->ServiceName;
+
+            enumerationKey = 0;
+
+            while (PhEnumHashtable(EspDependencyGraph, &node, &enumerationKey))
+            {
+                if (PhEqualString((*node)->ServiceName, ServiceName, TRUE))
+                    continue;
+                if (PhFindItemList(dependentList, *node) != -1)
+                    continue;
+
+                for (i = 0; i < (*node)->Dependencies->Count; i++)
+                {
+                    if (PhEqualString((*node)->Dependencies->Items[i], currentName, TRUE))
+                    {
+                        PhAddItemList(dependentList, *node);
+                        break;
+                    }
+                }
+            }
+        }
+
+        serviceList = PhCreateList(dependentList->Count + 1);
+
+        for (i = 0; i < dependentList->Count; i++)
+        {
+            if (serviceItem = PhReferenceServiceItem(((PES_DEPENDENCY_NODE)dependentList->Items[i])->ServiceName->Buffer))
+                PhAddItemList(serviceList, serviceItem);
+        }
+
+        PhDereferenceObject(dependentList);
+    }
+
+    PhReleaseQueuedLockExclusive(&EspDependencyGraphLock);
+
+    *Win32Result = win32Result;
+
+    return serviceList;
+}
+
 static VOID EspLayoutServiceListControl(
     _In_ HWND hwndDlg,
     _In_ HWND ServiceListHandle
@@ -141,9 +531,7 @@ INT_PTR CALLBACK EspServiceDependenciesDlgProc(
             PPH_SERVICE_ITEM serviceItem = (PPH_SERVICE_ITEM)propSheetPage->lParam;
             HWND serviceListHandle;
             PPH_LIST serviceList;
-            SC_HANDLE serviceHandle;
             ULONG win32Result = 0;
-            BOOLEAN success = FALSE;
             PPH_SERVICE_ITEM *services;
 
             SetDlgItemText(hwndDlg, IDC_MESSAGE, L"This service depends on the following services:");
@@ -151,64 +539,18 @@ INT_PTR CALLBACK EspServiceDependenciesDlgProc(
             PhInitializeLayoutManager(&context->LayoutManager, hwndDlg);
             PhAddLayoutItem(&context->LayoutManager, GetDlgItem(hwndDlg, IDC_SERVICES_LAYOUT), NULL, PH_ANCHOR_ALL);
 
-            if (serviceHandle = PhOpenService(serviceItem->Name->Buffer, SERVICE_QUERY_CONFIG))
+            if (serviceList = EsQueryServiceDependencies(serviceItem->Name, &win32Result))
             {
-                LPQUERY_SERVICE_CONFIG serviceConfig;
-
-                if (serviceConfig = PhGetServiceConfig(serviceHandle))
-                {
-                    PWSTR dependency;
-                    PPH_SERVICE_ITEM dependencyService;
-
-                    dependency = serviceConfig->lpDependencies;
-                    serviceList = PhCreateList(8);
-                    success = TRUE;
+                services = PhAllocateCopy(serviceList->Items, sizeof(PPH_SERVICE_ITEM) * serviceList->Count);
 
-                    if (dependency)
-                    {
-                        ULONG dependencyLength;
-
-                        while (TRUE)
-                        {
-                            dependencyLength = (ULONG)PhCountStringZ(dependency);
-
-                            if (dependencyLength == 0)
-                                break;
+                serviceListHandle = PhCreateServiceListControl(hwndDlg, services, serviceList->Count);
+                context->ServiceListHandle = serviceListHandle;
+                EspLayoutServiceListControl(hwndDlg, serviceListHandle);
+                ShowWindow(serviceListHandle, SW_SHOW);
 
-                            if (dependency[0] == SC_GROUP_IDENTIFIER)
-                                goto ContinueLoop;
-
-                            if (dependencyService = PhReferenceServiceItem(dependency))
-                                PhAddItemList(serviceList, dependencyService);
-
-ContinueLoop:
-                            dependency += dependencyLength + 1;
-                        }
-                    }
-
-                    services = PhAllocateCopy(serviceList->Items, sizeof(PPH_SERVICE_ITEM) * serviceList->Count);
-
-                    serviceListHandle = PhCreateServiceListControl(hwndDlg, services, serviceList->Count);
-                    context->ServiceListHandle = serviceListHandle;
-                    EspLayoutServiceListControl(hwndDlg, serviceListHandle);
-                    ShowWindow(serviceListHandle, SW_SHOW);
-
-                    PhDereferenceObject(serviceList);
-                    PhFree(serviceConfig);
-                }
-                else
-                {
-                    win32Result = GetLastError();
-                }
-
-                CloseServiceHandle(serviceHandle);
+                PhDereferenceObject(serviceList);
             }
             else
-            {
-                win32Result = GetLastError();
-            }
-
-            if (!success)
             {
                 SetDlgItemText(hwndDlg, IDC_SERVICES_LAYOUT, PhaConcatStrings2(L"Unable to enumerate dependencies: ",
                     ((PPH_STRING)PhAutoDereferenceObject(PhGetWin32Message(win32Result)))->Buffer)->Buffer);
@@ -270,9 +612,7 @@ INT_PTR CALLBACK EspServiceDependentsDlgProc(
             PPH_SERVICE_ITEM serviceItem = (PPH_SERVICE_ITEM)propSheetPage->lParam;
             HWND serviceListHandle;
             PPH_LIST serviceList;
-            SC_HANDLE serviceHandle;
             ULONG win32Result = 0;
-            BOOLEAN success = FALSE;
             PPH_SERVICE_ITEM *services;
 
             SetDlgItemText(hwndDlg, IDC_MESSAGE, L"The following services depend on this service:");
@@ -280,48 +620,18 @@ INT_PTR CALLBACK EspServiceDependentsDlgProc(
             PhInitializeLayoutManager(&context->LayoutManager, hwndDlg);
             PhAddLayoutItem(&context->LayoutManager, GetDlgItem(hwndDlg, IDC_SERVICES_LAYOUT), NULL, PH_ANCHOR_ALL);
 
-            if (serviceHandle = PhOpenService(serviceItem->Name->Buffer, SERVICE_ENUMERATE_DEPENDENTS))
+            if (serviceList = EsQueryServiceDependents(serviceItem->Name, &win32Result))
             {
-                LPENUM_SERVICE_STATUS dependentServices;
-                ULONG numberOfDependentServices;
-
-                if (dependentServices = EsEnumDependentServices(serviceHandle, 0, &numberOfDependentServices))
-                {
-                    ULONG i;
-                    PPH_SERVICE_ITEM dependentService;
+                services = PhAllocateCopy(serviceList->Items, sizeof(PPH_SERVICE_ITEM) * serviceList->Count);
 
-                    serviceList = PhCreateList(8);
-                    success = TRUE;
+                serviceListHandle = PhCreateServiceListControl(hwndDlg, services, serviceList->Count);
+                context->ServiceListHandle = serviceListHandle;
+                EspLayoutServiceListControl(hwndDlg, serviceListHandle);
+                ShowWindow(serviceListHandle, SW_SHOW);
 
-                    for (i = 0; i < numberOfDependentServices; i++)
-                    {
-                        if (dependentService = PhReferenceServiceItem(dependentServices[i].lpServiceName))
-                            PhAddItemList(serviceList, dependentService);
-                    }
-
-                    services = PhAllocateCopy(serviceList->Items, sizeof(PPH_SERVICE_ITEM) * serviceList->Count);
-
-                    serviceListHandle = PhCreateServiceListControl(hwndDlg, services, serviceList->Count);
-                    context->ServiceListHandle = serviceListHandle;
-                    EspLayoutServiceListControl(hwndDlg, serviceListHandle);
-                    ShowWindow(serviceListHandle, SW_SHOW);
-
-                    PhDereferenceObject(serviceList);
-                    PhFree(dependentServices);
-                }
-                else
-                {
-                    win32Result = GetLastError();
-                }
-
-                CloseServiceHandle(serviceHandle);
+                PhDereferenceObject(serviceList);
             }
             else
-            {
-                win32Result = GetLastError();
-            }
-
-            if (!success)
             {
                 SetDlgItemText(hwndDlg, IDC_SERVICES_LAYOUT, PhaConcatStrings2(L"Unable to enumerate dependents: ",
                     ((PPH_STRING)PhAutoDereferenceObject(PhGetWin32Message(win32Result)))->Buffer)->Buffer);
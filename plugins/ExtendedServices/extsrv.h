@@ -23,6 +23,20 @@ LPENUM_SERVICE_STATUS EsEnumDependentServices(
     _Out_ PULONG Count
     );
 
+VOID EsInitializeDependencyGraph(
+    VOID
+    );
+
+PPH_LIST EsQueryServiceDependencies(
+    _In_ PPH_STRING ServiceName,
+    _Out_ PULONG Win32Result
+    );
+
+PPH_LIST EsQueryServiceDependents(
+    _In_ PPH_STRING ServiceName,
+    _Out_ PULONG Win32Result
+    );
+
 INT_PTR CALLBACK EspServiceDependenciesDlgProc(
     _In_ HWND hwndDlg,
     _In_ UINT uMsg,
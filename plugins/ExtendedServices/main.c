@@ -146,7 +146,7 @@ VOID NTAPI LoadCallback(
     _In_opt_ PVOID Context
     )
 {
-    // Nothing
+    EsInitializeDependencyGraph();
 }
 
 VOID NTAPI ShowOptionsCallback(
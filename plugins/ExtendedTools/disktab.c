@@ -799,22 +799,7 @@ VOID EtWriteDiskList(
     _In_ ULONG Mode
     )
 {
-    PPH_LIST lines;
-    ULONG i;
-
-    lines = PhGetGenericTreeNewLines(DiskTreeNewHandle, Mode);
-
-    for (i = 0; i < lines->Count; i++)
-    {
-        PPH_STRING line;
-
-        line = lines->Items[i];
-        PhWriteStringAsUtf8FileStream(FileStream, &line->sr);
-        PhDereferenceObject(line);
-        PhWriteStringAsUtf8FileStream2(FileStream, L"\r\n");
-    }
-
-    PhDereferenceObject(lines);
+    PhWriteGenericTreeNew(FileStream, DiskTreeNewHandle, Mode);
 }
 
 VOID EtHandleDiskCommand(
@@ -30,6 +30,27 @@ typedef struct _ETP_DISK_PACKET
     PPH_STRING FileName;
 } ETP_DISK_PACKET, *PETP_DISK_PACKET;
 
+// File object to file name cache. Entries are added by FileCreate, Name and rundown events and
+// removed by FileDelete events. Since delete events can be lost, the cache is also trimmed when it
+// grows too large: entries that have not been looked up since the last trim are removed first.
+typedef struct _ETP_FILE_OBJECT_ENTRY
+{
+    PVOID FileObject;
+    PPH_STRING FileName; // interned
+    BOOLEAN Referenced;
+} ETP_FILE_OBJECT_ENTRY, *PETP_FILE_OBJECT_ENTRY;
+
+#define ETP_FILE_OBJECT_CACHE_LIMIT (64 * 1024)
+
+// File names are interned so that every file object and disk item for the same file shares a
+// single string. This lets disk items be compared and hashed by pointer instead of by name.
+typedef struct _ETP_INTERNED_FILE_NAME
+{
+    PH_STRINGREF Key;
+    PPH_STRING Name;
+    ULONG UseCount; // file objects and disk items using this name
+} ETP_INTERNED_FILE_NAME, *PETP_INTERNED_FILE_NAME;
+
 VOID NTAPI EtpDiskItemDeleteProcedure(
     _In_ PVOID Object,
     _In_ ULONG Flags
@@ -44,6 +65,28 @@ ULONG NTAPI EtpDiskHashtableHashFunction(
     _In_ PVOID Entry
     );
 
+BOOLEAN NTAPI EtpFileObjectCompareFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    );
+
+ULONG NTAPI EtpFileObjectHashFunction(
+    _In_ PVOID Entry
+    );
+
+BOOLEAN NTAPI EtpInternedFileNameCompareFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    );
+
+ULONG NTAPI EtpInternedFileNameHashFunction(
+    _In_ PVOID Entry
+    );
+
+VOID EtpReleaseFileName(
+    _In_ PPH_STRING FileName
+    );
+
 VOID NTAPI ProcessesUpdatedCallback(
     _In_opt_ PVOID Parameter,
     _In_opt_ PVOID Context
@@ -64,7 +107,10 @@ PH_FREE_LIST EtDiskPacketFreeList;
 SLIST_HEADER EtDiskPacketListHead;
 PPH_HASHTABLE EtFileNameHashtable;
 PH_QUEUED_LOCK EtFileNameHashtableLock = PH_QUEUED_LOCK_INIT;
+// Protected by EtFileNameHashtableLock.
+static PPH_HASHTABLE EtpInternedFileNameHashtable;
 
+static ULONG EtpDiskItemLimit;
 static LARGE_INTEGER EtpPerformanceFrequency;
 static PH_CALLBACK_REGISTRATION ProcessesUpdatedCallbackRegistration;
 
@@ -75,17 +121,32 @@ VOID EtInitializeDiskInformation(
     LARGE_INTEGER performanceCounter;
 
     EtDiskItemType = PhCreateObjectType(L"DiskItem", 0, EtpDiskItemDeleteProcedure);
-    EtDiskHashtable = PhCreateHashtable(
+    EtDiskHashtable = PhCreateHashtableEx(
         sizeof(PET_DISK_ITEM),
         EtpDiskHashtableCompareFunction,
         EtpDiskHashtableHashFunction,
-        128
+        128,
+        PH_HASHTABLE_INCREMENTAL_RESIZE
         );
     InitializeListHead(&EtDiskAgeListHead);
 
     PhInitializeFreeList(&EtDiskPacketFreeList, sizeof(ETP_DISK_PACKET), 64);
     RtlInitializeSListHead(&EtDiskPacketListHead);
-    EtFileNameHashtable = PhCreateSimpleHashtable(128);
+    EtFileNameHashtable = PhCreateHashtableEx(
+        sizeof(ETP_FILE_OBJECT_ENTRY),
+        EtpFileObjectCompareFunction,
+        EtpFileObjectHashFunction,
+        128,
+        PH_HASHTABLE_INCREMENTAL_RESIZE
+        );
+    EtpInternedFileNameHashtable = PhCreateHashtableEx(
+        sizeof(ETP_INTERNED_FILE_NAME),
+        EtpInternedFileNameCompareFunction,
+        EtpInternedFileNameHashFunction,
+        128,
+        PH_HASHTABLE_INCREMENTAL_RESIZE
+        );
+    EtpDiskItemLimit = max(PhGetIntegerSetting(SETTING_NAME_DISK_ITEM_LIMIT), 16);
 
     NtQueryPerformanceCounter(&performanceCounter, &EtpPerformanceFrequency);
 
@@ -121,11 +182,17 @@ VOID NTAPI EtpDiskItemDeleteProcedure(
 {
     PET_DISK_ITEM diskItem = Object;
 
-    if (diskItem->FileName) PhDereferenceObject(diskItem->FileName);
+    if (diskItem->FileName)
+    {
+        EtpReleaseFileName(diskItem->FileName);
+        PhDereferenceObject(diskItem->FileName);
+    }
     if (diskItem->FileNameWin32) PhDereferenceObject(diskItem->FileNameWin32);
     if (diskItem->ProcessName) PhDereferenceObject(diskItem->ProcessName);
     if (diskItem->ProcessIcon) EtProcIconDereferenceProcessIcon(diskItem->ProcessIcon);
     if (diskItem->ProcessRecord) PhDereferenceProcessRecord(diskItem->ProcessRecord);
+    if (diskItem->ReadHistory) PhFree(diskItem->ReadHistory);
+    if (diskItem->WriteHistory) PhFree(diskItem->WriteHistory);
 }
 
 BOOLEAN NTAPI EtpDiskHashtableCompareFunction(
@@ -136,7 +203,8 @@ BOOLEAN NTAPI EtpDiskHashtableCompareFunction(
     PET_DISK_ITEM diskItem1 = *(PET_DISK_ITEM *)Entry1;
     PET_DISK_ITEM diskItem2 = *(PET_DISK_ITEM *)Entry2;
 
-    return diskItem1->ProcessId == diskItem2->ProcessId && PhEqualString(diskItem1->FileName, diskItem2->FileName, TRUE);
+    // File names are interned.
+    return diskItem1->ProcessId == diskItem2->ProcessId && diskItem1->FileName == diskItem2->FileName;
 }
 
 ULONG NTAPI EtpDiskHashtableHashFunction(
@@ -145,7 +213,144 @@ ULONG NTAPI EtpDiskHashtableHashFunction(
 {
     PET_DISK_ITEM diskItem = *(PET_DISK_ITEM *)Entry;
 
-    return (HandleToUlong(diskItem->ProcessId) / 4) ^ PhHashStringRef(&diskItem->FileName->sr, TRUE);
+    return (HandleToUlong(diskItem->ProcessId) / 4) ^ PhHashIntPtr((ULONG_PTR)diskItem->FileName);
+}
+
+BOOLEAN NTAPI EtpFileObjectCompareFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    )
+{
+    return ((PETP_FILE_OBJECT_ENTRY)Entry1)->FileObject == ((PETP_FILE_OBJECT_ENTRY)Entry2)->FileObject;
+}
+
+ULONG NTAPI EtpFileObjectHashFunction(
+    _In_ PVOID Entry
+    )
+{
+    return PhHashIntPtr((ULONG_PTR)((PETP_FILE_OBJECT_ENTRY)Entry)->FileObject);
+}
+
+BOOLEAN NTAPI EtpInternedFileNameCompareFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    )
+{
+    PETP_INTERNED_FILE_NAME entry1 = Entry1;
+    PETP_INTERNED_FILE_NAME entry2 = Entry2;
+
+    return PhEqualStringRef(&entry1->Key, &entry2->Key, TRUE);
+}
+
+ULONG NTAPI EtpInternedFileNameHashFunction(
+    _In_ PVOID Entry
+    )
+{
+    PETP_INTERNED_FILE_NAME entry = Entry;
+
+    return PhHashStringRef(&entry->Key, TRUE);
+}
+
+/**
+ * Gets the interned copy of a file name and increments its use count. The caller must hold
+ * EtFileNameHashtableLock exclusively.
+ *
+ * \return The interned string. No reference is added to the string object; call
+ * EtpReleaseFileNameLocked when it is no longer being used.
+ */
+static PPH_STRING EtpInternFileNameLocked(
+    _In_ PPH_STRINGREF FileName
+    )
+{
+    ETP_INTERNED_FILE_NAME lookupEntry;
+    PETP_INTERNED_FILE_NAME entry;
+    BOOLEAN added;
+
+    lookupEntry.Key = *FileName;
+    lookupEntry.Name = NULL;
+    lookupEntry.UseCount = 0;
+
+    entry = PhAddEntryHashtableEx(EtpInternedFileNameHashtable, &lookupEntry, &added);
+
+    if (added)
+    {
+        entry->Name = PhCreateString2(FileName);
+        entry->Key = entry->Name->sr;
+    }
+
+    entry->UseCount++;
+
+    return entry->Name;
+}
+
+static VOID EtpReleaseFileNameLocked(
+    _In_ PPH_STRING FileName
+    )
+{
+    ETP_INTERNED_FILE_NAME lookupEntry;
+    PETP_INTERNED_FILE_NAME entry;
+
+    lookupEntry.Key = FileName->sr;
+
+    if (entry = PhFindEntryHashtable(EtpInternedFileNameHashtable, &lookupEntry))
+    {
+        // Another string with the same name may have been interned after this one was removed.
+        if (entry->Name != FileName)
+            return;
+
+        if (--entry->UseCount == 0)
+        {
+            PhRemoveEntryHashtable(EtpInternedFileNameHashtable, &lookupEntry);
+            PhDereferenceObject(FileName);
+        }
+    }
+}
+
+/**
+ * Removes entries from the file object cache until it is below its limit. The caller must hold
+ * EtFileNameHashtableLock exclusively.
+ */
+static VOID EtpTrimFileObjectCacheLocked(
+    VOID
+    )
+{
+    PH_HASHTABLE_ENUM_CONTEXT enumContext;
+    PETP_FILE_OBJECT_ENTRY entry;
+    ETP_FILE_OBJECT_ENTRY lookupEntry;
+    ULONG target;
+    ULONG pass;
+
+    target = ETP_FILE_OBJECT_CACHE_LIMIT / 4 * 3;
+
+    // The first pass removes entries that have not been looked up since the last trim and gives
+    // the others a second chance. The second pass removes whatever is needed to reach the target.
+    for (pass = 0; pass < 2 && EtFileNameHashtable->Count > target; pass++)
+    {
+        PhBeginEnumHashtable(EtFileNameHashtable, &enumContext);
+
+        while ((entry = PhNextEnumHashtable(&enumContext)) && EtFileNameHashtable->Count > target)
+        {
+            if (pass == 0 && entry->Referenced)
+            {
+                entry->Referenced = FALSE;
+                continue;
+            }
+
+            // Removing an entry doesn't move the others, so we can continue enumerating.
+            lookupEntry = *entry;
+            EtpReleaseFileNameLocked(lookupEntry.FileName);
+            PhRemoveEntryHashtable(EtFileNameHashtable, &lookupEntry);
+        }
+    }
+}
+
+VOID EtpReleaseFileName(
+    _In_ PPH_STRING FileName
+    )
+{
+    PhAcquireQueuedLockExclusive(&EtFileNameHashtableLock);
+    EtpReleaseFileNameLocked(FileName);
+    PhReleaseQueuedLockExclusive(&EtFileNameHashtableLock);
 }
 
 PET_DISK_ITEM EtReferenceDiskItem(
@@ -206,36 +411,49 @@ VOID EtDiskProcessFileEvent(
     _In_ PET_ETW_FILE_EVENT Event
     )
 {
-    PH_KEY_VALUE_PAIR pair;
-    PPH_KEY_VALUE_PAIR realPair;
+    ETP_FILE_OBJECT_ENTRY lookupEntry;
+    PETP_FILE_OBJECT_ENTRY entry;
 
     if (!EtDiskEnabled)
         return;
 
-    if (Event->Type == EtEtwFileCreateType || Event->Type == EtEtwFileRundownType)
+    if (Event->Type == EtEtwFileCreateType || Event->Type == EtEtwFileNameType || Event->Type == EtEtwFileRundownType)
     {
-        pair.Key = Event->FileObject;
-        pair.Value = NULL;
+        PPH_STRING fileName;
+        BOOLEAN added;
+
+        if (Event->FileName.Length == 0)
+            return;
+
+        lookupEntry.FileObject = Event->FileObject;
+        lookupEntry.FileName = NULL;
+        lookupEntry.Referenced = FALSE;
 
         PhAcquireQueuedLockExclusive(&EtFileNameHashtableLock);
 
-        realPair = PhAddEntryHashtableEx(EtFileNameHashtable, &pair, NULL);
-        PhMoveReference(&realPair->Value, PhCreateString2(&Event->FileName));
+        fileName = EtpInternFileNameLocked(&Event->FileName);
+        entry = PhAddEntryHashtableEx(EtFileNameHashtable, &lookupEntry, &added);
+
+        if (!added)
+            EtpReleaseFileNameLocked(entry->FileName);
+
+        entry->FileName = fileName;
+
+        if (added && EtFileNameHashtable->Count > ETP_FILE_OBJECT_CACHE_LIMIT)
+            EtpTrimFileObjectCacheLocked();
 
         PhReleaseQueuedLockExclusive(&EtFileNameHashtableLock);
     }
     else if (Event->Type == EtEtwFileDeleteType)
     {
-        pair.Key = Event->FileObject;
+        lookupEntry.FileObject = Event->FileObject;
 
         PhAcquireQueuedLockExclusive(&EtFileNameHashtableLock);
 
-        realPair = PhFindEntryHashtable(EtFileNameHashtable, &pair);
-
-        if (realPair)
+        if (entry = PhFindEntryHashtable(EtFileNameHashtable, &lookupEntry))
         {
-            PhDereferenceObject(realPair->Value);
-            PhRemoveEntryHashtable(EtFileNameHashtable, &pair);
+            EtpReleaseFileNameLocked(entry->FileName);
+            PhRemoveEntryHashtable(EtFileNameHashtable, &lookupEntry);
         }
 
         PhReleaseQueuedLockExclusive(&EtFileNameHashtableLock);
@@ -246,19 +464,21 @@ PPH_STRING EtFileObjectToFileName(
     _In_ PVOID FileObject
     )
 {
-    PH_KEY_VALUE_PAIR pair;
-    PPH_KEY_VALUE_PAIR realPair;
+    ETP_FILE_OBJECT_ENTRY lookupEntry;
+    PETP_FILE_OBJECT_ENTRY entry;
     PPH_STRING fileName;
 
-    pair.Key = FileObject;
+    lookupEntry.FileObject = FileObject;
     fileName = NULL;
 
     PhAcquireQueuedLockShared(&EtFileNameHashtableLock);
 
-    realPair = PhFindEntryHashtable(EtFileNameHashtable, &pair);
-
-    if (realPair)
-        PhSetReference(&fileName, realPair->Value);
+    if (entry = PhFindEntryHashtable(EtFileNameHashtable, &lookupEntry))
+    {
+        // This races with other readers, but all of them are setting the same value.
+        entry->Referenced = TRUE;
+        PhSetReference(&fileName, entry->FileName);
+    }
 
     PhReleaseQueuedLockShared(&EtFileNameHashtableLock);
 
@@ -282,47 +502,67 @@ VOID EtpProcessDiskPacket(
     if (diskEvent->TransferSize == 0)
         return;
 
+    // The name may have arrived after the packet was queued, e.g. from the rundown session.
+    if (!Packet->FileName)
+        Packet->FileName = EtFileObjectToFileName(diskEvent->FileObject);
+
     // Ignore packets with no file name - this is useless to the user.
     if (!Packet->FileName)
         return;
 
+    // The packet's file name is normally the interned string, so try that first.
     diskItem = EtReferenceDiskItem(diskEvent->ClientId.UniqueProcess, Packet->FileName);
 
     if (!diskItem)
     {
-        PPH_PROCESS_ITEM processItem;
+        PPH_STRING fileName;
+
+        // The file object may have been closed since the packet was queued, in which case the
+        // name has to be interned again.
+        PhAcquireQueuedLockExclusive(&EtFileNameHashtableLock);
+        fileName = EtpInternFileNameLocked(&Packet->FileName->sr);
+        PhReleaseQueuedLockExclusive(&EtFileNameHashtableLock);
 
-        // Disk item not found (or the address was re-used), create it.
+        if (fileName != Packet->FileName && (diskItem = EtReferenceDiskItem(diskEvent->ClientId.UniqueProcess, fileName)))
+        {
+            EtpReleaseFileName(fileName);
+        }
+        else
+        {
+            PPH_PROCESS_ITEM processItem;
 
-        diskItem = EtCreateDiskItem();
+            // Disk item not found (or the address was re-used), create it.
 
-        diskItem->ProcessId = diskEvent->ClientId.UniqueProcess;
-        PhSetReference(&diskItem->FileName, Packet->FileName);
-        diskItem->FileNameWin32 = PhGetFileName(diskItem->FileName);
+            diskItem = EtCreateDiskItem();
 
-        if (processItem = PhReferenceProcessItem(diskItem->ProcessId))
-        {
-            PhSetReference(&diskItem->ProcessName, processItem->ProcessName);
-            diskItem->ProcessIcon = EtProcIconReferenceSmallProcessIcon(EtGetProcessBlock(processItem));
-            diskItem->ProcessRecord = processItem->Record;
-            PhReferenceProcessRecord(diskItem->ProcessRecord);
+            diskItem->ProcessId = diskEvent->ClientId.UniqueProcess;
+            PhSetReference(&diskItem->FileName, fileName); // the use count is released by the delete procedure
+            diskItem->FileNameWin32 = PhGetFileName(diskItem->FileName);
 
-            PhDereferenceObject(processItem);
-        }
+            if (processItem = PhReferenceProcessItem(diskItem->ProcessId))
+            {
+                PhSetReference(&diskItem->ProcessName, processItem->ProcessName);
+                diskItem->ProcessIcon = EtProcIconReferenceSmallProcessIcon(EtGetProcessBlock(processItem));
+                diskItem->ProcessRecord = processItem->Record;
+                PhReferenceProcessRecord(diskItem->ProcessRecord);
 
-        // Add the disk item to the age list.
-        diskItem->AddTime = RunId;
-        diskItem->FreshTime = RunId;
-        InsertHeadList(&EtDiskAgeListHead, &diskItem->AgeListEntry);
+                PhDereferenceObject(processItem);
+            }
 
-        // Add the disk item to the hashtable.
-        PhAcquireQueuedLockExclusive(&EtDiskHashtableLock);
-        PhAddEntryHashtable(EtDiskHashtable, &diskItem);
-        PhReleaseQueuedLockExclusive(&EtDiskHashtableLock);
+            // Add the disk item to the age list.
+            diskItem->AddTime = RunId;
+            diskItem->FreshTime = RunId;
+            InsertHeadList(&EtDiskAgeListHead, &diskItem->AgeListEntry);
+
+            // Add the disk item to the hashtable.
+            PhAcquireQueuedLockExclusive(&EtDiskHashtableLock);
+            PhAddEntryHashtable(EtDiskHashtable, &diskItem);
+            PhReleaseQueuedLockExclusive(&EtDiskHashtableLock);
 
-        // Raise the disk item added event.
-        PhInvokeCallback(&EtDiskItemAddedEvent, diskItem);
-        added = TRUE;
+            // Raise the disk item added event.
+            PhInvokeCallback(&EtDiskItemAddedEvent, diskItem);
+            added = TRUE;
+        }
     }
 
     // The I/O priority number needs to be decoded.
@@ -361,39 +601,69 @@ VOID EtpProcessDiskPacket(
     }
 }
 
-ULONG64 EtpCalculateAverage(
-    _In_ PULONG64 Buffer,
-    _In_ ULONG BufferSize,
-    _In_ ULONG BufferPosition,
-    _In_ ULONG BufferCount,
-    _In_ ULONG NumberToConsider
+static VOID EtpUpdateDiskItemHistory(
+    _Inout_ PET_DISK_ITEM DiskItem
     )
 {
-    ULONG64 sum;
-    ULONG i;
-    ULONG count;
+    ULONG64 evictedRead = 0;
+    ULONG64 evictedWrite = 0;
+
+    if (!DiskItem->ReadHistory && DiskItem->HistoryCount != 0 && (DiskItem->ReadDelta != 0 || DiskItem->WriteDelta != 0))
+    {
+        ULONG firstPosition;
 
-    sum = 0;
-    i = BufferPosition;
+        // This item is active in more than one period, so it now needs real history buffers.
 
-    if (NumberToConsider > BufferCount)
-        NumberToConsider = BufferCount;
+        DiskItem->ReadHistory = PhAllocate(HISTORY_SIZE * sizeof(ULONG64));
+        memset(DiskItem->ReadHistory, 0, HISTORY_SIZE * sizeof(ULONG64));
+        DiskItem->WriteHistory = PhAllocate(HISTORY_SIZE * sizeof(ULONG64));
+        memset(DiskItem->WriteHistory, 0, HISTORY_SIZE * sizeof(ULONG64));
 
-    if (NumberToConsider == 0)
-        return 0;
+        firstPosition = (DiskItem->HistoryPosition + DiskItem->HistoryCount - 1) % HISTORY_SIZE;
+        DiskItem->ReadHistory[firstPosition] = DiskItem->FirstReadDelta;
+        DiskItem->WriteHistory[firstPosition] = DiskItem->FirstWriteDelta;
+    }
 
-    count = NumberToConsider;
+    if (DiskItem->HistoryPosition != 0)
+        DiskItem->HistoryPosition--;
+    else
+        DiskItem->HistoryPosition = HISTORY_SIZE - 1;
 
-    do
+    if (DiskItem->ReadHistory)
+    {
+        if (DiskItem->HistoryCount == HISTORY_SIZE)
+        {
+            evictedRead = DiskItem->ReadHistory[DiskItem->HistoryPosition];
+            evictedWrite = DiskItem->WriteHistory[DiskItem->HistoryPosition];
+        }
+
+        DiskItem->ReadHistory[DiskItem->HistoryPosition] = DiskItem->ReadDelta;
+        DiskItem->WriteHistory[DiskItem->HistoryPosition] = DiskItem->WriteDelta;
+    }
+    else
     {
-        sum += Buffer[i];
-        i++;
+        if (DiskItem->HistoryCount == 0)
+        {
+            DiskItem->FirstReadDelta = DiskItem->ReadDelta;
+            DiskItem->FirstWriteDelta = DiskItem->WriteDelta;
+        }
+        else if (DiskItem->HistoryCount == HISTORY_SIZE)
+        {
+            // The first values have left the window.
+            evictedRead = DiskItem->FirstReadDelta;
+            evictedWrite = DiskItem->FirstWriteDelta;
+            DiskItem->FirstReadDelta = 0;
+            DiskItem->FirstWriteDelta = 0;
+        }
+    }
 
-        if (i == BufferSize)
-            i = 0;
-    } while (--count != 0);
+    if (DiskItem->HistoryCount < HISTORY_SIZE)
+        DiskItem->HistoryCount++;
 
-    return sum / NumberToConsider;
+    DiskItem->ReadHistorySum += DiskItem->ReadDelta - evictedRead;
+    DiskItem->WriteHistorySum += DiskItem->WriteDelta - evictedWrite;
+    DiskItem->ReadAverage = DiskItem->ReadHistorySum / DiskItem->HistoryCount;
+    DiskItem->WriteAverage = DiskItem->WriteHistorySum / DiskItem->HistoryCount;
 }
 
 static VOID NTAPI ProcessesUpdatedCallback(
@@ -406,6 +676,9 @@ static VOID NTAPI ProcessesUpdatedCallback(
     PSLIST_ENTRY listEntry;
     PLIST_ENTRY ageListEntry;
 
+    // Stop the rundown session once it has finished enumerating file objects.
+    EtUpdateEtwRundown();
+
     // Process incoming disk event packets.
 
     listEntry = RtlInterlockedFlushSList(&EtDiskPacketListHead);
@@ -436,7 +709,12 @@ static VOID NTAPI ProcessesUpdatedCallback(
         diskItem = CONTAINING_RECORD(ageListEntry, ET_DISK_ITEM, AgeListEntry);
         ageListEntry = ageListEntry->Blink;
 
-        if (runCount - diskItem->FreshTime < HISTORY_SIZE) // must compare like this to avoid overflow/underflow problems
+        // Once there are too many items, we remove the least recently used ones even if they are
+        // still within the history window.
+        if (
+            runCount - diskItem->FreshTime < HISTORY_SIZE && // must compare like this to avoid overflow/underflow problems
+            EtDiskHashtable->Count <= EtpDiskItemLimit
+            )
             break;
 
         PhInvokeCallback(&EtDiskItemRemovedEvent, diskItem);
@@ -458,16 +736,7 @@ static VOID NTAPI ProcessesUpdatedCallback(
 
         // Update statistics.
 
-        if (diskItem->HistoryPosition != 0)
-            diskItem->HistoryPosition--;
-        else
-            diskItem->HistoryPosition = HISTORY_SIZE - 1;
-
-        diskItem->ReadHistory[diskItem->HistoryPosition] = diskItem->ReadDelta;
-        diskItem->WriteHistory[diskItem->HistoryPosition] = diskItem->WriteDelta;
-
-        if (diskItem->HistoryCount < HISTORY_SIZE)
-            diskItem->HistoryCount++;
+        EtpUpdateDiskItemHistory(diskItem);
 
         if (diskItem->ResponseTimeCount != 0)
         {
@@ -485,8 +754,6 @@ static VOID NTAPI ProcessesUpdatedCallback(
         diskItem->WriteTotal += diskItem->WriteDelta;
         diskItem->ReadDelta = 0;
         diskItem->WriteDelta = 0;
-        diskItem->ReadAverage = EtpCalculateAverage(diskItem->ReadHistory, HISTORY_SIZE, diskItem->HistoryPosition, diskItem->HistoryCount, HISTORY_SIZE);
-        diskItem->WriteAverage = EtpCalculateAverage(diskItem->WriteHistory, HISTORY_SIZE, diskItem->HistoryPosition, diskItem->HistoryCount, HISTORY_SIZE);
 
         if (diskItem->AddTime != runCount)
         {
@@ -65,12 +65,11 @@ BOOLEAN EtpDiskListSectionCallback(
                 PhAutoDereferenceObject(PhFormat(format, 4, 50)));
         }
         break;
-    case MiListSectionSortProcessList:
+    case MiListSectionGetProcessCompareFunction:
         {
-            PPH_MINIINFO_LIST_SECTION_SORT_LIST sortList = Parameter1;
+            PPH_MINIINFO_LIST_SECTION_GET_COMPARE_FUNCTION getCompareFunction = Parameter1;
 
-            qsort(sortList->List->Items, sortList->List->Count,
-                sizeof(PPH_PROCESS_NODE), EtpDiskListSectionProcessCompareFunction);
+            getCompareFunction->CompareFunction = EtpDiskListSectionProcessCompareFunction;
         }
         return TRUE;
     case MiListSectionAssignSortData:
@@ -177,12 +176,11 @@ BOOLEAN EtpNetworkListSectionCallback(
                 PhAutoDereferenceObject(PhFormat(format, 4, 50)));
         }
         break;
-    case MiListSectionSortProcessList:
+    case MiListSectionGetProcessCompareFunction:
         {
-            PPH_MINIINFO_LIST_SECTION_SORT_LIST sortList = Parameter1;
+            PPH_MINIINFO_LIST_SECTION_GET_COMPARE_FUNCTION getCompareFunction = Parameter1;
 
-            qsort(sortList->List->Items, sortList->List->Count,
-                sizeof(PPH_PROCESS_NODE), EtpNetworkListSectionProcessCompareFunction);
+            getCompareFunction->CompareFunction = EtpNetworkListSectionProcessCompareFunction;
         }
         return TRUE;
     case MiListSectionAssignSortData:
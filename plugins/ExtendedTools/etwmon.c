@@ -58,10 +58,19 @@ static GUID DiskIoGuid_I = { 0x3d6fa8d4, 0xfe05, 0x11d0, { 0x9d, 0xda, 0x00, 0xc
 static GUID FileIoGuid_I = { 0x90cbdc39, 0x4a3e, 0x11d1, { 0x84, 0xf4, 0x00, 0x00, 0xf8, 0x04, 0x64, 0xe3 } };
 static GUID TcpIpGuid_I = { 0x9a280ac0, 0xc8e0, 0x11d1, { 0x84, 0xe2, 0x00, 0xc0, 0x4f, 0xb9, 0x98, 0xa2 } };
 static GUID UdpIpGuid_I = { 0xbf3a50c5, 0xa9c9, 0x4988, { 0xa0, 0x05, 0x2d, 0xf0, 0xb7, 0xc8, 0x0f, 0x80 } };
+static GUID ProcessGuid_I = { 0x3d6fa8d0, 0xfe05, 0x11d0, { 0x9d, 0xda, 0x00, 0xc0, 0x4f, 0xd7, 0xba, 0x7c } };
+static GUID ThreadGuid_I = { 0x3d6fa8d1, 0xfe05, 0x11d0, { 0x9d, 0xda, 0x00, 0xc0, 0x4f, 0xd7, 0xba, 0x7c } };
+static GUID ImageLoadGuid_I = { 0x2cb15d1d, 0x5fc1, 0x11d2, { 0xab, 0xe1, 0x00, 0xa0, 0xc9, 0x11, 0xf5, 0x18 } };
 
 // ETW tracing layer
 
 BOOLEAN EtEtwEnabled;
+ULONG EtEtwEventsLost;
+ULONG EtEtwBuffersLost;
+ULONG EtEtwBuffersRead;
+ULONG64 EtEtwBytesRead;
+#define ET_ETW_MAXIMUM_BUFFERS_LIMIT 512
+
 static UNICODE_STRING EtpSharedKernelLoggerName = RTL_CONSTANT_STRING(KERNEL_LOGGER_NAME);
 static UNICODE_STRING EtpPrivateKernelLoggerName = RTL_CONSTANT_STRING(L"PhEtKernelLogger");
 static TRACEHANDLE EtpSessionHandle;
@@ -71,7 +80,15 @@ static PEVENT_TRACE_PROPERTIES EtpTraceProperties;
 static BOOLEAN EtpEtwActive;
 static BOOLEAN EtpStartedSession;
 static BOOLEAN EtpEtwExiting;
+static BOOLEAN EtpAdaptiveBuffers;
 static HANDLE EtpEtwMonitorThreadHandle;
+static BOOLEAN EtpProcessEventsEnabled;
+
+// Used to convert raw event time stamps. See EtpEtwTimeStampToSystemTime.
+static ULONG EtpEtwClockType;
+static LARGE_INTEGER EtpEtwReferenceCounter;
+static LARGE_INTEGER EtpEtwReferenceTime;
+static LARGE_INTEGER EtpEtwCounterFrequency;
 
 // ETW rundown layer
 
@@ -79,7 +96,11 @@ static UNICODE_STRING EtpRundownLoggerName = RTL_CONSTANT_STRING(L"PhEtRundownLo
 static TRACEHANDLE EtpRundownSessionHandle;
 static PEVENT_TRACE_PROPERTIES EtpRundownTraceProperties;
 static BOOLEAN EtpRundownActive;
+static BOOLEAN EtpRundownStopping;
 static HANDLE EtpRundownEtwMonitorThreadHandle;
+static ULONG EtpRundownEventCount;
+static ULONG EtpRundownLastEventCount;
+static ULONG EtpRundownIdleCount;
 
 VOID EtEtwMonitorInitialization(
     VOID
@@ -139,13 +160,35 @@ VOID EtStartEtwSession(
     EtpTraceProperties->Wnode.Guid = *EtpActualSessionGuid;
     EtpTraceProperties->Wnode.ClientContext = 1;
     EtpTraceProperties->Wnode.Flags = WNODE_FLAG_TRACED_GUID;
-    EtpTraceProperties->MinimumBuffers = 1;
+    EtpTraceProperties->BufferSize = PhGetIntegerSetting(SETTING_NAME_ETW_BUFFER_SIZE);
+    EtpTraceProperties->MinimumBuffers = PhGetIntegerSetting(SETTING_NAME_ETW_MINIMUM_BUFFERS);
+    EtpTraceProperties->MaximumBuffers = PhGetIntegerSetting(SETTING_NAME_ETW_MAXIMUM_BUFFERS);
     EtpTraceProperties->LogFileMode = EVENT_TRACE_REAL_TIME_MODE;
-    EtpTraceProperties->FlushTimer = 1;
+    EtpTraceProperties->FlushTimer = max(PhGetIntegerSetting(SETTING_NAME_ETW_FLUSH_TIMER), 1);
     EtpTraceProperties->EnableFlags = EVENT_TRACE_FLAG_DISK_IO | EVENT_TRACE_FLAG_DISK_FILE_IO | EVENT_TRACE_FLAG_NETWORK_TCPIP;
+
+    // Process, thread and image load events tell the providers about changes before they
+    // poll for them, which is otherwise only possible with KProcessHacker.
+    EtpProcessEventsEnabled = !!PhGetIntegerSetting(SETTING_NAME_ETW_PROCESS_EVENTS);
+
+    if (EtpProcessEventsEnabled)
+        EtpTraceProperties->EnableFlags |= EVENT_TRACE_FLAG_PROCESS | EVENT_TRACE_FLAG_THREAD | EVENT_TRACE_FLAG_IMAGE_LOAD;
+
     EtpTraceProperties->LogFileNameOffset = 0;
     EtpTraceProperties->LoggerNameOffset = sizeof(EVENT_TRACE_PROPERTIES);
 
+    if (EtpTraceProperties->MinimumBuffers == 0)
+        EtpTraceProperties->MinimumBuffers = PhSystemBasicInformation.NumberOfProcessors * 2;
+
+    // If no maximum was set, we start with a small pool and let EtFlushEtwSession grow it when
+    // the consumer falls behind.
+    EtpAdaptiveBuffers = EtpTraceProperties->MaximumBuffers == 0;
+
+    if (EtpAdaptiveBuffers)
+        EtpTraceProperties->MaximumBuffers = EtpTraceProperties->MinimumBuffers + 20;
+    else
+        EtpTraceProperties->MaximumBuffers = max(EtpTraceProperties->MaximumBuffers, EtpTraceProperties->MinimumBuffers);
+
     if (WindowsVersion >= WINDOWS_8)
         EtpTraceProperties->LogFileMode |= EVENT_TRACE_SYSTEM_LOGGER_MODE;
 
@@ -201,16 +244,142 @@ VOID EtFlushEtwSession(
     )
 {
     if (EtEtwEnabled)
-        EtpControlEtwSession(EVENT_TRACE_CONTROL_FLUSH);
+    {
+        // The properties receive the session statistics.
+        if (EtpControlEtwSession(EVENT_TRACE_CONTROL_FLUSH) == ERROR_SUCCESS)
+        {
+            BOOLEAN lost;
+
+            lost = EtpTraceProperties->EventsLost > EtEtwEventsLost ||
+                EtpTraceProperties->RealTimeBuffersLost > EtEtwBuffersLost;
+
+            EtEtwEventsLost = EtpTraceProperties->EventsLost;
+            EtEtwBuffersLost = EtpTraceProperties->RealTimeBuffersLost;
+
+            // Events were dropped because all buffers were full, so allow the session to use
+            // more of them. We only do this for sessions that we own.
+            if (
+                lost &&
+                EtpAdaptiveBuffers &&
+                EtpStartedSession &&
+                EtpTraceProperties->MaximumBuffers < ET_ETW_MAXIMUM_BUFFERS_LIMIT
+                )
+            {
+                EtpTraceProperties->MaximumBuffers = min(EtpTraceProperties->MaximumBuffers * 2, ET_ETW_MAXIMUM_BUFFERS_LIMIT);
+                EtpControlEtwSession(EVENT_TRACE_CONTROL_UPDATE);
+            }
+        }
+    }
 }
 
 ULONG NTAPI EtpEtwBufferCallback(
     _In_ PEVENT_TRACE_LOGFILE Buffer
     )
 {
+    // This is called on the consumer thread after each buffer has been delivered. Together with
+    // the lost counts from EtFlushEtwSession, this shows whether we are keeping up with the
+    // session.
+    EtEtwBuffersRead = Buffer->BuffersRead;
+    EtEtwBytesRead += Buffer->Filled;
+
     return !EtpEtwExiting;
 }
 
+/**
+ * Converts the raw time stamp of an event to a system time.
+ *
+ * \remarks The session is consumed with raw time stamps, so we only convert the few events
+ * which need a time.
+ */
+static VOID EtpEtwTimeStampToSystemTime(
+    _In_ PLARGE_INTEGER TimeStamp,
+    _Out_ PLARGE_INTEGER SystemTime
+    )
+{
+    if (EtpEtwClockType == 1 && EtpEtwCounterFrequency.QuadPart != 0) // QPC
+    {
+        SystemTime->QuadPart = EtpEtwReferenceTime.QuadPart +
+            (TimeStamp->QuadPart - EtpEtwReferenceCounter.QuadPart) * 10000000 / EtpEtwCounterFrequency.QuadPart;
+    }
+    else if (EtpEtwClockType == 2) // system time
+    {
+        *SystemTime = *TimeStamp;
+    }
+    else
+    {
+        // Events are delivered within a flush interval, which is close enough.
+        PhQuerySystemTime(SystemTime);
+    }
+}
+
+static VOID EtpProcessProcessEvent(
+    _In_ PEVENT_RECORD EventRecord
+    )
+{
+    PH_PROCESS_PROVIDER_HINT hint;
+    Process_TypeGroup1 *data = EventRecord->UserData;
+    PUCHAR userData = EventRecord->UserData;
+    ULONG userDataLength = EventRecord->UserDataLength;
+    ULONG offset;
+
+    if (userDataLength < FIELD_OFFSET(Process_TypeGroup1, DirectoryTableBase))
+        return;
+
+    memset(&hint, 0, sizeof(PH_PROCESS_PROVIDER_HINT));
+
+    switch (EventRecord->EventHeader.EventDescriptor.Opcode)
+    {
+    case EVENT_TRACE_TYPE_START:
+        hint.Type = ProcessProviderHintProcessCreate;
+        break;
+    case EVENT_TRACE_TYPE_END:
+        hint.Type = ProcessProviderHintProcessExit;
+        break;
+    default:
+        return;
+    }
+
+    hint.ProcessId = UlongToHandle(data->ProcessId);
+    hint.ParentProcessId = UlongToHandle(data->ParentId);
+    EtpEtwTimeStampToSystemTime(&EventRecord->EventHeader.TimeStamp, &hint.Time);
+
+    // Get the image file name, which follows the user SID. Older versions of the event have
+    // a different layout, so we don't bother with them.
+    if (hint.Type == ProcessProviderHintProcessCreate && EventRecord->EventHeader.EventDescriptor.Version >= 3)
+    {
+        offset = sizeof(Process_TypeGroup1);
+
+        if (EventRecord->EventHeader.EventDescriptor.Version >= 4)
+            offset += sizeof(ULONG); // Flags
+
+        // The SID is preceded by a TOKEN_USER structure, unless it is empty.
+        if (offset + sizeof(ULONG) <= userDataLength && *(PULONG)(userData + offset) == 0)
+        {
+            offset += sizeof(ULONG);
+        }
+        else
+        {
+            offset += sizeof(TOKEN_USER);
+
+            if (offset + FIELD_OFFSET(SID, SubAuthority) <= userDataLength)
+                offset += RtlLengthRequiredSid(((PSID)(userData + offset))->SubAuthorityCount);
+            else
+                offset = userDataLength;
+        }
+
+        if (offset < userDataLength)
+        {
+            hint.ImageName = PhConvertMultiByteToUtf16Ex(
+                (PCHAR)(userData + offset),
+                strnlen((PCHAR)(userData + offset), userDataLength - offset)
+                );
+        }
+    }
+
+    PhQueueProcessProviderHint(&hint);
+    PhClearReference(&hint.ImageName);
+}
+
 VOID NTAPI EtpEtwEventCallback(
     _In_ PEVENT_RECORD EventRecord
     )
@@ -376,6 +545,56 @@ VOID NTAPI EtpEtwEventCallback(
             EtProcessNetworkEvent(&networkEvent);
         }
     }
+    else if (memcmp(&EventRecord->EventHeader.ProviderId, &ProcessGuid_I, sizeof(GUID)) == 0)
+    {
+        // Process
+
+        EtpProcessProcessEvent(EventRecord);
+    }
+    else if (memcmp(&EventRecord->EventHeader.ProviderId, &ThreadGuid_I, sizeof(GUID)) == 0)
+    {
+        // Thread
+
+        // Disk events from threads created since the last update can't otherwise be
+        // attributed to their process.
+        if (
+            EventRecord->EventHeader.EventDescriptor.Opcode == EVENT_TRACE_TYPE_START &&
+            EventRecord->UserDataLength >= sizeof(Thread_TypeGroup1) &&
+            WindowsVersion >= WINDOWS_8
+            )
+        {
+            Thread_TypeGroup1 *data = EventRecord->UserData;
+
+            EtAddThreadProcessEntry(UlongToHandle(data->TThreadId), UlongToHandle(data->ProcessId));
+        }
+    }
+    else if (memcmp(&EventRecord->EventHeader.ProviderId, &ImageLoadGuid_I, sizeof(GUID)) == 0)
+    {
+        // ImageLoad
+
+        PH_PROCESS_PROVIDER_HINT hint;
+
+        memset(&hint, 0, sizeof(PH_PROCESS_PROVIDER_HINT));
+        hint.Type = -1;
+
+        switch (EventRecord->EventHeader.EventDescriptor.Opcode)
+        {
+        case EVENT_TRACE_TYPE_LOAD:
+            hint.Type = ProcessProviderHintImageLoad;
+            break;
+        case EVENT_TRACE_TYPE_END:
+            hint.Type = ProcessProviderHintImageUnload;
+            break;
+        }
+
+        if (hint.Type != -1 && EventRecord->UserDataLength >= sizeof(Image_Load))
+        {
+            Image_Load *data = EventRecord->UserData;
+
+            hint.ProcessId = UlongToHandle(data->ProcessId);
+            PhQueueProcessProviderHint(&hint);
+        }
+    }
 }
 
 NTSTATUS EtpEtwMonitorThreadStart(
@@ -388,7 +607,8 @@ NTSTATUS EtpEtwMonitorThreadStart(
 
     memset(&logFile, 0, sizeof(EVENT_TRACE_LOGFILE));
     logFile.LoggerName = EtpActualKernelLoggerName->Buffer;
-    logFile.ProcessTraceMode = PROCESS_TRACE_MODE_REAL_TIME | PROCESS_TRACE_MODE_EVENT_RECORD;
+    // We don't use event timestamps, so skip converting them for every event.
+    logFile.ProcessTraceMode = PROCESS_TRACE_MODE_REAL_TIME | PROCESS_TRACE_MODE_EVENT_RECORD | PROCESS_TRACE_MODE_RAW_TIMESTAMP;
     logFile.BufferCallback = EtpEtwBufferCallback;
     logFile.EventRecordCallback = EtpEtwEventCallback;
 
@@ -399,6 +619,11 @@ NTSTATUS EtpEtwMonitorThreadStart(
 
         if (traceHandle != INVALID_PROCESSTRACE_HANDLE)
         {
+            // Remember the clock of the session so that raw time stamps can be converted.
+            EtpEtwClockType = logFile.LogfileHeader.ReservedFlags;
+            NtQueryPerformanceCounter(&EtpEtwReferenceCounter, &EtpEtwCounterFrequency);
+            PhQuerySystemTime(&EtpEtwReferenceTime);
+
             while (!EtpEtwExiting && (result = ProcessTrace(&traceHandle, 1, NULL, NULL)) == ERROR_SUCCESS)
                 NOTHING;
 
@@ -412,6 +637,11 @@ NTSTATUS EtpEtwMonitorThreadStart(
         {
             // The session was stopped by another program. Try to start it again.
             EtStartEtwSession();
+
+            // File objects opened while the session was stopped are missing from the file name
+            // cache, so enumerate them again. Existing entries are simply updated.
+            if (EtpEtwActive && EtDiskEnabled && !EtpRundownActive)
+                EtStartEtwRundown();
         }
 
         // Some error occurred, so sleep for a while before trying again.
@@ -469,6 +699,10 @@ ULONG EtStartEtwRundown(
         return result;
     }
 
+    EtpRundownEventCount = 0;
+    EtpRundownLastEventCount = 0;
+    EtpRundownIdleCount = 0;
+    EtpRundownStopping = FALSE;
     EtpRundownActive = TRUE;
     EtpRundownEtwMonitorThreadHandle = PhCreateThread(0, EtpRundownEtwMonitorThreadStart, NULL);
 
@@ -483,6 +717,39 @@ ULONG EtpStopEtwRundownSession(
     return ControlTrace(0, EtpRundownLoggerName.Buffer, EtpRundownTraceProperties, EVENT_TRACE_CONTROL_STOP);
 }
 
+/**
+ * Stops the rundown session once no more rundown events are arriving. This should be called
+ * periodically.
+ */
+VOID EtUpdateEtwRundown(
+    VOID
+    )
+{
+    ULONG eventCount;
+
+    if (!EtpRundownActive || EtpRundownStopping)
+        return;
+
+    eventCount = EtpRundownEventCount;
+
+    if (eventCount != EtpRundownLastEventCount)
+    {
+        EtpRundownLastEventCount = eventCount;
+        EtpRundownIdleCount = 0;
+        return;
+    }
+
+    EtpRundownIdleCount++;
+
+    // The rundown is delivered in a single burst shortly after the session starts. Give the
+    // session more time if we haven't received anything yet.
+    if ((eventCount != 0 && EtpRundownIdleCount >= 2) || EtpRundownIdleCount >= 10)
+    {
+        EtpRundownStopping = TRUE;
+        EtpStopEtwRundownSession();
+    }
+}
+
 ULONG NTAPI EtpRundownEtwBufferCallback(
     _In_ PEVENT_TRACE_LOGFILE Buffer
     )
@@ -494,9 +761,6 @@ VOID NTAPI EtpRundownEtwEventCallback(
     _In_ PEVENT_RECORD EventRecord
     )
 {
-    // TODO: Find a way to call CloseTrace when the enumeration finishes so we can
-    // stop the trace cleanly.
-
     if (memcmp(&EventRecord->EventHeader.ProviderId, &FileIoGuid_I, sizeof(GUID)) == 0)
     {
         // FileIo
@@ -523,6 +787,7 @@ VOID NTAPI EtpRundownEtwEventCallback(
             PhInitializeStringRef(&fileEvent.FileName, data->FileName);
 
             EtDiskProcessFileEvent(&fileEvent);
+            EtpRundownEventCount++;
         }
     }
 }
@@ -553,6 +818,7 @@ NTSTATUS EtpRundownEtwMonitorThreadStart(
 
     NtClose(EtpRundownEtwMonitorThreadHandle);
     EtpRundownEtwMonitorThreadHandle = NULL;
+    EtpRundownActive = FALSE;
 
     return STATUS_SUCCESS;
 }
@@ -22,6 +22,35 @@ typedef struct
     WCHAR FileName[1];
 } FileIo_Name;
 
+typedef struct
+{
+    ULONG_PTR UniqueProcessKey;
+    ULONG ProcessId;
+    ULONG ParentId;
+    ULONG SessionId;
+    LONG ExitStatus;
+    ULONG_PTR DirectoryTableBase;
+    // ULONG Flags; // since WIN8 (version 4)
+    // SID UserSID; // preceded by TOKEN_USER unless empty
+    // CHAR ImageFileName[];
+    // WCHAR CommandLine[];
+} Process_TypeGroup1;
+
+typedef struct
+{
+    ULONG ProcessId;
+    ULONG TThreadId;
+    // ...
+} Thread_TypeGroup1;
+
+typedef struct
+{
+    ULONG_PTR ImageBase;
+    ULONG_PTR ImageSize;
+    ULONG ProcessId;
+    // ...
+} Image_Load;
+
 typedef struct
 {
     ULONG PID;
@@ -68,6 +97,10 @@ ULONG EtStartEtwRundown(
     VOID
     );
 
+VOID EtUpdateEtwRundown(
+    VOID
+    );
+
 // etwstat
 
 typedef enum _ET_ETW_EVENT_TYPE
@@ -123,6 +156,25 @@ HANDLE EtThreadIdToProcessId(
     _In_ HANDLE ThreadId
     );
 
+VOID EtAddThreadProcessEntry(
+    _In_ HANDLE ThreadId,
+    _In_ HANDLE ProcessId
+    );
+
+typedef struct _ET_THREAD_IO_COUNTERS
+{
+    ULONG DiskReadCount;
+    ULONG DiskWriteCount;
+    ULONG64 DiskReadRaw;
+    ULONG64 DiskWriteRaw;
+} ET_THREAD_IO_COUNTERS, *PET_THREAD_IO_COUNTERS;
+
+BOOLEAN EtQueryThreadIoCounters(
+    _In_ HANDLE ProcessId,
+    _In_ HANDLE ThreadId,
+    _Out_ PET_THREAD_IO_COUNTERS Counters
+    );
+
 // etwdisk
 
 VOID EtDiskProcessDiskEvent(
@@ -23,6 +23,78 @@
 #include "exttools.h"
 #include "etwmon.h"
 
+// Disk and network events are counted by the ETW consumer thread in private tables keyed by
+// process and connection, and the tables are handed to the provider thread once per update. This
+// keeps locks and lookups in the process and network providers out of the event path.
+
+#define ET_DISK_COUNTER_TABLE_SIZE 1024 // must be a power of two
+#define ET_DISK_COUNTER_TABLE_LIMIT (ET_DISK_COUNTER_TABLE_SIZE / 4 * 3)
+
+typedef struct _ET_DISK_COUNTER
+{
+    BOOLEAN InUse;
+    HANDLE ProcessId;
+
+    ULONG ReadCount;
+    ULONG WriteCount;
+    ULONG64 ReadRaw;
+    ULONG64 WriteRaw;
+} ET_DISK_COUNTER, *PET_DISK_COUNTER;
+
+typedef struct _ET_DISK_COUNTER_TABLE
+{
+    ULONG Count;
+    ULONG Dropped; // events that did not fit in the table
+    ET_DISK_COUNTER Counters[ET_DISK_COUNTER_TABLE_SIZE];
+} ET_DISK_COUNTER_TABLE, *PET_DISK_COUNTER_TABLE;
+
+#define ET_NETWORK_COUNTER_TABLE_SIZE 4096 // must be a power of two
+#define ET_NETWORK_COUNTER_TABLE_LIMIT (ET_NETWORK_COUNTER_TABLE_SIZE / 4 * 3)
+
+typedef struct _ET_NETWORK_COUNTER
+{
+    ULONG ProtocolType; // 0 if the entry is free
+    PH_IP_ENDPOINT LocalEndpoint;
+    PH_IP_ENDPOINT RemoteEndpoint;
+    HANDLE ProcessId;
+
+    ULONG ReceiveCount;
+    ULONG SendCount;
+    ULONG64 ReceiveRaw;
+    ULONG64 SendRaw;
+} ET_NETWORK_COUNTER, *PET_NETWORK_COUNTER;
+
+typedef struct _ET_NETWORK_COUNTER_TABLE
+{
+    ULONG Count;
+    ULONG Dropped; // events that did not fit in the table
+    ET_NETWORK_COUNTER Counters[ET_NETWORK_COUNTER_TABLE_SIZE];
+} ET_NETWORK_COUNTER_TABLE, *PET_NETWORK_COUNTER_TABLE;
+
+typedef struct _ET_STAGING_TABLES
+{
+    PVOID Tables[2];
+    // The table that the consumer thread adds events to.
+    PVOID volatile Active;
+    // The table that the consumer thread is currently writing to, or NULL.
+    PVOID volatile Consumer;
+} ET_STAGING_TABLES, *PET_STAGING_TABLES;
+
+#define ET_THREAD_MAP_PAGE_ENTRIES 1024
+#define ET_THREAD_MAP_DIRECTORY_SIZE 4096 // covers thread IDs below 16M
+
+typedef struct _ET_THREAD_MAP_ENTRY
+{
+    // Written by the consumer thread and the snapshot reconciliation.
+    ULONG ProcessId;
+    // The remaining fields are only written by the consumer thread.
+    ULONG CounterProcessId; // process that the counters belong to
+    ULONG DiskReadCount;
+    ULONG DiskWriteCount;
+    ULONG64 DiskReadRaw;
+    ULONG64 DiskWriteRaw;
+} ET_THREAD_MAP_ENTRY, *PET_THREAD_MAP_ENTRY;
+
 VOID NTAPI ProcessesUpdatedCallback(
     _In_opt_ PVOID Parameter,
     _In_opt_ PVOID Context
@@ -67,8 +139,91 @@ PH_CIRCULAR_BUFFER_ULONG EtNetworkSendHistory;
 PH_CIRCULAR_BUFFER_ULONG EtMaxDiskHistory; // ID of max. disk usage process
 PH_CIRCULAR_BUFFER_ULONG EtMaxNetworkHistory; // ID of max. network usage process
 
-PVOID EtpProcessInformation;
-PH_QUEUED_LOCK EtpProcessInformationLock = PH_QUEUED_LOCK_INIT;
+ULONG EtDiskEventsDropped;
+ULONG EtNetworkEventsDropped;
+
+// Thread map, indexed by thread ID. Each page of the directory is allocated when the first
+// thread in it is seen. Pages are never freed because the consumer thread may still be
+// running when the plugin is unloaded.
+static PET_THREAD_MAP_ENTRY volatile EtpThreadMapDirectory[ET_THREAD_MAP_DIRECTORY_SIZE];
+
+static ET_STAGING_TABLES EtpDiskCounterTables;
+static ET_STAGING_TABLES EtpNetworkCounterTables;
+
+static VOID EtpInitializeStagingTables(
+    _Out_ PET_STAGING_TABLES StagingTables,
+    _In_ SIZE_T Size
+    )
+{
+    StagingTables->Tables[0] = PhAllocate(Size);
+    memset(StagingTables->Tables[0], 0, Size);
+    StagingTables->Tables[1] = PhAllocate(Size);
+    memset(StagingTables->Tables[1], 0, Size);
+    StagingTables->Consumer = NULL;
+    _InterlockedExchangePointer(&StagingTables->Active, StagingTables->Tables[0]);
+}
+
+/**
+ * Claims the active staging table for the consumer thread.
+ *
+ * \return The active table, or NULL if the tables have not been initialized. The caller must
+ * call EtpReleaseStagingTable when it has finished with the table.
+ */
+static PVOID EtpAcquireStagingTable(
+    _Inout_ PET_STAGING_TABLES StagingTables
+    )
+{
+    PVOID table;
+
+    // The provider thread swaps the active table and then waits until we are no longer using the
+    // old one, so we have to check that the table we claimed is still active after we have
+    // published it.
+    do
+    {
+        table = StagingTables->Active;
+
+        if (!table)
+            return NULL;
+
+        _InterlockedExchangePointer(&StagingTables->Consumer, table);
+    } while (table != StagingTables->Active);
+
+    return table;
+}
+
+static VOID EtpReleaseStagingTable(
+    _Inout_ PET_STAGING_TABLES StagingTables
+    )
+{
+    _InterlockedExchangePointer(&StagingTables->Consumer, NULL);
+}
+
+/**
+ * Switches the consumer thread to the other staging table.
+ *
+ * \return The previously active table, which the caller now owns until the next swap.
+ */
+static PVOID EtpSwapStagingTables(
+    _Inout_ PET_STAGING_TABLES StagingTables
+    )
+{
+    PVOID table;
+
+    if (!(table = StagingTables->Active))
+        return NULL;
+
+    _InterlockedExchangePointer(
+        &StagingTables->Active,
+        table == StagingTables->Tables[0] ? StagingTables->Tables[1] : StagingTables->Tables[0]
+        );
+
+    // Wait for the consumer thread to finish with the old table. It only holds the table for the
+    // duration of a single event.
+    while (StagingTables->Consumer == table)
+        YieldProcessor();
+
+    return table;
+}
 
 VOID EtEtwStatisticsInitialization(
     VOID
@@ -88,6 +243,9 @@ VOID EtEtwStatisticsInitialization(
         PhInitializeCircularBuffer_ULONG(&EtMaxDiskHistory, sampleCount);
         PhInitializeCircularBuffer_ULONG(&EtMaxNetworkHistory, sampleCount);
 
+        EtpInitializeStagingTables(&EtpDiskCounterTables, sizeof(ET_DISK_COUNTER_TABLE));
+        EtpInitializeStagingTables(&EtpNetworkCounterTables, sizeof(ET_NETWORK_COUNTER_TABLE));
+
         PhRegisterCallback(
             &PhProcessesUpdatedEvent,
             ProcessesUpdatedCallback,
@@ -110,12 +268,140 @@ VOID EtEtwStatisticsUninitialization(
     EtEtwMonitorUninitialization();
 }
 
+/**
+ * Gets the entry for a thread in the thread map.
+ *
+ * \param ThreadId The ID of the thread.
+ * \param Create TRUE to allocate the page containing the entry if it does not exist.
+ *
+ * \return The entry, or NULL if it does not exist.
+ *
+ * \remarks This function does not acquire any locks. Pages are never freed, so the entry
+ * remains valid.
+ */
+static PET_THREAD_MAP_ENTRY EtpLookupThreadMapEntry(
+    _In_ HANDLE ThreadId,
+    _In_ BOOLEAN Create
+    )
+{
+    ULONG index;
+    PET_THREAD_MAP_ENTRY page;
+    PET_THREAD_MAP_ENTRY newPage;
+
+    // Thread IDs are multiples of 4.
+    index = HandleToUlong(ThreadId) / 4;
+
+    if (index >= ET_THREAD_MAP_DIRECTORY_SIZE * ET_THREAD_MAP_PAGE_ENTRIES)
+        return NULL;
+
+    page = EtpThreadMapDirectory[index / ET_THREAD_MAP_PAGE_ENTRIES];
+
+    if (!page)
+    {
+        if (!Create)
+            return NULL;
+
+        newPage = PhAllocate(ET_THREAD_MAP_PAGE_ENTRIES * sizeof(ET_THREAD_MAP_ENTRY));
+        memset(newPage, 0, ET_THREAD_MAP_PAGE_ENTRIES * sizeof(ET_THREAD_MAP_ENTRY));
+
+        // Another thread may have allocated the page at the same time.
+        if (page = _InterlockedCompareExchangePointer(
+            (PVOID volatile *)&EtpThreadMapDirectory[index / ET_THREAD_MAP_PAGE_ENTRIES],
+            newPage,
+            NULL
+            ))
+        {
+            PhFree(newPage);
+        }
+        else
+        {
+            page = newPage;
+        }
+    }
+
+    return &page[index % ET_THREAD_MAP_PAGE_ENTRIES];
+}
+
+/**
+ * Adds the disk I/O of an event to the counters of the thread which issued it.
+ *
+ * \remarks This function must only be called from the consumer thread.
+ */
+static VOID EtpAddThreadDiskEvent(
+    _In_ PET_ETW_DISK_EVENT Event
+    )
+{
+    PET_THREAD_MAP_ENTRY entry;
+    ULONG processId;
+
+    if (!(entry = EtpLookupThreadMapEntry(Event->ClientId.UniqueThread, TRUE)))
+        return;
+
+    processId = HandleToUlong(Event->ClientId.UniqueProcess);
+
+    // The thread ID was reused by a thread in another process.
+    if (entry->CounterProcessId != processId)
+    {
+        entry->DiskReadCount = 0;
+        entry->DiskWriteCount = 0;
+        entry->DiskReadRaw = 0;
+        entry->DiskWriteRaw = 0;
+        entry->CounterProcessId = processId;
+    }
+
+    if (Event->Type == EtEtwDiskReadType)
+    {
+        entry->DiskReadRaw += Event->TransferSize;
+        entry->DiskReadCount++;
+    }
+    else
+    {
+        entry->DiskWriteRaw += Event->TransferSize;
+        entry->DiskWriteCount++;
+    }
+}
+
+static PET_DISK_COUNTER EtpLookupDiskCounter(
+    _In_ PET_DISK_COUNTER_TABLE Table,
+    _In_ HANDLE ProcessId
+    )
+{
+    PET_DISK_COUNTER counter;
+    ULONG index;
+
+    index = HandleToUlong(ProcessId) / 4;
+
+    // Open addressing with linear probing.
+    while (TRUE)
+    {
+        index &= ET_DISK_COUNTER_TABLE_SIZE - 1;
+        counter = &Table->Counters[index];
+
+        if (!counter->InUse)
+        {
+            if (Table->Count >= ET_DISK_COUNTER_TABLE_LIMIT)
+                return NULL;
+
+            counter->InUse = TRUE;
+            counter->ProcessId = ProcessId;
+            Table->Count++;
+
+            return counter;
+        }
+
+        if (counter->ProcessId == ProcessId)
+            return counter;
+
+        index++;
+    }
+}
+
 VOID EtProcessDiskEvent(
     _In_ PET_ETW_DISK_EVENT Event
     )
 {
-    PPH_PROCESS_ITEM processItem;
-    PET_PROCESS_BLOCK block;
+    PET_DISK_COUNTER_TABLE table;
+    PET_DISK_COUNTER counter;
 
     if (Event->Type == EtEtwDiskReadType)
     {
@@ -128,22 +414,74 @@ VOID EtProcessDiskEvent(
         EtDiskWriteCount++;
     }
 
-    if (processItem = PhReferenceProcessItem(Event->ClientId.UniqueProcess))
-    {
-        block = EtGetProcessBlock(processItem);
+    EtpAddThreadDiskEvent(Event);
+
+    if (!(table = EtpAcquireStagingTable(&EtpDiskCounterTables)))
+        return;
 
+    if (counter = EtpLookupDiskCounter(table, Event->ClientId.UniqueProcess))
+    {
         if (Event->Type == EtEtwDiskReadType)
         {
-            block->DiskReadRaw += Event->TransferSize;
-            block->DiskReadCount++;
+            counter->ReadRaw += Event->TransferSize;
+            counter->ReadCount++;
         }
         else
         {
-            block->DiskWriteRaw += Event->TransferSize;
-            block->DiskWriteCount++;
+            counter->WriteRaw += Event->TransferSize;
+            counter->WriteCount++;
+        }
+    }
+    else
+    {
+        table->Dropped++;
+    }
+
+    EtpReleaseStagingTable(&EtpDiskCounterTables);
+}
+
+static PET_NETWORK_COUNTER EtpLookupNetworkCounter(
+    _In_ PET_NETWORK_COUNTER_TABLE Table,
+    _In_ PET_ETW_NETWORK_EVENT Event
+    )
+{
+    PET_NETWORK_COUNTER counter;
+    ULONG index;
+
+    index = PhHashIpEndpoint(&Event->LocalEndpoint) ^ (PhHashIpEndpoint(&Event->RemoteEndpoint) * 31) ^
+        Event->ProtocolType ^ (HandleToUlong(Event->ClientId.UniqueProcess) / 4);
+
+    // Open addressing with linear probing.
+    while (TRUE)
+    {
+        index &= ET_NETWORK_COUNTER_TABLE_SIZE - 1;
+        counter = &Table->Counters[index];
+
+        if (counter->ProtocolType == 0)
+        {
+            if (Table->Count >= ET_NETWORK_COUNTER_TABLE_LIMIT)
+                return NULL;
+
+            counter->ProtocolType = Event->ProtocolType;
+            counter->LocalEndpoint = Event->LocalEndpoint;
+            counter->RemoteEndpoint = Event->RemoteEndpoint;
+            counter->ProcessId = Event->ClientId.UniqueProcess;
+            Table->Count++;
+
+            return counter;
         }
 
-        PhDereferenceObject(processItem);
+        if (
+            counter->ProtocolType == Event->ProtocolType &&
+            counter->ProcessId == Event->ClientId.UniqueProcess &&
+            PhEqualIpEndpoint(&counter->LocalEndpoint, &Event->LocalEndpoint) &&
+            PhEqualIpEndpoint(&counter->RemoteEndpoint, &Event->RemoteEndpoint)
+            )
+        {
+            return counter;
+        }
+
+        index++;
     }
 }
 
@@ -151,10 +489,8 @@ VOID EtProcessNetworkEvent(
     _In_ PET_ETW_NETWORK_EVENT Event
     )
 {
-    PPH_PROCESS_ITEM processItem;
-    PET_PROCESS_BLOCK block;
-    PPH_NETWORK_ITEM networkItem;
-    PET_NETWORK_BLOCK networkBlock;
+    PET_NETWORK_COUNTER_TABLE table;
+    PET_NETWORK_COUNTER counter;
 
     if (Event->Type == EtEtwNetworkReceiveType)
     {
@@ -167,49 +503,137 @@ VOID EtProcessNetworkEvent(
         EtNetworkSendCount++;
     }
 
-    // Note: there is always the possibility of us receiving the event too early,
-    // before the process item or network item is created. So events may be lost.
+    if (!(table = EtpAcquireStagingTable(&EtpNetworkCounterTables)))
+        return;
 
-    if (processItem = PhReferenceProcessItem(Event->ClientId.UniqueProcess))
+    if (counter = EtpLookupNetworkCounter(table, Event))
     {
-        block = EtGetProcessBlock(processItem);
-
         if (Event->Type == EtEtwNetworkReceiveType)
         {
-            block->NetworkReceiveRaw += Event->TransferSize;
-            block->NetworkReceiveCount++;
+            counter->ReceiveRaw += Event->TransferSize;
+            counter->ReceiveCount++;
         }
         else
         {
-            block->NetworkSendRaw += Event->TransferSize;
-            block->NetworkSendCount++;
+            counter->SendRaw += Event->TransferSize;
+            counter->SendCount++;
         }
+    }
+    else
+    {
+        table->Dropped++;
+    }
 
-        PhDereferenceObject(processItem);
+    EtpReleaseStagingTable(&EtpNetworkCounterTables);
+}
+
+static VOID EtpFlushDiskCounters(
+    VOID
+    )
+{
+    PET_DISK_COUNTER_TABLE table;
+    PET_DISK_COUNTER counter;
+    PPH_PROCESS_ITEM processItem;
+    PET_PROCESS_BLOCK block;
+    ULONG i;
+
+    if (!(table = EtpSwapStagingTables(&EtpDiskCounterTables)))
+        return;
+
+    for (i = 0; i < ET_DISK_COUNTER_TABLE_SIZE && table->Count != 0; i++)
+    {
+        counter = &table->Counters[i];
+
+        if (!counter->InUse)
+            continue;
+
+        if (processItem = PhReferenceProcessItem(counter->ProcessId))
+        {
+            block = EtGetProcessBlock(processItem);
+            block->DiskReadRaw += counter->ReadRaw;
+            block->DiskReadCount += counter->ReadCount;
+            block->DiskWriteRaw += counter->WriteRaw;
+            block->DiskWriteCount += counter->WriteCount;
+
+            PhDereferenceObject(processItem);
+        }
+
+        memset(counter, 0, sizeof(ET_DISK_COUNTER));
+        table->Count--;
     }
 
-    if (networkItem = PhReferenceNetworkItem(
-        Event->ProtocolType,
-        &Event->LocalEndpoint,
-        &Event->RemoteEndpoint,
-        Event->ClientId.UniqueProcess
-        ))
+    EtDiskEventsDropped += table->Dropped;
+    table->Dropped = 0;
+}
+
+static VOID EtpFlushNetworkCounters(
+    VOID
+    )
+{
+    PET_NETWORK_COUNTER_TABLE table;
+    PET_NETWORK_COUNTER counter;
+    PPH_PROCESS_ITEM processItem = NULL;
+    PET_PROCESS_BLOCK block = NULL;
+    PPH_NETWORK_ITEM networkItem;
+    PET_NETWORK_BLOCK networkBlock;
+    ULONG i;
+
+    if (!(table = EtpSwapStagingTables(&EtpNetworkCounterTables)))
+        return;
+
+    // Note: there is always the possibility of us receiving the event too early,
+    // before the process item or network item is created. So events may be lost.
+
+    for (i = 0; i < ET_NETWORK_COUNTER_TABLE_SIZE && table->Count != 0; i++)
     {
-        networkBlock = EtGetNetworkBlock(networkItem);
+        counter = &table->Counters[i];
 
-        if (Event->Type == EtEtwNetworkReceiveType)
+        if (counter->ProtocolType == 0)
+            continue;
+
+        // Connections are often grouped by process, so keep the last process item.
+        if (!processItem || processItem->ProcessId != counter->ProcessId)
         {
-            networkBlock->ReceiveRaw += Event->TransferSize;
-            networkBlock->ReceiveCount++;
+            if (processItem)
+                PhDereferenceObject(processItem);
+
+            if (processItem = PhReferenceProcessItem(counter->ProcessId))
+                block = EtGetProcessBlock(processItem);
         }
-        else
+
+        if (processItem)
         {
-            networkBlock->SendRaw += Event->TransferSize;
-            networkBlock->SendCount++;
+            block->NetworkReceiveRaw += counter->ReceiveRaw;
+            block->NetworkReceiveCount += counter->ReceiveCount;
+            block->NetworkSendRaw += counter->SendRaw;
+            block->NetworkSendCount += counter->SendCount;
         }
 
-        PhDereferenceObject(networkItem);
+        if (networkItem = PhReferenceNetworkItem(
+            counter->ProtocolType,
+            &counter->LocalEndpoint,
+            &counter->RemoteEndpoint,
+            counter->ProcessId
+            ))
+        {
+            networkBlock = EtGetNetworkBlock(networkItem);
+            networkBlock->ReceiveRaw += counter->ReceiveRaw;
+            networkBlock->ReceiveCount += counter->ReceiveCount;
+            networkBlock->SendRaw += counter->SendRaw;
+            networkBlock->SendCount += counter->SendCount;
+
+            PhDereferenceObject(networkItem);
+        }
+
+        memset(counter, 0, sizeof(ET_NETWORK_COUNTER));
+        table->Count--;
     }
+
+    if (processItem)
+        PhDereferenceObject(processItem);
+
+    EtNetworkEventsDropped += table->Dropped;
+    table->Dropped = 0;
 }
 
 static VOID NTAPI ProcessesUpdatedCallback(
@@ -234,6 +658,10 @@ static VOID NTAPI ProcessesUpdatedCallback(
     // ETW is extremely lazy when it comes to flushing buffers, so we must do it
     // manually.
     EtFlushEtwSession();
+    EtpFlushDiskCounters();
+    // Network counters are flushed here and not in the network items callback because the
+    // network provider is disabled while the Network tab is hidden.
+    EtpFlushNetworkCounters();
 
     // Update global statistics.
 
@@ -372,49 +800,106 @@ VOID EtpUpdateProcessInformation(
     VOID
     )
 {
-    PhAcquireQueuedLockExclusive(&EtpProcessInformationLock);
+    PVOID processes;
+    PSYSTEM_PROCESS_INFORMATION process;
+    PET_THREAD_MAP_ENTRY entry;
+    ULONG i;
 
-    if (EtpProcessInformation)
-    {
-        PhFree(EtpProcessInformation);
-        EtpProcessInformation = NULL;
-    }
+    if (!NT_SUCCESS(PhEnumProcesses(&processes)))
+        return;
 
-    PhEnumProcesses(&EtpProcessInformation);
+    // Thread events keep the map up to date, but they may be disabled or lost, so we reconcile
+    // the map with the snapshot. Entries of threads which have exited are left alone; they are
+    // overwritten when the ID is reused.
+
+    process = PH_FIRST_PROCESS(processes);
+
+    do
+    {
+        for (i = 0; i < process->NumberOfThreads; i++)
+        {
+            if (entry = EtpLookupThreadMapEntry(process->Threads[i].ClientId.UniqueThread, TRUE))
+                entry->ProcessId = HandleToUlong(process->UniqueProcessId);
+        }
+    } while (process = PH_NEXT_PROCESS(process));
 
-    PhReleaseQueuedLockExclusive(&EtpProcessInformationLock);
+    PhFree(processes);
 }
 
+/**
+ * Gets the ID of the process which owns a thread.
+ *
+ * \param ThreadId The ID of the thread.
+ *
+ * \return The ID of the process, or NULL if the thread is unknown.
+ *
+ * \remarks This function is called for every disk event, so it does not acquire any locks.
+ */
 HANDLE EtThreadIdToProcessId(
     _In_ HANDLE ThreadId
     )
 {
-    PSYSTEM_PROCESS_INFORMATION process;
-    ULONG i;
-    HANDLE processId;
+    PET_THREAD_MAP_ENTRY entry;
 
-    if (!EtpProcessInformation)
-        return NULL;
+    if (entry = EtpLookupThreadMapEntry(ThreadId, FALSE))
+        return UlongToHandle(entry->ProcessId);
 
-    PhAcquireQueuedLockShared(&EtpProcessInformationLock);
+    return NULL;
+}
 
-    process = PH_FIRST_PROCESS(EtpProcessInformation);
+/**
+ * Records a thread which was created after the last snapshot.
+ *
+ * \param ThreadId The ID of the thread.
+ * \param ProcessId The ID of the process which owns the thread.
+ *
+ * \remarks This function must only be called from the consumer thread.
+ */
+VOID EtAddThreadProcessEntry(
+    _In_ HANDLE ThreadId,
+    _In_ HANDLE ProcessId
+    )
+{
+    PET_THREAD_MAP_ENTRY entry;
 
-    do
-    {
-        for (i = 0; i < process->NumberOfThreads; i++)
-        {
-            if (process->Threads[i].ClientId.UniqueThread == ThreadId)
-            {
-                processId = process->UniqueProcessId;
-                PhReleaseQueuedLockShared(&EtpProcessInformationLock);
+    if (!(entry = EtpLookupThreadMapEntry(ThreadId, TRUE)))
+        return;
 
-                return processId;
-            }
-        }
-    } while (process = PH_NEXT_PROCESS(process));
+    // This is a new thread, even if the ID was used by another thread in the same process.
+    entry->CounterProcessId = 0;
+    entry->ProcessId = HandleToUlong(ProcessId);
+}
+
+/**
+ * Gets the disk I/O counters of a thread.
+ *
+ * \param ProcessId The ID of the process which owns the thread.
+ * \param ThreadId The ID of the thread.
+ * \param Counters A variable which receives the counters.
+ *
+ * \return TRUE if the thread has any counters, otherwise FALSE.
+ *
+ * \remarks The counters are read without synchronization, so they may be slightly
+ * inconsistent with each other.
+ */
+BOOLEAN EtQueryThreadIoCounters(
+    _In_ HANDLE ProcessId,
+    _In_ HANDLE ThreadId,
+    _Out_ PET_THREAD_IO_COUNTERS Counters
+    )
+{
+    PET_THREAD_MAP_ENTRY entry;
 
-    PhReleaseQueuedLockShared(&EtpProcessInformationLock);
+    if (!(entry = EtpLookupThreadMapEntry(ThreadId, FALSE)))
+        return FALSE;
+    if (entry->CounterProcessId != HandleToUlong(ProcessId))
+        return FALSE;
 
-    return NULL;
+    Counters->DiskReadCount = entry->DiskReadCount;
+    Counters->DiskWriteCount = entry->DiskWriteCount;
+    Counters->DiskReadRaw = entry->DiskReadRaw;
+    Counters->DiskWriteRaw = entry->DiskWriteRaw;
+
+    // Check again in case the entry was reset while we were reading it.
+    return entry->CounterProcessId == HandleToUlong(ProcessId);
 }
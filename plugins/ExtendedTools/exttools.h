@@ -11,10 +11,16 @@ extern HWND ProcessTreeNewHandle;
 extern HWND NetworkTreeNewHandle;
 
 #define PLUGIN_NAME L"ProcessHacker.ExtendedTools"
+#define SETTING_NAME_DISK_ITEM_LIMIT (PLUGIN_NAME L".DiskItemLimit")
 #define SETTING_NAME_DISK_TREE_LIST_COLUMNS (PLUGIN_NAME L".DiskTreeListColumns")
 #define SETTING_NAME_DISK_TREE_LIST_SORT (PLUGIN_NAME L".DiskTreeListSort")
 #define SETTING_NAME_ENABLE_ETW_MONITOR (PLUGIN_NAME L".EnableEtwMonitor")
 #define SETTING_NAME_ENABLE_GPU_MONITOR (PLUGIN_NAME L".EnableGpuMonitor")
+#define SETTING_NAME_ETW_BUFFER_SIZE (PLUGIN_NAME L".EtwBufferSize")
+#define SETTING_NAME_ETW_FLUSH_TIMER (PLUGIN_NAME L".EtwFlushTimer")
+#define SETTING_NAME_ETW_MAXIMUM_BUFFERS (PLUGIN_NAME L".EtwMaximumBuffers")
+#define SETTING_NAME_ETW_MINIMUM_BUFFERS (PLUGIN_NAME L".EtwMinimumBuffers")
+#define SETTING_NAME_ETW_PROCESS_EVENTS (PLUGIN_NAME L".EtwProcessEvents")
 #define SETTING_NAME_GPU_NODE_BITMAP (PLUGIN_NAME L".GpuNodeBitmap")
 #define SETTING_NAME_GPU_LAST_NODE_COUNT (PLUGIN_NAME L".GpuLastNodeCount")
 
@@ -56,8 +62,15 @@ typedef struct _ET_DISK_ITEM
     ULONG64 ReadAverage;
     ULONG64 WriteAverage;
 
-    ULONG64 ReadHistory[HISTORY_SIZE];
-    ULONG64 WriteHistory[HISTORY_SIZE];
+    // Most items only see I/O in the period in which they were created, so the history buffers
+    // are only allocated once an item sees I/O in a later period. Until then, the only non-zero
+    // values in the history are the first ones.
+    ULONG64 FirstReadDelta;
+    ULONG64 FirstWriteDelta;
+    PULONG64 ReadHistory; // HISTORY_SIZE entries
+    PULONG64 WriteHistory; // HISTORY_SIZE entries
+    ULONG64 ReadHistorySum;
+    ULONG64 WriteHistorySum;
     ULONG HistoryCount;
     ULONG HistoryPosition;
 } ET_DISK_ITEM, *PET_DISK_ITEM;
@@ -144,6 +157,15 @@ typedef struct _ET_DISK_NODE
 #define ETNETNC_TOTALRATE 14
 #define ETNETNC_MAXIMUM 14
 
+// Thread list columns
+
+#define ETTHTNC_DISKREADS 1
+#define ETTHTNC_DISKWRITES 2
+#define ETTHTNC_DISKREADBYTES 3
+#define ETTHTNC_DISKWRITEBYTES 4
+#define ETTHTNC_DISKTOTALBYTES 5
+#define ETTHTNC_MAXIMUM 5
+
 // Firewall status
 
 typedef enum _ET_FIREWALL_STATUS
@@ -186,6 +208,12 @@ typedef struct _ET_PROCESS_BLOCK
     FLOAT GpuNodeUsage;
     ULONG64 GpuDedicatedUsage;
     ULONG64 GpuSharedUsage;
+    PULONG64 GpuNodeRunningTime; // last running time of each node
+    ULONG GpuLastUpdateRunCount;
+    ULONG GpuIdleCount; // number of updates without GPU activity
+    ULONG GpuUpdateSkip; // number of updates to skip after each update
+    ULONG GpuUpdateCountdown;
+    ULONG GpuUpdatesSkipped;
 
     PH_UINT32_DELTA HardFaultsDelta;
 
@@ -226,6 +254,13 @@ typedef struct _ET_NETWORK_BLOCK
     BOOLEAN TextCacheValid[ETNETNC_MAXIMUM + 1];
 } ET_NETWORK_BLOCK, *PET_NETWORK_BLOCK;
 
+typedef struct _ET_THREAD_BLOCK
+{
+    PPH_THREAD_ITEM ThreadItem;
+
+    PPH_STRING TextCache[ETTHTNC_MAXIMUM + 1];
+} ET_THREAD_BLOCK, *PET_THREAD_BLOCK;
+
 // main
 
 PET_PROCESS_BLOCK EtGetProcessBlock(
@@ -236,6 +271,10 @@ PET_NETWORK_BLOCK EtGetNetworkBlock(
     _In_ PPH_NETWORK_ITEM NetworkItem
     );
 
+PET_THREAD_BLOCK EtGetThreadBlock(
+    _In_ PPH_THREAD_ITEM ThreadItem
+    );
+
 // utils
 
 VOID EtFormatRate(
@@ -247,6 +286,10 @@ VOID EtFormatRate(
 // etwmon
 
 extern BOOLEAN EtEtwEnabled;
+extern ULONG EtEtwEventsLost;
+extern ULONG EtEtwBuffersLost;
+extern ULONG EtEtwBuffersRead;
+extern ULONG64 EtEtwBytesRead;
 
 // etwstat
 
@@ -254,6 +297,8 @@ extern ULONG EtDiskReadCount;
 extern ULONG EtDiskWriteCount;
 extern ULONG EtNetworkReceiveCount;
 extern ULONG EtNetworkSendCount;
+extern ULONG EtDiskEventsDropped;
+extern ULONG EtNetworkEventsDropped;
 
 extern PH_UINT32_DELTA EtDiskReadDelta;
 extern PH_UINT32_DELTA EtDiskWriteDelta;
@@ -352,6 +397,7 @@ VOID EtSaveSettingsDiskTreeList(
 // gpumon
 
 extern BOOLEAN EtGpuEnabled;
+extern BOOLEAN EtGpuColumnsVisible;
 
 extern ULONG EtGpuTotalNodeCount;
 extern ULONG EtGpuTotalSegmentCount;
@@ -369,7 +415,6 @@ extern PH_CIRCULAR_BUFFER_ULONG EtMaxGpuNodeHistory; // ID of max. GPU usage pro
 extern PH_CIRCULAR_BUFFER_FLOAT EtMaxGpuNodeUsageHistory;
 
 extern PPH_UINT64_DELTA EtGpuNodesTotalRunningTimeDelta;
-extern PPH_CIRCULAR_BUFFER_FLOAT EtGpuNodesHistory;
 
 extern ULONG64 EtGpuDedicatedUsage;
 extern ULONG64 EtGpuSharedUsage;
@@ -417,6 +462,21 @@ PPH_STRING EtGetGpuAdapterDescription(
     _In_ ULONG Index
     );
 
+ULONG EtGetGpuNodeHistoryCount(
+    VOID
+    );
+
+FLOAT EtGetGpuNodeHistoryItem(
+    _In_ ULONG NodeIndex,
+    _In_ ULONG Index
+    );
+
+VOID EtCopyGpuNodeHistory(
+    _In_ ULONG NodeIndex,
+    _Out_writes_(Count) PFLOAT Destination,
+    _In_ ULONG Count
+    );
+
 VOID EtAllocateGpuNodeBitMap(
     _Out_ PRTL_BITMAP BitMap
     );
@@ -454,6 +514,14 @@ VOID EtNetworkTreeNewMessage(
     _In_ PVOID Parameter
     );
 
+VOID EtThreadTreeNewInitializing(
+    _In_ PVOID Parameter
+    );
+
+VOID EtThreadTreeNewMessage(
+    _In_ PVOID Parameter
+    );
+
 ET_FIREWALL_STATUS EtQueryFirewallStatus(
     _In_ PPH_NETWORK_ITEM NetworkItem
     );
@@ -50,12 +50,11 @@ BOOLEAN EtpGpuListSectionCallback(
             PhaFormatString(L"GPU    %.2f%%", EtGpuNodeUsage * 100));
         }
         break;
-    case MiListSectionSortProcessList:
+    case MiListSectionGetProcessCompareFunction:
         {
-            PPH_MINIINFO_LIST_SECTION_SORT_LIST sortList = Parameter1;
+            PPH_MINIINFO_LIST_SECTION_GET_COMPARE_FUNCTION getCompareFunction = Parameter1;
 
-            qsort(sortList->List->Items, sortList->List->Count,
-                sizeof(PPH_PROCESS_NODE), EtpGpuListSectionProcessCompareFunction);
+            getCompareFunction->CompareFunction = EtpGpuListSectionProcessCompareFunction;
         }
         return TRUE;
     case MiListSectionAssignSortData:
@@ -36,8 +36,15 @@ static _SetupDiEnumDeviceInterfaces SetupDiEnumDeviceInterfaces_I;
 static _SetupDiGetDeviceInterfaceDetailW SetupDiGetDeviceInterfaceDetailW_I;
 static _SetupDiGetDeviceRegistryPropertyW SetupDiGetDeviceRegistryPropertyW_I;
 
+// Number of updates without GPU activity before we start querying a process less often.
+#define ETP_GPU_ACTIVE_UPDATES 10
+// Maximum number of updates to skip for an idle process.
+#define ETP_GPU_MAXIMUM_UPDATE_SKIP 15
+
 BOOLEAN EtGpuEnabled;
+BOOLEAN EtGpuColumnsVisible; // set when GPU columns are displayed or sorted
 static PPH_LIST EtpGpuAdapterList;
+static PULONG EtpGpuNodeLastActiveRunCount; // last update in which each node was running
 static PH_CALLBACK_REGISTRATION ProcessesUpdatedCallbackRegistration;
 
 ULONG EtGpuTotalNodeCount;
@@ -60,7 +67,15 @@ PH_CIRCULAR_BUFFER_ULONG EtMaxGpuNodeHistory; // ID of max. GPU usage process
 PH_CIRCULAR_BUFFER_FLOAT EtMaxGpuNodeUsageHistory;
 
 PPH_UINT64_DELTA EtGpuNodesTotalRunningTimeDelta;
-PPH_CIRCULAR_BUFFER_FLOAT EtGpuNodesHistory;
+
+// Usage history for each node. All nodes are sampled together, so they share a single ring
+// position and count. The samples of each node are stored contiguously in one block as
+// fixed-point values, and the block is only allocated once some node has been used.
+#define ETP_GPU_NODE_USAGE_SCALE 65535
+static ULONG EtpGpuNodesHistorySize;
+static ULONG EtpGpuNodesHistoryCount;
+static ULONG EtpGpuNodesHistoryIndex;
+static PUSHORT EtpGpuNodesHistoryData;
 
 ULONG64 EtGpuDedicatedUsage;
 ULONG64 EtGpuSharedUsage;
@@ -126,12 +141,9 @@ VOID EtGpuMonitorInitialization(
 
         EtGpuNodesTotalRunningTimeDelta = PhAllocate(sizeof(PH_UINT64_DELTA) * EtGpuTotalNodeCount);
         memset(EtGpuNodesTotalRunningTimeDelta, 0, sizeof(PH_UINT64_DELTA) * EtGpuTotalNodeCount);
-        EtGpuNodesHistory = PhAllocate(sizeof(PH_CIRCULAR_BUFFER_FLOAT) * EtGpuTotalNodeCount);
-
-        for (i = 0; i < EtGpuTotalNodeCount; i++)
-        {
-            PhInitializeCircularBuffer_FLOAT(&EtGpuNodesHistory[i], sampleCount);
-        }
+        EtpGpuNodesHistorySize = sampleCount;
+        EtpGpuNodeLastActiveRunCount = PhAllocate(sizeof(ULONG) * EtGpuTotalNodeCount);
+        memset(EtpGpuNodeLastActiveRunCount, 0, sizeof(ULONG) * EtGpuTotalNodeCount);
 
         PhRegisterCallback(
             &PhProcessesUpdatedEvent,
@@ -478,7 +490,8 @@ static VOID EtpUpdateSegmentInformation(
 }
 
 static VOID EtpUpdateNodeInformation(
-    _In_opt_ PET_PROCESS_BLOCK Block
+    _In_opt_ PET_PROCESS_BLOCK Block,
+    _In_ ULONG RunId
     )
 {
     ULONG i;
@@ -487,12 +500,21 @@ static VOID EtpUpdateNodeInformation(
     D3DKMT_QUERYSTATISTICS queryStatistics;
     ULONG64 totalRunningTime;
     ULONG64 systemRunningTime;
+    BOOLEAN queryAllNodes;
 
     if (Block && !Block->ProcessItem->QueryHandle)
         return;
 
     totalRunningTime = 0;
     systemRunningTime = 0;
+    queryAllNodes = FALSE;
+
+    if (Block && !Block->GpuNodeRunningTime)
+    {
+        Block->GpuNodeRunningTime = PhAllocate(sizeof(ULONG64) * EtGpuTotalNodeCount);
+        memset(Block->GpuNodeRunningTime, 0, sizeof(ULONG64) * EtGpuTotalNodeCount);
+        queryAllNodes = TRUE;
+    }
 
     for (i = 0; i < EtpGpuAdapterList->Count; i++)
     {
@@ -503,6 +525,15 @@ static VOID EtpUpdateNodeInformation(
             if (Block && !RtlCheckBit(&EtGpuNodeBitMap, gpuAdapter->FirstNodeIndex + j))
                 continue;
 
+            // The global statistics are always updated before the per-process statistics, so if
+            // a node hasn't run since we last queried this process, the process can't have used
+            // it either. This avoids querying idle adapters for every process.
+            if (Block && !queryAllNodes && EtpGpuNodeLastActiveRunCount[gpuAdapter->FirstNodeIndex + j] <= Block->GpuLastUpdateRunCount)
+            {
+                totalRunningTime += Block->GpuNodeRunningTime[gpuAdapter->FirstNodeIndex + j];
+                continue;
+            }
+
             memset(&queryStatistics, 0, sizeof(D3DKMT_QUERYSTATISTICS));
 
             if (Block)
@@ -526,7 +557,7 @@ static VOID EtpUpdateNodeInformation(
             {
                 if (Block)
                 {
-                    totalRunningTime += queryStatistics.QueryResult.ProcessNodeInformation.RunningTime.QuadPart;
+                    Block->GpuNodeRunningTime[gpuAdapter->FirstNodeIndex + j] = queryStatistics.QueryResult.ProcessNodeInformation.RunningTime.QuadPart;
                 }
                 else
                 {
@@ -536,6 +567,9 @@ static VOID EtpUpdateNodeInformation(
 
                     PhUpdateDelta(&EtGpuNodesTotalRunningTimeDelta[nodeIndex], queryStatistics.QueryResult.NodeInformation.GlobalInformation.RunningTime.QuadPart);
 
+                    if (EtGpuNodesTotalRunningTimeDelta[nodeIndex].Delta != 0)
+                        EtpGpuNodeLastActiveRunCount[nodeIndex] = RunId;
+
                     if (RtlCheckBit(&EtGpuNodeBitMap, gpuAdapter->FirstNodeIndex + j))
                     {
                         totalRunningTime += queryStatistics.QueryResult.NodeInformation.GlobalInformation.RunningTime.QuadPart;
@@ -543,11 +577,20 @@ static VOID EtpUpdateNodeInformation(
                     }
                 }
             }
+            else if (!Block)
+            {
+                // We don't know whether the node was running, so make sure processes are queried.
+                EtpGpuNodeLastActiveRunCount[gpuAdapter->FirstNodeIndex + j] = RunId;
+            }
+
+            if (Block)
+                totalRunningTime += Block->GpuNodeRunningTime[gpuAdapter->FirstNodeIndex + j];
         }
     }
 
     if (Block)
     {
+        Block->GpuLastUpdateRunCount = RunId;
         PhUpdateDelta(&Block->GpuRunningTimeDelta, totalRunningTime);
     }
     else
@@ -561,6 +604,47 @@ static VOID EtpUpdateNodeInformation(
     }
 }
 
+static VOID EtpAddGpuNodesHistory(
+    _In_ DOUBLE ElapsedTime
+    )
+{
+    ULONG i;
+
+    if (EtpGpuNodesHistorySize == 0)
+        return;
+
+    EtpGpuNodesHistoryIndex = (EtpGpuNodesHistoryIndex + EtpGpuNodesHistorySize - 1) % EtpGpuNodesHistorySize;
+
+    if (EtpGpuNodesHistoryCount < EtpGpuNodesHistorySize)
+        EtpGpuNodesHistoryCount++;
+
+    for (i = 0; i < EtGpuTotalNodeCount; i++)
+    {
+        FLOAT usage;
+
+        if (ElapsedTime != 0)
+            usage = (FLOAT)(EtGpuNodesTotalRunningTimeDelta[i].Delta / ElapsedTime);
+        else
+            usage = 0;
+
+        if (usage > 1)
+            usage = 1;
+
+        if (!EtpGpuNodesHistoryData)
+        {
+            if (usage == 0)
+                continue;
+
+            // Every sample so far was zero.
+            EtpGpuNodesHistoryData = PhAllocate(sizeof(USHORT) * EtpGpuNodesHistorySize * EtGpuTotalNodeCount);
+            memset(EtpGpuNodesHistoryData, 0, sizeof(USHORT) * EtpGpuNodesHistorySize * EtGpuTotalNodeCount);
+        }
+
+        EtpGpuNodesHistoryData[i * EtpGpuNodesHistorySize + EtpGpuNodesHistoryIndex] =
+            (USHORT)(usage * ETP_GPU_NODE_USAGE_SCALE + 0.5f);
+    }
+}
+
 static VOID NTAPI ProcessesUpdatedCallback(
     _In_opt_ PVOID Parameter,
     _In_opt_ PVOID Context
@@ -569,15 +653,15 @@ static VOID NTAPI ProcessesUpdatedCallback(
     static ULONG runCount = 0; // MUST keep in sync with runCount in process provider
 
     DOUBLE elapsedTime; // total GPU node elapsed time in micro-seconds
-    ULONG i;
     PLIST_ENTRY listEntry;
     FLOAT maxNodeValue = 0;
     PET_PROCESS_BLOCK maxNodeBlock = NULL;
+    BOOLEAN columnsVisible;
 
     // Update global statistics.
 
     EtpUpdateSegmentInformation(NULL);
-    EtpUpdateNodeInformation(NULL);
+    EtpUpdateNodeInformation(NULL, runCount);
 
     elapsedTime = (DOUBLE)EtClockTotalRunningTimeDelta.Delta * 10000000 / EtClockTotalRunningTimeFrequency.QuadPart;
 
@@ -603,38 +687,88 @@ static VOID NTAPI ProcessesUpdatedCallback(
             EtGpuNodeBitMapBuffer = newBuffer;
             EtGpuNodeBitMapBitsSet = RtlNumberOfSetBits(&EtGpuNodeBitMap);
             EtSaveGpuMonitorSettings();
+
+            // The cached running times don't cover the newly selected nodes.
+            listEntry = EtProcessBlockListHead.Flink;
+
+            while (listEntry != &EtProcessBlockListHead)
+            {
+                PET_PROCESS_BLOCK block;
+
+                block = CONTAINING_RECORD(listEntry, ET_PROCESS_BLOCK, ListEntry);
+
+                if (block->GpuNodeRunningTime)
+                {
+                    PhFree(block->GpuNodeRunningTime);
+                    block->GpuNodeRunningTime = NULL;
+                }
+
+                listEntry = listEntry->Flink;
+            }
         }
     }
 
     // Update per-process statistics.
     // Note: no lock is needed because we only ever modify the list on this same thread.
 
+    // If the GPU columns were displayed since the last update, every process needs current
+    // values. Otherwise we only need to keep up with processes that are using the GPU.
+    columnsVisible = EtGpuColumnsVisible;
+    EtGpuColumnsVisible = FALSE;
+
     listEntry = EtProcessBlockListHead.Flink;
 
     while (listEntry != &EtProcessBlockListHead)
     {
         PET_PROCESS_BLOCK block;
+        ULONG64 dedicatedUsage;
+        ULONG64 sharedUsage;
 
         block = CONTAINING_RECORD(listEntry, ET_PROCESS_BLOCK, ListEntry);
+        listEntry = listEntry->Flink;
+
+        if (!columnsVisible && block->GpuUpdateCountdown != 0)
+        {
+            block->GpuUpdateCountdown--;
+            block->GpuUpdatesSkipped++;
+            continue;
+        }
+
+        dedicatedUsage = block->GpuDedicatedUsage;
+        sharedUsage = block->GpuSharedUsage;
 
         EtpUpdateSegmentInformation(block);
-        EtpUpdateNodeInformation(block);
+        EtpUpdateNodeInformation(block, runCount);
 
         if (elapsedTime != 0)
         {
-            block->GpuNodeUsage = (FLOAT)(block->GpuRunningTimeDelta.Delta / (elapsedTime * EtGpuNodeBitMapBitsSet));
+            // Spread the running time over the updates we skipped.
+            block->GpuNodeUsage = (FLOAT)(block->GpuRunningTimeDelta.Delta / (elapsedTime * EtGpuNodeBitMapBitsSet * (block->GpuUpdatesSkipped + 1)));
 
             if (block->GpuNodeUsage > 1)
                 block->GpuNodeUsage = 1;
         }
 
+        block->GpuUpdatesSkipped = 0;
+
+        if (block->GpuRunningTimeDelta.Delta != 0 || block->GpuDedicatedUsage != dedicatedUsage || block->GpuSharedUsage != sharedUsage)
+        {
+            block->GpuIdleCount = 0;
+            block->GpuUpdateSkip = 0;
+        }
+        else if (++block->GpuIdleCount >= ETP_GPU_ACTIVE_UPDATES)
+        {
+            // Back off exponentially while the process stays idle.
+            block->GpuUpdateSkip = min(block->GpuUpdateSkip * 2 + 1, ETP_GPU_MAXIMUM_UPDATE_SKIP);
+        }
+
+        block->GpuUpdateCountdown = block->GpuUpdateSkip;
+
         if (maxNodeValue < block->GpuNodeUsage)
         {
             maxNodeValue = block->GpuNodeUsage;
             maxNodeBlock = block;
         }
-
-        listEntry = listEntry->Flink;
     }
 
     // Update history buffers.
@@ -644,18 +778,7 @@ static VOID NTAPI ProcessesUpdatedCallback(
         PhAddItemCircularBuffer_FLOAT(&EtGpuNodeHistory, EtGpuNodeUsage);
         PhAddItemCircularBuffer_ULONG(&EtGpuDedicatedHistory, (ULONG)(EtGpuDedicatedUsage / PAGE_SIZE));
         PhAddItemCircularBuffer_ULONG(&EtGpuSharedHistory, (ULONG)(EtGpuSharedUsage / PAGE_SIZE));
-
-        for (i = 0; i < EtGpuTotalNodeCount; i++)
-        {
-            FLOAT usage;
-
-            usage = (FLOAT)(EtGpuNodesTotalRunningTimeDelta[i].Delta / elapsedTime);
-
-            if (usage > 1)
-                usage = 1;
-
-            PhAddItemCircularBuffer_FLOAT(&EtGpuNodesHistory[i], usage);
-        }
+        EtpAddGpuNodesHistory(elapsedTime);
 
         if (maxNodeBlock)
         {
@@ -709,6 +832,66 @@ ULONG EtGetGpuAdapterIndexFromNodeIndex(
     return -1;
 }
 
+ULONG EtGetGpuNodeHistoryCount(
+    VOID
+    )
+{
+    return EtpGpuNodesHistoryCount;
+}
+
+/**
+ * Gets a sample from the usage history of a GPU node.
+ *
+ * \param NodeIndex The index of the node.
+ * \param Index The index of the sample, where 0 is the most recent sample.
+ *
+ * \return The usage of the node, from 0 to 1.
+ */
+FLOAT EtGetGpuNodeHistoryItem(
+    _In_ ULONG NodeIndex,
+    _In_ ULONG Index
+    )
+{
+    if (!EtpGpuNodesHistoryData || NodeIndex >= EtGpuTotalNodeCount || Index >= EtpGpuNodesHistoryCount)
+        return 0;
+
+    return (FLOAT)EtpGpuNodesHistoryData[NodeIndex * EtpGpuNodesHistorySize +
+        (EtpGpuNodesHistoryIndex + Index) % EtpGpuNodesHistorySize] / ETP_GPU_NODE_USAGE_SCALE;
+}
+
+/**
+ * Copies the usage history of a GPU node, starting from the most recent sample.
+ *
+ * \param NodeIndex The index of the node.
+ * \param Destination The buffer which receives the samples.
+ * \param Count The number of samples to copy. Entries after the available samples are zeroed.
+ */
+VOID EtCopyGpuNodeHistory(
+    _In_ ULONG NodeIndex,
+    _Out_writes_(Count) PFLOAT Destination,
+    _In_ ULONG Count
+    )
+{
+    PUSHORT data;
+    ULONG i;
+    ULONG available;
+
+    if (!EtpGpuNodesHistoryData || NodeIndex >= EtGpuTotalNodeCount)
+    {
+        memset(Destination, 0, sizeof(FLOAT) * Count);
+        return;
+    }
+
+    data = &EtpGpuNodesHistoryData[NodeIndex * EtpGpuNodesHistorySize];
+    available = min(Count, EtpGpuNodesHistoryCount);
+
+    for (i = 0; i < available; i++)
+        Destination[i] = (FLOAT)data[(EtpGpuNodesHistoryIndex + i) % EtpGpuNodesHistorySize] / ETP_GPU_NODE_USAGE_SCALE;
+
+    for (; i < Count; i++)
+        Destination[i] = 0;
+}
+
 PPH_STRING EtGetGpuAdapterDescription(
     _In_ ULONG Index
     )
@@ -342,12 +342,12 @@ INT_PTR CALLBACK EtpGpuNodesDlgProc(
                             PhGraphStateGetDrawInfo(
                                 &GraphState[i],
                                 getDrawInfo,
-                                EtGpuNodesHistory[i].Count
+                                EtGetGpuNodeHistoryCount()
                                 );
 
                             if (!GraphState[i].Valid)
                             {
-                                PhCopyCircularBuffer_FLOAT(&EtGpuNodesHistory[i], GraphState[i].Data1, drawInfo->LineDataCount);
+                                EtCopyGpuNodeHistory(i, GraphState[i].Data1, drawInfo->LineDataCount);
                                 GraphState[i].Valid = TRUE;
                             }
 
@@ -372,7 +372,7 @@ INT_PTR CALLBACK EtpGpuNodesDlgProc(
                                     ULONG adapterIndex;
                                     PPH_STRING adapterDescription;
 
-                                    gpu = PhGetItemCircularBuffer_FLOAT(&EtGpuNodesHistory[i], getTooltipText->Index);
+                                    gpu = EtGetGpuNodeHistoryItem(i, getTooltipText->Index);
                                     adapterIndex = EtGetGpuAdapterIndexFromNodeIndex(i);
 
                                     if (adapterIndex != -1)
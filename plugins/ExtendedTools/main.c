@@ -88,6 +88,11 @@ VOID NTAPI NetworkTreeNewInitializingCallback(
     _In_opt_ PVOID Context
     );
 
+VOID NTAPI ThreadTreeNewInitializingCallback(
+    _In_opt_ PVOID Parameter,
+    _In_opt_ PVOID Context
+    );
+
 VOID NTAPI SystemInformationInitializingCallback(
     _In_opt_ PVOID Parameter,
     _In_opt_ PVOID Context
@@ -108,6 +113,11 @@ VOID NTAPI NetworkItemsUpdatedCallback(
     _In_opt_ PVOID Context
     );
 
+VOID NTAPI DiagnosticsSamplingCallback(
+    _In_opt_ PVOID Parameter,
+    _In_opt_ PVOID Context
+    );
+
 VOID NTAPI ProcessItemCreateCallback(
     _In_ PVOID Object,
     _In_ PH_EM_OBJECT_TYPE ObjectType,
@@ -132,6 +142,18 @@ VOID NTAPI NetworkItemDeleteCallback(
     _In_ PVOID Extension
     );
 
+VOID NTAPI ThreadItemCreateCallback(
+    _In_ PVOID Object,
+    _In_ PH_EM_OBJECT_TYPE ObjectType,
+    _In_ PVOID Extension
+    );
+
+VOID NTAPI ThreadItemDeleteCallback(
+    _In_ PVOID Object,
+    _In_ PH_EM_OBJECT_TYPE ObjectType,
+    _In_ PVOID Extension
+    );
+
 PPH_PLUGIN PluginInstance;
 LIST_ENTRY EtProcessBlockListHead;
 LIST_ENTRY EtNetworkBlockListHead;
@@ -150,10 +172,12 @@ PH_CALLBACK_REGISTRATION ThreadMenuInitializingCallbackRegistration;
 PH_CALLBACK_REGISTRATION ModuleMenuInitializingCallbackRegistration;
 PH_CALLBACK_REGISTRATION ProcessTreeNewInitializingCallbackRegistration;
 PH_CALLBACK_REGISTRATION NetworkTreeNewInitializingCallbackRegistration;
+PH_CALLBACK_REGISTRATION ThreadTreeNewInitializingCallbackRegistration;
 PH_CALLBACK_REGISTRATION SystemInformationInitializingCallbackRegistration;
 PH_CALLBACK_REGISTRATION MiniInformationInitializingCallbackRegistration;
 PH_CALLBACK_REGISTRATION ProcessesUpdatedCallbackRegistration;
 PH_CALLBACK_REGISTRATION NetworkItemsUpdatedCallbackRegistration;
+PH_CALLBACK_REGISTRATION DiagnosticsSamplingCallbackRegistration;
 
 static HANDLE ModuleProcessId;
 
@@ -259,6 +283,12 @@ LOGICAL DllMain(
                 NULL,
                 &NetworkTreeNewInitializingCallbackRegistration
                 );
+            PhRegisterCallback(
+                PhGetGeneralCallback(GeneralCallbackThreadTreeNewInitializing),
+                ThreadTreeNewInitializingCallback,
+                NULL,
+                &ThreadTreeNewInitializingCallbackRegistration
+                );
             PhRegisterCallback(
                 PhGetGeneralCallback(GeneralCallbackSystemInformationInitializing),
                 SystemInformationInitializingCallback,
@@ -271,6 +301,12 @@ LOGICAL DllMain(
                 NULL,
                 &MiniInformationInitializingCallbackRegistration
                 );
+            PhRegisterCallback(
+                PhGetGeneralCallback(GeneralCallbackDiagnosticsSampling),
+                DiagnosticsSamplingCallback,
+                NULL,
+                &DiagnosticsSamplingCallbackRegistration
+                );
 
             PhRegisterCallback(
                 &PhProcessesUpdatedEvent,
@@ -302,14 +338,27 @@ LOGICAL DllMain(
                 NetworkItemCreateCallback,
                 NetworkItemDeleteCallback
                 );
+            PhPluginSetObjectExtension(
+                PluginInstance,
+                EmThreadItemType,
+                sizeof(ET_THREAD_BLOCK),
+                ThreadItemCreateCallback,
+                ThreadItemDeleteCallback
+                );
 
             {
                 static PH_SETTING_CREATE settings[] =
                 {
+                    { IntegerSettingType, SETTING_NAME_DISK_ITEM_LIMIT, L"1000" }, // 4096
                     { StringSettingType, SETTING_NAME_DISK_TREE_LIST_COLUMNS, L"" },
                     { IntegerPairSettingType, SETTING_NAME_DISK_TREE_LIST_SORT, L"4,2" }, // 4, DescendingSortOrder
                     { IntegerSettingType, SETTING_NAME_ENABLE_ETW_MONITOR, L"1" },
                     { IntegerSettingType, SETTING_NAME_ENABLE_GPU_MONITOR, L"1" },
+                    { IntegerSettingType, SETTING_NAME_ETW_BUFFER_SIZE, L"0" }, // KB, 0 for the system default
+                    { IntegerSettingType, SETTING_NAME_ETW_FLUSH_TIMER, L"1" }, // seconds
+                    { IntegerSettingType, SETTING_NAME_ETW_MAXIMUM_BUFFERS, L"0" }, // 0 to grow as needed
+                    { IntegerSettingType, SETTING_NAME_ETW_MINIMUM_BUFFERS, L"0" }, // 0 for two per processor
+                    { IntegerSettingType, SETTING_NAME_ETW_PROCESS_EVENTS, L"1" },
                     { StringSettingType, SETTING_NAME_GPU_NODE_BITMAP, L"01000000" },
                     { IntegerSettingType, SETTING_NAME_GPU_LAST_NODE_COUNT, L"0" }
                 };
@@ -398,6 +447,8 @@ VOID NTAPI TreeNewMessageCallback(
         EtProcessTreeNewMessage(Parameter);
     else if (message->TreeNewHandle == NetworkTreeNewHandle)
         EtNetworkTreeNewMessage(Parameter);
+    else if (message->Context) // only our thread columns have a context
+        EtThreadTreeNewMessage(Parameter);
 }
 
 VOID NTAPI MainWindowShowingCallback(
@@ -545,6 +596,14 @@ VOID NTAPI NetworkTreeNewInitializingCallback(
     EtNetworkTreeNewInitializing(Parameter);
 }
 
+VOID NTAPI ThreadTreeNewInitializingCallback(
+    _In_opt_ PVOID Parameter,
+    _In_opt_ PVOID Context
+    )
+{
+    EtThreadTreeNewInitializing(Parameter);
+}
+
 VOID NTAPI SystemInformationInitializingCallback(
     _In_opt_ PVOID Parameter,
     _In_opt_ PVOID Context
@@ -623,6 +682,22 @@ static VOID NTAPI NetworkItemsUpdatedCallback(
     }
 }
 
+static VOID NTAPI DiagnosticsSamplingCallback(
+    _In_opt_ PVOID Parameter,
+    _In_opt_ PVOID Context
+    )
+{
+    PPH_PLUGIN_DIAGNOSTICS_SAMPLE sample = Parameter;
+
+    if (!EtEtwEnabled)
+        return;
+
+    // The loss counters are updated whenever the session is flushed.
+    sample->AddCounter(L"etw.events_lost", EtEtwEventsLost, TRUE);
+    sample->AddCounter(L"etw.buffers_lost", EtEtwBuffersLost, TRUE);
+    sample->AddCounter(L"etw.buffers_read", EtEtwBuffersRead, TRUE);
+}
+
 PET_PROCESS_BLOCK EtGetProcessBlock(
     _In_ PPH_PROCESS_ITEM ProcessItem
     )
@@ -637,6 +712,13 @@ PET_NETWORK_BLOCK EtGetNetworkBlock(
     return PhPluginGetObjectExtension(PluginInstance, NetworkItem, EmNetworkItemType);
 }
 
+PET_THREAD_BLOCK EtGetThreadBlock(
+    _In_ PPH_THREAD_ITEM ThreadItem
+    )
+{
+    return PhPluginGetObjectExtension(PluginInstance, ThreadItem, EmThreadItemType);
+}
+
 VOID EtInitializeProcessBlock(
     _Out_ PET_PROCESS_BLOCK Block,
     _In_ PPH_PROCESS_ITEM ProcessItem
@@ -661,6 +743,9 @@ VOID EtDeleteProcessBlock(
         PhClearReference(&Block->TextCache[i]);
     }
 
+    if (Block->GpuNodeRunningTime)
+        PhFree(Block->GpuNodeRunningTime);
+
     RemoveEntryList(&Block->ListEntry);
 }
 
@@ -724,3 +809,30 @@ VOID NTAPI NetworkItemDeleteCallback(
 {
     EtDeleteNetworkBlock(Extension);
 }
+
+VOID NTAPI ThreadItemCreateCallback(
+    _In_ PVOID Object,
+    _In_ PH_EM_OBJECT_TYPE ObjectType,
+    _In_ PVOID Extension
+    )
+{
+    PET_THREAD_BLOCK block = Extension;
+
+    memset(block, 0, sizeof(ET_THREAD_BLOCK));
+    block->ThreadItem = Object;
+}
+
+VOID NTAPI ThreadItemDeleteCallback(
+    _In_ PVOID Object,
+    _In_ PH_EM_OBJECT_TYPE ObjectType,
+    _In_ PVOID Extension
+    )
+{
+    PET_THREAD_BLOCK block = Extension;
+    ULONG i;
+
+    for (i = 1; i <= ETTHTNC_MAXIMUM; i++)
+    {
+        PhClearReference(&block->TextCache[i]);
+    }
+}
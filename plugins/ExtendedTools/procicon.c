@@ -61,7 +61,7 @@ PET_PROCESS_ICON EtProcIconReferenceSmallProcessIcon(
 
     smallProcessIcon = Block->SmallProcessIcon;
 
-    if (!smallProcessIcon && PhTestEvent(&Block->ProcessItem->Stage1Event))
+    if (!smallProcessIcon && (Block->ProcessItem->Stage1Flags & PH_PROCESS_STAGE1_IMAGE))
     {
         smallProcessIcon = EtProcIconCreateProcessIcon(Block->ProcessItem->SmallIcon);
 
@@ -21,6 +21,7 @@
  */
 
 #include "exttools.h"
+#include "etwmon.h"
 #define CINTERFACE
 #define COBJMACROS
 #include <netfw.h>
@@ -39,6 +40,13 @@ LONG EtpNetworkTreeNewSortFunction(
     _In_ PVOID Context
     );
 
+LONG EtpThreadTreeNewSortFunction(
+    _In_ PVOID Node1,
+    _In_ PVOID Node2,
+    _In_ ULONG SubId,
+    _In_ PVOID Context
+    );
+
 typedef struct _COLUMN_INFO
 {
     ULONG SubId;
@@ -170,6 +178,9 @@ VOID EtProcessTreeNewMessage(
         processNode = (PPH_PROCESS_NODE)getCellText->Node;
         block = EtGetProcessBlock(processNode->ProcessItem);
 
+        if (message->SubId == ETPRTNC_GPU || message->SubId == ETPRTNC_GPUDEDICATEDBYTES || message->SubId == ETPRTNC_GPUSHAREDBYTES)
+            EtGpuColumnsVisible = TRUE;
+
         PhAcquireQueuedLockExclusive(&block->TextCacheLock);
 
         if (block->TextCacheValid[message->SubId])
@@ -338,6 +349,10 @@ VOID EtProcessTreeNewMessage(
             block->TextCacheValid[message->SubId] = TRUE;
         }
 
+        // The text is only replaced when we are asked for it again, so the tree can cache it until
+        // the next update.
+        getCellText->Flags = TN_CACHE;
+
         PhReleaseQueuedLockExclusive(&block->TextCacheLock);
     }
     else if (message->Message == TreeNewSortChanged)
@@ -444,12 +459,15 @@ LONG EtpProcessTreeNewSortFunction(
         result = uintcmp(block1->ProcessItem->PeakNumberOfThreads, block2->ProcessItem->PeakNumberOfThreads);
         break;
     case ETPRTNC_GPU:
+        EtGpuColumnsVisible = TRUE;
         result = singlecmp(block1->GpuNodeUsage, block2->GpuNodeUsage);
         break;
     case ETPRTNC_GPUDEDICATEDBYTES:
+        EtGpuColumnsVisible = TRUE;
         result = uint64cmp(block1->GpuDedicatedUsage, block2->GpuDedicatedUsage);
         break;
     case ETPRTNC_GPUSHAREDBYTES:
+        EtGpuColumnsVisible = TRUE;
         result = uint64cmp(block1->GpuSharedUsage, block2->GpuSharedUsage);
         break;
     case ETPRTNC_DISKREADRATE:
@@ -703,6 +721,141 @@ LONG EtpNetworkTreeNewSortFunction(
     return result;
 }
 
+VOID EtThreadTreeNewInitializing(
+    _In_ PVOID Parameter
+    )
+{
+    static COLUMN_INFO columns[] =
+    {
+        { ETTHTNC_DISKREADS, L"Disk Reads", 70, PH_ALIGN_RIGHT, DT_RIGHT, TRUE },
+        { ETTHTNC_DISKWRITES, L"Disk Writes", 70, PH_ALIGN_RIGHT, DT_RIGHT, TRUE },
+        { ETTHTNC_DISKREADBYTES, L"Disk Read Bytes", 70, PH_ALIGN_RIGHT, DT_RIGHT, TRUE },
+        { ETTHTNC_DISKWRITEBYTES, L"Disk Write Bytes", 70, PH_ALIGN_RIGHT, DT_RIGHT, TRUE },
+        { ETTHTNC_DISKTOTALBYTES, L"Disk Total Bytes", 70, PH_ALIGN_RIGHT, DT_RIGHT, TRUE }
+    };
+
+    PPH_PLUGIN_TREENEW_INFORMATION treeNewInfo = Parameter;
+    PH_TREENEW_COLUMN column;
+    ULONG i;
+
+    // There can be many thread lists, so the threads context is used as the column context.
+    // This lets TreeNewMessageCallback identify our columns and gives us the process ID.
+    for (i = 0; i < sizeof(columns) / sizeof(COLUMN_INFO); i++)
+    {
+        memset(&column, 0, sizeof(PH_TREENEW_COLUMN));
+        column.SortDescending = columns[i].SortDescending;
+        column.Text = columns[i].Text;
+        column.Width = columns[i].Width;
+        column.Alignment = columns[i].Alignment;
+        column.TextFlags = columns[i].TextFlags;
+
+        PhPluginAddTreeNewColumn(
+            PluginInstance,
+            treeNewInfo->CmData,
+            &column,
+            columns[i].SubId,
+            treeNewInfo->SystemContext,
+            EtpThreadTreeNewSortFunction
+            );
+    }
+}
+
+static VOID EtpQueryThreadIoCounters(
+    _In_ PPH_THREADS_CONTEXT ThreadsContext,
+    _In_ PPH_THREAD_NODE ThreadNode,
+    _Out_ PET_THREAD_IO_COUNTERS Counters
+    )
+{
+    if (!EtQueryThreadIoCounters(ThreadsContext->Provider->ProcessId, ThreadNode->ThreadId, Counters))
+        memset(Counters, 0, sizeof(ET_THREAD_IO_COUNTERS));
+}
+
+VOID EtThreadTreeNewMessage(
+    _In_ PVOID Parameter
+    )
+{
+    PPH_PLUGIN_TREENEW_MESSAGE message = Parameter;
+
+    if (message->Message == TreeNewGetCellText)
+    {
+        PPH_TREENEW_GET_CELL_TEXT getCellText = message->Parameter1;
+        PPH_THREAD_NODE threadNode = (PPH_THREAD_NODE)getCellText->Node;
+        PET_THREAD_BLOCK block = EtGetThreadBlock(threadNode->ThreadItem);
+        ET_THREAD_IO_COUNTERS counters;
+        PPH_STRING text = NULL;
+
+        EtpQueryThreadIoCounters(message->Context, threadNode, &counters);
+
+        switch (message->SubId)
+        {
+        case ETTHTNC_DISKREADS:
+            if (counters.DiskReadCount != 0)
+                text = PhFormatUInt64(counters.DiskReadCount, TRUE);
+            break;
+        case ETTHTNC_DISKWRITES:
+            if (counters.DiskWriteCount != 0)
+                text = PhFormatUInt64(counters.DiskWriteCount, TRUE);
+            break;
+        case ETTHTNC_DISKREADBYTES:
+            if (counters.DiskReadRaw != 0)
+                text = PhFormatSize(counters.DiskReadRaw, -1);
+            break;
+        case ETTHTNC_DISKWRITEBYTES:
+            if (counters.DiskWriteRaw != 0)
+                text = PhFormatSize(counters.DiskWriteRaw, -1);
+            break;
+        case ETTHTNC_DISKTOTALBYTES:
+            if (counters.DiskReadRaw + counters.DiskWriteRaw != 0)
+                text = PhFormatSize(counters.DiskReadRaw + counters.DiskWriteRaw, -1);
+            break;
+        }
+
+        // The counters change with every event, so we don't cache the text between updates.
+        PhMoveReference(&block->TextCache[message->SubId], text);
+
+        if (text)
+            getCellText->Text = text->sr;
+    }
+}
+
+LONG EtpThreadTreeNewSortFunction(
+    _In_ PVOID Node1,
+    _In_ PVOID Node2,
+    _In_ ULONG SubId,
+    _In_ PVOID Context
+    )
+{
+    LONG result;
+    ET_THREAD_IO_COUNTERS counters1;
+    ET_THREAD_IO_COUNTERS counters2;
+
+    EtpQueryThreadIoCounters(Context, Node1, &counters1);
+    EtpQueryThreadIoCounters(Context, Node2, &counters2);
+
+    result = 0;
+
+    switch (SubId)
+    {
+    case ETTHTNC_DISKREADS:
+        result = uintcmp(counters1.DiskReadCount, counters2.DiskReadCount);
+        break;
+    case ETTHTNC_DISKWRITES:
+        result = uintcmp(counters1.DiskWriteCount, counters2.DiskWriteCount);
+        break;
+    case ETTHTNC_DISKREADBYTES:
+        result = uint64cmp(counters1.DiskReadRaw, counters2.DiskReadRaw);
+        break;
+    case ETTHTNC_DISKWRITEBYTES:
+        result = uint64cmp(counters1.DiskWriteRaw, counters2.DiskWriteRaw);
+        break;
+    case ETTHTNC_DISKTOTALBYTES:
+        result = uint64cmp(counters1.DiskReadRaw + counters1.DiskWriteRaw, counters2.DiskReadRaw + counters2.DiskWriteRaw);
+        break;
+    }
+
+    return result;
+}
+
 ET_FIREWALL_STATUS EtQueryFirewallStatus(
     _In_ PPH_NETWORK_ITEM NetworkItem
     )
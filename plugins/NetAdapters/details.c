@@ -441,7 +441,7 @@ static VOID NetAdapterUpdateDetails(
         {
             MIB_IF_ROW2 interfaceRow;
 
-            interfaceRow = QueryInterfaceRowVista(Context->AdapterEntry);
+            interfaceRow = QueryInterfaceRowVista(Context->AdapterEntry, TRUE);
 
             interfaceStats.ifInDiscards = interfaceRow.InDiscards;
             interfaceStats.ifInErrors = interfaceRow.InErrors;
@@ -22,6 +22,8 @@
 
 #include "main.h"
 
+static PPH_NETADAPTER_SYSINFO_CONTEXT NetAdapterFastSamplingContext = NULL;
+
 static VOID NTAPI ProcessesUpdatedHandler(
     _In_opt_ PVOID Parameter,
     _In_opt_ PVOID Context
@@ -59,7 +61,6 @@ static VOID NetAdapterUpdatePanel(
     if (Context->DeviceHandle)
     {
         NDIS_STATISTICS_INFO interfaceStats;
-        NDIS_LINK_STATE interfaceState;
 
         if (NT_SUCCESS(NetworkAdapterQueryStatistics(Context->DeviceHandle, &interfaceStats)))
         {
@@ -85,21 +86,39 @@ static VOID NetAdapterUpdatePanel(
             outOctets = NetworkAdapterQueryValue(Context->DeviceHandle, OID_GEN_BYTES_XMIT);
         }
 
-        if (NT_SUCCESS(NetworkAdapterQueryLinkState(Context->DeviceHandle, &interfaceState)))
-        {
-            mediaState = interfaceState.MediaConnectState;
-            linkSpeed = interfaceState.XmitLinkSpeed;
-        }
-        else
+        // The link state and speed rarely change, so we keep them until we get an interface
+        // change notification.
+        if (!Context->LinkStateValid || Context->LinkStateChangeCount != NetAdapterInterfaceChangeCount)
         {
-            NetworkAdapterQueryLinkSpeed(Context->DeviceHandle, &linkSpeed);
+            NDIS_LINK_STATE interfaceState;
+
+            Context->LinkStateChangeCount = NetAdapterInterfaceChangeCount;
+            Context->MediaState = MediaConnectStateUnknown;
+            Context->LinkSpeed = 0;
+
+            if (NT_SUCCESS(NetworkAdapterQueryLinkState(Context->DeviceHandle, &interfaceState)))
+            {
+                Context->MediaState = interfaceState.MediaConnectState;
+                Context->LinkSpeed = interfaceState.XmitLinkSpeed;
+            }
+            else
+            {
+                NetworkAdapterQueryLinkSpeed(Context->DeviceHandle, &Context->LinkSpeed);
+            }
+
+            // Without change notifications we have to query the link state every time.
+            Context->LinkStateValid = NetAdapterInterfaceChangeHandle != NULL;
         }
+
+        mediaState = Context->MediaState;
+        linkSpeed = Context->LinkSpeed;
     }
     else if (GetIfEntry2_I)
     {
         MIB_IF_ROW2 interfaceRow;
 
-        interfaceRow = QueryInterfaceRowVista(Context->AdapterEntry);
+        // In fast sampling mode we query only this adapter instead of the whole table.
+        interfaceRow = QueryInterfaceRowVista(Context->AdapterEntry, !Context->FastSampling);
 
         inOctets = interfaceRow.InOctets;
         outOctets = interfaceRow.OutOctets;
@@ -133,6 +152,36 @@ static VOID NetAdapterUpdatePanel(
     SetDlgItemText(Context->PanelWindowHandle, IDC_STAT_BTOTAL, PhaFormatSize(inOctets + outOctets, -1)->Buffer);
 }
 
+static VOID NetAdapterSetFastSampling(
+    _Inout_ PPH_NETADAPTER_SYSINFO_CONTEXT Context,
+    _In_ BOOLEAN Enable
+    )
+{
+    if (Enable)
+    {
+        // Only one adapter can be sampled quickly at a time.
+        if (NetAdapterFastSamplingContext && NetAdapterFastSamplingContext != Context)
+        {
+            if (NetAdapterFastSamplingContext->PanelWindowHandle)
+                Button_SetCheck(GetDlgItem(NetAdapterFastSamplingContext->PanelWindowHandle, IDC_FAST_SAMPLING), BST_UNCHECKED);
+
+            NetAdapterSetFastSampling(NetAdapterFastSamplingContext, FALSE);
+        }
+
+        Context->FastSampling = TRUE;
+        NetAdapterFastSamplingContext = Context;
+        SetTimer(Context->WindowHandle, NETADAPTER_FAST_SAMPLING_TIMER_ID, NETADAPTER_FAST_SAMPLING_INTERVAL, NULL);
+    }
+    else if (Context->FastSampling)
+    {
+        KillTimer(Context->WindowHandle, NETADAPTER_FAST_SAMPLING_TIMER_ID);
+        Context->FastSampling = FALSE;
+
+        if (NetAdapterFastSamplingContext == Context)
+            NetAdapterFastSamplingContext = NULL;
+    }
+}
+
 static INT_PTR CALLBACK NetAdapterPanelDialogProc(
     _In_ HWND hwndDlg,
     _In_ UINT uMsg,
@@ -170,6 +219,9 @@ static INT_PTR CALLBACK NetAdapterPanelDialogProc(
             case IDC_DETAILS:
                 ShowDetailsDialog(context);
                 break;
+            case IDC_FAST_SAMPLING:
+                NetAdapterSetFastSampling(context, Button_GetCheck(GetDlgItem(hwndDlg, IDC_FAST_SAMPLING)) == BST_CHECKED);
+                break;
             }
         }
         break;
@@ -199,6 +251,8 @@ static INT_PTR CALLBACK NetAdapterDialogProc(
 
         if (uMsg == WM_NCDESTROY)
         {
+            NetAdapterSetFastSampling(context, FALSE);
+
             PhDeleteLayoutManager(&context->LayoutManager);
 
             PhDeleteGraphState(&context->GraphState);
@@ -374,6 +428,12 @@ static INT_PTR CALLBACK NetAdapterDialogProc(
             NetAdapterUpdatePanel(context);
         }
         break;
+    case WM_TIMER:
+        {
+            if (wParam == NETADAPTER_FAST_SAMPLING_TIMER_ID)
+                NetAdapterUpdatePanel(context);
+        }
+        break;
     }
 
     return FALSE;
@@ -494,7 +554,7 @@ static BOOLEAN NetAdapterSectionCallback(
             {
                 MIB_IF_ROW2 interfaceRow;
 
-                interfaceRow = QueryInterfaceRowVista(context->AdapterEntry);
+                interfaceRow = QueryInterfaceRowVista(context->AdapterEntry, TRUE);
 
                 networkInOctets = interfaceRow.InOctets;
                 networkOutOctets = interfaceRow.OutOctets;
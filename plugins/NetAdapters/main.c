@@ -41,6 +41,9 @@ static VOID NTAPI LoadCallback(
         if (IphlpHandle = PhGetDllHandle(L"iphlpapi.dll"))
         {
             GetIfEntry2_I = PhGetProcedureAddress(IphlpHandle, "GetIfEntry2", 0);
+            GetIfTable2_I = PhGetProcedureAddress(IphlpHandle, "GetIfTable2", 0);
+            FreeMibTable_I = PhGetProcedureAddress(IphlpHandle, "FreeMibTable", 0);
+            NotifyInterfaceChange_I = PhGetProcedureAddress(IphlpHandle, "NotifyIpInterfaceChange", 0);
             GetInterfaceDescriptionFromGuid_I = PhGetProcedureAddress(IphlpHandle, "NhGetInterfaceDescriptionFromGuid", 0);
             NotifyIpInterfaceChange_I = PhGetProcedureAddress(IphlpHandle, "NotifyUnicastIpAddressChange", 0);
             CancelMibChangeNotify2_I = PhGetProcedureAddress(IphlpHandle, "CancelMibChangeNotify2", 0);
@@ -48,6 +51,8 @@ static VOID NTAPI LoadCallback(
         }
     }
 
+    NetAdapterInitializeChangeNotification();
+
     NetworkAdaptersList = PhCreateList(1);
 
     string = PhGetStringSetting(SETTING_NAME_INTERFACE_LIST);
@@ -60,7 +65,7 @@ static VOID NTAPI UnloadCallback(
     _In_opt_ PVOID Context
     )
 {
-    NOTHING;
+    NetAdapterDeleteChangeNotification();
 }
 
 static VOID NTAPI ShowOptionsCallback(
@@ -87,6 +87,13 @@ typedef struct _PH_NETADAPTER_SYSINFO_CONTEXT
 
     HANDLE DeviceHandle;
 
+    BOOLEAN LinkStateValid;
+    LONG LinkStateChangeCount;
+    NDIS_MEDIA_CONNECT_STATE MediaState;
+    ULONG64 LinkSpeed;
+
+    BOOLEAN FastSampling;
+
     PPH_SYSINFO_SECTION SysinfoSection;
     PH_GRAPH_STATE GraphState;
     PH_LAYOUT_MANAGER LayoutManager;
@@ -221,10 +228,23 @@ typedef NETIO_STATUS (WINAPI* _NotifyIpInterfaceChange)(
 #define BITS_IN_ONE_BYTE 8
 #define NDIS_UNIT_OF_MEASUREMENT 100
 
+// Counters for all adapters are read with a single GetIfTable2 call at most this often (ms).
+#define NETADAPTER_TABLE_MAXIMUM_AGE 500
+#define NETADAPTER_FAST_SAMPLING_INTERVAL 100
+#define NETADAPTER_FAST_SAMPLING_TIMER_ID 1
+
 typedef ULONG (WINAPI* _GetIfEntry2)(
     _Inout_ PMIB_IF_ROW2 Row
     );
 
+typedef ULONG (WINAPI* _GetIfTable2)(
+    _Out_ PMIB_IF_TABLE2 *Table
+    );
+
+typedef VOID (WINAPI* _FreeMibTable)(
+    _In_ PVOID Memory
+    );
+
 // dmex: rev
 typedef ULONG (WINAPI* _GetInterfaceDescriptionFromGuid)(
     _Inout_ PGUID InterfaceGuid,
@@ -236,11 +256,26 @@ typedef ULONG (WINAPI* _GetInterfaceDescriptionFromGuid)(
 
 extern PVOID IphlpHandle;
 extern _GetIfEntry2 GetIfEntry2_I;
+extern _GetIfTable2 GetIfTable2_I;
+extern _FreeMibTable FreeMibTable_I;
+extern _NotifyIpInterfaceChange NotifyInterfaceChange_I;
 extern _GetInterfaceDescriptionFromGuid GetInterfaceDescriptionFromGuid_I;
 extern _NotifyIpInterfaceChange NotifyIpInterfaceChange_I;
 extern _CancelMibChangeNotify2 CancelMibChangeNotify2_I;
 extern _ConvertLengthToIpv4Mask ConvertLengthToIpv4Mask_I;
 
+// Incremented whenever an interface changes. Used to invalidate cached link state and speed.
+extern volatile LONG NetAdapterInterfaceChangeCount;
+extern HANDLE NetAdapterInterfaceChangeHandle;
+
+VOID NetAdapterInitializeChangeNotification(
+    VOID
+    );
+
+VOID NetAdapterDeleteChangeNotification(
+    VOID
+    );
+
 BOOLEAN NetworkAdapterQuerySupported(
     _In_ HANDLE DeviceHandle
     );
@@ -281,7 +316,8 @@ ULONG64 NetworkAdapterQueryValue(
     );
 
 MIB_IF_ROW2 QueryInterfaceRowVista(
-    _In_ PPH_NETADAPTER_ENTRY AdapterEntry
+    _In_ PPH_NETADAPTER_ENTRY AdapterEntry,
+    _In_ BOOLEAN UseSnapshot
     );
 
 MIB_IFROW QueryInterfaceRowXP(
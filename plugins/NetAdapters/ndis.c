@@ -24,8 +24,20 @@
 
 PVOID IphlpHandle = NULL;
 _GetIfEntry2 GetIfEntry2_I = NULL;
+_GetIfTable2 GetIfTable2_I = NULL;
+_FreeMibTable FreeMibTable_I = NULL;
+_NotifyIpInterfaceChange NotifyInterfaceChange_I = NULL;
 _GetInterfaceDescriptionFromGuid GetInterfaceDescriptionFromGuid_I = NULL;
 
+volatile LONG NetAdapterInterfaceChangeCount = 0;
+HANDLE NetAdapterInterfaceChangeHandle = NULL;
+
+// A snapshot of every interface's counters, shared by all adapter sections so that each tick
+// only needs one GetIfTable2 call.
+static PMIB_IF_TABLE2 NetAdapterInterfaceTable = NULL;
+static ULONG64 NetAdapterInterfaceTableTime = 0;
+static PH_QUEUED_LOCK NetAdapterInterfaceTableLock = PH_QUEUED_LOCK_INIT;
+
 BOOLEAN NetworkAdapterQuerySupported(
     _In_ HANDLE DeviceHandle
     )
@@ -384,12 +396,109 @@ ULONG64 NetworkAdapterQueryValue(
     return 0;
 }
 
+static VOID NTAPI NetAdapterInterfaceChangeCallback(
+    _In_ PVOID CallerContext,
+    _In_opt_ PMIB_IPINTERFACE_ROW Row,
+    _In_ MIB_NOTIFICATION_TYPE NotificationType
+    )
+{
+    _InterlockedIncrement(&NetAdapterInterfaceChangeCount);
+}
+
+VOID NetAdapterInitializeChangeNotification(
+    VOID
+    )
+{
+    if (NotifyInterfaceChange_I)
+    {
+        if (NotifyInterfaceChange_I(
+            AF_UNSPEC,
+            NetAdapterInterfaceChangeCallback,
+            NULL,
+            FALSE,
+            &NetAdapterInterfaceChangeHandle
+            ) != NO_ERROR)
+        {
+            NetAdapterInterfaceChangeHandle = NULL;
+        }
+    }
+}
+
+VOID NetAdapterDeleteChangeNotification(
+    VOID
+    )
+{
+    if (NetAdapterInterfaceChangeHandle && CancelMibChangeNotify2_I)
+    {
+        CancelMibChangeNotify2_I(NetAdapterInterfaceChangeHandle);
+        NetAdapterInterfaceChangeHandle = NULL;
+    }
+
+    if (NetAdapterInterfaceTable)
+    {
+        FreeMibTable_I(NetAdapterInterfaceTable);
+        NetAdapterInterfaceTable = NULL;
+    }
+}
+
+static BOOLEAN NetAdapterQueryInterfaceTableRow(
+    _In_ PPH_NETADAPTER_ENTRY AdapterEntry,
+    _Out_ PMIB_IF_ROW2 InterfaceRow
+    )
+{
+    BOOLEAN found = FALSE;
+    ULONG64 tickCount;
+    ULONG i;
+
+    if (!GetIfTable2_I || !FreeMibTable_I)
+        return FALSE;
+
+    tickCount = NtGetTickCount64();
+
+    PhAcquireQueuedLockExclusive(&NetAdapterInterfaceTableLock);
+
+    if (!NetAdapterInterfaceTable || tickCount - NetAdapterInterfaceTableTime >= NETADAPTER_TABLE_MAXIMUM_AGE)
+    {
+        if (NetAdapterInterfaceTable)
+        {
+            FreeMibTable_I(NetAdapterInterfaceTable);
+            NetAdapterInterfaceTable = NULL;
+        }
+
+        if (GetIfTable2_I(&NetAdapterInterfaceTable) != NO_ERROR)
+            NetAdapterInterfaceTable = NULL;
+
+        NetAdapterInterfaceTableTime = tickCount;
+    }
+
+    if (NetAdapterInterfaceTable)
+    {
+        for (i = 0; i < NetAdapterInterfaceTable->NumEntries; i++)
+        {
+            if (NetAdapterInterfaceTable->Table[i].InterfaceLuid.Value == AdapterEntry->InterfaceLuid.Value)
+            {
+                *InterfaceRow = NetAdapterInterfaceTable->Table[i];
+                found = TRUE;
+                break;
+            }
+        }
+    }
+
+    PhReleaseQueuedLockExclusive(&NetAdapterInterfaceTableLock);
+
+    return found;
+}
+
 MIB_IF_ROW2 QueryInterfaceRowVista(
-    _In_ PPH_NETADAPTER_ENTRY AdapterEntry
+    _In_ PPH_NETADAPTER_ENTRY AdapterEntry,
+    _In_ BOOLEAN UseSnapshot
     )
 {
     MIB_IF_ROW2 interfaceRow;
 
+    if (UseSnapshot && NetAdapterQueryInterfaceTableRow(AdapterEntry, &interfaceRow))
+        return interfaceRow;
+
     memset(&interfaceRow, 0, sizeof(MIB_IF_ROW2));
 
     interfaceRow.InterfaceLuid = AdapterEntry->InterfaceLuid;
@@ -19,6 +19,7 @@
 #define IDC_DETAILS                     1010
 #define IDC_DETAILS_LIST                1011
 #define IDC_SHOW_HIDDEN_ADAPTERS        1012
+#define IDC_FAST_SAMPLING               1013
 
 // Next default values for new objects
 // 
@@ -26,7 +27,7 @@
 #ifndef APSTUDIO_READONLY_SYMBOLS
 #define _APS_NEXT_RESOURCE_VALUE        106
 #define _APS_NEXT_COMMAND_VALUE         40001
-#define _APS_NEXT_CONTROL_VALUE         1013
+#define _APS_NEXT_CONTROL_VALUE         1014
 #define _APS_NEXT_SYMED_VALUE           106
 #endif
 #endif
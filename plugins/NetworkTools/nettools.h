@@ -69,12 +69,12 @@ typedef enum _PH_NETWORK_ACTION
 #define NTM_RECEIVEDTRACE (WM_APP + NETWORK_ACTION_TRACEROUTE)
 #define NTM_RECEIVEDWHOIS (WM_APP + NETWORK_ACTION_WHOIS)
 #define NTM_RECEIVEDFINISH (WM_APP + NETWORK_ACTION_FINISH)
+#define NTM_RECEIVEDTEXT (WM_APP + 10) // lParam: PPH_STRING, dereferenced by the window
 
 typedef struct _NETWORK_OUTPUT_CONTEXT
 {
     PH_NETWORK_ACTION Action;
     PH_LAYOUT_MANAGER LayoutManager;
-    PH_WORK_QUEUE PingWorkQueue;
     PH_GRAPH_STATE PingGraphState;
     PH_CIRCULAR_BUFFER_ULONG PingHistory;
     PH_CALLBACK_REGISTRATION ProcessesUpdatedRegistration;
@@ -88,6 +88,9 @@ typedef struct _NETWORK_OUTPUT_CONTEXT
     HANDLE ProcessHandle;
     HFONT FontHandle;
     HICON IconHandle;
+    HANDLE IcmpHandle;
+    PPH_BYTES IcmpEchoBuffer;
+    ULONG PingPendingCount;
 
     ULONG CurrentPingMs;
     ULONG MaxPingTimeout;
@@ -277,6 +277,20 @@ static INT_PTR CALLBACK NetworkOutputDlgProc(
             }
         }
         break;
+    case NTM_RECEIVEDTEXT:
+        {
+            PPH_STRING text = (PPH_STRING)lParam;
+            INT length;
+
+            // Append the text to the end of the output.
+            length = GetWindowTextLength(context->OutputHandle);
+            SendMessage(context->OutputHandle, EM_SETSEL, length, length);
+            SendMessage(context->OutputHandle, EM_REPLACESEL, FALSE, (LPARAM)text->Buffer);
+            SendMessage(context->OutputHandle, WM_VSCROLL, SB_BOTTOM, 0);
+
+            PhDereferenceObject(text);
+        }
+        break;
     case NTM_RECEIVEDWHOIS:
         {
             OEM_STRING inputString;
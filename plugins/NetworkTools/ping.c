@@ -23,6 +23,15 @@
 #include "nettools.h"
 
 #define WM_PING_UPDATE (WM_APP + 151)
+#define WM_PING_SEND (WM_APP + 152)
+#define PING_MAXIMUM_PENDING 20
+
+typedef struct _NETWORK_PING_PROBE
+{
+    PNETWORK_OUTPUT_CONTEXT Context;
+    ULONG ReplyLength;
+    UCHAR ReplyBuffer[1];
+} NETWORK_PING_PROBE, *PNETWORK_PING_PROBE;
 
 static RECT NormalGraphTextMargin = { 5, 5, 5, 5 };
 static RECT NormalGraphTextPadding = { 3, 3, 3, 3 };
@@ -127,253 +136,203 @@ static PPH_BYTES PhFormatAnsiString(
     return PhFormatAnsiString_V(Format, argptr);
 }
 
-static NTSTATUS PhNetworkPingThreadStart(
-    _In_ PVOID Parameter
+static VOID PhNetworkPingCompleteProbe(
+    _In_ PNETWORK_PING_PROBE Probe,
+    _In_ BOOLEAN Sent
     )
 {
-    HANDLE icmpHandle = INVALID_HANDLE_VALUE;
+    PNETWORK_OUTPUT_CONTEXT context = Probe->Context;
     ULONG icmpCurrentPingMs = 0;
-    ULONG icmpCurrentPingTtl = 0;
     ULONG icmpReplyCount = 0;
-    ULONG icmpReplyLength = 0;
-    PVOID icmpReplyBuffer = NULL;
-    PPH_STRING phVersion = NULL;
-    PPH_BYTES icmpEchoBuffer = NULL;
-    IP_OPTION_INFORMATION pingOptions =
-    {
-        255,         // Time To Live
-        0,           // Type Of Service
-        IP_FLAG_DF,  // IP header flags
-        0            // Size of options data
-    };
-
-    PNETWORK_OUTPUT_CONTEXT context = (PNETWORK_OUTPUT_CONTEXT)Parameter;
 
-    __try
+    if (context->IpAddress.Type == PH_IPV6_NETWORK_TYPE)
     {
-        // Query PH version.
-        if ((phVersion = PhGetPhVersion()) == NULL)
-            __leave;
+        PICMPV6_ECHO_REPLY icmp6ReplyStruct = (PICMPV6_ECHO_REPLY)Probe->ReplyBuffer;
 
-        // Create ICMP echo buffer.
-        if ((icmpEchoBuffer = PhFormatAnsiString("processhacker_%S_0x0D06F00D_x1", phVersion->Buffer)) == NULL)
-            __leave;
+        if (Sent)
+            icmpReplyCount = Icmp6ParseReplies(Probe->ReplyBuffer, Probe->ReplyLength);
 
-        if (context->IpAddress.Type == PH_IPV6_NETWORK_TYPE)
+        if (icmpReplyCount > 0)
         {
-            SOCKADDR_IN6 icmp6LocalAddr = { 0 };
-            SOCKADDR_IN6 icmp6RemoteAddr = { 0 };
-            PICMPV6_ECHO_REPLY icmp6ReplyStruct = NULL;
-
-            // Create ICMPv6 handle.
-            if ((icmpHandle = Icmp6CreateFile()) == INVALID_HANDLE_VALUE)
-                __leave;
+            if (icmp6ReplyStruct->Status != IP_SUCCESS)
+            {
+                InterlockedIncrement(&context->PingLossCount);
+            }
 
-            // Set Local IPv6-ANY address.
-            icmp6LocalAddr.sin6_addr = in6addr_any;
-            icmp6LocalAddr.sin6_family = AF_INET6;
+            if (_memicmp(
+                icmp6ReplyStruct->Address.sin6_addr,
+                context->IpAddress.In6Addr.u.Word,
+                sizeof(icmp6ReplyStruct->Address.sin6_addr)
+                ) != 0)
+            {
+                InterlockedIncrement(&context->UnknownAddrCount);
+            }
 
-            // Set Remote IPv6 address.
-            icmp6RemoteAddr.sin6_addr = context->IpAddress.In6Addr;
-            icmp6RemoteAddr.sin6_port = _byteswap_ushort((USHORT)context->NetworkItem->RemoteEndpoint.Port);
+            icmpCurrentPingMs = icmp6ReplyStruct->RoundTripTime;
+        }
+        else
+        {
+            InterlockedIncrement(&context->PingLossCount);
+        }
+    }
+    else
+    {
+        PICMP_ECHO_REPLY icmpReplyStruct = (PICMP_ECHO_REPLY)Probe->ReplyBuffer;
 
-            // Allocate ICMPv6 message.
-            icmpReplyLength = ICMP_BUFFER_SIZE(sizeof(ICMPV6_ECHO_REPLY), icmpEchoBuffer);
-            icmpReplyBuffer = PhAllocate(icmpReplyLength);
-            memset(icmpReplyBuffer, 0, icmpReplyLength);
+        if (Sent)
+            icmpReplyCount = IcmpParseReplies(Probe->ReplyBuffer, Probe->ReplyLength);
 
-            InterlockedIncrement(&context->PingSentCount);
+        if (icmpReplyCount > 0)
+        {
+            BOOLEAN icmpPacketSignature = FALSE;
 
-            // Send ICMPv6 ping...
-            icmpReplyCount = Icmp6SendEcho2(
-                icmpHandle,
-                NULL,
-                NULL,
-                NULL,
-                &icmp6LocalAddr,
-                &icmp6RemoteAddr,
-                icmpEchoBuffer->Buffer,
-                (USHORT)icmpEchoBuffer->Length,
-                &pingOptions,
-                icmpReplyBuffer,
-                icmpReplyLength,
-                context->MaxPingTimeout
-                );
+            if (icmpReplyStruct->Status != IP_SUCCESS)
+            {
+                InterlockedIncrement(&context->PingLossCount);
+            }
 
-            icmp6ReplyStruct = (PICMPV6_ECHO_REPLY)icmpReplyBuffer;
-            if (icmpReplyCount > 0 && icmp6ReplyStruct)
+            if (icmpReplyStruct->Address != context->IpAddress.InAddr.s_addr)
             {
-                BOOLEAN icmpPacketSignature = FALSE;
+                InterlockedIncrement(&context->UnknownAddrCount);
+            }
 
-                if (icmp6ReplyStruct->Status != IP_SUCCESS)
-                {
-                    InterlockedIncrement(&context->PingLossCount);
-                }
+            if (icmpReplyStruct->DataSize == context->IcmpEchoBuffer->Length)
+            {
+                icmpPacketSignature = (_memicmp(
+                    context->IcmpEchoBuffer->Buffer,
+                    icmpReplyStruct->Data,
+                    icmpReplyStruct->DataSize
+                    ) == 0);
+            }
 
-                if (_memicmp(
-                    icmp6ReplyStruct->Address.sin6_addr,
-                    context->IpAddress.In6Addr.u.Word,
-                    sizeof(icmp6ReplyStruct->Address.sin6_addr)
-                    ) != 0)
-                {
-                    InterlockedIncrement(&context->UnknownAddrCount);
-                }
+            icmpCurrentPingMs = icmpReplyStruct->RoundTripTime;
 
-                //if (icmp6ReplyStruct->DataSize == icmpEchoBuffer->MaximumLength)
-                //{
-                //    icmpPacketSignature = (_memicmp(
-                //        icmpEchoBuffer->Buffer,
-                //        icmp6ReplyStruct->Data,
-                //        icmp6ReplyStruct->DataSize
-                //        ) == 0);
-                //}
-
-                //if (icmpPacketSignature != TRUE)
-                //{
-                //    InterlockedIncrement(&context->HashFailCount);
-                //}
-
-                icmpCurrentPingMs = icmp6ReplyStruct->RoundTripTime;
-                //icmpCurrentPingTtl = icmp6ReplyStruct->Options.Ttl;
-            }
-            else
+            if (!icmpPacketSignature)
             {
-                InterlockedIncrement(&context->PingLossCount);
+                InterlockedIncrement(&context->HashFailCount);
             }
         }
         else
         {
-            IPAddr icmpLocalAddr = 0;
-            IPAddr icmpRemoteAddr = 0;
-            PICMP_ECHO_REPLY icmpReplyStruct = NULL;
-
-            // Create ICMPv4 handle.
-            if ((icmpHandle = IcmpCreateFile()) == INVALID_HANDLE_VALUE)
-                __leave;
-
-            // Set Local IPv4-ANY address.
-            icmpLocalAddr = in4addr_any.s_addr;
-
-            // Set Remote IPv4 address.
-            icmpRemoteAddr = context->IpAddress.InAddr.s_addr;
-
-            // Allocate ICMPv4 message.
-            icmpReplyLength = ICMP_BUFFER_SIZE(sizeof(ICMP_ECHO_REPLY), icmpEchoBuffer);
-            icmpReplyBuffer = PhAllocate(icmpReplyLength);
-            memset(icmpReplyBuffer, 0, icmpReplyLength);
-
-            InterlockedIncrement(&context->PingSentCount);
-
-            // Send ICMPv4 ping...
-            //if (WindowsVersion > WINDOWS_VISTA)
-            //{
-            //    // Vista SP1 and up we can specify the source address:
-            //    icmpReplyCount = IcmpSendEcho2Ex(
-            //        icmpHandle,
-            //        NULL,
-            //        NULL,
-            //        NULL,
-            //        icmpLocalAddr,
-            //        icmpRemoteAddr,
-            //        icmpEchoBuffer->Buffer,
-            //        icmpEchoBuffer->MaximumLength,
-            //        &pingOptions,
-            //        icmpReplyBuffer,
-            //        icmpReplyLength,
-            //        context->MaxPingTimeout
-            //        );
-            //}
-
-            icmpReplyCount = IcmpSendEcho2(
-                icmpHandle,
-                NULL,
-                NULL,
-                NULL,
-                icmpRemoteAddr,
-                icmpEchoBuffer->Buffer,
-                (USHORT)icmpEchoBuffer->Length,
-                &pingOptions,
-                icmpReplyBuffer,
-                icmpReplyLength,
-                context->MaxPingTimeout
-                );
+            InterlockedIncrement(&context->PingLossCount);
+        }
+    }
 
-            icmpReplyStruct = (PICMP_ECHO_REPLY)icmpReplyBuffer;
+    InterlockedIncrement(&context->PingRecvCount);
 
-            if (icmpReplyStruct && icmpReplyCount > 0)
-            {
-                BOOLEAN icmpPacketSignature = FALSE;
+    if (context->PingMinMs == 0 || icmpCurrentPingMs < context->PingMinMs)
+        context->PingMinMs = icmpCurrentPingMs;
+    if (icmpCurrentPingMs > context->PingMaxMs)
+        context->PingMaxMs = icmpCurrentPingMs;
 
-                if (icmpReplyStruct->Status != IP_SUCCESS)
-                {
-                    InterlockedIncrement(&context->PingLossCount);
-                }
+    context->CurrentPingMs = icmpCurrentPingMs;
 
-                if (icmpReplyStruct->Address != context->IpAddress.InAddr.s_addr)
-                {
-                    InterlockedIncrement(&context->UnknownAddrCount);
-                }
+    PhAddItemCircularBuffer_ULONG(&context->PingHistory, icmpCurrentPingMs);
 
-                if (icmpReplyStruct->DataSize == icmpEchoBuffer->Length)
-                {
-                    icmpPacketSignature = (_memicmp(
-                        icmpEchoBuffer->Buffer,
-                        icmpReplyStruct->Data,
-                        icmpReplyStruct->DataSize
-                        ) == 0);
-                }
+    context->PingPendingCount--;
+    PhFree(Probe);
 
-                icmpCurrentPingMs = icmpReplyStruct->RoundTripTime;
-                icmpCurrentPingTtl = icmpReplyStruct->Options.Ttl;
+    PostMessage(context->WindowHandle, WM_PING_UPDATE, 0, 0);
+}
 
-                if (!icmpPacketSignature)
-                {
-                    InterlockedIncrement(&context->HashFailCount);
-                }
-            }
-            else
-            {
-                InterlockedIncrement(&context->PingLossCount);
-            }
-        }
+static VOID NTAPI PhNetworkPingApcRoutine(
+    _In_ PVOID ApcContext,
+    _In_ PIO_STATUS_BLOCK IoStatusBlock,
+    _In_ ULONG Reserved
+    )
+{
+    PhNetworkPingCompleteProbe(ApcContext, TRUE);
+}
 
-        InterlockedIncrement(&context->PingRecvCount);
+/**
+ * Sends an asynchronous echo request. The reply is processed by an APC on the ping window's
+ * thread, so no thread has to block for the duration of the ping.
+ *
+ * \param Context The ping window context.
+ */
+static VOID PhNetworkPingSend(
+    _In_ PNETWORK_OUTPUT_CONTEXT Context
+    )
+{
+    PNETWORK_PING_PROBE probe;
+    ULONG replyLength;
+    ULONG result;
+    IP_OPTION_INFORMATION pingOptions =
+    {
+        255,         // Time To Live
+        0,           // Type Of Service
+        IP_FLAG_DF,  // IP header flags
+        0            // Size of options data
+    };
 
-        if (context->PingMinMs == 0 || icmpCurrentPingMs < context->PingMinMs)
-            context->PingMinMs = icmpCurrentPingMs;
-        if (icmpCurrentPingMs > context->PingMaxMs)
-            context->PingMaxMs = icmpCurrentPingMs;
+    if (Context->IcmpHandle == INVALID_HANDLE_VALUE || !Context->IcmpEchoBuffer)
+        return;
 
-        context->CurrentPingMs = icmpCurrentPingMs;
+    // Don't let requests to a slow link pile up.
+    if (Context->PingPendingCount >= PING_MAXIMUM_PENDING)
+        return;
 
-        PhAddItemCircularBuffer_ULONG(&context->PingHistory, icmpCurrentPingMs);
-    }
-    __finally
-    {
-        if (phVersion)
-        {
-            PhDereferenceObject(phVersion);
-        }
+    if (Context->IpAddress.Type == PH_IPV6_NETWORK_TYPE)
+        replyLength = ICMP_BUFFER_SIZE(sizeof(ICMPV6_ECHO_REPLY), Context->IcmpEchoBuffer);
+    else
+        replyLength = ICMP_BUFFER_SIZE(sizeof(ICMP_ECHO_REPLY), Context->IcmpEchoBuffer);
 
-        if (icmpEchoBuffer)
-        {
-            PhDereferenceObject(icmpEchoBuffer);
-        }
+    probe = PhAllocate(FIELD_OFFSET(NETWORK_PING_PROBE, ReplyBuffer) + replyLength);
+    memset(probe, 0, FIELD_OFFSET(NETWORK_PING_PROBE, ReplyBuffer) + replyLength);
+    probe->Context = Context;
+    probe->ReplyLength = replyLength;
 
-        if (icmpHandle != INVALID_HANDLE_VALUE)
-        {
-            IcmpCloseHandle(icmpHandle);
-        }
+    Context->PingPendingCount++;
+    InterlockedIncrement(&Context->PingSentCount);
 
-        if (icmpReplyBuffer)
-        {
-            PhFree(icmpReplyBuffer);
-        }
+    if (Context->IpAddress.Type == PH_IPV6_NETWORK_TYPE)
+    {
+        SOCKADDR_IN6 icmp6LocalAddr = { 0 };
+        SOCKADDR_IN6 icmp6RemoteAddr = { 0 };
+
+        // Set Local IPv6-ANY address.
+        icmp6LocalAddr.sin6_addr = in6addr_any;
+        icmp6LocalAddr.sin6_family = AF_INET6;
+
+        // Set Remote IPv6 address.
+        icmp6RemoteAddr.sin6_addr = Context->IpAddress.In6Addr;
+        icmp6RemoteAddr.sin6_port = _byteswap_ushort((USHORT)Context->NetworkItem->RemoteEndpoint.Port);
+
+        result = Icmp6SendEcho2(
+            Context->IcmpHandle,
+            NULL,
+            (FARPROC)PhNetworkPingApcRoutine,
+            probe,
+            &icmp6LocalAddr,
+            &icmp6RemoteAddr,
+            Context->IcmpEchoBuffer->Buffer,
+            (USHORT)Context->IcmpEchoBuffer->Length,
+            &pingOptions,
+            probe->ReplyBuffer,
+            probe->ReplyLength,
+            Context->MaxPingTimeout
+            );
+    }
+    else
+    {
+        result = IcmpSendEcho2(
+            Context->IcmpHandle,
+            NULL,
+            (FARPROC)PhNetworkPingApcRoutine,
+            probe,
+            Context->IpAddress.InAddr.s_addr,
+            Context->IcmpEchoBuffer->Buffer,
+            (USHORT)Context->IcmpEchoBuffer->Length,
+            &pingOptions,
+            probe->ReplyBuffer,
+            probe->ReplyLength,
+            Context->MaxPingTimeout
+            );
     }
 
-    PostMessage(context->WindowHandle, WM_PING_UPDATE, 0, 0);
-
-    return STATUS_SUCCESS;
+    // The request failed immediately, so no APC will be queued.
+    if (result == 0 && GetLastError() != ERROR_IO_PENDING)
+        PhNetworkPingCompleteProbe(probe, FALSE);
 }
 
 static VOID NTAPI NetworkPingUpdateHandler(
@@ -383,12 +342,8 @@ static VOID NTAPI NetworkPingUpdateHandler(
 {
     PNETWORK_OUTPUT_CONTEXT context = (PNETWORK_OUTPUT_CONTEXT)Context;
 
-    // Queue up the next ping into our work queue...
-    PhQueueItemWorkQueue(
-        &context->PingWorkQueue,
-        PhNetworkPingThreadStart,
-        (PVOID)context
-        );
+    // Send the next ping from the window's thread.
+    PostMessage(context->WindowHandle, WM_PING_SEND, 0, 0);
 }
 
 static INT_PTR CALLBACK NetworkPingWndProc(
@@ -419,6 +374,7 @@ static INT_PTR CALLBACK NetworkPingWndProc(
         {
             PH_RECTANGLE windowRectangle;
             PPH_LAYOUT_ITEM panelItem;
+            PPH_STRING phVersion;
 
             // We have already set the group boxes to have WS_EX_TRANSPARENT to fix
             // the drawing issue that arises when using WS_CLIPCHILDREN. However
@@ -466,8 +422,6 @@ static INT_PTR CALLBACK NetworkPingWndProc(
             if (context->IconHandle)
                 SendMessage(hwndDlg, WM_SETICON, ICON_SMALL, (LPARAM)context->IconHandle);
 
-            // Initialize the WorkQueue with a maximum of 20 threads (fix pinging slow-links with a high interval update).
-            PhInitializeWorkQueue(&context->PingWorkQueue, 0, 20, 5000);
             PhInitializeGraphState(&context->PingGraphState);
             PhInitializeLayoutManager(&context->LayoutManager, hwndDlg);
             PhInitializeCircularBuffer_ULONG(&context->PingHistory, PhGetIntegerSetting(L"SampleCount"));
@@ -505,6 +459,18 @@ static INT_PTR CALLBACK NetworkPingWndProc(
                 RtlIpv6AddressToString(&context->IpAddress.In6Addr, context->IpAddressString);
             }
 
+            // Create the ICMP handle and echo buffer that are used for every ping.
+            if (context->IpAddress.Type == PH_IPV6_NETWORK_TYPE)
+                context->IcmpHandle = Icmp6CreateFile();
+            else
+                context->IcmpHandle = IcmpCreateFile();
+
+            if (phVersion = PhGetPhVersion())
+            {
+                context->IcmpEchoBuffer = PhFormatAnsiString("processhacker_%S_0x0D06F00D_x1", phVersion->Buffer);
+                PhDereferenceObject(phVersion);
+            }
+
             SetWindowText(hwndDlg, PhaFormatString(L"Ping %s", context->IpAddressString)->Buffer);
             SetWindowText(context->StatusHandle, PhaFormatString(L"Pinging %s with 32 bytes of data:", context->IpAddressString)->Buffer);
 
@@ -549,12 +515,27 @@ static INT_PTR CALLBACK NetworkPingWndProc(
             if (context->FontHandle)
                 DeleteObject(context->FontHandle);
 
-            PhDeleteWorkQueue(&context->PingWorkQueue);
             PhDeleteGraphState(&context->PingGraphState);
             PhDeleteLayoutManager(&context->LayoutManager);
 
             RemoveProp(hwndDlg, L"Context");
-            PhFree(context);
+
+            // Wait for outstanding pings. Each one completes within the timeout.
+            while (context->PingPendingCount != 0)
+            {
+                if (SleepEx(context->MaxPingTimeout + 1000, TRUE) != WAIT_IO_COMPLETION)
+                    break;
+            }
+
+            if (context->IcmpHandle != INVALID_HANDLE_VALUE)
+                IcmpCloseHandle(context->IcmpHandle);
+
+            if (context->IcmpEchoBuffer)
+                PhDereferenceObject(context->IcmpEchoBuffer);
+
+            // If a request still hasn't completed, its reply buffer refers to the context.
+            if (context->PingPendingCount == 0)
+                PhFree(context);
         }
         break;
     case WM_SIZE:
@@ -583,18 +564,21 @@ static INT_PTR CALLBACK NetworkPingWndProc(
             return (INT_PTR)GetSysColorBrush(COLOR_WINDOW);
         }
         break;
+    case WM_PING_SEND:
+        {
+            PhNetworkPingSend(context);
+        }
+        break;
     case WM_PING_UPDATE:
         {
-            ULONG i = 0;
-            ULONG maxGraphHeight = 0;
             ULONG pingAvgValue = 0;
 
             PhNetworkPingUpdateGraph(context);
 
-            for (i = 0; i < context->PingHistory.Count; i++)
+            if (context->PingHistory.Count != 0)
             {
-                maxGraphHeight = maxGraphHeight + PhGetItemCircularBuffer_ULONG(&context->PingHistory, i);
-                pingAvgValue = maxGraphHeight / context->PingHistory.Count;
+                pingAvgValue = (ULONG)(PhSumCircularBuffer_ULONG(&context->PingHistory, 0, context->PingHistory.Count) /
+                    context->PingHistory.Count);
             }
 
             SetDlgItemText(hwndDlg, IDC_ICMP_AVG, PhaFormatString(
@@ -661,14 +645,9 @@ static INT_PTR CALLBACK NetworkPingWndProc(
                             FLOAT max = 0;
 
                             for (i = 0; i < drawInfo->LineDataCount; i++)
-                            {
-                                FLOAT data1;
+                                context->PingGraphState.Data1[i] = (FLOAT)PhGetItemCircularBuffer_ULONG(&context->PingHistory, i);
 
-                                context->PingGraphState.Data1[i] = data1 = (FLOAT)PhGetItemCircularBuffer_ULONG(&context->PingHistory, i);
-
-                                if (max < data1)
-                                    max = data1;
-                            }
+                            max = (FLOAT)PhMaximumCircularBuffer_ULONG(&context->PingHistory, 0, drawInfo->LineDataCount);
 
                             // Minimum scaling of timeout (1000ms default).
                             if (max < (FLOAT)context->MaxPingTimeout)
@@ -720,7 +699,6 @@ NTSTATUS PhNetworkPingDialogThreadStart(
     _In_ PVOID Parameter
     )
 {
-    BOOL result;
     MSG message;
     HWND windowHandle;
     PH_AUTO_POOL autoPool;
@@ -728,6 +706,8 @@ NTSTATUS PhNetworkPingDialogThreadStart(
 
     PhInitializeAutoPool(&autoPool);
 
+    context->IcmpHandle = INVALID_HANDLE_VALUE;
+
     windowHandle = CreateDialogParam(
         (HINSTANCE)PluginInstance->DllBase,
         MAKEINTRESOURCE(IDD_PINGDIALOG),
@@ -739,20 +719,28 @@ NTSTATUS PhNetworkPingDialogThreadStart(
     ShowWindow(windowHandle, SW_SHOW);
     SetForegroundWindow(windowHandle);
 
-    while (result = GetMessage(&message, NULL, 0, 0))
+    while (TRUE)
     {
-        if (result == -1)
-            break;
+        // Wait in an alertable state so that ping replies can be delivered to this thread.
+        if (MsgWaitForMultipleObjectsEx(0, NULL, INFINITE, QS_ALLINPUT, MWMO_ALERTABLE | MWMO_INPUTAVAILABLE) == WAIT_IO_COMPLETION)
+            continue;
 
-        if (!IsDialogMessage(windowHandle, &message))
+        while (PeekMessage(&message, NULL, 0, 0, PM_REMOVE))
         {
-            TranslateMessage(&message);
-            DispatchMessage(&message);
-        }
+            if (message.message == WM_QUIT)
+                goto ExitLoop;
 
-        PhDrainAutoPool(&autoPool);
+            if (!IsDialogMessage(windowHandle, &message))
+            {
+                TranslateMessage(&message);
+                DispatchMessage(&message);
+            }
+
+            PhDrainAutoPool(&autoPool);
+        }
     }
 
+ExitLoop:
     PhDeleteAutoPool(&autoPool);
     DestroyWindow(windowHandle);
 
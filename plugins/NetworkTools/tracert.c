@@ -22,6 +22,40 @@
 
 #include "nettools.h"
 
+#define TRACERT_MAXIMUM_HOPS 30
+#define TRACERT_PROBES_PER_HOP 4
+
+typedef struct _TRACERT_HOP
+{
+    ULONG Replies;
+    ULONG MinimumTime;
+    ULONG MaximumTime;
+    ULONG TotalTime;
+    BOOLEAN Destination;
+    BOOLEAN HaveAddress;
+    PH_IP_ADDRESS Address;
+} TRACERT_HOP, *PTRACERT_HOP;
+
+typedef struct _TRACERT_CONTEXT
+{
+    HWND WindowHandle;
+    PH_IP_ADDRESS IpAddress;
+    ULONG Timeout;
+    BOOLEAN ResolveNames;
+    ULONG PendingCount;
+    TRACERT_HOP Hops[TRACERT_MAXIMUM_HOPS];
+} TRACERT_CONTEXT, *PTRACERT_CONTEXT;
+
+typedef struct _TRACERT_PROBE
+{
+    PTRACERT_CONTEXT Context;
+    ULONG Hop;
+    ULONG ReplyLength;
+    UCHAR ReplyBuffer[1];
+} TRACERT_PROBE, *PTRACERT_PROBE;
+
+static CHAR TracertEchoData[32] = "processhacker_tracert";
+
 static NTSTATUS StdOutNetworkTracertThreadStart(
     _In_ PVOID Parameter
     )
@@ -56,6 +90,308 @@ static NTSTATUS StdOutNetworkTracertThreadStart(
     return STATUS_SUCCESS;
 }
 
+static VOID TracertCompleteProbe(
+    _In_ PTRACERT_PROBE Probe,
+    _In_ BOOLEAN Sent
+    )
+{
+    PTRACERT_CONTEXT context = Probe->Context;
+    PTRACERT_HOP hop = &context->Hops[Probe->Hop];
+    ULONG status = IP_REQ_TIMED_OUT;
+    ULONG roundTripTime = 0;
+    PH_IP_ADDRESS address;
+
+    memset(&address, 0, sizeof(PH_IP_ADDRESS));
+
+    if (context->IpAddress.Type == PH_IPV6_NETWORK_TYPE)
+    {
+        PICMPV6_ECHO_REPLY reply = (PICMPV6_ECHO_REPLY)Probe->ReplyBuffer;
+
+        if (Sent && Icmp6ParseReplies(Probe->ReplyBuffer, Probe->ReplyLength) > 0)
+        {
+            status = reply->Status;
+            roundTripTime = reply->RoundTripTime;
+            address.Type = PH_IPV6_NETWORK_TYPE;
+            memcpy(address.In6Addr.u.Word, reply->Address.sin6_addr, sizeof(reply->Address.sin6_addr));
+        }
+    }
+    else
+    {
+        PICMP_ECHO_REPLY reply = (PICMP_ECHO_REPLY)Probe->ReplyBuffer;
+
+        if (Sent && IcmpParseReplies(Probe->ReplyBuffer, Probe->ReplyLength) > 0)
+        {
+            status = reply->Status;
+            roundTripTime = reply->RoundTripTime;
+            address.Type = PH_IPV4_NETWORK_TYPE;
+            address.InAddr.s_addr = reply->Address;
+        }
+    }
+
+    if (status == IP_SUCCESS || status == IP_TTL_EXPIRED_TRANSIT)
+    {
+        if (hop->Replies == 0 || roundTripTime < hop->MinimumTime)
+            hop->MinimumTime = roundTripTime;
+        if (roundTripTime > hop->MaximumTime)
+            hop->MaximumTime = roundTripTime;
+
+        hop->Replies++;
+        hop->TotalTime += roundTripTime;
+
+        if (!hop->HaveAddress)
+        {
+            hop->Address = address;
+            hop->HaveAddress = TRUE;
+        }
+
+        if (status == IP_SUCCESS)
+            hop->Destination = TRUE;
+    }
+
+    context->PendingCount--;
+    PhFree(Probe);
+}
+
+static VOID NTAPI TracertApcRoutine(
+    _In_ PVOID ApcContext,
+    _In_ PIO_STATUS_BLOCK IoStatusBlock,
+    _In_ ULONG Reserved
+    )
+{
+    TracertCompleteProbe(ApcContext, TRUE);
+}
+
+static VOID TracertSendProbe(
+    _In_ PTRACERT_CONTEXT Context,
+    _In_ HANDLE IcmpHandle,
+    _In_ ULONG Hop
+    )
+{
+    PTRACERT_PROBE probe;
+    ULONG replyLength;
+    ULONG result;
+    IP_OPTION_INFORMATION options;
+
+    memset(&options, 0, sizeof(IP_OPTION_INFORMATION));
+    options.Ttl = (UCHAR)(Hop + 1);
+
+    if (Context->IpAddress.Type == PH_IPV6_NETWORK_TYPE)
+        replyLength = sizeof(ICMPV6_ECHO_REPLY) + sizeof(TracertEchoData) + 8 + sizeof(IO_STATUS_BLOCK);
+    else
+        replyLength = sizeof(ICMP_ECHO_REPLY) + sizeof(TracertEchoData) + 8 + sizeof(IO_STATUS_BLOCK);
+
+    probe = PhAllocate(FIELD_OFFSET(TRACERT_PROBE, ReplyBuffer) + replyLength);
+    memset(probe, 0, FIELD_OFFSET(TRACERT_PROBE, ReplyBuffer) + replyLength);
+    probe->Context = Context;
+    probe->Hop = Hop;
+    probe->ReplyLength = replyLength;
+
+    Context->PendingCount++;
+
+    if (Context->IpAddress.Type == PH_IPV6_NETWORK_TYPE)
+    {
+        SOCKADDR_IN6 localAddress = { 0 };
+        SOCKADDR_IN6 remoteAddress = { 0 };
+
+        localAddress.sin6_family = AF_INET6;
+        localAddress.sin6_addr = in6addr_any;
+        remoteAddress.sin6_family = AF_INET6;
+        remoteAddress.sin6_addr = Context->IpAddress.In6Addr;
+
+        result = Icmp6SendEcho2(
+            IcmpHandle,
+            NULL,
+            (FARPROC)TracertApcRoutine,
+            probe,
+            &localAddress,
+            &remoteAddress,
+            TracertEchoData,
+            sizeof(TracertEchoData),
+            &options,
+            probe->ReplyBuffer,
+            probe->ReplyLength,
+            Context->Timeout
+            );
+    }
+    else
+    {
+        result = IcmpSendEcho2(
+            IcmpHandle,
+            NULL,
+            (FARPROC)TracertApcRoutine,
+            probe,
+            Context->IpAddress.InAddr.s_addr,
+            TracertEchoData,
+            sizeof(TracertEchoData),
+            &options,
+            probe->ReplyBuffer,
+            probe->ReplyLength,
+            Context->Timeout
+            );
+    }
+
+    // The request failed immediately, so no APC will be queued.
+    if (result == 0 && GetLastError() != ERROR_IO_PENDING)
+        TracertCompleteProbe(probe, FALSE);
+}
+
+static PPH_STRING TracertFormatAddress(
+    _In_ PTRACERT_CONTEXT Context,
+    _In_ PPH_IP_ADDRESS Address
+    )
+{
+    WCHAR addressString[INET6_ADDRSTRLEN];
+    WCHAR hostName[NI_MAXHOST];
+
+    if (Address->Type == PH_IPV4_NETWORK_TYPE)
+        RtlIpv4AddressToString(&Address->InAddr, addressString);
+    else
+        RtlIpv6AddressToString(&Address->In6Addr, addressString);
+
+    if (Context->ResolveNames)
+    {
+        SOCKADDR_STORAGE sockAddress;
+        INT sockAddressLength;
+
+        memset(&sockAddress, 0, sizeof(SOCKADDR_STORAGE));
+
+        if (Address->Type == PH_IPV4_NETWORK_TYPE)
+        {
+            ((PSOCKADDR_IN)&sockAddress)->sin_family = AF_INET;
+            ((PSOCKADDR_IN)&sockAddress)->sin_addr = Address->InAddr;
+            sockAddressLength = sizeof(SOCKADDR_IN);
+        }
+        else
+        {
+            ((PSOCKADDR_IN6)&sockAddress)->sin6_family = AF_INET6;
+            ((PSOCKADDR_IN6)&sockAddress)->sin6_addr = Address->In6Addr;
+            sockAddressLength = sizeof(SOCKADDR_IN6);
+        }
+
+        if (GetNameInfoW((PSOCKADDR)&sockAddress, sockAddressLength, hostName, NI_MAXHOST, NULL, 0, NI_NAMEREQD) == 0)
+            return PhFormatString(L"%s [%s]", hostName, addressString);
+    }
+
+    return PhCreateString(addressString);
+}
+
+static VOID TracertPostText(
+    _In_ PTRACERT_CONTEXT Context,
+    _In_ PPH_STRING Text
+    )
+{
+    if (!PostMessage(Context->WindowHandle, NTM_RECEIVEDTEXT, 0, (LPARAM)Text))
+        PhDereferenceObject(Text);
+}
+
+static NTSTATUS NetworkTraceRouteThreadStart(
+    _In_ PVOID Parameter
+    )
+{
+    PTRACERT_CONTEXT context = Parameter;
+    HANDLE icmpHandle;
+    PH_STRING_BUILDER stringBuilder;
+    WCHAR addressString[INET6_ADDRSTRLEN];
+    ULONG i;
+    ULONG j;
+
+    if (context->IpAddress.Type == PH_IPV4_NETWORK_TYPE)
+        RtlIpv4AddressToString(&context->IpAddress.InAddr, addressString);
+    else
+        RtlIpv6AddressToString(&context->IpAddress.In6Addr, addressString);
+
+    TracertPostText(context, PhFormatString(
+        L"Tracing route to %s over a maximum of %u hops:\r\n\r\n",
+        addressString,
+        TRACERT_MAXIMUM_HOPS
+        ));
+
+    if (context->IpAddress.Type == PH_IPV6_NETWORK_TYPE)
+        icmpHandle = Icmp6CreateFile();
+    else
+        icmpHandle = IcmpCreateFile();
+
+    if (icmpHandle == INVALID_HANDLE_VALUE)
+    {
+        PPH_STRING message = PhGetWin32Message(GetLastError());
+
+        TracertPostText(context, PhFormatString(
+            L"Unable to create the ICMP handle: %s\r\n",
+            PhGetStringOrDefault(message, L"Unknown error")
+            ));
+        PhClearReference(&message);
+        goto CleanupExit;
+    }
+
+    // Send the probes for every hop at once instead of waiting for each hop to time out in turn.
+    // The whole trace takes about as long as the slowest probe.
+    for (j = 0; j < TRACERT_PROBES_PER_HOP; j++)
+    {
+        for (i = 0; i < TRACERT_MAXIMUM_HOPS; i++)
+            TracertSendProbe(context, icmpHandle, i);
+    }
+
+    // The replies are delivered as APCs to this thread. Each request completes within the timeout.
+    while (context->PendingCount != 0)
+    {
+        if (SleepEx(context->Timeout + 1000, TRUE) != WAIT_IO_COMPLETION)
+            break;
+    }
+
+    if (context->PendingCount != 0)
+    {
+        // Some requests are still outstanding and own memory in the context; don't free it.
+        return STATUS_SUCCESS;
+    }
+
+    IcmpCloseHandle(icmpHandle);
+
+    PhInitializeStringBuilder(&stringBuilder, 0x100);
+    PhAppendStringBuilder2(&stringBuilder, L"Hop      Min      Avg      Max   Loss  Address\r\n");
+
+    for (i = 0; i < TRACERT_MAXIMUM_HOPS; i++)
+    {
+        PTRACERT_HOP hop = &context->Hops[i];
+
+        if (hop->Replies != 0)
+        {
+            PPH_STRING address = TracertFormatAddress(context, &hop->Address);
+
+            PhAppendFormatStringBuilder(
+                &stringBuilder,
+                L"%3u  %5u ms %5u ms %5u ms  %3u%%  %s\r\n",
+                i + 1,
+                hop->MinimumTime,
+                hop->TotalTime / hop->Replies,
+                hop->MaximumTime,
+                (TRACERT_PROBES_PER_HOP - hop->Replies) * 100 / TRACERT_PROBES_PER_HOP,
+                address->Buffer
+                );
+            PhDereferenceObject(address);
+        }
+        else
+        {
+            PhAppendFormatStringBuilder(
+                &stringBuilder,
+                L"%3u        *        *        *   100%%  Request timed out.\r\n",
+                i + 1
+                );
+        }
+
+        if (hop->Destination)
+            break;
+    }
+
+    PhAppendStringBuilder2(&stringBuilder, L"\r\nTrace complete.\r\n");
+    TracertPostText(context, PhFinalStringBuilderString(&stringBuilder));
+
+CleanupExit:
+    PostMessage(context->WindowHandle, NTM_RECEIVEDFINISH, 0, 0);
+    PhFree(context);
+
+    return STATUS_SUCCESS;
+}
+
 NTSTATUS NetworkTracertThreadStart(
     _In_ PVOID Parameter
     )
@@ -63,6 +399,22 @@ NTSTATUS NetworkTracertThreadStart(
     HANDLE pipeWriteHandle = INVALID_HANDLE_VALUE;
     PNETWORK_OUTPUT_CONTEXT context = (PNETWORK_OUTPUT_CONTEXT)Parameter;
 
+    if (context->Action == NETWORK_ACTION_TRACEROUTE)
+    {
+        PTRACERT_CONTEXT tracertContext;
+
+        // Do the trace ourselves. The trace thread only talks to the window through posted
+        // messages, so it doesn't matter if the window is closed first.
+        tracertContext = PhAllocate(sizeof(TRACERT_CONTEXT));
+        memset(tracertContext, 0, sizeof(TRACERT_CONTEXT));
+        tracertContext->WindowHandle = context->WindowHandle;
+        tracertContext->IpAddress = context->IpAddress;
+        tracertContext->Timeout = PhGetIntegerSetting(SETTING_NAME_PING_TIMEOUT);
+        tracertContext->ResolveNames = !!PhGetIntegerSetting(L"EnableNetworkResolve");
+
+        return NetworkTraceRouteThreadStart(tracertContext);
+    }
+
     if (CreatePipe(&context->PipeReadHandle, &pipeWriteHandle, NULL, 0))
     {
         HANDLE threadHandle = NULL;
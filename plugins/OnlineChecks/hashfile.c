@@ -0,0 +1,448 @@
+/*
+ * Process Hacker Online Checks -
+ *   File Hashing
+ *
+ * Copyright (C) 2016 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * File streams read a file through two buffers using overlapped I/O. While the caller
+ * is hashing or uploading one buffer, the read into the other one is already in
+ * flight, so slow volumes (e.g. network shares) are read at their full speed.
+ *
+ * The hash cache remembers the SHA-256 hashes of recently checked files in the
+ * plugin's settings. An entry is only used while the file's ID, last write time and
+ * size are unchanged.
+ */
+
+#include "onlnchk.h"
+
+#define HASH_CACHE_MAXIMUM_ENTRIES 64
+
+static PH_QUEUED_LOCK HashCacheLock = PH_QUEUED_LOCK_INIT;
+
+static VOID IssueFileStreamRead(
+    _Inout_ PFILE_STREAM Stream,
+    _In_ ULONG Index
+    )
+{
+    LARGE_INTEGER byteOffset;
+
+    if (Stream->ReadOffset >= Stream->FileSize)
+    {
+        Stream->ReadStatus[Index] = STATUS_END_OF_FILE;
+        return;
+    }
+
+    byteOffset.QuadPart = Stream->ReadOffset;
+    Stream->ReadOffset += FILE_STREAM_BUFFER_SIZE;
+
+    // For a handle opened for asynchronous I/O, the event is signaled when the read
+    // completes, even if it completes immediately.
+    Stream->ReadStatus[Index] = NtReadFile(
+        Stream->FileHandle,
+        Stream->EventHandle[Index],
+        NULL,
+        NULL,
+        &Stream->IoStatusBlock[Index],
+        Stream->Buffer[Index],
+        FILE_STREAM_BUFFER_SIZE,
+        &byteOffset,
+        NULL
+        );
+}
+
+/**
+ * Starts reading a file.
+ *
+ * \param Stream A variable which receives the stream.
+ * \param FileHandle A handle to the file, opened for asynchronous I/O.
+ * \param FileSize The size of the file.
+ */
+NTSTATUS InitializeFileStream(
+    _Out_ PFILE_STREAM Stream,
+    _In_ HANDLE FileHandle,
+    _In_ ULONG64 FileSize
+    )
+{
+    NTSTATUS status;
+    ULONG i;
+
+    memset(Stream, 0, sizeof(FILE_STREAM));
+    Stream->FileHandle = FileHandle;
+    Stream->FileSize = FileSize;
+    Stream->ReadStatus[0] = STATUS_END_OF_FILE;
+    Stream->ReadStatus[1] = STATUS_END_OF_FILE;
+
+    for (i = 0; i < 2; i++)
+    {
+        if (!NT_SUCCESS(status = NtCreateEvent(&Stream->EventHandle[i], EVENT_ALL_ACCESS, NULL, NotificationEvent, FALSE)))
+        {
+            DeleteFileStream(Stream);
+            return status;
+        }
+
+        Stream->Buffer[i] = PhAllocatePage(FILE_STREAM_BUFFER_SIZE, NULL);
+
+        if (!Stream->Buffer[i])
+        {
+            DeleteFileStream(Stream);
+            return STATUS_NO_MEMORY;
+        }
+    }
+
+    IssueFileStreamRead(Stream, 0);
+    IssueFileStreamRead(Stream, 1);
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * Gets the next part of a file.
+ *
+ * \param Stream A stream.
+ * \param Buffer A variable which receives a pointer to the data. The data is valid
+ * until the next call to ReadFileStream() or DeleteFileStream().
+ * \param Length A variable which receives the number of bytes in \a Buffer.
+ *
+ * \return STATUS_END_OF_FILE if there is no more data.
+ */
+NTSTATUS ReadFileStream(
+    _Inout_ PFILE_STREAM Stream,
+    _Out_ PVOID *Buffer,
+    _Out_ PULONG Length
+    )
+{
+    NTSTATUS status;
+    ULONG index;
+
+    if (Stream->HaveBuffer)
+    {
+        // The caller is finished with the previous buffer. Reuse it for the read after
+        // the one that is already in progress.
+        IssueFileStreamRead(Stream, Stream->CurrentIndex);
+        Stream->CurrentIndex ^= 1;
+        Stream->HaveBuffer = FALSE;
+    }
+
+    index = Stream->CurrentIndex;
+    status = Stream->ReadStatus[index];
+
+    if (!NT_SUCCESS(status))
+        return status;
+
+    NtWaitForSingleObject(Stream->EventHandle[index], FALSE, NULL);
+    Stream->ReadStatus[index] = STATUS_END_OF_FILE;
+    status = Stream->IoStatusBlock[index].Status;
+
+    if (!NT_SUCCESS(status))
+        return status;
+
+    if (Stream->IoStatusBlock[index].Information == 0)
+        return STATUS_END_OF_FILE;
+
+    *Buffer = Stream->Buffer[index];
+    *Length = (ULONG)Stream->IoStatusBlock[index].Information;
+    Stream->HaveBuffer = TRUE;
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * Stops reading a file and frees the stream's buffers.
+ *
+ * \param Stream A stream.
+ */
+VOID DeleteFileStream(
+    _Inout_ PFILE_STREAM Stream
+    )
+{
+    IO_STATUS_BLOCK isb;
+    ULONG i;
+
+    NtCancelIoFile(Stream->FileHandle, &isb);
+
+    for (i = 0; i < 2; i++)
+    {
+        // The buffer may not be freed while a read into it is still in progress.
+        if (NT_SUCCESS(Stream->ReadStatus[i]))
+            NtWaitForSingleObject(Stream->EventHandle[i], FALSE, NULL);
+
+        if (Stream->Buffer[i])
+            PhFreePage(Stream->Buffer[i]);
+        if (Stream->EventHandle[i])
+            NtClose(Stream->EventHandle[i]);
+    }
+
+    memset(Stream, 0, sizeof(FILE_STREAM));
+}
+
+/**
+ * Gets information that changes whenever a file is replaced or modified.
+ *
+ * \param FileHandle A handle to the file.
+ * \param Key A variable which receives the key.
+ */
+NTSTATUS QueryFileHashKey(
+    _In_ HANDLE FileHandle,
+    _Out_ PFILE_HASH_KEY Key
+    )
+{
+    NTSTATUS status;
+    IO_STATUS_BLOCK isb;
+    FILE_INTERNAL_INFORMATION internalInfo;
+    FILE_NETWORK_OPEN_INFORMATION networkOpenInfo;
+
+    if (!NT_SUCCESS(status = NtQueryInformationFile(
+        FileHandle,
+        &isb,
+        &internalInfo,
+        sizeof(FILE_INTERNAL_INFORMATION),
+        FileInternalInformation
+        )))
+        return status;
+
+    if (!NT_SUCCESS(status = NtQueryInformationFile(
+        FileHandle,
+        &isb,
+        &networkOpenInfo,
+        sizeof(FILE_NETWORK_OPEN_INFORMATION),
+        FileNetworkOpenInformation
+        )))
+        return status;
+
+    Key->FileId = internalInfo.IndexNumber;
+    Key->LastWriteTime = networkOpenInfo.LastWriteTime;
+    Key->EndOfFile = networkOpenInfo.EndOfFile;
+
+    return STATUS_SUCCESS;
+}
+
+// Each cache entry is stored as "fileid,lastwritetime,size,hash,filename" (the file
+// name comes last because it may contain commas), and entries are separated by '|',
+// most recently used first.
+
+static BOOLEAN ParseHashCacheEntry(
+    _In_ PPH_STRINGREF Entry,
+    _Out_ PFILE_HASH_KEY Key,
+    _Out_ PPH_STRINGREF HashString,
+    _Out_ PPH_STRINGREF FileName
+    )
+{
+    PH_STRINGREF part;
+    PH_STRINGREF remainingPart;
+
+    remainingPart = *Entry;
+
+    if (!PhSplitStringRefAtChar(&remainingPart, ',', &part, &remainingPart))
+        return FALSE;
+    if (!PhStringToInteger64(&part, 16, &Key->FileId.QuadPart))
+        return FALSE;
+
+    if (!PhSplitStringRefAtChar(&remainingPart, ',', &part, &remainingPart))
+        return FALSE;
+    if (!PhStringToInteger64(&part, 16, &Key->LastWriteTime.QuadPart))
+        return FALSE;
+
+    if (!PhSplitStringRefAtChar(&remainingPart, ',', &part, &remainingPart))
+        return FALSE;
+    if (!PhStringToInteger64(&part, 16, &Key->EndOfFile.QuadPart))
+        return FALSE;
+
+    if (!PhSplitStringRefAtChar(&remainingPart, ',', HashString, FileName))
+        return FALSE;
+    if (HashString->Length != 64 * sizeof(WCHAR))
+        return FALSE;
+
+    return TRUE;
+}
+
+/**
+ * Looks up the cached SHA-256 hash of a file.
+ *
+ * \param FileName The file name of the file.
+ * \param Key The current key of the file (see QueryFileHashKey()).
+ * \param Hash A buffer which receives the 32 byte hash.
+ *
+ * \return TRUE if a valid entry was found, otherwise FALSE.
+ */
+BOOLEAN LookupFileHashCache(
+    _In_ PPH_STRING FileName,
+    _In_ PFILE_HASH_KEY Key,
+    _Out_writes_bytes_(32) PUCHAR Hash
+    )
+{
+    BOOLEAN result = FALSE;
+    PPH_STRING cache;
+    PH_STRINGREF remainingPart;
+    PH_STRINGREF entryPart;
+    FILE_HASH_KEY entryKey;
+    PH_STRINGREF hashString;
+    PH_STRINGREF entryFileName;
+
+    PhAcquireQueuedLockShared(&HashCacheLock);
+    cache = PhGetStringSetting(SETTING_NAME_HASH_CACHE);
+    PhReleaseQueuedLockShared(&HashCacheLock);
+
+    remainingPart = cache->sr;
+
+    while (remainingPart.Length != 0)
+    {
+        PhSplitStringRefAtChar(&remainingPart, '|', &entryPart, &remainingPart);
+
+        if (!ParseHashCacheEntry(&entryPart, &entryKey, &hashString, &entryFileName))
+            continue;
+
+        if (PhEqualStringRef(&entryFileName, &FileName->sr, TRUE))
+        {
+            if (RtlEqualMemory(&entryKey, Key, sizeof(FILE_HASH_KEY)))
+                result = PhHexStringToBuffer(&hashString, Hash);
+
+            break;
+        }
+    }
+
+    PhDereferenceObject(cache);
+
+    return result;
+}
+
+/**
+ * Adds the SHA-256 hash of a file to the cache.
+ *
+ * \param FileName The file name of the file.
+ * \param Key The key of the file at the time it was hashed.
+ * \param Hash The 32 byte hash.
+ */
+VOID UpdateFileHashCache(
+    _In_ PPH_STRING FileName,
+    _In_ PFILE_HASH_KEY Key,
+    _In_reads_bytes_(32) PUCHAR Hash
+    )
+{
+    PPH_STRING cache;
+    PPH_STRING hashString;
+    PH_STRING_BUILDER stringBuilder;
+    PH_STRINGREF remainingPart;
+    PH_STRINGREF entryPart;
+    FILE_HASH_KEY entryKey;
+    PH_STRINGREF entryHashString;
+    PH_STRINGREF entryFileName;
+    ULONG count;
+
+    // '|' can't appear in file names, but don't let a strange name corrupt the cache.
+    if (PhFindCharInString(FileName, 0, '|') != -1)
+        return;
+
+    hashString = PhBufferToHexString(Hash, 32);
+    PhInitializeStringBuilder(&stringBuilder, 512);
+
+    PhAppendFormatStringBuilder(
+        &stringBuilder,
+        L"%I64x,%I64x,%I64x,%s,%s",
+        Key->FileId.QuadPart,
+        Key->LastWriteTime.QuadPart,
+        Key->EndOfFile.QuadPart,
+        hashString->Buffer,
+        FileName->Buffer
+        );
+    count = 1;
+
+    PhAcquireQueuedLockExclusive(&HashCacheLock);
+
+    cache = PhGetStringSetting(SETTING_NAME_HASH_CACHE);
+    remainingPart = cache->sr;
+
+    while (remainingPart.Length != 0 && count < HASH_CACHE_MAXIMUM_ENTRIES)
+    {
+        PhSplitStringRefAtChar(&remainingPart, '|', &entryPart, &remainingPart);
+
+        if (!ParseHashCacheEntry(&entryPart, &entryKey, &entryHashString, &entryFileName))
+            continue;
+        if (PhEqualStringRef(&entryFileName, &FileName->sr, TRUE))
+            continue;
+
+        PhAppendCharStringBuilder(&stringBuilder, '|');
+        PhAppendStringBuilder(&stringBuilder, &entryPart);
+        count++;
+    }
+
+    PhSetStringSetting2(SETTING_NAME_HASH_CACHE, &stringBuilder.String->sr);
+
+    PhReleaseQueuedLockExclusive(&HashCacheLock);
+
+    PhDereferenceObject(cache);
+    PhDeleteStringBuilder(&stringBuilder);
+    PhDereferenceObject(hashString);
+}
+
+/**
+ * Computes the SHA-256 hash of a file, using the hash cache if possible.
+ *
+ * \param FileName The file name of the file.
+ * \param FileHandle A handle to the file, opened for asynchronous I/O.
+ * \param FileSize The size of the file.
+ * \param UpdateCache TRUE to add a newly computed hash to the cache. Bulk callers
+ * pass FALSE so that they don't evict the entries of files the user checked
+ * individually.
+ * \param Hash A buffer which receives the 32 byte hash.
+ */
+NTSTATUS HashFile(
+    _In_ PPH_STRING FileName,
+    _In_ HANDLE FileHandle,
+    _In_ ULONG64 FileSize,
+    _In_ BOOLEAN UpdateCache,
+    _Out_writes_bytes_(32) PUCHAR Hash
+    )
+{
+    NTSTATUS status;
+    FILE_HASH_KEY key;
+    BOOLEAN haveKey;
+    FILE_STREAM stream;
+    PH_HASH_CONTEXT hashContext;
+    PVOID buffer;
+    ULONG length;
+
+    haveKey = NT_SUCCESS(QueryFileHashKey(FileHandle, &key));
+
+    if (haveKey && LookupFileHashCache(FileName, &key, Hash))
+        return STATUS_SUCCESS;
+
+    if (!NT_SUCCESS(status = InitializeFileStream(&stream, FileHandle, FileSize)))
+        return status;
+
+    PhInitializeHash(&hashContext, Sha256HashAlgorithm);
+
+    while (NT_SUCCESS(status = ReadFileStream(&stream, &buffer, &length)))
+        PhUpdateHash(&hashContext, buffer, length);
+
+    DeleteFileStream(&stream);
+
+    if (status == STATUS_END_OF_FILE)
+        status = STATUS_SUCCESS;
+
+    if (NT_SUCCESS(status))
+    {
+        PhFinalHash(&hashContext, Hash, 32, NULL);
+
+        if (haveKey && UpdateCache)
+            UpdateFileHashCache(FileName, &key, Hash);
+    }
+
+    return status;
+}
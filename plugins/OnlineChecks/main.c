@@ -27,6 +27,7 @@ PPH_PLUGIN PluginInstance;
 static PH_CALLBACK_REGISTRATION PluginLoadCallbackRegistration;
 static PH_CALLBACK_REGISTRATION PluginShowOptionsCallbackRegistration;
 static PH_CALLBACK_REGISTRATION PluginMenuItemCallbackRegistration;
+static PH_CALLBACK_REGISTRATION MainWindowShowingCallbackRegistration;
 static PH_CALLBACK_REGISTRATION ProcessMenuInitializingCallbackRegistration;
 static PH_CALLBACK_REGISTRATION ModuleMenuInitializingCallbackRegistration;
 
@@ -68,9 +69,21 @@ static VOID NTAPI MenuItemCallback(
         fileName = menuItem->Context;
         UploadToOnlineService(fileName, UPLOAD_SERVICE_CIMA);
         break;
+    case ID_CHECK_ALL_PROCESSES:
+        ShowScanAllDialog();
+        break;
     }
 }
 
+static VOID NTAPI MainWindowShowingCallback(
+    _In_opt_ PVOID Parameter,
+    _In_opt_ PVOID Context
+    )
+{
+    PhPluginAddMenuItem(PluginInstance, PH_MENU_ITEM_LOCATION_TOOLS, L"$",
+        ID_CHECK_ALL_PROCESSES, L"Check All Processes with VirusTotal", NULL);
+}
+
 static PPH_EMENU_ITEM CreateSendToMenu(
     _In_ PPH_EMENU_ITEM Parent,
     _In_ PWSTR InsertAfter,
@@ -156,6 +169,12 @@ LOGICAL DllMain(
     case DLL_PROCESS_ATTACH:
         {
             PPH_PLUGIN_INFORMATION info;
+            PH_SETTING_CREATE settings[] =
+            {
+                { StringSettingType, SETTING_NAME_HASH_CACHE, L"" },
+                { StringSettingType, SETTING_NAME_VIRUSTOTAL_API_KEY, L"" },
+                { StringSettingType, SETTING_NAME_VIRUSTOTAL_RESULT_CACHE, L"" }
+            };
 
             PluginInstance = PhRegisterPlugin(PLUGIN_NAME, Instance, &info);
 
@@ -186,6 +205,12 @@ LOGICAL DllMain(
                 NULL,
                 &PluginMenuItemCallbackRegistration
                 );
+            PhRegisterCallback(
+                PhGetGeneralCallback(GeneralCallbackMainWindowShowing),
+                MainWindowShowingCallback,
+                NULL,
+                &MainWindowShowingCallbackRegistration
+                );
             PhRegisterCallback(
                 PhGetGeneralCallback(GeneralCallbackProcessMenuInitializing),
                 ProcessMenuInitializingCallback,
@@ -198,6 +223,8 @@ LOGICAL DllMain(
                 NULL,
                 &ModuleMenuInitializingCallbackRegistration
                 );
+
+            PhAddSettings(settings, ARRAYSIZE(settings));
         }
         break;
     }
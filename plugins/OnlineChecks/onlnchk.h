@@ -32,17 +32,18 @@
 #include <windowsx.h>
 #include <winhttp.h>
 
-#include "sha256.h"
 #include "resource.h"
 
 #define PLUGIN_NAME L"ProcessHacker.OnlineChecks"
-
-#define HASH_SHA1 1
-#define HASH_SHA256 2
+#define SETTING_NAME_HASH_CACHE (PLUGIN_NAME L".HashCache")
+#define SETTING_NAME_VIRUSTOTAL_API_KEY (PLUGIN_NAME L".VirusTotalApiKey")
+#define SETTING_NAME_VIRUSTOTAL_RESULT_CACHE (PLUGIN_NAME L".VirusTotalResultCache")
 
 #define UM_EXISTS (WM_USER + 1)
 #define UM_LAUNCH (WM_USER + 2)
 #define UM_ERROR (WM_USER + 3)
+#define UM_SCAN_ENTRIES (WM_USER + 4)
+#define UM_SCAN_UPDATE (WM_USER + 5)
 
 #define Control_Visible(hWnd, visible) \
     ShowWindow(hWnd, visible ? SW_SHOW : SW_HIDE);
@@ -92,14 +93,95 @@ typedef struct _UPLOAD_CONTEXT
 // main
 extern PPH_PLUGIN PluginInstance;
 
+// hashfile
+
+#define FILE_STREAM_BUFFER_SIZE (256 * 1024)
+
+typedef struct _FILE_STREAM
+{
+    HANDLE FileHandle;
+    ULONG64 FileSize;
+    ULONG64 ReadOffset;
+    ULONG CurrentIndex;
+    BOOLEAN HaveBuffer;
+    NTSTATUS ReadStatus[2];
+    HANDLE EventHandle[2];
+    IO_STATUS_BLOCK IoStatusBlock[2];
+    PVOID Buffer[2];
+} FILE_STREAM, *PFILE_STREAM;
+
+typedef struct _FILE_HASH_KEY
+{
+    LARGE_INTEGER FileId;
+    LARGE_INTEGER LastWriteTime;
+    LARGE_INTEGER EndOfFile;
+} FILE_HASH_KEY, *PFILE_HASH_KEY;
+
+NTSTATUS InitializeFileStream(
+    _Out_ PFILE_STREAM Stream,
+    _In_ HANDLE FileHandle,
+    _In_ ULONG64 FileSize
+    );
+
+NTSTATUS ReadFileStream(
+    _Inout_ PFILE_STREAM Stream,
+    _Out_ PVOID *Buffer,
+    _Out_ PULONG Length
+    );
+
+VOID DeleteFileStream(
+    _Inout_ PFILE_STREAM Stream
+    );
+
+NTSTATUS QueryFileHashKey(
+    _In_ HANDLE FileHandle,
+    _Out_ PFILE_HASH_KEY Key
+    );
+
+BOOLEAN LookupFileHashCache(
+    _In_ PPH_STRING FileName,
+    _In_ PFILE_HASH_KEY Key,
+    _Out_writes_bytes_(32) PUCHAR Hash
+    );
+
+VOID UpdateFileHashCache(
+    _In_ PPH_STRING FileName,
+    _In_ PFILE_HASH_KEY Key,
+    _In_reads_bytes_(32) PUCHAR Hash
+    );
+
+NTSTATUS HashFile(
+    _In_ PPH_STRING FileName,
+    _In_ HANDLE FileHandle,
+    _In_ ULONG64 FileSize,
+    _In_ BOOLEAN UpdateCache,
+    _Out_writes_bytes_(32) PUCHAR Hash
+    );
+
 // upload
 #define UPLOAD_SERVICE_VIRUSTOTAL 101
 #define UPLOAD_SERVICE_JOTTI 102
 #define UPLOAD_SERVICE_CIMA 103
 
+BOOL ReadRequestString(
+    _In_ HINTERNET Handle,
+    _Out_ _Deref_post_z_cap_(*DataLength) PSTR *Data,
+    _Out_ ULONG *DataLength
+    );
+
+HINTERNET CreateHttpSession(
+    VOID
+    );
+
 VOID UploadToOnlineService(
     _In_ PPH_STRING FileName,
     _In_ ULONG Service
     );
 
+// scanall
+
+VOID ShowScanAllDialog(
+    VOID
+    );
+
 #endif
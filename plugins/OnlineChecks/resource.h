@@ -11,17 +11,20 @@
 #define ID_SENDTO_SERVICE6              106
 #define ID_SENDTO_SERVICE7              107
 #define ID_SENDTO_SERVICE8              108
+#define IDD_SCANALL                     102
+#define ID_CHECK_ALL_PROCESSES          109
 #define IDC_MESSAGE                     1002
 #define IDC_PROGRESS1                   1003
 #define IDC_STATUS                      1004
+#define IDC_FILELIST                    1005
 
 // Next default values for new objects
 //
 #ifdef APSTUDIO_INVOKED
 #ifndef APSTUDIO_READONLY_SYMBOLS
-#define _APS_NEXT_RESOURCE_VALUE        102
+#define _APS_NEXT_RESOURCE_VALUE        103
 #define _APS_NEXT_COMMAND_VALUE         40001
-#define _APS_NEXT_CONTROL_VALUE         1005
-#define _APS_NEXT_SYMED_VALUE           109
+#define _APS_NEXT_CONTROL_VALUE         1006
+#define _APS_NEXT_SYMED_VALUE           110
 #endif
 #endif
@@ -0,0 +1,1218 @@
+/*
+ * Process Hacker Online Checks -
+ *   Check All Processes
+ *
+ * Copyright (C) 2016 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * This checks the images and modules of all running processes with VirusTotal.
+ * Every file is hashed once, even if it is loaded into many processes or reachable
+ * through several names, and hashes are only sent for files which don't have a
+ * recent result in the result cache. The hashes are sent a batch at a time over a
+ * single connection, and the batches are spaced out to stay within the request
+ * limit of VirusTotal's public API.
+ *
+ * The result cache is stored in the plugin's settings, so results survive restarts.
+ */
+
+#include "onlnchk.h"
+#include "json-c/json.h"
+
+#define SCAN_BATCH_SIZE 4 // the maximum number of resources for a public API key
+#define SCAN_REQUEST_INTERVAL 15 // in seconds; public API keys are allowed 4 requests per minute
+#define SCAN_RATE_LIMIT_INTERVAL 60 // in seconds; used after the service tells us to slow down
+
+#define SCAN_RESULT_CACHE_MAXIMUM_ENTRIES 1024
+#define SCAN_RESULT_LIFETIME (7 * PH_TICKS_PER_DAY)
+#define SCAN_RESULT_UNKNOWN_LIFETIME (PH_TICKS_PER_DAY)
+
+#define SCAN_ENTRY_PENDING 0
+#define SCAN_ENTRY_HASHED 1
+#define SCAN_ENTRY_FOUND 2
+#define SCAN_ENTRY_UNKNOWN 3
+#define SCAN_ENTRY_ERROR 4
+
+#define SCAN_PHASE_ENUMERATING 0
+#define SCAN_PHASE_HASHING 1
+#define SCAN_PHASE_QUERYING 2
+#define SCAN_PHASE_WAITING 3
+#define SCAN_PHASE_COMPLETED 4
+
+typedef struct _SCAN_RESULT
+{
+    UCHAR Hash[32];
+    LONG Positives;
+    LONG Total; // 0 if the file is unknown to the service
+    LARGE_INTEGER QueryTime;
+} SCAN_RESULT, *PSCAN_RESULT;
+
+typedef struct _SCAN_ENTRY
+{
+    PPH_STRING FileName;
+    PPH_STRING BaseName;
+    PPH_STRING HashString;
+    ULONG State;
+    LONG Positives;
+    LONG Total;
+    UCHAR Hash[32];
+} SCAN_ENTRY, *PSCAN_ENTRY;
+
+typedef struct _SCAN_FILE_ID
+{
+    FILE_HASH_KEY Key;
+    PSCAN_ENTRY Entry;
+} SCAN_FILE_ID, *PSCAN_FILE_ID;
+
+typedef struct _SCAN_CONTEXT
+{
+    LONG RefCount;
+    HWND DialogHandle;
+    HWND ListViewHandle;
+    HWND StatusHandle;
+    PH_LAYOUT_MANAGER LayoutManager;
+    HANDLE CancelEvent;
+
+    PPH_LIST EntryList;
+    PPH_HASHTABLE FileNameHashtable; // only used while enumerating
+
+    ULONG Phase;
+    ULONG NumberOfHashed;
+    ULONG NumberOfQueries;
+    ULONG NumberOfQueried;
+    PPH_STRING ErrorMessage;
+} SCAN_CONTEXT, *PSCAN_CONTEXT;
+
+static HWND ScanAllDialogHandle = NULL;
+
+static PH_INITONCE ScanResultCacheInitOnce = PH_INITONCE_INIT;
+static PH_QUEUED_LOCK ScanResultCacheLock = PH_QUEUED_LOCK_INIT;
+static PPH_HASHTABLE ScanResultCacheHashtable;
+
+static json_object_ptr json_get_object(json_object_ptr rootObj, const char* key)
+{
+    json_object_ptr returnObj;
+
+    if (json_object_object_get_ex(rootObj, key, &returnObj))
+    {
+        return returnObj;
+    }
+
+    return NULL;
+}
+
+static BOOLEAN NTAPI ScanResultCacheCompareFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    )
+{
+    return RtlEqualMemory(((PSCAN_RESULT)Entry1)->Hash, ((PSCAN_RESULT)Entry2)->Hash, 32);
+}
+
+static ULONG NTAPI ScanResultCacheHashFunction(
+    _In_ PVOID Entry
+    )
+{
+    // The hash is already uniformly distributed.
+    return *(PULONG)((PSCAN_RESULT)Entry)->Hash;
+}
+
+// Each cache entry is stored as "hash,positives,total,querytime", and entries are
+// separated by '|'.
+
+static BOOLEAN ParseScanResultEntry(
+    _In_ PPH_STRINGREF Entry,
+    _Out_ PSCAN_RESULT Result
+    )
+{
+    PH_STRINGREF part;
+    PH_STRINGREF remainingPart;
+    LONG64 integer;
+
+    remainingPart = *Entry;
+
+    if (!PhSplitStringRefAtChar(&remainingPart, ',', &part, &remainingPart))
+        return FALSE;
+    if (part.Length != 64 * sizeof(WCHAR) || !PhHexStringToBuffer(&part, Result->Hash))
+        return FALSE;
+
+    if (!PhSplitStringRefAtChar(&remainingPart, ',', &part, &remainingPart))
+        return FALSE;
+    if (!PhStringToInteger64(&part, 16, &integer))
+        return FALSE;
+    Result->Positives = (LONG)integer;
+
+    if (!PhSplitStringRefAtChar(&remainingPart, ',', &part, &remainingPart))
+        return FALSE;
+    if (!PhStringToInteger64(&part, 16, &integer))
+        return FALSE;
+    Result->Total = (LONG)integer;
+
+    if (!PhStringToInteger64(&remainingPart, 16, &Result->QueryTime.QuadPart))
+        return FALSE;
+
+    return TRUE;
+}
+
+static VOID InitializeScanResultCache(
+    VOID
+    )
+{
+    if (PhBeginInitOnce(&ScanResultCacheInitOnce))
+    {
+        PPH_STRING cache;
+        PH_STRINGREF remainingPart;
+        PH_STRINGREF entryPart;
+        SCAN_RESULT result;
+
+        ScanResultCacheHashtable = PhCreateHashtable(
+            sizeof(SCAN_RESULT),
+            ScanResultCacheCompareFunction,
+            ScanResultCacheHashFunction,
+            64
+            );
+
+        cache = PhGetStringSetting(SETTING_NAME_VIRUSTOTAL_RESULT_CACHE);
+        remainingPart = cache->sr;
+
+        while (remainingPart.Length != 0)
+        {
+            PhSplitStringRefAtChar(&remainingPart, '|', &entryPart, &remainingPart);
+
+            if (ParseScanResultEntry(&entryPart, &result))
+                PhAddEntryHashtable(ScanResultCacheHashtable, &result);
+        }
+
+        PhDereferenceObject(cache);
+
+        PhEndInitOnce(&ScanResultCacheInitOnce);
+    }
+}
+
+static BOOLEAN IsScanResultExpired(
+    _In_ PSCAN_RESULT Result,
+    _In_ PLARGE_INTEGER CurrentTime
+    )
+{
+    // Unknown files are checked again sooner, since someone may have submitted them.
+    if (Result->Total != 0)
+        return CurrentTime->QuadPart - Result->QueryTime.QuadPart > SCAN_RESULT_LIFETIME;
+    else
+        return CurrentTime->QuadPart - Result->QueryTime.QuadPart > SCAN_RESULT_UNKNOWN_LIFETIME;
+}
+
+static BOOLEAN LookupScanResultCache(
+    _In_reads_bytes_(32) PUCHAR Hash,
+    _Out_ PSCAN_RESULT Result
+    )
+{
+    BOOLEAN found = FALSE;
+    SCAN_RESULT lookupResult;
+    PSCAN_RESULT result;
+    LARGE_INTEGER currentTime;
+
+    memcpy(lookupResult.Hash, Hash, 32);
+    PhQuerySystemTime(&currentTime);
+
+    PhAcquireQueuedLockShared(&ScanResultCacheLock);
+
+    result = PhFindEntryHashtable(ScanResultCacheHashtable, &lookupResult);
+
+    if (result && !IsScanResultExpired(result, &currentTime))
+    {
+        *Result = *result;
+        found = TRUE;
+    }
+
+    PhReleaseQueuedLockShared(&ScanResultCacheLock);
+
+    return found;
+}
+
+static VOID UpdateScanResultCache(
+    _In_ PSCAN_RESULT Result
+    )
+{
+    PSCAN_RESULT result;
+    BOOLEAN added;
+
+    PhAcquireQueuedLockExclusive(&ScanResultCacheLock);
+
+    result = PhAddEntryHashtableEx(ScanResultCacheHashtable, Result, &added);
+
+    if (!added)
+        *result = *Result;
+
+    PhReleaseQueuedLockExclusive(&ScanResultCacheLock);
+}
+
+static int __cdecl ScanResultQueryTimeCompare(
+    _In_ const void *elem1,
+    _In_ const void *elem2
+    )
+{
+    PSCAN_RESULT result1 = *(PSCAN_RESULT *)elem1;
+    PSCAN_RESULT result2 = *(PSCAN_RESULT *)elem2;
+
+    // Most recent first.
+    return -int64cmp(result1->QueryTime.QuadPart, result2->QueryTime.QuadPart);
+}
+
+static VOID SaveScanResultCache(
+    VOID
+    )
+{
+    PPH_LIST resultList;
+    PH_HASHTABLE_ENUM_CONTEXT enumContext;
+    PSCAN_RESULT result;
+    PH_STRING_BUILDER stringBuilder;
+    LARGE_INTEGER currentTime;
+    ULONG i;
+
+    resultList = PhCreateList(ScanResultCacheHashtable->Count);
+    PhInitializeStringBuilder(&stringBuilder, 1024);
+    PhQuerySystemTime(&currentTime);
+
+    PhAcquireQueuedLockShared(&ScanResultCacheLock);
+
+    PhBeginEnumHashtable(ScanResultCacheHashtable, &enumContext);
+
+    while (result = PhNextEnumHashtable(&enumContext))
+    {
+        if (!IsScanResultExpired(result, &currentTime))
+            PhAddItemList(resultList, result);
+    }
+
+    qsort(resultList->Items, resultList->Count, sizeof(PVOID), ScanResultQueryTimeCompare);
+
+    for (i = 0; i < resultList->Count && i < SCAN_RESULT_CACHE_MAXIMUM_ENTRIES; i++)
+    {
+        PPH_STRING hashString;
+
+        result = resultList->Items[i];
+        hashString = PhBufferToHexString(result->Hash, 32);
+
+        if (i != 0)
+            PhAppendCharStringBuilder(&stringBuilder, '|');
+
+        PhAppendFormatStringBuilder(
+            &stringBuilder,
+            L"%s,%x,%x,%I64x",
+            hashString->Buffer,
+            result->Positives,
+            result->Total,
+            result->QueryTime.QuadPart
+            );
+
+        PhDereferenceObject(hashString);
+    }
+
+    PhReleaseQueuedLockShared(&ScanResultCacheLock);
+
+    PhSetStringSetting2(SETTING_NAME_VIRUSTOTAL_RESULT_CACHE, &stringBuilder.String->sr);
+
+    PhDeleteStringBuilder(&stringBuilder);
+    PhDereferenceObject(resultList);
+}
+
+static VOID ReleaseScanContext(
+    _In_ PSCAN_CONTEXT Context
+    )
+{
+    ULONG i;
+
+    if (_InterlockedDecrement(&Context->RefCount) != 0)
+        return;
+
+    for (i = 0; i < Context->EntryList->Count; i++)
+    {
+        PSCAN_ENTRY entry = Context->EntryList->Items[i];
+
+        PhDereferenceObject(entry->FileName);
+        PhDereferenceObject(entry->BaseName);
+        PhClearReference(&entry->HashString);
+        PhFree(entry);
+    }
+
+    PhDereferenceObject(Context->EntryList);
+    PhClearReference(&Context->ErrorMessage);
+    NtClose(Context->CancelEvent);
+    PhFree(Context);
+}
+
+static BOOLEAN WaitForScanInterval(
+    _In_ PSCAN_CONTEXT Context,
+    _In_ ULONG Seconds
+    )
+{
+    LARGE_INTEGER timeout;
+
+    // Returns FALSE if the scan was cancelled while waiting.
+    return NtWaitForSingleObject(
+        Context->CancelEvent,
+        FALSE,
+        PhTimeoutFromMilliseconds(&timeout, Seconds * 1000)
+        ) == STATUS_TIMEOUT;
+}
+
+static BOOLEAN NTAPI ScanEntryFileNameCompareFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    )
+{
+    return PhEqualString((*(PSCAN_ENTRY *)Entry1)->FileName, (*(PSCAN_ENTRY *)Entry2)->FileName, TRUE);
+}
+
+static ULONG NTAPI ScanEntryFileNameHashFunction(
+    _In_ PVOID Entry
+    )
+{
+    return PhHashStringRef(&(*(PSCAN_ENTRY *)Entry)->FileName->sr, TRUE);
+}
+
+static VOID AddScanEntry(
+    _In_ PSCAN_CONTEXT Context,
+    _In_ PPH_STRING FileName
+    )
+{
+    SCAN_ENTRY lookupEntry;
+    PSCAN_ENTRY lookupEntryPtr = &lookupEntry;
+    PSCAN_ENTRY entry;
+
+    lookupEntry.FileName = PhGetFileName(FileName);
+
+    if (!PhFindEntryHashtable(Context->FileNameHashtable, &lookupEntryPtr))
+    {
+        entry = PhAllocate(sizeof(SCAN_ENTRY));
+        memset(entry, 0, sizeof(SCAN_ENTRY));
+        entry->FileName = lookupEntry.FileName;
+        entry->BaseName = PhGetBaseName(entry->FileName);
+
+        PhAddEntryHashtable(Context->FileNameHashtable, &entry);
+        PhAddItemList(Context->EntryList, entry);
+    }
+    else
+    {
+        PhDereferenceObject(lookupEntry.FileName);
+    }
+}
+
+static BOOLEAN NTAPI EnumScanModulesCallback(
+    _In_ PPH_MODULE_INFO Module,
+    _In_opt_ PVOID Context
+    )
+{
+    if (Module->FileName)
+        AddScanEntry(Context, Module->FileName);
+
+    return TRUE;
+}
+
+static VOID CollectScanEntries(
+    _In_ PSCAN_CONTEXT Context
+    )
+{
+    PPH_PROCESS_ITEM *processes;
+    ULONG numberOfProcesses;
+    ULONG i;
+
+    Context->FileNameHashtable = PhCreateHashtable(
+        sizeof(PSCAN_ENTRY),
+        ScanEntryFileNameCompareFunction,
+        ScanEntryFileNameHashFunction,
+        256
+        );
+
+    PhEnumProcessItems(&processes, &numberOfProcesses);
+
+    for (i = 0; i < numberOfProcesses; i++)
+    {
+        PPH_PROCESS_ITEM processItem = processes[i];
+
+        // Skip the Idle process and the kernel; we only check user-mode images.
+        if (processItem->ProcessId == SYSTEM_IDLE_PROCESS_ID || processItem->ProcessId == SYSTEM_PROCESS_ID)
+            continue;
+
+        if (processItem->FileName)
+            AddScanEntry(Context, processItem->FileName);
+
+        PhEnumGenericModules(processItem->ProcessId, NULL, 0, EnumScanModulesCallback, Context);
+    }
+
+    PhDereferenceObjects(processes, numberOfProcesses);
+    PhFree(processes);
+
+    PhClearReference(&Context->FileNameHashtable);
+}
+
+static BOOLEAN NTAPI ScanFileIdCompareFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    )
+{
+    return RtlEqualMemory(&((PSCAN_FILE_ID)Entry1)->Key, &((PSCAN_FILE_ID)Entry2)->Key, sizeof(FILE_HASH_KEY));
+}
+
+static ULONG NTAPI ScanFileIdHashFunction(
+    _In_ PVOID Entry
+    )
+{
+    return PhHashBytes((PUCHAR)&((PSCAN_FILE_ID)Entry)->Key, sizeof(FILE_HASH_KEY));
+}
+
+static VOID ApplyScanResult(
+    _Inout_ PSCAN_ENTRY Entry,
+    _In_ PSCAN_RESULT Result
+    )
+{
+    Entry->Positives = Result->Positives;
+    Entry->Total = Result->Total;
+    Entry->State = Result->Total != 0 ? SCAN_ENTRY_FOUND : SCAN_ENTRY_UNKNOWN;
+}
+
+static VOID HashScanEntry(
+    _In_ PPH_HASHTABLE FileIdHashtable,
+    _Inout_ PSCAN_ENTRY Entry
+    )
+{
+    NTSTATUS status;
+    HANDLE fileHandle;
+    LARGE_INTEGER fileSize;
+    SCAN_FILE_ID fileId;
+    BOOLEAN haveKey;
+    PSCAN_FILE_ID existingFileId;
+    SCAN_RESULT result;
+
+    if (!NT_SUCCESS(PhCreateFileWin32(
+        &fileHandle,
+        Entry->FileName->Buffer,
+        FILE_GENERIC_READ,
+        0,
+        FILE_SHARE_READ | FILE_SHARE_DELETE,
+        FILE_OPEN,
+        FILE_NON_DIRECTORY_FILE | FILE_SEQUENTIAL_ONLY
+        )))
+    {
+        Entry->State = SCAN_ENTRY_ERROR;
+        return;
+    }
+
+    // Different names for the same file (hard links, short names, etc.) are only
+    // hashed once.
+
+    haveKey = NT_SUCCESS(QueryFileHashKey(fileHandle, &fileId.Key));
+
+    if (haveKey && (existingFileId = PhFindEntryHashtable(FileIdHashtable, &fileId)))
+    {
+        memcpy(Entry->Hash, existingFileId->Entry->Hash, 32);
+        status = STATUS_SUCCESS;
+    }
+    else
+    {
+        if (NT_SUCCESS(status = PhGetFileSize(fileHandle, &fileSize)))
+            status = HashFile(Entry->FileName, fileHandle, fileSize.QuadPart, FALSE, Entry->Hash);
+
+        if (NT_SUCCESS(status) && haveKey)
+        {
+            fileId.Entry = Entry;
+            PhAddEntryHashtable(FileIdHashtable, &fileId);
+        }
+    }
+
+    NtClose(fileHandle);
+
+    if (!NT_SUCCESS(status))
+    {
+        Entry->State = SCAN_ENTRY_ERROR;
+        return;
+    }
+
+    Entry->HashString = PhBufferToHexString(Entry->Hash, 32);
+
+    if (LookupScanResultCache(Entry->Hash, &result))
+        ApplyScanResult(Entry, &result);
+    else
+        Entry->State = SCAN_ENTRY_HASHED;
+}
+
+static VOID ParseScanReportObject(
+    _In_ json_object_ptr ReportObject,
+    _In_ PLARGE_INTEGER QueryTime
+    )
+{
+    PSTR resource;
+    PPH_STRING resourceString;
+    SCAN_RESULT result;
+
+    if (!(resource = json_object_get_string(json_get_object(ReportObject, "resource"))))
+        return;
+
+    resourceString = PhZeroExtendToUtf16(resource);
+
+    if (resourceString->Length == 64 * sizeof(WCHAR) && PhHexStringToBuffer(&resourceString->sr, result.Hash))
+    {
+        // A response code of 1 means that the service has a report for the file.
+        if (json_object_get_int(json_get_object(ReportObject, "response_code")) == 1)
+        {
+            result.Positives = json_object_get_int(json_get_object(ReportObject, "positives"));
+            result.Total = json_object_get_int(json_get_object(ReportObject, "total"));
+        }
+        else
+        {
+            result.Positives = 0;
+            result.Total = 0;
+        }
+
+        result.QueryTime = *QueryTime;
+        UpdateScanResultCache(&result);
+    }
+
+    PhDereferenceObject(resourceString);
+}
+
+static BOOLEAN ParseScanReport(
+    _In_ PSTR Data
+    )
+{
+    json_object_ptr rootJsonObject;
+    LARGE_INTEGER queryTime;
+
+    if (!(rootJsonObject = json_tokener_parse(Data)))
+        return FALSE;
+
+    PhQuerySystemTime(&queryTime);
+
+    // The response is an array if more than one resource was requested.
+    if (json_object_is_type(rootJsonObject, json_type_array))
+    {
+        INT i;
+
+        for (i = 0; i < json_object_array_length(rootJsonObject); i++)
+            ParseScanReportObject(json_object_array_get_idx(rootJsonObject, i), &queryTime);
+    }
+    else
+    {
+        ParseScanReportObject(rootJsonObject, &queryTime);
+    }
+
+    json_object_put(rootJsonObject);
+
+    return TRUE;
+}
+
+static BOOLEAN QueryScanBatch(
+    _In_ HINTERNET ConnectHandle,
+    _In_ PPH_STRING ApiKey,
+    _In_reads_(Count) PSCAN_ENTRY *Entries,
+    _In_ ULONG Count,
+    _Out_ PULONG StatusCode
+    )
+{
+    BOOLEAN result = FALSE;
+    HINTERNET requestHandle = NULL;
+    PH_STRING_BUILDER stringBuilder;
+    PPH_BYTES requestData;
+    ULONG statusCode = 0;
+    ULONG statusCodeLength = sizeof(ULONG);
+    PSTR data;
+    ULONG dataLength;
+    ULONG i;
+
+    PhInitializeStringBuilder(&stringBuilder, 100 + Count * 65);
+    PhAppendStringBuilder2(&stringBuilder, L"apikey=");
+    PhAppendStringBuilder(&stringBuilder, &ApiKey->sr);
+    PhAppendStringBuilder2(&stringBuilder, L"&resource=");
+
+    for (i = 0; i < Count; i++)
+    {
+        if (i != 0)
+            PhAppendCharStringBuilder(&stringBuilder, ',');
+
+        PhAppendStringBuilder(&stringBuilder, &Entries[i]->HashString->sr);
+    }
+
+    requestData = PhConvertUtf16ToUtf8(stringBuilder.String->Buffer);
+    PhDeleteStringBuilder(&stringBuilder);
+
+    __try
+    {
+        if (!(requestHandle = WinHttpOpenRequest(
+            ConnectHandle,
+            L"POST",
+            L"/vtapi/v2/file/report",
+            NULL,
+            WINHTTP_NO_REFERER,
+            WINHTTP_DEFAULT_ACCEPT_TYPES,
+            WINHTTP_FLAG_REFRESH | WINHTTP_FLAG_SECURE
+            )))
+        {
+            __leave;
+        }
+
+        if (!WinHttpSendRequest(
+            requestHandle,
+            L"Content-Type: application/x-www-form-urlencoded",
+            -1L,
+            requestData->Buffer,
+            (ULONG)requestData->Length,
+            (ULONG)requestData->Length,
+            0
+            ))
+        {
+            __leave;
+        }
+
+        if (!WinHttpReceiveResponse(requestHandle, NULL))
+            __leave;
+
+        if (!WinHttpQueryHeaders(
+            requestHandle,
+            WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER,
+            WINHTTP_HEADER_NAME_BY_INDEX,
+            &statusCode,
+            &statusCodeLength,
+            WINHTTP_NO_HEADER_INDEX
+            ))
+        {
+            __leave;
+        }
+
+        if (statusCode == HTTP_STATUS_OK)
+        {
+            if (!ReadRequestString(requestHandle, &data, &dataLength))
+                __leave;
+
+            result = ParseScanReport(data);
+            PhFree(data);
+        }
+    }
+    __finally
+    {
+        // Closing the request handle doesn't close the connection; WinHTTP keeps it
+        // alive for the next request.
+        if (requestHandle)
+            WinHttpCloseHandle(requestHandle);
+
+        PhDereferenceObject(requestData);
+    }
+
+    *StatusCode = statusCode;
+
+    return result;
+}
+
+static VOID ResolveScanEntries(
+    _In_ PSCAN_CONTEXT Context
+    )
+{
+    ULONG i;
+    SCAN_RESULT result;
+
+    // This also resolves entries of other files with the same contents.
+    for (i = 0; i < Context->EntryList->Count; i++)
+    {
+        PSCAN_ENTRY entry = Context->EntryList->Items[i];
+
+        if (entry->State == SCAN_ENTRY_HASHED && LookupScanResultCache(entry->Hash, &result))
+        {
+            ApplyScanResult(entry, &result);
+            PostMessage(Context->DialogHandle, UM_SCAN_UPDATE, 0, (LPARAM)entry);
+        }
+    }
+}
+
+static BOOLEAN NTAPI ScanEntryHashCompareFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    )
+{
+    return RtlEqualMemory((*(PSCAN_ENTRY *)Entry1)->Hash, (*(PSCAN_ENTRY *)Entry2)->Hash, 32);
+}
+
+static ULONG NTAPI ScanEntryHashHashFunction(
+    _In_ PVOID Entry
+    )
+{
+    return *(PULONG)(*(PSCAN_ENTRY *)Entry)->Hash;
+}
+
+static VOID QueryScanEntries(
+    _In_ PSCAN_CONTEXT Context
+    )
+{
+    PPH_HASHTABLE hashHashtable;
+    PPH_LIST queryList;
+    PPH_STRING apiKey = NULL;
+    HINTERNET httpHandle = NULL;
+    HINTERNET connectHandle = NULL;
+    ULONG waitInterval;
+    ULONG statusCode;
+    ULONG count;
+    ULONG i;
+
+    // Each distinct hash is only sent once.
+
+    hashHashtable = PhCreateHashtable(
+        sizeof(PSCAN_ENTRY),
+        ScanEntryHashCompareFunction,
+        ScanEntryHashHashFunction,
+        256
+        );
+    queryList = PhCreateList(256);
+
+    for (i = 0; i < Context->EntryList->Count; i++)
+    {
+        PSCAN_ENTRY entry = Context->EntryList->Items[i];
+        BOOLEAN added;
+
+        if (entry->State != SCAN_ENTRY_HASHED)
+            continue;
+
+        PhAddEntryHashtableEx(hashHashtable, &entry, &added);
+
+        if (added)
+            PhAddItemList(queryList, entry);
+    }
+
+    Context->NumberOfQueries = queryList->Count;
+
+    if (queryList->Count == 0)
+        goto CleanupExit;
+
+    apiKey = PhGetStringSetting(SETTING_NAME_VIRUSTOTAL_API_KEY);
+
+    if (apiKey->Length == 0)
+    {
+        Context->ErrorMessage = PhCreateString(
+            L"Some files have not been checked because no VirusTotal API key is set. "
+            L"Set " SETTING_NAME_VIRUSTOTAL_API_KEY L" to your API key to check them."
+            );
+        goto CleanupExit;
+    }
+
+    // All batches are sent over the same connection.
+
+    if (!(httpHandle = CreateHttpSession()) ||
+        !(connectHandle = WinHttpConnect(httpHandle, L"www.virustotal.com", INTERNET_DEFAULT_HTTPS_PORT, 0)))
+    {
+        Context->ErrorMessage = PhFormatString(L"Unable to connect to the service: [%lu]", GetLastError());
+        goto CleanupExit;
+    }
+
+    Context->Phase = SCAN_PHASE_QUERYING;
+    PostMessage(Context->DialogHandle, UM_SCAN_UPDATE, 0, 0);
+
+    waitInterval = 0;
+    i = 0;
+
+    while (i < queryList->Count)
+    {
+        if (waitInterval != 0 && !WaitForScanInterval(Context, waitInterval))
+            break;
+
+        count = min(queryList->Count - i, SCAN_BATCH_SIZE);
+
+        if (!QueryScanBatch(connectHandle, apiKey, (PSCAN_ENTRY *)queryList->Items + i, count, &statusCode))
+        {
+            if (statusCode == HTTP_STATUS_NO_CONTENT)
+            {
+                // We have exceeded the request limit. Wait and try the same batch again.
+                Context->Phase = SCAN_PHASE_WAITING;
+                PostMessage(Context->DialogHandle, UM_SCAN_UPDATE, 0, 0);
+                waitInterval = SCAN_RATE_LIMIT_INTERVAL;
+                continue;
+            }
+
+            if (statusCode == HTTP_STATUS_FORBIDDEN)
+                Context->ErrorMessage = PhCreateString(L"The VirusTotal API key was rejected.");
+            else if (statusCode != 0)
+                Context->ErrorMessage = PhFormatString(L"The service returned an error: [%lu]", statusCode);
+            else
+                Context->ErrorMessage = PhFormatString(L"Unable to query the service: [%lu]", GetLastError());
+
+            break;
+        }
+
+        i += count;
+        Context->NumberOfQueried = i;
+        Context->Phase = SCAN_PHASE_QUERYING;
+        ResolveScanEntries(Context);
+        PostMessage(Context->DialogHandle, UM_SCAN_UPDATE, 0, 0);
+
+        waitInterval = SCAN_REQUEST_INTERVAL;
+    }
+
+CleanupExit:
+    if (connectHandle)
+        WinHttpCloseHandle(connectHandle);
+    if (httpHandle)
+        WinHttpCloseHandle(httpHandle);
+
+    PhClearReference(&apiKey);
+    PhDereferenceObject(queryList);
+    PhDereferenceObject(hashHashtable);
+}
+
+static NTSTATUS ScanThreadStart(
+    _In_ PVOID Parameter
+    )
+{
+    PSCAN_CONTEXT context = Parameter;
+    PPH_HASHTABLE fileIdHashtable;
+    LARGE_INTEGER timeout;
+    BOOLEAN cancelled = FALSE;
+    ULONG i;
+
+    InitializeScanResultCache();
+
+    CollectScanEntries(context);
+    context->Phase = SCAN_PHASE_HASHING;
+    PostMessage(context->DialogHandle, UM_SCAN_ENTRIES, 0, 0);
+
+    fileIdHashtable = PhCreateHashtable(
+        sizeof(SCAN_FILE_ID),
+        ScanFileIdCompareFunction,
+        ScanFileIdHashFunction,
+        256
+        );
+
+    for (i = 0; i < context->EntryList->Count; i++)
+    {
+        PSCAN_ENTRY entry = context->EntryList->Items[i];
+
+        if (NtWaitForSingleObject(context->CancelEvent, FALSE, PhTimeoutFromMilliseconds(&timeout, 0)) == STATUS_WAIT_0)
+        {
+            cancelled = TRUE;
+            break;
+        }
+
+        HashScanEntry(fileIdHashtable, entry);
+        context->NumberOfHashed++;
+        PostMessage(context->DialogHandle, UM_SCAN_UPDATE, 0, (LPARAM)entry);
+    }
+
+    PhDereferenceObject(fileIdHashtable);
+
+    if (!cancelled)
+        QueryScanEntries(context);
+
+    SaveScanResultCache();
+
+    context->Phase = SCAN_PHASE_COMPLETED;
+    PostMessage(context->DialogHandle, UM_SCAN_UPDATE, 0, 0);
+
+    ReleaseScanContext(context);
+
+    return STATUS_SUCCESS;
+}
+
+static VOID UpdateScanEntryItem(
+    _In_ PSCAN_CONTEXT Context,
+    _In_ PSCAN_ENTRY Entry
+    )
+{
+    INT lvItemIndex;
+    WCHAR text[PH_INT32_STR_LEN_1 * 2 + 4];
+
+    lvItemIndex = PhFindListViewItemByParam(Context->ListViewHandle, -1, Entry);
+
+    if (lvItemIndex == -1)
+        return;
+
+    switch (Entry->State)
+    {
+    case SCAN_ENTRY_PENDING:
+        text[0] = 0;
+        break;
+    case SCAN_ENTRY_HASHED:
+        wcscpy_s(text, ARRAYSIZE(text), L"Not checked");
+        break;
+    case SCAN_ENTRY_FOUND:
+        swprintf_s(text, ARRAYSIZE(text), L"%ld / %ld", Entry->Positives, Entry->Total);
+        break;
+    case SCAN_ENTRY_UNKNOWN:
+        wcscpy_s(text, ARRAYSIZE(text), L"Unknown");
+        break;
+    case SCAN_ENTRY_ERROR:
+        wcscpy_s(text, ARRAYSIZE(text), L"Error");
+        break;
+    }
+
+    PhSetListViewSubItem(Context->ListViewHandle, lvItemIndex, 1, text);
+
+    if (Entry->HashString)
+        PhSetListViewSubItem(Context->ListViewHandle, lvItemIndex, 3, Entry->HashString->Buffer);
+}
+
+static VOID UpdateScanStatus(
+    _In_ PSCAN_CONTEXT Context
+    )
+{
+    PPH_STRING statusText;
+    ULONG numberOfDetected;
+    ULONG i;
+
+    switch (Context->Phase)
+    {
+    case SCAN_PHASE_ENUMERATING:
+        statusText = PhCreateString(L"Enumerating processes...");
+        break;
+    case SCAN_PHASE_HASHING:
+        statusText = PhFormatString(L"Hashing files (%lu of %lu)...", Context->NumberOfHashed, Context->EntryList->Count);
+        break;
+    case SCAN_PHASE_QUERYING:
+        statusText = PhFormatString(L"Querying VirusTotal (%lu of %lu)...", Context->NumberOfQueried, Context->NumberOfQueries);
+        break;
+    case SCAN_PHASE_WAITING:
+        statusText = PhFormatString(L"Waiting for the VirusTotal request limit (%lu of %lu)...", Context->NumberOfQueried, Context->NumberOfQueries);
+        break;
+    case SCAN_PHASE_COMPLETED:
+        if (Context->ErrorMessage)
+        {
+            statusText = PhReferenceObject(Context->ErrorMessage);
+        }
+        else
+        {
+            numberOfDetected = 0;
+
+            for (i = 0; i < Context->EntryList->Count; i++)
+            {
+                PSCAN_ENTRY entry = Context->EntryList->Items[i];
+
+                if (entry->State == SCAN_ENTRY_FOUND && entry->Positives != 0)
+                    numberOfDetected++;
+            }
+
+            statusText = PhFormatString(L"Checked %lu files; %lu have detections.", Context->EntryList->Count, numberOfDetected);
+        }
+        break;
+    default:
+        return;
+    }
+
+    Static_SetText(Context->StatusHandle, statusText->Buffer);
+    PhDereferenceObject(statusText);
+}
+
+static INT_PTR CALLBACK ScanAllDlgProc(
+    _In_ HWND hwndDlg,
+    _In_ UINT uMsg,
+    _In_ WPARAM wParam,
+    _In_ LPARAM lParam
+    )
+{
+    PSCAN_CONTEXT context = NULL;
+
+    if (uMsg == WM_INITDIALOG)
+    {
+        context = (PSCAN_CONTEXT)lParam;
+        SetProp(hwndDlg, L"Context", (HANDLE)context);
+    }
+    else
+    {
+        context = (PSCAN_CONTEXT)GetProp(hwndDlg, L"Context");
+
+        if (uMsg == WM_NCDESTROY)
+        {
+            // Tell the scan thread to stop; it holds its own reference to the context.
+            NtSetEvent(context->CancelEvent, NULL);
+            PhDeleteLayoutManager(&context->LayoutManager);
+            ScanAllDialogHandle = NULL;
+
+            RemoveProp(hwndDlg, L"Context");
+            ReleaseScanContext(context);
+        }
+    }
+
+    if (!context)
+        return FALSE;
+
+    switch (uMsg)
+    {
+    case WM_INITDIALOG:
+        {
+            HANDLE scanThread;
+
+            context->DialogHandle = hwndDlg;
+            context->ListViewHandle = GetDlgItem(hwndDlg, IDC_FILELIST);
+            context->StatusHandle = GetDlgItem(hwndDlg, IDC_STATUS);
+            ScanAllDialogHandle = hwndDlg;
+
+            PhCenterWindow(hwndDlg, PhMainWndHandle);
+
+            PhSetListViewStyle(context->ListViewHandle, FALSE, TRUE);
+            PhSetControlTheme(context->ListViewHandle, L"explorer");
+            PhAddListViewColumn(context->ListViewHandle, 0, 0, 0, LVCFMT_LEFT, 140, L"Name");
+            PhAddListViewColumn(context->ListViewHandle, 1, 1, 1, LVCFMT_LEFT, 80, L"Detections");
+            PhAddListViewColumn(context->ListViewHandle, 2, 2, 2, LVCFMT_LEFT, 240, L"File name");
+            PhAddListViewColumn(context->ListViewHandle, 3, 3, 3, LVCFMT_LEFT, 160, L"SHA-256");
+            PhSetExtendedListView(context->ListViewHandle);
+
+            PhInitializeLayoutManager(&context->LayoutManager, hwndDlg);
+            PhAddLayoutItem(&context->LayoutManager, context->ListViewHandle, NULL, PH_ANCHOR_ALL);
+            PhAddLayoutItem(&context->LayoutManager, context->StatusHandle, NULL, PH_ANCHOR_LEFT | PH_ANCHOR_RIGHT | PH_ANCHOR_BOTTOM);
+            PhAddLayoutItem(&context->LayoutManager, GetDlgItem(hwndDlg, IDCANCEL), NULL, PH_ANCHOR_RIGHT | PH_ANCHOR_BOTTOM);
+
+            UpdateScanStatus(context);
+
+            _InterlockedIncrement(&context->RefCount);
+
+            if (scanThread = PhCreateThread(0, ScanThreadStart, context))
+                NtClose(scanThread);
+            else
+                ReleaseScanContext(context);
+        }
+        break;
+    case WM_SIZE:
+        {
+            PhLayoutManagerLayout(&context->LayoutManager);
+        }
+        break;
+    case WM_COMMAND:
+        {
+            switch (LOWORD(wParam))
+            {
+            case IDCANCEL:
+                PostQuitMessage(0);
+                break;
+            }
+        }
+        break;
+    case WM_NOTIFY:
+        {
+            LPNMHDR header = (LPNMHDR)lParam;
+
+            if (header->hwndFrom == context->ListViewHandle && header->code == NM_DBLCLK)
+            {
+                PSCAN_ENTRY entry;
+
+                if ((entry = PhGetSelectedListViewItemParam(context->ListViewHandle)) && entry->HashString)
+                {
+                    PPH_STRING url;
+
+                    url = PhFormatString(L"http://www.virustotal.com/file/%s/analysis/", entry->HashString->Buffer);
+                    PhShellExecute(hwndDlg, url->Buffer, NULL);
+                    PhDereferenceObject(url);
+                }
+            }
+        }
+        break;
+    case UM_SCAN_ENTRIES:
+        {
+            ULONG i;
+
+            ExtendedListView_SetRedraw(context->ListViewHandle, FALSE);
+
+            for (i = 0; i < context->EntryList->Count; i++)
+            {
+                PSCAN_ENTRY entry = context->EntryList->Items[i];
+                INT lvItemIndex;
+
+                lvItemIndex = PhAddListViewItem(context->ListViewHandle, MAXINT, entry->BaseName->Buffer, entry);
+                PhSetListViewSubItem(context->ListViewHandle, lvItemIndex, 2, entry->FileName->Buffer);
+            }
+
+            ExtendedListView_SetRedraw(context->ListViewHandle, TRUE);
+
+            UpdateScanStatus(context);
+        }
+        break;
+    case UM_SCAN_UPDATE:
+        {
+            PSCAN_ENTRY entry = (PSCAN_ENTRY)lParam;
+
+            if (entry)
+                UpdateScanEntryItem(context, entry);
+
+            UpdateScanStatus(context);
+        }
+        break;
+    }
+
+    return FALSE;
+}
+
+static NTSTATUS ScanAllDialogThreadStart(
+    _In_ PVOID Parameter
+    )
+{
+    BOOL result;
+    MSG message;
+    HWND dialogHandle;
+    PH_AUTO_POOL autoPool;
+
+    PhInitializeAutoPool(&autoPool);
+
+    dialogHandle = CreateDialogParam(
+        PluginInstance->DllBase,
+        MAKEINTRESOURCE(IDD_SCANALL),
+        PhMainWndHandle,
+        ScanAllDlgProc,
+        (LPARAM)Parameter
+        );
+
+    ShowWindow(dialogHandle, SW_SHOW);
+    SetForegroundWindow(dialogHandle);
+
+    while (result = GetMessage(&message, NULL, 0, 0))
+    {
+        if (result == -1)
+            break;
+
+        if (!IsDialogMessage(dialogHandle, &message))
+        {
+            TranslateMessage(&message);
+            DispatchMessage(&message);
+        }
+
+        PhDrainAutoPool(&autoPool);
+    }
+
+    PhDeleteAutoPool(&autoPool);
+    DestroyWindow(dialogHandle);
+
+    return STATUS_SUCCESS;
+}
+
+VOID ShowScanAllDialog(
+    VOID
+    )
+{
+    HANDLE dialogThread;
+    PSCAN_CONTEXT context;
+
+    if (ScanAllDialogHandle)
+    {
+        if (IsIconic(ScanAllDialogHandle))
+            ShowWindow(ScanAllDialogHandle, SW_RESTORE);
+
+        SetForegroundWindow(ScanAllDialogHandle);
+        return;
+    }
+
+    context = PhAllocate(sizeof(SCAN_CONTEXT));
+    memset(context, 0, sizeof(SCAN_CONTEXT));
+    context->RefCount = 1;
+    context->EntryList = PhCreateList(256);
+    NtCreateEvent(&context->CancelEvent, EVENT_ALL_ACCESS, NULL, NotificationEvent, FALSE);
+
+    if (dialogThread = PhCreateThread(0, ScanAllDialogThreadStart, context))
+        NtClose(dialogThread);
+    else
+        ReleaseScanContext(context);
+}
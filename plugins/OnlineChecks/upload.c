@@ -84,7 +84,7 @@ static HFONT InitializeFont(
     return NULL;
 }
 
-static BOOL ReadRequestString(
+BOOL ReadRequestString(
     _In_ HINTERNET Handle,
     _Out_ _Deref_post_z_cap_(*DataLength) PSTR *Data,
     _Out_ ULONG *DataLength
@@ -137,6 +137,58 @@ static BOOL ReadRequestString(
     return TRUE;
 }
 
+/**
+ * Opens a WinHTTP session which uses the system proxy configuration.
+ *
+ * \return A session handle, or NULL if the session could not be opened.
+ */
+HINTERNET CreateHttpSession(
+    VOID
+    )
+{
+    HINTERNET httpHandle;
+    PPH_STRING phVersion = NULL;
+    PPH_STRING userAgent = NULL;
+    WINHTTP_CURRENT_USER_IE_PROXY_CONFIG proxyConfig = { 0 };
+
+    // Create a user agent string.
+    phVersion = PhGetPhVersion();
+    userAgent = PhConcatStrings2(L"ProcessHacker_", phVersion->Buffer);
+
+    // Query the current system proxy
+    WinHttpGetIEProxyConfigForCurrentUser(&proxyConfig);
+
+    // Open the HTTP session with the system proxy configuration if available
+    httpHandle = WinHttpOpen(
+        userAgent->Buffer,
+        proxyConfig.lpszProxy != NULL ? WINHTTP_ACCESS_TYPE_NAMED_PROXY : WINHTTP_ACCESS_TYPE_DEFAULT_PROXY,
+        proxyConfig.lpszProxy,
+        proxyConfig.lpszProxyBypass,
+        0
+        );
+
+    PhClearReference(&phVersion);
+    PhClearReference(&userAgent);
+
+    if (!httpHandle)
+        return NULL;
+
+    if (WindowsVersion >= WINDOWS_8_1)
+    {
+        // Enable GZIP and DEFLATE support on Windows 8.1 and above using undocumented flags.
+        ULONG httpFlags = WINHTTP_DECOMPRESSION_FLAG_GZIP | WINHTTP_DECOMPRESSION_FLAG_DEFLATE;
+
+        WinHttpSetOption(
+            httpHandle,
+            WINHTTP_OPTION_DECOMPRESSION,
+            &httpFlags,
+            sizeof(ULONG)
+            );
+    }
+
+    return httpHandle;
+}
+
 static VOID RaiseUploadError(
     _In_ PUPLOAD_CONTEXT Context,
     _In_ PWSTR Error,
@@ -290,91 +342,6 @@ static BOOLEAN PerformSubRequest(
     return result;
 }
 
-static NTSTATUS HashFileAndResetPosition(
-    _In_ HANDLE FileHandle,
-    _In_ PLARGE_INTEGER FileSize,
-    _In_ ULONG Algorithm,
-    _Out_ PVOID Hash
-    )
-{
-    NTSTATUS status;
-    IO_STATUS_BLOCK iosb;
-    PH_HASH_CONTEXT hashContext;
-    sha256_context sha256;
-    ULONG64 bytesRemaining;
-    FILE_POSITION_INFORMATION positionInfo;
-    UCHAR buffer[PAGE_SIZE];
-
-    bytesRemaining = FileSize->QuadPart;
-
-    switch (Algorithm)
-    {
-    case HASH_SHA1:
-        PhInitializeHash(&hashContext, Sha1HashAlgorithm);
-        break;
-    case HASH_SHA256:
-        sha256_starts(&sha256);
-        break;
-    }
-
-    while (bytesRemaining)
-    {
-        status = NtReadFile(
-            FileHandle,
-            NULL,
-            NULL,
-            NULL,
-            &iosb,
-            buffer,
-            sizeof(buffer),
-            NULL,
-            NULL
-            );
-
-        if (!NT_SUCCESS(status))
-            break;
-
-        switch (Algorithm)
-        {
-        case HASH_SHA1:
-            PhUpdateHash(&hashContext, buffer, (ULONG)iosb.Information);
-            break;
-        case HASH_SHA256:
-            sha256_update(&sha256, (PUCHAR)buffer, (ULONG)iosb.Information);
-            break;
-        }
-
-        bytesRemaining -= (ULONG)iosb.Information;
-    }
-
-    if (status == STATUS_END_OF_FILE)
-        status = STATUS_SUCCESS;
-
-    if (NT_SUCCESS(status))
-    {
-        switch (Algorithm)
-        {
-        case HASH_SHA1:
-            PhFinalHash(&hashContext, Hash, 20, NULL);
-            break;
-        case HASH_SHA256:
-            sha256_finish(&sha256, Hash);
-            break;
-        }
-
-        positionInfo.CurrentByteOffset.QuadPart = 0;
-        status = NtSetInformationFile(
-            FileHandle,
-            &iosb,
-            &positionInfo,
-            sizeof(FILE_POSITION_INFORMATION),
-            FilePositionInformation
-            );
-    }
-
-    return status;
-}
-
 static NTSTATUS UploadFileThreadStart(
     _In_ PVOID Parameter
     )
@@ -394,7 +361,12 @@ static NTSTATUS UploadFileThreadStart(
     ULONG64 timeBitsPerSecond = 0;
 
     HANDLE fileHandle = INVALID_HANDLE_VALUE;
-    IO_STATUS_BLOCK isb;
+    FILE_STREAM fileStream = { 0 };
+    FILE_HASH_KEY fileKey;
+    BOOLEAN haveFileKey;
+    PH_HASH_CONTEXT hashContext;
+    PVOID readBuffer;
+    ULONG readLength;
     PSERVICE_INFO serviceInfo = NULL;
     HINTERNET connectHandle = NULL;
     HINTERNET requestHandle = NULL;
@@ -405,7 +377,6 @@ static NTSTATUS UploadFileThreadStart(
     PH_STRING_BUILDER httpRequestHeaders = { 0 };
     PH_STRING_BUILDER httpPostHeader = { 0 };
     PH_STRING_BUILDER httpPostFooter = { 0 };
-    BYTE buffer[PAGE_SIZE];
 
     PUPLOAD_CONTEXT context = (PUPLOAD_CONTEXT)Parameter;
 
@@ -421,7 +392,7 @@ static NTSTATUS UploadFileThreadStart(
             0,
             FILE_SHARE_READ | FILE_SHARE_DELETE,
             FILE_OPEN,
-            FILE_NON_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT
+            FILE_NON_DIRECTORY_FILE | FILE_SEQUENTIAL_ONLY
             );
 
         if (!NT_SUCCESS(status))
@@ -430,6 +401,18 @@ static NTSTATUS UploadFileThreadStart(
             __leave;
         }
 
+        // The data is hashed as it is sent, so repeat checks of this file don't have to read
+        // it again.
+        haveFileKey = NT_SUCCESS(QueryFileHashKey(fileHandle, &fileKey));
+
+        if (!NT_SUCCESS(status = InitializeFileStream(&fileStream, fileHandle, context->TotalFileLength)))
+        {
+            RaiseUploadError(context, L"Unable to read the file", RtlNtStatusToDosError(status));
+            __leave;
+        }
+
+        PhInitializeHash(&hashContext, Sha256HashAlgorithm);
+
         // Connect to the online service.
         if (!(connectHandle = WinHttpConnect(
             context->HttpHandle,
@@ -601,25 +584,27 @@ static NTSTATUS UploadFileThreadStart(
             __leave;
         }
 
-        // Upload the file...
+        // Upload the file... The next read is already in progress while the current
+        // buffer is being sent.
         while (TRUE)
         {
-            status = NtReadFile(
-                fileHandle,
-                NULL,
-                NULL,
-                NULL,
-                &isb,
-                buffer,
-                PAGE_SIZE,
-                NULL,
-                NULL
-                );
+            status = ReadFileStream(&fileStream, &readBuffer, &readLength);
 
-            if (!NT_SUCCESS(status))
+            if (status == STATUS_END_OF_FILE)
+            {
+                status = STATUS_SUCCESS;
                 break;
+            }
+
+            if (!NT_SUCCESS(status))
+            {
+                RaiseUploadError(context, L"Unable to read the file", RtlNtStatusToDosError(status));
+                __leave;
+            }
 
-            if (!WinHttpWriteData(requestHandle, buffer, (ULONG)isb.Information, &totalWriteLength))
+            PhUpdateHash(&hashContext, readBuffer, readLength);
+
+            if (!WinHttpWriteData(requestHandle, readBuffer, readLength, &totalWriteLength))
             {
                 RaiseUploadError(context, L"Unable to upload the file data", GetLastError());
                 __leave;
@@ -659,6 +644,21 @@ static NTSTATUS UploadFileThreadStart(
             }
         }
 
+        if (haveFileKey)
+        {
+            FILE_HASH_KEY currentFileKey;
+            UCHAR hash[32];
+
+            PhFinalHash(&hashContext, hash, 32, NULL);
+
+            // Only remember the hash if the file didn't change while it was being sent.
+            if (NT_SUCCESS(QueryFileHashKey(fileHandle, &currentFileKey)) &&
+                RtlEqualMemory(&currentFileKey, &fileKey, sizeof(FILE_HASH_KEY)))
+            {
+                UpdateFileHashCache(context->FileName, &fileKey, hash);
+            }
+        }
+
         // Write the footer bytes
         if (!WinHttpWriteData(
             requestHandle,
@@ -824,6 +824,11 @@ static NTSTATUS UploadFileThreadStart(
             PhDeleteStringBuilder(&httpRequestHeaders);
         }
 
+        if (fileStream.FileHandle)
+        {
+            DeleteFileStream(&fileStream);
+        }
+
         if (fileHandle != INVALID_HANDLE_VALUE)
         {
             NtClose(fileHandle);
@@ -862,7 +867,7 @@ static NTSTATUS UploadCheckThreadStart(
             0,
             FILE_SHARE_READ | FILE_SHARE_DELETE,
             FILE_OPEN,
-            FILE_NON_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT
+            FILE_NON_DIRECTORY_FILE | FILE_SEQUENTIAL_ONLY
             );
 
         if (!NT_SUCCESS(status))
@@ -893,47 +898,9 @@ static NTSTATUS UploadCheckThreadStart(
             context->TotalFileLength = fileSize64.LowPart;
         }
 
-        // Get proxy configuration and create winhttp handle (used for all winhttp sessions + requests).
-        {
-            PPH_STRING phVersion = NULL;
-            PPH_STRING userAgent = NULL;
-            WINHTTP_CURRENT_USER_IE_PROXY_CONFIG proxyConfig = { 0 };
-
-            // Create a user agent string.
-            phVersion = PhGetPhVersion();
-            userAgent = PhConcatStrings2(L"ProcessHacker_", phVersion->Buffer);
-
-            // Query the current system proxy
-            WinHttpGetIEProxyConfigForCurrentUser(&proxyConfig);
-
-            // Open the HTTP session with the system proxy configuration if available
-            context->HttpHandle = WinHttpOpen(
-                userAgent->Buffer,
-                proxyConfig.lpszProxy != NULL ? WINHTTP_ACCESS_TYPE_NAMED_PROXY : WINHTTP_ACCESS_TYPE_DEFAULT_PROXY,
-                proxyConfig.lpszProxy,
-                proxyConfig.lpszProxyBypass,
-                0
-                );
-
-            PhClearReference(&phVersion);
-            PhClearReference(&userAgent);
-
-            if (!context->HttpHandle)
-                __leave;
-
-            if (WindowsVersion >= WINDOWS_8_1)
-            {
-                // Enable GZIP and DEFLATE support on Windows 8.1 and above using undocumented flags.
-                ULONG httpFlags = WINHTTP_DECOMPRESSION_FLAG_GZIP | WINHTTP_DECOMPRESSION_FLAG_DEFLATE;
-
-                WinHttpSetOption(
-                    context->HttpHandle,
-                    WINHTTP_OPTION_DECOMPRESSION,
-                    &httpFlags,
-                    sizeof(ULONG)
-                    );
-            }
-        }
+        // Create the winhttp handle (used for all winhttp sessions + requests).
+        if (!(context->HttpHandle = CreateHttpSession()))
+            __leave;
 
         switch (context->Service)
         {
@@ -945,7 +912,7 @@ static NTSTATUS UploadCheckThreadStart(
                 UCHAR hash[32];
                 json_object_ptr rootJsonObject;
 
-                if (!NT_SUCCESS(status = HashFileAndResetPosition(fileHandle, &fileSize64, HASH_SHA256, hash)))
+                if (!NT_SUCCESS(status = HashFile(context->FileName, fileHandle, fileSize64.QuadPart, TRUE, hash)))
                 {
                     RaiseUploadError(context, L"Unable to hash the file", RtlNtStatusToDosError(status));
                     __leave;
@@ -1006,7 +973,7 @@ static NTSTATUS UploadCheckThreadStart(
                 ULONG status = 0;
                 ULONG statusLength = sizeof(statusLength);
 
-                if (!NT_SUCCESS(status = HashFileAndResetPosition(fileHandle, &fileSize64, HASH_SHA256, hash)))
+                if (!NT_SUCCESS(status = HashFile(context->FileName, fileHandle, fileSize64.QuadPart, TRUE, hash)))
                 {
                     RaiseUploadError(context, L"Unable to hash the file", RtlNtStatusToDosError(status));
                     __leave;
@@ -37,6 +37,12 @@ typedef struct _BOXED_PROCESS
     WCHAR BoxName[34];
 } BOXED_PROCESS, *PBOXED_PROCESS;
 
+typedef struct _SBIE_PROCESS_EXTENSION
+{
+    BOOLEAN IsBoxed;
+    WCHAR BoxName[34];
+} SBIE_PROCESS_EXTENSION, *PSBIE_PROCESS_EXTENSION;
+
 VOID NTAPI LoadCallback(
     _In_opt_ PVOID Parameter,
     _In_opt_ PVOID Context
@@ -82,6 +88,12 @@ VOID NTAPI RefreshSandboxieInfo(
     _In_ BOOLEAN TimerOrWaitFired
     );
 
+VOID NTAPI ProcessItemCreateCallback(
+    _In_ PVOID Object,
+    _In_ PH_EM_OBJECT_TYPE ObjectType,
+    _In_ PVOID Extension
+    );
+
 INT_PTR CALLBACK OptionsDlgProc(
     _In_ HWND hwndDlg,
     _In_ UINT uMsg,
@@ -177,6 +189,14 @@ LOGICAL DllMain(
                 &GetProcessTooltipTextCallbackRegistration
                 );
 
+            PhPluginSetObjectExtension(
+                PluginInstance,
+                EmProcessItemType,
+                sizeof(SBIE_PROCESS_EXTENSION),
+                ProcessItemCreateCallback,
+                NULL
+                );
+
             {
                 static PH_SETTING_CREATE settings[] =
                 {
@@ -207,6 +227,52 @@ ULONG NTAPI BoxedProcessesHashFunction(
     return HandleToUlong(((PBOXED_PROCESS)Entry)->ProcessId) / 4;
 }
 
+PPH_HASHTABLE CreateBoxedProcessesHashtable(
+    VOID
+    )
+{
+    return PhCreateHashtable(
+        sizeof(BOXED_PROCESS),
+        BoxedProcessesCompareFunction,
+        BoxedProcessesHashFunction,
+        32
+        );
+}
+
+BOOLEAN UpdateProcessExtension(
+    _In_ PPH_PROCESS_ITEM ProcessItem,
+    _Inout_ PSBIE_PROCESS_EXTENSION Extension
+    )
+{
+    BOXED_PROCESS lookupBoxedProcess;
+    PBOXED_PROCESS boxedProcess;
+
+    // The caller must hold BoxedProcessesLock. Returns TRUE if the box membership of the
+    // process changed.
+
+    lookupBoxedProcess.ProcessId = ProcessItem->ProcessId;
+    boxedProcess = PhFindEntryHashtable(BoxedProcessesHashtable, &lookupBoxedProcess);
+
+    if (boxedProcess)
+    {
+        if (Extension->IsBoxed && wcscmp(Extension->BoxName, boxedProcess->BoxName) == 0)
+            return FALSE;
+
+        Extension->IsBoxed = TRUE;
+        memcpy(Extension->BoxName, boxedProcess->BoxName, sizeof(Extension->BoxName));
+    }
+    else
+    {
+        if (!Extension->IsBoxed)
+            return FALSE;
+
+        Extension->IsBoxed = FALSE;
+        Extension->BoxName[0] = 0;
+    }
+
+    return TRUE;
+}
+
 VOID NTAPI LoadCallback(
     _In_opt_ PVOID Parameter,
     _In_opt_ PVOID Context
@@ -217,12 +283,7 @@ VOID NTAPI LoadCallback(
     HANDLE timerQueueHandle;
     HANDLE timerHandle;
 
-    BoxedProcessesHashtable = PhCreateHashtable(
-        sizeof(BOXED_PROCESS),
-        BoxedProcessesCompareFunction,
-        BoxedProcessesHashFunction,
-        32
-        );
+    BoxedProcessesHashtable = CreateBoxedProcessesHashtable();
 
     sbieDllPath = PhGetStringSetting(SETTING_NAME_SBIE_DLL_PATH);
     module = LoadLibrary(sbieDllPath->Buffer);
@@ -318,29 +379,42 @@ VOID NTAPI ProcessesUpdatedCallback(
     _In_opt_ PVOID Context
     )
 {
-    PBOXED_PROCESS boxedProcess;
-    ULONG enumerationKey = 0;
-
     if (BoxedProcessesUpdated)
     {
-        // Invalidate the nodes of boxed processes (so they use the correct highlighting color).
+        PPH_PROCESS_ITEM *processes;
+        ULONG numberOfProcesses;
+        ULONG i;
+
+        // Copy the new box membership into the process items, and invalidate the nodes of
+        // processes which changed (so they use the correct highlighting color).
+
+        PhEnumProcessItems(&processes, &numberOfProcesses);
 
         PhAcquireQueuedLockShared(&BoxedProcessesLock);
 
         if (BoxedProcessesUpdated)
         {
-            while (PhEnumHashtable(BoxedProcessesHashtable, &boxedProcess, &enumerationKey))
+            for (i = 0; i < numberOfProcesses; i++)
             {
+                PSBIE_PROCESS_EXTENSION extension;
                 PPH_PROCESS_NODE processNode;
 
-                if (processNode = PhFindProcessNode(boxedProcess->ProcessId))
-                    PhUpdateProcessNode(processNode);
+                extension = PhPluginGetObjectExtension(PluginInstance, processes[i], EmProcessItemType);
+
+                if (UpdateProcessExtension(processes[i], extension))
+                {
+                    if (processNode = PhFindProcessNode(processes[i]->ProcessId))
+                        PhUpdateProcessNode(processNode);
+                }
             }
 
             BoxedProcessesUpdated = FALSE;
         }
 
         PhReleaseQueuedLockShared(&BoxedProcessesLock);
+
+        PhDereferenceObjects(processes, numberOfProcesses);
+        PhFree(processes);
     }
 }
 
@@ -350,21 +424,16 @@ VOID NTAPI GetProcessHighlightingColorCallback(
     )
 {
     PPH_PLUGIN_GET_HIGHLIGHTING_COLOR getHighlightingColor = Parameter;
-    BOXED_PROCESS lookupBoxedProcess;
-    PBOXED_PROCESS boxedProcess;
+    PSBIE_PROCESS_EXTENSION extension;
 
-    PhAcquireQueuedLockShared(&BoxedProcessesLock);
+    extension = PhPluginGetObjectExtension(PluginInstance, getHighlightingColor->Parameter, EmProcessItemType);
 
-    lookupBoxedProcess.ProcessId = ((PPH_PROCESS_ITEM)getHighlightingColor->Parameter)->ProcessId;
-
-    if (boxedProcess = PhFindEntryHashtable(BoxedProcessesHashtable, &lookupBoxedProcess))
+    if (extension->IsBoxed)
     {
         getHighlightingColor->BackColor = RGB(0x33, 0x33, 0x00);
         getHighlightingColor->Cache = TRUE;
         getHighlightingColor->Handled = TRUE;
     }
-
-    PhReleaseQueuedLockShared(&BoxedProcessesLock);
 }
 
 VOID NTAPI GetProcessTooltipTextCallback(
@@ -373,19 +442,14 @@ VOID NTAPI GetProcessTooltipTextCallback(
     )
 {
     PPH_PLUGIN_GET_TOOLTIP_TEXT getTooltipText = Parameter;
-    BOXED_PROCESS lookupBoxedProcess;
-    PBOXED_PROCESS boxedProcess;
-
-    PhAcquireQueuedLockShared(&BoxedProcessesLock);
+    PSBIE_PROCESS_EXTENSION extension;
 
-    lookupBoxedProcess.ProcessId = ((PPH_PROCESS_ITEM)getTooltipText->Parameter)->ProcessId;
+    extension = PhPluginGetObjectExtension(PluginInstance, getTooltipText->Parameter, EmProcessItemType);
 
-    if (boxedProcess = PhFindEntryHashtable(BoxedProcessesHashtable, &lookupBoxedProcess))
+    if (extension->IsBoxed)
     {
-        PhAppendFormatStringBuilder(getTooltipText->StringBuilder, L"Sandboxie:\n    Box name: %s\n", boxedProcess->BoxName);
+        PhAppendFormatStringBuilder(getTooltipText->StringBuilder, L"Sandboxie:\n    Box name: %s\n", extension->BoxName);
     }
-
-    PhReleaseQueuedLockShared(&BoxedProcessesLock);
 }
 
 VOID NTAPI RefreshSandboxieInfo(
@@ -397,13 +461,15 @@ VOID NTAPI RefreshSandboxieInfo(
     WCHAR boxName[34];
     ULONG pids[512];
     PBOX_INFO boxInfo;
+    PPH_HASHTABLE newBoxedProcessesHashtable;
+    BOOLEAN changed;
 
     if (!SbieApi_QueryBoxPath || !SbieApi_EnumBoxes || !SbieApi_EnumProcessEx)
         return;
 
-    PhAcquireQueuedLockExclusive(&BoxedProcessesLock);
+    newBoxedProcessesHashtable = CreateBoxedProcessesHashtable();
 
-    PhClearHashtable(BoxedProcessesHashtable);
+    PhAcquireQueuedLockExclusive(&BoxedProcessesLock);
 
     BoxInfoCount = 0;
 
@@ -426,7 +492,7 @@ VOID NTAPI RefreshSandboxieInfo(
                 boxedProcess.ProcessId = UlongToHandle(*pid);
                 memcpy(boxedProcess.BoxName, boxName, sizeof(boxName));
 
-                PhAddEntryHashtable(BoxedProcessesHashtable, &boxedProcess);
+                PhAddEntryHashtable(newBoxedProcessesHashtable, &boxedProcess);
 
                 count--;
                 pid++;
@@ -481,11 +547,63 @@ VOID NTAPI RefreshSandboxieInfo(
         }
     }
 
-    BoxedProcessesUpdated = TRUE;
+    // Only publish the new membership if it changed, so that the process items are
+    // left alone most of the time.
+
+    changed = newBoxedProcessesHashtable->Count != BoxedProcessesHashtable->Count;
+
+    if (!changed)
+    {
+        PBOXED_PROCESS newBoxedProcess;
+        PBOXED_PROCESS boxedProcess;
+        ULONG enumerationKey = 0;
+
+        while (PhEnumHashtable(newBoxedProcessesHashtable, &newBoxedProcess, &enumerationKey))
+        {
+            boxedProcess = PhFindEntryHashtable(BoxedProcessesHashtable, newBoxedProcess);
+
+            if (!boxedProcess || wcscmp(boxedProcess->BoxName, newBoxedProcess->BoxName) != 0)
+            {
+                changed = TRUE;
+                break;
+            }
+        }
+    }
+
+    if (changed)
+    {
+        PhMoveReference(&BoxedProcessesHashtable, newBoxedProcessesHashtable);
+        BoxedProcessesUpdated = TRUE;
+    }
+    else
+    {
+        PhDereferenceObject(newBoxedProcessesHashtable);
+    }
 
     PhReleaseQueuedLockExclusive(&BoxedProcessesLock);
 }
 
+VOID NTAPI ProcessItemCreateCallback(
+    _In_ PVOID Object,
+    _In_ PH_EM_OBJECT_TYPE ObjectType,
+    _In_ PVOID Extension
+    )
+{
+    PSBIE_PROCESS_EXTENSION extension = Extension;
+
+    memset(extension, 0, sizeof(SBIE_PROCESS_EXTENSION));
+
+    // New processes pick up their box membership here; after that it only changes when
+    // RefreshSandboxieInfo sees a change.
+
+    if (BoxedProcessesHashtable)
+    {
+        PhAcquireQueuedLockShared(&BoxedProcessesLock);
+        UpdateProcessExtension(Object, extension);
+        PhReleaseQueuedLockShared(&BoxedProcessesLock);
+    }
+}
+
 INT_PTR CALLBACK OptionsDlgProc(
     _In_ HWND hwndDlg,
     _In_ UINT uMsg,
@@ -21,17 +21,132 @@
  * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+/*
+ * The search text is split into its terms once when it changes (see FilterUpdateSearchText).
+ * The searchable text of each process, service and network item is built once, upper-cased and
+ * stored in an object extension; it is rebuilt only after the provider reports that the item
+ * has been modified. Each cache also remembers the result of the last search, so when the user
+ * extends the search text we only need to test the items that matched before.
+ */
+
 #include "toolstatus.h"
 #include <verify.h>
 
-BOOLEAN WordMatchStringRef(
-    _In_ PPH_STRINGREF Text
+typedef VOID (NTAPI *PSEARCH_BUILD_FUNCTION)(
+    _Inout_ PPH_STRING_BUILDER StringBuilder,
+    _In_ PVOID Object
+    );
+
+static PPH_STRING SearchText = NULL; // the text that SearchTerms was created from
+static PPH_LIST SearchTerms = NULL; // upper-case terms
+static ULONG SearchGeneration = 1;
+static BOOLEAN SearchNarrowed = FALSE; // current terms only match a subset of the previous terms
+
+static PH_CALLBACK_REGISTRATION ProcessModifiedCallbackRegistration;
+static PH_CALLBACK_REGISTRATION ServiceModifiedCallbackRegistration;
+static PH_CALLBACK_REGISTRATION NetworkItemModifiedCallbackRegistration;
+
+static VOID NTAPI SearchCacheCreateCallback(
+    _In_ PVOID Object,
+    _In_ PH_EM_OBJECT_TYPE ObjectType,
+    _In_ PVOID Extension
+    )
+{
+    memset(Extension, 0, sizeof(SEARCH_CACHE));
+}
+
+static VOID NTAPI SearchCacheDeleteCallback(
+    _In_ PVOID Object,
+    _In_ PH_EM_OBJECT_TYPE ObjectType,
+    _In_ PVOID Extension
+    )
+{
+    PSEARCH_CACHE cache = Extension;
+
+    PhClearReference(&cache->Text);
+}
+
+static VOID NTAPI ProcessModifiedCallback(
+    _In_opt_ PVOID Parameter,
+    _In_opt_ PVOID Context
+    )
+{
+    PSEARCH_CACHE cache;
+
+    cache = PhPluginGetObjectExtension(PluginInstance, Parameter, EmProcessItemType);
+    InterlockedExchange(&cache->Valid, FALSE);
+}
+
+static VOID NTAPI ServiceModifiedCallback(
+    _In_opt_ PVOID Parameter,
+    _In_opt_ PVOID Context
+    )
+{
+    PPH_SERVICE_MODIFIED_DATA serviceModifiedData = Parameter;
+    PSEARCH_CACHE cache;
+
+    cache = PhPluginGetObjectExtension(PluginInstance, serviceModifiedData->Service, EmServiceItemType);
+    InterlockedExchange(&cache->Valid, FALSE);
+}
+
+static VOID NTAPI NetworkItemModifiedCallback(
+    _In_opt_ PVOID Parameter,
+    _In_opt_ PVOID Context
+    )
+{
+    PSEARCH_CACHE cache;
+
+    cache = PhPluginGetObjectExtension(PluginInstance, Parameter, EmNetworkItemType);
+    InterlockedExchange(&cache->Valid, FALSE);
+}
+
+VOID FilterInitialize(
+    VOID
+    )
+{
+    SearchTerms = PhCreateList(4);
+
+    PhPluginSetObjectExtension(PluginInstance, EmProcessItemType, sizeof(SEARCH_CACHE),
+        SearchCacheCreateCallback, SearchCacheDeleteCallback);
+    PhPluginSetObjectExtension(PluginInstance, EmServiceItemType, sizeof(SEARCH_CACHE),
+        SearchCacheCreateCallback, SearchCacheDeleteCallback);
+    PhPluginSetObjectExtension(PluginInstance, EmNetworkItemType, sizeof(SEARCH_CACHE),
+        SearchCacheCreateCallback, SearchCacheDeleteCallback);
+
+    PhRegisterCallback(&PhProcessModifiedEvent,
+        ProcessModifiedCallback, NULL, &ProcessModifiedCallbackRegistration);
+    PhRegisterCallback(&PhServiceModifiedEvent,
+        ServiceModifiedCallback, NULL, &ServiceModifiedCallbackRegistration);
+    PhRegisterCallback(&PhNetworkItemModifiedEvent,
+        NetworkItemModifiedCallback, NULL, &NetworkItemModifiedCallbackRegistration);
+}
+
+VOID FilterUpdateSearchText(
+    _In_ PPH_STRING Text
     )
 {
     PH_STRINGREF part;
     PH_STRINGREF remainingPart;
+    BOOLEAN narrowed;
+
+    // Appending to the last term can only remove matches, as long as no new terms are added.
+    narrowed = FALSE;
+
+    if (!PhIsNullOrEmptyString(SearchText) &&
+        SearchText->Buffer[SearchText->Length / sizeof(WCHAR) - 1] != '|' &&
+        PhStartsWithString(Text, SearchText, FALSE))
+    {
+        PH_STRINGREF appendedPart;
+
+        appendedPart.Buffer = Text->Buffer + SearchText->Length / sizeof(WCHAR);
+        appendedPart.Length = Text->Length - SearchText->Length;
+        narrowed = PhFindCharInStringRef(&appendedPart, '|', FALSE) == -1;
+    }
+
+    PhDereferenceObjects(SearchTerms->Items, SearchTerms->Count);
+    PhClearList(SearchTerms);
 
-    remainingPart = SearchboxText->sr;
+    remainingPart = Text->sr;
 
     while (remainingPart.Length != 0)
     {
@@ -39,11 +154,36 @@ BOOLEAN WordMatchStringRef(
 
         if (part.Length != 0)
         {
-            if (PhFindStringInStringRef(Text, &part, TRUE) != -1)
-                return TRUE;
+            PPH_STRING term;
+
+            term = PhCreateString2(&part);
+            PhUpperString(term);
+            PhAddItemList(SearchTerms, term);
         }
     }
 
+    PhSwapReference(&SearchText, Text);
+    SearchGeneration++;
+    SearchNarrowed = narrowed;
+}
+
+BOOLEAN WordMatchStringRef(
+    _In_ PPH_STRINGREF Text
+    )
+{
+    ULONG i;
+
+    if (!SearchTerms)
+        return FALSE;
+
+    for (i = 0; i < SearchTerms->Count; i++)
+    {
+        PPH_STRING term = SearchTerms->Items[i];
+
+        if (PhFindStringInStringRef(Text, &term->sr, TRUE) != -1)
+            return TRUE;
+    }
+
     return FALSE;
 }
 
@@ -57,224 +197,248 @@ static BOOLEAN WordMatchStringZ(
     return WordMatchStringRef(&text);
 }
 
-BOOLEAN ProcessTreeFilterCallback(
-    _In_ PPH_TREENEW_NODE Node,
-    _In_opt_ PVOID Context
+static BOOLEAN WordMatchUpperStringRef(
+    _In_ PPH_STRINGREF Text
     )
 {
-    PPH_PROCESS_NODE processNode = (PPH_PROCESS_NODE)Node;
-
-    if (PhIsNullOrEmptyString(SearchboxText))
-        return TRUE;
-
-    if (!PhIsNullOrEmptyString(processNode->ProcessItem->ProcessName))
-    {
-        if (WordMatchStringRef(&processNode->ProcessItem->ProcessName->sr))
-            return TRUE;
-    }
-
-    if (!PhIsNullOrEmptyString(processNode->ProcessItem->FileName))
-    {
-        if (WordMatchStringRef(&processNode->ProcessItem->FileName->sr))
-            return TRUE;
-    }
+    ULONG i;
 
-    if (!PhIsNullOrEmptyString(processNode->ProcessItem->CommandLine))
+    for (i = 0; i < SearchTerms->Count; i++)
     {
-        if (WordMatchStringRef(&processNode->ProcessItem->CommandLine->sr))
-            return TRUE;
-    }
-
-    if (!PhIsNullOrEmptyString(processNode->ProcessItem->VersionInfo.CompanyName))
-    {
-        if (WordMatchStringRef(&processNode->ProcessItem->VersionInfo.CompanyName->sr))
-            return TRUE;
-    }
+        PPH_STRING term = SearchTerms->Items[i];
 
-    if (!PhIsNullOrEmptyString(processNode->ProcessItem->VersionInfo.FileDescription))
-    {
-        if (WordMatchStringRef(&processNode->ProcessItem->VersionInfo.FileDescription->sr))
+        if (PhFindStringInStringRef(Text, &term->sr, FALSE) != -1)
             return TRUE;
     }
 
-    if (!PhIsNullOrEmptyString(processNode->ProcessItem->VersionInfo.FileVersion))
-    {
-        if (WordMatchStringRef(&processNode->ProcessItem->VersionInfo.FileVersion->sr))
-            return TRUE;
-    }
-
-    if (!PhIsNullOrEmptyString(processNode->ProcessItem->VersionInfo.ProductName))
-    {
-        if (WordMatchStringRef(&processNode->ProcessItem->VersionInfo.ProductName->sr))
-            return TRUE;
-    }
+    return FALSE;
+}
 
-    if (!PhIsNullOrEmptyString(processNode->ProcessItem->UserName))
+static BOOLEAN SearchCacheMatch(
+    _Inout_ PSEARCH_CACHE Cache,
+    _In_ PSEARCH_BUILD_FUNCTION BuildFunction,
+    _In_ PVOID Object
+    )
+{
+    if (Cache->Valid)
     {
-        if (WordMatchStringRef(&processNode->ProcessItem->UserName->sr))
-            return TRUE;
-    }
+        if (Cache->Generation == SearchGeneration)
+            return Cache->Matched;
 
-    if (processNode->ProcessItem->IntegrityString)
-    {
-        if (WordMatchStringZ(processNode->ProcessItem->IntegrityString))
-            return TRUE;
+        if (SearchNarrowed && Cache->Generation == SearchGeneration - 1 && !Cache->Matched)
+        {
+            Cache->Generation = SearchGeneration;
+            return FALSE;
+        }
     }
-
-    if (!PhIsNullOrEmptyString(processNode->ProcessItem->JobName))
+    else
     {
-        if (WordMatchStringRef(&processNode->ProcessItem->JobName->sr))
-            return TRUE;
-    }
+        PH_STRING_BUILDER sb;
 
-    if (!PhIsNullOrEmptyString(processNode->ProcessItem->VerifySignerName))
-    {
-        if (WordMatchStringRef(&processNode->ProcessItem->VerifySignerName->sr))
-            return TRUE;
-    }
+        // Mark the cache as valid before reading the object, so that a modification that happens
+        // while we are building the text invalidates it again.
+        InterlockedExchange(&Cache->Valid, TRUE);
 
-    if (processNode->ProcessItem->ProcessIdString[0] != 0)
-    {
-        if (WordMatchStringZ(processNode->ProcessItem->ProcessIdString))
-            return TRUE;
+        PhInitializeStringBuilder(&sb, 256);
+        BuildFunction(&sb, Object);
+        PhMoveReference(&Cache->Text, PhFinalStringBuilderString(&sb));
+        PhUpperString(Cache->Text);
     }
 
-    if (processNode->ProcessItem->ParentProcessIdString[0] != 0)
-    {
-        if (WordMatchStringZ(processNode->ProcessItem->ParentProcessIdString))
-            return TRUE;
-    }
+    Cache->Matched = WordMatchUpperStringRef(&Cache->Text->sr);
+    Cache->Generation = SearchGeneration;
 
-    if (processNode->ProcessItem->SessionIdString[0] != 0)
-    {
-        if (WordMatchStringZ(processNode->ProcessItem->SessionIdString))
-            return TRUE;
-    }
+    return Cache->Matched;
+}
 
-    if (!PhIsNullOrEmptyString(processNode->ProcessItem->PackageFullName))
+static VOID SearchAppendString(
+    _Inout_ PPH_STRING_BUILDER StringBuilder,
+    _In_opt_ PPH_STRING String
+    )
+{
+    if (!PhIsNullOrEmptyString(String))
     {
-        if (WordMatchStringRef(&processNode->ProcessItem->PackageFullName->sr))
-            return TRUE;
+        PhAppendStringBuilder(StringBuilder, &String->sr);
+        PhAppendCharStringBuilder(StringBuilder, '\n');
     }
+}
 
-    if (WordMatchStringZ(PhGetProcessPriorityClassString(processNode->ProcessItem->PriorityClass)))
+static VOID SearchAppendStringZ(
+    _Inout_ PPH_STRING_BUILDER StringBuilder,
+    _In_opt_ PWSTR String
+    )
+{
+    if (String && String[0] != 0)
     {
-        return TRUE;
+        PhAppendStringBuilder2(StringBuilder, String);
+        PhAppendCharStringBuilder(StringBuilder, '\n');
     }
+}
 
-    if (processNode->ProcessItem->VerifyResult != VrUnknown)
-    {
-        switch (processNode->ProcessItem->VerifyResult)
+static VOID NTAPI ProcessBuildSearchText(
+    _Inout_ PPH_STRING_BUILDER StringBuilder,
+    _In_ PVOID Object
+    )
+{
+    PPH_PROCESS_ITEM processItem = Object;
+
+    SearchAppendString(StringBuilder, processItem->ProcessName);
+    SearchAppendString(StringBuilder, processItem->FileName);
+    SearchAppendString(StringBuilder, processItem->CommandLine);
+    SearchAppendString(StringBuilder, processItem->VersionInfo.CompanyName);
+    SearchAppendString(StringBuilder, processItem->VersionInfo.FileDescription);
+    SearchAppendString(StringBuilder, processItem->VersionInfo.FileVersion);
+    SearchAppendString(StringBuilder, processItem->VersionInfo.ProductName);
+    SearchAppendString(StringBuilder, processItem->UserName);
+    SearchAppendStringZ(StringBuilder, processItem->IntegrityString);
+    SearchAppendString(StringBuilder, processItem->JobName);
+    SearchAppendString(StringBuilder, processItem->VerifySignerName);
+    SearchAppendStringZ(StringBuilder, processItem->ProcessIdString);
+    SearchAppendStringZ(StringBuilder, processItem->ParentProcessIdString);
+    SearchAppendStringZ(StringBuilder, processItem->SessionIdString);
+    SearchAppendString(StringBuilder, processItem->PackageFullName);
+    SearchAppendStringZ(StringBuilder, PhGetProcessPriorityClassString(processItem->PriorityClass));
+
+    if (processItem->VerifyResult != VrUnknown)
+    {
+        switch (processItem->VerifyResult)
         {
         case VrNoSignature:
-            if (WordMatchStringZ(L"NoSignature"))
-                return TRUE;
+            SearchAppendStringZ(StringBuilder, L"NoSignature");
             break;
         case VrTrusted:
-            if (WordMatchStringZ(L"Trusted"))
-                return TRUE;
+            SearchAppendStringZ(StringBuilder, L"Trusted");
             break;
         case VrExpired:
-            if (WordMatchStringZ(L"Expired"))
-                return TRUE;
+            SearchAppendStringZ(StringBuilder, L"Expired");
             break;
         case VrRevoked:
-            if (WordMatchStringZ(L"Revoked"))
-                return TRUE;
+            SearchAppendStringZ(StringBuilder, L"Revoked");
             break;
         case VrDistrust:
-            if (WordMatchStringZ(L"Distrust"))
-                return TRUE;
+            SearchAppendStringZ(StringBuilder, L"Distrust");
             break;
         case VrSecuritySettings:
-            if (WordMatchStringZ(L"SecuritySettings"))
-                return TRUE;
+            SearchAppendStringZ(StringBuilder, L"SecuritySettings");
             break;
         case VrBadSignature:
-            if (WordMatchStringZ(L"BadSignature"))
-                return TRUE;
+            SearchAppendStringZ(StringBuilder, L"BadSignature");
             break;
         default:
-            if (WordMatchStringZ(L"Unknown"))
-                return TRUE;
+            SearchAppendStringZ(StringBuilder, L"Unknown");
             break;
         }
     }
 
-    if (WINDOWS_HAS_UAC && processNode->ProcessItem->ElevationType != TokenElevationTypeDefault)
+    if (WINDOWS_HAS_UAC && processItem->ElevationType != TokenElevationTypeDefault)
     {
-        switch (processNode->ProcessItem->ElevationType)
+        switch (processItem->ElevationType)
         {
         case TokenElevationTypeLimited:
-            if (WordMatchStringZ(L"Limited"))
-                return TRUE;
+            SearchAppendStringZ(StringBuilder, L"Limited");
             break;
         case TokenElevationTypeFull:
-            if (WordMatchStringZ(L"Full"))
-                return TRUE;
+            SearchAppendStringZ(StringBuilder, L"Full");
             break;
         default:
-            if (WordMatchStringZ(L"Unknown"))
-                return TRUE;
+            SearchAppendStringZ(StringBuilder, L"Unknown");
             break;
         }
     }
 
-    if (WordMatchStringZ(L"UpdateIsDotNet") && processNode->ProcessItem->UpdateIsDotNet)
-    {
-        return TRUE;
-    }
+    if (processItem->UpdateIsDotNet)
+        SearchAppendStringZ(StringBuilder, L"UpdateIsDotNet");
+    if (processItem->IsBeingDebugged)
+        SearchAppendStringZ(StringBuilder, L"IsBeingDebugged");
+    if (processItem->IsDotNet)
+        SearchAppendStringZ(StringBuilder, L"IsDotNet");
+    if (processItem->IsElevated)
+        SearchAppendStringZ(StringBuilder, L"IsElevated");
+    if (processItem->IsInJob)
+        SearchAppendStringZ(StringBuilder, L"IsInJob");
+    if (processItem->IsInSignificantJob)
+        SearchAppendStringZ(StringBuilder, L"IsInSignificantJob");
+    if (processItem->IsPacked)
+        SearchAppendStringZ(StringBuilder, L"IsPacked");
+    if (processItem->IsPosix)
+        SearchAppendStringZ(StringBuilder, L"IsPosix");
+    if (processItem->IsSuspended)
+        SearchAppendStringZ(StringBuilder, L"IsSuspended");
+    if (processItem->IsWow64)
+        SearchAppendStringZ(StringBuilder, L"IsWow64");
+    if (processItem->IsImmersive)
+        SearchAppendStringZ(StringBuilder, L"IsImmersive");
+}
 
-    if (WordMatchStringZ(L"IsBeingDebugged") && processNode->ProcessItem->IsBeingDebugged)
-    {
-        return TRUE;
-    }
+static VOID NTAPI ServiceBuildSearchText(
+    _Inout_ PPH_STRING_BUILDER StringBuilder,
+    _In_ PVOID Object
+    )
+{
+    PPH_SERVICE_ITEM serviceItem = Object;
 
-    if (WordMatchStringZ(L"IsDotNet") && processNode->ProcessItem->IsDotNet)
-    {
-        return TRUE;
-    }
+    SearchAppendStringZ(StringBuilder, PhGetServiceTypeString(serviceItem->Type));
+    SearchAppendStringZ(StringBuilder, PhGetServiceStateString(serviceItem->State));
+    SearchAppendStringZ(StringBuilder, PhGetServiceStartTypeString(serviceItem->StartType));
+    SearchAppendStringZ(StringBuilder, PhGetServiceErrorControlString(serviceItem->ErrorControl));
+    SearchAppendString(StringBuilder, serviceItem->Name);
+    SearchAppendString(StringBuilder, serviceItem->DisplayName);
 
-    if (WordMatchStringZ(L"IsElevated") && processNode->ProcessItem->IsElevated)
+    if (serviceItem->ProcessId)
     {
-        return TRUE;
-    }
+        WCHAR processIdString[PH_INT32_STR_LEN_1];
 
-    if (WordMatchStringZ(L"IsInJob") && processNode->ProcessItem->IsInJob)
-    {
-        return TRUE;
+        PhPrintUInt32(processIdString, HandleToUlong(serviceItem->ProcessId));
+        SearchAppendStringZ(StringBuilder, processIdString);
     }
+}
 
-    if (WordMatchStringZ(L"IsInSignificantJob") && processNode->ProcessItem->IsInSignificantJob)
-    {
-        return TRUE;
-    }
+static VOID NTAPI NetworkBuildSearchText(
+    _Inout_ PPH_STRING_BUILDER StringBuilder,
+    _In_ PVOID Object
+    )
+{
+    PPH_NETWORK_ITEM networkItem = Object;
 
-    if (WordMatchStringZ(L"IsPacked") && processNode->ProcessItem->IsPacked)
-    {
-        return TRUE;
-    }
+    SearchAppendString(StringBuilder, networkItem->ProcessName);
+    SearchAppendString(StringBuilder, networkItem->OwnerName);
+    SearchAppendStringZ(StringBuilder, networkItem->LocalAddressString);
+    SearchAppendStringZ(StringBuilder, networkItem->LocalPortString);
+    SearchAppendString(StringBuilder, networkItem->LocalHostString);
+    SearchAppendStringZ(StringBuilder, networkItem->RemoteAddressString);
+    SearchAppendStringZ(StringBuilder, networkItem->RemotePortString);
+    SearchAppendString(StringBuilder, networkItem->RemoteHostString);
+    SearchAppendStringZ(StringBuilder, PhGetProtocolTypeName(networkItem->ProtocolType));
 
-    if (WordMatchStringZ(L"IsPosix") && processNode->ProcessItem->IsPosix)
-    {
-        return TRUE;
-    }
+    if (networkItem->ProtocolType & PH_TCP_PROTOCOL_TYPE)
+        SearchAppendStringZ(StringBuilder, PhGetTcpStateName(networkItem->State));
 
-    if (WordMatchStringZ(L"IsSuspended") && processNode->ProcessItem->IsSuspended)
+    if (networkItem->ProcessId)
     {
-        return TRUE;
+        WCHAR processIdString[PH_INT32_STR_LEN_1];
+
+        PhPrintUInt32(processIdString, HandleToUlong(networkItem->ProcessId));
+        SearchAppendStringZ(StringBuilder, processIdString);
     }
+}
 
-    if (WordMatchStringZ(L"IsWow64") && processNode->ProcessItem->IsWow64)
-    {
+BOOLEAN ProcessTreeFilterCallback(
+    _In_ PPH_TREENEW_NODE Node,
+    _In_opt_ PVOID Context
+    )
+{
+    PPH_PROCESS_NODE processNode = (PPH_PROCESS_NODE)Node;
+    PSEARCH_CACHE cache;
+
+    if (PhIsNullOrEmptyString(SearchboxText))
         return TRUE;
-    }
 
-    if (WordMatchStringZ(L"IsImmersive") && processNode->ProcessItem->IsImmersive)
-    {
+    cache = PhPluginGetObjectExtension(PluginInstance, processNode->ProcessItem, EmProcessItemType);
+
+    if (SearchCacheMatch(cache, ProcessBuildSearchText, processNode->ProcessItem))
         return TRUE;
-    }
 
+    // The service list can change without the process being modified, so it is not cached.
     if (processNode->ProcessItem->ServiceList && processNode->ProcessItem->ServiceList->Count != 0)
     {
         ULONG enumerationKey = 0;
@@ -352,45 +516,14 @@ BOOLEAN ServiceTreeFilterCallback(
     )
 {
     PPH_SERVICE_NODE serviceNode = (PPH_SERVICE_NODE)Node;
+    PSEARCH_CACHE cache;
 
     if (PhIsNullOrEmptyString(SearchboxText))
         return TRUE;
 
-    if (WordMatchStringZ(PhGetServiceTypeString(serviceNode->ServiceItem->Type)))
-        return TRUE;
-
-    if (WordMatchStringZ(PhGetServiceStateString(serviceNode->ServiceItem->State)))
-        return TRUE;
-
-    if (WordMatchStringZ(PhGetServiceStartTypeString(serviceNode->ServiceItem->StartType)))
-        return TRUE;
-
-    if (WordMatchStringZ(PhGetServiceErrorControlString(serviceNode->ServiceItem->ErrorControl)))
-        return TRUE;
-
-    if (!PhIsNullOrEmptyString(serviceNode->ServiceItem->Name))
-    {
-        if (WordMatchStringRef(&serviceNode->ServiceItem->Name->sr))
-            return TRUE;
-    }
-
-    if (!PhIsNullOrEmptyString(serviceNode->ServiceItem->DisplayName))
-    {
-        if (WordMatchStringRef(&serviceNode->ServiceItem->DisplayName->sr))
-            return TRUE;
-    }
-
-    if (serviceNode->ServiceItem->ProcessId)
-    {
-        WCHAR processIdString[PH_INT32_STR_LEN_1];
-
-        PhPrintUInt32(processIdString, HandleToUlong(serviceNode->ServiceItem->ProcessId));
-
-        if (WordMatchStringZ(processIdString))
-            return TRUE;
-    }
+    cache = PhPluginGetObjectExtension(PluginInstance, serviceNode->ServiceItem, EmServiceItemType);
 
-    return FALSE;
+    return SearchCacheMatch(cache, ServiceBuildSearchText, serviceNode->ServiceItem);
 }
 
 BOOLEAN NetworkTreeFilterCallback(
@@ -399,74 +532,12 @@ BOOLEAN NetworkTreeFilterCallback(
     )
 {
     PPH_NETWORK_NODE networkNode = (PPH_NETWORK_NODE)Node;
+    PSEARCH_CACHE cache;
 
     if (PhIsNullOrEmptyString(SearchboxText))
         return TRUE;
 
-    if (!PhIsNullOrEmptyString(networkNode->NetworkItem->ProcessName))
-    {
-        if (WordMatchStringRef(&networkNode->NetworkItem->ProcessName->sr))
-            return TRUE;
-    }
-
-    if (!PhIsNullOrEmptyString(networkNode->NetworkItem->OwnerName))
-    {
-        if (WordMatchStringRef(&networkNode->NetworkItem->OwnerName->sr))
-            return TRUE;
-    }
+    cache = PhPluginGetObjectExtension(PluginInstance, networkNode->NetworkItem, EmNetworkItemType);
 
-    if (networkNode->NetworkItem->LocalAddressString[0] != 0)
-    {
-        if (WordMatchStringZ(networkNode->NetworkItem->LocalAddressString))
-            return TRUE;
-    }
-
-    if (networkNode->NetworkItem->LocalPortString[0] != 0)
-    {
-        if (WordMatchStringZ(networkNode->NetworkItem->LocalPortString))
-            return TRUE;
-    }
-
-    if (!PhIsNullOrEmptyString(networkNode->NetworkItem->LocalHostString))
-    {
-        if (WordMatchStringRef(&networkNode->NetworkItem->LocalHostString->sr))
-            return TRUE;
-    }
-
-    if (networkNode->NetworkItem->RemoteAddressString[0] != 0)
-    {
-        if (WordMatchStringZ(networkNode->NetworkItem->RemoteAddressString))
-            return TRUE;
-    }
-
-    if (networkNode->NetworkItem->RemotePortString[0] != 0)
-    {
-        if (WordMatchStringZ(networkNode->NetworkItem->RemotePortString))
-            return TRUE;
-    }
-
-    if (!PhIsNullOrEmptyString(networkNode->NetworkItem->RemoteHostString))
-    {
-        if (WordMatchStringRef(&networkNode->NetworkItem->RemoteHostString->sr))
-            return TRUE;
-    }
-
-    if (WordMatchStringZ(PhGetProtocolTypeName(networkNode->NetworkItem->ProtocolType)))
-        return TRUE;
-
-    if ((networkNode->NetworkItem->ProtocolType & PH_TCP_PROTOCOL_TYPE) &&
-        WordMatchStringZ(PhGetTcpStateName(networkNode->NetworkItem->State)))
-        return TRUE;
-
-    if (networkNode->NetworkItem->ProcessId)
-    {
-        WCHAR processIdString[PH_INT32_STR_LEN_1];
-
-        PhPrintUInt32(processIdString, HandleToUlong(networkNode->NetworkItem->ProcessId));
-
-        if (WordMatchStringZ(processIdString))
-            return TRUE;
-    }
-
-    return FALSE;
+    return SearchCacheMatch(cache, NetworkBuildSearchText, networkNode->NetworkItem);
 }
\ No newline at end of file
@@ -406,11 +406,7 @@ VOID ToolbarUpdateGraphsInfo(LPNMHDR Header)
 
                 if (!CpuGraphState.Valid)
                 {
-                    PhCopyCircularBuffer_FLOAT(SystemStatistics.CpuKernelHistory,
-                        CpuGraphState.Data1, drawInfo->LineDataCount);
-                    PhCopyCircularBuffer_FLOAT(SystemStatistics.CpuUserHistory,
-                        CpuGraphState.Data2, drawInfo->LineDataCount);
-
+                    PhGetSystemGraphSeries(SystemGraphCpuSeries, drawInfo->LineDataCount, CpuGraphState.Data1, CpuGraphState.Data2);
                     CpuGraphState.Valid = TRUE;
                 }
             }
@@ -429,17 +425,7 @@ VOID ToolbarUpdateGraphsInfo(LPNMHDR Header)
 
                 if (!MemGraphState.Valid)
                 {
-                    for (ULONG i = 0; i < drawInfo->LineDataCount; i++)
-                    {
-                        MemGraphState.Data1[i] = (FLOAT)PhGetItemCircularBuffer_ULONG(SystemStatistics.PhysicalHistory, i);
-                    }
-
-                    PhDivideSinglesBySingle(
-                        MemGraphState.Data1,
-                        (FLOAT)PhSystemBasicInformation.NumberOfPhysicalPages,
-                        drawInfo->LineDataCount
-                        );
-
+                    PhGetSystemGraphSeries(SystemGraphPhysicalSeries, drawInfo->LineDataCount, MemGraphState.Data1, NULL);
                     MemGraphState.Valid = TRUE;
                 }
             }
@@ -458,17 +444,7 @@ VOID ToolbarUpdateGraphsInfo(LPNMHDR Header)
 
                 if (!CommitGraphState.Valid)
                 {
-                    for (ULONG i = 0; i < drawInfo->LineDataCount; i++)
-                    {
-                        CommitGraphState.Data1[i] = (FLOAT)PhGetItemCircularBuffer_ULONG(SystemStatistics.CommitHistory, i);
-                    }
-
-                    PhDivideSinglesBySingle(
-                        CommitGraphState.Data1,
-                        (FLOAT)SystemStatistics.Performance->CommitLimit,
-                        drawInfo->LineDataCount
-                        );
-
+                    PhGetSystemGraphSeries(SystemGraphCommitSeries, drawInfo->LineDataCount, CommitGraphState.Data1, NULL);
                     CommitGraphState.Valid = TRUE;
                 }
             }
@@ -487,23 +463,7 @@ VOID ToolbarUpdateGraphsInfo(LPNMHDR Header)
 
                 if (!IoGraphState.Valid)
                 {
-                    FLOAT max = 1024 * 1024; // minimum scaling of 1 MB.
-
-                    for (ULONG i = 0; i < drawInfo->LineDataCount; i++)
-                    {
-                        IoGraphState.Data1[i] =
-                            (FLOAT)PhGetItemCircularBuffer_ULONG64(SystemStatistics.IoReadHistory, i) +
-                            (FLOAT)PhGetItemCircularBuffer_ULONG64(SystemStatistics.IoOtherHistory, i);
-                        IoGraphState.Data2[i] =
-                            (FLOAT)PhGetItemCircularBuffer_ULONG64(SystemStatistics.IoWriteHistory, i);
-
-                        if (max < IoGraphState.Data1[i] + IoGraphState.Data2[i])
-                            max = IoGraphState.Data1[i] + IoGraphState.Data2[i];
-                    }
-
-                    PhDivideSinglesBySingle(IoGraphState.Data1, max, drawInfo->LineDataCount);
-                    PhDivideSinglesBySingle(IoGraphState.Data2, max, drawInfo->LineDataCount);
-
+                    PhGetSystemGraphSeries(SystemGraphIoSeries, drawInfo->LineDataCount, IoGraphState.Data1, IoGraphState.Data2);
                     IoGraphState.Valid = TRUE;
                 }
             }
@@ -77,6 +77,7 @@ static BOOLEAN TargetingCompleted = FALSE;
 static HWND TargetingCurrentWindow = NULL;
 static PH_CALLBACK_REGISTRATION PluginLoadCallbackRegistration;
 static PH_CALLBACK_REGISTRATION PluginShowOptionsCallbackRegistration;
+static PH_CALLBACK_REGISTRATION PluginTreeNewMessageCallbackRegistration;
 static PH_CALLBACK_REGISTRATION MainWindowShowingCallbackRegistration;
 static PH_CALLBACK_REGISTRATION ProcessesUpdatedCallbackRegistration;
 static PH_CALLBACK_REGISTRATION LayoutPaddingCallbackRegistration;
@@ -116,7 +117,23 @@ VOID NTAPI TreeNewInitializingCallback(
     _In_opt_ PVOID Context
     )
 {
-    *(HWND *)Context = ((PPH_PLUGIN_TREENEW_INFORMATION)Parameter)->TreeNewHandle;
+    PPH_PLUGIN_TREENEW_INFORMATION info = Parameter;
+
+    *(HWND *)Context = info->TreeNewHandle;
+
+    // We need selection change notifications for the selected items count.
+    PhPluginEnableTreeNewNotify(PluginInstance, info->CmData);
+}
+
+static VOID NTAPI TreeNewMessageCallback(
+    _In_opt_ PVOID Parameter,
+    _In_opt_ PVOID Context
+    )
+{
+    PPH_PLUGIN_TREENEW_MESSAGE message = Parameter;
+
+    if (message->Message == TreeNewSelectionChanged)
+        StatusBarSelectionChanged(message->TreeNewHandle);
 }
 
 static VOID RegisterTabSearch(
@@ -635,6 +652,7 @@ static LRESULT CALLBACK MainWndSubclassProc(
 
                     // Cache the current search text for our callback.
                     PhMoveReference(&SearchboxText, PhGetWindowText(SearchboxHandle));
+                    FilterUpdateSearchText(SearchboxText);
 
                     // Expand the nodes so we can search them
                     PhExpandAllProcessNodes(TRUE);
@@ -1365,6 +1383,8 @@ LOGICAL DllMain(
             info->HasOptions = TRUE;
             info->Interface = &PluginInterface;
 
+            FilterInitialize();
+
             PhRegisterCallback(
                 PhGetPluginCallback(PluginInstance, PluginCallbackLoad),
                 LoadCallback,
@@ -1377,6 +1397,12 @@ LOGICAL DllMain(
                 NULL,
                 &PluginShowOptionsCallbackRegistration
                 );
+            PhRegisterCallback(
+                PhGetPluginCallback(PluginInstance, PluginCallbackTreeNewMessage),
+                TreeNewMessageCallback,
+                NULL,
+                &PluginTreeNewMessageCallbackRegistration
+                );
             PhRegisterCallback(
                 PhGetGeneralCallback(GeneralCallbackMainWindowShowing),
                 MainWindowShowingCallback,
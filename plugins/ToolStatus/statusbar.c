@@ -28,6 +28,14 @@ ULONG ProcessesUpdatedCount = 0;
 ULONG StatusBarMaxWidths[MAX_STATUSBAR_ITEMS];
 // Note: no lock is needed because we only ever modify the list on this same thread.
 PPH_LIST StatusBarItemList = NULL;
+static PPH_STRING StatusBarTextCache[MAX_STATUSBAR_ITEMS];
+static ULONG StatusBarTextWidthCache[MAX_STATUSBAR_ITEMS];
+static ULONG StatusBarPartWidths[MAX_STATUSBAR_ITEMS];
+static ULONG StatusBarPartCount = 0;
+static HWND StatusBarSelectionTreeNewHandle = NULL;
+static ULONG StatusBarSelectionFlatCount = 0;
+static ULONG StatusBarSelectedCount = 0;
+static BOOLEAN StatusBarSelectionValid = FALSE;
 ULONG StatusBarItems[MAX_STATUSBAR_ITEMS] =
 {
     // Default items (displayed)
@@ -255,8 +263,11 @@ VOID StatusBarUpdate(
 
     ULONG count;
     ULONG i;
-    HDC hdc;
+    HDC hdc = NULL;
     BOOLEAN resetMaxWidths = FALSE;
+    BOOLEAN partsChanged;
+    BOOLEAN textChanged[MAX_STATUSBAR_ITEMS];
+    BOOLEAN anyTextChanged = FALSE;
     PPH_STRING text[MAX_STATUSBAR_ITEMS];
     ULONG widths[MAX_STATUSBAR_ITEMS];
 
@@ -266,6 +277,11 @@ VOID StatusBarUpdate(
     // TODO: Review
     if (!StatusBarItemList || StatusBarItemList->Count == 0)
     {
+        for (i = 0; i < StatusBarPartCount; i++)
+            PhClearReference(&StatusBarTextCache[i]);
+
+        StatusBarPartCount = 0;
+
         // The status bar doesn't cope well with 0 parts.
         widths[0] = -1;
         SendMessage(StatusBarHandle, SB_SETPARTS, 1, (LPARAM)widths);
@@ -273,9 +289,6 @@ VOID StatusBarUpdate(
         return;
     }
 
-    hdc = GetDC(StatusBarHandle);
-    SelectObject(hdc, (HFONT)SendMessage(StatusBarHandle, WM_GETFONT, 0, 0));
-
     // Reset max. widths for Max. CPU Process and Max. I/O Process parts once in a while.
     {
         LARGE_INTEGER tickCount;
@@ -483,19 +496,33 @@ VOID StatusBarUpdate(
                 if (tnHandle)
                 {
                     ULONG visibleCount = 0;
-                    ULONG selectedCount = 0;
 
                     visibleCount = TreeNew_GetFlatNodeCount(tnHandle);
 
-                    for (ULONG i = 0; i < visibleCount; i++)
+                    // Only count the selected nodes again when the tree has told us the selection
+                    // changed. Nodes can also be removed without a notification, so we recount when
+                    // the number of visible nodes changes as well.
+                    if (!StatusBarSelectionValid ||
+                        StatusBarSelectionTreeNewHandle != tnHandle ||
+                        StatusBarSelectionFlatCount != visibleCount)
                     {
-                        if (TreeNew_GetFlatNode(tnHandle, i)->Selected)
-                            selectedCount++;
+                        ULONG selectedCount = 0;
+
+                        for (ULONG i = 0; i < visibleCount; i++)
+                        {
+                            if (TreeNew_GetFlatNode(tnHandle, i)->Selected)
+                                selectedCount++;
+                        }
+
+                        StatusBarSelectionTreeNewHandle = tnHandle;
+                        StatusBarSelectionFlatCount = visibleCount;
+                        StatusBarSelectedCount = selectedCount;
+                        StatusBarSelectionValid = TRUE;
                     }
 
                     text[count] = PhFormatString(
                         L"Selected: %lu",
-                        selectedCount
+                        StatusBarSelectedCount
                         );
                 }
                 else
@@ -544,8 +571,27 @@ VOID StatusBarUpdate(
         if (resetMaxWidths)
             StatusBarMaxWidths[count] = 0;
 
-        if (!GetTextExtentPoint32(hdc, text[count]->Buffer, (ULONG)text[count]->Length / sizeof(WCHAR), &size))
-            size.cx = 200;
+        textChanged[count] = ResetMaxWidths || count >= StatusBarPartCount ||
+            !StatusBarTextCache[count] || !PhEqualString(text[count], StatusBarTextCache[count], FALSE);
+
+        if (textChanged[count])
+        {
+            if (!hdc)
+            {
+                hdc = GetDC(StatusBarHandle);
+                SelectObject(hdc, (HFONT)SendMessage(StatusBarHandle, WM_GETFONT, 0, 0));
+            }
+
+            if (!GetTextExtentPoint32(hdc, text[count]->Buffer, (ULONG)text[count]->Length / sizeof(WCHAR), &size))
+                size.cx = 200;
+
+            StatusBarTextWidthCache[count] = size.cx;
+            anyTextChanged = TRUE;
+        }
+        else
+        {
+            size.cx = StatusBarTextWidthCache[count];
+        }
 
         if (count != 0)
             widths[count] = widths[count - 1];
@@ -568,13 +614,56 @@ VOID StatusBarUpdate(
         count++;
     }
 
-    ReleaseDC(StatusBarHandle, hdc);
+    if (hdc)
+        ReleaseDC(StatusBarHandle, hdc);
+
+    partsChanged = ResetMaxWidths || count != StatusBarPartCount ||
+        memcmp(widths, StatusBarPartWidths, count * sizeof(ULONG)) != 0;
+
+    if (!partsChanged && !anyTextChanged)
+    {
+        // Nothing changed since the last update.
+        for (i = 0; i < count; i++)
+            PhDereferenceObject(text[i]);
+
+        return;
+    }
+
+    // Suspend painting while we update the parts so the status bar is only invalidated once.
+    SendMessage(StatusBarHandle, WM_SETREDRAW, FALSE, 0);
 
-    SendMessage(StatusBarHandle, SB_SETPARTS, count, (LPARAM)widths);
+    if (partsChanged)
+    {
+        SendMessage(StatusBarHandle, SB_SETPARTS, count, (LPARAM)widths);
+        memcpy(StatusBarPartWidths, widths, count * sizeof(ULONG));
+    }
 
     for (i = 0; i < count; i++)
     {
-        SendMessage(StatusBarHandle, SB_SETTEXT, i, (LPARAM)text[i]->Buffer);
-        PhDereferenceObject(text[i]);
+        if (textChanged[i])
+        {
+            SendMessage(StatusBarHandle, SB_SETTEXT, i, (LPARAM)text[i]->Buffer);
+            PhMoveReference(&StatusBarTextCache[i], text[i]);
+        }
+        else
+        {
+            PhDereferenceObject(text[i]);
+        }
     }
+
+    for (i = count; i < StatusBarPartCount; i++)
+        PhClearReference(&StatusBarTextCache[i]);
+
+    StatusBarPartCount = count;
+
+    SendMessage(StatusBarHandle, WM_SETREDRAW, TRUE, 0);
+    InvalidateRect(StatusBarHandle, NULL, FALSE);
+}
+
+VOID StatusBarSelectionChanged(
+    _In_ HWND TreeNewHandle
+    )
+{
+    if (TreeNewHandle == StatusBarSelectionTreeNewHandle)
+        StatusBarSelectionValid = FALSE;
 }
\ No newline at end of file
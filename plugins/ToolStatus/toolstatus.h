@@ -241,6 +241,22 @@ VOID ShowOptionsDialog(
 
 // filter.c
 
+typedef struct _SEARCH_CACHE
+{
+    PPH_STRING Text;
+    volatile LONG Valid;
+    ULONG Generation;
+    BOOLEAN Matched;
+} SEARCH_CACHE, *PSEARCH_CACHE;
+
+VOID FilterInitialize(
+    VOID
+    );
+
+VOID FilterUpdateSearchText(
+    _In_ PPH_STRING Text
+    );
+
 BOOLEAN WordMatchStringRef(
     _In_ PPH_STRINGREF Text
     );
@@ -342,6 +358,10 @@ VOID StatusBarUpdate(
     _In_ BOOLEAN ResetMaxWidths
     );
 
+VOID StatusBarSelectionChanged(
+    _In_ HWND TreeNewHandle
+    );
+
 VOID StatusBarShowMenu(
     _In_ PPOINT Point
     );
@@ -652,64 +652,52 @@ static NTSTATUS UpdateCheckThread(
     return STATUS_SUCCESS;
 }
 
-static NTSTATUS UpdateDownloadThread(
-    _In_ PVOID Parameter
+static VOID UpdateDownloadProgress(
+    _In_ PPH_UPDATER_CONTEXT Context,
+    _In_ ULONG DownloadedBytes,
+    _In_ ULONG ContentLength
     )
 {
-    BOOLEAN downloadSuccess = FALSE;
-    BOOLEAN hashSuccess = FALSE;
-    BOOLEAN verifySuccess = FALSE;
+    // TODO: Update on GUI thread.
+    //int percent = MulDiv(100, downloadedBytes, contentLength);
+    FLOAT percent = ((FLOAT)DownloadedBytes / ContentLength * 100);
+    PPH_STRING totalDownloaded = PhFormatSize(DownloadedBytes, -1);
+    PPH_STRING totalLength = PhFormatSize(ContentLength, -1);
+
+    PPH_STRING dlLengthString = PhFormatString(
+        L"%s of %s (%.0f%%)",
+        totalDownloaded->Buffer,
+        totalLength->Buffer,
+        percent
+        );
+
+    // Update the progress bar position
+    SendMessage(Context->ProgressHandle, PBM_SETPOS, (ULONG)percent, 0);
+    Static_SetText(Context->StatusHandle, dlLengthString->Buffer);
+
+    PhDereferenceObject(dlLengthString);
+    PhDereferenceObject(totalDownloaded);
+    PhDereferenceObject(totalLength);
+}
+
+static BOOLEAN DownloadSetupFile(
+    _In_ PPH_UPDATER_CONTEXT Context,
+    _In_ HINTERNET ConnectionHandle,
+    _In_ PPH_STRING UrlPath,
+    _In_ ULONG RequestFlags,
+    _Out_writes_bytes_(20) PUCHAR Hash
+    )
+{
+    BOOLEAN result = FALSE;
     HANDLE tempFileHandle = NULL;
-    HINTERNET httpSessionHandle = NULL;
-    HINTERNET httpConnectionHandle = NULL;
     HINTERNET httpRequestHandle = NULL;
-    PPH_STRING setupTempPath = NULL;
-    PPH_STRING downloadHostPath = NULL;
-    PPH_STRING downloadUrlPath = NULL;
-    PPH_STRING userAgentString = NULL;
-    URL_COMPONENTS httpUrlComponents = { sizeof(URL_COMPONENTS) };
-    WINHTTP_CURRENT_USER_IE_PROXY_CONFIG proxyConfig = { 0 };
-
-    PPH_UPDATER_CONTEXT context = (PPH_UPDATER_CONTEXT)Parameter;
 
     __try
     {
-        // Create a user agent string.
-        userAgentString = PhFormatString(
-            L"PH_%lu.%lu_%lu",
-            context->CurrentMajorVersion,
-            context->CurrentMinorVersion,
-            context->CurrentRevisionVersion
-            );
-        if (PhIsNullOrEmptyString(userAgentString))
-            __leave;
-
-        // Allocate the GetTempPath buffer
-        setupTempPath = PhCreateStringEx(NULL, GetTempPath(0, NULL) * sizeof(WCHAR));
-        if (PhIsNullOrEmptyString(setupTempPath))
-            __leave;
-
-        // Get the temp path
-        if (GetTempPath((ULONG)setupTempPath->Length / sizeof(WCHAR), setupTempPath->Buffer) == 0)
-            __leave;
-        if (PhIsNullOrEmptyString(setupTempPath))
-            __leave;
-
-        // Append the tempath to our string: %TEMP%processhacker-%lu.%lu-setup.exe
-        // Example: C:\\Users\\dmex\\AppData\\Temp\\processhacker-2.90-setup.exe
-        context->SetupFilePath = PhFormatString(
-            L"%sprocesshacker-%lu.%lu-setup.exe",
-            setupTempPath->Buffer,
-            context->MajorVersion,
-            context->MinorVersion
-            );
-        if (PhIsNullOrEmptyString(context->SetupFilePath))
-            __leave;
-
         // Create output file
         if (!NT_SUCCESS(PhCreateFileWin32(
             &tempFileHandle,
-            context->SetupFilePath->Buffer,
+            Context->SetupFilePath->Buffer,
             FILE_GENERIC_READ | FILE_GENERIC_WRITE,
             FILE_ATTRIBUTE_NOT_CONTENT_INDEXED | FILE_ATTRIBUTE_TEMPORARY,
             FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
@@ -720,91 +708,20 @@ static NTSTATUS UpdateDownloadThread(
             __leave;
         }
 
-        // Set lengths to non-zero enabling these params to be cracked.
-        httpUrlComponents.dwSchemeLength = (ULONG)-1;
-        httpUrlComponents.dwHostNameLength = (ULONG)-1;
-        httpUrlComponents.dwUrlPathLength = (ULONG)-1;
-
-        if (!WinHttpCrackUrl(
-            context->SetupFileDownloadUrl->Buffer,
-            (ULONG)context->SetupFileDownloadUrl->Length,
-            0,
-            &httpUrlComponents
-            ))
-        {
-            __leave;
-        }
-
-        // Create the Host string.
-        downloadHostPath = PhCreateStringEx(
-            httpUrlComponents.lpszHostName,
-            httpUrlComponents.dwHostNameLength * sizeof(WCHAR)
-            );
-        if (PhIsNullOrEmptyString(downloadHostPath))
-            __leave;
-
-        // Create the Path string.
-        downloadUrlPath = PhCreateStringEx(
-            httpUrlComponents.lpszUrlPath,
-            httpUrlComponents.dwUrlPathLength * sizeof(WCHAR)
-            );
-        if (PhIsNullOrEmptyString(downloadUrlPath))
-            __leave;
-
-        SetDlgItemText(context->DialogHandle, IDC_STATUS, L"Connecting...");
-
-        // Query the current system proxy
-        WinHttpGetIEProxyConfigForCurrentUser(&proxyConfig);
-
-        // Open the HTTP session with the system proxy configuration if available
-        if (!(httpSessionHandle = WinHttpOpen(
-            userAgentString->Buffer,
-            proxyConfig.lpszProxy != NULL ? WINHTTP_ACCESS_TYPE_NAMED_PROXY : WINHTTP_ACCESS_TYPE_DEFAULT_PROXY,
-            proxyConfig.lpszProxy,
-            proxyConfig.lpszProxyBypass,
-            0
-            )))
-        {
-            __leave;
-        }
-
-        if (WindowsVersion >= WINDOWS_8_1)
-        {
-            // Enable GZIP and DEFLATE support on Windows 8.1 and above using undocumented flags.
-            ULONG httpFlags = WINHTTP_DECOMPRESSION_FLAG_GZIP | WINHTTP_DECOMPRESSION_FLAG_DEFLATE;
-
-            WinHttpSetOption(
-                httpSessionHandle,
-                WINHTTP_OPTION_DECOMPRESSION,
-                &httpFlags,
-                sizeof(ULONG)
-                );
-        }
-
-        if (!(httpConnectionHandle = WinHttpConnect(
-            httpSessionHandle,
-            downloadHostPath->Buffer,
-            httpUrlComponents.nScheme == INTERNET_SCHEME_HTTP ? INTERNET_DEFAULT_HTTP_PORT : INTERNET_DEFAULT_HTTPS_PORT,
-            0
-            )))
-        {
-            __leave;
-        }
-
         if (!(httpRequestHandle = WinHttpOpenRequest(
-            httpConnectionHandle,
+            ConnectionHandle,
             NULL,
-            downloadUrlPath->Buffer,
+            UrlPath->Buffer,
             NULL,
             WINHTTP_NO_REFERER,
             WINHTTP_DEFAULT_ACCEPT_TYPES,
-            WINHTTP_FLAG_REFRESH | (httpUrlComponents.nScheme == INTERNET_SCHEME_HTTPS ? WINHTTP_FLAG_SECURE : 0)
+            RequestFlags
             )))
         {
             __leave;
         }
 
-        SetDlgItemText(context->DialogHandle, IDC_STATUS, L"Sending request...");
+        SetDlgItemText(Context->DialogHandle, IDC_STATUS, L"Sending request...");
 
         if (!WinHttpSendRequest(
             httpRequestHandle,
@@ -819,7 +736,7 @@ static NTSTATUS UpdateDownloadThread(
             __leave;
         }
 
-        SetDlgItemText(context->DialogHandle, IDC_STATUS, L"Waiting for response...");
+        SetDlgItemText(Context->DialogHandle, IDC_STATUS, L"Waiting for response...");
 
         if (WinHttpReceiveResponse(httpRequestHandle, NULL))
         {
@@ -828,7 +745,6 @@ static NTSTATUS UpdateDownloadThread(
             ULONG contentLengthSize = sizeof(ULONG);
             ULONG contentLength = 0;
             BYTE buffer[PAGE_SIZE];
-            BYTE hashBuffer[20];
 
             PH_HASH_CONTEXT hashContext;
             IO_STATUS_BLOCK isb;
@@ -889,55 +805,670 @@ static NTSTATUS UpdateDownloadThread(
                     __leave;
 
                 // Update the GUI progress.
-                // TODO: Update on GUI thread.
-                {
-                    //int percent = MulDiv(100, downloadedBytes, contentLength);
-                    FLOAT percent = ((FLOAT)downloadedBytes / contentLength * 100);
-                    PPH_STRING totalDownloaded = PhFormatSize(downloadedBytes, -1);
-                    PPH_STRING totalLength = PhFormatSize(contentLength, -1);
-
-                    PPH_STRING dlLengthString = PhFormatString(
-                        L"%s of %s (%.0f%%)",
-                        totalDownloaded->Buffer,
-                        totalLength->Buffer,
-                        percent
-                        );
+                UpdateDownloadProgress(Context, downloadedBytes, contentLength);
+            }
 
-                    // Update the progress bar position
-                    SendMessage(context->ProgressHandle, PBM_SETPOS, (ULONG)percent, 0);
-                    Static_SetText(context->StatusHandle, dlLengthString->Buffer);
+            // Compute hash result (will fail if file not downloaded correctly).
+            result = PhFinalHash(&hashContext, Hash, 20, NULL);
+        }
+    }
+    __finally
+    {
+        if (httpRequestHandle)
+            WinHttpCloseHandle(httpRequestHandle);
 
-                    PhDereferenceObject(dlLengthString);
-                    PhDereferenceObject(totalDownloaded);
-                    PhDereferenceObject(totalLength);
-                }
+        if (tempFileHandle)
+            NtClose(tempFileHandle);
+    }
+
+    return result;
+}
+
+static BOOLEAN QuerySetupFileRanges(
+    _In_ HINTERNET ConnectionHandle,
+    _In_ PPH_STRING UrlPath,
+    _In_ ULONG RequestFlags,
+    _Out_ PULONG ContentLength
+    )
+{
+    BOOLEAN result = FALSE;
+    HINTERNET httpRequestHandle;
+    ULONG statusCode = 0;
+    ULONG contentLength = 0;
+    ULONG valueSize;
+    WCHAR acceptRanges[32];
+
+    if (!(httpRequestHandle = WinHttpOpenRequest(
+        ConnectionHandle,
+        L"HEAD",
+        UrlPath->Buffer,
+        NULL,
+        WINHTTP_NO_REFERER,
+        WINHTTP_DEFAULT_ACCEPT_TYPES,
+        RequestFlags
+        )))
+    {
+        return FALSE;
+    }
+
+    if (WinHttpSendRequest(
+        httpRequestHandle,
+        WINHTTP_NO_ADDITIONAL_HEADERS,
+        0,
+        WINHTTP_NO_REQUEST_DATA,
+        0,
+        0,
+        0
+        ) && WinHttpReceiveResponse(httpRequestHandle, NULL))
+    {
+        valueSize = sizeof(ULONG);
+        WinHttpQueryHeaders(
+            httpRequestHandle,
+            WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER,
+            WINHTTP_HEADER_NAME_BY_INDEX,
+            &statusCode,
+            &valueSize,
+            WINHTTP_NO_HEADER_INDEX
+            );
+
+        valueSize = sizeof(ULONG);
+        WinHttpQueryHeaders(
+            httpRequestHandle,
+            WINHTTP_QUERY_CONTENT_LENGTH | WINHTTP_QUERY_FLAG_NUMBER,
+            WINHTTP_HEADER_NAME_BY_INDEX,
+            &contentLength,
+            &valueSize,
+            WINHTTP_NO_HEADER_INDEX
+            );
+
+        valueSize = sizeof(acceptRanges);
+
+        if (statusCode == HTTP_STATUS_OK && contentLength != 0 && WinHttpQueryHeaders(
+            httpRequestHandle,
+            WINHTTP_QUERY_ACCEPT_RANGES,
+            WINHTTP_HEADER_NAME_BY_INDEX,
+            acceptRanges,
+            &valueSize,
+            WINHTTP_NO_HEADER_INDEX
+            ))
+        {
+            result = _wcsicmp(acceptRanges, L"bytes") == 0;
+        }
+    }
+
+    WinHttpCloseHandle(httpRequestHandle);
+
+    *ContentLength = contentLength;
+
+    return result;
+}
+
+static VOID InitializeDownloadStateHeader(
+    _In_ PUPDATER_DOWNLOAD Download,
+    _Out_ PUPDATER_DOWNLOAD_STATE Header
+    )
+{
+    memset(Header, 0, sizeof(UPDATER_DOWNLOAD_STATE));
+    Header->Magic = UPDATER_DOWNLOAD_STATE_MAGIC;
+    Header->ChunkSize = UPDATER_DOWNLOAD_CHUNK_SIZE;
+    Header->ContentLength = Download->ContentLength;
+
+    // The release hash identifies the file, so a partial download of an older
+    // release is never resumed.
+    memcpy(Header->Hash, Download->Context->Hash->Buffer, min(Download->Context->Hash->Length, sizeof(Header->Hash)));
+}
+
+static BOOLEAN OpenDownloadState(
+    _Inout_ PUPDATER_DOWNLOAD Download,
+    _In_ BOOLEAN Resumable
+    )
+{
+    PPH_STRING stateFileName;
+    UPDATER_DOWNLOAD_STATE header;
+    UPDATER_DOWNLOAD_STATE existingHeader;
+    PUCHAR completed;
+    LARGE_INTEGER offset;
+    LARGE_INTEGER stateSize;
+    IO_STATUS_BLOCK isb;
+    ULONG i;
+
+    stateFileName = PhConcatStrings2(Download->Context->SetupFilePath->Buffer, L".download");
+
+    if (!NT_SUCCESS(PhCreateFileWin32(
+        &Download->StateFileHandle,
+        stateFileName->Buffer,
+        FILE_GENERIC_READ | FILE_GENERIC_WRITE | DELETE,
+        FILE_ATTRIBUTE_NOT_CONTENT_INDEXED | FILE_ATTRIBUTE_TEMPORARY,
+        FILE_SHARE_READ,
+        FILE_OPEN_IF,
+        FILE_NON_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT
+        )))
+    {
+        PhDereferenceObject(stateFileName);
+        return FALSE;
+    }
+
+    PhDereferenceObject(stateFileName);
+
+    InitializeDownloadStateHeader(Download, &header);
+    completed = PhAllocate(Download->NumberOfChunks);
+
+    if (Resumable)
+    {
+        Resumable = FALSE;
+        offset.QuadPart = 0;
+
+        if (NT_SUCCESS(NtReadFile(Download->StateFileHandle, NULL, NULL, NULL, &isb, &existingHeader, sizeof(UPDATER_DOWNLOAD_STATE), &offset, NULL)) &&
+            isb.Information == sizeof(UPDATER_DOWNLOAD_STATE) &&
+            RtlEqualMemory(&existingHeader, &header, sizeof(UPDATER_DOWNLOAD_STATE)))
+        {
+            offset.QuadPart = sizeof(UPDATER_DOWNLOAD_STATE);
+
+            if (NT_SUCCESS(NtReadFile(Download->StateFileHandle, NULL, NULL, NULL, &isb, completed, Download->NumberOfChunks, &offset, NULL)) &&
+                isb.Information == Download->NumberOfChunks)
+            {
+                Resumable = TRUE;
             }
+        }
+    }
 
-            // Compute hash result (will fail if file not downloaded correctly).
-            if (PhFinalHash(&hashContext, &hashBuffer, 20, NULL))
+    if (Resumable)
+    {
+        for (i = 0; i < Download->NumberOfChunks; i++)
+        {
+            if (completed[i])
             {
-                // Allocate our hash string, hex the final hash result in our hashBuffer.
-                PPH_STRING hexString = PhBufferToHexString(hashBuffer, 20);
+                Download->Chunks[i].Completed = TRUE;
+                Download->DownloadedBytes += UPDATER_DOWNLOAD_CHUNK_LENGTH(Download->ContentLength, i);
+            }
+        }
+    }
+    else
+    {
+        // Start over.
 
-                if (PhEqualString(hexString, context->Hash, TRUE))
-                {
-                    hashSuccess = TRUE;
-                }
+        memset(completed, 0, Download->NumberOfChunks);
 
-                PhDereferenceObject(hexString);
-            }
+        offset.QuadPart = 0;
+        NtWriteFile(Download->StateFileHandle, NULL, NULL, NULL, &isb, &header, sizeof(UPDATER_DOWNLOAD_STATE), &offset, NULL);
+        offset.QuadPart = sizeof(UPDATER_DOWNLOAD_STATE);
+        NtWriteFile(Download->StateFileHandle, NULL, NULL, NULL, &isb, completed, Download->NumberOfChunks, &offset, NULL);
+
+        stateSize.QuadPart = sizeof(UPDATER_DOWNLOAD_STATE) + Download->NumberOfChunks;
+        PhSetFileSize(Download->StateFileHandle, &stateSize);
+    }
+
+    PhFree(completed);
+
+    return TRUE;
+}
+
+static BOOLEAN HashDownloadChunks(
+    _Inout_ PUPDATER_DOWNLOAD Download
+    )
+{
+    // The hash has to be computed in file order, so each chunk is hashed when it and
+    // all chunks before it are complete. The caller must hold the download lock.
+
+    while (Download->NextHashChunk < Download->NumberOfChunks)
+    {
+        PUPDATER_DOWNLOAD_CHUNK chunk = &Download->Chunks[Download->NextHashChunk];
+
+        if (!chunk->Completed)
+            break;
+
+        if (chunk->Buffer)
+        {
+            PhUpdateHash(&Download->HashContext, chunk->Buffer, chunk->Length);
+            PhFree(chunk->Buffer);
+            chunk->Buffer = NULL;
+        }
+        else
+        {
+            LARGE_INTEGER offset;
+            IO_STATUS_BLOCK isb;
+            ULONG length;
+
+            // This chunk was downloaded in an earlier attempt; read it back.
+
+            if (!Download->ReadBuffer)
+                Download->ReadBuffer = PhAllocate(UPDATER_DOWNLOAD_CHUNK_SIZE);
+
+            offset.QuadPart = (ULONG64)Download->NextHashChunk * UPDATER_DOWNLOAD_CHUNK_SIZE;
+            length = UPDATER_DOWNLOAD_CHUNK_LENGTH(Download->ContentLength, Download->NextHashChunk);
+
+            if (!NT_SUCCESS(NtReadFile(Download->FileHandle, NULL, NULL, NULL, &isb, Download->ReadBuffer, length, &offset, NULL)))
+                return FALSE;
+            if (isb.Information != length)
+                return FALSE;
+
+            PhUpdateHash(&Download->HashContext, Download->ReadBuffer, length);
+        }
+
+        Download->NextHashChunk++;
+    }
+
+    return TRUE;
+}
+
+static BOOLEAN DownloadChunk(
+    _In_ PUPDATER_DOWNLOAD Download,
+    _In_ ULONG Index,
+    _Out_writes_bytes_(UPDATER_DOWNLOAD_CHUNK_SIZE) PVOID Buffer
+    )
+{
+    BOOLEAN result = FALSE;
+    HINTERNET httpRequestHandle;
+    PPH_STRING rangeHeader;
+    ULONG offset;
+    ULONG length;
+    ULONG statusCode = 0;
+    ULONG statusCodeSize = sizeof(ULONG);
+    ULONG bytesDownloaded;
+    ULONG downloadedBytes = 0;
+
+    offset = Index * UPDATER_DOWNLOAD_CHUNK_SIZE;
+    length = UPDATER_DOWNLOAD_CHUNK_LENGTH(Download->ContentLength, Index);
+
+    // Requests on the same connection handle share WinHTTP's pool of keep-alive
+    // connections.
+    if (!(httpRequestHandle = WinHttpOpenRequest(
+        Download->ConnectionHandle,
+        NULL,
+        Download->UrlPath->Buffer,
+        NULL,
+        WINHTTP_NO_REFERER,
+        WINHTTP_DEFAULT_ACCEPT_TYPES,
+        Download->RequestFlags
+        )))
+    {
+        return FALSE;
+    }
+
+    rangeHeader = PhFormatString(L"Range: bytes=%lu-%lu", offset, offset + length - 1);
+
+    if (WinHttpSendRequest(
+        httpRequestHandle,
+        rangeHeader->Buffer,
+        (ULONG)rangeHeader->Length / sizeof(WCHAR),
+        WINHTTP_NO_REQUEST_DATA,
+        0,
+        0,
+        0
+        ) &&
+        WinHttpReceiveResponse(httpRequestHandle, NULL) &&
+        WinHttpQueryHeaders(
+        httpRequestHandle,
+        WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER,
+        WINHTTP_HEADER_NAME_BY_INDEX,
+        &statusCode,
+        &statusCodeSize,
+        WINHTTP_NO_HEADER_INDEX
+        ) &&
+        statusCode == HTTP_STATUS_PARTIAL_CONTENT)
+    {
+        while (downloadedBytes < length && UpdateDialogThreadHandle)
+        {
+            if (!WinHttpReadData(httpRequestHandle, (PCHAR)Buffer + downloadedBytes, length - downloadedBytes, &bytesDownloaded))
+                break;
+            if (bytesDownloaded == 0)
+                break;
+
+            downloadedBytes += bytesDownloaded;
         }
 
-        downloadSuccess = TRUE;
+        result = downloadedBytes == length;
+    }
+
+    PhDereferenceObject(rangeHeader);
+    WinHttpCloseHandle(httpRequestHandle);
+
+    return result;
+}
+
+static NTSTATUS DownloadChunkThread(
+    _In_ PVOID Parameter
+    )
+{
+    PUPDATER_DOWNLOAD download = Parameter;
+    PVOID buffer;
+    ULONG index;
+    ULONG length;
+    ULONG attempt;
+    BOOLEAN downloaded;
+    LARGE_INTEGER offset;
+    IO_STATUS_BLOCK isb;
+    UCHAR completed = TRUE;
+
+    buffer = PhAllocate(UPDATER_DOWNLOAD_CHUNK_SIZE);
+
+    while (!download->Failed)
+    {
+        index = (ULONG)_InterlockedIncrement(&download->NextChunk) - 1;
+
+        if (index >= download->NumberOfChunks)
+            break;
+        if (download->Chunks[index].Completed)
+            continue;
+
+        length = UPDATER_DOWNLOAD_CHUNK_LENGTH(download->ContentLength, index);
+        downloaded = FALSE;
+
+        // Retry the chunk a few times before giving up on the whole download. Chunks
+        // which have already been written are kept for the next attempt.
+        for (attempt = 0; attempt < UPDATER_DOWNLOAD_RETRIES && UpdateDialogThreadHandle; attempt++)
+        {
+            if (downloaded = DownloadChunk(download, index, buffer))
+                break;
+        }
+
+        if (!downloaded)
+        {
+            download->Failed = TRUE;
+            break;
+        }
+
+        offset.QuadPart = (ULONG64)index * UPDATER_DOWNLOAD_CHUNK_SIZE;
+
+        if (!NT_SUCCESS(NtWriteFile(download->FileHandle, NULL, NULL, NULL, &isb, buffer, length, &offset, NULL)) ||
+            isb.Information != length)
+        {
+            download->Failed = TRUE;
+            break;
+        }
+
+        // Record the chunk as complete. If this fails we'll just download the chunk
+        // again when the download is resumed.
+        offset.QuadPart = sizeof(UPDATER_DOWNLOAD_STATE) + index;
+        NtWriteFile(download->StateFileHandle, NULL, NULL, NULL, &isb, &completed, sizeof(UCHAR), &offset, NULL);
+
+        PhAcquireQueuedLockExclusive(&download->Lock);
+
+        download->Chunks[index].Buffer = buffer;
+        download->Chunks[index].Length = length;
+        download->Chunks[index].Completed = TRUE;
+        download->DownloadedBytes += length;
+
+        if (!HashDownloadChunks(download))
+            download->Failed = TRUE;
+
+        UpdateDownloadProgress(download->Context, download->DownloadedBytes, download->ContentLength);
+
+        PhReleaseQueuedLockExclusive(&download->Lock);
+
+        // The chunk now owns the buffer until it is hashed.
+        buffer = PhAllocate(UPDATER_DOWNLOAD_CHUNK_SIZE);
+    }
+
+    PhFree(buffer);
+
+    return STATUS_SUCCESS;
+}
+
+static BOOLEAN DownloadSetupFileRanges(
+    _In_ PPH_UPDATER_CONTEXT Context,
+    _In_ HINTERNET ConnectionHandle,
+    _In_ PPH_STRING UrlPath,
+    _In_ ULONG RequestFlags,
+    _In_ ULONG ContentLength,
+    _Out_writes_bytes_(20) PUCHAR Hash
+    )
+{
+    BOOLEAN result = FALSE;
+    UPDATER_DOWNLOAD download;
+    HANDLE threadHandles[UPDATER_DOWNLOAD_THREADS];
+    ULONG numberOfThreads = 0;
+    LARGE_INTEGER fileSize;
+    BOOLEAN resumable;
+    ULONG i;
+
+    memset(&download, 0, sizeof(UPDATER_DOWNLOAD));
+    download.Context = Context;
+    download.ConnectionHandle = ConnectionHandle;
+    download.UrlPath = UrlPath;
+    download.RequestFlags = RequestFlags;
+    download.ContentLength = ContentLength;
+    download.NumberOfChunks = (ContentLength + UPDATER_DOWNLOAD_CHUNK_SIZE - 1) / UPDATER_DOWNLOAD_CHUNK_SIZE;
+    download.Chunks = PhAllocate(download.NumberOfChunks * sizeof(UPDATER_DOWNLOAD_CHUNK));
+    memset(download.Chunks, 0, download.NumberOfChunks * sizeof(UPDATER_DOWNLOAD_CHUNK));
+    PhInitializeQueuedLock(&download.Lock);
+    PhInitializeHash(&download.HashContext, Sha1HashAlgorithm);
+
+    __try
+    {
+        // The chunks are written directly into the setup file. If it already has the
+        // right size, it may be left over from an interrupted download.
+        if (!NT_SUCCESS(PhCreateFileWin32(
+            &download.FileHandle,
+            Context->SetupFilePath->Buffer,
+            FILE_GENERIC_READ | FILE_GENERIC_WRITE,
+            FILE_ATTRIBUTE_NOT_CONTENT_INDEXED | FILE_ATTRIBUTE_TEMPORARY,
+            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            FILE_OPEN_IF,
+            FILE_NON_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT
+            )))
+        {
+            __leave;
+        }
+
+        resumable = NT_SUCCESS(PhGetFileSize(download.FileHandle, &fileSize)) && fileSize.QuadPart == ContentLength;
+
+        if (!OpenDownloadState(&download, resumable))
+            __leave;
+
+        if (!resumable)
+        {
+            // Allocate the whole file up front.
+            fileSize.QuadPart = ContentLength;
+
+            if (!NT_SUCCESS(PhSetFileSize(download.FileHandle, &fileSize)))
+                __leave;
+        }
+
+        // Hash the chunks at the start of the file which we already have.
+        if (!HashDownloadChunks(&download))
+            __leave;
+
+        for (i = 0; i < UPDATER_DOWNLOAD_THREADS && i < download.NumberOfChunks; i++)
+        {
+            if (!(threadHandles[numberOfThreads] = PhCreateThread(0, DownloadChunkThread, &download)))
+                break;
+
+            numberOfThreads++;
+        }
+
+        if (numberOfThreads == 0)
+            __leave;
+
+        NtWaitForMultipleObjects(numberOfThreads, threadHandles, WaitAll, FALSE, NULL);
+
+        for (i = 0; i < numberOfThreads; i++)
+            NtClose(threadHandles[i]);
+
+        if (download.Failed || download.NextHashChunk != download.NumberOfChunks)
+            __leave;
+
+        // The download is complete, so we don't need the state any more. If the hash
+        // turns out to be wrong, the next attempt starts over.
+        {
+            FILE_DISPOSITION_INFORMATION dispositionInfo;
+            IO_STATUS_BLOCK isb;
+
+            dispositionInfo.DeleteFile = TRUE;
+            NtSetInformationFile(
+                download.StateFileHandle,
+                &isb,
+                &dispositionInfo,
+                sizeof(FILE_DISPOSITION_INFORMATION),
+                FileDispositionInformation
+                );
+        }
+
+        result = PhFinalHash(&download.HashContext, Hash, 20, NULL);
     }
     __finally
     {
-        if (tempFileHandle)
-            NtClose(tempFileHandle);
+        for (i = 0; i < download.NumberOfChunks; i++)
+        {
+            if (download.Chunks[i].Buffer)
+                PhFree(download.Chunks[i].Buffer);
+        }
 
-        if (httpRequestHandle)
-            WinHttpCloseHandle(httpRequestHandle);
+        PhFree(download.Chunks);
+
+        if (download.ReadBuffer)
+            PhFree(download.ReadBuffer);
+
+        if (download.StateFileHandle)
+            NtClose(download.StateFileHandle);
+
+        if (download.FileHandle)
+            NtClose(download.FileHandle);
+    }
+
+    return result;
+}
 
+static NTSTATUS UpdateDownloadThread(
+    _In_ PVOID Parameter
+    )
+{
+    BOOLEAN downloadSuccess = FALSE;
+    BOOLEAN hashSuccess = FALSE;
+    BOOLEAN verifySuccess = FALSE;
+    HINTERNET httpSessionHandle = NULL;
+    HINTERNET httpConnectionHandle = NULL;
+    PPH_STRING setupTempPath = NULL;
+    PPH_STRING downloadHostPath = NULL;
+    PPH_STRING downloadUrlPath = NULL;
+    PPH_STRING userAgentString = NULL;
+    ULONG requestFlags;
+    ULONG contentLength;
+    UCHAR hashBuffer[20];
+    URL_COMPONENTS httpUrlComponents = { sizeof(URL_COMPONENTS) };
+    WINHTTP_CURRENT_USER_IE_PROXY_CONFIG proxyConfig = { 0 };
+
+    PPH_UPDATER_CONTEXT context = (PPH_UPDATER_CONTEXT)Parameter;
+
+    __try
+    {
+        // Create a user agent string.
+        userAgentString = PhFormatString(
+            L"PH_%lu.%lu_%lu",
+            context->CurrentMajorVersion,
+            context->CurrentMinorVersion,
+            context->CurrentRevisionVersion
+            );
+        if (PhIsNullOrEmptyString(userAgentString))
+            __leave;
+
+        // Allocate the GetTempPath buffer
+        setupTempPath = PhCreateStringEx(NULL, GetTempPath(0, NULL) * sizeof(WCHAR));
+        if (PhIsNullOrEmptyString(setupTempPath))
+            __leave;
+
+        // Get the temp path
+        if (GetTempPath((ULONG)setupTempPath->Length / sizeof(WCHAR), setupTempPath->Buffer) == 0)
+            __leave;
+        if (PhIsNullOrEmptyString(setupTempPath))
+            __leave;
+
+        // Append the tempath to our string: %TEMP%processhacker-%lu.%lu-setup.exe
+        // Example: C:\\Users\\dmex\\AppData\\Temp\\processhacker-2.90-setup.exe
+        context->SetupFilePath = PhFormatString(
+            L"%sprocesshacker-%lu.%lu-setup.exe",
+            setupTempPath->Buffer,
+            context->MajorVersion,
+            context->MinorVersion
+            );
+        if (PhIsNullOrEmptyString(context->SetupFilePath))
+            __leave;
+
+        // Set lengths to non-zero enabling these params to be cracked.
+        httpUrlComponents.dwSchemeLength = (ULONG)-1;
+        httpUrlComponents.dwHostNameLength = (ULONG)-1;
+        httpUrlComponents.dwUrlPathLength = (ULONG)-1;
+
+        if (!WinHttpCrackUrl(
+            context->SetupFileDownloadUrl->Buffer,
+            (ULONG)context->SetupFileDownloadUrl->Length,
+            0,
+            &httpUrlComponents
+            ))
+        {
+            __leave;
+        }
+
+        // Create the Host string.
+        downloadHostPath = PhCreateStringEx(
+            httpUrlComponents.lpszHostName,
+            httpUrlComponents.dwHostNameLength * sizeof(WCHAR)
+            );
+        if (PhIsNullOrEmptyString(downloadHostPath))
+            __leave;
+
+        // Create the Path string.
+        downloadUrlPath = PhCreateStringEx(
+            httpUrlComponents.lpszUrlPath,
+            httpUrlComponents.dwUrlPathLength * sizeof(WCHAR)
+            );
+        if (PhIsNullOrEmptyString(downloadUrlPath))
+            __leave;
+
+        SetDlgItemText(context->DialogHandle, IDC_STATUS, L"Connecting...");
+
+        // Query the current system proxy
+        WinHttpGetIEProxyConfigForCurrentUser(&proxyConfig);
+
+        // Open the HTTP session with the system proxy configuration if available
+        if (!(httpSessionHandle = WinHttpOpen(
+            userAgentString->Buffer,
+            proxyConfig.lpszProxy != NULL ? WINHTTP_ACCESS_TYPE_NAMED_PROXY : WINHTTP_ACCESS_TYPE_DEFAULT_PROXY,
+            proxyConfig.lpszProxy,
+            proxyConfig.lpszProxyBypass,
+            0
+            )))
+        {
+            __leave;
+        }
+
+        // Note: We don't enable GZIP and DEFLATE support here. The setup file is already
+        // compressed, and range requests must refer to offsets in the file itself.
+
+        if (!(httpConnectionHandle = WinHttpConnect(
+            httpSessionHandle,
+            downloadHostPath->Buffer,
+            httpUrlComponents.nScheme == INTERNET_SCHEME_HTTP ? INTERNET_DEFAULT_HTTP_PORT : INTERNET_DEFAULT_HTTPS_PORT,
+            0
+            )))
+        {
+            __leave;
+        }
+
+        requestFlags = WINHTTP_FLAG_REFRESH | (httpUrlComponents.nScheme == INTERNET_SCHEME_HTTPS ? WINHTTP_FLAG_SECURE : 0);
+
+        // Download the file in parallel ranges if the server supports it, otherwise fall
+        // back to a single stream.
+        if (QuerySetupFileRanges(httpConnectionHandle, downloadUrlPath, requestFlags, &contentLength))
+            downloadSuccess = DownloadSetupFileRanges(context, httpConnectionHandle, downloadUrlPath, requestFlags, contentLength, hashBuffer);
+        else
+            downloadSuccess = DownloadSetupFile(context, httpConnectionHandle, downloadUrlPath, requestFlags, hashBuffer);
+
+        if (downloadSuccess)
+        {
+            // Allocate our hash string, hex the final hash result in our hashBuffer.
+            PPH_STRING hexString = PhBufferToHexString(hashBuffer, 20);
+
+            if (PhEqualString(hexString, context->Hash, TRUE))
+            {
+                hashSuccess = TRUE;
+            }
+
+            PhDereferenceObject(hexString);
+        }
+    }
+    __finally
+    {
         if (httpConnectionHandle)
             WinHttpCloseHandle(httpConnectionHandle);
 
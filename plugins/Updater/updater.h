@@ -100,6 +100,53 @@ typedef struct _PH_UPDATER_CONTEXT
     PPH_STRING SetupFilePath;
 } PH_UPDATER_CONTEXT, *PPH_UPDATER_CONTEXT;
 
+#define UPDATER_DOWNLOAD_CHUNK_SIZE (256 * 1024)
+#define UPDATER_DOWNLOAD_CHUNK_LENGTH(ContentLength, Index) \
+    (min((ContentLength) - (Index) * UPDATER_DOWNLOAD_CHUNK_SIZE, UPDATER_DOWNLOAD_CHUNK_SIZE))
+#define UPDATER_DOWNLOAD_THREADS 4
+#define UPDATER_DOWNLOAD_RETRIES 3
+#define UPDATER_DOWNLOAD_STATE_MAGIC ('dlhP')
+
+// The state of a partial download is stored next to the setup file: this header,
+// followed by one byte per chunk which is non-zero once the chunk has been written.
+typedef struct _UPDATER_DOWNLOAD_STATE
+{
+    ULONG Magic;
+    ULONG ChunkSize;
+    ULONG ContentLength;
+    ULONG Reserved;
+    WCHAR Hash[40];
+} UPDATER_DOWNLOAD_STATE, *PUPDATER_DOWNLOAD_STATE;
+
+typedef struct _UPDATER_DOWNLOAD_CHUNK
+{
+    BOOLEAN Completed;
+    ULONG Length;
+    PVOID Buffer; // downloaded data waiting to be hashed
+} UPDATER_DOWNLOAD_CHUNK, *PUPDATER_DOWNLOAD_CHUNK;
+
+typedef struct _UPDATER_DOWNLOAD
+{
+    PPH_UPDATER_CONTEXT Context;
+    HINTERNET ConnectionHandle;
+    PPH_STRING UrlPath;
+    ULONG RequestFlags;
+    ULONG ContentLength;
+    ULONG NumberOfChunks;
+
+    HANDLE FileHandle;
+    HANDLE StateFileHandle;
+    volatile LONG NextChunk;
+    volatile BOOLEAN Failed;
+
+    PH_QUEUED_LOCK Lock;
+    PUPDATER_DOWNLOAD_CHUNK Chunks;
+    ULONG NextHashChunk;
+    PH_HASH_CONTEXT HashContext;
+    ULONG DownloadedBytes;
+    PVOID ReadBuffer;
+} UPDATER_DOWNLOAD, *PUPDATER_DOWNLOAD;
+
 VOID ShowUpdateDialog(
     _In_opt_ PPH_UPDATER_CONTEXT Context
     );
@@ -38,6 +38,8 @@ ULONG NTAPI ObjectDbHashFunction(
 PPH_HASHTABLE ObjectDb;
 PH_QUEUED_LOCK ObjectDbLock = PH_QUEUED_LOCK_INIT;
 PPH_STRING ObjectDbPath;
+PH_QUEUED_LOCK ObjectDbSaveLock = PH_QUEUED_LOCK_INIT;
+LONG ObjectDbSaveQueued = 0;
 
 VOID InitializeDb(
     VOID
@@ -59,7 +61,7 @@ BOOLEAN NTAPI ObjectDbCompareFunction(
     PDB_OBJECT object1 = *(PDB_OBJECT *)Entry1;
     PDB_OBJECT object2 = *(PDB_OBJECT *)Entry2;
 
-    return object1->Tag == object2->Tag && PhEqualStringRef(&object1->Key, &object2->Key, TRUE);
+    return object1->Tag == object2->Tag && object1->KeyHash == object2->KeyHash && PhEqualStringRef(&object1->Key, &object2->Key, TRUE);
 }
 
 ULONG NTAPI ObjectDbHashFunction(
@@ -68,7 +70,7 @@ ULONG NTAPI ObjectDbHashFunction(
 {
     PDB_OBJECT object = *(PDB_OBJECT *)Entry;
 
-    return object->Tag + PhHashStringRef(&object->Key, TRUE);
+    return object->Tag + object->KeyHash;
 }
 
 ULONG GetNumberOfDbObjects(
@@ -103,6 +105,7 @@ PDB_OBJECT FindDbObject(
 
     lookupObject.Tag = Tag;
     lookupObject.Key = *Name;
+    lookupObject.KeyHash = PhHashStringRef(Name, TRUE);
     lookupObjectPtr = &lookupObject;
 
     objectPtr = PhFindEntryHashtable(ObjectDb, &lookupObjectPtr);
@@ -127,6 +130,7 @@ PDB_OBJECT CreateDbObject(
     memset(object, 0, sizeof(DB_OBJECT));
     object->Tag = Tag;
     object->Key = *Name;
+    object->KeyHash = PhHashStringRef(Name, TRUE);
     object->BackColor = ULONG_MAX;
 
     realObject = PhAddEntryHashtableEx(ObjectDb, &object, &added);
@@ -398,6 +402,10 @@ NTSTATUS SaveDb(
     ULONG enumerationKey = 0;
     PDB_OBJECT *object;
 
+    // Saves can run on the work queue, so we have to make sure that an older snapshot of the
+    // database is never written after a newer one.
+    PhAcquireQueuedLockExclusive(&ObjectDbSaveLock);
+
     topNode = mxmlNewElement(MXML_NO_PARENT, "objects");
 
     LockDb();
@@ -458,6 +466,7 @@ NTSTATUS SaveDb(
     if (!NT_SUCCESS(status))
     {
         mxmlDelete(topNode);
+        PhReleaseQueuedLockExclusive(&ObjectDbSaveLock);
         return status;
     }
 
@@ -465,5 +474,31 @@ NTSTATUS SaveDb(
     mxmlDelete(topNode);
     NtClose(fileHandle);
 
+    PhReleaseQueuedLockExclusive(&ObjectDbSaveLock);
+
     return STATUS_SUCCESS;
 }
+
+static NTSTATUS SaveDbWorker(
+    _In_ PVOID Parameter
+    )
+{
+    // Changes made after this point will queue another save.
+    _InterlockedExchange(&ObjectDbSaveQueued, 0);
+
+    SaveDb();
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * Saves the database in the background. Multiple changes made in quick succession are
+ * written out together.
+ */
+VOID QueueSaveDb(
+    VOID
+    )
+{
+    if (_InterlockedExchange(&ObjectDbSaveQueued, 1) == 0)
+        PhQueueItemGlobalWorkQueue(SaveDbWorker, NULL);
+}
@@ -36,6 +36,7 @@ typedef struct _DB_OBJECT
 {
     ULONG Tag;
     PH_STRINGREF Key;
+    ULONG KeyHash; // case-insensitive hash of Key
 
     PPH_STRING Name;
     PPH_STRING Comment;
@@ -87,4 +88,8 @@ NTSTATUS SaveDb(
     VOID
     );
 
+VOID QueueSaveDb(
+    VOID
+    );
+
 #endif
@@ -379,7 +379,7 @@ VOID NTAPI MenuItemCallback(
             }
 
             UnlockDb();
-            SaveDb();
+            QueueSaveDb();
         }
         break;
     case PROCESS_PRIORITY_SAVE_FOR_THIS_COMMAND_LINE_ID:
@@ -400,7 +400,7 @@ VOID NTAPI MenuItemCallback(
                 }
 
                 UnlockDb();
-                SaveDb();
+                QueueSaveDb();
             }
         }
         break;
@@ -420,7 +420,7 @@ VOID NTAPI MenuItemCallback(
             }
 
             UnlockDb();
-            SaveDb();
+            QueueSaveDb();
         }
         break;
     case PROCESS_IO_PRIORITY_SAVE_FOR_THIS_COMMAND_LINE_ID:
@@ -441,7 +441,7 @@ VOID NTAPI MenuItemCallback(
                 }
 
                 UnlockDb();
-                SaveDb();
+                QueueSaveDb();
             }
         }
         break;
@@ -468,7 +468,7 @@ VOID NTAPI MenuItemCallback(
                 }
 
                 UnlockDb();
-                SaveDb();
+                QueueSaveDb();
             }
 
             PhInvalidateAllProcessNodes();
@@ -485,7 +485,7 @@ VOID NTAPI MenuItemCallback(
             }
 
             UnlockDb();
-            SaveDb();
+            QueueSaveDb();
 
             PhInvalidateAllProcessNodes();
         }
@@ -538,7 +538,7 @@ VOID NTAPI MenuHookCallback(
             PhFree(processes);
 
             if (changed)
-                SaveDb();
+                QueueSaveDb();
         }
         break;
     case PHAPP_ID_I_0:
@@ -574,7 +574,7 @@ VOID NTAPI MenuHookCallback(
             PhFree(processes);
 
             if (changed)
-                SaveDb();
+                QueueSaveDb();
         }
         break;
     }
@@ -1404,7 +1404,7 @@ INT_PTR CALLBACK ProcessCommentPageDlgProc(
 
             PhPropPageDlgProcDestroy(hwndDlg);
 
-            SaveDb();
+            QueueSaveDb();
             InvalidateProcessComments();
         }
         break;
@@ -1577,7 +1577,7 @@ INT_PTR CALLBACK ServiceCommentPageDlgProc(
 
                     PhDereferenceObject(comment);
 
-                    SaveDb();
+                    QueueSaveDb();
                     InvalidateServiceComments();
 
                     SetWindowLongPtr(hwndDlg, DWLP_MSGRESULT, PSNRET_NOERROR);
@@ -25,8 +25,12 @@
 #include "resource.h"
 #include <windowsx.h>
 
+#define WE_REFRESH_TIMER_ID 10
+#define WE_REFRESH_TIMER_INTERVAL 500
+
 typedef struct _WINDOWS_CONTEXT
 {
+    HWND WindowHandle;
     HWND TreeNewHandle;
     WE_WINDOW_TREE_CONTEXT TreeContext;
     WE_WINDOW_SELECTOR Selector;
@@ -35,8 +39,48 @@ typedef struct _WINDOWS_CONTEXT
 
     HWND HighlightingWindow;
     ULONG HighlightingWindowCount;
+
+    HANDLE ScanThreadHandle;
+    ULONG ScanGeneration;
+    BOOLEAN RefreshPending;
+    BOOLEAN RefreshTimerActive;
 } WINDOWS_CONTEXT, *PWINDOWS_CONTEXT;
 
+typedef struct _WE_WINDOW_SCAN_KNOWN
+{
+    HWND WindowHandle;
+    HANDLE ThreadId;
+    BOOLEAN TextDirty;
+} WE_WINDOW_SCAN_KNOWN, *PWE_WINDOW_SCAN_KNOWN;
+
+typedef struct _WE_WINDOW_SCAN_ENTRY
+{
+    HWND WindowHandle;
+    HWND ParentHandle; // NULL for root windows
+    CLIENT_ID ClientId;
+    BOOLEAN WindowVisible;
+    BOOLEAN HasChildren;
+    BOOLEAN InfoValid; // WindowClass and WindowText were queried
+    WCHAR WindowClass[64];
+    PPH_STRING WindowText;
+} WE_WINDOW_SCAN_ENTRY, *PWE_WINDOW_SCAN_ENTRY;
+
+// A snapshot of the windows shown by a dialog. It is created on the GUI thread, filled in on
+// a background thread and merged back into the tree on the GUI thread.
+typedef struct _WE_WINDOW_SCAN
+{
+    HWND WindowHandle;
+    ULONG Generation;
+    WE_WINDOW_SELECTOR_TYPE SelectorType;
+    HANDLE FilterProcessId;
+    HANDLE FilterThreadId;
+    PPH_STRING DesktopName;
+
+    PPH_LIST OpenedList; // windows whose children are shown
+    PPH_HASHTABLE KnownHashtable; // windows that are already in the tree
+    PPH_LIST EntryList;
+} WE_WINDOW_SCAN, *PWE_WINDOW_SCAN;
+
 VOID WepShowWindowsDialogCallback(
     _In_ PVOID Parameter
     );
@@ -49,6 +93,8 @@ INT_PTR CALLBACK WepWindowsDlgProc(
     );
 
 static RECT MinimumSize = { -1, -1, -1, -1 };
+static PPH_LIST WindowsContextList = NULL;
+static HWINEVENTHOOK WindowsEventHooks[2] = { NULL, NULL };
 
 VOID WeShowWindowsDialog(
     _In_ HWND ParentWindowHandle,
@@ -118,18 +164,20 @@ VOID WepFillWindowInfo(
 }
 
 VOID WepAddChildWindowNode(
-    _In_ PWE_WINDOW_TREE_CONTEXT Context,
+    _In_ PWINDOWS_CONTEXT Context,
     _In_opt_ PWE_WINDOW_NODE ParentNode,
     _In_ HWND hwnd
     )
 {
     PWE_WINDOW_NODE childNode;
 
-    childNode = WeAddWindowNode(Context);
+    childNode = WeAddWindowNode(&Context->TreeContext);
     childNode->WindowHandle = hwnd;
     WepFillWindowInfo(childNode);
 
     childNode->Node.Expanded = FALSE;
+    // Keep the node if a scan that started before it was added completes.
+    childNode->ScanGeneration = Context->ScanGeneration;
 
     if (ParentNode)
     {
@@ -140,7 +188,7 @@ VOID WepAddChildWindowNode(
     else
     {
         // This is a root node.
-        PhAddItemList(Context->NodeRootList, childNode);
+        PhAddItemList(Context->TreeContext.NodeRootList, childNode);
     }
 }
 
@@ -169,7 +217,93 @@ VOID WepAddChildWindows(
             (!FilterThreadId || UlongToHandle(threadId) == FilterThreadId)
             )
         {
-            WepAddChildWindowNode(&Context->TreeContext, ParentNode, childWindow);
+            WepAddChildWindowNode(Context, ParentNode, childWindow);
+        }
+
+        i++;
+    }
+}
+
+BOOLEAN WepScanKnownHashtableCompareFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    )
+{
+    return ((PWE_WINDOW_SCAN_KNOWN)Entry1)->WindowHandle == ((PWE_WINDOW_SCAN_KNOWN)Entry2)->WindowHandle;
+}
+
+ULONG WepScanKnownHashtableHashFunction(
+    _In_ PVOID Entry
+    )
+{
+    return PhHashIntPtr((ULONG_PTR)((PWE_WINDOW_SCAN_KNOWN)Entry)->WindowHandle);
+}
+
+VOID WepScanAddWindow(
+    _In_ PWE_WINDOW_SCAN Scan,
+    _In_opt_ HWND ParentHandle,
+    _In_ HWND hwnd,
+    _In_ ULONG ProcessId,
+    _In_ ULONG ThreadId
+    )
+{
+    PWE_WINDOW_SCAN_ENTRY entry;
+    WE_WINDOW_SCAN_KNOWN lookupKnown;
+    PWE_WINDOW_SCAN_KNOWN known;
+
+    entry = PhAllocate(sizeof(WE_WINDOW_SCAN_ENTRY));
+    memset(entry, 0, sizeof(WE_WINDOW_SCAN_ENTRY));
+    entry->WindowHandle = hwnd;
+    entry->ParentHandle = ParentHandle;
+    entry->ClientId.UniqueProcess = UlongToHandle(ProcessId);
+    entry->ClientId.UniqueThread = UlongToHandle(ThreadId);
+    entry->WindowVisible = !!IsWindowVisible(hwnd);
+    entry->HasChildren = !!FindWindowEx(hwnd, NULL, NULL, NULL);
+
+    // The class and owner of a window never change, so we only need to query windows we haven't
+    // seen before (or whose handle has been reused) and windows whose text has changed.
+
+    lookupKnown.WindowHandle = hwnd;
+    known = PhFindEntryHashtable(Scan->KnownHashtable, &lookupKnown);
+
+    if (!known || known->ThreadId != entry->ClientId.UniqueThread || known->TextDirty)
+    {
+        GetClassName(hwnd, entry->WindowClass, sizeof(entry->WindowClass) / sizeof(WCHAR));
+        // Don't send WM_GETTEXT. Windows owned by the GUI thread would deadlock if the dialog is
+        // waiting for this thread.
+        PhGetWindowTextEx(hwnd, PH_GET_WINDOW_TEXT_INTERNAL, &entry->WindowText);
+        entry->InfoValid = TRUE;
+    }
+
+    PhAddItemList(Scan->EntryList, entry);
+}
+
+VOID WepScanChildWindows(
+    _In_ PWE_WINDOW_SCAN Scan,
+    _In_opt_ HWND ParentHandle,
+    _In_ HWND hwnd,
+    _In_opt_ HANDLE FilterProcessId,
+    _In_opt_ HANDLE FilterThreadId
+    )
+{
+    HWND childWindow = NULL;
+    ULONG i = 0;
+
+    // We use FindWindowEx because EnumWindows doesn't return Metro app windows.
+    // Set a reasonable limit to prevent infinite loops.
+    while (i < 0x800 && (childWindow = FindWindowEx(hwnd, childWindow, NULL, NULL)))
+    {
+        ULONG processId;
+        ULONG threadId;
+
+        threadId = GetWindowThreadProcessId(childWindow, &processId);
+
+        if (
+            (!FilterProcessId || UlongToHandle(processId) == FilterProcessId) &&
+            (!FilterThreadId || UlongToHandle(threadId) == FilterThreadId)
+            )
+        {
+            WepScanAddWindow(Scan, ParentHandle, childWindow, processId, threadId);
         }
 
         i++;
@@ -181,73 +315,338 @@ BOOL CALLBACK WepEnumDesktopWindowsProc(
     _In_ LPARAM lParam
     )
 {
-    PWINDOWS_CONTEXT context = (PWINDOWS_CONTEXT)lParam;
+    ULONG processId;
+    ULONG threadId;
 
-    WepAddChildWindowNode(&context->TreeContext, NULL, hwnd);
+    threadId = GetWindowThreadProcessId(hwnd, &processId);
+    WepScanAddWindow((PWE_WINDOW_SCAN)lParam, NULL, hwnd, processId, threadId);
 
     return TRUE;
 }
 
-VOID WepAddDesktopWindows(
-    _In_ PWINDOWS_CONTEXT Context,
-    _In_ PWSTR DesktopName
+NTSTATUS WepScanWindowsThreadStart(
+    _In_ PVOID Parameter
     )
 {
-    HDESK desktopHandle;
+    PWE_WINDOW_SCAN scan = Parameter;
+    HWND desktopWindow;
+    ULONG i;
 
-    if (desktopHandle = OpenDesktop(DesktopName, 0, FALSE, DESKTOP_ENUMERATE))
+    desktopWindow = GetDesktopWindow();
+
+    switch (scan->SelectorType)
     {
-        EnumDesktopWindows(desktopHandle, WepEnumDesktopWindowsProc, (LPARAM)Context);
-        CloseDesktop(desktopHandle);
+    case WeWindowSelectorAll:
+        {
+            ULONG processId;
+            ULONG threadId;
+
+            threadId = GetWindowThreadProcessId(desktopWindow, &processId);
+            WepScanAddWindow(scan, NULL, desktopWindow, processId, threadId);
+            WepScanChildWindows(scan, desktopWindow, desktopWindow, NULL, NULL);
+        }
+        break;
+    case WeWindowSelectorThread:
+        WepScanChildWindows(scan, NULL, desktopWindow, NULL, scan->FilterThreadId);
+        break;
+    case WeWindowSelectorProcess:
+        WepScanChildWindows(scan, NULL, desktopWindow, scan->FilterProcessId, NULL);
+        break;
+    case WeWindowSelectorDesktop:
+        {
+            HDESK desktopHandle;
+
+            if (desktopHandle = OpenDesktop(scan->DesktopName->Buffer, 0, FALSE, DESKTOP_ENUMERATE))
+            {
+                EnumDesktopWindows(desktopHandle, WepEnumDesktopWindowsProc, (LPARAM)scan);
+                CloseDesktop(desktopHandle);
+            }
+        }
+        break;
     }
+
+    // Refresh the children of expanded windows. Parents always come before their children in
+    // the list, so the GUI thread can attach each entry to a node that already exists.
+    for (i = 0; i < scan->OpenedList->Count; i++)
+    {
+        HWND hwnd = scan->OpenedList->Items[i];
+
+        if (scan->SelectorType == WeWindowSelectorAll && hwnd == desktopWindow)
+            continue;
+
+        WepScanChildWindows(scan, hwnd, hwnd, NULL, NULL);
+    }
+
+    PostMessage(scan->WindowHandle, WM_WE_SCAN_COMPLETED, 0, (LPARAM)scan);
+
+    return STATUS_SUCCESS;
+}
+
+VOID WepDestroyWindowScan(
+    _In_ PWE_WINDOW_SCAN Scan
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < Scan->EntryList->Count; i++)
+    {
+        PWE_WINDOW_SCAN_ENTRY entry = Scan->EntryList->Items[i];
+
+        if (entry->WindowText) PhDereferenceObject(entry->WindowText);
+
+        PhFree(entry);
+    }
+
+    if (Scan->DesktopName) PhDereferenceObject(Scan->DesktopName);
+
+    PhDereferenceObject(Scan->OpenedList);
+    PhDereferenceObject(Scan->KnownHashtable);
+    PhDereferenceObject(Scan->EntryList);
+    PhFree(Scan);
 }
 
 VOID WepRefreshWindows(
     _In_ PWINDOWS_CONTEXT Context
     )
 {
-    TreeNew_SetRedraw(Context->TreeNewHandle, FALSE);
-    WeClearWindowTree(&Context->TreeContext);
-    TreeNew_NodesStructured(Context->TreeNewHandle);
+    PWE_WINDOW_SCAN scan;
+    ULONG i;
+
+    // Only one scan runs at a time. Refresh requests made in the meantime are combined into a
+    // single scan that starts when the current one completes.
+    if (Context->ScanThreadHandle)
+    {
+        Context->RefreshPending = TRUE;
+        return;
+    }
+
+    Context->RefreshPending = FALSE;
+
+    scan = PhAllocate(sizeof(WE_WINDOW_SCAN));
+    memset(scan, 0, sizeof(WE_WINDOW_SCAN));
+    scan->WindowHandle = Context->WindowHandle;
+    scan->Generation = ++Context->ScanGeneration;
+    scan->SelectorType = Context->Selector.Type;
 
     switch (Context->Selector.Type)
     {
-    case WeWindowSelectorAll:
-        {
-            PWE_WINDOW_NODE desktopNode;
+    case WeWindowSelectorThread:
+        scan->FilterThreadId = Context->Selector.Thread.ThreadId;
+        break;
+    case WeWindowSelectorProcess:
+        scan->FilterProcessId = Context->Selector.Process.ProcessId;
+        break;
+    case WeWindowSelectorDesktop:
+        PhSetReference(&scan->DesktopName, Context->Selector.Desktop.DesktopName);
+        break;
+    }
+
+    scan->OpenedList = PhCreateList(10);
+    scan->KnownHashtable = PhCreateHashtable(
+        sizeof(WE_WINDOW_SCAN_KNOWN),
+        WepScanKnownHashtableCompareFunction,
+        WepScanKnownHashtableHashFunction,
+        Context->TreeContext.NodeList->Count + 1
+        );
+    scan->EntryList = PhCreateList(Context->TreeContext.NodeList->Count + 100);
+
+    for (i = 0; i < Context->TreeContext.NodeList->Count; i++)
+    {
+        PWE_WINDOW_NODE node = Context->TreeContext.NodeList->Items[i];
+        WE_WINDOW_SCAN_KNOWN known;
+
+        known.WindowHandle = node->WindowHandle;
+        known.ThreadId = node->ClientId.UniqueThread;
+        known.TextDirty = !!node->TextDirty;
+        PhAddEntryHashtable(scan->KnownHashtable, &known);
+        node->TextDirty = FALSE;
 
-            desktopNode = WeAddWindowNode(&Context->TreeContext);
-            desktopNode->WindowHandle = GetDesktopWindow();
-            WepFillWindowInfo(desktopNode);
+        if (node->Opened)
+            PhAddItemList(scan->OpenedList, node->WindowHandle);
+    }
 
-            PhAddItemList(Context->TreeContext.NodeRootList, desktopNode);
+    if (!(Context->ScanThreadHandle = PhCreateThread(0, WepScanWindowsThreadStart, scan)))
+        WepDestroyWindowScan(scan);
+}
 
-            WepAddChildWindows(Context, desktopNode, desktopNode->WindowHandle, NULL, NULL);
+VOID WepApplyWindowScan(
+    _In_ PWINDOWS_CONTEXT Context,
+    _In_ PWE_WINDOW_SCAN Scan
+    )
+{
+    PWE_WINDOW_TREE_CONTEXT treeContext = &Context->TreeContext;
+    ULONG i;
+
+    TreeNew_SetRedraw(Context->TreeNewHandle, FALSE);
 
-            desktopNode->HasChildren = TRUE;
-            desktopNode->Opened = TRUE;
+    for (i = 0; i < Scan->EntryList->Count; i++)
+    {
+        PWE_WINDOW_SCAN_ENTRY entry = Scan->EntryList->Items[i];
+        PWE_WINDOW_NODE node;
+
+        node = WeFindWindowNode(treeContext, entry->WindowHandle);
+
+        // If the handle has been reused by a different window, throw away the old node.
+        if (node && node->ClientId.UniqueThread != entry->ClientId.UniqueThread)
+        {
+            WeRemoveWindowNode(treeContext, node);
+            node = NULL;
         }
-        break;
-    case WeWindowSelectorThread:
+
+        if (!node)
         {
-            WepAddChildWindows(Context, NULL, GetDesktopWindow(), NULL, Context->Selector.Thread.ThreadId);
+            PWE_WINDOW_NODE parentNode = NULL;
+
+            if (!entry->InfoValid)
+                continue;
+
+            if (entry->ParentHandle)
+            {
+                // The parent disappeared while we were scanning.
+                if (!(parentNode = WeFindWindowNode(treeContext, entry->ParentHandle)))
+                    continue;
+            }
+
+            node = WeAddWindowNode(treeContext);
+            node->WindowHandle = entry->WindowHandle;
+            node->ClientId = entry->ClientId;
+            node->Node.Expanded = FALSE;
+
+            if (parentNode)
+            {
+                node->Parent = parentNode;
+                PhAddItemList(parentNode->Children, node);
+            }
+            else
+            {
+                PhAddItemList(treeContext->NodeRootList, node);
+            }
+
+            // The desktop window is always shown expanded.
+            if (Scan->SelectorType == WeWindowSelectorAll && !entry->ParentHandle)
+            {
+                node->Opened = TRUE;
+            }
         }
-        break;
-    case WeWindowSelectorProcess:
+        else
         {
-            WepAddChildWindows(Context, NULL, GetDesktopWindow(), Context->Selector.Process.ProcessId, NULL);
+            PhInvalidateTreeNewNode(&node->Node, TN_CACHE_COLOR);
+            TreeNew_InvalidateNode(Context->TreeNewHandle, &node->Node);
         }
-        break;
-    case WeWindowSelectorDesktop:
+
+        if (entry->InfoValid)
         {
-            WepAddDesktopWindows(Context, Context->Selector.Desktop.DesktopName->Buffer);
+            memcpy(node->WindowClass, entry->WindowClass, sizeof(node->WindowClass));
+            PhMoveReference(&node->WindowText, entry->WindowText ? entry->WindowText : PhReferenceEmptyString());
+            entry->WindowText = NULL;
+            memset(node->TextCache, 0, sizeof(PH_STRINGREF) * WEWNTLC_MAXIMUM);
         }
-        break;
+
+        node->WindowVisible = entry->WindowVisible;
+        node->HasChildren = entry->HasChildren || (node->Opened && node->Children->Count != 0);
+        node->ScanGeneration = Scan->Generation;
     }
 
+    // Remove windows that no longer exist. Children are always after their parents in the node
+    // list, so walking backwards is safe even though removing a node also removes its children.
+    for (i = treeContext->NodeList->Count; i != 0; i--)
+    {
+        PWE_WINDOW_NODE node;
+
+        if (i > treeContext->NodeList->Count)
+            continue;
+
+        node = treeContext->NodeList->Items[i - 1];
+
+        if (node->ScanGeneration < Scan->Generation)
+            WeRemoveWindowNode(treeContext, node);
+    }
+
+    TreeNew_NodesStructured(Context->TreeNewHandle);
     TreeNew_SetRedraw(Context->TreeNewHandle, TRUE);
 }
 
+VOID CALLBACK WepWindowsEventProc(
+    _In_ HWINEVENTHOOK EventHook,
+    _In_ ULONG Event,
+    _In_ HWND hwnd,
+    _In_ LONG ObjectId,
+    _In_ LONG ChildId,
+    _In_ ULONG EventThreadId,
+    _In_ ULONG EventTime
+    )
+{
+    ULONG i;
+
+    if (!hwnd || ObjectId != OBJID_WINDOW || ChildId != CHILDID_SELF)
+        return;
+
+    for (i = 0; i < WindowsContextList->Count; i++)
+    {
+        PWINDOWS_CONTEXT context = WindowsContextList->Items[i];
+
+        if (Event == EVENT_OBJECT_NAMECHANGE)
+        {
+            PWE_WINDOW_NODE node;
+
+            // We only care about text changes for windows that are already shown.
+            if (!(node = WeFindWindowNode(&context->TreeContext, hwnd)))
+                continue;
+
+            node->TextDirty = TRUE;
+        }
+
+        // Batch bursts of events into a single refresh.
+        if (!context->RefreshTimerActive)
+        {
+            SetTimer(context->WindowHandle, WE_REFRESH_TIMER_ID, WE_REFRESH_TIMER_INTERVAL, NULL);
+            context->RefreshTimerActive = TRUE;
+        }
+    }
+}
+
+VOID WepRegisterWindowsContext(
+    _In_ PWINDOWS_CONTEXT Context
+    )
+{
+    if (!WindowsContextList)
+        WindowsContextList = PhCreateList(2);
+
+    PhAddItemList(WindowsContextList, Context);
+
+    if (WindowsContextList->Count == 1 && PhGetIntegerSetting(SETTING_NAME_WINDOWS_AUTO_REFRESH))
+    {
+        // The callbacks run on this thread, so no locking is needed.
+        WindowsEventHooks[0] = SetWinEventHook(EVENT_OBJECT_CREATE, EVENT_OBJECT_HIDE, NULL,
+            WepWindowsEventProc, 0, 0, WINEVENT_OUTOFCONTEXT | WINEVENT_SKIPOWNPROCESS);
+        WindowsEventHooks[1] = SetWinEventHook(EVENT_OBJECT_NAMECHANGE, EVENT_OBJECT_NAMECHANGE, NULL,
+            WepWindowsEventProc, 0, 0, WINEVENT_OUTOFCONTEXT | WINEVENT_SKIPOWNPROCESS);
+    }
+}
+
+VOID WepUnregisterWindowsContext(
+    _In_ PWINDOWS_CONTEXT Context
+    )
+{
+    ULONG index;
+    ULONG i;
+
+    if ((index = PhFindItemList(WindowsContextList, Context)) != -1)
+        PhRemoveItemList(WindowsContextList, index);
+
+    if (WindowsContextList->Count == 0)
+    {
+        for (i = 0; i < RTL_NUMBER_OF(WindowsEventHooks); i++)
+        {
+            if (WindowsEventHooks[i])
+            {
+                UnhookWinEvent(WindowsEventHooks[i]);
+                WindowsEventHooks[i] = NULL;
+            }
+        }
+    }
+}
+
 PPH_STRING WepGetWindowTitleForSelector(
     _In_ PWE_WINDOW_SELECTOR Selector
     )
@@ -322,6 +721,7 @@ INT_PTR CALLBACK WepWindowsDlgProc(
             PPH_STRING windowTitle;
             PH_RECTANGLE windowRectangle;
 
+            context->WindowHandle = hwndDlg;
             context->TreeNewHandle = GetDlgItem(hwndDlg, IDC_LIST);
             WeInitializeWindowTree(hwndDlg, context->TreeNewHandle, &context->TreeContext);
 
@@ -361,11 +761,29 @@ INT_PTR CALLBACK WepWindowsDlgProc(
             SetWindowText(hwndDlg, windowTitle->Buffer);
             PhDereferenceObject(windowTitle);
 
+            WepRegisterWindowsContext(context);
             WepRefreshWindows(context);
         }
         break;
     case WM_DESTROY:
         {
+            MSG message;
+
+            WepUnregisterWindowsContext(context);
+
+            if (context->RefreshTimerActive)
+                KillTimer(hwndDlg, WE_REFRESH_TIMER_ID);
+
+            if (context->ScanThreadHandle)
+            {
+                NtWaitForSingleObject(context->ScanThreadHandle, FALSE, NULL);
+                NtClose(context->ScanThreadHandle);
+
+                // The scan was posted back to us, so we have to free it.
+                if (PeekMessage(&message, hwndDlg, WM_WE_SCAN_COMPLETED, WM_WE_SCAN_COMPLETED, PM_REMOVE))
+                    WepDestroyWindowScan((PWE_WINDOW_SCAN)message.lParam);
+            }
+
             PhSaveWindowPlacementToSetting(SETTING_NAME_WINDOWS_WINDOW_POSITION, SETTING_NAME_WINDOWS_WINDOW_SIZE, hwndDlg);
 
             PhDeleteLayoutManager(&context->LayoutManager);
@@ -704,6 +1122,13 @@ INT_PTR CALLBACK WepWindowsDlgProc(
                         KillTimer(hwndDlg, 9);
                 }
                 break;
+            case WE_REFRESH_TIMER_ID:
+                {
+                    KillTimer(hwndDlg, WE_REFRESH_TIMER_ID);
+                    context->RefreshTimerActive = FALSE;
+                    WepRefreshWindows(context);
+                }
+                break;
             }
         }
         break;
@@ -730,6 +1155,20 @@ INT_PTR CALLBACK WepWindowsDlgProc(
             }
         }
         break;
+    case WM_WE_SCAN_COMPLETED:
+        {
+            PWE_WINDOW_SCAN scan = (PWE_WINDOW_SCAN)lParam;
+
+            NtClose(context->ScanThreadHandle);
+            context->ScanThreadHandle = NULL;
+
+            WepApplyWindowScan(context, scan);
+            WepDestroyWindowScan(scan);
+
+            if (context->RefreshPending)
+                WepRefreshWindows(context);
+        }
+        break;
     }
 
     return FALSE;
@@ -12,6 +12,7 @@ extern PPH_PLUGIN PluginInstance;
 #define SETTING_NAME_WINDOW_TREE_LIST_COLUMNS (PLUGIN_NAME L".WindowTreeListColumns")
 #define SETTING_NAME_WINDOWS_WINDOW_POSITION (PLUGIN_NAME L".WindowsWindowPosition")
 #define SETTING_NAME_WINDOWS_WINDOW_SIZE (PLUGIN_NAME L".WindowsWindowSize")
+#define SETTING_NAME_WINDOWS_AUTO_REFRESH (PLUGIN_NAME L".WindowsAutoRefresh")
 
 // hook
 
@@ -101,6 +102,7 @@ VOID WeShowWindowsDialog(
     );
 
 #define WM_WE_PLUSMINUS (WM_APP + 1)
+#define WM_WE_SCAN_COMPLETED (WM_APP + 2)
 
 // wndprp
 
@@ -174,6 +174,23 @@ VOID WeRemoveWindowNode(
 {
     ULONG index;
 
+    // Remove the children first, since they cannot outlive their parent.
+    while (WindowNode->Children->Count != 0)
+        WeRemoveWindowNode(Context, WindowNode->Children->Items[WindowNode->Children->Count - 1]);
+
+    // Unlink from the parent.
+
+    if (WindowNode->Parent)
+    {
+        if ((index = PhFindItemList(WindowNode->Parent->Children, WindowNode)) != -1)
+            PhRemoveItemList(WindowNode->Parent->Children, index);
+    }
+    else
+    {
+        if ((index = PhFindItemList(Context->NodeRootList, WindowNode)) != -1)
+            PhRemoveItemList(Context->NodeRootList, index);
+    }
+
     // Remove from hashtable/list and cleanup.
 
     PhRemoveEntryHashtable(Context->NodeHashtable, &WindowNode);
@@ -22,10 +22,13 @@ typedef struct _WE_WINDOW_NODE
             ULONG HasChildren : 1;
             ULONG Opened : 1;
             ULONG WindowVisible : 1;
-            ULONG Spare : 29;
+            ULONG TextDirty : 1;
+            ULONG Spare : 28;
         };
     };
 
+    ULONG ScanGeneration;
+
     PH_STRINGREF TextCache[WEWNTLC_MAXIMUM];
 
     HWND WindowHandle;
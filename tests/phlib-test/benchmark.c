@@ -0,0 +1,347 @@
+#include "tests.h"
+
+// Microbenchmarks for phlib primitives. Run with "phlib-test -benchmark [filter]". Each line
+// of output is "name,iterations,median_ns,minimum_ns", where the timings are per operation.
+// The iteration count is calibrated so that each sample takes at least BENCHMARK_SAMPLE_TIME,
+// and the median of BENCHMARK_SAMPLES samples is reported to reduce noise.
+
+#define BENCHMARK_SAMPLES 7
+#define BENCHMARK_SAMPLE_TIME 20 // ms
+#define BENCHMARK_HASHTABLE_SIZE 1024
+#define BENCHMARK_WORK_ITEMS 256
+
+typedef VOID (NTAPI *PBENCHMARK_FUNCTION)(
+    _In_ ULONG64 Iterations
+    );
+
+typedef struct _BENCHMARK
+{
+    PSTR Name;
+    PBENCHMARK_FUNCTION Function;
+    ULONG OperationsPerIteration;
+} BENCHMARK, *PBENCHMARK;
+
+static volatile ULONG_PTR BenchmarkSink;
+
+static PPH_STRING HaystackString;
+static PH_STRINGREF NeedleString;
+static PPH_BYTES Utf8String;
+static PPH_STRING Utf16String;
+static PPH_OBJECT_TYPE BenchmarkObjectType;
+static PPH_HASHTABLE FindHashtable;
+static PH_WORK_QUEUE BenchmarkWorkQueue;
+
+static BOOLEAN NTAPI BenchmarkHashtableCompareFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    )
+{
+    return *(PULONG)Entry1 == *(PULONG)Entry2;
+}
+
+static ULONG NTAPI BenchmarkHashtableHashFunction(
+    _In_ PVOID Entry
+    )
+{
+    return PhHashInt32(*(PULONG)Entry);
+}
+
+static VOID NTAPI Benchmark_findstring(
+    _In_ ULONG64 Iterations
+    )
+{
+    while (Iterations--)
+        BenchmarkSink += PhFindStringInStringRef(&HaystackString->sr, &NeedleString, FALSE);
+}
+
+static VOID NTAPI Benchmark_findstring_ignorecase(
+    _In_ ULONG64 Iterations
+    )
+{
+    while (Iterations--)
+        BenchmarkSink += PhFindStringInStringRef(&HaystackString->sr, &NeedleString, TRUE);
+}
+
+static VOID NTAPI Benchmark_utf8_to_utf16(
+    _In_ ULONG64 Iterations
+    )
+{
+    PPH_STRING string;
+
+    while (Iterations--)
+    {
+        string = PhConvertUtf8ToUtf16Ex(Utf8String->Buffer, Utf8String->Length);
+        BenchmarkSink += string->Length;
+        PhDereferenceObject(string);
+    }
+}
+
+static VOID NTAPI Benchmark_utf16_to_utf8(
+    _In_ ULONG64 Iterations
+    )
+{
+    PPH_BYTES bytes;
+
+    while (Iterations--)
+    {
+        bytes = PhConvertUtf16ToUtf8Ex(Utf16String->Buffer, Utf16String->Length);
+        BenchmarkSink += bytes->Length;
+        PhDereferenceObject(bytes);
+    }
+}
+
+static VOID NTAPI Benchmark_hashtable_insert(
+    _In_ ULONG64 Iterations
+    )
+{
+    PPH_HASHTABLE hashtable;
+    ULONG i;
+
+    while (Iterations--)
+    {
+        hashtable = PhCreateHashtable(sizeof(ULONG), BenchmarkHashtableCompareFunction, BenchmarkHashtableHashFunction, 16);
+
+        for (i = 0; i < BENCHMARK_HASHTABLE_SIZE; i++)
+            PhAddEntryHashtable(hashtable, &i);
+
+        BenchmarkSink += hashtable->Count;
+        PhDereferenceObject(hashtable);
+    }
+}
+
+static VOID NTAPI Benchmark_hashtable_find(
+    _In_ ULONG64 Iterations
+    )
+{
+    ULONG i;
+
+    while (Iterations--)
+    {
+        // Half of the lookups miss.
+        for (i = 0; i < BENCHMARK_HASHTABLE_SIZE; i++)
+        {
+            ULONG key = i * 2;
+
+            BenchmarkSink += (ULONG_PTR)PhFindEntryHashtable(FindHashtable, &key);
+        }
+    }
+}
+
+static VOID NTAPI Benchmark_format_to_buffer(
+    _In_ ULONG64 Iterations
+    )
+{
+    PH_FORMAT format[5];
+    WCHAR buffer[128];
+
+    while (Iterations--)
+    {
+        PhInitFormatS(&format[0], L"Process ");
+        PhInitFormatU(&format[1], 1234);
+        PhInitFormatS(&format[2], L" at 0x");
+        PhInitFormatIX(&format[3], (ULONG_PTR)0x7ffe0000);
+        PhInitFormatF(&format[4], 12.3456, 2);
+        BenchmarkSink += PhFormatToBuffer(format, 5, buffer, sizeof(buffer), NULL);
+    }
+}
+
+static VOID NTAPI Benchmark_compare_natural(
+    _In_ ULONG64 Iterations
+    )
+{
+    while (Iterations--)
+    {
+        BenchmarkSink += PhCompareStringZNatural(L"svchost.exe (1234) file10.txt", L"svchost.exe (1234) file9.txt", FALSE);
+        BenchmarkSink += PhCompareStringZNatural(L"SVCHOST.EXE (1234) File10.txt", L"svchost.exe (1234) file9.txt", TRUE);
+    }
+}
+
+static VOID NTAPI Benchmark_create_object(
+    _In_ ULONG64 Iterations
+    )
+{
+    PVOID object;
+
+    while (Iterations--)
+    {
+        object = PhCreateObject(64, BenchmarkObjectType);
+        BenchmarkSink += (ULONG_PTR)object;
+        PhDereferenceObject(object);
+    }
+}
+
+static NTSTATUS NTAPI BenchmarkWorkItem(
+    _In_ PVOID Parameter
+    )
+{
+    _InterlockedIncrement((PLONG)Parameter);
+    return STATUS_SUCCESS;
+}
+
+static VOID NTAPI Benchmark_workqueue(
+    _In_ ULONG64 Iterations
+    )
+{
+    LONG count = 0;
+    ULONG i;
+
+    while (Iterations--)
+    {
+        for (i = 0; i < BENCHMARK_WORK_ITEMS; i++)
+            PhQueueItemWorkQueue(&BenchmarkWorkQueue, BenchmarkWorkItem, &count);
+
+        PhWaitForWorkQueue(&BenchmarkWorkQueue);
+    }
+
+    BenchmarkSink += count;
+}
+
+static BENCHMARK Benchmarks[] =
+{
+    { "findstring", Benchmark_findstring, 1 },
+    { "findstring_ignorecase", Benchmark_findstring_ignorecase, 1 },
+    { "utf8_to_utf16", Benchmark_utf8_to_utf16, 1 },
+    { "utf16_to_utf8", Benchmark_utf16_to_utf8, 1 },
+    { "hashtable_insert", Benchmark_hashtable_insert, BENCHMARK_HASHTABLE_SIZE },
+    { "hashtable_find", Benchmark_hashtable_find, BENCHMARK_HASHTABLE_SIZE },
+    { "format_to_buffer", Benchmark_format_to_buffer, 1 },
+    { "compare_natural", Benchmark_compare_natural, 2 },
+    { "create_object", Benchmark_create_object, 1 },
+    { "workqueue", Benchmark_workqueue, BENCHMARK_WORK_ITEMS }
+};
+
+static VOID InitializeBenchmarks(
+    VOID
+    )
+{
+    PH_STRING_BUILDER stringBuilder;
+    ULONG i;
+
+    // A 4 KB haystack where the needle only appears at the end.
+    PhInitializeStringBuilder(&stringBuilder, 4096 * sizeof(WCHAR));
+
+    for (i = 0; i < 256; i++)
+        PhAppendStringBuilder2(&stringBuilder, L"C:\\Windows\\Sys ");
+
+    PhAppendStringBuilder2(&stringBuilder, L"C:\\Windows\\System32\\ntdll.dll");
+    HaystackString = PhFinalStringBuilderString(&stringBuilder);
+    PhInitializeStringRef(&NeedleString, L"system32\\NTDLL");
+
+    // Mostly ASCII text with some multi-byte characters.
+    PhInitializeStringBuilder(&stringBuilder, 1024 * sizeof(WCHAR));
+
+    for (i = 0; i < 32; i++)
+        PhAppendStringBuilder2(&stringBuilder, L"Process Hacker \x00e9\x4e2d\xd83d\xde00 ");
+
+    Utf16String = PhFinalStringBuilderString(&stringBuilder);
+    Utf8String = PhConvertUtf16ToUtf8Ex(Utf16String->Buffer, Utf16String->Length);
+
+    BenchmarkObjectType = PhCreateObjectType(L"Benchmark", 0, NULL);
+
+    FindHashtable = PhCreateHashtable(sizeof(ULONG), BenchmarkHashtableCompareFunction, BenchmarkHashtableHashFunction, BENCHMARK_HASHTABLE_SIZE);
+
+    for (i = 0; i < BENCHMARK_HASHTABLE_SIZE; i++)
+        PhAddEntryHashtable(FindHashtable, &i);
+
+    PhInitializeWorkQueue(&BenchmarkWorkQueue, 0, 4, 1000);
+}
+
+static VOID DeleteBenchmarks(
+    VOID
+    )
+{
+    PhDeleteWorkQueue(&BenchmarkWorkQueue);
+    PhDereferenceObject(FindHashtable);
+    PhDereferenceObject(Utf8String);
+    PhDereferenceObject(Utf16String);
+    PhDereferenceObject(HaystackString);
+}
+
+static ULONG64 TimeBenchmark(
+    _In_ PBENCHMARK Benchmark,
+    _In_ ULONG64 Iterations
+    )
+{
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+
+    NtQueryPerformanceCounter(&start, NULL);
+    Benchmark->Function(Iterations);
+    NtQueryPerformanceCounter(&end, NULL);
+
+    return end.QuadPart - start.QuadPart;
+}
+
+static int __cdecl DoubleCompare(
+    _In_ const void *elem1,
+    _In_ const void *elem2
+    )
+{
+    return doublecmp(*(DOUBLE *)elem1, *(DOUBLE *)elem2);
+}
+
+static VOID RunBenchmark(
+    _In_ PBENCHMARK Benchmark,
+    _In_ ULONG64 Frequency
+    )
+{
+    ULONG64 iterations;
+    ULONG64 ticks;
+    DOUBLE samples[BENCHMARK_SAMPLES];
+    ULONG i;
+
+    // Warm up and calibrate.
+    iterations = 1;
+
+    while ((ticks = TimeBenchmark(Benchmark, iterations)) < Frequency * BENCHMARK_SAMPLE_TIME / 1000)
+    {
+        if (ticks * 8 < Frequency * BENCHMARK_SAMPLE_TIME / 1000)
+            iterations *= 8;
+        else
+            iterations *= 2;
+    }
+
+    for (i = 0; i < BENCHMARK_SAMPLES; i++)
+    {
+        ticks = TimeBenchmark(Benchmark, iterations);
+        samples[i] = (DOUBLE)ticks * 1e9 / Frequency / ((DOUBLE)iterations * Benchmark->OperationsPerIteration);
+    }
+
+    qsort(samples, BENCHMARK_SAMPLES, sizeof(DOUBLE), DoubleCompare);
+
+    printf(
+        "%s,%I64u,%.2f,%.2f\n",
+        Benchmark->Name,
+        iterations * Benchmark->OperationsPerIteration,
+        samples[BENCHMARK_SAMPLES / 2],
+        samples[0]
+        );
+}
+
+/**
+ * Runs the phlib microbenchmarks.
+ *
+ * \param Filter If specified, only benchmarks whose name starts with this string are run.
+ */
+VOID RunBenchmarks(
+    _In_opt_ PSTR Filter
+    )
+{
+    LARGE_INTEGER frequency;
+    ULONG i;
+
+    InitializeBenchmarks();
+    NtQueryPerformanceCounter(&frequency, &frequency);
+
+    printf("name,iterations,median_ns,minimum_ns\n");
+
+    for (i = 0; i < sizeof(Benchmarks) / sizeof(BENCHMARK); i++)
+    {
+        if (Filter && strncmp(Benchmarks[i].Name, Filter, strlen(Filter)) != 0)
+            continue;
+
+        RunBenchmark(&Benchmarks[i], frequency.QuadPart);
+    }
+
+    DeleteBenchmarks();
+}
@@ -0,0 +1,444 @@
+#include "tests.h"
+#include <phintrnl.h>
+
+// Contended lock benchmarks. Run with "phlib-test -lockbench [filter]". Every lock type is run
+// with every workload on 1 to LOCKBENCH_MAXIMUM_THREADS threads for LOCKBENCH_RUN_TIME each,
+// and each run is written as a line of output:
+//
+// name,threads,ops_per_sec,fairness,min_max,errors,blocks,waits,wakes,wakes_deferred,optimizations,woken
+//
+// The name is "lock/workload", and the filter matches a prefix of it. fairness is Jain's index
+// of the per-thread operation counts (1 is perfectly fair), and min_max is the ratio of the
+// slowest thread to the fastest. errors counts violations of mutual exclusion, so the runs
+// double as a stress test. The remaining columns are deltas of the queued lock statistics,
+// which are only kept by debug builds. They show how often acquires had to block, and how
+// much time went into waking waiters and optimizing the wait list.
+
+#define LOCKBENCH_RUN_TIME 250 // ms
+#define LOCKBENCH_MAXIMUM_THREADS 64
+#define LOCKBENCH_VALUES 8
+#define LOCKBENCH_ITEMS 1024
+#define LOCKBENCH_OUTSIDE_WORK 32
+
+typedef union _LOCKBENCH_LOCK
+{
+    PH_QUEUED_LOCK QueuedLock;
+    PH_FAST_LOCK FastLock;
+    RTL_SRWLOCK SrwLock;
+} LOCKBENCH_LOCK, *PLOCKBENCH_LOCK;
+
+typedef struct _LOCKBENCH_LOCK_TYPE
+{
+    PSTR Name;
+    VOID (NTAPI *Initialize)(_Out_ PLOCKBENCH_LOCK Lock);
+    VOID (NTAPI *Delete)(_Inout_ PLOCKBENCH_LOCK Lock);
+    VOID (NTAPI *AcquireExclusive)(_Inout_ PLOCKBENCH_LOCK Lock);
+    VOID (NTAPI *AcquireShared)(_Inout_ PLOCKBENCH_LOCK Lock);
+    VOID (NTAPI *ReleaseExclusive)(_Inout_ PLOCKBENCH_LOCK Lock);
+    VOID (NTAPI *ReleaseShared)(_Inout_ PLOCKBENCH_LOCK Lock);
+} LOCKBENCH_LOCK_TYPE, *PLOCKBENCH_LOCK_TYPE;
+
+typedef struct _LOCKBENCH_WORKLOAD
+{
+    PSTR Name;
+    ULONG ExclusivePercent;
+    BOOLEAN ItemLookups;
+} LOCKBENCH_WORKLOAD, *PLOCKBENCH_WORKLOAD;
+
+typedef struct _LOCKBENCH_ITEM
+{
+    ULONG Id;
+    LONG RefCount;
+} LOCKBENCH_ITEM, *PLOCKBENCH_ITEM;
+
+typedef struct _LOCKBENCH_RUN
+{
+    PLOCKBENCH_LOCK_TYPE LockType;
+    PLOCKBENCH_WORKLOAD Workload;
+    LOCKBENCH_LOCK Lock;
+    PH_BARRIER StartBarrier;
+    volatile BOOLEAN Stop;
+
+    // Protected by the lock.
+    volatile LONG Writers;
+    volatile LONG Readers;
+    ULONG Values[LOCKBENCH_VALUES];
+    PPH_HASHTABLE ItemHashtable;
+} LOCKBENCH_RUN, *PLOCKBENCH_RUN;
+
+typedef struct _LOCKBENCH_THREAD
+{
+    PLOCKBENCH_RUN Run;
+    ULONG Seed;
+    ULONG Errors;
+    ULONG64 Operations;
+    UCHAR Padding[64]; // keep the counters of different threads on different cache lines
+} LOCKBENCH_THREAD, *PLOCKBENCH_THREAD;
+
+static LOCKBENCH_ITEM LockBenchItems[LOCKBENCH_ITEMS];
+
+static VOID NTAPI QueuedLockInitialize(_Out_ PLOCKBENCH_LOCK Lock) { PhInitializeQueuedLock(&Lock->QueuedLock); }
+static VOID NTAPI QueuedLockDelete(_Inout_ PLOCKBENCH_LOCK Lock) { NOTHING; }
+static VOID NTAPI QueuedLockAcquireExclusive(_Inout_ PLOCKBENCH_LOCK Lock) { PhAcquireQueuedLockExclusive(&Lock->QueuedLock); }
+static VOID NTAPI QueuedLockAcquireShared(_Inout_ PLOCKBENCH_LOCK Lock) { PhAcquireQueuedLockShared(&Lock->QueuedLock); }
+static VOID NTAPI QueuedLockReleaseExclusive(_Inout_ PLOCKBENCH_LOCK Lock) { PhReleaseQueuedLockExclusive(&Lock->QueuedLock); }
+static VOID NTAPI QueuedLockReleaseShared(_Inout_ PLOCKBENCH_LOCK Lock) { PhReleaseQueuedLockShared(&Lock->QueuedLock); }
+
+static VOID NTAPI FastLockInitialize(_Out_ PLOCKBENCH_LOCK Lock) { PhInitializeFastLock(&Lock->FastLock); }
+static VOID NTAPI FastLockDelete(_Inout_ PLOCKBENCH_LOCK Lock) { PhDeleteFastLock(&Lock->FastLock); }
+static VOID NTAPI FastLockAcquireExclusive(_Inout_ PLOCKBENCH_LOCK Lock) { PhAcquireFastLockExclusive(&Lock->FastLock); }
+static VOID NTAPI FastLockAcquireShared(_Inout_ PLOCKBENCH_LOCK Lock) { PhAcquireFastLockShared(&Lock->FastLock); }
+static VOID NTAPI FastLockReleaseExclusive(_Inout_ PLOCKBENCH_LOCK Lock) { PhReleaseFastLockExclusive(&Lock->FastLock); }
+static VOID NTAPI FastLockReleaseShared(_Inout_ PLOCKBENCH_LOCK Lock) { PhReleaseFastLockShared(&Lock->FastLock); }
+
+static VOID NTAPI SrwLockInitialize(_Out_ PLOCKBENCH_LOCK Lock) { RtlInitializeSRWLock(&Lock->SrwLock); }
+static VOID NTAPI SrwLockDelete(_Inout_ PLOCKBENCH_LOCK Lock) { NOTHING; }
+static VOID NTAPI SrwLockAcquireExclusive(_Inout_ PLOCKBENCH_LOCK Lock) { RtlAcquireSRWLockExclusive(&Lock->SrwLock); }
+static VOID NTAPI SrwLockAcquireShared(_Inout_ PLOCKBENCH_LOCK Lock) { RtlAcquireSRWLockShared(&Lock->SrwLock); }
+static VOID NTAPI SrwLockReleaseExclusive(_Inout_ PLOCKBENCH_LOCK Lock) { RtlReleaseSRWLockExclusive(&Lock->SrwLock); }
+static VOID NTAPI SrwLockReleaseShared(_Inout_ PLOCKBENCH_LOCK Lock) { RtlReleaseSRWLockShared(&Lock->SrwLock); }
+
+static LOCKBENCH_LOCK_TYPE LockBenchLockTypes[] =
+{
+    { "queued", QueuedLockInitialize, QueuedLockDelete, QueuedLockAcquireExclusive, QueuedLockAcquireShared, QueuedLockReleaseExclusive, QueuedLockReleaseShared },
+    { "fast", FastLockInitialize, FastLockDelete, FastLockAcquireExclusive, FastLockAcquireShared, FastLockReleaseExclusive, FastLockReleaseShared },
+    { "srw", SrwLockInitialize, SrwLockDelete, SrwLockAcquireExclusive, SrwLockAcquireShared, SrwLockReleaseExclusive, SrwLockReleaseShared }
+};
+
+static LOCKBENCH_WORKLOAD LockBenchWorkloads[] =
+{
+    { "read95", 5, FALSE },
+    { "read50", 50, FALSE },
+    { "write90", 90, FALSE },
+    // Reference items by ID, like PhReferenceProcessItem, while another thread occasionally
+    // replaces items, like the provider does during an update.
+    { "items", 2, TRUE }
+};
+
+static BOOLEAN NTAPI LockBenchItemCompareFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    )
+{
+    return (*(PLOCKBENCH_ITEM *)Entry1)->Id == (*(PLOCKBENCH_ITEM *)Entry2)->Id;
+}
+
+static ULONG NTAPI LockBenchItemHashFunction(
+    _In_ PVOID Entry
+    )
+{
+    return PhHashInt32((*(PLOCKBENCH_ITEM *)Entry)->Id);
+}
+
+FORCEINLINE ULONG LockBenchRandom(
+    _Inout_ PULONG Seed
+    )
+{
+    ULONG x = *Seed;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *Seed = x;
+
+    return x;
+}
+
+static VOID LockBenchValues(
+    _In_ PLOCKBENCH_THREAD Thread,
+    _In_ BOOLEAN Exclusive
+    )
+{
+    PLOCKBENCH_RUN run = Thread->Run;
+    ULONG value;
+    ULONG i;
+
+    if (Exclusive)
+    {
+        run->LockType->AcquireExclusive(&run->Lock);
+
+        if (_InterlockedIncrement(&run->Writers) != 1 || run->Readers != 0)
+            Thread->Errors++;
+
+        value = run->Values[0] + 1;
+
+        for (i = 0; i < LOCKBENCH_VALUES; i++)
+            run->Values[i] = value;
+
+        _InterlockedDecrement(&run->Writers);
+        run->LockType->ReleaseExclusive(&run->Lock);
+    }
+    else
+    {
+        run->LockType->AcquireShared(&run->Lock);
+        _InterlockedIncrement(&run->Readers);
+
+        if (run->Writers != 0)
+            Thread->Errors++;
+
+        // A torn write shows up as values that differ.
+        value = run->Values[0];
+
+        for (i = 1; i < LOCKBENCH_VALUES; i++)
+        {
+            if (run->Values[i] != value)
+            {
+                Thread->Errors++;
+                break;
+            }
+        }
+
+        _InterlockedDecrement(&run->Readers);
+        run->LockType->ReleaseShared(&run->Lock);
+    }
+}
+
+static VOID LockBenchItems(
+    _In_ PLOCKBENCH_THREAD Thread,
+    _In_ BOOLEAN Exclusive
+    )
+{
+    PLOCKBENCH_RUN run = Thread->Run;
+    PLOCKBENCH_ITEM item;
+    PLOCKBENCH_ITEM *entry;
+    LOCKBENCH_ITEM lookupItem;
+    PLOCKBENCH_ITEM lookupItemPointer;
+
+    lookupItem.Id = LockBenchRandom(&Thread->Seed) % LOCKBENCH_ITEMS;
+    lookupItemPointer = &lookupItem;
+
+    if (Exclusive)
+    {
+        run->LockType->AcquireExclusive(&run->Lock);
+
+        // Readers must never see the item missing.
+        if (entry = PhFindEntryHashtable(run->ItemHashtable, &lookupItemPointer))
+        {
+            item = *entry;
+            PhRemoveEntryHashtable(run->ItemHashtable, &lookupItemPointer);
+            PhAddEntryHashtable(run->ItemHashtable, &item);
+        }
+        else
+        {
+            Thread->Errors++;
+        }
+
+        run->LockType->ReleaseExclusive(&run->Lock);
+    }
+    else
+    {
+        run->LockType->AcquireShared(&run->Lock);
+
+        if (entry = PhFindEntryHashtable(run->ItemHashtable, &lookupItemPointer))
+        {
+            item = *entry;
+            _InterlockedIncrement(&item->RefCount);
+        }
+        else
+        {
+            item = NULL;
+            Thread->Errors++;
+        }
+
+        run->LockType->ReleaseShared(&run->Lock);
+
+        if (item)
+            _InterlockedDecrement(&item->RefCount);
+    }
+}
+
+static NTSTATUS NTAPI LockBenchThreadStart(
+    _In_ PVOID Parameter
+    )
+{
+    PLOCKBENCH_THREAD thread = Parameter;
+    PLOCKBENCH_RUN run = thread->Run;
+    BOOLEAN exclusive;
+    ULONG i;
+
+    PhWaitForBarrier(&run->StartBarrier, FALSE);
+
+    while (!run->Stop)
+    {
+        exclusive = LockBenchRandom(&thread->Seed) % 100 < run->Workload->ExclusivePercent;
+
+        if (run->Workload->ItemLookups)
+            LockBenchItems(thread, exclusive);
+        else
+            LockBenchValues(thread, exclusive);
+
+        thread->Operations++;
+
+        // Some work outside of the lock.
+        for (i = 0; i < LOCKBENCH_OUTSIDE_WORK; i++)
+            LockBenchRandom(&thread->Seed);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static ULONG RunLockBenchmark(
+    _In_ PLOCKBENCH_LOCK_TYPE LockType,
+    _In_ PLOCKBENCH_WORKLOAD Workload,
+    _In_ ULONG NumberOfThreads
+    )
+{
+    PLOCKBENCH_RUN run;
+    PLOCKBENCH_THREAD threads;
+    HANDLE threadHandles[LOCKBENCH_MAXIMUM_THREADS];
+    LARGE_INTEGER interval;
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+#ifdef DEBUG
+    PHLIB_STATISTICS_BLOCK statistics;
+#endif
+    ULONG64 totalOperations;
+    ULONG64 minimumOperations;
+    ULONG64 maximumOperations;
+    DOUBLE sumOfSquares;
+    DOUBLE seconds;
+    ULONG errors;
+    ULONG i;
+
+    run = PhAllocate(sizeof(LOCKBENCH_RUN));
+    memset(run, 0, sizeof(LOCKBENCH_RUN));
+    run->LockType = LockType;
+    run->Workload = Workload;
+    LockType->Initialize(&run->Lock);
+    PhInitializeBarrier(&run->StartBarrier, NumberOfThreads + 1);
+
+    if (Workload->ItemLookups)
+    {
+        run->ItemHashtable = PhCreateHashtable(
+            sizeof(PLOCKBENCH_ITEM),
+            LockBenchItemCompareFunction,
+            LockBenchItemHashFunction,
+            LOCKBENCH_ITEMS
+            );
+
+        for (i = 0; i < LOCKBENCH_ITEMS; i++)
+        {
+            PLOCKBENCH_ITEM item = &LockBenchItems[i];
+
+            item->Id = i;
+            item->RefCount = 1;
+            PhAddEntryHashtable(run->ItemHashtable, &item);
+        }
+    }
+
+    threads = PhAllocate(sizeof(LOCKBENCH_THREAD) * NumberOfThreads);
+    memset(threads, 0, sizeof(LOCKBENCH_THREAD) * NumberOfThreads);
+
+    for (i = 0; i < NumberOfThreads; i++)
+    {
+        threads[i].Run = run;
+        threads[i].Seed = 0x9e3779b9 * (i + 1);
+        threadHandles[i] = PhCreateThread(0, LockBenchThreadStart, &threads[i]);
+        assert(threadHandles[i]);
+    }
+
+    PhWaitForBarrier(&run->StartBarrier, FALSE);
+#ifdef DEBUG
+    statistics = PhLibStatisticsBlock;
+#endif
+    NtQueryPerformanceCounter(&start, &frequency);
+
+    interval.QuadPart = -(LONGLONG)LOCKBENCH_RUN_TIME * PH_TIMEOUT_MS;
+    NtDelayExecution(FALSE, &interval);
+    run->Stop = TRUE;
+
+    for (i = 0; i < NumberOfThreads; i++)
+    {
+        NtWaitForSingleObject(threadHandles[i], FALSE, NULL);
+        NtClose(threadHandles[i]);
+    }
+
+    NtQueryPerformanceCounter(&end, NULL);
+    seconds = (DOUBLE)(end.QuadPart - start.QuadPart) / frequency.QuadPart;
+
+    totalOperations = 0;
+    minimumOperations = MAXULONG64;
+    maximumOperations = 0;
+    sumOfSquares = 0;
+    errors = 0;
+
+    for (i = 0; i < NumberOfThreads; i++)
+    {
+        totalOperations += threads[i].Operations;
+        minimumOperations = min(minimumOperations, threads[i].Operations);
+        maximumOperations = max(maximumOperations, threads[i].Operations);
+        sumOfSquares += (DOUBLE)threads[i].Operations * threads[i].Operations;
+        errors += threads[i].Errors;
+    }
+
+    printf(
+        "%s/%s,%u,%.0f,%.3f,%.3f,%u,",
+        LockType->Name,
+        Workload->Name,
+        NumberOfThreads,
+        totalOperations / seconds,
+        sumOfSquares != 0 ? (DOUBLE)totalOperations * totalOperations / (NumberOfThreads * sumOfSquares) : 0,
+        maximumOperations != 0 ? (DOUBLE)minimumOperations / maximumOperations : 0,
+        errors
+        );
+#ifdef DEBUG
+    printf(
+        "%u,%u,%u,%u,%u,%u\n",
+        (PhLibStatisticsBlock.QlAcquireExclusiveBlocks - statistics.QlAcquireExclusiveBlocks) +
+        (PhLibStatisticsBlock.QlAcquireSharedBlocks - statistics.QlAcquireSharedBlocks),
+        PhLibStatisticsBlock.QlBlockWaits - statistics.QlBlockWaits,
+        PhLibStatisticsBlock.QlWakes - statistics.QlWakes,
+        PhLibStatisticsBlock.QlWakesDeferred - statistics.QlWakesDeferred,
+        PhLibStatisticsBlock.QlOptimizations - statistics.QlOptimizations,
+        PhLibStatisticsBlock.QlWaitersWoken - statistics.QlWaitersWoken
+        );
+#else
+    printf(",,,,,\n");
+#endif
+
+    if (run->ItemHashtable)
+        PhDereferenceObject(run->ItemHashtable);
+
+    LockType->Delete(&run->Lock);
+    PhFree(threads);
+    PhFree(run);
+
+    return errors;
+}
+
+/**
+ * Runs the contended lock benchmarks.
+ *
+ * \param Filter If specified, only runs whose name starts with this string are run.
+ *
+ * \return The number of mutual exclusion violations that were detected.
+ */
+ULONG RunLockBenchmarks(
+    _In_opt_ PSTR Filter
+    )
+{
+    CHAR name[64];
+    ULONG errors = 0;
+    ULONG i;
+    ULONG j;
+    ULONG numberOfThreads;
+
+    printf("name,threads,ops_per_sec,fairness,min_max,errors,blocks,waits,wakes,wakes_deferred,optimizations,woken\n");
+
+    for (i = 0; i < sizeof(LockBenchLockTypes) / sizeof(LOCKBENCH_LOCK_TYPE); i++)
+    {
+        for (j = 0; j < sizeof(LockBenchWorkloads) / sizeof(LOCKBENCH_WORKLOAD); j++)
+        {
+            _snprintf_s(name, sizeof(name), _TRUNCATE, "%s/%s", LockBenchLockTypes[i].Name, LockBenchWorkloads[j].Name);
+
+            if (Filter && strncmp(name, Filter, strlen(Filter)) != 0)
+                continue;
+
+            for (numberOfThreads = 1; numberOfThreads <= LOCKBENCH_MAXIMUM_THREADS; numberOfThreads *= 2)
+                errors += RunLockBenchmark(&LockBenchLockTypes[i], &LockBenchWorkloads[j], numberOfThreads);
+        }
+    }
+
+    return errors;
+}
@@ -7,8 +7,28 @@ int __cdecl main(int argc, char *argv[])
     status = PhInitializePhLib();
     assert(NT_SUCCESS(status));
 
+    if (argc >= 2 && _stricmp(argv[1], "-benchmark") == 0)
+    {
+        RunBenchmarks(argc >= 3 ? argv[2] : NULL);
+        return 0;
+    }
+
+    if (argc >= 2 && _stricmp(argv[1], "-lockbench") == 0)
+    {
+        return RunLockBenchmarks(argc >= 3 ? argv[2] : NULL) != 0;
+    }
+
+    if (argc >= 2 && _stricmp(argv[1], "-treebench") == 0)
+    {
+        RunTreeBenchmarks(argc >= 3 ? strtoul(argv[2], NULL, 10) : 0, argc >= 4 ? strtoul(argv[3], NULL, 10) : 0);
+        return 0;
+    }
+
     Test_basesup();
+    Test_circbuf();
+    Test_filepool();
     Test_format();
+    Test_mapimg();
     Test_support();
 
     return 0;
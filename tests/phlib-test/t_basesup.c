@@ -89,6 +89,61 @@ static VOID Test_stringz(
     assert(PhCompareStringZNatural(L"file-12", L"file-90", FALSE) < 0);
 }
 
+static LONG Test_sortkey_compare(
+    _In_ PWSTR A,
+    _In_ PWSTR B,
+    _In_ BOOLEAN IgnoreCase
+    )
+{
+    PH_STRINGREF sr1;
+    PH_STRINGREF sr2;
+    PPH_BYTES key1;
+    PPH_BYTES key2;
+    LONG result;
+
+    PhInitializeStringRefLongHint(&sr1, A);
+    PhInitializeStringRefLongHint(&sr2, B);
+    key1 = PhCreateNaturalSortKey(&sr1, IgnoreCase);
+    key2 = PhCreateNaturalSortKey(&sr2, IgnoreCase);
+    result = PhCompareNaturalSortKey(key1, key2);
+    PhDereferenceObject(key1);
+    PhDereferenceObject(key2);
+
+    return result;
+}
+
+static VOID Test_sortkey(
+    VOID
+    )
+{
+    static PWSTR strings[] =
+    {
+        L"", L" ", L"abc", L"ABC", L"abd", L"a bc", L"1", L"2", L"9", L"12", L"012", L"0012", L"01", L"0",
+        L"file-1", L"file-9", L"file-12", L"file-90", L"file-012", L"file 3", L"file3a", L"file3b", L"file", L"file-"
+    };
+    ULONG i;
+    ULONG j;
+    LONG result1;
+    LONG result2;
+
+    assert(Test_sortkey_compare(L"abc", L"abc", FALSE) == 0);
+    assert(Test_sortkey_compare(L"abc", L"ABC", FALSE) != 0);
+    assert(Test_sortkey_compare(L"abc", L"ABC", TRUE) == 0);
+    assert(Test_sortkey_compare(L"12", L"9", FALSE) > 0);
+    assert(Test_sortkey_compare(L"file-12", L"file-90", FALSE) < 0);
+
+    // The keys must give the same order as PhCompareStringZNatural.
+    for (i = 0; i < sizeof(strings) / sizeof(PWSTR); i++)
+    {
+        for (j = 0; j < sizeof(strings) / sizeof(PWSTR); j++)
+        {
+            result1 = PhCompareStringZNatural(strings[i], strings[j], TRUE);
+            result2 = Test_sortkey_compare(strings[i], strings[j], TRUE);
+            assert((result1 < 0) == (result2 < 0) && (result1 > 0) == (result2 > 0));
+        }
+    }
+}
+
 VOID Test_stringref(
     VOID
     )
@@ -339,14 +394,326 @@ VOID Test_unicode(
     assert(memcmp(utf8_2->Buffer, utf8_3->Buffer, utf8_2->Length) == 0);
 }
 
+VOID Test_stringbuilder(
+    VOID
+    )
+{
+    PH_STRING_BUILDER sb;
+    ULONG_PTR storage[8];
+    WCHAR buffer[8];
+    SIZE_T returnLength;
+    BOOLEAN result;
+    PPH_STRING string;
+    ULONG i;
+
+    // Inline storage, finalized into a buffer.
+
+    PhInitializeStringBuilderInline(&sb, storage, sizeof(storage));
+    assert(sb.InlineStorage && sb.String->Length == 0 && sb.String->Buffer[0] == 0);
+    PhAppendStringBuilder2(&sb, L"abc");
+    PhAppendCharStringBuilder(&sb, 'd');
+    assert(sb.InlineStorage);
+    result = PhFinalStringBuilderToBuffer(&sb, buffer, sizeof(buffer), &returnLength);
+    assert(result && wcscmp(buffer, L"abcd") == 0 && returnLength == 5 * sizeof(WCHAR));
+
+    // Truncation.
+
+    PhInitializeStringBuilderInline(&sb, storage, sizeof(storage));
+    PhAppendStringBuilder2(&sb, L"abcdefghij");
+    result = PhFinalStringBuilderToBuffer(&sb, buffer, sizeof(buffer), &returnLength);
+    assert(!result && wcscmp(buffer, L"abcdefg") == 0 && returnLength == 11 * sizeof(WCHAR));
+
+    // Spilling to the heap.
+
+    PhInitializeStringBuilderInline(&sb, storage, sizeof(storage));
+
+    for (i = 0; i < 100; i++)
+        PhAppendCharStringBuilder(&sb, (WCHAR)('0' + i % 10));
+
+    assert(!sb.InlineStorage && sb.String->Length == 100 * sizeof(WCHAR));
+    string = PhFinalStringBuilderString(&sb);
+    assert(string->Length == 100 * sizeof(WCHAR) && string->Buffer[99] == '9' && string->Buffer[100] == 0);
+    PhDereferenceObject(string);
+
+    // Finalizing inline storage into a string.
+
+    PhInitializeStringBuilderInline(&sb, storage, sizeof(storage));
+    PhAppendStringBuilder2(&sb, L"xyz");
+    string = PhFinalStringBuilderString(&sb);
+    assert(wcscmp(string->Buffer, L"xyz") == 0 && string->Length == 3 * sizeof(WCHAR));
+    PhDereferenceObject(string);
+
+    // Reserve.
+
+    PhInitializeStringBuilder(&sb, 4);
+    PhAppendStringBuilder2(&sb, L"ab");
+    PhReserveStringBuilder(&sb, 1000);
+    assert(sb.AllocatedLength >= 1004);
+    string = sb.String;
+    PhAppendCharStringBuilder2(&sb, 'c', 500);
+    assert(sb.String == string && sb.String->Length == 502 * sizeof(WCHAR));
+    PhDeleteStringBuilder(&sb);
+}
+
+static VOID NTAPI Test_callback_function(
+    _In_opt_ PVOID Parameter,
+    _In_opt_ PVOID Context
+    )
+{
+    *(PULONG_PTR)Context += (ULONG_PTR)Parameter;
+}
+
+static VOID NTAPI Test_callback_batch_function(
+    _In_opt_ PVOID Parameter,
+    _In_opt_ PVOID Context
+    )
+{
+    PPH_CALLBACK_BATCH batch = Parameter;
+    ULONG i;
+
+    for (i = 0; i < batch->Count; i++)
+        *(PULONG_PTR)Context += (ULONG_PTR)batch->Parameters[i];
+
+    *(PULONG_PTR)Context += 1000;
+}
+
+static VOID Test_callback(
+    VOID
+    )
+{
+    PH_CALLBACK callback;
+    PH_CALLBACK_REGISTRATION registration1;
+    PH_CALLBACK_REGISTRATION registration2;
+    ULONG_PTR sum1 = 0;
+    ULONG_PTR sum2 = 0;
+    PVOID parameters[3] = { (PVOID)1, (PVOID)2, (PVOID)3 };
+
+    PhInitializeCallback(&callback);
+    PhInvokeCallback(&callback, (PVOID)1);
+
+    PhRegisterCallback(&callback, Test_callback_function, &sum1, &registration1);
+    PhRegisterCallbackEx(&callback, Test_callback_batch_function, &sum2, PH_CALLBACK_BATCH, &registration2);
+
+    PhInvokeCallback(&callback, (PVOID)5);
+    assert(sum1 == 5 && sum2 == 1005);
+
+    PhInvokeCallbackBatch(&callback, parameters, 3);
+    assert(sum1 == 11 && sum2 == 2011);
+
+    PhUnregisterCallback(&callback, &registration1);
+    PhInvokeCallback(&callback, (PVOID)1);
+    assert(sum1 == 11 && sum2 == 3012);
+
+    PhUnregisterCallback(&callback, &registration2);
+    PhInvokeCallbackBatch(&callback, parameters, 3);
+    assert(sum1 == 11 && sum2 == 3012);
+
+    PhDeleteCallback(&callback);
+}
+
+typedef struct _TEST_OBJECT_SITE_CONTEXT
+{
+    UCHAR TypeIndex;
+    ULONG NumberOfSamples;
+    ULONG64 NumberOfBytes;
+} TEST_OBJECT_SITE_CONTEXT, *PTEST_OBJECT_SITE_CONTEXT;
+
+static BOOLEAN NTAPI Test_objecttype_site_callback(
+    _In_ PPH_OBJECT_ALLOCATION_SITE_INFORMATION Information,
+    _In_opt_ PVOID Context
+    )
+{
+    PTEST_OBJECT_SITE_CONTEXT context = Context;
+
+    if (Information->TypeIndex == context->TypeIndex)
+    {
+        assert(Information->NumberOfFrames != 0);
+        context->NumberOfSamples += Information->NumberOfSamples;
+        context->NumberOfBytes += Information->NumberOfBytes;
+    }
+
+    return TRUE;
+}
+
+static VOID Test_objecttype(
+    VOID
+    )
+{
+    PPH_OBJECT_TYPE objectType;
+    PH_OBJECT_TYPE_INFORMATION information;
+    TEST_OBJECT_SITE_CONTEXT context;
+    PVOID objects[4];
+    ULONG i;
+
+    objectType = PhCreateObjectType(L"TestAccounting", 0, NULL);
+
+    for (i = 0; i < 4; i++)
+        objects[i] = PhCreateObject(100, objectType);
+
+    PhGetObjectTypeInformation(objectType, &information);
+    assert(information.NumberOfObjects == 4 && information.NumberOfAllocations == 4);
+#ifdef _WIN64
+    assert(information.NumberOfBytes == 400 && information.PeakNumberOfBytes == 400);
+#endif
+
+    for (i = 0; i < 4; i++)
+        PhDereferenceObject(objects[i]);
+
+    PhGetObjectTypeInformation(objectType, &information);
+    assert(information.NumberOfObjects == 0 && information.NumberOfAllocations == 4);
+#ifdef _WIN64
+    assert(information.NumberOfBytes == 0 && information.PeakNumberOfBytes == 400);
+#endif
+
+    // Sample every allocation, then make sure that nothing is recorded once sampling is off.
+    PhSetObjectAllocationSampling(1);
+    assert(PhGetObjectAllocationSampling() == 1);
+
+    for (i = 0; i < 3; i++)
+        PhDereferenceObject(PhCreateObject(16, objectType));
+
+    PhSetObjectAllocationSampling(0);
+    PhDereferenceObject(PhCreateObject(16, objectType));
+
+    memset(&context, 0, sizeof(TEST_OBJECT_SITE_CONTEXT));
+    context.TypeIndex = information.TypeIndex;
+    PhEnumObjectAllocationSites(Test_objecttype_site_callback, &context);
+    assert(context.NumberOfSamples == 3 && context.NumberOfBytes == 48);
+
+    PhResetObjectAllocationSites();
+    memset(&context, 0, sizeof(TEST_OBJECT_SITE_CONTEXT));
+    context.TypeIndex = information.TypeIndex;
+    PhEnumObjectAllocationSites(Test_objecttype_site_callback, &context);
+    assert(context.NumberOfSamples == 0);
+}
+
+static int __cdecl Test_incrementalsort_compare(
+    _In_ const void *Item1,
+    _In_ const void *Item2
+    )
+{
+    return uintptrcmp(*(PULONG_PTR)Item1, *(PULONG_PTR)Item2);
+}
+
+static BOOLEAN Test_incrementalsort_sorted(
+    _In_ PVOID *Items,
+    _In_ ULONG Count
+    )
+{
+    ULONG i;
+
+    for (i = 1; i < Count; i++)
+    {
+        if ((ULONG_PTR)Items[i - 1] > (ULONG_PTR)Items[i])
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+static VOID Test_incrementalsort(
+    VOID
+    )
+{
+    PVOID items[200];
+    ULONG_PTR sum;
+    ULONG i;
+
+    // A few changed items.
+    for (i = 0; i < 200; i++)
+        items[i] = (PVOID)(ULONG_PTR)(i * 2);
+    items[3] = (PVOID)301;
+    items[150] = (PVOID)1;
+    items[199] = (PVOID)0;
+    PhSortItemsIncremental(items, 200, Test_incrementalsort_compare);
+    assert(Test_incrementalsort_sorted(items, 200));
+    assert((ULONG_PTR)items[0] == 0 && (ULONG_PTR)items[1] == 0 && (ULONG_PTR)items[2] == 1);
+
+    // Too many changed items; falls back to a full sort.
+    for (i = 0, sum = 0; i < 200; i++)
+    {
+        items[i] = (PVOID)(ULONG_PTR)(200 - i);
+        sum += 200 - i;
+    }
+    PhSortItemsIncremental(items, 200, Test_incrementalsort_compare);
+    assert(Test_incrementalsort_sorted(items, 200));
+    for (i = 0; i < 200; i++)
+        sum -= (ULONG_PTR)items[i];
+    assert(sum == 0);
+
+    // Small arrays.
+    items[0] = (PVOID)3;
+    items[1] = (PVOID)1;
+    items[2] = (PVOID)2;
+    PhSortItemsIncremental(items, 3, Test_incrementalsort_compare);
+    assert((ULONG_PTR)items[0] == 1 && (ULONG_PTR)items[1] == 2 && (ULONG_PTR)items[2] == 3);
+    PhSortItemsIncremental(items, 0, Test_incrementalsort_compare);
+}
+
+static VOID Test_hashtable(
+    VOID
+    )
+{
+    PPH_HASHTABLE hashtable;
+    PH_KEY_VALUE_PAIR entry;
+    ULONG i;
+    ULONG j;
+
+    // 16384 entries fill the table, so the next addition starts an incremental resize and the
+    // last 99 additions only move some of the old buckets.
+    hashtable = PhCreateSimpleHashtableEx(1, PH_HASHTABLE_INCREMENTAL_RESIZE);
+
+    for (i = 1; i <= 16484; i++)
+    {
+        PhAddItemSimpleHashtable(hashtable, UlongToPtr(i), UlongToPtr(i * 2));
+
+        if (i % 97 == 0)
+        {
+            for (j = 1; j <= i; j += 13)
+                assert(PhFindItemSimpleHashtable2(hashtable, UlongToPtr(j)) == UlongToPtr(j * 2));
+        }
+    }
+
+    assert(hashtable->Count == 16484);
+    assert(hashtable->OldBuckets);
+    entry.Key = UlongToPtr(16484);
+    entry.Value = NULL;
+    assert(!PhAddEntryHashtable(hashtable, &entry));
+
+    // Removals finish the resize.
+    for (i = 1; i <= 16484; i += 2)
+        assert(PhRemoveItemSimpleHashtable(hashtable, UlongToPtr(i)));
+
+    assert(hashtable->Count == 8242);
+    assert(!hashtable->OldBuckets);
+
+    for (i = 1; i <= 16484; i++)
+    {
+        if (i & 1)
+            assert(!PhFindItemSimpleHashtable(hashtable, UlongToPtr(i)));
+        else
+            assert(PhFindItemSimpleHashtable2(hashtable, UlongToPtr(i)) == UlongToPtr(i * 2));
+    }
+
+    PhClearHashtable(hashtable);
+    assert(hashtable->Count == 0 && !PhFindItemSimpleHashtable(hashtable, UlongToPtr(2)));
+    PhDereferenceObject(hashtable);
+}
+
 VOID Test_basesup(
     VOID
     )
 {
     Test_time();
     Test_stringz();
+    Test_sortkey();
     Test_stringref();
     Test_hexstring();
     Test_strint();
     Test_unicode();
+    Test_stringbuilder();
+    Test_callback();
+    Test_objecttype();
+    Test_incrementalsort();
+    Test_hashtable();
 }
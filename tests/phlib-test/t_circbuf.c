@@ -0,0 +1,155 @@
+#include "tests.h"
+#include <circbuf.h>
+
+static VOID Test_aggregates(
+    VOID
+    )
+{
+    PH_CIRCULAR_BUFFER_ULONG buffer;
+    PH_CIRCULAR_BUFFER_FLOAT floatBuffer;
+    ULONG i;
+    ULONG j;
+    ULONG maximum;
+    ULONG64 sum;
+
+    PhInitializeCircularBuffer_ULONG(&buffer, 16);
+    PhInitializeCircularBuffer_FLOAT(&floatBuffer, 16);
+
+    assert(PhMaximumCircularBuffer_ULONG(&buffer, 0, 16) == 0);
+    assert(PhSumCircularBuffer_ULONG(&buffer, 0, 16) == 0);
+
+    // Wrap around the end of the buffer more than once.
+    for (i = 0; i < 40; i++)
+    {
+        PhAddItemCircularBuffer_ULONG(&buffer, (i * 37) % 101 + 0x7ffffff0);
+        PhAddItemCircularBuffer_FLOAT(&floatBuffer, (FLOAT)((i * 37) % 101));
+    }
+
+    for (i = 0; i < 18; i++)
+    {
+        maximum = 0;
+        sum = 0;
+
+        for (j = i; j < 16; j++)
+        {
+            if (maximum < PhGetItemCircularBuffer_ULONG(&buffer, j))
+                maximum = PhGetItemCircularBuffer_ULONG(&buffer, j);
+
+            sum += PhGetItemCircularBuffer_ULONG(&buffer, j);
+        }
+
+        assert(PhMaximumCircularBuffer_ULONG(&buffer, i, 100) == maximum);
+        assert(PhSumCircularBuffer_ULONG(&buffer, i, 100) == sum);
+        assert(PhMaximumCircularBuffer_FLOAT(&floatBuffer, i, 100) == (FLOAT)(maximum == 0 ? 0 : maximum - 0x7ffffff0));
+    }
+
+    assert(PhSumCircularBuffer_ULONG(&buffer, 3, 2) ==
+        (ULONG64)PhGetItemCircularBuffer_ULONG(&buffer, 3) + PhGetItemCircularBuffer_ULONG(&buffer, 4));
+
+    PhDeleteCircularBuffer_FLOAT(&floatBuffer);
+    PhDeleteCircularBuffer_ULONG(&buffer);
+}
+
+static VOID Test_slidingmax(
+    VOID
+    )
+{
+    static ULONG64 values[] = { 5, 1, 3, 2, 8, 8, 4, 0, 0, 0, 7, 6, 5, 4, 3, 2, 1 };
+    PH_SLIDING_MAXIMUM slidingMaximum;
+    ULONG i;
+    ULONG j;
+    ULONG64 maximum;
+
+    PhInitializeSlidingMaximum(&slidingMaximum, 3);
+    assert(PhGetSlidingMaximum(&slidingMaximum) == 0);
+
+    for (i = 0; i < ARRAYSIZE(values); i++)
+    {
+        PhAddItemSlidingMaximum(&slidingMaximum, values[i]);
+
+        maximum = 0;
+
+        for (j = i >= 2 ? i - 2 : 0; j <= i; j++)
+        {
+            if (maximum < values[j])
+                maximum = values[j];
+        }
+
+        assert(PhGetSlidingMaximum(&slidingMaximum) == maximum);
+    }
+
+    PhClearSlidingMaximum(&slidingMaximum);
+    PhAddFloatItemSlidingMaximum(&slidingMaximum, 1.5f);
+    PhAddFloatItemSlidingMaximum(&slidingMaximum, 0.25f);
+    assert(PhGetFloatSlidingMaximum(&slidingMaximum) == 1.5f);
+
+    PhDeleteSlidingMaximum(&slidingMaximum);
+}
+
+static VOID Test_arena(
+    VOID
+    )
+{
+    PH_ARENA arena;
+    PH_CIRCULAR_BUFFER_ULONG64 buffers[80];
+    PVOID block;
+    PVOID largeBlock;
+    SIZE_T size;
+    ULONG i;
+    ULONG j;
+
+    PhInitializeArena(&arena, 0);
+
+    // Enough buffers to need more than one region.
+    for (i = 0; i < ARRAYSIZE(buffers); i++)
+    {
+        PhInitializeCircularBufferEx_ULONG64(&buffers[i], 2000, &arena);
+        assert(buffers[i].Size == 2048);
+
+        for (j = 0; j < 3000; j++)
+            PhAddItemCircularBuffer_ULONG64(&buffers[i], (ULONG64)i << 32 | j);
+    }
+
+    assert(arena.NumberOfRegions > 1);
+
+    for (i = 0; i < ARRAYSIZE(buffers); i++)
+    {
+        assert(PhGetItemCircularBuffer_ULONG64(&buffers[i], 0) == ((ULONG64)i << 32 | 2999));
+        assert(PhGetItemCircularBuffer_ULONG64(&buffers[i], 2047) == ((ULONG64)i << 32 | 952));
+    }
+
+    // Freed blocks are reused for the same size class.
+    block = buffers[5].Data;
+    PhDeleteCircularBuffer_ULONG64(&buffers[5]);
+    PhInitializeCircularBufferEx_ULONG64(&buffers[5], 1500, &arena);
+    assert(buffers[5].Data == block);
+
+    // Resizing gives back the old block.
+    PhResizeCircularBuffer_ULONG64(&buffers[5], 100);
+    assert(buffers[5].Size == 128);
+    assert(PhAllocateArena(&arena, sizeof(ULONG64) * 2048, &size) == block);
+    assert(size == sizeof(ULONG64) * 2048);
+    PhFreeArena(&arena, block, size);
+
+    block = PhAllocateArena(&arena, 100, &size);
+    assert(block && size == 128);
+    PhFreeArena(&arena, block, 100);
+
+    largeBlock = PhAllocateArena(&arena, PH_ARENA_MAXIMUM_BLOCK_SIZE + 1, &size);
+    assert(largeBlock && size >= PH_ARENA_MAXIMUM_BLOCK_SIZE + 1);
+    PhFreeArena(&arena, largeBlock, PH_ARENA_MAXIMUM_BLOCK_SIZE + 1);
+
+    for (i = 0; i < ARRAYSIZE(buffers); i++)
+        PhDeleteCircularBuffer_ULONG64(&buffers[i]);
+
+    PhDeleteArena(&arena);
+}
+
+VOID Test_circbuf(
+    VOID
+    )
+{
+    Test_aggregates();
+    Test_slidingmax();
+    Test_arena();
+}
@@ -0,0 +1,119 @@
+#include "tests.h"
+#include <filepool.h>
+
+#define TEST_POOL_BLOCKS 100
+
+static VOID Test_pool(
+    VOID
+    )
+{
+    static PH_STRINGREF poolFileName = PH_STRINGREF_INIT(L"%TEMP%\\phlib-test-pool.tmp");
+    static PH_STRINGREF compactFileName = PH_STRINGREF_INIT(L"%TEMP%\\phlib-test-pool2.tmp");
+    NTSTATUS status;
+    PPH_STRING fileName;
+    PPH_STRING fileName2;
+    PPH_FILE_POOL pool;
+    PPH_FILE_POOL newPool;
+    ULONG sizes[TEST_POOL_BLOCKS];
+    PVOID blocks[TEST_POOL_BLOCKS];
+    ULONG rvas[TEST_POOL_BLOCKS];
+    ULONG freeRvas[TEST_POOL_BLOCKS / 2];
+    PPH_FILE_POOL_RELOCATION relocations;
+    ULONG numberOfRelocations;
+    ULONGLONG userContext;
+    PULONG block;
+    ULONG rva;
+    ULONG i;
+
+    fileName = PhExpandEnvironmentStrings(&poolFileName);
+    fileName2 = PhExpandEnvironmentStrings(&compactFileName);
+
+    status = PhCreateFilePool2(&pool, fileName->Buffer, FALSE, 0, FILE_OVERWRITE_IF, NULL);
+    assert(NT_SUCCESS(status));
+
+    for (i = 0; i < TEST_POOL_BLOCKS; i++)
+        sizes[i] = 16 + i * 40;
+
+    assert(PhAllocateFilePoolBatch(pool, TEST_POOL_BLOCKS, sizes, blocks, rvas) == TEST_POOL_BLOCKS);
+
+    for (i = 0; i < TEST_POOL_BLOCKS; i++)
+    {
+        ((PULONG)blocks[i])[0] = i;
+        ((PULONG)blocks[i])[sizes[i] / sizeof(ULONG) - 1] = ~i;
+        PhDereferenceFilePool(pool, blocks[i]);
+    }
+
+    // Free every other block to fragment the file.
+    for (i = 0; i < TEST_POOL_BLOCKS / 2; i++)
+        freeRvas[i] = rvas[i * 2];
+
+    assert(PhFreeFilePoolBatch(pool, TEST_POOL_BLOCKS / 2, freeRvas) == TEST_POOL_BLOCKS / 2);
+
+    userContext = rvas[1];
+    PhSetUserContextFilePool(pool, &userContext);
+
+    assert(NT_SUCCESS(PhCommitFilePool(pool)));
+    PhDestroyFilePool(pool);
+
+    // A committed file can be opened again.
+    status = PhCreateFilePool2(&pool, fileName->Buffer, FALSE, 0, FILE_OPEN, NULL);
+    assert(NT_SUCCESS(status));
+
+    for (i = 1; i < TEST_POOL_BLOCKS; i += 2)
+    {
+        block = PhReferenceFilePoolByRva(pool, rvas[i]);
+        assert(block && block[0] == i);
+        PhDereferenceFilePoolByRva(pool, rvas[i]);
+    }
+
+    // Compaction keeps only the live blocks.
+    status = PhCompactFilePool(pool, fileName2->Buffer, NULL, &newPool, &relocations, &numberOfRelocations);
+    assert(NT_SUCCESS(status));
+    assert(numberOfRelocations == TEST_POOL_BLOCKS / 2);
+
+    PhGetUserContextFilePool(newPool, &userContext);
+    assert(userContext == rvas[1]);
+
+    for (i = 0; i < TEST_POOL_BLOCKS; i++)
+    {
+        rva = PhRelocateRvaFilePool(relocations, numberOfRelocations, rvas[i]);
+
+        if (i % 2 == 0)
+        {
+            assert(rva == 0);
+            continue;
+        }
+
+        assert(rva != 0);
+        block = PhReferenceFilePoolByRva(newPool, rva);
+        assert(block && block[0] == i && block[sizes[i] / sizeof(ULONG) - 1] == ~i);
+        PhDereferenceFilePoolByRva(newPool, rva);
+    }
+
+    PhFree(relocations);
+    assert(NT_SUCCESS(PhCommitFilePool(newPool)));
+    PhDestroyFilePool(newPool);
+    PhDestroyFilePool(pool);
+
+    // A file that was changed but not committed is rejected.
+    status = PhCreateFilePool2(&pool, fileName2->Buffer, FALSE, 0, FILE_OPEN, NULL);
+    assert(NT_SUCCESS(status));
+    assert(PhAllocateFilePool(pool, 100, &rva));
+    PhDereferenceFilePoolByRva(pool, rva);
+    PhDestroyFilePool(pool);
+
+    status = PhCreateFilePool2(&pool, fileName2->Buffer, FALSE, 0, FILE_OPEN, NULL);
+    assert(status == STATUS_FILE_CORRUPT_ERROR);
+
+    DeleteFile(fileName->Buffer);
+    DeleteFile(fileName2->Buffer);
+    PhDereferenceObject(fileName);
+    PhDereferenceObject(fileName2);
+}
+
+VOID Test_filepool(
+    VOID
+    )
+{
+    Test_pool();
+}
@@ -359,6 +359,36 @@ static VOID Test_float(
     result = PhFormatToBuffer(format, 1, buffer, sizeof(buffer), NULL);
     assert(result && wcscmp(buffer, L"-1.230") == 0);
 
+    // Rounding (of the exact binary value)
+
+    format[0].Type = DoubleFormatType | FormatUsePrecision;
+    format[0].Width = 0;
+
+    format[0].u.Double = 0.125;
+    format[0].Precision = 2;
+    result = PhFormatToBuffer(format, 1, buffer, sizeof(buffer), NULL);
+    assert(result && wcscmp(buffer, L"0.12") == 0);
+    format[0].u.Double = 0.375;
+    format[0].Precision = 2;
+    result = PhFormatToBuffer(format, 1, buffer, sizeof(buffer), NULL);
+    assert(result && wcscmp(buffer, L"0.38") == 0);
+    format[0].u.Double = 2.675;
+    format[0].Precision = 2;
+    result = PhFormatToBuffer(format, 1, buffer, sizeof(buffer), NULL);
+    assert(result && wcscmp(buffer, L"2.67") == 0);
+    format[0].u.Double = 0.999;
+    format[0].Precision = 2;
+    result = PhFormatToBuffer(format, 1, buffer, sizeof(buffer), NULL);
+    assert(result && wcscmp(buffer, L"1.00") == 0);
+    format[0].u.Double = -0.001;
+    format[0].Precision = 2;
+    result = PhFormatToBuffer(format, 1, buffer, sizeof(buffer), NULL);
+    assert(result && wcscmp(buffer, L"-0.00") == 0);
+    format[0].u.Double = 1e30;
+    format[0].Precision = 2;
+    result = PhFormatToBuffer(format, 1, buffer, sizeof(buffer), NULL);
+    assert(result && wcscmp(buffer, L"1000000000000000019884624838656.00") == 0);
+
     // Digit grouping
 
     if (!IsThousandSepComma())
@@ -416,6 +446,98 @@ static VOID Test_float(
     assert(result && wcscmp(buffer, L"-9,876,543.21000") == 0);
 }
 
+static VOID Test_shortest(
+    VOID
+    )
+{
+    BOOLEAN result;
+    PH_FORMAT format[1];
+    WCHAR buffer[1024];
+
+    PhInitFormatR(&format[0], 0);
+    result = PhFormatToBuffer(format, 1, buffer, sizeof(buffer), NULL);
+    assert(result && wcscmp(buffer, L"0") == 0);
+    PhInitFormatR(&format[0], 100);
+    result = PhFormatToBuffer(format, 1, buffer, sizeof(buffer), NULL);
+    assert(result && wcscmp(buffer, L"100") == 0);
+    PhInitFormatR(&format[0], 0.1);
+    result = PhFormatToBuffer(format, 1, buffer, sizeof(buffer), NULL);
+    assert(result && wcscmp(buffer, L"0.1") == 0);
+    PhInitFormatR(&format[0], -2.5);
+    result = PhFormatToBuffer(format, 1, buffer, sizeof(buffer), NULL);
+    assert(result && wcscmp(buffer, L"-2.5") == 0);
+    PhInitFormatR(&format[0], 1.0 / 3);
+    result = PhFormatToBuffer(format, 1, buffer, sizeof(buffer), NULL);
+    assert(result && wcscmp(buffer, L"0.3333333333333333") == 0);
+    PhInitFormatR(&format[0], 0.000001);
+    result = PhFormatToBuffer(format, 1, buffer, sizeof(buffer), NULL);
+    assert(result && wcscmp(buffer, L"0.000001") == 0);
+    PhInitFormatR(&format[0], 1e-7);
+    result = PhFormatToBuffer(format, 1, buffer, sizeof(buffer), NULL);
+    assert(result && wcscmp(buffer, L"1e-07") == 0);
+    PhInitFormatR(&format[0], 1e21);
+    result = PhFormatToBuffer(format, 1, buffer, sizeof(buffer), NULL);
+    assert(result && wcscmp(buffer, L"1e+21") == 0);
+    PhInitFormatR(&format[0], 5e-324);
+    result = PhFormatToBuffer(format, 1, buffer, sizeof(buffer), NULL);
+    assert(result && wcscmp(buffer, L"5e-324") == 0);
+    PhInitFormatR(&format[0], 1.7976931348623157e308);
+    result = PhFormatToBuffer(format, 1, buffer, sizeof(buffer), NULL);
+    assert(result && wcscmp(buffer, L"1.7976931348623157e+308") == 0);
+
+    PhInitFormatR(&format[0], 1234.5);
+    format[0].Type |= FormatStandardForm | FormatUpperCase;
+    result = PhFormatToBuffer(format, 1, buffer, sizeof(buffer), NULL);
+    assert(result && wcscmp(buffer, L"1.2345E+03") == 0);
+
+    if (!IsThousandSepComma())
+        return;
+
+    PhInitFormatR(&format[0], 1234567.5);
+    format[0].Type |= FormatGroupDigits;
+    result = PhFormatToBuffer(format, 1, buffer, sizeof(buffer), NULL);
+    assert(result && wcscmp(buffer, L"1,234,567.5") == 0);
+}
+
+static VOID Test_compiled(
+    VOID
+    )
+{
+    BOOLEAN result;
+    PH_FORMAT format[5];
+    PPH_COMPILED_FORMAT compiledFormat;
+    PH_FORMAT_VALUE values[2];
+    WCHAR buffer[1024];
+    SIZE_T returnLength;
+    PPH_STRING string;
+
+    PhInitFormatS(&format[0], L"CPU: ");
+    PhInitFormatF(&format[1], 0, 2);
+    PhInitFormatC(&format[2], '%');
+    PhInitFormatC(&format[3], ' ');
+    PhInitFormatI64U(&format[4], 0);
+    compiledFormat = PhCompileFormat(format, 5);
+
+    // The two adjacent characters are merged.
+    assert(compiledFormat->Count == 4 && compiledFormat->NumberOfValues == 2);
+
+    values[0].Double = 12.3456;
+    values[1].UInt64 = 42;
+    result = PhFormatCompiledToBuffer(compiledFormat, values, buffer, sizeof(buffer), &returnLength);
+    assert(result && wcscmp(buffer, L"CPU: 12.35% 42") == 0 && returnLength == 15 * sizeof(WCHAR));
+
+    values[0].Double = 0.5;
+    values[1].UInt64 = 7;
+    result = PhFormatCompiledToBuffer(compiledFormat, values, buffer, sizeof(buffer), NULL);
+    assert(result && wcscmp(buffer, L"CPU: 0.50% 7") == 0);
+
+    string = PhFormatCompiled(compiledFormat, values, 0);
+    assert(PhEqualStringZ(string->Buffer, L"CPU: 0.50% 7", FALSE));
+    PhDereferenceObject(string);
+
+    PhFreeCompiledFormat(compiledFormat);
+}
+
 static VOID Test_width(
     VOID
     )
@@ -561,6 +683,8 @@ VOID Test_format(
     Test_string();
     Test_integer();
     Test_float();
+    Test_shortest();
+    Test_compiled();
     Test_width();
     Test_wildcards();
 }
@@ -0,0 +1,140 @@
+#include "tests.h"
+
+static USHORT ReferenceCheckSum(
+    _In_ ULONG Sum,
+    _In_reads_(Count) PUSHORT Buffer,
+    _In_ ULONG Count
+    )
+{
+    while (Count--)
+    {
+        Sum += *Buffer++;
+        Sum = (Sum >> 16) + (Sum & 0xffff);
+    }
+
+    Sum = (Sum >> 16) + Sum;
+
+    return (USHORT)Sum;
+}
+
+static VOID Test_checksum(
+    VOID
+    )
+{
+    static ULONG initialSums[] = { 0, 1, 0xffff, 0x10000, 0x1fffe, 0xfffffff0, 0xffffffff };
+    PUSHORT buffer;
+    ULONG count;
+    ULONG pattern;
+    ULONG seed;
+    ULONG i;
+    ULONG j;
+
+    buffer = PhAllocate(1024 * sizeof(USHORT));
+    seed = 1;
+
+    // Small buffers with patterns that hit the zero and 0xffff edge cases of the fold.
+    for (count = 0; count < 1024; count += count < 40 ? 1 : 37)
+    {
+        for (pattern = 0; pattern < 4; pattern++)
+        {
+            for (i = 0; i < count; i++)
+            {
+                switch (pattern)
+                {
+                case 0:
+                    buffer[i] = 0;
+                    break;
+                case 1:
+                    buffer[i] = 0xffff;
+                    break;
+                case 2:
+                    buffer[i] = (i % 3 == 0) ? 0xffff : 0;
+                    break;
+                default:
+                    buffer[i] = (USHORT)(RtlRandomEx(&seed) >> 3);
+                    break;
+                }
+            }
+
+            for (j = 0; j < sizeof(initialSums) / sizeof(ULONG); j++)
+            {
+                assert(PhCheckSum(initialSums[j], buffer, count) == ReferenceCheckSum(initialSums[j], buffer, count));
+            }
+        }
+    }
+
+    PhFree(buffer);
+
+    // A buffer large enough to be split between threads.
+    count = 20 * 1024 * 1024;
+    buffer = PhAllocate(count * sizeof(USHORT));
+
+    for (i = 0; i < count; i++)
+        buffer[i] = (USHORT)(RtlRandomEx(&seed) >> 3);
+
+    assert(PhCheckSum(0, buffer, count) == ReferenceCheckSum(0, buffer, count));
+    assert(PhCheckSum(0, buffer + 1, count - 1) == ReferenceCheckSum(0, buffer + 1, count - 1));
+
+    memset(buffer, 0xff, count * sizeof(USHORT));
+    assert(PhCheckSum(0, buffer, count) == ReferenceCheckSum(0, buffer, count));
+
+    PhFree(buffer);
+}
+
+static VOID Test_exportindex(
+    VOID
+    )
+{
+    NTSTATUS status;
+    PPH_STRING fileName;
+    PH_MAPPED_IMAGE mappedImage;
+    PH_MAPPED_IMAGE_EXPORTS exports;
+    PH_MAPPED_IMAGE_EXPORT_ENTRY exportEntry;
+    NTSTATUS expectedStatus;
+    PVOID function;
+    ULONG rva;
+    USHORT magic;
+    ULONG pass;
+    ULONG i;
+
+    fileName = PhConcatStrings2(USER_SHARED_DATA->NtSystemRoot, L"\\System32\\ntdll.dll");
+    status = PhLoadMappedImage(fileName->Buffer, NULL, TRUE, &mappedImage);
+    assert(NT_SUCCESS(status));
+    status = PhGetMappedImageExports(&exports, &mappedImage);
+    assert(NT_SUCCESS(status));
+
+    // The first pass builds the index and the second one uses the cached copy.
+    for (pass = 0; pass < 2; pass++)
+    {
+        for (i = 0; i < exports.NumberOfEntries; i++)
+        {
+            if (!NT_SUCCESS(PhGetMappedImageExportEntry(&exports, i, &exportEntry)))
+                continue;
+
+            // With a remote base of zero, the function address is the RVA.
+            expectedStatus = PhGetMappedImageExportFunctionRemote(&exports, exportEntry.Name, exportEntry.Ordinal, NULL, &function);
+            status = PhGetImageExportRvaCached(fileName->Buffer, exportEntry.Name, exportEntry.Ordinal, &rva, &magic);
+            assert(status == expectedStatus);
+
+            if (NT_SUCCESS(status))
+            {
+                assert(rva == PtrToUlong(function));
+                assert(magic == mappedImage.Magic);
+            }
+        }
+    }
+
+    status = PhGetImageExportRvaCached(fileName->Buffer, "PhDoesNotExist", 0, &rva, NULL);
+    assert(status == STATUS_PROCEDURE_NOT_FOUND);
+
+    PhUnloadMappedImage(&mappedImage);
+    PhDereferenceObject(fileName);
+}
+
+VOID Test_mapimg(
+    VOID
+    )
+{
+    Test_checksum();
+    Test_exportindex();
+}
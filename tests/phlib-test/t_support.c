@@ -191,6 +191,112 @@ VOID Test_compareignoremenuprefix(
     assert(PhCompareUnicodeStringZIgnoreMenuPrefix(L"AAA&&&&asdf", L"aaa&&&&asdf&&", TRUE, TRUE) == 0);
 }
 
+static BOOLEAN IsHashEqual(
+    _In_ PPH_HASH_CONTEXT Context,
+    _In_ PWSTR Expected
+    )
+{
+    UCHAR hash[32];
+    ULONG hashLength;
+    PPH_STRING hashString;
+    BOOLEAN result;
+
+    PhFinalHash(Context, hash, sizeof(hash), &hashLength);
+    hashString = PhBufferToHexString(hash, hashLength);
+    result = PhEqualStringZ(hashString->Buffer, Expected, TRUE);
+    PhDereferenceObject(hashString);
+
+    return result;
+}
+
+static VOID Test_hash(
+    VOID
+    )
+{
+    static UCHAR data[1000];
+    PH_HASH_CONTEXT context;
+    PH_HASH_CONTEXT contexts[10];
+    PPH_HASH_CONTEXT contextPointers[10];
+    PVOID buffers[10];
+    ULONG i;
+    ULONG j;
+
+    for (i = 0; i < sizeof(data); i++)
+        data[i] = (UCHAR)(i * 7 + 3);
+
+    PhInitializeHash(&context, Sha1HashAlgorithm);
+    PhUpdateHash(&context, "abc", 3);
+    assert(IsHashEqual(&context, L"a9993e364706816aba3e25717850c26c9cd0d89d"));
+
+    PhInitializeHash(&context, Sha256HashAlgorithm);
+    PhUpdateHash(&context, "abc", 3);
+    assert(IsHashEqual(&context, L"ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"));
+
+    // Uneven pieces, so that blocks are split between calls.
+    PhInitializeHash(&context, Sha1HashAlgorithm);
+    PhUpdateHash(&context, data, 3);
+    PhUpdateHash(&context, data + 3, 200);
+    PhUpdateHash(&context, data + 203, 797);
+    assert(IsHashEqual(&context, L"4231a8a50a10fa9758db8ec71fdef855b751048a"));
+
+    PhInitializeHash(&context, Sha256HashAlgorithm);
+    PhUpdateHash(&context, data, 3);
+    PhUpdateHash(&context, data + 3, 200);
+    PhUpdateHash(&context, data + 203, 797);
+    assert(IsHashEqual(&context, L"1e9bc38cbf860b9ec31918b065f9b52476c549a782e0e7990bed8ce3868d2371"));
+
+    // Mixed algorithms, with more SHA-256 contexts than are hashed in parallel.
+    for (i = 0; i < 10; i++)
+    {
+        PhInitializeHash(&contexts[i], i == 4 ? Sha1HashAlgorithm : Sha256HashAlgorithm);
+        contextPointers[i] = &contexts[i];
+    }
+
+    for (j = 0; j < sizeof(data); j += 100)
+    {
+        for (i = 0; i < 10; i++)
+            buffers[i] = data + j;
+
+        PhUpdateHashMultiple(contextPointers, buffers, 100, 10);
+    }
+
+    for (i = 0; i < 10; i++)
+    {
+        assert(IsHashEqual(&contexts[i], i == 4 ?
+            L"4231a8a50a10fa9758db8ec71fdef855b751048a" :
+            L"1e9bc38cbf860b9ec31918b065f9b52476c549a782e0e7990bed8ce3868d2371"));
+    }
+}
+
+static VOID Test_sidcache(
+    VOID
+    )
+{
+    PSID sids[2];
+    PPH_STRING name1;
+    PPH_STRING name2;
+    SID_NAME_USE nameUse;
+
+    // Resolve in a batch, then make sure the cached results match.
+
+    sids[0] = &PhSeLocalSystemSid;
+    sids[1] = &PhSeEveryoneSid;
+    PhLookupSidsToCache(2, sids);
+
+    name1 = PhGetSidFullName(&PhSeLocalSystemSid, TRUE, &nameUse);
+    assert(name1 && nameUse == SidTypeWellKnownGroup);
+    name2 = PhGetSidFullName(&PhSeLocalSystemSid, FALSE, NULL);
+    assert(name2 && PhEndsWithString(name1, name2, TRUE));
+    assert(name1->Length > name2->Length && name1->Buffer[(name1->Length - name2->Length) / sizeof(WCHAR) - 1] == '\\');
+    PhDereferenceObject(name2);
+
+    PhFlushSidCache();
+    name2 = PhGetSidFullName(&PhSeLocalSystemSid, TRUE, NULL);
+    assert(name2 && PhEqualString(name1, name2, FALSE));
+    PhDereferenceObject(name1);
+    PhDereferenceObject(name2);
+}
+
 VOID Test_support(
     VOID
     )
@@ -199,4 +305,6 @@ VOID Test_support(
     Test_guid();
     Test_ellipsis();
     Test_compareignoremenuprefix();
+    Test_hash();
+    Test_sidcache();
 }
@@ -7,12 +7,43 @@ VOID Test_basesup(
     VOID
     );
 
+VOID Test_circbuf(
+    VOID
+    );
+
+VOID Test_filepool(
+    VOID
+    );
+
 VOID Test_format(
     VOID
     );
 
+VOID Test_mapimg(
+    VOID
+    );
+
 VOID Test_support(
     VOID
     );
 
+// benchmark
+
+VOID RunBenchmarks(
+    _In_opt_ PSTR Filter
+    );
+
+// lockbench
+
+ULONG RunLockBenchmarks(
+    _In_opt_ PSTR Filter
+    );
+
+// treebench
+
+VOID RunTreeBenchmarks(
+    _In_ ULONG NumberOfNodes,
+    _In_ ULONG NumberOfColumns
+    );
+
 #endif
@@ -0,0 +1,554 @@
+#include "tests.h"
+#include <phgui.h>
+#include <treenew.h>
+
+// TreeNew benchmarks. Run with "phlib-test -treebench [nodes] [columns]". A hidden TreeNew
+// is filled with synthetic nodes, where every root has TREEBENCH_CHILDREN children, and is
+// painted into a memory DC with WM_PRINTCLIENT, which goes through the same PhTnpPaint and
+// PhTnpDrawCell code as WM_PAINT. Each line of output is "name,nodes,columns,median_us,minimum_us",
+// where the timings are per operation:
+//
+// repaint - paint the whole client area.
+// scroll - scroll down by one row, then paint. Unlike a visible window, the whole client area
+//   is painted rather than just the rows that scrolled into view.
+// sort - sort by a different column, then paint. This includes the owner's sort, which is done
+//   the same way as the process tree: qsort of each child list, then TreeNew_NodesStructured.
+// structure - rebuild the flat node list without painting.
+// expand_collapse - collapse or expand every root, then paint.
+// expand_one - collapse or expand a single root with TreeNew_SetNodeExpanded, then paint.
+// filter - hide or show two thirds of the nodes, then paint.
+
+#define TREEBENCH_SAMPLES 7
+#define TREEBENCH_DEFAULT_NODES 10000
+#define TREEBENCH_DEFAULT_COLUMNS 16
+#define TREEBENCH_MAXIMUM_COLUMNS 64
+#define TREEBENCH_CHILDREN 7
+#define TREEBENCH_SCROLL_ROWS 64
+#define TREEBENCH_WIDTH 1280
+#define TREEBENCH_HEIGHT 1024
+
+typedef struct _TREEBENCH_NODE
+{
+    PH_TREENEW_NODE Node;
+
+    ULONG Id;
+    PPH_LIST Children;
+    PPH_STRING *Text;
+} TREEBENCH_NODE, *PTREEBENCH_NODE;
+
+typedef struct _TREEBENCH_CONTEXT
+{
+    HWND ParentHandle;
+    HWND TreeNewHandle;
+    HDC Dc;
+    HBITMAP Bitmap;
+    HBITMAP OldBitmap;
+
+    ULONG NumberOfNodes;
+    ULONG NumberOfColumns;
+    PTREEBENCH_NODE Nodes;
+    PPH_LIST RootList;
+
+    ULONG SortColumn;
+    PH_SORT_ORDER SortOrder;
+    ULONG Step;
+} TREEBENCH_CONTEXT, *PTREEBENCH_CONTEXT;
+
+typedef VOID (NTAPI *PTREEBENCH_FUNCTION)(
+    _In_ PTREEBENCH_CONTEXT Context
+    );
+
+typedef struct _TREEBENCH
+{
+    PSTR Name;
+    PTREEBENCH_FUNCTION Function;
+    ULONG OperationsPerSample;
+} TREEBENCH, *PTREEBENCH;
+
+static PWSTR TreeBenchWords[] =
+{
+    L"svchost", L"explorer", L"System", L"conhost", L"RuntimeBroker", L"dwm", L"lsass", L"csrss"
+};
+
+static WCHAR TreeBenchColumnNames[TREEBENCH_MAXIMUM_COLUMNS][16];
+
+static int __cdecl TreeBenchCompareNodes(
+    _In_ void *context,
+    _In_ const void *elem1,
+    _In_ const void *elem2
+    )
+{
+    PTREEBENCH_CONTEXT treeContext = context;
+    PTREEBENCH_NODE node1 = *(PTREEBENCH_NODE *)elem1;
+    PTREEBENCH_NODE node2 = *(PTREEBENCH_NODE *)elem2;
+    int sortResult;
+
+    sortResult = PhCompareString(node1->Text[treeContext->SortColumn], node2->Text[treeContext->SortColumn], TRUE);
+
+    if (sortResult == 0)
+        sortResult = uintcmp(node1->Id, node2->Id);
+
+    return PhModifySort(sortResult, treeContext->SortOrder);
+}
+
+static VOID TreeBenchSortNodes(
+    _In_ PTREEBENCH_CONTEXT Context
+    )
+{
+    ULONG i;
+
+    if (Context->SortOrder == NoSortOrder)
+        return;
+
+    qsort_s(Context->RootList->Items, Context->RootList->Count, sizeof(PVOID), TreeBenchCompareNodes, Context);
+
+    for (i = 0; i < Context->RootList->Count; i++)
+    {
+        PTREEBENCH_NODE node = Context->RootList->Items[i];
+
+        if (node->Children)
+            qsort_s(node->Children->Items, node->Children->Count, sizeof(PVOID), TreeBenchCompareNodes, Context);
+    }
+}
+
+static BOOLEAN NTAPI TreeBenchCallback(
+    _In_ HWND hwnd,
+    _In_ PH_TREENEW_MESSAGE Message,
+    _In_opt_ PVOID Parameter1,
+    _In_opt_ PVOID Parameter2,
+    _In_opt_ PVOID Context
+    )
+{
+    PTREEBENCH_CONTEXT context = Context;
+    PTREEBENCH_NODE node;
+
+    switch (Message)
+    {
+    case TreeNewGetChildren:
+        {
+            PPH_TREENEW_GET_CHILDREN getChildren = Parameter1;
+            PPH_LIST list;
+
+            node = (PTREEBENCH_NODE)getChildren->Node;
+            list = node ? node->Children : context->RootList;
+
+            if (list)
+            {
+                getChildren->Children = (PPH_TREENEW_NODE *)list->Items;
+                getChildren->NumberOfChildren = list->Count;
+            }
+        }
+        return TRUE;
+    case TreeNewIsLeaf:
+        {
+            PPH_TREENEW_IS_LEAF isLeaf = Parameter1;
+
+            node = (PTREEBENCH_NODE)isLeaf->Node;
+            isLeaf->IsLeaf = !node->Children;
+        }
+        return TRUE;
+    case TreeNewGetCellText:
+        {
+            PPH_TREENEW_GET_CELL_TEXT getCellText = Parameter1;
+
+            node = (PTREEBENCH_NODE)getCellText->Node;
+
+            if (getCellText->Id >= context->NumberOfColumns)
+                return FALSE;
+
+            getCellText->Text = node->Text[getCellText->Id]->sr;
+        }
+        return TRUE;
+    case TreeNewSortChanged:
+        {
+            TreeNew_GetSort(hwnd, &context->SortColumn, &context->SortOrder);
+            TreeBenchSortNodes(context);
+            TreeNew_NodesStructured(hwnd);
+        }
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+static VOID TreeBenchPumpMessages(
+    VOID
+    )
+{
+    MSG message;
+
+    while (PeekMessage(&message, NULL, 0, 0, PM_REMOVE))
+    {
+        TranslateMessage(&message);
+        DispatchMessage(&message);
+    }
+}
+
+static VOID TreeBenchPaint(
+    _In_ PTREEBENCH_CONTEXT Context
+    )
+{
+    SendMessage(Context->TreeNewHandle, WM_PRINTCLIENT, (WPARAM)Context->Dc, PRF_CLIENT | PRF_ERASEBKGND);
+    GdiFlush();
+}
+
+static VOID NTAPI TreeBench_repaint(
+    _In_ PTREEBENCH_CONTEXT Context
+    )
+{
+    TreeBenchPaint(Context);
+}
+
+static VOID NTAPI TreeBench_scroll(
+    _In_ PTREEBENCH_CONTEXT Context
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < TREEBENCH_SCROLL_ROWS; i++)
+    {
+        TreeNew_Scroll(Context->TreeNewHandle, 1, 0);
+        TreeBenchPaint(Context);
+    }
+}
+
+static VOID NTAPI TreeBench_sort(
+    _In_ PTREEBENCH_CONTEXT Context
+    )
+{
+    ULONG column;
+
+    column = Context->Step % Context->NumberOfColumns;
+    TreeNew_SetSort(
+        Context->TreeNewHandle,
+        column,
+        (Context->Step / Context->NumberOfColumns) % 2 ? DescendingSortOrder : AscendingSortOrder
+        );
+    TreeBenchPaint(Context);
+}
+
+static VOID NTAPI TreeBench_structure(
+    _In_ PTREEBENCH_CONTEXT Context
+    )
+{
+    TreeNew_NodesStructured(Context->TreeNewHandle);
+}
+
+static VOID NTAPI TreeBench_expand_collapse(
+    _In_ PTREEBENCH_CONTEXT Context
+    )
+{
+    BOOLEAN expanded;
+    ULONG i;
+
+    expanded = Context->Step % 2 != 0;
+
+    for (i = 0; i < Context->RootList->Count; i++)
+        ((PTREEBENCH_NODE)Context->RootList->Items[i])->Node.Expanded = expanded;
+
+    TreeNew_NodesStructured(Context->TreeNewHandle);
+    TreeBenchPaint(Context);
+}
+
+static VOID NTAPI TreeBench_expand_one(
+    _In_ PTREEBENCH_CONTEXT Context
+    )
+{
+    PTREEBENCH_NODE node;
+
+    node = Context->RootList->Items[Context->RootList->Count / 2];
+    TreeNew_SetNodeExpanded(Context->TreeNewHandle, &node->Node, !node->Node.Expanded);
+    TreeBenchPaint(Context);
+}
+
+static VOID NTAPI TreeBench_filter(
+    _In_ PTREEBENCH_CONTEXT Context
+    )
+{
+    BOOLEAN filtered;
+    ULONG i;
+
+    filtered = Context->Step % 2 == 0;
+
+    for (i = 0; i < Context->NumberOfNodes; i++)
+    {
+        PTREEBENCH_NODE node = &Context->Nodes[i];
+
+        // Never hide a parent, so that the children that match stay reachable.
+        node->Node.Visible = !filtered || node->Children || node->Id % 3 == 0;
+    }
+
+    TreeNew_NodesStructured(Context->TreeNewHandle);
+    TreeBenchPaint(Context);
+}
+
+static TREEBENCH TreeBenchmarks[] =
+{
+    { "repaint", TreeBench_repaint, 1 },
+    { "scroll", TreeBench_scroll, TREEBENCH_SCROLL_ROWS },
+    { "sort", TreeBench_sort, 1 },
+    { "structure", TreeBench_structure, 1 },
+    { "expand_collapse", TreeBench_expand_collapse, 1 },
+    { "expand_one", TreeBench_expand_one, 1 },
+    { "filter", TreeBench_filter, 1 }
+};
+
+static BOOLEAN InitializeTreeBench(
+    _Out_ PTREEBENCH_CONTEXT Context,
+    _In_ ULONG NumberOfNodes,
+    _In_ ULONG NumberOfColumns
+    )
+{
+    static BOOLEAN initialized = FALSE;
+    INITCOMMONCONTROLSEX icex;
+    HDC screenDc;
+    PTREEBENCH_NODE parentNode;
+    ULONG i;
+    ULONG j;
+
+    if (!initialized)
+    {
+        icex.dwSize = sizeof(INITCOMMONCONTROLSEX);
+        icex.dwICC = ICC_LISTVIEW_CLASSES;
+        InitCommonControlsEx(&icex);
+
+        if (!PhTreeNewInitialization())
+            return FALSE;
+
+        initialized = TRUE;
+    }
+
+    memset(Context, 0, sizeof(TREEBENCH_CONTEXT));
+    Context->NumberOfNodes = NumberOfNodes;
+    Context->NumberOfColumns = NumberOfColumns;
+
+    Context->ParentHandle = CreateWindowEx(
+        0,
+        L"STATIC",
+        L"TreeNew benchmark",
+        WS_OVERLAPPEDWINDOW | WS_CLIPCHILDREN,
+        0,
+        0,
+        TREEBENCH_WIDTH,
+        TREEBENCH_HEIGHT,
+        NULL,
+        NULL,
+        NULL,
+        NULL
+        );
+
+    if (!Context->ParentHandle)
+        return FALSE;
+
+    Context->TreeNewHandle = CreateWindow(
+        PH_TREENEW_CLASSNAME,
+        NULL,
+        WS_CHILD | WS_VISIBLE | WS_CLIPCHILDREN | WS_CLIPSIBLINGS | WS_BORDER | TN_STYLE_DOUBLE_BUFFERED,
+        0,
+        0,
+        3,
+        3,
+        Context->ParentHandle,
+        NULL,
+        NULL,
+        NULL
+        );
+
+    if (!Context->TreeNewHandle)
+    {
+        DestroyWindow(Context->ParentHandle);
+        return FALSE;
+    }
+
+    MoveWindow(Context->TreeNewHandle, 0, 0, TREEBENCH_WIDTH, TREEBENCH_HEIGHT, FALSE);
+    TreeNew_SetCallback(Context->TreeNewHandle, TreeBenchCallback, Context);
+
+    for (i = 0; i < NumberOfColumns; i++)
+    {
+        _snwprintf_s(TreeBenchColumnNames[i], 16, _TRUNCATE, L"Column %u", i);
+        PhAddTreeNewColumn(Context->TreeNewHandle, i, TRUE, TreeBenchColumnNames[i], i == 0 ? 200 : 80, PH_ALIGN_LEFT, i == 0 ? -2 : i - 1, 0);
+    }
+
+    // Build the nodes. Every (TREEBENCH_CHILDREN + 1)th node is a root.
+
+    Context->Nodes = PhAllocate(sizeof(TREEBENCH_NODE) * NumberOfNodes);
+    Context->RootList = PhCreateList(NumberOfNodes / (TREEBENCH_CHILDREN + 1) + 1);
+    parentNode = NULL;
+
+    for (i = 0; i < NumberOfNodes; i++)
+    {
+        PTREEBENCH_NODE node = &Context->Nodes[i];
+
+        PhInitializeTreeNewNode(&node->Node);
+        node->Id = i;
+        node->Children = NULL;
+        node->Text = PhAllocate(sizeof(PPH_STRING) * NumberOfColumns);
+
+        for (j = 0; j < NumberOfColumns; j++)
+        {
+            ULONG hash = (i + 1) * 2654435761 ^ (j + 1) * 40503;
+
+            if (j % 2 == 0)
+                node->Text[j] = PhFormatString(L"%s (%u)", TreeBenchWords[hash % ARRAYSIZE(TreeBenchWords)], hash % 100000);
+            else
+                node->Text[j] = PhFormatString(L"%u,%03u K", hash % 10000, (hash >> 8) % 1000);
+        }
+
+        node->Node.TextCache = PhAllocate(sizeof(PH_STRINGREF) * NumberOfColumns);
+        memset(node->Node.TextCache, 0, sizeof(PH_STRINGREF) * NumberOfColumns);
+        node->Node.TextCacheSize = NumberOfColumns;
+
+        if (i % (TREEBENCH_CHILDREN + 1) == 0)
+        {
+            PhAddItemList(Context->RootList, node);
+            parentNode = node;
+        }
+        else
+        {
+            if (!parentNode->Children)
+                parentNode->Children = PhCreateList(TREEBENCH_CHILDREN);
+
+            PhAddItemList(parentNode->Children, node);
+        }
+    }
+
+    TreeNew_NodesStructured(Context->TreeNewHandle);
+
+    screenDc = GetDC(NULL);
+    Context->Dc = CreateCompatibleDC(screenDc);
+    Context->Bitmap = CreateCompatibleBitmap(screenDc, TREEBENCH_WIDTH, TREEBENCH_HEIGHT);
+    Context->OldBitmap = SelectObject(Context->Dc, Context->Bitmap);
+    ReleaseDC(NULL, screenDc);
+
+    TreeBenchPumpMessages();
+
+    return TRUE;
+}
+
+static VOID DeleteTreeBench(
+    _In_ PTREEBENCH_CONTEXT Context
+    )
+{
+    ULONG i;
+    ULONG j;
+
+    SelectObject(Context->Dc, Context->OldBitmap);
+    DeleteObject(Context->Bitmap);
+    DeleteDC(Context->Dc);
+    DestroyWindow(Context->ParentHandle);
+    TreeBenchPumpMessages();
+
+    for (i = 0; i < Context->NumberOfNodes; i++)
+    {
+        PTREEBENCH_NODE node = &Context->Nodes[i];
+
+        for (j = 0; j < Context->NumberOfColumns; j++)
+            PhDereferenceObject(node->Text[j]);
+
+        PhFree(node->Text);
+        PhFree(node->Node.TextCache);
+
+        if (node->Children)
+            PhDereferenceObject(node->Children);
+    }
+
+    PhDereferenceObject(Context->RootList);
+    PhFree(Context->Nodes);
+}
+
+static int __cdecl TreeBenchDoubleCompare(
+    _In_ const void *elem1,
+    _In_ const void *elem2
+    )
+{
+    return doublecmp(*(DOUBLE *)elem1, *(DOUBLE *)elem2);
+}
+
+static VOID RunTreeBenchmark(
+    _In_ PTREEBENCH_CONTEXT Context,
+    _In_ PTREEBENCH Benchmark,
+    _In_ ULONG64 Frequency
+    )
+{
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+    DOUBLE samples[TREEBENCH_SAMPLES];
+    ULONG i;
+
+    // Warm up, which also fills the text caches.
+    Context->Step = 0;
+    Benchmark->Function(Context);
+    Context->Step++;
+
+    for (i = 0; i < TREEBENCH_SAMPLES; i++)
+    {
+        NtQueryPerformanceCounter(&start, NULL);
+        Benchmark->Function(Context);
+        NtQueryPerformanceCounter(&end, NULL);
+        Context->Step++;
+
+        samples[i] = (DOUBLE)(end.QuadPart - start.QuadPart) * 1e6 / Frequency / Benchmark->OperationsPerSample;
+        TreeBenchPumpMessages();
+    }
+
+    qsort(samples, TREEBENCH_SAMPLES, sizeof(DOUBLE), TreeBenchDoubleCompare);
+
+    printf(
+        "%s,%u,%u,%.1f,%.1f\n",
+        Benchmark->Name,
+        Context->NumberOfNodes,
+        Context->NumberOfColumns,
+        samples[TREEBENCH_SAMPLES / 2],
+        samples[0]
+        );
+
+    // Put the tree back into its initial state for the next benchmark.
+
+    for (i = 0; i < Context->NumberOfNodes; i++)
+    {
+        Context->Nodes[i].Node.Visible = TRUE;
+        Context->Nodes[i].Node.Expanded = TRUE;
+    }
+
+    TreeNew_SetSort(Context->TreeNewHandle, 0, NoSortOrder);
+    TreeNew_NodesStructured(Context->TreeNewHandle);
+    TreeNew_Scroll(Context->TreeNewHandle, -(LONG)Context->NumberOfNodes, 0);
+}
+
+/**
+ * Runs the TreeNew benchmarks.
+ *
+ * \param NumberOfNodes The number of nodes to create, or 0 for the default.
+ * \param NumberOfColumns The number of columns to create, or 0 for the default.
+ */
+VOID RunTreeBenchmarks(
+    _In_ ULONG NumberOfNodes,
+    _In_ ULONG NumberOfColumns
+    )
+{
+    TREEBENCH_CONTEXT context;
+    LARGE_INTEGER frequency;
+    ULONG i;
+
+    if (NumberOfNodes == 0)
+        NumberOfNodes = TREEBENCH_DEFAULT_NODES;
+    if (NumberOfColumns == 0)
+        NumberOfColumns = TREEBENCH_DEFAULT_COLUMNS;
+    if (NumberOfColumns > TREEBENCH_MAXIMUM_COLUMNS)
+        NumberOfColumns = TREEBENCH_MAXIMUM_COLUMNS;
+
+    if (!InitializeTreeBench(&context, NumberOfNodes, NumberOfColumns))
+    {
+        printf("Unable to create the TreeNew control.\n");
+        return;
+    }
+
+    NtQueryPerformanceCounter(&frequency, &frequency);
+
+    printf("name,nodes,columns,median_us,minimum_us\n");
+
+    for (i = 0; i < sizeof(TreeBenchmarks) / sizeof(TREEBENCH); i++)
+        RunTreeBenchmark(&context, &TreeBenchmarks[i], frequency.QuadPart);
+
+    DeleteTreeBench(&context);
+}
@@ -605,8 +605,222 @@ INT_PTR CALLBACK PvpPeGeneralDlgProc(
     return FALSE;
 }
 
-VOID PvpProcessImports(
+// The imports and exports pages use owner data list views. Each row is backed by a small
+// record that points into the mapped image, and the text is only formatted when the row is
+// drawn. Sorting and incremental search work on the records directly.
+
+typedef struct _PV_IMPORT_ITEM
+{
+    ULONG Sequence;
+    BOOLEAN DelayImport;
+    USHORT OrdinalOrHint;
+    PSTR DllName;
+    PSTR Name; // NULL if imported by ordinal
+} PV_IMPORT_ITEM, *PPV_IMPORT_ITEM;
+
+typedef struct _PV_EXPORT_ITEM
+{
+    ULONG Sequence;
+    USHORT Ordinal;
+    PSTR Name; // NULL if unnamed
+} PV_EXPORT_ITEM, *PPV_EXPORT_ITEM;
+
+typedef struct _PV_SYMBOL_LIST
+{
+    PVOID Items;
+    ULONG ItemSize;
+    ULONG NumberOfItems;
+    ULONG AllocatedItems;
+
+    ULONG SortColumn;
+    PH_SORT_ORDER SortOrder;
+    int (__cdecl *CompareFunction)(void *, const void *, const void *);
+} PV_SYMBOL_LIST, *PPV_SYMBOL_LIST;
+
+static PV_SYMBOL_LIST PvpImportList;
+static PV_SYMBOL_LIST PvpExportList;
+static PH_MAPPED_IMAGE_EXPORTS PvpExports;
+
+static PVOID PvpAddSymbolListItem(
+    _Inout_ PPV_SYMBOL_LIST List
+    )
+{
+    PVOID item;
+
+    if (List->NumberOfItems == List->AllocatedItems)
+    {
+        List->AllocatedItems = List->AllocatedItems ? List->AllocatedItems * 2 : 64;
+        List->Items = PhReAllocate(List->Items, List->AllocatedItems * List->ItemSize);
+    }
+
+    item = PTR_ADD_OFFSET(List->Items, List->NumberOfItems * List->ItemSize);
+    memset(item, 0, List->ItemSize);
+    *(PULONG)item = List->NumberOfItems; // Sequence
+    List->NumberOfItems++;
+
+    return item;
+}
+
+static VOID PvpDeleteSymbolList(
+    _Inout_ PPV_SYMBOL_LIST List
+    )
+{
+    if (List->Items)
+        PhFree(List->Items);
+
+    List->Items = NULL;
+    List->NumberOfItems = 0;
+    List->AllocatedItems = 0;
+}
+
+static VOID PvpSortSymbolList(
     _In_ HWND ListViewHandle,
+    _Inout_ PPV_SYMBOL_LIST List
+    )
+{
+    if (List->NumberOfItems != 0)
+        qsort_s(List->Items, List->NumberOfItems, List->ItemSize, List->CompareFunction, List);
+
+    PhSetHeaderSortIcon(ListView_GetHeader(ListViewHandle), List->SortColumn, List->SortOrder);
+    InvalidateRect(ListViewHandle, NULL, FALSE);
+}
+
+static int PvpCompareAnsiStrings(
+    _In_opt_ PSTR String1,
+    _In_opt_ PSTR String2
+    )
+{
+    // NULL strings always sort after non-NULL ones.
+    if (String1 && String2)
+        return _stricmp(String1, String2);
+    else if (String1)
+        return -1;
+    else if (String2)
+        return 1;
+    else
+        return 0;
+}
+
+static VOID PvpCopyAnsiString(
+    _Out_writes_(Count) PWSTR Buffer,
+    _In_ ULONG Count,
+    _In_ PSTR String
+    )
+{
+    ULONG i;
+
+    if (Count == 0)
+        return;
+
+    // Names in the image are ASCII, so zero-extending is enough.
+    for (i = 0; i < Count - 1 && String[i]; i++)
+        Buffer[i] = (UCHAR)String[i];
+
+    Buffer[i] = 0;
+}
+
+static BOOLEAN PvpAnsiStringStartsWith(
+    _In_opt_ PSTR String,
+    _In_ PWSTR Prefix
+    )
+{
+    if (!String)
+        return FALSE;
+
+    for (; *Prefix; Prefix++, String++)
+    {
+        if (!*String || towlower(*Prefix) != towlower((UCHAR)*String))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+static INT PvpFindSymbolListItem(
+    _In_ PPV_SYMBOL_LIST List,
+    _In_ LPNMLVFINDITEM FindItem,
+    _In_ PSTR (*GetName)(PVOID Item)
+    )
+{
+    ULONG i;
+    ULONG start;
+
+    if (!(FindItem->lvfi.flags & (LVFI_STRING | LVFI_PARTIAL)) || List->NumberOfItems == 0)
+        return -1;
+
+    start = FindItem->iStart >= 0 ? (ULONG)FindItem->iStart % List->NumberOfItems : 0;
+
+    // Search from the starting item, wrapping around to the beginning.
+    for (i = 0; i < List->NumberOfItems; i++)
+    {
+        ULONG index = (start + i) % List->NumberOfItems;
+        PSTR name = GetName(PTR_ADD_OFFSET(List->Items, index * List->ItemSize));
+
+        if (FindItem->lvfi.flags & LVFI_PARTIAL)
+        {
+            if (PvpAnsiStringStartsWith(name, (PWSTR)FindItem->lvfi.psz))
+                return index;
+        }
+        else
+        {
+            if (name && PvpAnsiStringStartsWith(name, (PWSTR)FindItem->lvfi.psz) &&
+                strlen(name) == wcslen(FindItem->lvfi.psz))
+                return index;
+        }
+    }
+
+    return -1;
+}
+
+static int __cdecl PvpImportCompareFunction(
+    _In_ void *context,
+    _In_ const void *elem1,
+    _In_ const void *elem2
+    )
+{
+    PPV_SYMBOL_LIST list = context;
+    PPV_IMPORT_ITEM item1 = (PPV_IMPORT_ITEM)elem1;
+    PPV_IMPORT_ITEM item2 = (PPV_IMPORT_ITEM)elem2;
+    int result = 0;
+
+    switch (list->SortOrder != NoSortOrder ? list->SortColumn : -1)
+    {
+    case 0:
+        result = PvpCompareAnsiStrings(item1->DllName, item2->DllName);
+
+        if (result == 0)
+            result = intcmp(item1->DelayImport, item2->DelayImport);
+        break;
+    case 1:
+        result = PvpCompareAnsiStrings(item1->Name, item2->Name);
+
+        if (result == 0 && !item1->Name)
+            result = uintcmp(item1->OrdinalOrHint, item2->OrdinalOrHint);
+        break;
+    case 2:
+        // Only named imports have a hint.
+        result = intcmp(!item1->Name, !item2->Name);
+
+        if (result == 0 && item1->Name)
+            result = uintcmp(item1->OrdinalOrHint, item2->OrdinalOrHint);
+        break;
+    }
+
+    if (result == 0)
+        return uintcmp(item1->Sequence, item2->Sequence);
+
+    return PhModifySort(result, list->SortOrder);
+}
+
+static PSTR PvpGetImportItemName(
+    _In_ PVOID Item
+    )
+{
+    return ((PPV_IMPORT_ITEM)Item)->DllName;
+}
+
+VOID PvpProcessImports(
+    _Inout_ PPV_SYMBOL_LIST List,
     _In_ PPH_MAPPED_IMAGE_IMPORTS Imports,
     _In_ BOOLEAN DelayImports
     )
@@ -624,33 +838,13 @@ VOID PvpProcessImports(
             {
                 if (NT_SUCCESS(PhGetMappedImageImportEntry(&importDll, j, &importEntry)))
                 {
-                    INT lvItemIndex;
-                    PPH_STRING name;
-                    WCHAR number[PH_INT32_STR_LEN_1];
-
-                    if (!DelayImports)
-                        name = PhZeroExtendToUtf16(importDll.Name);
-                    else
-                        name = PhFormatString(L"%S (Delay)", importDll.Name);
-
-                    lvItemIndex = PhAddListViewItem(ListViewHandle, MAXINT, name->Buffer, NULL);
-                    PhDereferenceObject(name);
-
-                    if (importEntry.Name)
-                    {
-                        name = PhZeroExtendToUtf16(importEntry.Name);
-                        PhSetListViewSubItem(ListViewHandle, lvItemIndex, 1, name->Buffer);
-                        PhDereferenceObject(name);
+                    PPV_IMPORT_ITEM item;
 
-                        PhPrintUInt32(number, importEntry.NameHint);
-                        PhSetListViewSubItem(ListViewHandle, lvItemIndex, 2, number);
-                    }
-                    else
-                    {
-                        name = PhFormatString(L"(Ordinal %u)", importEntry.Ordinal);
-                        PhSetListViewSubItem(ListViewHandle, lvItemIndex, 1, name->Buffer);
-                        PhDereferenceObject(name);
-                    }
+                    item = PvpAddSymbolListItem(List);
+                    item->DelayImport = DelayImports;
+                    item->DllName = importDll.Name;
+                    item->Name = importEntry.Name;
+                    item->OrdinalOrHint = importEntry.Name ? importEntry.NameHint : importEntry.Ordinal;
                 }
             }
         }
@@ -668,7 +862,6 @@ INT_PTR CALLBACK PvpPeImportsDlgProc(
     {
     case WM_INITDIALOG:
         {
-            ULONG fallbackColumns[] = { 0, 1, 2 };
             HWND lvHandle;
             PH_MAPPED_IMAGE_IMPORTS imports;
 
@@ -678,25 +871,107 @@ INT_PTR CALLBACK PvpPeImportsDlgProc(
             PhAddListViewColumn(lvHandle, 0, 0, 0, LVCFMT_LEFT, 130, L"DLL");
             PhAddListViewColumn(lvHandle, 1, 1, 1, LVCFMT_LEFT, 210, L"Name");
             PhAddListViewColumn(lvHandle, 2, 2, 2, LVCFMT_LEFT, 50, L"Hint");
-            PhSetExtendedListView(lvHandle);
-            ExtendedListView_AddFallbackColumns(lvHandle, 3, fallbackColumns);
+
+            memset(&PvpImportList, 0, sizeof(PV_SYMBOL_LIST));
+            PvpImportList.ItemSize = sizeof(PV_IMPORT_ITEM);
+            PvpImportList.CompareFunction = PvpImportCompareFunction;
 
             if (NT_SUCCESS(PhGetMappedImageImports(&imports, &PvMappedImage)))
             {
-                PvpProcessImports(lvHandle, &imports, FALSE);
+                PvpProcessImports(&PvpImportList, &imports, FALSE);
             }
 
             if (NT_SUCCESS(PhGetMappedImageDelayImports(&imports, &PvMappedImage)))
             {
-                PvpProcessImports(lvHandle, &imports, TRUE);
+                PvpProcessImports(&PvpImportList, &imports, TRUE);
             }
 
-            ExtendedListView_SortItems(lvHandle);
+            ListView_SetItemCountEx(lvHandle, PvpImportList.NumberOfItems, 0);
+        }
+        break;
+    case WM_DESTROY:
+        {
+            PvpDeleteSymbolList(&PvpImportList);
         }
         break;
     case WM_NOTIFY:
         {
-            PvHandleListViewNotifyForCopy(lParam, GetDlgItem(hwndDlg, IDC_LIST));
+            LPNMHDR header = (LPNMHDR)lParam;
+            HWND lvHandle = GetDlgItem(hwndDlg, IDC_LIST);
+
+            PvHandleListViewNotifyForCopy(lParam, lvHandle);
+
+            if (header->hwndFrom != lvHandle)
+                break;
+
+            switch (header->code)
+            {
+            case LVN_GETDISPINFO:
+                {
+                    NMLVDISPINFO *dispInfo = (NMLVDISPINFO *)header;
+                    PPV_IMPORT_ITEM item;
+                    PPH_STRING string;
+
+                    if (!(dispInfo->item.mask & LVIF_TEXT) || (ULONG)dispInfo->item.iItem >= PvpImportList.NumberOfItems)
+                        break;
+
+                    item = &((PPV_IMPORT_ITEM)PvpImportList.Items)[dispInfo->item.iItem];
+
+                    switch (dispInfo->item.iSubItem)
+                    {
+                    case 0:
+                        if (!item->DelayImport)
+                        {
+                            PvpCopyAnsiString(dispInfo->item.pszText, dispInfo->item.cchTextMax, item->DllName);
+                        }
+                        else
+                        {
+                            string = PhFormatString(L"%S (Delay)", item->DllName);
+                            wcsncpy_s(dispInfo->item.pszText, dispInfo->item.cchTextMax, string->Buffer, _TRUNCATE);
+                            PhDereferenceObject(string);
+                        }
+                        break;
+                    case 1:
+                        if (item->Name)
+                        {
+                            PvpCopyAnsiString(dispInfo->item.pszText, dispInfo->item.cchTextMax, item->Name);
+                        }
+                        else
+                        {
+                            string = PhFormatString(L"(Ordinal %u)", item->OrdinalOrHint);
+                            wcsncpy_s(dispInfo->item.pszText, dispInfo->item.cchTextMax, string->Buffer, _TRUNCATE);
+                            PhDereferenceObject(string);
+                        }
+                        break;
+                    case 2:
+                        if (item->Name)
+                        {
+                            WCHAR number[PH_INT32_STR_LEN_1];
+
+                            PhPrintUInt32(number, item->OrdinalOrHint);
+                            wcsncpy_s(dispInfo->item.pszText, dispInfo->item.cchTextMax, number, _TRUNCATE);
+                        }
+                        break;
+                    }
+                }
+                break;
+            case LVN_ODFINDITEM:
+                {
+                    SetWindowLongPtr(hwndDlg, DWLP_MSGRESULT,
+                        PvpFindSymbolListItem(&PvpImportList, (LPNMLVFINDITEM)header, PvpGetImportItemName));
+                }
+                return TRUE;
+            case LVN_COLUMNCLICK:
+                {
+                    LPNMLISTVIEW listView = (LPNMLISTVIEW)header;
+
+                    PvpImportList.SortOrder = PvpImportList.SortColumn == (ULONG)listView->iSubItem ?
+                        (PvpImportList.SortOrder + 1) % 3 : AscendingSortOrder;
+                    PvpImportList.SortColumn = listView->iSubItem;
+                    PvpSortSymbolList(lvHandle, &PvpImportList);
+                }
+                break;
+            }
         }
         break;
     case WM_CTLCOLORDLG:
@@ -709,6 +984,63 @@ INT_PTR CALLBACK PvpPeImportsDlgProc(
     return FALSE;
 }
 
+static int __cdecl PvpExportCompareFunction(
+    _In_ void *context,
+    _In_ const void *elem1,
+    _In_ const void *elem2
+    )
+{
+    PPV_SYMBOL_LIST list = context;
+    PPV_EXPORT_ITEM item1 = (PPV_EXPORT_ITEM)elem1;
+    PPV_EXPORT_ITEM item2 = (PPV_EXPORT_ITEM)elem2;
+    int result = 0;
+
+    switch (list->SortOrder != NoSortOrder ? list->SortColumn : -1)
+    {
+    case 0:
+        result = PvpCompareAnsiStrings(item1->Name, item2->Name);
+        break;
+    case 1:
+        result = uintcmp(item1->Ordinal, item2->Ordinal);
+        break;
+    case 2:
+        {
+            PH_MAPPED_IMAGE_EXPORT_FUNCTION function1;
+            PH_MAPPED_IMAGE_EXPORT_FUNCTION function2;
+
+            // Sorting by address is rare, so we resolve the functions here instead of storing them.
+            if (!NT_SUCCESS(PhGetMappedImageExportFunction(&PvpExports, NULL, item1->Ordinal, &function1)))
+                memset(&function1, 0, sizeof(function1));
+            if (!NT_SUCCESS(PhGetMappedImageExportFunction(&PvpExports, NULL, item2->Ordinal, &function2)))
+                memset(&function2, 0, sizeof(function2));
+
+            // Forwarded exports sort after the ones with an address.
+            result = intcmp(!!function1.ForwardedName, !!function2.ForwardedName);
+
+            if (result == 0)
+            {
+                if (function1.ForwardedName)
+                    result = PvpCompareAnsiStrings(function1.ForwardedName, function2.ForwardedName);
+                else
+                    result = uintptrcmp((ULONG_PTR)function1.Function, (ULONG_PTR)function2.Function);
+            }
+        }
+        break;
+    }
+
+    if (result == 0)
+        return uintcmp(item1->Sequence, item2->Sequence);
+
+    return PhModifySort(result, list->SortOrder);
+}
+
+static PSTR PvpGetExportItemName(
+    _In_ PVOID Item
+    )
+{
+    return ((PPV_EXPORT_ITEM)Item)->Name;
+}
+
 INT_PTR CALLBACK PvpPeExportsDlgProc(
     _In_ HWND hwndDlg,
     _In_ UINT uMsg,
@@ -721,9 +1053,7 @@ INT_PTR CALLBACK PvpPeExportsDlgProc(
     case WM_INITDIALOG:
         {
             HWND lvHandle;
-            PH_MAPPED_IMAGE_EXPORTS exports;
             PH_MAPPED_IMAGE_EXPORT_ENTRY exportEntry;
-            PH_MAPPED_IMAGE_EXPORT_FUNCTION exportFunction;
             ULONG i;
 
             lvHandle = GetDlgItem(hwndDlg, IDC_LIST);
@@ -732,61 +1062,116 @@ INT_PTR CALLBACK PvpPeExportsDlgProc(
             PhAddListViewColumn(lvHandle, 0, 0, 0, LVCFMT_LEFT, 220, L"Name");
             PhAddListViewColumn(lvHandle, 1, 1, 1, LVCFMT_LEFT, 50, L"Ordinal");
             PhAddListViewColumn(lvHandle, 2, 2, 2, LVCFMT_LEFT, 120, L"VA");
-            PhSetExtendedListView(lvHandle);
 
-            if (NT_SUCCESS(PhGetMappedImageExports(&exports, &PvMappedImage)))
+            memset(&PvpExportList, 0, sizeof(PV_SYMBOL_LIST));
+            PvpExportList.ItemSize = sizeof(PV_EXPORT_ITEM);
+            PvpExportList.CompareFunction = PvpExportCompareFunction;
+
+            if (NT_SUCCESS(PhGetMappedImageExports(&PvpExports, &PvMappedImage)))
             {
-                for (i = 0; i < exports.NumberOfEntries; i++)
+                for (i = 0; i < PvpExports.NumberOfEntries; i++)
                 {
-                    if (
-                        NT_SUCCESS(PhGetMappedImageExportEntry(&exports, i, &exportEntry)) &&
-                        NT_SUCCESS(PhGetMappedImageExportFunction(&exports, NULL, exportEntry.Ordinal, &exportFunction))
-                        )
+                    if (NT_SUCCESS(PhGetMappedImageExportEntry(&PvpExports, i, &exportEntry)))
                     {
-                        INT lvItemIndex;
-                        PPH_STRING name;
-                        WCHAR number[PH_INT32_STR_LEN_1];
-                        WCHAR pointer[PH_PTR_STR_LEN_1];
+                        PPV_EXPORT_ITEM item;
 
-                        if (exportEntry.Name)
-                        {
-                            name = PhZeroExtendToUtf16(exportEntry.Name);
-                            lvItemIndex = PhAddListViewItem(lvHandle, MAXINT, name->Buffer, NULL);
-                            PhDereferenceObject(name);
-                        }
-                        else
-                        {
-                            lvItemIndex = PhAddListViewItem(lvHandle, MAXINT, L"(unnamed)", NULL);
-                        }
+                        item = PvpAddSymbolListItem(&PvpExportList);
+                        item->Ordinal = exportEntry.Ordinal;
+                        item->Name = exportEntry.Name;
+                    }
+                }
+            }
+
+            ListView_SetItemCountEx(lvHandle, PvpExportList.NumberOfItems, 0);
+        }
+        break;
+    case WM_DESTROY:
+        {
+            PvpDeleteSymbolList(&PvpExportList);
+        }
+        break;
+    case WM_NOTIFY:
+        {
+            LPNMHDR header = (LPNMHDR)lParam;
+            HWND lvHandle = GetDlgItem(hwndDlg, IDC_LIST);
+
+            PvHandleListViewNotifyForCopy(lParam, lvHandle);
+
+            if (header->hwndFrom != lvHandle)
+                break;
+
+            switch (header->code)
+            {
+            case LVN_GETDISPINFO:
+                {
+                    NMLVDISPINFO *dispInfo = (NMLVDISPINFO *)header;
+                    PPV_EXPORT_ITEM item;
+
+                    if (!(dispInfo->item.mask & LVIF_TEXT) || (ULONG)dispInfo->item.iItem >= PvpExportList.NumberOfItems)
+                        break;
 
-                        PhPrintUInt32(number, exportEntry.Ordinal);
-                        PhSetListViewSubItem(lvHandle, lvItemIndex, 1, number);
+                    item = &((PPV_EXPORT_ITEM)PvpExportList.Items)[dispInfo->item.iItem];
 
-                        if (!exportFunction.ForwardedName)
+                    switch (dispInfo->item.iSubItem)
+                    {
+                    case 0:
+                        if (item->Name)
+                            PvpCopyAnsiString(dispInfo->item.pszText, dispInfo->item.cchTextMax, item->Name);
+                        else
+                            wcsncpy_s(dispInfo->item.pszText, dispInfo->item.cchTextMax, L"(unnamed)", _TRUNCATE);
+                        break;
+                    case 1:
                         {
-                            if ((ULONG_PTR)exportFunction.Function >= (ULONG_PTR)PvMappedImage.ViewBase)
-                                PhPrintPointer(pointer, PTR_SUB_OFFSET(exportFunction.Function, PvMappedImage.ViewBase));
-                            else
-                                PhPrintPointer(pointer, exportFunction.Function);
+                            WCHAR number[PH_INT32_STR_LEN_1];
 
-                            PhSetListViewSubItem(lvHandle, lvItemIndex, 2, pointer);
+                            PhPrintUInt32(number, item->Ordinal);
+                            wcsncpy_s(dispInfo->item.pszText, dispInfo->item.cchTextMax, number, _TRUNCATE);
                         }
-                        else
+                        break;
+                    case 2:
                         {
-                            name = PhZeroExtendToUtf16(exportFunction.ForwardedName);
-                            PhSetListViewSubItem(lvHandle, lvItemIndex, 2, name->Buffer);
-                            PhDereferenceObject(name);
+                            PH_MAPPED_IMAGE_EXPORT_FUNCTION exportFunction;
+
+                            if (!NT_SUCCESS(PhGetMappedImageExportFunction(&PvpExports, NULL, item->Ordinal, &exportFunction)))
+                                break;
+
+                            if (!exportFunction.ForwardedName)
+                            {
+                                WCHAR pointer[PH_PTR_STR_LEN_1];
+
+                                if ((ULONG_PTR)exportFunction.Function >= (ULONG_PTR)PvMappedImage.ViewBase)
+                                    PhPrintPointer(pointer, PTR_SUB_OFFSET(exportFunction.Function, PvMappedImage.ViewBase));
+                                else
+                                    PhPrintPointer(pointer, exportFunction.Function);
+
+                                wcsncpy_s(dispInfo->item.pszText, dispInfo->item.cchTextMax, pointer, _TRUNCATE);
+                            }
+                            else
+                            {
+                                PvpCopyAnsiString(dispInfo->item.pszText, dispInfo->item.cchTextMax, exportFunction.ForwardedName);
+                            }
                         }
+                        break;
                     }
                 }
-            }
+                break;
+            case LVN_ODFINDITEM:
+                {
+                    SetWindowLongPtr(hwndDlg, DWLP_MSGRESULT,
+                        PvpFindSymbolListItem(&PvpExportList, (LPNMLVFINDITEM)header, PvpGetExportItemName));
+                }
+                return TRUE;
+            case LVN_COLUMNCLICK:
+                {
+                    LPNMLISTVIEW listView = (LPNMLISTVIEW)header;
 
-            ExtendedListView_SortItems(lvHandle);
-        }
-        break;
-    case WM_NOTIFY:
-        {
-            PvHandleListViewNotifyForCopy(lParam, GetDlgItem(hwndDlg, IDC_LIST));
+                    PvpExportList.SortOrder = PvpExportList.SortColumn == (ULONG)listView->iSubItem ?
+                        (PvpExportList.SortOrder + 1) % 3 : AscendingSortOrder;
+                    PvpExportList.SortColumn = listView->iSubItem;
+                    PvpSortSymbolList(lvHandle, &PvpExportList);
+                }
+                break;
+            }
         }
         break;
     case WM_CTLCOLORDLG: